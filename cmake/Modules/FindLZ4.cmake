@@ -0,0 +1,26 @@
+# Find LZ4 headers and libraries.
+#
+#  LZ4_INCLUDE_DIRS - where to find LZ4 includes.
+#  LZ4_LIBRARIES    - List of libraries when using LZ4.
+#  LZ4_FOUND        - True if LZ4 found.
+
+# Look for the header file.
+FIND_PATH( LZ4_INCLUDE_DIR NAMES lz4.h)
+
+# Look for the library.
+FIND_LIBRARY( LZ4_LIBRARY NAMES lz4 liblz4)
+
+# handle the QUIETLY and REQUIRED arguments and set LZ4_FOUND to TRUE if all listed variables are TRUE
+INCLUDE( FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS( LZ4 DEFAULT_MSG LZ4_LIBRARY LZ4_INCLUDE_DIR)
+
+# Copy the results to the output variables.
+IF( LZ4_FOUND)
+  SET( LZ4_LIBRARIES ${LZ4_LIBRARY})
+  SET( LZ4_INCLUDE_DIRS ${LZ4_INCLUDE_DIR})
+ELSE()
+  SET( LZ4_LIBRARIES)
+  SET( LZ4_INCLUDE_DIRS)
+ENDIF()
+
+MARK_AS_ADVANCED( LZ4_INCLUDE_DIR LZ4_LIBRARY)
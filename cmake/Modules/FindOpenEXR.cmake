@@ -0,0 +1,37 @@
+# - Find OpenEXR
+# Find OpenEXR headers and libraries.
+#
+#  OPENEXR_INCLUDE_DIRS - where to find OpenEXR includes.
+#  OPENEXR_LIBRARIES    - List of libraries when using OpenEXR.
+#  OPENEXR_FOUND        - True if OpenEXR found.
+
+# Look for the header file. Deep images require OpenEXR 2.
+FIND_PATH( OPENEXR_INCLUDE_DIR NAMES OpenEXR/ImfDeepScanLineOutputFile.h)
+
+# Look for the libraries.
+FIND_LIBRARY( OPENEXR_ILMIMF_LIBRARY NAMES IlmImf)
+FIND_LIBRARY( OPENEXR_ILMTHREAD_LIBRARY NAMES IlmThread)
+
+# handle the QUIETLY and REQUIRED arguments and set OPENEXR_FOUND to TRUE if
+# all listed variables are TRUE
+INCLUDE( FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS( OPENEXR DEFAULT_MSG  OPENEXR_ILMIMF_LIBRARY
+                                                        OPENEXR_ILMTHREAD_LIBRARY
+                                                        OPENEXR_INCLUDE_DIR
+                                                        )
+# Copy the results to the output variables.
+IF( OPENEXR_FOUND)
+    SET( OPENEXR_LIBRARIES ${OPENEXR_ILMIMF_LIBRARY}
+                           ${OPENEXR_ILMTHREAD_LIBRARY}
+                           )
+
+    SET( OPENEXR_INCLUDE_DIRS ${OPENEXR_INCLUDE_DIR})
+ELSE()
+    SET( OPENEXR_LIBRARIES)
+    SET( OPENEXR_INCLUDE_DIRS)
+ENDIF()
+
+MARK_AS_ADVANCED(   OPENEXR_ILMIMF_LIBRARY
+                    OPENEXR_ILMTHREAD_LIBRARY
+                    OPENEXR_INCLUDE_DIR
+                    )
@@ -0,0 +1,27 @@
+# Find OpenVDB headers and libraries.
+#
+#  OPENVDB_INCLUDE_DIRS - where to find OpenVDB includes.
+#  OPENVDB_LIBRARIES    - List of libraries when using OpenVDB.
+#  OPENVDB_FOUND        - True if OpenVDB found.
+
+# Look for the header file.
+FIND_PATH( OPENVDB_INCLUDE_DIR NAMES openvdb/openvdb.h)
+
+# Look for the libraries. OpenVDB depends on TBB.
+FIND_LIBRARY( OPENVDB_LIBRARY NAMES openvdb)
+FIND_LIBRARY( OPENVDB_TBB_LIBRARY NAMES tbb)
+
+# handle the QUIETLY and REQUIRED arguments and set OPENVDB_FOUND to TRUE if all listed variables are TRUE
+INCLUDE( FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS( OPENVDB DEFAULT_MSG OPENVDB_LIBRARY OPENVDB_TBB_LIBRARY OPENVDB_INCLUDE_DIR)
+
+# Copy the results to the output variables.
+IF( OPENVDB_FOUND)
+  SET( OPENVDB_LIBRARIES ${OPENVDB_LIBRARY} ${OPENVDB_TBB_LIBRARY})
+  SET( OPENVDB_INCLUDE_DIRS ${OPENVDB_INCLUDE_DIR})
+ELSE()
+  SET( OPENVDB_LIBRARIES)
+  SET( OPENVDB_INCLUDE_DIRS)
+ENDIF()
+
+MARK_AS_ADVANCED( OPENVDB_INCLUDE_DIR OPENVDB_LIBRARY OPENVDB_TBB_LIBRARY)
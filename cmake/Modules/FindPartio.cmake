@@ -0,0 +1,27 @@
+# Find Partio headers and libraries.
+#
+#  PARTIO_INCLUDE_DIRS - where to find Partio includes.
+#  PARTIO_LIBRARIES    - List of libraries when using Partio.
+#  PARTIO_FOUND        - True if Partio found.
+
+# Look for the header file.
+FIND_PATH( PARTIO_INCLUDE_DIR NAMES Partio.h)
+
+# Look for the libraries. Partio depends on zlib for compressed formats.
+FIND_LIBRARY( PARTIO_LIBRARY NAMES partio)
+FIND_LIBRARY( PARTIO_ZLIB_LIBRARY NAMES z zlib)
+
+# handle the QUIETLY and REQUIRED arguments and set PARTIO_FOUND to TRUE if all listed variables are TRUE
+INCLUDE( FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS( PARTIO DEFAULT_MSG PARTIO_LIBRARY PARTIO_ZLIB_LIBRARY PARTIO_INCLUDE_DIR)
+
+# Copy the results to the output variables.
+IF( PARTIO_FOUND)
+  SET( PARTIO_LIBRARIES ${PARTIO_LIBRARY} ${PARTIO_ZLIB_LIBRARY})
+  SET( PARTIO_INCLUDE_DIRS ${PARTIO_INCLUDE_DIR})
+ELSE()
+  SET( PARTIO_LIBRARIES)
+  SET( PARTIO_INCLUDE_DIRS)
+ENDIF()
+
+MARK_AS_ADVANCED( PARTIO_INCLUDE_DIR PARTIO_LIBRARY PARTIO_ZLIB_LIBRARY)
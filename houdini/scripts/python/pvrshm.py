@@ -0,0 +1,183 @@
+# ------------------------------------------------------------------------------
+# pvrshm.py
+# ------------------------------------------------------------------------------
+
+"""Hands Houdini geometry to PVR through POSIX shared memory, so that a PVR
+script can pick it up with pvr.Geometry.readShared() instead of reading a
+.bgeo back from disk.
+
+The segment uses the layout of PVR's geometry cache (see writeCache() in
+libpvr/src/Geometry.cpp): each attribute is one contiguous, 64 byte aligned
+column, so PVR reads it without parsing individual points. Only points and
+detail attributes are written. Float attributes of size 3 become vector
+attributes, like P and v in a .bgeo.
+
+The module doesn't depend on PVR itself. It writes to /dev/shm, which is
+where shm_open() keeps its segments on Linux.
+
+Example, in a Python SOP or shelf tool:
+
+  import pvrshm
+  pvrshm.write(hou.pwd().geometry(), "/pvr_lookdev")
+
+and then in the PVR script:
+
+  geo = pvr.Geometry.readShared("/pvr_lookdev")
+"""
+
+import os
+import struct
+
+import hou
+
+# ------------------------------------------------------------------------------
+# Constants, which must match the ones in Geometry.cpp
+# ------------------------------------------------------------------------------
+
+_magic = "PVRGEOC\0"
+_version = 1
+_alignment = 64
+
+_tableGlobals = 0
+_tableParticles = 1
+
+_typeInt = 0
+_typeFloat = 1
+_typeVector = 2
+_typeString = 3
+
+# ------------------------------------------------------------------------------
+
+class _Writer(object):
+    """Accumulates the segment in memory, tracking offsets for alignment."""
+    def __init__(self):
+        self.chunks = []
+        self.pos = 0
+    def write(self, data):
+        self.chunks.append(data)
+        self.pos += len(data)
+    def pod(self, fmt, value):
+        self.write(struct.pack("=" + fmt, value))
+    def string(self, s):
+        self.pod("Q", len(s))
+        self.write(s)
+    def column(self, data):
+        self.pod("Q", len(data))
+        self.write("\0" * ((_alignment - self.pos % _alignment) % _alignment))
+        self.write(data)
+    def data(self):
+        return "".join(self.chunks)
+
+# ------------------------------------------------------------------------------
+
+def _attrType(attrib):
+    dataType = attrib.dataType()
+    if dataType == hou.attribData.Int:
+        return _typeInt
+    if dataType == hou.attribData.String:
+        return _typeString
+    if attrib.size() == 3:
+        return _typeVector
+    return _typeFloat
+
+# ------------------------------------------------------------------------------
+
+def _writeStrings(w, values):
+    table = {}
+    strings = []
+    indices = []
+    for value in values:
+        if value not in table:
+            table[value] = len(strings)
+            strings.append(value)
+        indices.append(table[value])
+    w.pod("Q", len(strings))
+    for s in strings:
+        w.string(s)
+    w.column(struct.pack("=%dQ" % len(indices), *indices))
+
+# ------------------------------------------------------------------------------
+
+def _writePoints(w, geo, attribs):
+    w.pod("I", _tableParticles)
+    w.pod("Q", len(geo.iterPoints()))
+    w.pod("Q", len(attribs) + 1)
+    # Positions aren't part of pointAttribs()
+    w.pod("I", _typeVector)
+    w.pod("I", 1)
+    w.string("P")
+    w.column(geo.pointFloatAttribValuesAsString("P"))
+    for attrib in attribs:
+        attrType = _attrType(attrib)
+        w.pod("I", attrType)
+        w.pod("I", 1 if attrType in (_typeVector, _typeString) else
+              attrib.size())
+        w.string(attrib.name())
+        if attrType == _typeInt:
+            w.column(geo.pointIntAttribValuesAsString(attrib.name()))
+        elif attrType == _typeString:
+            _writeStrings(w, geo.pointStringAttribValues(attrib.name()))
+        else:
+            w.column(geo.pointFloatAttribValuesAsString(attrib.name()))
+
+# ------------------------------------------------------------------------------
+
+def _writeGlobals(w, geo, attribs):
+    w.pod("I", _tableGlobals)
+    w.pod("Q", 1)
+    w.pod("Q", len(attribs))
+    for attrib in attribs:
+        attrType = _attrType(attrib)
+        value = geo.attribValue(attrib.name())
+        if not isinstance(value, tuple):
+            value = (value,)
+        w.pod("I", attrType)
+        w.pod("I", 1 if attrType in (_typeVector, _typeString) else
+              attrib.size())
+        w.string(attrib.name())
+        if attrType == _typeInt:
+            w.column(struct.pack("=%di" % len(value), *value))
+        elif attrType == _typeString:
+            _writeStrings(w, value[:1])
+        else:
+            w.column(struct.pack("=%df" % len(value), *value))
+
+# ------------------------------------------------------------------------------
+
+def _path(name):
+    return os.path.join("/dev/shm", name.lstrip("/"))
+
+# ------------------------------------------------------------------------------
+
+def write(geo, name, attrNames = None):
+    """Writes the points and detail attributes of a hou.Geometry to the 
+    shared memory segment with the given name, replacing any previous
+    contents. If attrNames is given, only those point attributes are written
+    along with P. String attributes must have size 1."""
+    attribs = [a for a in geo.pointAttribs() if a.name() != "P" and 
+               (attrNames is None or a.name() in attrNames)]
+    w = _Writer()
+    w.write(_magic)
+    w.pod("I", _version)
+    w.pod("I", 2)
+    _writeGlobals(w, geo, list(geo.globalAttribs()))
+    _writePoints(w, geo, attribs)
+    # Write to a temporary segment and rename it, so that a reader never
+    # attaches to a half written one
+    path = _path(name)
+    tmpPath = path + ".tmp%d" % os.getpid()
+    f = open(tmpPath, "wb")
+    try:
+        f.write(w.data())
+    finally:
+        f.close()
+    os.rename(tmpPath, path)
+
+# ------------------------------------------------------------------------------
+
+def remove(name):
+    """Removes the shared memory segment with the given name, if any."""
+    if os.path.exists(_path(name)):
+        os.remove(_path(name))
+
+# ------------------------------------------------------------------------------
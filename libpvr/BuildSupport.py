@@ -89,7 +89,7 @@ systemPyLibPaths = {
 
 systemLibs = {
     darwin : [],
-    linux2 : ["dl"]
+    linux2 : ["dl", "rt"]
     }
 
 # ------------------------------------------------------------------------------
@@ -203,6 +203,7 @@ def setupEnv(env, pathToRoot = "."):
         env.Append(LIBS = ["SpiHalf"])
         env.Append(LIBS = ["SpiIex"])
         env.Append(LIBS = ["SpiImath"])
+        env.Append(LIBS = ["SpiIlmImf"])
         # OIIO
         addSpComp2(env, "OpenImageIO")
         env.Append(CPPDEFINES = {"OPENIMAGEIO_NAMESPACE": "SPI_OpenImageIO_v28"})
@@ -215,6 +216,7 @@ def setupEnv(env, pathToRoot = "."):
         env.Append(LIBS = ["Half"])
         env.Append(LIBS = ["Iex"])
         env.Append(LIBS = ["Imath"])
+        env.Append(LIBS = ["IlmImf"])
         env.Append(LIBS = ["boost_thread-mt"])
     env.Append(LIBS = ["OpenImageIO"])
     env.Append(LIBS = ["Field3D"])
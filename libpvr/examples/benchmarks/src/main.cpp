@@ -0,0 +1,238 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/* Micro-benchmarks for the hot paths of rendering and modeling.
+ * 
+ * Prints the results as JSON to stdout, for scenes/benchmarks.py to merge
+ * with the scene timings and compare against the stored baseline.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <OpenEXR/ImathRandom.h>
+
+#include <Field3D/FieldInterp.h>
+
+#include <pvr/Acceleration.h>
+#include <pvr/Curve.h>
+#include <pvr/DeepImage.h>
+#include <pvr/Log.h>
+#include <pvr/Noise/Noise.h>
+#include <pvr/Types.h>
+#include <pvr/VoxelBuffer.h>
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace pvr;
+
+//----------------------------------------------------------------------------//
+// Helpers
+//----------------------------------------------------------------------------//
+
+//! Number of operations per benchmark
+const size_t k_numOps = 4000000;
+
+//! Accumulates benchmark outputs, so the compiler can't remove the work
+float g_sink = 0.0f;
+
+struct Result
+{
+  Result(const string &n, const size_t o, const float s)
+    : name(n), ops(o), seconds(s)
+  { }
+  string name;
+  size_t ops;
+  float  seconds;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Pre-generates random points so that the RNG isn't part of the timing
+vector<Vector> randomPoints(const size_t count, const double scale)
+{
+  Imath::Rand48 rng(1);
+  vector<Vector> points(count);
+  for (size_t i = 0; i < count; ++i) {
+    points[i] = Vector(rng.nextf(), rng.nextf(), rng.nextf()) * scale;
+  }
+  return points;
+}
+
+//----------------------------------------------------------------------------//
+// Benchmarks
+//----------------------------------------------------------------------------//
+
+Result benchCurveInterpolate()
+{
+  Util::ColorCurve curve;
+  for (int i = 0; i < 256; ++i) {
+    curve.addSample(i / 255.0f, Color(i / 255.0f));
+  }
+  Imath::Rand48 rng(1);
+  vector<float> ts(4096);
+  for (size_t i = 0; i < ts.size(); ++i) {
+    ts[i] = rng.nextf();
+  }
+  Util::Timer timer;
+  for (size_t i = 0; i < k_numOps; ++i) {
+    g_sink += curve.interpolate(ts[i % ts.size()]).x;
+  }
+  return Result("curve_interpolate", k_numOps, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+Result benchPerlinEval()
+{
+  Noise::PerlinNoise noise;
+  const vector<Vector> points = randomPoints(4096, 100.0);
+  Util::Timer timer;
+  for (size_t i = 0; i < k_numOps; ++i) {
+    const Vector &p = points[i % points.size()];
+    g_sink += noise.eval(p.x, p.y, p.z);
+  }
+  return Result("perlin_eval", k_numOps, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+Result benchPerlinEvalBatch()
+{
+  Noise::PerlinNoise noise;
+  const vector<Vector> points = randomPoints(4096, 100.0);
+  const vector<Imath::V3f> fPoints(points.begin(), points.end());
+  vector<float> values(fPoints.size());
+  size_t ops = 0;
+  Util::Timer timer;
+  for (; ops < k_numOps; ops += fPoints.size()) {
+    noise.evalBatch(&fPoints[0], &values[0], fPoints.size());
+    g_sink += values[ops % values.size()];
+  }
+  return Result("perlin_eval_batch", ops, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+Result benchLinearInterp()
+{
+  DenseBuffer buffer;
+  buffer.setSize(Imath::V3i(128));
+  Imath::Rand48 rng(1);
+  for (DenseBuffer::iterator i = buffer.begin(); i != buffer.end(); ++i) {
+    *i = Imath::V3f(rng.nextf());
+  }
+  Field3D::LinearFieldInterp<Imath::V3f> interp;
+  const vector<Vector> points = randomPoints(4096, 128.0);
+  Util::Timer timer;
+  for (size_t i = 0; i < k_numOps; ++i) {
+    g_sink += interp.sample(buffer, points[i % points.size()]).x;
+  }
+  return Result("linear_interp_sample", k_numOps, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+Result benchUniformGridGet()
+{
+  Accel::UniformGrid<int> grid;
+  grid.clear(1.0f, 32, Vector(0.0));
+  const vector<Vector> points = randomPoints(4096, 32.0);
+  for (size_t i = 0; i < 1000; ++i) {
+    grid.addPoint(points[i], 0.5f, static_cast<int>(i));
+  }
+  grid.build();
+  Util::Timer timer;
+  for (size_t i = 0; i < k_numOps; ++i) {
+    g_sink += grid.get(points[i % points.size()]).size();
+  }
+  return Result("uniform_grid_get", k_numOps, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+Result benchDeepImageLerp()
+{
+  const size_t res = 64;
+  Render::DeepImage::Ptr image = Render::DeepImage::create();
+  image->setSize(res, res);
+  for (size_t y = 0; y < res; ++y) {
+    for (size_t x = 0; x < res; ++x) {
+      Util::ColorCurve::Ptr func(new Util::ColorCurve);
+      for (int i = 0; i < 32; ++i) {
+        func->addSample(i / 31.0f, Color(1.0f - i / 31.0f));
+      }
+      image->setPixel(x, y, func);
+    }
+  }
+  const vector<Vector> points = randomPoints(4096, 1.0);
+  Util::Timer timer;
+  for (size_t i = 0; i < k_numOps; ++i) {
+    const Vector &p = points[i % points.size()];
+    g_sink += image->lerp(p.x * res, p.y * res, p.z).x;
+  }
+  return Result("deep_image_lerp", k_numOps, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+Result benchDeepImageLerpInterleaved()
+{
+  const size_t res = 64;
+  Render::DeepImage::Ptr image = Render::DeepImage::create();
+  image->setSize(res, res);
+  for (size_t y = 0; y < res; ++y) {
+    for (size_t x = 0; x < res; ++x) {
+      Util::ColorCurve::Ptr func(new Util::ColorCurve);
+      for (int i = 0; i < 32; ++i) {
+        func->addSample(i / 31.0f, Color(1.0f - i / 31.0f));
+      }
+      image->setPixel(x, y, func);
+    }
+  }
+  image->interleave(32);
+  const vector<Vector> points = randomPoints(4096, 1.0);
+  Util::Timer timer;
+  for (size_t i = 0; i < k_numOps; ++i) {
+    const Vector &p = points[i % points.size()];
+    g_sink += image->lerpInterleaved(p.x * res, p.y * res, p.z).x;
+  }
+  return Result("deep_image_lerp_interleaved", k_numOps, timer.elapsed());
+}
+
+//----------------------------------------------------------------------------//
+
+int main()
+{
+  vector<Result> results;
+  results.push_back(benchCurveInterpolate());
+  results.push_back(benchPerlinEval());
+  results.push_back(benchPerlinEvalBatch());
+  results.push_back(benchLinearInterp());
+  results.push_back(benchUniformGridGet());
+  results.push_back(benchDeepImageLerp());
+  results.push_back(benchDeepImageLerpInterleaved());
+
+  cout << "{" << endl;
+  for (size_t i = 0, size = results.size(); i < size; ++i) {
+    const Result &r = results[i];
+    const double ns = r.seconds * 1e9 / r.ops;
+    cout << "  \"" << r.name << "\": { "
+         << "\"ns_per_op\": " << ns << ", "
+         << "\"ops_per_sec\": " << (ns > 0.0 ? 1e9 / ns : 0.0) << " }"
+         << (i + 1 < size ? "," : "") << endl;
+  }
+  cout << "}" << endl;
+
+  // Keep the sink alive
+  cerr << "checksum: " << g_sink << endl;
+}
+
+//----------------------------------------------------------------------------//
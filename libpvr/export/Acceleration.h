@@ -34,15 +34,19 @@
 
 // System headers
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
 #include <vector>
 
 // Library headers
 
-#include <Field3D/DenseField.h>
-
 // Project headers
 
 #include "pvr/Math.h"
+#include "pvr/Memory.h"
 #include "pvr/Strings.h"
 #include "pvr/Types.h"
 
@@ -57,6 +61,23 @@ namespace Accel {
 // UniformGrid
 //----------------------------------------------------------------------------//
 
+/*! \class UniformGrid
+  A uniform grid that maps points in space to the values whose primitives
+  overlap the enclosing cell.
+
+  Values are first added with addPoint()/addLine(), which only visit the 
+  cells inside each primitive's bounds. build() then packs all cell lists
+  into a single flat array (compressed sparse row layout), so that get() 
+  returns a contiguous range without any per-cell allocations.
+
+  Only occupied cells are stored, and get() finds them in an open 
+  addressing hash table. Memory therefore follows the number of values 
+  added rather than the resolution, so a long, thin curve can use cells as
+  small as its radius.
+ */
+
+//----------------------------------------------------------------------------//
+
 template <class T>
 class UniformGrid
 {
@@ -65,7 +86,30 @@ public:
   // Typedefs ------------------------------------------------------------------
 
   typedef std::vector<T> HashVec;
-  typedef Field3D::DenseField<HashVec> HashGrid;
+
+  // Range ---------------------------------------------------------------------
+
+  //! Contiguous range of values stored in a single cell
+  struct Range
+  {
+    typedef const T* const_iterator;
+    Range()
+      : m_begin(NULL), m_end(NULL)
+    { }
+    Range(const T *begin, const T *end)
+      : m_begin(begin), m_end(end)
+    { }
+    const_iterator begin() const
+    { return m_begin; }
+    const_iterator end() const
+    { return m_end; }
+    size_t size() const
+    { return m_end - m_begin; }
+    bool empty() const
+    { return m_begin == m_end; }
+  private:
+    const T *m_begin, *m_end;
+  };
 
   // Ctors ---------------------------------------------------------------------
 
@@ -74,22 +118,57 @@ public:
 
   // Main methods --------------------------------------------------------------
 
-  //! Resets the 
+  //! Resets the grid to the given domain and removes all values.
   void clear(const float cellSize, const size_t res, const pvr::Vector origin);
-  //! Returns the vector of hits given a point in space
-  const HashVec& get(const pvr::Vector &p) const;
+  //! Returns the values in the cell containing the given point. 
+  //! \note Only values added before the last call to build() are visible.
+  Range get(const pvr::Vector &p) const;
   //! Adds a point (with radius) to the grid. 
   void addPoint(pvr::Vector p, const float radius, const T value);
   //! Adds a line with radius to the grid
   void addLine(pvr::Vector p0, pvr::Vector p1, const float radius,
                const T value);
+  //! Packs all added values into the flat lookup arrays. Must be called
+  //! after adding values and before calling get().
+  void build();
   
 private:
 
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::pair<size_t, T> CellEntry;
+
+  // Structs -------------------------------------------------------------------
+
+  //! Orders entries by cell index only
+  struct CompareCell
+  {
+    bool operator () (const CellEntry &a, const CellEntry &b) const
+    { return a.first < b.first; }
+  };
+
   // Utility methods -----------------------------------------------------------
 
   //! Computes an integer 3D coordinate given a point in space.
   Imath::V3i hash(pvr::Vector p) const;
+  //! Computes the linear index of a cell
+  size_t cellIndex(const int x, const int y, const int z) const
+  { return (static_cast<size_t>(z) * m_size + y) * m_size + x; }
+  //! Whether the cell lies on the boundary of the grid. Since hash() clamps
+  //! to the grid, boundary cells also cover all space outside the grid.
+  bool isBoundary(const int x, const int y, const int z) const;
+  //! Scrambles the bits of a cell index, so that neighboring cells spread
+  //! over the hash table
+  static size_t mix(size_t cell)
+  {
+    cell ^= cell >> 16;
+    cell *= 0x45d9f3b;
+    cell ^= cell >> 16;
+    return cell;
+  }
+  //! Returns the position of a cell in m_cells, or m_cells.size() if the 
+  //! cell holds no values
+  size_t findCell(const size_t cell) const;
 
   // Data members --------------------------------------------------------------
 
@@ -100,8 +179,213 @@ private:
   //! Origin (lower left corner) of hash
   pvr::Vector m_origin;
 
-  //! 3D Array of vector<T>
-  HashGrid m_hash;
+  //! All values added, tagged with their cell index
+  std::vector<CellEntry> m_entries;
+  //! Indices of the occupied cells, in increasing order
+  std::vector<size_t> m_cells;
+  //! Offset into m_values for each occupied cell. The values of m_cells[i]
+  //! are m_values[m_offsets[i]] to m_values[m_offsets[i + 1]].
+  std::vector<size_t> m_offsets;
+  //! Values of all cells, stored contiguously in cell order
+  std::vector<T> m_values;
+  //! Hash table of positions in m_cells. Empty slots hold m_cells.size().
+  //! The size is a power of two, at least twice the number of cells.
+  std::vector<size_t> m_table;
+  //! Accounts for the memory used by the above
+  pvr::Sys::Memory::Tracker m_memory;
+
+};
+
+//----------------------------------------------------------------------------//
+// CapsuleBVH
+//----------------------------------------------------------------------------//
+
+/*! \class CapsuleBVH
+  A bounding volume hierarchy over capsules, i.e. line segments with a 
+  radius that varies linearly from one end point to the other.
+
+  The tree is built using the binned surface area heuristic and stored as a
+  flat, depth-first array of nodes. Unlike UniformGrid it adapts to 
+  segments whose radii differ by orders of magnitude.
+
+  Each capsule also has a 'reach', which is the largest distance from its
+  axis at which it may contribute (e.g. radius plus displacement). 
+  closest() only considers capsules within reach of the query point.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+class CapsuleBVH
+{
+public:
+
+  // Ctors ---------------------------------------------------------------------
+
+  CapsuleBVH()
+    : m_memory(pvr::Sys::Memory::Acceleration)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Removes all capsules and nodes
+  void clear();
+  //! Adds a capsule to the BVH. 
+  void addCapsule(const pvr::Vector &p0, const pvr::Vector &p1, 
+                  const float r0, const float r1, const float reach, 
+                  const T value);
+  //! Builds the tree. Must be called after adding capsules and before 
+  //! calling closest().
+  void build();
+  //! Finds the capsule with the smallest radius-normalized distance to p, 
+  //! among those whose reach plus slack extends to p.
+  //! \returns Whether a capsule was found.
+  bool closest(const pvr::Vector &p, const double slack, 
+               T &value, double &relDist) const;
+  //! Number of capsules
+  size_t size() const
+  { return m_capsules.size(); }
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Capsule
+  {
+    pvr::Vector p0, p1;
+    float       r0, r1, reach;
+    T           value;
+  };
+
+  //! Single node in the flattened tree. Interior nodes store their left 
+  //! child directly after themselves, and the right child at 'offset'.
+  //! Leaf nodes store their capsules at m_order[offset, offset + count).
+  struct Node
+  {
+    //! Bounds of the capsule axes
+    pvr::BBox axisBounds;
+    //! Largest radius in subtree
+    float     maxRadius;
+    //! Largest reach in subtree
+    float     maxReach;
+    //! Right child index or first capsule index
+    size_t    offset;
+    //! Number of capsules. Zero for interior nodes
+    size_t    count;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Recursively builds the subtree for m_order[first, last)
+  void buildRecursive(const size_t first, const size_t last, 
+                      const size_t depth);
+  //! Distance from a point to a box. Zero if inside.
+  static double distance(const pvr::Vector &p, const pvr::BBox &box);
+  //! Surface area of a box, inflated by the given amount
+  static double area(const pvr::BBox &box, const double inflate);
+  //! Computes the axis bounds of a capsule
+  pvr::BBox capsuleBounds(const size_t i) const;
+
+  // Data members --------------------------------------------------------------
+
+  //! Capsules, in insertion order
+  std::vector<Capsule> m_capsules;
+  //! Capsule indices, ordered by leaf
+  std::vector<size_t>  m_order;
+  //! Flattened nodes. m_nodes[0] is the root
+  std::vector<Node>    m_nodes;
+  //! Accounts for the memory used by the above
+  pvr::Sys::Memory::Tracker m_memory;
+
+};
+
+//----------------------------------------------------------------------------//
+// BoundsBVH
+//----------------------------------------------------------------------------//
+
+/*! \class BoundsBVH
+  A bounding volume hierarchy over axis-aligned boxes, each tagged with a 
+  value. Used to find the boxes a ray passes through without testing each 
+  of them.
+
+  The tree is built by median splits along the largest axis of the box 
+  centroids and stored as a flat, depth-first array of nodes.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+class BoundsBVH
+{
+public:
+
+  // Ctors ---------------------------------------------------------------------
+
+  BoundsBVH()
+    : m_memory(pvr::Sys::Memory::Acceleration)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Removes all boxes and nodes
+  void clear();
+  //! Adds a box to the BVH. 
+  void add(const pvr::BBox &bounds, const T value);
+  //! Builds the tree. Must be called after adding boxes and before calling
+  //! intersect().
+  void build();
+  //! Appends the values of all boxes hit by the ray to hits.
+  void intersect(const pvr::Ray &ray, std::vector<T> &hits) const;
+  //! Number of boxes
+  size_t size() const
+  { return m_items.size(); }
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Item
+  {
+    pvr::BBox   bounds;
+    pvr::Vector centroid;
+    T           value;
+  };
+
+  //! Single node in the flattened tree. Interior nodes store their left 
+  //! child directly after themselves, and the right child at 'offset'.
+  //! Leaf nodes store their items at m_items[offset, offset + count).
+  struct Node
+  {
+    pvr::BBox bounds;
+    size_t    offset;
+    size_t    count;
+  };
+
+  //! Orders items by centroid along one axis
+  struct CompareCentroid
+  {
+    CompareCentroid(const int axis)
+      : m_axis(axis)
+    { }
+    bool operator()(const Item &a, const Item &b) const
+    { return a.centroid[m_axis] < b.centroid[m_axis]; }
+  private:
+    int m_axis;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Recursively builds the subtree for m_items[first, last)
+  void buildRecursive(const size_t first, const size_t last);
+
+  // Data members --------------------------------------------------------------
+
+  //! Boxes. Reordered by build() so that each leaf's items are contiguous
+  std::vector<Item> m_items;
+  //! Flattened nodes. m_nodes[0] is the root
+  std::vector<Node> m_nodes;
+  //! Accounts for the memory used by the above
+  pvr::Sys::Memory::Tracker m_memory;
 
 };
 
@@ -111,9 +395,10 @@ private:
 
 template <class T>
 UniformGrid<T>::UniformGrid()
-  : m_size(32), m_cellSize(1.0), m_origin(0.0)
+  : m_size(32), m_cellSize(1.0), m_origin(0.0), 
+    m_memory(pvr::Sys::Memory::Acceleration)
 { 
-  m_hash.setSize(Imath::V3i(m_size));
+  build();
 }
   
 //----------------------------------------------------------------------------//
@@ -123,19 +408,28 @@ void UniformGrid<T>::clear(const float cellSize, const size_t res,
                            const Vector origin)
 {
   m_cellSize = cellSize;
-  m_size = res;
+  m_size = std::max(res, static_cast<size_t>(1));
   m_origin = origin;
-  m_hash.setSize(Imath::V3i(m_size));
+  m_entries.clear();
+  build();
 }
   
 //----------------------------------------------------------------------------//
 
 template <class T>
-const typename UniformGrid<T>::HashVec& 
+typename UniformGrid<T>::Range
 UniformGrid<T>::get(const pvr::Vector &p) const
 {
-  Imath::V3i idx = hash(p - m_origin);
-  return m_hash.fastValue(idx.x, idx.y, idx.z);
+  if (m_values.empty()) {
+    return Range();
+  }
+  Imath::V3i   idx = hash(p - m_origin);
+  const size_t i   = findCell(cellIndex(idx.x, idx.y, idx.z));
+  if (i == m_cells.size()) {
+    return Range();
+  }
+  const T *values = &m_values[0];
+  return Range(values + m_offsets[i], values + m_offsets[i + 1]);
 }
   
 //----------------------------------------------------------------------------//
@@ -143,12 +437,30 @@ UniformGrid<T>::get(const pvr::Vector &p) const
 template <class T>
 void UniformGrid<T>::addPoint(pvr::Vector p, const float radius, const T value)
 {
+  using namespace pvr;
   p -= m_origin;
-  for (typename HashGrid::iterator i = m_hash.begin(), end = m_hash.end();
-       i != end; ++i) {
-    pvr::Vector cellPos(i.x * m_cellSize, i.y * m_cellSize, i.z * m_cellSize);
-    if ((p - cellPos).length() < radius + m_cellSize) {
-      i->push_back(value);
+  const Imath::V3i min = hash(p - Vector(radius));
+  const Imath::V3i max = hash(p + Vector(radius));
+  const double     r2  = radius * radius;
+  for (int z = min.z; z <= max.z; ++z) {
+    for (int y = min.y; y <= max.y; ++y) {
+      for (int x = min.x; x <= max.x; ++x) {
+        if (!isBoundary(x, y, z)) {
+          // Distance from point to the cell's box
+          Vector cellMin(x * m_cellSize, y * m_cellSize, z * m_cellSize);
+          Vector cellMax = cellMin + Vector(m_cellSize);
+          double d2 = 0.0;
+          for (int dim = 0; dim < 3; ++dim) {
+            double d = std::max(0.0, std::max(cellMin[dim] - p[dim], 
+                                              p[dim] - cellMax[dim]));
+            d2 += d * d;
+          }
+          if (d2 > r2) {
+            continue;
+          }
+        } 
+        m_entries.push_back(CellEntry(cellIndex(x, y, z), value));
+      }
     }
   }
 }
@@ -160,15 +472,86 @@ void UniformGrid<T>::addLine(pvr::Vector p0, pvr::Vector p1, const float radius,
                           const T value)
 {
   using namespace pvr;
-  double t;
   p0 -= m_origin;
   p1 -= m_origin;
-  for (typename HashGrid::iterator i = m_hash.begin(), end = m_hash.end();
-       i != end; ++i) {
-    Vector cellPos(i.x * m_cellSize, i.y * m_cellSize, i.z * m_cellSize);
-    Vector pOnLine =  Math::closestPointOnLineSegment(p0, p1, cellPos, t);
-    if ((pOnLine - cellPos).length() < radius + m_cellSize) {
-      i->push_back(value);
+  Vector lower(std::min(p0.x, p1.x), std::min(p0.y, p1.y), 
+               std::min(p0.z, p1.z));
+  Vector upper(std::max(p0.x, p1.x), std::max(p0.y, p1.y), 
+               std::max(p0.z, p1.z));
+  const Imath::V3i min = hash(lower - Vector(radius));
+  const Imath::V3i max = hash(upper + Vector(radius));
+  // A cell overlaps the capsule if its center is within radius plus half 
+  // the cell diagonal of the segment
+  const double maxDist = radius + 0.5 * std::sqrt(3.0) * m_cellSize;
+  double t;
+  for (int z = min.z; z <= max.z; ++z) {
+    for (int y = min.y; y <= max.y; ++y) {
+      for (int x = min.x; x <= max.x; ++x) {
+        if (!isBoundary(x, y, z)) {
+          Vector cellCenter((x + 0.5) * m_cellSize, (y + 0.5) * m_cellSize, 
+                            (z + 0.5) * m_cellSize);
+          Vector pOnLine = 
+            Math::closestPointOnLineSegment(p0, p1, cellCenter, t);
+          if ((pOnLine - cellCenter).length2() > maxDist * maxDist) {
+            continue;
+          }
+        }
+        m_entries.push_back(CellEntry(cellIndex(x, y, z), value));
+      }
+    }
+  }
+}
+  
+//----------------------------------------------------------------------------//
+
+template <class T>
+void UniformGrid<T>::build()
+{
+  // Group the values by cell. Insertion order is preserved within each 
+  // cell.
+  std::stable_sort(m_entries.begin(), m_entries.end(), CompareCell());
+  m_cells.clear();
+  m_offsets.clear();
+  m_values.resize(m_entries.size());
+  for (size_t i = 0, size = m_entries.size(); i < size; ++i) {
+    if (i == 0 || m_entries[i].first != m_entries[i - 1].first) {
+      m_cells.push_back(m_entries[i].first);
+      m_offsets.push_back(i);
+    }
+    m_values[i] = m_entries[i].second;
+  }
+  m_offsets.push_back(m_entries.size());
+  // Hash the occupied cells, probing linearly on collisions
+  size_t tableSize = 1;
+  while (tableSize < 2 * m_cells.size()) {
+    tableSize *= 2;
+  }
+  const size_t mask = tableSize - 1;
+  m_table.assign(tableSize, m_cells.size());
+  for (size_t i = 0, size = m_cells.size(); i < size; ++i) {
+    size_t slot = mix(m_cells[i]) & mask;
+    while (m_table[slot] != size) {
+      slot = (slot + 1) & mask;
+    }
+    m_table[slot] = i;
+  }
+  m_memory.track(m_entries.capacity() * sizeof(CellEntry) + 
+                 (m_cells.capacity() + m_offsets.capacity() + 
+                  m_table.capacity()) * sizeof(size_t) + 
+                 m_values.capacity() * sizeof(T));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+size_t UniformGrid<T>::findCell(const size_t cell) const
+{
+  const size_t numCells = m_cells.size();
+  const size_t mask     = m_table.size() - 1;
+  for (size_t slot = mix(cell) & mask; ; slot = (slot + 1) & mask) {
+    const size_t i = m_table[slot];
+    if (i == numCells || m_cells[i] == cell) {
+      return i;
     }
   }
 }
@@ -192,6 +575,376 @@ Imath::V3i UniformGrid<T>::hash(pvr::Vector p) const
 
 //----------------------------------------------------------------------------//
 
+template <class T>
+bool UniformGrid<T>::isBoundary(const int x, const int y, const int z) const
+{
+  const int last = static_cast<int>(m_size) - 1;
+  return x == 0 || y == 0 || z == 0 || x == last || y == last || z == last;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void CapsuleBVH<T>::clear()
+{
+  m_capsules.clear();
+  m_order.clear();
+  m_nodes.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void CapsuleBVH<T>::addCapsule(const pvr::Vector &p0, const pvr::Vector &p1, 
+                               const float r0, const float r1, 
+                               const float reach, const T value)
+{
+  Capsule c;
+  c.p0    = p0;
+  c.p1    = p1;
+  c.r0    = r0;
+  c.r1    = r1;
+  c.reach = reach;
+  c.value = value;
+  m_capsules.push_back(c);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void CapsuleBVH<T>::build()
+{
+  m_nodes.clear();
+  m_order.resize(m_capsules.size());
+  for (size_t i = 0, size = m_order.size(); i < size; ++i) {
+    m_order[i] = i;
+  }
+  if (!m_capsules.empty()) {
+    m_nodes.reserve(2 * m_capsules.size());
+    buildRecursive(0, m_capsules.size(), 0);
+  }
+  m_memory.track(m_capsules.capacity() * sizeof(Capsule) + 
+                 m_order.capacity() * sizeof(size_t) + 
+                 m_nodes.capacity() * sizeof(Node));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+bool CapsuleBVH<T>::closest(const pvr::Vector &p, const double slack, 
+                            T &value, double &relDist) const
+{
+  using namespace pvr;
+
+  if (m_nodes.empty()) {
+    return false;
+  }
+
+  const size_t k_stackSize = 64;
+
+  size_t stack[k_stackSize];
+  size_t stackSize = 0;
+  bool   found     = false;
+  double t;
+
+  relDist = std::numeric_limits<double>::max();
+  stack[stackSize++] = 0;
+
+  while (stackSize > 0) {
+    const Node &node  = m_nodes[stack[--stackSize]];
+    const double dist = distance(p, node.axisBounds);
+    // Early-out if out of reach, or if the node can't beat the current best
+    if (dist > node.maxReach + slack || dist >= relDist * node.maxRadius) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (size_t i = node.offset, end = node.offset + node.count; 
+           i < end; ++i) {
+        const Capsule &c = m_capsules[m_order[i]];
+        Vector pOnLine = Math::closestPointOnLineSegment(c.p0, c.p1, p, t);
+        double d = (p - pOnLine).length();
+        if (d > c.reach + slack) {
+          continue;
+        }
+        double rel = d / Math::fit01(t, c.r0, c.r1);
+        if (rel < relDist) {
+          relDist = rel;
+          value   = c.value;
+          found   = true;
+        }
+      }
+    } else {
+      // Visit the nearer child first
+      const size_t left  = &node - &m_nodes[0] + 1;
+      const size_t right = node.offset;
+      const double dLeft = distance(p, m_nodes[left].axisBounds);
+      const double dRight = distance(p, m_nodes[right].axisBounds);
+      assert(stackSize + 2 <= k_stackSize);
+      if (dLeft < dRight) {
+        stack[stackSize++] = right;
+        stack[stackSize++] = left;
+      } else {
+        stack[stackSize++] = left;
+        stack[stackSize++] = right;
+      }
+    }
+  }
+
+  return found;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void CapsuleBVH<T>::buildRecursive(const size_t first, const size_t last,
+                                   const size_t depth)
+{
+  using namespace pvr;
+
+  // The depth limit keeps the traversal stack in closest() bounded
+  const size_t k_maxDepth    = 48;
+  const size_t k_maxLeafSize = 4;
+  const size_t k_numBins     = 12;
+
+  const size_t index = m_nodes.size();
+  m_nodes.push_back(Node());
+
+  // Compute node bounds, and bounds of capsule centroids
+  BBox   bounds, centroidBounds;
+  float  maxRadius = 0.0f, maxReach = 0.0f;
+  for (size_t i = first; i < last; ++i) {
+    const Capsule &c = m_capsules[m_order[i]];
+    bounds.extendBy(capsuleBounds(m_order[i]));
+    centroidBounds.extendBy((c.p0 + c.p1) * 0.5);
+    maxRadius = std::max(maxRadius, std::max(c.r0, c.r1));
+    maxReach  = std::max(maxReach, c.reach);
+  }
+  m_nodes[index].axisBounds = bounds;
+  m_nodes[index].maxRadius  = maxRadius;
+  m_nodes[index].maxReach   = maxReach;
+
+  const size_t count = last - first;
+  const int    axis  = centroidBounds.majorAxis();
+  const double cMin  = centroidBounds.min[axis];
+  const double cSize = centroidBounds.max[axis] - cMin;
+
+  // Find the SAH-optimal split among the bin boundaries
+  size_t bestSplit = 0;
+  double bestCost  = std::numeric_limits<double>::max();
+  if (count > 1 && cSize > 0.0) {
+    BBox   binBounds[k_numBins];
+    size_t binCounts[k_numBins] = { 0 };
+    for (size_t i = first; i < last; ++i) {
+      const Capsule &c = m_capsules[m_order[i]];
+      double centroid = ((c.p0 + c.p1) * 0.5)[axis];
+      size_t bin = std::min(static_cast<size_t>(k_numBins * 
+                                                (centroid - cMin) / cSize),
+                            k_numBins - 1);
+      binCounts[bin]++;
+      binBounds[bin].extendBy(capsuleBounds(m_order[i]));
+    }
+    for (size_t split = 1; split < k_numBins; ++split) {
+      BBox   left, right;
+      size_t numLeft = 0, numRight = 0;
+      for (size_t b = 0; b < split; ++b) {
+        left.extendBy(binBounds[b]);
+        numLeft += binCounts[b];
+      }
+      for (size_t b = split; b < k_numBins; ++b) {
+        right.extendBy(binBounds[b]);
+        numRight += binCounts[b];
+      }
+      if (numLeft == 0 || numRight == 0) {
+        continue;
+      }
+      double cost = area(left, maxReach) * numLeft + 
+        area(right, maxReach) * numRight;
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = split;
+      }
+    }
+  }
+
+  // Create a leaf if splitting isn't possible or doesn't pay off
+  const double leafCost = area(bounds, maxReach) * count;
+  if (bestSplit == 0 || depth >= k_maxDepth || 
+      (count <= k_maxLeafSize && bestCost >= leafCost)) {
+    m_nodes[index].offset = first;
+    m_nodes[index].count  = count;
+    return;
+  }
+
+  // Partition capsules by bin
+  size_t mid = first;
+  for (size_t i = first; i < last; ++i) {
+    const Capsule &c = m_capsules[m_order[i]];
+    double centroid = ((c.p0 + c.p1) * 0.5)[axis];
+    size_t bin = std::min(static_cast<size_t>(k_numBins * 
+                                              (centroid - cMin) / cSize),
+                          k_numBins - 1);
+    if (bin < bestSplit) {
+      std::swap(m_order[i], m_order[mid++]);
+    }
+  }
+
+  // Recurse. Left child directly follows this node.
+  m_nodes[index].count = 0;
+  buildRecursive(first, mid, depth + 1);
+  m_nodes[index].offset = m_nodes.size();
+  buildRecursive(mid, last, depth + 1);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+double CapsuleBVH<T>::distance(const pvr::Vector &p, const pvr::BBox &box)
+{
+  double d2 = 0.0;
+  for (int dim = 0; dim < 3; ++dim) {
+    double d = std::max(0.0, std::max(box.min[dim] - p[dim], 
+                                      p[dim] - box.max[dim]));
+    d2 += d * d;
+  }
+  return std::sqrt(d2);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+double CapsuleBVH<T>::area(const pvr::BBox &box, const double inflate)
+{
+  const pvr::Vector size = box.size() + pvr::Vector(2.0 * inflate);
+  return 2.0 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+pvr::BBox CapsuleBVH<T>::capsuleBounds(const size_t i) const
+{
+  pvr::BBox bounds;
+  bounds.extendBy(m_capsules[i].p0);
+  bounds.extendBy(m_capsules[i].p1);
+  return bounds;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void BoundsBVH<T>::clear()
+{
+  m_items.clear();
+  m_nodes.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void BoundsBVH<T>::add(const pvr::BBox &bounds, const T value)
+{
+  Item item;
+  item.bounds   = bounds;
+  item.centroid = bounds.center();
+  item.value    = value;
+  m_items.push_back(item);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void BoundsBVH<T>::build()
+{
+  m_nodes.clear();
+  if (!m_items.empty()) {
+    m_nodes.reserve(2 * m_items.size());
+    buildRecursive(0, m_items.size());
+  }
+  m_memory.track(m_items.capacity() * sizeof(Item) + 
+                 m_nodes.capacity() * sizeof(Node));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void BoundsBVH<T>::intersect(const pvr::Ray &ray, std::vector<T> &hits) const
+{
+  if (m_nodes.empty()) {
+    return;
+  }
+
+  const size_t k_stackSize = 64;
+
+  size_t stack[k_stackSize];
+  size_t stackSize = 0;
+  double t0, t1;
+
+  stack[stackSize++] = 0;
+
+  while (stackSize > 0) {
+    const size_t index = stack[--stackSize];
+    const Node  &node  = m_nodes[index];
+    if (!pvr::Math::intersect(ray, node.bounds, t0, t1)) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (size_t i = node.offset, end = node.offset + node.count; 
+           i < end; ++i) {
+        if (node.count == 1 || 
+            pvr::Math::intersect(ray, m_items[i].bounds, t0, t1)) {
+          hits.push_back(m_items[i].value);
+        }
+      }
+    } else {
+      assert(stackSize + 2 <= k_stackSize);
+      stack[stackSize++] = node.offset;
+      stack[stackSize++] = index + 1;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class T>
+void BoundsBVH<T>::buildRecursive(const size_t first, const size_t last)
+{
+  using namespace pvr;
+
+  const size_t k_maxLeafSize = 2;
+
+  const size_t index = m_nodes.size();
+  m_nodes.push_back(Node());
+
+  BBox bounds, centroidBounds;
+  for (size_t i = first; i < last; ++i) {
+    bounds.extendBy(m_items[i].bounds);
+    centroidBounds.extendBy(m_items[i].centroid);
+  }
+  m_nodes[index].bounds = bounds;
+
+  const size_t count = last - first;
+  if (count <= k_maxLeafSize || 
+      centroidBounds.min == centroidBounds.max) {
+    m_nodes[index].offset = first;
+    m_nodes[index].count  = count;
+    return;
+  }
+
+  // Median split along the largest axis
+  const size_t mid = first + count / 2;
+  std::nth_element(m_items.begin() + first, m_items.begin() + mid, 
+                   m_items.begin() + last, 
+                   CompareCentroid(centroidBounds.majorAxis()));
+
+  // Recurse. Left child directly follows this node.
+  m_nodes[index].count = 0;
+  buildRecursive(first, mid);
+  m_nodes[index].offset = m_nodes.size();
+  buildRecursive(mid, last);
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Accel
 } // namespace pvr
 
@@ -0,0 +1,180 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file AttrChannels.h
+  Contains the AttrChannels class
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_ATTRCHANNELS_H__
+#define __INCLUDED_PVR_ATTRCHANNELS_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Library headers
+
+#include <boost/align/aligned_allocator.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/AttrTable.h"
+#include "pvr/AttrUtil.h"
+#include "pvr/Exception.h"
+#include "pvr/ParamMap.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Geo {
+
+//----------------------------------------------------------------------------//
+// AttrChannels
+//----------------------------------------------------------------------------//
+
+/*! \class AttrChannels
+  \brief Structure-of-arrays snapshot of selected AttrTable attributes.
+
+  Each float attribute becomes one channel, and each vector attribute 
+  becomes three (x, y and z). Channels are contiguous and aligned, so loops
+  over them can be vectorized. Attributes missing from the table are 
+  resolved the same way as Attr does: first against the global parameters,
+  then against the given default. The channel is filled with that constant.
+
+  The AttrTable itself is left untouched. The snapshot is only valid while
+  the table is unchanged.
+
+  \code
+  AttrChannels channels(points, globals);
+  channels.add(attrs.wsCenter);
+  channels.add(attrs.radius);
+  AttrChannels::Span px = channels.span("P", 0), radius = channels.span("radius");
+  for (size_t i = 0; i < channels.size(); ++i) {
+    // Do work with px[i], radius[i]
+  }
+  \endcode
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC AttrChannels
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! Alignment of each channel, in bytes
+  enum { Alignment = 32 };
+
+  typedef std::vector<float, 
+                      boost::alignment::aligned_allocator<float, Alignment> > 
+  Channel;
+
+  // Exceptions ----------------------------------------------------------------
+
+  DECLARE_PVR_RT_EXC(MissingChannelException, "Channel not found:");
+
+  // Structs -------------------------------------------------------------------
+
+  //! Contiguous, read-only run of float values
+  struct Span
+  {
+    Span()
+      : data(NULL), size(0)
+    { }
+    Span(const float *d, const size_t s)
+      : data(d), size(s)
+    { }
+    const float& operator[] (const size_t idx) const
+    { return data[idx]; }
+    const float *data;
+    size_t       size;
+  };
+
+  // Constructor ---------------------------------------------------------------
+
+  AttrChannels(const AttrTable &table, const Util::ParamMap &globals);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Number of elements in each channel
+  size_t size() const
+  { return m_size; }
+
+  //! Adds a channel for the named float attribute
+  void add(const std::string &name, const float defaultValue);
+  //! Adds three channels for the named vector attribute
+  void add(const std::string &name, const Imath::V3f &defaultValue);
+  //! Adds channels using the Attr's name and default value
+  void add(const Attr<float> &attr)
+  { add(attr.name(), attr.defaultValue()); }
+  void add(const Attr<Imath::V3f> &attr)
+  { add(attr.name(), attr.defaultValue()); }
+
+  //! Whether the channels for the given name exist
+  bool has(const std::string &name) const;
+
+  //! Returns the channel for a float attribute, or one component of a 
+  //! vector attribute
+  //! \throws MissingChannelException if the channel wasn't added
+  Span span(const std::string &name, const size_t component = 0) const;
+
+private:
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! Maps attribute name to first channel index and number of channels
+  typedef std::map<std::string, std::pair<size_t, size_t> > ChannelMap;
+
+  // Private data members ------------------------------------------------------
+
+  const AttrTable      &m_table;
+  const Util::ParamMap &m_globals;
+  size_t                m_size;
+  ChannelMap            m_channelMap;
+  std::vector<Channel>  m_channels;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Geo
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
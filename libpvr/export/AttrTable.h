@@ -38,12 +38,16 @@
 #include <vector>
 #include <string>
 
+#include <boost/atomic.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_array.hpp>
 
 // Project headers
 
 #include "pvr/export.h"
 #include "pvr/Exception.h"
+#include "pvr/Memory.h"
 #include "pvr/Types.h"
 
 //----------------------------------------------------------------------------//
@@ -53,6 +57,12 @@
 namespace pvr {
 namespace Geo {
 
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+class AttrAppender;
+
 //----------------------------------------------------------------------------//
 // AttrArray
 //----------------------------------------------------------------------------//
@@ -192,6 +202,9 @@ private:
   Attributes are stored internally as a 'structure of vectors', meaning that
   new attributes can be added without disturbing existing data. It also means
   that the attributes for a given element are stored in different memory areas.
+
+  Use an AttrAppender to add elements when their number isn't known up front,
+  or when several threads add them.
  */
 
 //----------------------------------------------------------------------------//
@@ -251,6 +264,8 @@ public:
   void   resize  (const size_t size);
   //! Returns size of table
   size_t size    () const;
+  //! Returns the memory allocated for the attribute columns, in bytes
+  size_t memSize () const;
 
   // Attribute names -----------------------------------------------------------
 
@@ -385,6 +400,8 @@ public:
   //! \returns Index of string added
   size_t             addStringToTable(const AttrRef &ref, 
                                       const std::string &s);
+  //! Returns the number of strings in the string table
+  size_t             stringTableSize (const AttrRef &ref) const;
 
   //! \}
 
@@ -410,6 +427,16 @@ public:
 
 private:
 
+  // Friends -------------------------------------------------------------------
+
+  //! Moves its pages straight into the columns
+  friend class AttrAppender;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Reports the current memSize() to the memory accounting
+  void updateMemory();
+
   // Private data members ------------------------------------------------------
 
   //! Store the size here, even though it's implicit in the attributes.
@@ -426,6 +453,136 @@ private:
   VectorAttrVec m_vectorAttrs;
   StringIdxAttrVec m_stringIdxAttrs;
 
+  //! Accounts for the memory used by the columns
+  Sys::Memory::Tracker m_memory;
+
+};
+
+//----------------------------------------------------------------------------//
+// AttrAppender
+//----------------------------------------------------------------------------//
+
+/*! \brief Appends elements to an AttrTable, from several threads at once.
+
+  Elements are reserved in ranges and stored in fixed-size pages that hold
+  every column of the table. A page is allocated when part of it is first
+  reserved and is never moved, so reserving doesn't lock, doesn't copy and
+  leaves the addresses of earlier elements unchanged. New elements hold the
+  attribute defaults.
+
+  commit() appends the reserved elements to the table. Each column is
+  allocated once at its final size and each page column is freed as soon
+  as it's copied, so memory stays close to the final size of the table.
+
+  Attributes must not be added to the table, and its size must not change,
+  while elements are reserved. String indices may be written from several
+  threads, but addStringToTable() is not thread safe.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC AttrAppender : boost::noncopyable
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(AttrAppender);
+
+  // Exceptions ----------------------------------------------------------------
+
+  DECLARE_PVR_RT_EXC(CapacityException,     "Appender capacity exceeded:");
+  DECLARE_PVR_RT_EXC(TableChangedException, "Table changed while appending:");
+
+  // Constructor, destructor, factory ------------------------------------------
+
+  //! Appends to the given table, which must outlive the appender
+  AttrAppender(AttrTable &table);
+  //! Frees any pages that weren't committed
+  ~AttrAppender();
+
+  //! Factory function. Use this whenever the life span of the object needs
+  //! to be managed.
+  static Ptr create(AttrTable &table);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Reserves numItems consecutive elements. Thread safe.
+  //! \returns The table index of the first element
+  //! \throws  CapacityException if the appender is full
+  size_t reserveElems(const size_t numItems);
+  //! Returns the number of elements reserved since the last commit()
+  size_t size        () const;
+  //! Returns the memory allocated for the pages, in bytes
+  size_t memSize     () const;
+  //! Appends the reserved elements to the table, after which the appender
+  //! may be used again. Must not run concurrently with anything else.
+  //! \throws TableChangedException if the table changed since reserving
+  void   commit      ();
+
+  // Element access ------------------------------------------------------------
+
+  /*! \{
+    \name Access to reserved elements
+    Each returns the arraySize() values of one reserved element, which are 
+    stored consecutively. Thread safe, provided each element is written by 
+    a single thread. The pointers are valid until commit().
+  */
+
+  int*        intElem      (const AttrRef &ref, const size_t elem);
+  float*      floatElem    (const AttrRef &ref, const size_t elem);
+  Imath::V3f* vectorElem   (const AttrRef &ref, const size_t elem);
+  size_t*     stringIdxElem(const AttrRef &ref, const size_t elem);
+
+  //! \}
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! The values of a fixed number of elements, one vector per attribute
+  struct Page
+  {
+    std::vector<std::vector<int> >        ints;
+    std::vector<std::vector<float> >      floats;
+    std::vector<std::vector<Imath::V3f> > vectors;
+    std::vector<std::vector<size_t> >     stringIdxs;
+  };
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_array<boost::atomic<Page*> > PageArray;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the given page, allocating it if needed
+  Page& page(const size_t idx);
+  //! Returns the values of a reserved element
+  template <typename T>
+  T* elemValues(std::vector<std::vector<T> > Page::*columns, 
+                const AttrRef &ref, const size_t elem);
+  //! Moves the reserved elements into the columns of one attribute type
+  template <typename T>
+  void commitColumns(std::vector<AttrArray<T> > &attrs, 
+                     std::vector<std::vector<T> > Page::*columns);
+  //! Frees all pages
+  void clearPages();
+
+  // Data members --------------------------------------------------------------
+
+  //! Table being appended to
+  AttrTable            &m_table;
+  //! Table index of the first reserved element
+  size_t                m_first;
+  //! Number of elements reserved
+  boost::atomic<size_t> m_size;
+  //! Number of pages allocated
+  boost::atomic<size_t> m_numPages;
+  //! Bytes allocated per page
+  size_t                m_pageBytes;
+  //! Page directory. Unallocated pages are null.
+  PageArray             m_pages;
+
 };
 
 //----------------------------------------------------------------------------//
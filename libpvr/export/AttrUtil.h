@@ -65,6 +65,11 @@ namespace Geo {
   and in the case where the global param is used, no iteration or memory access
   occurs.
 
+  Once bound, the attribute is a raw pointer and a stride into the AttrTable's
+  storage. A missing attribute has a stride of zero and points at its own
+  default value, so updating and reading never branch on whether the 
+  attribute exists.
+
   \code
   AttrVisitor visitor(points, globalParams);
   Attr<float> density("density");
@@ -84,21 +89,35 @@ class Attr
 {
 public:
 
-  // Typedefs ------------------------------------------------------------------
-
-  typedef typename std::vector<T>::const_iterator Iter;
-
   // Constructor ---------------------------------------------------------------
 
   Attr(const std::string &name)
-    : m_pos(0), m_name(name), m_isActive(false), m_isInitialized(false)
+    : m_name(name), m_isActive(false), m_isInitialized(false)
   {
     m_defaultValue = static_cast<T>(0);
+    setData(NULL);
   }
   Attr(const std::string &name, const T &defaultValue)
-    : m_pos(0), m_name(name), m_isActive(false), m_isInitialized(false)
+    : m_name(name), m_isActive(false), m_isInitialized(false)
   {
     m_defaultValue = defaultValue;
+    setData(NULL);
+  }
+  //! Copies must not refer to the source's default value
+  Attr(const Attr &other)
+    : m_name(other.m_name), m_defaultValue(other.m_defaultValue),
+      m_isActive(other.m_isActive), m_isInitialized(other.m_isInitialized)
+  {
+    copyData(other);
+  }
+  Attr& operator = (const Attr &other)
+  {
+    m_name          = other.m_name;
+    m_defaultValue  = other.m_defaultValue;
+    m_isActive      = other.m_isActive;
+    m_isInitialized = other.m_isInitialized;
+    copyData(other);
+    return *this;
   }
 
   // Main methods --------------------------------------------------------------
@@ -118,36 +137,61 @@ public:
   bool isInitialized() const
   { return m_isInitialized; }
 
-  void setIterator(const Iter &i)
-  { m_value = i; }
+  //! Points the attribute at the first element of the table's storage. 
+  //! Passing NULL makes it use the default value for every element.
+  void setData(const T *data)
+  { 
+    m_data    = data ? data : &m_defaultValue;
+    m_stride  = data ? 1 : 0;
+    m_current = m_data;
+  }
 
   void setDefaultValue(const T defaultValue)
   { m_defaultValue = defaultValue; }
 
+  const T& defaultValue() const
+  { return m_defaultValue; }
+
   void updateIndex(size_t newPos)
-  {
-    std::advance(m_value, (newPos - m_pos));
-    m_pos = newPos;
-  }
+  { m_current = m_data + newPos * m_stride; }
 
   const T& value() const
-  { return m_isActive ? *(m_value) : m_defaultValue; }
+  { return *m_current; }
+
+  //! Returns the value at the given index, without moving the attribute.
+  //! Only valid once the attribute has been bound. See AttrVisitor::bind().
+  const T& valueAt(const size_t idx) const
+  { return m_data[idx * m_stride]; }
 
   template <typename Other_T>
   Other_T as() const
-  { return static_cast<Other_T>(m_isActive ? *(m_value) : m_defaultValue); }
+  { return static_cast<Other_T>(*m_current); }
   
   // Overloaded operators ------------------------------------------------------
 
   operator const T& () const
-  { return m_isActive ? *(m_value) : m_defaultValue; }
+  { return *m_current; }
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  void copyData(const Attr &other)
+  {
+    if (other.m_stride == 0) {
+      setData(NULL);
+    } else {
+      m_data    = other.m_data;
+      m_stride  = other.m_stride;
+      m_current = other.m_current;
+    }
+  }
+
   // Private data members ------------------------------------------------------
 
-  size_t      m_pos;
-  Iter        m_value;
+  const T    *m_data;
+  const T    *m_current;
+  size_t      m_stride;
   std::string m_name;
   T           m_defaultValue;
   bool        m_isActive;
@@ -187,18 +231,32 @@ class ArrayAttr
 {
 public:
 
-  // Typedefs ------------------------------------------------------------------
-
-  typedef typename std::vector<T>::const_iterator Iter;
-
   // Constructor ---------------------------------------------------------------
 
   ArrayAttr(const std::string &name)
-    : m_pos(0), m_name(name), m_isActive(false), m_isInitialized(false)
+    : m_name(name), m_isActive(false), m_isInitialized(false)
   {
     for (size_t i = 0; i < ArraySize_T; ++i) {
       m_defaultValue[i] = static_cast<T>(0);
     }
+    setData(NULL);
+  }
+  //! Copies must not refer to the source's default value
+  ArrayAttr(const ArrayAttr &other)
+    : m_name(other.m_name), m_isActive(other.m_isActive), 
+      m_isInitialized(other.m_isInitialized)
+  {
+    setDefaultValue(other.m_defaultValue);
+    copyData(other);
+  }
+  ArrayAttr& operator = (const ArrayAttr &other)
+  {
+    m_name          = other.m_name;
+    m_isActive      = other.m_isActive;
+    m_isInitialized = other.m_isInitialized;
+    setDefaultValue(other.m_defaultValue);
+    copyData(other);
+    return *this;
   }
 
   // Main methods --------------------------------------------------------------
@@ -218,8 +276,14 @@ public:
   bool isInitialized() const
   { return m_isInitialized; }
 
-  void setIterator(const Iter &i)
-  { m_value = i; }
+  //! Points the attribute at the first element of the table's storage. 
+  //! Passing NULL makes it use the default value for every element.
+  void setData(const T *data)
+  { 
+    m_data    = data ? data : m_defaultValue;
+    m_stride  = data ? ArraySize_T : 0;
+    m_current = m_data;
+  }
 
   void setDefaultValue(const T defaultValue[ArraySize_T])
   {
@@ -229,23 +293,38 @@ public:
   }
 
   void updateIndex(size_t newPos)
-  {
-    newPos *= ArraySize_T;
-    std::advance(m_value, (newPos - m_pos));
-    m_pos = newPos;
-  }
+  { m_current = m_data + newPos * m_stride; }
+
+  //! Returns the value at the given index, without moving the attribute.
+  //! Only valid once the attribute has been bound. See AttrVisitor::bind().
+  const T& valueAt(const size_t idx, const size_t arrayIdx) const
+  { return m_data[idx * m_stride + arrayIdx]; }
 
   // Overloaded operators ------------------------------------------------------
 
   const T& operator[] (size_t arrayIdx) const
-  { return m_isActive ? *(m_value + arrayIdx) : m_defaultValue[arrayIdx]; }
+  { return m_current[arrayIdx]; }
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  void copyData(const ArrayAttr &other)
+  {
+    if (other.m_stride == 0) {
+      setData(NULL);
+    } else {
+      m_data    = other.m_data;
+      m_stride  = other.m_stride;
+      m_current = other.m_current;
+    }
+  }
+
   // Private data members ------------------------------------------------------
 
-  size_t      m_pos;
-  Iter        m_value;
+  const T    *m_data;
+  const T    *m_current;
+  size_t      m_stride;
   std::string m_name;
   T           m_defaultValue[ArraySize_T];
   bool        m_isActive;
@@ -326,6 +405,18 @@ public:
   //! Returns const_iterator to one step past given index
   const_iterator end(const size_t idx) const;
 
+  //! Resolves the Attr against the visited AttrTable and global parameters.
+  //! Call this once before iterating, e.g. at the start of execute(), to 
+  //! avoid the lazy initialization check per element and to rebind 
+  //! attributes that were used with a previous table.
+  template <class T>
+  void bind(Attr<T> &attr) const;
+
+  //! Resolves the ArrayAttr against the visited AttrTable and global 
+  //! parameters.
+  template <class T, size_t ArraySize_T>
+  void bind(ArrayAttr<T, ArraySize_T> &attr) const;
+
   //! Updates a Attr's value to that of the given point index's.
   template <class T>
   void update(Attr<T> &attr, size_t pos) const;
@@ -367,18 +458,31 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
 // AttrVisitor - Implementations of templated methods
 //----------------------------------------------------------------------------//
 
+template <class T>
+void AttrVisitor::bind(Attr<T> &attr) const
+{
+  initialize(m_points, m_globals, attr);
+}
+  
+//----------------------------------------------------------------------------//
+
+template <class T, size_t ArraySize_T>
+void AttrVisitor::bind(ArrayAttr<T, ArraySize_T> &attr) const
+{
+  initialize(m_points, m_globals, attr);
+}
+  
+//----------------------------------------------------------------------------//
+
 template <class T>
 void AttrVisitor::update(Attr<T> &attr, size_t pos) const
 {
   if (!attr.isInitialized()) {
     initialize(m_points, m_globals, attr);
   }
-  if (attr.isActive()) {
-    attr.updateIndex(pos);
-  } else {
-    // If the point attr isn't active it means the global has already been set
-    // In this case we do nothing
-  }
+  // Inactive attributes have zero stride, so this leaves them pointing at
+  // their default value
+  attr.updateIndex(pos);
 }
   
 //----------------------------------------------------------------------------//
@@ -390,12 +494,9 @@ void AttrVisitor::update(ArrayAttr<T, ArraySize_T> &attr,
   if (!attr.isInitialized()) {
     initialize(m_points, m_globals, attr);
   }
-  if (attr.isActive()) {
-    attr.updateIndex(pos);
-  } else {
-    // If the point attr isn't active it means the global has already been set
-    // In this case we do nothing
-  }
+  // Inactive attributes have zero stride, so this leaves them pointing at
+  // their default value
+  attr.updateIndex(pos);
 }
   
 //----------------------------------------------------------------------------//
@@ -411,7 +512,8 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
 
   AttrRef ref = points.intAttrRef(attr.name());
   if (ref.isValid() && ref.arraySize() == ArraySize_T) {
-    attr.setIterator(points.intAttrElems(ref).begin());
+    const std::vector<int> &elems = points.intAttrElems(ref);
+    attr.setData(elems.empty() ? NULL : &elems[0]);
     attr.setActive(true);
   } else {
     int defaultValue[ArraySize_T];
@@ -423,6 +525,7 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
       // No default value found in globals map. Revert to ArrayAttr's
       // own default.
     }
+    attr.setData(NULL);
     attr.setActive(false);
   }
 }
@@ -438,7 +541,8 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
 
   AttrRef ref = points.floatAttrRef(attr.name());
   if (ref.isValid() && ref.arraySize() == ArraySize_T) {
-    attr.setIterator(points.floatAttrElems(ref).begin());
+    const std::vector<float> &elems = points.floatAttrElems(ref);
+    attr.setData(elems.empty() ? NULL : &elems[0]);
     attr.setActive(true);
   } else {
     float defaultValue[ArraySize_T];
@@ -450,6 +554,7 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
       // No default value found in globals map. Revert to ArrayAttr's
       // own default.
     }
+    attr.setData(NULL);
     attr.setActive(false);
   }
 }
@@ -0,0 +1,143 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlockCache.h
+  Contains the BlockCache class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_BLOCKCACHE_H__
+#define __INCLUDED_PVR_BLOCKCACHE_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <string>
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// BlockCache
+//----------------------------------------------------------------------------//
+
+/*! \class BlockCache
+  \brief Compresses the blocks of CompressedBuffer, and caches decompressed
+  blocks per thread.
+
+  Every thread keeps the blocks it decompressed most recently, up to the
+  memory limit, and evicts the least recently used block first. Render
+  tiles only touch a small part of a volume, and each thread renders one
+  tile at a time, so most blocks are cold and stay compressed. Since no
+  thread reads another thread's blocks, lookups need no locking.
+
+  Blocks are byte-shuffled, so that the corresponding bytes of all words
+  are stored together, and then compressed with LZ4. Builds without
+  PVR_USE_LZ4 run-length encode the shuffled bytes instead, which is
+  faster but saves less.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC BlockCache
+{
+public:
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets the maximum amount of memory in megabytes that each thread may
+  //! use for decompressed blocks. At least one block is always kept.
+  static void   setMemoryLimit(const float megabytes);
+  //! Returns the per-thread memory limit in megabytes
+  static float  memoryLimit();
+  //! Returns a new id for a compressed buffer. Ids are never reused, so
+  //! the blocks of a deleted buffer are never found again, and simply age
+  //! out of the caches.
+  static size_t newBufferId();
+  //! Returns the calling thread's decompressed copy of the given block, or
+  //! null if it has none. The pointer is valid until the thread's next
+  //! call to insert().
+  static const void* find(const size_t bufferId, const size_t block);
+  //! Adds a block to the calling thread's cache, evicting the least
+  //! recently used blocks to stay within the memory limit, and returns
+  //! memory of the given size to decompress it into. The pointer is valid
+  //! until the thread's next call to insert().
+  static void*  insert(const size_t bufferId, const size_t block,
+                       const size_t bytes);
+
+  // Compression ---------------------------------------------------------------
+
+  //! Compresses bytes of data, made up of words of wordSize bytes.
+  //! \returns False if compression saves nothing, in which case packed is
+  //! left empty.
+  static bool   compress(const void *data, const size_t bytes,
+                         const size_t wordSize,
+                         std::vector<unsigned char> &packed);
+  //! Decompresses the output of compress() into bytes of data
+  static void   decompress(const std::vector<unsigned char> &packed,
+                           const size_t wordSize, void *data,
+                           const size_t bytes);
+  //! Returns the name of the codec
+  static std::string codecName();
+
+  // Statistics ----------------------------------------------------------------
+
+  //! Number of blocks decompressed, i.e. cache misses, since the last reset
+  static long   numMisses();
+  //! Resets the statistics counters.
+  static void   resetStatistics();
+  //! Returns the settings and statistics as human-readable lines, in the
+  //! same form as Volume::info().
+  static std::vector<std::string> info();
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  static float ms_memoryLimit;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,290 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file BrickedBuffer.h
+  Contains the BrickedBuffer class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_BRICKEDBUFFER_H__
+#define __INCLUDED_PVR_BRICKEDBUFFER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Library headers
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <Field3D/FieldMapping.h>
+
+// Project headers
+
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+
+//----------------------------------------------------------------------------//
+// BrickedBuffer
+//----------------------------------------------------------------------------//
+
+/*! \class BrickedBuffer
+  \brief Dense voxel buffer stored as cubic bricks, with both the bricks 
+  and the voxels inside each brick in Morton order.
+
+  Neighbouring voxels along any axis are close in memory, which keeps
+  interpolation taps and rays that travel along z or diagonally within a
+  few cache lines and pages. Bricks are 2^order voxels on a side, with 
+  4^3 and 8^3 being typical. Bricks along the upper edges of the data 
+  window are padded.
+
+  The interface mirrors the parts of Field3D's DenseField and SparseField
+  that VoxelVolume uses. Bricks count as blocks that are always 
+  allocated. Voxel coordinates are the same as in the original field.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class BrickedBuffer
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(BrickedBuffer);
+  typedef Data_T value_type;
+
+  // Ctor ----------------------------------------------------------------------
+
+  //! Creates a buffer with all voxels set to zero.
+  BrickedBuffer(const Field3D::Box3i &extents, 
+                const Field3D::Box3i &dataWindow, const int brickOrder = 3);
+  //! Copies any DenseField or SparseField, or anything else with 
+  //! extents(), dataWindow(), mapping() and fastValue().
+  template <typename Field_T>
+  explicit BrickedBuffer(const Field_T &field, const int brickOrder = 3);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the value of the given voxel, which must be inside the data 
+  //! window.
+  const Data_T& fastValue(int i, int j, int k) const
+  { return m_data[voxelIndex(i, j, k)]; }
+  //! Returns a writable reference to the given voxel, which must be inside
+  //! the data window.
+  Data_T& fastLValue(int i, int j, int k)
+  { return m_data[voxelIndex(i, j, k)]; }
+  //! Same as fastValue(). Provided for Field3D-style code.
+  Data_T value(const int i, const int j, const int k) const
+  { return fastValue(i, j, k); }
+  //! Returns the mapping of the buffer
+  const Field3D::FieldMapping::Ptr& mapping() const
+  { return m_mapping; }
+  //! Sets the mapping of the buffer
+  void setMapping(Field3D::FieldMapping::Ptr mapping)
+  { m_mapping = mapping; }
+  //! Returns the extents of the buffer
+  const Field3D::Box3i& extents() const
+  { return m_extents; }
+  //! Returns the data window of the buffer
+  const Field3D::Box3i& dataWindow() const
+  { return m_dataWindow; }
+  //! Returns the brick order, i.e. log2 of the brick size
+  int blockOrder() const
+  { return m_blockOrder; }
+  //! Returns the brick size, in voxels
+  int blockSize() const
+  { return 1 << m_blockOrder; }
+  //! Returns the number of bricks along each axis
+  const Imath::V3i& blockRes() const
+  { return m_blockRes; }
+  //! Returns the brick containing the given voxel. The voxel coordinate is
+  //! relative to the data window's minimum, just like in SparseField.
+  void getBlockCoord(const int i, const int j, const int k,
+                     int &bi, int &bj, int &bk) const
+  { bi = i >> m_blockOrder; bj = j >> m_blockOrder; bk = k >> m_blockOrder; }
+  //! Bricks are always allocated.
+  bool blockIsAllocated(const int, const int, const int) const
+  { return true; }
+  //! Never used, since bricks are always allocated.
+  Data_T getBlockEmptyValue(const int, const int, const int) const
+  { return Data_T(0.0f); }
+  //! Returns the voxels of the given brick, in Morton order. Use with 
+  //! brickOffset() to read several voxels of a brick at once.
+  const Data_T* brickData(const int bi, const int bj, const int bk) const
+  { return &m_data[brickStart(bi, bj, bk)]; }
+  //! Returns the position within its brick of the given voxel. The voxel 
+  //! coordinate is relative to the brick's first voxel.
+  int brickOffset(const int i, const int j, const int k) const
+  { return m_spread[i] | (m_spread[j] << 1) | (m_spread[k] << 2); }
+  //! Returns the memory use of the buffer, in bytes.
+  size_t memSize() const
+  { 
+    return sizeof(*this) + m_data.size() * sizeof(Data_T) + 
+      m_brickStarts.size() * sizeof(size_t) + m_spread.size() * sizeof(int);
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Sets up the brick layout for the current data window
+  void init();
+  //! Returns the index in m_data of the given brick's first voxel
+  size_t brickStart(const int bi, const int bj, const int bk) const
+  { return m_brickStarts[bi + m_blockRes.x * (bj + m_blockRes.y * bk)]; }
+  //! Returns the index in m_data of the given voxel
+  size_t voxelIndex(int i, int j, int k) const
+  {
+    i -= m_dataWindow.min.x;
+    j -= m_dataWindow.min.y;
+    k -= m_dataWindow.min.z;
+    const int mask = (1 << m_blockOrder) - 1;
+    return brickStart(i >> m_blockOrder, j >> m_blockOrder, k >> m_blockOrder)
+      + brickOffset(i & mask, j & mask, k & mask);
+  }
+  //! Spreads the bits of x out so that there are two zero bits between 
+  //! each of them, for interleaving three coordinates into a Morton code.
+  static boost::uint64_t spreadBits(const boost::uint64_t x)
+  {
+    boost::uint64_t result = 0;
+    for (int bit = 0; bit < 21; ++bit) {
+      result |= ((x >> bit) & 1) << (3 * bit);
+    }
+    return result;
+  }
+
+  // Private data members ------------------------------------------------------
+
+  Field3D::FieldMapping::Ptr m_mapping;
+  Field3D::Box3i             m_extents;
+  Field3D::Box3i             m_dataWindow;
+  int                        m_blockOrder;
+  Imath::V3i                 m_blockRes;
+  //! Index of each brick's first voxel, with bricks in x-fastest order
+  std::vector<size_t>        m_brickStarts;
+  //! spreadBits() of each voxel coordinate within a brick
+  std::vector<int>           m_spread;
+  //! Voxel data, one brick after the other
+  std::vector<Data_T>        m_data;
+
+};
+
+//----------------------------------------------------------------------------//
+// Template implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+BrickedBuffer<Data_T>::BrickedBuffer(const Field3D::Box3i &extents, 
+                                     const Field3D::Box3i &dataWindow, 
+                                     const int brickOrder)
+  : m_extents(extents), 
+    m_dataWindow(dataWindow), 
+    m_blockOrder(brickOrder)
+{
+  init();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+template <typename Field_T>
+BrickedBuffer<Data_T>::BrickedBuffer(const Field_T &field, 
+                                     const int brickOrder)
+  : m_mapping(field.mapping()), 
+    m_extents(field.extents()), 
+    m_dataWindow(field.dataWindow()), 
+    m_blockOrder(brickOrder)
+{
+  init();
+  const Field3D::Box3i &dw = m_dataWindow;
+  for (int k = dw.min.z; k <= dw.max.z; ++k) {
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        fastLValue(i, j, k) = field.fastValue(i, j, k);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void BrickedBuffer<Data_T>::init()
+{
+  const int blockSize = 1 << m_blockOrder;
+  const size_t brickVoxels = blockSize * blockSize * blockSize;
+
+  m_blockRes = m_dataWindow.isEmpty() ? Imath::V3i(0) :
+    (m_dataWindow.size() + Imath::V3i(blockSize)) / blockSize;
+  const int numBricks = m_blockRes.x * m_blockRes.y * m_blockRes.z;
+
+  // Lay the bricks out in the order of their Morton codes
+  std::vector<std::pair<boost::uint64_t, int> > codes;
+  codes.reserve(numBricks);
+  for (int bk = 0; bk < m_blockRes.z; ++bk) {
+    for (int bj = 0; bj < m_blockRes.y; ++bj) {
+      for (int bi = 0; bi < m_blockRes.x; ++bi) {
+        const boost::uint64_t code = 
+          spreadBits(bi) | (spreadBits(bj) << 1) | (spreadBits(bk) << 2);
+        codes.push_back(std::make_pair(code, static_cast<int>(codes.size())));
+      }
+    }
+  }
+  std::sort(codes.begin(), codes.end());
+  m_brickStarts.resize(numBricks);
+  for (int i = 0; i < numBricks; ++i) {
+    m_brickStarts[codes[i].second] = i * brickVoxels;
+  }
+
+  m_spread.resize(blockSize);
+  for (int i = 0; i < blockSize; ++i) {
+    m_spread[i] = static_cast<int>(spreadBits(i));
+  }
+
+  m_data.resize(numBricks * brickVoxels, Data_T(0.0f));
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
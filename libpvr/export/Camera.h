@@ -156,11 +156,43 @@ public:
   //! Returns the world-space coordinate given a camera-space coordinate.
   Vector cameraToWorld(const Vector &csP, const PTime time) const;
 
+  //! Transforms wsP to raster space and to camera space. Occluders that 
+  //! look up deep maps need both, and subclasses can share the work 
+  //! between the two. The default implementation calls worldToRaster() 
+  //! and worldToCamera().
+  virtual void worldToRasterAndCamera(const Vector &wsP, const PTime time,
+                                      Vector &rsP, Vector &csP) const;
+
   //! Returns the world to camera transform matrices
   const MatrixVec& worldToCameraMatrices() const;
   //! Returns the camera to world transform matrices
   const MatrixVec& cameraToWorldMatrices() const;
 
+  // Ray generation ------------------------------------------------------------
+
+  //! Returns the ray from the camera position through the given raster-space
+  //! position. Equivalent to the ray from position() to rasterToWorld(),
+  //! but subclasses may compute it faster.
+  virtual Ray rasterRay(const float rsX, const float rsY, 
+                        const PTime time) const;
+  //! Returns the distance along the camera's ray from its start to wsP, 
+  //! i.e. the depth at which deep images rendered with the camera store 
+  //! wsP. Defaults to the distance from position().
+  virtual double rayDistance(const Vector &wsP, const PTime time) const;
+
+  // Pixel sampling ------------------------------------------------------------
+
+  //! Returns the number of horizontally adjacent pixels in raster row y 
+  //! that the Renderer traces as one, spreading their samples over the 
+  //! whole block and writing the result to each of its pixels. Cameras 
+  //! whose pixels cover much less of the view in some rows than in others
+  //! may return more than one there. Progressive renders trace every 
+  //! pixel. Defaults to 1.
+  virtual size_t pixelStride(const size_t y) const;
+  //! Returns the fraction of the pixel samples that a block of 
+  //! pixelStride() pixels in raster row y needs, in (0,1]. Defaults to 1.
+  virtual float  pixelSampleDensity(const size_t y) const;
+
   // To be implemented by subclasses -------------------------------------------
 
   //! Returns the screen-space coordinate given a world-space coordinate.
@@ -192,9 +224,14 @@ protected:
   //! transformation matrices of the camera.
   virtual void recomputeTransforms();
   //! Transforms the given point by interpolating between the two closest
-  //! matrix transformations, given a [0,1] parametric time sample
+  //! matrix transformations, given a [0,1] parametric time sample. Static
+  //! cameras only use the first matrix.
   Vector transformPoint(const Vector &p, const MatrixVec &matrices,
                         const PTime time) const;
+  //! Finds the two time samples closest to the given time, and the 
+  //! interpolation factor between them
+  void   timeSamples(const PTime time, unsigned int &first, 
+                     unsigned int &second, double &lerpFactor) const;
   //! Computes the camera to world transform at the given time
   //! \param time Time in [0,1] range
   Matrix computeCameraToWorld(const PTime time) const;
@@ -218,6 +255,10 @@ protected:
   //! Transformation matrices representing world to camera transform
   //! for the [0,dt] time interval
   MatrixVec m_worldToCamera;
+  //! Whether all of the camera's transforms are the same at every time 
+  //! sample, so that transformPoint() needs no interpolation. Subclasses 
+  //! with transforms of their own must also check those.
+  bool m_isStatic;
   
 };
 
@@ -269,6 +310,14 @@ public:
   virtual Vector worldToRaster(const Vector &wsP, const PTime time) const;
   virtual Vector rasterToWorld(const Vector &rsP, const PTime time) const;
   virtual bool canTransformNegativeCamZ() const;
+  virtual Ray rasterRay(const float rsX, const float rsY, 
+                        const PTime time) const;
+  //! Uses the static camera position, if there is one.
+  virtual double rayDistance(const Vector &wsP, const PTime time) const;
+  //! Static cameras transform to raster space from camera space, which 
+  //! takes one matrix multiply for each.
+  virtual void worldToRasterAndCamera(const Vector &wsP, const PTime time,
+                                      Vector &rsP, Vector &csP) const;
 
   // Cloning -------------------------------------------------------------------
 
@@ -281,6 +330,25 @@ protected:
 
   virtual void recomputeTransforms();
 
+  // Structs -------------------------------------------------------------------
+
+  //! The raster-space plane z = 1 in world space, at one time sample. Points
+  //! on it are affine in raster x and y, so a ray through any raster 
+  //! position costs two multiply-adds per axis instead of a 4x4 transform.
+  struct RasterPlane
+  {
+    //! World-space position of raster (0, 0)
+    Vector origin;
+    //! World-space step for one pixel in raster x
+    Vector dx;
+    //! World-space step for one pixel in raster y
+    Vector dy;
+  };
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::vector<RasterPlane> RasterPlaneVec;
+
   // Utility methods -----------------------------------------------------------
 
   //! Computes the camera to screen transform at the given time
@@ -307,6 +375,13 @@ protected:
   MatrixVec m_worldToRaster;
   //! Transformation matrix representing raster to world transform
   MatrixVec m_rasterToWorld;
+  //! Raster plane at each time sample. Used by rasterRay().
+  RasterPlaneVec m_rasterPlanes;
+  //! Camera to raster transform. The field of view is sampled at shutter
+  //! open, so this is the same at every time sample.
+  Matrix m_cameraToRaster;
+  //! Camera position, if it's static
+  Vector m_staticPosition;
 
 private:
 
@@ -317,6 +392,102 @@ private:
 
 };
 
+//----------------------------------------------------------------------------//
+// OrthographicCamera
+//----------------------------------------------------------------------------//
+
+/*! \brief An orthographic projection camera
+
+  All rays are parallel to the view axis and start on the image plane, which
+  passes through the camera's position. Mainly used for the transmittance
+  maps of directional lights, where a perspective camera would have to be 
+  placed very far away with a tiny field of view.
+
+  Screen space x and y are in [-1, 1] across the frame, and screen and 
+  raster space depth are the same as camera space depth.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC OrthographicCamera : public Camera
+{
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(OrthographicCamera);
+
+  // Constructor, destructor, factory ------------------------------------------
+
+  //! Constructs a default OrthographicCamera 
+  OrthographicCamera();
+
+  PVR_DEFINE_CREATE_FUNC(OrthographicCamera);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets the world space width of the frame. The height follows from the
+  //! aspect ratio of the resolution. Defaults to 10.0.
+  void   setWidth(const double width);
+  //! Returns the world space width of the frame
+  double width() const;
+
+  // From Camera ---------------------------------------------------------------
+  
+  PVR_DEFINE_STATIC_CLONE_FUNC(OrthographicCamera);
+
+  virtual Vector worldToScreen(const Vector &wsP, const PTime time) const;
+  virtual Vector screenToWorld(const Vector &ssP, const PTime time) const;
+  virtual Vector worldToRaster(const Vector &wsP, const PTime time) const;
+  virtual Vector rasterToWorld(const Vector &rsP, const PTime time) const;
+  //! Returns false, since the rays start at the image plane and nothing 
+  //! behind it is seen.
+  virtual bool canTransformNegativeCamZ() const;
+  virtual Ray rasterRay(const float rsX, const float rsY, 
+                        const PTime time) const;
+  //! Returns the camera space depth, which is zero behind the image plane.
+  virtual double rayDistance(const Vector &wsP, const PTime time) const;
+  //! Static cameras transform to raster space from camera space, which 
+  //! takes one matrix multiply for each.
+  virtual void worldToRasterAndCamera(const Vector &wsP, const PTime time,
+                                      Vector &rsP, Vector &csP) const;
+
+  // Cloning -------------------------------------------------------------------
+
+  OrthographicCamera::Ptr clone() const
+  { return OrthographicCamera::Ptr(rawClone()); }
+
+protected:
+  
+  // From Camera ---------------------------------------------------------------
+
+  virtual void recomputeTransforms();
+
+  // Protected data members ----------------------------------------------------
+
+  //! World space width of the frame
+  double m_width;
+
+  //! Transformation matrix representing world to screen transform
+  MatrixVec m_worldToScreen;
+  //! Transformation matrix representing screen to world transform
+  MatrixVec m_screenToWorld;
+  //! Transformation matrix representing world to raster transform
+  MatrixVec m_worldToRaster;
+  //! Transformation matrix representing raster to world transform
+  MatrixVec m_rasterToWorld;
+  //! Camera to raster transform, which doesn't change over time
+  Matrix m_cameraToRaster;
+
+private:
+
+  // Cloning -------------------------------------------------------------------
+  
+  virtual OrthographicCamera* rawClone() const
+  { return new OrthographicCamera(*this); }
+
+};
+
 //----------------------------------------------------------------------------//
 // SphericalCoords
 //----------------------------------------------------------------------------//
@@ -356,6 +527,14 @@ struct SphericalCoords
   Raster space depth is translated to world space distance directly, so the
   camera has no near and far plane.
 
+  Pixels cover solid angle in proportion to the cosine of their latitude,
+  so rows near the poles oversample the same few directions. With 
+  solid angle sampling enabled, the number of pixel samples scales with 
+  the cosine. With solid angle resolution enabled, those rows are traced 
+  as blocks of about 1 / cos(latitude) pixels, each covering about as 
+  much solid angle as a pixel on the equator, and every pixel of a block 
+  gets its result.
+
  */
 
 //----------------------------------------------------------------------------//
@@ -370,7 +549,19 @@ public:
 
   // Constructor, destructor, factory ------------------------------------------
 
+  //! Constructs a default SphericalCamera
+  SphericalCamera();
+
   PVR_DEFINE_CREATE_FUNC(SphericalCamera);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets whether the number of pixel samples scales with the solid angle 
+  //! that the pixels of each row cover. Off by default.
+  void setSolidAngleSampling(const bool enabled);
+  //! Sets whether rows near the poles are traced at lower horizontal 
+  //! resolution. Off by default.
+  void setSolidAngleResolution(const bool enabled);
   
   // From Camera ---------------------------------------------------------------
   
@@ -381,6 +572,11 @@ public:
   virtual Vector worldToRaster(const Vector &wsP, const PTime time) const;
   virtual Vector rasterToWorld(const Vector &rsP, const PTime time) const;
   virtual bool canTransformNegativeCamZ() const;
+  //! About 1 / cos(latitude) with solid angle resolution enabled
+  virtual size_t pixelStride(const size_t y) const;
+  //! The solid angle covered by a block of pixelStride() pixels, relative
+  //! to a pixel on the equator, with solid angle sampling enabled
+  virtual float  pixelSampleDensity(const size_t y) const;
 
   // Cloning -------------------------------------------------------------------
 
@@ -399,6 +595,8 @@ protected:
   SphericalCoords cartToSphere(const Vector &cs) const;
   //! Transforms spherical coordinates to cartesian coordinates
   Vector sphereToCart(const SphericalCoords &ss) const;
+  //! Returns the cosine of the latitude at the center of raster row y
+  double rowCosLatitude(const size_t y) const;
 
   // Protected data members ----------------------------------------------------
   
@@ -406,6 +604,10 @@ protected:
   Matrix m_screenToRaster;
   //! Pre-computed raster to screen transform. This is never time-depedent.
   Matrix m_rasterToScreen;
+  //! Whether pixel samples scale with solid angle
+  bool   m_doSolidAngleSampling;
+  //! Whether horizontal resolution scales with solid angle
+  bool   m_doSolidAngleResolution;
 
 private:
 
@@ -0,0 +1,381 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file CompressedBuffer.h
+  Contains the CompressedBuffer class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_COMPRESSEDBUFFER_H__
+#define __INCLUDED_PVR_COMPRESSEDBUFFER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <algorithm>
+#include <vector>
+
+// Library headers
+
+#include <boost/shared_ptr.hpp>
+
+#include <Field3D/SparseField.h>
+
+// Project headers
+
+#include "pvr/BlockCache.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+
+//----------------------------------------------------------------------------//
+// Helper functions
+//----------------------------------------------------------------------------//
+
+//! Returns the size of one channel of a voxel. The block cache shuffles 
+//! the bytes of each channel, rather than those of the whole voxel.
+template <typename Data_T>
+size_t voxelChannelSize(const Data_T &)
+{ return sizeof(Data_T); }
+
+//! Vector voxels have three channels
+template <typename T>
+size_t voxelChannelSize(const Imath::Vec3<T> &)
+{ return sizeof(T); }
+
+//----------------------------------------------------------------------------//
+// CompressedBuffer
+//----------------------------------------------------------------------------//
+
+/*! \class CompressedBuffer
+  \brief Read-only sparse buffer that keeps each allocated block
+  compressed, and decompresses blocks into the per-thread Sys::BlockCache
+  as they are read.
+
+  Compression is lossless. Blocks that don't compress are stored as they
+  are, and read without going through the cache. The block layout is taken
+  from the SparseField that the buffer is created from, and unallocated
+  blocks stay unallocated.
+
+  The interface mirrors the parts of Field3D::SparseField that VoxelVolume
+  uses. Voxel coordinates are the same as in the original field.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class CompressedBuffer
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(CompressedBuffer);
+  typedef Data_T value_type;
+
+  // Ctor ----------------------------------------------------------------------
+
+  //! Compresses the given field, keeping its blocks.
+  explicit CompressedBuffer(const Field3D::SparseField<Data_T> &field);
+  //! Compresses any DenseField, or anything else with extents(),
+  //! dataWindow(), mapping() and fastValue(), in blocks of 2^blockOrder
+  //! voxels on a side. Blocks whose voxels all have the same value are
+  //! left unallocated.
+  template <typename Field_T>
+  explicit CompressedBuffer(const Field_T &field, const int blockOrder = 4);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the value of the given voxel, which must be inside the data
+  //! window.
+  Data_T fastValue(int i, int j, int k) const;
+  //! Same as fastValue(). Provided for Field3D-style code.
+  Data_T value(const int i, const int j, const int k) const
+  { return fastValue(i, j, k); }
+  //! Returns the voxels of an allocated block, indexed by blockOffset().
+  //! The pointer may be into the calling thread's block cache, and is then
+  //! only valid until the thread's next lookup into a compressed buffer.
+  const Data_T* blockData(const int bi, const int bj, const int bk) const
+  { return blockData(blockId(bi, bj, bk)); }
+  //! Returns the index in blockData() of a voxel, given its coordinates
+  //! relative to the block's first voxel.
+  int blockOffset(const int i, const int j, const int k) const
+  { return i + ((j + (k << m_blockOrder)) << m_blockOrder); }
+  //! Returns the mapping of the original field
+  const Field3D::FieldMapping::Ptr& mapping() const
+  { return m_mapping; }
+  //! Returns the extents of the original field
+  const Field3D::Box3i& extents() const
+  { return m_extents; }
+  //! Returns the data window of the original field
+  const Field3D::Box3i& dataWindow() const
+  { return m_dataWindow; }
+  //! Returns the block order, i.e. log2 of the block size
+  int blockOrder() const
+  { return m_blockOrder; }
+  //! Returns the block size, in voxels
+  int blockSize() const
+  { return 1 << m_blockOrder; }
+  //! Returns the number of blocks along each axis
+  const Imath::V3i& blockRes() const
+  { return m_blockRes; }
+  //! Returns the block containing the given voxel. The voxel coordinate is
+  //! relative to the data window's minimum, just like in SparseField.
+  void getBlockCoord(const int i, const int j, const int k,
+                     int &bi, int &bj, int &bk) const
+  { bi = i >> m_blockOrder; bj = j >> m_blockOrder; bk = k >> m_blockOrder; }
+  //! Returns whether the given block holds voxel data.
+  bool blockIsAllocated(const int bi, const int bj, const int bk) const
+  { return !m_blocks[blockId(bi, bj, bk)].bytes.empty(); }
+  //! Returns the value of all voxels in an unallocated block.
+  Data_T getBlockEmptyValue(const int bi, const int bj, const int bk) const
+  { return m_blocks[blockId(bi, bj, bk)].emptyValue; }
+  //! Returns the memory use of the buffer, in bytes. Decompressed blocks
+  //! are held by the block cache, and aren't included.
+  size_t memSize() const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Block
+  {
+    Block()
+      : emptyValue(0.0f), isPacked(false)
+    { }
+    //! Value used if the block has no data
+    Data_T                     emptyValue;
+    //! Whether bytes holds compressed data, rather than the voxels
+    //! themselves
+    bool                       isPacked;
+    //! Compressed or plain voxels. Empty for unallocated blocks.
+    std::vector<unsigned char> bytes;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  int blockId(const int bi, const int bj, const int bk) const
+  { return bi + m_blockRes.x * (bj + m_blockRes.y * bk); }
+  //! Returns the number of voxels stored per block
+  size_t blockVoxels() const
+  { return static_cast<size_t>(1) << (3 * m_blockOrder); }
+  //! Copies the voxels of a block out of the field, padding voxels outside
+  //! the data window with the first one.
+  //! \returns Whether all voxels have the same value.
+  template <typename Field_T>
+  bool gather(const Field_T &field, const Imath::V3i &block,
+              std::vector<Data_T> &voxels) const;
+  //! Stores the voxels in the block
+  void store(const std::vector<Data_T> &voxels, Block &block) const;
+  //! Returns the voxels of the given allocated block
+  const Data_T* blockData(const int id) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! Identifies the buffer's blocks in the block cache
+  size_t                     m_id;
+  Field3D::FieldMapping::Ptr m_mapping;
+  Field3D::Box3i             m_extents;
+  Field3D::Box3i             m_dataWindow;
+  int                        m_blockOrder;
+  Imath::V3i                 m_blockRes;
+  std::vector<Block>         m_blocks;
+
+};
+
+//----------------------------------------------------------------------------//
+// Template implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+CompressedBuffer<Data_T>::CompressedBuffer
+(const Field3D::SparseField<Data_T> &field)
+  : m_id(Sys::BlockCache::newBufferId()),
+    m_mapping(field.mapping()),
+    m_extents(field.extents()),
+    m_dataWindow(field.dataWindow()),
+    m_blockOrder(field.blockOrder()),
+    m_blockRes(field.blockRes()),
+    m_blocks(m_blockRes.x * m_blockRes.y * m_blockRes.z)
+{
+  std::vector<Data_T> voxels;
+  for (int bk = 0; bk < m_blockRes.z; ++bk) {
+    for (int bj = 0; bj < m_blockRes.y; ++bj) {
+      for (int bi = 0; bi < m_blockRes.x; ++bi) {
+        Block &block = m_blocks[blockId(bi, bj, bk)];
+        if (!field.blockIsAllocated(bi, bj, bk)) {
+          block.emptyValue = field.getBlockEmptyValue(bi, bj, bk);
+          continue;
+        }
+        gather(field, Imath::V3i(bi, bj, bk), voxels);
+        store(voxels, block);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+template <typename Field_T>
+CompressedBuffer<Data_T>::CompressedBuffer(const Field_T &field,
+                                           const int blockOrder)
+  : m_id(Sys::BlockCache::newBufferId()),
+    m_mapping(field.mapping()),
+    m_extents(field.extents()),
+    m_dataWindow(field.dataWindow()),
+    m_blockOrder(blockOrder)
+{
+  const int blockSize = 1 << m_blockOrder;
+  m_blockRes = (m_dataWindow.size() + Imath::V3i(blockSize)) / blockSize;
+  if (m_dataWindow.isEmpty()) {
+    m_blockRes = Imath::V3i(0);
+  }
+  m_blocks.resize(m_blockRes.x * m_blockRes.y * m_blockRes.z);
+
+  std::vector<Data_T> voxels;
+  for (int bk = 0; bk < m_blockRes.z; ++bk) {
+    for (int bj = 0; bj < m_blockRes.y; ++bj) {
+      for (int bi = 0; bi < m_blockRes.x; ++bi) {
+        Block &block = m_blocks[blockId(bi, bj, bk)];
+        if (gather(field, Imath::V3i(bi, bj, bk), voxels)) {
+          block.emptyValue = voxels[0];
+        } else {
+          store(voxels, block);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+Data_T CompressedBuffer<Data_T>::fastValue(int i, int j, int k) const
+{
+  i -= m_dataWindow.min.x;
+  j -= m_dataWindow.min.y;
+  k -= m_dataWindow.min.z;
+  const int id =
+    blockId(i >> m_blockOrder, j >> m_blockOrder, k >> m_blockOrder);
+  const Block &block = m_blocks[id];
+  if (block.bytes.empty()) {
+    return block.emptyValue;
+  }
+  const int mask = (1 << m_blockOrder) - 1;
+  return blockData(id)[blockOffset(i & mask, j & mask, k & mask)];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+size_t CompressedBuffer<Data_T>::memSize() const
+{
+  size_t size = sizeof(*this) + m_blocks.size() * sizeof(Block);
+  for (size_t i = 0, end = m_blocks.size(); i < end; ++i) {
+    size += m_blocks[i].bytes.size();
+  }
+  return size;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+template <typename Field_T>
+bool CompressedBuffer<Data_T>::gather(const Field_T &field,
+                                      const Imath::V3i &block,
+                                      std::vector<Data_T> &voxels) const
+{
+  const int        blockSize = 1 << m_blockOrder;
+  const Imath::V3i min       = m_dataWindow.min + block * blockSize;
+  const Imath::V3i max =
+    Imath::V3i(std::min(min.x + blockSize - 1, m_dataWindow.max.x),
+               std::min(min.y + blockSize - 1, m_dataWindow.max.y),
+               std::min(min.z + blockSize - 1, m_dataWindow.max.z));
+  const Data_T first = field.fastValue(min.x, min.y, min.z);
+  voxels.assign(blockVoxels(), first);
+  bool isConstant = true;
+  for (int k = min.z; k <= max.z; ++k) {
+    for (int j = min.y; j <= max.y; ++j) {
+      for (int i = min.x; i <= max.x; ++i) {
+        const Data_T value = field.fastValue(i, j, k);
+        voxels[blockOffset(i - min.x, j - min.y, k - min.z)] = value;
+        isConstant = isConstant && value == first;
+      }
+    }
+  }
+  return isConstant;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void CompressedBuffer<Data_T>::store(const std::vector<Data_T> &voxels,
+                                     Block &block) const
+{
+  const size_t bytes = voxels.size() * sizeof(Data_T);
+  block.isPacked = Sys::BlockCache::compress(&voxels[0], bytes, 
+                                             voxelChannelSize(voxels[0]),
+                                             block.bytes);
+  if (!block.isPacked) {
+    const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(&voxels[0]);
+    block.bytes.assign(data, data + bytes);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+const Data_T* CompressedBuffer<Data_T>::blockData(const int id) const
+{
+  const Block &block = m_blocks[id];
+  if (!block.isPacked) {
+    return reinterpret_cast<const Data_T *>(&block.bytes[0]);
+  }
+  if (const void *data = Sys::BlockCache::find(m_id, id)) {
+    return static_cast<const Data_T *>(data);
+  }
+  const size_t bytes = blockVoxels() * sizeof(Data_T);
+  Data_T *data = 
+    static_cast<Data_T *>(Sys::BlockCache::insert(m_id, id, bytes));
+  Sys::BlockCache::decompress(block.bytes, voxelChannelSize(block.emptyValue),
+                              data, bytes);
+  return data;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
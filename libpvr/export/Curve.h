@@ -34,7 +34,10 @@
 
 // System headers
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <limits>
 #include <vector>
 
 // Library headers
@@ -102,12 +105,24 @@ public:
   // Main methods --------------------------------------------------------------
 
   //! Adds a sample point to the curve.
+  //! \note Samples that are added in increasing t order (as during 
+  //! raymarching) are appended in constant time.
   //! \param t Sample position
   //! \param value Sample value
   void               addSample(const float t, const T &value);
-  //! Interpolates a value from the curve.
+  //! Moves the last sample point. The new position must not be before 
+  //! that of the sample preceding it.
+  void               setLastSample(const float t, const T &value);
+  //! Interpolates a value from the curve. Uses a binary search to find the
+  //! nearest two sample points.
   //! \param t Position along curve
   T                  interpolate(const float t) const;
+  //! Interpolates a value from the curve, starting the search for the 
+  //! nearest two sample points at the given index. Successive lookups at
+  //! nearby positions only walk the curve between them.
+  //! \param t Position along curve
+  //! \param index Index of the lower sample point. Updated on return.
+  T                  interpolate(const float t, size_t &index) const;
   //! Returns number of samples in curve
   size_t             numSamples() const;
   //! Returns a const reference to the samples in the curve.
@@ -120,23 +135,28 @@ public:
   void               removeDuplicates();
   //! Average a set of Curves into a single one.
   static CPtr        average(const std::vector<CPtr> &curves);
+  //! Averages a set of Curves into the given samples, which are replaced.
+  //! The result has as many evenly spaced samples as the longest curve, 
+  //! and takes time linear in the total number of samples.
+  static void        average(const std::vector<CPtr> &curves, 
+                             SampleVec &result);
 
 private:
   
   // Structs -------------------------------------------------------------------
 
-  //! Used when looking up values in the m_samples vector.
-  struct CheckTGreaterThan : 
-    public std::unary_function<std::pair<float, T>, bool>
+  //! Used with std::upper_bound() when looking up values in the m_samples 
+  //! vector.
+  struct CompareT
   {
-    CheckTGreaterThan(float match)
-      : m_match(match)
-    { }
-    bool operator()(const std::pair<float, T> &test)
+    bool operator()(const float t, const Sample &sample) const
+    {
+      return t < sample.first;
+    }
+    bool operator()(const Sample &sample, const float t) const
     {
-      return test.first > m_match;
+      return sample.first < t;
     }
-    float m_match;
   };
 
   // Utility methods -----------------------------------------------------------
@@ -187,18 +207,27 @@ template <typename T>
 void Curve<T>::addSample(const float t, const T &value)
 {
   using namespace std;
-  // Find the first sample location that is greater than the interpolation
-  // position
-  typename SampleVec::iterator i = 
-    find_if(m_samples.begin(), m_samples.end(), CheckTGreaterThan(t));
-  // If we get something other than end() back then we insert the new
-  // sample before that. If there wasn't a larger value we add this sample
-  // to the end of the vector.
-  if (i != m_samples.end()) {
-    m_samples.insert(i, make_pair(t, value));
-  } else {
+  // If the sample is past the last one we append it directly
+  if (m_samples.empty() || t >= m_samples.back().first) {
     m_samples.push_back(make_pair(t, value));
+    return;
   }
+  // Find the first sample location that is greater than the new sample's
+  // position, and insert the new sample before that.
+  typename SampleVec::iterator i = 
+    upper_bound(m_samples.begin(), m_samples.end(), t, CompareT());
+  m_samples.insert(i, make_pair(t, value));
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void Curve<T>::setLastSample(const float t, const T &value)
+{
+  assert(!m_samples.empty() && "Curve has no samples");
+  assert((m_samples.size() < 2 || t >= m_samples[m_samples.size() - 2].first)
+         && "Sample moved past its predecessor");
+  m_samples.back() = std::make_pair(t, value);
 }
 
 //----------------------------------------------------------------------------//
@@ -214,7 +243,7 @@ T Curve<T>::interpolate(const float t) const
   // Find the first sample location that is greater than the interpolation
   // position
   typename SampleVec::const_iterator i = 
-    find_if(m_samples.begin(), m_samples.end(), CheckTGreaterThan(t));
+    upper_bound(m_samples.begin(), m_samples.end(), t, CompareT());
   // If we get end() back then there was no sample larger, so we return the
   // last value. If we got the first value then there is only one value and
   // we return that.
@@ -232,6 +261,38 @@ T Curve<T>::interpolate(const float t) const
 
 //----------------------------------------------------------------------------//
 
+template <typename T>
+T Curve<T>::interpolate(const float t, size_t &index) const
+{
+  // If there are no samples, return zero
+  if (m_samples.size() == 0) {
+    return defaultReturnValue();
+  }
+  // Walk to the last sample location that is not greater than the 
+  // interpolation position
+  const size_t last = m_samples.size() - 1;
+  index = std::min(index, last);
+  while (index < last && m_samples[index + 1].first <= t) {
+    ++index;
+  }
+  while (index > 0 && m_samples[index].first > t) {
+    --index;
+  }
+  // Outside the curve we return the end values, same as interpolate(t).
+  if (index == last) {
+    return m_samples.back().second;
+  } else if (t < m_samples[index].first) {
+    return m_samples.front().second;
+  }
+  // Interpolate between the nearest two samples.
+  const Sample &lower = m_samples[index];
+  const Sample &upper = m_samples[index + 1];
+  const float interpT = Imath::lerpfactor(t, lower.first, upper.first);
+  return lerp(lower, upper, interpT);
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename T>
 std::vector<float> Curve<T>::samplePoints() const
 {
@@ -293,39 +354,56 @@ template <typename T>
 typename Curve<T>::CPtr 
 Curve<T>::average(const std::vector<typename Curve<T>::CPtr> &curves)
 {
-  typename Curve<T>::Ptr result(new Curve<T>);
-
-  if (curves.size() == 0) {
-    return result;
-  }
-
   if (curves.size() == 1) {
     return curves[0];
   }
 
+  typename Curve<T>::Ptr result(new Curve<T>);
+  average(curves, result->m_samples);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void Curve<T>::average(const std::vector<typename Curve<T>::CPtr> &curves,
+                       SampleVec &result)
+{
+  result.clear();
+
   // Find first and last sample in all curves
-  float first = std::numeric_limits<float>::max();
-  float last = std::numeric_limits<float>::min();
+  float  first      = std::numeric_limits<float>::max();
+  float  last       = -std::numeric_limits<float>::max();
   size_t numSamples = 0;
   for (size_t c = 0, numCurves = curves.size(); c < numCurves; ++c) {
-    first = std::min(first, curves[c]->samplePoints().front());
-    last = std::max(last, curves[c]->samplePoints().back());
-    numSamples = std::max(numSamples, curves[c]->samplePoints().size());
+    const SampleVec &samples = curves[c]->m_samples;
+    if (samples.empty()) {
+      continue;
+    }
+    first      = std::min(first, samples.front().first);
+    last       = std::max(last, samples.back().first);
+    numSamples = std::max(numSamples, samples.size());
+  }
+  if (numSamples == 0) {
+    return;
   }
 
-  // Average curves
+  // Average curves. The sample positions increase, so each curve's cursor
+  // only moves forward, and each curve is walked once.
+  std::vector<size_t> cursors(curves.size(), 0);
+  const float         scale = 1.0f / curves.size();
+  const float         dt    = numSamples > 1 ? 
+    (last - first) / static_cast<float>(numSamples - 1) : 0.0f;
+  result.reserve(numSamples);
   for (size_t i = 0; i < numSamples; ++i) {
+    const float t = i + 1 < numSamples ? first + dt * i : last;
     T value = defaultReturnValue();
-    float t = Math::fit(static_cast<float>(i), 0.0f, 
-                        static_cast<float>(numSamples - 1), first, last);
     for (size_t c = 0, numCurves = curves.size(); c < numCurves; ++c) {
-      value += curves[c]->interpolate(t);
+      value += curves[c]->interpolate(t, cursors[c]);
     }
-    value *= 1.0 / curves.size();
-    result->addSample(t, value);
+    value *= scale;
+    result.push_back(std::make_pair(t, value));
   }
-
-  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -34,9 +34,15 @@
 
 // System headers
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 // Library headers
 
+#include <boost/cstdint.hpp>
 #include <boost/foreach.hpp>
+#include <OpenEXR/half.h>
 
 // Project headers
 
@@ -44,6 +50,7 @@
 #include "pvr/Curve.h"
 #include "pvr/Interpolation.h"
 #include "pvr/Log.h"
+#include "pvr/Memory.h"
 #include "pvr/StlUtil.h"
 
 //----------------------------------------------------------------------------//
@@ -59,7 +66,15 @@ namespace Render {
 
 /*! \class DeepImage 
   \brief Stores a 2d array of Curve<Color> (a deep image).
-  PVR uses a fixed number of samples per pixel.
+
+  Each pixel function is simplified when it is set, so that it uses as few
+  knots as possible while staying within maxError() of the original curve,
+  and never more than numSamples() knots. Knots store their values as half
+  floats.
+
+  While an image is being built, each pixel owns its knots, so different
+  threads may set different pixels at the same time. compact() then packs
+  all knots into a single array.
  */
 
 //----------------------------------------------------------------------------//
@@ -73,15 +88,51 @@ public:
   PVR_TYPEDEF_SMART_PTRS(DeepImage);
   typedef Util::ColorCurve Curve;
 
+  // Enums ---------------------------------------------------------------------
+
+  //! What the pixel functions hold. This decides how the image is stored in
+  //! OpenEXR deep files.
+  enum Contents {
+    //! Transmittance as a function of depth. Stored as per-sample opacity 
+    //! in the A, AR, AG and AB channels.
+    Transmittance,
+    //! Accumulated luminance as a function of depth. Stored as per-sample
+    //! luminance in the R, G and B channels.
+    Luminance
+  };
+
+  // Structs -------------------------------------------------------------------
+
+  //! Remembers where the last lerp() found its samples in each of the four
+  //! pixels it interpolated, so that lookups at nearby depths only walk 
+  //! the pixel functions between them.
+  struct LerpCursor
+  {
+    LerpCursor()
+    { std::fill(index, index + 4, 0); }
+    size_t index[4];
+  };
+
   // Constructor, destructor, factory ------------------------------------------
 
   //! Default constructor. Creates a 2x2 image.
   DeepImage();
 
+  //! Copies the image into compact storage
+  DeepImage(const DeepImage &other);
+
+  //! Releases the pixel functions
+  ~DeepImage();
+
   //! Factory creation function. Always use this when creating objects
   //! that need lifespan management.
   static Ptr create();
 
+  // Operators -----------------------------------------------------------------
+
+  //! Copies the image into compact storage
+  DeepImage& operator = (const DeepImage &other);
+
   //! Clones the instance. Will clear all the non-const data members but keeps
   //! pointers to const data members
   Ptr clone() const;
@@ -92,46 +143,183 @@ public:
   void       setSize(const size_t width, const size_t height);
   //! Returns the size of the image
   Imath::V2i size() const;
-  //! Sets the number of samples to use per pixel 
+  //! Sets the maximum number of samples to use per pixel 
   void       setNumSamples(const size_t numSamples);
-  //! Returns the number of samples per pixel
+  //! Returns the maximum number of samples per pixel
   size_t     numSamples() const;
+  //! Sets the largest error allowed when simplifying pixel functions. The 
+  //! error is absolute for curves with values up to one, such as 
+  //! transmittance, and relative to the largest value otherwise.
+  void       setMaxError(const float maxError);
+  //! Returns the largest error allowed when simplifying pixel functions
+  float      maxError() const;
   //! Sets the transmittance function of a pixel
   void       setPixel(const size_t x, const size_t y, const Curve::CPtr func);
   //! Sets the transmittance function of a pixel to a single value
   void       setPixel(const size_t x, const size_t y, const Color &value);
+  //! Sets the transmittance function of a pixel to the average of the 
+  //! given functions, such as those of a pixel's sub-samples. Same as
+  //! setPixel(x, y, Curve::average(funcs)), but the average goes into 
+  //! per-thread scratch space rather than a new curve.
+  void       setPixel(const size_t x, const size_t y, 
+                      const std::vector<Curve::CPtr> &funcs);
   //! Returns a pointer to the underlying pixel function
   //! \note Creates a mutable copy of the data.
   Curve::Ptr pixelFunction(const size_t x, const size_t y) const;
   //! Interpolated transmittance at a given raster coordinate and depth.
   Color      lerp(const float rsX, const float rsY, const float z) const;
+  //! Interpolated transmittance at a given raster coordinate and depth,
+  //! starting the search of each pixel function at the cursor.
+  Color      lerp(const float rsX, const float rsY, const float z, 
+                  LerpCursor &cursor) const;
+  //! Builds a copy of the image for lerpInterleaved(). Each pixel function
+  //! is resampled at numSamples evenly spaced depths, shared with its right,
+  //! lower and lower right neighbors, and stored next to theirs. A lookup 
+  //! then finds its samples without searching and blends the four pixels 
+  //! in one go.
+  //! \note The copy uses 48 * numSamples bytes per pixel and isn't updated
+  //! by setPixel(). Call again after changing the image.
+  void       interleave(const size_t numSamples);
+  //! Returns whether interleave() has been called
+  bool       isInterleaved() const;
+  //! Interpolated transmittance at a given raster coordinate and depth,
+  //! looked up in the copy built by interleave().
+  Color      lerpInterleaved(const float rsX, const float rsY, 
+                             const float z) const;
   //! Prints statistics about the image
   void       printStats() const;
+  //! Approximate memory used by the image, in bytes
+  size_t     memSize() const;
+  //! Packs all pixel functions into a single array. Call once the image is
+  //! complete. 
+  //! \note Setting pixels after this is allowed, but not from multiple 
+  //! threads at once.
+  void       compact();
+  //! Copies the pixels of a partial image that have knots. Merging the 
+  //! parts of a split render assembles the frame. See Renderer::setSplit().
+  //! \returns false if the images differ in size
+  bool       merge(const DeepImage &part);
+  //! Copies the pixels of another image of the same size from (x0, y0) up
+  //! to but not including (x1, y1), knots and all. Used to checkpoint the
+  //! finished tiles of a render. See Renderer::setCheckpoint().
+  //! \returns false if the images differ in size
+  bool       copyPixels(const DeepImage &source, 
+                        const size_t x0, const size_t y0, 
+                        const size_t x1, const size_t y1);
+
+  // I/O -----------------------------------------------------------------------
+
+  //! Writes the image to disk. Filenames ending in .exr are written as 
+  //! OpenEXR deep scanline files, with one deep sample per curve sample, 
+  //! that other deep compositing tools can read. Other filenames are 
+  //! written as PVR deep image files, which store each pixel function as 
+  //! is.
+  //! \param contents What the pixel functions hold. Only used for OpenEXR.
+  //! \returns false if the file couldn't be written
+  bool       write(const std::string &filename, 
+                   const Contents contents = Transmittance) const;
+  //! Creates a new DeepImage from a file written by write(). OpenEXR deep
+  //! files written by other applications can be read if they have A or 
+  //! R, G, B channels.
+  //! \returns A null pointer if the file couldn't be read
+  static Ptr read(const std::string &filename);
 
 private:
   
+  // Structs -------------------------------------------------------------------
+
+  //! A sample of a pixel function
+  struct Knot
+  {
+    float z;
+    half  value[3];
+  };
+
+  //! The knots of a pixel function. Points either into a heap block owned 
+  //! by the pixel, or into m_arena once the image is compact.
+  struct PixelRef
+  {
+    PixelRef() 
+      : knots(NULL), count(0)
+    { }
+    Knot            *knots;
+    boost::uint32_t  count;
+  };
+
+  //! Depth range of an interleaved cell
+  struct CellRange
+  {
+    float zMin;
+    //! Converts depth relative to zMin to a sample index
+    float zScale;
+  };
+
   // Typedefs ------------------------------------------------------------------
 
-  typedef std::vector<Util::ColorCurve> PixelsVec;
+  typedef std::vector<Knot>      KnotVec;
+  typedef std::vector<PixelRef>  PixelRefVec;
+  typedef std::vector<CellRange> CellRangeVec;
 
   // Utility methods -----------------------------------------------------------
 
-  //! Returns a const reference to the given pixel's color curve
-  const Util::ColorCurve& pixel(const size_t x, const size_t y) const;
-
-  //! Returns a reference to the given pixel's color curve.
-  Util::ColorCurve& pixel(const size_t x, const size_t y);
+  //! Writes the image to an OpenEXR deep scanline file
+  bool       writeExr(const std::string &filename, 
+                      const Contents contents) const;
+  //! Reads an image from an OpenEXR deep scanline file
+  static Ptr readExr(const std::string &filename);
+
+  //! Makes room for count knots in the given pixel
+  //! \returns The pixel's knots
+  Knot*      allocatePixel(const size_t idx, const size_t count);
+  //! Simplifies the samples into the knots of the given pixel
+  void       simplifyPixel(const size_t idx, 
+                           const Util::ColorCurve::SampleVec &samples);
+  //! Stores the samples as the knots of the given pixel, without 
+  //! simplification
+  void       storePixel(const size_t idx, 
+                        const Util::ColorCurve::SampleVec &samples);
+  //! Gives each pixel its own copy of its knots, so that pixels can be set
+  void       expand();
+  //! Frees the pixels' knots
+  void       release();
+  //! Reports the current memSize() to the memory accounting. Called after
+  //! resizing, compacting, merging and interleaving, not per pixel.
+  void       updateMemory();
+
+  //! Returns the given pixel's knots
+  const PixelRef& pixel(const size_t x, const size_t y) const;
+
+  //! Interpolates a pixel function
+  static Color interpolate(const PixelRef &p, const float z);
+  //! Interpolates a pixel function, starting the search at the given knot.
+  //! See Curve::interpolate().
+  static Color interpolate(const PixelRef &p, const float z, size_t &index);
 
   // Private data members ------------------------------------------------------
 
-  //! Stores the samples that define the DeepImage.
-  PixelsVec  m_pixels;
+  //! Knots of each pixel
+  PixelRefVec m_pixels;
+  //! Stores all knots once the image is compact
+  KnotVec     m_arena;
+  //! Whether the knots are stored in m_arena
+  bool        m_isCompact;
   //! Width of image
-  size_t     m_width;
+  size_t      m_width;
   //! Height of image
-  size_t     m_height;
-  //! Number of samples per pixel
-  size_t     m_numSamples;
+  size_t      m_height;
+  //! Maximum number of samples per pixel
+  size_t      m_numSamples;
+  //! Largest error allowed when simplifying pixel functions
+  float       m_maxError;
+  //! Samples of the interleaved cells. For each cell and sample, holds the
+  //! red values of the cell's four pixels, then green, then blue.
+  std::vector<float> m_cells;
+  //! Depth range of each interleaved cell
+  CellRangeVec       m_cellRanges;
+  //! Number of samples per interleaved cell. Zero if not interleaved.
+  size_t             m_cellSamples;
+  //! Accounts for the memory used by the image
+  Sys::Memory::Tracker m_memory;
 
 };
 
@@ -139,23 +327,9 @@ private:
 // Inline methods
 //----------------------------------------------------------------------------//
 
-inline const Util::ColorCurve& 
+inline const DeepImage::PixelRef& 
 DeepImage::pixel(const size_t x, const size_t y) const
 {
-  assert(x >= 0 && "DeepImage::pixel(): x less than zero");
-  assert(y >= 0 && "DeepImage::pixel(): y less than zero");
-  assert(x < m_width  && "DeepImage::pixel(): x out of range");
-  assert(y < m_height && "DeepImage::pixel(): y out of range");
-  return m_pixels[x + y * m_width];
-}
-
-//----------------------------------------------------------------------------//
-
-inline Util::ColorCurve& 
-DeepImage::pixel(const size_t x, const size_t y) 
-{
-  assert(x >= 0 && "DeepImage::pixel(): x less than zero");
-  assert(y >= 0 && "DeepImage::pixel(): y less than zero");
   assert(x < m_width  && "DeepImage::pixel(): x out of range");
   assert(y < m_height && "DeepImage::pixel(): y out of range");
   return m_pixels[x + y * m_width];
@@ -165,7 +339,8 @@ DeepImage::pixel(const size_t x, const size_t y)
 // Utility Functions
 //----------------------------------------------------------------------------//
 
-//! Converts a ColorCurve to a curve with a fixed number of samples
+//! Converts a ColorCurve to a curve with a fixed number of samples. Curves
+//! that are monotonic are sampled evenly in value, others evenly in depth.
 Util::ColorCurve::Ptr makeFixedSample(Util::ColorCurve::CPtr curve,
                                       const size_t numSamples);
 
@@ -0,0 +1,147 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Denoiser.h
+  Contains the Denoiser class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_DENOISER_H__
+#define __INCLUDED_PVR_DENOISER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Image.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// Denoiser
+//----------------------------------------------------------------------------//
+
+/*! \class Denoiser
+  \brief Removes the noise of a low-sample render with a non-local means
+  filter, guided by feature images.
+
+  Each pixel becomes the weighted average of the pixels within radius() of
+  it. A neighbor's weight falls off with the difference between the
+  patches of patchRadius() around the two pixels, so pixels are only
+  averaged with others that look alike, and with the difference of the
+  two pixels in each guide image, such as a depth map, so that edges in
+  the guides are kept. Color differences are relative to the brightness of
+  the pixels, which suits the wide range of a linear render. Alpha is part
+  of the patches, so the edges of a volume are kept too.
+
+  Rows are filtered in parallel. The cost grows with the square of both
+  the radius and the patch width.
+*/
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC Denoiser
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(Denoiser);
+
+  // Constructor, factory method -----------------------------------------------
+
+  //! Default constructor
+  Denoiser();
+
+  PVR_DEFINE_CREATE_FUNC(Denoiser);
+
+  // Options -------------------------------------------------------------------
+
+  //! Sets how many pixels away, along each axis, neighbors are averaged
+  //! from. Defaults to 5. Zero leaves images unchanged.
+  void   setRadius      (const size_t radius);
+  //! Returns the radius of the neighborhood
+  size_t radius         () const;
+  //! Sets the radius of the patches that are compared to weigh a neighbor.
+  //! Defaults to 1, i.e. 3x3 pixels. Zero compares single pixels, like a
+  //! bilateral filter.
+  void   setPatchRadius (const size_t radius);
+  //! Returns the radius of the patches
+  size_t patchRadius    () const;
+  //! Sets how different a patch may be and still count. Higher values
+  //! remove more noise, at the cost of detail. Defaults to 0.3.
+  void   setStrength    (const float strength);
+  //! Returns the strength of the filter
+  float  strength       () const;
+  //! Sets how different two pixels of a guide image may be and still
+  //! count, relative to their values. Defaults to 0.1.
+  void   setGuideSigma  (const float sigma);
+  //! Returns the relative falloff of the guide images
+  float  guideSigma     () const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Denoises the pixels of the image's data window. The RGB channels of
+  //! each guide are compared. Guides need the image's size and data
+  //! window, and others are ignored with a warning.
+  //! \param numThreads Zero means one per core.
+  void apply(Image &image,
+             const std::vector<Image::CPtr> &guides =
+             std::vector<Image::CPtr>(),
+             const size_t numThreads = 0) const;
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  size_t m_radius;
+  size_t m_patchRadius;
+  float  m_strength;
+  float  m_guideSigma;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
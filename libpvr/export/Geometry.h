@@ -34,6 +34,9 @@
 
 // System headers
 
+#include <string>
+#include <vector>
+
 #include <boost/lexical_cast.hpp>
 
 // Project headers
@@ -70,6 +73,7 @@ public:
   // Typedefs ------------------------------------------------------------------
 
   PVR_TYPEDEF_SMART_PTRS(Geometry);
+  typedef std::vector<std::string> StringVec;
 
   // Exceptions ----------------------------------------------------------------
 
@@ -88,9 +92,52 @@ public:
     \name File I/O
   */
 
-  //! Creates a new Geometry object from the contents of a file
-  //! \note Currently supports: .geo, .bgeo
-  static Geometry::Ptr read(const std::string &filename);
+  //! Creates a new Geometry object from the contents of a file. 
+  //! The point attributes of large primitives are copied in parallel, one
+  //! attribute per task.
+  //! \param attrNames If not empty, only these point attributes are read,
+  //! along with the position. Primitives that only use a few attributes 
+  //! can skip the rest this way.
+  //! \note Currently supports: .geo, .bgeo, and when built with 
+  //! PVR_USE_PARTIO, the particle formats that Partio reads (.pdb, .prt, 
+  //! .bin, .pda, .pdc, .ptc, .mc and so on). Partio's "position" and 
+  //! "velocity" attributes are renamed "P" and "v".
+  static Geometry::Ptr read(const std::string &filename,
+                            const StringVec &attrNames = StringVec());
+
+  //! Writes the particles and global attributes to a PVR geometry cache.
+  //! The cache stores each attribute as one contiguous column, so that
+  //! readCache() can load it without any per-point work.
+  //! \note Polygons and meshes are not written to the cache.
+  //! \returns false if the file couldn't be written
+  bool                 writeCache(const std::string &filename) const;
+
+  //! Creates a new Geometry object from a file written by writeCache(). The
+  //! file is memory mapped and each column is copied straight into its
+  //! AttrTable, without the intermediate GPD representation used by read().
+  //! \returns A null pointer if the file couldn't be read
+  static Geometry::Ptr readCache(const std::string &filename);
+
+  //! Writes the particles and global attributes to a named POSIX shared 
+  //! memory segment, in the same layout as writeCache(). An existing 
+  //! segment with the same name is replaced. This lets a process such as
+  //! Houdini hand geometry to PVR without going through the file system.
+  //! \note Not supported on Windows.
+  //! \returns false if the segment couldn't be written
+  bool                 writeShared(const std::string &name) const;
+
+  //! Creates a new Geometry object from a shared memory segment written by
+  //! writeShared() or by houdini/scripts/python/pvrshm.py. The segment is 
+  //! mapped read-only and each column is copied straight into its 
+  //! AttrTable. The segment is left in place, so the same geometry can be
+  //! read by several renders.
+  //! \returns A null pointer if the segment couldn't be read
+  static Geometry::Ptr readShared(const std::string &name);
+
+  //! Removes a shared memory segment. Processes that are reading it are 
+  //! unaffected.
+  //! \returns false if there was no such segment
+  static bool          removeShared(const std::string &name);
 
   //! \}
 
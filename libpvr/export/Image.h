@@ -34,13 +34,17 @@
 
 // System headers
 
+#include <string>
+#include <vector>
+
 // Library headers
 
-#include <OpenImageIO/imagebuf.h>
+#include <OpenEXR/ImathBox.h>
 
 // Project headers
 
 #include "pvr/export.h"
+#include "pvr/Threading.h"
 #include "pvr/Types.h"
 
 //----------------------------------------------------------------------------//
@@ -55,12 +59,15 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 /*! \class Image
-  \brief Wraps a very simple image class.
+  \brief A very simple RGBA image class.
 
   Because PVR doesn't need any fancy image operations, this class is only used
-  to store a simple RGBA images, and is not focused on efficiency. Although
-  the internal representation of the image is RGBA, it can be written to disk
-  as RGB by passing Channels::RGB to the write() method.
+  to store simple RGBA images. The pixels of the data window are stored as
+  one contiguous array of floats, so that render threads can set the pixels
+  of different tiles at the same time, and files are written with a single
+  OpenImageIO call. Although the internal representation of the image is 
+  RGBA, it can be written to disk as RGB by passing Channels::RGB to the 
+  write() method.
 */
 
 //----------------------------------------------------------------------------//
@@ -81,12 +88,27 @@ public:
     RGBA
   };
 
+  //! Pixel type of files written by write() and writeLayers(). Only used 
+  //! for formats that support it, such as EXR.
+  enum PixelType {
+    FloatPixels,
+    HalfPixels
+  };
+
   // Structs -------------------------------------------------------------------
 
   struct pixel_iterator;
+  struct Layer;
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::vector<Layer> LayerVec;
   
   // Constructor, destructor, factory ------------------------------------------
 
+  //! Default constructor. The image is empty until setSize() is called.
+  Image();
+
   //! Factory method. Use this whenever the lifespan of the image needs
   //! to be managed
   static Ptr create();
@@ -97,8 +119,14 @@ public:
 
   // Main methods --------------------------------------------------------------
 
-  //! Sets the size/resolution of the image
+  //! Sets the size/resolution of the image. The data window covers the 
+  //! whole image.
   void       setSize(const size_t width, const size_t height);
+  //! Restricts pixel storage to the given region of the image, in 
+  //! inclusive pixel coordinates. The region is clipped to the image size.
+  //! Pixels outside of it read as zero and must not be set. 
+  //! \note Clears the image
+  void       setDataWindow(const Imath::Box2i &window);
 
   //! Sets the value of a given pixel
   void       setPixel(const size_t x, const size_t y, const Color &value);
@@ -107,30 +135,113 @@ public:
 
   //! Returns the size of the image
   Imath::V2i size() const;
+  //! Returns the region of the image that has pixel storage
+  Imath::Box2i dataWindow() const;
 
   //! Returns the value of a given pixel.
   Color      pixel(const size_t x, const size_t y) const;
   //! Returns the alpha value of a given pixel
   float      pixelAlpha(const size_t x, const size_t y) const;
 
+  //! Returns the RGBA pixels of the data window, stored as floats in 
+  //! scanline order. Valid until the size or data window changes.
+  float*       pixels();
+  //! Returns the RGBA pixels of the data window. See pixels().
+  const float* pixels() const;
+
+  //! Adds the pixels of a partial render of the same image, inside this 
+  //! image's data window. Pixels that the part didn't render are zero, so
+  //! merging the parts of a split render assembles the frame. See 
+  //! Renderer::setSplit().
+  void       merge(const Image &part);
+
+  //! Sets the pixel type of written files. Defaults to FloatPixels.
+  void       setPixelType(const PixelType type);
+  //! Returns the pixel type of written files
+  PixelType  pixelType() const;
+  //! Sets the compression of written EXR files, by OpenImageIO name, e.g. 
+  //! "none", "rle", "zips", "zip", "piz", "pxr24" or "b44". Defaults to
+  //! "zip".
+  void       setCompression(const std::string &compression);
+  //! Returns the compression of written EXR files
+  const std::string& compression() const;
+
   //! Writes the image to disk. The filename extension may be any format
-  //! supported by OpenImageIO.
+  //! supported by OpenImageIO. EXR files keep the data window. Other 
+  //! formats only get the pixels inside of it. EXR files are encoded by
+  //! Sys::numThreads() threads.
   void       write(const std::string &filename, Channels channels) const;
+  //! Writes a copy of the image to disk on a background thread, so that the
+  //! image can be modified straight away. See write().
+  //! \returns The task, to wait() on before relying on the file.
+  Sys::BackgroundTask::Ptr 
+             writeAsync(const std::string &filename, Channels channels) const;
+  //! Creates a new Image from a file written by write(). The data window
+  //! is kept for EXR files.
+  //! \returns A null pointer if the file couldn't be read
+  static Ptr read(const std::string &filename);
+  //! Creates a new Image from one channel of a file, such as the Z channel
+  //! of a depth AOV. The channel's values are copied to red, green and 
+  //! blue, and alpha is one. The data window is kept, as in read().
+  //! \returns A null pointer if the file or channel couldn't be read
+  static Ptr readChannel(const std::string &filename, 
+                         const std::string &channel);
+  //! Writes several images as the layers of one multi-channel EXR file. 
+  //! The channels of a layer are called name.R, name.G and so on, or just 
+  //! R, G and so on for a layer without a name. Layer::channelNames can 
+  //! rename them. All the images must have
+  //! the same size and data window. The pixel type and compression of the
+  //! first layer's image are used.
+  //! \returns False if the file couldn't be written
+  static bool writeLayers(const std::string &filename, 
+                          const LayerVec &layers);
 
   // Iteration -----------------------------------------------------------------
 
-  //! Returns iterator to first pixel
+  //! Returns iterator to first pixel of the data window
   pixel_iterator begin();
-  //! Returns iterator to one element past last pixel
+  //! Returns iterator to one element past last pixel of the data window
   pixel_iterator end();
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the index of the given pixel's red channel in m_pixels
+  size_t     index(const size_t x, const size_t y) const;
+
   // Private data members ------------------------------------------------------
 
-  //! Internal representation of RGBA image.
-  OpenImageIO::ImageBuf m_buf;
+  //! RGBA pixels of the data window, in scanline order
+  std::vector<float> m_pixels;
+  //! Resolution of the full image
+  Imath::V2i         m_size;
+  //! Region of the image that m_pixels covers
+  Imath::Box2i       m_dataWindow;
+  //! Pixel type of written files
+  PixelType          m_pixelType;
+  //! Compression of written EXR files
+  std::string        m_compression;
+
+};
 
+//----------------------------------------------------------------------------//
+
+//! An image and the name of the layer to write it as. See writeLayers().
+struct LIBPVR_PUBLIC Image::Layer
+{
+  Layer(const std::string &layerName, Image::CPtr layerImage, 
+        const Channels layerChannels)
+    : name(layerName), image(layerImage), channels(layerChannels)
+  { }
+  //! Name of the layer. Empty for the main layer.
+  std::string name;
+  //! Image holding the layer's pixels
+  Image::CPtr image;
+  //! Which channels to write
+  Channels    channels;
+  //! If not empty, replaces R, G, B and A as the names of the channels
+  std::vector<std::string> channelNames;
 };
 
 //----------------------------------------------------------------------------//
@@ -152,7 +263,7 @@ struct LIBPVR_PUBLIC Image::pixel_iterator
   size_t x, y;
 private:
   Image& m_image;
-  Imath::Vec2<size_t> m_size;
+  Imath::Box2i m_window;
 };
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,139 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file InScatterCache.h
+  Contains the InScatterCache class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_INSCATTERCACHE_H__
+#define __INCLUDED_PVR_INSCATTERCACHE_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+#include <Field3D/FieldInterp.h>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Memory.h"
+#include "pvr/RenderState.h"
+#include "pvr/Scene.h"
+#include "pvr/Threading.h"
+#include "pvr/VoxelBuffer.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// InScatterCache
+//----------------------------------------------------------------------------//
+
+/*! \class InScatterCache
+  \brief Caches the light that the scene's lights scatter into each voxel
+  of a grid over the volume's bounds.
+
+  Each voxel holds the occluded luminance of all lights, summed and scaled
+  by the isotropic phase function, so that a lookup replaces the light and
+  occluder queries of every light with one trilinear interpolation. The 
+  direction of the light is discarded, which makes the cache exact only 
+  for isotropic phase functions at the voxel centers. Shadows are blurred 
+  to the resolution of the grid.
+
+  Voxels are computed the first time a lookup needs them, at the start of
+  the shutter, and may be filled and read by several threads at once.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC InScatterCache
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(InScatterCache);
+
+  // Constructor, factory method -----------------------------------------------
+
+  //! Constructs an empty cache for the given scene. res is the resolution 
+  //! of the longest edge of the volume's bounds.
+  InScatterCache(Scene::CPtr scene, const size_t res);
+
+  PVR_DEFINE_CREATE_FUNC_2_ARG(InScatterCache, Scene::CPtr, const size_t);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the luminance scattered towards any direction at the sample
+  //! point, per unit of scattering coefficient. Zero outside the grid.
+  Color sample(const VolumeSampleState &state) const;
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  size_t offset(const int i, const int j, const int k) const
+  { 
+    const Imath::V3i res = m_buffer.dataResolution();
+    return i + res.x * (j + res.y * k); 
+  }
+  //! Computes the in-scattered light of one voxel. The context is that of
+  //! the ray whose lookup needed the voxel, and supplies the scene that 
+  //! the lights' occluders trace against.
+  void updateVoxel(const int i, const int j, const int k,
+                   const RenderContext *context) const;
+
+  // Data members --------------------------------------------------------------
+
+  //! Scene whose lights are cached
+  Scene::CPtr m_scene;
+  mutable DenseBuffer m_buffer;
+  //! Accounts for the memory used by m_buffer
+  Sys::Memory::Tracker m_bufferMemory;
+  //! Tracks which voxels have been computed. Voxels are only read once they
+  //! are ready, so threads may share the buffer.
+  Sys::LazyFillState m_computed;
+  //! Linear interpolator
+  Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
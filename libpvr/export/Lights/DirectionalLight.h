@@ -0,0 +1,132 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file DirectionalLight.h
+  Contains the DirectionalLight class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_DIRECTIONALLIGHT_H__
+#define __INCLUDED_PVR_DIRECTIONALLIGHT_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Camera.h"
+#include "pvr/Renderer.h"
+#include "pvr/Lights/Light.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// DirectionalLight
+//----------------------------------------------------------------------------//
+
+/*! \class DirectionalLight
+  \brief Implements a light at infinity, such as the sun, whose light 
+  arrives along a single direction everywhere in the scene.
+
+  There is no falloff. Occlusion is best handled by a 
+  TransmittanceMapOccluder with the orthographic camera returned by
+  fitCamera(), whose rays are all parallel to the light.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC DirectionalLight : public Light
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(DirectionalLight);
+
+  // Exceptions ----------------------------------------------------------------
+
+  DECLARE_PVR_RT_EXC(MissingVolumeException, 
+                     "DirectionalLight needs a scene volume to fit a camera");
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Default constructor. The light points straight down.
+  DirectionalLight();
+  PVR_DEFINE_CREATE_FUNC(DirectionalLight);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(DirectionalLight);
+
+  // From Light ----------------------------------------------------------------
+
+  //! The sampled light position lies far away along the opposite of the 
+  //! light's direction, so that lookups that trace towards it travel
+  //! back along the light.
+  virtual LightSample sample(const LightSampleState &state) const;
+  virtual void        sampleBatch(const LightSampleStatePtrVec &states,
+                                  LightSampleVec &samples) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets the direction that the light travels in
+  void                    setDirection(const Vector &wsDir);
+  //! Returns the direction that the light travels in
+  const Vector&           direction() const;
+  //! Returns an orthographic camera that looks along the light's direction 
+  //! and whose res x res frame covers the renderer's scene volume. The 
+  //! image plane sits just outside the volume's bounds, so the camera's 
+  //! rays see all of it.
+  //! \throws MissingVolumeException if the scene has no volume.
+  OrthographicCamera::Ptr fitCamera(Renderer::CPtr renderer, 
+                                    const size_t res) const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! Normalized direction that the light travels in
+  Vector m_wsDir;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
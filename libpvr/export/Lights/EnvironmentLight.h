@@ -0,0 +1,168 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file EnvironmentLight.h
+  Contains the EnvironmentLight class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_ENVIRONMENTLIGHT_H__
+#define __INCLUDED_PVR_ENVIRONMENTLIGHT_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+#include <Field3D/FieldInterp.h>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Memory.h"
+#include "pvr/Renderer.h"
+#include "pvr/Threading.h"
+#include "pvr/VoxelBuffer.h"
+#include "pvr/Lights/Light.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// EnvironmentLight
+//----------------------------------------------------------------------------//
+
+/*! \class EnvironmentLight
+  \brief Implements a uniform sky dome (or full sphere) of light.
+
+  Occlusion from every direction is precomputed once by precompute() into a
+  low resolution voxel buffer covering the scene volume, so that sampling
+  the light costs about as much as a single VoxelOccluder lookup.
+
+  Each voxel stores the transmittance integrated over the dome, which 
+  gives the exact result for an isotropic phase function. The light sample
+  is placed far away along the voxel's dominant unoccluded direction, so 
+  that anisotropic phase functions see the light coming mostly from where
+  the dome is visible.
+
+  \note The light does its own occlusion. Leave its occluder set to the
+  default NullOccluder.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC EnvironmentLight : public Light
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(EnvironmentLight);
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Default constructor
+  EnvironmentLight();
+
+  PVR_DEFINE_CREATE_FUNC(EnvironmentLight);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(EnvironmentLight);
+
+  // From Light ----------------------------------------------------------------
+
+  virtual LightSample sample(const LightSampleState &state) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets the up direction of the dome.
+  void                setUpVector(const Vector &wsUp);
+  //! Returns the up direction of the dome.
+  const Vector&       upVector() const;
+  //! Sets whether light only arrives from the hemisphere around the up 
+  //! vector. Defaults to true.
+  void                setHemisphereEnabled(const bool enabled);
+  //! Returns whether light only arrives from the upper hemisphere.
+  bool                hemisphereEnabled() const;
+  //! Precomputes occlusion by tracing transmittance rays toward 
+  //! numDirections evenly distributed directions from each voxel of a 
+  //! buffer whose longest edge has res voxels. Call again if the scene's 
+  //! volume, the up vector or the hemisphere setting changes. Until this is
+  //! called, the light is unoccluded.
+  void                precompute(Renderer::CPtr renderer, const size_t res,
+                                 const size_t numDirections);
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Updates the values used for unoccluded points, i.e. the solid angle
+  //! of the dome and its integrated direction.
+  void updateUnoccluded();
+  //! Worker thread entry point. Computes every numThreads'th z slice of the
+  //! buffers, starting at the given thread index.
+  void computeSlices(Renderer::CPtr renderer, const std::vector<Vector> &dirs,
+                     const float solidAngle, const double tMax,
+                     const size_t numThreads, Sys::JobState &job,
+                     const size_t thread);
+
+  // Private data members ------------------------------------------------------
+
+  //! Up direction of the dome
+  Vector      m_wsUp;
+  //! Whether only the upper hemisphere emits light
+  bool        m_hemisphere;
+  //! Whether precompute() has filled the buffers
+  bool        m_precomputed;
+  //! Luminance per unit intensity integrated over the dome, per voxel
+  DenseBuffer m_luminance;
+  //! Luminance weighted incoming direction, per voxel
+  DenseBuffer m_direction;
+  //! Accounts for the memory used by the buffers
+  Sys::Memory::Tracker m_bufferMemory;
+  //! Luminance of a voxel that isn't occluded
+  Color       m_unoccludedLuminance;
+  //! Direction of a voxel that isn't occluded
+  Vector      m_unoccludedDir;
+  //! Linear interpolator
+  Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -71,6 +71,8 @@ struct LightSample
   Vector wsP;
 };
 
+typedef std::vector<LightSample> LightSampleVec;
+
 //----------------------------------------------------------------------------//
 // Light
 //----------------------------------------------------------------------------//
@@ -103,6 +105,21 @@ public:
   //! withouth taking into consideration occlusion.
   virtual LightSample sample(const LightSampleState &state) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Samples the light at a batch of points. Lights that can share work 
+  //! between points should override this. The default implementation calls
+  //! sample() once per point.
+  //! \note samples will be resized to match states.
+  virtual void sampleBatch(const LightSampleStatePtrVec &states,
+                           LightSampleVec &samples) const
+  {
+    samples.resize(states.size());
+    for (size_t i = 0, size = states.size(); i < size; ++i) {
+      samples[i] = sample(*states[i]);
+    }
+  }
+
   // Main methods --------------------------------------------------------------
 
   //! Sets the intesity of the light source.
@@ -113,11 +130,14 @@ public:
   void                setFalloffEnabled(const bool enabled);
   //! Returns whether falloff is enabled
   bool                falloffEnabled() const;
+  //! Returns whether falloff is softened within unit distance of the light
+  bool                softRolloff() const;
   //! Sets the Occluder to use for the light. By default, each light has the
   //! NullOccluder assigned.
   void                setOccluder(Occluder::CPtr occluder);
-  //! Returns the light's Occluder.
-  Occluder::CPtr      occluder() const;
+  //! Returns the light's Occluder. A reference, since the raymarch
+  //! samplers call this for every sample and light.
+  const Occluder::CPtr& occluder() const;
 
 protected:
 
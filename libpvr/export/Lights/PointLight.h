@@ -78,6 +78,8 @@ public:
   // From Light ----------------------------------------------------------------
 
   virtual LightSample sample(const LightSampleState &state) const;
+  virtual void        sampleBatch(const LightSampleStatePtrVec &states,
+                                  LightSampleVec &samples) const;
 
   // Main methods --------------------------------------------------------------
 
@@ -81,24 +81,40 @@ public:
   // From Light ----------------------------------------------------------------
 
   virtual LightSample sample(const LightSampleState &state) const;
+  virtual void        sampleBatch(const LightSampleStatePtrVec &states,
+                                  LightSampleVec &samples) const;
 
   // Main methods --------------------------------------------------------------
 
-  //! Sets the camera to use for projection
+  //! Sets the camera to use for projection. The camera's position and 
+  //! orientation are cached, so later changes to it have no effect.
   void                setCamera(Camera::CPtr camera);
   //! Returns the camera used for projection
   Camera::CPtr        camera() const;
   //! Sets the cone falloff width and delta
   void                setConeAngles(const float width, const float start);
+  //! Returns the cosine of the cone width, outside which the light is zero
+  float               cosConeWidth() const;
+  //! Returns the cosine of the angle inside which there is no cone falloff
+  float               cosConeStart() const;
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the cone falloff at the given point
+  float               coneFalloff(const Vector &wsP, const PTime time) const;
+
   // Private data members ------------------------------------------------------
 
   //! Position of spot light
   Vector       m_wsP;
   //! Camera to use for projection
   Camera::CPtr m_camera;
+  //! Position of the camera at each of its time samples
+  std::vector<Vector> m_wsSampleP;
+  //! Direction of the cone axis at each of the camera's time samples
+  std::vector<Vector> m_wsSampleAxis;
   //! Stores cos(width)
   float        m_cosWidth;
   //! Stores cos(start)
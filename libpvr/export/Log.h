@@ -37,6 +37,7 @@
 
 // Library includes
 
+#include <boost/atomic.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <Field3D/Log.h>
@@ -54,21 +55,22 @@ namespace Util {
 // Timer
 //----------------------------------------------------------------------------//
 
-//! Keeps track of wall-time
+//! Keeps track of wall-time. Uses UTC, which avoids the time zone conversion
+//! that makes local time expensive to query.
 class Timer
 {
 public:
   Timer()
-    : m_start(boost::posix_time::microsec_clock::local_time())
+    : m_start(boost::posix_time::microsec_clock::universal_time())
   { /* Empty */ }
   void reset()
   {
-    m_start = boost::posix_time::microsec_clock::local_time();
+    m_start = boost::posix_time::microsec_clock::universal_time();
   }
   float elapsed() const
   {
     using namespace boost::posix_time;
-    ptime now = microsec_clock::local_time();
+    ptime now = microsec_clock::universal_time();
     time_duration diff = now - m_start;
     return diff.total_milliseconds() / 1000.0f;
   }
@@ -111,6 +113,10 @@ std::string timeStamp();
 // Log
 //----------------------------------------------------------------------------//
 
+// Each message is formatted into a single line before it's written, and 
+// lines are written whole under a lock, so the output of concurrent threads
+// doesn't interleave.
+
 namespace Log {
   
   //! Severity of log output
@@ -127,9 +133,72 @@ namespace Log {
   
   //! Prints a log message SevWarning level
   void LIBPVR_EXPORT warning(const std::string &msg);
+
+  //! Sets the lowest severity that is printed. Defaults to SevMessage. 
+  //! Setting it to SevWarning prints warnings only.
+  void LIBPVR_EXPORT setMinSeverity(const Severity severity);
+
+  //! Returns the lowest severity that is printed
+  Severity LIBPVR_EXPORT minSeverity();
+
+  //! Whether messages of the given severity are printed. Check this before
+  //! building a costly message, or use PVR_LOG_PRINT().
+  bool LIBPVR_EXPORT isEnabled(const Severity severity);
+
+  //--------------------------------------------------------------------------//
+
+  /*! \class RateLimiter
+    \brief Limits how many times a warning that may repeat in a loop is 
+    printed.
+
+    Keep one per warning, at file scope, and pass it to 
+    PVR_LOG_WARNING_LIMITED(). Thread safe.
+   */
+  class LIBPVR_EXPORT RateLimiter
+  {
+  public:
+    //! \param what Describes the warnings, for the notice that further 
+    //! ones are suppressed
+    //! \param maxMessages Number of warnings to print
+    RateLimiter(const std::string &what, const size_t maxMessages = 10);
+    //! Counts a warning, and returns whether to print it. The first call 
+    //! that returns false prints a notice that further warnings are 
+    //! suppressed.
+    bool allow();
+  private:
+    //! Describes the warnings
+    const std::string     m_what;
+    //! Number of warnings to print
+    const size_t          m_maxMessages;
+    //! Number of warnings counted so far
+    boost::atomic<size_t> m_count;
+  };
   
 }
 
+//----------------------------------------------------------------------------//
+// Macros
+//----------------------------------------------------------------------------//
+
+//! Prints a message at SevMessage level. The message expression is only 
+//! evaluated if the message is printed.
+#define PVR_LOG_PRINT(msg)                                              \
+  do {                                                                  \
+    if (pvr::Util::Log::isEnabled(pvr::Util::Log::SevMessage)) {        \
+      pvr::Util::Log::print(msg);                                       \
+    }                                                                   \
+  } while (0)
+
+//! Prints a warning through the given Log::RateLimiter. The message 
+//! expression is only evaluated if the warning is printed.
+#define PVR_LOG_WARNING_LIMITED(limiter, msg)                           \
+  do {                                                                  \
+    if (pvr::Util::Log::isEnabled(pvr::Util::Log::SevWarning) &&        \
+        (limiter).allow()) {                                            \
+      pvr::Util::Log::warning(msg);                                     \
+    }                                                                   \
+  } while (0)
+
 //----------------------------------------------------------------------------//
 
 } // namespace Util
@@ -0,0 +1,179 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Memory.h
+  Contains the Memory class, which accounts for the memory held by large 
+  data structures.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_MEMORY_H__
+#define __INCLUDED_PVR_MEMORY_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <string>
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Exception.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Exceptions
+//----------------------------------------------------------------------------//
+
+DECLARE_PVR_RT_EXC(MemoryBudgetException, "Memory budget exceeded:");
+
+//----------------------------------------------------------------------------//
+// Memory
+//----------------------------------------------------------------------------//
+
+/*! \class Memory
+  \brief Keeps current and peak memory use per category of data structure.
+
+  Data structures hold a Memory::Tracker and report their size through it
+  whenever it changes significantly, i.e. on resize, build or compaction,
+  never per element. Each tracked allocation is identified by a key, so a
+  buffer that is shared by several holders (for example a Modeler and a 
+  VoxelVolume) is only counted once.
+
+  A global budget may be set. Allocation sites that can fail fast call 
+  checkBudget() before allocating.
+
+  All methods are thread safe.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC Memory
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  enum Category {
+    //! Voxel buffers held by Modeler and VoxelVolume
+    VoxelBuffers = 0,
+    //! Buffers held by occluders
+    OccluderBuffers,
+    //! DeepImage pixel functions
+    DeepImages,
+    //! AttrTable columns of points, polygons, meshes and particles
+    Geometry,
+    //! Acceleration structures built for modeling and lookups
+    Acceleration,
+    //! Number of categories. Not a category itself.
+    NumCategories
+  };
+
+  // Tracker -------------------------------------------------------------------
+
+  /*! \class Tracker
+    \brief Accounts for one allocation for as long as it lives.
+
+    A copied tracker counts a copy of an allocation it tracked by its own 
+    key, and shares allocations that were tracked by an explicit key.
+   */
+  class LIBPVR_PUBLIC Tracker
+  {
+  public:
+    Tracker(const Category category);
+    Tracker(const Tracker &other);
+    ~Tracker();
+    Tracker& operator = (const Tracker &other);
+    //! Reports the size of the allocation, keyed by the tracker itself.
+    //! Replaces any allocation tracked previously.
+    void track(const size_t bytes);
+    //! Reports the size of a shared allocation. Replaces any allocation 
+    //! tracked previously.
+    void track(const void *key, const size_t bytes);
+    //! Reports a new size for the allocation already tracked. Does nothing
+    //! if nothing is tracked.
+    void update(const size_t bytes);
+    //! Stops tracking
+    void release();
+  private:
+    Category    m_category;
+    //! Key of the tracked allocation. Null if nothing is tracked
+    const void *m_key;
+    //! Size last reported through this tracker. Repeated reports of the 
+    //! same size return without locking.
+    size_t      m_bytes;
+  };
+
+  // Main methods --------------------------------------------------------------
+
+  //! Bytes currently held in the given category
+  static size_t       current(const Category category);
+  //! Most bytes held in the given category since the last resetPeaks()
+  static size_t       peak(const Category category);
+  //! Bytes currently held across all categories
+  static size_t       totalCurrent();
+  //! Most bytes held across all categories since the last resetPeaks()
+  static size_t       totalPeak();
+  //! Sets the peaks to the current values
+  static void         resetPeaks();
+  //! Sets the budget, in bytes. Zero means no budget.
+  static void         setBudget(const size_t bytes);
+  //! Returns the budget, in bytes. Zero means no budget.
+  static size_t       budget();
+  //! Returns the bytes left in the budget. Returns the largest size_t if no
+  //! budget is set.
+  static size_t       available();
+  //! Throws MemoryBudgetException if allocating the given number of bytes
+  //! would exceed the budget.
+  //! \param what Describes the allocation, for the error message
+  static void         checkBudget(const size_t bytes, const std::string &what);
+  //! Returns the name of the given category
+  static std::string  name(const Category category);
+  //! Returns current and peak use as human-readable lines, one per category
+  static std::vector<std::string> info();
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -34,6 +34,9 @@
 
 // System headers
 
+#include <map>
+#include <string>
+
 #include <boost/shared_ptr.hpp>
 
 // Library headers
@@ -45,9 +48,12 @@
 #include "pvr/export.h"
 #include "pvr/Camera.h"
 #include "pvr/Geometry.h"
+#include "pvr/Memory.h"
 #include "pvr/ModelerInput.h"
+#include "pvr/Threading.h"
 #include "pvr/Types.h"
 #include "pvr/VoxelBuffer.h"
+#include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -87,6 +93,16 @@ public:
     FrustumMappingType
   };
 
+  //! Enumerates the depth distributions of frustum mapped buffers
+  enum FrustumDepth {
+    //! Voxels are evenly spaced in screen space depth, so they get deeper
+    //! with the square of the distance to the camera
+    PerspectiveDepth,
+    //! Voxels are evenly spaced in camera space depth. Their width and 
+    //! height still grow with distance, while their depth doesn't.
+    UniformDepth
+  };
+
   //! Enumerates data structures supported by modeler
   enum DataStructure {
     DenseBufferType,
@@ -100,6 +116,18 @@ public:
     SparseBlockSize32
   };
 
+  //! Enumerates the voxel formats that saveBuffer() can write
+  enum OutputFormat {
+    //! Full precision vector density, as rasterized
+    VectorOutput,
+    //! Half precision vector density
+    HalfVectorOutput,
+    //! Full precision scalar density, i.e. the average of the channels
+    ScalarOutput,
+    //! Half precision scalar density
+    HalfScalarOutput
+  };
+
   // Exceptions ----------------------------------------------------------------  
 
   DECLARE_PVR_RT_EXC(InvalidPrimitiveException, "Invalid primitive:");
@@ -118,7 +146,8 @@ public:
 
   // Settings ------------------------------------------------------------------
 
-  //! Sets the resolution of the voxel buffer explicitly.
+  //! Sets the resolution of the voxel buffer explicitly. The resolution is
+  //! scaled down by RenderGlobals::previewLevel(), as are the ones below.
   void setResolution(const size_t x, const size_t y, const size_t z);
   //! Sets the resolution of the longest edge of the buffer. Then sets 
   //! divisions along the other edges to make voxel size uniform in all 
@@ -128,12 +157,83 @@ public:
   void setVoxelSize(const Vector &size);
   //! Sets the mapping type to use
   void setMapping(const Mapping mapping);
+  //! Sets the depth distribution of frustum mapped buffers. Defaults to 
+  //! PerspectiveDepth. setResolution() makes voxels as deep, on average, 
+  //! as they are wide at the middle of the buffer.
+  void setFrustumDepth(const FrustumDepth depth);
   //! Sets the data structure to use
   void setDataStructure(const DataStructure dataStructure);
   //! Sets the block size in the case of a sparse voxel buffer
   void setSparseBlockSize(const SparseBlockSize size);
   //! Sets the camera to be used during rendering. Required for frustum mappings
   void setCamera(Render::PerspectiveCamera::CPtr camera);
+  //! Sets the number of threads to rasterize and instance with. Zero means
+  //! one per core.
+  void setNumThreads(const size_t numThreads);
+  //! Sets the maximum number of points that instantiation primitives output
+  //! at a time. Each chunk is rasterized and released before the next one is
+  //! created, which bounds peak memory use. Zero means no chunking.
+  void setInstanceChunkSize(const size_t chunkSize);
+  //! Sets whether instantiation primitives that support it should rasterize
+  //! their points straight into the voxel buffer, skipping the intermediate
+  //! Geometry. The direct path runs on a single thread.
+  void setDirectInstancing(const bool enabled);
+  //! Sets whether instantiation primitives that support it should 
+  //! rasterize their points into one sparse grid per thread as they are 
+  //! generated, and add the grids to the voxel buffer at the end. Takes 
+  //! precedence over direct instancing. Suits many sub-voxel points, since 
+  //! no points are stored and the work is spread over setNumThreads() 
+  //! threads.
+  void setAggregateInstancing(const bool enabled);
+  //! Sets whether the voxel buffer must come out bit-identical for any 
+  //! number of threads, e.g. for render caches keyed on the result. 
+  //! Rasterization primitives and chunked and direct instancing already 
+  //! add their splats in a fixed order. Aggregate instancing then splits 
+  //! the inputs into a fixed number of grids rather than one per thread, 
+  //! which costs more merging, and rasterization on the GPU, whose splats
+  //! land in any order, is skipped. Off by default.
+  void setDeterministic(const bool enabled);
+  //! Sets the voxel format that saveBuffer() writes
+  void setOutputFormat(const OutputFormat format);
+  //! Sets whether saveBuffer() writes dense buffers as sparse ones, using the
+  //! current sparse block size. Blocks that only hold zeros are left out of
+  //! sparse output either way.
+  void setSparseOutput(const bool enabled);
+  //! Sets whether dense buffers come from a pool shared by all modelers. 
+  //! Once nothing else references a pooled buffer, such as the Modeler or 
+  //! a VoxelVolume of the previous frame, the next buffer of the same 
+  //! resolution reuses its memory instead of allocating and page faulting
+  //! it again. It is still cleared. Sparse buffers release their blocks 
+  //! when cleared, so they aren't pooled. Defaults to false.
+  void setReuseBuffers(const bool enabled);
+  //! Frees the pooled buffers that are no longer in use
+  static void clearBufferPool();
+  //! Sets whether execute() keeps what each input with a cache key 
+  //! rasterized, in a sparse buffer of its own. The next execute() then 
+  //! only rasterizes the inputs whose keys it hasn't seen, and adds up the
+  //! kept buffers of the others, which suits tweaking one input out of 
+  //! many. The kept buffers are only reused while the buffer's mapping, 
+  //! resolution and block size stay the same. Inputs that aren't added 
+  //! again are dropped. Clones share the cache. Defaults to false.
+  //! \note Each cached input holds a buffer of its own, which for many 
+  //! overlapping inputs takes more memory than the final buffer.
+  void setInputCaching(const bool enabled);
+  //! Frees the buffers kept by input caching
+  void clearInputCache();
+  //! Sets how many times larger than those of the buffer the voxels of the
+  //! coarse level are. When larger than one, execute() rasterizes the 
+  //! inputs whose primitives only have large features, see 
+  //! setCoarseFeatureSize(), into a sparse coarseBuffer() instead, which 
+  //! has the same mapping as the buffer. Smooth primitives then fill 
+  //! fewer, larger voxels. Render the sum of both levels with 
+  //! VoxelVolume::setCoarseBuffer(). Input caching rasterizes every input
+  //! into the buffer itself. Defaults to one, i.e. no coarse level.
+  void setCoarseLevel(const size_t factor);
+  //! Sets the smallest feature size, in coarse voxels, that a primitive 
+  //! must have to be rasterized into the coarse level. Feature sizes come
+  //! from Prim::Primitive::wsFeatureSize(), and are compared to the voxel
+  //! size at the center of the coarse buffer. Defaults to 2.
+  void setCoarseFeatureSize(const float voxels);
 
   // Main methods --------------------------------------------------------------
 
@@ -147,38 +247,168 @@ public:
   //! can be set prior to calling execute, allowing more ModelerInput objects
   //! to be added before the modeling process starts.
   void updateBounds();
+  //! Picks the data structure, sparse block size and voxel size that give
+  //! the smallest voxels whose buffer fits in the given budget, and 
+  //! recreates the buffer with them. The occupied part of the bounds is 
+  //! estimated from the item bounds of the rasterization primitives, so 
+  //! this must be called after updateBounds() and before execute(). Other 
+  //! primitives count as occupying their whole bounds. Only uniform 
+  //! mappings are supported. Logs the expected memory use. If a global
+  //! budget is set with Sys::Memory::setBudget(), the voxels are also kept
+  //! within what is left of it.
+  //! \param memoryBudget Budget for the voxel buffer, in megabytes
+  void autoConfigure(const double memoryBudget);
   //! Executes all the inputs currently added to the Modeler. Once modeling is
   //! complete the ModelerInput objects are purged from the list of current 
   //! inputs.
   void execute();
-  //! Saves the state of the voxel buffer to disk.
+  //! Executes the inputs into one tight buffer per cluster of inputs, 
+  //! instead of a single buffer spanning the bounds of all of them, so 
+  //! that distant inputs don't allocate the empty space between them. 
+  //! Inputs are clustered while the union of two clusters' bounds covers
+  //! at most twice their own volume. Each buffer uses the current settings
+  //! and has the given resolution along its longest edge, so the voxel 
+  //! size is picked per cluster. The inputs are purged, and the current 
+  //! buffer is left untouched.
+  //! \returns The VoxelVolume of the single cluster, or a CompositeVolume
+  //! of one VoxelVolume per cluster. Null if no cluster had any bounds.
+  Render::Volume::Ptr executeClustered(const size_t res);
+  //! Converts a dense buffer to a sparse one with the current sparse block
+  //! size, on the modeling threads, once modeling is done. Blocks that only
+  //! hold zeros are left unallocated, so rendering gets the empty space 
+  //! optimization and memory use of a sparse buffer, while rasterization
+  //! ran at dense speed. Logs how many blocks were kept. Does nothing if 
+  //! the buffer isn't dense.
+  void compactBuffer();
+  //! Blurs the voxel buffer with a Gaussian reaching radius voxels, on the
+  //! modeling threads. See Model::gaussianBlur().
+  void blurBuffer(const float radius);
+  //! Resamples the voxel buffer to the given resolution with a Mitchell-
+  //! Netravali filter, on the modeling threads. The bounds and mapping 
+  //! type are kept. See Model::resample().
+  void resampleBuffer(const size_t x, const size_t y, const size_t z);
+  //! Returns a copy of the voxel buffer downsampled by the given factor,
+  //! keeping the maximum of the voxels it covers, e.g. for majorants. The
+  //! voxel buffer itself is left untouched. See Model::maxDownsample().
+  VoxelBuffer::Ptr maxDownsampledBuffer(const size_t factor) const;
+  //! Saves the state of the voxel buffer to disk, in the format set by 
+  //! setOutputFormat() and setSparseOutput(). Any conversion runs on the
+  //! modeling threads.
   void saveBuffer(const std::string &filename) const;
+  //! Saves the voxel buffer on a background thread. The buffer is shared 
+  //! with the task rather than copied, so it must not be written to until
+  //! the task is done. updateBounds() allocates a new buffer, so the next 
+  //! frame can be set up and modeled while the file is written.
+  //! \returns The task, to wait() on before relying on the file.
+  Sys::BackgroundTask::Ptr saveBufferAsync(const std::string &filename) const;
   //! Returns the current buffer
   VoxelBuffer::Ptr buffer() const;
+  //! Returns the coarse level written by the last execute(), or null if 
+  //! there is no coarse level. saveBuffer() doesn't write it.
+  VoxelBuffer::Ptr coarseBuffer() const;
 
 private:
 
   // Utility methods -----------------------------------------------------------
 
+  //! Creates m_buffer with the current data structure and mapping type
+  void createBuffer(const BBox &wsBounds);
   //! Builds a frustum mapping using m_camera and the provided bounds
   void setupFrustumMapping(const BBox &wsBounds) const;
   //! Builds a uniform/matrix mapping using the provided bounds.
   void setupUniformMapping(const BBox &wsBounds) const;
+  //! Rasterizes a chunk of instantiation primitive output into m_buffer
+  void executeChunk(ModelerInput::Ptr chunk);
+  //! Rasterizes a single input into m_buffer, or m_coarseBuffer if its
+  //! features are large enough
+  void executeInput(ModelerInput::Ptr input);
+  //! Creates m_coarseBuffer with the mapping of m_buffer
+  void createCoarseBuffer();
+  //! Rasterizes the inputs whose buffers aren't in m_inputCache, and adds
+  //! up the buffers of all inputs in m_buffer
+  void executeCached();
+  //! Rasterizes a single input into a new sparse buffer with the layout of 
+  //! m_buffer
+  SparseBuffer::Ptr rasterizeDelta(ModelerInput::Ptr input, 
+                                   const int blockOrder);
+
+  // Structs -------------------------------------------------------------------
+
+  //! A buffer kept by input caching, and its memory accounting
+  struct CachedInput
+  {
+    CachedInput()
+      : memory(Sys::Memory::VoxelBuffers)
+    { }
+    SparseBuffer::Ptr    buffer;
+    Sys::Memory::Tracker memory;
+  };
+
+  typedef std::map<std::string, CachedInput> CachedInputMap;
+
+  //! What input caching keeps between calls to execute()
+  struct InputCache
+  {
+    InputCache()
+      : blockOrder(0)
+    { }
+    //! Buffer of each input, by cache key
+    CachedInputMap             inputs;
+    //! Mapping, data window and block order that the buffers share
+    Field3D::FieldMapping::Ptr mapping;
+    Field3D::Box3i             dataWindow;
+    int                        blockOrder;
+  };
 
   // Protected data members ----------------------------------------------------
 
   //! Current mapping type
   Mapping                         m_mapping;
+  //! Depth distribution of frustum mapped buffers
+  FrustumDepth                    m_frustumDepth;
   //! Current data structure
   DataStructure                   m_dataStructure;
   //! Current sparse block size
   SparseBlockSize                 m_sparseBlockSize;
+  //! Number of rasterization threads. Zero means one per core.
+  size_t                          m_numThreads;
+  //! Maximum number of points per instantiation chunk. Zero means no 
+  //! chunking.
+  size_t                          m_instanceChunkSize;
+  //! Whether to rasterize instanced points directly
+  bool                            m_directInstancing;
+  //! Whether to aggregate instanced points in per-thread grids
+  bool                            m_aggregateInstancing;
+  //! Whether the result must not depend on the number of threads
+  bool                            m_deterministic;
+  //! Voxel format written by saveBuffer()
+  OutputFormat                    m_outputFormat;
+  //! Whether saveBuffer() writes dense buffers as sparse ones
+  bool                            m_sparseOutput;
+  //! Whether dense buffers come from the buffer pool
+  bool                            m_reuseBuffers;
+  //! Input buffers kept by execute(). Null unless input caching is on.
+  boost::shared_ptr<InputCache>   m_inputCache;
+  //! Voxel size of the coarse level, relative to m_buffer. One or less 
+  //! means no coarse level.
+  size_t                          m_coarseFactor;
+  //! Smallest feature size of coarse level inputs, in coarse voxels
+  float                           m_coarseFeatureSize;
   //! List of current inputs to the Modeler. This will be cleared by the 
   //! execute() call. 
   std::vector<ModelerInput::Ptr>  m_inputs;
+  //! Bounds found by the last updateBounds() call
+  BBox                            m_wsBounds;
   //! Pointer to the resulting voxel buffer. updateBounds() is responsible for
   //! allocating the pointer.
   VoxelBuffer::Ptr                m_buffer;
+  //! Accounts for the memory used by m_buffer
+  Sys::Memory::Tracker            m_bufferMemory;
+  //! Coarse level of m_buffer. Created by execute(), and reset whenever 
+  //! m_buffer changes layout. Null without a coarse level.
+  VoxelBuffer::Ptr                m_coarseBuffer;
+  //! Accounts for the memory used by m_coarseBuffer
+  Sys::Memory::Tracker            m_coarseBufferMemory;
   //! Camera used during final rendering. Used when creating frustum mapped
   //! buffers.
   Render::PerspectiveCamera::CPtr m_camera;
@@ -34,6 +34,8 @@
 
 // System headers
 
+#include <string>
+
 // Library headers
 
 #include <boost/foreach.hpp>
@@ -88,6 +90,14 @@ public:
   void                  setVolumePrimitive(Prim::Primitive::CPtr primitive);
   //! Returns the volumetric primitive currently assigned.
   Prim::Primitive::CPtr volumePrimitive() const;
+  //! Sets the key that identifies what the input rasterizes, for 
+  //! Modeler::setInputCaching(). It must change whenever the geometry or
+  //! the primitive's parameters do, e.g. a hash of the input files and 
+  //! parameters such as pvr.snapshot.contentHash() returns. Inputs without
+  //! a key are never cached.
+  void                  setCacheKey(const std::string &key);
+  //! Returns the input's cache key. Empty unless set.
+  const std::string&    cacheKey() const;
 
 protected:
   
@@ -95,6 +105,7 @@ protected:
 
   Geo::Geometry::CPtr   m_geometry;
   Prim::Primitive::CPtr m_primitive;
+  std::string           m_cacheKey;
 
 };
 
@@ -44,6 +44,7 @@
 
 #include "pvr/Globals.h"
 #include "pvr/Math.h"
+#include "pvr/SplatWriter.h"
 #include "pvr/Types.h"
 #include "pvr/VoxelBuffer.h"
 
@@ -65,20 +66,39 @@ inline double sphereVolume(const double radius)
 
 //----------------------------------------------------------------------------//
 
+inline bool isInWindow(const int i, const int j, const int k, 
+                       const DiscreteBBox &dvsWindow)
+{
+  return i >= dvsWindow.min.x && i <= dvsWindow.max.x &&
+    j >= dvsWindow.min.y && j <= dvsWindow.max.y &&
+    k >= dvsWindow.min.z && k <= dvsWindow.max.z;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Writes a point, touching only voxels inside dvsWindow. 
+inline void writePoint(const Vector &vsP, const Imath::V3f &value, 
+                       VoxelBuffer::Ptr buffer, const DiscreteBBox &dvsWindow)
+{
+  SplatWriter(buffer).writePoint(vsP, value, dvsWindow);
+}
+
+//----------------------------------------------------------------------------//
+
 inline void writePoint(const Vector &vsP, const Imath::V3f &value, 
                        VoxelBuffer::Ptr buffer)
 {
-  using namespace std;
-  using namespace Imath;
-  using namespace Field3D;
-  
-  int i = contToDisc(vsP.x);
-  int j = contToDisc(vsP.y);
-  int k = contToDisc(vsP.z);
-  
-  if (buffer->isInBounds(i, j, k)) {
-    buffer->lvalue(i, j, k) += value;
-  }
+  writePoint(vsP, value, buffer, buffer->dataWindow());
+}
+
+//--------------------------------------------------------------------------//
+
+//! Writes an antialiased point, touching only voxels inside dvsWindow. 
+inline void writeAntialiasedPoint(const Vector &vsP, const Imath::V3f &value, 
+                                  VoxelBuffer::Ptr buffer, 
+                                  const DiscreteBBox &dvsWindow)
+{
+  SplatWriter(buffer).writeAntialiasedPoint(vsP, value, dvsWindow);
 }
 
 //--------------------------------------------------------------------------//
@@ -86,48 +106,19 @@ inline void writePoint(const Vector &vsP, const Imath::V3f &value,
 inline void writeAntialiasedPoint(const Vector &vsP, const Imath::V3f &value, 
                                   VoxelBuffer::Ptr buffer)
 {
-  using namespace std;
-  using namespace Imath;
-  
-  // Offset the voxel-space position relative to voxel centers
-  // The rest of the calculations will be done in this space
-  Vector p(vsP.x - 0.5, vsP.y - 0.5, vsP.z - 0.5);
-  // Find the lower-left corner of the cube of 8 voxels that
-  // we need to access
-  V3i corner(static_cast<int>(floor(p.x)), 
-             static_cast<int>(floor(p.y)), 
-             static_cast<int>(floor(p.z)));
-  // Calculate P's fractional distance between voxels
-  // We start out with weight = fraction, then each step in the loop
-  // inverts the value.
-  Vector fraction(static_cast<Vector>(corner + V3i(1)) - p);
-  // Loop over the 8 voxels and distribute the value
-  for (int k = 0; k < 2; k++) {
-    for (int j = 0; j < 2; j++) {
-      for (int i = 0; i < 2; i++) {
-        double weight = fraction[0] * fraction[1] * fraction[2];
-        if (buffer->isInBounds(corner.x + i, corner.y + j, corner.z + k)) {
-          buffer->lvalue(corner.x + i, 
-                         corner.y + j, 
-                         corner.z + k) += value * weight;
-        }
-        fraction[0] = 1.0 - fraction[0];
-      }
-      fraction[1] = 1.0 - fraction[1];
-    }
-    fraction[2] = 1.0 - fraction[2];
-  }
+  writeAntialiasedPoint(vsP, value, buffer, buffer->dataWindow());
 }
 
 //----------------------------------------------------------------------------//
 
+//! Queues a line in the splat writer, touching only voxels inside 
+//! dvsWindow. The splats are written by SplatWriter::flush().
 template <bool Antialiased_T>
 inline void writeLine(const Vector &vsStart, const Vector &vsEnd,
-                      const Imath::V3f &value, VoxelBuffer::Ptr buffer)
+                      const Imath::V3f &value, SplatWriter &writer,
+                      const DiscreteBBox &dvsWindow)
 {
   using namespace std;
-  using namespace Imath;
-  using namespace Field3D;
   
   // Construct a line in voxel space
   Vector vsLine = (vsEnd - vsStart);
@@ -142,17 +133,35 @@ inline void writeLine(const Vector &vsStart, const Vector &vsEnd,
     double fraction = static_cast<double>(i) / 
       static_cast<double>(numSamples - 1);
     Vector vsP = Imath::lerp(vsStart, vsEnd, fraction);
-    // Write antialiased or non-antialiased point based on template argument
-    if (Antialiased_T) {
-      writeAntialiasedPoint(vsP, sampleValue, buffer);
-    } else {
-      writePoint(vsP, sampleValue, buffer);
-    }
+    writer.queuePoint(vsP, sampleValue, Antialiased_T, dvsWindow);
   }
 }
 
 //----------------------------------------------------------------------------//
 
+//! Writes a line, touching only voxels inside dvsWindow. 
+template <bool Antialiased_T>
+inline void writeLine(const Vector &vsStart, const Vector &vsEnd,
+                      const Imath::V3f &value, VoxelBuffer::Ptr buffer,
+                      const DiscreteBBox &dvsWindow)
+{
+  SplatWriter writer(buffer);
+  writeLine<Antialiased_T>(vsStart, vsEnd, value, writer, dvsWindow);
+  writer.flush();
+}
+
+//----------------------------------------------------------------------------//
+
+template <bool Antialiased_T>
+inline void writeLine(const Vector &vsStart, const Vector &vsEnd,
+                      const Imath::V3f &value, VoxelBuffer::Ptr buffer)
+{
+  writeLine<Antialiased_T>(vsStart, vsEnd, value, buffer, 
+                           buffer->dataWindow());
+}
+
+//----------------------------------------------------------------------------//
+
 inline BBox vsSphereBounds(Field3D::FieldMapping::Ptr mapping, 
                            const Vector &wsCenter, const float wsRadius) 
 {
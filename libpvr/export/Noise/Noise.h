@@ -39,6 +39,7 @@
 // Project headers
 
 #include "pvr/export.h"
+#include "pvr/Exception.h"
 #include "pvr/Math.h"
 #include "pvr/Types.h"
 #include "pvr/Noise/NoiseImpl.h"
@@ -78,6 +79,17 @@ public:
                              const float z) const = 0;
   //! Returns the range (min and max) of the noise function.
   virtual Range      range() const = 0;
+
+  // Batch evaluation ----------------------------------------------------------
+
+  //! Evaluates scalar noise for n points. The default implementation calls
+  //! eval() once per point.
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  //! Evaluates vector noise for n points. The default implementation calls
+  //! evalVec() once per point.
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
   
   // Utility member functions --------------------------------------------------
 
@@ -113,6 +125,12 @@ public:
   virtual Imath::V3f evalVec(const float x, const float y) const;
   virtual Imath::V3f evalVec(const float x, const float y, const float z) const;
   virtual Range      range() const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
 
 private:
 
@@ -148,6 +166,12 @@ public:
   virtual Imath::V3f evalVec(const float x, const float y) const;
   virtual Imath::V3f evalVec(const float x, const float y, const float z) const;
   virtual Range      range() const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
 
 private:
 
@@ -157,6 +181,91 @@ private:
   SNoise m_noise;
 };
 
+//----------------------------------------------------------------------------//
+// SimplexNoise
+//----------------------------------------------------------------------------//
+
+//! Simplex noise. Each lookup sums the contributions of the 4 corners of the
+//! containing tetrahedron, rather than interpolating the 8 corners of a 
+//! cube, so it is cheaper than PerlinNoise, particularly for vector noise.
+//! The result doesn't match PerlinNoise and has no directional artifacts.
+class LIBPVR_PUBLIC SimplexNoise : public NoiseFunction
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(SimplexNoise);
+
+  // Ctor, factory function ----------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC(SimplexNoise);
+
+  // From NoiseFunction --------------------------------------------------------
+
+  virtual float      eval(const float x) const;
+  virtual float      eval(const float x, const float y) const;
+  virtual float      eval(const float x, const float y, const float z) const;
+  virtual Imath::V3f evalVec(const float x) const;
+  virtual Imath::V3f evalVec(const float x, const float y) const;
+  virtual Imath::V3f evalVec(const float x, const float y, const float z) const;
+  virtual Range      range() const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! SimplexSNoise instance to use for sampling noise.
+  SimplexSNoise m_noise;
+
+};
+
+//----------------------------------------------------------------------------//
+// AbsSimplexNoise
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC AbsSimplexNoise : public NoiseFunction
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(AbsSimplexNoise);
+
+  // Ctor, factory function ----------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC(AbsSimplexNoise);
+
+  // From NoiseFunction --------------------------------------------------------
+
+  virtual float      eval(const float x) const;
+  virtual float      eval(const float x, const float y) const;
+  virtual float      eval(const float x, const float y, const float z) const;
+  virtual Imath::V3f evalVec(const float x) const;
+  virtual Imath::V3f evalVec(const float x, const float y) const;
+  virtual Imath::V3f evalVec(const float x, const float y, const float z) const;
+  virtual Range      range() const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  //! Evaluates SIMD width points at a time, when compiled with SSE2 or AVX2
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! SimplexSNoise instance to use for sampling noise.
+  SimplexSNoise m_noise;
+};
+
 //----------------------------------------------------------------------------//
 // Fractal
 //----------------------------------------------------------------------------//
@@ -176,6 +285,33 @@ public:
   virtual Imath::V3f evalVec(const Imath::V3f &p) const = 0;
   virtual Range      range() const = 0;
 
+  // Batch evaluation ----------------------------------------------------------
+
+  //! Evaluates the scalar fractal for n points. The default implementation
+  //! calls eval() once per point.
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  //! Evaluates the vector fractal for n points. The default implementation
+  //! calls evalVec() once per point.
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
+
+  // Filtered evaluation -------------------------------------------------------
+
+  //! Evaluates the fractal for a lookup that covers filterWidth, in the same
+  //! space as p. Detail finer than the footprint can't be resolved and only
+  //! aliases, so subclasses may leave it out. The default implementation 
+  //! ignores the filter width.
+  virtual float      eval(const Imath::V3f &p, const float filterWidth) const;
+  //! Vector version of eval(p, filterWidth)
+  virtual Imath::V3f evalVec(const Imath::V3f &p, 
+                             const float filterWidth) const;
+  //! Evaluates the scalar fractal for n points, each with its own filter 
+  //! width. The default implementation calls eval(p, filterWidth) once 
+  //! per point.
+  virtual void       evalBatch(const Imath::V3f *p, const float *filterWidths,
+                               float *result, const size_t n) const;
+
   // Utility member functions --------------------------------------------------
 
   float      eval(const float x) const;
@@ -212,9 +348,33 @@ public:
   virtual float      eval(const Imath::V3f &p) const;
   virtual Imath::V3f evalVec(const Imath::V3f &p) const;
   virtual Range      range() const;
+  //! Evaluates each octave for a batch of points at once, using the noise
+  //! function's batch evaluation.
+  virtual void       evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const;
+  virtual void       evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const;
+  //! Leaves out the octaves finer than the filter width, fading out the 
+  //! last one over an octave so that the result is continuous in the 
+  //! filter width. The first octave is always kept.
+  virtual float      eval(const Imath::V3f &p, const float filterWidth) const;
+  virtual Imath::V3f evalVec(const Imath::V3f &p, 
+                             const float filterWidth) const;
+  //! Evaluates each octave for a batch of points at once, as far as the 
+  //! point with the smallest filter width needs.
+  virtual void       evalBatch(const Imath::V3f *p, const float *filterWidths,
+                               float *result, const size_t n) const;
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  //! Evaluates the given number of octaves
+  float              evalOctaves(const Imath::V3f &p, 
+                                 const float octaves) const;
+  Imath::V3f         evalVecOctaves(const Imath::V3f &p, 
+                                    const float octaves) const;
+
   // Private data members ------------------------------------------------------
 
   NoiseFunction::CPtr m_noise;
@@ -225,6 +385,127 @@ private:
 
 };
 
+//----------------------------------------------------------------------------//
+// TiledfBm
+//----------------------------------------------------------------------------//
+
+//! fBm that evaluates its octaves by trilinear lookup into a pre-baked,
+//! periodic noise tile rather than evaluating the noise function 
+//! analytically. The tile is stored at half precision and is baked once per
+//! process, the first time a TiledfBm using the given noise type is 
+//! constructed. The result is slightly blurrier than fBm and repeats every
+//! k_tilePeriod noise units, but is considerably faster at high octave counts.
+//! \note Only PerlinNoise and AbsPerlinNoise are supported.
+class LIBPVR_PUBLIC TiledfBm : public Fractal
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(TiledfBm);
+
+  // Exceptions ----------------------------------------------------------------
+
+  DECLARE_PVR_RT_EXC(UnsupportedNoiseException, "Unsupported noise function:");
+
+  // Constants -----------------------------------------------------------------
+
+  //! Resolution of the baked tile along each axis. Must be a power of two.
+  static const int k_tileRes = 128;
+  //! Period of the baked tile, in noise space units
+  static const int k_tilePeriod = 32;
+
+  // Ctor, factory function ----------------------------------------------------
+
+  TiledfBm(NoiseFunction::CPtr noise, float scale, float octaves, 
+           float octaveGain, float lacunarity);
+  static Ptr create(NoiseFunction::CPtr noise, float scale, float octaves, 
+                    float octaveGain, float lacunarity);
+
+  // From Fractal --------------------------------------------------------------
+
+  virtual float      eval(const Imath::V3f &p) const;
+  virtual Imath::V3f evalVec(const Imath::V3f &p) const;
+  virtual Range      range() const;
+  //! Leaves out the octaves finer than the filter width, the same way
+  //! fBm does
+  virtual float      eval(const Imath::V3f &p, const float filterWidth) const;
+  virtual Imath::V3f evalVec(const Imath::V3f &p, 
+                             const float filterWidth) const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Baked noise values. Defined in Noise.cpp.
+  struct Tile;
+  typedef boost::shared_ptr<const Tile> TileCPtr;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Evaluates the given number of octaves
+  float              evalOctaves(const Imath::V3f &p, 
+                                 const float octaves) const;
+  Imath::V3f         evalVecOctaves(const Imath::V3f &p, 
+                                    const float octaves) const;
+
+  //! Returns the tile for the given noise type, baking it on first use
+  static TileCPtr bakedTile(const bool absolute);
+
+  // Private data members ------------------------------------------------------
+
+  TileCPtr m_tile;
+  Range    m_noiseRange;
+  float    m_scale;
+  float    m_octaves;
+  float    m_octaveGain;
+  float    m_lacunarity;
+
+};
+
+//----------------------------------------------------------------------------//
+// fBmCache
+//----------------------------------------------------------------------------//
+
+//! Hands out immutable fBm instances, reusing the most recently built one
+//! as long as the requested parameters are unchanged. Primitives keep one in
+//! their attribute state so that consecutive points with the same noise 
+//! settings don't allocate a new fractal each.
+//! \note Not thread safe. Each thread should use its own instance.
+class LIBPVR_PUBLIC fBmCache
+{
+public:
+
+  // Ctor ----------------------------------------------------------------------
+
+  fBmCache();
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns an fBm with the given parameters, using AbsPerlinNoise or
+  //! PerlinNoise as its basis, or their simplex counterparts if simplex 
+  //! is true. If tiled is true, a TiledfBm is returned. Its tile is always
+  //! baked from Perlin noise, so simplex is ignored.
+  const Fractal::CPtr& get(const bool absNoise, const bool tiled, 
+                           const bool simplex, const float scale, 
+                           const float octaves, const float octaveGain, 
+                           const float lacunarity);
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  Fractal::CPtr m_fractal;
+  bool          m_absNoise;
+  bool          m_tiled;
+  bool          m_simplex;
+  float         m_scale;
+  float         m_octaves;
+  float         m_octaveGain;
+  float         m_lacunarity;
+
+};
+
 //----------------------------------------------------------------------------//
 // Utility functions
 //----------------------------------------------------------------------------//
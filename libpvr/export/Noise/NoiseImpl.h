@@ -41,6 +41,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
 #include <limits>
 
 #include "pvr/Types.h"
@@ -396,6 +397,139 @@ inline void perlin (V &result, const H &hash,
   result = scale4 (result);
 }
 
+namespace {
+
+  // helper functions for simplex noise
+
+  // skew and unskew factors of the 2D and 3D simplex grids
+  const float k_simplexF2 = 0.366025403f; // (sqrt(3) - 1) / 2
+  const float k_simplexG2 = 0.211324865f; // (3 - sqrt(3)) / 6
+  const float k_simplexF3 = 1.0f / 3.0f;
+  const float k_simplexG3 = 1.0f / 6.0f;
+
+  // radially symmetric falloff of a simplex corner's contribution,
+  // (r2 - d^2)^4 clamped to zero outside the kernel
+  inline float simplexFalloff (float r2, float x) {
+    float t = std::max(r2 - x * x, 0.0f);
+    t *= t;
+    return t * t;
+  }
+
+  inline float simplexFalloff (float r2, float x, float y) {
+    float t = std::max(r2 - x * x - y * y, 0.0f);
+    t *= t;
+    return t * t;
+  }
+
+  inline float simplexFalloff (float r2, float x, float y, float z) {
+    float t = std::max(r2 - x * x - y * y - z * z, 0.0f);
+    t *= t;
+    return t * t;
+  }
+
+  // the gradients are the same as perlin's, and the factors bringing the
+  // result to roughly [-1,1] were found experimentally like theirs:
+  //    1D:   0.395
+  //    2D:   45.0
+  //    3D:   76.0
+
+  template <typename T>
+  inline T simplexScale1 (const T &result) { return 0.395f * result; }
+  template <typename T>
+  inline T simplexScale2 (const T &result) { return 45.0f * result; }
+  template <typename T>
+  inline T simplexScale3 (const T &result) { return 76.0f * result; }
+
+} // Anonymous namespace
+
+// simplex noise sums the contributions of the corners of the simplex 
+// containing the point, so it hashes 2, 3 and 4 lattice points in 1, 2 and 
+// 3 dimensions rather than perlin's 2, 4 and 8. vector noise evaluates all 
+// three components from one hash per corner and shares everything else.
+
+template <typename V, typename H>
+inline void simplex (V &result, const H &hash, float x) {
+  int X = quick_floor(x);
+  float x0 = x - X;
+  float x1 = x0 - 1.0f;
+
+  result = simplexFalloff(1.0f, x0) * grad (hash (X  ), x0) + 
+           simplexFalloff(1.0f, x1) * grad (hash (X+1), x1);
+  result = simplexScale1 (result);
+}
+
+template <typename V, typename H>
+inline void simplex (V &result, const H &hash, float x, float y) {
+  // find the cell of the skewed grid, and the point relative to its origin
+  float s = (x + y) * k_simplexF2;
+  int X = quick_floor(x + s);
+  int Y = quick_floor(y + s);
+  float t = (X + Y) * k_simplexG2;
+  float x0 = x - (X - t);
+  float y0 = y - (Y - t);
+
+  // the middle corner of the containing triangle
+  int X1 = x0 >= y0 ? 1 : 0;
+  int Y1 = 1 - X1;
+
+  float x1 = x0 - X1 + k_simplexG2;
+  float y1 = y0 - Y1 + k_simplexG2;
+  float x2 = x0 - 1.0f + 2.0f * k_simplexG2;
+  float y2 = y0 - 1.0f + 2.0f * k_simplexG2;
+
+  result = simplexFalloff(0.5f, x0, y0) * grad (hash (X   , Y   ), x0, y0) +
+           simplexFalloff(0.5f, x1, y1) * grad (hash (X+X1, Y+Y1), x1, y1) +
+           simplexFalloff(0.5f, x2, y2) * grad (hash (X+1 , Y+1 ), x2, y2);
+  result = simplexScale2 (result);
+}
+
+template <typename V, typename H>
+inline void simplex (V &result, const H &hash, float x, float y, float z) {
+  // find the cell of the skewed grid, and the point relative to its origin
+  float s = (x + y + z) * k_simplexF3;
+  int X = quick_floor(x + s);
+  int Y = quick_floor(y + s);
+  int Z = quick_floor(z + s);
+  float t = (X + Y + Z) * k_simplexG3;
+  float x0 = x - (X - t);
+  float y0 = y - (Y - t);
+  float z0 = z - (Z - t);
+
+  // rank the coordinates to find the two middle corners of the containing
+  // tetrahedron. written without branches so that it matches the batched
+  // version in Noise.cpp
+  bool xy = x0 >= y0;
+  bool xz = x0 >= z0;
+  bool yz = y0 >= z0;
+  int X1 = xy && xz;
+  int Y1 = !xy && yz;
+  int Z1 = !xz && !yz;
+  int X2 = xy || xz;
+  int Y2 = !xy || yz;
+  int Z2 = !(xz && yz);
+
+  float x1 = x0 - X1 + k_simplexG3;
+  float y1 = y0 - Y1 + k_simplexG3;
+  float z1 = z0 - Z1 + k_simplexG3;
+  float x2 = x0 - X2 + 2.0f * k_simplexG3;
+  float y2 = y0 - Y2 + 2.0f * k_simplexG3;
+  float z2 = z0 - Z2 + 2.0f * k_simplexG3;
+  float x3 = x0 - 1.0f + 3.0f * k_simplexG3;
+  float y3 = y0 - 1.0f + 3.0f * k_simplexG3;
+  float z3 = z0 - 1.0f + 3.0f * k_simplexG3;
+
+  result = 
+    simplexFalloff(0.5f, x0, y0, z0) * 
+    grad (hash (X   , Y   , Z   ), x0, y0, z0) +
+    simplexFalloff(0.5f, x1, y1, z1) * 
+    grad (hash (X+X1, Y+Y1, Z+Z1), x1, y1, z1) +
+    simplexFalloff(0.5f, x2, y2, z2) * 
+    grad (hash (X+X2, Y+Y2, Z+Z2), x2, y2, z2) +
+    simplexFalloff(0.5f, x3, y3, z3) * 
+    grad (hash (X+1 , Y+1 , Z+1 ), x3, y3, z3);
+  result = simplexScale3 (result);
+}
+
 namespace {
 
   struct HashScalar 
@@ -700,6 +834,43 @@ struct SNoise
 
 };
 
+struct SimplexSNoise 
+{
+  
+  SimplexSNoise () { }
+
+  inline void operator() (float &result, float x) const {
+    HashScalar h;
+    simplex(result, h, x);
+  }
+
+  inline void operator() (float &result, float x, float y) const {
+    HashScalar h;
+    simplex(result, h, x, y);
+  }
+
+  inline void operator() (float &result, const Imath::V3f &p) const {
+    HashScalar h;
+    simplex(result, h, p.x, p.y, p.z);
+  }
+
+  inline void operator() (Imath::V3f &result, float x) const {
+    HashVector h;
+    simplex(result, h, x);
+  }
+
+  inline void operator() (Imath::V3f &result, float x, float y) const {
+    HashVector h;
+    simplex(result, h, x, y);
+  }
+
+  inline void operator() (Imath::V3f &result, const Imath::V3f &p) const {
+    HashVector h;
+    simplex(result, h, p.x, p.y, p.z);
+  }
+
+};
+
 struct PeriodicNoise 
 {
 
@@ -0,0 +1,104 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file FrustumVoxelOccluder.h
+  Contains the FrustumVoxelOccluder class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_FRUSTUMVOXELOCCLUDER_H__
+#define __INCLUDED_PVR_FRUSTUMVOXELOCCLUDER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Camera.h"
+#include "pvr/Occluders/VoxelOccluder.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// FrustumVoxelOccluder
+//----------------------------------------------------------------------------//
+
+/*! \class FrustumVoxelOccluder
+  \brief A VoxelOccluder whose buffer is frustum mapped to a spot light's
+  camera, with its clip planes fitted to the scene volume's bounds.
+
+  Only the part of the volume inside the light's cone gets voxels, so a 
+  narrow cone gets much higher effective resolution for the same memory.
+  Points outside the frustum are treated as unoccluded, which is harmless
+  since the spot light doesn't reach them.
+
+  \note The frustum is built from the camera at time zero, just as 
+  VoxelOccluder uses a single light position.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC FrustumVoxelOccluder : public VoxelOccluder
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(FrustumVoxelOccluder);
+  
+  // Constructor, factory method -----------------------------------------------
+
+  //! Constructor requires a Renderer and the light's camera. The longest 
+  //! screen axis and the depth axis each get res voxels.
+  FrustumVoxelOccluder(Renderer::CPtr renderer, 
+                       PerspectiveCamera::CPtr camera, const size_t res);
+
+  PVR_DEFINE_CREATE_FUNC_3_ARG(FrustumVoxelOccluder, Renderer::CPtr, 
+                               PerspectiveCamera::CPtr, const size_t);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(FrustumVoxelOccluder);
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
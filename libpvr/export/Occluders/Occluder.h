@@ -79,6 +79,25 @@ public:
 
   virtual Color sample(const OcclusionSampleState &state) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Binds the attributes used by the occluder's renderer, if it raymarches
+  //! during rendering. The default implementation does nothing.
+  virtual void bindAttributes() const
+  { }
+  //! Samples the occluder at a batch of points. Occluders that can share
+  //! lookup work between nearby points should override this. The default 
+  //! implementation calls sample() once per point.
+  //! \note transmittances will be resized to match states.
+  virtual void sampleBatch(const OcclusionSampleStatePtrVec &states,
+                           ColorVec &transmittances) const
+  {
+    transmittances.resize(states.size());
+    for (size_t i = 0, size = states.size(); i < size; ++i) {
+      transmittances[i] = sample(*states[i]);
+    }
+  }
+
 };
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,116 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+//----------------------------------------------------------------------------//
+
+/*! \file OccluderResolution.h
+  Contains the OccluderResolution class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_OCCLUDERRESOLUTION_H__
+#define __INCLUDED_PVR_OCCLUDERRESOLUTION_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Camera.h"
+#include "pvr/Renderer.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// OccluderResolution
+//----------------------------------------------------------------------------//
+
+/*! \class OccluderResolution
+  \brief Picks occluder resolutions from the scene instead of by hand.
+
+  An occluder needs no detail finer than the voxels of the scene's volumes,
+  which have none, or than the render camera's pixels where they fall on 
+  the volume, which can't show it. The coarser of the two is the detail 
+  size, and the resolution that resolves it is then reduced to fit the 
+  memory budget and the number of shadow rays allowed.
+
+  The chosen settings and their expected cost are printed before returning,
+  so that they can be checked before the occluder is built.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC OccluderResolution
+{
+public:
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the world-space size of the finest detail that occluders of
+  //! the renderer's scene need to resolve. Zero if the scene has neither
+  //! voxel volumes nor a camera to derive it from.
+  static double     detailSize(Renderer::CPtr renderer);
+  //! Returns the resolution of the longest edge of a VoxelOccluder,
+  //! SweepVoxelOccluder, SparseVoxelOccluder or OtfVoxelOccluder buffer 
+  //! for the renderer's scene.
+  //! \param memoryBudget Megabytes the buffer may use. Zero uses the 
+  //! global memory budget only. See Sys::Memory::setBudget().
+  //! \param maxRays Most shadow rays to trace, one per voxel. Zero means
+  //! no limit.
+  static size_t     voxelOccluder(Renderer::CPtr renderer, 
+                                  const float memoryBudget = 0.0f,
+                                  const size_t maxRays = 0);
+  //! Returns the resolution of a transmittance map rendered from the given
+  //! light camera. The camera's current resolution sets the aspect ratio.
+  //! \param numSamples Most samples per pixel, as for 
+  //! Renderer::setNumDeepSamples()
+  //! \param memoryBudget Megabytes the map may use. Zero uses the global
+  //! memory budget only.
+  //! \param maxRays Most camera rays to trace, counting every pixel 
+  //! sample. Zero means no limit.
+  static Imath::V2i transmittanceMap(Renderer::CPtr renderer, 
+                                     Camera::CPtr lightCamera,
+                                     const size_t numSamples,
+                                     const float memoryBudget = 0.0f,
+                                     const size_t maxRays = 0);
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
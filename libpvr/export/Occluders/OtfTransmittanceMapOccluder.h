@@ -42,6 +42,7 @@
 #include "pvr/Camera.h"
 #include "pvr/DeepImage.h"
 #include "pvr/Renderer.h"
+#include "pvr/Threading.h"
 #include "pvr/Occluders/Occluder.h"
 
 //----------------------------------------------------------------------------//
@@ -57,6 +58,11 @@ namespace Render {
 
 /*! \class OtfTransmittanceMapOccluder
   \brief Determines occlusion using a transmittance map generated on the fly.
+
+  The map is filled in tiles of pixels. The first lookup that touches a tile
+  traces all of its pixels, one packet of neighboring rays per tile row and
+  pixel sample, so that the raymarch steps that follow find their pixels
+  ready. The rows of a tile are spread over any pool threads that are idle.
  */
 
 //----------------------------------------------------------------------------//
@@ -90,15 +96,25 @@ public:
   // From Occluder -------------------------------------------------------------
 
   virtual Color sample(const OcclusionSampleState &state) const;
+  virtual void  bindAttributes() const;
 
 protected:
 
   // Utility methods -----------------------------------------------------------
 
-  size_t offset(const size_t x, const size_t y) const
-  { return x + m_resolution.x * y; }
+  size_t tileOffset(const size_t tx, const size_t ty) const
+  { return tx + m_numTiles.x * ty; }
+  //! Ensures that the tiles covering the pixels around rsP are computed
   void updateCoordinate(const Vector &rsP) const;
-  void updatePixel(const size_t x, const size_t y) const;
+  //! Returns the given transmittance ray of pixel (x, y)
+  RayState pixelRay(const size_t x, const size_t y, const size_t sample, 
+                    const size_t numRays) const;
+  //! Computes all pixels of the given tile
+  void updateTile(const size_t tx, const size_t ty) const;
+  //! Computes rows [begin, end) of the given tile, tracing the same sample
+  //! of each pixel in a row as one packet
+  void updateTileRows(const size_t tx, const size_t ty, 
+                      const size_t begin, const size_t end) const;
 
   // Data members --------------------------------------------------------------
 
@@ -108,8 +124,13 @@ protected:
   Imath::V2f                m_floatRasterBounds;
   Imath::V2i                m_intRasterBounds;
   Imath::V2i                m_resolution;
+  //! Number of tiles in x and y
+  Imath::V2i                m_numTiles;
   mutable DeepImage         m_transmittanceMap;
-  mutable std::vector<char> m_computed;
+  //! Tracks which tiles of the transmittance map have been computed. 
+  //! Pixels are only read once their tile is ready, so threads may share 
+  //! the map.
+  Sys::LazyFillState        m_computed;
 };
 
 //----------------------------------------------------------------------------//
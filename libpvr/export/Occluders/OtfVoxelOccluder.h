@@ -41,7 +41,9 @@
 // Project headers
 
 #include "pvr/export.h"
+#include "pvr/Memory.h"
 #include "pvr/Renderer.h"
+#include "pvr/Threading.h"
 #include "pvr/VoxelBuffer.h"
 #include "pvr/Occluders/Occluder.h"
 
@@ -86,18 +88,37 @@ public:
   // From Occluder -------------------------------------------------------------
 
   virtual Color sample(const OcclusionSampleState &state) const;
+  virtual void  bindAttributes() const;
 
 protected:
 
   // Utility methods -----------------------------------------------------------
 
+  size_t offset(const int i, const int j, const int k) const
+  { 
+    const Imath::V3i res = m_buffer.dataResolution();
+    return i + res.x * (j + res.y * k); 
+  }
+  //! Returns the shadow ray of the given voxel
+  RayState shadowRay(const int i, const int j, const int k) const;
+  //! Traces the shadow ray of the given voxel
   void updateVoxel(const int i, const int j, const int k) const;
+  //! Traces the shadow rays of the given voxels as one packet
+  void updateVoxels(const Imath::V3i *voxels, const size_t numVoxels) const;
 
   // Data members --------------------------------------------------------------
 
   Renderer::CPtr m_renderer;
   const Vector m_wsLightPos;
   mutable DenseBuffer m_buffer;
+  //! The mapping of m_buffer, kept so that sample() doesn't copy the
+  //! pointer that FieldRes::mapping() returns.
+  Field3D::FieldMapping::Ptr m_mapping;
+  //! Accounts for the memory used by m_buffer
+  Sys::Memory::Tracker m_bufferMemory;
+  //! Tracks which voxels have been computed. Voxels are only read once they
+  //! are ready, so threads may share the buffer.
+  Sys::LazyFillState m_computed;
   //! Linear interpolator
   Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
 
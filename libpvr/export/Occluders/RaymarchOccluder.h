@@ -80,6 +80,7 @@ public:
   // From Occluder -------------------------------------------------------------
 
   virtual Color sample(const OcclusionSampleState &state) const;
+  virtual void  bindAttributes() const;
 
 protected:
 
@@ -0,0 +1,136 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseVoxelOccluder.h
+  Contains the SparseVoxelOccluder class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SPARSEVOXELOCCLUDER_H__
+#define __INCLUDED_PVR_SPARSEVOXELOCCLUDER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <vector>
+
+// Library headers
+
+#include <Field3D/FieldInterp.h>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Memory.h"
+#include "pvr/Renderer.h"
+#include "pvr/Threading.h"
+#include "pvr/VoxelBuffer.h"
+#include "pvr/Occluders/Occluder.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SparseVoxelOccluder
+//----------------------------------------------------------------------------//
+
+/*! \class SparseVoxelOccluder
+  \brief Determines occlusion using a sparse transmittance buffer.
+
+  Works like VoxelOccluder, but only allocates the blocks of the buffer
+  where the scene volume may scatter light, so that memory follows the 
+  sparsity of the scene. Occlusion is only ever looked up where light
+  scatters, so the remaining blocks store a constant transmittance of one.
+
+  Empty blocks are found through Volume::boundsMajorant(). Volumes that 
+  can't bound their scattering get a fully allocated buffer.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC SparseVoxelOccluder : public Occluder
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(SparseVoxelOccluder);
+  
+  // Constructor, factory method -----------------------------------------------
+
+  //! Constructor requires a Renderer and the light position to use for 
+  //! precomputation.
+  SparseVoxelOccluder(Renderer::CPtr renderer, const Vector &wsLightPos,
+                      const size_t res);
+
+  PVR_DEFINE_CREATE_FUNC_3_ARG(SparseVoxelOccluder, Renderer::CPtr, 
+                               const Vector&, const size_t);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(SparseVoxelOccluder);
+
+  // From Occluder -------------------------------------------------------------
+
+  virtual Color sample(const OcclusionSampleState &state) const;
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Worker thread entry point. Computes every numThreads'th of the given
+  //! blocks, starting at the given thread index.
+  void computeBlocks(Renderer::CPtr renderer, const Vector &wsLightPos,
+                     const std::vector<Imath::V3i> &blocks,
+                     const size_t numThreads, Sys::JobState &job,
+                     const size_t thread);
+
+  // Data members --------------------------------------------------------------
+
+  SparseBuffer m_buffer;
+  //! The mapping of m_buffer, kept so that sample() doesn't copy the
+  //! pointer that FieldRes::mapping() returns.
+  Field3D::FieldMapping::Ptr m_mapping;
+  //! Accounts for the memory used by m_buffer
+  Sys::Memory::Tracker m_bufferMemory;
+  //! Linear interpolator
+  Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
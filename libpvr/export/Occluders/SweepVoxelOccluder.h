@@ -0,0 +1,139 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SweepVoxelOccluder.h
+  Contains the SweepVoxelOccluder class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SWEEPVOXELOCCLUDER_H__
+#define __INCLUDED_PVR_SWEEPVOXELOCCLUDER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Occluders/VoxelOccluder.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SweepVoxelOccluder
+//----------------------------------------------------------------------------//
+
+/*! \class SweepVoxelOccluder
+  \brief A VoxelOccluder whose buffer is propagated outward from the light
+  instead of tracing a full shadow ray from every voxel.
+
+  Voxels are processed in shells of increasing distance (in the max norm,
+  measured in voxels) from the light. Each voxel only traces the short 
+  segment back to the next layer of voxels towards the light, and 
+  multiplies its transmittance with the bilinearly interpolated value 
+  already computed there. Building thus costs about one voxel's worth of
+  raymarching per voxel, rather than one full ray.
+
+  Voxels whose upstream neighbors fall outside the buffer, or haven't been
+  computed yet, trace the full ray as VoxelOccluder does. These are 
+  limited to the buffer's boundary and the diagonals through the light.
+
+  \note Repeated interpolation slightly blurs shadows along the light's 
+  direction compared to VoxelOccluder.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC SweepVoxelOccluder : public VoxelOccluder
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(SweepVoxelOccluder);
+  
+  // Constructor, factory method -----------------------------------------------
+
+  //! Constructor requires a Renderer and the light position to use for 
+  //! precomputation.
+  SweepVoxelOccluder(Renderer::CPtr renderer, const Vector &wsLightPos,
+                     const size_t res);
+
+  PVR_DEFINE_CREATE_FUNC_3_ARG(SweepVoxelOccluder, Renderer::CPtr, 
+                               const Vector&, const size_t);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(SweepVoxelOccluder);
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Index range [min, max] of the voxels in one shell, along each axis
+  struct Shell
+  {
+    //! Voxels closer to the light than the shell's outer edge
+    Imath::Box3i outer;
+    //! Voxels closer to the light than the shell's inner edge. These have 
+    //! been computed before the shell.
+    Imath::Box3i inner;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the voxels of the given shell, clipped to the data window
+  Shell shell(const Vector &vsLightPos, const int index) const;
+  //! Worker thread entry point. Computes every numThreads'th z slice of the
+  //! shell, starting at the given thread index.
+  void  sweepShell(Renderer::CPtr renderer, const Vector &wsLightPos,
+                   const Vector &vsLightPos, const Shell &shell,
+                   const size_t numThreads, Sys::JobState &job,
+                   const size_t thread);
+  //! Computes a single voxel
+  Color sweepVoxel(Renderer::CPtr renderer, RayState &state, 
+                   const Vector &wsLightPos, const Vector &vsLightPos, 
+                   const Imath::Box3i &inner, const int x, const int y, 
+                   const int z) const;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -34,6 +34,8 @@
 
 // System headers
 
+#include <vector>
+
 // Library headers
 
 // Project headers
@@ -57,6 +59,13 @@ namespace Render {
 
 /*! \class TransmittanceMapOccluder
   \brief Determines occlusion using a transmittance map.
+
+  Lookups can be blurred for soft shadows. Setting a blur builds a pyramid
+  of prefiltered maps, each half the size of the one before, whose pixels
+  average the transmittance functions of four pixels of the level below at
+  common depths. A lookup then picks the two levels that bracket the filter
+  width and blends between them, so a wide blur costs the same as a sharp
+  lookup, and a low resolution map still gives smooth shadows.
  */
 
 //----------------------------------------------------------------------------//
@@ -85,6 +94,15 @@ public:
   PVR_DEFINE_CREATE_FUNC_3_ARG(TransmittanceMapOccluder, 
                                Renderer::CPtr, Camera::CPtr, const size_t);
 
+  //! Constructs the occluder from an existing transmittance map, such as 
+  //! one loaded with DeepImage::read(). The camera must match the one the
+  //! map was rendered with.
+  TransmittanceMapOccluder(DeepImage::CPtr transmittanceMap, 
+                           Camera::CPtr camera);
+
+  PVR_DEFINE_CREATE_FUNC_2_ARG(TransmittanceMapOccluder, 
+                               DeepImage::CPtr, Camera::CPtr);
+
   // From ParamBase ------------------------------------------------------------
 
   PVR_DEFINE_TYPENAME(TransmittanceMapOccluder);
@@ -92,15 +110,63 @@ public:
   // From Occluder -------------------------------------------------------------
 
   virtual Color sample(const OcclusionSampleState &state) const;
+  //! Shares a DeepImage::LerpCursor between the points, so that a batch of
+  //! points along a ray walks each pixel function once.
+  virtual void  sampleBatch(const OcclusionSampleStatePtrVec &states,
+                            ColorVec &transmittances) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the transmittance map, e.g. for writing it to disk
+  DeepImage::CPtr transmittanceMap() const
+  { return m_transmittanceMap; }
+  //! Sets the width of the lookup filter, in pixels of the transmittance
+  //! map. Widths above one build the prefiltered pyramid, if needed.
+  void            setBlur(const float pixels);
+  //! Returns the width of the lookup filter in pixels
+  float           blur() const
+  { return m_blur; }
+  //! Sets the width of the lookup filter in world space units. The width 
+  //! in pixels then follows from the distance to the light, so that the 
+  //! blur stays the same size across the scene. Adds to setBlur().
+  void            setWorldBlur(const float width);
+  //! Returns the width of the lookup filter in world space units
+  float           worldBlur() const
+  { return m_worldBlur; }
+  //! Returns the number of levels of the prefiltered pyramid, including 
+  //! the transmittance map itself. One until a blur is set.
+  size_t          numLevels() const
+  { return m_levels.size() + 1; }
 
 protected:
 
+  // Utility methods -----------------------------------------------------------
+
+  //! Finds the raster position and depth of a point in the transmittance 
+  //! map.
+  //! \returns False if the point is outside the map.
+  bool          project(const OcclusionSampleState &state, Vector &rsP,
+                        float &depth) const;
+  //! Returns the width of the lookup filter at the given depth, in pixels
+  float         filterWidth(const float depth) const;
+  //! Looks up one level of the pyramid. Level zero is the map itself.
+  Color         lerpLevel(const size_t level, const Vector &rsP, 
+                          const float depth) const;
+  //! Builds the prefiltered pyramid, unless it has been built already
+  void          buildPyramid();
+
   // Data members --------------------------------------------------------------
 
   bool            m_clipBehindCamera;
   DeepImage::CPtr m_transmittanceMap;
   Camera::CPtr    m_camera;
   Imath::V2f      m_rasterBounds;
+  //! Prefiltered levels of the transmittance map, from the second level on
+  std::vector<DeepImage::CPtr> m_levels;
+  float           m_blur;
+  float           m_worldBlur;
+  //! Angle between the rays of neighboring pixels near the map's center
+  float           m_pixelAngle;
 };
 
 //----------------------------------------------------------------------------//
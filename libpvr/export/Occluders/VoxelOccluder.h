@@ -41,7 +41,9 @@
 // Project headers
 
 #include "pvr/export.h"
+#include "pvr/Memory.h"
 #include "pvr/Renderer.h"
+#include "pvr/Threading.h"
 #include "pvr/VoxelBuffer.h"
 #include "pvr/Occluders/Occluder.h"
 
@@ -79,6 +81,36 @@ public:
   PVR_DEFINE_CREATE_FUNC_3_ARG(VoxelOccluder, Renderer::CPtr, const Vector&,
                             const size_t);
 
+  // I/O -----------------------------------------------------------------------
+
+  //! Writes the transmittance buffer to a Field3D file, so that it can be
+  //! reused while the scene's volume and the light stay the same.
+  //! \returns false if the file couldn't be written
+  bool       write(const std::string &filename) const;
+  //! Creates a VoxelOccluder from a file written by write(), without 
+  //! recomputing the transmittance buffer.
+  //! \returns A null pointer if the file couldn't be read
+  static Ptr read(const std::string &filename);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Approximates multiple scattering by diffusing the transmittance buffer
+  //! into a second buffer of the same resolution. Each iteration applies a 
+  //! separable three voxel box blur, so more iterations carry light further
+  //! into shadowed regions. sample() then returns the transmittance plus 
+  //! strength times the diffused buffer, at the cost of one extra lookup.
+  //! A strength of zero disables the term and frees the buffer.
+  //! \note The result may exceed one, which also brightens lit regions.
+  void computeMultipleScattering(const size_t iterations, 
+                                 const float strength);
+  //! Returns the transmittance buffer
+  const DenseBuffer& buffer() const;
+  //! Returns the diffused transmittance buffer. Empty unless multiple 
+  //! scattering has been computed.
+  const DenseBuffer& multipleScatteringBuffer() const;
+  //! Returns the multiple scattering strength. Zero if disabled.
+  float multipleScatteringStrength() const;
+
   // From ParamBase ------------------------------------------------------------
 
   PVR_DEFINE_TYPENAME(VoxelOccluder);
@@ -89,9 +121,52 @@ public:
 
 protected:
 
+  // Constructor ---------------------------------------------------------------
+
+  //! Constructs an occluder with an empty buffer. Used by read().
+  VoxelOccluder()
+    : m_bufferMemory(Sys::Memory::OccluderBuffers), 
+      m_msStrength(0.0f), m_msBufferMemory(Sys::Memory::OccluderBuffers)
+  { }
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Sets the mapping of the buffer, and keeps it in m_mapping.
+  void setMapping(Field3D::FieldMapping::Ptr mapping);
+  //! Maps the buffer onto the given bounds with a MatrixFieldMapping.
+  //! \returns The resolution giving the longest edge res voxels.
+  Imath::V3i setupUniformMapping(const BBox &wsBounds, const size_t res);
+  //! Allocates the buffer at the given resolution and fills it with the 
+  //! transmittance towards the light. The buffer's mapping must already be
+  //! set. 
+  //! \param name Describes the occluder in the memory budget check
+  void computeBuffer(Renderer::CPtr renderer, const Vector &wsLightPos,
+                     const Imath::V3i &bufferRes, const std::string &name);
+  //! Worker thread entry point. Computes every numThreads'th z slice of the
+  //! buffer, starting at the given thread index.
+  void computeSlices(Renderer::CPtr renderer, const Vector &wsLightPos,
+                     const size_t numThreads, Sys::JobState &job,
+                     const size_t thread);
+  //! Worker thread entry point. Blurs every numThreads'th z slice of src 
+  //! along the given axis into dst.
+  void blurSlices(const DenseBuffer &src, DenseBuffer &dst, const int axis,
+                  const size_t numThreads, Sys::JobState &job,
+                  const size_t thread) const;
+
   // Data members --------------------------------------------------------------
 
   DenseBuffer m_buffer;
+  //! The mapping of m_buffer. FieldRes::mapping() returns the pointer by
+  //! value, which costs a reference count update on every sample.
+  Field3D::FieldMapping::Ptr m_mapping;
+  //! Accounts for the memory used by m_buffer
+  Sys::Memory::Tracker m_bufferMemory;
+  //! Diffused transmittance, used to approximate multiple scattering
+  DenseBuffer m_msBuffer;
+  //! Multiplier for m_msBuffer. Zero if multiple scattering is disabled
+  float m_msStrength;
+  //! Accounts for the memory used by m_msBuffer
+  Sys::Memory::Tracker m_msBufferMemory;
   //! Linear interpolator
   Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
 
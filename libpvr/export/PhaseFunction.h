@@ -34,6 +34,8 @@
 
 // System headers
 
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
 
 // Project headers
@@ -70,6 +72,126 @@ public:
   //! Returns the scattering probability given two normalized vectors
   virtual float probability(const Vector &in, const Vector &out) const = 0;
 
+  // Main methods --------------------------------------------------------------
+
+  //! Whether the probability is the same for all directions. Lighting 
+  //! caches use this to decide whether the incoming light's direction may
+  //! be discarded.
+  virtual bool isIsotropic() const
+  { return false; }
+
+};
+
+//----------------------------------------------------------------------------//
+// CosineTable
+//----------------------------------------------------------------------------//
+
+/*! \class CosineTable
+  \brief Tabulates a phase function over the cosine of the scattering angle.
+
+  Lookups interpolate linearly between Resolution + 1 evenly spaced 
+  entries, which replaces the per-lookup std::pow() of the Henyey-Greenstein
+  functions with a table lookup.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC CosineTable
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Number of table intervals between cosTheta -1 and 1
+  enum { Resolution = 1024 };
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the cosine that the given entry is tabulated at
+  static float cosTheta(const size_t idx)
+  { return -1.0f + 2.0f * static_cast<float>(idx) / Resolution; }
+  //! Returns whether the table has been allocated
+  bool  empty() const
+  { return m_values.empty(); }
+  //! Allocates the table. All entries are zero.
+  void  allocate()
+  { m_values.assign(Resolution + 1, 0.0f); }
+  //! Sets the value of the given entry
+  void  setValue(const size_t idx, const float value)
+  { m_values[idx] = value; }
+  //! Returns the interpolated value at the given cosine
+  float lookup(const float cosTheta) const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! Tabulated values
+  std::vector<float> m_values;
+
+};
+
+//----------------------------------------------------------------------------//
+// Lobes
+//----------------------------------------------------------------------------//
+
+/*! \class Lobes
+  \brief A weighted mix of phase functions, stored inline.
+
+  Volumes that blend the phase functions of several children return the 
+  per-sample mix in VolumeSample::lobes, so that no phase function object
+  is modified during rendering. The phase functions are referenced by raw
+  pointer and are owned by the volumes that returned them.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC Lobes
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Maximum number of lobes. Once full, adding a lobe replaces the 
+  //! lightest one, if the new lobe is heavier.
+  enum { MaxLobes = 4 };
+
+  // Ctor ----------------------------------------------------------------------
+
+  Lobes()
+    : m_size(0)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the number of lobes
+  size_t size() const
+  { return m_size; }
+  //! Returns whether there are no lobes
+  bool   empty() const
+  { return m_size == 0; }
+  //! Adds a lobe with the given weight
+  void   add(const PhaseFunction *function, const float weight);
+  //! Adds all lobes of another mix, scaled so that their weights sum to
+  //! the given weight
+  void   add(const Lobes &lobes, const float weight);
+  //! Returns the weighted average of the lobes' scattering probabilities.
+  //! Returns isotropic scattering if the weights sum to zero.
+  float  probability(const Vector &in, const Vector &out) const;
+  //! Whether every lobe with non-zero weight is isotropic
+  bool   isIsotropic() const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! Phase function of each lobe
+  const PhaseFunction *m_functions[MaxLobes];
+  //! Weight of each lobe
+  float                m_weights[MaxLobes];
+  //! Number of lobes in use
+  size_t               m_size;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -97,12 +219,16 @@ public:
   // From PhaseFunction --------------------------------------------------------
 
   virtual float probability(const Vector &in, const Vector &out) const; 
+  //! True if all the composited phase functions are isotropic
+  virtual bool  isIsotropic() const;
 
   // Main methods --------------------------------------------------------------
 
   //! Adds a phase function to the composite
   void add(PhaseFunction::CPtr phaseFunction);
   //! Sets the weight of one phase function
+  //! \note Not thread safe. Volumes that mix phase functions per sample
+  //! should return Lobes instead.
   void setWeight(const size_t idx, const float weight);
 
 private:
@@ -141,6 +267,8 @@ public:
   // From PhaseFunction --------------------------------------------------------
 
   virtual float probability(const Vector &in, const Vector &out) const;
+  virtual bool  isIsotropic() const
+  { return true; }
 
 };
 
@@ -178,6 +306,8 @@ private:
 
   //! Eccentricity parameter
   const float m_g;
+  //! Tabulated probability. Empty if the lobe is too narrow to tabulate.
+  CosineTable m_table;
 
 };
 
@@ -219,6 +349,8 @@ private:
   const float m_g2;
   //! Blend parameter
   const float m_blend;
+  //! Tabulated probability. Empty if either lobe is too narrow to tabulate.
+  CosineTable m_table;
 
 };
 
@@ -0,0 +1,99 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlueNoiseSampler.h
+  Contains the BlueNoiseSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_BLUENOISESAMPLER_H__
+#define __INCLUDED_PVR_BLUENOISESAMPLER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/PixelSamplers/PixelSampler.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// BlueNoiseSampler
+//----------------------------------------------------------------------------//
+
+/*! \class BlueNoiseSampler
+   \brief Owen-scrambled Sobol points, offset per pixel by a blue noise 
+   mask.
+
+   All pixels share the same sequence, shifted toroidally by the value of a
+   64x64 void-and-cluster mask at the pixel. Neighboring pixels get very 
+   different shifts, which pushes the noise in the image toward high 
+   frequencies, where it is less visible and filters away easily. The 
+   mask is generated the first time it is needed.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC BlueNoiseSampler : public PixelSampler
+{
+public:
+  // Typedefs ---
+  PVR_TYPEDEF_SMART_PTRS(BlueNoiseSampler);
+  // Ctor, factory ---
+  PVR_DEFINE_CREATE_FUNC(BlueNoiseSampler);
+  // From ParamBase ---
+  PVR_DEFINE_TYPENAME(BlueNoiseSampler);
+  // From PixelSampler ---
+  virtual float sample(const size_t x, const size_t y, const size_t index, 
+                       const size_t numSamples, 
+                       const size_t dimension) const;
+private:
+  // Utility methods ---
+  //! Returns the mask value at the given pixel, for a given dimension
+  static float maskValue(const size_t x, const size_t y, 
+                         const size_t dimension);
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
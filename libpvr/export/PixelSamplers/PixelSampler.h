@@ -0,0 +1,148 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file PixelSampler.h
+  Contains the PixelSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_PIXELSAMPLER_H__
+#define __INCLUDED_PVR_PIXELSAMPLER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+#include <boost/cstdint.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/ParamBase.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// PixelSampler
+//----------------------------------------------------------------------------//
+
+/*! \class PixelSampler
+   \brief Base class for pixel samplers.
+
+   These classes provide the sample values that the Renderer uses to place
+   its camera rays in the pixel and in the shutter interval. A sample value
+   is a pure function of the pixel, the sample index and the dimension, 
+   which makes samplers thread safe and the results independent of the 
+   order in which tiles are rendered.
+
+   The first dimensions are reserved for the camera, see Dimension. Other 
+   users, such as occluders, should start at LastCameraDimension.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC PixelSampler : public Util::ParamBase
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Dimensions used by the Renderer for its camera samples
+  enum Dimension {
+    PixelX = 0,
+    PixelY,
+    Time,
+    //! Offset of the raymarch steps. See RayState::stepOffset.
+    StepOffset,
+    LastCameraDimension
+  };
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(PixelSampler);
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Returns the value in [0,1) of the given sample in the given pixel. 
+  //! \param numSamples The number of samples that the caller takes per 
+  //! pass. Samplers may use it to stratify, but must accept indices beyond
+  //! it, since adaptive sampling takes several passes.
+  virtual float sample(const size_t x, const size_t y, const size_t index, 
+                       const size_t numSamples, 
+                       const size_t dimension) const = 0;
+
+protected:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Scrambles the bits of a 32 bit value
+  static boost::uint32_t hash(boost::uint32_t value);
+  //! Combines two values into a new hash
+  static boost::uint32_t hash(const boost::uint32_t a, 
+                              const boost::uint32_t b);
+  //! Returns a seed that is unique to the given pixel and dimension
+  static boost::uint32_t seed(const size_t x, const size_t y, 
+                              const size_t dimension);
+  //! Returns a value in [0,1) using the top 24 bits of the argument
+  static float toUnit(const boost::uint32_t value);
+  //! Clamps a value to [0,1). Sums of strata and offsets may otherwise 
+  //! round up to 1.0.
+  static float clampUnit(const float value);
+  //! Returns the index'th element of a pseudo-random permutation of 
+  //! [0, size)
+  static boost::uint32_t permute(boost::uint32_t index, 
+                                 const boost::uint32_t size, 
+                                 const boost::uint32_t seed);
+  //! Reverses the order of the bits in a 32 bit value
+  static boost::uint32_t reverseBits(boost::uint32_t value);
+  //! Applies a nested uniform (Owen) scramble to a 0.32 fixed point value
+  static boost::uint32_t owenScramble(const boost::uint32_t value, 
+                                      const boost::uint32_t seed);
+  //! Returns the index'th point of the given dimension (0 or 1) of the 
+  //! Sobol sequence, as a 0.32 fixed point value
+  static boost::uint32_t sobol(boost::uint32_t index, 
+                               const size_t dimension);
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
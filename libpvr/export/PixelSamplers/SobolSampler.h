@@ -0,0 +1,93 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file SobolSampler.h
+  Contains the SobolSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SOBOLSAMPLER_H__
+#define __INCLUDED_PVR_SOBOLSAMPLER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/PixelSamplers/PixelSampler.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SobolSampler
+//----------------------------------------------------------------------------//
+
+/*! \class SobolSampler
+   \brief Owen-scrambled Sobol points.
+
+   Dimensions are taken in pairs from the first two Sobol dimensions, which
+   together form a (0,2)-sequence. Every power of two prefix is stratified
+   in both dimensions of a pair, also across adaptive sampling passes. The
+   points are Owen-scrambled and reordered per pixel and pair, following 
+   Burley, "Practical Hash-based Owen Scrambling".
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC SobolSampler : public PixelSampler
+{
+public:
+  // Typedefs ---
+  PVR_TYPEDEF_SMART_PTRS(SobolSampler);
+  // Ctor, factory ---
+  PVR_DEFINE_CREATE_FUNC(SobolSampler);
+  // From ParamBase ---
+  PVR_DEFINE_TYPENAME(SobolSampler);
+  // From PixelSampler ---
+  virtual float sample(const size_t x, const size_t y, const size_t index, 
+                       const size_t numSamples, 
+                       const size_t dimension) const;
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
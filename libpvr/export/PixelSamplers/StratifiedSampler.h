@@ -0,0 +1,92 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file StratifiedSampler.h
+  Contains the StratifiedSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_STRATIFIEDSAMPLER_H__
+#define __INCLUDED_PVR_STRATIFIEDSAMPLER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/PixelSamplers/PixelSampler.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// StratifiedSampler
+//----------------------------------------------------------------------------//
+
+/*! \class StratifiedSampler
+   \brief Jittered stratification of each dimension.
+
+   Each pass of numSamples samples puts one sample in each of numSamples 
+   equal strata, in an order that is shuffled per pixel, dimension and 
+   pass. This matches the Renderer's original sampling of the shutter 
+   interval.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC StratifiedSampler : public PixelSampler
+{
+public:
+  // Typedefs ---
+  PVR_TYPEDEF_SMART_PTRS(StratifiedSampler);
+  // Ctor, factory ---
+  PVR_DEFINE_CREATE_FUNC(StratifiedSampler);
+  // From ParamBase ---
+  PVR_DEFINE_TYPENAME(StratifiedSampler);
+  // From PixelSampler ---
+  virtual float sample(const size_t x, const size_t y, const size_t index, 
+                       const size_t numSamples, 
+                       const size_t dimension) const;
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
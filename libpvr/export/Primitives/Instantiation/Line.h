@@ -51,13 +51,14 @@
 // Defines
 //----------------------------------------------------------------------------//
 
-//! Interpolates an attribute in m_pointAttrs.
+//! Interpolates an attribute in a vector of PointAttrState.
+//! \param attrs Vector of PointAttrState
 //! \param variable Name of variable
 //! \param t In range [0, nPoints - 1]
-#define LINE_INST_INTERP(variable, t)                                   \
+#define LINE_INST_INTERP(attrs, variable, t)                            \
   Math::fit01(t - std::floor(t),                                        \
-    m_pointAttrs[static_cast<int>(std::floor(t))].variable.value(),     \
-    m_pointAttrs[static_cast<int>(std::ceil(t))].variable.value())  \
+    attrs[static_cast<int>(std::floor(t))].variable.value(),            \
+    attrs[static_cast<int>(std::ceil(t))].variable.value())  \
   
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -80,7 +81,7 @@ namespace Inst {
 
 //----------------------------------------------------------------------------//
 
-class LIBPVR_PUBLIC Line : public InstantiationPrim
+class LIBPVR_PUBLIC Line : public PointInstancer
 {
 public:
   
@@ -96,15 +97,18 @@ public:
 
   PVR_DEFINE_TYPENAME(LineInstancer);
 
-  // From Primitive ------------------------------------------------------------
-
-  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
-
-  // From InstantiationPrimitive -----------------------------------------------
+protected:
 
-  virtual ModelerInput::Ptr execute(const Geo::Geometry::CPtr geo) const;
+  // From PointInstancer -------------------------------------------------------
 
-protected:
+  virtual size_t numInputs(const Geo::Geometry::CPtr geo) const;
+  virtual InstancingContext::Ptr 
+  createContext(const Geo::Geometry::CPtr geo) const;
+  virtual size_t updateInput(const size_t input, 
+                             InstancingContext &context) const;
+  virtual void instanceInput(InstancingContext &context, 
+                             InstancePoint *points) const;
+  virtual BBox inputWsBounds(const InstancingContext &context) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -149,6 +153,8 @@ protected:
 
     Noise::Fractal::CPtr  densFractal;
     Noise::Fractal::CPtr  dispFractal;
+    Noise::fBmCache       densFractalCache;
+    Noise::fBmCache       dispFractalCache;
   };
 
   //! Contains the per-point attributes
@@ -180,24 +186,26 @@ protected:
     Geo::Attr<Imath::V3f> density;
   };
 
-  // Utility functions ---------------------------------------------------------
-
-  //! Counts the number of points that will be created for the given 
-  //! input geometry
-  size_t numOutputPoints(const Geo::Geometry::CPtr geo) const;
-
-  virtual void updatePolyAttrs(Geo::AttrVisitor::const_iterator i) const;
-  virtual void updatePointAttrs(Geo::AttrVisitor::const_iterator i, 
-                                const size_t numPoints) const;
-
-  // Data members --------------------------------------------------------------
-
-  //! Holds the Attr instances that describe a single primitive
-  //! Gets set up in execute() and is used in getSample().
-  mutable PolyAttrState m_polyAttrs;
+  //! Per-thread instancing state
+  struct Context : public InstancingContext
+  {
+    Context(Geo::Polygons::CPtr polys, const Util::ParamMap &params)
+      : polys(polys), 
+        polyVisitor(polys->polyAttrs(), params), 
+        pointVisitor(polys->pointAttrs(), params)
+    { }
 
-  //! Holds the Attr instances that describe each point on the line prim
-  mutable std::vector<PointAttrState> m_pointAttrs;
+    //! Input polygons
+    Geo::Polygons::CPtr         polys;
+    //! Visits the polygons
+    Geo::AttrVisitor            polyVisitor;
+    //! Visits the points of the polygons
+    Geo::AttrVisitor            pointVisitor;
+    //! Attributes of the current line. Gets set up in updateInput().
+    PolyAttrState               polyAttrs;
+    //! Attributes of each point on the current line
+    std::vector<PointAttrState> pointAttrs;
+  };
 
 };
 
@@ -68,7 +68,7 @@ namespace Inst {
 
 //----------------------------------------------------------------------------//
 
-class LIBPVR_PUBLIC Sphere : public InstantiationPrim
+class LIBPVR_PUBLIC Sphere : public PointInstancer
 {
 public:
   
@@ -84,15 +84,18 @@ public:
 
   PVR_DEFINE_TYPENAME(SphereInstancer);
 
-  // From Primitive ------------------------------------------------------------
-
-  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
+protected:
 
-  // From InstantiationPrimitive -----------------------------------------------
+  // From PointInstancer -------------------------------------------------------
 
-  virtual ModelerInput::Ptr execute(const Geo::Geometry::CPtr geo) const;
-
-protected:
+  virtual size_t numInputs(const Geo::Geometry::CPtr geo) const;
+  virtual InstancingContext::Ptr 
+  createContext(const Geo::Geometry::CPtr geo) const;
+  virtual size_t updateInput(const size_t input, 
+                             InstancingContext &context) const;
+  virtual void instanceInput(InstancingContext &context, 
+                             InstancePoint *points) const;
+  virtual BBox inputWsBounds(const InstancingContext &context) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -120,11 +123,15 @@ protected:
         dispLacunarity("displacement_noise_lacunarity",  1.92f), 
         dispAmplitude ("displacement_noise_amplitude",   1.0f), 
         doDensNoise   ("density_noise",                  0), 
-        doDispNoise   ("displacement_noise",             0)
+        doDispNoise   ("displacement_noise",             0),
+        tiledNoise    ("tiled_noise",                    0),
+        simplexNoise  ("simplex_noise",                  0)
     { }
 
     // Main methods ---
 
+    //! Binds the point attributes to the visitor's table
+    void bind(const Geo::AttrVisitor &visitor);
     //! Updates the point attributes
     void update(const Geo::AttrVisitor::const_iterator &i);
 
@@ -149,21 +156,28 @@ protected:
     Geo::Attr<float>      dispAmplitude;
     Geo::Attr<int>        doDensNoise;    
     Geo::Attr<int>        doDispNoise;
+    Geo::Attr<int>        tiledNoise;
+    Geo::Attr<int>        simplexNoise;
     Noise::Fractal::CPtr  densFractal;
     Noise::Fractal::CPtr  dispFractal;
+    Noise::fBmCache       densFractalCache;
+    Noise::fBmCache       dispFractalCache;
   };
 
-  // Utility functions ---------------------------------------------------------
-
-  //! Counts the number of points that will be created for the given 
-  //! input geometry
-  size_t numOutputPoints(const Geo::Geometry::CPtr geo) const;
-
-  // Data members --------------------------------------------------------------
-
-  //! Holds the Attr instances that describe a single point.
-  //! Gets set up in execute() and is used in getSample().
-  mutable AttrState m_attrs;
+  //! Per-thread instancing state
+  struct Context : public InstancingContext
+  {
+    Context(const Geo::AttrTable &points, const Util::ParamMap &params)
+      : visitor(points, params)
+    { 
+      attrs.bind(visitor);
+    }
+
+    //! Visits the input points
+    Geo::AttrVisitor visitor;
+    //! Attributes of the current input point. Gets set up in updateInput().
+    AttrState        attrs;
+  };
 
 };
 
@@ -47,21 +47,6 @@
 #include "pvr/Types.h"
 #include "pvr/Noise/Noise.h"
 
-//----------------------------------------------------------------------------//
-// Defines
-//----------------------------------------------------------------------------//
-
-//! Interpolates an attribute in m_pointAttrs.
-//! \param variable Name of variable
-//! \param s In range [0, numCols - 1]
-//! \param t In range [0, numRows - 1]
-#define SURFACE_INST_INTERP(variable, s, t)                                \
-  Math::linear2D(s - std::floor(s), t - std::floor(t),                     \
-    m_pointAttrs[pointIdx(s, t, numCols, numRows, 0, 0)].variable.value(), \
-    m_pointAttrs[pointIdx(s, t, numCols, numRows, 1, 0)].variable.value(), \
-    m_pointAttrs[pointIdx(s, t, numCols, numRows, 0, 1)].variable.value(), \
-    m_pointAttrs[pointIdx(s, t, numCols, numRows, 1, 1)].variable.value()) \
-  
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -79,11 +64,15 @@ namespace Inst {
   \brief Implements the surface-based instantiation primitive.
 
   Instantiation-based primitives are covered in chapter XX.
+
+  Instances are spread uniformly in the mesh's parameter space, unless the
+  mesh's area_uniform attribute is set, in which case each patch receives
+  instances in proportion to its world space area.
  */
 
 //----------------------------------------------------------------------------//
 
-class LIBPVR_PUBLIC Surface : public InstantiationPrim
+class LIBPVR_PUBLIC Surface : public PointInstancer
 {
 public:
   
@@ -99,15 +88,18 @@ public:
 
   PVR_DEFINE_TYPENAME(SurfaceInstancer);
 
-  // From Primitive ------------------------------------------------------------
-
-  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
-
-  // From InstantiationPrimitive -----------------------------------------------
+protected:
 
-  virtual ModelerInput::Ptr execute(const Geo::Geometry::CPtr geo) const;
+  // From PointInstancer -------------------------------------------------------
 
-protected:
+  virtual size_t numInputs(const Geo::Geometry::CPtr geo) const;
+  virtual InstancingContext::Ptr 
+  createContext(const Geo::Geometry::CPtr geo) const;
+  virtual size_t updateInput(const size_t input, 
+                             InstancingContext &context) const;
+  virtual void instanceInput(InstancingContext &context, 
+                             InstancePoint *points) const;
+  virtual BBox inputWsBounds(const InstancingContext &context) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -130,7 +122,8 @@ protected:
         dispLacunarity("displacement_noise_lacunarity",  1.92f), 
         dispAmplitude ("displacement_noise_amplitude",   1.0f), 
         doDensNoise   ("density_noise",                  0), 
-        doDispNoise   ("displacement_noise",             0)
+        doDispNoise   ("displacement_noise",             0),
+        doAreaUniform ("area_uniform",                   0)
     { }
     
     void update(const Geo::AttrVisitor::const_iterator &i);
@@ -151,9 +144,12 @@ protected:
     Geo::Attr<float>      dispAmplitude;
     Geo::Attr<int>        doDensNoise;    
     Geo::Attr<int>        doDispNoise;
+    Geo::Attr<int>        doAreaUniform;
 
     Noise::Fractal::CPtr  densFractal;
     Noise::Fractal::CPtr  dispFractal;
+    Noise::fBmCache       densFractalCache;
+    Noise::fBmCache       dispFractalCache;
   };
 
   //! Contains the per-point attributes
@@ -187,42 +183,71 @@ protected:
     Geo::Attr<Imath::V3f> density;
   };
 
-  // Utility functions ---------------------------------------------------------
+  //! The corner values of each patch of a mesh, i.e. each quad between 
+  //! four neighbouring points. The corners of a patch are packed together,
+  //! so interpolating an instance reads one contiguous block rather than 
+  //! four scattered PointAttrStates.
+  struct PatchTable
+  {
+    PatchTable()
+      : numCols(0), numRows(0)
+    { }
 
-  //! Returns the index of the point for the given parametric coordinates
-  //! \param s Coordinate in range [0, numCols-1]
-  //! \param t Coordinate in range [0, numRows-1]
-  //! \param numCols Size of current mesh in X direction
-  //! \param numRows Size of current mesh in Y direction
-  //! \param xOff Offset in X direction
-  //! \param yOff Offset in Y direction
-  size_t pointIdx(const float s, const float t, 
-                  const size_t numCols, const size_t numRows, 
-                  const int xOff, const int yOff) const;
+    //! Rebuilds the table for the given mesh points
+    //! \param doAreaCdf Whether to build the area CDF
+    void update(const std::vector<PointAttrState> &pointAttrs, 
+                const size_t meshCols, const size_t meshRows, 
+                const bool doAreaCdf);
+
+    //! Number of patches in X direction
+    size_t             numCols;
+    //! Number of patches in Y direction
+    size_t             numRows;
+    //! Indexed by [patch][channel][corner], with the channels listed in
+    //! Surface.cpp
+    std::vector<float> corners;
+    //! Running sum of the patch areas, normalized to end at 1.0. Empty
+    //! unless built with areaCdf, or if the mesh has no area.
+    std::vector<float> areaCdf;
+  };
+
+  //! Per-thread instancing state
+  struct Context : public InstancingContext
+  {
+    Context(Geo::Meshes::CPtr meshes, const Util::ParamMap &params)
+      : meshes(meshes), 
+        meshVisitor(meshes->meshAttrs(), params), 
+        pointVisitor(meshes->pointAttrs(), params),
+        numCols(0),
+        numRows(0)
+    { }
+
+    //! Input meshes
+    Geo::Meshes::CPtr           meshes;
+    //! Visits the meshes
+    Geo::AttrVisitor            meshVisitor;
+    //! Visits the points of the meshes
+    Geo::AttrVisitor            pointVisitor;
+    //! Attributes of the current mesh. Gets set up in updateInput().
+    SurfAttrState               surfAttrs;
+    //! Attributes of each point on the current mesh
+    std::vector<PointAttrState> pointAttrs;
+    //! Size of the current mesh in X direction
+    size_t                      numCols;
+    //! Size of the current mesh in Y direction
+    size_t                      numRows;
+    //! Patches of the current mesh. Gets set up in instanceInput().
+    PatchTable                  patches;
+  };
+
+  // Utility functions ---------------------------------------------------------
 
   //! Computes a [-1,1] offset based on the position on the primitive
   //! \param x Position in [0,1] range
   //! \param y Position in [0,1] range
   //! \param z Position in [0,1] range
-  //! \note Assumes that m_pointAttrs is updated.
-  float edgeFade(float x, float y, float z) const;
-
-  //! Counts the number of points that will be created for the given 
-  //! input geometry
-  size_t numOutputPoints(const Geo::Geometry::CPtr geo) const;
-
-  virtual void updateSurfAttrs(Geo::AttrVisitor::const_iterator i) const;
-  virtual void updatePointAttrs(Geo::AttrVisitor::const_iterator i, 
-                                const size_t numPoints) const;
-
-  // Data members --------------------------------------------------------------
-
-  //! Holds the Attr instances that describe a single primitive
-  //! Gets set up in execute() and is used in getSample().
-  mutable SurfAttrState m_surfAttrs;
-
-  //! Holds the Attr instances that describe each point on the surface prim
-  mutable std::vector<PointAttrState> m_pointAttrs;
+  //! \param fit Width of the fade in each dimension
+  float edgeFade(float x, float y, float z, const Imath::V3f &fit) const;
 
 };
 
@@ -34,17 +34,19 @@
 
 // System headers
 
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 
 // Library headers
 
 
-
 // Project headers
 
+#include "pvr/export.h"
 #include "pvr/ModelerInput.h"
-#include "pvr/Primitives/Primitive.h"
 #include "pvr/Types.h"
+#include "pvr/VoxelBuffer.h"
+#include "pvr/Primitives/Primitive.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -75,11 +77,261 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(InstantiationPrim);
 
+  //! Receives the output of executeChunked(), one chunk at a time
+  typedef boost::function<void (ModelerInput::Ptr)> ChunkCallback;
+
   // Main methods --------------------------------------------------------------
 
   //! Executes the instantiation primitive
   virtual ModelerInput::Ptr execute(const Geo::Geometry::CPtr geo) const = 0;
 
+  //! Executes the instantiation primitive, handing the output to the callback
+  //! in chunks of at most chunkSize points. Each chunk can be rasterized and
+  //! released before the next one is created, so peak memory depends on the
+  //! chunk size rather than on the total number of points. A chunk size of
+  //! zero means that all points go in a single chunk.
+  //! The default implementation calls execute() and passes the result on as
+  //! a single chunk.
+  //! \param numThreads Number of threads to instance with. Zero means one 
+  //! per core.
+  virtual void executeChunked(const Geo::Geometry::CPtr geo, 
+                              const size_t chunkSize,
+                              const ChunkCallback &callback,
+                              const size_t numThreads = 0) const
+  {
+    ModelerInput::Ptr result = execute(geo);
+    if (result) {
+      callback(result);
+    }
+  }
+
+  //! Rasterizes the instanced points straight into the buffer, without 
+  //! building an intermediate Geometry.
+  //! 
+eturns False if the primitive has no direct path, in which case 
+  //! nothing was written and the caller should fall back to execute().
+  //! \param numThreads Number of threads to instance with. Zero means one 
+  //! per core.
+  virtual bool rasterizeDirect(const Geo::Geometry::CPtr geo, 
+                               VoxelBuffer::Ptr buffer,
+                               const size_t numThreads = 0) const
+  {
+    return false;
+  }
+
+  //! Rasterizes the instanced points into one accumulation grid per 
+  //! thread, as they are generated, and adds the grids to the buffer once 
+  //! all inputs are done. No points are stored beyond the input being 
+  //! instanced, which suits the many sub-voxel points of dense instancing.
+  //! Each grid is sparse, so it costs memory in proportion to the part of 
+  //! the buffer that its thread's points touch.
+  //! \returns False if the primitive has no aggregating path, in which case
+  //! nothing was written and the caller should fall back to 
+  //! rasterizeDirect() or execute().
+  //! \param numThreads Number of threads to instance with. Zero means one 
+  //! per core.
+  //! \param deterministic Whether the result must be the same for any 
+  //! number of threads, down to the round-off of adding up the grids.
+  virtual bool rasterizeAggregated(const Geo::Geometry::CPtr geo, 
+                                   VoxelBuffer::Ptr buffer,
+                                   const size_t numThreads = 0,
+                                   const bool deterministic = false) const
+  {
+    return false;
+  }
+
+};
+
+//----------------------------------------------------------------------------//
+// InstancePoint
+//----------------------------------------------------------------------------//
+
+//! A single point generated by a PointInstancer
+struct InstancePoint
+{
+  Imath::V3f wsP;
+  Imath::V3f wsV;
+  Imath::V3f density;
+  float      radius;
+};
+
+//----------------------------------------------------------------------------//
+// InstancingContext
+//----------------------------------------------------------------------------//
+
+/*! \class InstancingContext
+  \brief Base class for the state of the input (point, polygon, etc.) that a
+  PointInstancer is currently working on.
+
+  Like rasterization primitives, point instancers keep no per-input state in
+  data members. Each subclass instead stores its input attributes in a 
+  subclass of InstancingContext, and each thread uses its own context.
+ */
+
+//----------------------------------------------------------------------------//
+
+class InstancingContext
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(InstancingContext);
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  virtual ~InstancingContext()
+  { }
+
+};
+
+//----------------------------------------------------------------------------//
+// PointSink
+//----------------------------------------------------------------------------//
+
+/*! \class PointSink
+  \brief Receives the points generated by a PointInstancer.
+
+  The sink decides what happens to each point, i.e. whether it is stored
+  in a Geometry or written straight to a voxel buffer.
+ */
+
+//----------------------------------------------------------------------------//
+
+class PointSink
+{
+public:
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  virtual ~PointSink()
+  { }
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Called once before the first point is added, with the total number of
+  //! points that will be added.
+  virtual void begin(const size_t numPoints) = 0;
+  //! Adds a single point
+  virtual void add(const InstancePoint &point) = 0;
+
+};
+
+//----------------------------------------------------------------------------//
+// PointInstancer
+//----------------------------------------------------------------------------//
+
+/*! \class PointInstancer
+  \brief Base class for instantiation primitives whose output is a set of 
+  points rasterized by Rast::Point.
+
+  Subclasses only generate the points of each input, in instanceInput(). 
+  This class provides execute(), executeChunked(), rasterizeDirect() and
+  rasterizeAggregated() on top of it.
+
+  The number of points per input is counted in parallel and prefix-summed,
+  so that each input writes to its own range of the output. Inputs are then instanced in 
+  parallel, in batches, and each batch is handed to the sink in order. 
+  Since every input seeds its own random number generator the output is 
+  identical regardless of the number of threads.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC PointInstancer : public InstantiationPrim
+{
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(PointInstancer);
+
+  // From Primitive ------------------------------------------------------------
+
+  //! Bounds the inputs in parallel, using inputWsBounds()
+  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
+
+  // From InstantiationPrim ----------------------------------------------------
+
+  virtual ModelerInput::Ptr execute(const Geo::Geometry::CPtr geo) const;
+  virtual void executeChunked(const Geo::Geometry::CPtr geo, 
+                              const size_t chunkSize,
+                              const ChunkCallback &callback,
+                              const size_t numThreads = 0) const;
+  virtual bool rasterizeDirect(const Geo::Geometry::CPtr geo, 
+                               VoxelBuffer::Ptr buffer,
+                               const size_t numThreads = 0) const;
+  //! Each grid holds a contiguous range of inputs. Neighboring inputs tend
+  //! to be close in space, which keeps the grids small. There is one grid 
+  //! per thread, so the result depends on the number of threads, unless 
+  //! deterministic is set. The inputs are then split into a fixed number 
+  //! of grids, which the threads fill a batch at a time, and the grids are
+  //! added to the buffer in input order.
+  virtual bool rasterizeAggregated(const Geo::Geometry::CPtr geo, 
+                                   VoxelBuffer::Ptr buffer,
+                                   const size_t numThreads = 0,
+                                   const bool deterministic = false) const;
+
+protected:
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Returns the number of inputs (points, polygons, etc.) in the geometry.
+  //! Returns zero (after printing a warning) if the primitive can't handle
+  //! the geometry.
+  virtual size_t numInputs(const Geo::Geometry::CPtr geo) const = 0;
+  //! Creates a context for instancing the given geometry. Each thread 
+  //! needs its own context.
+  virtual InstancingContext::Ptr 
+  createContext(const Geo::Geometry::CPtr geo) const = 0;
+  //! Loads the attributes of the given input into the context.
+  //! 
+eturns Number of points that the input instances.
+  virtual size_t updateInput(const size_t input, 
+                             InstancingContext &context) const = 0;
+  //! Generates the points of the input last loaded by updateInput(). 
+  //! Writes exactly as many points as updateInput() returned.
+  //! \note May be called concurrently from several threads, each with its 
+  //! own context.
+  virtual void instanceInput(InstancingContext &context, 
+                             InstancePoint *points) const = 0;
+  //! Returns the world-space bounds of the input last loaded by 
+  //! updateInput(), including motion blur and displacement.
+  //! \note May be called concurrently from several threads, each with its 
+  //! own context.
+  virtual BBox inputWsBounds(const InstancingContext &context) const = 0;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! State shared by the worker threads of instance()
+  struct InstanceState;
+  //! State shared by the worker threads of scanInputs()
+  struct ScanState;
+  //! State shared by the worker threads of aggregateInputs()
+  struct AggregateState;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Loads every input once, in parallel, and records the number of points
+  //! of each. Also finds the bounds of all inputs if doBounds is set.
+  void scan(const Geo::Geometry::CPtr geo, 
+            std::vector<InstancingContext::Ptr> &contexts, 
+            const bool doBounds, std::vector<size_t> &counts, 
+            BBox &wsBounds) const;
+  //! Loads the given thread's range of inputs
+  void scanInputs(ScanState &state, const size_t thread) const;
+
+  //! Instances all inputs of the geometry and hands the points to the sink
+  void instance(const Geo::Geometry::CPtr geo, PointSink &sink,
+                const size_t numThreads) const;
+  //! Instances inputs of the current batch until none are left
+  void instanceBatch(InstanceState &state, const size_t thread) const;
+  //! Instances the range of inputs of the thread's group of the current 
+  //! batch into its grid
+  void aggregateInputs(AggregateState &state, const size_t thread) const;
+
 };
 
 //----------------------------------------------------------------------------//
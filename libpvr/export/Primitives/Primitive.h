@@ -86,6 +86,13 @@ public:
   //! Returns a world-space bounding box for the primitive
   //! \note See chapter 8.2.1 (Bounding primitives)
   virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const = 0;
+  //! Returns the world-space size of the smallest features that the 
+  //! primitive produces, e.g. its smallest radius or noise wavelength. 
+  //! Modeler uses it to pick the level of detail that a primitive is 
+  //! rasterized at. The default implementation returns zero, which always
+  //! picks the finest level.
+  virtual float wsFeatureSize(Geo::Geometry::CPtr /* geometry */) const
+  { return 0.0f; }
 
   //! Sets the primitive's global parameters
   //! \note See chapter 5.4 for an overview of attributes and parameters in PVR.
@@ -0,0 +1,177 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuSplatKernels.h
+  Contains the device item descriptions and the host interface of the CUDA
+  kernels used to rasterize Point and PyroclasticPoint primitives.
+  \note Only available when built with PVR_USE_CUDA.
+  \note Everything here is plain data, so that the CUDA sources don't need
+  Imath, Field3D or boost.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_GPUSPLATKERNELS_H__
+#define __INCLUDED_PVR_GPUSPLATKERNELS_H__
+
+#ifdef PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <cstddef>
+#include <string>
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+namespace Prim {
+namespace Rast {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+// Structs
+//----------------------------------------------------------------------------//
+
+//! The voxels that items are rasterized into. Only the blocks that some
+//! item touches are allocated on the device. Each is a brick of
+//! blockSize^3 voxels with three floats per voxel, x varying fastest.
+struct Grid
+{
+  //! Voxel-to-world matrix without its translation, for row vectors as in
+  //! Imath. Items are placed relative to their voxel-space center, which
+  //! keeps the precision of world-space distances.
+  float        vsToWs[3][3];
+  //! Data window, inclusive
+  int          dataMin[3];
+  int          dataMax[3];
+  //! Size of the blocks, in voxels. Blocks are counted from dataMin.
+  int          blockSize;
+  //! Number of blocks along each axis
+  int          blockRes[3];
+  //! The brick of each block, or -1 for blocks that no item touches
+  const int   *blockBricks;
+  //! Number of allocated bricks
+  size_t       numBricks;
+};
+
+//----------------------------------------------------------------------------//
+
+//! A point smaller than a voxel, as queued by SplatWriter::queuePoint()
+struct Splat
+{
+  float        vsP[3];
+  float        value[3];
+  //! Whether the value is spread over the 8 nearest voxels, or only
+  //! written to the voxel containing vsP
+  int          antialiased;
+};
+
+//----------------------------------------------------------------------------//
+
+//! A point larger than a voxel, as rasterized by Point::getSample()
+struct Sphere
+{
+  float        vsCenter[3];
+  //! Density, already scaled by the filter width compensation
+  float        density[3];
+  //! Distances at which the density starts and finishes falling off
+  float        wsInnerRadius;
+  float        wsOuterRadius;
+  //! Voxels to rasterize, inclusive and inside the data window
+  int          boxMin[3];
+  int          boxMax[3];
+};
+
+//----------------------------------------------------------------------------//
+
+//! A pyroclastic point, as rasterized by PyroclasticPoint::getSampleBatch()
+struct PyroPoint
+{
+  float        vsCenter[3];
+  float        density[3];
+  float        wsRadius;
+  //! Local space rotation, for row vectors
+  float        rotation[3][3];
+  //! Offset of the noise lookups, from the seed
+  float        nsOffset[3];
+  //! Length of the world-space voxel size, divided by wsRadius
+  float        filterWidth;
+  //! fBm parameters
+  float        scale;
+  float        octaves;
+  float        octaveGain;
+  float        lacunarity;
+  int          absNoise;
+  //! Displacement parameters
+  float        amplitude;
+  float        gamma;
+  //! Range of the displacement, after gamma and amplitude
+  float        dispMin;
+  float        dispMax;
+  int          isPyroclastic;
+  int          isPyro2D;
+  //! Voxels to rasterize, inclusive and inside the data window
+  int          boxMin[3];
+  int          boxMax[3];
+};
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Returns the number of CUDA devices. Zero if there is no driver.
+int  numDevices();
+//! Rasterizes the items into the grid's bricks on the current device, and
+//! copies the bricks to the host. Items are summed with atomics, so the
+//! order of the sums varies from run to run.
+//! \param bricks Receives grid.numBricks bricks.
+//! \returns False if the device couldn't run the kernels, with the reason
+//! in error.
+bool rasterize(const Grid &grid,
+               const Splat *splats, const size_t numSplats,
+               const Sphere *spheres, const size_t numSpheres,
+               const PyroPoint *pyroPoints, const size_t numPyroPoints,
+               float *bricks, std::string &error);
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Rast
+} // namespace Prim
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
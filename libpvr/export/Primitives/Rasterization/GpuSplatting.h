@@ -0,0 +1,121 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuSplatting.h
+  Contains the host side of rasterizing point primitives on a CUDA device.
+  \note Only available when built with PVR_USE_CUDA.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_GPUSPLATTING_H__
+#define __INCLUDED_PVR_GPUSPLATTING_H__
+
+#ifdef PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <string>
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Types.h"
+#include "pvr/VoxelBuffer.h"
+#include "pvr/Primitives/Rasterization/GpuSplatKernels.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+namespace Prim {
+namespace Rast {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Returns whether items can be rasterized into the buffer on the device.
+//! The buffer needs a MatrixFieldMapping without motion, so that every
+//! voxel has the same world-space size. If not, the reason is put in
+//! reason.
+LIBPVR_PUBLIC bool isSupported(VoxelBuffer::Ptr buffer, std::string &reason);
+
+//----------------------------------------------------------------------------//
+
+//! Finds the voxels that RasterizationPrim::rasterize() visits for the
+//! given bounds, i.e. the bounds padded by one voxel and clipped to the
+//! data window.
+//! \returns False if there are none.
+LIBPVR_PUBLIC bool itemBox(VoxelBuffer::Ptr buffer, const BBox &vsBounds,
+                           int boxMin[3], int boxMax[3]);
+
+//----------------------------------------------------------------------------//
+
+//! Rasterizes the items on the device and adds the result to the buffer.
+//! Only the blocks of the buffer that the items touch are allocated on the
+//! device.
+//! \returns False if the device couldn't rasterize the items, with the
+//! reason in error. The buffer is left untouched in that case.
+LIBPVR_PUBLIC bool rasterize(VoxelBuffer::Ptr buffer,
+                             const std::vector<Splat> &splats,
+                             const std::vector<Sphere> &spheres,
+                             const std::vector<PyroPoint> &pyroPoints,
+                             std::string &error);
+
+//----------------------------------------------------------------------------//
+
+//! Copies a vector to a device struct member
+template <typename T>
+void toDevice(const Imath::Vec3<T> &v, float result[3])
+{
+  for (int i = 0; i < 3; ++i) {
+    result[i] = static_cast<float>(v[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Rast
+} // namespace Prim
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -83,11 +83,17 @@ public:
 
   PVR_DEFINE_TYPENAME(Line);
 
+  // From Primitive ------------------------------------------------------------
+
+  //! Returns the smallest radius along the lines
+  virtual float wsFeatureSize(Geo::Geometry::CPtr geometry) const;
+
 protected:
 
   // From RasterizationPrimitive -----------------------------------------------
 
-  virtual void getSample(const RasterizationState &state,
+  virtual void getSample(const RasterizationContext &context,
+                         const RasterizationState &state,
                          RasterizationSample &sample) const;
 
 };
@@ -61,9 +61,9 @@
 // Defines
 //----------------------------------------------------------------------------//
 
-#define LINE_INTERP(variable, info)                                   \
-  Math::fit01(info.t, m_basePointAttrs[info.index].variable.value(),  \
-              m_basePointAttrs[info.index + 1].variable.value())      \
+#define LINE_INTERP(context, variable, info)                                \
+  Math::fit01(info.t, context.basePointAttrs[info.index].variable.value(),  \
+              context.basePointAttrs[info.index + 1].variable.value())      \
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -94,16 +94,10 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(LineBase);
 
-  // From Primitive ------------------------------------------------------------
-
-  //! Returns a world-space bounding box for the primitive
-  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
-
   // From RasterizationPrim ----------------------------------------------------
 
-  //! Lets the primitive write its data to the voxel buffer
-  virtual void execute(Geo::Geometry::CPtr geometry, 
-                       VoxelBuffer::Ptr buffer) const;
+  //! Returns a new LineBase::Context
+  virtual RasterizationContext::Ptr createContext() const;
 
 protected:
 
@@ -135,10 +129,14 @@ protected:
   struct PolyAttrState
   {
     PolyAttrState()
-      : antialiased("antialiased", 1)
+      : antialiased("antialiased", 1),
+        useBvh     ("use_bvh", 0)
     { }
     void update(const Geo::AttrVisitor::const_iterator &i);
     Geo::Attr<int> antialiased;
+    //! Whether to use a CapsuleBVH instead of the UniformGrid. Preferable
+    //! when segment radii vary a lot along the poly.
+    Geo::Attr<int> useBvh;
   };
 
   //! Struct containing the results of findClosestSegment()
@@ -159,39 +157,67 @@ protected:
     double radius;
   };
 
+  //! Per-thread rasterization state. Subclasses that need additional 
+  //! per-point or per-poly attributes should derive from this.
+  struct Context : public RasterizationContext
+  {
+    //! Holds the vector of per-point Attr instances 
+    std::vector<PointAttrState> basePointAttrs;
+    //! Holds the current per-poly Attr instances 
+    PolyAttrState basePolyAttrs;
+    //! Acceleration structure for finding line segments quickly.
+    pvr::Accel::UniformGrid<size_t> gridAccel;
+    //! Acceleration structure used instead of gridAccel if use_bvh is set.
+    pvr::Accel::CapsuleBVH<size_t> bvhAccel;
+    //! Voxel-space bounds of the current poly, excluding motion
+    BBox vsBounds;
+    //! Voxel-space bounds of each segment of the current poly, excluding 
+    //! motion. Filled in by rasterizeItem().
+    std::vector<BBox> segmentVsBounds;
+  };
+
+  // From RasterizationPrim ----------------------------------------------------
+
+  virtual size_t numItems(Geo::Geometry::CPtr geometry) const;
+  virtual BBox updateItem(Geo::Geometry::CPtr geometry, 
+                          Field3D::FieldMapping::Ptr mapping, 
+                          const size_t item,
+                          RasterizationContext &context) const;
+  virtual void rasterizeItem(VoxelBuffer::Ptr buffer, 
+                             RasterizationContext &context) const;
+  virtual void itemWsBounds(Geo::Geometry::CPtr geometry, 
+                            const size_t first, const size_t last,
+                            RasterizationContext &context, 
+                            Imath::Box3f *bounds) const;
+
   // To be implemented by subclasses -------------------------------------------
 
   //! Updates all per-poly attributes. 
-  virtual void updatePolyAttrs(Geo::AttrVisitor::const_iterator i) const;
+  virtual void updatePolyAttrs(Geo::AttrVisitor::const_iterator i,
+                               Context &context) const;
   //! Updates all per-point attributes. Assumes that all vertices of the polygon
   //! are contiguous in the AttrTable.
   virtual void updatePointAttrs(Geo::AttrVisitor::const_iterator i, 
-                                const size_t numPoints) const;
+                                const size_t numPoints,
+                                Context &context) const;
   //! Returns the displacement bounds at the given point.
   //! \returns The relative displacement. I.e. if radius = 2m and displ = 1m,
   //! the function should return 0.5.
-  virtual float displacementBounds(const size_t) const
+  virtual float displacementBounds(const size_t, const Context &) const
   { return 0.0f; }
 
   // Utility methods -----------------------------------------------------------
 
-  //! Updates the acceleration structure. Uses the current state of 
-  //! m_pointAttrs and m_polyAttrs.
-  void updateAccelStruct() const;
+  //! Updates the acceleration structure. Uses the current state of the
+  //! context's point and poly attributes.
+  void updateAccelStruct(Context &context) const;
   //! Finds the closest line segment on the current polygon described by
-  //! m_pointAttrs.
+  //! the context's point attributes.
   //! \returns Whether a segment was found for which distance < radius.
-  bool findClosestSegment(const RasterizationState &state, 
+  bool findClosestSegment(const Context &context,
+                          const RasterizationState &state, 
                           SegmentInfo &info) const;
 
-  // Data members --------------------------------------------------------------
-
-  //! Holds the vector of per-point Attr instances 
-  mutable std::vector<PointAttrState> m_basePointAttrs;
-  //! Holds the current per-poly Attr instances 
-  mutable PolyAttrState m_basePolyAttrs;
-  //! Acceleration structure for finding line segments quickly.
-  mutable pvr::Accel::UniformGrid<size_t> m_gridAccel;
 };
 
 //----------------------------------------------------------------------------//
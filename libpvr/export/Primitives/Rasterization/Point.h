@@ -40,6 +40,7 @@
 
 #include "pvr/export.h"
 #include "pvr/AttrUtil.h"
+#include "pvr/SplatWriter.h"
 #include "pvr/Strings.h"
 #include "pvr/Types.h"
 #include "pvr/VoxelBuffer.h"
@@ -74,6 +75,24 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(Point);
 
+  // Structs -------------------------------------------------------------------
+
+  //! Attributes of a single point, as loaded from the geometry or passed
+  //! to rasterizePoint().
+  struct Item
+  {
+    Item()
+      : wsCenter(0.0), wsVelocity(0.0), radius(0.1f), density(1.0f), 
+        antialiased(true)
+    { }
+
+    Vector     wsCenter;
+    Vector     wsVelocity;
+    float      radius;
+    Imath::V3f density;
+    bool       antialiased;
+  };
+
   // Factory -------------------------------------------------------------------
 
   //! Factory function
@@ -84,22 +103,66 @@ public:
   //! Returns the type name of the primitive
   PVR_DEFINE_TYPENAME(Point);
 
+  // From Primitive ------------------------------------------------------------
+
+  //! Returns the smallest point radius
+  virtual float wsFeatureSize(Geo::Geometry::CPtr geometry) const;
+
   // From RasterizationPrim ----------------------------------------------------
 
-  //! Lets the primitive write its data to the voxel buffer
-  virtual void execute(Geo::Geometry::CPtr geometry, 
-                       VoxelBuffer::Ptr buffer) const;
+  //! Returns a new Point::Context
+  virtual RasterizationContext::Ptr createContext() const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Rasterizes a single point straight into the buffer, without it having
+  //! to be stored in a Geometry first. Only voxels inside the context's 
+  //! window are written.
+  //! \param context Must have been created by createContext().
+  void rasterizePoint(const Item &point, VoxelBuffer::Ptr buffer,
+                      RasterizationContext &context) const;
+  //! Like rasterizePoint(), but sub-voxel points stay queued in the 
+  //! context, so that splats of consecutive points get written sorted by
+  //! block. Queued splats are written by flushPoints(), or when the queue 
+  //! gets long.
+  //! \param context Must have been created by createContext().
+  void queuePoint(const Item &point, VoxelBuffer::Ptr buffer,
+                  RasterizationContext &context) const;
+  //! Writes the splats left queued by queuePoint()
+  void flushPoints(RasterizationContext &context) const;
 
 protected:
 
   // From RasterizationPrimitive -----------------------------------------------
 
-  virtual void getSample(const RasterizationState &state,
+  virtual void getSample(const RasterizationContext &context,
+                         const RasterizationState &state,
                          RasterizationSample &sample) const;
+  virtual size_t numItems(Geo::Geometry::CPtr geometry) const;
+  virtual BBox updateItem(Geo::Geometry::CPtr geometry, 
+                          Field3D::FieldMapping::Ptr mapping, 
+                          const size_t item,
+                          RasterizationContext &context) const;
+  virtual void rasterizeItem(VoxelBuffer::Ptr buffer, 
+                             RasterizationContext &context) const;
+  //! Writes the queued splats of sub-voxel points
+  virtual void flushItems(RasterizationContext &context) const;
+  //! Computes the same bounds as pointWsBounds() would, but streams through
+  //! contiguous attribute channels instead of visiting each point.
+  virtual void computeItemWsBounds(Geo::Geometry::CPtr geometry,
+                                   std::vector<Imath::Box3f> &bounds) const;
+#ifdef PVR_USE_CUDA
+  //! Rasterizes the points on the device. Falls back to the CPU if any 
+  //! point moves, or if the buffer's mapping isn't supported by 
+  //! Gpu::isSupported().
+  virtual bool executeOnDevice(Geo::Geometry::CPtr geometry, 
+                               VoxelBuffer::Ptr buffer) const;
+#endif
 
   // From PointRasterizationPrimitive ------------------------------------------
 
-  virtual BBox pointWsBounds(const Geo::AttrVisitor::const_iterator &i) const;
+  virtual BBox pointWsBounds(const Geo::AttrVisitor::const_iterator &i,
+                             RasterizationContext &context) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -128,16 +191,36 @@ protected:
     Geo::Attr<float>      radius;
     Geo::Attr<Imath::V3f> density;
     Geo::Attr<int>        antialiased;
-
-    float                 densityFactor;
   };
 
-  // Data members --------------------------------------------------------------
+  //! Per-thread rasterization state
+  struct Context : public RasterizationContext
+  {
+    //! Holds the Attr instances used to read points from the geometry.
+    AttrState attrs;
+    //! The point being rasterized. Gets set up in updateItem() or 
+    //! rasterizePoint() and is used in rasterizeItem() and getSample().
+    Item      point;
+    //! Voxel-space position of the point
+    Vector    vsP;
+    //! World-space voxel size at the point
+    Vector    wsVoxelSize;
+    //! Voxel-space bounds of the sphere, if the point is larger than a voxel
+    BBox      vsBounds;
+    //! Whether the point is larger than a voxel
+    bool      isSphere;
+    //! Queues the splats of sub-voxel points, so that they get written 
+    //! sorted by block
+    SplatWriter splats;
+  };
 
-  //! Holds the Attr instances that describe a single point.
-  //! Gets set up in execute() and is used in getSample().
-  mutable AttrState m_attrs;
+  // Utility methods -----------------------------------------------------------
 
+  //! Prepares the context for rasterizing the point in context.point.
+  //! 
+eturns Voxel-space bounds of all voxels the point may write to.
+  BBox setupPoint(Field3D::FieldMapping::Ptr mapping, Context &context) const;
+  
 };
 
 //----------------------------------------------------------------------------//
@@ -59,7 +59,9 @@ namespace Rast {
 
 //----------------------------------------------------------------------------//
 
-Vector lineWsToNs(const Vector &wsP, const Vector &wsE1, const Vector &wsE2,
+//! Transforms wsP into the local space of the frame e1, e2, e3 at wsCenter.
+//! x and y are scaled by the radius, and z is replaced by u.
+Vector lineWsToLs(const Vector &wsP, const Vector &wsE1, const Vector &wsE2,
                   const Vector &wsE3, const Vector &wsCenter, 
                   const float u, const float radius);
 
@@ -91,19 +93,32 @@ public:
   //! Returns the type name of the primitive
   PVR_DEFINE_TYPENAME(PyroclasticLine);
 
+  // From RasterizationPrim ----------------------------------------------------
+
+  //! Returns a new PyroclasticLine::Context
+  virtual RasterizationContext::Ptr createContext() const;
+
 protected:
 
   // From RasterizationPrimitive -----------------------------------------------
 
-  virtual void getSample(const RasterizationState &state,
+  virtual void getSample(const RasterizationContext &context,
+                         const RasterizationState &state,
                          RasterizationSample &sample) const;
+  virtual void getSampleBatch(const RasterizationContext &context,
+                              const RasterizationState *states,
+                              RasterizationSample *samples,
+                              const size_t n) const;
 
   // From LineRasterizationPrimitive -------------------------------------------
 
-  virtual void updatePolyAttrs(Geo::AttrVisitor::const_iterator i) const;
+  virtual void updatePolyAttrs(Geo::AttrVisitor::const_iterator i,
+                               LineBase::Context &context) const;
   virtual void updatePointAttrs(Geo::AttrVisitor::const_iterator i, 
-                                const size_t numPoints) const;
-  virtual float displacementBounds(const size_t index) const;
+                                const size_t numPoints,
+                                LineBase::Context &context) const;
+  virtual float displacementBounds(const size_t index,
+                                   const LineBase::Context &context) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -116,7 +131,9 @@ protected:
         lacunarity  ("lacunarity",     1.92f), 
         absNoise    ("absolute_noise", 1),
         pyroclastic ("pyroclastic",    1),
-        pyro2D      ("pyroclastic_2d", 1)
+        pyro2D      ("pyroclastic_2d", 1),
+        tiledNoise  ("tiled_noise",    0),
+        simplexNoise("simplex_noise",  0)
     { }
     
     void update(const Geo::AttrVisitor::const_iterator &i);
@@ -128,8 +145,11 @@ protected:
     Geo::Attr<int>        absNoise;
     Geo::Attr<int>        pyroclastic;
     Geo::Attr<int>        pyro2D;
+    Geo::Attr<int>        tiledNoise;
+    Geo::Attr<int>        simplexNoise;
 
     Noise::Fractal::CPtr  fractal;
+    Noise::fBmCache       fractalCache;
   };
 
   struct PointAttrState
@@ -151,12 +171,46 @@ protected:
     Geo::Attr<float>      gamma;
   };
 
-  // Data members --------------------------------------------------------------
+  //! Value of an attribute at the start of each segment, and its change
+  //! along the segment. Lets a voxel's value be found with a single 
+  //! multiply-add.
+  template <typename T>
+  struct SegmentLerp
+  {
+    void resize(const size_t size)
+    { start.resize(size); delta.resize(size); }
+    void set(const size_t i, const T &v0, const T &v1)
+    { start[i] = v0; delta[i] = v1 - v0; }
+    T eval(const size_t i, const float t) const
+    { return start[i] + delta[i] * t; }
+    std::vector<T> start;
+    std::vector<T> delta;
+  };
 
-  //! Holds the per-point attributes specific to this class
-  mutable std::vector<PointAttrState> m_pointAttrs;
-  //! Holds the per-poly attributes specific to this class
-  mutable PolyAttrState m_polyAttrs;
+  //! The interpolated attributes of each segment of the current poly, 
+  //! packed per attribute
+  struct Segments
+  {
+    SegmentLerp<Imath::V3f> wsCenter;
+    SegmentLerp<Imath::V3f> wsVelocity;
+    SegmentLerp<Imath::V3f> density;
+    SegmentLerp<Imath::V3f> wsNormal;
+    SegmentLerp<Imath::V3f> wsTangent;
+    SegmentLerp<float>      u;
+    SegmentLerp<float>      amplitude;
+    SegmentLerp<float>      gamma;
+  };
+
+  //! Per-thread rasterization state
+  struct Context : public LineBase::Context
+  {
+    //! Holds the per-point attributes specific to this class
+    std::vector<PointAttrState> pointAttrs;
+    //! Holds the per-poly attributes specific to this class
+    PolyAttrState polyAttrs;
+    //! Per-segment attributes, computed once per poly by updatePointAttrs()
+    Segments segments;
+  };
 
 };
 
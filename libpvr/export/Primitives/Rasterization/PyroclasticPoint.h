@@ -85,22 +85,48 @@ public:
   //! Returns the type name of the primitive
   PVR_DEFINE_TYPENAME(PyroclasticPoint);
 
+  // From Primitive ------------------------------------------------------------
+
+  //! Returns the smallest wavelength of the finest noise octave, or the
+  //! smallest radius if that's smaller
+  virtual float wsFeatureSize(Geo::Geometry::CPtr geometry) const;
+
   // From RasterizationPrim ----------------------------------------------------
 
-  //! Lets the primitive write its data to the voxel buffer
-  virtual void execute(Geo::Geometry::CPtr geometry, 
-                       VoxelBuffer::Ptr buffer) const;
+  //! Returns a new PyroclasticPoint::Context
+  virtual RasterizationContext::Ptr createContext() const;
 
 protected:
 
   // From RasterizationPrimitive -----------------------------------------------
 
-  virtual void getSample(const RasterizationState &state,
+  virtual void getSample(const RasterizationContext &context,
+                         const RasterizationState &state,
                          RasterizationSample &sample) const;
+  virtual void getSampleBatch(const RasterizationContext &context,
+                              const RasterizationState *states,
+                              RasterizationSample *samples,
+                              const size_t n) const;
+  virtual size_t numItems(Geo::Geometry::CPtr geometry) const;
+  virtual BBox updateItem(Geo::Geometry::CPtr geometry, 
+                          Field3D::FieldMapping::Ptr mapping, 
+                          const size_t item,
+                          RasterizationContext &context) const;
+  virtual void rasterizeItem(VoxelBuffer::Ptr buffer, 
+                             RasterizationContext &context) const;
+#ifdef PVR_USE_CUDA
+  //! Rasterizes the points on the device, evaluating their fBm there too.
+  //! Falls back to the CPU if any point moves or uses tiled or simplex 
+  //! noise, or if the buffer's mapping isn't supported by 
+  //! Gpu::isSupported().
+  virtual bool executeOnDevice(Geo::Geometry::CPtr geometry, 
+                               VoxelBuffer::Ptr buffer) const;
+#endif
 
   // From PointRasterizationPrimitive ------------------------------------------
 
-  virtual BBox pointWsBounds(const Geo::AttrVisitor::const_iterator &i) const;
+  virtual BBox pointWsBounds(const Geo::AttrVisitor::const_iterator &i,
+                             RasterizationContext &context) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -126,7 +152,9 @@ protected:
         pyroclastic("pyroclastic",    1), 
         pyro2D     ("pyroclastic_2d", 1), 
         absNoise   ("absolute_noise", 1),
-        antialiased("antialiased",    1)
+        antialiased("antialiased",    1),
+        tiledNoise ("tiled_noise",    0),
+        simplexNoise("simplex_noise", 0)
     { }
      
     // Main methods ---
@@ -152,15 +180,22 @@ protected:
     Geo::Attr<int>        pyro2D;
     Geo::Attr<int>        absNoise;
     Geo::Attr<int>        antialiased;
+    Geo::Attr<int>        tiledNoise;
+    Geo::Attr<int>        simplexNoise;
     Matrix                rotation;
     Noise::Fractal::CPtr  fractal;
+    Noise::fBmCache       fractalCache;
   };
 
-  // Data members --------------------------------------------------------------
-
-  //! Holds the Attr instances that describe a single point.
-  //! Gets set up in execute() and is used in getSample().
-  mutable AttrState m_attrs;
+  //! Per-thread rasterization state
+  struct Context : public RasterizationContext
+  {
+    //! Holds the Attr instances that describe a single point.
+    //! Gets set up in updateItem() and is used in getSample().
+    AttrState attrs;
+    //! Voxel-space bounds of the displaced sphere
+    BBox      vsBounds;
+  };
 
 };
 
@@ -34,6 +34,8 @@
 
 // System headers
 
+#include <vector>
+
 // Library headers
 
 #include <boost/foreach.hpp>
@@ -45,6 +47,7 @@
 #include "pvr/Geometry.h"
 #include "pvr/Math.h"
 #include "pvr/Primitives/Primitive.h"
+#include "pvr/Threading.h"
 #include "pvr/Types.h"
 #include "pvr/VoxelBuffer.h"
 
@@ -93,6 +96,56 @@ struct RasterizationState
   { }
 };
 
+//----------------------------------------------------------------------------//
+// RasterizationContext
+//----------------------------------------------------------------------------//
+
+/*! \class RasterizationContext
+  \brief Base class for the state of the item (point, poly, etc.) that a 
+  rasterization primitive is currently working on.
+
+  Rasterization primitives keep no per-item state in data members. Instead
+  each subclass stores its item attributes in a subclass of 
+  RasterizationContext, which is passed through rasterize() to getSample(). 
+  Each thread that rasterizes a primitive uses its own context, which lets 
+  the same primitive be rasterized concurrently.
+
+  The context also holds the window of voxels that its thread owns. All 
+  writes to the buffer must stay inside that window.
+*/
+
+//----------------------------------------------------------------------------//
+
+class RasterizationContext
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(RasterizationContext);
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  RasterizationContext()
+    : hasMotion(false), job(NULL)
+  { }
+  virtual ~RasterizationContext()
+  { }
+
+  // Data members --------------------------------------------------------------
+
+  //! Voxels that the context's thread may write to. Other threads own the
+  //! voxels outside of the window.
+  DiscreteBBox         dvsWindow;
+  //! Whether the current item is motion blurred. If so, rasterize() visits
+  //! voxels outside the window too, since their motion may reach into it.
+  bool                 hasMotion;
+  //! Job that the context's thread is working on. rasterize() returns
+  //! early if the job is aborted. May be null.
+  const Sys::JobState *job;
+
+};
+
 //----------------------------------------------------------------------------//
 // RasterizationPrim
 //----------------------------------------------------------------------------//
@@ -113,28 +166,154 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(RasterizationPrim);
 
+  // Ctor ----------------------------------------------------------------------
+
+  RasterizationPrim()
+    : m_boundsDt(0.0f)
+  { }
+
+  // From Primitive ------------------------------------------------------------
+
+  //! Returns a world-space bounding box for all items in the primitive.
+  //! The bounds of each item are computed in parallel by 
+  //! computeItemWsBounds(), and are kept so that execute() doesn't have to
+  //! visit every item's attributes again to bin it. The cache costs 24 
+  //! bytes per item, and is released by execute().
+  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Lets the primitive write to the voxel buffer. 
+  //! The buffer is split into slabs along z, aligned to the sparse block 
+  //! size, and each slab is rasterized by a single thread so that no locking
+  //! is needed when writing voxels. Items are written to each slab in their
+  //! original order, which keeps the result deterministic.
+  //! If the int parameter "spatial_sort" is non-zero, each slab's items are
+  //! instead sorted by the Morton code of their voxel-space center. This
+  //! keeps consecutive writes close together in the buffer, which helps 
+  //! when the input is in e.g. emission order. The result is still 
+  //! deterministic, but may differ from the unsorted one by round-off.
+  //! If the int parameter "use_gpu" is non-zero, executeOnDevice() gets 
+  //! the first chance to write the items.
+  //! \param numThreads Number of threads to use. Zero means one per core.
+  //! \param deterministic Skips executeOnDevice(), whose result may depend
+  //! on the order that the device adds up the items in.
+  void execute(Geo::Geometry::CPtr geometry, VoxelBuffer::Ptr buffer,
+               const size_t numThreads = 0, 
+               const bool deterministic = false) const;
+  //! Returns the per-item world-space bounds kept by wsBounds(), if they 
+  //! were computed for the given geometry with the current parameters and
+  //! shutter. Returns null otherwise, and after execute().
+  const std::vector<Imath::Box3f>* 
+  cachedItemWsBounds(Geo::Geometry::CPtr geometry) const;
+
   // To be implemented by subclasses -------------------------------------------
 
-  //! Lets the primitive write to the voxel buffer
-  virtual void execute(Geo::Geometry::CPtr geometry, 
-                       VoxelBuffer::Ptr buffer) const = 0;
+  //! Creates a context of the type that the subclass expects in 
+  //! getSample(). Each thread needs its own context.
+  virtual RasterizationContext::Ptr createContext() const = 0;
 
 protected:
 
   // To be called from subclasses ----------------------------------------------
 
-  //! Rasterizes the domain in vsBounds, making a call to wsSample() at each 
-  //! voxel.
-  void rasterize(const BBox &vsBounds, VoxelBuffer::Ptr buffer) const;
+  //! Rasterizes the domain in vsBounds, making a call to getSampleBatch() for
+  //! each scanline. Only voxels inside the context's window are written.
+  //! Samples with a velocity are blurred along their motion over 
+  //! RenderGlobals::dt(). If the whole item moves the same amount, this is
+  //! done with a few shift-and-average passes over a scratch grid instead
+  //! of one line per voxel.
+  void rasterize(const BBox &vsBounds, VoxelBuffer::Ptr buffer,
+                 const RasterizationContext &context) const;
+  //! Rasterizes the union of the boxes in vsBounds, visiting each voxel at
+  //! most once. Lets long, thin items skip the empty parts of their overall
+  //! bounds.
+  void rasterize(const std::vector<BBox> &vsBounds, VoxelBuffer::Ptr buffer,
+                 const RasterizationContext &context) const;
 
   // To be implemented by subclasses -------------------------------------------
 
   //! Samples the rasterization primitive at a given world-space position
-  //! This is called from rasterize(), and assumes that the internal state
-  //! of the subclass is configured to know which underlying primitive is 
-  //! being rasterized.
-  virtual void getSample(const RasterizationState &state,
+  //! This is called from rasterize(), and assumes that the context has been
+  //! configured to know which underlying primitive is being rasterized.
+  virtual void getSample(const RasterizationContext &context,
+                         const RasterizationState &state,
                          RasterizationSample &sample) const = 0;
+  //! Samples the primitive at n positions. rasterize() calls this once per
+  //! scanline, which lets subclasses evaluate noise for many voxels at 
+  //! once. The default implementation calls getSample() for each position.
+  virtual void getSampleBatch(const RasterizationContext &context,
+                              const RasterizationState *states,
+                              RasterizationSample *samples,
+                              const size_t n) const;
+  //! Returns the number of items (points, polygons, etc.) in the geometry.
+  //! Returns zero (after printing a warning) if the primitive can't handle 
+  //! the geometry.
+  virtual size_t numItems(Geo::Geometry::CPtr geometry) const = 0;
+  //! Loads the attributes of the given item into the context.
+  //! 
+eturns Voxel-space bounds of all voxels that the item may write to,
+  //! including motion blur. Empty if the item writes nothing.
+  virtual BBox updateItem(Geo::Geometry::CPtr geometry, 
+                          Field3D::FieldMapping::Ptr mapping, 
+                          const size_t item,
+                          RasterizationContext &context) const = 0;
+  //! Writes the item last loaded by updateItem() to the buffer, restricted
+  //! to the context's window.
+  virtual void rasterizeItem(VoxelBuffer::Ptr buffer, 
+                             RasterizationContext &context) const = 0;
+  //! Writes anything that rasterizeItem() deferred, e.g. queued splats. 
+  //! Called after the last item of each slab. The default does nothing.
+  virtual void flushItems(RasterizationContext &context) const;
+  //! Computes the world-space bounds of items first through last - 1,
+  //! including motion blur. Called concurrently from several threads, each
+  //! with its own context.
+  virtual void itemWsBounds(Geo::Geometry::CPtr geometry, 
+                            const size_t first, const size_t last,
+                            RasterizationContext &context, 
+                            Imath::Box3f *bounds) const = 0;
+  //! Rasterizes all items into the buffer on a CUDA device. Called by 
+  //! execute() when the int parameter "use_gpu" is non-zero. The default 
+  //! prints a warning and does nothing.
+  //! \returns False if nothing was written, in which case execute() 
+  //! rasterizes the items on the CPU as usual.
+  virtual bool executeOnDevice(Geo::Geometry::CPtr geometry, 
+                               VoxelBuffer::Ptr buffer) const;
+  //! Computes the world-space bounds of all items. The default splits the
+  //! items into one range per thread and calls itemWsBounds() for each.
+  virtual void computeItemWsBounds(Geo::Geometry::CPtr geometry,
+                                   std::vector<Imath::Box3f> &bounds) const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! State shared by the worker threads of execute()
+  struct ExecuteState;
+  //! State shared by the worker threads of computeItemWsBounds()
+  struct BoundsState;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Finds the slabs that each item in the given thread's range overlaps
+  void binItems(ExecuteState &state, const size_t thread) const;
+  //! Sorts the items of slabs spatially until none are left
+  void sortBins(ExecuteState &state, const size_t thread) const;
+  //! Rasterizes slabs until none are left
+  void rasterizeSlabs(ExecuteState &state, const size_t thread) const;
+  //! Computes the bounds of the given thread's range of items
+  void boundItems(BoundsState &state, const size_t thread) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! Geometry that m_itemWsBounds belongs to
+  mutable Geo::Geometry::CPtr       m_boundsGeometry;
+  //! Parameters that m_itemWsBounds was computed with
+  mutable Util::ParamMap            m_boundsParams;
+  //! Shutter length that m_itemWsBounds was computed with
+  mutable float                     m_boundsDt;
+  //! World-space bounds of each item, cached by wsBounds()
+  mutable std::vector<Imath::Box3f> m_itemWsBounds;
 
 };
 
@@ -161,20 +340,23 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(PointBase);
 
-  // From Primitive ------------------------------------------------------------
+protected:
 
-  //! Returns a world-space bounding box for all points in primitive
-  //! \note Calls pointWsBounds().
-  virtual BBox wsBounds(Geo::Geometry::CPtr geometry) const;
+  // From RasterizationPrim ----------------------------------------------------
 
-protected:
+  //! Calls pointWsBounds() for each point in the range
+  virtual void itemWsBounds(Geo::Geometry::CPtr geometry, 
+                            const size_t first, const size_t last,
+                            RasterizationContext &context, 
+                            Imath::Box3f *bounds) const;
 
   // To be implemented by subclasses -------------------------------------------
 
   //! Returns a world-space bounding box for single point in primitive
   //! \todo THIS SHOULD NOT TAKE V INTO ACCOUNT, SINCE RASTERIZATION HAPPENS
   //! AT TIME=0.0
-  virtual BBox pointWsBounds(const Geo::AttrVisitor::const_iterator &i) const = 0;
+  virtual BBox pointWsBounds(const Geo::AttrVisitor::const_iterator &i,
+                             RasterizationContext &context) const = 0;
 
 };
 
@@ -0,0 +1,277 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file QuantizedBuffer.h
+  Contains the QuantizedBuffer class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_QUANTIZEDBUFFER_H__
+#define __INCLUDED_PVR_QUANTIZEDBUFFER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Library headers
+
+#include <boost/shared_ptr.hpp>
+
+#include <Field3D/SparseField.h>
+
+// Project headers
+
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+
+//----------------------------------------------------------------------------//
+// QuantizedBuffer
+//----------------------------------------------------------------------------//
+
+/*! \class QuantizedBuffer
+  \brief Read-only scalar sparse buffer that stores each voxel as an 8 or
+  16 bit code.
+
+  Each allocated block keeps the minimum and maximum of its voxels, and
+  the codes are spread evenly between the two. The block layout is taken
+  from the SparseField that the buffer is created from, and unallocated
+  blocks stay unallocated.
+
+  The interface mirrors the parts of Field3D::SparseField that VoxelVolume
+  uses. Voxel coordinates are the same as in the original field.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Code_T>
+class QuantizedBuffer
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(QuantizedBuffer);
+  typedef float value_type;
+
+  // Ctor ----------------------------------------------------------------------
+
+  //! Quantizes the given field.
+  explicit QuantizedBuffer(const Field3D::SparseField<float> &field);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the value of the given voxel, which must be inside the data 
+  //! window.
+  float fastValue(int i, int j, int k) const;
+  //! Same as fastValue(). Provided for Field3D-style code.
+  float value(const int i, const int j, const int k) const
+  { return fastValue(i, j, k); }
+  //! Returns the mapping of the original field
+  const Field3D::FieldMapping::Ptr& mapping() const
+  { return m_mapping; }
+  //! Returns the extents of the original field
+  const Field3D::Box3i& extents() const
+  { return m_extents; }
+  //! Returns the data window of the original field
+  const Field3D::Box3i& dataWindow() const
+  { return m_dataWindow; }
+  //! Returns the block order, i.e. log2 of the block size
+  int blockOrder() const
+  { return m_blockOrder; }
+  //! Returns the block size, in voxels
+  int blockSize() const
+  { return 1 << m_blockOrder; }
+  //! Returns the number of blocks along each axis
+  const Imath::V3i& blockRes() const
+  { return m_blockRes; }
+  //! Returns the block containing the given voxel. The voxel coordinate is
+  //! relative to the data window's minimum, just like in SparseField.
+  void getBlockCoord(const int i, const int j, const int k,
+                     int &bi, int &bj, int &bk) const
+  { bi = i >> m_blockOrder; bj = j >> m_blockOrder; bk = k >> m_blockOrder; }
+  //! Returns whether the given block holds voxel data.
+  bool blockIsAllocated(const int bi, const int bj, const int bk) const
+  { return !m_blocks[blockId(bi, bj, bk)].codes.empty(); }
+  //! Returns the value of all voxels in an unallocated block.
+  float getBlockEmptyValue(const int bi, const int bj, const int bk) const
+  { return m_blocks[blockId(bi, bj, bk)].emptyValue; }
+  //! Returns the memory use of the buffer, in bytes.
+  size_t memSize() const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Block
+  {
+    Block()
+      : offset(0.0f), scale(0.0f), emptyValue(0.0f)
+    { }
+    //! Value of code zero
+    float               offset;
+    //! Value increment per code step
+    float               scale;
+    //! Value used if the block has no codes
+    float               emptyValue;
+    //! Voxel codes. Empty for unallocated blocks.
+    std::vector<Code_T> codes;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  int blockId(const int bi, const int bj, const int bk) const
+  { return bi + m_blockRes.x * (bj + m_blockRes.y * bk); }
+
+  // Private data members ------------------------------------------------------
+
+  Field3D::FieldMapping::Ptr m_mapping;
+  Field3D::Box3i             m_extents;
+  Field3D::Box3i             m_dataWindow;
+  int                        m_blockOrder;
+  Imath::V3i                 m_blockRes;
+  std::vector<Block>         m_blocks;
+
+};
+
+//----------------------------------------------------------------------------//
+// Typedefs
+//----------------------------------------------------------------------------//
+
+typedef QuantizedBuffer<unsigned char>  QuantizedBuffer8;
+typedef QuantizedBuffer<unsigned short> QuantizedBuffer16;
+
+//----------------------------------------------------------------------------//
+// Template implementations
+//----------------------------------------------------------------------------//
+
+template <typename Code_T>
+QuantizedBuffer<Code_T>::QuantizedBuffer
+(const Field3D::SparseField<float> &field)
+  : m_mapping(field.mapping()), 
+    m_extents(field.extents()), 
+    m_dataWindow(field.dataWindow()),
+    m_blockOrder(field.blockOrder()),
+    m_blockRes(field.blockRes()),
+    m_blocks(m_blockRes.x * m_blockRes.y * m_blockRes.z)
+{
+  const int   blockSize = 1 << m_blockOrder;
+  const float maxCode   = std::numeric_limits<Code_T>::max();
+
+  for (int bk = 0; bk < m_blockRes.z; ++bk) {
+    for (int bj = 0; bj < m_blockRes.y; ++bj) {
+      for (int bi = 0; bi < m_blockRes.x; ++bi) {
+        Block &block = m_blocks[blockId(bi, bj, bk)];
+        if (!field.blockIsAllocated(bi, bj, bk)) {
+          block.emptyValue = field.getBlockEmptyValue(bi, bj, bk);
+          continue;
+        }
+        const Imath::V3i min = 
+          m_dataWindow.min + Imath::V3i(bi, bj, bk) * blockSize;
+        const Imath::V3i max = 
+          Imath::V3i(std::min(min.x + blockSize - 1, m_dataWindow.max.x), 
+                     std::min(min.y + blockSize - 1, m_dataWindow.max.y), 
+                     std::min(min.z + blockSize - 1, m_dataWindow.max.z));
+        // Find the value range of the block
+        float minValue = std::numeric_limits<float>::max();
+        float maxValue = -std::numeric_limits<float>::max();
+        for (int k = min.z; k <= max.z; ++k) {
+          for (int j = min.y; j <= max.y; ++j) {
+            for (int i = min.x; i <= max.x; ++i) {
+              const float value = field.fastValue(i, j, k);
+              minValue = std::min(minValue, value);
+              maxValue = std::max(maxValue, value);
+            }
+          }
+        }
+        block.offset = minValue;
+        block.scale  = (maxValue - minValue) / maxCode;
+        // Quantize. Voxels outside the data window keep code zero.
+        block.codes.resize(blockSize * blockSize * blockSize, 0);
+        const float invScale = block.scale > 0.0f ? 1.0f / block.scale : 0.0f;
+        for (int k = min.z; k <= max.z; ++k) {
+          for (int j = min.y; j <= max.y; ++j) {
+            for (int i = min.x; i <= max.x; ++i) {
+              const float code = 
+                (field.fastValue(i, j, k) - minValue) * invScale + 0.5f;
+              const int vi = (i - min.x) + 
+                ((j - min.y + ((k - min.z) << m_blockOrder)) << m_blockOrder);
+              block.codes[vi] = 
+                static_cast<Code_T>(std::min(std::max(code, 0.0f), maxCode));
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Code_T>
+float QuantizedBuffer<Code_T>::fastValue(int i, int j, int k) const
+{
+  i -= m_dataWindow.min.x;
+  j -= m_dataWindow.min.y;
+  k -= m_dataWindow.min.z;
+  const Block &block = 
+    m_blocks[blockId(i >> m_blockOrder, j >> m_blockOrder, k >> m_blockOrder)];
+  if (block.codes.empty()) {
+    return block.emptyValue;
+  }
+  const int mask = (1 << m_blockOrder) - 1;
+  const int vi = (i & mask) + 
+    (((j & mask) + ((k & mask) << m_blockOrder)) << m_blockOrder);
+  return block.offset + block.scale * block.codes[vi];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Code_T>
+size_t QuantizedBuffer<Code_T>::memSize() const
+{
+  size_t size = sizeof(*this) + m_blocks.size() * sizeof(Block);
+  for (size_t i = 0, end = m_blocks.size(); i < end; ++i) {
+    size += m_blocks[i].codes.size() * sizeof(Code_T);
+  }
+  return size;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
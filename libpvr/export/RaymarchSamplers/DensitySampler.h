@@ -70,7 +70,13 @@ public:
   // From ParamBase ---
   PVR_DEFINE_TYPENAME(DensitySampler);
   // From RaymarchSampler ---
+  virtual void bindAttributes(const Volume &volume) const;
   virtual RaymarchSample sample(const VolumeSampleState &state) const;
+  virtual void sampleBatch(const VolumeSampleStatePtrVec &states,
+                           RaymarchSampleVec &samples) const;
+  virtual bool extinctionMajorant(const RayState &state, 
+                                  const double t0, const double t1,
+                                  Color &majorant) const;
 private:
   // Private data members ---
   VolumeAttr m_densityAttr;
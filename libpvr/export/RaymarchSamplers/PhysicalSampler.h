@@ -57,6 +57,33 @@ namespace Render {
 
 /*! \class PhysicalSampler
    \brief Looks for scattering and performs a simplified lighting calculation.
+
+  Lights whose unoccluded contribution is zero (outside a spot light's cone,
+  or where the phase function vanishes) are skipped before their occluder 
+  is queried. If light_samples is set, only that many of the remaining 
+  lights are evaluated at each step, chosen in proportion to their 
+  unoccluded contribution.
+
+  If occlusion_cull_threshold is set, a light's occluder is only looked up
+  if the light could add more than that fraction of the luminance the ray
+  has already accumulated, given the ray's transmittance and the length of
+  the step. Lookups that fall short are played by Russian roulette, so
+  the result stays unbiased, unless occlusion_cull_roulette is 0, in which
+  case they are dropped.
+
+  Attributes that the scene's volume doesn't have aren't looked up, so an 
+  emission and absorption only volume costs two lookups per step. Samples
+  that don't scatter, and scenes without lights, skip the light and 
+  occluder setup.
+
+  sampleBatch() defers the occlusion lookups until the scattering of every
+  point in the batch is known, then evaluates each light's occluder once 
+  for all of the points. This keeps each occluder's data hot in cache.
+
+  If the render has an in-scatter cache (see 
+  Renderer::setInScatterCacheResolution()), samples with an isotropic 
+  phase function interpolate the lights' contribution from it instead, 
+  unless the ray outputs the luminance of each light.
  */
 
 //----------------------------------------------------------------------------//
@@ -79,15 +106,65 @@ public:
   // From ParamBase ---
 
   PVR_DEFINE_TYPENAME(PhysicalSampler);
+  virtual void setParams(const Util::ParamMap &params);
   
   // From RaymarchSampler ---
 
+  virtual void bindAttributes(const Volume &volume) const;
   virtual RaymarchSample sample(const VolumeSampleState &state) const;
+  virtual void sampleBatch(const VolumeSampleStatePtrVec &states,
+                           RaymarchSampleVec &samples) const;
+  //! Looks up scattering and absorption together. See Volume::sampleSum().
+  virtual Color extinction(const VolumeSampleState &state) const;
+  virtual void extinctionBatch(const VolumeSampleStatePtrVec &states,
+                               RaymarchSampleVec &samples) const;
+  //! Extinction is bounded by the sum of the scattering and absorption
+  //! majorants.
+  virtual bool extinctionMajorant(const RayState &state, 
+                                  const double t0, const double t1,
+                                  Color &majorant) const;
+
+  // Main methods ---
+
+  //! Returns the number of lights sampled per step. Zero means every light
+  //! is evaluated.
+  int lightSamples() const
+  { return m_params.lightSamples; }
+  //! Returns the fraction of the ray's luminance below which occluder
+  //! lookups are culled. Zero means every occluder is looked up.
+  float occlusionCullThreshold() const
+  { return m_params.occlusionCullThreshold; }
 
 private:
 
+  // Structs ---
+
+  struct Params
+  {
+    Params();
+    //! Number of lights to sample per step. Zero evaluates every light.
+    int lightSamples;
+    //! Fraction of the ray's accumulated luminance that an occluder lookup
+    //! must be able to add. Zero looks up every occluder.
+    float occlusionCullThreshold;
+    //! Whether culled lookups are played by Russian roulette. Otherwise 
+    //! they are dropped, which darkens the result slightly.
+    int occlusionCullRoulette;
+  };
+
+  // Utility methods ---
+
+  //! Samples the in-scattered light, and combines it with the already 
+  //! sampled absorption, emission and scattering.
+  RaymarchSample sampleScattering(const VolumeSampleState &state,
+                                  const Color &sigma_a, 
+                                  const Color &L_em,
+                                  const VolumeSample &scSample) const;
+
   // Private data members ---
 
+  //! Holds user parameters
+  Params m_params;
   //! Used for sampling the scattering attribute
   VolumeAttr m_scatteringAttr;
   //! Used for sampling the absorption attribute
@@ -50,6 +50,12 @@
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+class Volume;
+
 //----------------------------------------------------------------------------//
 // Structs
 //----------------------------------------------------------------------------//
@@ -75,8 +81,15 @@ struct RaymarchSample
   //! Extinction coefficient for the sample's point in space. This should
   //! not be scaled by the step length
   Color extinction;
+  //! Part of the luminance scattered from each light, in the order of 
+  //! Scene::lights. Only filled in for rays with RayState::doOutputLights.
+  ColorVec lightLuminance;
 };
 
+//----------------------------------------------------------------------------//
+
+typedef std::vector<RaymarchSample> RaymarchSampleVec;
+
 //----------------------------------------------------------------------------//
 // RaymarchSampler
 //----------------------------------------------------------------------------//
@@ -103,6 +116,49 @@ public:
 
   virtual RaymarchSample sample(const VolumeSampleState &state) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Binds the sampler's attributes to the given volume. See 
+  //! Volume::bindAttribute(). The default implementation does nothing.
+  virtual void bindAttributes(const Volume &/* volume */) const
+  { }
+  //! Samples a batch of points. Subclasses should override this to use
+  //! Volume::sampleBatch(). The default implementation calls sample() once 
+  //! per point.
+  virtual void sampleBatch(const VolumeSampleStatePtrVec &states,
+                           RaymarchSampleVec &samples) const
+  {
+    samples.resize(states.size());
+    for (size_t i = 0, size = states.size(); i < size; ++i) {
+      samples[i] = sample(*states[i]);
+    }
+  }
+  //! Samples only the extinction coefficient. Raymarchers call this for
+  //! transmittance-only rays, which don't need luminance. The default 
+  //! implementation returns the extinction of sample().
+  virtual Color extinction(const VolumeSampleState &state) const
+  { return sample(state).extinction; }
+  //! Samples only the extinction coefficient of a batch of points. The 
+  //! luminance of the returned samples is zero. The default implementation
+  //! calls extinction() once per point.
+  virtual void extinctionBatch(const VolumeSampleStatePtrVec &states,
+                               RaymarchSampleVec &samples) const
+  {
+    samples.resize(states.size());
+    for (size_t i = 0, size = states.size(); i < size; ++i) {
+      samples[i] = RaymarchSample(Colors::zero(), extinction(*states[i]));
+    }
+  }
+  //! Computes an upper bound of the extinction along the [t0, t1] segment
+  //! of the ray. Used by tracking raymarchers.
+  //! \returns False if no bound is available. This is what the default 
+  //! implementation does.
+  virtual bool extinctionMajorant(const RayState &/* state */, 
+                                  const double /* t0 */, 
+                                  const double /* t1 */,
+                                  Color &/* majorant */) const
+  { return false; }
+
 };
 
 //----------------------------------------------------------------------------//
@@ -93,6 +93,21 @@ protected:
     //! Threshold at which transparency is considered to be zero. 
     //! Used when doEarlyTermination is true.
     double earlyTerminationThreshold;
+    //! Step length multiplier for transmittance-only rays
+    double shadowStepLengthMult;
+    //! Early termination threshold for transmittance-only rays
+    double shadowEarlyTerminationThreshold;
+    //! Whether to offset the first step of each ray by its step offset
+    int doJitterSteps;
+    //! Step length multiplier for camera rays in homogeneous intervals (see
+    //! Interval::isHomogeneous), which are integrated in closed form rather
+    //! than adaptively. Transmittance-only rays take them in one step.
+    double homogeneousStepLengthMult;
+    //! Transmittance below which rays play Russian roulette. Zero disables
+    //! it. See UniformRaymarcher::Params::rouletteThreshold.
+    double rouletteThreshold;
+    //! Russian roulette threshold for transmittance-only rays
+    double shadowRouletteThreshold;
   };
 
   // Protected data members ----------------------------------------------------
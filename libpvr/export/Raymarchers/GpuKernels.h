@@ -0,0 +1,262 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuKernels.h
+  Contains the device scene description and the host interface of the CUDA
+  kernels used by GpuRaymarcher.
+  \note Only available when built with PVR_USE_CUDA.
+  \note Everything here is plain data, so that the CUDA sources don't need
+  Imath, Field3D or boost.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_GPUKERNELS_H__
+#define __INCLUDED_PVR_GPUKERNELS_H__
+
+#ifdef PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <cstddef>
+#include <string>
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+// Enums
+//----------------------------------------------------------------------------//
+
+//! Largest number of voxel volumes and lights in a device scene. The volume
+//! intervals of each ray are kept in registers, which bounds the former.
+enum Limits {
+  MaxVolumes = 16,
+  MaxLights  = 64
+};
+
+//----------------------------------------------------------------------------//
+// Structs
+//----------------------------------------------------------------------------//
+
+//! A voxel buffer on the device. Dense buffers are a single 3D texture.
+//! Sparse buffers are an atlas of bricks, one per block that isn't zero
+//! throughout, each with a one voxel apron copied from the neighboring
+//! blocks so that the hardware interpolates across block boundaries.
+struct Volume
+{
+  //! World-to-voxel matrix, for row vectors as in Imath
+  float        wsToVs[4][4];
+  //! Voxel space bounds of the mapping, which rays are intersected with
+  float        vsBoundsMin[3];
+  float        vsBoundsMax[3];
+  //! Data window, inclusive
+  int          dataMin[3];
+  int          dataMax[3];
+  //! Scaling values of the attributes used by PhysicalSampler
+  float        scattering[3];
+  float        absorption[3];
+  float        emission[3];
+  //! Size of sparse blocks, in voxels. Zero for dense buffers.
+  int          blockSize;
+  //! Number of sparse blocks along each axis
+  int          blockRes[3];
+  //! Device array with the atlas brick of each sparse block, or -1 for
+  //! blocks that are zero throughout
+  const int   *blockBricks;
+  //! Number of bricks along each axis of the atlas
+  int          atlasBricks[3];
+  //! Texture object of the voxel data
+  unsigned long long texture;
+};
+
+//----------------------------------------------------------------------------//
+
+//! A dense transmittance buffer on the device, as used by VoxelOccluder
+struct Occluder
+{
+  //! World-to-voxel matrix, for row vectors as in Imath
+  float        wsToVs[4][4];
+  //! Data window, inclusive
+  int          dataMin[3];
+  int          dataMax[3];
+  //! Texture object of the transmittance
+  unsigned long long texture;
+};
+
+//----------------------------------------------------------------------------//
+
+//! A point or spot light
+struct Light
+{
+  float        position[3];
+  //! Intensity, already divided by the isotropic phase function
+  float        intensity[3];
+  int          falloffEnabled;
+  int          softRolloff;
+  //! Whether the cone parameters apply
+  int          isSpot;
+  float        axis[3];
+  float        cosWidth;
+  float        cosStart;
+  //! Index of the light's occluder, or -1 for lights without occlusion
+  int          occluder;
+};
+
+//----------------------------------------------------------------------------//
+
+//! UniformRaymarcher parameters that the kernel implements
+struct Params
+{
+  float        stepLength;
+  int          useVolumeStepLength;
+  float        volumeStepLengthMult;
+  int          doEarlyTermination;
+  float        earlyTerminationThreshold;
+  float        shadowStepLengthMult;
+  float        shadowEarlyTerminationThreshold;
+  int          doJitterSteps;
+};
+
+//----------------------------------------------------------------------------//
+
+//! The parts of a RayState that the kernel needs
+struct Ray
+{
+  float        pos[3];
+  float        dir[3];
+  float        tMin;
+  float        tMax;
+  float        stepOffset;
+  //! Whether the ray is TransmittanceOnly
+  int          isShadow;
+};
+
+//----------------------------------------------------------------------------//
+
+//! The integrated luminance and transmittance of a Ray, and what it cost
+struct Result
+{
+  float        luminance[3];
+  float        transmittance[3];
+  int          numSteps;
+  int          numIntervals;
+  int          isTerminated;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Voxel data to be uploaded as a 3D texture. texels holds four floats per
+//! voxel, x varying fastest. The fourth is unused, since the hardware has
+//! no three channel float textures.
+struct TextureDesc
+{
+  const float *texels;
+  int          size[3];
+  //! Whether lookups are trilinear, or nearest neighbor otherwise
+  bool         isLinear;
+};
+
+//----------------------------------------------------------------------------//
+
+//! A Volume along with its data on the host. The texture and block array
+//! members of volume are filled in by createScene().
+struct VolumeDesc
+{
+  Volume       volume;
+  TextureDesc  texture;
+  const int   *blockBricks;
+  size_t       numBlocks;
+};
+
+//----------------------------------------------------------------------------//
+
+//! An Occluder along with its data on the host. The texture member of
+//! occluder is filled in by createScene().
+struct OccluderDesc
+{
+  Occluder     occluder;
+  TextureDesc  texture;
+};
+
+//----------------------------------------------------------------------------//
+// Device resources
+//----------------------------------------------------------------------------//
+
+//! Textures and scene description on the device
+class Scene;
+//! A CUDA stream with buffers for the rays and results of one thread
+class Stream;
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Returns the number of CUDA devices. Zero if there is no driver.
+int     numDevices();
+//! Returns the largest extent of a 3D texture on the current device
+int     maxTextureSize();
+//! Uploads a scene to the current device.
+//! \returns Null if the scene couldn't be uploaded, with the reason in
+//! error.
+Scene*  createScene(const VolumeDesc *volumes, const size_t numVolumes,
+                    const OccluderDesc *occluders, const size_t numOccluders,
+                    const Light *lights, const size_t numLights,
+                    std::string &error);
+//! Frees everything that createScene() allocated
+void    destroyScene(Scene *scene);
+//! Creates a stream.
+//! \returns Null if the stream couldn't be created, with the reason in
+//! error.
+Stream* createStream(std::string &error);
+//! Frees a stream and its buffers
+void    destroyStream(Stream *stream);
+//! Integrates the rays on the device, and waits for the results. Calls
+//! on different streams may run concurrently.
+//! \returns False if the kernel couldn't be run, with the reason in error.
+bool    integrate(const Scene &scene, const Params &params,
+                  const Ray *rays, const size_t numRays, Result *results,
+                  Stream &stream, std::string &error);
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,173 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuRaymarcher.h
+  Contains the GpuRaymarcher class and related functions.
+  \note Only available when built with PVR_USE_CUDA.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_GPURAYMARCHER_H__
+#define __INCLUDED_PVR_GPURAYMARCHER_H__
+
+#ifdef PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+#include <boost/thread/mutex.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Raymarchers/UniformRaymarcher.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+namespace Gpu {
+  class Scene;
+}
+
+//----------------------------------------------------------------------------//
+// GpuRaymarcher
+//----------------------------------------------------------------------------//
+
+/*! \class GpuRaymarcher
+  \brief Runs UniformRaymarcher's integration on a CUDA device.
+
+  Each packet of rays is integrated by one kernel launch, with one thread
+  per ray. The Renderer hands out packets of up to packet_size rays, which
+  may span several rows of a tile, so larger tiles keep the device busier.
+
+  The scene is uploaded the first time a packet is integrated after
+  bindAttributes(), i.e. once per render. Voxel buffers become 3D textures,
+  which the hardware interpolates. Sparse buffers are packed into an atlas
+  of their non-empty blocks. Texture filtering uses 8 bit interpolation
+  weights, so results differ slightly from the CPU raymarcher.
+
+  Scenes that the device can't render are integrated by UniformRaymarcher
+  instead. The device handles:
+  - VoxelVolumes of dense or sparse float, half, V3f and V3h buffers with
+    static matrix mappings, no interpolation or linear interpolation, no
+    velocity buffer and no mipmaps, on their own or in CompositeVolumes
+  - PhysicalSampler with an isotropic phase function and light_samples 0
+  - Point and spot lights, with NullOccluder or VoxelOccluder occluders
+  - The step length, early termination and jitter parameters, without
+    holdouts, linear steps, max_step_optical_depth or Russian roulette
+
+  Rays with deep or per-light output are always integrated on the CPU, as
+  are preview renders with an in-scatter cache.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC GpuRaymarcher : public UniformRaymarcher
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(GpuRaymarcher);
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Default constructor
+  GpuRaymarcher();
+  //! Factory method
+  static Ptr create()
+  { return Ptr(new GpuRaymarcher); }
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(Gpu);
+  virtual void setParams(const Util::ParamMap &params);
+
+  // From Raymarcher -----------------------------------------------------------
+
+  //! Also marks the device scene as out of date
+  virtual void bindAttributes(const Volume &volume) const;
+  //! Returns the packet_size parameter
+  virtual size_t packetSize() const;
+  //! Integrates the packet on the device if the scene allows it, and with
+  //! UniformRaymarcher otherwise.
+  virtual void integratePacket(const RayStateVec &states,
+                               IntegrationResultVec &results) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns whether a CUDA device is present
+  static bool isAvailable();
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns whether the raymarcher's settings and raymarch sampler can be
+  //! integrated on the device. If not, the reason is put in reason.
+  bool isSupported(std::string &reason) const;
+  //! Returns the device version of the given scene, uploading it if it
+  //! isn't up to date. Returns null if it can't be rendered on the device.
+  boost::shared_ptr<Gpu::Scene> deviceScene(const Scene &scene) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! Number of rays per packet
+  size_t                                m_packetSize;
+  //! Guards the device scene
+  mutable boost::mutex                  m_mutex;
+  //! Scene that m_deviceScene was uploaded from
+  mutable const Scene                  *m_scene;
+  //! Whether m_deviceScene is up to date with m_scene
+  mutable bool                          m_isUploaded;
+  //! Device scene. Null if the scene can't be rendered on the device.
+  mutable boost::shared_ptr<Gpu::Scene> m_deviceScene;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
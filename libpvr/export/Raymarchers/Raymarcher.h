@@ -34,8 +34,13 @@
 
 // System headers
 
+#include <vector>
+
 // Library headers
 
+#include <boost/noncopyable.hpp>
+#include <OpenEXR/ImathRandom.h>
+
 // Project headers
 
 #include "pvr/Curve.h"
@@ -43,6 +48,7 @@
 #include "pvr/RenderState.h"
 #include "pvr/Types.h"
 #include "pvr/RaymarchSamplers/RaymarchSampler.h"
+#include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -77,6 +83,131 @@ struct IntegrationResult
   Util::ColorCurve::CPtr luminanceFunction;
   //! Transmittance function defined by raymarch. May be NULL if not computed.
   Util::ColorCurve::CPtr transmittanceFunction;
+  //! Part of the luminance scattered from each light, in the order of 
+  //! Scene::lights. Only filled in for rays with RayState::doOutputLights.
+  ColorVec lightLuminance;
+};
+
+//----------------------------------------------------------------------------//
+
+typedef std::vector<RayState>          RayStateVec;
+typedef std::vector<IntegrationResult> IntegrationResultVec;
+
+//----------------------------------------------------------------------------//
+
+//! Start or end point of an interval, used by splitIntervals()
+struct IntervalEvent
+{
+  enum Type {
+    End = 0,
+    Start,
+    Point
+  };
+  IntervalEvent(const double time, const double step, const Type eventType,
+                const bool homogeneous)
+    : t(time), stepLength(step), type(eventType), isHomogeneous(homogeneous)
+  { }
+  bool operator<(const IntervalEvent &other) const
+  { return t < other.t; }
+  double t;
+  double stepLength;
+  Type   type;
+  bool   isHomogeneous;
+};
+
+typedef std::vector<IntervalEvent> IntervalEventVec;
+
+//----------------------------------------------------------------------------//
+
+/*! \struct DeepSimplifyState
+  \brief Lets updateDeepFunctions() drop the knots of a ray's deep 
+  functions as the raymarch steps arrive.
+
+  The last knot of each function is provisional. A new step replaces it as
+  long as the segment from the knot before it passes within tolerance of 
+  every step it has replaced so far. The bounds on the slope of that 
+  segment are all that needs to be remembered, so a ray's deep functions
+  end up with roughly as many knots as their shape needs, rather than one
+  per step.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct DeepSimplifyState
+{
+  //! Bounds on the slope of the last segment of one function
+  struct Bounds
+  {
+    Bounds()
+      : isValid(false)
+    { }
+    Color low;
+    Color high;
+    //! False until the function has a segment to bound
+    bool  isValid;
+  };
+  //! Bounds for the luminance function
+  Bounds lf;
+  //! Bounds for the transmittance function
+  Bounds tf;
+};
+
+//----------------------------------------------------------------------------//
+// RaymarchScratch
+//----------------------------------------------------------------------------//
+
+/*! \struct RaymarchScratch
+  \brief Buffers that raymarchers reuse from ray to ray, so that once they
+  have grown, integrating a ray doesn't allocate.
+
+  Each thread keeps one RaymarchScratch per level of nested integration
+  (rays fired while lighting other rays). Get one with a Lease, which 
+  returns it when it goes out of scope.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct RaymarchScratch
+{
+  // Lease ---
+
+  class Lease : boost::noncopyable
+  {
+  public:
+    Lease();
+    ~Lease();
+    RaymarchScratch& operator * () const
+    { return *m_scratch; }
+    RaymarchScratch* operator -> () const
+    { return m_scratch; }
+  private:
+    RaymarchScratch *m_scratch;
+  };
+
+  // Data members ---
+
+  //! Intervals returned by the volume
+  IntervalVec             rawIntervals;
+  //! Non-overlapping integration intervals
+  IntervalVec             intervals;
+  //! Used by splitIntervals()
+  IntervalEventVec        events;
+  //! Used by splitIntervals()
+  std::vector<double>     activeStepLengths;
+  //! Intervals of all the rays in a packet
+  IntervalVec             packetIntervals;
+  //! Indices of the rays in a packet that are still marching
+  std::vector<size_t>     rayIndices;
+  //! Sample points of a batch of steps
+  VolumeSampleStatePtrVec sampleStatePtrs;
+  //! Holdout samples of a batch of steps
+  VolumeSampleVec         hoSamples;
+  //! Raymarch samples of a batch of steps
+  RaymarchSampleVec       samples;
+  //! Samples that ended a rejected step, used by AdaptiveRaymarcher
+  RaymarchSampleVec       rejectedSamples;
+  //! Ray parameters of rejectedSamples
+  std::vector<double>     rejectedTimes;
 };
 
 //----------------------------------------------------------------------------//
@@ -111,6 +242,21 @@ public:
   //! luminance and transmittance in the IntegrationResult struct.
   virtual IntegrationResult integrate(const RayState &state) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Binds the attributes of the raymarcher and its raymarch sampler to the
+  //! given volume. See Volume::bindAttribute(). Subclasses with their own
+  //! attributes should bind those and call this.
+  virtual void bindAttributes(const Volume &volume) const;
+  //! Returns the preferred number of rays to pass to integratePacket().
+  virtual size_t packetSize() const
+  { return 1; }
+  //! Integrates a packet of (preferably coherent) rays. The default 
+  //! implementation calls integrate() once per ray.
+  //! \note results will be resized to match states.
+  virtual void integratePacket(const RayStateVec &states, 
+                               IntegrationResultVec &results) const;
+
 protected:
 
   // Protected data members ----------------------------------------------------
@@ -127,6 +273,14 @@ protected:
 //! which is guaranteed to have no overlap (but possible continuity).
 IntervalVec splitIntervals(const IntervalVec &intervals);
 
+//! Splits scratch.rawIntervals into scratch.intervals, like 
+//! splitIntervals(), without allocating once the scratch buffers have grown.
+void        splitIntervals(RaymarchScratch &scratch);
+
+//! Intersects the ray with the scene volume and stores the non-overlapping
+//! integration intervals in scratch.intervals.
+void        findIntervals(const RayState &state, RaymarchScratch &scratch);
+
 //! Allocates and initializes the deep luminance function based on 
 //! whether the RayState has requested it.
 Util::ColorCurve::Ptr setupDeepLCurve(const RayState &state, const float first);
@@ -136,9 +290,39 @@ Util::ColorCurve::Ptr setupDeepLCurve(const RayState &state, const float first);
 Util::ColorCurve::Ptr setupDeepTCurve(const RayState &state, const float first);
 
 //! Updates the deep functions (luminance and transmittance) with the
-//! provided L and T values, at a depth computed from wsP.
+//! provided L and T values at depth t. Knots that the neighboring knots
+//! predict closely enough are dropped. See DeepSimplifyState.
 void updateDeepFunctions(const float t, const Color &L, const Color &T, 
-                         Util::ColorCurve::Ptr lf, Util::ColorCurve::Ptr tf);
+                         const Util::ColorCurve::Ptr &lf, 
+                         const Util::ColorCurve::Ptr &tf,
+                         DeepSimplifyState &simplify);
+
+//! Returns the length of the first step of an interval, shortened by the 
+//! ray's step offset. The remaining steps keep their length, which shifts
+//! all the sample points of the interval by the offset.
+double jitteredStepLength(const RayState &state, const double stepLength);
+
+//! Seeds a ray's random sequence from the ray itself, so that stochastic
+//! integration is deterministic regardless of which thread fires the ray.
+size_t raySeed(const RayState &state);
+
+//! Plays Russian roulette once the largest channel of T drops below the 
+//! threshold. \returns 1.0 if T is above the threshold or the threshold is
+//! zero, 0.0 if the ray should terminate, and otherwise the survival weight
+//! that keeps the estimate unbiased, which raises T back to the threshold.
+float rouletteWeight(const Color &T, const double threshold, 
+                     Imath::Rand48 &rng);
+
+//! Adds the per-light luminance of a sample, scaled by weight, to the 
+//! per-light luminance of a ray.
+void accumulateLights(const RaymarchSample &sample, const Color &weight, 
+                      ColorVec &lightL);
+
+//! Returns the integral of transmittance over a step through a homogeneous
+//! medium with the given extinction, relative to the transmittance at the 
+//! start of the step. Weighting a step's luminance by this rather than by 
+//! its length makes the step exact however thick the medium is.
+Color homogeneousStepWeight(const Color &extinction, const double stepLength);
 
 //----------------------------------------------------------------------------//
 
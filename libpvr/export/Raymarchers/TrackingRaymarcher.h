@@ -0,0 +1,152 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file TrackingRaymarcher.h
+  Contains the TrackingRaymarcher class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_TRACKINGRAYMARCHER_H__
+#define __INCLUDED_PVR_TRACKINGRAYMARCHER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+#include <OpenEXR/ImathRandom.h>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Raymarchers/UniformRaymarcher.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// TrackingRaymarcher
+//----------------------------------------------------------------------------//
+
+/*! \class TrackingRaymarcher
+  \brief Estimates transmittance with ratio tracking against a majorant of 
+  the extinction, instead of sampling at every fixed step.
+
+  Only TransmittanceOnly rays (i.e. the ones fired by occluders) are 
+  tracked. Each interval is split into segments of segment_steps times the 
+  step length, and the volume is asked for the extinction majorant of each
+  segment. Segments with a zero majorant are skipped without sampling,
+  and elsewhere the number of samples is proportional to the majorant
+  rather than the length of the segment. Segments that the volume can't 
+  bound are raymarched with uniform steps, as are all other rays.
+
+  The estimate is unbiased but noisy. Each ray is seeded from its own 
+  origin and direction, so results are deterministic.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC TrackingRaymarcher : public UniformRaymarcher
+{
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(TrackingRaymarcher);
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Factory method
+  static Ptr create()
+  { return Ptr(new TrackingRaymarcher); }
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(Tracking);
+  virtual void setParams(const Util::ParamMap &params);
+
+  // From Raymarcher -----------------------------------------------------------
+
+  virtual IntegrationResult integrate(const RayState &state) const;
+  //! Packets with TransmittanceOnly rays are integrated one ray at a time.
+  virtual void integratePacket(const RayStateVec &states, 
+                               IntegrationResultVec &results) const;
+
+protected:
+
+  // Structs -------------------------------------------------------------------
+
+  struct TrackingParams
+  {
+    TrackingParams();
+    //! Length of each majorant segment, in multiples of the step length.
+    double segmentSteps;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Whether the given ray should use tracking
+  static bool       isTracked(const RayState &state);
+  //! Ratio tracks the [t0, t1] segment against the given majorant.
+  //! \returns False if the ray was terminated.
+  bool              trackSegment(const RayState &state, 
+                                 VolumeSampleState &sampleState,
+                                 const double t0, const double t1,
+                                 const float majorant, Imath::Rand48 &rng, 
+                                 Color &T, Util::ColorCurve::Ptr tf,
+                                 DeepSimplifyState &simplify) const;
+  //! Raymarches the [t0, t1] segment with uniform steps.
+  //! \returns False if the ray was terminated.
+  bool              marchSegment(VolumeSampleState &sampleState,
+                                 const double t0, const double t1,
+                                 const double stepLength, 
+                                 Color &T, Util::ColorCurve::Ptr tf,
+                                 DeepSimplifyState &simplify) const;
+  //! Returns the extinction at the current sample point, including holdouts.
+  Color             extinction(const VolumeSampleState &sampleState) const;
+
+  // Protected data members ----------------------------------------------------
+  
+  //! Holds user parameters specific to tracking.
+  TrackingParams m_trackingParams;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
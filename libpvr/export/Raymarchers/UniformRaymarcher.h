@@ -82,7 +82,14 @@ public:
 
   // From Raymarcher -----------------------------------------------------------
 
+  virtual void bindAttributes(const Volume &volume) const;
   virtual IntegrationResult integrate(const RayState &state) const;
+  //! Returns the packet size used by integratePacket()
+  virtual size_t packetSize() const;
+  //! Marches all rays of the packet in lock step, so that each step makes
+  //! one batched volume lookup for the whole packet.
+  virtual void integratePacket(const RayStateVec &states, 
+                               IntegrationResultVec &results) const;
 
 protected:
 
@@ -102,8 +109,79 @@ protected:
     //! Threshold at which transparency is considered to be zero. 
     //! Used when doEarlyTermination is true.
     double earlyTerminationThreshold;
+    //! Step length multiplier for transmittance-only rays, on top of the 
+    //! regular step length. Shadow rays tolerate far coarser steps.
+    double shadowStepLengthMult;
+    //! Early termination threshold for transmittance-only rays
+    double shadowEarlyTerminationThreshold;
+    //! Largest optical depth a single step may cover. If non-zero, the step
+    //! length of each interval is lengthened to this over the interval's 
+    //! extinction majorant, where that is longer than the volume's step 
+    //! length. Intervals without extinction are taken in a single step.
+    double maxStepOpticalDepth;
+    //! Whether to march each ray in batches of steps, recording the sample
+    //! points of a batch before the raymarch sampler evaluates them 
+    //! together. Samplers that look up occluders can then evaluate each 
+    //! light's occluder once per batch. Rays are not marched in packets
+    //! when this is enabled.
+    int    deferredLighting;
+    //! Whether to offset the steps of each ray by its step offset. This 
+    //! turns the banding of long steps into noise, which the pixel samples
+    //! average out.
+    int    doJitterSteps;
+    //! Step length multiplier for camera rays in homogeneous intervals (see
+    //! Interval::isHomogeneous). Their luminance is weighted by the exact 
+    //! transmittance over each step, so steps only need to resolve the 
+    //! lighting. Transmittance-only rays take such intervals in one step.
+    double homogeneousStepLengthMult;
+    //! Whether to treat extinction and luminance as linear across each 
+    //! step, rather than constant. Steps are sampled at their ends, so each
+    //! sample serves two steps, and the exponential is integrated 
+    //! analytically, which keeps longer steps accurate in dense media. 
+    //! Rays are not marched in packets when this is enabled.
+    int    doLinearSteps;
+    //! Transmittance below which rays play Russian roulette, surviving 
+    //! with a probability of their transmittance over the threshold and 
+    //! being reweighted by its inverse. Unlike raising the early 
+    //! termination threshold, this skips the tail of dense media without
+    //! bias. Zero disables it.
+    double rouletteThreshold;
+    //! Russian roulette threshold for transmittance-only rays
+    double shadowRouletteThreshold;
   };
 
+  //! Integration state of a single ray in a packet
+  struct PacketRay;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Integrates a single ray. integrate() picks the instantiation once per
+  //! ray, so that the step loop has no branches for the ray's depth and 
+  //! deep output, and no holdout handling when the volume has no holdouts.
+  template <bool IsPrimary, bool HasDeepOutput, bool HasHoldouts>
+  IntegrationResult integrateRay(const RayState &state) const;
+  //! Sets up the first raymarch step of the ray's next non-empty interval.
+  //! \returns False if there are no more intervals.
+  bool beginInterval(PacketRay &ray) const;
+  //! Returns the step length to use for the [tStart, tEnd] part of the 
+  //! given interval.
+  double intervalStepLength(const RayState &state, const Interval &interval,
+                            const double tStart, const double tEnd) const;
+  //! Bounds the holdout attribute over [t0, t1]. Returns zero without 
+  //! querying the scene when no volume defines a holdout attribute.
+  bool boundHoldouts(const RayState &state, const double t0, const double t1,
+                     Color &result) const;
+  //! Returns the early termination threshold for the given ray's type
+  double earlyTerminationThreshold(const RayState &state) const;
+  //! Returns the Russian roulette threshold for the given ray's type
+  double rouletteThreshold(const RayState &state) const;
+  //! Samples the holdout, luminance and extinction of a batch of points 
+  //! into scratch.hoSamples and scratch.samples. Batches of transmittance-
+  //! only rays only sample extinction, and holdouts are only sampled if
+  //! the scene volume has them.
+  void sampleSteps(const VolumeSampleStatePtrVec &states,
+                   RaymarchScratch &scratch) const;
+
   // Protected data members ----------------------------------------------------
   
   //! Holds user parameters.
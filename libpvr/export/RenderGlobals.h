@@ -84,6 +84,21 @@ public:
   static void       setScene(SceneCPtr scene);
   //! Sets the current Camera
   static void       setCamera(CameraCPtr camera);
+  //! Sets the number of threads used by rendering, modeling and every 
+  //! other parallel job that doesn't ask for a thread count of its own.
+  //! Zero means the PVR_NUM_THREADS environment variable, or one thread per
+  //! core if it's not set. 
+  //! \note Same as Sys::setNumThreads().
+  static void       setNumThreads(const size_t numThreads);
+  //! Sets the preview level, for quick lookdev renders from unchanged 
+  //! scripts. Each level halves the resolution of modeled buffers, voxel
+  //! occluders and transmittance maps, the number of deep samples and
+  //! the pixel samples along each axis, doubles raymarch step lengths and
+  //! looks up one coarser mip level in mipmapped voxel volumes. Zero, the
+  //! default, renders at full quality. Resolutions are scaled when the 
+  //! buffers and occluders are created, so set this before building the 
+  //! scene.
+  static void       setPreviewLevel(const size_t level);
 
   // Accessors -----------------------------------------------------------------
 
@@ -97,6 +112,18 @@ public:
   static SceneCPtr  scene();
   //! Returns a pointer to the current camera
   static CameraCPtr camera();
+  //! Returns the number of threads used by parallel jobs
+  static size_t     numThreads();
+  //! Returns the preview level
+  static size_t     previewLevel();
+  //! Returns a resolution or sample count scaled down by the preview level,
+  //! but never below one
+  static size_t     previewResolution(const size_t res);
+  //! Returns the factor that the preview level multiplies step lengths by
+  static double     previewStepScale();
+  //! Returns a copy of the camera with its resolution scaled down by the
+  //! preview level, or the camera itself at full quality
+  static CameraCPtr previewCamera(CameraCPtr camera);
 
 private:
 
@@ -107,6 +134,7 @@ private:
   static float      ms_dt;
   static SceneCPtr  ms_scene;
   static CameraCPtr ms_camera;
+  static size_t     ms_previewLevel;
 
 };
 
@@ -34,10 +34,13 @@
 
 // System headers
 
+#include <vector>
+
 // Library headers
 
 // Project headers
 
+#include "pvr/Constants.h"
 #include "pvr/Time.h"
 #include "pvr/Types.h"
 
@@ -48,6 +51,43 @@
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+class Camera;
+class InScatterCache;
+class Scene;
+
+//----------------------------------------------------------------------------//
+// RenderContext
+//----------------------------------------------------------------------------//
+
+/*! \class RenderContext
+  \brief Holds the scene and camera of the render that a ray belongs to,
+  and the caches built for it.
+
+  The context is owned by the Renderer and doesn't change while any rays
+  refer to it, so several Renderers can trace rays at the same time.
+  Raw pointers are used since the context is read for every sample.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct RenderContext
+{
+  RenderContext()
+    : scene(NULL), camera(NULL), inScatterCache(NULL)
+  { }
+  //! Scene being rendered
+  const Scene          *scene;
+  //! Camera being rendered from
+  const Camera         *camera;
+  //! Light scattered by the scene's lights. Null unless enabled for the
+  //! render. See Renderer::setInScatterCacheResolution().
+  const InScatterCache *inScatterCache;
+};
+
 //----------------------------------------------------------------------------//
 // RayState
 //----------------------------------------------------------------------------//
@@ -71,8 +111,24 @@ struct RayState
       rayType(FullRaymarch),
       time(0.0f),
       doOutputDeepL(false),
-      doOutputDeepT(false)
+      doOutputDeepT(false),
+      doOutputLights(false),
+      wsFootprint(0.0),
+      footprintSpread(0.0),
+      stepOffset(0.0f),
+      context(NULL)
   { }
+  //! Returns the world space width of the ray's footprint at parameter t.
+  double footprint(const double t) const
+  { return wsFootprint + footprintSpread * t; }
+  //! Sets up the footprint of a ray that starts out wsWidth wide and 
+  //! converges to a point at tMax, as rays towards point lights do.
+  //! \note tMax must be set first.
+  void setConvergingFootprint(const double wsWidth)
+  { 
+    wsFootprint     = wsWidth;
+    footprintSpread = -wsWidth / tMax;
+  }
   Ray     wsRay;
   double  tMin;
   double  tMax;
@@ -81,6 +137,21 @@ struct RayState
   PTime   time;
   bool    doOutputDeepL;
   bool    doOutputDeepT;
+  //! Whether to also return the luminance scattered from each light. See
+  //! IntegrationResult::lightLuminance.
+  bool    doOutputLights;
+  //! World space width of the ray's footprint at its origin. Together with
+  //! footprintSpread this forms an isotropic ray differential. Zero means
+  //! the ray is infinitely thin, and volumes are sampled at full resolution.
+  double  wsFootprint;
+  //! Growth of the footprint width per unit distance along the ray.
+  double  footprintSpread;
+  //! Offset of the raymarch steps, as a fraction of the step length in 
+  //! [0,1). Only used by raymarchers that jitter their steps.
+  float   stepOffset;
+  //! Render that the ray belongs to. Set by Renderer, and inherited by
+  //! secondary rays.
+  const RenderContext *context;
 };
 
 //----------------------------------------------------------------------------//
@@ -106,12 +177,18 @@ struct LightSampleState
   Vector wsP;
 };
 
+typedef std::vector<const LightSampleState *> LightSampleStatePtrVec;
+
 //----------------------------------------------------------------------------//
 // VolumeSampleState
 //----------------------------------------------------------------------------//
 
 /*! \class VolumeSampleState
   \brief Stores the information needed to evaluate a Volume at a given point.
+
+  Raymarchers also record how far along the ray the sample is, so that 
+  raymarch samplers can skip work that couldn't visibly change the result.
+  The defaults describe a sample that may contribute fully.
  */
 
 //----------------------------------------------------------------------------//
@@ -119,12 +196,30 @@ struct LightSampleState
 struct VolumeSampleState
 {
   VolumeSampleState(const RayState &rState)
-    : rayState(rState)
+    : rayState(rState), rayTransmittance(Colors::one()), 
+      rayLuminance(Colors::zero()), stepLength(0.0)
   { }
+  //! Returns the world space width of the ray's footprint at wsP.
+  double footprint() const
+  { return rayState.footprint((wsP - rayState.wsRay.pos).length()); }
   const RayState &rayState;
   Vector wsP;
+  //! Transmittance of the ray from its start to the sample's step, or an
+  //! upper bound on it. Defaults to one.
+  Color  rayTransmittance;
+  //! Luminance the ray has accumulated before the sample's step, or a
+  //! lower bound on it. Defaults to zero.
+  Color  rayLuminance;
+  //! Upper bound on the length of ray that the sample's luminance is 
+  //! integrated over. Zero if unknown.
+  double stepLength;
 };
 
+//----------------------------------------------------------------------------//
+
+//! Batch of sample states, as passed to Volume::sampleBatch()
+typedef std::vector<const VolumeSampleState *> VolumeSampleStatePtrVec;
+
 //----------------------------------------------------------------------------//
 // OcclusionSampleState
 //----------------------------------------------------------------------------//
@@ -141,10 +236,14 @@ struct OcclusionSampleState
   OcclusionSampleState(const RayState &rState)
     : rayState(rState)
   { }
-  //! Returns a RayState that can be used to fire a secondary ray.
+  //! Returns a RayState that can be used to fire a secondary ray. The 
+  //! secondary ray keeps the width of the primary footprint at wsP.
   RayState makeSecondaryRayState() const
   {
     RayState state(rayState);
+    state.wsFootprint = 
+      rayState.footprint((wsP - rayState.wsRay.pos).length());
+    state.footprintSpread = 0.0;
     state.rayDepth++;
     state.rayType = RayState::TransmittanceOnly;
     state.wsRay.pos = wsP;
@@ -160,6 +259,11 @@ struct OcclusionSampleState
 
 //----------------------------------------------------------------------------//
 
+//! Batch of occlusion sample states, as passed to Occluder::sampleBatch()
+typedef std::vector<const OcclusionSampleState *> OcclusionSampleStatePtrVec;
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
@@ -34,20 +34,33 @@
 
 // System headers
 
+#include <string>
+#include <vector>
+
 // Library headers
 
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <OpenEXR/ImathBox.h>
 #include <OpenEXR/ImathRandom.h>
 
 // Project headers
 
 #include "pvr/export.h"
 #include "pvr/Camera.h"
+#include "pvr/Denoiser.h"
 #include "pvr/Image.h"
 #include "pvr/Exception.h"
+#include "pvr/InScatterCache.h"
 #include "pvr/Scene.h"
+#include "pvr/Stats.h"
 #include "pvr/DeepImage.h"
+#include "pvr/Threading.h"
+#include "pvr/TileScheduler.h"
 #include "pvr/Types.h"
 
+#include "pvr/PixelSamplers/PixelSampler.h"
 #include "pvr/Raymarchers/Raymarcher.h"
 #include "pvr/Lights/Light.h"
 #include "pvr/Volumes/Volume.h"
@@ -80,14 +93,31 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(Renderer);
 
+  //! Called after each pass of a progressive render, with the number of 
+  //! passes finished and the total number of passes
+  typedef boost::function<void (const size_t, const size_t)> ProgressCallback;
+
   // Enums ---------------------------------------------------------------------
 
+  //! How the values of a holdout depth map are measured. See 
+  //! setHoldoutDepth().
+  enum HoldoutDepthType {
+    //! Distance from the camera along each ray, as in the deep images
+    RayDistanceDepth,
+    //! Camera-space z, as written by most renderers
+    CameraDepth
+  };
+
   // Exceptions ----------------------------------------------------------------  
 
   DECLARE_PVR_RT_EXC(MissingCameraException, "No camera found.");
   DECLARE_PVR_RT_EXC(MissingRaymarcherException, "No raymarcher found.");
   DECLARE_PVR_RT_EXC(MissingSceneException, "No scene created.");
   DECLARE_PVR_RT_EXC(MissingVolumeException, "No volume in scene.");
+  DECLARE_PVR_RT_EXC(EmptyCropWindowException, 
+                     "Crop window is outside of the image.");
+  DECLARE_PVR_RT_EXC(InvalidSplitException, "Invalid split part:");
+  DECLARE_PVR_RT_EXC(InvalidViewException, "Invalid view index:");
 
   // Constructor, destructor, factory ------------------------------------------
 
@@ -96,8 +126,17 @@ public:
   //! Factory method. Use this for all objects that require lifetime management
   static Ptr create();
   //! Clones the Renderer. Will clear all the non-const data members but keeps
-  //! pointers to const data members (volumes, lights, etc)
+  //! pointers to const data members (volumes, lights, etc). The clone 
+  //! renders whole frames, without progressive passes, crop window or split.
   Ptr clone() const;
+  //! Creates a lightweight renderer for secondary passes, such as 
+  //! transmittance maps, rendered from the given camera. Unlike clone(), 
+  //! the view shares this renderer's scene, raymarchers and pixel sampler
+  //! rather than copying them, and only allocates outputs of the camera's
+  //! resolution. Adding volumes or lights to the view gives it its own copy
+  //! of the scene first, so this renderer is never changed. The view uses
+  //! the same render settings as clone().
+  Ptr createView(Camera::CPtr camera) const;
 
   // Setup ---------------------------------------------------------------------
 
@@ -105,19 +144,63 @@ public:
   void setCamera    (Camera::CPtr camera);
   //! Sets the raymarcher to use for rendering
   void setRaymarcher(Raymarcher::CPtr raymarcher);
+  //! Sets the raymarcher to use for transmittance-only rays, such as 
+  //! shadow rays and transmittance maps. Null means the main raymarcher.
+  void setShadowRaymarcher(Raymarcher::CPtr raymarcher);
+  //! Sets the sampler that places the pixel samples. Defaults to a 
+  //! StratifiedSampler.
+  void setPixelSampler(PixelSampler::CPtr sampler);
+  //! Sets the filter that execute() and relight() run on the image once
+  //! it's rendered, so that fewer pixel samples are needed. It's guided by
+  //! the first-hit depth of the transmittance map and by the holdout depth
+  //! map, where they're enabled, and by the image's alpha. Null turns 
+  //! denoising off, which is the default.
+  //! \note Split renders are denoised part by part, so parts meant to be
+  //! merged should be rendered without a denoiser, and the merged image 
+  //! denoised with Denoiser::apply().
+  void setDenoiser  (Denoiser::CPtr denoiser);
   //! Adds a Volume object to the collection of volumes to be rendered
   void addVolume    (Volume::CPtr volume);
   //! Adds a Light to the scene
   void addLight     (Light::CPtr light);
+  //! Adds a camera that execute() renders along with the main one, e.g.
+  //! the second eye of a stereo pair. Views share the scene, its lights and
+  //! their occluders, and all render settings, and their tiles are 
+  //! rendered in a single pass, so threads that run out of tiles in one 
+  //! view help with the others. Each view has its own outputs. See view().
+  void addView      (Camera::CPtr camera);
+  //! Removes the views added by addView()
+  void clearViews   ();
 
   // Access --------------------------------------------------------------------
 
+  //! Returns a pointer to the camera
+  Camera::CPtr     camera() const;
   //! Returns a pointer to the raymarcher
   Raymarcher::CPtr raymarcher() const;
+  //! Returns a pointer to the shadow raymarcher. May be null.
+  Raymarcher::CPtr shadowRaymarcher() const;
+  //! Returns a pointer to the pixel sampler
+  PixelSampler::CPtr pixelSampler() const;
+  //! Returns a pointer to the denoiser. May be null.
+  Denoiser::CPtr   denoiser() const;
   //! Returns a pointer to the Scene instance
   Scene::Ptr       scene() const;  
-  //! Returns the number of pixel samples to use
+  //! Returns the number of pixel samples to use, scaled down by 
+  //! RenderGlobals::previewLevel()
   size_t           numPixelSamples() const;
+  //! Returns the most pixel samples adaptive sampling takes, scaled down 
+  //! by RenderGlobals::previewLevel()
+  size_t           maxPixelSamples() const;
+  //! Returns the number of threads to use. Zero means one per hardware core.
+  size_t           numThreads() const;
+  //! Returns the number of views added by addView()
+  size_t           numViews() const;
+  //! Returns the renderer that holds the outputs of the given view, in the
+  //! order they were added. Its image and deep images, and its save 
+  //! methods, work as they do for the main camera's renderer.
+  //! \throws InvalidViewException unless index < numViews()
+  Ptr              view(const size_t index) const;
   
   // Options -------------------------------------------------------------------
 
@@ -133,43 +216,315 @@ public:
   //! Sets the number of pixel samples to use
   //! \note The number of rays fired will be the square of this number
   void setNumPixelSamples        (const size_t numSamples);
+  //! Sets whether to render progressively. A progressive render first 
+  //! fills the image with coarse preview passes, then refines it by adding
+  //! one pixel sample per pixel and pass. If the render is interrupted, the
+  //! image keeps what was accumulated so far.
+  //! \note Adaptive sampling doesn't apply to progressive renders
+  void setProgressiveEnabled     (const bool enabled);
+  //! Sets the function to call after each progressive pass. It's called on
+  //! the thread that called execute(), while no tiles are rendering, so it
+  //! may use imageSnapshot().
+  void setProgressCallback       (const ProgressCallback &callback);
+  //! Sets whether to use adaptive sampling. Each pixel starts with the 
+  //! number of pixel samples, then takes that many more at a time until 
+  //! the standard error of its alpha and luminance drops below the 
+  //! adaptive threshold, or it reaches the max number of pixel samples.
+  void setAdaptiveSamplingEnabled(const bool enabled);
+  //! Sets the most pixel samples adaptive sampling takes per pixel
+  //! \note Like setNumPixelSamples(), the number of rays is the square
+  void setMaxPixelSamples        (const size_t numSamples);
+  //! Sets the standard error at which adaptive sampling considers a pixel
+  //! converged. Luminance error is relative for luminance above one.
+  void setAdaptiveThreshold      (const float threshold);
+  //! Sets whether to store the scattered luminance of each light in an 
+  //! image of its own, divided by the light's intensity. relight() uses
+  //! them to update the image for new light intensities without
+  //! re-rendering. Costs one image per light, and slows down rendering
+  //! while enabled. Channels that a light has no intensity in during the
+  //! render can't be relit.
+  void setLightAovsEnabled       (const bool enabled);
+  //! Sets whether to keep the luminance that isn't scattered from lights,
+  //! such as emission, in an AOV of its own. This is the image minus the
+  //! lights' parts, so the per-light luminance is computed too.
+  void setEmissionAovEnabled     (const bool enabled);
+  //! Sets whether to record what each pixel cost to render, in an AOV 
+  //! holding the raymarch steps, leaf volume lookups, occluder lookups and
+  //! wall clock nanoseconds spent on it. Enables Sys::Stats during the 
+  //! render. Pixels are integrated one at a time rather than in packets 
+  //! while enabled, so the render itself gets somewhat slower.
+  void setCostAovEnabled         (const bool enabled);
   //! Sets the number of samples to use for deep images (transmittance and
   //! luminance)
   void setNumDeepSamples         (const size_t numSamples);
+  //! Sets the number of threads to render with. Zero means one thread per
+  //! hardware core.
+  void setNumThreads             (const size_t numThreads);
+  //! Sets the width/height of the square tiles handed out to each thread
+  void setTileSize               (const size_t tileSize);
+  //! Restricts rendering to the given pixels, in inclusive raster space 
+  //! coordinates. Only the crop window gets pixel storage, and saveImage()
+  //! writes it as the data window of an EXR file. The deep images cover
+  //! just the crop window, starting at its corner.
+  void setCropWindow             (const size_t xMin, const size_t yMin,
+                                  const size_t xMax, const size_t yMax);
+  //! Renders the whole image again after setCropWindow()
+  void clearCropWindow           ();
+  //! Splits the frame (or crop window) into numParts parts that may be 
+  //! rendered by separate processes, and renders only the given one. Each
+  //! part takes every numParts-th tile, starting at tile number part. 
+  //! Pixels of other parts are left zero in the image and empty in the 
+  //! deep images, so Image::merge() and DeepImage::merge() assemble the 
+  //! frame from the parts' files. The tiles' random numbers don't depend 
+  //! on the split, so the result matches an unsplit render.
+  //! \throws InvalidSplitException unless part < numParts
+  void setSplit                  (const size_t part, const size_t numParts);
+  //! Sets the resolution of the longest edge of the in-scatter cache that
+  //! execute() builds over the volume's bounds. Samplers that support it,
+  //! such as PhysicalSampler, then interpolate the light scattered at
+  //! isotropic sample points from the cache instead of sampling each light
+  //! and occluder. Voxels are computed as rays reach them. Zero disables
+  //! the cache, which is the default.
+  //! \note The cache blurs shadows to its resolution, and ignores light 
+  //! AOVs, which need each light's part.
+  void setInScatterCacheResolution(const size_t res);
+  //! Sets where to checkpoint the render, so that a render that is killed
+  //! can be resumed with setResumeEnabled(). While execute() runs, the
+  //! finished tiles are saved every interval seconds, and once more when
+  //! the render completes. The image is saved as prefix.exr, the enabled 
+  //! deep images as prefix.transmittance.pvrdeep and 
+  //! prefix.luminance.pvrdeep, and the list of finished tiles as 
+  //! prefix.tiles, which is replaced last. An empty prefix disables 
+  //! checkpointing, which is the default.
+  //! \note Only applies to renders that aren't progressive and have no 
+  //! views. Light, emission and cost AOVs aren't saved. Occluders are 
+  //! built before execute(), so they aren't part of the checkpoint. Use 
+  //! pvr.lights.OccluderCache to keep them on disk for the resumed render.
+  void setCheckpoint             (const std::string &prefix, 
+                                  const float interval = 300.0f);
+  //! Sets whether execute() resumes from the checkpoint set by 
+  //! setCheckpoint(). The checkpointed pixels are read back, and the tiles
+  //! they list are skipped. A checkpoint of a different resolution, crop
+  //! window, tile size or split is ignored with a warning, as is a missing
+  //! one, and the render starts over.
+  void setResumeEnabled          (const bool enabled);
+  //! Sets a depth map of the surfaces that hold out the volume, such as
+  //! the depth AOV of a geometry render. Primary rays stop at the depth 
+  //! in the red channel of their pixel, so no steps are taken behind the
+  //! surface. Pixels with zero, negative or infinite depth don't hold out.
+  //! The map is scaled to the camera's resolution, using the nearest pixel.
+  //! Null disables the holdout, which is the default.
+  //! \note Views and transmittance maps ignore the depth map.
+  void setHoldoutDepth           (Image::CPtr depth, 
+                                  const HoldoutDepthType type = 
+                                  RayDistanceDepth);
 
   // Execution -----------------------------------------------------------------
 
   //! Prints the scene contents
   void printSceneInfo() const;
+  //! Binds the attributes of the raymarcher to the scene volume. See 
+  //! Volume::bindAttribute(). Called by execute().
+  void bindAttributes() const;
   //! Executes the render
   void execute();
+  //! Updates the rendered image for the changes to the lights' intensities
+  //! since the last execute() or relight(), using the light AOVs. Takes 
+  //! milliseconds instead of a full render, and leaves the occluders alone.
+  //! Any other change to the scene, including moving a light, needs 
+  //! execute(). The deep images aren't updated.
+  //! \returns False if the last render had no light AOVs for the current
+  //! lights. The image is left unchanged.
+  bool relight();
 
   // Ray server ----------------------------------------------------------------
 
   //! Traces a single arbitrary ray.
   //! \note Does not change current camera.
   IntegrationResult trace(const RayState &state) const;
+  //! Traces a packet of rays together, with the raymarcher that trace()
+  //! would use for the first of them. Nearby, nearly parallel rays, such as
+  //! the shadow rays of neighboring occluder voxels, then share their 
+  //! volume lookups. See Raymarcher::integratePacket().
+  //! \note All rays must be of the same type.
+  void              tracePacket(const RayStateVec &states, 
+                                IntegrationResultVec &results) const;
 
   // Results -------------------------------------------------------------------
 
-  //! Returns a pointer to the transmittance map
+  //! Returns a pointer to the transmittance map. Empty unless it was 
+  //! enabled for the last execute().
   DeepImage::Ptr transmittanceMap() const;
-  //! Returns a pointer to the luminance map
+  //! Returns a pointer to the luminance map. Empty unless it was enabled
+  //! for the last execute().
   DeepImage::Ptr luminanceMap() const;
+  //! Returns the AOV of the given light, in the order the lights were 
+  //! added. See setLightAovsEnabled(). 
+  //! \returns A null pointer if there is no such AOV
+  Image::Ptr     lightAov(const size_t light) const;
+  //! Returns the luminance that wasn't scattered from a light, such as 
+  //! emission. With a denoiser, it's taken from the image before 
+  //! denoising.
+  //! \returns A null pointer unless setEmissionAovEnabled() was on for the
+  //! last render
+  Image::Ptr     emissionAov() const;
+  //! Returns the cost of each pixel. The R, G, B and A channels hold the 
+  //! raymarch steps, volume lookups, occluder lookups and nanoseconds. 
+  //! Time is measured at the resolution of the system clock, usually a 
+  //! microsecond.
+  //! \returns A null pointer unless setCostAovEnabled() was on for the 
+  //! last render
+  Image::Ptr     costAov() const;
+  //! Returns a copy of the rendered image. During a progressive render, 
+  //! this is the image accumulated so far.
+  Image::Ptr     imageSnapshot() const;
   //! Saves the rendered image to the given filename
   void           saveImage(const std::string &filename) const;
+  //! Saves a copy of the rendered image on a background thread, so that the
+  //! next frame can start rendering while the file is written.
+  //! \returns The task, to wait() on before relying on the file.
+  Sys::BackgroundTask::Ptr 
+                 saveImageAsync(const std::string &filename) const;
+  //! Saves the rendered image and the enabled AOVs as the layers of one 
+  //! EXR file. The light layers are called light0, light1 and so on, and 
+  //! hold each light's part of the image, at the intensity it was rendered
+  //! or relit with. The luminance of all the layers adds up to the image.
+  //! With a denoiser, the layers add up to the image before denoising.
+  //! The cost AOV is written as cost.steps, cost.volume_samples, 
+  //! cost.occluder_lookups and cost.ns.
+  //! \returns false if the file couldn't be written
+  bool           saveAovs(const std::string &filename) const;
+  //! Saves the transmittance map to the given filename. See 
+  //! DeepImage::write() for the supported formats.
+  //! \returns false if there is no transmittance map, or if it couldn't be 
+  //! written
+  bool           saveTransmittanceMap(const std::string &filename) const;
+  //! Saves the luminance map to the given filename. See DeepImage::write()
+  //! for the supported formats.
+  //! \returns false if there is no luminance map, or if it couldn't be 
+  //! written
+  bool           saveLuminanceMap(const std::string &filename) const;
+  //! Returns the statistics counters aggregated over the last execute(). 
+  //! All counts are zero unless Sys::Stats is enabled.
+  const Sys::Stats::Counts& statistics() const;
+  //! Returns the seconds that the last execute() spent rendering pixels,
+  //! i.e. without setting up the scene and caches
+  float          renderTime() const;
 
 private:
 
+  // Structs -------------------------------------------------------------------
+
+  //! Accumulated samples of a single pixel
+  struct PixelSamples;
+  //! Pixels of a row that are traced as one
+  struct PixelBlock;
+  //! Finished tiles of a checkpointed render
+  struct Checkpoint;
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::vector<PixelSamples> PixelSamplesVec;
+  typedef boost::shared_ptr<TileScheduler> TileSchedulerPtr;
+  typedef std::vector<TileSchedulerPtr> TileSchedulerVec;
+  //! Renders a single tile
+  typedef boost::function<void (const Tile &, 
+                                const Sys::JobState &)> TileFunc;
+
   // Private methods -----------------------------------------------------------
 
-  //! Integrates a single ray and returns the result
-  IntegrationResult integrateRay(const float x, const float y, 
-                                 const PTime time) const;
-  //! Configures the next pixel sample
-  void setupSample(const float xCenter, const float yCenter,
-                   const size_t xSubpixel, const size_t ySubpixel, 
-                   float &xSample, float &ySample, PTime &pTime) const;
+  //! Checks the setup and prepares the outputs for rendering. Called by 
+  //! execute(), for the main camera and for each view.
+  void setupRender();
+  //! Packs the deep images once all of their pixels are set
+  void finishRender();
+  //! Points m_context at the current scene, camera and in-scatter cache.
+  //! Called whenever any of them is replaced.
+  void updateContext();
+  //! Turns off the settings that only apply to the main render, for 
+  //! clone() and createView()
+  void disableMainRenderParams();
+  //! Returns the scene for modification. Creates it if there is none, and
+  //! copies it if it's shared with the renderer that created this view.
+  Scene& mutableScene();
+  //! Renders the tiles of the main camera and of all views in one pass
+  void runViewsPass() const;
+  //! Worker thread entry point for runViewsPass(). Renders tiles of each
+  //! view in turn, starting with a different view for each queue.
+  void renderViewTiles(const std::vector<const Renderer*> &renderers,
+                       TileSchedulerVec &schedulers, Sys::JobState &job,
+                       const size_t queue) const;
+  //! Renders every tile of the image with the given function, on worker 
+  //! threads
+  void runPass(const TileFunc &renderFunc) const;
+  //! Worker thread entry point. Renders tiles until the scheduler runs dry.
+  void renderTiles(TileScheduler &scheduler, Sys::JobState &job, 
+                   const size_t queue, const TileFunc &renderFunc) const;
+  //! Runs the preview and refinement passes of a progressive render
+  void renderProgressive();
+  //! Reports a finished progressive pass
+  void finishPass(const size_t pass, const size_t numPasses) const;
+  //! Renders all the pixels in a single tile
+  void renderTile(const Tile &tile, const Sys::JobState &job) const;
+  //! Renders a tile unless the checkpoint being resumed has it, then adds
+  //! it to the checkpoint
+  void renderCheckpointTile(const Tile &tile, const Sys::JobState &job) const;
+  //! Sets up m_checkpoint for execute(), reading back the checkpoint if 
+  //! resuming
+  void setupCheckpoint();
+  //! Writes the finished tiles to the checkpoint files. The caller holds
+  //! the checkpoint's mutex.
+  void saveCheckpoint() const;
+  //! Returns the raymarcher for camera rays. These are transmittance-only,
+  //! and use the shadow raymarcher, when the primary image is disabled.
+  const Raymarcher& cameraRaymarcher() const;
+  //! Renders a tile of a progressive preview pass, with one ray per block 
+  //! of stride x stride pixels
+  void renderPreviewTile(const Tile &tile, const Sys::JobState &job, 
+                         const size_t stride) const;
+  //! Adds the given sample to each pixel of a tile, for a progressive 
+  //! refinement pass
+  void renderRefineTile(const Tile &tile, const Sys::JobState &job, 
+                        const size_t sample, PixelSamplesVec &pixels) const;
+  //! Returns the crop window clipped to the image, or the whole image if
+  //! there is no crop window
+  Imath::Box2i renderWindow() const;
+  //! Writes the normalized result of a pixel to the image, and to the deep
+  //! images if requested
+  void writePixel(const size_t x, const size_t y, const PixelSamples &pixel,
+                  const bool doDeep) const;
+  //! Allocates the light AOVs for the given data window, if enabled, and 
+  //! records the intensities of the lights they're relative to
+  void setupLightAovs(const Imath::Box2i &window);
+  //! Finds the rectangles of pixels that the volume may be visible in, by 
+  //! projecting the bounds of each of its leaf volumes
+  void findVisibleRects();
+  //! Whether the volume is provably invisible in all the pixels from 
+  //! (x0, y0) up to but not including (x1, y1)
+  bool isCulled(const size_t x0, const size_t y0, 
+                const size_t x1, const size_t y1) const;
+  //! Returns a light's part of the image, at the intensity it was rendered
+  //! or relit with
+  Image::Ptr lightImage(const size_t light) const;
+  //! Sets up the primary ray through the given raster-space position
+  RayState setupRayState(const float x, const float y, 
+                         const PTime time) const;
+  //! Denoises m_primary, if there is a denoiser, keeping the noisy image 
+  //! for relight() and the emission AOV
+  void denoise();
+  //! Returns the feature images that m_primary is denoised with
+  std::vector<Image::CPtr> denoiseGuides() const;
+  //! Returns the distance along the primary ray through the raster-space 
+  //! position (x, y) to the holdout depth map. Returns the largest double
+  //! if the pixel doesn't hold out.
+  double holdoutDistance(const float x, const float y, const Ray &wsRay,
+                         const PTime time) const;
+  //! Sets up the primary ray of the given sample of a pixel.
+  //! \param numSamples The number of samples per pass. See PixelSampler.
+  //! \param width The number of pixels, starting at x, that the samples 
+  //! are spread over. See Camera::pixelStride().
+  RayState setupSample(const size_t x, const size_t y, const size_t index, 
+                       const size_t numSamples, const size_t width) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -179,27 +534,81 @@ private:
     bool doLuminanceMap;
     bool doTransmittanceMap;
     bool doRandomizePixelSamples;
+    bool doAdaptiveSampling;
+    bool doProgressive;
+    bool doCrop;
+    bool doLightAovs;
+    bool doEmissionAov;
+    bool doCostAov;
+    size_t splitPart;
+    size_t numSplitParts;
     size_t numPixelSamples;
+    size_t maxPixelSamples;
+    float adaptiveThreshold;
+    Imath::Box2i cropWindow;
+    size_t numThreads;
+    size_t tileSize;
+    size_t inScatterCacheRes;
+    std::string checkpointPrefix;
+    float checkpointInterval;
+    bool doResume;
   };
 
   // Private data members ------------------------------------------------------
 
-  //! Random number generator
-  mutable Imath::Rand48 m_rng;
   //! Renderer parameters
   Params m_params;
   //! Pointer to scene
   Scene::Ptr m_scene;
+  //! Whether m_scene belongs to the renderer that created this view
+  bool m_sharesScene;
   //! Pointer to primary camera
   Camera::CPtr m_camera;
   //! Pointer to raymarcher instance
   Raymarcher::CPtr m_raymarcher;
+  //! Pointer to raymarcher instance for transmittance-only rays
+  Raymarcher::CPtr m_shadowRaymarcher;
+  //! Pointer to pixel sampler instance
+  PixelSampler::CPtr m_pixelSampler;
+  //! Filter run on the finished image. May be null.
+  Denoiser::CPtr m_denoiser;
   //! Primary image output. 
   Image::Ptr m_primary;
+  //! m_primary before it was denoised. Only kept while there are light 
+  //! or emission AOVs to relight or subtract it with.
+  Image::Ptr m_noisyPrimary;
   //! Pointer to deep transmittance map
   DeepImage::Ptr m_deepTransmittance;
   //! Pointer to deep luminance map
   DeepImage::Ptr m_deepLuminance;
+  //! Scattered luminance of each light, per unit of intensity
+  std::vector<Image::Ptr> m_lightAovs;
+  //! Intensity of each light that m_primary was rendered or relit with
+  ColorVec m_aovIntensities;
+  //! Per-pixel cost of the last render. Null unless the cost AOV is on.
+  Image::Ptr m_costAov;
+  //! Depth of the surfaces that hold out primary rays. May be null.
+  Image::CPtr m_holdoutDepth;
+  //! How the values of m_holdoutDepth are measured
+  HoldoutDepthType m_holdoutDepthType;
+  //! Pixels that the volume may be visible in. Pixels outside of all of 
+  //! them are left empty without firing any rays.
+  std::vector<Imath::Box2i> m_visibleRects;
+  //! Statistics counters from the last execute()
+  Sys::Stats::Counts m_statistics;
+  //! Seconds that the last execute() spent rendering pixels
+  float m_renderTime;
+  //! Renderers of the views added by addView()
+  std::vector<Ptr> m_views;
+  //! In-scattered light of the current execute(). Shared with the views.
+  InScatterCache::CPtr m_inScatterCache;
+  //! Scene, camera and caches referenced by each RayState this renderer 
+  //! sets up
+  RenderContext m_context;
+  //! Called after each progressive pass
+  ProgressCallback m_progressCallback;
+  //! Finished tiles of the current execute(), if checkpointing
+  boost::shared_ptr<Checkpoint> m_checkpoint;
 };
 
 //----------------------------------------------------------------------------//
@@ -208,9 +617,21 @@ private:
 
 //! Creates a Ray for a given pixel and time.
 //! \param time Between shutter open and shutter close. Always in [0,1]
-Ray setupRay(Camera::CPtr camera, const float x, const float y, 
+Ray setupRay(const Camera::CPtr &camera, const float x, const float y, 
              const PTime time);
 
+//! Returns the growth of a pixel's footprint per unit distance along its ray,
+//! for use as RayState::footprintSpread. This is the angle subtended by one
+//! pixel, found from the rays through the neighboring pixels.
+double pixelFootprintSpread(const Camera::CPtr &camera, const Ray &wsRay,
+                            const float x, const float y, const PTime time);
+
+//! Returns the width of a pixel's footprint where its ray starts, for use as
+//! RayState::wsFootprint. This is zero for cameras whose rays all start at
+//! the camera position, and the pixel spacing for orthographic cameras.
+double pixelFootprintWidth(const Camera::CPtr &camera, const Ray &wsRay,
+                           const float x, const float y, const PTime time);
+
 //----------------------------------------------------------------------------//
 
 } // namespace Render
@@ -0,0 +1,129 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseCache.h
+  Contains the SparseCache class, which controls out-of-core loading of
+  sparse voxel buffers.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SPARSECACHE_H__
+#define __INCLUDED_PVR_SPARSECACHE_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <string>
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// SparseCache
+//----------------------------------------------------------------------------//
+
+/*! \class SparseCache
+  \brief Controls paged loading of SparseField data from disk.
+
+  When a memory limit is set, SparseField layers that are read from disk
+  afterwards (i.e. through VoxelVolume::load()) only have their block 
+  headers loaded. Voxel data is paged in one block at a time when first 
+  accessed and evicted least-recently-used first once the limit is reached.
+
+  Blocks that are unallocated in the file are never paged in, which means 
+  that the SparseUniformOptimizer/SparseFrustumOptimizer skipping of empty
+  blocks also avoids any disk access for them.
+
+  The cache is global and shared by all loaded fields. It is implemented on
+  top of Field3D's SparseFileManager.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC SparseCache
+{
+public:
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets the maximum amount of memory in megabytes that paged sparse 
+  //! blocks may use. A limit of zero disables paging, so that subsequently
+  //! loaded files are read into memory in their entirety.
+  static void   setMemoryLimit(const float megabytes);
+  //! Returns the current memory limit in megabytes. Zero means disabled.
+  static float  memoryLimit();
+  //! Whether files loaded from now on will be paged.
+  static bool   isEnabled();
+
+  // Statistics ----------------------------------------------------------------
+
+  //! Number of block loads from disk, i.e. cache misses, since the last reset
+  static long   numMisses();
+  //! Number of blocks currently resident in memory
+  static long   numResidentBlocks();
+  //! Number of distinct blocks loaded at least once since the last reset
+  static long   numDistinctBlocks();
+  //! Fraction of all paged blocks that are currently resident
+  static float  fractionResident();
+  //! Average number of times each distinct block was loaded. A value of 1.0
+  //! means no block was ever evicted and then needed again.
+  static float  loadsPerBlock();
+  //! Resets the statistics counters.
+  static void   resetStatistics();
+  //! Returns the statistics as human-readable lines, in the same form as
+  //! Volume::info().
+  static std::vector<std::string> info();
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  static float ms_memoryLimit;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
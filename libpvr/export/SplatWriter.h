@@ -0,0 +1,172 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file SplatWriter.h
+  Contains the SplatWriter class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SPLATWRITER_H__
+#define __INCLUDED_PVR_SPLATWRITER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Types.h"
+#include "pvr/VoxelBuffer.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+
+//----------------------------------------------------------------------------//
+// SplatWriter
+//----------------------------------------------------------------------------//
+
+/*! \class SplatWriter
+  \brief Writes point splats to a voxel buffer.
+
+  The concrete buffer type is resolved once, when the buffer is set. For
+  DenseBuffer and SparseBuffer, splats whose voxels are all inside the 
+  window are written without the per-voxel bounds checks and virtual 
+  calls of ResizableField::lvalue(). Dense splats are written through a 
+  pointer to their first voxel. Other splats and other buffer types are 
+  written voxel by voxel.
+
+  Splats can also be queued, in which case flush() writes them sorted by
+  destination block. Splats to the same block keep their queued order, so
+  the result is deterministic.
+
+  Each thread needs its own SplatWriter, and the threads must write to
+  disjoint windows.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC SplatWriter
+{
+public:
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  SplatWriter();
+  explicit SplatWriter(VoxelBuffer::Ptr buffer);
+  //! Writes any queued splats.
+  ~SplatWriter();
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets the buffer to write to. Queued splats are written to the 
+  //! previous buffer first.
+  void               setBuffer(VoxelBuffer::Ptr buffer);
+  //! Returns the buffer being written to.
+  VoxelBuffer::Ptr   buffer() const
+  { return m_buffer; }
+  //! Adds value to the voxel containing vsP, if it's inside dvsWindow.
+  void               writePoint(const Vector &vsP, const Imath::V3f &value,
+                                const DiscreteBBox &dvsWindow);
+  //! Distributes value over the eight voxels nearest to vsP, touching only
+  //! voxels inside dvsWindow.
+  void               writeAntialiasedPoint(const Vector &vsP, 
+                                           const Imath::V3f &value,
+                                           const DiscreteBBox &dvsWindow);
+  //! Queues a splat, to be written by flush(). Queued splats are written
+  //! when the window changes, or when the queue gets long.
+  void               queuePoint(const Vector &vsP, const Imath::V3f &value,
+                                const bool antialiased, 
+                                const DiscreteBBox &dvsWindow);
+  //! Writes all queued splats, sorted by destination block.
+  void               flush();
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! A queued splat
+  struct Splat
+  {
+    //! Destination block, used as the sort key
+    size_t     block;
+    Vector     vsP;
+    Imath::V3f value;
+    bool       antialiased;
+    //! Sorts by destination block
+    bool operator < (const Splat &other) const
+    { return block < other.block; }
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Writes the splat voxel by voxel through ResizableField::lvalue().
+  void               writeAntialiasedSlow(const Imath::V3i &corner, 
+                                          const Vector &fraction,
+                                          const Imath::V3f &value,
+                                          const DiscreteBBox &dvsWindow);
+  //! Returns the sort key of a splat at vsP
+  size_t             blockIndex(const Vector &vsP) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! Buffer being written to
+  VoxelBuffer::Ptr   m_buffer;
+  //! m_buffer, if it is a DenseBuffer
+  DenseBuffer       *m_dense;
+  //! m_buffer, if it is a SparseBuffer
+  SparseBuffer      *m_sparse;
+  //! Data window of m_buffer
+  DiscreteBBox       m_dataWindow;
+  //! Log2 of the block size used to sort queued splats
+  int                m_blockOrder;
+  //! Number of blocks along each axis, for the sort key
+  Imath::V3i         m_blockRes;
+  //! Queued splats
+  std::vector<Splat> m_queue;
+  //! Window of the queued splats
+  DiscreteBBox       m_queueWindow;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
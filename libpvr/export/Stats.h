@@ -0,0 +1,179 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Stats.h
+  Contains the Stats class, which counts events in the render hot paths.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_STATS_H__
+#define __INCLUDED_PVR_STATS_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <string>
+#include <vector>
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Stats
+//----------------------------------------------------------------------------//
+
+/*! \class Stats
+  \brief Per-thread statistics counters.
+
+  Each thread increments its own block of counters, so counting needs no
+  locks or atomics. Blocks outlive their threads, and aggregate() sums 
+  them. The Renderer resets the counters when execute() starts and 
+  aggregates them when it finishes.
+
+  Counting is compiled in but disabled by default. When disabled, each
+  counting site costs a single branch.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC Stats
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  enum Counter {
+    //! Rays of type RayState::FullRaymarch passed to a raymarcher
+    FullRaymarchRays = 0,
+    //! Rays of type RayState::TransmittanceOnly passed to a raymarcher
+    TransmittanceOnlyRays,
+    //! Integration intervals raymarched
+    RaymarchIntervals,
+    //! Raymarch steps taken (or collisions, for tracking raymarchers)
+    RaymarchSteps,
+    //! Rays terminated early
+    EarlyTerminations,
+    //! VoxelVolume lookups
+    VoxelVolumeSamples,
+    //! ConstantVolume lookups
+    ConstantVolumeSamples,
+    //! CompositeVolume lookups
+    CompositeVolumeSamples,
+    //! FractalCloud lookups
+    FractalCloudSamples,
+    //! OpenVDBVolume lookups
+    OpenVDBVolumeSamples,
+    //! Occluder lookups made by raymarch samplers, one per light and sample
+    OccluderLookups,
+    //! Occluder lookups that raymarch samplers culled as negligible
+    CulledOccluderLookups,
+    //! On-the-fly occluder lookups that found their data already computed
+    OccluderCacheHits,
+    //! On-the-fly occluder lookups that had to compute their data
+    OccluderCacheMisses,
+    //! In-scatter cache lookups that found their voxels already computed
+    InScatterCacheHits,
+    //! In-scatter cache lookups that had to compute a voxel
+    InScatterCacheMisses,
+    //! Unallocated sparse blocks skipped by empty space optimization
+    EsoBlocksSkipped,
+    //! Primary rays fired by the renderer
+    PixelSamples,
+    //! Pixels skipped because the volume's bounds don't project to them
+    CulledPixels,
+    //! Number of counters. Not a counter itself.
+    NumCounters
+  };
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! One value per Counter
+  typedef std::vector<long> Counts;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Enables or disables counting
+  static void         setEnabled(const bool enabled);
+  //! Whether counting is enabled
+  static bool         isEnabled()
+  { return ms_enabled; }
+  //! Adds to the calling thread's value of the given counter.
+  static void         add(const Counter counter, const long value = 1)
+  { 
+    if (ms_enabled) {
+      threadCounts()[counter] += value; 
+    }
+  }
+  //! Returns the calling thread's value of the given counter. The 
+  //! difference between two calls is the work the thread counted in 
+  //! between.
+  static long         threadValue(const Counter counter)
+  { return threadCounts()[counter]; }
+  //! Zeroes all threads' counters.
+  //! \note Must not be called while other threads are counting.
+  static void         reset();
+  //! Sums the counters of all threads.
+  //! \note Must not be called while other threads are counting.
+  static Counts       aggregate();
+  //! Returns the name of the given counter
+  static std::string  name(const Counter counter);
+  //! Returns the counts as human-readable lines, one per counter
+  static std::vector<std::string> info(const Counts &counts);
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the calling thread's counter block, creating it if needed
+  static long*        threadCounts();
+
+  // Data members --------------------------------------------------------------
+
+  static bool ms_enabled;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,482 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Threading.h
+  Contains utilities for running jobs on multiple threads.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_THREADING_H__
+#define __INCLUDED_PVR_THREADING_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <deque>
+#include <string>
+
+// Library headers
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Exception.h"
+#include "pvr/Log.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Exceptions
+//----------------------------------------------------------------------------//
+
+DECLARE_PVR_RT_EXC(WorkerThreadException, "Error in worker thread:");
+
+//----------------------------------------------------------------------------//
+// JobState
+//----------------------------------------------------------------------------//
+
+/*! \class JobState
+  \brief Keeps track of the combined progress of a job that is split across
+  several worker threads, as well as abort requests and errors raised in any
+  of the threads.
+
+  All methods are thread safe. markDone(), aborted() and progress() only touch
+  atomic counters, so workers may call them often, but per-item loops should
+  still report through a JobCounter.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC JobState
+{
+public:
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  //! Constructs the job state given the total number of work units 
+  //! (pixels, points, etc.) in the job.
+  JobState(const size_t numUnits);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Marks a number of work units as finished
+  void   markDone(const size_t numUnits);
+  //! Aborts the job.
+  //! \param error Error message. Leave empty for user interrupts.
+  void   abort(const std::string &error = std::string());
+  //! Sets the number of worker threads that will be processing the job
+  void   setNumWorkers(const size_t numWorkers);
+  //! Called by each worker thread when it exits
+  void   workerFinished();
+  //! Blocks until all work units are done, the job is aborted, all workers 
+  //! have exited, or the given number of milliseconds has passed.
+  //! \returns True if the job is complete (or aborted).
+  bool   wait(const size_t milliseconds);
+  //! Blocks until all workers have exited, or the given number of 
+  //! milliseconds has passed. 
+  //! \returns True if all workers have exited.
+  bool   waitForWorkers(const size_t milliseconds);
+
+  // Queries -------------------------------------------------------------------
+
+  //! Fraction of work units done, combined across all workers
+  float  progress() const;
+  //! Whether the job was aborted
+  bool   aborted() const;
+  //! Whether an error was raised by a worker
+  bool   hasError() const;
+  //! Returns the first error message raised by a worker
+  std::string error() const;
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns true if all units are done, all workers have exited, or the 
+  //! job was aborted.
+  //! \note Assumes that m_mutex is locked.
+  bool isComplete() const;
+
+  // Data members --------------------------------------------------------------
+
+  //! Total number of units in the job
+  size_t m_numUnits;
+  //! Number of units that are finished
+  boost::atomic<size_t> m_numDone;
+  //! Number of worker threads. Zero if unknown.
+  size_t m_numWorkers;
+  //! Number of worker threads that have exited
+  size_t m_numFinished;
+  //! Whether the job was aborted
+  boost::atomic<bool> m_aborted;
+  //! First error raised by a worker
+  std::string m_error;
+  //! Guards the worker counts and the error, and is held when signaling
+  //! m_completed
+  mutable boost::mutex m_mutex;
+  //! Signaled when the job completes or aborts
+  boost::condition_variable m_completed;
+
+};
+
+//----------------------------------------------------------------------------//
+// JobCounter
+//----------------------------------------------------------------------------//
+
+/*! \class JobCounter
+  \brief Batches the work units that a single worker reports to a JobState,
+  so that loops over many small items only touch the shared state, and check
+  for aborts, once every few items.
+
+  Any units not yet reported are flushed on destruction.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC JobCounter
+{
+public:
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  //! Constructs a counter that reports to the job once every interval units
+  JobCounter(JobState &job, const size_t interval)
+    : m_job(job), m_interval(interval), m_count(0)
+  { }
+  ~JobCounter()
+  { flush(); }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Counts work units as done.
+  //! \returns False if the job was found to be aborted.
+  bool add(const size_t numUnits = 1)
+  {
+    m_count += numUnits;
+    if (m_count < m_interval) {
+      return true;
+    }
+    flush();
+    return !m_job.aborted();
+  }
+  //! Reports any pending units to the job
+  void flush()
+  {
+    if (m_count > 0) {
+      m_job.markDone(m_count);
+      m_count = 0;
+    }
+  }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! Job to report to
+  JobState     &m_job;
+  //! Number of units between reports
+  const size_t  m_interval;
+  //! Number of units not yet reported
+  size_t        m_count;
+
+};
+
+//----------------------------------------------------------------------------//
+// LazyFillState
+//----------------------------------------------------------------------------//
+
+/*! \class LazyFillState
+  \brief Tracks which elements of a lazily computed cache (pixels, voxels, 
+  etc.) have been filled in.
+
+  Each element goes from Empty to Computing to Ready. The first thread to 
+  claim an element computes it, and other threads that need the same element 
+  wait until it is ready. They wait at most as long as it takes to compute
+  one element. If the computation throws, the element goes back to Empty so 
+  that another thread may retry it.
+
+  All methods are thread safe. Checking an element that is already filled
+  in is a single atomic load.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC LazyFillState
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  enum State {
+    Empty = 0,
+    Computing,
+    Ready
+  };
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  //! Constructs the state for the given number of elements, all Empty.
+  LazyFillState(const size_t size);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Whether the given element has been filled in. Once this returns true,
+  //! all writes made while computing the element are visible to the caller.
+  bool isReady(const size_t i) const
+  { return m_states[i].load(boost::memory_order_acquire) == Ready; }
+  //! Ensures that the given element is filled in. If no other thread is
+  //! computing it, compute() is called on the current thread. Otherwise the
+  //! call blocks until the other thread has finished.
+  void fill(const size_t i, const boost::function<void ()> &compute) const;
+  //! Claims the given element for the current thread if it is Empty, so 
+  //! that several elements can be computed together. A claimed element 
+  //! must be passed to either finish() or release().
+  //! \returns False if another thread is computing it or it is ready.
+  bool claim(const size_t i) const;
+  //! Marks an element claimed with claim() as Ready
+  void finish(const size_t i) const;
+  //! Returns an element claimed with claim() to Empty, for when computing 
+  //! it failed
+  void release(const size_t i) const;
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! Number of elements
+  size_t                                   m_size;
+  //! State of each element
+  boost::shared_array<boost::atomic<int> > m_states;
+
+};
+
+//----------------------------------------------------------------------------//
+// ThreadPool
+//----------------------------------------------------------------------------//
+
+/*! \class ThreadPool
+  \brief The threads that all parallel jobs in PVR run on.
+
+  runWorkers() queues its workers on the global pool instead of starting 
+  threads of its own, so rendering, modeling and occluder builds share the
+  thread count set by setNumThreads(), rather than each oversubscribing the
+  machine. The pool grows to numThreads() threads as it is used. Its 
+  threads wait for work between jobs and live as long as the process.
+
+  A job started from a pool thread runs its own queued workers on that 
+  thread while it waits, so nested jobs never wait for the pool threads 
+  that are running the enclosing job.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC ThreadPool : boost::noncopyable
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::function<void ()> Task;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the global pool
+  static ThreadPool& global();
+  //! Whether the calling thread is one of the pool's threads
+  static bool        isPoolThread();
+  //! Queues a task belonging to the given job
+  void               submit(const JobState *job, const Task &task);
+  //! Runs the first queued task of the given job on the calling thread.
+  //! \returns False if none of the job's tasks were queued.
+  bool               runPending(const JobState *job);
+  //! Returns the number of threads started so far
+  size_t             size() const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct QueuedTask
+  {
+    QueuedTask(const JobState *job, const Task &task)
+      : job(job), task(task)
+    { }
+    const JobState *job;
+    Task            task;
+  };
+
+  // Ctor ----------------------------------------------------------------------
+
+  ThreadPool();
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Creates the global pool
+  static void createGlobal();
+  //! Runs queued tasks until the process exits
+  void workerLoop();
+
+  // Data members --------------------------------------------------------------
+
+  //! Tasks waiting for a thread, oldest first
+  std::deque<QueuedTask>    m_tasks;
+  //! Pool threads
+  boost::thread_group       m_threads;
+  //! Number of pool threads
+  size_t                    m_size;
+  //! Guards m_tasks and m_size
+  mutable boost::mutex      m_mutex;
+  //! Signaled when a task is queued
+  boost::condition_variable m_taskQueued;
+
+};
+
+//----------------------------------------------------------------------------//
+// BackgroundTask
+//----------------------------------------------------------------------------//
+
+/*! \class BackgroundTask
+  \brief Runs a function on a thread of its own, so that the caller can 
+  carry on. Used by the asynchronous file writers, which return the task as
+  a handle to wait on.
+
+  Destroying the task waits for it to finish.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC BackgroundTask
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(BackgroundTask);
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  //! Starts running the given function on a new thread
+  static Ptr run(const boost::function<void ()> &task);
+  ~BackgroundTask();
+
+  // Main methods --------------------------------------------------------------
+
+  //! Blocks until the task has finished.
+  //! \throws WorkerThreadException if the task raised an exception.
+  void wait();
+  //! Whether the task has finished
+  bool isDone();
+
+private:
+
+  // Ctor ----------------------------------------------------------------------
+
+  BackgroundTask(const boost::function<void ()> &task);
+
+  // Data members --------------------------------------------------------------
+
+  //! The task, called with a dummy thread index
+  boost::function<void (size_t)> m_task;
+  //! Completion state and error of the task
+  JobState                       m_job;
+  //! Thread running the task
+  boost::thread                  m_thread;
+
+};
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Sets the number of threads that jobs use by default, which is also the
+//! size that the thread pool grows to. Zero restores the default, which is
+//! the value of the PVR_NUM_THREADS environment variable, so that farm 
+//! jobs can match the cores they were given, or else one thread per 
+//! hardware core.
+LIBPVR_PUBLIC void   setNumThreads(const size_t numThreads);
+
+//! Returns the number of threads that jobs use by default
+LIBPVR_PUBLIC size_t numThreads();
+
+//----------------------------------------------------------------------------//
+
+//! Returns the number of threads to use for a job. 
+//! \param requested Zero means numThreads().
+LIBPVR_PUBLIC size_t numWorkerThreads(const size_t requested);
+
+//----------------------------------------------------------------------------//
+
+//! Calls worker(i) on a separate thread for each i in [0, numThreads). The 
+//! calling thread polls the global interrupt and reports progress until the
+//! job is complete.
+//! \note Workers must not call Interrupt::throwOnAbort(). They should instead
+//! stop early once job.aborted() returns true.
+//! \throws UserInterruptException if the user aborted the job.
+//! \throws WorkerThreadException if a worker raised an exception.
+LIBPVR_PUBLIC void runWorkers(const size_t numThreads,
+                              const boost::function<void (size_t)> &worker,
+                              JobState &job, 
+                              Util::ProgressReporter &progress);
+
+//----------------------------------------------------------------------------//
+
+//! Calls func(begin, end) for each chunk of chunkSize items in 
+//! [0, numItems), on up to numThreads threads. Each thread claims the next
+//! unprocessed chunk once it is done with its last one, so uneven chunks 
+//! are balanced across the threads. The chunk boundaries only depend on 
+//! chunkSize, so results gathered per chunk are deterministic regardless
+//! of the thread count. Aborts and errors are handled as by runWorkers().
+LIBPVR_PUBLIC void parallelFor(const size_t numItems, const size_t chunkSize,
+                               const boost::function<void (size_t, size_t)>
+                               &func, 
+                               const size_t numThreads,
+                               Util::ProgressReporter &progress);
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
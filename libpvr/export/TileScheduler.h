@@ -0,0 +1,152 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file TileScheduler.h
+  Contains the TileScheduler class and related structs.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_TILESCHEDULER_H__
+#define __INCLUDED_PVR_TILESCHEDULER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <deque>
+#include <vector>
+
+// Library headers
+
+#include <boost/thread/mutex.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// Tile
+//----------------------------------------------------------------------------//
+
+//! Rectangular region of an image. x1 and y1 are exclusive.
+struct Tile
+{
+  Tile()
+    : index(0), x0(0), y0(0), x1(0), y1(0)
+  { }
+  //! Number of pixels in the tile
+  size_t numPixels() const
+  { return (x1 - x0) * (y1 - y0); }
+  //! Index of tile in scanline order, regardless of the order tiles are 
+  //! handed out in. Used to seed per-tile random numbers.
+  size_t index;
+  size_t x0, y0, x1, y1;
+};
+
+//----------------------------------------------------------------------------//
+// TileScheduler
+//----------------------------------------------------------------------------//
+
+/*! \class TileScheduler
+  \brief Hands out image tiles to a set of worker threads.
+
+  Tiles are ordered along a Hilbert curve, and each worker owns a 
+  contiguous run of it. Once its own queue runs dry it steals from the back 
+  of the other workers' queues.
+
+  All methods are thread safe.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC TileScheduler
+{
+public:
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  //! Splits the given image resolution into tiles and distributes them 
+  //! evenly over numQueues worker queues.
+  TileScheduler(const size_t width, const size_t height, 
+                const size_t tileSize, const size_t numQueues);
+  //! Splits the region of the given size, starting at pixel (xMin, yMin),
+  //! into tiles. Tile indices count from the region's corner.
+  TileScheduler(const size_t xMin, const size_t yMin, 
+                const size_t width, const size_t height, 
+                const size_t tileSize, const size_t numQueues);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the next tile for the given worker. Falls back to stealing 
+  //! from other workers if the worker's own queue is empty.
+  //! \returns False if no tiles remain.
+  bool   next(const size_t queue, Tile &tile);
+
+  // Queries -------------------------------------------------------------------
+
+  //! Number of tiles in the job
+  size_t numTiles() const;
+
+private:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::deque<Tile> TileQueue;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Creates the tiles. Called by the constructors.
+  void init(const size_t xMin, const size_t yMin, 
+            const size_t width, const size_t height, const size_t tileSize);
+
+  // Data members --------------------------------------------------------------
+
+  //! Number of tiles in the job
+  size_t m_numTiles;
+  //! Per-worker tile queues. Guarded by m_mutex.
+  std::vector<TileQueue> m_queues;
+  //! Guards m_queues
+  boost::mutex m_mutex;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
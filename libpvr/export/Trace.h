@@ -0,0 +1,133 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Trace.h
+  Contains the Trace class, which records a timeline of a job for viewing in
+  Chrome's trace viewer or Perfetto.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_TRACE_H__
+#define __INCLUDED_PVR_TRACE_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <string>
+
+// Library headers
+
+#include <boost/cstdint.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Trace
+//----------------------------------------------------------------------------//
+
+/*! \class Trace
+  \brief Records timed events on each thread and writes them as a Chrome 
+  trace JSON file.
+
+  Like Stats, each thread appends to its own event buffer, so recording 
+  needs no locks. Tracing is started by start(), or by setting the PVR_TRACE
+  environment variable to the output filename (see Globals::init()). A trace
+  that is still running when the process exits is written then.
+
+  When tracing is disabled, each Scope costs a single branch.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC Trace
+{
+public:
+
+  // Scope ---------------------------------------------------------------------
+
+  //! Records an event covering the lifetime of the object
+  class LIBPVR_PUBLIC Scope
+  {
+  public:
+    Scope(const std::string &name, const char *category = "pvr");
+    ~Scope();
+  private:
+    //! Name of the event. Left empty if tracing was disabled on construction
+    std::string    m_name;
+    const char    *m_category;
+    //! Start time, in microseconds since tracing started
+    boost::int64_t m_start;
+  };
+
+  // Main methods --------------------------------------------------------------
+
+  //! Discards any recorded events and starts tracing. The events are written
+  //! to the given file when stop() is called.
+  //! \note Must not be called while other threads are recording.
+  static void        start(const std::string &filename);
+  //! Stops tracing and writes the recorded events.
+  //! \note Must not be called while other threads are recording.
+  static void        stop();
+  //! Whether tracing is enabled
+  static bool        isEnabled()
+  { return ms_enabled; }
+  //! Records an event on the calling thread
+  //! \param start Start time, as returned by now()
+  //! \param duration Duration in microseconds
+  static void        record(const std::string &name, const char *category,
+                            const boost::int64_t start, 
+                            const boost::int64_t duration);
+  //! Returns the number of microseconds since tracing started
+  static boost::int64_t now();
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  static bool ms_enabled;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -35,6 +35,7 @@
 // System includes
 
 #include <stdexcept>
+#include <vector>
 
 // Library includes
 
@@ -112,8 +113,8 @@ struct Interval
   // Constructor ---------------------------------------------------------------
 
   //! Default constructor
-  Interval(double start, double end, double step)
-    : t0(start), t1(end), stepLength(step) 
+  Interval(double start, double end, double step, bool homogeneous = false)
+    : t0(start), t1(end), stepLength(step), isHomogeneous(homogeneous)
   { }
 
   // Public data members -------------------------------------------------------
@@ -125,6 +126,10 @@ struct Interval
   //! The world space step length that is reasonable to use for the given 
   //! interval.
   double stepLength;
+  //! Whether the volume's extinction and holdout are constant over the 
+  //! interval. Raymarchers may then integrate transmittance in closed form
+  //! rather than by sampling it.
+  bool   isHomogeneous;
 };
 
 typedef std::vector<Interval> IntervalVec;
@@ -143,6 +148,8 @@ typedef Imath::Plane3d Plane;
 typedef Imath::Quatd   Quat;
 typedef Imath::V3d     Vector;
 
+typedef std::vector<Color> ColorVec;
+
 //----------------------------------------------------------------------------//
 
 } // namespace pvr
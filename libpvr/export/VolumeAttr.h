@@ -53,7 +53,9 @@ namespace Render {
   IndexNotSet. The first time the instance is used to sample a Volume, that
   Volume is responsible for setting the index of the VolumeAttr, so that
   future calls to Volume::sample() efficiently can determine which attribute
-  is requested.
+  is requested. Renderer::execute() resolves the attributes of its 
+  raymarcher and samplers up front through Volume::bindAttribute(), so 
+  that render threads only ever read the index.
 
   \note A single VolumeAttr can only be used to sample into a single Volume.
   Once the index has been locked in, there is no guarantee that the attribute
@@ -43,6 +43,8 @@
 // Project headers
 
 #include "pvr/export.h"
+#include "pvr/Acceleration.h"
+#include "pvr/Threading.h"
 #include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
@@ -87,7 +89,8 @@ public:
 
   //! Default constructor
   CompositeVolume()
-    : m_compositePhaseFunction(new Phase::Composite)
+    : m_compositePhaseFunction(new Phase::Composite),
+      m_childBvhState(1)
   { 
     m_phaseFunction = m_compositePhaseFunction;
   }
@@ -105,8 +108,45 @@ public:
   virtual VolumeSample sample(const VolumeSampleState &state,
                               const VolumeAttr &attribute) const;
   virtual BBox         wsBounds() const;
+  //! Also binds the matching attribute of each child.
+  virtual void         bindAttribute(const VolumeAttr &attribute) const;
+  //! Also binds the light mask of each child.
+  virtual void         bindLights(const LightVec &sceneLights) const;
   virtual IntervalVec  intersect(const RayState &state) const;
+  virtual void         appendIntersections(const RayState &state,
+                                           IntervalVec &intervals) const;
   virtual CVec         inputs() const;
+  virtual void         sampleBatch(const VolumeSampleStatePtrVec &states,
+                                   const VolumeAttr &attribute,
+                                   VolumeSampleVec &samples) const;
+  //! Forwards all the attributes to each child in one call, so that each 
+  //! child can use its own single lookup.
+  virtual void         sampleAttributes(const VolumeSampleState &state,
+                                        const VolumeAttr *const *attributes,
+                                        const size_t numAttrs,
+                                        VolumeSample *samples) const;
+  virtual void         sampleAttributesBatch(
+    const VolumeSampleStatePtrVec &states, 
+    const VolumeAttr *const *attributes, const size_t numAttrs, 
+    VolumeSampleVec *samples) const;
+  //! Sums the children's sampleSum(), so that each child can use its own
+  //! single lookup.
+  virtual Color        sampleSum(const VolumeSampleState &state,
+                                 const VolumeAttr &first,
+                                 const VolumeAttr &second) const;
+  virtual void         sampleSumBatch(const VolumeSampleStatePtrVec &states,
+                                      const VolumeAttr &first,
+                                      const VolumeAttr &second,
+                                      ColorVec &result) const;
+  //! The majorant of a composite is the sum of its childrens' majorants.
+  virtual bool         majorant(const RayState &state, 
+                                const VolumeAttr &attribute,
+                                const double t0, const double t1,
+                                Color &result) const;
+  //! The bounds majorant of a composite is the sum of its childrens'.
+  virtual bool         boundsMajorant(const BBox &wsBounds, 
+                                      const VolumeAttr &attribute,
+                                      Color &result) const;
 
   // Main methods --------------------------------------------------------------
 
@@ -118,6 +158,9 @@ protected:
   // Utility methods -----------------------------------------------------------
 
   void                 setupAttribute(const VolumeAttr &attribute) const;
+  //! Builds the BVH over the children's world space bounds. Children with 
+  //! empty or infinite bounds are kept in m_unboundedChildren instead.
+  void                 buildChildBvh() const;
 
   // Protected data members ----------------------------------------------------
 
@@ -127,6 +170,12 @@ protected:
   mutable ChildAttrsVec     m_childAttrs;
   //! Pointer to composite phase function
   Phase::Composite::Ptr     m_compositePhaseFunction;
+  //! BVH over child bounds. Values are indices into m_volumes.
+  mutable Accel::BoundsBVH<size_t> m_childBvh;
+  //! Indices of children that can't be culled by m_childBvh.
+  mutable std::vector<size_t>      m_unboundedChildren;
+  //! Whether m_childBvh has been built. Reset when children are added.
+  Sys::LazyFillState               m_childBvhState;
 
 };
 
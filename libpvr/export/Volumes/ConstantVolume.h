@@ -81,7 +81,17 @@ public:
                                    const VolumeAttr &attribute) const;
   virtual BBox              wsBounds() const;
   virtual IntervalVec       intersect(const RayState &state) const;
+  //! Appends a single homogeneous interval through the volume's bounds
+  virtual void              appendIntersections(const RayState &state,
+                                                IntervalVec &intervals) const;
   virtual Volume::StringVec info() const;
+  virtual bool              majorant(const RayState &state, 
+                                     const VolumeAttr &attribute,
+                                     const double t0, const double t1,
+                                     Color &result) const;
+  virtual bool              boundsMajorant(const BBox &wsBounds,
+                                           const VolumeAttr &attribute,
+                                           Color &result) const;
 
 protected:
 
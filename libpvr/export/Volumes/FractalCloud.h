@@ -87,6 +87,12 @@ public:
                               const VolumeAttr &attribute) const;
   virtual BBox wsBounds() const { return BBox(); }
   virtual IntervalVec intersect(const RayState &state) const;
+  virtual void appendIntersections(const RayState &state,
+                                   IntervalVec &intervals) const;
+  //! Evaluates the fractal for the whole batch at once
+  virtual void sampleBatch(const VolumeSampleStatePtrVec &states,
+                           const VolumeAttr &attribute,
+                           VolumeSampleVec &samples) const;
 
   // Main methods --------------------------------------------------------------
 
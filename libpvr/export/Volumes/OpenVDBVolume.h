@@ -0,0 +1,195 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file OpenVDBVolume.h
+  Contains the OpenVDBVolume class and related functions.
+  \note Only available when built with PVR_USE_OPENVDB.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_OPENVDBVOLUME_H__
+#define __INCLUDED_PVR_OPENVDBVOLUME_H__
+
+#ifdef PVR_USE_OPENVDB
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <vector>
+
+// Library headers
+
+#include <boost/shared_ptr.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Memory.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// OpenVDBVolume
+//----------------------------------------------------------------------------//
+
+/*! \class OpenVDBVolume
+  \brief Samples an OpenVDB float or vec3 grid directly, without converting
+  it to a Field3D buffer.
+
+  Ray intersection uses a hierarchical DDA over the grid's tree, so that
+  empty tiles are skipped at every level of the tree, down to individual
+  leaf nodes. Lookups are trilinear, and each lookup or batch of lookups
+  goes through a value accessor, so that neighbouring taps reuse the cached
+  path through the tree.
+
+  The grid's transform must be linear. OpenVDB frustum transforms are not
+  supported.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC OpenVDBVolume : public Volume
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(OpenVDBVolume);
+
+  // Exceptions ----------------------------------------------------------------
+
+  DECLARE_PVR_RT_EXC(UnsupportedGridException,
+                     "Unsupported OpenVDB grid:");
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Default constructor
+  OpenVDBVolume();
+  PVR_DEFINE_CREATE_FUNC(OpenVDBVolume);
+  //! Destructor. Defined in the .cpp so that the OpenVDB types stay there.
+  virtual ~OpenVDBVolume();
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(OpenVDBVolume);
+
+  // From Volume ---------------------------------------------------------------
+
+  virtual AttrNameVec  attributeNames() const;
+  virtual VolumeSample sample(const VolumeSampleState &state,
+                              const VolumeAttr &attribute) const;
+  virtual BBox         wsBounds() const;
+  virtual IntervalVec  intersect(const RayState &state) const;
+  virtual StringVec    info() const;
+
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Appends one interval per run of active tree nodes along the ray.
+  virtual void         appendIntersections(const RayState &state,
+                                           IntervalVec &intervals) const;
+  //! Uses a single value accessor for the whole batch.
+  virtual void         sampleBatch(const VolumeSampleStatePtrVec &states,
+                                   const VolumeAttr &attribute,
+                                   VolumeSampleVec &samples) const;
+  //! Bounds the attribute using the largest value in the grid.
+  virtual bool         majorant(const RayState &state,
+                                const VolumeAttr &attribute,
+                                const double t0, const double t1,
+                                Color &result) const;
+  //! Bounds the attribute using the largest value in the grid, or zero
+  //! if the bounds don't overlap the grid's active voxels.
+  virtual bool         boundsMajorant(const BBox &wsBounds,
+                                      const VolumeAttr &attribute,
+                                      Color &result) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Loads a grid from an OpenVDB file. If gridName is empty, the first
+  //! float or vec3s grid in the file is used.
+  //! \throws UnsupportedGridException if the grid isn't a float or vec3s
+  //! grid, or if its transform isn't linear.
+  void                 load(const std::string &filename,
+                            const std::string &gridName = "");
+  //! Adds an attribute to be exposed. The supplied value acts as a scaling
+  //! factor on top of the value sampled from the grid.
+  void                 addAttribute(const std::string &attrName,
+                                    const Imath::V3f &value);
+  //! Sets whether to skip the empty parts of the tree. When disabled, each
+  //! ray gets a single interval through the active voxel bounds.
+  void                 setUseEmptySpaceOptimization(const bool enabled);
+
+protected:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Holds the grid and everything derived from it. Defined in the .cpp.
+  struct GridData;
+  //! GridData for a given OpenVDB grid type. Defined in the .cpp.
+  template <typename GridT>
+  struct TypedGridData;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the scaling value of the attribute, which is zero if the
+  //! volume doesn't have it. Sets up the attribute index if needed.
+  Imath::V3f           attributeScale(const VolumeAttr &attribute) const;
+
+  // Protected data members ----------------------------------------------------
+
+  //! The grid. Null until a grid has been loaded.
+  boost::shared_ptr<GridData> m_grid;
+  //! Accounts for the memory used by the grid
+  Sys::Memory::Tracker      m_gridMemory;
+  //! World space bounds of the active voxels
+  BBox                      m_wsBounds;
+  //! Attribute names
+  AttrNameVec               m_attrNames;
+  //! Attribute scaling values
+  std::vector<Imath::V3f>   m_attrValues;
+  //! Whether to use empty space optimization
+  bool                      m_useEmptySpaceOptimization;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_OPENVDB
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -34,6 +34,8 @@
 
 // System headers
 
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
 
 // Project headers
@@ -51,6 +53,81 @@
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+class Light;
+
+//----------------------------------------------------------------------------//
+// LightLinks
+//----------------------------------------------------------------------------//
+
+//! One flag per light in the scene's light list, set for the lights that
+//! illuminate a volume. Built by Volume::bindLights().
+typedef std::vector<char> LightMask;
+
+//----------------------------------------------------------------------------//
+
+/*! \class LightLinks
+  \brief The light masks of the volumes that make up a sample, stored 
+  inline.
+
+  Composite volumes add the mask of each child that scatters at the sample
+  point, weighted by the child's value, so that each light only 
+  illuminates the part of the sample that is linked to it. A null mask
+  stands for a volume that every light illuminates. The masks are owned
+  by the volumes that returned them.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC LightLinks
+{
+public:
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Maximum number of distinct masks. Once full, adding a mask replaces 
+  //! the lightest one, if the new mask is heavier.
+  enum { MaxLinks = 4 };
+
+  // Ctor ----------------------------------------------------------------------
+
+  LightLinks()
+    : m_size(0), m_isLinked(false)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns whether some volume in the sample is restricted to a set of
+  //! lights. If not, every light illuminates all of the sample.
+  bool  isLinked() const
+  { return m_isLinked; }
+  //! Adds a mask with the given weight. Null masks are lit by all lights.
+  void  add(const LightMask *mask, const float weight);
+  //! Adds all masks of another sample, scaled so that their weights sum to
+  //! the given weight. Its null masks are replaced by defaultMask.
+  void  add(const LightLinks &links, const float weight, 
+            const LightMask *defaultMask);
+  //! Returns the fraction of the sample that the given light illuminates
+  float fraction(const size_t lightIdx) const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! Mask of each link
+  const LightMask *m_masks[MaxLinks];
+  //! Weight of each link
+  float            m_weights[MaxLinks];
+  //! Number of links in use
+  size_t           m_size;
+  //! Whether any link has a non-null mask
+  bool             m_isLinked;
+
+};
+
 //----------------------------------------------------------------------------//
 // VolumeSample
 //----------------------------------------------------------------------------//
@@ -60,17 +137,57 @@ struct VolumeSample
   
   // Constructors ---
 
-  VolumeSample(const Color &v, Phase::PhaseFunction::CPtr p)
+  VolumeSample()
+    : value(0.0f), phaseFunction(NULL)
+  { }
+  //! Takes the phase function by reference, so that no reference count is
+  //! touched. The volume owns it for as long as it renders.
+  VolumeSample(const Color &v, const Phase::PhaseFunction::CPtr &p)
+    : value(v), phaseFunction(p.get())
+  { }
+  VolumeSample(const Color &v, const Phase::PhaseFunction *p)
     : value(v), phaseFunction(p)
   { }
 
+  // Main methods ---
+
+  //! Returns the scattering probability of the sample, using lobes if
+  //! there are any, and phaseFunction otherwise.
+  float probability(const Vector &in, const Vector &out) const
+  {
+    return lobes.empty() ? 
+      phaseFunction->probability(in, out) : lobes.probability(in, out);
+  }
+  //! Returns whether the sample scatters equally in all directions
+  bool isIsotropic() const
+  {
+    return lobes.empty() ? 
+      phaseFunction->isIsotropic() : lobes.isIsotropic();
+  }
+
   // Public data members ---
 
   Color value;
-  Phase::PhaseFunction::CPtr phaseFunction;
+  //! Phase function of the volume that took the sample. A raw pointer, as
+  //! samples are created and copied for every step of every ray, and 
+  //! atomic reference counting would make all threads contend for the 
+  //! phase function's count.
+  const Phase::PhaseFunction *phaseFunction;
+  //! Per-sample mix of phase functions. Overrides phaseFunction when 
+  //! non-empty.
+  Phase::Lobes lobes;
+  //! Light links of the volumes that make up the sample. Filled in by
+  //! composite volumes, and only for primary rays, like lobes. Samples of
+  //! other volumes leave it unlinked, and are lit according to 
+  //! Volume::lightMask().
+  LightLinks   lightLinks;
 
 };
 
+//----------------------------------------------------------------------------//
+
+typedef std::vector<VolumeSample> VolumeSampleVec;
+
 //----------------------------------------------------------------------------//
 // Volume
 //----------------------------------------------------------------------------//
@@ -86,6 +203,8 @@ public:
   typedef std::vector<std::string>  AttrNameVec;
   typedef std::vector<std::string>  StringVec;
   typedef std::vector<Volume::CPtr> CVec;
+  typedef Util::SPtr<const Light>::type LightPtr;
+  typedef std::vector<LightPtr>         LightVec;
 
   // Constructors and destructor -----------------------------------------------
 
@@ -101,6 +220,21 @@ public:
   //! Returns the phase function
   Phase::PhaseFunction::CPtr phaseFunction() const;
 
+  // Light linking -------------------------------------------------------------
+
+  //! Links a light to the volume. Once a volume has links, only the linked
+  //! lights illuminate it. Volumes without links are lit by every light.
+  //! Children of a CompositeVolume that have no links of their own use 
+  //! the composite's.
+  void                       linkLight(LightPtr light);
+  //! Removes all light links, so that every light illuminates the volume
+  void                       clearLightLinks();
+  //! Returns the linked lights
+  const LightVec&            linkedLights() const;
+  //! Returns the flags of the linked lights, indexed like the scene's 
+  //! lights, or null if the volume has no links.
+  const LightMask*           lightMask() const;
+
   // To be implemented by subclasses -------------------------------------------
 
   //! Returns the names of the attributes that the volume provides.
@@ -118,6 +252,82 @@ public:
 
   // Optionally implemented by subclasses --------------------------------------
 
+  //! Appends the intersection intervals of the ray to the given vector.
+  //! Raymarchers call this with reused vectors, so subclasses should 
+  //! implement it without allocating. The default implementation appends
+  //! the result of intersect().
+  virtual void               appendIntersections(const RayState &state,
+                                                 IntervalVec &intervals) const;
+
+  //! Samples the volume at a batch of points, which lets subclasses avoid
+  //! per-point setup and virtual calls. The default implementation calls
+  //! sample() once per point.
+  //! \note samples will be resized to match states.
+  virtual void               sampleBatch(const VolumeSampleStatePtrVec &states,
+                                         const VolumeAttr &attribute,
+                                         VolumeSampleVec &samples) const;
+  //! Samples several attributes at the same point, e.g. the absorption,
+  //! emission and scattering that raymarch samplers need at each step. 
+  //! Subclasses that store attributes as scaled copies of the same data 
+  //! can do this in a single lookup. The default implementation calls 
+  //! sample() for each attribute.
+  //! \note samples must have room for numAttrs samples.
+  virtual void               sampleAttributes(
+    const VolumeSampleState &state, const VolumeAttr *const *attributes, 
+    const size_t numAttrs, VolumeSample *samples) const;
+  //! Batch version of sampleAttributes(). The default implementation calls
+  //! sampleBatch() for each attribute.
+  //! \note samples must hold numAttrs vectors, which will be resized to 
+  //! match states.
+  virtual void               sampleAttributesBatch(
+    const VolumeSampleStatePtrVec &states, 
+    const VolumeAttr *const *attributes, const size_t numAttrs, 
+    VolumeSampleVec *samples) const;
+  //! Returns the sum of two attributes at a given point. Used for the 
+  //! extinction of transmittance-only rays, which is the sum of scattering
+  //! and absorption. Subclasses that store attributes as scaled copies of 
+  //! the same data can do this in a single lookup. The default 
+  //! implementation calls sample() for each attribute.
+  virtual Color              sampleSum(const VolumeSampleState &state,
+                                       const VolumeAttr &first,
+                                       const VolumeAttr &second) const;
+  //! Batch version of sampleSum(). The default implementation calls 
+  //! sampleBatch() for each attribute.
+  //! \note result will be resized to match states.
+  virtual void               sampleSumBatch(
+    const VolumeSampleStatePtrVec &states, const VolumeAttr &first, 
+    const VolumeAttr &second, ColorVec &result) const;
+  //! Computes an upper bound (majorant) of the attribute's value along the
+  //! [t0, t1] segment of the ray. Used by tracking raymarchers to pick
+  //! free-flight distances. 
+  //! \returns False if the volume can't bound the attribute, in which case
+  //! the caller needs to fall back to regular sampling. The default 
+  //! implementation returns false.
+  virtual bool               majorant(const RayState &state, 
+                                      const VolumeAttr &attribute,
+                                      const double t0, const double t1,
+                                      Color &result) const;
+  //! Computes an upper bound of the attribute's value inside the given 
+  //! world space bounds, at any time during the shutter. Used to find the
+  //! regions where a volume is known to be empty.
+  //! \returns False if the volume can't bound the attribute. The default 
+  //! implementation returns false.
+  virtual bool               boundsMajorant(const BBox &wsBounds,
+                                            const VolumeAttr &attribute,
+                                            Color &result) const;
+
+  //! Resolves the index of the attribute, so that sampling with it later 
+  //! only reads it. Renderer::execute() binds every attribute up front, 
+  //! so that render threads never modify a VolumeAttr. Attributes that 
+  //! weren't bound are still resolved on first use, which is not thread 
+  //! safe. The default implementation looks the name up in 
+  //! attributeNames().
+  virtual void               bindAttribute(const VolumeAttr &attribute) const;
+  //! Builds the light mask from the scene's lights, so that rendering 
+  //! only reads it. Renderer::execute() calls this before any render 
+  //! thread samples the volume. Subclasses with inputs should also bind 
+  //! those.
+  virtual void               bindLights(const LightVec &sceneLights) const;
   //! Returns string-formatted information about the volume
   virtual StringVec          info() const;
   //! Returns a vector of other volumes that the volume references
@@ -129,6 +339,10 @@ protected:
   
   //! Pointer to phase function
   Phase::PhaseFunction::CPtr m_phaseFunction;
+  //! Lights that illuminate the volume. Empty if all lights do.
+  LightVec                   m_linkedLights;
+  //! Flag per scene light, set by bindLights()
+  mutable LightMask          m_lightMask;
 
 };
 
@@ -0,0 +1,180 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file VolumeBaker.h
+  Contains the VolumeBaker class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_VOLUMEBAKER_H__
+#define __INCLUDED_PVR_VOLUMEBAKER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <vector>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Camera.h"
+#include "pvr/Threading.h"
+#include "pvr/Volumes/Volume.h"
+#include "pvr/VoxelBuffer.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// VolumeBaker
+//----------------------------------------------------------------------------//
+
+/*! \class VolumeBaker
+  \brief Evaluates any Volume on a voxel grid, so that a procedural volume
+  that doesn't change between renders can be replaced by trilinear lookups.
+
+  Each attribute of the volume is baked to its own buffer, at the voxel
+  centers and at the start of the shutter. The buffers are computed in
+  parallel, in tiles of 8^3 voxels. Tiles outside the volume's bounds, and
+  tiles where Volume::boundsMajorant() proves that the attribute is zero,
+  are skipped. In sparse buffers, they are left unallocated.
+
+  The baked volume is a VoxelVolume, or a CompositeVolume of one
+  VoxelVolume per attribute if the volume has more than one, and uses the
+  phase function of the original volume.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC VolumeBaker
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(VolumeBaker);
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Enumerates the mapping types of the baked buffers
+  enum MappingType {
+    UniformMapping,
+    FrustumMapping
+  };
+
+  // Exceptions ----------------------------------------------------------------
+
+  DECLARE_PVR_RT_EXC(MissingCameraException,
+                     "VolumeBaker needs a camera for frustum mappings");
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Constructs a baker for the given volume. Nothing is evaluated until
+  //! execute() is called.
+  VolumeBaker(Volume::CPtr volume);
+  PVR_DEFINE_CREATE_FUNC_1_ARG(VolumeBaker, Volume::CPtr);
+
+  // Settings ------------------------------------------------------------------
+
+  //! Sets the resolution of the longest edge of the buffer. For frustum
+  //! mappings, this is the resolution of the longest screen edge and of
+  //! the depth axis. Defaults to 128.
+  void setResolution(const size_t res);
+  //! Sets the mapping type. Defaults to UniformMapping.
+  void setMapping(const MappingType mapping);
+  //! Sets the camera that frustum mappings are fitted to
+  void setCamera(PerspectiveCamera::CPtr camera);
+  //! Sets whether to bake to sparse buffers. Defaults to true.
+  void setUseSparseBuffers(const bool enabled);
+  //! Sets the number of threads to bake with. Zero means one per core.
+  void setNumThreads(const size_t numThreads);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Bakes each attribute of the volume.
+  //! \throws MissingCameraException if a frustum mapping is used without
+  //! a camera.
+  void         execute();
+  //! Returns the baked volume. Null until execute() or read() has 
+  //! succeeded.
+  Volume::Ptr  volume() const;
+  //! Writes the baked buffers to a Field3D file, one layer per attribute.
+  //! \returns False if the file couldn't be written.
+  bool         write(const std::string &filename) const;
+  //! Reads buffers written by write() in place of calling execute(). The
+  //! buffers must have been baked from the same volume, since only they
+  //! are stored.
+  //! \returns False if the file couldn't be read.
+  bool         read(const std::string &filename);
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Creates an empty buffer with the current settings. Returns null if
+  //! the volume is outside the camera frustum.
+  VoxelBuffer::Ptr createBuffer(const BBox &wsBounds) const;
+  //! Bakes the given tiles of one attribute. Each thread handles every
+  //! numThreads'th tile.
+  template <typename Buffer_T>
+  void         bakeTiles(Buffer_T &buffer, const VolumeAttr &attribute,
+                         const std::vector<Imath::V3i> &tiles,
+                         const int tileSize, const size_t numThreads,
+                         Sys::JobState &job, const size_t thread) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! The volume to be baked
+  Volume::CPtr                  m_volume;
+  //! Resolution of the longest edge
+  size_t                        m_res;
+  //! Mapping type of the baked buffers
+  MappingType                   m_mapping;
+  //! Camera used by frustum mappings
+  PerspectiveCamera::CPtr       m_camera;
+  //! Whether to bake to sparse buffers
+  bool                          m_useSparseBuffers;
+  //! Number of threads. Zero means one per core.
+  size_t                        m_numThreads;
+  //! Baked buffers, one per attribute. The attribute name is stored in
+  //! each buffer's attribute field.
+  std::vector<VoxelBuffer::Ptr> m_buffers;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
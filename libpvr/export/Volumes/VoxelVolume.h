@@ -34,6 +34,8 @@
 
 // System headers
 
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
 
 // Library headers
@@ -44,10 +46,10 @@
 
 // Project headers
 
+#include "pvr/Curve.h"
 #include "pvr/export.h"
-#include "pvr/CubicInterp.h"
-#include "pvr/GaussianInterp.h"
-#include "pvr/MitchellInterp.h"
+#include "pvr/Memory.h"
+#include "pvr/Threading.h"
 #include "pvr/Volumes/Volume.h"
 #include "pvr/VoxelBuffer.h"
 
@@ -74,6 +76,17 @@ public:
 
   //! Returns a list of intersections for the given ray and time.
   virtual IntervalVec intersect(const Ray &wsRay, const PTime time) const = 0;
+
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Appends the intersections for the given ray and time to intervals. 
+  //! The default implementation appends the result of intersect().
+  virtual void        appendIntersections(const Ray &wsRay, const PTime time,
+                                          IntervalVec &intervals) const
+  {
+    const IntervalVec own = intersect(wsRay, time);
+    intervals.insert(intervals.end(), own.begin(), own.end());
+  }
 };
 
 //----------------------------------------------------------------------------//
@@ -95,6 +108,8 @@ public:
   // From BufferIntersection ---------------------------------------------------
 
   virtual IntervalVec intersect(const Ray &wsRay, const PTime time) const;
+  virtual void        appendIntersections(const Ray &wsRay, const PTime time,
+                                          IntervalVec &intervals) const;
 
 private:
 
@@ -126,10 +141,131 @@ public:
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  //! Computes the world space planes of the frustum's six faces at the 
+  //! given time
+  void computePlanes(const PTime time, Plane planes[6]) const;
+
   // Data members --------------------------------------------------------------
 
   //! Pointer to frustum mapping
   Field3D::FrustumFieldMapping::Ptr m_mapping;
+  //! Whether the frustum is the same throughout the shutter, in which case
+  //! m_planes are used for every ray. Otherwise the planes are computed 
+  //! for each ray's time.
+  bool                              m_isStatic;
+  //! World space planes of the frustum's faces, at shutter open
+  Plane                             m_planes[6];
+};
+
+//----------------------------------------------------------------------------//
+// SparseBlockMap
+//----------------------------------------------------------------------------//
+
+/*! \class SparseBlockMap
+  \brief Records the maximum voxel value of each block of a voxel buffer.
+
+  This lets the empty space optimizers work the same for all voxel types.
+  Sparse buffers use their own block layout, dense buffers are divided 
+  into blocks (macrocells) explicitly. Each block's maximum includes the 
+  voxels within one voxel of it, since linear interpolation reads that 
+  far. Blocks whose maximum doesn't exceed the threshold count as empty, 
+  which also skips allocated blocks that only hold (near) zero values.
+ */
+
+//----------------------------------------------------------------------------//
+
+class SparseBlockMap
+{
+public:
+
+  // Ctor ----------------------------------------------------------------------
+
+  //! Constructs a block map with the given layout. blockMax holds the 
+  //! maximum of each block, with x varying fastest.
+  SparseBlockMap(Field3D::FieldMapping::Ptr mapping, 
+                 const Field3D::Box3i &extents, const int blockOrder,
+                 const Imath::V3i &blockRes, 
+                 const std::vector<float> &blockMax);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the mapping of the sparse buffer
+  const Field3D::FieldMapping::Ptr& mapping() const
+  { return m_mapping; }
+  //! Returns the extents of the sparse buffer
+  const Field3D::Box3i& extents() const
+  { return m_extents; }
+  //! Returns the block size, in voxels
+  int blockSize() const
+  { return 1 << m_blockOrder; }
+  //! Returns the block containing the given voxel. Same as 
+  //! SparseField::getBlockCoord().
+  void getBlockCoord(const int i, const int j, const int k, 
+                     int &bi, int &bj, int &bk) const
+  { bi = i >> m_blockOrder; bj = j >> m_blockOrder; bk = k >> m_blockOrder; }
+  //! Returns whether the given block index is inside the buffer
+  bool blockIndexIsValid(const int bi, const int bj, const int bk) const
+  { 
+    return bi >= 0 && bj >= 0 && bk >= 0 && 
+      bi < m_blockRes.x && bj < m_blockRes.y && bk < m_blockRes.z; 
+  }
+  //! Returns the maximum voxel value of the given block
+  float blockMax(const int bi, const int bj, const int bk) const
+  { return m_blockMax[bi + m_blockRes.x * (bj + m_blockRes.y * bk)]; }
+  //! Returns whether the given block needs to be raymarched
+  bool blockIsOccupied(const int bi, const int bj, const int bk) const
+  { return blockMax(bi, bj, bk) > m_threshold; }
+  //! Returns the size of a super block, in blocks. Super blocks group 
+  //! blocks so that traversals can skip runs of empty blocks at once.
+  int superBlockSize() const
+  { return 1 << k_superBlockOrder; }
+  //! Returns whether any block in the super block containing the given 
+  //! block needs to be raymarched
+  bool superBlockIsOccupied(const int bi, const int bj, const int bk) const
+  { 
+    const int si = bi >> k_superBlockOrder, sj = bj >> k_superBlockOrder,
+      sk = bk >> k_superBlockOrder;
+    return m_superMax[si + m_superRes.x * (sj + m_superRes.y * sk)] > 
+      m_threshold; 
+  }
+  //! Sets the value that a block's maximum must exceed for it to be 
+  //! occupied. Defaults to zero.
+  void setThreshold(const float threshold)
+  { m_threshold = threshold; }
+  //! Raises the maximum of each block to that of the same block in other,
+  //! so that a block is occupied if it is occupied in either map.
+  //! \returns False, leaving the map unchanged, if the maps don't have the
+  //! same extents and block layout.
+  bool merge(const SparseBlockMap &other);
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Gathers the maximum of each super block from the block maxima
+  void updateSuperBlocks();
+
+  // Constants -----------------------------------------------------------------
+
+  //! Each super block holds 2^k_superBlockOrder blocks along each axis
+  static const int k_superBlockOrder = 2;
+
+  // Private data members ------------------------------------------------------
+
+  Field3D::FieldMapping::Ptr m_mapping;
+  Field3D::Box3i             m_extents;
+  int                        m_blockOrder;
+  Imath::V3i                 m_blockRes;
+  //! Maximum voxel value of each block
+  std::vector<float>         m_blockMax;
+  //! Number of super blocks along each axis
+  Imath::V3i                 m_superRes;
+  //! Maximum voxel value of each super block
+  std::vector<float>         m_superMax;
+  //! Blocks at or below this value are empty
+  float                      m_threshold;
 };
 
 //----------------------------------------------------------------------------//
@@ -164,9 +300,9 @@ public:
 
   // Ctor, factory -------------------------------------------------------------
 
-  PVR_DEFINE_CREATE_FUNC_2_ARG(SparseUniformOptimizer, SparseBuffer::Ptr,
+  PVR_DEFINE_CREATE_FUNC_2_ARG(SparseUniformOptimizer, const SparseBlockMap &,
                                Field3D::MatrixFieldMapping::Ptr);
-  SparseUniformOptimizer(SparseBuffer::Ptr sparse, 
+  SparseUniformOptimizer(const SparseBlockMap &blocks, 
                          Field3D::MatrixFieldMapping::Ptr mapping);
 
   // From ParamBase ------------------------------------------------------------
@@ -179,21 +315,10 @@ public:
                                const IntervalVec &intervals) const;
 private:
 
-  // Utility methods -----------------------------------------------------------
-
-  //! Constructs an Interval given the start and end blocks along the ray
-  Interval            intervalForRun(const Ray &wsRay, const PTime time,
-                                     const Imath::V3i &start, 
-                                     const Imath::V3i &end) const;
-  //! Intersects the ray with the given sparse block
-  void                intersect(const Ray &wsRay, const PTime time, 
-                                const Imath::V3i block,
-                                double &t0, double &t1) const;
-
   // Private data members ------------------------------------------------------
 
-  //! Pointer to the sparse buffer
-  SparseBuffer::Ptr m_sparse;
+  //! Block layout of the sparse buffer
+  SparseBlockMap m_blocks;
   //! Pointer to the uniform mapping
   Field3D::MatrixFieldMapping::Ptr m_mapping;
 };
@@ -212,9 +337,9 @@ public:
 
   // Ctor, factory -------------------------------------------------------------
 
-  PVR_DEFINE_CREATE_FUNC_2_ARG(SparseFrustumOptimizer, SparseBuffer::Ptr,
-                            Field3D::FrustumFieldMapping::Ptr);
-  SparseFrustumOptimizer(SparseBuffer::Ptr sparse, 
+  PVR_DEFINE_CREATE_FUNC_2_ARG(SparseFrustumOptimizer, const SparseBlockMap &,
+                               Field3D::FrustumFieldMapping::Ptr);
+  SparseFrustumOptimizer(const SparseBlockMap &blocks, 
                          Field3D::FrustumFieldMapping::Ptr mapping);
 
   // From ParamBase ------------------------------------------------------------
@@ -229,24 +354,42 @@ private:
 
   // Utility methods -----------------------------------------------------------
 
-  Interval            intervalForRun(const Ray &wsRay, const PTime time, 
-                                     const Vector &vsFirst, 
-                                     const int start, const int end) const;
+  //! Returns the ray parameter at which the ray crosses the lower boundary
+  //! of the given block along the given axis. Block boundaries are planes 
+  //! in world space.
+  double              boundaryT(const Ray &wsRay, const PTime time, 
+                                const int axis, const int block) const;
 
   // Private data members ------------------------------------------------------
   
-  //! Pointer to the sparse buffer
-  SparseBuffer::Ptr m_sparse;
+  //! Block layout of the sparse buffer
+  SparseBlockMap m_blocks;
   //! Pointer to the frustum mapping
   Field3D::FrustumFieldMapping::Ptr m_mapping;
 };
 
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+//! Type-independent voxel storage used by VoxelVolume. Implemented in 
+//! VoxelVolume.cpp, with one templated subclass per buffer type.
+class VoxelStorage;
+
 //----------------------------------------------------------------------------//
 // VoxelVolume
 //----------------------------------------------------------------------------//
 
 /*! \class VoxelVolume
   \brief Wraps a VoxelBuffer in the Volume interface.
+
+  By default every attribute scales the voxels of the one buffer. 
+  Attributes can instead read a buffer of their own, such as a temperature
+  buffer for emission next to the density buffer, as long as it shares the 
+  mapping and data window of the main buffer. Each lookup then transforms
+  the sample point once and interpolates each buffer that the requested 
+  attributes read, and intersection and empty space optimization are done
+  once for all buffers.
  */
 
 //----------------------------------------------------------------------------//
@@ -270,11 +413,45 @@ public:
     MitchellInterp
   };
 
+  //! Voxel types that buffers get stored as. NativeStorage keeps each 
+  //! buffer's own type. Scalar formats store the average of the three
+  //! channels of a vector buffer. The quantized formats are always sparse,
+  //! and only support NoInterp and LinearInterp (other interpolation types
+  //! fall back to linear). BrickedStorage keeps the voxel type but stores
+  //! every voxel in 8^3 bricks (see BrickedBuffer), trading the savings of
+  //! sparse buffers for locality. It uses plain cubic interpolation for
+  //! MonotonicCubicInterp. CompressedStorage keeps the voxel type but makes
+  //! the buffer sparse, with every allocated block compressed losslessly 
+  //! (see CompressedBuffer). Blocks are decompressed into a per-thread 
+  //! cache as they are read, so only the blocks near each thread's current
+  //! tile take up full memory. Like BrickedStorage, it uses plain cubic 
+  //! interpolation for MonotonicCubicInterp. Gaussian and Mitchell lookups 
+  //! evaluate the full kernel, as no prefiltered copy is kept.
+  enum StorageFormat {
+    NativeStorage,
+    FloatStorage, 
+    HalfStorage, 
+    HalfVectorStorage,
+    Quantized8Storage, 
+    Quantized16Storage,
+    BrickedStorage,
+    CompressedStorage
+  };
+
   // Exceptions ----------------------------------------------------------------
 
   DECLARE_PVR_RT_EXC(MissingBufferException, "No buffer in VoxelVolume");
   DECLARE_PVR_RT_EXC(MissingMappingException, "No mapping in buffer");
   DECLARE_PVR_RT_EXC(UnsupportedMappingException, "Unsupported mapping type");
+  DECLARE_PVR_RT_EXC(UnsupportedBufferException, 
+                     "Unsupported voxel buffer type");
+  DECLARE_PVR_RT_EXC(MissingAttributeException, 
+                     "No such attribute in VoxelVolume:");
+  DECLARE_PVR_RT_EXC(MismatchedBufferException, 
+                     "Attribute buffer doesn't share the mapping and data "
+                     "window of the VoxelVolume's buffer");
+  DECLARE_PVR_RT_EXC(TooManyBuffersException, 
+                     "Too many attribute buffers in VoxelVolume");
 
   // Ctor, factory -------------------------------------------------------------
 
@@ -294,69 +471,301 @@ public:
                               const VolumeAttr &attribute) const;
   virtual BBox         wsBounds() const;
   virtual IntervalVec  intersect(const RayState &state) const;
+  virtual void         appendIntersections(const RayState &state,
+                                           IntervalVec &intervals) const;
   virtual StringVec    info() const;
+  virtual void         sampleBatch(const VolumeSampleStatePtrVec &states,
+                                   const VolumeAttr &attribute,
+                                   VolumeSampleVec &samples) const;
+  //! The sample point is transformed once, and each buffer is only 
+  //! interpolated once, and scaled by the value of each attribute that 
+  //! reads it.
+  virtual void         sampleAttributes(const VolumeSampleState &state,
+                                        const VolumeAttr *const *attributes,
+                                        const size_t numAttrs,
+                                        VolumeSample *samples) const;
+  virtual void         sampleAttributesBatch(
+    const VolumeSampleStatePtrVec &states, 
+    const VolumeAttr *const *attributes, const size_t numAttrs, 
+    VolumeSampleVec *samples) const;
+  //! If both attributes read the same buffer, the sum only takes one 
+  //! lookup, scaled by the sum of the attribute values.
+  virtual Color        sampleSum(const VolumeSampleState &state,
+                                 const VolumeAttr &first,
+                                 const VolumeAttr &second) const;
+  virtual void         sampleSumBatch(const VolumeSampleStatePtrVec &states,
+                                      const VolumeAttr &first,
+                                      const VolumeAttr &second,
+                                      ColorVec &result) const;
+  //! Bounds the attribute using a coarse grid of voxel maxima, which is
+  //! built the first time a majorant is requested.
+  virtual bool         majorant(const RayState &state, 
+                                const VolumeAttr &attribute,
+                                const double t0, const double t1,
+                                Color &result) const;
+  //! Bounds the attribute using the same grid as majorant().
+  virtual bool         boundsMajorant(const BBox &wsBounds, 
+                                      const VolumeAttr &attribute,
+                                      Color &result) const;
 
   // Main methods --------------------------------------------------------------
 
-  //! Loads a Field3D file from disk. 
+  //! Loads a Field3D file from disk. DenseField and SparseField layers of 
+  //! <float>, <half>, <V3f> and <V3h> are accepted.
   void                 load(const std::string &filename);
   //! Sets the voxel buffer.
   void                 setBuffer(VoxelBuffer::Ptr buffer);
+  //! Sets the voxel buffer from any DenseField or SparseField of <float>,
+  //! <half>, <V3f> or <V3h>. Removes any attribute buffers, since they 
+  //! have to match the buffer.
+  //! \throws UnsupportedBufferException for other field types.
+  void                 setField(Field3D::FieldRes::Ptr field);
+  //! Makes the named attribute read the given buffer, scaled by its value,
+  //! instead of the main buffer. Several attributes may share a buffer.
+  //! The buffer is stored, interpolated and mipmapped using the volume's 
+  //! settings, and its blocks are merged into those that empty space 
+  //! optimization skips. The coarse buffer only adds to the attributes of
+  //! the main buffer. Pass null to make the attribute read the main buffer
+  //! again.
+  //! \throws MissingAttributeException unless the attribute was added 
+  //! with addAttribute().
+  //! \throws MismatchedBufferException unless the buffer has the mapping
+  //! and data window of the main buffer, which must have been set.
+  void                 setAttributeBuffer(const std::string &attrName,
+                                          VoxelBuffer::Ptr buffer);
+  //! Sets a coarser buffer with the same bounds, such as 
+  //! Model::Modeler::coarseBuffer(), whose voxels are added to those of 
+  //! the buffer when sampling. It is stored, interpolated and skipped 
+  //! through like the buffer, using the volume's settings. Pass null to 
+  //! remove it.
+  //! \throws UnsupportedBufferException if the buffer can't be stored.
+  void                 setCoarseBuffer(VoxelBuffer::Ptr buffer);
+  //! Sets a buffer of world-space velocities, in units per second, that 
+  //! the volume is motion blurred with at render time. A lookup at time t
+  //! reads the density at wsP - v(wsP) * t * RenderGlobals::dt(), so the
+  //! density buffer can be modeled without motion, and shutter changes 
+  //! don't require it to be modeled again. The empty space optimizer isn't
+  //! used while a velocity buffer is set. Pass null to disable.
+  //! \throws UnsupportedBufferException if the buffer can't be stored.
+  void                 setVelocityBuffer(VoxelBuffer::Ptr velocity);
+  //! Sets the format that buffers are converted to when they are set or
+  //! loaded. Only applies to subsequent calls to setBuffer(), setField()
+  //! and load().
+  void                 setStorageFormat(const StorageFormat format);
   //! Adds an attribute to be exposed. The supplied value acts as a scaling
   //! factor on top of the density value sampled from the voxel buffer.
   void                 addAttribute(const std::string &attrName, 
                                     const Imath::V3f &value);
-  //! Sets the interpolator type to use for lookups.
+  //! Sets the interpolator type to use for lookups. GaussianInterp and 
+  //! MitchellInterp convolve the full resolution buffer with their kernel
+  //! once, in parallel, and then interpolate the result trilinearly. That
+  //! matches the filters at voxel centers and costs the same per lookup as
+  //! LinearInterp, but keeps a second copy of the buffer.
   void                 setInterpolation(const InterpType interpType);
-  //! Sets whether to use empty space optimization.
+  //! Sets whether to use empty space optimization. Sparse buffers skip 
+  //! their empty blocks, dense buffers skip empty 8^3 macrocells.
   void                 setUseEmptySpaceOptimization(const bool enabled);
+  //! Sets the voxel value at or below which a block counts as empty for
+  //! empty space optimization. Defaults to zero. The per-block maxima are
+  //! computed once per buffer, so changing this is cheap.
+  void                 setEmptySpaceThreshold(const float threshold);
+  //! Sets whether to build a mip pyramid of the voxel buffer. When enabled,
+  //! each lookup picks the level whose voxel size matches the ray's
+  //! footprint (see RayState::wsFootprint), so that distant volumes are
+  //! neither aliased nor read at full resolution.
+  void                 setUseMipmaps(const bool enabled);
+
+  // Accessors -----------------------------------------------------------------
+
+  //! Returns the full resolution voxel buffer, in its storage format. Null 
+  //! if no buffer has been set, or if the storage format isn't a Field3D 
+  //! field, as with the quantized and bricked formats.
+  Field3D::FieldRes::Ptr field() const;
+  //! Returns the world-space size of the voxel at the center of the buffer.
+  //! Frustum mapped voxels grow with depth, so this is only representative
+  //! of uniform mappings. Zero if no buffer has been set.
+  Vector               wsVoxelSize() const;
+  //! Returns the interpolator type used for lookups
+  InterpType           interpolation() const;
+  //! Returns whether a velocity buffer is set
+  bool                 hasVelocity() const;
+  //! Returns whether mip levels are built and sampled
+  bool                 useMipmaps() const;
+  //! Returns the scaling value of the named attribute, which is zero if the
+  //! volume doesn't have it
+  Imath::V3f           attributeValue(const std::string &attrName) const;
+  //! Returns the number of buffers, counting the main buffer and each 
+  //! distinct attribute buffer
+  size_t               numBuffers() const;
 
 protected:
 
-  // Typedefs ------------------------------------------------------------------
-
-  typedef Field3D::LinearFieldInterp<Imath::V3f>   LinearInterpType;
-  //! Cubic interpolator
-  typedef Field3D::TriCubicFieldInterp<Imath::V3f> CubicInterpType;
-  //! Monotonic cubic interpolator
-  typedef Field3D::CubicFieldInterp<Imath::V3f>    MonotonicCubicInterpType;
-  //! Gaussian interpolator
-  typedef Field3D::GaussianFieldInterp<Imath::V3f> GaussianInterpType;
-  //! Mitchell-Netravali interpolator
-  typedef Field3D::MitchellFieldInterp<Imath::V3f> MitchellInterpType;
-
   // Utility methods -----------------------------------------------------------
 
   void                 updateIntersectionHandler();
+  //! Builds m_worldToVoxel from the current mapping.
+  void                 updateWorldToVoxel();
+  //! Returns the scaling value of the attribute, which is zero if the 
+  //! volume doesn't have it. Sets up the attribute index if needed.
+  Imath::V3f           attributeScale(const VolumeAttr &attribute) const;
+  //! Returns the buffer that the attribute reads, zero being the main 
+  //! buffer. Sets up the attribute index if needed.
+  size_t               attributeBuffer(const VolumeAttr &attribute) const;
+  //! Returns the storage of the given buffer, zero being the main buffer
+  const VoxelStorage&  bufferStorage(const size_t buffer) const;
+  //! Interpolates the given buffer at vsP, which is assumed to be inside 
+  //! the data window. The coarse level is added to the main buffer.
+  Imath::V3f           bufferValue(const size_t buffer, 
+                                   const VolumeSampleState &state,
+                                   const Vector &vsP) const;
+  //! Returns the interpolated voxel value at the sample point, before any
+  //! attribute scaling. Zero outside the data window. Used to add the 
+  //! coarse level to the buffer's values.
+  Imath::V3f           voxelValue(const VolumeSampleState &state) const;
+  //! Transforms a world-space position to voxel space at the given time.
+  //! Uses the cached matrices when available, and Field3D otherwise.
+  //! In PVR_FLOAT_SAMPLING builds, static matrix mappings transform in 
+  //! single precision relative to the center of the buffer.
+  void                 worldToVoxel(const Vector &wsP, const PTime time, 
+                                    Vector &vsP) const
+  {
+    const size_t numSamples = m_worldToVoxel.numSamples();
+    if (numSamples == 1) {
+#ifdef PVR_FLOAT_SAMPLING
+      Imath::V3f vsOffset;
+      m_originToVoxel.multDirMatrix(Imath::V3f(wsP - m_wsOrigin), vsOffset);
+      vsP = m_vsOrigin + vsOffset;
+#else
+      m_worldToVoxel.samples().front().second.multVecMatrix(wsP, vsP);
+#endif
+    } else if (numSamples > 1) {
+      m_worldToVoxel.interpolate(time).multVecMatrix(wsP, vsP);
+    } else {
+      m_mapping->worldToVoxel(wsP, vsP, time);
+    }
+  }
+  //! Transforms the sample points of a batch to voxel space, as 
+  //! worldToVoxel() of their advected positions does. A batch along one
+  //! ray through the eye of a frustum mapping's camera, such as the steps
+  //! of a primary ray rendered from that camera, lies in a single voxel 
+  //! column. Only three of its points are then transformed by Field3D, 
+  //! and the depth of the others follows from them.
+  void                 worldToVoxelBatch(const VolumeSampleStatePtrVec &states,
+                                         std::vector<Vector> &vsPs) const;
+  //! Returns the world-space position that a point at wsP at the given 
+  //! time occupied at the start of the shutter, according to the velocity
+  //! buffer. Returns wsP if there is no velocity buffer.
+  Vector               advect(const Vector &wsP, const PTime time) const;
+  //! Returns the largest world-space distance any voxel moves during the 
+  //! shutter. Zero without a velocity buffer.
+  double               wsMaxDisplacement() const;
+  //! Replaces the voxel storage and everything that is derived from it.
+  void                 setStorage(boost::shared_ptr<VoxelStorage> storage);
+  //! Interpolates a voxel storage at the given voxel-space position, which
+  //! is assumed to be inside the data window.
+  Imath::V3f           interpolate(const VoxelStorage &storage,
+                                   const Vector &vsP) const;
+  //! Interpolates the mip level matching the footprint of the given sample
+  //! state. vsP is the voxel-space position in the full resolution buffer.
+  Imath::V3f           interpolate(const VoxelStorage &storage,
+                                   const VolumeSampleState &state,
+                                   const Vector &vsP) const;
+  //! Removes the attribute buffers, e.g. when the main buffer changes
+  void                 clearAttrBuffers();
+  //! Drops the attribute buffers that no attribute reads any more
+  void                 pruneAttrBuffers();
+  //! Builds m_eso from the blocks of all buffers
+  void                 updateOptimizer();
+  //! Clears m_majorants, so that they are rebuilt on first use
+  void                 resetMajorants();
+  //! Builds or clears the mip levels of all buffers, depending on 
+  //! m_useMipmaps.
+  void                 buildMipLevels();
+  //! Builds or clears the prefiltered copies of all buffers, depending on 
+  //! m_interpType.
+  void                 prefilter();
+  //! Builds m_majorants from the current voxel buffers.
+  void                 buildMajorantGrid() const;
+  //! Returns the largest value of the majorant grid cells of the given 
+  //! buffer overlapping the given voxel space bounds. The grid must have 
+  //! been built.
+  Imath::V3f           majorantInside(const size_t buffer, 
+                                      Imath::Box3d vsBounds) const;
 
   // Protected data members ----------------------------------------------------
 
-  //! Voxel buffer
-  VoxelBuffer::Ptr          m_buffer;
+  //! Voxel storage
+  boost::shared_ptr<VoxelStorage> m_storage;
+  //! Accounts for the memory used by m_storage
+  Sys::Memory::Tracker      m_storageMemory;
+  //! Mapping of the voxel storage
+  Field3D::FieldMapping::Ptr m_mapping;
+  //! Data window of the voxel storage
+  Field3D::Box3i            m_dataWindow;
+  //! World-to-voxel matrix of each motion sample of a MatrixFieldMapping. 
+  //! Empty for frustum mappings, which are transformed by Field3D.
+  Util::MatrixCurve         m_worldToVoxel;
+  //! Center of the buffer in world space, for non-moving matrix mappings.
+  //! Positions are made relative to it in double precision before 
+  //! m_originToVoxel transforms them, so that single precision suffices
+  //! however far the buffer is from the world origin.
+  Vector                    m_wsOrigin;
+  //! Center of the buffer in voxel space
+  Vector                    m_vsOrigin;
+  //! Single precision world-to-voxel matrix, without translation. Only 
+  //! used by PVR_FLOAT_SAMPLING builds.
+  Imath::M44f               m_originToVoxel;
+  //! Format that new buffers are stored as
+  StorageFormat             m_storageFormat;
   //! World space bounds
   BBox                      m_wsBounds;
   //! Attribute names
   AttrNameVec               m_attrNames;
   //! Attribute scaling values
   std::vector<Imath::V3f>   m_attrValues;
+  //! Buffer that each attribute reads, zero being m_storage and b being
+  //! m_attrStorage[b - 1]
+  std::vector<size_t>       m_attrBuffers;
+  //! Storage of the attribute buffers. They share the mapping and data 
+  //! window of m_storage.
+  std::vector<boost::shared_ptr<VoxelStorage> > m_attrStorage;
+  //! The buffer each of m_attrStorage was created from, so that attributes
+  //! given the same buffer share its storage
+  std::vector<Field3D::FieldRes::Ptr> m_attrFields;
+  //! Accounts for the memory used by each of m_attrStorage
+  std::vector<Sys::Memory::Tracker> m_attrStorageMemory;
   //! Handles ray/buffer intersection tests
   BufferIntersection::CPtr  m_intersectionHandler;
   //! Interpolation type to use for lookups
   InterpType                m_interpType;
-  //! Linear interpolator
-  LinearInterpType          m_linearInterp;
-  //! Cubic interpolator
-  CubicInterpType           m_cubicInterp;
-  //! Monotonic cubic interpolator
-  MonotonicCubicInterpType  m_monotonicCubicInterp;
-  //! Gaussian interpolator
-  GaussianInterpType        m_gaussInterp;
-  //! Mitchell-Netravali interpolator
-  MitchellInterpType        m_mitchellInterp;
   //! Empty space optimizer. May be null.
   EmptySpaceOptimizer::CPtr m_eso;
   //! Whether to use empty space optimization
   bool                      m_useEmptySpaceOptimization;
+  //! Blocks at or below this value are skipped by m_eso
+  float                     m_emptySpaceThreshold;
+  //! Whether to build and sample mip levels. The levels themselves are 
+  //! kept by m_storage.
+  bool                      m_useMipmaps;
+  //! Velocity storage for render-time motion blur. May be null.
+  boost::shared_ptr<VoxelStorage> m_velocity;
+  //! The mapping of m_velocity, which advect() would otherwise copy for
+  //! every sample
+  Field3D::FieldMapping::Ptr m_velocityMapping;
+  //! Largest speed in m_velocity
+  double                    m_maxSpeed;
+  //! Holds the coarse buffer, with the same settings and attributes. May 
+  //! be null.
+  VoxelVolume::Ptr          m_coarse;
+  //! Per-cell maxima of each buffer, dilated by one cell so that each cell
+  //! bounds all interpolated values inside it. The buffers share one grid.
+  mutable std::vector<std::vector<Imath::V3f> > m_majorants;
+  //! Resolution of the majorant grid
+  mutable Imath::V3i        m_majorantRes;
+  //! Size of each majorant grid cell, in voxels
+  mutable int               m_majorantCellSize;
+  //! Tracks whether the majorant grid has been built
+  Sys::LazyFillState        m_majorantState;
 
 };
 
@@ -365,6 +774,14 @@ protected:
 Interval makeInterval(const Ray &wsRay, const double t0, const double t1,
                       Field3D::FieldMapping::Ptr mapping);
 
+//! Appends intervals covering [t0, t1] through a frustum mapped buffer. The
+//! size of frustum voxels changes along the ray, depending on the mapping's
+//! depth distribution, so the segment is split into intervals spanning a
+//! fixed number of voxels, each with the step length of its own voxels.
+void appendFrustumIntervals(const Ray &wsRay, const double t0, const double t1,
+                            Field3D::FieldMapping::Ptr mapping,
+                            IntervalVec &intervals);
+
 //----------------------------------------------------------------------------//
 
 } // namespace Render
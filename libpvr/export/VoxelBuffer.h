@@ -57,6 +57,19 @@ typedef Field3D::SparseField<Imath::V3f>    SparseBuffer;
 
 //----------------------------------------------------------------------------//
 
+// Compact buffer types. These are only used for storage, see 
+// VoxelVolume::setStorageFormat(). Rasterization always writes to a 
+// VoxelBuffer.
+
+typedef Field3D::DenseField<float>               DenseScalarBuffer;
+typedef Field3D::SparseField<float>              SparseScalarBuffer;
+typedef Field3D::DenseField<half>                DenseHalfBuffer;
+typedef Field3D::SparseField<half>               SparseHalfBuffer;
+typedef Field3D::DenseField<Imath::Vec3<half> >  DenseHalfVectorBuffer;
+typedef Field3D::SparseField<Imath::Vec3<half> > SparseHalfVectorBuffer;
+
+//----------------------------------------------------------------------------//
+
 } // namespace pvr
 
 //----------------------------------------------------------------------------//
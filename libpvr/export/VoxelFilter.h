@@ -0,0 +1,111 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file VoxelFilter.h
+  Contains functions that filter and resample voxel buffers.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_VOXELFILTER_H__
+#define __INCLUDED_PVR_VOXELFILTER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/Exception.h"
+#include "pvr/export.h"
+#include "pvr/VoxelBuffer.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+
+//----------------------------------------------------------------------------//
+// Exceptions
+//----------------------------------------------------------------------------//
+
+DECLARE_PVR_RT_EXC(UnsupportedFilterBufferException,
+                   "Can only filter DenseBuffer and SparseBuffer");
+DECLARE_PVR_RT_EXC(InvalidFilterArgumentException, "Invalid filter argument:");
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+// All of these filter one axis at a time, in parallel over z slices of
+// dense buffers and rows of blocks of sparse ones. The result has the same
+// data structure as the input, and the mapping of the input adapted to the
+// new resolution. A sparse block of the result is only allocated if an
+// allocated input block lies within the filter's reach of it. Taps outside
+// the data window are clamped to its edge.
+
+//----------------------------------------------------------------------------//
+
+//! Blurs the buffer with Filter::Gaussian, scaled to reach radius voxels.
+//! Radii below one voxel leave the buffer unchanged.
+//! \param numThreads Zero means one per core.
+LIBPVR_PUBLIC VoxelBuffer::Ptr gaussianBlur(VoxelBuffer::Ptr buffer,
+                                            const float radius,
+                                            const size_t numThreads = 0);
+
+//----------------------------------------------------------------------------//
+
+//! Resamples the buffer to the given resolution, with
+//! Filter::MitchellNetravali. When the resolution goes down along an axis,
+//! the filter is widened to cover the larger voxels, so that the result
+//! doesn't alias.
+//! \param numThreads Zero means one per core.
+LIBPVR_PUBLIC VoxelBuffer::Ptr resample(VoxelBuffer::Ptr buffer,
+                                        const Imath::V3i &res,
+                                        const size_t numThreads = 0);
+
+//----------------------------------------------------------------------------//
+
+//! Downsamples the buffer by the given factor along each axis, keeping the
+//! largest value of each channel over the voxels that a voxel of the
+//! result overlaps. Suitable for majorants, since no value of the input
+//! exceeds the result at the same position.
+//! \param numThreads Zero means one per core.
+LIBPVR_PUBLIC VoxelBuffer::Ptr maxDownsample(VoxelBuffer::Ptr buffer,
+                                             const int factor,
+                                             const size_t numThreads = 0);
+
+//----------------------------------------------------------------------------//
+
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -33,12 +33,37 @@
 
 // System includes
 
+#include <string>
+
 // Library includes
 
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
 
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Returns the array interface type string for elements of the given kind
+//! and the size of T, in the native byte order
+template <typename T>
+std::string typeStrOf(const char kind)
+{
+  const int   one          = 1;
+  const bool  littleEndian = *reinterpret_cast<const char*>(&one) == 1;
+  std::string typeStr(littleEndian ? "<" : ">");
+  typeStr += kind;
+  typeStr += static_cast<char>('0' + sizeof(T));
+  return typeStr;
+}
+
+//----------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+
 namespace pvr {
 
 //----------------------------------------------------------------------------//
@@ -59,6 +84,56 @@ Util::ParamMap dictToParamMap(boost::python::dict d)
   return params;
 }
 
+//----------------------------------------------------------------------------//
+// ArrayView
+//----------------------------------------------------------------------------//
+
+ArrayView::ArrayView(const bp::object &owner, void *data, 
+                     const bp::tuple &shape, const std::string &typeStr)
+  : m_owner(owner), m_data(data), m_shape(shape), m_typeStr(typeStr)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+bp::dict ArrayView::arrayInterface() const
+{
+  bp::dict result;
+  result["version"] = 3;
+  result["shape"]   = m_shape;
+  result["typestr"] = m_typeStr;
+  result["data"]    = bp::make_tuple(reinterpret_cast<size_t>(m_data), false);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <>
+std::string arrayTypeStr<int>()
+{
+  return typeStrOf<int>('i');
+}
+
+//----------------------------------------------------------------------------//
+
+template <>
+std::string arrayTypeStr<float>()
+{
+  return typeStrOf<float>('f');
+}
+
+//----------------------------------------------------------------------------//
+
+void exportArrayView()
+{
+  using namespace boost::python;
+
+  class_<ArrayView>("ArrayView", no_init)
+    .add_property("__array_interface__", &ArrayView::arrayInterface)
+    ;
+}
+
 //----------------------------------------------------------------------------//
 
 } // namespace pvr
@@ -129,10 +129,96 @@ std::map<Key_T, Value_T> pyDictValues(boost::python::dict d)
 
 Util::ParamMap dictToParamMap(boost::python::dict d);
 
+//----------------------------------------------------------------------------//
+// GIL helpers
+//----------------------------------------------------------------------------//
+
+//! Releases the GIL for the lifetime of the instance, so that other Python 
+//! threads can run during long calls. The Python API must not be used 
+//! until it goes out of scope, except under a ScopedGILAcquire.
+class ScopedGILRelease
+{
+public:
+  ScopedGILRelease()
+    : m_state(PyEval_SaveThread())
+  { }
+  ~ScopedGILRelease()
+  { PyEval_RestoreThread(m_state); }
+private:
+  PyThreadState *m_state;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Acquires the GIL for the lifetime of the instance. Works from any 
+//! thread, whether or not it already holds the GIL.
+class ScopedGILAcquire
+{
+public:
+  ScopedGILAcquire()
+    : m_state(PyGILState_Ensure())
+  { }
+  ~ScopedGILAcquire()
+  { PyGILState_Release(m_state); }
+private:
+  PyGILState_STATE m_state;
+};
+
 //----------------------------------------------------------------------------//
 
 typedef bp::return_value_policy<bp::detail::return_none> bpRetNone;
 
+//----------------------------------------------------------------------------//
+// ArrayView
+//----------------------------------------------------------------------------//
+
+//! Exposes memory owned by a PVR object through the NumPy array interface.
+//! numpy.asarray() of an ArrayView shares the memory instead of copying it,
+//! and keeps the owner alive. The view is invalidated by any call that 
+//! reallocates the memory.
+class ArrayView
+{
+public:
+  //! \param owner Python object that owns the memory 
+  //! \param shape Tuple of dimensions, slowest varying first
+  //! \param typeStr Array interface type string of the elements
+  ArrayView(const bp::object &owner, void *data, const bp::tuple &shape, 
+            const std::string &typeStr);
+  //! Returns the __array_interface__ dictionary
+  bp::dict arrayInterface() const;
+private:
+  bp::object  m_owner;
+  void       *m_data;
+  bp::tuple   m_shape;
+  std::string m_typeStr;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Returns the array interface type string of an element type
+template <typename T>
+std::string arrayTypeStr();
+
+template <>
+std::string arrayTypeStr<int>();
+
+template <>
+std::string arrayTypeStr<float>();
+
+//----------------------------------------------------------------------------//
+
+//! Returns an ArrayView of the given elements
+template <typename T>
+ArrayView arrayView(const bp::object &owner, T *data, const bp::tuple &shape)
+{
+  return ArrayView(owner, data, shape, arrayTypeStr<T>());
+}
+
+//----------------------------------------------------------------------------//
+
+//! Registers the ArrayView class with Python
+void exportArrayView();
+
 //----------------------------------------------------------------------------//
 
 } // namespace pvr
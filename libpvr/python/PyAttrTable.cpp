@@ -85,6 +85,57 @@ AttrTable::StringIdxVec& stringIdxAttrElemsHelper(AttrTable &self,
 
 //----------------------------------------------------------------------------//
 
+//! Returns the shape of an attribute's values. The array dimension is left 
+//! out for attributes with one value per element.
+bp::tuple attrShape(const AttrTable &table, const AttrRef &ref, 
+                    const size_t numComponents)
+{
+  bp::list shape;
+  shape.append(table.size());
+  if (ref.arraySize() > 1) {
+    shape.append(ref.arraySize());
+  }
+  if (numComponents > 1) {
+    shape.append(numComponents);
+  }
+  return bp::tuple(shape);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns an ArrayView of the values of an int attribute
+ArrayView intAttrViewHelper(bp::object self, const AttrRef &ref)
+{
+  AttrTable         &table = bp::extract<AttrTable&>(self);
+  AttrTable::IntVec &elems = table.intAttrElems(ref);
+  return arrayView(self, elems.empty() ? NULL : &elems[0], 
+                   attrShape(table, ref, 1));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns an ArrayView of the values of a float attribute
+ArrayView floatAttrViewHelper(bp::object self, const AttrRef &ref)
+{
+  AttrTable           &table = bp::extract<AttrTable&>(self);
+  AttrTable::FloatVec &elems = table.floatAttrElems(ref);
+  return arrayView(self, elems.empty() ? NULL : &elems[0], 
+                   attrShape(table, ref, 1));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns an ArrayView of the values of a vector attribute
+ArrayView vectorAttrViewHelper(bp::object self, const AttrRef &ref)
+{
+  AttrTable            &table = bp::extract<AttrTable&>(self);
+  AttrTable::VectorVec &elems = table.vectorAttrElems(ref);
+  return arrayView(self, elems.empty() ? NULL : &elems[0].x, 
+                   attrShape(table, ref, 3));
+}
+
+//----------------------------------------------------------------------------//
+
 AttrRef addIntAttr(AttrTable &self, const std::string &attrName, 
                    const size_t size, boost::python::list l)
 {
@@ -150,6 +201,9 @@ void exportAttrTable()
          return_internal_reference<>())
     .def("stringIdxAttrElems", &stringIdxAttrElemsHelper,
          return_internal_reference<>())
+    .def("intAttrView",        &intAttrViewHelper)
+    .def("floatAttrView",      &floatAttrViewHelper)
+    .def("vectorAttrView",     &vectorAttrViewHelper)
     .def("setIntAttr",         &AttrTable::setIntAttr)
     .def("setFloatAttr",       &AttrTable::setFloatAttr)
     .def("setVectorAttr",      &AttrTable::setVectorAttr)
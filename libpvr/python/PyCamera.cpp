@@ -114,6 +114,9 @@ void exportPerspectiveCamera()
     .def("worldToCamera",  &PerspectiveCamera::worldToCamera)
     .def("cameraToWorld",  &PerspectiveCamera::cameraToWorld)
     .def("setNumTimeSamples", &Camera::setNumTimeSamples)
+    .def("resolution",     &Camera::resolution,
+         return_value_policy<copy_const_reference>())
+    .def("clone",          &Camera::clone)
     ;
 
   implicitly_convertible<Camera::Ptr, Camera::CPtr>();
@@ -131,9 +134,24 @@ void exportPerspectiveCamera()
 
   implicitly_convertible<PerspectiveCamera::Ptr, PerspectiveCamera::CPtr>();
 
+  class_<OrthographicCamera, bases<Camera>, OrthographicCamera::Ptr>
+    ("OrthographicCamera", no_init)
+    .def("__init__",       make_constructor(OrthographicCamera::create))
+    .def("setWidth",       &OrthographicCamera::setWidth)
+    .def("width",          &OrthographicCamera::width)
+    .def("worldToScreen",  &OrthographicCamera::worldToScreen)
+    .def("screenToWorld",  &OrthographicCamera::screenToWorld)
+    .def("worldToRaster",  &OrthographicCamera::worldToRaster)
+    .def("rasterToWorld",  &OrthographicCamera::rasterToWorld)
+    ;
+
+  implicitly_convertible<OrthographicCamera::Ptr, OrthographicCamera::CPtr>();
+
   class_<SphericalCamera, bases<Camera>, SphericalCamera::Ptr>
     ("SphericalCamera", no_init)
     .def("__init__",       make_constructor(SphericalCamera::create))
+    .def("setSolidAngleSampling",   &SphericalCamera::setSolidAngleSampling)
+    .def("setSolidAngleResolution", &SphericalCamera::setSolidAngleResolution)
     ;
 
   implicitly_convertible<SphericalCamera::Ptr, SphericalCamera::CPtr>();
@@ -42,7 +42,7 @@
 // Helper functions
 //----------------------------------------------------------------------------//
 
-
+BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(writeOverloads, write, 1, 2)
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -61,7 +61,20 @@ void exportDeepImage()
     .def("__init__",      make_constructor(DeepImage::create))
     .def("setNumSamples", &DeepImage::setNumSamples)
     .def("pixelFunction", &DeepImage::pixelFunction)
+    .def("setMaxError",   &DeepImage::setMaxError)
+    .def("maxError",      &DeepImage::maxError)
+    .def("interleave",    &DeepImage::interleave)
+    .def("isInterleaved", &DeepImage::isInterleaved)
     .def("printStats",    &DeepImage::printStats)
+    .def("compact",       &DeepImage::compact)
+    .def("merge",         &DeepImage::merge)
+    .def("write",         &DeepImage::write, writeOverloads())
+    .def("read",          &DeepImage::read).staticmethod("read")
+    ;
+
+  enum_<DeepImage::Contents>("DeepImageContents")
+    .value("Transmittance", DeepImage::Transmittance)
+    .value("Luminance", DeepImage::Luminance)
     ;
   
   implicitly_convertible<DeepImage::Ptr, DeepImage::CPtr>();
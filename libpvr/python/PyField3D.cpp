@@ -44,6 +44,57 @@
 // Helper functions
 //----------------------------------------------------------------------------//
 
+//! Returns an ArrayView of the voxels of a dense buffer's data window, with
+//! shape (z, y, x, 3)
+pvr::ArrayView voxelViewHelper(bp::object self)
+{
+  pvr::DenseBuffer     &buffer    = bp::extract<pvr::DenseBuffer&>(self);
+  const Field3D::Box3i window    = buffer.dataWindow();
+  const Imath::V3i     res       = buffer.dataResolution();
+  const size_t         numVoxels = res.x * res.y * res.z;
+  float *data = numVoxels == 0 ? NULL :
+    &buffer.fastLValue(window.min.x, window.min.y, window.min.z).x;
+  return pvr::arrayView(self, data, 
+                        bp::make_tuple(res.z, res.y, res.x, 3));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the resolution of the buffer's data window
+Imath::V3i dataResolutionHelper(const pvr::VoxelBuffer &self)
+{
+  return self.dataResolution();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the fraction of a sparse buffer's blocks that are allocated. 
+//! Dense buffers are fully occupied.
+float occupancyHelper(const pvr::VoxelBuffer &self)
+{
+  const pvr::SparseBuffer *sparse = 
+    dynamic_cast<const pvr::SparseBuffer *>(&self);
+  if (!sparse) {
+    return 1.0f;
+  }
+  const Imath::V3i blockRes  = sparse->blockRes();
+  const size_t     numBlocks = 
+    static_cast<size_t>(blockRes.x) * blockRes.y * blockRes.z;
+  if (numBlocks == 0) {
+    return 0.0f;
+  }
+  size_t numAllocated = 0;
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        if (sparse->blockIsAllocated(bi, bj, bk)) {
+          ++numAllocated;
+        }
+      }
+    }
+  }
+  return static_cast<float>(numAllocated) / numBlocks;
+}
 
 
 //----------------------------------------------------------------------------//
@@ -59,12 +110,15 @@ void exportField3D()
 
   class_<VoxelBuffer, VoxelBuffer::Ptr, boost::noncopyable>
     ("VoxelBuffer", no_init)
+    .def("dataResolution", &dataResolutionHelper)
+    .def("occupancy",      &occupancyHelper)
     ;
 
   // DenseBuffer ---
 
   class_<DenseBuffer, bases<VoxelBuffer>, DenseBuffer::Ptr>
     ("DenseBuffer")
+    .def("voxelView", &voxelViewHelper)
     ;
 
   // SparseBuffer ---
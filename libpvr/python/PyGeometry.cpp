@@ -43,6 +43,8 @@
 
 #include <pvr/Geometry.h>
 
+#include "Common.h"
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -81,6 +83,34 @@ AttrTable& globalAttrHelper(Geometry &self)
   return self.globalAttrs();
 }
 
+//----------------------------------------------------------------------------//
+
+//! Reads without holding the GIL, so that other Python threads can run
+Geometry::Ptr readHelper(const std::string &filename)
+{
+  pvr::ScopedGILRelease release;
+  return Geometry::read(filename);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads without holding the GIL, so that other Python threads can run
+Geometry::Ptr readAttrsHelper(const std::string &filename,
+                              const Geometry::StringVec &attrNames)
+{
+  pvr::ScopedGILRelease release;
+  return Geometry::read(filename, attrNames);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads without holding the GIL, so that other Python threads can run
+Geometry::Ptr readCacheHelper(const std::string &filename)
+{
+  pvr::ScopedGILRelease release;
+  return Geometry::readCache(filename);
+}
+
 //----------------------------------------------------------------------------//
 // Pvr python module
 //----------------------------------------------------------------------------//
@@ -91,7 +121,14 @@ void exportGeometry()
 
   class_<Geometry, Geometry::Ptr>("Geometry", no_init)
     .def("__init__",     make_constructor(Geometry::create))
-    .def("read",         &Geometry::read).staticmethod("read")
+    .def("read",         &readHelper)
+    .def("read",         &readAttrsHelper).staticmethod("read")
+    .def("readCache",    &readCacheHelper).staticmethod("readCache")
+    .def("writeCache",   &Geometry::writeCache)
+    .def("readShared",   &Geometry::readShared).staticmethod("readShared")
+    .def("writeShared",  &Geometry::writeShared)
+    .def("removeShared", &Geometry::removeShared)
+    .staticmethod("removeShared")
     .def("setParticles", &Geometry::setParticles)
     .def("setPolygons",  &Geometry::setPolygons)
     .def("setMeshes",    &Geometry::setMeshes)
@@ -43,10 +43,12 @@
 
 // Project includes
 
+#include <pvr/BlockCache.h>
 #include <pvr/Camera.h>
 #include <pvr/Globals.h>
 #include <pvr/RenderGlobals.h>
 #include <pvr/Scene.h>
+#include <pvr/SparseCache.h>
 
 //----------------------------------------------------------------------------//
 // Helper functions
@@ -71,6 +73,48 @@ void exportGlobals()
   class_<Sys::Globals>("Globals")
     ;
 
+  // SparseCache ---
+
+  class_<Sys::SparseCache>("SparseCache")
+    .def("setMemoryLimit", &Sys::SparseCache::setMemoryLimit)
+    .staticmethod("setMemoryLimit")
+    .def("memoryLimit", &Sys::SparseCache::memoryLimit)
+    .staticmethod("memoryLimit")
+    .def("isEnabled", &Sys::SparseCache::isEnabled)
+    .staticmethod("isEnabled")
+    .def("numMisses", &Sys::SparseCache::numMisses)
+    .staticmethod("numMisses")
+    .def("numResidentBlocks", &Sys::SparseCache::numResidentBlocks)
+    .staticmethod("numResidentBlocks")
+    .def("numDistinctBlocks", &Sys::SparseCache::numDistinctBlocks)
+    .staticmethod("numDistinctBlocks")
+    .def("fractionResident", &Sys::SparseCache::fractionResident)
+    .staticmethod("fractionResident")
+    .def("loadsPerBlock", &Sys::SparseCache::loadsPerBlock)
+    .staticmethod("loadsPerBlock")
+    .def("resetStatistics", &Sys::SparseCache::resetStatistics)
+    .staticmethod("resetStatistics")
+    .def("info", &Sys::SparseCache::info)
+    .staticmethod("info")
+    ;
+
+  // BlockCache ---
+
+  class_<Sys::BlockCache>("BlockCache")
+    .def("setMemoryLimit", &Sys::BlockCache::setMemoryLimit)
+    .staticmethod("setMemoryLimit")
+    .def("memoryLimit", &Sys::BlockCache::memoryLimit)
+    .staticmethod("memoryLimit")
+    .def("codecName", &Sys::BlockCache::codecName)
+    .staticmethod("codecName")
+    .def("numMisses", &Sys::BlockCache::numMisses)
+    .staticmethod("numMisses")
+    .def("resetStatistics", &Sys::BlockCache::resetStatistics)
+    .staticmethod("resetStatistics")
+    .def("info", &Sys::BlockCache::info)
+    .staticmethod("info")
+    ;
+
   // RenderGlobals ---
 
   class_<RenderGlobals>("RenderGlobals")
@@ -81,6 +125,13 @@ void exportGlobals()
     .def("fps", &RenderGlobals::fps).staticmethod("fps")
     .def("scene", &RenderGlobals::scene).staticmethod("scene")
     .def("camera", &RenderGlobals::camera).staticmethod("camera")
+    .def("setNumThreads", &RenderGlobals::setNumThreads)
+    .staticmethod("setNumThreads")
+    .def("numThreads", &RenderGlobals::numThreads).staticmethod("numThreads")
+    .def("setPreviewLevel", &RenderGlobals::setPreviewLevel)
+    .staticmethod("setPreviewLevel")
+    .def("previewLevel", &RenderGlobals::previewLevel)
+    .staticmethod("previewLevel")
     ;
 
 }
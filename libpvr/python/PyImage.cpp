@@ -45,11 +45,29 @@
 
 #include <pvr/Image.h>
 
+#include "Common.h"
+
 //----------------------------------------------------------------------------//
 // Helper functions
 //----------------------------------------------------------------------------//
 
+//! Returns the resolution of the image's data window
+Imath::V2i dataResolutionHelper(const pvr::Render::Image &self)
+{
+  return self.dataWindow().size() + Imath::V2i(1);
+}
+
+//----------------------------------------------------------------------------//
 
+//! Returns an ArrayView of the RGBA pixels of the data window, with 
+//! shape (height, width, 4)
+pvr::ArrayView pixelViewHelper(bp::object self)
+{
+  using pvr::Render::Image;
+  Image &image = bp::extract<Image&>(self);
+  const Imath::V2i res = dataResolutionHelper(image);
+  return pvr::arrayView(self, image.pixels(), bp::make_tuple(res.y, res.x, 4));
+}
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -67,13 +85,25 @@ void exportImage()
   // Image ---
 
   class_<Image, Image::Ptr>("Image", no_init)
-    .def("__init__",      make_constructor(Image::create))
-    .def("setSize",       &Image::setSize)
-    .def("setPixel",      &Image::setPixel)
-    .def("setPixelAlpha", &Image::setPixelAlpha)
-    .def("pixel",         &Image::pixel)
-    .def("pixelAlpha",    &Image::pixelAlpha)
-    .def("write",         &Image::write)
+    .def("__init__",       make_constructor(Image::create))
+    .def("setSize",        &Image::setSize)
+    .def("setPixel",       &Image::setPixel)
+    .def("setPixelAlpha",  &Image::setPixelAlpha)
+    .def("pixel",          &Image::pixel)
+    .def("pixelAlpha",     &Image::pixelAlpha)
+    .def("merge",          &Image::merge)
+    .def("size",           &Image::size)
+    .def("dataResolution", &dataResolutionHelper)
+    .def("pixelView",      &pixelViewHelper)
+    .def("setPixelType",   &Image::setPixelType)
+    .def("pixelType",      &Image::pixelType)
+    .def("setCompression", &Image::setCompression)
+    .def("compression",    &Image::compression,
+         return_value_policy<copy_const_reference>())
+    .def("write",          &Image::write)
+    .def("writeAsync",     &Image::writeAsync)
+    .def("read",           &Image::read).staticmethod("read")
+    .def("readChannel",    &Image::readChannel).staticmethod("readChannel")
     ;
 
   enum_<Image::Channels>("Channels")
@@ -81,6 +111,11 @@ void exportImage()
     .value("RGBA", Image::RGBA)
     ;
 
+  enum_<Image::PixelType>("PixelType")
+    .value("FloatPixels", Image::FloatPixels)
+    .value("HalfPixels", Image::HalfPixels)
+    ;
+
 }
 
 //----------------------------------------------------------------------------//
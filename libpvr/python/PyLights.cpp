@@ -33,18 +33,42 @@
 // System includes
 
 #include <boost/python.hpp>
+#include <boost/python/copy_const_reference.hpp>
 
 // Library includes
 
 #include <pvr/Lights/Light.h>
+#include <pvr/Lights/DirectionalLight.h>
+#include <pvr/Lights/EnvironmentLight.h>
 #include <pvr/Lights/PointLight.h>
 #include <pvr/Lights/SpotLight.h>
 
+#include "Common.h"
+
 //----------------------------------------------------------------------------//
 // Helper functions
 //----------------------------------------------------------------------------//
 
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  //! Precomputes the light's occlusion without holding the GIL.
+  void precomputeEnvironmentLight(EnvironmentLight &light, 
+                                  Renderer::CPtr renderer, const size_t res,
+                                  const size_t numDirections)
+  {
+    pvr::ScopedGILRelease release;
+    light.precompute(renderer, res, numDirections);
+  }
+
+  //--------------------------------------------------------------------------//
 
+} // local namespace
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -64,7 +88,8 @@ void exportLights()
     .def("setFalloffEnabled", &Light::setFalloffEnabled)
     .def("falloffEnabled",    &Light::falloffEnabled)
     .def("setOccluder",       &Light::setOccluder)
-    .def("occluder",          &Light::occluder)
+    .def("occluder",          &Light::occluder,
+         return_value_policy<copy_const_reference>())
     ;
   
   implicitly_convertible<Light::Ptr, Light::CPtr>();
@@ -90,6 +115,34 @@ void exportLights()
   
   implicitly_convertible<SpotLight::Ptr, SpotLight::CPtr>();
 
+  // DirectionalLight ---
+
+  class_<DirectionalLight, bases<Light>, DirectionalLight::Ptr>
+    ("DirectionalLight", no_init)
+    .def("__init__",     make_constructor(DirectionalLight::create))
+    .def("setDirection", &DirectionalLight::setDirection)
+    .def("direction",    &DirectionalLight::direction,
+         return_value_policy<copy_const_reference>())
+    .def("fitCamera",    &DirectionalLight::fitCamera)
+    ;
+  
+  implicitly_convertible<DirectionalLight::Ptr, DirectionalLight::CPtr>();
+
+  // EnvironmentLight ---
+
+  class_<EnvironmentLight, bases<Light>, EnvironmentLight::Ptr>
+    ("EnvironmentLight", no_init)
+    .def("__init__",             make_constructor(EnvironmentLight::create))
+    .def("setUpVector",          &EnvironmentLight::setUpVector)
+    .def("upVector",             &EnvironmentLight::upVector,
+         return_value_policy<copy_const_reference>())
+    .def("setHemisphereEnabled", &EnvironmentLight::setHemisphereEnabled)
+    .def("hemisphereEnabled",    &EnvironmentLight::hemisphereEnabled)
+    .def("precompute",           &precomputeEnvironmentLight)
+    ;
+  
+  implicitly_convertible<EnvironmentLight::Ptr, EnvironmentLight::CPtr>();
+
 }
 
 //----------------------------------------------------------------------------//
@@ -69,8 +69,15 @@ void exportLog()
 
   // Log ---
 
+  enum_<Log::Severity>("LogSeverity")
+    .value("SevMessage", Log::SevMessage)
+    .value("SevWarning", Log::SevWarning)
+    ;
+
   def("logPrint", &printHelper1);
   def("logWarning", &Log::warning);
+  def("logSetMinSeverity", &Log::setMinSeverity);
+  def("logMinSeverity", &Log::minSeverity);
 
 }
 
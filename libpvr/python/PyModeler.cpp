@@ -45,6 +45,8 @@
 
 #include <pvr/Modeler.h>
 
+#include "Common.h"
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -59,6 +61,63 @@ using pvr::Model::ModelerInput;
 void (Modeler::*setRes1)(size_t)                 = &Modeler::setResolution;
 void (Modeler::*setRes3)(size_t, size_t, size_t) = &Modeler::setResolution;
 
+//----------------------------------------------------------------------------//
+
+//! Executes without holding the GIL, so that other Python threads can run
+void executeHelper(Modeler &self)
+{
+  pvr::ScopedGILRelease release;
+  self.execute();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Executes without holding the GIL, so that other Python threads can run
+pvr::Render::Volume::Ptr executeClusteredHelper(Modeler &self, 
+                                                const size_t res)
+{
+  pvr::ScopedGILRelease release;
+  return self.executeClustered(res);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Compacts without holding the GIL, so that other Python threads can run
+void compactBufferHelper(Modeler &self)
+{
+  pvr::ScopedGILRelease release;
+  self.compactBuffer();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Blurs without holding the GIL, so that other Python threads can run
+void blurBufferHelper(Modeler &self, const float radius)
+{
+  pvr::ScopedGILRelease release;
+  self.blurBuffer(radius);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Resamples without holding the GIL, so that other Python threads can run
+void resampleBufferHelper(Modeler &self, const size_t x, const size_t y, 
+                          const size_t z)
+{
+  pvr::ScopedGILRelease release;
+  self.resampleBuffer(x, y, z);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Downsamples without holding the GIL, so that other Python threads can run
+pvr::VoxelBuffer::Ptr maxDownsampledBufferHelper(const Modeler &self, 
+                                                 const size_t factor)
+{
+  pvr::ScopedGILRelease release;
+  return self.maxDownsampledBuffer(factor);
+}
+
 //----------------------------------------------------------------------------//
 // Pvr python module
 //----------------------------------------------------------------------------//
@@ -80,14 +139,37 @@ void exportModeler()
     .def("setResolution",      setRes3)
     .def("setVoxelSize",       &Modeler::setVoxelSize)
     .def("setMapping",         &Modeler::setMapping)
+    .def("setFrustumDepth",    &Modeler::setFrustumDepth)
     .def("setDataStructure",   &Modeler::setDataStructure)
     .def("setSparseBlockSize", &Modeler::setSparseBlockSize)
     .def("setCamera",          &Modeler::setCamera)
+    .def("setNumThreads",      &Modeler::setNumThreads)
+    .def("setInstanceChunkSize", &Modeler::setInstanceChunkSize)
+    .def("setDirectInstancing", &Modeler::setDirectInstancing)
+    .def("setAggregateInstancing", &Modeler::setAggregateInstancing)
+    .def("setDeterministic", &Modeler::setDeterministic)
+    .def("setOutputFormat",    &Modeler::setOutputFormat)
+    .def("setSparseOutput",    &Modeler::setSparseOutput)
+    .def("setReuseBuffers",    &Modeler::setReuseBuffers)
+    .def("clearBufferPool",    &Modeler::clearBufferPool)
+      .staticmethod("clearBufferPool")
+    .def("setInputCaching",    &Modeler::setInputCaching)
+    .def("clearInputCache",    &Modeler::clearInputCache)
+    .def("setCoarseLevel",     &Modeler::setCoarseLevel)
+    .def("setCoarseFeatureSize", &Modeler::setCoarseFeatureSize)
     .def("addInput",           &Modeler::addInput)
     .def("updateBounds",       &Modeler::updateBounds)
-    .def("execute",            &Modeler::execute)
+    .def("autoConfigure",      &Modeler::autoConfigure)
+    .def("execute",            &executeHelper)
+    .def("executeClustered",   &executeClusteredHelper)
+    .def("compactBuffer",      &compactBufferHelper)
+    .def("blurBuffer",         &blurBufferHelper)
+    .def("resampleBuffer",     &resampleBufferHelper)
+    .def("maxDownsampledBuffer", &maxDownsampledBufferHelper)
     .def("saveBuffer",         &Modeler::saveBuffer)
+    .def("saveBufferAsync",    &Modeler::saveBufferAsync)
     .def("buffer",             &Modeler::buffer)
+    .def("coarseBuffer",       &Modeler::coarseBuffer)
     ;
 
   enum_<Modeler::Mapping>("Mapping")
@@ -95,6 +177,11 @@ void exportModeler()
     .value("FrustumMappingType", Modeler::FrustumMappingType)
     ;
 
+  enum_<Modeler::FrustumDepth>("FrustumDepth")
+    .value("PerspectiveDepth", Modeler::PerspectiveDepth)
+    .value("UniformDepth",     Modeler::UniformDepth)
+    ;
+
   enum_<Modeler::DataStructure>("DataStructure")
     .value("DenseBufferType",  Modeler::DenseBufferType)
     .value("SparseBufferType", Modeler::SparseBufferType)
@@ -106,6 +193,13 @@ void exportModeler()
     .value("Size32", Modeler::SparseBlockSize32)
     ;
 
+  enum_<Modeler::OutputFormat>("OutputFormat")
+    .value("VectorOutput",     Modeler::VectorOutput)
+    .value("HalfVectorOutput", Modeler::HalfVectorOutput)
+    .value("ScalarOutput",     Modeler::ScalarOutput)
+    .value("HalfScalarOutput", Modeler::HalfScalarOutput)
+    ;
+
 }
 
 //----------------------------------------------------------------------------//
@@ -124,6 +218,9 @@ void exportModelerInput()
     .def("__init__",           make_constructor(ModelerInput::create))
     .def("setGeometry",        &ModelerInput::setGeometry)
     .def("setVolumePrimitive", &ModelerInput::setVolumePrimitive)
+    .def("setCacheKey",        &ModelerInput::setCacheKey)
+    .def("cacheKey",           &ModelerInput::cacheKey,
+         return_value_policy<copy_const_reference>())
     ;
 
 }
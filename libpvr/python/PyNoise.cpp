@@ -96,6 +96,46 @@ inline double perlinHelperV(const Vector &p)
 
 //----------------------------------------------------------------------------//
 
+inline double simplexHelper1(const float x)
+{
+  SimplexSNoise noise;
+  float result;
+  noise(result, x);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+inline double simplexHelper2(const float x, const float y)
+{
+  SimplexSNoise noise;
+  float result;
+  noise(result, x, y);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+inline double simplexHelper3(const float x, const float y, const float z)
+{
+  SimplexSNoise noise;
+  float result;
+  noise(result, Vector(x, y, z));
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+inline double simplexHelperV(const Vector &p)
+{
+  SimplexSNoise noise;
+  float result;
+  noise(result, p);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
 inline double noiseFunctionHelper1(const NoiseFunction &self, const float x)
 {
   return self.eval(x);
@@ -156,6 +196,14 @@ inline double fractalHelperV(const Fractal &self,
   return self.eval(p);
 }
 
+//----------------------------------------------------------------------------//
+
+inline double fractalHelperVFiltered(const Fractal &self, 
+                                     const Vector &p, const float filterWidth)
+{
+  return self.eval(p, filterWidth);
+}
+
 //----------------------------------------------------------------------------//
 // Pvr python module
 //----------------------------------------------------------------------------//
@@ -166,6 +214,10 @@ void exportNoiseFunctions()
   def("perlin", &perlinHelper2);
   def("perlin", &perlinHelper3);
   def("perlin", &perlinHelperV);
+  def("simplex", &simplexHelper1);
+  def("simplex", &simplexHelper2);
+  def("simplex", &simplexHelper3);
+  def("simplex", &simplexHelperV);
 }
 
 //----------------------------------------------------------------------------//
@@ -201,6 +253,7 @@ void exportNoiseClasses()
     .def("eval",  &fractalHelper2)
     .def("eval",  &fractalHelper3)
     .def("eval",  &fractalHelperV)
+    .def("eval",  &fractalHelperVFiltered)
     ;
   implicitly_convertible<Fractal::Ptr, Fractal::CPtr>();
 
@@ -214,6 +267,14 @@ void exportNoiseClasses()
     ("AbsPerlinNoise", no_init)
     .def("__init__", make_constructor(AbsPerlinNoise::create))
     ;
+  class_<SimplexNoise, SimplexNoise::Ptr, bases<NoiseFunction> >
+    ("SimplexNoise", no_init)
+    .def("__init__", make_constructor(SimplexNoise::create))
+    ;
+  class_<AbsSimplexNoise, AbsSimplexNoise::Ptr, bases<NoiseFunction> >
+    ("AbsSimplexNoise", no_init)
+    .def("__init__", make_constructor(AbsSimplexNoise::create))
+    ;
 
   // Fractal subclasses ---
 
@@ -222,6 +283,10 @@ void exportNoiseClasses()
     .def("__init__", make_constructor(fBm::create))
     ;
 
+  class_<TiledfBm, TiledfBm::Ptr, bases<Fractal> >("TiledfBm", no_init)
+    .def("__init__", make_constructor(TiledfBm::create))
+    ;
+
 }
 
 //----------------------------------------------------------------------------//
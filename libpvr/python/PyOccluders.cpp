@@ -37,17 +37,111 @@
 // Library includes
 
 #include <pvr/Occluders/Occluder.h>
+#include <pvr/Occluders/OccluderResolution.h>
 #include <pvr/Occluders/RaymarchOccluder.h>
 #include <pvr/Occluders/TransmittanceMapOccluder.h>
 #include <pvr/Occluders/OtfTransmittanceMapOccluder.h>
 #include <pvr/Occluders/VoxelOccluder.h>
 #include <pvr/Occluders/OtfVoxelOccluder.h>
+#include <pvr/Occluders/FrustumVoxelOccluder.h>
+#include <pvr/Occluders/SweepVoxelOccluder.h>
+#include <pvr/Occluders/SparseVoxelOccluder.h>
+
+#include "Common.h"
 
 //----------------------------------------------------------------------------//
 // Helper functions
 //----------------------------------------------------------------------------//
 
+namespace {
+
+  //--------------------------------------------------------------------------//
 
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  BOOST_PYTHON_FUNCTION_OVERLOADS(voxelOccluderOverloads, 
+                                  OccluderResolution::voxelOccluder, 1, 3)
+  BOOST_PYTHON_FUNCTION_OVERLOADS(transmittanceMapOverloads, 
+                                  OccluderResolution::transmittanceMap, 3, 5)
+
+  //--------------------------------------------------------------------------//
+
+  //! Disambiguates the two TransmittanceMapOccluder::create() overloads.
+  //! Renders the map without holding the GIL.
+  TransmittanceMapOccluder::Ptr 
+  createTransmittanceMapOccluder(Renderer::CPtr renderer, Camera::CPtr camera,
+                                 const size_t numSamples)
+  {
+    pvr::ScopedGILRelease release;
+    return TransmittanceMapOccluder::create(renderer, camera, numSamples);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  TransmittanceMapOccluder::Ptr 
+  createTransmittanceMapOccluderFromMap(DeepImage::Ptr transmittanceMap, 
+                                        Camera::CPtr camera)
+  {
+    return TransmittanceMapOccluder::create(transmittanceMap, camera);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Precomputes the voxel buffer without holding the GIL
+  VoxelOccluder::Ptr 
+  createVoxelOccluder(Renderer::CPtr renderer, const pvr::Vector &wsLightPos,
+                      const size_t res)
+  {
+    pvr::ScopedGILRelease release;
+    return VoxelOccluder::create(renderer, wsLightPos, res);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  FrustumVoxelOccluder::Ptr 
+  createFrustumVoxelOccluder(Renderer::CPtr renderer, 
+                             PerspectiveCamera::CPtr camera, const size_t res)
+  {
+    pvr::ScopedGILRelease release;
+    return FrustumVoxelOccluder::create(renderer, camera, res);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  SweepVoxelOccluder::Ptr 
+  createSweepVoxelOccluder(Renderer::CPtr renderer, 
+                           const pvr::Vector &wsLightPos, const size_t res)
+  {
+    pvr::ScopedGILRelease release;
+    return SweepVoxelOccluder::create(renderer, wsLightPos, res);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  SparseVoxelOccluder::Ptr 
+  createSparseVoxelOccluder(Renderer::CPtr renderer, 
+                            const pvr::Vector &wsLightPos, const size_t res)
+  {
+    pvr::ScopedGILRelease release;
+    return SparseVoxelOccluder::create(renderer, wsLightPos, res);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Diffuses the occluder's buffer without holding the GIL.
+  void computeMultipleScattering(VoxelOccluder &occluder, 
+                                 const size_t iterations, 
+                                 const float strength)
+  {
+    pvr::ScopedGILRelease release;
+    occluder.computeMultipleScattering(iterations, strength);
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -76,6 +170,19 @@ void exportOccluders()
   
   implicitly_convertible<NullOccluder::Ptr, NullOccluder::CPtr>();
 
+  // OccluderResolution ---
+
+  class_<OccluderResolution>("OccluderResolution")
+    .def("detailSize", &OccluderResolution::detailSize)
+    .staticmethod("detailSize")
+    .def("voxelOccluder", &OccluderResolution::voxelOccluder, 
+         voxelOccluderOverloads())
+    .staticmethod("voxelOccluder")
+    .def("transmittanceMap", &OccluderResolution::transmittanceMap, 
+         transmittanceMapOverloads())
+    .staticmethod("transmittanceMap")
+    ;
+
   // RaymarchOccluder ---
 
   class_<RaymarchOccluder, bases<Occluder>, RaymarchOccluder::Ptr>
@@ -90,7 +197,13 @@ void exportOccluders()
   class_<TransmittanceMapOccluder, bases<Occluder>, 
          TransmittanceMapOccluder::Ptr>
     ("TransmittanceMapOccluder", no_init)
-    .def("__init__", make_constructor(TransmittanceMapOccluder::create))
+    .def("__init__", make_constructor(createTransmittanceMapOccluder))
+    .def("__init__", make_constructor(createTransmittanceMapOccluderFromMap))
+    .def("setBlur", &TransmittanceMapOccluder::setBlur)
+    .def("blur", &TransmittanceMapOccluder::blur)
+    .def("setWorldBlur", &TransmittanceMapOccluder::setWorldBlur)
+    .def("worldBlur", &TransmittanceMapOccluder::worldBlur)
+    .def("numLevels", &TransmittanceMapOccluder::numLevels)
     ;
   
   implicitly_convertible<TransmittanceMapOccluder::Ptr, 
@@ -112,12 +225,48 @@ void exportOccluders()
   class_<VoxelOccluder, bases<Occluder>, 
          VoxelOccluder::Ptr>
     ("VoxelOccluder", no_init)
-    .def("__init__", make_constructor(VoxelOccluder::create))
+    .def("__init__", make_constructor(createVoxelOccluder))
+    .def("write", &VoxelOccluder::write)
+    .def("computeMultipleScattering", &computeMultipleScattering)
+    .def("read", &VoxelOccluder::read).staticmethod("read")
     ;
   
   implicitly_convertible<VoxelOccluder::Ptr, 
                          VoxelOccluder::CPtr>();
 
+  // FrustumVoxelOccluder ---
+
+  class_<FrustumVoxelOccluder, bases<VoxelOccluder>, 
+         FrustumVoxelOccluder::Ptr>
+    ("FrustumVoxelOccluder", no_init)
+    .def("__init__", make_constructor(createFrustumVoxelOccluder))
+    ;
+  
+  implicitly_convertible<FrustumVoxelOccluder::Ptr, 
+                         FrustumVoxelOccluder::CPtr>();
+
+  // SweepVoxelOccluder ---
+
+  class_<SweepVoxelOccluder, bases<VoxelOccluder>, 
+         SweepVoxelOccluder::Ptr>
+    ("SweepVoxelOccluder", no_init)
+    .def("__init__", make_constructor(createSweepVoxelOccluder))
+    ;
+  
+  implicitly_convertible<SweepVoxelOccluder::Ptr, 
+                         SweepVoxelOccluder::CPtr>();
+
+  // SparseVoxelOccluder ---
+
+  class_<SparseVoxelOccluder, bases<Occluder>, 
+         SparseVoxelOccluder::Ptr>
+    ("SparseVoxelOccluder", no_init)
+    .def("__init__", make_constructor(createSparseVoxelOccluder))
+    ;
+  
+  implicitly_convertible<SparseVoxelOccluder::Ptr, 
+                         SparseVoxelOccluder::CPtr>();
+
   // OtfVoxelOccluder ---
 
   class_<OtfVoxelOccluder, bases<Occluder>, 
@@ -0,0 +1,97 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file PyPixelSamplers.cpp
+  Contains the interface definition for the PixelSampler subclasses
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Needs to be first, to avoid macro "tolower" passed 2 arguments, on OSX, python 2.7
+#include <Python.h>
+
+// System includes
+
+// Library includes
+
+#include <pvr/PixelSamplers/PixelSampler.h>
+#include <pvr/PixelSamplers/BlueNoiseSampler.h>
+#include <pvr/PixelSamplers/SobolSampler.h>
+#include <pvr/PixelSamplers/StratifiedSampler.h>
+
+#include "Common.h"
+
+//----------------------------------------------------------------------------//
+// Pvr python module
+//----------------------------------------------------------------------------//
+
+void exportPixelSamplers()
+{
+  using namespace boost;
+  using namespace boost::python;
+
+  using namespace std;
+  using namespace pvr;
+
+  using namespace pvr::Render;
+
+  // PixelSampler ---
+
+  class_<PixelSampler, PixelSampler::Ptr, boost::noncopyable>
+    ("PixelSampler", no_init)
+    .def("typeName", &PixelSampler::typeName)
+    .def("sample", &PixelSampler::sample)
+    ;
+  
+  implicitly_convertible<PixelSampler::Ptr, PixelSampler::CPtr>();
+
+  // StratifiedSampler ---
+
+  class_<StratifiedSampler, bases<PixelSampler>, StratifiedSampler::Ptr>
+    ("StratifiedSampler", no_init)
+    .def("__init__", make_constructor(StratifiedSampler::create))
+    ;
+  
+  implicitly_convertible<StratifiedSampler::Ptr, StratifiedSampler::CPtr>();
+
+  // SobolSampler ---
+
+  class_<SobolSampler, bases<PixelSampler>, SobolSampler::Ptr>
+    ("SobolSampler", no_init)
+    .def("__init__", make_constructor(SobolSampler::create))
+    ;
+  
+  implicitly_convertible<SobolSampler::Ptr, SobolSampler::CPtr>();
+
+  // BlueNoiseSampler ---
+
+  class_<BlueNoiseSampler, bases<PixelSampler>, BlueNoiseSampler::Ptr>
+    ("BlueNoiseSampler", no_init)
+    .def("__init__", make_constructor(BlueNoiseSampler::create))
+    ;
+  
+  implicitly_convertible<BlueNoiseSampler::Ptr, BlueNoiseSampler::CPtr>();
+
+}
+
+//----------------------------------------------------------------------------//
@@ -50,6 +50,8 @@
 #include <pvr/Time.h>
 #include <pvr/Types.h>
 
+#include "Common.h"
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -80,6 +82,7 @@ void exportOccluders();
 void exportParticles();
 void exportPerspectiveCamera();
 void exportPhaseFunction();
+void exportPixelSamplers();
 void exportPolygons();
 void exportPrimitive();
 void exportRaymarchers();
@@ -92,6 +95,9 @@ void exportVolumes();
 // PythonInterrupt
 //----------------------------------------------------------------------------//
 
+//! Aborts on keyboard interrupts and when Python has requested it through
+//! setAbortRequested(). Long calls release the GIL, so it is acquired for 
+//! each check. The flag is only accessed with the GIL held.
 class PythonInterrupt : public pvr::Sys::Interrupt
 {
 public:
@@ -99,21 +105,49 @@ public:
   { return Ptr(new PythonInterrupt); }
   virtual bool abort() const
   {
-    if (PyErr_CheckSignals() != 0) {
+    ScopedGILAcquire gil;
+    if (ms_abortRequested) {
+      pvr::Util::Log::print("PVR got abort request. Aborting.");
+      return true;
+    } else if (PyErr_CheckSignals() != 0) {
       pvr::Util::Log::print("PVR got interrupt signal. Aborting.");
       return true;
     } else {
       return false;
     }
   }
+  static bool ms_abortRequested;
 };
 
+//----------------------------------------------------------------------------//
+
+bool PythonInterrupt::ms_abortRequested = false;
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether running and future renders should abort. The flag stays 
+//! set until it is cleared, which lets another Python thread cancel a 
+//! render.
+void setAbortRequested(const bool requested)
+{
+  PythonInterrupt::ms_abortRequested = requested;
+}
+
+//----------------------------------------------------------------------------//
+
+bool abortRequested()
+{
+  return PythonInterrupt::ms_abortRequested;
+}
+
 //----------------------------------------------------------------------------//
 // Initialization helper
 //----------------------------------------------------------------------------//
 
 void initPyPvr()
 {
+  // Long calls release the GIL, which needs threads to be set up
+  PyEval_InitThreads();
   // PVR globals
   Sys::Globals::init();
   // Field3D initialization
@@ -132,6 +166,10 @@ BOOST_PYTHON_MODULE(_pvr)
 
   initPyPvr();
 
+  def("setAbortRequested", &setAbortRequested);
+  def("abortRequested", &abortRequested);
+
+  pvr::exportArrayView();
   exportAttrTable();
   exportCameraFunctions();
   exportCurve();
@@ -151,6 +189,7 @@ BOOST_PYTHON_MODULE(_pvr)
   exportParticles();
   exportPerspectiveCamera();
   exportPhaseFunction();
+  exportPixelSamplers();
   exportPolygons();
   exportPrimitive();
   exportRaymarchSamplers();
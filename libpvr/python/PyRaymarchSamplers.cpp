@@ -46,7 +46,11 @@
 // Helper functions
 //----------------------------------------------------------------------------//
 
-
+void samplerSetParamsHelper(pvr::Render::RaymarchSampler &self, 
+                            boost::python::dict d)
+{
+  self.setParams(pvr::dictToParamMap(d));
+}
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -67,6 +71,7 @@ void exportRaymarchSamplers()
   class_<RaymarchSampler, RaymarchSampler::Ptr, boost::noncopyable>
     ("RaymarchSampler", no_init)
     .def("typeName", &RaymarchSampler::typeName)
+    .def("setParams", &samplerSetParamsHelper)
     ;
   
   implicitly_convertible<RaymarchSampler::Ptr, RaymarchSampler::CPtr>();
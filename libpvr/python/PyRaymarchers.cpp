@@ -36,8 +36,10 @@
 
 // Library includes
 
+#include <pvr/Raymarchers/GpuRaymarcher.h>
 #include <pvr/Raymarchers/Raymarcher.h>
 #include <pvr/Raymarchers/UniformRaymarcher.h>
+#include <pvr/Raymarchers/TrackingRaymarcher.h>
 
 #include "Common.h"
 
@@ -91,6 +93,30 @@ void exportRaymarchers()
   
   implicitly_convertible<UniformRaymarcher::Ptr, UniformRaymarcher::CPtr>();
 
+  // TrackingRaymarcher ---
+
+  class_<TrackingRaymarcher, bases<UniformRaymarcher>, TrackingRaymarcher::Ptr>
+    ("TrackingRaymarcher", no_init)
+    .def("__init__", make_constructor(TrackingRaymarcher::create))
+    ;
+  
+  implicitly_convertible<TrackingRaymarcher::Ptr, TrackingRaymarcher::CPtr>();
+
+#ifdef PVR_USE_CUDA
+
+  // GpuRaymarcher ---
+
+  class_<GpuRaymarcher, bases<UniformRaymarcher>, GpuRaymarcher::Ptr>
+    ("GpuRaymarcher", no_init)
+    .def("__init__",    make_constructor(GpuRaymarcher::create))
+    .def("isAvailable", &GpuRaymarcher::isAvailable)
+    .staticmethod("isAvailable")
+    ;
+  
+  implicitly_convertible<GpuRaymarcher::Ptr, GpuRaymarcher::CPtr>();
+
+#endif
+
 }
 
 //----------------------------------------------------------------------------//
@@ -13,7 +13,9 @@
 
 // System includes
 
+#include <pvr/Memory.h>
 #include <pvr/Renderer.h>
+#include <pvr/Trace.h>
 
 #include <boost/shared_ptr.hpp>
 
@@ -26,11 +28,134 @@
 
 // Library includes
 
+#include "Common.h"
+
 //----------------------------------------------------------------------------//
 // Helper functions
 //----------------------------------------------------------------------------//
 
+BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(setCheckpointOverloads, 
+                                       setCheckpoint, 1, 2)
+BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(setHoldoutDepthOverloads, 
+                                       setHoldoutDepth, 1, 2)
+
+//----------------------------------------------------------------------------//
+
+//! Returns the statistics of the last render as a dict of name : count
+boost::python::dict statisticsHelper(const pvr::Render::Renderer &self)
+{
+  using pvr::Sys::Stats;
+  boost::python::dict d;
+  const Stats::Counts &counts = self.statistics();
+  for (size_t i = 0, size = counts.size(); i < size; ++i) {
+    d[Stats::name(static_cast<Stats::Counter>(i))] = counts[i];
+  }
+  return d;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the memory use of each category as a dict of 
+//! name : (current bytes, peak bytes)
+boost::python::dict memoryStatisticsHelper()
+{
+  using pvr::Sys::Memory;
+  boost::python::dict d;
+  for (int i = 0; i < Memory::NumCategories; ++i) {
+    const Memory::Category category = static_cast<Memory::Category>(i);
+    d[Memory::name(category)] = 
+      boost::python::make_tuple(Memory::current(category), 
+                                Memory::peak(category));
+  }
+  d["total"] = boost::python::make_tuple(Memory::totalCurrent(), 
+                                         Memory::totalPeak());
+  return d;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Deletes a Python object while holding the GIL
+struct PyObjectDeleter
+{
+  void operator () (boost::python::object *object) const
+  { 
+    pvr::ScopedGILAcquire gil;
+    delete object; 
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Calls a Python callable after each progressive pass. The GIL is 
+//! released while rendering, so it is reacquired for the call. The 
+//! callable is shared, so that the renderer can copy the callback without
+//! touching Python reference counts.
+struct PyProgressCallback
+{
+  PyProgressCallback(const boost::python::object &callable)
+    : m_callable(new boost::python::object(callable), PyObjectDeleter())
+  { }
+  void operator () (const size_t pass, const size_t numPasses) const
+  { 
+    pvr::ScopedGILAcquire gil;
+    (*m_callable)(pass, numPasses); 
+  }
+  boost::shared_ptr<boost::python::object> m_callable;
+};
 
+//----------------------------------------------------------------------------//
+
+//! Sets the progress callback. Passing None removes it.
+void setProgressCallbackHelper(pvr::Render::Renderer &self, 
+                               const boost::python::object &callable)
+{
+  using pvr::Render::Renderer;
+  if (callable.is_none()) {
+    self.setProgressCallback(Renderer::ProgressCallback());
+  } else {
+    self.setProgressCallback(PyProgressCallback(callable));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Renders without holding the GIL, so that other Python threads can run
+void executeHelper(pvr::Render::Renderer &self)
+{
+  pvr::ScopedGILRelease release;
+  self.execute();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Waits without holding the GIL, so that other Python threads can run
+void waitHelper(pvr::Sys::BackgroundTask &self)
+{
+  pvr::ScopedGILRelease release;
+  self.wait();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Denoises an image with a list of guide images, without holding the GIL
+void denoiserApplyHelper(const pvr::Render::Denoiser &self, 
+                         pvr::Render::Image::Ptr image,
+                         const boost::python::list &guides = 
+                         boost::python::list(),
+                         const size_t numThreads = 0)
+{
+  using pvr::Render::Image;
+  std::vector<Image::CPtr> guideVec;
+  for (boost::python::ssize_t i = 0, size = boost::python::len(guides); 
+       i < size; ++i) {
+    guideVec.push_back(boost::python::extract<Image::Ptr>(guides[i])());
+  }
+  pvr::ScopedGILRelease release;
+  self.apply(*image, guideVec, numThreads);
+}
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(denoiserApplyOverloads, 
+                                denoiserApplyHelper, 2, 4)
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -40,32 +165,143 @@ void exportRenderer()
 {
   using namespace boost::python;
 
+  using pvr::Render::Denoiser;
   using pvr::Render::Renderer;
 
+  // Denoiser ---
+
+  class_<Denoiser, Denoiser::Ptr>("Denoiser", no_init)
+    .def("__init__",       make_constructor(Denoiser::create))
+    .def("setRadius",      &Denoiser::setRadius)
+    .def("radius",         &Denoiser::radius)
+    .def("setPatchRadius", &Denoiser::setPatchRadius)
+    .def("patchRadius",    &Denoiser::patchRadius)
+    .def("setStrength",    &Denoiser::setStrength)
+    .def("strength",       &Denoiser::strength)
+    .def("setGuideSigma",  &Denoiser::setGuideSigma)
+    .def("guideSigma",     &Denoiser::guideSigma)
+    .def("apply",          &denoiserApplyHelper, denoiserApplyOverloads())
+    ;
+
+  implicitly_convertible<Denoiser::Ptr, Denoiser::CPtr>();
+
   // Renderer ---
 
   class_<Renderer, Renderer::Ptr>("Renderer", no_init)
     .def("__init__",                   make_constructor(Renderer::create))
     .def("clone",                      &Renderer::clone)
+    .def("createView",                 &Renderer::createView)
     .def("setCamera",                  &Renderer::setCamera)
     .def("setRaymarcher",              &Renderer::setRaymarcher)
+    .def("setShadowRaymarcher",        &Renderer::setShadowRaymarcher)
+    .def("setPixelSampler",            &Renderer::setPixelSampler)
+    .def("setDenoiser",                &Renderer::setDenoiser)
     .def("addVolume",                  &Renderer::addVolume)
     .def("addLight",                   &Renderer::addLight)
+    .def("addView",                    &Renderer::addView)
+    .def("clearViews",                 &Renderer::clearViews)
+    .def("numViews",                   &Renderer::numViews)
+    .def("view",                       &Renderer::view)
     .def("printSceneInfo",             &Renderer::printSceneInfo)
     .def("setPrimaryEnabled",          &Renderer::setPrimaryEnabled)
     .def("setTransmittanceMapEnabled", &Renderer::setTransmittanceMapEnabled)
     .def("setLuminanceMapEnabled",     &Renderer::setLuminanceMapEnabled)
     .def("setDoRandomizePixelSamples", &Renderer::setDoRandomizePixelSamples)
     .def("setNumPixelSamples",         &Renderer::setNumPixelSamples)
-    .def("execute",                    &Renderer::execute)
+    .def("setProgressiveEnabled",      &Renderer::setProgressiveEnabled)
+    .def("setProgressCallback",        &setProgressCallbackHelper)
+    .def("setAdaptiveSamplingEnabled", &Renderer::setAdaptiveSamplingEnabled)
+    .def("setMaxPixelSamples",         &Renderer::setMaxPixelSamples)
+    .def("setAdaptiveThreshold",       &Renderer::setAdaptiveThreshold)
+    .def("setLightAovsEnabled",        &Renderer::setLightAovsEnabled)
+    .def("setEmissionAovEnabled",      &Renderer::setEmissionAovEnabled)
+    .def("setCostAovEnabled",          &Renderer::setCostAovEnabled)
+    .def("setNumDeepSamples",          &Renderer::setNumDeepSamples)
+    .def("setNumThreads",              &Renderer::setNumThreads)
+    .def("setTileSize",                &Renderer::setTileSize)
+    .def("setCropWindow",              &Renderer::setCropWindow)
+    .def("clearCropWindow",            &Renderer::clearCropWindow)
+    .def("setSplit",                   &Renderer::setSplit)
+    .def("setInScatterCacheResolution",
+         &Renderer::setInScatterCacheResolution)
+    .def("setCheckpoint",              &Renderer::setCheckpoint,
+         setCheckpointOverloads())
+    .def("setResumeEnabled",           &Renderer::setResumeEnabled)
+    .def("setHoldoutDepth",            &Renderer::setHoldoutDepth,
+         setHoldoutDepthOverloads())
+    .def("execute",                    &executeHelper)
+    .def("relight",                    &Renderer::relight)
     .def("raymarcher",                 &Renderer::raymarcher)
+    .def("shadowRaymarcher",           &Renderer::shadowRaymarcher)
+    .def("pixelSampler",               &Renderer::pixelSampler)
+    .def("denoiser",                   &Renderer::denoiser)
     .def("transmittanceMap",           &Renderer::transmittanceMap)
     .def("luminanceMap",               &Renderer::luminanceMap)
+    .def("lightAov",                   &Renderer::lightAov)
+    .def("emissionAov",                &Renderer::emissionAov)
+    .def("costAov",                    &Renderer::costAov)
+    .def("imageSnapshot",              &Renderer::imageSnapshot)
     .def("saveImage",                  &Renderer::saveImage)
+    .def("saveAovs",                   &Renderer::saveAovs)
+    .def("saveImageAsync",             &Renderer::saveImageAsync)
+    .def("saveTransmittanceMap",       &Renderer::saveTransmittanceMap)
+    .def("saveLuminanceMap",           &Renderer::saveLuminanceMap)
+    .def("statistics",                 &statisticsHelper)
+    .def("renderTime",                 &Renderer::renderTime)
     ;
 
   implicitly_convertible<Renderer::Ptr, Renderer::CPtr>();
 
+  enum_<Renderer::HoldoutDepthType>("HoldoutDepthType")
+    .value("RayDistanceDepth", Renderer::RayDistanceDepth)
+    .value("CameraDepth",      Renderer::CameraDepth)
+    ;
+
+  // Stats ---
+
+  class_<pvr::Sys::Stats>("Stats", no_init)
+    .def("setEnabled", &pvr::Sys::Stats::setEnabled)
+    .staticmethod("setEnabled")
+    .def("isEnabled", &pvr::Sys::Stats::isEnabled)
+    .staticmethod("isEnabled")
+    ;
+
+  // Trace ---
+
+  class_<pvr::Sys::Trace>("Trace", no_init)
+    .def("start", &pvr::Sys::Trace::start)
+    .staticmethod("start")
+    .def("stop", &pvr::Sys::Trace::stop)
+    .staticmethod("stop")
+    .def("isEnabled", &pvr::Sys::Trace::isEnabled)
+    .staticmethod("isEnabled")
+    ;
+
+  // BackgroundTask ---
+
+  using pvr::Sys::BackgroundTask;
+
+  class_<BackgroundTask, BackgroundTask::Ptr, boost::noncopyable>
+    ("BackgroundTask", no_init)
+    .def("wait",   &waitHelper)
+    .def("isDone", &BackgroundTask::isDone)
+    ;
+
+  // Memory ---
+
+  class_<pvr::Sys::Memory>("Memory", no_init)
+    .def("statistics", &memoryStatisticsHelper)
+    .staticmethod("statistics")
+    .def("info", &pvr::Sys::Memory::info)
+    .staticmethod("info")
+    .def("resetPeaks", &pvr::Sys::Memory::resetPeaks)
+    .staticmethod("resetPeaks")
+    .def("setBudget", &pvr::Sys::Memory::setBudget)
+    .staticmethod("setBudget")
+    .def("budget", &pvr::Sys::Memory::budget)
+    .staticmethod("budget")
+    ;
+
 }
 
 //----------------------------------------------------------------------------//
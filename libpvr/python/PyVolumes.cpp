@@ -36,9 +36,12 @@
 
 // Library includes
 
+#include <pvr/Lights/Light.h>
 #include <pvr/Volumes/FractalCloud.h>
 #include <pvr/Volumes/CompositeVolume.h>
 #include <pvr/Volumes/ConstantVolume.h>
+#include <pvr/Volumes/OpenVDBVolume.h>
+#include <pvr/Volumes/VolumeBaker.h>
 #include <pvr/Volumes/VoxelVolume.h>
 
 #include "Common.h"
@@ -47,7 +50,30 @@
 // Helper functions
 //----------------------------------------------------------------------------//
 
+namespace {
 
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  //! Bakes without holding the GIL
+  void executeVolumeBaker(VolumeBaker::Ptr baker)
+  {
+    pvr::ScopedGILRelease release;
+    baker->execute();
+  }
+
+  //--------------------------------------------------------------------------//
+
+}
+
+//----------------------------------------------------------------------------//
+
+#ifdef PVR_USE_OPENVDB
+BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(vdbLoadOverloads, load, 1, 2)
+#endif
 
 //----------------------------------------------------------------------------//
 // Pvr python module
@@ -65,6 +91,8 @@ void exportVolumes()
     .def("typeName",         &Volume::typeName)
     .def("setPhaseFunction", &Volume::setPhaseFunction)
     .def("phaseFunction",    &Volume::phaseFunction)
+    .def("linkLight",        &Volume::linkLight)
+    .def("clearLightLinks",  &Volume::clearLightLinks)
     ;
 
   implicitly_convertible<Volume::Ptr, Volume::CPtr>();
@@ -80,6 +108,17 @@ void exportVolumes()
     .value("MitchellInterp",       VoxelVolume::MitchellInterp)
     ;
 
+  enum_<VoxelVolume::StorageFormat>("StorageFormat")
+    .value("NativeStorage",      VoxelVolume::NativeStorage)
+    .value("FloatStorage",       VoxelVolume::FloatStorage)
+    .value("HalfStorage",        VoxelVolume::HalfStorage)
+    .value("HalfVectorStorage",  VoxelVolume::HalfVectorStorage)
+    .value("Quantized8Storage",  VoxelVolume::Quantized8Storage)
+    .value("Quantized16Storage", VoxelVolume::Quantized16Storage)
+    .value("BrickedStorage",     VoxelVolume::BrickedStorage)
+    .value("CompressedStorage",  VoxelVolume::CompressedStorage)
+    ;
+
   class_<VoxelVolume, bases<Volume>, VoxelVolume::Ptr>
     ("VoxelVolume")
     .def("__init__",         make_constructor(VoxelVolume::create))
@@ -88,6 +127,13 @@ void exportVolumes()
     .def("addAttribute",     &VoxelVolume::addAttribute)
     .def("setInterpolation", &VoxelVolume::setInterpolation)
     .def("setUseEmptySpaceOptimization", &VoxelVolume::setUseEmptySpaceOptimization)
+    .def("setEmptySpaceThreshold", &VoxelVolume::setEmptySpaceThreshold)
+    .def("setUseMipmaps",    &VoxelVolume::setUseMipmaps)
+    .def("setStorageFormat", &VoxelVolume::setStorageFormat)
+    .def("setVelocityBuffer", &VoxelVolume::setVelocityBuffer)
+    .def("setCoarseBuffer",  &VoxelVolume::setCoarseBuffer)
+    .def("setAttributeBuffer", &VoxelVolume::setAttributeBuffer)
+    .def("numBuffers",       &VoxelVolume::numBuffers)
     ;
 
   implicitly_convertible<VoxelVolume::Ptr, VoxelVolume::CPtr>();
@@ -123,6 +169,44 @@ void exportVolumes()
 
   implicitly_convertible<FractalCloud::Ptr, FractalCloud::CPtr>();
 
+  // VolumeBaker ---
+
+  enum_<VolumeBaker::MappingType>("BakeMapping")
+    .value("UniformMapping", VolumeBaker::UniformMapping)
+    .value("FrustumMapping", VolumeBaker::FrustumMapping)
+    ;
+
+  class_<VolumeBaker, VolumeBaker::Ptr>
+    ("VolumeBaker", no_init)
+    .def("__init__",            make_constructor(VolumeBaker::create))
+    .def("setResolution",       &VolumeBaker::setResolution)
+    .def("setMapping",          &VolumeBaker::setMapping)
+    .def("setCamera",           &VolumeBaker::setCamera)
+    .def("setUseSparseBuffers", &VolumeBaker::setUseSparseBuffers)
+    .def("setNumThreads",       &VolumeBaker::setNumThreads)
+    .def("execute",             &executeVolumeBaker)
+    .def("volume",              &VolumeBaker::volume)
+    .def("write",               &VolumeBaker::write)
+    .def("read",                &VolumeBaker::read)
+    ;
+
+#ifdef PVR_USE_OPENVDB
+
+  // OpenVDBVolume ---
+
+  class_<OpenVDBVolume, bases<Volume>, OpenVDBVolume::Ptr>
+    ("OpenVDBVolume")
+    .def("__init__",     make_constructor(OpenVDBVolume::create))
+    .def("load",         &OpenVDBVolume::load, vdbLoadOverloads())
+    .def("addAttribute", &OpenVDBVolume::addAttribute)
+    .def("setUseEmptySpaceOptimization", 
+         &OpenVDBVolume::setUseEmptySpaceOptimization)
+    ;
+
+  implicitly_convertible<OpenVDBVolume::Ptr, OpenVDBVolume::CPtr>();
+
+#endif
+
 }
 
 //----------------------------------------------------------------------------//
@@ -2,7 +2,8 @@
 from _pvr import *
 
 # bring in python submodules
-import cameras, renderers, lights
+import cameras, renderers, lights, mergesplit, tasks, perflog, snapshot, \
+    frames, estimate
 
 # Bring in util functions
 from pvrutil import *
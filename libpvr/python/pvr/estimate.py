@@ -0,0 +1,144 @@
+# ------------------------------------------------------------------------------
+# estimate.py
+# ------------------------------------------------------------------------------
+
+"""Predicts the wall time and memory of a render from a low-resolution probe
+render, so that a farm scheduler can pick a node type, or split the frame
+with Renderer.setSplit(), before the real render is submitted.
+
+The probe is a clone of the renderer, with a copy of its camera at a
+fraction of the pixels. It runs with the statistics counters enabled, so
+the raymarch steps and volume samples it took stand in for the step
+lengths, empty space optimization and lights of the scene. The time it
+spent rendering pixels is scaled up by the pixel ratio. Scene setup, such
+as the in-scatter cache, is counted once.
+
+    estimate = pvr.estimate.estimate(renderer, camera,
+                                     buffers = [modeler.buffer()])
+    for line in estimate.info():
+        pvr.logPrint(line)
+    json.dump(estimate.asDict(), open("cost.json", "w"))
+
+Occluders that are computed on the fly are shared with the probe, so the
+probe pays for the ones it needs and the real render then finds them
+cached. That makes the prediction conservative.
+"""
+
+import math
+import time
+
+import pvr
+
+# ------------------------------------------------------------------------------
+
+# Bytes per pixel of the rendered image, which holds four floats
+_imageBytesPerPixel = 16
+
+# ------------------------------------------------------------------------------
+
+class CostEstimate(object):
+    """The predicted cost of a render, along with what it was based on.
+    Times are in seconds and memory is in bytes."""
+    def __init__(self):
+        self.pixels = 0
+        self.probePixels = 0
+        self.probeSeconds = 0.0
+        self.setupSeconds = 0.0
+        self.statistics = {}
+        self.stepsPerRay = 0.0
+        self.voxels = 0
+        self.occupancy = 1.0
+        self.sceneMemory = 0
+        self.predictedSteps = 0
+        self.predictedSeconds = 0.0
+        self.predictedMemory = 0
+    def info(self):
+        """Returns a description of the estimate, one line per item."""
+        mb = 1.0 / (1024.0 * 1024.0)
+        return [
+            "Pixels: %d (probe %d)" % (self.pixels, self.probePixels),
+            "Probe time: %.2fs (setup %.2fs)" % (self.probeSeconds,
+                                                 self.setupSeconds),
+            "Steps per ray: %.1f" % self.stepsPerRay,
+            "Voxels: %d (%.1f%% occupied)" % (self.voxels,
+                                              100.0 * self.occupancy),
+            "Scene memory: %.1f MB" % (self.sceneMemory * mb),
+            "Predicted steps: %d" % self.predictedSteps,
+            "Predicted time: %.1fs" % self.predictedSeconds,
+            "Predicted memory: %.1f MB" % (self.predictedMemory * mb)
+            ]
+    def asDict(self):
+        """Returns the estimate as a dict, e.g. for writing as JSON."""
+        return dict(self.__dict__)
+
+# ------------------------------------------------------------------------------
+
+def estimate(renderer, camera, probeFraction = 1.0 / 16.0, buffers = ()):
+    """Renders a probe of the frame and predicts the cost of the full render.
+
+    renderer must be set up for the real render, with camera as its
+    camera. probeFraction is the fraction of the pixels that the probe
+    renders. buffers are the modeled VoxelBuffers of the scene, whose voxel
+    counts and sparse occupancy are reported alongside the prediction.
+
+    The renderer itself is left untouched, but the Memory peaks are reset,
+    since the probe's peak is part of the prediction."""
+    result = CostEstimate()
+
+    res = camera.resolution()
+    scale = math.sqrt(min(max(probeFraction, 0.0), 1.0))
+    probeRes = pvr.V2i(max(1, int(round(res.x * scale))),
+                       max(1, int(round(res.y * scale))))
+    result.pixels = res.x * res.y
+    result.probePixels = probeRes.x * probeRes.y
+    ratio = float(result.pixels) / result.probePixels
+
+    occupied = 0.0
+    for buffer in buffers:
+        dataRes = buffer.dataResolution()
+        voxels = dataRes.x * dataRes.y * dataRes.z
+        result.voxels += voxels
+        occupied += voxels * buffer.occupancy()
+    if result.voxels > 0:
+        result.occupancy = occupied / result.voxels
+
+    # Probe render ---
+
+    probeCamera = camera.clone()
+    probeCamera.setResolution(probeRes)
+    probe = renderer.clone()
+    probe.setCamera(probeCamera)
+
+    wasCounting = pvr.Stats.isEnabled()
+    pvr.Stats.setEnabled(True)
+    pvr.Memory.resetPeaks()
+    result.sceneMemory = pvr.Memory.statistics()["total"][0]
+    start = time.time()
+    try:
+        probe.execute()
+    finally:
+        pvr.Stats.setEnabled(wasCounting)
+    result.probeSeconds = time.time() - start
+    peakMemory = pvr.Memory.statistics()["total"][1]
+
+    # Prediction ---
+
+    stats = probe.statistics()
+    result.statistics = stats
+    rays = stats["full_raymarch_rays"] + stats["transmittance_only_rays"]
+    if rays > 0:
+        result.stepsPerRay = float(stats["raymarch_steps"]) / rays
+    result.predictedSteps = int(stats["raymarch_steps"] * ratio)
+
+    renderSeconds = min(probe.renderTime(), result.probeSeconds)
+    result.setupSeconds = result.probeSeconds - renderSeconds
+    result.predictedSeconds = result.setupSeconds + renderSeconds * ratio
+
+    # What the probe allocated while rendering is assumed to grow with the
+    # number of pixels, like the image itself
+    transient = max(peakMemory - result.sceneMemory, 0)
+    result.predictedMemory = int(result.sceneMemory + transient * ratio +
+                                 result.pixels * _imageBytesPerPixel)
+    return result
+
+# ------------------------------------------------------------------------------
@@ -0,0 +1,140 @@
+# ------------------------------------------------------------------------------
+# frames.py
+# ------------------------------------------------------------------------------
+
+"""Renders a range of frames in one process, overlapping the stages of
+neighbouring frames instead of running each frame from start to finish.
+
+While frame N renders, frame N+1 is read (and optionally modeled) on a
+thread of its own, and frame N-1 is written on another. This hides the
+file I/O and parsing between frames, and the process, PVR's thread pool
+and the Modeler buffer pool carry over from one frame to the next.
+Geometry.read(), Modeler.execute() and Renderer.execute() release the GIL
+and share the thread pool, so the stages don't oversubscribe the machine.
+
+At most three frames are in flight at once: the one being written, the
+one rendering and the one being prefetched. To let Modeler buffers be
+reused, call Modeler.setReuseBuffers(True) and make sure render() doesn't
+keep references to the scene once it returns.
+
+    def read(frame):
+        return pvr.Geometry.read("/data/sim.%04d.bgeo" % frame)
+    def model(frame, geo):
+        modeler = buildModeler(geo)
+        modeler.execute()
+        return modeler
+    def render(frame, modeler):
+        renderer = buildRenderer(modeler)
+        renderer.execute()
+        return renderer
+    def write(frame, renderer):
+        renderer.saveImage("/out/render.%04d.exr" % frame)
+    pvr.frames.FrameRange(range(1, 101), read, render,
+                          model = model, write = write).run()
+"""
+
+import threading
+import time
+
+import pvr
+
+# ------------------------------------------------------------------------------
+
+class FrameFailedError(RuntimeError):
+    """Raised by FrameRange.run() when a stage of a frame raised an
+    exception."""
+    pass
+
+# ------------------------------------------------------------------------------
+
+def _start(name, func, *args):
+    """Calls func(*args) on a new thread. Returns the pvr.tasks.Task that
+    holds the result."""
+    task = pvr.tasks.Task(lambda: func(*args), (), name)
+    thread = threading.Thread(target = task._run, name = name)
+    thread.daemon = True
+    thread.start()
+    return task
+
+# ------------------------------------------------------------------------------
+
+def _finish(task):
+    """Waits for a task started by _start() and returns its result. Waits
+    with a timeout, so that KeyboardInterrupt still reaches the calling
+    thread."""
+    while not task.done.is_set():
+        task.done.wait(0.1)
+    if task.error:
+        raise FrameFailedError("%s: %s" % (task.name, task.error))
+    return task.value
+
+# ------------------------------------------------------------------------------
+
+class FrameRange(object):
+    """Runs the stages of each frame in a sequence, prefetching the next
+    frame and writing the previous one while the current one renders.
+
+    Each stage is a function of the frame and the result of the stage
+    before it:
+      read(frame) reads the input of a frame, e.g. its Geometry.
+      model(frame, input) optionally turns it into the scene to render.
+        It runs on the prefetch thread, right after read().
+      render(frame, scene) renders the frame on the calling thread.
+      write(frame, result) optionally writes what render() returned.
+
+    If any stage fails, no further frames are started. Once the stages in
+    flight have finished, run() re-raises the exception of a failed
+    render(), or raises FrameFailedError for other stages."""
+    def __init__(self, frames, read, render, model = None, write = None):
+        self.frames = list(frames)
+        self.read = read
+        self.render = render
+        self.model = model
+        self.write = write
+    def _prefetch(self, frame):
+        scene = self.read(frame)
+        if self.model:
+            scene = self.model(frame, scene)
+        return scene
+    def run(self):
+        """Renders all frames, in order. Returns once the last frame has
+        been written."""
+        if not self.frames:
+            return
+        prefetch = _start("prefetch %s" % self.frames[0], self._prefetch,
+                          self.frames[0])
+        write = None
+        try:
+            for i, frame in enumerate(self.frames):
+                start = time.time()
+                scene = _finish(prefetch)
+                prefetch = None
+                waited = time.time() - start
+                if waited > 0.01:
+                    pvr.logPrint("Frame %s waited %.2fs for prefetch" %
+                                 (frame, waited))
+                if i + 1 < len(self.frames):
+                    nextFrame = self.frames[i + 1]
+                    prefetch = _start("prefetch %s" % nextFrame, 
+                                      self._prefetch, nextFrame)
+                result = self.render(frame, scene)
+                del scene
+                # Only one frame is written at a time
+                if write:
+                    _finish(write)
+                    write = None
+                if self.write:
+                    write = _start("write %s" % frame, self.write, frame,
+                                   result)
+                del result
+            if write:
+                _finish(write)
+                write = None
+        finally:
+            # Don't leave stages running past a failure. Their errors are
+            # secondary to the one being raised.
+            for task in (prefetch, write):
+                while task and not task.done.is_set():
+                    task.done.wait(0.1)
+
+# ------------------------------------------------------------------------------
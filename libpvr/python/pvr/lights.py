@@ -2,6 +2,9 @@
 # lights.py
 # ------------------------------------------------------------------------------
 
+import hashlib
+import os
+import threading
 from math import radians
 
 import pvr
@@ -49,44 +52,256 @@ __defaultLight = pvr.SpotLight
 
 # ------------------------------------------------------------------------------
 
+def _voxelRes(renderer, resMult):
+    # A resMult of None picks the resolution from the scene
+    if resMult is None:
+        return pvr.OccluderResolution.voxelOccluder(renderer)
+    return int(256 * resMult)
+
+# ------------------------------------------------------------------------------
+
+def _autoMapResolution(renderer, cam, numSamples, resMult, occlType):
+    # A resMult of None picks the map resolution from the scene, keeping the
+    # aspect ratio of the camera's nominal resolution
+    if resMult is None and occlType in (pvr.TransmittanceMapOccluder, 
+                                        pvr.OtfTransmittanceMapOccluder):
+        cam.setResolution(pvr.OccluderResolution.transmittanceMap(
+            renderer, cam, numSamples))
+
+# ------------------------------------------------------------------------------
+
 OCCLUDER_MAP = {
     pvr.TransmittanceMapOccluder : lambda renderer, cam, numSamples, _, __: 
         pvr.TransmittanceMapOccluder(renderer, cam, numSamples),
     pvr.OtfTransmittanceMapOccluder : lambda renderer, cam, numSamples, _, __:
         pvr.OtfTransmittanceMapOccluder(renderer, cam, numSamples),
     pvr.VoxelOccluder: lambda renderer, _, __, parms, resMult:
-        pvr.VoxelOccluder(renderer, parms['position'], int(256 * resMult)),
+        pvr.VoxelOccluder(renderer, parms['position'], 
+                          _voxelRes(renderer, resMult)),
+    pvr.SweepVoxelOccluder: lambda renderer, _, __, parms, resMult:
+        pvr.SweepVoxelOccluder(renderer, parms['position'], 
+                               _voxelRes(renderer, resMult)),
+    pvr.SparseVoxelOccluder: lambda renderer, _, __, parms, resMult:
+        pvr.SparseVoxelOccluder(renderer, parms['position'], 
+                                _voxelRes(renderer, resMult)),
+    pvr.FrustumVoxelOccluder: lambda renderer, cam, _, __, resMult:
+        pvr.FrustumVoxelOccluder(renderer, cam, 
+                                 int(256 * (resMult or 1.0))),
     pvr.OtfVoxelOccluder: lambda renderer, _, __, parms, resMult:
-        pvr.OtfVoxelOccluder(renderer, parms['position'], int(256 * resMult)), 
+        pvr.OtfVoxelOccluder(renderer, parms['position'], 
+                             _voxelRes(renderer, resMult)),
     pvr.RaymarchOccluder : lambda renderer, _, __, ___, ____:
         pvr.RaymarchOccluder(renderer),
 }
 
-def makePointLight(renderer, parms, resMult, occlType):
+# ------------------------------------------------------------------------------
+
+def _vecKey(v):
+    return "%r,%r,%r" % (v.x, v.y, v.z)
+
+# ------------------------------------------------------------------------------
+
+def _occluderKey(occlType, cam, numSamples, parms, resMult):
+    # Only the parameters that change an occluder's contents go into the key.
+    # Voxel occluders don't depend on the light's orientation or field of 
+    # view, so spot lights at the same position share them.
+    key = [occlType.__name__, repr(resMult)]
+    if occlType in (pvr.VoxelOccluder, pvr.SweepVoxelOccluder, 
+                    pvr.SparseVoxelOccluder, pvr.OtfVoxelOccluder):
+        key.append(_vecKey(parms["position"]))
+    elif occlType in (pvr.TransmittanceMapOccluder, 
+                      pvr.OtfTransmittanceMapOccluder,
+                      pvr.FrustumVoxelOccluder):
+        # Directional lights have a direction in place of a position
+        placement = parms["position"] if "position" in parms \
+            else parms["direction"]
+        key += [cam.__class__.__name__, _vecKey(placement), repr(numSamples)]
+        if "rotation" in parms:
+            key.append(_vecKey(parms["rotation"]))
+        if "fov" in parms:
+            key.append(repr(parms["fov"]))
+        if parms.get("solid_angle_sampling", False):
+            key.append("solid_angle_sampling")
+    return key
+
+# ------------------------------------------------------------------------------
+
+def _typeName(obj):
+    if obj:
+        return obj.typeName()
+    return "None"
+
+# ------------------------------------------------------------------------------
+
+def _renderTransmittanceMap(renderer, cam, numSamples):
+    mapRenderer = renderer.createView(cam)
+    mapRenderer.setPrimaryEnabled(False)
+    mapRenderer.setTransmittanceMapEnabled(True)
+    mapRenderer.setNumDeepSamples(numSamples)
+    mapRenderer.execute()
+    return mapRenderer.transmittanceMap()
+
+# ------------------------------------------------------------------------------
+
+def _writeAtomically(obj, path):
+    # Write to a temporary file next to path, then rename it into place, so 
+    # that processes sharing the cache never read a partial file. The 
+    # extension is kept since it decides the file format.
+    base, ext = os.path.splitext(path)
+    tmpPath = "%s.tmp%d%s" % (base, os.getpid(), ext)
+    if obj.write(tmpPath):
+        os.rename(tmpPath, path)
+
+# ------------------------------------------------------------------------------
+
+class OccluderCache(object):
+    """Keeps precomputed TransmittanceMapOccluder and VoxelOccluder data on 
+    disk, so that lights can reuse it from frame to frame instead of 
+    recomputing it. The scene key must change whenever the scene volume or 
+    the holdout geometry changes, for example by including the volume's file
+    name and frame number. Other occluder types are always built.
+
+    Files are renamed into place once written, so the processes of a split
+    render (see Renderer.setSplit()) can share a cache directory. Render 
+    the occluders once before starting the parts, or each part that finds
+    the cache empty computes them too."""
+    def __init__(self, directory, sceneKey):
+        self.directory = directory
+        self.sceneKey = str(sceneKey)
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+    def path(self, occlType, cam, numSamples, parms, resMult):
+        key = [self.sceneKey] + _occluderKey(occlType, cam, numSamples, parms,
+                                             resMult)
+        digest = hashlib.md5("|".join(key)).hexdigest()
+        if occlType in (pvr.VoxelOccluder, pvr.SweepVoxelOccluder,
+                        pvr.FrustumVoxelOccluder):
+            return os.path.join(self.directory, digest + ".f3d")
+        return os.path.join(self.directory, digest + ".pvrdeep")
+    def occluder(self, occlType, renderer, cam, numSamples, parms, resMult):
+        if occlType == pvr.TransmittanceMapOccluder:
+            path = self.path(occlType, cam, numSamples, parms, resMult)
+            tMap = None
+            if os.path.exists(path):
+                tMap = pvr.DeepImage.read(path)
+            if not tMap:
+                tMap = _renderTransmittanceMap(renderer, cam, numSamples)
+                _writeAtomically(tMap, path)
+            return pvr.TransmittanceMapOccluder(tMap, cam)
+        if occlType in (pvr.VoxelOccluder, pvr.SweepVoxelOccluder,
+                        pvr.FrustumVoxelOccluder):
+            path = self.path(occlType, cam, numSamples, parms, resMult)
+            occluder = None
+            if os.path.exists(path):
+                occluder = pvr.VoxelOccluder.read(path)
+            if not occluder:
+                occluder = OCCLUDER_MAP[occlType](renderer, cam, numSamples, 
+                                                  parms, resMult)
+                _writeAtomically(occluder, path)
+            return occluder
+        return OCCLUDER_MAP.get(occlType, lambda *args: pvr.NullOccluder())(
+            renderer, cam, numSamples, parms, resMult)
+
+# ------------------------------------------------------------------------------
+
+class OccluderRegistry(object):
+    """Hands out a single occluder instance for each distinct set of 
+    occluder parameters, so that co-located lights (for example lights that
+    only differ in color) share one precomputed buffer instead of building
+    and storing one each. Pass it to the make*Light() functions in place of
+    an OccluderCache.
+
+    As with OccluderCache, the scene key must change whenever the scene 
+    volume or the holdout geometry changes, and should include any 
+    raymarcher parameters that affect occlusion. The raymarcher types are 
+    added to the key automatically. If a cache is given, occluders missing
+    from the registry are loaded from or stored in it.
+
+    The registry can be used from the tasks of a TaskGraph. Each distinct 
+    occluder is still only built once, by whichever task asks for it first."""
+    def __init__(self, sceneKey, cache = None):
+        self.sceneKey = str(sceneKey)
+        self.cache = cache
+        self.occluders = {}
+        self.keyLocks = {}
+        self.lock = threading.Lock()
+    def occluder(self, occlType, renderer, cam, numSamples, parms, resMult):
+        key = tuple([self.sceneKey, _typeName(renderer.raymarcher()), 
+                     _typeName(renderer.shadowRaymarcher())] + 
+                    _occluderKey(occlType, cam, numSamples, parms, resMult))
+        # Builds of different occluders run concurrently, while tasks asking
+        # for the same one wait for the first build
+        with self.lock:
+            keyLock = self.keyLocks.setdefault(key, threading.Lock())
+        with keyLock:
+            occluder = self.occluders.get(key)
+            if occluder is None:
+                occluder = makeOccluder(renderer, cam, numSamples, parms, 
+                                        resMult, occlType, self.cache)
+                self.occluders[key] = occluder
+        return occluder
+    def clear(self):
+        """Drops all shared occluders, e.g. before moving to a new frame."""
+        with self.lock:
+            self.occluders = {}
+            self.keyLocks = {}
+
+# ------------------------------------------------------------------------------
+
+def makeOccluder(renderer, cam, numSamples, parms, resMult, occlType, cache):
+    if cache:
+        return cache.occluder(occlType, renderer, cam, numSamples, parms, 
+                              resMult)
+    return OCCLUDER_MAP.get(occlType, lambda *args: pvr.NullOccluder())(
+        renderer, cam, numSamples, parms, resMult)
+
+# ------------------------------------------------------------------------------
+
+def _setupOccluder(light, renderer, cam, numSamples, parms, resMult, occlType,
+                   cache, graph, deps):
+    # Without a graph the occluder is built right away. Otherwise its build
+    # is added as a task, which sets the occluder once deps are done.
+    build = lambda: light.setOccluder(
+        makeOccluder(renderer, cam, numSamples, parms, resMult, occlType, 
+                     cache))
+    if graph is None:
+        build()
+    else:
+        graph.add(build, deps, "%s occluder" % occlType.__name__)
+
+# ------------------------------------------------------------------------------
+
+def makePointLight(renderer, parms, resMult, occlType, cache = None, 
+                   graph = None, deps = ()):
     light = pvr.PointLight()
     cam = pvr.SphericalCamera()
     # Position
     light.setPosition(parms["position"])
     cam.setPosition(parms["position"])
     # Resolution
-    resolution = pvr.V2i(int(2048 * resMult), int(1024 * resMult))
+    mult = resMult or 1.0
+    resolution = pvr.V2i(int(2048 * mult), int(1024 * mult))
     cam.setResolution(resolution)
+    # Fewer samples and pixels near the poles of the map
+    if parms.get("solid_angle_sampling", False):
+        cam.setSolidAngleSampling(True)
+        cam.setSolidAngleResolution(True)
     # Intensity
     light.setIntensity(parms["intensity"])
 
     # Number of samples
     numSamples = parms.get("num_samples", 32)
+    _autoMapResolution(renderer, cam, numSamples, resMult, occlType)
 
     # Occluder
-    occluder = OCCLUDER_MAP.get(occlType, lambda *args: pvr.NullOccluder())(
-        renderer, cam, numSamples, parms, resMult)
-
-    light.setOccluder(occluder)
+    _setupOccluder(light, renderer, cam, numSamples, parms, resMult, 
+                   occlType, cache, graph, deps)
     return light
 
 # ------------------------------------------------------------------------------
 
-def makeSpotLight(renderer, parms, resMult, occlType):
+def makeSpotLight(renderer, parms, resMult, occlType, cache = None, 
+                  graph = None, deps = ()):
     light = pvr.SpotLight()
     cam = pvr.PerspectiveCamera()
     # Position
@@ -98,20 +313,55 @@ def makeSpotLight(renderer, parms, resMult, occlType):
     # FOV
     cam.setVerticalFOV(parms["fov"])
     # Resolution
-    resolution = pvr.V2i(int(1024 * resMult), int(1024 * resMult))
+    mult = resMult or 1.0
+    resolution = pvr.V2i(int(1024 * mult), int(1024 * mult))
     cam.setResolution(resolution)
+    # Number of samples
+    numSamples = parms.get("num_samples", 32)
+    _autoMapResolution(renderer, cam, numSamples, resMult, occlType)
     # Intensity
     light.setIntensity(parms["intensity"])
     # Camera
     light.setCamera(cam)
+
+    # Occluder
+    _setupOccluder(light, renderer, cam, numSamples, parms, resMult, 
+                   occlType, cache, graph, deps)
+    return light
+
+# ------------------------------------------------------------------------------
+
+def makeDirectionalLight(renderer, parms, resMult, occlType, cache = None, 
+                         graph = None, deps = ()):
+    """Creates a sun-like light. Its transmittance map is orthographic and 
+    fitted to the renderer's scene volume, so the volume must be set first, 
+    and occlType should use a camera (e.g. TransmittanceMapOccluder)."""
+    light = pvr.DirectionalLight()
+    # Direction
+    light.setDirection(parms["direction"])
+    # Intensity
+    light.setIntensity(parms["intensity"])
+    # Camera
+    cam = light.fitCamera(renderer, int(1024 * (resMult or 1.0)))
     # Number of samples
     numSamples = parms.get("num_samples", 32)
+    _autoMapResolution(renderer, cam, numSamples, resMult, occlType)
 
     # Occluder
-    occluder = OCCLUDER_MAP.get(occlType, lambda *args: pvr.NullOccluder())(
-            renderer, cam, numSamples, parms, resMult)
+    _setupOccluder(light, renderer, cam, numSamples, parms, resMult, 
+                   occlType, cache, graph, deps)
+    return light
+
+# ------------------------------------------------------------------------------
 
-    light.setOccluder(occluder)
+def makeEnvironmentLight(renderer, intensity, resMult, numDirections = 32,
+                         hemisphere = True):
+    """Creates a sky dome light. Its occlusion is precomputed once from the
+    renderer's scene, so the scene's volume must be set first."""
+    light = pvr.EnvironmentLight()
+    light.setIntensity(intensity)
+    light.setHemisphereEnabled(hemisphere)
+    light.precompute(renderer, int(32 * (resMult or 1.0)), numDirections)
     return light
 
 # ------------------------------------------------------------------------------
@@ -119,50 +369,74 @@ def makeSpotLight(renderer, parms, resMult, occlType):
 LIGHT_MAP = {
     pvr.SpotLight : makeSpotLight,
     pvr.PointLight: makePointLight,
+    pvr.DirectionalLight: makeDirectionalLight,
 }
 
-def makeLight(renderer, parms, resMult, occlType, lightType):
+def makeLight(renderer, parms, resMult, occlType, lightType, cache = None,
+              graph = None, deps = ()):
+    """Creates a light of the given type. If graph is given, the light is
+    returned right away and its occluder is built by a task of the graph, 
+    once the tasks in deps are done. The light must not be rendered until 
+    that task has finished. A resMult of None picks transmittance map and 
+    voxel occluder resolutions from the scene with pvr.OccluderResolution,
+    so the scene's volume and the renderer's camera must be set first."""
     try:
-        return LIGHT_MAP[lightType](renderer, parms, resMult, occlType)
+        return LIGHT_MAP[lightType](renderer, parms, resMult, occlType, cache,
+                                    graph, deps)
     except KeyError:
         print "Unrecognized light type (%s) in makeLight()" % lightType
 
 # ------------------------------------------------------------------------------
 
 def standardKey(renderer, resMult, occlType = __defaultOccluder,
-                lightType = __defaultLight):
-    return makeLight(renderer, __stdKeyLight, resMult, occlType, lightType)
+                lightType = __defaultLight, cache = None, graph = None, 
+                deps = ()):
+    return makeLight(renderer, __stdKeyLight, resMult, occlType, lightType, cache,
+                     graph, deps)
 
 # ------------------------------------------------------------------------------
 
 def standardFill(renderer, resMult, occlType = __defaultOccluder,
-                lightType = __defaultLight):
-    return makeLight(renderer, __stdFillLight, resMult, occlType, lightType)
+                lightType = __defaultLight, cache = None, graph = None, 
+                deps = ()):
+    return makeLight(renderer, __stdFillLight, resMult, occlType, lightType, cache,
+                     graph, deps)
 
 # ------------------------------------------------------------------------------
 
 def standardRim(renderer, resMult, occlType = __defaultOccluder,
-                lightType = __defaultLight):
-    return makeLight(renderer, __stdRimLight, resMult, occlType, lightType)
+                lightType = __defaultLight, cache = None, graph = None, 
+                deps = ()):
+    return makeLight(renderer, __stdRimLight, resMult, occlType, lightType, cache,
+                     graph, deps)
 
 # ------------------------------------------------------------------------------
 
 def standardThreePoint(renderer, resMult, occlType = __defaultOccluder,
-                lightType = __defaultLight):
-    return [standardKey(renderer, resMult, occlType, lightType), 
-            standardFill(renderer, resMult, occlType, lightType), 
-            standardRim(renderer, resMult, occlType, lightType)]
+                lightType = __defaultLight, cache = None, graph = None,
+                deps = ()):
+    # With a graph, the three occluders are built concurrently
+    return [standardKey(renderer, resMult, occlType, lightType, cache, graph,
+                        deps), 
+            standardFill(renderer, resMult, occlType, lightType, cache, graph,
+                         deps), 
+            standardRim(renderer, resMult, occlType, lightType, cache, graph,
+                        deps)]
 
 # ------------------------------------------------------------------------------
 
 def standardBehind(renderer, resMult, occlType = __defaultOccluder,
-                lightType = __defaultLight):
-    return makeLight(renderer, __stdBehindLight, resMult, occlType, lightType)
+                lightType = __defaultLight, cache = None, graph = None, 
+                deps = ()):
+    return makeLight(renderer, __stdBehindLight, resMult, occlType, lightType, cache,
+                     graph, deps)
 
 # ------------------------------------------------------------------------------
 
 def standardRight(renderer, resMult, occlType = __defaultOccluder,
-                lightType = __defaultLight):
-    return makeLight(renderer, __stdRightLight, resMult, occlType, lightType)
+                lightType = __defaultLight, cache = None, graph = None, 
+                deps = ()):
+    return makeLight(renderer, __stdRightLight, resMult, occlType, lightType, cache,
+                     graph, deps)
 
 # ------------------------------------------------------------------------------
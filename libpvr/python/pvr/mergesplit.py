@@ -0,0 +1,84 @@
+# ------------------------------------------------------------------------------
+# mergesplit.py
+# ------------------------------------------------------------------------------
+
+"""Assembles a frame that was rendered in parts with Renderer.setSplit().
+
+Each part leaves the pixels of the other parts zero in its image and empty
+in its deep images, so the parts can be merged in any order. Part images 
+must be EXR files, since other formats lose alpha and the data window.
+
+Usage: python -m pvr.mergesplit [--deep [--luminance]] output part [part...]
+"""
+
+import sys
+from optparse import OptionParser
+
+import pvr
+
+# ------------------------------------------------------------------------------
+
+def mergeImages(partPaths, outPath, channels = pvr.Channels.RGBA):
+    """Merges the part images into outPath. Returns False if a part 
+    couldn't be read."""
+    image = None
+    for path in partPaths:
+        part = pvr.Image.read(path)
+        if not part:
+            return False
+        if image:
+            image.merge(part)
+        else:
+            image = part
+    if not image:
+        return False
+    image.write(outPath, channels)
+    return True
+
+# ------------------------------------------------------------------------------
+
+def mergeDeepImages(partPaths, outPath, 
+                    contents = pvr.DeepImageContents.Transmittance):
+    """Merges the part deep images into outPath. Returns False if a part 
+    couldn't be read, or if the parts differ in size."""
+    image = None
+    for path in partPaths:
+        part = pvr.DeepImage.read(path)
+        if not part:
+            return False
+        if image:
+            if not image.merge(part):
+                return False
+        else:
+            image = part
+    if not image:
+        return False
+    image.compact()
+    return image.write(outPath, contents)
+
+# ------------------------------------------------------------------------------
+
+def main(args):
+    parser = OptionParser(usage = "%prog [options] output part [part...]")
+    parser.add_option("--deep", action = "store_true", default = False,
+                      help = "merge deep images instead of images")
+    parser.add_option("--luminance", action = "store_true", default = False,
+                      help = "deep images hold luminance, for EXR output")
+    options, paths = parser.parse_args(args)
+    if len(paths) < 2:
+        parser.error("need an output and at least one part")
+    if options.deep:
+        contents = pvr.DeepImageContents.Transmittance
+        if options.luminance:
+            contents = pvr.DeepImageContents.Luminance
+        ok = mergeDeepImages(paths[1:], paths[0], contents)
+    else:
+        ok = mergeImages(paths[1:], paths[0])
+    return 0 if ok else 1
+
+# ------------------------------------------------------------------------------
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
+
+# ------------------------------------------------------------------------------
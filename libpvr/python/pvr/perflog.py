@@ -0,0 +1,52 @@
+# ------------------------------------------------------------------------------
+# perflog.py
+# ------------------------------------------------------------------------------
+
+"""Records the statistics counters of every Renderer.execute() call in a
+process, so that scenes/regression_tests.py can collect them from render
+scripts without changing the scripts.
+
+When the PVR_STATS_FILE environment variable is set, importing pvr enables
+Stats and appends one JSON object per render to that file, mapping each
+counter name to its count.
+"""
+
+import json
+import os
+import threading
+
+import _pvr
+
+# ------------------------------------------------------------------------------
+
+_lock = threading.Lock()
+
+# ------------------------------------------------------------------------------
+
+def install(path):
+    """Enables Stats and makes Renderer.execute() append its statistics to
+    the given file. Calling it more than once has no further effect."""
+    if getattr(_pvr.Renderer, "_perflogPath", None):
+        return
+    _pvr.Stats.setEnabled(True)
+    execute = _pvr.Renderer.execute
+    def loggedExecute(self, *args):
+        result = execute(self, *args)
+        line = json.dumps(self.statistics(), sort_keys = True)
+        # Renders in a TaskGraph may finish at the same time
+        with _lock:
+            f = open(path, "a")
+            try:
+                f.write(line + "\n")
+            finally:
+                f.close()
+        return result
+    _pvr.Renderer.execute = loggedExecute
+    _pvr.Renderer._perflogPath = path
+
+# ------------------------------------------------------------------------------
+
+if "PVR_STATS_FILE" in os.environ:
+    install(os.environ["PVR_STATS_FILE"])
+
+# ------------------------------------------------------------------------------
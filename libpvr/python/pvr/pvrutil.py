@@ -2,6 +2,7 @@
 # pvrutil.py
 # ------------------------------------------------------------------------------
 
+import os
 from math import radians, degrees
 
 import pvr
@@ -86,8 +87,7 @@ def makeLights(filename, renderer, mult = 1.0):
                 cam.setVerticalFOV(fov)
                 cam.setResolution(res)
                 # Create map render job
-                mapRenderer = renderer.clone()
-                mapRenderer.setCamera(cam)
+                mapRenderer = renderer.createView(cam)
                 mapRenderer.setPrimaryEnabled(False)
                 mapRenderer.setTransmittanceMapEnabled(True)
                 mapRenderer.execute()
@@ -110,26 +110,68 @@ def makeLights(filename, renderer, mult = 1.0):
 # ------------------------------------------------------------------------------
 
 def setupTransmittanceMap(baseRenderer, light, resolution, orientation, fov, 
-                          raymarcherType, raymarcherParams, samplerType):
-    rend = baseRenderer.clone()
+                          raymarcherType, raymarcherParams, samplerType,
+                          cachePath = None, interleavedSamples = 0):
+    # If cachePath is given, the map is loaded from it when it exists, and 
+    # written to it otherwise. The caller is responsible for picking a path
+    # that changes whenever the scene volume or the light changes.
+    # If interleavedSamples is given, the map is resampled for faster 
+    # lookups. See DeepImage.interleave().
+    # If resolution is None, it is picked from the scene's voxel size and 
+    # the camera's footprint by pvr.OccluderResolution, for a square map 
+    # with DeepImage's default of 32 samples per pixel.
     cam = pvr.PerspectiveCamera()
     cam.setPosition(light.position())
     cam.setOrientation(orientation)
     cam.setVerticalFOV(fov)
+    if resolution is None:
+        cam.setResolution(pvr.V2i(1024, 1024))
+        resolution = pvr.OccluderResolution.transmittanceMap(
+            baseRenderer, cam, 32)
     cam.setResolution(resolution)
-    rend.setCamera(cam)
-    rend.setPrimaryEnabled(False)
-    rend.setTransmittanceMapEnabled(True)
-    rend.execute()
-    tMap = rend.transmittanceMap()
+    tMap = None
+    if cachePath and os.path.exists(cachePath):
+        tMap = pvr.DeepImage.read(cachePath)
+    if not tMap:
+        rend = baseRenderer.createView(cam)
+        rend.setPrimaryEnabled(False)
+        rend.setTransmittanceMapEnabled(True)
+        rend.execute()
+        tMap = rend.transmittanceMap()
+        if cachePath:
+            tMap.write(cachePath)
+    if interleavedSamples > 0:
+        tMap.interleave(interleavedSamples)
     tMap.printStats()
-    occluder = pvr.TransmittanceMapOccluder()
-    occluder.setTransmittanceMap(tMap)
-    occluder.setCamera(cam)
+    occluder = pvr.TransmittanceMapOccluder(tMap, cam)
     light.setOccluder(occluder)
 
 # ------------------------------------------------------------------------------
 
+def bakeVolume(volume, resolution, cachePath = None, sparse = True, 
+               camera = None, numThreads = 0):
+    # Returns a voxelized copy of volume, so that procedural volumes are 
+    # only evaluated once. If camera is given, the buffers are frustum 
+    # mapped to it. If cachePath is given, the baked volume is loaded from it
+    # when it exists, and written to it otherwise. The caller is responsible
+    # for picking a path that changes whenever the volume or the bake 
+    # settings change.
+    baker = pvr.VolumeBaker(volume)
+    if cachePath and os.path.exists(cachePath) and baker.read(cachePath):
+        return baker.volume()
+    baker.setResolution(resolution)
+    baker.setUseSparseBuffers(sparse)
+    baker.setNumThreads(numThreads)
+    if camera:
+        baker.setMapping(pvr.BakeMapping.FrustumMapping)
+        baker.setCamera(camera)
+    baker.execute()
+    if cachePath and baker.volume():
+        pvr.lights._writeAtomically(baker, cachePath)
+    return baker.volume()
+
+# ------------------------------------------------------------------------------
+
 def printArrayAttrs(table, namesFunc, refFunc, valFunc, typeStr):
     names = namesFunc()
     print "  " + typeStr + " attrs:"
@@ -0,0 +1,98 @@
+# ------------------------------------------------------------------------------
+# snapshot.py
+# ------------------------------------------------------------------------------
+
+"""Keeps the expensive parts of a scene on disk, so that re-renders that
+only change the camera or shading can skip Geometry.read(),
+Modeler.execute() and the occluder builds.
+
+A snapshot lives in a directory and is identified by a content hash of the
+modeling inputs: the bytes of the input files and any parameters the
+script passes. Change an input file or a parameter and the hash changes,
+so the scene is modeled again. Everything else, such as VoxelVolume
+attributes, interpolation and the lights, is cheap and stays in the script.
+
+    snapshot = pvr.snapshot.SceneSnapshot("/tmp/snapshots", [geoPath],
+                                          {"res": res, "radius": radius})
+    volume = snapshot.voxelVolume(lambda: buildModeler(geoPath, res, radius))
+    volume.addAttribute("density", pvr.V3f(10.0))
+    renderer.addVolume(volume)
+    lights = pvr.lights.standardThreePoint(renderer, resMult, occlType,
+                                           cache = snapshot.occluderCache(
+                                               "density 10"))
+"""
+
+import hashlib
+import os
+
+import pvr
+
+# ------------------------------------------------------------------------------
+
+def contentHash(paths, params = None):
+    """Returns a hex digest of the bytes of each of the given files, in
+    order, and of the repr() of each parameter, sorted by name if params is
+    a dict. File names aren't hashed, so moving an input doesn't invalidate
+    the snapshot."""
+    digest = hashlib.md5()
+    for path in paths:
+        with open(path, "rb") as f:
+            while True:
+                chunk = f.read(1 << 20)
+                if not chunk:
+                    break
+                digest.update(chunk)
+        digest.update(b"|")
+    if isinstance(params, dict):
+        params = sorted(params.items())
+    for param in params or ():
+        digest.update(repr(param).encode("utf-8"))
+        digest.update(b"|")
+    return digest.hexdigest()
+
+# ------------------------------------------------------------------------------
+
+class SceneSnapshot(object):
+    """Loads the modeled buffers and occluders of a scene from a directory
+    when its inputs haven't changed, and writes them there otherwise.
+
+    Files are renamed into place once written, like those of
+    pvr.lights.OccluderCache, so that several processes can share the
+    directory. Old snapshots are never removed."""
+    def __init__(self, directory, inputFiles, params = None):
+        self.directory = directory
+        self.key = contentHash(inputFiles, params)
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+    def bufferPath(self, name = "buffer"):
+        return os.path.join(self.directory, "%s.%s.f3d" % (self.key, name))
+    def hasBuffer(self, name = "buffer"):
+        return os.path.exists(self.bufferPath(name))
+    def voxelVolume(self, model, name = "buffer"):
+        """Returns a VoxelVolume holding the named buffer. If the snapshot
+        has no such buffer, model() is called to create it. It must return
+        a Modeler that has been executed, and its buffer is written to the
+        snapshot. Several buffers of one scene need different names."""
+        volume = pvr.VoxelVolume()
+        path = self.bufferPath(name)
+        if os.path.exists(path):
+            pvr.logPrint("Loading scene snapshot: " + path)
+            volume.load(path)
+            return volume
+        modeler = model()
+        volume.setBuffer(modeler.buffer())
+        base, ext = os.path.splitext(path)
+        tmpPath = "%s.tmp%d%s" % (base, os.getpid(), ext)
+        modeler.saveBuffer(tmpPath)
+        if os.path.exists(tmpPath):
+            os.rename(tmpPath, path)
+        return volume
+    def occluderCache(self, shadingKey = ""):
+        """Returns an OccluderCache for the snapshot, in the same directory
+        and keyed by the same hash. Pass it to the pvr.lights functions.
+        Occluders also depend on the volume attributes that scale density,
+        which the snapshot doesn't see, so pass them as the shading key."""
+        return pvr.lights.OccluderCache(self.directory, 
+                                        self.key + str(shadingKey))
+
+# ------------------------------------------------------------------------------
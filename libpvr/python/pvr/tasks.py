@@ -0,0 +1,105 @@
+# ------------------------------------------------------------------------------
+# tasks.py
+# ------------------------------------------------------------------------------
+
+"""Runs the stages of a frame as a graph of tasks, so that stages that don't
+depend on each other overlap instead of running one after the other.
+
+Each task runs on its own Python thread as soon as the tasks it depends on
+have finished. The long PVR calls (Modeler.execute(), VolumeBaker.execute(),
+occluder construction, Renderer.execute() and so on) release the GIL and
+share PVR's thread pool, so running several at once keeps the machine busy
+through the serial parts of each stage without oversubscribing it.
+
+Example:
+
+  graph = pvr.tasks.TaskGraph()
+  model = graph.add(modeler.execute)
+  lights = pvr.lights.standardThreePoint(renderer, 1.0, graph = graph,
+                                         deps = [model])
+  graph.add(renderer.execute, deps = graph.tasks())
+  graph.run()
+"""
+
+import threading
+import traceback
+
+# ------------------------------------------------------------------------------
+
+class TaskFailedError(RuntimeError):
+    """Raised by TaskGraph.run() when a task raised an exception."""
+    pass
+
+# ------------------------------------------------------------------------------
+
+class Task(object):
+    """A node in a TaskGraph. Created by TaskGraph.add()."""
+    def __init__(self, func, deps, name):
+        self.func = func
+        self.deps = list(deps)
+        self.name = name or getattr(func, "__name__", "task")
+        self.done = threading.Event()
+        self.value = None
+        self.error = None
+    def result(self):
+        """Returns the value returned by the task's function. Only valid
+        once the task is done, i.e. in tasks that depend on it or after
+        TaskGraph.run() has returned."""
+        return self.value
+    def _run(self):
+        try:
+            for dep in self.deps:
+                dep.done.wait()
+            failed = [dep.name for dep in self.deps if dep.error]
+            if failed:
+                self.error = "Skipped, since %s failed" % ", ".join(failed)
+            else:
+                self.value = self.func()
+        except Exception:
+            self.error = traceback.format_exc()
+        self.done.set()
+
+# ------------------------------------------------------------------------------
+
+class TaskGraph(object):
+    """Collects tasks and their dependencies, and runs them concurrently.
+    A task's function is called without arguments, and can get at the 
+    results of its dependencies through Task.result(). Dependencies must be
+    added before the tasks that use them, so the graph can't have cycles."""
+    def __init__(self):
+        self._tasks = []
+    def add(self, func, deps = (), name = None):
+        """Adds a task that calls func once all tasks in deps are done.
+        Returns the Task, which can be used as a dependency of later
+        tasks."""
+        for dep in deps:
+            if dep not in self._tasks:
+                raise ValueError("Dependency %s isn't part of the graph" %
+                                 dep.name)
+        task = Task(func, deps, name)
+        self._tasks.append(task)
+        return task
+    def tasks(self):
+        """Returns all tasks added so far."""
+        return list(self._tasks)
+    def run(self):
+        """Runs all tasks and waits for them to finish. Tasks whose
+        dependencies failed are skipped. Raises TaskFailedError naming each
+        failed task if any task raised an exception."""
+        threads = []
+        for task in self._tasks:
+            thread = threading.Thread(target = task._run, name = task.name)
+            thread.daemon = True
+            thread.start()
+            threads.append(thread)
+        # Join with a timeout, so that KeyboardInterrupt still reaches the
+        # calling thread
+        for thread in threads:
+            while thread.is_alive():
+                thread.join(0.1)
+        failed = [task for task in self._tasks if task.error]
+        if failed:
+            raise TaskFailedError("\n".join("%s: %s" % (task.name, task.error)
+                                            for task in failed))
+
+# ------------------------------------------------------------------------------
@@ -0,0 +1,154 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file AttrChannels.cpp
+  Contains implementations of AttrChannels class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/AttrChannels.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Geo {
+
+//----------------------------------------------------------------------------//
+// AttrChannels
+//----------------------------------------------------------------------------//
+
+AttrChannels::AttrChannels(const AttrTable &table, 
+                           const Util::ParamMap &globals)
+  : m_table(table), m_globals(globals), m_size(table.size())
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+void AttrChannels::add(const std::string &name, const float defaultValue)
+{
+  if (has(name)) {
+    return;
+  }
+
+  m_channelMap[name] = make_pair(m_channels.size(), 1);
+  m_channels.push_back(Channel(m_size));
+  Channel &channel = m_channels.back();
+
+  AttrRef ref = m_table.floatAttrRef(name);
+  if (ref.isValid() && ref.arraySize() == 1) {
+    const AttrTable::FloatVec &elems = m_table.floatAttrElems(ref);
+    std::copy(elems.begin(), elems.end(), channel.begin());
+  } else {
+    map<string, float>::const_iterator i = m_globals.floatMap.find(name);
+    const float value = i != m_globals.floatMap.end() ? i->second : 
+      defaultValue;
+    std::fill(channel.begin(), channel.end(), value);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void AttrChannels::add(const std::string &name, 
+                       const Imath::V3f &defaultValue)
+{
+  if (has(name)) {
+    return;
+  }
+
+  const size_t first = m_channels.size();
+  m_channelMap[name] = make_pair(first, 3);
+  m_channels.resize(first + 3, Channel(m_size));
+  if (m_size == 0) {
+    return;
+  }
+  float *x = &m_channels[first + 0][0];
+  float *y = &m_channels[first + 1][0];
+  float *z = &m_channels[first + 2][0];
+
+  AttrRef ref = m_table.vectorAttrRef(name);
+  if (ref.isValid() && ref.arraySize() == 1) {
+    // Transpose from interleaved V3f storage
+    const AttrTable::VectorVec &elems = m_table.vectorAttrElems(ref);
+    for (size_t i = 0; i < m_size; ++i) {
+      x[i] = elems[i].x;
+      y[i] = elems[i].y;
+      z[i] = elems[i].z;
+    }
+  } else {
+    map<string, Imath::V3f>::const_iterator i = 
+      m_globals.vectorMap.find(name);
+    const Imath::V3f value = i != m_globals.vectorMap.end() ? i->second : 
+      defaultValue;
+    std::fill(x, x + m_size, value.x);
+    std::fill(y, y + m_size, value.y);
+    std::fill(z, z + m_size, value.z);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool AttrChannels::has(const std::string &name) const
+{
+  return m_channelMap.find(name) != m_channelMap.end();
+}
+
+//----------------------------------------------------------------------------//
+
+AttrChannels::Span AttrChannels::span(const std::string &name, 
+                                      const size_t component) const
+{
+  ChannelMap::const_iterator i = m_channelMap.find(name);
+  if (i == m_channelMap.end() || component >= i->second.second) {
+    throw MissingChannelException(name);
+  }
+  const Channel &channel = m_channels[i->second.first + component];
+  return Span(channel.empty() ? NULL : &channel[0], channel.size());
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Geo
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
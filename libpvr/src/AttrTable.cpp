@@ -36,6 +36,7 @@
 #include <cassert>
 #include <string>
 #include <algorithm>
+#include <new>
 
 // Project includes
 
@@ -103,6 +104,61 @@ namespace {
     }
   }
 
+  //! log2 of the number of elements per AttrAppender page
+  const size_t k_pageBits = 16;
+  //! Number of elements per AttrAppender page
+  const size_t k_pageSize = size_t(1) << k_pageBits;
+  //! Size of the AttrAppender page directory. Limits an appender to 2^30
+  //! elements between commits.
+  const size_t k_maxPages = 1 << 14;
+
+  //--------------------------------------------------------------------------//
+
+  //! Fills one page column per attribute with the attribute's defaults
+  template <typename T>
+  void initPageColumns(const vector<AttrArray<T> > &attrs, 
+                       vector<vector<T> > &columns)
+  {
+    columns.resize(attrs.size());
+    for (size_t i = 0, size = attrs.size(); i < size; ++i) {
+      const size_t     arraySize = attrs[i].arraySize();
+      const vector<T> &defaults  = attrs[i].defaults();
+      columns[i].resize(k_pageSize * arraySize);
+      for (size_t j = 0, end = columns[i].size(); j < end; ++j) {
+        columns[i][j] = defaults[j % arraySize];
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the bytes of one page column per attribute
+  template <typename T>
+  size_t pageColumnsMemSize(const vector<AttrArray<T> > &attrs)
+  {
+    size_t bytes = 0;
+    for (size_t i = 0, size = attrs.size(); i < size; ++i) {
+      bytes += k_pageSize * attrs[i].arraySize() * sizeof(T);
+    }
+    return bytes;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the memory allocated for the elements of each column
+  template <typename AttrVec_T>
+  size_t columnMemSize(const AttrVec_T &attrArrays)
+  {
+    typedef typename AttrVec_T::value_type::value_type T;
+    typedef typename AttrVec_T::const_iterator Iter;
+    size_t bytes = 0;
+    for (Iter attr = attrArrays.begin(), end = attrArrays.end(); 
+         attr != end; ++attr) {
+      bytes += attr->elems.capacity() * sizeof(T);
+    }
+    return bytes;
+  }
+
   //--------------------------------------------------------------------------//
 
   template <typename Attr_T>
@@ -227,7 +283,7 @@ namespace Geo {
 //----------------------------------------------------------------------------//
 
 AttrTable::AttrTable()
-  : m_size(0)
+  : m_size(0), m_memory(Sys::Memory::Geometry)
 {
   // Empty
 }
@@ -250,6 +306,7 @@ void AttrTable::resize(const size_t size)
   clearAndResize(m_stringIdxAttrs, size);
   // Update size
   m_size = size;
+  updateMemory();
 }
 
 //----------------------------------------------------------------------------//
@@ -270,6 +327,23 @@ void AttrTable::addElems(const size_t numItems)
   addElemUtil(m_stringIdxAttrs, numItems);
   // Update size
   m_size += numItems;
+  // Columns grow geometrically, so this rarely reaches the accounting
+  updateMemory();
+}
+
+//----------------------------------------------------------------------------//
+
+size_t AttrTable::memSize() const
+{
+  return columnMemSize(m_intAttrs) + columnMemSize(m_floatAttrs) + 
+    columnMemSize(m_vectorAttrs) + columnMemSize(m_stringIdxAttrs);
+}
+
+//----------------------------------------------------------------------------//
+
+void AttrTable::updateMemory()
+{
+  m_memory.track(memSize());
 }
 
 //----------------------------------------------------------------------------//
@@ -308,6 +382,7 @@ AttrRef AttrTable::addIntAttr(const std::string &attrName, const size_t size,
 {
   checkForExistingAttr(m_intAttrs, attrName);
   m_intAttrs.push_back(IntAttr(attrName, size, defaults, m_size));
+  updateMemory();
   return intAttrRef(attrName);
 }
 
@@ -319,6 +394,7 @@ AttrRef AttrTable::addFloatAttr(const std::string &attrName, const size_t size,
 {
   checkForExistingAttr(m_floatAttrs, attrName);
   m_floatAttrs.push_back(FloatAttr(attrName, size, defaults, m_size));
+  updateMemory();
   return floatAttrRef(attrName);
 }
 
@@ -332,6 +408,7 @@ AttrRef AttrTable::addVectorAttr(const std::string &attrName,
   vector<Imath::V3f> defaultVec;
   defaultVec.push_back(defaults);
   m_vectorAttrs.push_back(VectorAttr(attrName, 1, defaultVec, m_size));
+  updateMemory();
   return vectorAttrRef(attrName);
 }
 
@@ -348,6 +425,7 @@ AttrRef AttrTable::addStringAttr(const std::string &attrName)
   // Set up the string table
   StringVec initial = createInitialStringVec();
   m_stringTables.push_back(initial);
+  updateMemory();
   // Return index of newly created attr
   return stringAttrRef(attrName);
 }
@@ -589,6 +667,233 @@ AttrTable::addStringToTable(const AttrRef &ref, const std::string &s)
 
 //----------------------------------------------------------------------------//
 
+size_t AttrTable::stringTableSize(const AttrRef &ref) const
+{
+  checkRefValid(ref);
+  return m_stringTables[ref.idx()].size();
+}
+
+//----------------------------------------------------------------------------//
+// AttrAppender
+//----------------------------------------------------------------------------//
+
+AttrAppender::AttrAppender(AttrTable &table)
+  : m_table(table), m_first(table.size()), m_size(0), m_numPages(0),
+    m_pageBytes(pageColumnsMemSize(table.m_intAttrs) + 
+                pageColumnsMemSize(table.m_floatAttrs) + 
+                pageColumnsMemSize(table.m_vectorAttrs) + 
+                pageColumnsMemSize(table.m_stringIdxAttrs)),
+    m_pages(new boost::atomic<Page*>[k_maxPages])
+{
+  for (size_t i = 0; i < k_maxPages; ++i) {
+    m_pages[i] = NULL;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+AttrAppender::~AttrAppender()
+{
+  clearPages();
+}
+
+//----------------------------------------------------------------------------//
+
+AttrAppender::Ptr AttrAppender::create(AttrTable &table)
+{
+  return Ptr(new AttrAppender(table));
+}
+
+//----------------------------------------------------------------------------//
+
+size_t AttrAppender::reserveElems(const size_t numItems)
+{
+  const size_t capacity = k_maxPages * k_pageSize;
+  size_t first = m_size.load();
+  do {
+    if (numItems > capacity - first) {
+      throw CapacityException(lexical_cast<string>(capacity) + " elements");
+    }
+  } while (!m_size.compare_exchange_weak(first, first + numItems));
+  // Allocate the pages up front, so element access only has to look them up
+  if (numItems > 0) {
+    for (size_t i = first >> k_pageBits, 
+           end = ((first + numItems - 1) >> k_pageBits) + 1; i < end; ++i) {
+      page(i);
+    }
+  }
+  return m_first + first;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t AttrAppender::size() const
+{
+  return m_size;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t AttrAppender::memSize() const
+{
+  return m_numPages * m_pageBytes;
+}
+
+//----------------------------------------------------------------------------//
+
+//! \todo Not exception safe.
+void AttrAppender::commit()
+{
+  if (m_table.size() != m_first) {
+    throw TableChangedException("size is " + 
+                                lexical_cast<string>(m_table.size()) + 
+                                ", expected " + 
+                                lexical_cast<string>(m_first));
+  }
+  const size_t numItems = m_size;
+  if (numItems > 0) {
+    // Pages hold the attributes that existed when they were allocated
+    const Page &first = page(0);
+    if (first.ints.size() != m_table.m_intAttrs.size() || 
+        first.floats.size() != m_table.m_floatAttrs.size() || 
+        first.vectors.size() != m_table.m_vectorAttrs.size() || 
+        first.stringIdxs.size() != m_table.m_stringIdxAttrs.size()) {
+      throw TableChangedException("attributes were added");
+    }
+    commitColumns(m_table.m_intAttrs, &Page::ints);
+    commitColumns(m_table.m_floatAttrs, &Page::floats);
+    commitColumns(m_table.m_vectorAttrs, &Page::vectors);
+    commitColumns(m_table.m_stringIdxAttrs, &Page::stringIdxs);
+    m_table.m_size += numItems;
+    m_table.updateMemory();
+  }
+  clearPages();
+  m_first = m_table.size();
+  m_size  = 0;
+}
+
+//----------------------------------------------------------------------------//
+
+int* AttrAppender::intElem(const AttrRef &ref, const size_t elem)
+{
+  return elemValues(&Page::ints, ref, elem);
+}
+
+//----------------------------------------------------------------------------//
+
+float* AttrAppender::floatElem(const AttrRef &ref, const size_t elem)
+{
+  return elemValues(&Page::floats, ref, elem);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f* AttrAppender::vectorElem(const AttrRef &ref, const size_t elem)
+{
+  return elemValues(&Page::vectors, ref, elem);
+}
+
+//----------------------------------------------------------------------------//
+
+size_t* AttrAppender::stringIdxElem(const AttrRef &ref, const size_t elem)
+{
+  return elemValues(&Page::stringIdxs, ref, elem);
+}
+
+//----------------------------------------------------------------------------//
+
+AttrAppender::Page& AttrAppender::page(const size_t idx)
+{
+  Page *page = m_pages[idx].load(boost::memory_order_acquire);
+  if (page) {
+    return *page;
+  }
+  Page *fresh = new Page;
+  try {
+    initPageColumns(m_table.m_intAttrs, fresh->ints);
+    initPageColumns(m_table.m_floatAttrs, fresh->floats);
+    initPageColumns(m_table.m_vectorAttrs, fresh->vectors);
+    initPageColumns(m_table.m_stringIdxAttrs, fresh->stringIdxs);
+  }
+  catch (bad_alloc &e) {
+    delete fresh;
+    throw AttrTable::AttrResizeException("");
+  }
+  // Another thread may have allocated the page in the meantime
+  if (m_pages[idx].compare_exchange_strong(page, fresh, 
+                                           boost::memory_order_acq_rel)) {
+    m_numPages++;
+    return *fresh;
+  }
+  delete fresh;
+  return *page;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+T* AttrAppender::elemValues(std::vector<std::vector<T> > Page::*columns, 
+                            const AttrRef &ref, const size_t elem)
+{
+  checkRefValid(ref);
+  if (elem < m_first) {
+    throw AttrTable::ElemIdxException
+      (lexical_cast<string>(elem) + 
+       " (first appended is " + lexical_cast<string>(m_first) + ")");
+  }
+  checkElemRange(elem - m_first, m_size);
+  const size_t        i           = elem - m_first;
+  vector<vector<T> > &pageColumns = page(i >> k_pageBits).*columns;
+  if (ref.idx() >= pageColumns.size()) {
+    throw AttrTable::AttrInvalidException(lexical_cast<string>(ref.idx()));
+  }
+  return &pageColumns[ref.idx()][(i & (k_pageSize - 1)) * ref.arraySize()];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void AttrAppender::commitColumns(std::vector<AttrArray<T> > &attrs, 
+                                 std::vector<std::vector<T> > Page::*columns)
+{
+  const size_t numItems = m_size;
+  const size_t numPages = ((numItems - 1) >> k_pageBits) + 1;
+  for (size_t a = 0, size = attrs.size(); a < size; ++a) {
+    AttrArray<T> &attr      = attrs[a];
+    const size_t  arraySize = attr.arraySize();
+    vector<T>     elems;
+    try {
+      elems.reserve((m_first + numItems) * arraySize);
+    }
+    catch (bad_alloc &e) {
+      throw AttrTable::AttrResizeException("");
+    }
+    elems.insert(elems.end(), attr.elems.begin(), attr.elems.end());
+    swapClear(attr.elems);
+    for (size_t p = 0; p < numPages; ++p) {
+      vector<vector<T> > &pageColumns = page(p).*columns;
+      const size_t rows = std::min(k_pageSize, numItems - p * k_pageSize);
+      elems.insert(elems.end(), pageColumns[a].begin(), 
+                   pageColumns[a].begin() + rows * arraySize);
+      swapClear(pageColumns[a]);
+    }
+    attr.elems.swap(elems);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void AttrAppender::clearPages()
+{
+  for (size_t i = 0, end = (m_size + k_pageSize - 1) >> k_pageBits; 
+       i < end && i < k_maxPages; ++i) {
+    delete m_pages[i].exchange(NULL);
+  }
+  m_numPages = 0;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Geo
 } // namespace pvr
 
@@ -119,7 +119,8 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
 
   AttrRef ref = points.intAttrRef(attr.name());
   if (ref.isValid() && ref.arraySize() == 1) {
-    attr.setIterator(points.intAttrElems(ref).begin());
+    const std::vector<int> &elems = points.intAttrElems(ref);
+    attr.setData(elems.empty() ? NULL : &elems[0]);
     attr.setActive(true);
   } else {
     int defaultValue;
@@ -131,6 +132,7 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
       // No default value found in globals map. Revert to PointArrayAttr's
       // own default.
     }
+    attr.setData(NULL);
     attr.setActive(false);
   }
 }
@@ -146,7 +148,8 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
 
   AttrRef ref = points.floatAttrRef(attr.name());
   if (ref.isValid() && ref.arraySize() == 1) {
-    attr.setIterator(points.floatAttrElems(ref).begin());
+    const std::vector<float> &elems = points.floatAttrElems(ref);
+    attr.setData(elems.empty() ? NULL : &elems[0]);
     attr.setActive(true);
   } else {
     float defaultValue;
@@ -158,6 +161,7 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
       // No default value found in globals map. Revert to PointArrayAttr's
       // own default.
     }
+    attr.setData(NULL);
     attr.setActive(false);
   }
 }
@@ -174,7 +178,8 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
 
   AttrRef ref = points.vectorAttrRef(attr.name());
   if (ref.isValid() && ref.arraySize() == 1) {
-    attr.setIterator(points.vectorAttrElems(ref).begin());
+    const std::vector<Imath::V3f> &elems = points.vectorAttrElems(ref);
+    attr.setData(elems.empty() ? NULL : &elems[0]);
     attr.setActive(true);
   } else {
     Imath::V3f defaultValue;
@@ -186,6 +191,7 @@ void initialize(const AttrTable &points, const Util::ParamMap &globals,
       // No default value found in globals map. Revert to PointArrayAttr's
       // own default.
     }
+    attr.setData(NULL);
     attr.setActive(false);
   }
 }
@@ -0,0 +1,411 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlockCache.cpp
+  Contains implementations of BlockCache class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/BlockCache.h"
+
+// System includes
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <list>
+#include <map>
+#include <utility>
+
+// Library includes
+
+#include <boost/atomic.hpp>
+#include <boost/thread/tss.hpp>
+
+#ifdef PVR_USE_LZ4
+#include <lz4.h>
+#endif
+
+// Project includes
+
+#include "pvr/Log.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Default per-thread memory limit, in megabytes
+  const float k_defaultMemoryLimit = 32.0f;
+
+  //--------------------------------------------------------------------------//
+
+  //! A decompressed block
+  struct Entry
+  {
+    std::pair<size_t, size_t>  key;
+    std::vector<unsigned char> data;
+  };
+
+  typedef std::list<Entry>                                   EntryList;
+  typedef std::map<std::pair<size_t, size_t>,
+                   EntryList::iterator>                      EntryMap;
+
+  //--------------------------------------------------------------------------//
+
+  //! The blocks decompressed by one thread, most recently used first
+  struct ThreadCache
+  {
+    ThreadCache()
+      : bytes(0)
+    { }
+    EntryList                  entries;
+    EntryMap                   index;
+    //! Total size of the entries' data
+    size_t                     bytes;
+    //! Holds shuffled bytes during compression and decompression
+    std::vector<unsigned char> scratch;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  boost::thread_specific_ptr<ThreadCache> g_threadCache;
+  boost::atomic<size_t>                   g_nextBufferId(0);
+  boost::atomic<long>                     g_numMisses(0);
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the calling thread's cache, creating it if needed
+  ThreadCache& threadCache()
+  {
+    ThreadCache *cache = g_threadCache.get();
+    if (!cache) {
+      cache = new ThreadCache;
+      g_threadCache.reset(cache);
+    }
+    return *cache;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Gathers byte b of every word into plane b
+  void shuffle(const unsigned char *in, const size_t bytes,
+               const size_t wordSize, unsigned char *out)
+  {
+    const size_t numWords = bytes / wordSize;
+    for (size_t b = 0; b < wordSize; ++b) {
+      for (size_t i = 0; i < numWords; ++i) {
+        out[b * numWords + i] = in[i * wordSize + b];
+      }
+    }
+    // Any trailing partial word is copied as-is
+    std::copy(in + numWords * wordSize, in + bytes, out + numWords * wordSize);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Inverse of shuffle()
+  void unshuffle(const unsigned char *in, const size_t bytes,
+                 const size_t wordSize, unsigned char *out)
+  {
+    const size_t numWords = bytes / wordSize;
+    for (size_t b = 0; b < wordSize; ++b) {
+      for (size_t i = 0; i < numWords; ++i) {
+        out[i * wordSize + b] = in[b * numWords + i];
+      }
+    }
+    std::copy(in + numWords * wordSize, in + bytes, out + numWords * wordSize);
+  }
+
+  //--------------------------------------------------------------------------//
+
+#ifndef PVR_USE_LZ4
+
+  //! Run-length encodes bytes. A control byte below 128 is followed by
+  //! that many plus one literal bytes. Other control bytes are followed by
+  //! a single byte that repeats the control byte minus 125 times.
+  void encodeRuns(const unsigned char *in, const size_t bytes,
+                  std::vector<unsigned char> &out)
+  {
+    out.clear();
+    size_t i = 0;
+    while (i < bytes) {
+      size_t run = 1;
+      while (i + run < bytes && run < 130 && in[i + run] == in[i]) {
+        ++run;
+      }
+      if (run >= 3) {
+        out.push_back(static_cast<unsigned char>(run + 125));
+        out.push_back(in[i]);
+        i += run;
+        continue;
+      }
+      // Gather literals until a run of three starts
+      const size_t first = i;
+      while (i < bytes && i - first < 128 &&
+             !(i + 2 < bytes && in[i] == in[i + 1] && in[i] == in[i + 2])) {
+        ++i;
+      }
+      out.push_back(static_cast<unsigned char>(i - first - 1));
+      out.insert(out.end(), in + first, in + i);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Inverse of encodeRuns()
+  void decodeRuns(const std::vector<unsigned char> &in, unsigned char *out,
+                  const size_t bytes)
+  {
+    size_t o = 0;
+    for (size_t i = 0, size = in.size(); i < size; ) {
+      const unsigned char control = in[i++];
+      if (control < 128) {
+        const size_t count = control + 1;
+        assert(o + count <= bytes && i + count <= size);
+        std::memcpy(out + o, &in[i], count);
+        i += count;
+        o += count;
+      } else {
+        const size_t count = control - 125;
+        assert(o + count <= bytes && i < size);
+        std::memset(out + o, in[i++], count);
+        o += count;
+      }
+    }
+    assert(o == bytes && "Corrupt compressed block");
+  }
+
+#endif
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// BlockCache static member instantiation
+//----------------------------------------------------------------------------//
+
+float BlockCache::ms_memoryLimit = k_defaultMemoryLimit;
+
+//----------------------------------------------------------------------------//
+// BlockCache implementations
+//----------------------------------------------------------------------------//
+
+void BlockCache::setMemoryLimit(const float megabytes)
+{
+  ms_memoryLimit = std::max(megabytes, 0.0f);
+  Log::print("Compressed block cache limit: " + str(ms_memoryLimit) +
+             " MB per thread");
+}
+
+//----------------------------------------------------------------------------//
+
+float BlockCache::memoryLimit()
+{
+  return ms_memoryLimit;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t BlockCache::newBufferId()
+{
+  return g_nextBufferId++;
+}
+
+//----------------------------------------------------------------------------//
+
+const void* BlockCache::find(const size_t bufferId, const size_t block)
+{
+  ThreadCache *cache = g_threadCache.get();
+  if (!cache || cache->entries.empty()) {
+    return NULL;
+  }
+  // Consecutive lookups mostly hit the same block
+  const std::pair<size_t, size_t> key(bufferId, block);
+  if (cache->entries.front().key == key) {
+    return &cache->entries.front().data[0];
+  }
+  EntryMap::iterator i = cache->index.find(key);
+  if (i == cache->index.end()) {
+    return NULL;
+  }
+  cache->entries.splice(cache->entries.begin(), cache->entries, i->second);
+  return &i->second->data[0];
+}
+
+//----------------------------------------------------------------------------//
+
+void* BlockCache::insert(const size_t bufferId, const size_t block,
+                         const size_t bytes)
+{
+  ThreadCache &cache = threadCache();
+  const std::pair<size_t, size_t> key(bufferId, block);
+  assert(cache.index.find(key) == cache.index.end());
+
+  g_numMisses++;
+
+  // Evict until the block fits, keeping the memory of the last evicted
+  // entry for the new one
+  const size_t limit = static_cast<size_t>(ms_memoryLimit * 1024 * 1024);
+  EntryList spare;
+  while (!cache.entries.empty() && cache.bytes + bytes > limit) {
+    Entry &last = cache.entries.back();
+    cache.bytes -= last.data.size();
+    cache.index.erase(last.key);
+    spare.clear();
+    spare.splice(spare.begin(), cache.entries, --cache.entries.end());
+  }
+  if (spare.empty()) {
+    spare.push_back(Entry());
+  }
+  cache.entries.splice(cache.entries.begin(), spare);
+
+  Entry &entry = cache.entries.front();
+  entry.key = key;
+  entry.data.resize(std::max(bytes, static_cast<size_t>(1)));
+  cache.bytes += entry.data.size();
+  cache.index[key] = cache.entries.begin();
+  return &entry.data[0];
+}
+
+//----------------------------------------------------------------------------//
+
+bool BlockCache::compress(const void *data, const size_t bytes,
+                          const size_t wordSize,
+                          std::vector<unsigned char> &packed)
+{
+  packed.clear();
+  if (bytes == 0) {
+    return false;
+  }
+
+  std::vector<unsigned char> &shuffled = threadCache().scratch;
+  shuffled.resize(bytes);
+  shuffle(static_cast<const unsigned char *>(data), bytes, wordSize,
+          &shuffled[0]);
+
+#ifdef PVR_USE_LZ4
+  packed.resize(LZ4_compressBound(static_cast<int>(bytes)));
+  const int size =
+    LZ4_compress_default(reinterpret_cast<const char *>(&shuffled[0]),
+                         reinterpret_cast<char *>(&packed[0]),
+                         static_cast<int>(bytes),
+                         static_cast<int>(packed.size()));
+  packed.resize(std::max(size, 0));
+#else
+  encodeRuns(&shuffled[0], bytes, packed);
+#endif
+
+  if (packed.empty() || packed.size() >= bytes) {
+    std::vector<unsigned char>().swap(packed);
+    return false;
+  }
+  // Don't keep the slack of the worst case output
+  std::vector<unsigned char>(packed).swap(packed);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void BlockCache::decompress(const std::vector<unsigned char> &packed,
+                            const size_t wordSize, void *data,
+                            const size_t bytes)
+{
+  std::vector<unsigned char> &shuffled = threadCache().scratch;
+  shuffled.resize(bytes);
+
+#ifdef PVR_USE_LZ4
+  const int size =
+    LZ4_decompress_safe(reinterpret_cast<const char *>(&packed[0]),
+                        reinterpret_cast<char *>(&shuffled[0]),
+                        static_cast<int>(packed.size()),
+                        static_cast<int>(bytes));
+  assert(size == static_cast<int>(bytes) && "Corrupt compressed block");
+  (void)size;
+#else
+  decodeRuns(packed, &shuffled[0], bytes);
+#endif
+
+  unshuffle(&shuffled[0], bytes, wordSize, static_cast<unsigned char *>(data));
+}
+
+//----------------------------------------------------------------------------//
+
+std::string BlockCache::codecName()
+{
+#ifdef PVR_USE_LZ4
+  return "shuffle+lz4";
+#else
+  return "shuffle+rle";
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+long BlockCache::numMisses()
+{
+  return g_numMisses;
+}
+
+//----------------------------------------------------------------------------//
+
+void BlockCache::resetStatistics()
+{
+  g_numMisses = 0;
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<std::string> BlockCache::info()
+{
+  std::vector<std::string> info;
+  info.push_back("Codec: " + codecName());
+  info.push_back("Memory limit: " + str(ms_memoryLimit) + " MB per thread");
+  info.push_back("Misses (block decompressions): " + str(numMisses()));
+  return info;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
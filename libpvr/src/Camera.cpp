@@ -38,6 +38,9 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+
 // Project includes
 
 #include "pvr/RenderGlobals.h"
@@ -71,7 +74,7 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 Camera::Camera()
-  : m_resolution(640, 480), m_numSamples(2)
+  : m_resolution(640, 480), m_numSamples(2), m_isStatic(false)
 {
   Camera::recomputeTransforms();
 }
@@ -164,6 +167,15 @@ Vector Camera::cameraToWorld(const Vector &csP, const PTime time) const
 
 //----------------------------------------------------------------------------//
 
+void Camera::worldToRasterAndCamera(const Vector &wsP, const PTime time,
+                                    Vector &rsP, Vector &csP) const
+{
+  rsP = worldToRaster(wsP, time);
+  csP = worldToCamera(wsP, time);
+}
+
+//----------------------------------------------------------------------------//
+
 const Camera::MatrixVec& Camera::worldToCameraMatrices() const
 {
   return m_worldToCamera;
@@ -190,6 +202,11 @@ void Camera::recomputeTransforms()
     m_cameraToWorld[i] = computeCameraToWorld(time);
     m_worldToCamera[i] = m_cameraToWorld[i].inverse();
   }
+
+  m_isStatic = true;
+  for (unsigned int i = 1; i < m_numSamples; ++i) {
+    m_isStatic = m_isStatic && m_cameraToWorld[i] == m_cameraToWorld[0];
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -198,13 +215,13 @@ Vector Camera::transformPoint(const Vector &p,
                               const std::vector<Matrix> &matrices,
                               const PTime time) const
 {
+  if (m_isStatic) {
+    return p * matrices[0];
+  }
   // Calculate which interval to interpolate in
-  double stepSize   = 1.0 / static_cast<float>(m_numSamples - 1);
-  double t          = time / stepSize;
-  unsigned int   first      = static_cast<unsigned int>(std::floor(t));
-  unsigned int   second     = first + 1;
-  second            = std::min(second, m_numSamples - 1);
-  double lerpFactor = t - static_cast<double>(first);
+  unsigned int first, second;
+  double       lerpFactor;
+  timeSamples(time, first, second, lerpFactor);
   // Transform point twice
   Vector t0         = p * matrices[first];
   Vector t1         = p * matrices[second];
@@ -214,6 +231,47 @@ Vector Camera::transformPoint(const Vector &p,
 
 //----------------------------------------------------------------------------//
 
+void Camera::timeSamples(const PTime time, unsigned int &first, 
+                         unsigned int &second, double &lerpFactor) const
+{
+  double stepSize = 1.0 / static_cast<float>(m_numSamples - 1);
+  double t        = time / stepSize;
+  first           = static_cast<unsigned int>(std::floor(t));
+  second          = std::min(first + 1, m_numSamples - 1);
+  lerpFactor      = t - static_cast<double>(first);
+}
+
+//----------------------------------------------------------------------------//
+
+Ray Camera::rasterRay(const float rsX, const float rsY, 
+                      const PTime time) const
+{
+  return Ray(position(time), rasterToWorld(Vector(rsX, rsY, 1.0), time));
+}
+
+//----------------------------------------------------------------------------//
+
+double Camera::rayDistance(const Vector &wsP, const PTime time) const
+{
+  return (wsP - position(time)).length();
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Camera::pixelStride(const size_t /* y */) const
+{
+  return 1;
+}
+
+//----------------------------------------------------------------------------//
+
+float Camera::pixelSampleDensity(const size_t /* y */) const
+{
+  return 1.0f;
+}
+
+//----------------------------------------------------------------------------//
+
 Matrix Camera::computeCameraToWorld(const PTime time) const
 {
   // Interpolate current position and orientation
@@ -310,6 +368,53 @@ bool PerspectiveCamera::canTransformNegativeCamZ() const
 
 //----------------------------------------------------------------------------//
 
+Ray PerspectiveCamera::rasterRay(const float rsX, const float rsY, 
+                                 const PTime time) const
+{
+  if (m_isStatic) {
+    const RasterPlane &plane = m_rasterPlanes[0];
+    return Ray(m_staticPosition, 
+               plane.origin + plane.dx * rsX + plane.dy * rsY);
+  }
+  // Interpolate the same way as rasterToWorld()
+  unsigned int first, second;
+  double       lerpFactor;
+  timeSamples(time, first, second, lerpFactor);
+  const RasterPlane &p0  = m_rasterPlanes[first];
+  const RasterPlane &p1  = m_rasterPlanes[second];
+  const Vector       ws0 = p0.origin + p0.dx * rsX + p0.dy * rsY;
+  const Vector       ws1 = p1.origin + p1.dx * rsX + p1.dy * rsY;
+  return Ray(position(time), lerp(ws0, ws1, lerpFactor));
+}
+
+//----------------------------------------------------------------------------//
+
+double PerspectiveCamera::rayDistance(const Vector &wsP, 
+                                      const PTime time) const
+{
+  if (m_isStatic) {
+    return (wsP - m_staticPosition).length();
+  }
+  return Camera::rayDistance(wsP, time);
+}
+
+//----------------------------------------------------------------------------//
+
+void PerspectiveCamera::worldToRasterAndCamera(const Vector &wsP, 
+                                               const PTime time,
+                                               Vector &rsP, 
+                                               Vector &csP) const
+{
+  if (m_isStatic) {
+    csP = wsP * m_worldToCamera[0];
+    rsP = csP * m_cameraToRaster;
+    return;
+  }
+  Camera::worldToRasterAndCamera(wsP, time, rsP, csP);
+}
+
+//----------------------------------------------------------------------------//
+
 void PerspectiveCamera::recomputeTransforms()
 {
   Camera::recomputeTransforms();
@@ -326,11 +431,34 @@ void PerspectiveCamera::recomputeTransforms()
     PTime time(Math::parametric(i, m_numSamples));
     // Compute matrices
     getTransforms(time, cameraToScreen, screenToRaster);
+    m_cameraToRaster   = cameraToScreen * screenToRaster;
     m_worldToScreen[i] = m_worldToCamera[i] * cameraToScreen;
     m_screenToWorld[i] = m_worldToScreen[i].inverse();
     m_worldToRaster[i] = m_worldToScreen[i] * screenToRaster;
     m_rasterToWorld[i] = m_worldToRaster[i].inverse();
   }
+
+  // The perspective divide of raster z = 1 is the same for all raster x 
+  // and y, so the raster plane maps to world space affinely
+  m_rasterPlanes.resize(m_numSamples);
+  for (unsigned int i = 0; i < m_numSamples; ++i) {
+    const Vector origin = Vector(0.0, 0.0, 1.0) * m_rasterToWorld[i];
+    m_rasterPlanes[i].origin = origin;
+    m_rasterPlanes[i].dx     = Vector(1.0, 0.0, 1.0) * m_rasterToWorld[i] - 
+      origin;
+    m_rasterPlanes[i].dy     = Vector(0.0, 1.0, 1.0) * m_rasterToWorld[i] - 
+      origin;
+  }
+
+  // Static if neither the transforms nor the position change
+  for (unsigned int i = 1; i < m_numSamples; ++i) {
+    m_isStatic = m_isStatic && m_rasterToWorld[i] == m_rasterToWorld[0];
+  }
+  const std::vector<Vector> positions = m_position.sampleValues();
+  for (size_t i = 1, size = positions.size(); i < size; ++i) {
+    m_isStatic = m_isStatic && positions[i] == positions[0];
+  }
+  m_staticPosition = position(0.0);
 }
 
 //----------------------------------------------------------------------------//
@@ -367,10 +495,165 @@ void PerspectiveCamera::getTransforms(const PTime time,
   screenToRaster = screenToNdc * ndcToRaster; 
 }
 
+//----------------------------------------------------------------------------//
+// OrthographicCamera
+//----------------------------------------------------------------------------//
+
+OrthographicCamera::OrthographicCamera()
+  : Camera(),
+    m_width(10.0)
+{
+  recomputeTransforms();
+}
+
+//----------------------------------------------------------------------------//
+
+void OrthographicCamera::setWidth(const double width)
+{
+  m_width = width;
+  recomputeTransforms();
+}
+
+//----------------------------------------------------------------------------//
+
+double OrthographicCamera::width() const
+{
+  return m_width;
+}
+
+//----------------------------------------------------------------------------//
+
+Vector OrthographicCamera::worldToScreen(const Vector &wsP, 
+                                         const PTime time) const
+{
+  return transformPoint(wsP, m_worldToScreen, time);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector OrthographicCamera::screenToWorld(const Vector &ssP, 
+                                         const PTime time) const
+{
+  return transformPoint(ssP, m_screenToWorld, time);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector OrthographicCamera::worldToRaster(const Vector &wsP, 
+                                         const PTime time) const
+{
+  return transformPoint(wsP, m_worldToRaster, time);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector OrthographicCamera::rasterToWorld(const Vector &rsP, 
+                                         const PTime time) const
+{
+  return transformPoint(rsP, m_rasterToWorld, time);
+}
+
+//----------------------------------------------------------------------------//
+
+bool OrthographicCamera::canTransformNegativeCamZ() const
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+Ray OrthographicCamera::rasterRay(const float rsX, const float rsY, 
+                                  const PTime time) const
+{
+  // Raster depth is camera depth, so the ray runs from the image plane 
+  // along the view axis
+  return Ray(rasterToWorld(Vector(rsX, rsY, 0.0), time), 
+             rasterToWorld(Vector(rsX, rsY, 1.0), time));
+}
+
+//----------------------------------------------------------------------------//
+
+double OrthographicCamera::rayDistance(const Vector &wsP, 
+                                       const PTime time) const
+{
+  return std::max(worldToCamera(wsP, time).z, 0.0);
+}
+
+//----------------------------------------------------------------------------//
+
+void OrthographicCamera::worldToRasterAndCamera(const Vector &wsP, 
+                                                const PTime time,
+                                                Vector &rsP, 
+                                                Vector &csP) const
+{
+  if (m_isStatic) {
+    csP = wsP * m_worldToCamera[0];
+    rsP = csP * m_cameraToRaster;
+    return;
+  }
+  Camera::worldToRasterAndCamera(wsP, time, rsP, csP);
+}
+
+//----------------------------------------------------------------------------//
+
+void OrthographicCamera::recomputeTransforms()
+{
+  Camera::recomputeTransforms();
+
+  m_worldToScreen.resize(m_numSamples);
+  m_screenToWorld.resize(m_numSamples);
+  m_worldToRaster.resize(m_numSamples);
+  m_rasterToWorld.resize(m_numSamples);
+
+  // Camera to screen scales the frame to [-1, 1]
+  const double height = m_width * static_cast<double>(m_resolution.y) / 
+    static_cast<double>(m_resolution.x);
+  Matrix cameraToScreen;
+  cameraToScreen.setScale(Vector(2.0 / m_width, 2.0 / height, 1.0));
+  // Screen to raster, using the same convention as PerspectiveCamera
+  Matrix ndcTranslate, ndcScale, ndcToRaster;
+  ndcTranslate.setTranslation(Vector(1.0, 1.0, 0.0));
+  ndcScale.setScale(Vector(0.5, 0.5, 1.0));
+  ndcToRaster.setScale(Vector(m_resolution.x, m_resolution.y, 1.0));
+  const Matrix screenToRaster = ndcTranslate * ndcScale * ndcToRaster;
+  m_cameraToRaster = cameraToScreen * screenToRaster;
+
+  for (unsigned int i = 0; i < m_numSamples; ++i) {
+    m_worldToScreen[i] = m_worldToCamera[i] * cameraToScreen;
+    m_screenToWorld[i] = m_worldToScreen[i].inverse();
+    m_worldToRaster[i] = m_worldToScreen[i] * screenToRaster;
+    m_rasterToWorld[i] = m_worldToRaster[i].inverse();
+  }
+}
+
 //----------------------------------------------------------------------------//
 // SphericalCamera
 //----------------------------------------------------------------------------//
 
+SphericalCamera::SphericalCamera()
+  : Camera(),
+    m_doSolidAngleSampling(false),
+    m_doSolidAngleResolution(false)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+void SphericalCamera::setSolidAngleSampling(const bool enabled)
+{
+  m_doSolidAngleSampling = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void SphericalCamera::setSolidAngleResolution(const bool enabled)
+{
+  m_doSolidAngleResolution = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
 Vector SphericalCamera::worldToScreen(const Vector &wsP, const PTime time) const
 {
   Vector csP = worldToCamera(wsP, time);
@@ -418,6 +701,30 @@ bool SphericalCamera::canTransformNegativeCamZ() const
 
 //----------------------------------------------------------------------------//
 
+size_t SphericalCamera::pixelStride(const size_t y) const
+{
+  if (!m_doSolidAngleResolution) {
+    return 1;
+  }
+  // Row centers never reach the poles, so the cosine is positive
+  const double stride   = std::floor(1.0 / rowCosLatitude(y));
+  const double maxWidth = std::max(m_resolution.x, 1);
+  return static_cast<size_t>(Imath::clamp(stride, 1.0, maxWidth));
+}
+
+//----------------------------------------------------------------------------//
+
+float SphericalCamera::pixelSampleDensity(const size_t y) const
+{
+  if (!m_doSolidAngleSampling) {
+    return 1.0f;
+  }
+  return static_cast<float>(std::min(rowCosLatitude(y) * pixelStride(y), 
+                                     1.0));
+}
+
+//----------------------------------------------------------------------------//
+
 void SphericalCamera::recomputeTransforms()
 {
   Camera::recomputeTransforms();
@@ -456,6 +763,15 @@ SphericalCoords SphericalCamera::cartToSphere(const Vector &cc) const
 
 //----------------------------------------------------------------------------//
 
+double SphericalCamera::rowCosLatitude(const size_t y) const
+{
+  // Same mapping as rasterToWorld(), for the center of the row
+  const double ssY = (y + 0.5) / std::max(m_resolution.y, 1) * 2.0 - 1.0;
+  return std::max(std::cos(ssY * M_PI * 0.5), 0.0);
+}
+
+//----------------------------------------------------------------------------//
+
 Vector SphericalCamera::sphereToCart(const SphericalCoords &sc) const
 {
   const float rho   = sc.radius;
@@ -31,12 +31,36 @@
 
 #include "pvr/DeepImage.h"
 
+// System includes
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PVR_DEEPIMAGE_SIMD
+#endif
+
 // Library includes
 
+#include <boost/cstdint.hpp>
+#include <boost/thread/tss.hpp>
 #include <OpenEXR/ImathFun.h>
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfDeepFrameBuffer.h>
+#include <OpenEXR/ImfDeepScanLineInputFile.h>
+#include <OpenEXR/ImfDeepScanLineOutputFile.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfPartType.h>
 
 // Project includes
 
+#include "pvr/Constants.h"
+#include "pvr/Exception.h"
 #include "pvr/Log.h"
 
 //----------------------------------------------------------------------------//
@@ -47,7 +71,300 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
-  
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+  // Deep image file
+  //--------------------------------------------------------------------------//
+
+  //! Identifies a PVR deep image file
+  const char            k_fileMagic[8] = { 'P', 'V', 'R', 'D', 
+                                           'E', 'E', 'P', '\0' };
+  const boost::uint32_t k_fileVersion  = 1;
+
+  //--------------------------------------------------------------------------//
+
+  DECLARE_PVR_RT_EXC(DeepFileFormatException, "Invalid deep image file:");
+
+  //--------------------------------------------------------------------------//
+
+  template <typename T>
+  void writePod(std::ostream &out, const T &value)
+  {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <typename T>
+  T readPod(std::istream &in)
+  {
+    T value;
+    if (!in.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+      throw DeepFileFormatException("Unexpected end of file");
+    }
+    return value;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns whether the filename has an .exr extension
+  bool isExrFile(const std::string &filename)
+  {
+    const std::string ext(".exr");
+    return filename.size() >= ext.size() && 
+      filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+  }
+
+  //--------------------------------------------------------------------------//
+  // OpenEXR deep files
+  //--------------------------------------------------------------------------//
+
+  //! Number of floats stored per sample when writing: Z and four values
+  const size_t k_exrWriteStride = 5;
+  //! Number of floats stored per sample when reading: Z and three values
+  const size_t k_exrReadStride  = 4;
+
+  //--------------------------------------------------------------------------//
+
+  //! Per-sample opacity that takes transmittance from prev to value
+  float opacity(const float prev, const float value)
+  {
+    return prev > 0.0f ? Imath::clamp(1.0f - value / prev, 0.0f, 1.0f) : 0.0f;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sorts deep samples by depth
+  bool depthLess(const Util::ColorCurve::Sample &a, 
+                 const Util::ColorCurve::Sample &b)
+  {
+    return a.first < b.first;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Interleaved cells
+  //--------------------------------------------------------------------------//
+
+  //! Number of floats per interleaved cell sample: four pixels times three
+  //! channels
+  const size_t k_cellStride = 12;
+
+  //--------------------------------------------------------------------------//
+  // Curve simplification
+  //--------------------------------------------------------------------------//
+
+  //! Number of times the tolerance is doubled before giving up on fitting
+  //! a curve within the sample budget
+  const size_t k_maxSimplifyPasses = 8;
+
+  //! Per-thread samples of the averaged pixel function in 
+  //! DeepImage::setPixel()
+  boost::thread_specific_ptr<Util::ColorCurve::SampleVec> 
+    g_averageScratch;
+
+  //--------------------------------------------------------------------------//
+
+  //! Largest absolute value of any sample, but no less than one
+  float valueScale(const Util::ColorCurve::SampleVec &samples)
+  {
+    float scale = 1.0f;
+    BOOST_FOREACH (const Util::ColorCurve::Sample &s, samples) {
+      scale = std::max(scale, std::abs(s.second.x));
+      scale = std::max(scale, std::abs(s.second.y));
+      scale = std::max(scale, std::abs(s.second.z));
+    }
+    return scale;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether all channels of a and b are within tolerance of each other
+  bool isWithin(const Color &a, const Color &b, const float tolerance)
+  {
+    return std::abs(a.x - b.x) <= tolerance && 
+      std::abs(a.y - b.y) <= tolerance && 
+      std::abs(a.z - b.z) <= tolerance;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes a knot. Works for DeepImage's knots as well as curve samples.
+  template <typename Knot_T>
+  inline void setKnot(Knot_T &knot, const float z, const Color &value)
+  {
+    knot.z        = z;
+    knot.value[0] = value.x;
+    knot.value[1] = value.y;
+    knot.value[2] = value.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  inline void setKnot(Util::ColorCurve::Sample &sample, const float z, 
+                      const Color &value)
+  {
+    sample.first  = z;
+    sample.second = value;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Simplifies a piecewise linear curve, so that the result stays within 
+  //! tolerance of every input sample in each channel. This is the 
+  //! compression from Lokovic and Veach's Deep Shadow Maps: starting at the
+  //! last output sample, we keep the range of slopes that pass within 
+  //! tolerance of each input sample seen so far. Once that range is empty,
+  //! a sample is output at the previous input depth, in the middle of the
+  //! range.
+  //! \param out Where to write the result. If null, the result is only 
+  //! counted.
+  //! \returns The number of output samples
+  template <typename Knot_T>
+  size_t simplify(const Util::ColorCurve::SampleVec &in, const float tolerance,
+                  Knot_T *out)
+  {
+    const float inf = std::numeric_limits<float>::infinity();
+
+    if (in.empty()) {
+      return 0;
+    }
+
+    float  z0     = in.front().first;
+    Color  v0     = in.front().second;
+    Color  lo(-inf), hi(inf);
+    bool   isOpen = false;
+    size_t count  = 0;
+
+    if (out) {
+      setKnot(out[count], z0, v0);
+    }
+    ++count;
+
+    for (size_t i = 1; i < in.size(); ) {
+      const float  z  = in[i].first;
+      const Color &v  = in[i].second;
+      const float  dz = z - z0;
+      // Samples at the depth of the last output sample are steps in the 
+      // curve. They're kept unless they're close enough to it.
+      if (dz <= 0.0f) {
+        if (!isWithin(v, v0, tolerance)) {
+          v0 = v;
+          if (out) {
+            setKnot(out[count], z0, v0);
+          }
+          ++count;
+        }
+        ++i;
+        continue;
+      }
+      const Color sLo = (v - Color(tolerance) - v0) / dz;
+      const Color sHi = (v + Color(tolerance) - v0) / dz;
+      const Color newLo(std::max(lo.x, sLo.x), std::max(lo.y, sLo.y), 
+                        std::max(lo.z, sLo.z));
+      const Color newHi(std::min(hi.x, sHi.x), std::min(hi.y, sHi.y), 
+                        std::min(hi.z, sHi.z));
+      if (isOpen && 
+          (newLo.x > newHi.x || newLo.y > newHi.y || newLo.z > newHi.z)) {
+        // No line through the last output sample passes close enough to 
+        // this one. End the segment at the previous sample and try again 
+        // from there.
+        const float zPrev = in[i - 1].first;
+        v0     = v0 + (lo + hi) * 0.5f * (zPrev - z0);
+        z0     = zPrev;
+        lo     = Color(-inf);
+        hi     = Color(inf);
+        isOpen = false;
+        if (out) {
+          setKnot(out[count], z0, v0);
+        }
+        ++count;
+        continue;
+      }
+      lo     = newLo;
+      hi     = newHi;
+      isOpen = true;
+      ++i;
+    }
+
+    if (isOpen) {
+      const float z = in.back().first;
+      if (out) {
+        setKnot(out[count], z, v0 + (lo + hi) * 0.5f * (z - z0));
+      }
+      ++count;
+    }
+
+    return count;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Resamples a curve with at least two samples to exactly numSamples 
+  //! samples, in a single pass. Curves that are monotonic in their average
+  //! value are sampled evenly in value, so that each step changes the 
+  //! transmittance equally. Other curves are sampled evenly in depth.
+  //! \param out Where to write the result. Must hold numSamples samples.
+  template <typename Knot_T>
+  void resampleFixed(const Util::ColorCurve::SampleVec &in, 
+                     const size_t numSamples, Knot_T *out)
+  {
+    using namespace Math;
+
+    assert(in.size() >= 2 && "resampleFixed() needs at least two samples");
+
+    const size_t last = in.size() - 1;
+
+    if (numSamples == 1) {
+      setKnot(out[0], in[last].first, in[last].second);
+      return;
+    }
+
+    // Check that the function is monotonic in either direction
+    const float first      = avg(in.front().second);
+    const float end        = avg(in.back().second);
+    const bool  increasing = end >= first;
+    bool        monotonic  = first != end;
+    for (size_t i = 1; i < in.size() && monotonic; ++i) {
+      const float diff = avg(in[i].second) - avg(in[i - 1].second);
+      monotonic = increasing ? diff >= 0.0f : diff <= 0.0f;
+    }
+
+    // Walk the input once. p is the first sample at or beyond the target.
+    size_t p     = 1;
+    float  prevZ = in.front().first;
+    for (size_t i = 0; i < numSamples; ++i) {
+      if (i == 0 || i == numSamples - 1) {
+        const size_t src = i == 0 ? 0 : last;
+        setKnot(out[i], in[src].first, in[src].second);
+        continue;
+      }
+      const float t = static_cast<float>(i) / (numSamples - 1);
+      float       factor;
+      if (monotonic) {
+        const float target = Imath::lerp(first, end, t);
+        while (p < last && (increasing ? avg(in[p].second) < target : 
+                            avg(in[p].second) > target)) {
+          ++p;
+        }
+        const float a0 = avg(in[p - 1].second), a1 = avg(in[p].second);
+        factor = a1 != a0 ? (target - a0) / (a1 - a0) : 0.0f;
+      } else {
+        const float target = Imath::lerp(in.front().first, in.back().first, t);
+        while (p < last && in[p].first < target) {
+          ++p;
+        }
+        const float z0 = in[p - 1].first, z1 = in[p].first;
+        factor = z1 != z0 ? (target - z0) / (z1 - z0) : 0.0f;
+      }
+      // Rounding must not take the depth outside the previous knot and 
+      // the last one
+      factor = Imath::clamp(factor, 0.0f, 1.0f);
+      const float z = fit01(factor, in[p - 1].first, in[p].first);
+      prevZ = Imath::clamp(z, prevZ, in.back().first);
+      setKnot(out[i], prevZ, fit01(factor, in[p - 1].second, in[p].second));
+    }
+  }
 
   //--------------------------------------------------------------------------//
 
@@ -69,13 +386,31 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 DeepImage::DeepImage()
-  : m_numSamples(32)
+  : m_isCompact(false), m_width(0), m_height(0), m_numSamples(32), 
+    m_maxError(0.002f), m_cellSamples(0), 
+    m_memory(Sys::Memory::DeepImages)
 {
   setSize(2, 2);
 }
 
 //----------------------------------------------------------------------------//
 
+DeepImage::DeepImage(const DeepImage &other)
+  : m_isCompact(false), m_width(0), m_height(0), m_cellSamples(0),
+    m_memory(Sys::Memory::DeepImages)
+{
+  *this = other;
+}
+
+//----------------------------------------------------------------------------//
+
+DeepImage::~DeepImage()
+{
+  release();
+}
+
+//----------------------------------------------------------------------------//
+
 DeepImage::Ptr DeepImage::create()
 { 
   return Ptr(new DeepImage); 
@@ -90,12 +425,56 @@ DeepImage::Ptr DeepImage::clone() const
 
 //----------------------------------------------------------------------------//
 
+DeepImage& DeepImage::operator = (const DeepImage &other)
+{
+  if (this == &other) {
+    return *this;
+  }
+  release();
+  m_width      = other.m_width;
+  m_height     = other.m_height;
+  m_numSamples = other.m_numSamples;
+  m_maxError   = other.m_maxError;
+  m_pixels     = other.m_pixels;
+  m_isCompact  = true;
+  // The interleaved cells hold no pointers, so they're copied as is
+  m_cells       = other.m_cells;
+  m_cellRanges  = other.m_cellRanges;
+  m_cellSamples = other.m_cellSamples;
+  // Pack the other image's knots into our own arena
+  size_t numKnots = 0;
+  BOOST_FOREACH (const PixelRef &p, m_pixels) {
+    numKnots += p.count;
+  }
+  m_arena.resize(numKnots);
+  for (size_t i = 0, offset = 0; i < m_pixels.size(); ++i) {
+    PixelRef &p = m_pixels[i];
+    if (p.count > 0) {
+      std::copy(p.knots, p.knots + p.count, &m_arena[offset]);
+      p.knots = &m_arena[offset];
+      offset += p.count;
+    } else {
+      p.knots = NULL;
+    }
+  }
+  updateMemory();
+  return *this;
+}
+
+//----------------------------------------------------------------------------//
+
 void DeepImage::setSize(const size_t width, const size_t height)
 {
+  release();
   m_width = width;
   m_height = height;
+  m_isCompact = false;
   swapClear(m_pixels);
   m_pixels.resize(width * height);
+  swapClear(m_cells);
+  swapClear(m_cellRanges);
+  m_cellSamples = 0;
+  updateMemory();
 }
 
 //----------------------------------------------------------------------------//
@@ -109,7 +488,7 @@ Imath::V2i DeepImage::size() const
 
 void DeepImage::setNumSamples(const size_t numSamples)
 {
-  m_numSamples = numSamples;
+  m_numSamples = std::max(numSamples, static_cast<size_t>(1));
 }
 
 //----------------------------------------------------------------------------//
@@ -119,6 +498,19 @@ size_t DeepImage::numSamples() const
   return m_numSamples;
 }
 
+//----------------------------------------------------------------------------//
+
+void DeepImage::setMaxError(const float maxError)
+{
+  m_maxError = std::max(maxError, 0.0f);
+}
+
+//----------------------------------------------------------------------------//
+
+float DeepImage::maxError() const
+{
+  return m_maxError;
+}
 
 //----------------------------------------------------------------------------//
 
@@ -128,9 +520,51 @@ void DeepImage::setPixel(const size_t x, const size_t y,
   assert(x < m_width && "Pixel x coordinate out of bounds");
   assert(y < m_height && "Pixel y coordinate out of bounds");
   assert(func != NULL && "Got null pointer for pixel function");
-  Util::ColorCurve::Ptr fixedSampleCurve = makeFixedSample(func,
-                                                           m_numSamples);
-  pixel(x, y) = *fixedSampleCurve;
+  simplifyPixel(x + y * m_width, func->samples());
+}
+  
+//----------------------------------------------------------------------------//
+
+void DeepImage::setPixel(const size_t x, const size_t y, 
+                         const std::vector<Util::ColorCurve::CPtr> &funcs)
+{
+  assert(x < m_width && "Pixel x coordinate out of bounds");
+  assert(y < m_height && "Pixel y coordinate out of bounds");
+  assert(!funcs.empty() && "Got no pixel functions");
+  if (funcs.size() == 1) {
+    simplifyPixel(x + y * m_width, funcs[0]->samples());
+    return;
+  }
+  ColorCurve::SampleVec *samples = g_averageScratch.get();
+  if (!samples) {
+    samples = new ColorCurve::SampleVec;
+    g_averageScratch.reset(samples);
+  }
+  ColorCurve::average(funcs, *samples);
+  simplifyPixel(x + y * m_width, *samples);
+}
+  
+//----------------------------------------------------------------------------//
+
+void DeepImage::simplifyPixel(const size_t idx, 
+                              const Util::ColorCurve::SampleVec &samples)
+{
+  // Loosen the tolerance until the curve fits in the sample budget. Until
+  // then the knots are only counted.
+  float  tolerance = m_maxError * valueScale(samples);
+  size_t count     = simplify(samples, tolerance, static_cast<Knot *>(NULL));
+  for (size_t i = 0; i < k_maxSimplifyPasses && count > m_numSamples; ++i) {
+    tolerance = tolerance > 0.0f ? tolerance * 2.0f : 1e-4f;
+    count     = simplify(samples, tolerance, static_cast<Knot *>(NULL));
+  }
+
+  // Write the knots straight into the pixel. Curves that still don't fit
+  // are resampled to the budget.
+  if (count > m_numSamples) {
+    resampleFixed(samples, m_numSamples, allocatePixel(idx, m_numSamples));
+  } else {
+    simplify(samples, tolerance, allocatePixel(idx, count));
+  }
 }
   
 //----------------------------------------------------------------------------//
@@ -140,8 +574,7 @@ void DeepImage::setPixel(const size_t x, const size_t y,
 {
   assert(x < m_width && "Pixel x coordinate out of bounds");
   assert(y < m_height && "Pixel y coordinate out of bounds");
-  pixel(x, y) = *makeFixedSample(ColorCurve::Ptr(new ColorCurve(value)),
-                                 m_numSamples);
+  setKnot(*allocatePixel(x + y * m_width, 1), 0.0f, value);
 }
   
 //----------------------------------------------------------------------------//
@@ -151,11 +584,15 @@ DeepImage::pixelFunction(const size_t x, const size_t y) const
 {
   assert(x < m_width && "Pixel x coordinate out of bounds");
   assert(y < m_height && "Pixel y coordinate out of bounds");
-  return Util::ColorCurve::Ptr
-    (new Util::ColorCurve(m_pixels[x + y * m_width]));
+  const PixelRef &p = pixel(x, y);
+  Util::ColorCurve::Ptr curve(new Util::ColorCurve);
+  for (size_t i = 0; i < p.count; ++i) {
+    const Knot &k = p.knots[i];
+    curve->addSample(k.z, Color(k.value[0], k.value[1], k.value[2]));
+  }
+  return curve;
 }
 
-
 //----------------------------------------------------------------------------//
 
 Color DeepImage::lerp(const float rsX, const float rsY, const float z) const
@@ -171,10 +608,146 @@ Color DeepImage::lerp(const float rsX, const float rsY, const float z) const
   yMax = Imath::clamp(yMax, zero, m_height - 1);
   return Util::lerp2D(rsX - static_cast<float>(xMin), 
                       rsY - static_cast<float>(yMin), 
-                      pixel(xMin, yMin).interpolate(z),
-                      pixel(xMax, yMin).interpolate(z),
-                      pixel(xMin, yMax).interpolate(z),
-                      pixel(xMax, yMax).interpolate(z));
+                      interpolate(pixel(xMin, yMin), z),
+                      interpolate(pixel(xMax, yMin), z),
+                      interpolate(pixel(xMin, yMax), z),
+                      interpolate(pixel(xMax, yMax), z));
+}
+
+//----------------------------------------------------------------------------//
+
+Color DeepImage::lerp(const float rsX, const float rsY, const float z,
+                      LerpCursor &cursor) const
+{
+  const size_t zero = 0;
+  size_t xMin = std::floor(rsX);
+  size_t xMax = std::ceil(rsX);
+  size_t yMin = std::floor(rsY);
+  size_t yMax = std::ceil(rsY);
+  xMin = Imath::clamp(xMin, zero, m_width - 1);
+  xMax = Imath::clamp(xMax, zero, m_width - 1);
+  yMin = Imath::clamp(yMin, zero, m_height - 1);
+  yMax = Imath::clamp(yMax, zero, m_height - 1);
+  return Util::lerp2D(rsX - static_cast<float>(xMin), 
+                      rsY - static_cast<float>(yMin), 
+                      interpolate(pixel(xMin, yMin), z, cursor.index[0]),
+                      interpolate(pixel(xMax, yMin), z, cursor.index[1]),
+                      interpolate(pixel(xMin, yMax), z, cursor.index[2]),
+                      interpolate(pixel(xMax, yMax), z, cursor.index[3]));
+}
+
+//----------------------------------------------------------------------------//
+
+void DeepImage::interleave(const size_t numSamples)
+{
+  const size_t n = std::max(numSamples, static_cast<size_t>(2));
+
+  m_cellSamples = n;
+  m_cellRanges.resize(m_width * m_height);
+  m_cells.resize(m_width * m_height * n * k_cellStride);
+
+  for (size_t y = 0; y < m_height; ++y) {
+    for (size_t x = 0; x < m_width; ++x) {
+      const size_t    x1  = std::min(x + 1, m_width - 1);
+      const size_t    y1  = std::min(y + 1, m_height - 1);
+      const PixelRef *p[4] = { &pixel(x, y), &pixel(x1, y), 
+                               &pixel(x, y1), &pixel(x1, y1) };
+      // The cell's samples span the depth range of all four pixels
+      float zMin = std::numeric_limits<float>::max();
+      float zMax = -std::numeric_limits<float>::max();
+      for (size_t c = 0; c < 4; ++c) {
+        if (p[c]->count > 0) {
+          zMin = std::min(zMin, p[c]->knots[0].z);
+          zMax = std::max(zMax, p[c]->knots[p[c]->count - 1].z);
+        }
+      }
+      if (zMin > zMax) {
+        zMin = zMax = 0.0f;
+      }
+      const size_t idx   = x + y * m_width;
+      CellRange   &range = m_cellRanges[idx];
+      range.zMin   = zMin;
+      range.zScale = zMax > zMin ? (n - 1) / (zMax - zMin) : 0.0f;
+      // Resample the four pixels
+      size_t  index[4] = { 0, 0, 0, 0 };
+      float  *d        = &m_cells[idx * n * k_cellStride];
+      for (size_t s = 0; s < n; ++s, d += k_cellStride) {
+        const float z = 
+          Imath::lerp(zMin, zMax, static_cast<float>(s) / (n - 1));
+        for (size_t c = 0; c < 4; ++c) {
+          const Color value = interpolate(*p[c], z, index[c]);
+          d[c]     = value.x;
+          d[4 + c] = value.y;
+          d[8 + c] = value.z;
+        }
+      }
+    }
+  }
+  updateMemory();
+}
+
+//----------------------------------------------------------------------------//
+
+bool DeepImage::isInterleaved() const
+{
+  return m_cellSamples > 0;
+}
+
+//----------------------------------------------------------------------------//
+
+Color DeepImage::lerpInterleaved(const float rsX, const float rsY, 
+                                 const float z) const
+{
+  assert(isInterleaved() && "DeepImage::lerpInterleaved(): not interleaved");
+
+  // Find the cell, clamping to the image the same way lerp() does
+  const int   xMin = Imath::clamp(static_cast<int>(std::floor(rsX)), 0, 
+                                  static_cast<int>(m_width) - 1);
+  const int   yMin = Imath::clamp(static_cast<int>(std::floor(rsY)), 0, 
+                                  static_cast<int>(m_height) - 1);
+  const float tX   = Imath::clamp(rsX - xMin, 0.0f, 1.0f);
+  const float tY   = Imath::clamp(rsY - yMin, 0.0f, 1.0f);
+  const size_t idx = xMin + yMin * m_width;
+
+  // Find the two samples on either side of the depth
+  const size_t     n     = m_cellSamples;
+  const CellRange &range = m_cellRanges[idx];
+  const float      f     = Imath::clamp((z - range.zMin) * range.zScale, 
+                                        0.0f, static_cast<float>(n - 1));
+  const size_t     s     = std::min(static_cast<size_t>(f), n - 2);
+  const float      t     = f - s;
+  const float     *a     = &m_cells[(idx * n + s) * k_cellStride];
+  const float     *b     = a + k_cellStride;
+
+  // Bilinear weights of the four pixels, in the order they're stored
+  const float w[4] = { (1.0f - tX) * (1.0f - tY), tX * (1.0f - tY),
+                       (1.0f - tX) * tY,          tX * tY };
+  float       result[3];
+
+#if defined(PVR_DEEPIMAGE_SIMD)
+  const __m128 vT = _mm_set1_ps(t);
+  const __m128 vW = _mm_loadu_ps(w);
+  for (size_t c = 0; c < 3; ++c) {
+    const __m128 vA = _mm_loadu_ps(a + 4 * c);
+    const __m128 vB = _mm_loadu_ps(b + 4 * c);
+    __m128 v = _mm_mul_ps(vW, _mm_add_ps(vA, _mm_mul_ps(_mm_sub_ps(vB, vA), 
+                                                         vT)));
+    // Sum the four weighted pixels
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    result[c] = _mm_cvtss_f32(v);
+  }
+#else
+  for (size_t c = 0; c < 3; ++c) {
+    result[c] = 0.0f;
+    for (size_t i = 0; i < 4; ++i) {
+      const float va = a[4 * c + i], vb = b[4 * c + i];
+      result[c] += w[i] * (va + (vb - va) * t);
+    }
+  }
+#endif
+
+  return Color(result[0], result[1], result[2]);
 }
 
 //----------------------------------------------------------------------------//
@@ -187,8 +760,8 @@ void DeepImage::printStats() const
 
   // Count samples
   size_t numSamples = 0;
-  BOOST_FOREACH (const Util::ColorCurve &p, m_pixels) {
-    numSamples += p.numSamples();
+  BOOST_FOREACH (const PixelRef &p, m_pixels) {
+    numSamples += p.count;
   }
 
   // Average samples/pixel
@@ -197,80 +770,532 @@ void DeepImage::printStats() const
   Log::print("  Average # samples per pixel: " + str(avg));
 
   // Memory use
-  size_t bytesUsed = numSamples * (sizeof(float) + sizeof(Color));
-  float mbUsed = static_cast<float>(bytesUsed) / (1024.0f * 1024.0f);
+  float mbUsed = static_cast<float>(memSize()) / (1024.0f * 1024.0f);
   Log::print("  Approximate memory use: " + str(mbUsed) + " MB");
 }
 
 //----------------------------------------------------------------------------//
-// Utility functions
+
+size_t DeepImage::memSize() const
+{
+  size_t numSamples = 0;
+  BOOST_FOREACH (const PixelRef &p, m_pixels) {
+    numSamples += p.count;
+  }
+  return numSamples * sizeof(Knot) + m_pixels.size() * sizeof(PixelRef) + 
+    m_cells.size() * sizeof(float) + m_cellRanges.size() * sizeof(CellRange);
+}
+
 //----------------------------------------------------------------------------//
 
-Util::ColorCurve::Ptr makeFixedSample(Util::ColorCurve::CPtr curve,
-                                      const size_t numSamples) 
+bool DeepImage::merge(const DeepImage &part)
+{
+  if (part.m_width != m_width || part.m_height != m_height) {
+    Log::warning("Can't merge deep images of different sizes");
+    return false;
+  }
+  for (size_t i = 0, size = m_pixels.size(); i < size; ++i) {
+    const PixelRef &src = part.m_pixels[i];
+    if (src.count > 0) {
+      Knot *knots = allocatePixel(i, src.count);
+      std::copy(src.knots, src.knots + src.count, knots);
+    }
+  }
+  updateMemory();
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool DeepImage::copyPixels(const DeepImage &source, 
+                           const size_t x0, const size_t y0, 
+                           const size_t x1, const size_t y1)
+{
+  if (source.m_width != m_width || source.m_height != m_height) {
+    Log::warning("Can't copy pixels between deep images of different sizes");
+    return false;
+  }
+  for (size_t y = y0, yEnd = std::min(y1, m_height); y < yEnd; ++y) {
+    for (size_t x = x0, xEnd = std::min(x1, m_width); x < xEnd; ++x) {
+      const size_t    i   = x + y * m_width;
+      const PixelRef &src = source.m_pixels[i];
+      if (src.count > 0) {
+        Knot *knots = allocatePixel(i, src.count);
+        std::copy(src.knots, src.knots + src.count, knots);
+      }
+    }
+  }
+  updateMemory();
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void DeepImage::compact()
 {
-  using namespace Math;
+  if (m_isCompact) {
+    return;
+  }
+  // Assignment packs the knots into the arena of the copy
+  DeepImage compacted(*this);
+  release();
+  m_pixels.swap(compacted.m_pixels);
+  m_arena.swap(compacted.m_arena);
+  m_isCompact = true;
+  updateMemory();
+}
 
-  typedef ColorCurve::SampleVec SampleVec;
-  typedef SampleVec::const_iterator CIter;
-  
-  const ColorCurve::SampleVec &samples = curve->samples();
+//----------------------------------------------------------------------------//
+
+DeepImage::Knot* DeepImage::allocatePixel(const size_t idx, 
+                                          const size_t count)
+{
+  if (m_isCompact) {
+    expand();
+  }
+  PixelRef &p = m_pixels[idx];
+  if (p.count != count) {
+    delete [] p.knots;
+    p.knots = count > 0 ? new Knot[count] : NULL;
+    p.count = count;
+  }
+  return p.knots;
+}
+
+//----------------------------------------------------------------------------//
+
+void DeepImage::storePixel(const size_t idx, 
+                           const Util::ColorCurve::SampleVec &samples)
+{
+  Knot *knots = allocatePixel(idx, samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    setKnot(knots[i], samples[i].first, samples[i].second);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void DeepImage::expand()
+{
+  BOOST_FOREACH (PixelRef &p, m_pixels) {
+    if (p.count > 0) {
+      Knot *knots = new Knot[p.count];
+      std::copy(p.knots, p.knots + p.count, knots);
+      p.knots = knots;
+    }
+  }
+  swapClear(m_arena);
+  m_isCompact = false;
+}
+
+//----------------------------------------------------------------------------//
+
+void DeepImage::updateMemory()
+{
+  m_memory.track(memSize());
+}
+
+//----------------------------------------------------------------------------//
+
+void DeepImage::release()
+{
+  BOOST_FOREACH (PixelRef &p, m_pixels) {
+    if (!m_isCompact) {
+      delete [] p.knots;
+    }
+    p = PixelRef();
+  }
+  swapClear(m_arena);
+}
+
+//----------------------------------------------------------------------------//
+
+Color DeepImage::interpolate(const PixelRef &p, const float z)
+{
+  if (p.count == 0) {
+    return Colors::zero();
+  }
+  // Binary search for the first knot beyond z
+  size_t lower = 0, upper = p.count;
+  while (lower < upper) {
+    const size_t mid = (lower + upper) / 2;
+    if (p.knots[mid].z <= z) {
+      lower = mid + 1;
+    } else {
+      upper = mid;
+    }
+  }
+  // Outside the curve we return the end values, same as Curve
+  if (upper == p.count || upper == 0) {
+    const Knot &k = p.knots[upper == 0 ? 0 : p.count - 1];
+    return Color(k.value[0], k.value[1], k.value[2]);
+  }
+  const Knot &b = p.knots[upper];
+  const Knot &a = p.knots[upper - 1];
+  const float t = Imath::lerpfactor(z, a.z, b.z);
+  return Color(Imath::lerp<float>(a.value[0], b.value[0], t),
+               Imath::lerp<float>(a.value[1], b.value[1], t),
+               Imath::lerp<float>(a.value[2], b.value[2], t));
+}
+
+//----------------------------------------------------------------------------//
+
+Color DeepImage::interpolate(const PixelRef &p, const float z, size_t &index)
+{
+  if (p.count == 0) {
+    return Colors::zero();
+  }
+  // Walk to the last knot that is not beyond z
+  const size_t last = p.count - 1;
+  index = std::min(index, last);
+  while (index < last && p.knots[index + 1].z <= z) {
+    ++index;
+  }
+  while (index > 0 && p.knots[index].z > z) {
+    --index;
+  }
+  // Outside the curve we return the end values, same as Curve
+  const Knot &a = p.knots[index];
+  if (index == last || z < a.z) {
+    return Color(a.value[0], a.value[1], a.value[2]);
+  }
+  const Knot &b = p.knots[index + 1];
+  const float t = Imath::lerpfactor(z, a.z, b.z);
+  return Color(Imath::lerp<float>(a.value[0], b.value[0], t),
+               Imath::lerp<float>(a.value[1], b.value[1], t),
+               Imath::lerp<float>(a.value[2], b.value[2], t));
+}
+
+//----------------------------------------------------------------------------//
+
+bool DeepImage::write(const std::string &filename, 
+                      const Contents contents) const
+{
+  if (isExrFile(filename)) {
+    return writeExr(filename, contents);
+  }
+
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  if (!out) {
+    Log::warning("Couldn't open deep image for writing: " + filename);
+    return false;
+  }
+
+  out.write(k_fileMagic, sizeof(k_fileMagic));
+  writePod<boost::uint32_t>(out, k_fileVersion);
+  writePod<boost::uint64_t>(out, m_width);
+  writePod<boost::uint64_t>(out, m_height);
+  writePod<boost::uint64_t>(out, m_numSamples);
+
+  // Each pixel is its sample count followed by (depth, r, g, b) tuples
+  BOOST_FOREACH (const PixelRef &p, m_pixels) {
+    writePod<boost::uint32_t>(out, p.count);
+    for (size_t i = 0; i < p.count; ++i) {
+      writePod<float>(out, p.knots[i].z);
+      writePod<float>(out, p.knots[i].value[0]);
+      writePod<float>(out, p.knots[i].value[1]);
+      writePod<float>(out, p.knots[i].value[2]);
+    }
+  }
 
-  // Handle case of no samples
-  if (samples.size() == 0) {
-    return ColorCurve::Ptr(new ColorCurve(numSamples, Color(0.0)));
+  if (!out) {
+    Log::warning("Couldn't write deep image: " + filename);
+    return false;
   }
 
-  // Handle case of zero samples
-  if (samples.size() == 1) {
-    return ColorCurve::Ptr(new ColorCurve(numSamples, 
-                                          samples[0].second));
+  Log::print("Wrote deep image: " + filename);
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+DeepImage::Ptr DeepImage::read(const std::string &filename)
+{
+  if (isExrFile(filename)) {
+    return readExr(filename);
   }
 
-  Color first = samples.front().second;
-  Color last  = samples.back().second;
-  int   sign  = first.x >= last.x ? 1 : -1;
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in) {
+    Log::warning("Couldn't open deep image: " + filename);
+    return Ptr();
+  }
 
-  // Check that function is monotonic
-  bool  monotonic = true;
-  Color lastVal   = samples[0].second;
-  for (size_t i = 1; i < samples.size(); ++i) {
-    Color value = samples[i].second;
-    if (value.x > sign * lastVal.x || 
-        value.y > sign * lastVal.y || 
-        value.z > sign * lastVal.z) {
-      Log::warning("Non-monotonic curve in DeepImage::makeFixedSample()");
-      return makeFixedSample(ColorCurve::Ptr(new ColorCurve(Color(0.0))),
-                             numSamples);
+  Ptr image = create();
+
+  try {
+    char magic[sizeof(k_fileMagic)];
+    if (!in.read(magic, sizeof(magic)) || 
+        std::memcmp(magic, k_fileMagic, sizeof(k_fileMagic)) != 0) {
+      throw DeepFileFormatException("Not a PVR deep image");
+    }
+    if (readPod<boost::uint32_t>(in) != k_fileVersion) {
+      throw DeepFileFormatException("Unsupported version");
     }
-    last = value;
-  }
-
-  // If function is monotonic, divide equally over the range of transmittance
-  // If the function is non-monotonic, divide equally in depth.
-  if (monotonic) {
-    ColorCurve::Ptr result(new ColorCurve);
-    result->addSample(samples[0].first, samples[0].second);
-    lastVal = samples[0].second;
-    size_t p = 0;
-    for (size_t i = 1; i < numSamples; ++i) {
-      float t = static_cast<float>(i) / static_cast<float>(numSamples - 1);
-      Color value = fit01(t, first, last);
-      while (avg(samples[p].second) > avg(value) * sign) {
-        lastVal = samples[p].second;
-        p++;
+    const size_t width  = readPod<boost::uint64_t>(in);
+    const size_t height = readPod<boost::uint64_t>(in);
+    image->setSize(width, height);
+    image->setNumSamples(readPod<boost::uint64_t>(in));
+    ColorCurve::SampleVec samples;
+    for (size_t idx = 0; idx < width * height; ++idx) {
+      samples.resize(readPod<boost::uint32_t>(in));
+      BOOST_FOREACH (ColorCurve::Sample &s, samples) {
+        s.first    = readPod<float>(in);
+        s.second.x = readPod<float>(in);
+        s.second.y = readPod<float>(in);
+        s.second.z = readPod<float>(in);
       }
-      float factor = Imath::lerpfactor(avg(value), avg(lastVal), 
-                                       avg(samples[p].second));
-      Color interp = fit01(factor, lastVal, samples[p].second);
-      float position = fit01(factor, samples[p-1].first, samples[p].first);
-      result->addSample(position, interp);
+      image->storePixel(idx, samples);
     }
-    return result;
-  } else {
-    //! \todo Finish
-    return ColorCurve::Ptr(new ColorCurve(*curve));;
+    image->compact();
+  }
+  catch (const DeepFileFormatException &e) {
+    Log::warning(std::string(e.what()) + " " + filename);
+    return Ptr();
+  }
+
+  Log::print("Loaded deep image: " + filename);
+
+  return image;
+}
+
+bool DeepImage::writeExr(const std::string &filename, 
+                         const Contents contents) const
+{
+  const char *transmittanceChannels[] = { "AR", "AG", "AB", "A" };
+  const char *luminanceChannels[]     = { "R", "G", "B", "A" };
+  const char **channels = 
+    contents == Transmittance ? transmittanceChannels : luminanceChannels;
+
+  const size_t numPixels = m_width * m_height;
+
+  size_t numSamples = 0;
+  BOOST_FOREACH (const PixelRef &p, m_pixels) {
+    numSamples += p.count;
+  }
+
+  // Flatten the samples, top scanline first. Each sample holds its depth 
+  // and the change in value since the previous sample, so that compositing
+  // the samples front to back gives back the pixel function.
+  std::vector<unsigned int> counts(numPixels);
+  std::vector<float>        data(numSamples * k_exrWriteStride);
+  std::vector<float *>      ptrs[k_exrWriteStride];
+  for (size_t c = 0; c < k_exrWriteStride; ++c) {
+    ptrs[c].resize(numPixels, NULL);
+  }
+
+  for (size_t j = 0, offset = 0; j < m_height; ++j) {
+    for (size_t i = 0; i < m_width; ++i) {
+      const PixelRef &p   = pixel(i, m_height - 1 - j);
+      const size_t    idx = i + j * m_width;
+      counts[idx] = p.count;
+      if (p.count == 0) {
+        continue;
+      }
+      for (size_t c = 0; c < k_exrWriteStride; ++c) {
+        ptrs[c][idx] = &data[offset * k_exrWriteStride + c];
+      }
+      Color prev = contents == Transmittance ? Colors::one() : Colors::zero();
+      for (size_t s = 0; s < p.count; ++s) {
+        const Knot  &k     = p.knots[s];
+        const Color  value(k.value[0], k.value[1], k.value[2]);
+        float       *d     = &data[offset * k_exrWriteStride];
+        d[0] = k.z;
+        if (contents == Transmittance) {
+          d[1] = opacity(prev.x, value.x);
+          d[2] = opacity(prev.y, value.y);
+          d[3] = opacity(prev.z, value.z);
+          d[4] = (d[1] + d[2] + d[3]) / 3.0f;
+        } else {
+          d[1] = value.x - prev.x;
+          d[2] = value.y - prev.y;
+          d[3] = value.z - prev.z;
+          d[4] = 0.0f;
+        }
+        prev = value;
+        offset++;
+      }
+    }
+  }
+
+  try {
+    Imf::Header header(m_width, m_height);
+    header.setType(Imf::DEEPSCANLINE);
+    header.compression() = Imf::ZIPS_COMPRESSION;
+    header.channels().insert("Z", Imf::Channel(Imf::FLOAT));
+    for (size_t c = 0; c < 4; ++c) {
+      header.channels().insert(channels[c], Imf::Channel(Imf::FLOAT));
+    }
+
+    Imf::DeepFrameBuffer frameBuffer;
+    frameBuffer.insertSampleCountSlice
+      (Imf::Slice(Imf::UINT, reinterpret_cast<char *>(&counts[0]), 
+                  sizeof(unsigned int), sizeof(unsigned int) * m_width));
+    for (size_t c = 0; c < k_exrWriteStride; ++c) {
+      frameBuffer.insert(c == 0 ? "Z" : channels[c - 1],
+                         Imf::DeepSlice(Imf::FLOAT, 
+                                        reinterpret_cast<char *>(&ptrs[c][0]),
+                                        sizeof(float *), 
+                                        sizeof(float *) * m_width, 
+                                        sizeof(float) * k_exrWriteStride));
+    }
+
+    Imf::DeepScanLineOutputFile file(filename.c_str(), header);
+    file.setFrameBuffer(frameBuffer);
+    file.writePixels(m_height);
+  }
+  catch (const std::exception &e) {
+    Log::warning("Couldn't write deep image " + filename + ": " + e.what());
+    return false;
+  }
+
+  Log::print("Wrote deep image: " + filename);
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+DeepImage::Ptr DeepImage::readExr(const std::string &filename)
+{
+  Ptr image = create();
+
+  try {
+    Imf::DeepScanLineInputFile file(filename.c_str());
+
+    const Imf::Header      &header   = file.header();
+    const Imf::ChannelList &channels = header.channels();
+    const Imath::Box2i      dw       = header.dataWindow();
+    const size_t            width    = dw.max.x - dw.min.x + 1;
+    const size_t            height   = dw.max.y - dw.min.y + 1;
+    const std::ptrdiff_t    origin   = 
+      dw.min.x + static_cast<std::ptrdiff_t>(dw.min.y) * 
+      static_cast<std::ptrdiff_t>(width);
+
+    // Channels are read into the three value slots of each sample. Files 
+    // with only an A channel are read as grey transmittance.
+    const char *names[3];
+    Contents    contents = Transmittance;
+    if (channels.findChannel("AR") && channels.findChannel("AG") && 
+        channels.findChannel("AB")) {
+      names[0] = "AR"; names[1] = "AG"; names[2] = "AB";
+    } else if (channels.findChannel("R") && channels.findChannel("G") && 
+               channels.findChannel("B")) {
+      names[0] = "R"; names[1] = "G"; names[2] = "B";
+      contents = Luminance;
+    } else if (channels.findChannel("A")) {
+      names[0] = names[1] = names[2] = "A";
+    } else {
+      throw DeepFileFormatException("No A or R, G, B channels");
+    }
+    if (!channels.findChannel("Z")) {
+      throw DeepFileFormatException("No Z channel");
+    }
+
+    // Read the sample counts
+    std::vector<unsigned int> counts(width * height);
+    Imf::DeepFrameBuffer      frameBuffer;
+    frameBuffer.insertSampleCountSlice
+      (Imf::Slice(Imf::UINT, 
+                  reinterpret_cast<char *>(&counts[0] - origin),
+                  sizeof(unsigned int), sizeof(unsigned int) * width));
+    file.setFrameBuffer(frameBuffer);
+    file.readPixelSampleCounts(dw.min.y, dw.max.y);
+
+    // Read the samples
+    size_t numSamples = 0, maxSamples = 0;
+    BOOST_FOREACH (const unsigned int count, counts) {
+      numSamples += count;
+      maxSamples = std::max(maxSamples, static_cast<size_t>(count));
+    }
+    std::vector<float>   data(numSamples * k_exrReadStride);
+    std::vector<float *> ptrs[k_exrReadStride];
+    for (size_t c = 0; c < k_exrReadStride; ++c) {
+      ptrs[c].resize(counts.size(), NULL);
+      for (size_t idx = 0, offset = 0; idx < counts.size(); ++idx) {
+        if (counts[idx] > 0) {
+          ptrs[c][idx] = &data[offset * k_exrReadStride + c];
+        }
+        offset += counts[idx];
+      }
+      frameBuffer.insert(c == 0 ? "Z" : names[c - 1],
+                         Imf::DeepSlice(Imf::FLOAT, 
+                                        reinterpret_cast<char *>
+                                        (&ptrs[c][0] - origin),
+                                        sizeof(float *), 
+                                        sizeof(float *) * width, 
+                                        sizeof(float) * k_exrReadStride));
+    }
+    file.setFrameBuffer(frameBuffer);
+    file.readPixels(dw.min.y, dw.max.y);
+
+    // Composite each pixel's samples front to back
+    image->setSize(width, height);
+    image->setNumSamples(std::max(maxSamples, static_cast<size_t>(1)));
+    ColorCurve::SampleVec samples, curve;
+    for (size_t j = 0, offset = 0; j < height; ++j) {
+      for (size_t i = 0; i < width; ++i) {
+        const size_t count = counts[i + j * width];
+        samples.clear();
+        for (size_t s = 0; s < count; ++s, ++offset) {
+          const float *d = &data[offset * k_exrReadStride];
+          samples.push_back(std::make_pair(d[0], Color(d[1], d[2], d[3])));
+        }
+        std::stable_sort(samples.begin(), samples.end(), depthLess);
+        Color value = 
+          contents == Transmittance ? Colors::one() : Colors::zero();
+        curve.clear();
+        if (samples.empty()) {
+          curve.push_back(std::make_pair(0.0f, value));
+        }
+        BOOST_FOREACH (const ColorCurve::Sample &s, samples) {
+          if (contents == Transmittance) {
+            value *= Colors::one() - s.second;
+          } else {
+            value += s.second;
+          }
+          curve.push_back(std::make_pair(s.first, value));
+        }
+        image->storePixel(i + (height - 1 - j) * width, curve);
+      }
+    }
+    image->compact();
+  }
+  catch (const std::exception &e) {
+    Log::warning("Couldn't read deep image " + filename + ": " + e.what());
+    return Ptr();
+  }
+
+  Log::print("Loaded deep image: " + filename);
+
+  return image;
+}
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+Util::ColorCurve::Ptr makeFixedSample(Util::ColorCurve::CPtr curve,
+                                      const size_t numSamples) 
+{
+  const ColorCurve::SampleVec &samples = curve->samples();
+
+  // Handle case of zero or one samples
+  if (samples.size() < 2) {
+    const Color value = samples.empty() ? Color(0.0) : samples[0].second;
+    return ColorCurve::Ptr(new ColorCurve(numSamples, value));
+  }
+
+  ColorCurve::SampleVec fixed(numSamples);
+  ColorCurve::Ptr       result(new ColorCurve);
+  if (numSamples > 0) {
+    resampleFixed(samples, numSamples, &fixed[0]);
+  }
+  BOOST_FOREACH (const ColorCurve::Sample &s, fixed) {
+    result->addSample(s.first, s.second);
   }
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,310 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Denoiser.cpp
+  Contains implementations of Denoiser class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Denoiser.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+#include <OpenEXR/ImathFun.h>
+
+// Project includes
+
+#include "pvr/Log.h"
+#include "pvr/Strings.h"
+#include "pvr/Threading.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  //! Keeps the relative difference of black pixels finite
+  const float k_epsilon = 1e-4f;
+
+  //--------------------------------------------------------------------------//
+
+  //! Squared difference of two values, relative to their magnitude
+  inline float relativeDistance(const float a, const float b)
+  {
+    const float d = a - b;
+    return d * d / (k_epsilon + a * a + b * b);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! What each thread needs to filter its rows. Pixels are RGBA floats in
+  //! scanline order, as in Image::pixels().
+  struct DenoiseJob
+  {
+    //! Copy of the noisy pixels, which the filter reads
+    const float *src;
+    //! Pixels of the image, which the filter writes
+    float *dst;
+    //! Pixels of each guide image
+    std::vector<const float*> guides;
+    int width;
+    int height;
+    int radius;
+    int patchRadius;
+    //! Turns the summed patch difference into an exponent
+    float patchScale;
+    //! Turns the summed guide difference into an exponent
+    float guideScale;
+    //! Turns the squared pixel distance into an exponent
+    float spatialScale;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Difference between the patches around two pixels. Patch pixels
+  //! outside the image are clamped to its edge.
+  float patchDistance(const DenoiseJob &job, const int px, const int py,
+                      const int qx, const int qy)
+  {
+    float d = 0.0f;
+    for (int oy = -job.patchRadius; oy <= job.patchRadius; ++oy) {
+      const int ay = Imath::clamp(py + oy, 0, job.height - 1);
+      const int by = Imath::clamp(qy + oy, 0, job.height - 1);
+      for (int ox = -job.patchRadius; ox <= job.patchRadius; ++ox) {
+        const int    ax = Imath::clamp(px + ox, 0, job.width - 1);
+        const int    bx = Imath::clamp(qx + ox, 0, job.width - 1);
+        const float *a  = job.src + 4 * (ay * job.width + ax);
+        const float *b  = job.src + 4 * (by * job.width + bx);
+        // Alpha is between zero and one, so its difference is absolute
+        const float  dA = a[3] - b[3];
+        d += relativeDistance(a[0], b[0]) + relativeDistance(a[1], b[1]) +
+          relativeDistance(a[2], b[2]) + dA * dA;
+      }
+    }
+    return d;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Filters the rows [begin, end) of the image
+  void denoiseRows(const DenoiseJob &job, const size_t begin,
+                   const size_t end)
+  {
+    for (int y = begin; y < static_cast<int>(end); ++y) {
+      const int yMin = std::max(y - job.radius, 0);
+      const int yMax = std::min(y + job.radius, job.height - 1);
+      for (int x = 0; x < job.width; ++x) {
+        const int    xMin = std::max(x - job.radius, 0);
+        const int    xMax = std::min(x + job.radius, job.width - 1);
+        const size_t p    = 4 * (y * job.width + x);
+        float sum[4]      = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float sumWeight   = 0.0f;
+        for (int qy = yMin; qy <= yMax; ++qy) {
+          for (int qx = xMin; qx <= xMax; ++qx) {
+            const size_t q = 4 * (qy * job.width + qx);
+            float g = 0.0f;
+            BOOST_FOREACH (const float *guide, job.guides) {
+              g += relativeDistance(guide[p], guide[q]) +
+                relativeDistance(guide[p + 1], guide[q + 1]) +
+                relativeDistance(guide[p + 2], guide[q + 2]);
+            }
+            const float dx = qx - x;
+            const float dy = qy - y;
+            // The pixel itself has a weight of one
+            const float weight =
+              std::exp(-patchDistance(job, x, y, qx, qy) * job.patchScale -
+                       g * job.guideScale -
+                       (dx * dx + dy * dy) * job.spatialScale);
+            for (int c = 0; c < 4; ++c) {
+              sum[c] += weight * job.src[q + c];
+            }
+            sumWeight += weight;
+          }
+        }
+        for (int c = 0; c < 4; ++c) {
+          job.dst[p + c] = sum[c] / sumWeight;
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// Denoiser
+//----------------------------------------------------------------------------//
+
+Denoiser::Denoiser()
+  : m_radius(5), m_patchRadius(1), m_strength(0.3f), m_guideSigma(0.1f)
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+void Denoiser::setRadius(const size_t radius)
+{
+  m_radius = radius;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Denoiser::radius() const
+{
+  return m_radius;
+}
+
+//----------------------------------------------------------------------------//
+
+void Denoiser::setPatchRadius(const size_t radius)
+{
+  m_patchRadius = radius;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Denoiser::patchRadius() const
+{
+  return m_patchRadius;
+}
+
+//----------------------------------------------------------------------------//
+
+void Denoiser::setStrength(const float strength)
+{
+  m_strength = strength;
+}
+
+//----------------------------------------------------------------------------//
+
+float Denoiser::strength() const
+{
+  return m_strength;
+}
+
+//----------------------------------------------------------------------------//
+
+void Denoiser::setGuideSigma(const float sigma)
+{
+  m_guideSigma = sigma;
+}
+
+//----------------------------------------------------------------------------//
+
+float Denoiser::guideSigma() const
+{
+  return m_guideSigma;
+}
+
+//----------------------------------------------------------------------------//
+
+void Denoiser::apply(Image &image, const std::vector<Image::CPtr> &guides,
+                     const size_t numThreads) const
+{
+  const Imath::Box2i dw   = image.dataWindow();
+  const Imath::V2i   size = dw.size() + Imath::V2i(1);
+  if (m_radius == 0 || m_strength <= 0.0f || size.x <= 0 || size.y <= 0) {
+    return;
+  }
+
+  Timer timer;
+
+  DenoiseJob job;
+  BOOST_FOREACH (const Image::CPtr &guide, guides) {
+    if (!guide || guide->size() != image.size() ||
+        guide->dataWindow() != dw) {
+      Log::warning("Denoiser::apply() ignored a guide image that doesn't "
+                   "match the image");
+      continue;
+    }
+    job.guides.push_back(guide->pixels());
+  }
+
+  // Neighbors read the noisy pixels, not the ones already filtered
+  const size_t       numFloats = size.x * size.y * 4;
+  const float       *pixels    = image.pixels();
+  std::vector<float> src(pixels, pixels + numFloats);
+
+  const float patchWidth = 2.0f * m_patchRadius + 1.0f;
+  const float guideSigma = std::max(m_guideSigma, k_epsilon);
+  job.src          = &src[0];
+  job.dst          = image.pixels();
+  job.width        = size.x;
+  job.height       = size.y;
+  job.radius       = m_radius;
+  job.patchRadius  = m_patchRadius;
+  // Differences are averaged over the channels of the patch or guide
+  job.patchScale   = 1.0f /
+    (m_strength * m_strength * patchWidth * patchWidth * 4.0f);
+  job.guideScale   = 1.0f / (guideSigma * guideSigma * 3.0f);
+  job.spatialScale = 1.0f / (2.0f * m_radius * m_radius);
+
+  Util::ProgressReporter progress(std::numeric_limits<float>::max());
+  Sys::parallelFor(size.y, 1,
+                   boost::bind(&denoiseRows, boost::cref(job), _1, _2),
+                   Sys::numWorkerThreads(numThreads), progress);
+
+  Log::print("Denoised image in " + str(timer.elapsed()) + " seconds");
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
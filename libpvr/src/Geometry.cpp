@@ -33,10 +33,27 @@
 
 // System includes
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
 #include <string>
 
+#if defined(_WIN32)
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/foreach.hpp>
 
 #include <GPD-pvr/GPD_Detail.h>
@@ -45,9 +62,14 @@
 #include <GPD-pvr/GPD_PrimPart.h>
 #include <GPD-pvr/GPD_PrimPoly.h>
 
+#ifdef PVR_USE_PARTIO
+#include <Partio.h>
+#endif
+
 // Project includes
 
 #include "pvr/Log.h"
+#include "pvr/Threading.h"
 
 //----------------------------------------------------------------------------//
 
@@ -69,171 +91,768 @@ namespace {
   using namespace pvr::Geo;
 
   //--------------------------------------------------------------------------//
-  // AttrTraits<T>
+  // GPD loading
   //--------------------------------------------------------------------------//
 
-  template <class T>
-  struct AttrTraits
+  //! Primitives with at least this many points copy their attributes on 
+  //! separate threads
+  const size_t k_minParallelPoints = 16384;
+
+  //--------------------------------------------------------------------------//
+
+  typedef std::vector<const GPD_Point *> GPDPointVec;
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether the named attribute should be read. An empty list reads all 
+  //! attributes.
+  bool isWanted(const std::string &name, 
+                const std::vector<std::string> &attrNames)
   {
-    static AttrRef addAttr(const std::string &name, const size_t arraySize, 
-                           const std::vector<T> defaults, AttrTable &points);
-    static AttrRef attrRef(const std::string &name, const AttrTable &points);
-    static void setAttr   (const AttrRef &ref, const size_t idx, 
-                           const size_t arrayIdx, const T value, 
-                           AttrTable &points);
-  };
+    return attrNames.empty() || 
+      std::find(attrNames.begin(), attrNames.end(), name) != attrNames.end();
+  }
 
   //--------------------------------------------------------------------------//
 
-  template <>
-  struct AttrTraits<int>
+  //! Returns the extension of the filename in lower case, without the dot
+  std::string extension(const std::string &filename)
   {
-    static AttrRef addAttr(const std::string &name, const size_t arraySize, 
-                           const std::vector<int> defaults, AttrTable &points)
-    { 
-      return points.addIntAttr(name, arraySize, defaults); 
+    const size_t dot = filename.rfind('.');
+    if (dot == std::string::npos || 
+        filename.find('/', dot) != std::string::npos) {
+      return std::string();
     }
-    static AttrRef attrRef(const std::string &name, const AttrTable &points)
-    {
-      return points.intAttrRef(name);
-    }
-    static void setAttr(const AttrRef &ref, const size_t idx, 
-                        const size_t arrayIdx, const int value, 
-                        AttrTable &points)
-    { 
-      points.setIntAttr(ref, idx, arrayIdx, value); 
-    }
-  };
+    std::string ext = filename.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+  }
 
   //--------------------------------------------------------------------------//
 
-  template <>
-  struct AttrTraits<float>
+  //! A GPD point attribute, and the PVR attribute that it's copied to
+  struct AttrCopy
   {
-    static AttrRef addAttr(const std::string &name, const size_t arraySize, 
-                           const std::vector<float> defaults, AttrTable &points)
-    { 
-      return points.addFloatAttr(name, arraySize, defaults); 
-    }
-    static AttrRef attrRef(const std::string &name, const AttrTable &points)
-    {
-      return points.floatAttrRef(name);
-    }
-    static void setAttr(const AttrRef &ref, const size_t idx, 
-                        const size_t arrayIdx, const float value, 
-                        AttrTable &points)
-    { 
-      points.setFloatAttr(ref, idx, arrayIdx, value); 
-    }
+    AttrCopy(const GPD_Attribute *a, const GPD_AttribType t, const int o,
+             const AttrRef &r)
+      : attr(a), type(t), offset(o), ref(r)
+    { }
+    const GPD_Attribute *attr;
+    GPD_AttribType       type;
+    //! Offset of the attribute in each GPD point's data
+    int                  offset;
+    AttrRef              ref;
   };
 
+  typedef std::vector<AttrCopy> AttrCopyVec;
+
   //--------------------------------------------------------------------------//
-  // Utility functions
+
+  //! Returns the start of the given attribute's data in a GPD point
+  const char* attrData(const GPD_Point *point, const int offset)
+  {
+    return static_cast<const char *>(point->attribData.getData(offset));
+  }
+
   //--------------------------------------------------------------------------//
 
+  //! Copies the values of the GPD points, which are stored contiguously in 
+  //! each point, to elements of a PVR attribute column
   template <class T>
-  void addAttr(GPD_Detail &detail, const GPD_Attribute *attrPtr, 
-               const GPD_AttribType attrType, 
-               const std::vector<int> & vertList, 
-               const std::vector<int> & pvrVertList, AttrTable &points)
+  void copyColumn(const GPDPointVec &gpdPoints, const int offset, 
+                  const std::vector<int> &pvrVertList, const size_t arraySize,
+                  std::vector<T> &elems)
   {
-    const size_t    numVerts = vertList.size();
-    const string    attrName = attrPtr->getName();
-    const int       hAttrSize = attrPtr->getSize();
-    const int       pvrAttrSize = hAttrSize / sizeof(T);
-    const vector<T> defaults(pvrAttrSize, 0);
-    const int       offset = detail.pointAttribs().getOffset(attrName.c_str(), 
-                                                             hAttrSize, 
-                                                             attrType);
-    AttrRef         attrRef = AttrTraits<T>::attrRef(attrName, points);
-    if (!attrRef.isValid()) {
-       attrRef = AttrTraits<T>::addAttr(attrName, pvrAttrSize, 
-                                        defaults, points);
+    const size_t numBytes = arraySize * sizeof(T);
+    for (size_t idx = 0, size = gpdPoints.size(); idx < size; idx++) {
+      std::memcpy(&elems[pvrVertList[idx] * arraySize], 
+                  attrData(gpdPoints[idx], offset), numBytes);
     }
-    for (size_t idx = 0; idx < numVerts; idx++) {
-      for (int arrayIdx = 0; arrayIdx < pvrAttrSize; arrayIdx++) {
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies string attribute values. Each distinct GPD string is added to 
+  //! the PVR string table once.
+  void copyStringColumn(const GPDPointVec &gpdPoints, const AttrCopy &c,
+                        const std::vector<int> &pvrVertList, 
+                        AttrTable &points)
+  {
+    AttrTable::StringIdxVec &elems = points.stringIdxAttrElems(c.ref);
+    std::vector<long>        tableIdx;
+    for (size_t idx = 0, size = gpdPoints.size(); idx < size; idx++) {
+      int strIdx;
+      std::memcpy(&strIdx, attrData(gpdPoints[idx], c.offset), sizeof(int));
+      if (strIdx >= static_cast<int>(tableIdx.size())) {
+        tableIdx.resize(strIdx + 1, -1);
+      }
+      if (tableIdx[strIdx] < 0) {
 #ifdef GPD_VERSION_NS
-        const GPD_Point *point = &detail.points[vertList[idx]];
+        const char *str = c.attr->indexArray[strIdx];
 #else
-        const GPD_Point *point = detail.point(vertList[idx]);
+        const char *str = c.attr->getIndex(strIdx);
 #endif
-        void *data = point->attribData.getData(offset + arrayIdx * sizeof(T));
-        T val = *reinterpret_cast<T *>(data);
-        AttrTraits<T>::setAttr(attrRef, pvrVertList[idx], arrayIdx, val, points);
+        tableIdx[strIdx] = points.addStringToTable(c.ref, string(str));
       }
+      elems[pvrVertList[idx]] = tableIdx[strIdx];
     }
   }
 
   //--------------------------------------------------------------------------//
-  
-  void addVectorAttr(GPD_Detail &detail, const GPD_Attribute *attrPtr, 
-                     const GPD_AttribType attrType, 
-                     const std::vector<int> & vertList, 
-                     const std::vector<int> & pvrVertList, AttrTable &points)
+
+  //! Copies the attributes in [begin, end). Each attribute only writes to
+  //! its own column, so ranges may be copied concurrently.
+  void copyAttrs(const AttrCopyVec &copies, const GPDPointVec &gpdPoints, 
+                 const std::vector<int> &pvrVertList, AttrTable &points,
+                 const size_t begin, const size_t end)
   {
-    const size_t    numVerts = vertList.size();
-    const string    attrName = attrPtr->getName();
-    const int       hAttrSize = attrPtr->getSize();
-    const V3f       defaults(0.0);
-    const int       offset = detail.pointAttribs().getOffset(attrName.c_str(), 
-                                                             hAttrSize, 
-                                                             attrType);
-    AttrRef         attrRef = points.vectorAttrRef(attrName);
-    if (!attrRef.isValid()) {
-       attrRef = points.addVectorAttr(attrName, defaults);
+    for (size_t i = begin; i < end; i++) {
+      const AttrCopy &c = copies[i];
+      switch (c.type) {
+      case GPD_ATTRIB_INT:
+        copyColumn(gpdPoints, c.offset, pvrVertList, c.ref.arraySize(), 
+                   points.intAttrElems(c.ref));
+        break;
+      case GPD_ATTRIB_FLOAT:
+        copyColumn(gpdPoints, c.offset, pvrVertList, c.ref.arraySize(), 
+                   points.floatAttrElems(c.ref));
+        break;
+      case GPD_ATTRIB_VECTOR:
+        copyColumn(gpdPoints, c.offset, pvrVertList, 1, 
+                   points.vectorAttrElems(c.ref));
+        break;
+      default:
+        copyStringColumn(gpdPoints, c, pvrVertList, points);
+      }
     }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies the position and point attributes of the GPD points in vertList
+  //! to the PVR points in pvrVertList. Only the attributes in attrNames are
+  //! copied, unless it's empty.
+  void copyPoints(GPD_Detail &detail, const std::vector<int> &vertList, 
+                  const std::vector<int> &pvrVertList, 
+                  const std::vector<std::string> &attrNames, 
+                  AttrTable &points)
+  {
+    const size_t numVerts = vertList.size();
+
+    // Resolve each GPD point once, rather than once per attribute ---
+
+    GPDPointVec gpdPoints(numVerts);
     for (size_t idx = 0; idx < numVerts; idx++) {
 #ifdef GPD_VERSION_NS
-      void *data = 
-        detail.points[vertList[idx]].attribData.getData(offset);
+      gpdPoints[idx] = &detail.points[vertList[idx]];
 #else
-      void *data = 
-        detail.point(vertList[idx])->attribData.getData(offset);
+      gpdPoints[idx] = detail.point(vertList[idx]);
 #endif
-      V3f val = *reinterpret_cast<V3f *>(data);
-      points.setVectorAttr(attrRef, pvrVertList[idx], val);
+    }
+
+    // Then get point positions ---
+
+    AttrTable::VectorVec &wsP = 
+      points.vectorAttrElems(points.vectorAttrRef("P"));
+    for (size_t idx = 0; idx < numVerts; idx++) {
+      const GPD_Point *p = gpdPoints[idx];
+      wsP[pvrVertList[idx]] = V3f(p->pos[0], p->pos[1], p->pos[2]);
+    }
+
+    // Add any missing attributes. This changes the table, so it's done
+    // before any values are copied ---
+
+    AttrCopyVec    copies;
+    int            numPointAttrs = detail.pointAttribs().numAttribs();
+    GPD_Attribute *attrPtr       = detail.pointAttribs().getHead();
+
+    for (int iAttr = 0; iAttr < numPointAttrs; iAttr++) {
+      const GPD_AttribType attrType  = attrPtr->getType();
+      const string         attrName  = attrPtr->getName();
+      const int            hAttrSize = attrPtr->getSize();
+      if (!isWanted(attrName, attrNames)) {
+        attrPtr = static_cast<GPD_Attribute *>(attrPtr->next());
+        continue;
+      }
+      const int            offset    = 
+        detail.pointAttribs().getOffset(attrName.c_str(), hAttrSize, attrType);
+      AttrRef              ref;
+      switch (attrType) {
+      case GPD_ATTRIB_INT:
+        ref = points.intAttrRef(attrName);
+        if (!ref.isValid()) {
+          const size_t n = hAttrSize / sizeof(int);
+          ref = points.addIntAttr(attrName, n, vector<int>(n, 0));
+        }
+        break;
+      case GPD_ATTRIB_FLOAT:
+        ref = points.floatAttrRef(attrName);
+        if (!ref.isValid()) {
+          const size_t n = hAttrSize / sizeof(float);
+          ref = points.addFloatAttr(attrName, n, vector<float>(n, 0.0f));
+        }
+        break;
+      case GPD_ATTRIB_VECTOR:
+        ref = points.vectorAttrRef(attrName);
+        if (!ref.isValid()) {
+          ref = points.addVectorAttr(attrName, V3f(0.0));
+        }
+        break;
+      case GPD_ATTRIB_INDEX:
+        ref = points.stringAttrRef(attrName);
+        if (!ref.isValid()) {
+          ref = points.addStringAttr(attrName);
+        }
+        break;
+      default:
+        {
+          // Nothing
+        }
+      }
+      if (ref.isValid()) {
+        copies.push_back(AttrCopy(attrPtr, attrType, offset, ref));
+      }
+      // Advance to next attr. This is ugly but it's just how GPD works.
+      attrPtr = static_cast<GPD_Attribute *>(attrPtr->next());
+    }
+
+    // Then copy the values, one attribute per task for large primitives ---
+
+    if (numVerts >= k_minParallelPoints && copies.size() > 1) {
+      Util::ProgressReporter progress(std::numeric_limits<float>::max());
+      Sys::parallelFor(copies.size(), 1, 
+                       boost::bind(&copyAttrs, boost::cref(copies), 
+                                   boost::cref(gpdPoints), 
+                                   boost::cref(pvrVertList), 
+                                   boost::ref(points), _1, _2),
+                       Sys::numThreads(), progress);
+    } else {
+      copyAttrs(copies, gpdPoints, pvrVertList, points, 0, copies.size());
     }
   }
 
   //--------------------------------------------------------------------------//
+  // Partio loading
+  //--------------------------------------------------------------------------//
 
-  void addStringAttr(GPD_Detail &detail, const GPD_Attribute *attrPtr, 
-                     const GPD_AttribType attrType, 
-                     const std::vector<int> & vertList, 
-                     const std::vector<int> & pvrVertList, AttrTable &points)
+#ifdef PVR_USE_PARTIO
+
+  //! Number of particles whose values are fetched from Partio at a time
+  const int k_partioChunkSize = 65536;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the PVR name of a Partio attribute. Partio calls the standard
+  //! attributes by their full names.
+  std::string pvrAttrName(const std::string &partioName)
   {
-    const size_t    numVerts = vertList.size();
-    const string    attrName = attrPtr->getName();
-    const int       hAttrSize = attrPtr->getSize();
-    const V3f       defaults(0.0);
-    const int       offset = detail.pointAttribs().getOffset(attrName.c_str(), 
-                                                             hAttrSize, 
-                                                             attrType);
-    AttrRef         attrRef = points.stringAttrRef(attrName);
-    if (!attrRef.isValid()) {
-       attrRef = points.addStringAttr(attrName);
+    if (partioName == "position") {
+      return "P";
+    } else if (partioName == "velocity") {
+      return "v";
     }
-    for (size_t idx = 0; idx < numVerts; idx++) {
-#ifdef GPD_VERSION_NS
-      void *data = 
-        detail.points[vertList[idx]].attribData.getData(offset);
+    return partioName;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Fetches the values of one attribute into contiguous storage, a chunk
+  //! of particles at a time, so that only this attribute is decoded.
+  template <class T>
+  void copyPartioColumn(Partio::ParticlesDataMutable &data, 
+                        const Partio::ParticleAttribute &attr, T *values)
+  {
+    const int numParticles = data.numParticles();
+    std::vector<Partio::ParticleIndex> indices(k_partioChunkSize);
+    for (int start = 0; start < numParticles; start += k_partioChunkSize) {
+      const int count = std::min(k_partioChunkSize, numParticles - start);
+      for (int i = 0; i < count; ++i) {
+        indices[i] = start + i;
+      }
+      data.data<T>(attr, count, &indices[0], true, 
+                   values + static_cast<size_t>(start) * attr.count);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads a particle file through Partio. Only the attributes in attrNames
+  //! are decoded, unless it's empty. The position is always read.
+  Geometry::Ptr readPartio(const std::string &filename,
+                           const std::vector<std::string> &attrNames)
+  {
+    Partio::ParticlesDataMutable *data = Partio::read(filename.c_str());
+    if (!data) {
+      Log::warning("Couldn't load particle file: " + filename);
+      return Geometry::Ptr();
+    }
+
+    Particles::Ptr parts  = Particles::create();
+    AttrTable     &points = parts->pointAttrs();
+    parts->add(data->numParticles());
+
+    // Empty files have no columns to fill
+    const int numAttrs = data->numParticles() > 0 ? data->numAttributes() : 0;
+    for (int iAttr = 0; iAttr < numAttrs; ++iAttr) {
+      Partio::ParticleAttribute attr;
+      data->attributeInfo(iAttr, attr);
+      const std::string name = pvrAttrName(attr.name);
+      if (name != "P" && !isWanted(name, attrNames)) {
+        continue;
+      }
+      AttrRef ref;
+      switch (attr.type) {
+      case Partio::INT:
+        ref = points.intAttrRef(name);
+        if (!ref.isValid()) {
+          ref = points.addIntAttr(name, attr.count, 
+                                  vector<int>(attr.count, 0));
+        }
+        if (ref.arraySize() == static_cast<size_t>(attr.count)) {
+          copyPartioColumn(*data, attr, &points.intAttrElems(ref)[0]);
+        }
+        break;
+      case Partio::FLOAT:
+      case Partio::VECTOR:
+        if (attr.count == 3) {
+          ref = points.vectorAttrRef(name);
+          if (!ref.isValid()) {
+            ref = points.addVectorAttr(name, V3f(0.0));
+          }
+          copyPartioColumn(*data, attr, 
+                           &points.vectorAttrElems(ref)[0].x);
+        } else {
+          ref = points.floatAttrRef(name);
+          if (!ref.isValid()) {
+            ref = points.addFloatAttr(name, attr.count, 
+                                      vector<float>(attr.count, 0.0f));
+          }
+          if (ref.arraySize() == static_cast<size_t>(attr.count)) {
+            copyPartioColumn(*data, attr, &points.floatAttrElems(ref)[0]);
+          }
+        }
+        break;
+      case Partio::INDEXEDSTR:
+        if (attr.count == 1) {
+          const std::vector<std::string> &strs = data->indexedStrs(attr);
+          std::vector<int>                strIdx(data->numParticles());
+          std::vector<size_t>             remap;
+          ref = points.stringAttrRef(name);
+          if (!ref.isValid()) {
+            ref = points.addStringAttr(name);
+          }
+          BOOST_FOREACH (const std::string &str, strs) {
+            remap.push_back(points.addStringToTable(ref, str));
+          }
+          copyPartioColumn(*data, attr, &strIdx[0]);
+          AttrTable::StringIdxVec &elems = points.stringIdxAttrElems(ref);
+          for (size_t i = 0, end = strIdx.size(); i < end; ++i) {
+            if (strIdx[i] >= 0 && 
+                static_cast<size_t>(strIdx[i]) < remap.size()) {
+              elems[i] = remap[strIdx[i]];
+            }
+          }
+        }
+        break;
+      default:
+        {
+          // Nothing
+        }
+      }
+    }
+
+    data->release();
+
+    Log::print("Loaded file: " + filename);
+
+    Geometry::Ptr geo = Geometry::create();
+    geo->setParticles(parts);
+    return geo;
+  }
+
+#endif // PVR_USE_PARTIO
+
+  //--------------------------------------------------------------------------//
+  // Geometry cache
+  //--------------------------------------------------------------------------//
+
+  //! Identifies a PVR geometry cache file
+  const char            k_cacheMagic[8]  = { 'P', 'V', 'R', 'G', 
+                                             'E', 'O', 'C', '\0' };
+  const boost::uint32_t k_cacheVersion   = 1;
+  //! Column data starts on a multiple of this many bytes in the file
+  const size_t          k_cacheAlignment = 64;
+
+  //--------------------------------------------------------------------------//
+
+  enum CacheTable {
+    CacheGlobals = 0,
+    CacheParticles
+  };
+
+  //--------------------------------------------------------------------------//
+
+  enum CacheAttrType {
+    CacheInt = 0,
+    CacheFloat,
+    CacheVector,
+    CacheString
+  };
+
+  //--------------------------------------------------------------------------//
+
+  DECLARE_PVR_RT_EXC(CacheFormatException, "Invalid geometry cache:");
+
+  //--------------------------------------------------------------------------//
+
+  template <typename T>
+  void writePod(std::ostream &out, const T &value)
+  {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  void writeString(std::ostream &out, const std::string &s)
+  {
+    writePod<boost::uint64_t>(out, s.size());
+    out.write(s.data(), s.size());
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the size of the column followed by its data. The data is padded
+  //! to start at an aligned file offset.
+  void writeColumn(std::ostream &out, const void *data, const size_t numBytes)
+  {
+    static const char zeros[k_cacheAlignment] = { 0 };
+    writePod<boost::uint64_t>(out, numBytes);
+    const size_t pos = static_cast<size_t>(out.tellp());
+    out.write(zeros, (k_cacheAlignment - pos % k_cacheAlignment) % 
+              k_cacheAlignment);
+    if (numBytes > 0) {
+      out.write(static_cast<const char *>(data), numBytes);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  void writeAttrHeader(std::ostream &out, const CacheAttrType type, 
+                       const size_t arraySize, const std::string &name)
+  {
+    writePod<boost::uint32_t>(out, type);
+    writePod<boost::uint32_t>(out, arraySize);
+    writeString(out, name);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  void writeTable(std::ostream &out, const CacheTable kind, 
+                  const AttrTable &table)
+  {
+    const AttrTable::StringVec intNames    = table.intAttrNames();
+    const AttrTable::StringVec floatNames  = table.floatAttrNames();
+    const AttrTable::StringVec vectorNames = table.vectorAttrNames();
+    const AttrTable::StringVec stringNames = table.stringAttrNames();
+
+    writePod<boost::uint32_t>(out, kind);
+    writePod<boost::uint64_t>(out, table.size());
+    writePod<boost::uint64_t>(out, intNames.size() + floatNames.size() + 
+                              vectorNames.size() + stringNames.size());
+
+    BOOST_FOREACH (const std::string &name, intNames) {
+      const AttrRef            ref   = table.intAttrRef(name);
+      const AttrTable::IntVec &elems = table.intAttrElems(ref);
+      writeAttrHeader(out, CacheInt, ref.arraySize(), name);
+      writeColumn(out, elems.empty() ? NULL : &elems[0], 
+                  elems.size() * sizeof(int));
+    }
+    BOOST_FOREACH (const std::string &name, floatNames) {
+      const AttrRef              ref   = table.floatAttrRef(name);
+      const AttrTable::FloatVec &elems = table.floatAttrElems(ref);
+      writeAttrHeader(out, CacheFloat, ref.arraySize(), name);
+      writeColumn(out, elems.empty() ? NULL : &elems[0], 
+                  elems.size() * sizeof(float));
+    }
+    BOOST_FOREACH (const std::string &name, vectorNames) {
+      const AttrRef               ref   = table.vectorAttrRef(name);
+      const AttrTable::VectorVec &elems = table.vectorAttrElems(ref);
+      writeAttrHeader(out, CacheVector, 1, name);
+      writeColumn(out, elems.empty() ? NULL : &elems[0], 
+                  elems.size() * sizeof(V3f));
+    }
+    BOOST_FOREACH (const std::string &name, stringNames) {
+      const AttrRef ref        = table.stringAttrRef(name);
+      const size_t  numStrings = table.stringTableSize(ref);
+      writeAttrHeader(out, CacheString, 1, name);
+      writePod<boost::uint64_t>(out, numStrings);
+      for (size_t i = 0; i < numStrings; ++i) {
+        writeString(out, table.stringFromTable(ref, i));
+      }
+      // String indices are stored as 64 bit regardless of size_t
+      const AttrTable::StringIdxVec &elems = table.stringIdxAttrElems(ref);
+      std::vector<boost::uint64_t>   indices(elems.begin(), elems.end());
+      writeColumn(out, indices.empty() ? NULL : &indices[0], 
+                  indices.size() * sizeof(boost::uint64_t));
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Read-only view of an entire file. Uses mmap where available, so only
+  //! the pages that are touched get read from disk.
+  class MappedFile
+  {
+  public:
+    //! \param sharedMemory If true, name is a POSIX shared memory segment
+    //! rather than a file. The segment is mapped shared and read-only.
+    MappedFile(const std::string &name, const bool sharedMemory = false)
+      : m_data(NULL), m_size(0)
+    {
+#if defined(_WIN32)
+      if (sharedMemory) {
+        return;
+      }
+      std::ifstream in(name.c_str(), std::ios::binary);
+      if (in) {
+        m_buffer.assign(std::istreambuf_iterator<char>(in), 
+                        std::istreambuf_iterator<char>());
+        m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+        m_size = m_buffer.size();
+      }
 #else
-      void *data = 
-        detail.point(vertList[idx])->attribData.getData(offset);
+      int fd = sharedMemory ? shm_open(name.c_str(), O_RDONLY, 0) : 
+                              open(name.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return;
+      }
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *data = mmap(NULL, info.st_size, PROT_READ, 
+                          sharedMemory ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          madvise(data, info.st_size, MADV_SEQUENTIAL);
+          m_data = static_cast<const char *>(data);
+          m_size = info.st_size;
+        }
+      }
+      close(fd);
 #endif
-      int strIdx = *reinterpret_cast<int *>(data);
-#ifdef GPD_VERSION_NS
-      const char *str = attrPtr->indexArray[strIdx];
-#else
-      const char *str = attrPtr->getIndex(strIdx);
+    }
+    ~MappedFile()
+    {
+#if !defined(_WIN32)
+      if (m_data) {
+        munmap(const_cast<char *>(m_data), m_size);
+      }
+#endif
+    }
+    const char* data() const
+    { return m_data; }
+    size_t size() const
+    { return m_size; }
+  private:
+    MappedFile(const MappedFile &);
+    MappedFile& operator = (const MappedFile &);
+#if defined(_WIN32)
+    std::vector<char> m_buffer;
 #endif
-      points.setStringAttr(attrRef, pvrVertList[idx], string(str));
+    const char *m_data;
+    size_t      m_size;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Sequential, bounds-checked reads from a mapped cache file
+  class CacheReader
+  {
+  public:
+    CacheReader(const char *data, const size_t size)
+      : m_data(data), m_size(size), m_pos(0)
+    { }
+    template <typename T>
+    T read()
+    {
+      T value;
+      std::memcpy(&value, bytes(sizeof(T)), sizeof(T));
+      return value;
+    }
+    std::string readString()
+    {
+      const size_t length = read<boost::uint64_t>();
+      return std::string(bytes(length), length);
+    }
+    //! Returns the next column, which must hold the expected number of bytes
+    const char* readColumn(const size_t numBytes)
+    {
+      if (read<boost::uint64_t>() != numBytes) {
+        throw CacheFormatException("Column size mismatch");
+      }
+      bytes((k_cacheAlignment - m_pos % k_cacheAlignment) % k_cacheAlignment);
+      return bytes(numBytes);
+    }
+    //! Returns a pointer to the next n bytes and steps past them
+    const char* bytes(const size_t n)
+    {
+      if (n > m_size - m_pos) {
+        throw CacheFormatException("Unexpected end of file");
+      }
+      const char *result = m_data + m_pos;
+      m_pos += n;
+      return result;
+    }
+  private:
+    const char *m_data;
+    size_t      m_size;
+    size_t      m_pos;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads a column straight into the elements of an attribute
+  template <typename T>
+  void readColumn(CacheReader &reader, std::vector<T> &elems)
+  {
+    const size_t numBytes = elems.size() * sizeof(T);
+    const char  *column   = reader.readColumn(numBytes);
+    if (numBytes > 0) {
+      std::memcpy(&elems[0], column, numBytes);
     }
   }
-  
+
   //--------------------------------------------------------------------------//
 
+  void readTable(CacheReader &reader, AttrTable &table)
+  {
+    const size_t numElems = reader.read<boost::uint64_t>();
+    const size_t numAttrs = reader.read<boost::uint64_t>();
 
+    table.resize(numElems);
+
+    for (size_t iAttr = 0; iAttr < numAttrs; ++iAttr) {
+      const boost::uint32_t type      = reader.read<boost::uint32_t>();
+      const size_t          arraySize = reader.read<boost::uint32_t>();
+      const std::string     name      = reader.readString();
+      if (arraySize == 0) {
+        throw CacheFormatException("Zero array size for " + name);
+      }
+      AttrRef ref;
+      switch (type) {
+      case CacheInt:
+        ref = table.intAttrRef(name);
+        if (!ref.isValid()) {
+          ref = table.addIntAttr(name, arraySize, 
+                                 std::vector<int>(arraySize, 0));
+        }
+        if (ref.arraySize() != arraySize) {
+          throw CacheFormatException("Array size mismatch for " + name);
+        }
+        readColumn(reader, table.intAttrElems(ref));
+        break;
+      case CacheFloat:
+        ref = table.floatAttrRef(name);
+        if (!ref.isValid()) {
+          ref = table.addFloatAttr(name, arraySize, 
+                                   std::vector<float>(arraySize, 0.0f));
+        }
+        if (ref.arraySize() != arraySize) {
+          throw CacheFormatException("Array size mismatch for " + name);
+        }
+        readColumn(reader, table.floatAttrElems(ref));
+        break;
+      case CacheVector:
+        ref = table.vectorAttrRef(name);
+        if (!ref.isValid()) {
+          ref = table.addVectorAttr(name, V3f(0.0f));
+        }
+        readColumn(reader, table.vectorAttrElems(ref));
+        break;
+      case CacheString:
+        {
+          ref = table.stringAttrRef(name);
+          if (!ref.isValid()) {
+            ref = table.addStringAttr(name);
+          }
+          // Strings may end up at different indices in the new table
+          const size_t   numStrings = reader.read<boost::uint64_t>();
+          vector<size_t> remap;
+          for (size_t i = 0; i < numStrings; ++i) {
+            remap.push_back(table.addStringToTable(ref, reader.readString()));
+          }
+          AttrTable::StringIdxVec &elems  = table.stringIdxAttrElems(ref);
+          const char              *column = 
+            reader.readColumn(elems.size() * sizeof(boost::uint64_t));
+          for (size_t i = 0, end = elems.size(); i < end; ++i) {
+            boost::uint64_t strIdx;
+            std::memcpy(&strIdx, column + i * sizeof(strIdx), sizeof(strIdx));
+            if (strIdx >= numStrings) {
+              throw CacheFormatException("String index out of range in " + 
+                                         name);
+            }
+            elems[i] = remap[strIdx];
+          }
+        }
+        break;
+      default:
+        throw CacheFormatException("Unknown attribute type for " + name);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the global attributes and particles in the cache layout. Used
+  //! both for cache files and for shared memory segments.
+  void writeCacheData(std::ostream &out, const AttrTable &globalAttrs,
+                      Particles::CPtr particles)
+  {
+    out.write(k_cacheMagic, sizeof(k_cacheMagic));
+    writePod<boost::uint32_t>(out, k_cacheVersion);
+    writePod<boost::uint32_t>(out, particles ? 2 : 1);
+
+    writeTable(out, CacheGlobals, globalAttrs);
+    if (particles) {
+      writeTable(out, CacheParticles, particles->pointAttrs());
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Creates a Geometry from data in the cache layout.
+  //! \throws CacheFormatException if the data is malformed
+  Geometry::Ptr readCacheData(const char *data, const size_t size)
+  {
+    Geometry::Ptr  geo   = Geometry::create();
+    Particles::Ptr parts = Particles::create();
+
+    CacheReader reader(data, size);
+    if (std::memcmp(reader.bytes(sizeof(k_cacheMagic)), k_cacheMagic, 
+                    sizeof(k_cacheMagic)) != 0) {
+      throw CacheFormatException("Not a PVR geometry cache");
+    }
+    if (reader.read<boost::uint32_t>() != k_cacheVersion) {
+      throw CacheFormatException("Unsupported version");
+    }
+    const size_t numTables = reader.read<boost::uint32_t>();
+    for (size_t iTable = 0; iTable < numTables; ++iTable) {
+      switch (reader.read<boost::uint32_t>()) {
+      case CacheGlobals:
+        readTable(reader, geo->globalAttrs());
+        break;
+      case CacheParticles:
+        readTable(reader, parts->pointAttrs());
+        break;
+      default:
+        throw CacheFormatException("Unknown table");
+      }
+    }
+
+    geo->setParticles(parts);
+    geo->setPolygons(Polygons::create());
+    geo->setMeshes(Meshes::create());
+
+    return geo;
+  }
 
   //--------------------------------------------------------------------------//
 
@@ -269,8 +888,20 @@ Geometry::Ptr Geometry::create()
 //----------------------------------------------------------------------------//
 
 //! \todo Geometry::read is not done!
-Geometry::Ptr Geometry::read(const std::string &filename)
+Geometry::Ptr Geometry::read(const std::string &filename,
+                             const StringVec &attrNames)
 {
+  const std::string ext = extension(filename);
+  if (ext != "geo" && ext != "bgeo") {
+#ifdef PVR_USE_PARTIO
+    return readPartio(filename, attrNames);
+#else
+    Log::warning("Reading ." + ext + " files requires PVR_USE_PARTIO. " 
+                 "Trying GPD: " + filename);
+#endif
+  }
+
+
   Geometry::Ptr geo = Geometry::create();
   Particles::Ptr parts = Particles::create();
   Polygons::Ptr polys = Polygons::create();
@@ -301,59 +932,18 @@ Geometry::Ptr Geometry::read(const std::string &filename)
       AttrTable &points = parts->pointAttrs();
 
       size_t numVerts = particlePrim->nVtx;
+      size_t firstPoint = parts->size();
       parts->add(numVerts);
         
-      // First build vertex list ---
+      // Build vertex list, then copy the points ---
 
       vector<int> vertList(numVerts);
       vector<int> pvrVertList(numVerts);
       for (size_t idx = 0; idx < numVerts; idx++) {
         vertList[idx] = particlePrim->vtxList[idx].getPt()->getNum();
-        pvrVertList[idx] = idx;
-      }
-      
-      // Then get point positions ---
-
-      AttrRef pRef = points.vectorAttrRef("P");
-      for (size_t idx = 0; idx < numVerts; idx++) {
-#ifdef GPD_VERSION_NS
-        GPD_Point *p = &detail.points[vertList[idx]];
-#else
-        GPD_Point *p = detail.point(vertList[idx]);
-#endif
-        V3f wsP(p->pos[0], p->pos[1], p->pos[2]);
-        points.setVectorAttr(pRef, idx, wsP);
-      }
-      
-      // Then copy the other attributes ---
-
-      int numPointAttrs = detail.pointAttribs().numAttribs();
-      GPD_Attribute *attrPtr = detail.pointAttribs().getHead();
-      
-      for (int iAttr = 0; iAttr < numPointAttrs; iAttr++) {
-        GPD_AttribType attrType = attrPtr->getType();
-        switch (attrType) {
-        case GPD_ATTRIB_INT:
-          addAttr<int>(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_FLOAT:
-          addAttr<float>(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_VECTOR:
-          addVectorAttr(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_INDEX:
-          addStringAttr(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        default:
-          {
-            // Nothing
-          }
-        }
-
-        // Advance to next attr. This is ugly but it's just how GPD works.
-        attrPtr = static_cast<GPD_Attribute *>(attrPtr->next());
+        pvrVertList[idx] = firstPoint + idx;
       }
+      copyPoints(detail, vertList, pvrVertList, attrNames, points);
 
     } else if (polyPrim) {
 
@@ -372,7 +962,7 @@ Geometry::Ptr Geometry::read(const std::string &filename)
         polys->setVertex(polyIdx, iVert, pointIdx);
       }
 
-      // First build vertex lists ---
+      // Build vertex lists, then copy the points ---
 
       vector<int> vertList(numVerts);
       vector<int> pvrVertList(numVerts);
@@ -380,49 +970,7 @@ Geometry::Ptr Geometry::read(const std::string &filename)
         vertList[idx] = polyPrim->vtxList[idx].getPt()->getNum();
         pvrVertList[idx] = polys->pointForVertex(polyIdx, idx);
       }
-
-      // Then get point positions ---
-
-      AttrRef pRef = polys->pointAttrs().vectorAttrRef("P");
-      for (size_t iVert = 0; iVert < numVerts; iVert++) {
-#ifdef GPD_VERSION_NS
-        GPD_Point *p = &detail.points[vertList[iVert]];
-#else
-        GPD_Point *p = detail.point(vertList[iVert]);
-#endif
-        V3f wsP(p->pos[0], p->pos[1], p->pos[2]);
-        points.setVectorAttr(pRef, pvrVertList[iVert], wsP);
-      }
-
-      // Then copy the other attributes ---
-
-      int numPointAttrs = detail.pointAttribs().numAttribs();
-      GPD_Attribute *attrPtr = detail.pointAttribs().getHead();
-      
-      for (int iAttr = 0; iAttr < numPointAttrs; iAttr++) {
-        GPD_AttribType attrType = attrPtr->getType();
-        const string    attrName = attrPtr->getName();
-        switch (attrType) {
-        case GPD_ATTRIB_INT:
-          addAttr<int>(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_FLOAT:
-          addAttr<float>(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_VECTOR:
-          addVectorAttr(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_INDEX:
-          addStringAttr(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        default:
-          {
-            // Nothing
-          }
-        }
-        // Advance to next attr. This is ugly but it's just how GPD works.
-        attrPtr = static_cast<GPD_Attribute *>(attrPtr->next());
-      }
+      copyPoints(detail, vertList, pvrVertList, attrNames, points);
 
     } else if (meshPrim) {
       
@@ -435,7 +983,7 @@ Geometry::Ptr Geometry::read(const std::string &filename)
       size_t meshIdx = meshes->addMesh(numRows, numCols);
       size_t firstVertex = meshes->startPoint(meshIdx);
       
-      // First build vertex lists ---
+      // Build vertex lists, then copy the points ---
 
       vector<int> vertList(numVerts);
       vector<int> pvrVertList(numVerts);
@@ -446,49 +994,7 @@ Geometry::Ptr Geometry::read(const std::string &filename)
           pvrVertList[idx] = firstVertex + idx;
         }
       }
-
-      // Then get point positions ---
-
-      AttrRef pRef = meshes->pointAttrs().vectorAttrRef("P");
-      for (size_t iVert = 0; iVert < numVerts; iVert++) {
-#ifdef GPD_VERSION_NS
-        GPD_Point *p = &detail.points[vertList[iVert]];
-#else
-        GPD_Point *p = detail.point(vertList[iVert]);
-#endif
-        V3f wsP(p->pos[0], p->pos[1], p->pos[2]);
-        points.setVectorAttr(pRef, pvrVertList[iVert], wsP);
-      }
-
-      // Then copy the other attributes ---
-
-      int numPointAttrs = detail.pointAttribs().numAttribs();
-      GPD_Attribute *attrPtr = detail.pointAttribs().getHead();
-      
-      for (int iAttr = 0; iAttr < numPointAttrs; iAttr++) {
-        GPD_AttribType attrType = attrPtr->getType();
-        const string    attrName = attrPtr->getName();
-        switch (attrType) {
-        case GPD_ATTRIB_INT:
-          addAttr<int>(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_FLOAT:
-          addAttr<float>(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_VECTOR:
-          addVectorAttr(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        case GPD_ATTRIB_INDEX:
-          addStringAttr(detail, attrPtr, attrType, vertList, pvrVertList, points);
-          break;
-        default:
-          {
-            // Nothing
-          }
-        }
-        // Advance to next attr. This is ugly but it's just how GPD works.
-        attrPtr = static_cast<GPD_Attribute *>(attrPtr->next());
-      }
+      copyPoints(detail, vertList, pvrVertList, attrNames, points);
 
     } else {
       
@@ -509,6 +1015,142 @@ Geometry::Ptr Geometry::read(const std::string &filename)
 
 //----------------------------------------------------------------------------//
 
+bool Geometry::writeCache(const std::string &filename) const
+{
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  if (!out) {
+    Log::warning("Couldn't open geometry cache for writing: " + filename);
+    return false;
+  }
+
+  if ((m_polygons && m_polygons->size() > 0) || 
+      (m_meshes && m_meshes->size() > 0)) {
+    Log::warning("Geometry cache doesn't support polygons or meshes. "
+                 "Only particles will be written to " + filename);
+  }
+
+  writeCacheData(out, m_globalAttrs, m_particles);
+
+  if (!out) {
+    Log::warning("Couldn't write geometry cache: " + filename);
+    return false;
+  }
+
+  Log::print("Wrote geometry cache: " + filename);
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+Geometry::Ptr Geometry::readCache(const std::string &filename)
+{
+  MappedFile file(filename);
+  if (!file.data()) {
+    Log::warning("Couldn't open geometry cache: " + filename);
+    return Geometry::Ptr();
+  }
+
+  Geometry::Ptr geo;
+  try {
+    geo = readCacheData(file.data(), file.size());
+  } 
+  catch (const std::exception &e) {
+    Log::warning("Couldn't read geometry cache " + filename + ". " + 
+                 e.what());
+    return Geometry::Ptr();
+  }
+
+  Log::print("Loaded geometry cache: " + filename);
+
+  return geo;
+}
+
+//----------------------------------------------------------------------------//
+
+bool Geometry::writeShared(const std::string &name) const
+{
+#if defined(_WIN32)
+  Log::warning("Shared memory geometry isn't supported on Windows: " + name);
+  return false;
+#else
+  if ((m_polygons && m_polygons->size() > 0) || 
+      (m_meshes && m_meshes->size() > 0)) {
+    Log::warning("Shared memory geometry doesn't support polygons or "
+                 "meshes. Only particles will be written to " + name);
+  }
+
+  std::ostringstream out(std::ios::binary);
+  writeCacheData(out, m_globalAttrs, m_particles);
+  const std::string data = out.str();
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    Log::warning("Couldn't create shared memory segment: " + name);
+    return false;
+  }
+  bool success = false;
+  if (ftruncate(fd, data.size()) == 0) {
+    void *segment = mmap(NULL, data.size(), PROT_READ | PROT_WRITE, 
+                         MAP_SHARED, fd, 0);
+    if (segment != MAP_FAILED) {
+      std::memcpy(segment, data.data(), data.size());
+      munmap(segment, data.size());
+      success = true;
+    }
+  }
+  close(fd);
+
+  if (!success) {
+    Log::warning("Couldn't write shared memory segment: " + name);
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  Log::print("Wrote shared memory geometry: " + name);
+
+  return true;
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+Geometry::Ptr Geometry::readShared(const std::string &name)
+{
+  MappedFile segment(name, true);
+  if (!segment.data()) {
+    Log::warning("Couldn't attach to shared memory geometry: " + name);
+    return Geometry::Ptr();
+  }
+
+  Geometry::Ptr geo;
+  try {
+    geo = readCacheData(segment.data(), segment.size());
+  } 
+  catch (const std::exception &e) {
+    Log::warning("Couldn't read shared memory geometry " + name + ". " + 
+                 e.what());
+    return Geometry::Ptr();
+  }
+
+  Log::print("Loaded shared memory geometry: " + name);
+
+  return geo;
+}
+
+//----------------------------------------------------------------------------//
+
+bool Geometry::removeShared(const std::string &name)
+{
+#if defined(_WIN32)
+  return false;
+#else
+  return shm_unlink(name.c_str()) == 0;
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
 void Geometry::setParticles(Particles::Ptr particles)
 {
   m_particles = particles;
@@ -38,6 +38,7 @@
 // Project includes
 
 #include "pvr/Log.h"
+#include "pvr/Trace.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -67,6 +68,11 @@ void Globals::init()
   if (debugLog) {
     Util::Log::print("Debug printouts enabled.");
   }
+  const char *traceFile = getenv("PVR_TRACE");
+  if (traceFile && traceFile[0] != '\0') {
+    Trace::start(traceFile);
+    Util::Log::print("Tracing to " + std::string(traceFile));
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -31,14 +31,24 @@
 
 #include "pvr/Image.h"
 
+// System includes
+
+#include <algorithm>
+#include <vector>
 
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
 #include <OpenImageIO/color.h>
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/imageio.h>
 
 // Project includes
 
 #include "pvr/Log.h"
+#include "pvr/Trace.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -47,6 +57,53 @@
 using namespace pvr::Util;
 using namespace OpenImageIO;
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  const char *k_channelNames[4] = { "R", "G", "B", "A" };
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns whether the filename has an EXR extension
+  bool isExr(const std::string &filename)
+  {
+    const size_t len = filename.size();
+    return len >= 3 && filename.substr(len - 3) == "exr";
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the pixels in a single call. Rows are flipped on output, so 
+  //! lastRow points to the last row in memory, which is the first row of
+  //! the file, and the rows are stepped through backwards.
+  bool writePixels(const std::string &filename, const ImageSpec &spec,
+                   const float *lastRow, const stride_t xStride,
+                   const stride_t yStride)
+  {
+    // Use all the threads for encoding EXR files
+    OpenImageIO::attribute("exr_threads", 
+                           static_cast<int>(pvr::Sys::numThreads()));
+
+    ImageOutput *out = ImageOutput::create(filename);
+    if (!out) {
+      return false;
+    }
+    bool success = out->open(filename, spec) &&
+      out->write_image(TypeDesc::FLOAT, lastRow, xStride, -yStride);
+    success = out->close() && success;
+    delete out;
+    return success;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 
 namespace pvr {
@@ -56,6 +113,17 @@ namespace Render {
 // Image
 //----------------------------------------------------------------------------//
 
+Image::Image()
+  : m_size(0), 
+    m_dataWindow(Imath::V2i(0), Imath::V2i(-1)),
+    m_pixelType(FloatPixels),
+    m_compression("zip")
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
 Image::Ptr Image::create()
 { 
   return Ptr(new Image); 
@@ -72,118 +140,392 @@ Image::Ptr Image::clone()
 
 void Image::setSize(const size_t width, const size_t height)
 {
-  using namespace OpenImageIO;
+  m_size       = Imath::V2i(width, height);
+  m_dataWindow = Imath::Box2i(Imath::V2i(0), m_size - Imath::V2i(1));
+  m_pixels.assign(width * height * 4, 0.0f);
+}
   
-  ImageSpec spec(width, height, 4, TypeDesc::FLOAT);
-  spec.attribute("oiio:ColorSpace", "Linear");
-  m_buf.alloc(spec);
+//----------------------------------------------------------------------------//
+
+void Image::setDataWindow(const Imath::Box2i &window)
+{
+  const Imath::V2i res = size();
+  const Imath::V2i wMin(std::max(window.min.x, 0), std::max(window.min.y, 0));
+  const Imath::V2i wMax(std::min(window.max.x, res.x - 1), 
+                        std::min(window.max.y, res.y - 1));
+  
+  assert(wMin.x <= wMax.x && wMin.y <= wMax.y && "Empty data window");
+
+  const Imath::V2i wSize = wMax - wMin + Imath::V2i(1);
+  m_dataWindow = Imath::Box2i(wMin, wMax);
+  m_pixels.assign(wSize.x * wSize.y * 4, 0.0f);
 }
   
 //----------------------------------------------------------------------------//
 
 void Image::setPixel(const size_t x, const size_t y, const Color &value)
 {
-  assert(static_cast<int>(x) <= m_buf.xmax() && "x out of range");
-  assert(static_cast<int>(y) <= m_buf.ymax() && "y out of range");
-  m_buf.setpixel(x, y, &value.x, 3);
+  assert(m_dataWindow.intersects(Imath::V2i(x, y)) && "Pixel out of range");
+  float *pixel = &m_pixels[index(x, y)];
+  pixel[0] = value.x;
+  pixel[1] = value.y;
+  pixel[2] = value.z;
 }
   
 //----------------------------------------------------------------------------//
 
 void Image::setPixelAlpha(const size_t x, const size_t y, const float value)
 {
-  float col[4];
-  m_buf.getpixel(x, y, col, 3);
-  col[3] = value;
-  m_buf.setpixel(x, y, col, 4);
+  assert(m_dataWindow.intersects(Imath::V2i(x, y)) && "Pixel out of range");
+  m_pixels[index(x, y) + 3] = value;
 }
   
 //----------------------------------------------------------------------------//
 
 Imath::V2i Image::size() const
 { 
-  return Imath::V2i(m_buf.xmax() + 1, m_buf.ymax() + 1); 
+  return m_size;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::Box2i Image::dataWindow() const
+{ 
+  return m_dataWindow;
 }
 
 //----------------------------------------------------------------------------//
 
 Color Image::pixel(const size_t x, const size_t y) const
 {
-  Color col;
-  m_buf.getpixel(x, y, &col.x, 3);
-  return col;
+  if (!m_dataWindow.intersects(Imath::V2i(x, y))) {
+    return Color(0.0f);
+  }
+  const float *pixel = &m_pixels[index(x, y)];
+  return Color(pixel[0], pixel[1], pixel[2]);
 }
 
 //----------------------------------------------------------------------------//
 
 float Image::pixelAlpha(const size_t x, const size_t y) const
 {
-  float value[4];
-  m_buf.getpixel(x, y, value, 4);
-  return value[3];
+  if (!m_dataWindow.intersects(Imath::V2i(x, y))) {
+    return 0.0f;
+  }
+  return m_pixels[index(x, y) + 3];
+}
+
+//----------------------------------------------------------------------------//
+
+float* Image::pixels()
+{
+  return m_pixels.empty() ? NULL : &m_pixels[0];
+}
+
+//----------------------------------------------------------------------------//
+
+const float* Image::pixels() const
+{
+  return m_pixels.empty() ? NULL : &m_pixels[0];
+}
+
+//----------------------------------------------------------------------------//
+
+void Image::merge(const Image &part)
+{
+  const Imath::Box2i &window     = m_dataWindow;
+  const Imath::Box2i &partWindow = part.m_dataWindow;
+
+  const int xMin = std::max(window.min.x, partWindow.min.x);
+  const int xMax = std::min(window.max.x, partWindow.max.x);
+  if (xMin > xMax) {
+    return;
+  }
+
+  for (int j = std::max(window.min.y, partWindow.min.y), 
+         yMax = std::min(window.max.y, partWindow.max.y); j <= yMax; ++j) {
+    // Rows are contiguous in both images
+    float       *row     = &m_pixels[index(xMin, j)];
+    const float *partRow = &part.m_pixels[part.index(xMin, j)];
+    for (int c = 0, size = (xMax - xMin + 1) * 4; c < size; ++c) {
+      row[c] += partRow[c];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Image::setPixelType(const PixelType type)
+{
+  m_pixelType = type;
+}
+
+//----------------------------------------------------------------------------//
+
+Image::PixelType Image::pixelType() const
+{
+  return m_pixelType;
+}
+
+//----------------------------------------------------------------------------//
+
+void Image::setCompression(const std::string &compression)
+{
+  m_compression = compression;
+}
+
+//----------------------------------------------------------------------------//
+
+const std::string& Image::compression() const
+{
+  return m_compression;
 }
 
 //----------------------------------------------------------------------------//
 
 void Image::write(const std::string &filename, Channels channels) const
 {
+  Sys::Trace::Scope trace("Image::write", "io");
+
   Log::print("Writing image: " + filename);
 
-  size_t len = filename.size();
-  if (filename.substr(len-3,len) != "exr") {
+  const Imath::V2i   res         = m_dataWindow.size() + Imath::V2i(1);
+  const int          numChannels = channels == RGBA ? 4 : 3;
+  const stride_t     xStride     = 4 * sizeof(float);
+  const stride_t     yStride     = res.x * xStride;
+  bool               success     = false;
+
+  if (m_pixels.empty()) {
+    Log::warning("Can't write empty image: " + filename);
+    return;
+  }
+
+  if (!isExr(filename)) {
     
-    ImageSpec spec = m_buf.spec();
+    // Only the data window is written, with the origin at its corner
+    ImageSpec spec(res.x, res.y, numChannels, m_pixelType == HalfPixels ? 
+                   TypeDesc::HALF : TypeDesc::FLOAT);
     spec.attribute("oiio:ColorSpace", "sRGB");
 
-    ImageBuf buf("", spec);
-    
-    for (int j = 0, ymax = buf.ymax(); j <= ymax; ++j) {
-      int invertedJ = buf.ymax() - j;
-      for (int i = 0, xmax = buf.xmax(); i <= xmax; ++i) {
-        float pixel[4];
-        m_buf.getpixel(i, j, pixel, 4);
-        for (int c = 0; c < 3; c++) {
-          pixel[c] = linear_to_sRGB(pixel[c]);
-        }
-        pixel[3] = 1.0f;
-        buf.setpixel(i, invertedJ, pixel);
+    // Convert to sRGB, and make the image opaque
+    std::vector<float> converted(m_pixels);
+    for (size_t i = 0, size = converted.size(); i < size; i += 4) {
+      for (int c = 0; c < 3; c++) {
+        converted[i + c] = linear_to_sRGB(converted[i + c]);
       }
+      converted[i + 3] = 1.0f;
     }
-    
-    buf.save(filename);
+
+    success = writePixels(filename, spec, 
+                          &converted[converted.size() - res.x * 4], 
+                          xStride, yStride);
 
   } else {
 
-    ImageBuf buf("", m_buf.spec());
-    
-    for (int j = 0, ymax = buf.ymax(); j <= ymax; ++j) {
-      int invertedJ = ymax - j;
-      for (int i = 0, xmax = buf.xmax(); i <= xmax; ++i) {
-        float pixel[4];
-        m_buf.getpixel(i, j, pixel, 4);
-        buf.setpixel(i, invertedJ, pixel);
+    // Rows are flipped on output, which moves the data window
+    ImageSpec spec(res.x, res.y, numChannels, m_pixelType == HalfPixels ? 
+                   TypeDesc::HALF : TypeDesc::FLOAT);
+    spec.x           = m_dataWindow.min.x;
+    spec.y           = m_size.y - 1 - m_dataWindow.max.y;
+    spec.full_x      = 0;
+    spec.full_y      = 0;
+    spec.full_width  = m_size.x;
+    spec.full_height = m_size.y;
+    spec.alpha_channel = numChannels == 4 ? 3 : -1;
+    spec.attribute("oiio:ColorSpace", "Linear");
+    spec.attribute("compression", m_compression);
+
+    success = writePixels(filename, spec, 
+                          &m_pixels[m_pixels.size() - res.x * 4],
+                          xStride, yStride);
+
+  }
+
+  if (!success) {
+    Log::warning("Couldn't write image: " + filename);
+    return;
+  }
+
+  Log::print("  Done.");
+}
+
+//----------------------------------------------------------------------------//
+
+Sys::BackgroundTask::Ptr 
+Image::writeAsync(const std::string &filename, Channels channels) const
+{
+  Ptr snapshot(new Image(*this));
+  return Sys::BackgroundTask::run(boost::bind(&Image::write, snapshot, 
+                                              filename, channels));
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Image::read(const std::string &filename)
+{
+  ImageBuf in(filename);
+  if (!in.read(0, 0, true, TypeDesc::FLOAT)) {
+    Log::warning("Couldn't read image: " + filename);
+    return Ptr();
+  }
+
+  // Rows were flipped on output, which moved the data window
+  const ImageSpec &spec   = in.spec();
+  const int        height = static_cast<int>(spec.full_height);
+  
+  Ptr image = create();
+  image->setSize(spec.full_width, spec.full_height);
+  image->setDataWindow(Imath::Box2i(Imath::V2i(in.xmin(), 
+                                               height - 1 - in.ymax()),
+                                    Imath::V2i(in.xmax(), 
+                                               height - 1 - in.ymin())));
+
+  for (int j = in.ymin(), ymax = in.ymax(); j <= ymax; ++j) {
+    int invertedJ = height - 1 - j;
+    for (int i = in.xmin(), xmax = in.xmax(); i <= xmax; ++i) {
+      // Files without alpha are opaque
+      float *pixel = &image->m_pixels[image->index(i, invertedJ)];
+      pixel[3] = 1.0f;
+      in.getpixel(i, j, pixel, 4);
+    }
+  }
+
+  return image;
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Image::readChannel(const std::string &filename, 
+                              const std::string &channel)
+{
+  ImageBuf in(filename);
+  if (!in.read(0, 0, true, TypeDesc::FLOAT)) {
+    Log::warning("Couldn't read image: " + filename);
+    return Ptr();
+  }
+
+  const ImageSpec &spec   = in.spec();
+  const int        index  = spec.channelindex(channel);
+  const int        height = static_cast<int>(spec.full_height);
+  if (index < 0) {
+    Log::warning("Image has no channel " + channel + ": " + filename);
+    return Ptr();
+  }
+  
+  Ptr image = create();
+  image->setSize(spec.full_width, spec.full_height);
+  image->setDataWindow(Imath::Box2i(Imath::V2i(in.xmin(), 
+                                               height - 1 - in.ymax()),
+                                    Imath::V2i(in.xmax(), 
+                                               height - 1 - in.ymin())));
+
+  std::vector<float> values(spec.nchannels);
+  for (int j = in.ymin(), ymax = in.ymax(); j <= ymax; ++j) {
+    int invertedJ = height - 1 - j;
+    for (int i = in.xmin(), xmax = in.xmax(); i <= xmax; ++i) {
+      in.getpixel(i, j, &values[0], spec.nchannels);
+      float *pixel = &image->m_pixels[image->index(i, invertedJ)];
+      pixel[0] = pixel[1] = pixel[2] = values[index];
+      pixel[3] = 1.0f;
+    }
+  }
+
+  return image;
+}
+
+//----------------------------------------------------------------------------//
+
+bool Image::writeLayers(const std::string &filename, const LayerVec &layers)
+{
+  Sys::Trace::Scope trace("Image::writeLayers", "io");
+
+  if (layers.empty() || !isExr(filename)) {
+    Log::warning("Image::writeLayers() needs at least one layer and an EXR "
+                 "file: " + filename);
+    return false;
+  }
+
+  Log::print("Writing image layers: " + filename);
+
+  const Image       &first  = *layers[0].image;
+  const Imath::V2i   res    = first.m_dataWindow.size() + Imath::V2i(1);
+
+  // Rows are flipped on output, which moves the data window
+  ImageSpec spec(res.x, res.y, 0, first.m_pixelType == HalfPixels ? 
+                 TypeDesc::HALF : TypeDesc::FLOAT);
+  spec.x           = first.m_dataWindow.min.x;
+  spec.y           = first.m_size.y - 1 - first.m_dataWindow.max.y;
+  spec.full_x      = 0;
+  spec.full_y      = 0;
+  spec.full_width  = first.m_size.x;
+  spec.full_height = first.m_size.y;
+  spec.channelnames.clear();
+  spec.alpha_channel = -1;
+  BOOST_FOREACH (const Layer &layer, layers) {
+    const int numChannels = layer.channels == RGBA ? 4 : 3;
+    for (int c = 0; c < numChannels; ++c) {
+      if (layer.name.empty() && c == 3) {
+        spec.alpha_channel = spec.channelnames.size();
       }
+      const std::string channel = 
+        c < static_cast<int>(layer.channelNames.size()) ? 
+        layer.channelNames[c] : std::string(k_channelNames[c]);
+      spec.channelnames.push_back(layer.name.empty() ? channel :
+                                  layer.name + "." + channel);
     }
-    
-    buf.save(filename);
+  }
+  spec.nchannels = spec.channelnames.size();
+  spec.attribute("oiio:ColorSpace", "Linear");
+  spec.attribute("compression", first.m_compression);
+
+  // Interleave the layers' channels
+  const size_t       numPixels = res.x * res.y;
+  std::vector<float> pixels(numPixels * spec.nchannels);
+  size_t             offset    = 0;
+  BOOST_FOREACH (const Layer &layer, layers) {
+    const int    numChannels = layer.channels == RGBA ? 4 : 3;
+    const float *src         = layer.image->pixels();
+    for (size_t i = 0; i < numPixels; ++i) {
+      for (int c = 0; c < numChannels; ++c) {
+        pixels[i * spec.nchannels + offset + c] = src[i * 4 + c];
+      }
+    }
+    offset += numChannels;
+  }
 
+  const stride_t xStride = spec.nchannels * sizeof(float);
+  if (!writePixels(filename, spec, &pixels[(numPixels - res.x) * 
+                                           spec.nchannels],
+                   xStride, res.x * xStride)) {
+    Log::warning("Couldn't write image: " + filename);
+    return false;
   }
 
   Log::print("  Done.");
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Image::index(const size_t x, const size_t y) const
+{
+  const size_t width = m_dataWindow.max.x - m_dataWindow.min.x + 1;
+  return ((y - m_dataWindow.min.y) * width + (x - m_dataWindow.min.x)) * 4;
 }
 
 //----------------------------------------------------------------------------//
 
 Image::pixel_iterator Image::begin() 
 { 
-  return pixel_iterator(*this, 0, 0); 
+  return pixel_iterator(*this, m_dataWindow.min.x, m_dataWindow.min.y); 
 }
 
 //----------------------------------------------------------------------------//
 
 Image::pixel_iterator Image::end() 
 { 
-  return pixel_iterator(*this, m_buf.xmin(), m_buf.ymax() + 1); 
+  return pixel_iterator(*this, m_dataWindow.min.x, m_dataWindow.max.y + 1); 
 }
 
 //----------------------------------------------------------------------------//
@@ -192,7 +534,7 @@ Image::pixel_iterator Image::end()
 
 Image::pixel_iterator::pixel_iterator(Image &image, const size_t xPos, 
                                       const size_t yPos)
-  : x(xPos), y(yPos), m_image(image), m_size(image.size())
+  : x(xPos), y(yPos), m_image(image), m_window(image.dataWindow())
 { 
 
 }
@@ -203,9 +545,9 @@ const Image::pixel_iterator&
 Image::pixel_iterator::operator ++ ()
 { 
   x++;
-  if (x == m_size.x) {
+  if (static_cast<int>(x) > m_window.max.x) {
     y++;
-    x = 0;
+    x = m_window.min.x;
   } 
   return *this;
 }
@@ -235,8 +577,11 @@ void Image::pixel_iterator::setPixelAlpha(const float alpha)
 
 float Image::pixel_iterator::progress() const
 { 
-  return static_cast<float>(x + y * m_size.x) / 
-    static_cast<float>(m_size.x * m_size.y);
+  const Imath::V2i size = m_window.size() + Imath::V2i(1);
+  const int        i    = static_cast<int>(x) - m_window.min.x;
+  const int        j    = static_cast<int>(y) - m_window.min.y;
+  return static_cast<float>(i + j * size.x) / 
+    static_cast<float>(size.x * size.y);
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,187 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file InScatterCache.cpp
+  Contains implementations of InScatterCache class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/InScatterCache.h"
+
+// System includes
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Math.h"
+#include "pvr/PhaseFunction.h"
+#include "pvr/Stats.h"
+#include "pvr/Lights/Light.h"
+#include "pvr/Occluders/Occluder.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  Imath::V3i bufferResolution(const BBox &bounds, const size_t res)
+  {
+    return bounds.size() / Math::max(bounds.size()) * res;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  size_t numVoxels(const BBox &bounds, const size_t res)
+  {
+    const Imath::V3i bufferRes = bufferResolution(bounds, res);
+    return bufferRes.x * bufferRes.y * bufferRes.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// InScatterCache
+//----------------------------------------------------------------------------//
+
+InScatterCache::InScatterCache(Scene::CPtr scene, const size_t res)
+  : m_scene(scene), 
+    m_bufferMemory(Sys::Memory::OccluderBuffers),
+    m_computed(numVoxels(scene->volume->wsBounds(), res))
+{
+  const BBox bounds = scene->volume->wsBounds();
+  Sys::Memory::checkBudget(numVoxels(bounds, res) * sizeof(V3f), 
+                           "InScatterCache");
+  m_buffer.setMapping(Math::makeMatrixMapping(bounds));
+  m_buffer.setSize(bufferResolution(bounds, res));
+  m_bufferMemory.track(m_buffer.memSize());
+}
+
+//----------------------------------------------------------------------------//
+
+Color InScatterCache::sample(const VolumeSampleState &state) const
+{
+  Vector vsP;
+  m_buffer.mapping()->worldToVoxel(state.wsP, vsP);
+  
+  if (!Math::isInBounds(vsP, m_buffer.dataWindow())) {
+    return Colors::zero();
+  }
+
+  int x0 = static_cast<int>(std::floor(vsP.x));
+  int y0 = static_cast<int>(std::floor(vsP.y));
+  int z0 = static_cast<int>(std::floor(vsP.z));
+
+  for (int k = z0; k < z0 + 2; ++k) {
+    for (int j = y0; j < y0 + 2; ++j) {
+      for (int i = x0; i < x0 + 2; ++i) {
+        int ii = Imath::clamp(i, m_buffer.dataWindow().min.x, 
+                              m_buffer.dataWindow().max.x);
+        int jj = Imath::clamp(j, m_buffer.dataWindow().min.y, 
+                              m_buffer.dataWindow().max.y);
+        int kk = Imath::clamp(k, m_buffer.dataWindow().min.z, 
+                              m_buffer.dataWindow().max.z);
+        if (m_computed.isReady(offset(ii, jj, kk))) {
+          Sys::Stats::add(Sys::Stats::InScatterCacheHits);
+        } else {
+          Sys::Stats::add(Sys::Stats::InScatterCacheMisses);
+          m_computed.fill(offset(ii, jj, kk),
+                          boost::bind(&InScatterCache::updateVoxel, this, 
+                                      ii, jj, kk, state.rayState.context));
+        }
+      }
+    }
+  }
+
+  return m_linearInterp.sample(m_buffer, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+void InScatterCache::updateVoxel(const int i, const int j, const int k,
+                                 const RenderContext *context) const
+{
+  // Transform point from voxel to world space
+  Vector wsP;
+  m_buffer.mapping()->voxelToWorld(discToCont(V3i(i, j, k)), wsP);
+  // The lookups stand in for the whole voxel. Their time is fixed, so the
+  // result doesn't depend on which ray needed the voxel first.
+  RayState rayState;
+  rayState.wsRay.pos   = wsP;
+  rayState.wsFootprint = Math::min(m_buffer.mapping()->wsVoxelSize(i, j, k));
+  rayState.context     = context;
+  // Sum up the occluded light
+  LightSampleState     lightState(rayState);
+  OcclusionSampleState occlusionState(rayState);
+  lightState.wsP     = wsP;
+  occlusionState.wsP = wsP;
+  Color L = Colors::zero();
+  BOOST_FOREACH (const Scene::LightPtr &light, m_scene->lights) {
+    const LightSample lightSample = light->sample(lightState);
+    if (Math::max(lightSample.luminance) <= 0.0f) {
+      continue;
+    }
+    occlusionState.wsLightP = lightSample.wsP;
+    L += lightSample.luminance * light->occluder()->sample(occlusionState);
+  }
+  m_buffer.fastLValue(i, j, k) = L * Phase::k_isotropic;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,136 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file DirectionalLight.cpp
+  Contains implementations of DirectionalLight class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Lights/DirectionalLight.h"
+
+// System includes
+
+// Project includes
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Distance to the sampled position of the light. Far enough to be 
+  //! outside any scene, while staying accurate in double precision.
+  const double k_lightDistance = 1.0e6;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// DirectionalLight implementations
+//----------------------------------------------------------------------------//
+
+DirectionalLight::DirectionalLight()
+  : m_wsDir(0.0, -1.0, 0.0)
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+LightSample DirectionalLight::sample(const LightSampleState &state) const
+{
+  return LightSample(m_intensity, state.wsP - m_wsDir * k_lightDistance);
+}
+
+//----------------------------------------------------------------------------//
+
+void DirectionalLight::sampleBatch(const LightSampleStatePtrVec &states,
+                                   LightSampleVec &samples) const
+{
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    samples[i] = LightSample(m_intensity, 
+                             states[i]->wsP - m_wsDir * k_lightDistance);
+  }
+}
+
+//----------------------------------------------------------------------------//
+  
+void DirectionalLight::setDirection(const Vector &wsDir)
+{ 
+  m_wsDir = wsDir.normalized(); 
+}
+
+//----------------------------------------------------------------------------//
+
+const Vector& DirectionalLight::direction() const
+{ 
+  return m_wsDir; 
+}
+
+//----------------------------------------------------------------------------//
+
+OrthographicCamera::Ptr 
+DirectionalLight::fitCamera(Renderer::CPtr renderer, const size_t res) const
+{
+  if (!renderer->scene()->volume) {
+    throw MissingVolumeException("");
+  }
+
+  // Fit the frame to the bounding sphere, so that any light direction 
+  // gives the same map resolution
+  const BBox   wsBounds = renderer->scene()->volume->wsBounds();
+  const Vector center   = wsBounds.center();
+  const double radius   = 0.5 * wsBounds.size().length();
+
+  // Cameras look down -z before their camera space flip
+  Quat orientation;
+  orientation.setRotation(Vector(0.0, 0.0, -1.0), m_wsDir);
+
+  OrthographicCamera::Ptr camera = OrthographicCamera::create();
+  camera->setPosition(center - m_wsDir * radius);
+  camera->setOrientation(orientation);
+  camera->setResolution(Imath::V2i(res, res));
+  camera->setWidth(2.0 * radius);
+  return camera;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
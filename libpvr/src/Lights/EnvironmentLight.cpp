@@ -0,0 +1,304 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file EnvironmentLight.cpp
+  Contains implementations of EnvironmentLight class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Lights/EnvironmentLight.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+// Project includes
+
+#include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/Trace.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Distance at which light samples are placed. Only the direction to the
+  //! sample matters, since the light isn't affected by falloff.
+  const double k_distance = 1.0e6;
+  //! Directions shorter than this fall back to the up vector.
+  const double k_minDirLength = 1.0e-6;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns numDirs directions evenly distributed on the unit sphere, 
+  //! using a Fibonacci spiral.
+  std::vector<Vector> sphereDirections(const size_t numDirs)
+  {
+    const double goldenAngle = M_PI * (3.0 - std::sqrt(5.0));
+    std::vector<Vector> dirs(numDirs);
+    for (size_t i = 0; i < numDirs; ++i) {
+      const double z   = 1.0 - (2.0 * i + 1.0) / numDirs;
+      const double r   = std::sqrt(std::max(0.0, 1.0 - z * z));
+      const double phi = goldenAngle * i;
+      dirs[i] = Vector(r * std::cos(phi), r * std::sin(phi), z);
+    }
+    return dirs;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// EnvironmentLight implementations
+//----------------------------------------------------------------------------//
+
+EnvironmentLight::EnvironmentLight()
+  : m_wsUp(0.0, 1.0, 0.0), m_hemisphere(true), m_precomputed(false),
+    m_bufferMemory(Sys::Memory::OccluderBuffers)
+{ 
+  updateUnoccluded();
+}
+
+//----------------------------------------------------------------------------//
+
+LightSample EnvironmentLight::sample(const LightSampleState &state) const
+{
+  Color  luminance = m_unoccludedLuminance;
+  Vector wsDir     = m_unoccludedDir;
+
+  if (m_precomputed) {
+    Vector vsP;
+    m_luminance.mapping()->worldToVoxel(state.wsP, vsP);
+    if (Math::isInBounds(vsP, m_luminance.dataWindow())) {
+      luminance = m_linearInterp.sample(m_luminance, vsP);
+      wsDir     = m_linearInterp.sample(m_direction, vsP);
+    }
+  }
+
+  const double length = wsDir.length();
+  wsDir = length > k_minDirLength ? wsDir / length : m_wsUp;
+
+  return LightSample(m_intensity * luminance, state.wsP + wsDir * k_distance);
+}
+
+//----------------------------------------------------------------------------//
+
+void EnvironmentLight::setUpVector(const Vector &wsUp)
+{
+  m_wsUp = wsUp.normalized();
+  updateUnoccluded();
+}
+
+//----------------------------------------------------------------------------//
+
+const Vector& EnvironmentLight::upVector() const
+{
+  return m_wsUp;
+}
+
+//----------------------------------------------------------------------------//
+
+void EnvironmentLight::setHemisphereEnabled(const bool enabled)
+{
+  m_hemisphere = enabled;
+  updateUnoccluded();
+}
+
+//----------------------------------------------------------------------------//
+
+bool EnvironmentLight::hemisphereEnabled() const
+{
+  return m_hemisphere;
+}
+
+//----------------------------------------------------------------------------//
+
+void EnvironmentLight::precompute(Renderer::CPtr renderer, const size_t res,
+                                  const size_t numDirections)
+{
+  Sys::Trace::Scope trace("EnvironmentLight::precompute", "occluder");
+
+  Log::print("Precomputing EnvironmentLight occlusion");
+
+  // Only directions on the dome contribute. Each gets an equal share of 
+  // the dome's solid angle, so that an unoccluded voxel matches the 
+  // analytic value used outside the buffer.
+  std::vector<Vector> dirs;
+  BOOST_FOREACH (const Vector &dir, sphereDirections(numDirections)) {
+    if (!m_hemisphere || dir.dot(m_wsUp) >= 0.0) {
+      dirs.push_back(dir);
+    }
+  }
+  if (dirs.empty()) {
+    Log::warning("EnvironmentLight needs at least one direction on the dome");
+    m_precomputed = false;
+    return;
+  }
+  const float solidAngle = 
+    (m_hemisphere ? 2.0 : 4.0) * M_PI / static_cast<double>(dirs.size());
+
+  BBox wsBounds       = renderer->scene()->volume->wsBounds();
+  Matrix localToWorld = Math::coordinateSystem(wsBounds);
+  MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping);
+  mapping->setLocalToWorld(localToWorld);
+  m_luminance.setMapping(mapping);
+  m_direction.setMapping(mapping);
+
+  V3i bufferRes = wsBounds.size() / Math::max(wsBounds.size()) * res;
+  Sys::Memory::checkBudget(static_cast<size_t>(bufferRes.x) * bufferRes.y * 
+                           bufferRes.z * sizeof(V3f) * 2, "EnvironmentLight");
+  m_luminance.setSize(bufferRes);
+  m_direction.setSize(bufferRes);
+  m_bufferMemory.track(m_luminance.memSize() + m_direction.memSize());
+
+  Log::print("  Resolution: " + str(bufferRes));
+  Log::print("  Directions: " + str(dirs.size()));
+
+  // Every ray starting inside the bounds leaves them within one diagonal
+  const double tMax = wsBounds.size().length();
+
+  // Each z slice is computed by a single thread
+  const size_t numThreads = 
+    std::min(Sys::numWorkerThreads(renderer->numThreads()), 
+             static_cast<size_t>(bufferRes.z));
+
+  Timer timer;
+  ProgressReporter progress(2.5f, "  ");
+
+  Sys::JobState job(bufferRes.x * bufferRes.y * bufferRes.z);
+  Sys::runWorkers(numThreads, 
+                  boost::bind(&EnvironmentLight::computeSlices, this, 
+                              renderer, boost::cref(dirs), solidAngle, tMax,
+                              numThreads, boost::ref(job), _1),
+                  job, progress);
+
+  m_precomputed = !job.aborted();
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void EnvironmentLight::updateUnoccluded()
+{
+  if (m_hemisphere) {
+    // The cosine weighted integral over a hemisphere is pi
+    m_unoccludedLuminance = Color(2.0 * M_PI);
+    m_unoccludedDir       = m_wsUp * M_PI;
+  } else {
+    m_unoccludedLuminance = Color(4.0 * M_PI);
+    m_unoccludedDir       = Vectors::zero();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void EnvironmentLight::computeSlices(Renderer::CPtr renderer, 
+                                     const std::vector<Vector> &dirs,
+                                     const float solidAngle, 
+                                     const double tMax,
+                                     const size_t numThreads, 
+                                     Sys::JobState &job,
+                                     const size_t thread)
+{
+  RayState state;
+  state.rayType  = RayState::TransmittanceOnly;
+  state.rayDepth = 1;
+  state.tMax     = tMax;
+
+  const Box3i dataWindow = m_luminance.dataWindow();
+  
+  for (int z = dataWindow.min.z + static_cast<int>(thread); 
+       z <= dataWindow.max.z; z += static_cast<int>(numThreads)) {
+    Box3i slice = dataWindow;
+    slice.min.z = slice.max.z = z;
+    DenseBuffer::iterator d = m_direction.begin(slice);
+    for (DenseBuffer::iterator i = m_luminance.begin(slice), 
+           end = m_luminance.end(slice); i != end; ++i, ++d) {
+      Vector wsP;
+      m_luminance.mapping()->voxelToWorld(discToCont(V3i(i.x, i.y, i.z)), 
+                                          wsP);
+      Color  luminance = Colors::zero();
+      Vector wsDir     = Vectors::zero();
+      state.wsRay.pos  = wsP;
+      // Each ray stands in for a whole voxel, and the rays are parallel
+      state.wsFootprint = 
+        Math::min(m_luminance.mapping()->wsVoxelSize(i.x, i.y, i.z));
+      BOOST_FOREACH (const Vector &dir, dirs) {
+        state.wsRay.dir = dir;
+        const Color t   = renderer->trace(state).transmittance;
+        luminance += t;
+        wsDir     += dir * Math::avg(t);
+      }
+      *i = luminance * solidAngle;
+      *d = wsDir * solidAngle;
+    }
+    // Report progress, and stop if the user terminated or another thread 
+    // failed
+    job.markDone((slice.max.x - slice.min.x + 1) * 
+                 (slice.max.y - slice.min.y + 1));
+    if (job.aborted()) {
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -92,6 +92,13 @@ bool Light::falloffEnabled() const
 
 //----------------------------------------------------------------------------//
 
+bool Light::softRolloff() const
+{
+  return m_softRolloff;
+}
+
+//----------------------------------------------------------------------------//
+
 void Light::setOccluder(Occluder::CPtr occluder)
 { 
   assert(occluder != NULL && "Light::setOccluder got null pointer");
@@ -100,7 +107,7 @@ void Light::setOccluder(Occluder::CPtr occluder)
 
 //----------------------------------------------------------------------------//
 
-Occluder::CPtr Light::occluder() const
+const Occluder::CPtr& Light::occluder() const
 { 
   return m_occluder; 
 }
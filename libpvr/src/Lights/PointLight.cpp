@@ -51,6 +51,18 @@ LightSample PointLight::sample(const LightSampleState &state) const
   return LightSample(m_intensity * falloffFactor(state.wsP, m_wsP), m_wsP);
 }
 
+//----------------------------------------------------------------------------//
+
+void PointLight::sampleBatch(const LightSampleStatePtrVec &states,
+                             LightSampleVec &samples) const
+{
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    samples[i] = LightSample(m_intensity * falloffFactor(states[i]->wsP, m_wsP),
+                             m_wsP);
+  }
+}
+
 //----------------------------------------------------------------------------//
   
 void PointLight::setPosition(const Vector &wsP)
@@ -33,6 +33,9 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+
 // Project includes
 
 #include "pvr/PhaseFunction.h"
@@ -59,19 +62,23 @@ SpotLight::SpotLight()
 
 LightSample SpotLight::sample(const LightSampleState &state) const
 {
-  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState.time);
-  float cosTheta = csP.normalized().z;
-  float coneFalloff = 1.0;
-  if (cosTheta < m_cosWidth) {
-    coneFalloff = 0.0;
-  } else if (cosTheta > m_cosStart) {
-    coneFalloff = 1.0;
-  } else {
-    float delta = (cosTheta - m_cosWidth) / (m_cosStart - m_cosWidth);
-    coneFalloff = delta * delta * delta * delta;
+  const float falloff = coneFalloff(state.wsP, state.rayState.time);
+  if (falloff == 0.0f) {
+    return LightSample(Colors::zero(), m_wsP);
   }
   float distanceFalloff = falloffFactor(state.wsP, m_wsP);
-  return LightSample(m_intensity * coneFalloff * distanceFalloff, m_wsP);
+  return LightSample(m_intensity * falloff * distanceFalloff, m_wsP);
+}
+
+//----------------------------------------------------------------------------//
+
+void SpotLight::sampleBatch(const LightSampleStatePtrVec &states,
+                            LightSampleVec &samples) const
+{
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    samples[i] = SpotLight::sample(*states[i]);
+  }
 }
   
 //----------------------------------------------------------------------------//
@@ -80,6 +87,26 @@ void SpotLight::setCamera(Camera::CPtr camera)
 { 
   m_camera = camera; 
   m_wsP = camera->position(PTime(0.0));
+  // Camera space is a rigid transform of world space, so the cone test only
+  // needs the camera's position and view axis
+  const Camera::MatrixVec &matrices = camera->cameraToWorldMatrices();
+  m_wsSampleP.resize(matrices.size());
+  m_wsSampleAxis.resize(matrices.size());
+  for (size_t i = 0, size = matrices.size(); i < size; ++i) {
+    m_wsSampleP[i] = Vector(0.0) * matrices[i];
+    matrices[i].multDirMatrix(Vector(0.0, 0.0, 1.0), m_wsSampleAxis[i]);
+    m_wsSampleAxis[i].normalize();
+  }
+  // A camera without motion only needs one time sample
+  bool isStatic = true;
+  for (size_t i = 1, size = matrices.size(); i < size; ++i) {
+    isStatic = isStatic && m_wsSampleP[i] == m_wsSampleP[0] && 
+      m_wsSampleAxis[i] == m_wsSampleAxis[0];
+  }
+  if (isStatic && !matrices.empty()) {
+    m_wsSampleP.resize(1);
+    m_wsSampleAxis.resize(1);
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -99,6 +126,58 @@ void SpotLight::setConeAngles(const float width, const float start)
 
 //----------------------------------------------------------------------------//
 
+float SpotLight::cosConeWidth() const
+{
+  return m_cosWidth;
+}
+
+//----------------------------------------------------------------------------//
+
+float SpotLight::cosConeStart() const
+{
+  return m_cosStart;
+}
+
+//----------------------------------------------------------------------------//
+
+float SpotLight::coneFalloff(const Vector &wsP, const PTime time) const
+{
+  if (m_wsSampleP.empty()) {
+    return 0.0f;
+  }
+
+  // Find the light's frame at the given time. Static lights have a single
+  // time sample.
+  Vector wsLightP = m_wsSampleP[0];
+  Vector wsAxis   = m_wsSampleAxis[0];
+  if (m_wsSampleP.size() > 1) {
+    const double t      = time * (m_wsSampleP.size() - 1);
+    const size_t first  = 
+      std::min(static_cast<size_t>(std::floor(t)), m_wsSampleP.size() - 1);
+    const size_t second = std::min(first + 1, m_wsSampleP.size() - 1);
+    const double f      = t - first;
+    wsLightP = Imath::lerp(m_wsSampleP[first], m_wsSampleP[second], f);
+    wsAxis   = Imath::lerp(m_wsSampleAxis[first], m_wsSampleAxis[second], f);
+    wsAxis.normalize();
+  }
+
+  // Angle to the cone axis
+  const Vector wsD      = wsP - wsLightP;
+  const double length   = wsD.length();
+  const float  cosTheta = length > 0.0 ? wsD.dot(wsAxis) / length : 0.0;
+
+  if (cosTheta < m_cosWidth) {
+    return 0.0f;
+  } else if (cosTheta > m_cosStart) {
+    return 1.0f;
+  } else {
+    float delta = (cosTheta - m_cosWidth) / (m_cosStart - m_cosWidth);
+    return delta * delta * delta * delta;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
@@ -33,9 +33,13 @@
 
 // System includes
 
+#include <ctime>
+#include <iostream>
+
 // Library includes
 
 #include <boost/format.hpp>
+#include <boost/thread/mutex.hpp>
 
 // Project headers
 
@@ -51,6 +55,31 @@ using namespace std;
 
 using namespace Field3D;
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Lowest severity printed
+  boost::atomic<int> g_minSeverity(pvr::Util::Log::SevMessage);
+
+  //! Guards the output stream and the time stamp cache
+  boost::mutex       g_outputMutex;
+
+  //! The second that g_timeStamp was made for
+  std::time_t        g_timeStampTime = 0;
+
+  //! Time stamp of g_timeStampTime. Local time is costly to convert, so 
+  //! it's only converted once per second.
+  std::string        g_timeStamp;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 
 namespace pvr {
@@ -71,6 +100,9 @@ ProgressReporter::ProgressReporter(const float interval,
 
 void ProgressReporter::update(const float fractionDone)
 {
+  if (!Log::isEnabled(Log::SevMessage)) {
+    return;
+  }
   if (m_timer.elapsed() > m_interval) {
     m_timer.reset();
     const float percentDone = fractionDone * 100.0f;
@@ -100,18 +132,30 @@ namespace Log {
 
 void print(const Severity severity, const std::string &msg)
 {
-  cout << timeStamp() << " " << Str::pvrLogStamp;
+  if (!isEnabled(severity)) {
+    return;
+  }
 
+  // The line is built outside the lock
+  string line = " " + Str::pvrLogStamp;
   switch (severity) {
   case SevWarning:
-    cout << "WARNING: ";
+    line += "WARNING: ";
     break;
   case SevMessage:
   default:
     break;
   }
-
-  cout << msg << endl;
+  line += msg;
+  line += "\n";
+
+  boost::mutex::scoped_lock lock(g_outputMutex);
+  const std::time_t now = std::time(NULL);
+  if (now != g_timeStampTime || g_timeStamp.empty()) {
+    g_timeStampTime = now;
+    g_timeStamp     = timeStamp();
+  }
+  cout << g_timeStamp << line << flush;
 }
 
 //----------------------------------------------------------------------------//
@@ -130,6 +174,48 @@ void warning(const std::string &msg)
   
 //----------------------------------------------------------------------------//
 
+void setMinSeverity(const Severity severity)
+{
+  g_minSeverity = severity;
+}
+
+//----------------------------------------------------------------------------//
+
+Severity minSeverity()
+{
+  return static_cast<Severity>(g_minSeverity.load());
+}
+
+//----------------------------------------------------------------------------//
+
+bool isEnabled(const Severity severity)
+{
+  return severity >= g_minSeverity.load(boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+// RateLimiter
+//----------------------------------------------------------------------------//
+
+RateLimiter::RateLimiter(const std::string &what, const size_t maxMessages)
+  : m_what(what), m_maxMessages(maxMessages), m_count(0)
+{ 
+  
+}
+
+//----------------------------------------------------------------------------//
+
+bool RateLimiter::allow()
+{
+  const size_t count = m_count++;
+  if (count == m_maxMessages) {
+    warning("Suppressing further warnings: " + m_what);
+  }
+  return count < m_maxMessages;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Log
 } // namespace Util
 } // namespace pvr
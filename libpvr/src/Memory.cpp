@@ -0,0 +1,389 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Memory.cpp
+  Contains implementations of Memory class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Memory.h"
+
+// System includes
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+// Library includes
+
+#include <boost/format.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Project includes
+
+#include "pvr/Log.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Sys;
+
+  //--------------------------------------------------------------------------//
+
+  //! One tracked allocation
+  struct Entry
+  {
+    Memory::Category category;
+    size_t           bytes;
+    //! Number of trackers holding the allocation
+    size_t           refs;
+  };
+
+  typedef std::map<const void*, Entry> EntryMap;
+
+  //--------------------------------------------------------------------------//
+
+  //! All tracked allocations and the per-category totals. Guarded by 
+  //! g_mutex.
+  EntryMap     g_entries;
+  size_t       g_current[Memory::NumCategories] = { 0 };
+  size_t       g_peak[Memory::NumCategories]    = { 0 };
+  size_t       g_totalCurrent                   = 0;
+  size_t       g_totalPeak                      = 0;
+  size_t       g_budget                         = 0;
+  boost::mutex g_mutex;
+
+  //--------------------------------------------------------------------------//
+
+  const char *k_names[Memory::NumCategories] = {
+    "voxel_buffers",
+    "occluder_buffers",
+    "deep_images",
+    "geometry",
+    "acceleration"
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Adjusts the totals of a category, updating the peaks.
+  //! \note Assumes that g_mutex is locked.
+  void adjust(const Memory::Category category, const size_t oldBytes, 
+              const size_t newBytes)
+  {
+    g_current[category] = g_current[category] - oldBytes + newBytes;
+    g_totalCurrent      = g_totalCurrent - oldBytes + newBytes;
+    g_peak[category]    = std::max(g_peak[category], g_current[category]);
+    g_totalPeak         = std::max(g_totalPeak, g_totalCurrent);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds a reference to the allocation with the given key, and sets its 
+  //! size. 
+  //! \note Assumes that g_mutex is locked.
+  void addRef(const void *key, const Memory::Category category, 
+              const size_t bytes)
+  {
+    EntryMap::iterator i = g_entries.find(key);
+    if (i == g_entries.end()) {
+      Entry entry = { category, bytes, 1 };
+      g_entries[key] = entry;
+      adjust(category, 0, bytes);
+    } else {
+      adjust(i->second.category, i->second.bytes, bytes);
+      i->second.bytes = bytes;
+      i->second.refs++;
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Removes a reference to the allocation with the given key. The 
+  //! allocation stops counting once the last reference is gone.
+  //! \note Assumes that g_mutex is locked.
+  void removeRef(const void *key)
+  {
+    EntryMap::iterator i = g_entries.find(key);
+    if (i == g_entries.end()) {
+      return;
+    }
+    if (--i->second.refs == 0) {
+      adjust(i->second.category, i->second.bytes, 0);
+      g_entries.erase(i);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Formats a byte count in megabytes
+  std::string megabytes(const size_t bytes)
+  {
+    return (boost::format("%.1f MB") % (bytes / (1024.0 * 1024.0))).str();
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Memory::Tracker implementations
+//----------------------------------------------------------------------------//
+
+Memory::Tracker::Tracker(const Category category)
+  : m_category(category), m_key(NULL), m_bytes(0)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+Memory::Tracker::Tracker(const Tracker &other)
+  : m_category(other.m_category), m_key(NULL), m_bytes(0)
+{
+  *this = other;
+}
+
+//----------------------------------------------------------------------------//
+
+Memory::Tracker::~Tracker()
+{
+  release();
+}
+
+//----------------------------------------------------------------------------//
+
+Memory::Tracker& Memory::Tracker::operator = (const Tracker &other)
+{
+  if (&other == this) {
+    return *this;
+  }
+  boost::mutex::scoped_lock lock(g_mutex);
+  if (m_key) {
+    removeRef(m_key);
+    m_key   = NULL;
+    m_bytes = 0;
+  }
+  m_category = other.m_category;
+  if (!other.m_key) {
+    return *this;
+  }
+  EntryMap::const_iterator i = g_entries.find(other.m_key);
+  const size_t bytes = i == g_entries.end() ? 0 : i->second.bytes;
+  // Allocations keyed by the other tracker were copied along with their 
+  // holder. Shared allocations are shared by the copy too.
+  m_key   = other.m_key == &other ? this : other.m_key;
+  m_bytes = bytes;
+  addRef(m_key, m_category, bytes);
+  return *this;
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::Tracker::track(const size_t bytes)
+{
+  track(this, bytes);
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::Tracker::track(const void *key, const size_t bytes)
+{
+  if (m_key == key && m_bytes == bytes) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(g_mutex);
+  m_bytes = bytes;
+  if (m_key && m_key != key) {
+    removeRef(m_key);
+  } else if (m_key == key) {
+    // Updating the size of the allocation already tracked
+    EntryMap::iterator i = g_entries.find(key);
+    if (i != g_entries.end()) {
+      adjust(i->second.category, i->second.bytes, bytes);
+      i->second.bytes = bytes;
+      return;
+    }
+  }
+  m_key = key;
+  addRef(m_key, m_category, bytes);
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::Tracker::update(const size_t bytes)
+{
+  if (m_key) {
+    track(m_key, bytes);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::Tracker::release()
+{
+  if (!m_key) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(g_mutex);
+  removeRef(m_key);
+  m_key   = NULL;
+  m_bytes = 0;
+}
+
+//----------------------------------------------------------------------------//
+// Memory implementations
+//----------------------------------------------------------------------------//
+
+size_t Memory::current(const Category category)
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  return g_current[category];
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Memory::peak(const Category category)
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  return g_peak[category];
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Memory::totalCurrent()
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  return g_totalCurrent;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Memory::totalPeak()
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  return g_totalPeak;
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::resetPeaks()
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  std::copy(g_current, g_current + NumCategories, g_peak);
+  g_totalPeak = g_totalCurrent;
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::setBudget(const size_t bytes)
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  g_budget = bytes;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Memory::budget()
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  return g_budget;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Memory::available()
+{
+  boost::mutex::scoped_lock lock(g_mutex);
+  if (g_budget == 0) {
+    return std::numeric_limits<size_t>::max();
+  }
+  return g_budget > g_totalCurrent ? g_budget - g_totalCurrent : 0;
+}
+
+//----------------------------------------------------------------------------//
+
+void Memory::checkBudget(const size_t bytes, const std::string &what)
+{
+  const size_t left = available();
+  if (bytes > left) {
+    throw MemoryBudgetException(what + " needs " + megabytes(bytes) + 
+                                ", " + megabytes(left) + " left");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+std::string Memory::name(const Category category)
+{
+  if (category < 0 || category >= NumCategories) {
+    return std::string();
+  }
+  return k_names[category];
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<std::string> Memory::info()
+{
+  std::vector<std::string> info;
+  boost::mutex::scoped_lock lock(g_mutex);
+  for (int i = 0; i < NumCategories; ++i) {
+    info.push_back(std::string(k_names[i]) + " : " + 
+                   megabytes(g_current[i]) + " (peak " + 
+                   megabytes(g_peak[i]) + ")");
+  }
+  info.push_back("total : " + megabytes(g_totalCurrent) + " (peak " + 
+                 megabytes(g_totalPeak) + ")");
+  if (g_budget > 0) {
+    info.push_back("budget : " + megabytes(g_budget));
+  }
+  return info;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
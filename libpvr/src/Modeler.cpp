@@ -33,8 +33,14 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include <Field3D/Field3DFile.h>
 #include <Field3D/FieldMapping.h>
 
@@ -42,9 +48,16 @@
 
 #include "pvr/Constants.h"
 #include "pvr/Log.h"
+#include "pvr/Math.h"
 #include "pvr/Primitives/InstantiationPrim.h"
 #include "pvr/Primitives/RasterizationPrim.h"
+#include "pvr/RenderGlobals.h"
 #include "pvr/Strings.h"
+#include "pvr/Threading.h"
+#include "pvr/Trace.h"
+#include "pvr/Volumes/CompositeVolume.h"
+#include "pvr/Volumes/VoxelVolume.h"
+#include "pvr/VoxelFilter.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -80,6 +93,519 @@ namespace {
   }
 
   //--------------------------------------------------------------------------//
+  // Output conversion
+  //--------------------------------------------------------------------------//
+
+  //! Returns the block order of the given block size
+  int sparseBlockOrder(const Model::Modeler::SparseBlockSize size)
+  {
+    switch (size) {
+    case Model::Modeler::SparseBlockSize8:
+      return 3;
+    case Model::Modeler::SparseBlockSize32:
+      return 5;
+    case Model::Modeler::SparseBlockSize16:
+    default:
+      return 4;
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Converts a voxel to an output voxel type. Scalars are the average of 
+  //! the channels.
+  inline void convertVoxel(const Imath::V3f &v, Imath::V3f &out)
+  { out = v; }
+  inline void convertVoxel(const Imath::V3f &v, Imath::Vec3<half> &out)
+  { out = Imath::Vec3<half>(v.x, v.y, v.z); }
+  inline void convertVoxel(const Imath::V3f &v, float &out)
+  { out = (v.x + v.y + v.z) / 3.0f; }
+  inline void convertVoxel(const Imath::V3f &v, half &out)
+  { out = (v.x + v.y + v.z) / 3.0f; }
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether the given block holds any data. Dense buffers hold all blocks.
+  inline bool isAllocated(const DenseBuffer &, const int, const int, 
+                          const int)
+  { return true; }
+  inline bool isAllocated(const SparseBuffer &buffer, const int bi, 
+                          const int bj, const int bk)
+  { return buffer.blockIsAllocated(bi, bj, bk); }
+
+  //--------------------------------------------------------------------------//
+
+  //! Converts every numThreads'th row of blocks, starting at the thread's 
+  //! index. Blocks that only hold zeros are left unallocated.
+  template <typename In_T, typename Out_T>
+  void convertBlocks(const In_T &in, Field3D::SparseField<Out_T> &out, 
+                     const size_t numThreads, Sys::JobState &job, 
+                     const size_t thread)
+  {
+    const Field3D::Box3i &dw        = in.dataWindow();
+    const Imath::V3i      blockRes  = out.blockRes();
+    const int             blockSize = out.blockSize();
+
+    for (int bk = thread; bk < blockRes.z; bk += numThreads) {
+      if (job.aborted()) {
+        return;
+      }
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi) {
+          if (!isAllocated(in, bi, bj, bk)) {
+            continue;
+          }
+          const Imath::V3i min = 
+            dw.min + Imath::V3i(bi, bj, bk) * blockSize;
+          const Imath::V3i max = 
+            Imath::V3i(std::min(min.x + blockSize - 1, dw.max.x), 
+                       std::min(min.y + blockSize - 1, dw.max.y), 
+                       std::min(min.z + blockSize - 1, dw.max.z));
+          bool isEmpty = true;
+          for (int k = min.z; k <= max.z && isEmpty; ++k) {
+            for (int j = min.y; j <= max.y && isEmpty; ++j) {
+              for (int i = min.x; i <= max.x; ++i) {
+                if (in.fastValue(i, j, k) != Imath::V3f(0.0f)) {
+                  isEmpty = false;
+                  break;
+                }
+              }
+            }
+          }
+          if (isEmpty) {
+            continue;
+          }
+          for (int k = min.z; k <= max.z; ++k) {
+            for (int j = min.y; j <= max.y; ++j) {
+              for (int i = min.x; i <= max.x; ++i) {
+                convertVoxel(in.fastValue(i, j, k), out.fastLValue(i, j, k));
+              }
+            }
+          }
+        }
+      }
+      job.markDone(1);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Converts every numThreads'th z slice, starting at the thread's index
+  template <typename Out_T>
+  void convertSlices(const DenseBuffer &in, Field3D::DenseField<Out_T> &out, 
+                     const size_t numThreads, Sys::JobState &job, 
+                     const size_t thread)
+  {
+    const Field3D::Box3i &dw = in.dataWindow();
+
+    for (int k = dw.min.z + thread; k <= dw.max.z; k += numThreads) {
+      if (job.aborted()) {
+        return;
+      }
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        for (int i = dw.min.x; i <= dw.max.x; ++i) {
+          convertVoxel(in.fastValue(i, j, k), out.fastLValue(i, j, k));
+        }
+      }
+      job.markDone(1);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Clears every numThreads'th z slice, starting at the thread's index.
+  //! Spreads the first write to each page of a large buffer over the 
+  //! threads, and thereby over the memory of each socket.
+  void clearSlices(DenseBuffer &buffer, const size_t numThreads, 
+                   Sys::JobState &job, const size_t thread)
+  {
+    const Field3D::Box3i &dw = buffer.dataWindow();
+
+    for (int k = dw.min.z + thread; k <= dw.max.z; k += numThreads) {
+      if (job.aborted()) {
+        return;
+      }
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        for (int i = dw.min.x; i <= dw.max.x; ++i) {
+          buffer.fastLValue(i, j, k) = Imath::V3f(0.0f);
+        }
+      }
+      job.markDone(1);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Converts a dense or sparse buffer to the given voxel type, in parallel.
+  //! \param toSparse Whether to output a sparse field.
+  //! \param blockOrder Block order of sparse output. Must match the input's
+  //! if the input is sparse.
+  template <typename Out_T>
+  typename Field3D::Field<Out_T>::Ptr
+  convertForOutput(VoxelBuffer::Ptr buffer, const bool toSparse, 
+                   const int blockOrder, const size_t numThreads)
+  {
+    using namespace Field3D;
+
+    typename ResizableField<Out_T>::Ptr result;
+    SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer);
+    DenseBuffer::Ptr  dense  = field_dynamic_cast<DenseBuffer>(buffer);
+    Util::ProgressReporter progress(2.5f, "  Converting: ");
+
+    if (toSparse) {
+      typename SparseField<Out_T>::Ptr out(new SparseField<Out_T>);
+      out->setBlockOrder(blockOrder);
+      out->setSize(buffer->extents(), buffer->dataWindow());
+      const size_t numRows = out->blockRes().z;
+      const size_t n       = std::max(std::min(numThreads, numRows), 
+                                      static_cast<size_t>(1));
+      Sys::JobState job(numRows);
+      if (sparse) {
+        Sys::runWorkers(n, boost::bind(&convertBlocks<SparseBuffer, Out_T>, 
+                                       boost::cref(*sparse), boost::ref(*out),
+                                       n, boost::ref(job), _1), 
+                        job, progress);
+      } else {
+        Sys::runWorkers(n, boost::bind(&convertBlocks<DenseBuffer, Out_T>, 
+                                       boost::cref(*dense), boost::ref(*out),
+                                       n, boost::ref(job), _1), 
+                        job, progress);
+      }
+      result = out;
+    } else {
+      typename DenseField<Out_T>::Ptr out(new DenseField<Out_T>);
+      out->setSize(buffer->extents(), buffer->dataWindow());
+      const size_t numSlices = buffer->dataResolution().z;
+      const size_t n         = std::max(std::min(numThreads, numSlices),
+                                        static_cast<size_t>(1));
+      Sys::JobState job(numSlices);
+      Sys::runWorkers(n, boost::bind(&convertSlices<Out_T>, 
+                                     boost::cref(*dense), boost::ref(*out),
+                                     n, boost::ref(job), _1), 
+                      job, progress);
+      result = out;
+    }
+
+    result->setMapping(buffer->mapping());
+    result->name      = buffer->name;
+    result->attribute = buffer->attribute;
+    result->copyMetadata(*buffer);
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds every numThreads'th row of blocks of each input buffer to the 
+  //! output, starting at the thread's index. The inputs share the block 
+  //! layout of sparse outputs, so no two threads write the same block.
+  template <typename Buffer_T>
+  void addBlocks(const std::vector<SparseBuffer::Ptr> &in, Buffer_T &out,
+                 const size_t numThreads, Sys::JobState &job, 
+                 const size_t thread)
+  {
+    const Field3D::Box3i &dw        = out.dataWindow();
+    const Imath::V3i      blockRes  = in.front()->blockRes();
+    const int             blockSize = in.front()->blockSize();
+
+    for (int bk = thread; bk < blockRes.z; bk += numThreads) {
+      if (job.aborted()) {
+        return;
+      }
+      BOOST_FOREACH (const SparseBuffer::Ptr &buffer, in) {
+        for (int bj = 0; bj < blockRes.y; ++bj) {
+          for (int bi = 0; bi < blockRes.x; ++bi) {
+            if (!buffer->blockIsAllocated(bi, bj, bk)) {
+              continue;
+            }
+            const Imath::V3i min = 
+              dw.min + Imath::V3i(bi, bj, bk) * blockSize;
+            const Imath::V3i max = 
+              Imath::V3i(std::min(min.x + blockSize - 1, dw.max.x), 
+                         std::min(min.y + blockSize - 1, dw.max.y), 
+                         std::min(min.z + blockSize - 1, dw.max.z));
+            for (int k = min.z; k <= max.z; ++k) {
+              for (int j = min.y; j <= max.y; ++j) {
+                for (int i = min.x; i <= max.x; ++i) {
+                  out.fastLValue(i, j, k) += buffer->fastValue(i, j, k);
+                }
+              }
+            }
+          }
+        }
+      }
+      job.markDone(1);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Resolution of the longest edge of the grid that autoConfigure() 
+  //! records occupancy on
+  const int    k_occupancyRes  = 256;
+  //! Memory used by each voxel of a VoxelBuffer
+  const double k_bytesPerVoxel = sizeof(Imath::V3f);
+  //! Approximate memory used by each block of a SparseBuffer, whether it is
+  //! allocated or not
+  const double k_bytesPerBlock = 40.0;
+  //! Largest resolution that autoConfigure() considers
+  const size_t k_maxAutoRes    = 16384;
+
+  //--------------------------------------------------------------------------//
+
+  //! Records which cells of a grid over the modeler's bounds are touched by
+  //! any item, and counts the touched cells at successively coarser levels.
+  class Occupancy
+  {
+  public:
+    Occupancy(const BBox &wsBounds, const int res)
+      : m_wsBounds(wsBounds), 
+        m_cellSize(Math::max(wsBounds.size()) / res)
+    { 
+      for (int dim = 0; dim < 3; ++dim) {
+        m_res[dim] = std::max(1, static_cast<int>(
+          std::ceil(wsBounds.size()[dim] / m_cellSize)));
+      }
+      m_cells.resize(static_cast<size_t>(m_res.x) * m_res.y * m_res.z, 0);
+    }
+    //! Marks the cells touched by the given world-space box
+    void add(const BBox &wsBox)
+    {
+      if (wsBox.isEmpty()) {
+        return;
+      }
+      Imath::V3i lo, hi;
+      for (int dim = 0; dim < 3; ++dim) {
+        const double min = (wsBox.min[dim] - m_wsBounds.min[dim]) / m_cellSize;
+        const double max = (wsBox.max[dim] - m_wsBounds.min[dim]) / m_cellSize;
+        lo[dim] = Imath::clamp(static_cast<int>(std::floor(min)), 
+                               0, m_res[dim] - 1);
+        hi[dim] = Imath::clamp(static_cast<int>(std::floor(max)), 
+                               0, m_res[dim] - 1);
+      }
+      for (int k = lo.z; k <= hi.z; ++k) {
+        for (int j = lo.y; j <= hi.y; ++j) {
+          for (int i = lo.x; i <= hi.x; ++i) {
+            m_cells[i + m_res.x * (j + static_cast<size_t>(m_res.y) * k)] = 1;
+          }
+        }
+      }
+    }
+    //! Returns the number of occupied cells at each level, where level n
+    //! has cells 2^n times the size of the grid's
+    std::vector<double> countLevels() const
+    {
+      std::vector<double> counts;
+      std::vector<char>   cells = m_cells;
+      Imath::V3i          res   = m_res;
+      while (true) {
+        counts.push_back(std::count(cells.begin(), cells.end(), 1));
+        if (res == Imath::V3i(1)) {
+          break;
+        }
+        const Imath::V3i coarseRes((res + Imath::V3i(1)) / 2);
+        std::vector<char> coarse(static_cast<size_t>(coarseRes.x) * 
+                                 coarseRes.y * coarseRes.z, 0);
+        for (int k = 0; k < res.z; ++k) {
+          for (int j = 0; j < res.y; ++j) {
+            for (int i = 0; i < res.x; ++i) {
+              if (cells[i + res.x * (j + static_cast<size_t>(res.y) * k)]) {
+                coarse[i / 2 + coarseRes.x * 
+                       (j / 2 + static_cast<size_t>(coarseRes.y) * (k / 2))] 
+                  = 1;
+              }
+            }
+          }
+        }
+        cells.swap(coarse);
+        res = coarseRes;
+      }
+      return counts;
+    }
+    //! Returns the world-space size of a cell
+    double cellSize() const
+    { return m_cellSize; }
+  private:
+    BBox              m_wsBounds;
+    double            m_cellSize;
+    Imath::V3i        m_res;
+    std::vector<char> m_cells;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the buffer resolution that Modeler::setVoxelSize() picks
+  Imath::V3i resolutionForVoxelSize(const BBox &wsBounds, 
+                                    const double voxelSize)
+  {
+    const Vector size = wsBounds.size();
+    return Imath::V3i(std::max(1, static_cast<int>(size.x / voxelSize)),
+                      std::max(1, static_cast<int>(size.y / voxelSize)),
+                      std::max(1, static_cast<int>(size.z / voxelSize)));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Estimates the memory use, in bytes, of a buffer over wsBounds with the
+  //! given resolution along its longest edge. blockSize is zero for dense
+  //! buffers. counts are the occupied cells of each level of an Occupancy.
+  double estimateMemory(const BBox &wsBounds, const size_t res, 
+                        const int blockSize, const double cellSize,
+                        const std::vector<double> &counts)
+  {
+    const double     voxelSize = Math::max(wsBounds.size()) / res;
+    const Imath::V3i voxelRes  = resolutionForVoxelSize(wsBounds, voxelSize);
+    if (blockSize == 0) {
+      return k_bytesPerVoxel * voxelRes.x * voxelRes.y * voxelRes.z;
+    }
+    const Imath::V3i blockRes  = 
+      (voxelRes + Imath::V3i(blockSize - 1)) / blockSize;
+    const double     numBlocks = 
+      static_cast<double>(blockRes.x) * blockRes.y * blockRes.z;
+    // Number of occupancy cells along each block's edge
+    const double ratio = blockSize * voxelSize / cellSize;
+    double numAllocated;
+    if (ratio <= 1.0) {
+      // Occupied cells are assumed to be full
+      numAllocated = counts[0] / (ratio * ratio * ratio);
+    } else {
+      const size_t level = std::min(static_cast<size_t>(std::log(ratio) / 
+                                                        std::log(2.0)),
+                                    counts.size() - 1);
+      const double scale = std::ldexp(1.0, level) / ratio;
+      numAllocated = counts[level] * scale * scale * scale;
+      // Each occupied coarser cell holds at least one allocated block
+      if (level + 1 < counts.size()) {
+        numAllocated = std::max(numAllocated, counts[level + 1]);
+      }
+    }
+    numAllocated = std::min(numAllocated, numBlocks);
+    return numAllocated * blockSize * blockSize * blockSize * 
+      k_bytesPerVoxel + numBlocks * k_bytesPerBlock;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Clustering
+  //--------------------------------------------------------------------------//
+
+  //! Two clusters are merged if the bounds of their union cover at most 
+  //! this many times the volume of their own bounds
+  const double k_clusterMergeFactor = 2.0;
+
+  //--------------------------------------------------------------------------//
+
+  double boundsVolume(const BBox &bounds)
+  {
+    const Vector size = bounds.size();
+    return size.x * size.y * size.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Groups the given bounds into clusters, returning the indices of the 
+  //! bounds in each cluster. Overlapping and nearby bounds share a cluster,
+  //! while distant ones get their own.
+  std::vector<std::vector<size_t> > 
+  clusterBounds(const std::vector<BBox> &wsBounds)
+  {
+    std::vector<BBox>                 bounds(wsBounds);
+    std::vector<std::vector<size_t> > clusters;
+    for (size_t i = 0, size = wsBounds.size(); i < size; ++i) {
+      clusters.push_back(std::vector<size_t>(1, i));
+    }
+    // Merge one pair at a time until no pair qualifies. There are few
+    // inputs, so the brute force search is cheap.
+    bool didMerge = true;
+    while (didMerge) {
+      didMerge = false;
+      for (size_t i = 0; i < clusters.size() && !didMerge; ++i) {
+        for (size_t j = i + 1; j < clusters.size() && !didMerge; ++j) {
+          BBox merged = bounds[i];
+          merged.extendBy(bounds[j]);
+          if (boundsVolume(merged) <= k_clusterMergeFactor * 
+              (boundsVolume(bounds[i]) + boundsVolume(bounds[j]))) {
+            bounds[i] = merged;
+            clusters[i].insert(clusters[i].end(), 
+                               clusters[j].begin(), clusters[j].end());
+            bounds.erase(bounds.begin() + j);
+            clusters.erase(clusters.begin() + j);
+            didMerge = true;
+          }
+        }
+      }
+    }
+    return clusters;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Buffer pool
+  //--------------------------------------------------------------------------//
+
+  //! A dense buffer kept for reuse. The tracker accounts for it while no
+  //! Modeler does.
+  struct PooledBuffer
+  {
+    PooledBuffer(DenseBuffer::Ptr buffer)
+      : buffer(buffer), memory(Sys::Memory::VoxelBuffers)
+    { memory.track(buffer.get(), buffer->memSize()); }
+    DenseBuffer::Ptr     buffer;
+    Sys::Memory::Tracker memory;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Dense buffers handed out to modelers that reuse buffers. A buffer is 
+  //! idle once the pool holds its only reference.
+  std::vector<PooledBuffer> g_bufferPool;
+  //! Guards g_bufferPool
+  boost::mutex              g_bufferPoolMutex;
+
+  //--------------------------------------------------------------------------//
+
+  bool isIdle(const PooledBuffer &pooled)
+  {
+    return pooled.buffer->refcnt() == 1;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Frees the idle pooled buffers. The pool mutex must be held.
+  void freeIdleBuffers()
+  {
+    for (size_t i = 0; i < g_bufferPool.size(); ) {
+      if (isIdle(g_bufferPool[i])) {
+        g_bufferPool.erase(g_bufferPool.begin() + i);
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns an idle pooled buffer of the given resolution, or allocates 
+  //! one if there is none. Idle buffers of other resolutions are freed 
+  //! first, so at most the buffers of a single frame are kept around. The
+  //! buffer's voxels are left as they were.
+  DenseBuffer::Ptr acquirePooledBuffer(const Imath::V3i &res)
+  {
+    boost::mutex::scoped_lock lock(g_bufferPoolMutex);
+    for (size_t i = 0; i < g_bufferPool.size(); ++i) {
+      const PooledBuffer &pooled = g_bufferPool[i];
+      if (isIdle(pooled) && pooled.buffer->dataResolution() == res) {
+        Util::Log::print("Reusing pooled dense buffer");
+        return pooled.buffer;
+      }
+    }
+    freeIdleBuffers();
+    Sys::Memory::checkBudget(res.x * res.y * res.z * sizeof(Imath::V3f), 
+                             "Dense voxel buffer");
+    DenseBuffer::Ptr buffer(new DenseBuffer);
+    buffer->setSize(res);
+    g_bufferPool.push_back(PooledBuffer(buffer));
+    return buffer;
+  }
+
+  //--------------------------------------------------------------------------//
 
 } // local namespace
 
@@ -105,8 +631,21 @@ namespace Model {
 
 Modeler::Modeler()
   : m_mapping(UniformMappingType), 
+    m_frustumDepth(PerspectiveDepth),
     m_dataStructure(DenseBufferType),
-    m_sparseBlockSize(SparseBlockSize16)
+    m_sparseBlockSize(SparseBlockSize16),
+    m_numThreads(0),
+    m_instanceChunkSize(0),
+    m_directInstancing(false),
+    m_aggregateInstancing(false),
+    m_deterministic(false),
+    m_outputFormat(VectorOutput),
+    m_sparseOutput(false),
+    m_reuseBuffers(false),
+    m_coarseFactor(1),
+    m_coarseFeatureSize(2.0f),
+    m_bufferMemory(Sys::Memory::VoxelBuffers),
+    m_coarseBufferMemory(Sys::Memory::VoxelBuffers)
 { 
   // Empty
 }
@@ -157,8 +696,12 @@ void Modeler::clearInputs()
 
 void Modeler::updateBounds()
 {
+  Sys::Trace::Scope trace("Modeler::updateBounds", "modeling");
+
   BBox wsBounds;
   
+  m_wsBounds.makeEmpty();
+
   BOOST_FOREACH (ModelerInput::CPtr i, m_inputs) {
     Prim::Primitive::CPtr prim = i->volumePrimitive();
     if (prim) {
@@ -176,12 +719,138 @@ void Modeler::updateBounds()
     Log::warning("Modeler::updateBounds() got an empty bounding box. "
                  "No voxel buffer will be created.");
     m_buffer = VoxelBuffer::Ptr();
+    m_bufferMemory.release();
+    m_coarseBuffer.reset();
+    m_coarseBufferMemory.release();
     return;
   }
 
   Log::print("Updated bounds to: "
              "(" + str(wsBounds.min) + ", " + str(wsBounds.max) + ")");
 
+  m_wsBounds = wsBounds;
+  createBuffer(wsBounds);
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::autoConfigure(const double memoryBudget)
+{
+  if (!m_buffer) {
+    Log::warning("Modeler::autoConfigure() was called before updateBounds()");
+    return;
+  }
+  if (m_mapping != UniformMappingType) {
+    Log::warning("Modeler::autoConfigure() only supports uniform mappings");
+    return;
+  }
+
+  // Record the occupied parts of the bounds ---
+
+  Occupancy occupancy(m_wsBounds, k_occupancyRes);
+  BOOST_FOREACH (ModelerInput::CPtr i, m_inputs) {
+    Prim::Primitive::CPtr prim = i->volumePrimitive();
+    if (!prim || !i->geometry()) {
+      continue;
+    }
+    Prim::Rast::RasterizationPrim::CPtr rastPrim = 
+      dynamic_pointer_cast<const Prim::Rast::RasterizationPrim>(prim);
+    const std::vector<Imath::Box3f> *itemBounds = 
+      rastPrim ? rastPrim->cachedItemWsBounds(i->geometry()) : NULL;
+    if (itemBounds) {
+      BOOST_FOREACH (const Imath::Box3f &bounds, *itemBounds) {
+        if (!bounds.isEmpty()) {
+          occupancy.add(BBox(bounds.min, bounds.max));
+        }
+      }
+    } else {
+      occupancy.add(prim->wsBounds(i->geometry()));
+    }
+  }
+  const std::vector<double> counts = occupancy.countLevels();
+  const double fraction = 
+    counts[0] / (std::pow(static_cast<double>(k_occupancyRes), 3.0));
+  Log::print("Modeler::autoConfigure() estimated occupancy: " + 
+             str(counts[0]) + " of " + str(k_occupancyRes) + "^3 cells (" +
+             str(fraction * 100.0) + "%)");
+
+  // Find the finest resolution each data structure fits the budget with ---
+
+  // Stay within the global budget too. The current buffer will be replaced.
+  m_bufferMemory.release();
+  const double budget     = 
+    std::min(memoryBudget * 1024.0 * 1024.0, 
+             static_cast<double>(Sys::Memory::available()));
+  const int    options[4] = { 0, 8, 16, 32 };
+  size_t       bestRes    = 0;
+  int          bestBlock  = 0;
+  double       bestMemory = 0.0;
+  for (int o = 0; o < 4; ++o) {
+    // Memory grows with resolution, so binary search for the largest fit
+    size_t lo = 0, hi = k_maxAutoRes;
+    while (lo < hi) {
+      const size_t mid = (lo + hi + 1) / 2;
+      if (estimateMemory(m_wsBounds, mid, options[o], occupancy.cellSize(), 
+                         counts) <= budget) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    if (lo == 0) {
+      continue;
+    }
+    const double memory = estimateMemory(m_wsBounds, lo, options[o], 
+                                         occupancy.cellSize(), counts);
+    // Dense buffers are tried first, and win ties
+    if (lo > bestRes) {
+      bestRes    = lo;
+      bestBlock  = options[o];
+      bestMemory = memory;
+    }
+  }
+  if (bestRes == 0) {
+    Log::warning("Modeler::autoConfigure() found no buffer that fits in " + 
+                 str(memoryBudget) + " MB");
+    return;
+  }
+
+  // Recreate the buffer ---
+
+  switch (bestBlock) {
+  case 0:
+    m_dataStructure = DenseBufferType;
+    break;
+  case 8:
+    m_dataStructure   = SparseBufferType;
+    m_sparseBlockSize = SparseBlockSize8;
+    break;
+  case 16:
+    m_dataStructure   = SparseBufferType;
+    m_sparseBlockSize = SparseBlockSize16;
+    break;
+  default:
+    m_dataStructure   = SparseBufferType;
+    m_sparseBlockSize = SparseBlockSize32;
+  }
+  createBuffer(m_wsBounds);
+  if (!m_buffer) {
+    return;
+  }
+  setVoxelSize(Vector(Math::max(m_wsBounds.size()) / bestRes));
+
+  Log::print("Modeler::autoConfigure() expects " + 
+             str(bestMemory / (1024.0 * 1024.0)) + " MB of voxel data");
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::createBuffer(const BBox &wsBounds)
+{
+  m_bufferMemory.release();
+  m_coarseBuffer.reset();
+  m_coarseBufferMemory.release();
+
   switch (m_dataStructure) {
   case SparseBufferType:
     {
@@ -238,17 +907,55 @@ void Modeler::updateBounds()
 
 //----------------------------------------------------------------------------//
 
-void Modeler::setResolution(const size_t x, const size_t y, const size_t z)
+void Modeler::setResolution(const size_t xRes, const size_t yRes, 
+                            const size_t zRes)
 {
   if (!m_buffer) {
     Log::warning("Modeler::setResolution() was called before updateBounds()");
     return;
   }
 
+  // Preview renders model at a fraction of the resolution
+  const size_t x = RenderGlobals::previewResolution(xRes);
+  const size_t y = RenderGlobals::previewResolution(yRes);
+  const size_t z = RenderGlobals::previewResolution(zRes);
+
   Log::print("Setting voxel buffer resolution to: " + str(V3i(x, y, z)));
-  
-  m_buffer->setSize(V3i(x, y, z));
-  m_buffer->clear(Colors::zero());
+
+  // Dense buffers allocate all their voxels up front, so fail before that
+  // if they don't fit the budget. The current buffer is about to be freed.
+  m_bufferMemory.release();
+  m_coarseBuffer.reset();
+  m_coarseBufferMemory.release();
+  if (m_reuseBuffers && field_dynamic_cast<DenseBuffer>(m_buffer)) {
+    // Swap in a pooled buffer, which takes over the mapping and names
+    DenseBuffer::Ptr pooled = acquirePooledBuffer(V3i(x, y, z));
+    pooled->setMapping(m_buffer->mapping());
+    pooled->name      = m_buffer->name;
+    pooled->attribute = m_buffer->attribute;
+    m_buffer = pooled;
+  } else {
+    if (field_dynamic_cast<DenseBuffer>(m_buffer)) {
+      Sys::Memory::checkBudget(x * y * z * sizeof(V3f), "Dense voxel buffer");
+    }
+    m_buffer->setSize(V3i(x, y, z));
+  }
+  if (DenseBuffer::Ptr dense = field_dynamic_cast<DenseBuffer>(m_buffer)) {
+    // Dense buffers are cleared by all threads, so that the voxels are 
+    // spread over the memory of all sockets rather than the calling thread's
+    const size_t numSlices  = dense->dataResolution().z;
+    const size_t numThreads = 
+      std::max(std::min(Sys::numWorkerThreads(m_numThreads), numSlices),
+               static_cast<size_t>(1));
+    Sys::JobState          job(numSlices);
+    Util::ProgressReporter progress(2.5f, "  Clearing: ");
+    Sys::runWorkers(numThreads, boost::bind(&clearSlices, boost::ref(*dense),
+                                            numThreads, boost::ref(job), _1),
+                    job, progress);
+  } else {
+    m_buffer->clear(Colors::zero());
+  }
+  m_bufferMemory.track(m_buffer.get(), m_buffer->memSize());
 }
 
 //----------------------------------------------------------------------------//
@@ -297,6 +1004,13 @@ void Modeler::setMapping(const Mapping mapping)
 
 //----------------------------------------------------------------------------//
 
+void Modeler::setFrustumDepth(const FrustumDepth depth)
+{
+  m_frustumDepth = depth;
+}
+
+//----------------------------------------------------------------------------//
+
 void Modeler::setDataStructure(const DataStructure dataStructure)
 {
   m_dataStructure = dataStructure;
@@ -318,6 +1032,106 @@ void Modeler::setCamera(Render::PerspectiveCamera::CPtr camera)
 
 //----------------------------------------------------------------------------//
 
+void Modeler::setNumThreads(const size_t numThreads)
+{
+  m_numThreads = numThreads;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setInstanceChunkSize(const size_t chunkSize)
+{
+  m_instanceChunkSize = chunkSize;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setDirectInstancing(const bool enabled)
+{
+  m_directInstancing = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setAggregateInstancing(const bool enabled)
+{
+  m_aggregateInstancing = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setDeterministic(const bool enabled)
+{
+  m_deterministic = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setOutputFormat(const OutputFormat format)
+{
+  m_outputFormat = format;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setSparseOutput(const bool enabled)
+{
+  m_sparseOutput = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setReuseBuffers(const bool enabled)
+{
+  m_reuseBuffers = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::clearBufferPool()
+{
+  boost::mutex::scoped_lock lock(g_bufferPoolMutex);
+  freeIdleBuffers();
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setInputCaching(const bool enabled)
+{
+  if (!enabled) {
+    m_inputCache.reset();
+  } else if (!m_inputCache) {
+    m_inputCache.reset(new InputCache);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::clearInputCache()
+{
+  if (m_inputCache) {
+    m_inputCache.reset(new InputCache);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setCoarseLevel(const size_t factor)
+{
+  m_coarseFactor = std::max(factor, static_cast<size_t>(1));
+  m_coarseBuffer.reset();
+  m_coarseBufferMemory.release();
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::setCoarseFeatureSize(const float voxels)
+{
+  m_coarseFeatureSize = std::max(voxels, 0.0f);
+}
+
+//----------------------------------------------------------------------------//
+
 void Modeler::execute()
 {
   if (!m_buffer) {
@@ -325,45 +1139,179 @@ void Modeler::execute()
     return;
   }
 
-  BOOST_FOREACH (ModelerInput::Ptr i, m_inputs) {
-
-    Prim::Primitive::CPtr prim = i->volumePrimitive();
-
-    if (!prim) {
-      Log::warning("Got null volume primitive in modeler input");
-      continue;
-    }
-
-    Prim::Inst::InstantiationPrim::CPtr instPrim = 
-      dynamic_pointer_cast<const Prim::Inst::InstantiationPrim>(prim);
-    Prim::Rast::RasterizationPrim::CPtr rastPrim = 
-      dynamic_pointer_cast<const Prim::Rast::RasterizationPrim>(prim);
+  // Clones that rasterize instancing chunks share the coarse level
+  if (m_coarseFactor <= 1 || m_inputCache) {
+    m_coarseBuffer.reset();
+    m_coarseBufferMemory.release();
+  } else if (!m_coarseBuffer) {
+    createCoarseBuffer();
+  }
 
-    if (instPrim) {
-      // Handle instantiation primitives
-      ModelerInput::Ptr newInput = instPrim->execute(i->geometry());
-      Modeler::Ptr modeler = clone();
-      modeler->clearInputs();
-      modeler->addInput(newInput);
-      modeler->execute();
-    } else if (rastPrim) {
-      // Handle rasterization primitives
-      rastPrim->execute(i->geometry(), m_buffer);
-    } else {
-      throw InvalidPrimitiveException(prim->typeName());
+  if (m_inputCache) {
+    executeCached();
+  } else {
+    BOOST_FOREACH (ModelerInput::Ptr i, m_inputs) {
+      executeInput(i);
     }
+  }
 
-  } 
+  m_bufferMemory.track(m_buffer.get(), m_buffer->memSize());
 
   //! \todo Move out of this function.
   float mbUse = m_buffer->memSize() / (1024 * 1024);
   Log::print("Voxel buffer memory use: " + str(mbUse) + "MB");
 
+  if (m_coarseBuffer) {
+    m_coarseBufferMemory.track(m_coarseBuffer.get(), 
+                               m_coarseBuffer->memSize());
+    Log::print("Coarse voxel buffer memory use: " + 
+               str(m_coarseBuffer->memSize() / (1024 * 1024)) + "MB");
+  }
+
   m_inputs.clear();
 }
   
 //----------------------------------------------------------------------------//
 
+Render::Volume::Ptr Modeler::executeClustered(const size_t res)
+{
+  using namespace Render;
+
+  Sys::Trace::Scope trace("Modeler::executeClustered", "modeling");
+
+  std::vector<BBox> wsBounds;
+  BOOST_FOREACH (ModelerInput::CPtr i, m_inputs) {
+    wsBounds.push_back(i->volumePrimitive()->wsBounds(i->geometry()));
+  }
+  const std::vector<std::vector<size_t> > clusters = clusterBounds(wsBounds);
+
+  Log::print("Modeling " + str(m_inputs.size()) + " inputs in " + 
+             str(clusters.size()) + " clusters");
+
+  // Each cluster is modeled by a copy of this modeler, so that all the 
+  // settings carry over. The volume takes over accounting for the buffer.
+  // Each cluster has a buffer layout of its own, so they don't share the 
+  // input cache.
+  std::vector<VoxelVolume::Ptr> volumes;
+  BOOST_FOREACH (const std::vector<size_t> &cluster, clusters) {
+    Modeler::Ptr modeler = clone();
+    modeler->m_inputCache.reset();
+    modeler->clearInputs();
+    BOOST_FOREACH (const size_t idx, cluster) {
+      modeler->addInput(m_inputs[idx]);
+    }
+    modeler->updateBounds();
+    if (!modeler->buffer()) {
+      continue;
+    }
+    modeler->setResolution(res);
+    modeler->execute();
+    VoxelVolume::Ptr volume = VoxelVolume::create();
+    volume->setBuffer(modeler->buffer());
+    volume->addAttribute(modeler->buffer()->attribute, V3f(1.0f));
+    volume->setCoarseBuffer(modeler->coarseBuffer());
+    volumes.push_back(volume);
+  }
+
+  m_inputs.clear();
+
+  if (volumes.empty()) {
+    return Volume::Ptr();
+  }
+  if (volumes.size() == 1) {
+    return volumes.front();
+  }
+  CompositeVolume::Ptr composite = CompositeVolume::create();
+  BOOST_FOREACH (const VoxelVolume::Ptr &volume, volumes) {
+    composite->add(volume);
+  }
+  return composite;
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::compactBuffer()
+{
+  Sys::Trace::Scope trace("Modeler::compactBuffer", "modeling");
+
+  if (!field_dynamic_cast<DenseBuffer>(m_buffer)) {
+    return;
+  }
+
+  Log::print("Compacting dense buffer");
+
+  Timer timer;
+
+  SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>
+    (convertForOutput<V3f>(m_buffer, true, sparseBlockOrder(m_sparseBlockSize),
+                           Sys::numWorkerThreads(m_numThreads)));
+
+  const V3i blockRes  = sparse->blockRes();
+  size_t    numBlocks = 0;
+  for (int k = 0; k < blockRes.z; ++k) {
+    for (int j = 0; j < blockRes.y; ++j) {
+      for (int i = 0; i < blockRes.x; ++i) {
+        numBlocks += sparse->blockIsAllocated(i, j, k) ? 1 : 0;
+      }
+    }
+  }
+  const size_t totalBlocks = blockRes.x * blockRes.y * blockRes.z;
+
+  m_buffer = sparse;
+  m_bufferMemory.track(m_buffer.get(), m_buffer->memSize());
+
+  Log::print("  Kept " + str(numBlocks) + " of " + str(totalBlocks) + 
+             " blocks, " + str(m_buffer->memSize() / (1024 * 1024)) + "MB");
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::blurBuffer(const float radius)
+{
+  Sys::Trace::Scope trace("Modeler::blurBuffer", "modeling");
+
+  if (!m_buffer) {
+    Log::warning("Modeler::blurBuffer(): No buffer to blur.");
+    return;
+  }
+
+  m_buffer = Model::gaussianBlur(m_buffer, radius, m_numThreads);
+  m_bufferMemory.track(m_buffer.get(), m_buffer->memSize());
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::resampleBuffer(const size_t x, const size_t y, const size_t z)
+{
+  Sys::Trace::Scope trace("Modeler::resampleBuffer", "modeling");
+
+  if (!m_buffer) {
+    Log::warning("Modeler::resampleBuffer(): No buffer to resample.");
+    return;
+  }
+
+  const V3i res(static_cast<int>(x), static_cast<int>(y), 
+                static_cast<int>(z));
+  m_buffer = Model::resample(m_buffer, res, m_numThreads);
+  m_bufferMemory.track(m_buffer.get(), m_buffer->memSize());
+}
+
+//----------------------------------------------------------------------------//
+
+VoxelBuffer::Ptr Modeler::maxDownsampledBuffer(const size_t factor) const
+{
+  Sys::Trace::Scope trace("Modeler::maxDownsampledBuffer", "modeling");
+
+  if (!m_buffer) {
+    return VoxelBuffer::Ptr();
+  }
+  return Model::maxDownsample(m_buffer, static_cast<int>(factor), 
+                              m_numThreads);
+}
+
+//----------------------------------------------------------------------------//
+
 void Modeler::saveBuffer(const std::string &filename) const
 {
   if (!m_buffer) {
@@ -373,11 +1321,68 @@ void Modeler::saveBuffer(const std::string &filename) const
 
   Log::print("Writing voxel buffer: " + filename);
 
+  Timer timer;
+
+  SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(m_buffer);
+  DenseBuffer::Ptr  dense  = field_dynamic_cast<DenseBuffer>(m_buffer);
+  // Sparse buffers are converted block by block, keeping their layout
+  const bool toSparse   = sparse || (dense && m_sparseOutput);
+  const int  blockOrder = 
+    sparse ? sparse->blockOrder() : sparseBlockOrder(m_sparseBlockSize);
+  const size_t numThreads = Sys::numWorkerThreads(m_numThreads);
+
   Field3DOutputFile out;
-  out.create(filename);
-  out.writeVectorLayer<float>(m_buffer);
+  if (!out.create(filename)) {
+    Log::warning("Couldn't create file: " + filename);
+    return;
+  }
+
+  bool success = false;
+  if (m_outputFormat == VectorOutput && !(dense && m_sparseOutput)) {
+    success = out.writeVectorLayer<float>(m_buffer);
+  } else if (!sparse && !dense) {
+    Log::warning("Modeler::saveBuffer() can only convert dense and sparse "
+                 "buffers. Writing as is.");
+    success = out.writeVectorLayer<float>(m_buffer);
+  } else {
+    switch (m_outputFormat) {
+    case VectorOutput:
+      success = out.writeVectorLayer<float>
+        (convertForOutput<V3f>(m_buffer, toSparse, blockOrder, numThreads));
+      break;
+    case HalfVectorOutput:
+      success = out.writeVectorLayer<half>
+        (convertForOutput<Imath::Vec3<half> >(m_buffer, toSparse, blockOrder, 
+                                              numThreads));
+      break;
+    case ScalarOutput:
+      success = out.writeScalarLayer<float>
+        (convertForOutput<float>(m_buffer, toSparse, blockOrder, numThreads));
+      break;
+    case HalfScalarOutput:
+    default:
+      success = out.writeScalarLayer<half>
+        (convertForOutput<half>(m_buffer, toSparse, blockOrder, numThreads));
+    }
+  }
+  if (!success) {
+    Log::warning("Couldn't write voxel buffer to " + filename);
+    return;
+  }
   
-  Log::print("  Done");
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+Sys::BackgroundTask::Ptr 
+Modeler::saveBufferAsync(const std::string &filename) const
+{
+  // The copy holds on to the buffer and the output settings
+  Modeler::Ptr snapshot = create();
+  *snapshot = *this;
+  return Sys::BackgroundTask::run(boost::bind(&Modeler::saveBuffer, snapshot,
+                                              filename));
 }
 
 //----------------------------------------------------------------------------//
@@ -389,6 +1394,13 @@ VoxelBuffer::Ptr Modeler::buffer() const
 
 //----------------------------------------------------------------------------//
 
+VoxelBuffer::Ptr Modeler::coarseBuffer() const
+{
+  return m_coarseBuffer;
+}
+
+//----------------------------------------------------------------------------//
+
 void Modeler::setupFrustumMapping(const BBox &wsBounds) const
 {
   using namespace Render;
@@ -410,6 +1422,9 @@ void Modeler::setupFrustumMapping(const BBox &wsBounds) const
   cam->setClipPlanes(near, far);
   // Copy the transforms from the camera
   FrustumFieldMapping::Ptr mapping(new FrustumFieldMapping);
+  mapping->setZDistribution(m_frustumDepth == UniformDepth ? 
+                            FrustumFieldMapping::UniformDistribution :
+                            FrustumFieldMapping::PerspectiveDistribution);
   const Camera::MatrixVec& ssToWs = cam->screenToWorldMatrices();
   const Camera::MatrixVec& csToWs = cam->cameraToWorldMatrices();
   const size_t numSamples = ssToWs.size();
@@ -434,6 +1449,196 @@ void Modeler::setupUniformMapping(const BBox &wsBounds) const
 
 //----------------------------------------------------------------------------//
 
+void Modeler::executeChunk(ModelerInput::Ptr chunk)
+{
+  Modeler::Ptr modeler = clone();
+  modeler->clearInputs();
+  modeler->addInput(chunk);
+  modeler->execute();
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::executeInput(ModelerInput::Ptr input)
+{
+  Prim::Primitive::CPtr prim = input->volumePrimitive();
+
+  if (!prim) {
+    Log::warning("Got null volume primitive in modeler input");
+    return;
+  }
+
+  Sys::Trace::Scope trace(prim->typeName() + "::execute", "modeling");
+
+  // Primitives whose smallest features span enough coarse voxels go to 
+  // the coarse level
+  VoxelBuffer::Ptr buffer = m_buffer;
+  if (m_coarseBuffer) {
+    const V3i    dvsCenter = 
+      (m_coarseBuffer->dataWindow().min + m_coarseBuffer->dataWindow().max) / 2;
+    const Vector wsVoxelSize = 
+      m_coarseBuffer->mapping()->wsVoxelSize(dvsCenter.x, dvsCenter.y, 
+                                             dvsCenter.z);
+    const double wsCoarseSize = m_coarseFeatureSize * 
+      std::max(std::max(wsVoxelSize.x, wsVoxelSize.y), wsVoxelSize.z);
+    if (prim->wsFeatureSize(input->geometry()) >= wsCoarseSize) {
+      Log::print(prim->typeName() + " rasterized into the coarse level");
+      buffer = m_coarseBuffer;
+    }
+  }
+
+  Prim::Inst::InstantiationPrim::CPtr instPrim = 
+    dynamic_pointer_cast<const Prim::Inst::InstantiationPrim>(prim);
+  Prim::Rast::RasterizationPrim::CPtr rastPrim = 
+    dynamic_pointer_cast<const Prim::Rast::RasterizationPrim>(prim);
+
+  if (instPrim) {
+    // Handle instantiation primitives. If possible, the instanced points
+    // are aggregated in per-thread grids, or written straight to the 
+    // buffer. Otherwise each chunk of output is rasterized as it is 
+    // produced, so only one chunk is held in memory at a time.
+    const bool aggregated = m_aggregateInstancing &&
+      instPrim->rasterizeAggregated(input->geometry(), buffer, m_numThreads,
+                                    m_deterministic);
+    const bool direct = aggregated || (m_directInstancing &&
+      instPrim->rasterizeDirect(input->geometry(), buffer, m_numThreads));
+    if (!direct) {
+      instPrim->executeChunked(input->geometry(), m_instanceChunkSize, 
+                               boost::bind(&Modeler::executeChunk, this, _1),
+                               m_numThreads);
+    }
+  } else if (rastPrim) {
+    // Handle rasterization primitives
+    rastPrim->execute(input->geometry(), buffer, m_numThreads, 
+                      m_deterministic);
+  } else {
+    throw InvalidPrimitiveException(prim->typeName());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::createCoarseBuffer()
+{
+  // Rounding the resolution up keeps the coarse voxels at most m_coarseFactor
+  // times larger, while the shared mapping keeps the bounds the same
+  const int factor = static_cast<int>(m_coarseFactor);
+  const V3i res    = m_buffer->extents().size() + V3i(1);
+  const V3i coarseRes((res.x + factor - 1) / factor, 
+                      (res.y + factor - 1) / factor,
+                      (res.z + factor - 1) / factor);
+
+  SparseBuffer::Ptr buffer(new SparseBuffer);
+  buffer->setBlockOrder(sparseBlockOrder(m_sparseBlockSize));
+  buffer->setSize(coarseRes);
+  buffer->setMapping(m_buffer->mapping());
+  buffer->name      = m_buffer->name;
+  buffer->attribute = m_buffer->attribute;
+  m_coarseBuffer = buffer;
+
+  Log::print("Creating coarse sparse buffer: " + str(coarseRes));
+}
+
+//----------------------------------------------------------------------------//
+
+void Modeler::executeCached()
+{
+  Sys::Trace::Scope trace("Modeler::executeCached", "modeling");
+
+  InputCache       &cache  = *m_inputCache;
+  SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(m_buffer);
+  DenseBuffer::Ptr  dense  = field_dynamic_cast<DenseBuffer>(m_buffer);
+  const int         blockOrder = 
+    sparse ? sparse->blockOrder() : sparseBlockOrder(m_sparseBlockSize);
+
+  // The kept buffers only line up with a buffer of the same layout
+  if (!cache.mapping || !m_buffer->mapping()->isIdentical(cache.mapping) ||
+      cache.dataWindow != m_buffer->dataWindow() ||
+      cache.blockOrder != blockOrder) {
+    if (!cache.inputs.empty()) {
+      Log::print("Voxel buffer layout changed. Clearing input cache");
+    }
+    cache.inputs.clear();
+    cache.mapping    = m_buffer->mapping();
+    cache.dataWindow = m_buffer->dataWindow();
+    cache.blockOrder = blockOrder;
+  }
+
+  // Inputs that weren't added again are dropped along with the old map
+  CachedInputMap                 inputs;
+  std::vector<SparseBuffer::Ptr> buffers;
+  size_t                         numRasterized = 0;
+
+  BOOST_FOREACH (ModelerInput::Ptr i, m_inputs) {
+    const std::string &key = i->cacheKey();
+    CachedInputMap::iterator cached = 
+      key.empty() ? cache.inputs.end() : cache.inputs.find(key);
+    if (cached != cache.inputs.end()) {
+      buffers.push_back(cached->second.buffer);
+      inputs[key] = cached->second;
+      continue;
+    }
+    SparseBuffer::Ptr buffer = rasterizeDelta(i, blockOrder);
+    numRasterized++;
+    buffers.push_back(buffer);
+    if (!key.empty()) {
+      CachedInput &entry = inputs[key];
+      entry.buffer = buffer;
+      entry.memory.track(buffer.get(), buffer->memSize());
+    }
+  }
+  cache.inputs.swap(inputs);
+
+  Log::print("Rasterized " + str(numRasterized) + " of " + 
+             str(m_inputs.size()) + " inputs, reused the rest from the "
+             "input cache");
+
+  if (buffers.empty()) {
+    return;
+  }
+
+  // Add up the input buffers, one row of blocks per job
+  const size_t numRows = buffers.front()->blockRes().z;
+  const size_t n       = std::max(std::min(Sys::numWorkerThreads(m_numThreads),
+                                           numRows), static_cast<size_t>(1));
+  Util::ProgressReporter progress(2.5f, "  Adding input buffers: ");
+  Sys::JobState          job(numRows);
+  if (sparse) {
+    Sys::runWorkers(n, boost::bind(&addBlocks<SparseBuffer>, 
+                                   boost::cref(buffers), boost::ref(*sparse),
+                                   n, boost::ref(job), _1), 
+                    job, progress);
+  } else {
+    Sys::runWorkers(n, boost::bind(&addBlocks<DenseBuffer>, 
+                                   boost::cref(buffers), boost::ref(*dense),
+                                   n, boost::ref(job), _1), 
+                    job, progress);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+SparseBuffer::Ptr Modeler::rasterizeDelta(ModelerInput::Ptr input, 
+                                          const int blockOrder)
+{
+  SparseBuffer::Ptr buffer(new SparseBuffer);
+  buffer->setBlockOrder(blockOrder);
+  buffer->setSize(m_buffer->extents(), m_buffer->dataWindow());
+  buffer->setMapping(m_buffer->mapping());
+  buffer->name      = m_buffer->name;
+  buffer->attribute = m_buffer->attribute;
+
+  // A copy of this modeler writes into the new buffer, without caching
+  Modeler::Ptr modeler = clone();
+  modeler->m_inputCache.reset();
+  modeler->m_coarseFactor = 1;
+  modeler->m_buffer = buffer;
+  modeler->executeInput(input);
+  return buffer;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Model
 } // namespace pvr
 
@@ -74,6 +74,20 @@ Prim::Primitive::CPtr ModelerInput::volumePrimitive() const
 {
   return m_primitive;
 }
+
+//----------------------------------------------------------------------------//
+
+void ModelerInput::setCacheKey(const std::string &key)
+{
+  m_cacheKey = key;
+}
+
+//----------------------------------------------------------------------------//
+
+const std::string& ModelerInput::cacheKey() const
+{
+  return m_cacheKey;
+}
   
 //----------------------------------------------------------------------------//
 
@@ -33,7 +33,577 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PVR_NOISE_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PVR_NOISE_SIMD
+#endif
+
+// Library includes
+
+#include <boost/thread/mutex.hpp>
+#include <OpenEXR/half.h>
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of points processed per call to a Fractal's noise function
+  const size_t k_fractalBatchSize = 64;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the number of octaves of a fractal that a lookup covering 
+  //! filterWidth resolves. The footprint of octave i is 
+  //! filterWidth / scale * lacunarity^i noise units, and the noise functions
+  //! have features about one unit across, so octaves whose footprint is 
+  //! wider than half a unit are dropped. The fractional part fades out the
+  //! last octave, and at least one octave is always kept.
+  float filteredOctaves(const float octaves, const float scale, 
+                        const float lacunarity, const float filterWidth)
+  {
+    if (filterWidth <= 0.0f || lacunarity <= 1.0f) {
+      return octaves;
+    }
+    const float nyquist = 
+      std::log(0.5f * scale / filterWidth) / std::log(lacunarity);
+    return std::min(octaves, std::max(nyquist, 1.0f));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Guards baking of the TiledfBm noise tiles
+  boost::mutex g_tileMutex;
+
+  //--------------------------------------------------------------------------//
+
+  //! Noise functions are stateless, so fBmCache shares these between all 
+  //! the fractals it builds
+  const Noise::NoiseFunction::CPtr g_perlinNoise(new Noise::PerlinNoise);
+  const Noise::NoiseFunction::CPtr g_absPerlinNoise(new Noise::AbsPerlinNoise);
+  const Noise::NoiseFunction::CPtr g_simplexNoise(new Noise::SimplexNoise);
+  const Noise::NoiseFunction::CPtr 
+  g_absSimplexNoise(new Noise::AbsSimplexNoise);
+
+  //--------------------------------------------------------------------------//
+
+  //! Lattice cell and interpolation weights of a lookup into a noise tile
+  struct TileCoord
+  {
+    size_t offset[2][3];
+    float  t[3];
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the tile voxels surrounding the noise space point p. Indices
+  //! wrap around since the tile is periodic.
+  inline void tileCoord(const Imath::V3f &p, const int res, const int period,
+                        TileCoord &c)
+  {
+    const float  toTile = static_cast<float>(res) / period;
+    const size_t stride[3] = { 1, static_cast<size_t>(res), 
+                               static_cast<size_t>(res * res) };
+    for (int a = 0; a < 3; ++a) {
+      const float u  = p[a] * toTile;
+      const float fu = std::floor(u);
+      const int   i0 = static_cast<int>(fu) & (res - 1);
+      const int   i1 = (i0 + 1) & (res - 1);
+      c.t[a]         = u - fu;
+      c.offset[0][a] = i0 * stride[a];
+      c.offset[1][a] = i1 * stride[a];
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Trilinearly interpolates a tile. Stride is the number of channels.
+  inline float tileLookup(const half *tile, const size_t stride, 
+                          const TileCoord &c)
+  {
+    float v[2][2];
+    for (int k = 0; k < 2; ++k) {
+      for (int j = 0; j < 2; ++j) {
+        const size_t row = c.offset[j][1] + c.offset[k][2];
+        const float  v0  = tile[(row + c.offset[0][0]) * stride];
+        const float  v1  = tile[(row + c.offset[1][0]) * stride];
+        v[k][j] = Imath::lerp(v0, v1, c.t[0]);
+      }
+    }
+    return Imath::lerp(Imath::lerp(v[0][0], v[0][1], c.t[1]),
+                       Imath::lerp(v[1][0], v[1][1], c.t[1]), c.t[2]);
+  }
+
+  //--------------------------------------------------------------------------//
+
+#if defined(PVR_NOISE_SIMD)
+
+  //--------------------------------------------------------------------------//
+
+  //! Thin wrappers around the SIMD intrinsics used by the batched Perlin 
+  //! and simplex noise. The operations mirror NoiseImpl.h exactly, so the 
+  //! batched results match eval() bit for bit.
+
+#if defined(__AVX2__)
+
+  struct Lanes
+  {
+    enum { Size = 8 };
+    typedef __m256  Float;
+    typedef __m256i Int;
+
+    static Float load(const float *p)       { return _mm256_loadu_ps(p); }
+    static void  store(float *p, Float x)   { _mm256_storeu_ps(p, x); }
+    static Float set(const float x)         { return _mm256_set1_ps(x); }
+    static Int   set(const int x)           { return _mm256_set1_epi32(x); }
+    static Float add(Float a, Float b)      { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b)      { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b)      { return _mm256_mul_ps(a, b); }
+    static Float xorBits(Float a, Int b)    
+    { return _mm256_xor_ps(a, _mm256_castsi256_ps(b)); }
+    static Int   add(Int a, Int b)          { return _mm256_add_epi32(a, b); }
+    static Int   sub(Int a, Int b)          { return _mm256_sub_epi32(a, b); }
+    static Int   xorBits(Int a, Int b)      { return _mm256_xor_si256(a, b); }
+    static Int   andBits(Int a, Int b)      { return _mm256_and_si256(a, b); }
+    static Int   orBits(Int a, Int b)       { return _mm256_or_si256(a, b); }
+    template <int K>
+    static Int   shl(Int a)                 { return _mm256_slli_epi32(a, K); }
+    template <int K>
+    static Int   shr(Int a)                 { return _mm256_srli_epi32(a, K); }
+    static Int   less(Int a, Int b)         { return _mm256_cmpgt_epi32(b, a); }
+    static Int   equal(Int a, Int b)        { return _mm256_cmpeq_epi32(a, b); }
+    static Int   lessZero(Float a)          
+    { 
+      return _mm256_castps_si256(_mm256_cmp_ps(a, _mm256_setzero_ps(), 
+                                               _CMP_LT_OQ)); 
+    }
+    static Int   greaterEqual(Float a, Float b)
+    { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+    static Float max(Float a, Float b)      { return _mm256_max_ps(a, b); }
+    static Int   truncate(Float a)          { return _mm256_cvttps_epi32(a); }
+    static Float toFloat(Int a)             { return _mm256_cvtepi32_ps(a); }
+    static Float select(Int mask, Float a, Float b)
+    { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask)); }
+  };
+
+#else
+
+  struct Lanes
+  {
+    enum { Size = 4 };
+    typedef __m128  Float;
+    typedef __m128i Int;
+
+    static Float load(const float *p)       { return _mm_loadu_ps(p); }
+    static void  store(float *p, Float x)   { _mm_storeu_ps(p, x); }
+    static Float set(const float x)         { return _mm_set1_ps(x); }
+    static Int   set(const int x)           { return _mm_set1_epi32(x); }
+    static Float add(Float a, Float b)      { return _mm_add_ps(a, b); }
+    static Float sub(Float a, Float b)      { return _mm_sub_ps(a, b); }
+    static Float mul(Float a, Float b)      { return _mm_mul_ps(a, b); }
+    static Float xorBits(Float a, Int b)    
+    { return _mm_xor_ps(a, _mm_castsi128_ps(b)); }
+    static Int   add(Int a, Int b)          { return _mm_add_epi32(a, b); }
+    static Int   sub(Int a, Int b)          { return _mm_sub_epi32(a, b); }
+    static Int   xorBits(Int a, Int b)      { return _mm_xor_si128(a, b); }
+    static Int   andBits(Int a, Int b)      { return _mm_and_si128(a, b); }
+    static Int   orBits(Int a, Int b)       { return _mm_or_si128(a, b); }
+    template <int K>
+    static Int   shl(Int a)                 { return _mm_slli_epi32(a, K); }
+    template <int K>
+    static Int   shr(Int a)                 { return _mm_srli_epi32(a, K); }
+    static Int   less(Int a, Int b)         { return _mm_cmplt_epi32(a, b); }
+    static Int   equal(Int a, Int b)        { return _mm_cmpeq_epi32(a, b); }
+    static Int   lessZero(Float a)          
+    { return _mm_castps_si128(_mm_cmplt_ps(a, _mm_setzero_ps())); }
+    static Int   greaterEqual(Float a, Float b)
+    { return _mm_castps_si128(_mm_cmpge_ps(a, b)); }
+    static Float max(Float a, Float b)      { return _mm_max_ps(a, b); }
+    static Int   truncate(Float a)          { return _mm_cvttps_epi32(a); }
+    static Float toFloat(Int a)             { return _mm_cvtepi32_ps(a); }
+    static Float select(Int mask, Float a, Float b)
+    { 
+      const __m128 m = _mm_castsi128_ps(mask);
+      return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); 
+    }
+  };
+
+#endif
+
+  //--------------------------------------------------------------------------//
+
+  typedef Lanes::Float LFloat;
+  typedef Lanes::Int   LInt;
+
+  //--------------------------------------------------------------------------//
+
+  //! Rotates left. Matches rot() in inthash().
+  template <int K>
+  inline LInt rot(const LInt x)
+  {
+    return Lanes::orBits(Lanes::shl<K>(x), Lanes::shr<32 - K>(x));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Vectorized inthash<3>()
+  inline LInt hash3(const LInt x, const LInt y, const LInt z)
+  {
+    const LInt init = Lanes::set(static_cast<int>(0xdeadbeef + (3 << 2) + 13));
+    LInt a = Lanes::add(init, x);
+    LInt b = Lanes::add(init, y);
+    LInt c = Lanes::add(init, z);
+    c = Lanes::sub(Lanes::xorBits(c, b), rot<14>(b));
+    a = Lanes::sub(Lanes::xorBits(a, c), rot<11>(c));
+    b = Lanes::sub(Lanes::xorBits(b, a), rot<25>(a));
+    c = Lanes::sub(Lanes::xorBits(c, b), rot<16>(b));
+    a = Lanes::sub(Lanes::xorBits(a, c), rot<4>(c));
+    b = Lanes::sub(Lanes::xorBits(b, a), rot<14>(a));
+    c = Lanes::sub(Lanes::xorBits(c, b), rot<24>(b));
+    return c;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Vectorized 3D grad()
+  inline LFloat grad(const LInt hash, const LFloat x, const LFloat y, 
+                     const LFloat z)
+  {
+    const LInt   h   = Lanes::andBits(hash, Lanes::set(15));
+    const LFloat u   = Lanes::select(Lanes::less(h, Lanes::set(8)), x, y);
+    const LInt   hXZ = Lanes::equal(Lanes::orBits(h, Lanes::set(2)), 
+                                    Lanes::set(14));
+    const LFloat v   = Lanes::select(Lanes::less(h, Lanes::set(4)), y, 
+                                     Lanes::select(hXZ, x, z));
+    // Negation flips the sign bit
+    const LInt   uSign = Lanes::shl<31>(Lanes::andBits(h, Lanes::set(1)));
+    const LInt   vSign = Lanes::shl<30>(Lanes::andBits(h, Lanes::set(2)));
+    return Lanes::add(Lanes::xorBits(u, uSign), Lanes::xorBits(v, vSign));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  inline LFloat lerp(const LFloat t, const LFloat a, const LFloat b)
+  {
+    return Lanes::add(Lanes::mul(Lanes::sub(Lanes::set(1.0f), t), a), 
+                      Lanes::mul(t, b));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  inline LFloat fade(const LFloat t)
+  {
+    const LFloat poly = 
+      Lanes::add(Lanes::mul(t, Lanes::sub(Lanes::mul(t, Lanes::set(6.0f)), 
+                                          Lanes::set(15.0f))), 
+                 Lanes::set(10.0f));
+    return Lanes::mul(Lanes::mul(Lanes::mul(t, t), t), poly);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches quick_floor() and floorfrac(), including quick_floor()'s 
+  //! behavior for negative integers.
+  inline LFloat floorfrac(const LFloat x, LInt &i)
+  {
+    i = Lanes::add(Lanes::truncate(x), Lanes::lessZero(x));
+    return Lanes::sub(x, Lanes::toFloat(i));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Per-lane state for one 3D Perlin lookup
+  struct PerlinLookup
+  {
+    PerlinLookup(const Imath::V3f *p)
+    {
+      float x[Lanes::Size], y[Lanes::Size], z[Lanes::Size];
+      for (int i = 0; i < Lanes::Size; ++i) {
+        x[i] = p[i].x;
+        y[i] = p[i].y;
+        z[i] = p[i].z;
+      }
+      fx = floorfrac(Lanes::load(x), X);
+      fy = floorfrac(Lanes::load(y), Y);
+      fz = floorfrac(Lanes::load(z), Z);
+      u  = fade(fx);
+      v  = fade(fy);
+      w  = fade(fz);
+      // Corner coordinates, offset by one
+      const LInt one = Lanes::set(1);
+      const LFloat fOne = Lanes::set(1.0f);
+      X1 = Lanes::add(X, one);
+      Y1 = Lanes::add(Y, one);
+      Z1 = Lanes::add(Z, one);
+      fx1 = Lanes::sub(fx, fOne);
+      fy1 = Lanes::sub(fy, fOne);
+      fz1 = Lanes::sub(fz, fOne);
+    }
+    //! Interpolates the eight corner gradients, given the corner hashes
+    //! in x-fastest order.
+    LFloat interpolate(const LInt *h, const int shift) const
+    {
+      LInt c[8];
+      for (int i = 0; i < 8; ++i) {
+        c[i] = shift == 0 ? h[i] : shift == 8 ? Lanes::shr<8>(h[i]) : 
+          Lanes::shr<16>(h[i]);
+      }
+      LFloat g000 = grad(c[0], fx,  fy,  fz);
+      LFloat g100 = grad(c[1], fx1, fy,  fz);
+      LFloat g010 = grad(c[2], fx,  fy1, fz);
+      LFloat g110 = grad(c[3], fx1, fy1, fz);
+      LFloat g001 = grad(c[4], fx,  fy,  fz1);
+      LFloat g101 = grad(c[5], fx1, fy,  fz1);
+      LFloat g011 = grad(c[6], fx,  fy1, fz1);
+      LFloat g111 = grad(c[7], fx1, fy1, fz1);
+      LFloat result = 
+        lerp(w, lerp(v, lerp(u, g000, g100), lerp(u, g010, g110)),
+             lerp(v, lerp(u, g001, g101), lerp(u, g011, g111)));
+      return Lanes::mul(Lanes::set(0.9820f), result);
+    }
+    //! Computes the corner hashes
+    void hashes(LInt *h) const
+    {
+      h[0] = hash3(X,  Y,  Z);
+      h[1] = hash3(X1, Y,  Z);
+      h[2] = hash3(X,  Y1, Z);
+      h[3] = hash3(X1, Y1, Z);
+      h[4] = hash3(X,  Y,  Z1);
+      h[5] = hash3(X1, Y,  Z1);
+      h[6] = hash3(X,  Y1, Z1);
+      h[7] = hash3(X1, Y1, Z1);
+    }
+    LInt   X, Y, Z, X1, Y1, Z1;
+    LFloat fx, fy, fz, fx1, fy1, fz1;
+    LFloat u, v, w;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Per-lane state for one 3D simplex lookup. Mirrors simplex() in 
+  //! NoiseImpl.h operation for operation.
+  struct SimplexLookup
+  {
+    SimplexLookup(const Imath::V3f *p)
+    {
+      float xs[Lanes::Size], ys[Lanes::Size], zs[Lanes::Size];
+      for (int i = 0; i < Lanes::Size; ++i) {
+        xs[i] = p[i].x;
+        ys[i] = p[i].y;
+        zs[i] = p[i].z;
+      }
+      const LFloat x = Lanes::load(xs);
+      const LFloat y = Lanes::load(ys);
+      const LFloat z = Lanes::load(zs);
+      // Cell of the skewed grid
+      const LFloat s = Lanes::mul(Lanes::add(Lanes::add(x, y), z), 
+                                  Lanes::set(Noise::k_simplexF3));
+      LInt X, Y, Z;
+      floorfrac(Lanes::add(x, s), X);
+      floorfrac(Lanes::add(y, s), Y);
+      floorfrac(Lanes::add(z, s), Z);
+      const LInt   sum = Lanes::add(Lanes::add(X, Y), Z);
+      const LFloat t   = Lanes::mul(Lanes::toFloat(sum), 
+                                    Lanes::set(Noise::k_simplexG3));
+      fx[0] = Lanes::sub(x, Lanes::sub(Lanes::toFloat(X), t));
+      fy[0] = Lanes::sub(y, Lanes::sub(Lanes::toFloat(Y), t));
+      fz[0] = Lanes::sub(z, Lanes::sub(Lanes::toFloat(Z), t));
+      // Middle corners, from the rank of the coordinates. The masks are 
+      // all ones where set.
+      const LInt ones = Lanes::set(-1);
+      const LInt xy   = Lanes::greaterEqual(fx[0], fy[0]);
+      const LInt xz   = Lanes::greaterEqual(fx[0], fz[0]);
+      const LInt yz   = Lanes::greaterEqual(fy[0], fz[0]);
+      const LInt yx   = Lanes::xorBits(xy, ones);
+      const LInt zx   = Lanes::xorBits(xz, ones);
+      const LInt zy   = Lanes::xorBits(yz, ones);
+      const LInt offset[2][3] = { 
+        { Lanes::andBits(xy, xz), Lanes::andBits(yx, yz), 
+          Lanes::andBits(zx, zy) },
+        { Lanes::orBits(xy, xz), Lanes::orBits(yx, yz), 
+          Lanes::xorBits(Lanes::andBits(xz, yz), ones) }
+      };
+      const LFloat g[3] = { 
+        Lanes::set(Noise::k_simplexG3), 
+        Lanes::set(2.0f * Noise::k_simplexG3),
+        Lanes::set(3.0f * Noise::k_simplexG3)
+      };
+      const LInt one = Lanes::set(1);
+      for (int c = 0; c < 2; ++c) {
+        const LInt *o = offset[c];
+        const LFloat ox = Lanes::toFloat(Lanes::andBits(o[0], one));
+        const LFloat oy = Lanes::toFloat(Lanes::andBits(o[1], one));
+        const LFloat oz = Lanes::toFloat(Lanes::andBits(o[2], one));
+        fx[c + 1] = Lanes::add(Lanes::sub(fx[0], ox), g[c]);
+        fy[c + 1] = Lanes::add(Lanes::sub(fy[0], oy), g[c]);
+        fz[c + 1] = Lanes::add(Lanes::sub(fz[0], oz), g[c]);
+        // Subtracting a mask of all ones adds one
+        cx[c + 1] = Lanes::sub(X, o[0]);
+        cy[c + 1] = Lanes::sub(Y, o[1]);
+        cz[c + 1] = Lanes::sub(Z, o[2]);
+      }
+      const LFloat fOne = Lanes::set(1.0f);
+      fx[3] = Lanes::add(Lanes::sub(fx[0], fOne), g[2]);
+      fy[3] = Lanes::add(Lanes::sub(fy[0], fOne), g[2]);
+      fz[3] = Lanes::add(Lanes::sub(fz[0], fOne), g[2]);
+      cx[0] = X;
+      cy[0] = Y;
+      cz[0] = Z;
+      cx[3] = Lanes::add(X, one);
+      cy[3] = Lanes::add(Y, one);
+      cz[3] = Lanes::add(Z, one);
+      // Falloff of each corner
+      const LFloat r2   = Lanes::set(0.5f);
+      const LFloat zero = Lanes::set(0.0f);
+      for (int c = 0; c < 4; ++c) {
+        LFloat d = Lanes::sub(r2, Lanes::mul(fx[c], fx[c]));
+        d = Lanes::sub(d, Lanes::mul(fy[c], fy[c]));
+        d = Lanes::sub(d, Lanes::mul(fz[c], fz[c]));
+        d = Lanes::max(d, zero);
+        d = Lanes::mul(d, d);
+        w[c] = Lanes::mul(d, d);
+      }
+    }
+    //! Sums the four corner contributions, given the corner hashes
+    LFloat interpolate(const LInt *h, const int shift) const
+    {
+      LFloat n[4];
+      for (int c = 0; c < 4; ++c) {
+        const LInt hc = shift == 0 ? h[c] : shift == 8 ? 
+          Lanes::shr<8>(h[c]) : Lanes::shr<16>(h[c]);
+        n[c] = Lanes::mul(w[c], grad(hc, fx[c], fy[c], fz[c]));
+      }
+      const LFloat result = 
+        Lanes::add(Lanes::add(Lanes::add(n[0], n[1]), n[2]), n[3]);
+      return Lanes::mul(Lanes::set(76.0f), result);
+    }
+    //! Computes the corner hashes
+    void hashes(LInt *h) const
+    {
+      for (int c = 0; c < 4; ++c) {
+        h[c] = hash3(cx[c], cy[c], cz[c]);
+      }
+    }
+    LInt   cx[4], cy[4], cz[4];
+    LFloat fx[4], fy[4], fz[4];
+    LFloat w[4];
+  };
+
+  //--------------------------------------------------------------------------//
+
+#endif // PVR_NOISE_SIMD
+
+  //--------------------------------------------------------------------------//
+
+  //! Evaluates SNoise for a batch of points
+  void perlinBatch(const Noise::SNoise &noise, const Imath::V3f *p, 
+                   float *result, const size_t n)
+  {
+    size_t i = 0;
+#if defined(PVR_NOISE_SIMD)
+    for (; i + Lanes::Size <= n; i += Lanes::Size) {
+      PerlinLookup lookup(p + i);
+      LInt h[8];
+      lookup.hashes(h);
+      Lanes::store(result + i, lookup.interpolate(h, 0));
+    }
+#endif
+    for (; i < n; ++i) {
+      noise(result[i], p[i]);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Evaluates vector SNoise for a batch of points. Each component uses 
+  //! eight bits of the same hash, as in HashVector.
+  void perlinVecBatch(const Noise::SNoise &noise, const Imath::V3f *p, 
+                      Imath::V3f *result, const size_t n)
+  {
+    size_t i = 0;
+#if defined(PVR_NOISE_SIMD)
+    for (; i + Lanes::Size <= n; i += Lanes::Size) {
+      PerlinLookup lookup(p + i);
+      LInt h[8];
+      lookup.hashes(h);
+      float x[Lanes::Size], y[Lanes::Size], z[Lanes::Size];
+      Lanes::store(x, lookup.interpolate(h, 0));
+      Lanes::store(y, lookup.interpolate(h, 8));
+      Lanes::store(z, lookup.interpolate(h, 16));
+      for (int lane = 0; lane < Lanes::Size; ++lane) {
+        result[i + lane] = Imath::V3f(x[lane], y[lane], z[lane]);
+      }
+    }
+#endif
+    for (; i < n; ++i) {
+      noise(result[i], p[i]);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Evaluates SimplexSNoise for a batch of points
+  void simplexBatch(const Noise::SimplexSNoise &noise, const Imath::V3f *p, 
+                    float *result, const size_t n)
+  {
+    size_t i = 0;
+#if defined(PVR_NOISE_SIMD)
+    for (; i + Lanes::Size <= n; i += Lanes::Size) {
+      SimplexLookup lookup(p + i);
+      LInt h[4];
+      lookup.hashes(h);
+      Lanes::store(result + i, lookup.interpolate(h, 0));
+    }
+#endif
+    for (; i < n; ++i) {
+      noise(result[i], p[i]);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Evaluates vector SimplexSNoise for a batch of points. The setup and 
+  //! corner hashes are shared by the three components.
+  void simplexVecBatch(const Noise::SimplexSNoise &noise, const Imath::V3f *p,
+                       Imath::V3f *result, const size_t n)
+  {
+    size_t i = 0;
+#if defined(PVR_NOISE_SIMD)
+    for (; i + Lanes::Size <= n; i += Lanes::Size) {
+      SimplexLookup lookup(p + i);
+      LInt h[4];
+      lookup.hashes(h);
+      float x[Lanes::Size], y[Lanes::Size], z[Lanes::Size];
+      Lanes::store(x, lookup.interpolate(h, 0));
+      Lanes::store(y, lookup.interpolate(h, 8));
+      Lanes::store(z, lookup.interpolate(h, 16));
+      for (int lane = 0; lane < Lanes::Size; ++lane) {
+        result[i + lane] = Imath::V3f(x[lane], y[lane], z[lane]);
+      }
+    }
+#endif
+    for (; i < n; ++i) {
+      noise(result[i], p[i]);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -56,6 +626,26 @@ Imath::V3f NoiseFunction::evalVec(const Imath::V3f &p) const
   return evalVec(p.x, p.y, p.z);
 }
 
+//----------------------------------------------------------------------------//
+
+void NoiseFunction::evalBatch(const Imath::V3f *p, float *result, 
+                              const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = eval(p[i].x, p[i].y, p[i].z);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void NoiseFunction::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                 const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = evalVec(p[i].x, p[i].y, p[i].z);
+  }
+}
+
 //----------------------------------------------------------------------------//
 // PerlinNoise
 //----------------------------------------------------------------------------//
@@ -120,6 +710,22 @@ NoiseFunction::Range PerlinNoise::range() const
   return std::make_pair(-1.0, 1.0f);
 }
 
+//----------------------------------------------------------------------------//
+
+void PerlinNoise::evalBatch(const Imath::V3f *p, float *result, 
+                            const size_t n) const
+{
+  perlinBatch(m_noise, p, result, n);
+}
+
+//----------------------------------------------------------------------------//
+
+void PerlinNoise::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                               const size_t n) const
+{
+  perlinVecBatch(m_noise, p, result, n);
+}
+
 //----------------------------------------------------------------------------//
 // AbsPerlinNoise
 //----------------------------------------------------------------------------//
@@ -183,6 +789,194 @@ NoiseFunction::Range AbsPerlinNoise::range() const
   return std::make_pair(0.0f, 1.0f);
 }
 
+//----------------------------------------------------------------------------//
+
+void AbsPerlinNoise::evalBatch(const Imath::V3f *p, float *result, 
+                               const size_t n) const
+{
+  perlinBatch(m_noise, p, result, n);
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = std::abs(result[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void AbsPerlinNoise::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                  const size_t n) const
+{
+  perlinVecBatch(m_noise, p, result, n);
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = Math::abs(result[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// SimplexNoise
+//----------------------------------------------------------------------------//
+
+float SimplexNoise::eval(const float x) const
+{
+  float result;
+  m_noise(result, x);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+float SimplexNoise::eval(const float x, const float y) const
+{
+  float result;
+  m_noise(result, x, y);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+float SimplexNoise::eval(const float x, const float y, const float z) const
+{
+  float result;
+  m_noise(result, Imath::V3f(x, y, z));
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f SimplexNoise::evalVec(const float x) const
+{
+  Imath::V3f result;
+  m_noise(result, x);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f SimplexNoise::evalVec(const float x, const float y) const
+{
+  Imath::V3f result;
+  m_noise(result, x, y);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f SimplexNoise::evalVec(const float x, const float y, 
+                                 const float z) const
+{
+  Imath::V3f result;
+  m_noise(result, Imath::V3f(x, y, z));
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+NoiseFunction::Range SimplexNoise::range() const
+{
+  return std::make_pair(-1.0f, 1.0f);
+}
+
+//----------------------------------------------------------------------------//
+
+void SimplexNoise::evalBatch(const Imath::V3f *p, float *result, 
+                             const size_t n) const
+{
+  simplexBatch(m_noise, p, result, n);
+}
+
+//----------------------------------------------------------------------------//
+
+void SimplexNoise::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                const size_t n) const
+{
+  simplexVecBatch(m_noise, p, result, n);
+}
+
+//----------------------------------------------------------------------------//
+// AbsSimplexNoise
+//----------------------------------------------------------------------------//
+
+float AbsSimplexNoise::eval(const float x) const
+{
+  float result;
+  m_noise(result, x);
+  return std::abs(result);
+}
+
+//----------------------------------------------------------------------------//
+
+float AbsSimplexNoise::eval(const float x, const float y) const
+{
+  float result;
+  m_noise(result, x, y);
+  return std::abs(result);
+}
+
+//----------------------------------------------------------------------------//
+
+float AbsSimplexNoise::eval(const float x, const float y, const float z) const
+{
+  float result;
+  m_noise(result, Imath::V3f(x, y, z));
+  return std::abs(result);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f AbsSimplexNoise::evalVec(const float x) const
+{
+  Imath::V3f result;
+  m_noise(result, x);
+  return Math::abs(result);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f AbsSimplexNoise::evalVec(const float x, const float y) const
+{
+  Imath::V3f result;
+  m_noise(result, x, y);
+  return Math::abs(result);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f AbsSimplexNoise::evalVec(const float x, const float y, 
+                                    const float z) const
+{
+  Imath::V3f result;
+  m_noise(result, Imath::V3f(x, y, z));
+  return Math::abs(result);
+}
+
+//----------------------------------------------------------------------------//
+
+NoiseFunction::Range AbsSimplexNoise::range() const
+{
+  return std::make_pair(0.0f, 1.0f);
+}
+
+//----------------------------------------------------------------------------//
+
+void AbsSimplexNoise::evalBatch(const Imath::V3f *p, float *result, 
+                                const size_t n) const
+{
+  simplexBatch(m_noise, p, result, n);
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = std::abs(result[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void AbsSimplexNoise::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                                   const size_t n) const
+{
+  simplexVecBatch(m_noise, p, result, n);
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = Math::abs(result[i]);
+  }
+}
+
 //----------------------------------------------------------------------------//
 // Fractal
 //----------------------------------------------------------------------------//
@@ -227,6 +1021,51 @@ Imath::V3f Fractal::evalVec(const float x, const float y, const float z) const
   return evalVec(Imath::V3f(x, y, z)); 
 }
 
+//----------------------------------------------------------------------------//
+
+void Fractal::evalBatch(const Imath::V3f *p, float *result, 
+                        const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = eval(p[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Fractal::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                           const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = evalVec(p[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+float Fractal::eval(const Imath::V3f &p, const float /* filterWidth */) const
+{
+  return eval(p);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f Fractal::evalVec(const Imath::V3f &p, 
+                            const float /* filterWidth */) const
+{
+  return evalVec(p);
+}
+
+//----------------------------------------------------------------------------//
+
+void Fractal::evalBatch(const Imath::V3f *p, const float *filterWidths, 
+                        float *result, const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    result[i] = eval(p[i], filterWidths[i]);
+  }
+}
+
 //----------------------------------------------------------------------------//
 // fBm
 //----------------------------------------------------------------------------//
@@ -250,13 +1089,42 @@ fBm::Ptr fBm::create(NoiseFunction::CPtr noise, float scale, float octaves,
 //----------------------------------------------------------------------------//
 
 float fBm::eval(const Imath::V3f &p) const
+{
+  return evalOctaves(p, m_octaves);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f fBm::evalVec(const Imath::V3f &p) const
+{
+  return evalVecOctaves(p, m_octaves);
+}
+
+//----------------------------------------------------------------------------//
+
+float fBm::eval(const Imath::V3f &p, const float filterWidth) const
+{
+  return evalOctaves(p, filteredOctaves(m_octaves, m_scale, m_lacunarity,
+                                        filterWidth));
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f fBm::evalVec(const Imath::V3f &p, const float filterWidth) const
+{
+  return evalVecOctaves(p, filteredOctaves(m_octaves, m_scale, m_lacunarity,
+                                           filterWidth));
+}
+
+//----------------------------------------------------------------------------//
+
+float fBm::evalOctaves(const Imath::V3f &p, float octaves) const
 {
   // Scale the lookup point
   Imath::V3f noiseP(p / m_scale);
   // Initialize iteration variables
   float result = 0.0f;
   float octaveContribution = 1.0f;
-  float octaves = m_octaves;
   // Loop over octaves
   for (; octaves > 1.0f; octaves -= 1.0f) {
     // Add in noise function
@@ -275,14 +1143,13 @@ float fBm::eval(const Imath::V3f &p) const
 
 //----------------------------------------------------------------------------//
 
-Imath::V3f fBm::evalVec(const Imath::V3f &p) const
+Imath::V3f fBm::evalVecOctaves(const Imath::V3f &p, float octaves) const
 {
   // Scale the lookup point
   Imath::V3f noiseP(p / m_scale);
   // Initialize iteration variables
   Imath::V3f result(0.0f);
   float octaveContribution = 1.0f;
-  float octaves = m_octaves;
   // Loop over octaves
   for (; octaves > 1.0f; octaves -= 1.0f) {
     // Add in noise function
@@ -301,6 +1168,107 @@ Imath::V3f fBm::evalVec(const Imath::V3f &p) const
 
 //----------------------------------------------------------------------------//
 
+void fBm::evalBatch(const Imath::V3f *p, float *result, const size_t n) const
+{
+  Imath::V3f noiseP[k_fractalBatchSize];
+  float      noise[k_fractalBatchSize];
+  for (size_t first = 0; first < n; first += k_fractalBatchSize) {
+    const size_t count = std::min(n - first, k_fractalBatchSize);
+    // Scale the lookup points
+    for (size_t i = 0; i < count; ++i) {
+      noiseP[i] = p[first + i] / m_scale;
+      result[first + i] = 0.0f;
+    }
+    float octaveContribution = 1.0f;
+    float octaves = m_octaves;
+    // Loop over octaves, same as eval()
+    for (; octaves > 1.0f; octaves -= 1.0f) {
+      m_noise->evalBatch(noiseP, noise, count);
+      for (size_t i = 0; i < count; ++i) {
+        result[first + i] += noise[i] * octaveContribution;
+        noiseP[i] *= m_lacunarity;
+      }
+      octaveContribution *= m_octaveGain;
+    }
+    if (octaves > 0.0f) {
+      m_noise->evalBatch(noiseP, noise, count);
+      for (size_t i = 0; i < count; ++i) {
+        result[first + i] += noise[i] * octaveContribution * octaves;
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void fBm::evalVecBatch(const Imath::V3f *p, Imath::V3f *result, 
+                       const size_t n) const
+{
+  Imath::V3f noiseP[k_fractalBatchSize];
+  Imath::V3f noise[k_fractalBatchSize];
+  for (size_t first = 0; first < n; first += k_fractalBatchSize) {
+    const size_t count = std::min(n - first, k_fractalBatchSize);
+    // Scale the lookup points
+    for (size_t i = 0; i < count; ++i) {
+      noiseP[i] = p[first + i] / m_scale;
+      result[first + i] = Imath::V3f(0.0f);
+    }
+    float octaveContribution = 1.0f;
+    float octaves = m_octaves;
+    // Loop over octaves, same as evalVec()
+    for (; octaves > 1.0f; octaves -= 1.0f) {
+      m_noise->evalVecBatch(noiseP, noise, count);
+      for (size_t i = 0; i < count; ++i) {
+        result[first + i] += noise[i] * octaveContribution;
+        noiseP[i] *= m_lacunarity;
+      }
+      octaveContribution *= m_octaveGain;
+    }
+    if (octaves > 0.0f) {
+      m_noise->evalVecBatch(noiseP, noise, count);
+      for (size_t i = 0; i < count; ++i) {
+        result[first + i] += noise[i] * octaveContribution * octaves;
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void fBm::evalBatch(const Imath::V3f *p, const float *filterWidths, 
+                    float *result, const size_t n) const
+{
+  Imath::V3f noiseP[k_fractalBatchSize];
+  float      noise[k_fractalBatchSize];
+  float      octaves[k_fractalBatchSize];
+  for (size_t first = 0; first < n; first += k_fractalBatchSize) {
+    const size_t count = std::min(n - first, k_fractalBatchSize);
+    // Scale the lookup points and find the octaves each one resolves
+    float maxOctaves = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      noiseP[i] = p[first + i] / m_scale;
+      result[first + i] = 0.0f;
+      octaves[i] = filteredOctaves(m_octaves, m_scale, m_lacunarity, 
+                                   filterWidths[first + i]);
+      maxOctaves = std::max(maxOctaves, octaves[i]);
+    }
+    // Octave o is weighted by the point's octaves minus o, clamped to 
+    // [0,1], which is what eval() does with its partial last octave
+    float octaveContribution = 1.0f;
+    for (float o = 0.0f; o < maxOctaves; o += 1.0f) {
+      m_noise->evalBatch(noiseP, noise, count);
+      for (size_t i = 0; i < count; ++i) {
+        const float weight = Imath::clamp(octaves[i] - o, 0.0f, 1.0f);
+        result[first + i] += noise[i] * octaveContribution * weight;
+        noiseP[i] *= m_lacunarity;
+      }
+      octaveContribution *= m_octaveGain;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 Fractal::Range fBm::range() const
 {
   Range noiseRange = m_noise->range(), range = std::make_pair(0.0f, 0.0f);
@@ -319,6 +1287,254 @@ Fractal::Range fBm::range() const
   return range;
 }
 
+//----------------------------------------------------------------------------//
+// TiledfBm
+//----------------------------------------------------------------------------//
+
+struct TiledfBm::Tile
+{
+  //! Scalar noise values, x varying fastest
+  std::vector<half> scalar;
+  //! Vector noise values, interleaved xyz
+  std::vector<half> vec;
+};
+
+//----------------------------------------------------------------------------//
+
+const int TiledfBm::k_tileRes;
+const int TiledfBm::k_tilePeriod;
+
+//----------------------------------------------------------------------------//
+
+TiledfBm::TiledfBm(NoiseFunction::CPtr noise, float scale, float octaves, 
+                   float octaveGain, float lacunarity)
+  : m_scale(scale), m_octaves(octaves), m_octaveGain(octaveGain), 
+    m_lacunarity(lacunarity)
+{
+  bool absolute;
+  if (boost::dynamic_pointer_cast<const AbsPerlinNoise>(noise)) {
+    absolute = true;
+  } else if (boost::dynamic_pointer_cast<const PerlinNoise>(noise)) {
+    absolute = false;
+  } else {
+    throw UnsupportedNoiseException("TiledfBm requires PerlinNoise or "
+                                    "AbsPerlinNoise");
+  }
+  m_noiseRange = noise->range();
+  m_tile       = bakedTile(absolute);
+}
+
+//----------------------------------------------------------------------------//
+
+TiledfBm::Ptr TiledfBm::create(NoiseFunction::CPtr noise, float scale, 
+                               float octaves, float octaveGain, 
+                               float lacunarity)
+{ 
+  return Ptr(new TiledfBm(noise, scale, octaves, octaveGain, lacunarity)); 
+}
+
+//----------------------------------------------------------------------------//
+
+float TiledfBm::eval(const Imath::V3f &p) const
+{
+  return evalOctaves(p, m_octaves);
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f TiledfBm::evalVec(const Imath::V3f &p) const
+{
+  return evalVecOctaves(p, m_octaves);
+}
+
+//----------------------------------------------------------------------------//
+
+float TiledfBm::eval(const Imath::V3f &p, const float filterWidth) const
+{
+  return evalOctaves(p, filteredOctaves(m_octaves, m_scale, m_lacunarity,
+                                        filterWidth));
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f TiledfBm::evalVec(const Imath::V3f &p, 
+                             const float filterWidth) const
+{
+  return evalVecOctaves(p, filteredOctaves(m_octaves, m_scale, m_lacunarity,
+                                           filterWidth));
+}
+
+//----------------------------------------------------------------------------//
+
+float TiledfBm::evalOctaves(const Imath::V3f &p, float octaves) const
+{
+  const half *tile = &m_tile->scalar[0];
+  TileCoord   coord;
+  // Scale the lookup point
+  Imath::V3f noiseP(p / m_scale);
+  // Initialize iteration variables
+  float result = 0.0f;
+  float octaveContribution = 1.0f;
+  // Loop over octaves, same as fBm::eval()
+  for (; octaves > 1.0f; octaves -= 1.0f) {
+    tileCoord(noiseP, k_tileRes, k_tilePeriod, coord);
+    result += tileLookup(tile, 1, coord) * octaveContribution;
+    octaveContribution *= m_octaveGain;
+    noiseP *= m_lacunarity;
+  }
+  if (octaves > 0.0f) {
+    tileCoord(noiseP, k_tileRes, k_tilePeriod, coord);
+    result += tileLookup(tile, 1, coord) * octaveContribution * octaves;
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f TiledfBm::evalVecOctaves(const Imath::V3f &p, 
+                                     float octaves) const
+{
+  const half *tile = &m_tile->vec[0];
+  TileCoord   coord;
+  // Scale the lookup point
+  Imath::V3f noiseP(p / m_scale);
+  // Initialize iteration variables
+  Imath::V3f result(0.0f);
+  float octaveContribution = 1.0f;
+  // Loop over octaves, same as fBm::evalVec()
+  for (; octaves > 1.0f; octaves -= 1.0f) {
+    tileCoord(noiseP, k_tileRes, k_tilePeriod, coord);
+    for (int c = 0; c < 3; ++c) {
+      result[c] += tileLookup(tile + c, 3, coord) * octaveContribution;
+    }
+    octaveContribution *= m_octaveGain;
+    noiseP *= m_lacunarity;
+  }
+  if (octaves > 0.0f) {
+    tileCoord(noiseP, k_tileRes, k_tilePeriod, coord);
+    for (int c = 0; c < 3; ++c) {
+      result[c] += tileLookup(tile + c, 3, coord) * 
+        octaveContribution * octaves;
+    }
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Fractal::Range TiledfBm::range() const
+{
+  Range range = std::make_pair(0.0f, 0.0f);
+  float octaveContribution = 1.0f;
+  float octaves = m_octaves;
+  // Loop over octaves
+  for (; octaves > 1.0f; octaves -= 1.0f) {
+    range.first += m_noiseRange.first * octaveContribution;
+    range.second += m_noiseRange.second * octaveContribution;
+    octaveContribution *= m_octaveGain;
+  }
+  if (octaves > 0.0f) {
+    range.first += m_noiseRange.first * octaveContribution * octaves;
+    range.second += m_noiseRange.second * octaveContribution * octaves;
+  }
+  return range;
+}
+
+//----------------------------------------------------------------------------//
+
+TiledfBm::TileCPtr TiledfBm::bakedTile(const bool absolute)
+{
+  static TileCPtr s_tiles[2];
+
+  boost::mutex::scoped_lock lock(g_tileMutex);
+
+  TileCPtr &cached = s_tiles[absolute ? 1 : 0];
+  if (cached) {
+    return cached;
+  }
+
+  // Bake the periodic noise at each tile voxel. The trilinear lookup
+  // never produces values outside the range of the baked samples, so the
+  // noise function's range still holds.
+  boost::shared_ptr<Tile> tile(new Tile);
+  const size_t     numVoxels = k_tileRes * k_tileRes * k_tileRes;
+  const float      spacing   = static_cast<float>(k_tilePeriod) / k_tileRes;
+  const Imath::V3f period(k_tilePeriod);
+  PeriodicSNoise   noise;
+  tile->scalar.resize(numVoxels);
+  tile->vec.resize(numVoxels * 3);
+  size_t idx = 0;
+  for (int k = 0; k < k_tileRes; ++k) {
+    for (int j = 0; j < k_tileRes; ++j) {
+      for (int i = 0; i < k_tileRes; ++i, ++idx) {
+        const Imath::V3f p(i * spacing, j * spacing, k * spacing);
+        float      value;
+        Imath::V3f vecValue;
+        noise(value, p, period);
+        noise(vecValue, p, period);
+        if (absolute) {
+          value = std::abs(value);
+          vecValue = Math::abs(vecValue);
+        }
+        tile->scalar[idx]      = value;
+        tile->vec[idx * 3 + 0] = vecValue.x;
+        tile->vec[idx * 3 + 1] = vecValue.y;
+        tile->vec[idx * 3 + 2] = vecValue.z;
+      }
+    }
+  }
+
+  cached = tile;
+  return cached;
+}
+
+//----------------------------------------------------------------------------//
+// fBmCache
+//----------------------------------------------------------------------------//
+
+fBmCache::fBmCache()
+  : m_absNoise(false), m_tiled(false), m_simplex(false), m_scale(0.0f), 
+    m_octaves(0.0f), m_octaveGain(0.0f), m_lacunarity(0.0f)
+{
+  
+}
+
+//----------------------------------------------------------------------------//
+
+const Fractal::CPtr& fBmCache::get(const bool absNoise, const bool tiled, 
+                                   const bool simplex, const float scale, 
+                                   const float octaves, 
+                                   const float octaveGain, 
+                                   const float lacunarity)
+{
+  if (m_fractal && absNoise == m_absNoise && tiled == m_tiled && 
+      simplex == m_simplex && scale == m_scale && octaves == m_octaves && 
+      octaveGain == m_octaveGain && lacunarity == m_lacunarity) {
+    return m_fractal;
+  }
+
+  NoiseFunction::CPtr noise = absNoise ? g_absPerlinNoise : g_perlinNoise;
+  if (simplex && !tiled) {
+    noise = absNoise ? g_absSimplexNoise : g_simplexNoise;
+  }
+  if (tiled) {
+    m_fractal.reset(new TiledfBm(noise, scale, octaves, 
+                                 octaveGain, lacunarity));
+  } else {
+    m_fractal.reset(new fBm(noise, scale, octaves, octaveGain, lacunarity));
+  }
+
+  m_absNoise   = absNoise;
+  m_tiled      = tiled;
+  m_simplex    = simplex;
+  m_scale      = scale;
+  m_octaves    = octaves;
+  m_octaveGain = octaveGain;
+  m_lacunarity = lacunarity;
+
+  return m_fractal;
+}
+
 //----------------------------------------------------------------------------//
 // Utility functions
 //----------------------------------------------------------------------------//
@@ -0,0 +1,140 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file FrustumVoxelOccluder.cpp
+  Contains implementations of FrustumVoxelOccluder class and related 
+  functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Occluders/FrustumVoxelOccluder.h"
+
+// System includes
+
+#include <algorithm>
+#include <limits>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+
+// Project headers
+
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Trace.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Smallest near plane, relative to the far plane. Keeps the projection 
+  //! invertible when the light is inside the volume's bounds.
+  const double k_minNearFraction = 1.0e-3;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// FrustumVoxelOccluder
+//----------------------------------------------------------------------------//
+
+FrustumVoxelOccluder::FrustumVoxelOccluder(Renderer::CPtr renderer, 
+                                           PerspectiveCamera::CPtr camera,
+                                           const size_t fullRes)
+{
+  Sys::Trace::Scope trace("FrustumVoxelOccluder::build", "occluder");
+
+  Log::print("Building FrustumVoxelOccluder");
+
+  const size_t res = RenderGlobals::previewResolution(fullRes);
+
+  const PTime  time(0.0);
+  const Vector wsLightPos = camera->position(time);
+
+  // Fit the clip planes to the depth range of the volume's bounds
+  BBox   wsBounds = renderer->scene()->volume->wsBounds();
+  double near     = std::numeric_limits<double>::max(), far = 0.0;
+  BOOST_FOREACH (const Vector &wsP, Math::cornerPoints(wsBounds)) {
+    const Vector csP = camera->worldToCamera(wsP, time);
+    near = std::min(near, csP.z);
+    far  = std::max(far, csP.z);
+  }
+  if (far <= 0.0) {
+    // The buffer stays empty, so every point is unoccluded
+    Log::warning("FrustumVoxelOccluder: The volume is behind the light");
+    return;
+  }
+  near = std::max(near, far * k_minNearFraction);
+
+  PerspectiveCamera::Ptr cam = camera->clone();
+  cam->setClipPlanes(near, far);
+
+  // A single set of transforms, matching the static light position
+  FrustumFieldMapping::Ptr mapping(new FrustumFieldMapping);
+  mapping->setTransforms(cam->screenToWorldMatrices()[0], 
+                         cam->cameraToWorldMatrices()[0]);
+  setMapping(mapping);
+
+  // Voxels follow the camera's aspect ratio on screen
+  const Imath::V2i rasterRes = camera->resolution();
+  const double     aspect    = static_cast<double>(rasterRes.x) / rasterRes.y;
+  V3i bufferRes(res, res, res);
+  if (aspect >= 1.0) {
+    bufferRes.y = std::max(static_cast<int>(res / aspect), 1);
+  } else {
+    bufferRes.x = std::max(static_cast<int>(res * aspect), 1);
+  }
+
+  computeBuffer(renderer, wsLightPos, bufferRes, "FrustumVoxelOccluder");
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
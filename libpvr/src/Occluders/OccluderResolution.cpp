@@ -0,0 +1,297 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+//----------------------------------------------------------------------------//
+
+/*! \file OccluderResolution.cpp
+  Contains implementations of OccluderResolution class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Occluders/OccluderResolution.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+
+// Library includes
+
+#include <boost/format.hpp>
+
+// Project headers
+
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/Memory.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Volumes/VoxelVolume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Resolution used when the scene gives nothing to go by
+  const size_t k_defaultVoxelRes = 256;
+  //! Resolution limits of voxel occluder buffers, along the longest edge
+  const size_t k_minVoxelRes     = 16;
+  const size_t k_maxVoxelRes     = 1024;
+  //! Resolution limits of transmittance maps, along the longest edge
+  const int    k_minMapRes       = 16;
+  const int    k_maxMapRes       = 8192;
+  //! Bytes per voxel of the V3f voxel occluder buffers
+  const double k_bytesPerVoxel   = 12.0;
+  //! Bytes per transmittance map sample, including alignment
+  const double k_bytesPerKnot    = 12.0;
+
+  //--------------------------------------------------------------------------//
+
+  //! Formats a byte count in megabytes
+  std::string megabytes(const double bytes)
+  {
+    return (boost::format("%.1f MB") % (bytes / (1024.0 * 1024.0))).str();
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the smallest voxel size of the VoxelVolumes among volume and 
+  //! its inputs. Zero if there are none.
+  double minVoxelSize(pvr::Render::Volume::CPtr volume)
+  {
+    using namespace pvr::Render;
+
+    if (!volume) {
+      return 0.0;
+    }
+    double size = 0.0;
+    VoxelVolume::CPtr voxelVolume = 
+      boost::dynamic_pointer_cast<const VoxelVolume>(volume);
+    if (voxelVolume) {
+      size = pvr::Math::min(voxelVolume->wsVoxelSize());
+    }
+    const Volume::CVec inputs = volume->inputs();
+    for (size_t i = 0, numInputs = inputs.size(); i < numInputs; ++i) {
+      const double inputSize = minVoxelSize(inputs[i]);
+      if (inputSize > 0.0 && (size <= 0.0 || inputSize < size)) {
+        size = inputSize;
+      }
+    }
+    return size;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the width of the camera's center pixel at the given distance
+  double pixelWidth(pvr::Render::Camera::CPtr camera, const double distance)
+  {
+    using namespace pvr;
+    using namespace pvr::Render;
+
+    const Imath::V2i res  = camera->resolution();
+    const float      x    = 0.5f * res.x;
+    const float      y    = 0.5f * res.y;
+    const Ray        ray  = setupRay(camera, x, y, PTime(0.0));
+    return pixelFootprintWidth(camera, ray, x, y, PTime(0.0)) + 
+      pixelFootprintSpread(camera, ray, x, y, PTime(0.0)) * distance;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the bytes available for an occluder, in the given budget in 
+  //! megabytes and in the global budget
+  double availableBytes(const float memoryBudget)
+  {
+    const double available = 
+      static_cast<double>(pvr::Sys::Memory::available());
+    if (memoryBudget > 0.0f) {
+      return std::min(memoryBudget * 1024.0 * 1024.0, available);
+    }
+    return available;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// OccluderResolution
+//----------------------------------------------------------------------------//
+
+double OccluderResolution::detailSize(Renderer::CPtr renderer)
+{
+  const Scene::CPtr scene = renderer->scene();
+  if (!scene || !scene->volume) {
+    return 0.0;
+  }
+  const BBox wsBounds = scene->volume->wsBounds();
+  if (wsBounds.isEmpty()) {
+    return 0.0;
+  }
+
+  double size = minVoxelSize(scene->volume);
+  // Detail finer than the camera's pixels where they reach the volume 
+  // doesn't show
+  const Camera::CPtr camera = renderer->camera();
+  if (camera) {
+    const double distance = 
+      camera->rayDistance(wsBounds.center(), PTime(0.0));
+    size = std::max(size, pixelWidth(camera, distance));
+  }
+  return size;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t OccluderResolution::voxelOccluder(Renderer::CPtr renderer, 
+                                         const float memoryBudget,
+                                         const size_t maxRays)
+{
+  const Scene::CPtr scene = renderer->scene();
+  if (!scene || !scene->volume || scene->volume->wsBounds().isEmpty()) {
+    Log::warning("OccluderResolution found no volume. Using resolution " + 
+                 str(k_defaultVoxelRes));
+    return k_defaultVoxelRes;
+  }
+
+  const Vector wsSize  = scene->volume->wsBounds().size();
+  const double longest = Math::max(wsSize);
+  const double detail  = detailSize(renderer);
+
+  // Resolve the detail size along the longest edge ---
+
+  double res = detail > 0.0 ? longest / detail : k_defaultVoxelRes;
+  res = Imath::clamp(res, static_cast<double>(k_minVoxelRes), 
+                     static_cast<double>(k_maxVoxelRes));
+
+  // The buffer keeps the bounds' proportions, so its voxel count is a 
+  // fraction of res^3
+  const double fraction = wsSize.x * wsSize.y * wsSize.z / 
+    (longest * longest * longest);
+  const double budget   = availableBytes(memoryBudget);
+  const double bytes    = std::pow(res, 3.0) * fraction * k_bytesPerVoxel;
+  if (bytes > budget) {
+    res *= std::pow(budget / bytes, 1.0 / 3.0);
+  }
+  const double rays     = std::pow(res, 3.0) * fraction;
+  if (maxRays > 0 && rays > maxRays) {
+    res *= std::pow(maxRays / rays, 1.0 / 3.0);
+  }
+  const size_t result   = 
+    std::max(static_cast<size_t>(res), static_cast<size_t>(1));
+
+  // Report ---
+
+  const V3i    bufferRes = 
+    wsSize / longest * RenderGlobals::previewResolution(result);
+  const double voxels    = 
+    static_cast<double>(bufferRes.x) * bufferRes.y * bufferRes.z;
+  Log::print("OccluderResolution picked voxel occluder resolution " + 
+             str(result) + " for detail size " + str(detail));
+  Log::print("  Expected cost: " + str(bufferRes) + " voxels, " + 
+             megabytes(voxels * k_bytesPerVoxel) + ", " + str(voxels) + 
+             " shadow rays");
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V2i OccluderResolution::transmittanceMap(Renderer::CPtr renderer, 
+                                                Camera::CPtr lightCamera,
+                                                const size_t numSamples,
+                                                const float memoryBudget,
+                                                const size_t maxRays)
+{
+  const Imath::V2i baseRes = lightCamera->resolution();
+  const Scene::CPtr scene  = renderer->scene();
+  const double      detail = detailSize(renderer);
+  if (detail <= 0.0) {
+    Log::warning("OccluderResolution found no detail size. Using the "
+                 "light camera's resolution " + str(baseRes));
+    return baseRes;
+  }
+
+  // The light camera's pixels at the volume should match the detail size.
+  // Widths grow with the pixel angle, which is inversely proportional to 
+  // the resolution for narrow fields of view.
+  const double distance = 
+    lightCamera->rayDistance(scene->volume->wsBounds().center(), PTime(0.0));
+  double scale = pixelWidth(lightCamera, distance) / detail;
+
+  const double longest = std::max(baseRes.x, baseRes.y);
+  scale = Imath::clamp(scale, k_minMapRes / longest, k_maxMapRes / longest);
+
+  // Fit the memory budget and the ray limit. Both grow with the pixels.
+  const double pixels  = baseRes.x * baseRes.y * scale * scale;
+  const double bytes   = pixels * numSamples * k_bytesPerKnot;
+  const double budget  = availableBytes(memoryBudget);
+  if (bytes > budget) {
+    scale *= std::sqrt(budget / bytes);
+  }
+  const double raysPerPixel = 
+    static_cast<double>(renderer->numPixelSamples() * 
+                        renderer->numPixelSamples());
+  const double rays    = baseRes.x * baseRes.y * scale * scale * raysPerPixel;
+  if (maxRays > 0 && rays > maxRays) {
+    scale *= std::sqrt(maxRays / rays);
+  }
+  const Imath::V2i result(std::max(static_cast<int>(baseRes.x * scale), 1), 
+                          std::max(static_cast<int>(baseRes.y * scale), 1));
+
+  // Report ---
+
+  const double numPixels = static_cast<double>(result.x) * result.y;
+  Log::print("OccluderResolution picked transmittance map resolution " + 
+             str(result) + " for detail size " + str(detail));
+  Log::print("  Expected cost: up to " + 
+             megabytes(numPixels * numSamples * k_bytesPerKnot) + ", " + 
+             str(numPixels * raysPerPixel) + " camera rays");
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
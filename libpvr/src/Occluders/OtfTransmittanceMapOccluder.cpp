@@ -34,13 +34,19 @@
 
 // System includes
 
+#include <algorithm>
+#include <limits>
+
 // Library includes
 
-#include <OpenEXR/ImathRandom.h>
+#include <boost/bind.hpp>
 
 // Project headers
 
 #include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Stats.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -50,6 +56,18 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Width and height of the tiles that the map is filled in. A tile row
+  //! matches the packet size of the UniformRaymarcher.
+  const size_t k_tileSize = 8;
+
+  //--------------------------------------------------------------------------//
+
+  Imath::V2i numTiles(const Imath::V2i &res)
+  {
+    const int size = static_cast<int>(k_tileSize);
+    return Imath::V2i((res.x + size - 1) / size, (res.y + size - 1) / size);
+  }
+
   //--------------------------------------------------------------------------//
 
 } // local namespace
@@ -72,17 +90,18 @@ namespace Render {
 OtfTransmittanceMapOccluder::OtfTransmittanceMapOccluder(Renderer::CPtr renderer, 
                                                          Camera::CPtr camera,
                                                          const size_t numSamples)
-  : m_renderer(renderer), m_camera(camera)
+  : m_renderer(renderer), m_camera(RenderGlobals::previewCamera(camera)), 
+    m_numTiles(numTiles(m_camera->resolution())),
+    m_computed(m_numTiles.x * m_numTiles.y)
 { 
-  // Record resolution of camera
+  // Record resolution of camera. Preview renders use a smaller map.
   m_resolution = m_camera->resolution();
   m_floatRasterBounds = static_cast<Imath::V2f>(m_resolution);
   m_intRasterBounds = m_resolution - Imath::V2i(1);
   // Update transmittance map size and sample count
   m_transmittanceMap.setSize(m_resolution.x, m_resolution.y);
-  m_transmittanceMap.setNumSamples(numSamples);
-  // Reset the list of computed pixels
-  m_computed.resize(m_resolution.x * m_resolution.y, 0);
+  m_transmittanceMap.setNumSamples
+    (RenderGlobals::previewResolution(numSamples));
   // Check if space behind camera is valid
   m_clipBehindCamera = !camera->canTransformNegativeCamZ();
 }
@@ -97,8 +116,8 @@ Color OtfTransmittanceMapOccluder::sample(const OcclusionSampleState &state) con
   }
 
   // Transform to camera space for depth and raster space for pixel coordinate
-  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState.time);
-  Vector rsP = m_camera->worldToRaster(state.wsP, state.rayState.time);
+  Vector csP, rsP;
+  m_camera->worldToRasterAndCamera(state.wsP, state.rayState.time, rsP, csP);
   
   // Bounds checks
   if (m_clipBehindCamera && csP.z < 0.0) {
@@ -110,8 +129,7 @@ Color OtfTransmittanceMapOccluder::sample(const OcclusionSampleState &state) con
   }
 
   // Compute depth to sample at
-  Vector wsCamPosition = m_camera->position(state.rayState.time);
-  float depth = (state.wsP - wsCamPosition).length();
+  float depth = m_camera->rayDistance(state.wsP, state.rayState.time);
 
   // Ensure all samples are available
   updateCoordinate(rsP);
@@ -122,64 +140,173 @@ Color OtfTransmittanceMapOccluder::sample(const OcclusionSampleState &state) con
 
 //----------------------------------------------------------------------------//
 
+void OtfTransmittanceMapOccluder::bindAttributes() const
+{
+  m_renderer->bindAttributes();
+}
+
+//----------------------------------------------------------------------------//
+
 void
 OtfTransmittanceMapOccluder::updateCoordinate(const Vector &rsP) const
 {
-  size_t x = static_cast<size_t>(std::floor(rsP.x));
-  size_t y = static_cast<size_t>(std::floor(rsP.y));
-  for (unsigned int j = y; j < y + 2; j++) {
-    for (unsigned int i = x; i < x + 2; i++) {
-      unsigned int iC = Imath::clamp(i, 0u, static_cast<unsigned int>(m_intRasterBounds.x));
-      unsigned int jC = Imath::clamp(j, 0u, static_cast<unsigned int>(m_intRasterBounds.y));
-      if (!m_computed[offset(iC, jC)]) {
-        updatePixel(iC, jC);
+  // The pixels to interpolate between, clamped at the edges
+  const size_t x = static_cast<size_t>(std::floor(rsP.x));
+  const size_t y = static_cast<size_t>(std::floor(rsP.y));
+  const size_t maxX = static_cast<size_t>(m_intRasterBounds.x);
+  const size_t maxY = static_cast<size_t>(m_intRasterBounds.y);
+  const size_t tx[2] = { std::min(x, maxX) / k_tileSize, 
+                         std::min(x + 1, maxX) / k_tileSize };
+  const size_t ty[2] = { std::min(y, maxY) / k_tileSize, 
+                         std::min(y + 1, maxY) / k_tileSize };
+
+  // Tiles that this thread claims are computed here. Those that other 
+  // threads are computing are waited for.
+  Imath::V2i claimed[4], pending[4];
+  size_t     numClaimed = 0, numPending = 0;
+
+  for (size_t j = 0; j < 2; ++j) {
+    if (j == 1 && ty[1] == ty[0]) {
+      continue;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+      if (i == 1 && tx[1] == tx[0]) {
+        continue;
+      }
+      const Imath::V2i tile(tx[i], ty[j]);
+      const size_t     idx = tileOffset(tile.x, tile.y);
+      if (m_computed.isReady(idx)) {
+        Sys::Stats::add(Sys::Stats::OccluderCacheHits);
+      } else {
+        Sys::Stats::add(Sys::Stats::OccluderCacheMisses);
+        if (m_computed.claim(idx)) {
+          claimed[numClaimed++] = tile;
+        } else {
+          pending[numPending++] = tile;
+        }
+      }
+    }
+  }
+
+  for (size_t t = 0; t < numClaimed; ++t) {
+    const size_t idx = tileOffset(claimed[t].x, claimed[t].y);
+    try {
+      updateTile(claimed[t].x, claimed[t].y);
+    }
+    catch (...) {
+      for (size_t r = t; r < numClaimed; ++r) {
+        m_computed.release(tileOffset(claimed[r].x, claimed[r].y));
       }
+      throw;
     }
+    m_computed.finish(idx);
+  }
+
+  // Finishing the claimed tiles first means no thread waits for a tile
+  // while holding one that another thread waits for
+  for (size_t t = 0; t < numPending; ++t) {
+    m_computed.fill(tileOffset(pending[t].x, pending[t].y),
+                    boost::bind(&OtfTransmittanceMapOccluder::updateTile,
+                                this, pending[t].x, pending[t].y));
   }
 }
 
 //----------------------------------------------------------------------------//
 
+RayState
+OtfTransmittanceMapOccluder::pixelRay(const size_t x, const size_t y, 
+                                      const size_t sample, 
+                                      const size_t numRays) const
+{
+  // The renderer's sampler gives each pixel its own sampling pattern
+  const PixelSampler &sampler = *m_renderer->pixelSampler();
+  // Set up the ray with a sampled time
+  RayState state;
+  PTime ptime           (sampler.sample(x, y, sample, numRays, 
+                                        PixelSampler::Time));
+  state.wsRay         = setupRay(m_camera, Field3D::discToCont(x), 
+                                 Field3D::discToCont(y), ptime);
+  state.time          = ptime;
+  state.wsFootprint   = 
+    pixelFootprintWidth(m_camera, state.wsRay, Field3D::discToCont(x),
+                        Field3D::discToCont(y), ptime);
+  state.footprintSpread = 
+    pixelFootprintSpread(m_camera, state.wsRay, Field3D::discToCont(x),
+                         Field3D::discToCont(y), ptime);
+  state.rayType       = RayState::TransmittanceOnly;
+  state.rayDepth      = 1;
+  state.doOutputDeepT = true;
+  state.doOutputDeepL = false;
+  state.stepOffset    = sampler.sample(x, y, sample, numRays, 
+                                       PixelSampler::StepOffset);
+  return state;
+}
+
+//----------------------------------------------------------------------------//
+
 void
-OtfTransmittanceMapOccluder::updatePixel(const size_t x, const size_t y) const
+OtfTransmittanceMapOccluder::updateTile(const size_t tx, const size_t ty) const
 {
-  // Storage for transmittance functions
-  size_t numSamples = m_renderer->numPixelSamples();
-  std::vector<Util::ColorCurve::CPtr> tf;
-  tf.reserve(numSamples * numSamples);
-
-  // Ensure a unique sampling pattern for each pixel
-  Imath::Rand48 rng(x + y * m_resolution.x);
-
-  // Fire N^2 rays, to match the number of rays used in main render
-  for (size_t i = 0; i < numSamples * numSamples; ++i) {
-    // Set up the next ray with a random time sample
-    RayState state;
-    PTime ptime           ((i + rng.nextf()) / (numSamples * numSamples));
-    state.wsRay         = setupRay(m_camera, Field3D::discToCont(x), 
-                                   Field3D::discToCont(y), ptime);
-    state.time          = ptime;
-    state.rayType       = RayState::TransmittanceOnly;
-    state.rayDepth      = 1;
-    state.doOutputDeepT = true;
-    state.doOutputDeepL = false;
-    // Trace ray to find transmittance
-    IntegrationResult result = m_renderer->trace(state);
-    // Store transmittance function
-    if (result.transmittanceFunction) {
-      tf.push_back(result.transmittanceFunction);
-    }
-  }
+  const size_t height  = static_cast<size_t>(m_resolution.y);
+  const size_t numRows = std::min(k_tileSize, height - ty * k_tileSize);
+  // Called from a render thread, this runs the rows on that thread unless
+  // other pool threads are idle and pick them up
+  Util::ProgressReporter progress(std::numeric_limits<float>::max());
+  Sys::parallelFor(numRows, 1, 
+                   boost::bind(&OtfTransmittanceMapOccluder::updateTileRows,
+                               this, tx, ty, _1, _2),
+                   Sys::numThreads(), progress);
+}
 
-  // Update transmittance map
-  if (tf.size() > 0) {
-    m_transmittanceMap.setPixel(x, y, Util::ColorCurve::average(tf));
-  } else {
-    m_transmittanceMap.setPixel(x, y, Colors::one());
-  }
+//----------------------------------------------------------------------------//
 
-  // Mark pixel as computed
-  m_computed[offset(x, y)] = 1;
+void
+OtfTransmittanceMapOccluder::updateTileRows(const size_t tx, const size_t ty,
+                                            const size_t begin, 
+                                            const size_t end) const
+{
+  // Fire N^2 rays per pixel, to match the number of rays used in main render
+  const size_t numSamples = m_renderer->numPixelSamples();
+  const size_t numRays    = numSamples * numSamples;
+  const size_t x0         = tx * k_tileSize;
+  const size_t width      = std::min(k_tileSize, 
+                                     static_cast<size_t>(m_resolution.x) - x0);
+
+  // Storage for the transmittance functions of each pixel in a row
+  std::vector<std::vector<Util::ColorCurve::CPtr> > tf(width);
+  RayStateVec          states;
+  IntegrationResultVec results;
+  states.reserve(width);
+
+  for (size_t row = begin; row < end; ++row) {
+    const size_t y = ty * k_tileSize + row;
+    for (size_t p = 0; p < width; ++p) {
+      tf[p].clear();
+      tf[p].reserve(numRays);
+    }
+    // Trace the same sample of all pixels in the row together
+    for (size_t i = 0; i < numRays; ++i) {
+      states.clear();
+      for (size_t p = 0; p < width; ++p) {
+        states.push_back(pixelRay(x0 + p, y, i, numRays));
+      }
+      m_renderer->tracePacket(states, results);
+      // Store transmittance functions
+      for (size_t p = 0; p < width; ++p) {
+        if (results[p].transmittanceFunction) {
+          tf[p].push_back(results[p].transmittanceFunction);
+        }
+      }
+    }
+    // Update transmittance map
+    for (size_t p = 0; p < width; ++p) {
+      if (tf[p].size() > 0) {
+        m_transmittanceMap.setPixel(x0 + p, y, tf[p]);
+      } else {
+        m_transmittanceMap.setPixel(x0 + p, y, Colors::one());
+      }
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
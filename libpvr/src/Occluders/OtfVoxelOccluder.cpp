@@ -36,12 +36,15 @@
 
 // Library includes
 
+#include <boost/bind.hpp>
+
 // Project headers
 
 #include "pvr/Constants.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Stats.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -51,6 +54,33 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  using namespace pvr;
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  BBox wsBounds(Renderer::CPtr renderer)
+  {
+    return renderer->scene()->volume->wsBounds();
+  }
+
+  //--------------------------------------------------------------------------//
+
+  Imath::V3i bufferResolution(Renderer::CPtr renderer, const size_t res)
+  {
+    const BBox bounds = wsBounds(renderer);
+    return bounds.size() / Math::max(bounds.size()) * 
+      RenderGlobals::previewResolution(res);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  size_t numVoxels(Renderer::CPtr renderer, const size_t res)
+  {
+    const Imath::V3i bufferRes = bufferResolution(renderer, res);
+    return bufferRes.x * bufferRes.y * bufferRes.z;
+  }
+
   //--------------------------------------------------------------------------//
 
 } // local namespace
@@ -76,13 +106,16 @@ namespace Render {
 OtfVoxelOccluder::OtfVoxelOccluder(Renderer::CPtr renderer, 
                              const Vector &wsLightPos,
                              const size_t res)
-  : m_renderer(renderer), m_wsLightPos(wsLightPos)
+  : m_renderer(renderer), m_wsLightPos(wsLightPos), 
+    m_bufferMemory(Sys::Memory::OccluderBuffers),
+    m_computed(numVoxels(renderer, res))
 {
-  BBox wsBounds = renderer->scene()->volume->wsBounds();
-  V3i bufferRes = wsBounds.size() / Math::max(wsBounds.size()) * res;
-  m_buffer.setMapping(Math::makeMatrixMapping(wsBounds));
-  m_buffer.setSize(bufferRes);
-  m_buffer.clear(Color(-1.0));
+  Sys::Memory::checkBudget(numVoxels(renderer, res) * sizeof(V3f), 
+                           "OtfVoxelOccluder");
+  m_mapping = Math::makeMatrixMapping(wsBounds(renderer));
+  m_buffer.setMapping(m_mapping);
+  m_buffer.setSize(bufferResolution(renderer, res));
+  m_bufferMemory.track(m_buffer.memSize());
 }
 
 //----------------------------------------------------------------------------//
@@ -90,7 +123,7 @@ OtfVoxelOccluder::OtfVoxelOccluder(Renderer::CPtr renderer,
 Color OtfVoxelOccluder::sample(const OcclusionSampleState &state) const
 {
   Vector vsP;
-  m_buffer.mapping()->worldToVoxel(state.wsP, vsP);
+  m_mapping->worldToVoxel(state.wsP, vsP);
   
   if (!Math::isInBounds(vsP, m_buffer.dataWindow())) {
     return Colors::one();
@@ -100,33 +133,75 @@ Color OtfVoxelOccluder::sample(const OcclusionSampleState &state) const
   int y0 = static_cast<int>(std::floor(vsP.y));
   int z0 = static_cast<int>(std::floor(vsP.z));
 
+  // Voxels of the interpolation stencil that this thread claims are traced
+  // as one packet. Those that other threads are computing are waited for.
+  const Box3i &dataWindow = m_buffer.dataWindow();
+  V3i          claimed[8], pending[8];
+  size_t       numClaimed = 0, numPending = 0;
+
   for (int k = z0; k < z0 + 2; ++k) {
     for (int j = y0; j < y0 + 2; ++j) {
       for (int i = x0; i < x0 + 2; ++i) {
-        int ii = Imath::clamp(i, m_buffer.dataWindow().min.x, 
-                              m_buffer.dataWindow().max.x);
-        int jj = Imath::clamp(j, m_buffer.dataWindow().min.y, 
-                              m_buffer.dataWindow().max.y);
-        int kk = Imath::clamp(k, m_buffer.dataWindow().min.z, 
-                              m_buffer.dataWindow().max.z);
-        if (Math::max(m_buffer.fastValue(ii, jj, kk)) < 0.0) {
-          updateVoxel(ii, jj, kk);
+        const V3i voxel(Imath::clamp(i, dataWindow.min.x, dataWindow.max.x),
+                        Imath::clamp(j, dataWindow.min.y, dataWindow.max.y),
+                        Imath::clamp(k, dataWindow.min.z, dataWindow.max.z));
+        const size_t idx = offset(voxel.x, voxel.y, voxel.z);
+        if (m_computed.isReady(idx)) {
+          Sys::Stats::add(Sys::Stats::OccluderCacheHits);
+        } else {
+          Sys::Stats::add(Sys::Stats::OccluderCacheMisses);
+          if (m_computed.claim(idx)) {
+            claimed[numClaimed++] = voxel;
+          } else {
+            pending[numPending++] = voxel;
+          }
         }
       }
     }
   }
 
+  if (numClaimed > 0) {
+    try {
+      updateVoxels(claimed, numClaimed);
+    }
+    catch (...) {
+      for (size_t v = 0; v < numClaimed; ++v) {
+        m_computed.release(offset(claimed[v].x, claimed[v].y, claimed[v].z));
+      }
+      throw;
+    }
+    for (size_t v = 0; v < numClaimed; ++v) {
+      m_computed.finish(offset(claimed[v].x, claimed[v].y, claimed[v].z));
+    }
+  }
+
+  // Clamping at the edges repeats voxels, some of which this thread may
+  // have just finished
+  for (size_t v = 0; v < numPending; ++v) {
+    const V3i &voxel = pending[v];
+    m_computed.fill(offset(voxel.x, voxel.y, voxel.z),
+                    boost::bind(&OtfVoxelOccluder::updateVoxel, this, 
+                                voxel.x, voxel.y, voxel.z));
+  }
+
   return m_linearInterp.sample(m_buffer, vsP);
 }
 
 //----------------------------------------------------------------------------//
 
-void
-OtfVoxelOccluder::updateVoxel(const int i, const int j, const int k) const
+void OtfVoxelOccluder::bindAttributes() const
+{
+  m_renderer->bindAttributes();
+}
+
+//----------------------------------------------------------------------------//
+
+RayState OtfVoxelOccluder::shadowRay(const int i, const int j, 
+                                     const int k) const
 {
   // Transform point from voxel to world space
   Vector wsP;
-  m_buffer.mapping()->voxelToWorld(discToCont(V3i(i, j, k)), wsP);
+  m_mapping->voxelToWorld(discToCont(V3i(i, j, k)), wsP);
   // Set up the ray state
   RayState state;
   state.rayType = RayState::TransmittanceOnly;
@@ -134,13 +209,41 @@ OtfVoxelOccluder::updateVoxel(const int i, const int j, const int k) const
   state.wsRay.pos = wsP;
   state.wsRay.dir = (m_wsLightPos - wsP).normalized();
   state.tMax = (m_wsLightPos - wsP).length();
+  // The ray stands in for a whole voxel
+  state.setConvergingFootprint(Math::min(m_mapping->wsVoxelSize(i, j, k)));
+  return state;
+}
+
+//----------------------------------------------------------------------------//
+
+void
+OtfVoxelOccluder::updateVoxel(const int i, const int j, const int k) const
+{
   // Trace ray and record transmittance
-  IntegrationResult result = m_renderer->trace(state);
+  IntegrationResult result = m_renderer->trace(shadowRay(i, j, k));
   m_buffer.fastLValue(i, j, k) = result.transmittance;
 }
 
 //----------------------------------------------------------------------------//
 
+void OtfVoxelOccluder::updateVoxels(const V3i *voxels, 
+                                    const size_t numVoxels) const
+{
+  RayStateVec          states;
+  IntegrationResultVec results;
+  states.reserve(numVoxels);
+  for (size_t v = 0; v < numVoxels; ++v) {
+    states.push_back(shadowRay(voxels[v].x, voxels[v].y, voxels[v].z));
+  }
+  m_renderer->tracePacket(states, results);
+  for (size_t v = 0; v < numVoxels; ++v) {
+    m_buffer.fastLValue(voxels[v].x, voxels[v].y, voxels[v].z) = 
+      results[v].transmittance;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
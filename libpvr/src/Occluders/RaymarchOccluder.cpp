@@ -80,6 +80,13 @@ Color RaymarchOccluder::sample(const OcclusionSampleState &state) const
 
 //----------------------------------------------------------------------------//
 
+void RaymarchOccluder::bindAttributes() const
+{
+  m_renderer->bindAttributes();
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
@@ -0,0 +1,238 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseVoxelOccluder.cpp
+  Contains implementations of SparseVoxelOccluder class and related 
+  functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Occluders/SparseVoxelOccluder.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Strings.h"
+#include "pvr/Trace.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Blocks of 8^3 voxels follow the scene's sparsity more closely than 
+  //! Field3D's default of 16^3.
+  const int k_blockOrder = 3;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SparseVoxelOccluder
+//----------------------------------------------------------------------------//
+
+SparseVoxelOccluder::SparseVoxelOccluder(Renderer::CPtr renderer, 
+                                         const Vector &wsLightPos,
+                                         const size_t res)
+  : m_bufferMemory(Sys::Memory::OccluderBuffers)
+{
+  Sys::Trace::Scope trace("SparseVoxelOccluder::build", "occluder");
+
+  Log::print("Building SparseVoxelOccluder");
+
+  Volume::CPtr volume = renderer->scene()->volume;
+
+  BBox wsBounds       = volume->wsBounds();
+  Matrix localToWorld = Math::coordinateSystem(wsBounds);
+  MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping);
+  mapping->setLocalToWorld(localToWorld);
+  m_buffer.setMapping(mapping);
+  m_mapping = mapping;
+  m_buffer.setBlockOrder(k_blockOrder);
+
+  V3i bufferRes = wsBounds.size() / Math::max(wsBounds.size()) * 
+    RenderGlobals::previewResolution(res);
+  m_buffer.setSize(bufferRes);
+
+  Log::print("  Resolution: " + str(bufferRes));
+
+  // Find the blocks where the volume may scatter light. Each block's 
+  // bounds are padded by a voxel, since interpolation reads that far into
+  // the neighboring blocks.
+
+  const VolumeAttr scatteringAttr(Str::scattering);
+  const Box3i      dataWindow = m_buffer.dataWindow();
+  const V3i        blockRes   = m_buffer.blockRes();
+  const int        blockSize  = m_buffer.blockSize();
+
+  std::vector<V3i> blocks;
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        const V3i          min = dataWindow.min + V3i(bi, bj, bk) * blockSize;
+        const Imath::Box3d vsBlock(Vector(min) - Vector(1.0), 
+                                   Vector(min + V3i(blockSize)) + Vector(1.0));
+        BBox               wsBlock;
+        BOOST_FOREACH (const Vector &vsP, Math::cornerPoints(vsBlock)) {
+          Vector wsP;
+          mapping->voxelToWorld(vsP, wsP);
+          wsBlock.extendBy(wsP);
+        }
+        Color majorant;
+        if (!volume->boundsMajorant(wsBlock, scatteringAttr, majorant) ||
+            Math::max(majorant) > 0.0f) {
+          blocks.push_back(V3i(bi, bj, bk));
+        } else {
+          m_buffer.setBlockEmptyValue(bi, bj, bk, Colors::one());
+        }
+      }
+    }
+  }
+
+  const size_t blockVoxels = 
+    static_cast<size_t>(blockSize) * blockSize * blockSize;
+  Sys::Memory::checkBudget(blocks.size() * blockVoxels * sizeof(V3f), 
+                           "SparseVoxelOccluder");
+
+  Log::print("  Allocated blocks: " + str(blocks.size()) + " of " + 
+             str(blockRes.x * blockRes.y * blockRes.z));
+
+  // Each block is computed by a single thread
+  const size_t numThreads = 
+    std::min(Sys::numWorkerThreads(renderer->numThreads()), blocks.size());
+
+  Timer timer;
+  ProgressReporter progress(2.5f, "  ");
+
+  if (!blocks.empty()) {
+    Sys::JobState job(blocks.size());
+    Sys::runWorkers(numThreads, 
+                    boost::bind(&SparseVoxelOccluder::computeBlocks, this, 
+                                renderer, wsLightPos, boost::cref(blocks), 
+                                numThreads, boost::ref(job), _1),
+                    job, progress);
+  }
+
+  m_bufferMemory.track(m_buffer.memSize());
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseVoxelOccluder::computeBlocks(Renderer::CPtr renderer, 
+                                        const Vector &wsLightPos,
+                                        const std::vector<V3i> &blocks,
+                                        const size_t numThreads, 
+                                        Sys::JobState &job,
+                                        const size_t thread)
+{
+  RayState state;
+  state.rayType  = RayState::TransmittanceOnly;
+  state.rayDepth = 1;
+
+  const Box3i dataWindow = m_buffer.dataWindow();
+  const int   blockSize  = m_buffer.blockSize();
+  
+  for (size_t b = thread, size = blocks.size(); b < size; b += numThreads) {
+    const V3i min = dataWindow.min + blocks[b] * blockSize;
+    const V3i max(std::min(min.x + blockSize - 1, dataWindow.max.x), 
+                  std::min(min.y + blockSize - 1, dataWindow.max.y), 
+                  std::min(min.z + blockSize - 1, dataWindow.max.z));
+    for (int k = min.z; k <= max.z; ++k) {
+      for (int j = min.y; j <= max.y; ++j) {
+        for (int i = min.x; i <= max.x; ++i) {
+          Vector wsP;
+          m_buffer.mapping()->voxelToWorld(discToCont(V3i(i, j, k)), wsP);
+          state.wsRay.pos          = wsP;
+          state.wsRay.dir          = (wsLightPos - wsP).normalized();
+          state.tMax               = (wsLightPos - wsP).length();
+          // Each ray stands in for a whole voxel
+          state.setConvergingFootprint(
+            Math::min(m_buffer.mapping()->wsVoxelSize(i, j, k)));
+          IntegrationResult result = renderer->trace(state);
+          m_buffer.fastLValue(i, j, k) = result.transmittance;
+        }
+      }
+    }
+    // Report progress, and stop if the user terminated or another thread 
+    // failed
+    job.markDone(1);
+    if (job.aborted()) {
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color SparseVoxelOccluder::sample(const OcclusionSampleState &state) const
+{
+  Vector vsP;
+  m_mapping->worldToVoxel(state.wsP, vsP);
+  if (!Math::isInBounds(vsP, m_buffer.dataWindow())) {
+    return Colors::one();
+  }
+  Color val = m_linearInterp.sample(m_buffer, vsP);
+  return val;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,341 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SweepVoxelOccluder.cpp
+  Contains implementations of SweepVoxelOccluder class and related 
+  functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Occluders/SweepVoxelOccluder.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Library includes
+
+#include <boost/bind.hpp>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Trace.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of voxels in the box. Zero if it is empty.
+  size_t numVoxels(const Imath::Box3i &box)
+  {
+    if (box.isEmpty()) {
+      return 0;
+    }
+    const Imath::V3i size = box.size() + Imath::V3i(1);
+    return static_cast<size_t>(size.x) * size.y * size.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the voxels whose centers are less than distance voxels from 
+  //! vsP along every axis. Voxel i has its center at i + 0.5.
+  Imath::Box3i voxelsWithin(const pvr::Vector &vsP, const double distance)
+  {
+    Imath::Box3i box;
+    for (int dim = 0; dim < 3; ++dim) {
+      box.min[dim] = 
+        static_cast<int>(std::floor(vsP[dim] - distance - 0.5)) + 1;
+      box.max[dim] = 
+        static_cast<int>(std::ceil(vsP[dim] + distance - 0.5)) - 1;
+    }
+    return box;
+  }
+  
+  //--------------------------------------------------------------------------//
+
+  //! Intersection of two boxes. May be empty.
+  Imath::Box3i intersection(const Imath::Box3i &a, const Imath::Box3i &b)
+  {
+    Imath::Box3i box;
+    for (int dim = 0; dim < 3; ++dim) {
+      box.min[dim] = std::max(a.min[dim], b.min[dim]);
+      box.max[dim] = std::min(a.max[dim], b.max[dim]);
+    }
+    return box;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether the box contains the given voxel
+  bool contains(const Imath::Box3i &box, const int x, const int y, const int z)
+  {
+    return x >= box.min.x && x <= box.max.x &&
+      y >= box.min.y && y <= box.max.y &&
+      z >= box.min.z && z <= box.max.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SweepVoxelOccluder
+//----------------------------------------------------------------------------//
+
+SweepVoxelOccluder::SweepVoxelOccluder(Renderer::CPtr renderer, 
+                                       const Vector &wsLightPos,
+                                       const size_t res)
+{
+  Sys::Trace::Scope trace("SweepVoxelOccluder::build", "occluder");
+
+  Log::print("Building SweepVoxelOccluder");
+
+  const V3i bufferRes = 
+    setupUniformMapping(renderer->scene()->volume->wsBounds(), 
+                        RenderGlobals::previewResolution(res));
+  Sys::Memory::checkBudget(static_cast<size_t>(bufferRes.x) * bufferRes.y * 
+                           bufferRes.z * sizeof(V3f), "SweepVoxelOccluder");
+  m_buffer.setSize(bufferRes);
+  m_bufferMemory.track(m_buffer.memSize());
+
+  Log::print("  Resolution: " + str(bufferRes));
+
+  Vector vsLightPos;
+  m_buffer.mapping()->worldToVoxel(wsLightPos, vsLightPos);
+
+  // The farthest voxel lies within the shell of the farthest corner
+  const Box3i dataWindow = m_buffer.dataWindow();
+  double maxDistance = 0.0;
+  for (int dim = 0; dim < 3; ++dim) {
+    maxDistance = std::max(maxDistance, 
+      std::abs(dataWindow.min[dim] + 0.5 - vsLightPos[dim]));
+    maxDistance = std::max(maxDistance, 
+      std::abs(dataWindow.max[dim] + 0.5 - vsLightPos[dim]));
+  }
+  const int numShells = static_cast<int>(std::floor(maxDistance)) + 1;
+
+  const size_t maxThreads = Sys::numWorkerThreads(renderer->numThreads());
+  const size_t numTotal   = numVoxels(dataWindow);
+  size_t       numDone    = 0;
+
+  Timer timer;
+  ProgressReporter progress(2.5f, "  ");
+  // Shells are small and many, so progress is reported between shells 
+  // rather than by each runWorkers() call
+  ProgressReporter shellProgress(std::numeric_limits<float>::max());
+
+  // Each shell only depends on the ones before it, so the voxels of a 
+  // shell can be computed in parallel
+  for (int i = 0; i < numShells; ++i) {
+    const Shell  s         = shell(vsLightPos, i);
+    const size_t numShell  = numVoxels(s.outer) - numVoxels(s.inner);
+    if (numShell == 0) {
+      continue;
+    }
+    const size_t numThreads = 
+      std::min(maxThreads, static_cast<size_t>(s.outer.size().z + 1));
+    Sys::JobState job(numShell);
+    Sys::runWorkers(numThreads, 
+                    boost::bind(&SweepVoxelOccluder::sweepShell, this, 
+                                renderer, wsLightPos, vsLightPos, 
+                                boost::cref(s), numThreads, boost::ref(job),
+                                _1),
+                    job, shellProgress);
+    numDone += numShell;
+    progress.update(static_cast<float>(numDone) / numTotal);
+  }
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+SweepVoxelOccluder::Shell 
+SweepVoxelOccluder::shell(const Vector &vsLightPos, const int index) const
+{
+  const Box3i dataWindow = m_buffer.dataWindow();
+  Shell s;
+  s.outer = intersection(voxelsWithin(vsLightPos, index + 1), dataWindow);
+  s.inner = intersection(voxelsWithin(vsLightPos, index), dataWindow);
+  return s;
+}
+
+//----------------------------------------------------------------------------//
+
+void SweepVoxelOccluder::sweepShell(Renderer::CPtr renderer, 
+                                    const Vector &wsLightPos,
+                                    const Vector &vsLightPos,
+                                    const Shell &s,
+                                    const size_t numThreads, 
+                                    Sys::JobState &job,
+                                    const size_t thread)
+{
+  RayState state;
+  state.rayType  = RayState::TransmittanceOnly;
+  state.rayDepth = 1;
+
+  const Box3i &outer = s.outer, &inner = s.inner;
+
+  for (int z = outer.min.z + static_cast<int>(thread); z <= outer.max.z; 
+       z += static_cast<int>(numThreads)) {
+    size_t numSlice = 0;
+    for (int y = outer.min.y; y <= outer.max.y; ++y) {
+      // Rows crossing the inner box only have voxels on either side of it
+      const bool crossesInner = 
+        z >= inner.min.z && z <= inner.max.z && 
+        y >= inner.min.y && y <= inner.max.y && !inner.isEmpty();
+      for (int x = outer.min.x; x <= outer.max.x; ++x) {
+        if (crossesInner && x == inner.min.x) {
+          x = inner.max.x;
+          continue;
+        }
+        m_buffer.fastLValue(x, y, z) = 
+          sweepVoxel(renderer, state, wsLightPos, vsLightPos, inner, 
+                     x, y, z);
+        numSlice++;
+      }
+    }
+    // Report progress, and stop if the user terminated or another thread 
+    // failed
+    job.markDone(numSlice);
+    if (job.aborted()) {
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color SweepVoxelOccluder::sweepVoxel(Renderer::CPtr renderer, 
+                                     RayState &state,
+                                     const Vector &wsLightPos, 
+                                     const Vector &vsLightPos,
+                                     const Box3i &inner, 
+                                     const int x, const int y, 
+                                     const int z) const
+{
+  const V3i    idx(x, y, z);
+  const Vector vsP   = discToCont(idx);
+  const Vector vsDir = vsP - vsLightPos;
+
+  Vector wsP;
+  m_buffer.mapping()->voxelToWorld(vsP, wsP);
+  state.wsRay.pos = wsP;
+  state.wsRay.dir = (wsLightPos - wsP).normalized();
+
+  // The ray stands in for a whole voxel
+  const double wsWidth = Math::min(m_buffer.mapping()->wsVoxelSize(x, y, z));
+
+  // The axis along which the voxel is farthest from the light. Stepping 
+  // one voxel towards the light along it lands on the centers of the 
+  // neighboring layer, which belongs to an earlier shell.
+  int axis = 0;
+  for (int dim = 1; dim < 3; ++dim) {
+    if (std::abs(vsDir[dim]) > std::abs(vsDir[axis])) {
+      axis = dim;
+    }
+  }
+  const double distance = std::abs(vsDir[axis]);
+
+  if (distance > 1.0) {
+    const Vector vsUpstream = 
+      vsLightPos + vsDir * ((distance - 1.0) / distance);
+    const int    dim1       = (axis + 1) % 3, dim2 = (axis + 2) % 3;
+    const double f1         = vsUpstream[dim1] - 0.5;
+    const double f2         = vsUpstream[dim2] - 0.5;
+    const int    i1         = static_cast<int>(std::floor(f1));
+    const int    i2         = static_cast<int>(std::floor(f2));
+    const float  t1         = static_cast<float>(f1 - i1);
+    const float  t2         = static_cast<float>(f2 - i2);
+    
+    // Bilinear interpolation in the upstream layer, from neighbors of 
+    // earlier shells only
+    V3i   n = idx;
+    n[axis] += vsDir[axis] > 0.0 ? -1 : 1;
+    V3f   upstream(0.0f);
+    bool  valid = true;
+    for (int j = 0; j < 4 && valid; ++j) {
+      const int   o1 = j & 1, o2 = j >> 1;
+      const float w  = (o1 ? t1 : 1.0f - t1) * (o2 ? t2 : 1.0f - t2);
+      if (w <= 0.0f) {
+        continue;
+      }
+      n[dim1] = i1 + o1;
+      n[dim2] = i2 + o2;
+      if (!contains(inner, n.x, n.y, n.z)) {
+        valid = false;
+      } else {
+        upstream += m_buffer.fastValue(n.x, n.y, n.z) * w;
+      }
+    }
+
+    if (valid) {
+      Vector wsUpstream;
+      m_buffer.mapping()->voxelToWorld(vsUpstream, wsUpstream);
+      state.tMax            = (wsUpstream - wsP).length();
+      state.wsFootprint     = wsWidth;
+      state.footprintSpread = 0.0;
+      const Color segment = renderer->trace(state).transmittance;
+      return segment * Color(upstream);
+    }
+  }
+
+  // Trace the full ray to the light
+  state.tMax = (wsLightPos - wsP).length();
+  state.setConvergingFootprint(wsWidth);
+  return renderer->trace(state).transmittance;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
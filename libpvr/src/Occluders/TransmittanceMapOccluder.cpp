@@ -34,11 +34,20 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 // Library includes
 
+#include <boost/bind.hpp>
+
 // Project headers
 
 #include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Threading.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -48,6 +57,64 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Smallest pixel angle, to keep world space blurs finite
+  const float k_minPixelAngle = 1e-6f;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the angle between the rays of two neighboring pixels at the
+  //! center of a map of the given size.
+  float pixelAngle(const pvr::Render::Camera &camera, 
+                   const Imath::V2f &rasterBounds)
+  {
+    using namespace pvr;
+
+    const float x = 0.5f * rasterBounds.x;
+    const float y = 0.5f * rasterBounds.y;
+    const Ray   a = camera.rasterRay(x, y, PTime(0.0));
+    const Ray   b = camera.rasterRay(x + 1.0f, y, PTime(0.0));
+    const float angle = std::acos(Imath::clamp(a.dir.dot(b.dir), -1.0, 1.0));
+    return std::max(angle, k_minPixelAngle);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Averages each 2x2 block of pixels of source into a pixel of target, 
+  //! for the rows from begin up to end. The functions are averaged at 
+  //! common depths, spread over the depth range of all four, so that 
+  //! features at different depths don't blend into each other.
+  void downsampleRows(const pvr::Render::DeepImage &source, 
+                      pvr::Render::DeepImage &target,
+                      const size_t begin, const size_t end)
+  {
+    using namespace pvr;
+
+    const Imath::V2i sourceSize = source.size();
+    const Imath::V2i targetSize = target.size();
+
+    std::vector<Util::ColorCurve::CPtr> curves;
+
+    for (int y = begin; y < static_cast<int>(end); ++y) {
+      for (int x = 0; x < targetSize.x; ++x) {
+        curves.clear();
+        // Edge pixels of odd sized levels average fewer pixels
+        const int xEnd = std::min(2 * x + 2, sourceSize.x);
+        const int yEnd = std::min(2 * y + 2, sourceSize.y);
+        for (int sy = 2 * y; sy < yEnd; ++sy) {
+          for (int sx = 2 * x; sx < xEnd; ++sx) {
+            Util::ColorCurve::CPtr curve = source.pixelFunction(sx, sy);
+            if (curve->numSamples() > 0) {
+              curves.push_back(curve);
+            }
+          }
+        }
+        if (!curves.empty()) {
+          target.setPixel(x, y, curves);
+        }
+      }
+    }
+  }
+
   //--------------------------------------------------------------------------//
 
 } // local namespace
@@ -57,6 +124,7 @@ namespace {
 //----------------------------------------------------------------------------//
 
 using namespace std;
+using namespace pvr::Util;
 
 //----------------------------------------------------------------------------//
 
@@ -70,20 +138,44 @@ namespace Render {
 TransmittanceMapOccluder::TransmittanceMapOccluder(Renderer::CPtr baseRenderer, 
                                                    Camera::CPtr camera,
                                                    const size_t numSamples)
-  : m_camera(camera)
+  : m_camera(RenderGlobals::previewCamera(camera)), 
+    m_blur(0.0f), m_worldBlur(0.0f)
 { 
-  // Clone Renderer to create a mutable copy
-  Renderer::Ptr renderer = baseRenderer->clone();
+  // Create a view that shares the scene but has its own outputs. Preview
+  // renders use a smaller map, which m_camera projects into.
+  Renderer::Ptr renderer = baseRenderer->createView(m_camera);
   // Configure Renderer
-  renderer->setCamera(camera);
   renderer->setPrimaryEnabled(false);
   renderer->setTransmittanceMapEnabled(true);
-  renderer->setNumDeepSamples(numSamples);
-  // Execute render and grab transmittace map
+  renderer->setNumDeepSamples(RenderGlobals::previewResolution(numSamples));
+  // Execute render and grab transmittace map. The view keeps the base 
+  // renderer's thread count and tile size, so the map's tiles are rendered
+  // in parallel just like the beauty pass.
   renderer->execute();
   m_transmittanceMap = renderer->transmittanceMap();
   // Record the bounds of the transmittance map
   m_rasterBounds = static_cast<Imath::V2f>(m_transmittanceMap->size());
+  m_pixelAngle = pixelAngle(*m_camera, m_rasterBounds);
+  // Check if space behind camera is valid
+  m_clipBehindCamera = !camera->canTransformNegativeCamZ();
+}
+
+//----------------------------------------------------------------------------//
+
+TransmittanceMapOccluder::TransmittanceMapOccluder
+(DeepImage::CPtr transmittanceMap, Camera::CPtr camera)
+  : m_transmittanceMap(transmittanceMap), m_camera(camera), 
+    m_blur(0.0f), m_worldBlur(0.0f)
+{
+  if (!m_camera) {
+    throw MissingCameraException("");
+  }
+  if (!m_transmittanceMap) {
+    throw MissingTransmittanceMapException("");
+  }
+  // Record the bounds of the transmittance map
+  m_rasterBounds = static_cast<Imath::V2f>(m_transmittanceMap->size());
+  m_pixelAngle = pixelAngle(*m_camera, m_rasterBounds);
   // Check if space behind camera is valid
   m_clipBehindCamera = !camera->canTransformNegativeCamZ();
 }
@@ -91,6 +183,63 @@ TransmittanceMapOccluder::TransmittanceMapOccluder(Renderer::CPtr baseRenderer,
 //----------------------------------------------------------------------------//
 
 Color TransmittanceMapOccluder::sample(const OcclusionSampleState &state) const
+{
+  Vector rsP;
+  float  depth;
+  if (!project(state, rsP, depth)) {
+    return Colors::one();
+  }
+
+  // Blurred lookups blend the two levels that bracket the filter width
+  const float width = filterWidth(depth);
+  if (width > 1.0f && !m_levels.empty()) {
+    const float  level = std::min(std::log(width) / std::log(2.0f), 
+                                  static_cast<float>(m_levels.size()));
+    const size_t lower = static_cast<size_t>(level);
+    const float  t     = level - static_cast<float>(lower);
+    const Color  value = lerpLevel(lower, rsP, depth);
+    if (t == 0.0f) {
+      return value;
+    }
+    return Imath::lerp(value, lerpLevel(lower + 1, rsP, depth), t);
+  }
+
+  return lerpLevel(0, rsP, depth);
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+TransmittanceMapOccluder::sampleBatch(const OcclusionSampleStatePtrVec &states,
+                                      ColorVec &transmittances) const
+{
+  // Interleaved lookups don't search, so there's nothing to share. Blurred
+  // lookups move between levels, so they don't share either.
+  if (m_transmittanceMap && 
+      (m_transmittanceMap->isInterleaved() || !m_levels.empty())) {
+    Occluder::sampleBatch(states, transmittances);
+    return;
+  }
+
+  DeepImage::LerpCursor cursor;
+
+  transmittances.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    Vector rsP;
+    float  depth;
+    if (project(*states[i], rsP, depth)) {
+      transmittances[i] = m_transmittanceMap->lerp(rsP.x, rsP.y, depth, 
+                                                   cursor);
+    } else {
+      transmittances[i] = Colors::one();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool TransmittanceMapOccluder::project(const OcclusionSampleState &state,
+                                       Vector &rsP, float &depth) const
 {
   // Error checking
   if (!m_camera) {
@@ -101,28 +250,112 @@ Color TransmittanceMapOccluder::sample(const OcclusionSampleState &state) const
   }
 
   // Transform to camera space for depth and raster space for pixel coordinate
-  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState.time);
-  Vector rsP = m_camera->worldToRaster(state.wsP, state.rayState.time);
+  Vector csP;
+  m_camera->worldToRasterAndCamera(state.wsP, state.rayState.time, rsP, csP);
   
   // Bounds checks
   if (m_clipBehindCamera && csP.z < 0.0) {
-    return Colors::one();
+    return false;
   }
   if (rsP.x < 0.0 || rsP.x > m_rasterBounds.x ||
       rsP.y < 0.0 || rsP.y > m_rasterBounds.y) {
-    return Colors::one();
+    return false;
   }
   
   // Compute depth to sample at
-  float depth = (state.wsP - m_camera->position(state.rayState.time)).length();
+  depth = m_camera->rayDistance(state.wsP, state.rayState.time);
 
-  // Finally interpolate
-  return m_transmittanceMap->lerp(rsP.x, rsP.y, depth);
+  return true;
 }
 
 //----------------------------------------------------------------------------//
 
+void TransmittanceMapOccluder::setBlur(const float pixels)
+{
+  m_blur = std::max(pixels, 0.0f);
+  if (m_blur > 1.0f) {
+    buildPyramid();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void TransmittanceMapOccluder::setWorldBlur(const float width)
+{
+  m_worldBlur = std::max(width, 0.0f);
+  if (m_worldBlur > 0.0f) {
+    buildPyramid();
+  }
+}
+
+//----------------------------------------------------------------------------//
 
+float TransmittanceMapOccluder::filterWidth(const float depth) const
+{
+  float width = m_blur;
+  if (m_worldBlur > 0.0f) {
+    // A pixel spans depth * m_pixelAngle at the given depth
+    width += m_worldBlur / 
+      (std::max(depth, std::numeric_limits<float>::epsilon()) * m_pixelAngle);
+  }
+  return width;
+}
+
+//----------------------------------------------------------------------------//
+
+Color TransmittanceMapOccluder::lerpLevel(const size_t level, 
+                                          const Vector &rsP, 
+                                          const float depth) const
+{
+  if (level == 0) {
+    // Interleaved maps need no search along depth
+    if (m_transmittanceMap->isInterleaved()) {
+      return m_transmittanceMap->lerpInterleaved(rsP.x, rsP.y, depth);
+    }
+    return m_transmittanceMap->lerp(rsP.x, rsP.y, depth);
+  }
+  // Pixel i of a level covers pixels scale * i up to scale * (i + 1) of 
+  // the map, so its center lies half a pixel short of the far edge
+  const float scale  = static_cast<float>(1 << level);
+  const float offset = 0.5f * (scale - 1.0f);
+  const float x      = std::max((rsP.x - offset) / scale, 0.0f);
+  const float y      = std::max((rsP.y - offset) / scale, 0.0f);
+  return m_levels[level - 1]->lerp(x, y, depth);
+}
+
+//----------------------------------------------------------------------------//
+
+void TransmittanceMapOccluder::buildPyramid()
+{
+  if (!m_levels.empty()) {
+    return;
+  }
+
+  Util::Timer timer;
+  Util::ProgressReporter progress(std::numeric_limits<float>::max());
+
+  DeepImage::CPtr source = m_transmittanceMap;
+  Imath::V2i      size   = source->size();
+  while (size.x > 1 || size.y > 1) {
+    size = Imath::V2i((size.x + 1) / 2, (size.y + 1) / 2);
+    DeepImage::Ptr level = DeepImage::create();
+    level->setSize(size.x, size.y);
+    level->setNumSamples(source->numSamples());
+    level->setMaxError(source->maxError());
+    // Each thread only allocates the pixels of its own rows
+    Sys::parallelFor(size.y, 1, 
+                     boost::bind(&downsampleRows, boost::cref(*source), 
+                                 boost::ref(*level), _1, _2),
+                     Sys::numThreads(), progress);
+    level->compact();
+    m_levels.push_back(level);
+    source = level;
+  }
+
+  Log::print("Built " + str(m_levels.size()) + 
+             " prefiltered transmittance map levels in " + 
+             str(timer.elapsed()) + " s");
+}
 
 //----------------------------------------------------------------------------//
 
@@ -34,14 +34,22 @@
 
 // System includes
 
+#include <algorithm>
+#include <vector>
+
 // Library includes
 
+#include <boost/bind.hpp>
+
+#include <Field3D/Field3DFile.h>
+
 // Project headers
 
 #include "pvr/Constants.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Trace.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -51,6 +59,10 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Width and height, in voxels, of the tiles of a slice whose shadow rays
+  //! are traced as one packet
+  const int k_packetTileSize = 4;
+
   //--------------------------------------------------------------------------//
 
 } // local namespace
@@ -76,57 +88,305 @@ namespace Render {
 VoxelOccluder::VoxelOccluder(Renderer::CPtr renderer, 
                              const Vector &wsLightPos,
                              const size_t res)
+  : m_bufferMemory(Sys::Memory::OccluderBuffers), 
+    m_msStrength(0.0f), m_msBufferMemory(Sys::Memory::OccluderBuffers)
 {
+  Sys::Trace::Scope trace("VoxelOccluder::build", "occluder");
+
   Log::print("Building VoxelOccluder");
 
-  BBox wsBounds       = renderer->scene()->volume->wsBounds();
+  const V3i bufferRes = 
+    setupUniformMapping(renderer->scene()->volume->wsBounds(), 
+                        RenderGlobals::previewResolution(res));
+  computeBuffer(renderer, wsLightPos, bufferRes, "VoxelOccluder");
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelOccluder::write(const std::string &filename) const
+{
+  Log::print("Writing VoxelOccluder: " + filename);
+
+  DenseBuffer::Ptr buffer(new DenseBuffer(m_buffer));
+  buffer->name      = "voxel_occluder";
+  buffer->attribute = "transmittance";
+
+  Field3DOutputFile out;
+  if (!out.create(filename) || !out.writeVectorLayer<float>(buffer)) {
+    Log::warning("Couldn't write VoxelOccluder: " + filename);
+    return false;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+VoxelOccluder::Ptr VoxelOccluder::read(const std::string &filename)
+{
+  Log::print("Loading VoxelOccluder: " + filename);
+
+  Field3DInputFile in;
+  if (!in.open(filename)) {
+    Log::warning("Couldn't load " + filename);
+    return Ptr();
+  }
+
+  Field<V3f>::Vec fields = in.readVectorLayers<float>("voxel_occluder", 
+                                                      "transmittance");
+  DenseBuffer::Ptr buffer;
+  if (!fields.empty()) {
+    buffer = field_dynamic_cast<DenseBuffer>(fields[0]);
+  }
+  // Frustum mapped buffers are written by FrustumVoxelOccluder
+  if (!buffer || 
+      (!field_dynamic_cast<MatrixFieldMapping>(buffer->mapping()) &&
+       !field_dynamic_cast<FrustumFieldMapping>(buffer->mapping()))) {
+    Log::warning("No matrix or frustum mapped DenseField<V3f> transmittance "
+                 "buffer could be loaded from " + filename);
+    return Ptr();
+  }
+
+  Ptr occluder(new VoxelOccluder);
+  occluder->m_buffer = *buffer;
+  occluder->m_mapping = buffer->mapping();
+  occluder->m_bufferMemory.track(occluder->m_buffer.memSize());
+
+  Log::print("  Resolution: " + str(buffer->dataResolution()));
+
+  return occluder;
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelOccluder::computeMultipleScattering(const size_t iterations, 
+                                              const float strength)
+{
+  if (strength <= 0.0f || iterations == 0) {
+    m_msStrength = 0.0f;
+    m_msBuffer   = DenseBuffer();
+    m_msBufferMemory.release();
+    return;
+  }
+
+  Sys::Trace::Scope trace("VoxelOccluder::multipleScattering", "occluder");
+
+  Log::print("Computing VoxelOccluder multiple scattering");
+  Log::print("  Iterations: " + str(iterations));
+
+  const V3i bufferRes = m_buffer.dataResolution();
+  Sys::Memory::checkBudget(static_cast<size_t>(bufferRes.x) * bufferRes.y * 
+                           bufferRes.z * sizeof(V3f) * 2, 
+                           "VoxelOccluder multiple scattering");
+
+  // Blurring ping-pongs between the result and a scratch buffer, one axis
+  // per pass. Each pass reads neighboring slices of its source, so the 
+  // passes run one after the other.
+  m_msBuffer = m_buffer;
+  DenseBuffer scratch(m_buffer);
+  DenseBuffer *src = &m_msBuffer, *dst = &scratch;
+  m_msBufferMemory.track(m_msBuffer.memSize());
+
+  const size_t numThreads = 
+    std::min(Sys::numWorkerThreads(0), static_cast<size_t>(bufferRes.z));
+
+  Timer timer;
+  ProgressReporter progress(2.5f, "  ");
+
+  for (size_t pass = 0; pass < iterations * 3; ++pass) {
+    Sys::JobState job(bufferRes.z);
+    Sys::runWorkers(numThreads, 
+                    boost::bind(&VoxelOccluder::blurSlices, this, 
+                                boost::cref(*src), boost::ref(*dst), 
+                                static_cast<int>(pass % 3), numThreads, 
+                                boost::ref(job), _1),
+                    job, progress);
+    std::swap(src, dst);
+  }
+  if (src != &m_msBuffer) {
+    m_msBuffer = *src;
+  }
+
+  m_msStrength = strength;
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelOccluder::blurSlices(const DenseBuffer &src, DenseBuffer &dst,
+                               const int axis, const size_t numThreads, 
+                               Sys::JobState &job, const size_t thread) const
+{
+  const Box3i dataWindow = src.dataWindow();
+  const float weight     = 1.0f / 3.0f;
+
+  for (int z = dataWindow.min.z + static_cast<int>(thread); 
+       z <= dataWindow.max.z; z += static_cast<int>(numThreads)) {
+    for (int y = dataWindow.min.y; y <= dataWindow.max.y; ++y) {
+      for (int x = dataWindow.min.x; x <= dataWindow.max.x; ++x) {
+        // Neighbors outside the buffer are clamped to the edge voxel
+        V3i lo(x, y, z), hi(x, y, z);
+        lo[axis] = std::max(lo[axis] - 1, dataWindow.min[axis]);
+        hi[axis] = std::min(hi[axis] + 1, dataWindow.max[axis]);
+        dst.fastLValue(x, y, z) = 
+          (src.fastValue(lo.x, lo.y, lo.z) + src.fastValue(x, y, z) + 
+           src.fastValue(hi.x, hi.y, hi.z)) * weight;
+      }
+    }
+    job.markDone(1);
+    if (job.aborted()) {
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelOccluder::setMapping(Field3D::FieldMapping::Ptr mapping)
+{
+  m_buffer.setMapping(mapping);
+  m_mapping = mapping;
+}
+
+//----------------------------------------------------------------------------//
+
+V3i VoxelOccluder::setupUniformMapping(const BBox &wsBounds, const size_t res)
+{
   Matrix localToWorld = Math::coordinateSystem(wsBounds);
   MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping);
   mapping->setLocalToWorld(localToWorld);
-  m_buffer.setMapping(mapping);
+  setMapping(mapping);
+
+  return wsBounds.size() / Math::max(wsBounds.size()) * res;
+}
+
+//----------------------------------------------------------------------------//
 
-  V3i bufferRes = wsBounds.size() / Math::max(wsBounds.size()) * res;
+void VoxelOccluder::computeBuffer(Renderer::CPtr renderer, 
+                                  const Vector &wsLightPos,
+                                  const V3i &bufferRes, 
+                                  const std::string &name)
+{
+  Sys::Memory::checkBudget(static_cast<size_t>(bufferRes.x) * bufferRes.y * 
+                           bufferRes.z * sizeof(V3f), name);
   m_buffer.setSize(bufferRes);
+  m_bufferMemory.track(m_buffer.memSize());
 
   Log::print("  Resolution: " + str(bufferRes));
 
-  RayState state;
-  state.rayType  = RayState::TransmittanceOnly;
-  state.rayDepth = 1;
+  // Each z slice is computed by a single thread
+  const size_t numThreads = 
+    std::min(Sys::numWorkerThreads(renderer->numThreads()), 
+             static_cast<size_t>(bufferRes.z));
 
   Timer timer;
   ProgressReporter progress(2.5f, "  ");
 
-  size_t count = 0, numVoxels = bufferRes.x * bufferRes.y * bufferRes.z;
-  for (DenseBuffer::iterator i = m_buffer.begin(), end = m_buffer.end();
-       i != end; ++i, ++count) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(static_cast<float>(count) / numVoxels);
-    // Do work
-    Vector wsP;
-    m_buffer.mapping()->voxelToWorld(discToCont(V3i(i.x, i.y, i.z)), wsP);
-    state.wsRay.pos          = wsP;
-    state.wsRay.dir          = (wsLightPos - wsP).normalized();
-    state.tMax               = (wsLightPos - wsP).length();
-    IntegrationResult result = renderer->trace(state);
-    *i = result.transmittance;
-  }
+  Sys::JobState job(bufferRes.x * bufferRes.y * bufferRes.z);
+  Sys::runWorkers(numThreads, 
+                  boost::bind(&VoxelOccluder::computeSlices, this, renderer,
+                              wsLightPos, numThreads, boost::ref(job), _1),
+                  job, progress);
 
   Log::print("  Time elapsed: " + str(timer.elapsed()));
 }
 
 //----------------------------------------------------------------------------//
 
+void VoxelOccluder::computeSlices(Renderer::CPtr renderer, 
+                                  const Vector &wsLightPos,
+                                  const size_t numThreads, 
+                                  Sys::JobState &job,
+                                  const size_t thread)
+{
+  RayState state;
+  state.rayType  = RayState::TransmittanceOnly;
+  state.rayDepth = 1;
+
+  const Box3i dataWindow = m_buffer.dataWindow();
+
+  // Neighboring voxels send nearly parallel rays through the same parts 
+  // of the volume, so each tile of a slice is traced as one packet
+  RayStateVec          states;
+  IntegrationResultVec results;
+  std::vector<V3i>     voxels;
+  
+  for (int z = dataWindow.min.z + static_cast<int>(thread); 
+       z <= dataWindow.max.z; z += static_cast<int>(numThreads)) {
+    Box3i slice = dataWindow;
+    slice.min.z = slice.max.z = z;
+    for (int y0 = slice.min.y; y0 <= slice.max.y; y0 += k_packetTileSize) {
+      for (int x0 = slice.min.x; x0 <= slice.max.x; x0 += k_packetTileSize) {
+        const int y1 = std::min(y0 + k_packetTileSize - 1, slice.max.y);
+        const int x1 = std::min(x0 + k_packetTileSize - 1, slice.max.x);
+        states.clear();
+        voxels.clear();
+        for (int y = y0; y <= y1; ++y) {
+          for (int x = x0; x <= x1; ++x) {
+            Vector wsP;
+            m_mapping->voxelToWorld(discToCont(V3i(x, y, z)), wsP);
+            state.wsRay.pos = wsP;
+            state.wsRay.dir = (wsLightPos - wsP).normalized();
+            state.tMax      = (wsLightPos - wsP).length();
+            // Each ray stands in for a whole voxel
+            state.setConvergingFootprint(
+              Math::min(m_mapping->wsVoxelSize(x, y, z)));
+            states.push_back(state);
+            voxels.push_back(V3i(x, y, z));
+          }
+        }
+        renderer->tracePacket(states, results);
+        for (size_t v = 0, size = voxels.size(); v < size; ++v) {
+          m_buffer.fastLValue(voxels[v].x, voxels[v].y, voxels[v].z) = 
+            results[v].transmittance;
+        }
+      }
+    }
+    // Report progress, and stop if the user terminated or another thread 
+    // failed
+    job.markDone((slice.max.x - slice.min.x + 1) * 
+                 (slice.max.y - slice.min.y + 1));
+    if (job.aborted()) {
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+const DenseBuffer& VoxelOccluder::buffer() const
+{
+  return m_buffer;
+}
+
+//----------------------------------------------------------------------------//
+
+const DenseBuffer& VoxelOccluder::multipleScatteringBuffer() const
+{
+  return m_msBuffer;
+}
+
+//----------------------------------------------------------------------------//
+
+float VoxelOccluder::multipleScatteringStrength() const
+{
+  return m_msStrength;
+}
+
+//----------------------------------------------------------------------------//
+
 Color VoxelOccluder::sample(const OcclusionSampleState &state) const
 {
   Vector vsP;
-  m_buffer.mapping()->worldToVoxel(state.wsP, vsP);
+  m_mapping->worldToVoxel(state.wsP, vsP);
   if (!Math::isInBounds(vsP, m_buffer.dataWindow())) {
     return Colors::one();
   }
   Color val = m_linearInterp.sample(m_buffer, vsP);
+  if (m_msStrength > 0.0f) {
+    val += m_linearInterp.sample(m_msBuffer, vsP) * m_msStrength;
+  }
   return val;
 }
 
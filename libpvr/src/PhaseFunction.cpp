@@ -35,6 +35,9 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+#include <cmath>
+
 // Library includes
 
 // Project headers
@@ -42,6 +45,35 @@
 #include "pvr/Math.h"
 #include "pvr/Strings.h"
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+// Local constants
+//----------------------------------------------------------------------------//
+
+//! Eccentricities beyond this give peaks too narrow for the table, which 
+//! would then be off by more than about one percent
+const float k_maxTabulatedG = 0.85f;
+
+//----------------------------------------------------------------------------//
+// Local functions
+//----------------------------------------------------------------------------//
+
+//! Evaluates the Henyey-Greenstein phase function
+float henyeyGreenstein(const float g, const float cosTheta)
+{
+  return pvr::Render::Phase::k_isotropic * (1.0f - g * g) / 
+    std::pow(1.0f + g * g - 2.0f * g * cosTheta, 1.5f);
+}
+
+//----------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -50,6 +82,91 @@ namespace pvr {
 namespace Render {
 namespace Phase {
 
+//----------------------------------------------------------------------------//
+// CosineTable
+//----------------------------------------------------------------------------//
+
+float CosineTable::lookup(const float cosTheta) const
+{
+  const float x = (Imath::clamp(cosTheta, -1.0f, 1.0f) + 1.0f) * 
+    0.5f * Resolution;
+  const size_t idx = std::min(static_cast<size_t>(x), 
+                              static_cast<size_t>(Resolution - 1));
+  const float t = x - static_cast<float>(idx);
+  return m_values[idx] + (m_values[idx + 1] - m_values[idx]) * t;
+}
+
+//----------------------------------------------------------------------------//
+// Lobes
+//----------------------------------------------------------------------------//
+
+void Lobes::add(const PhaseFunction *function, const float weight)
+{
+  if (m_size < MaxLobes) {
+    m_functions[m_size] = function;
+    m_weights[m_size] = weight;
+    m_size++;
+    return;
+  }
+  // Replace the lightest lobe
+  size_t lightest = 0;
+  for (size_t i = 1; i < m_size; i++) {
+    if (m_weights[i] < m_weights[lightest]) {
+      lightest = i;
+    }
+  }
+  if (weight > m_weights[lightest]) {
+    m_functions[lightest] = function;
+    m_weights[lightest] = weight;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Lobes::add(const Lobes &lobes, const float weight)
+{
+  float sum = 0.0f;
+  for (size_t i = 0; i < lobes.m_size; i++) {
+    sum += lobes.m_weights[i];
+  }
+  if (sum <= 0.0f) {
+    return;
+  }
+  for (size_t i = 0; i < lobes.m_size; i++) {
+    add(lobes.m_functions[i], lobes.m_weights[i] * weight / sum);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+float Lobes::probability(const Vector &in, const Vector &out) const
+{
+  float p = 0.0;
+  float weight = 0.0;
+  for (size_t i = 0; i < m_size; i++) {
+    if (m_weights[i] > 0.0f) {
+      p += m_functions[i]->probability(in, out) * m_weights[i];
+      weight += m_weights[i];
+    }
+  }
+  if (weight <= 0.0f) {
+    return k_isotropic;
+  }
+  return p / weight;
+}
+
+//----------------------------------------------------------------------------//
+
+bool Lobes::isIsotropic() const
+{
+  for (size_t i = 0; i < m_size; i++) {
+    if (m_weights[i] > 0.0f && !m_functions[i]->isIsotropic()) {
+      return false;
+    }
+  }
+  return true;
+}
+
 //----------------------------------------------------------------------------//
 // Composite
 //----------------------------------------------------------------------------//
@@ -59,14 +176,32 @@ float Composite::probability(const Vector &in, const Vector &out) const
   float p = 0.0;
   float weight = 0.0;
   for (size_t i = 0, size = m_functions.size(); i < size; i++) {
-    p += m_functions[i]->probability(in, out) * m_weights[i];
-    weight += m_weights[i];
+    // Children that don't contribute at this sample have zero weight
+    if (m_weights[i] > 0.0f) {
+      p += m_functions[i]->probability(in, out) * m_weights[i];
+      weight += m_weights[i];
+    }
+  }
+  if (weight <= 0.0f) {
+    return k_isotropic;
   }
   return p / weight;
 }
 
 //----------------------------------------------------------------------------//
 
+bool Composite::isIsotropic() const
+{
+  for (size_t i = 0, size = m_functions.size(); i < size; i++) {
+    if (!m_functions[i]->isIsotropic()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
 void Composite::add(PhaseFunction::CPtr phaseFunction)
 {
   m_functions.push_back(phaseFunction);
@@ -97,7 +232,12 @@ float Isotropic::probability(const Vector &in, const Vector &out) const
 HenyeyGreenstein::HenyeyGreenstein(float g)
   : m_g(Imath::clamp(g, -1.0f, 1.0f))
 { 
-
+  if (std::abs(m_g) <= k_maxTabulatedG) {
+    m_table.allocate();
+    for (size_t i = 0; i <= CosineTable::Resolution; i++) {
+      m_table.setValue(i, henyeyGreenstein(m_g, CosineTable::cosTheta(i)));
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -105,8 +245,10 @@ HenyeyGreenstein::HenyeyGreenstein(float g)
 float HenyeyGreenstein::probability(const Vector &in, const Vector &out) const
 {
   const float cosTheta = in.dot(out);
-  return k_isotropic * (1.0f - m_g * m_g) / 
-    std::pow(1.0f + m_g * m_g - 2.0f * m_g * cosTheta, 1.5f);
+  if (!m_table.empty()) {
+    return m_table.lookup(cosTheta);
+  }
+  return henyeyGreenstein(m_g, cosTheta);
 }
 
 //----------------------------------------------------------------------------//
@@ -118,7 +260,15 @@ DoubleHenyeyGreenstein::DoubleHenyeyGreenstein(float g1, float g2, float blend)
     m_g2(Imath::clamp(g2, -1.0f, 1.0f)),
     m_blend(Imath::clamp(blend, 0.0f, 1.0f))
 { 
-
+  if (std::abs(m_g1) <= k_maxTabulatedG && std::abs(m_g2) <= k_maxTabulatedG) {
+    m_table.allocate();
+    for (size_t i = 0; i <= CosineTable::Resolution; i++) {
+      const float cosTheta = CosineTable::cosTheta(i);
+      m_table.setValue(i, Math::fit01(m_blend, 
+                                      henyeyGreenstein(m_g2, cosTheta),
+                                      henyeyGreenstein(m_g1, cosTheta)));
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -127,10 +277,11 @@ float DoubleHenyeyGreenstein::probability(const Vector &in,
                                           const Vector &out) const
 {
   const float cosTheta = in.dot(out);
-  float p1 = k_isotropic * (1.0f - m_g1 * m_g1) / 
-    std::pow(1.0f + m_g1 * m_g1 - 2.0f * m_g1 * cosTheta, 1.5f);
-  float p2 = k_isotropic * (1.0f - m_g2 * m_g2) / 
-    std::pow(1.0f + m_g2 * m_g2 - 2.0f * m_g2 * cosTheta, 1.5f);
+  if (!m_table.empty()) {
+    return m_table.lookup(cosTheta);
+  }
+  float p1 = henyeyGreenstein(m_g1, cosTheta);
+  float p2 = henyeyGreenstein(m_g2, cosTheta);
   return Math::fit01(m_blend, p2, p1);
 }
 
@@ -0,0 +1,260 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlueNoiseSampler.cpp
+  Contains implementations of BlueNoiseSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/PixelSamplers/BlueNoiseSampler.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Library includes
+
+#include <boost/thread/once.hpp>
+
+#include <OpenEXR/ImathRandom.h>
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Resolution of the blue noise mask
+  const size_t k_maskSize = 64;
+  //! Width of the void-and-cluster energy filter, in pixels
+  const float  k_sigma    = 1.5f;
+
+  //--------------------------------------------------------------------------//
+
+  //! \brief Builds a blue noise rank mask using Ulichney's void-and-cluster
+  //! method. The mask tiles seamlessly, since all distances wrap around.
+  class VoidAndCluster
+  {
+  public:
+    VoidAndCluster(const size_t size, const float sigma)
+      : m_size(size), m_kernel(size * size), m_energy(size * size, 0.0f),
+        m_bits(size * size, 0)
+    { 
+      for (size_t j = 0; j < size; ++j) {
+        for (size_t i = 0; i < size; ++i) {
+          const float dx = static_cast<float>(std::min(i, size - i));
+          const float dy = static_cast<float>(std::min(j, size - j));
+          m_kernel[i + j * size] = 
+            std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+      }
+    }
+    //! Returns the rank of each pixel, normalized to [0,1)
+    std::vector<float> generate()
+    {
+      const size_t numPixels  = m_size * m_size;
+      const size_t numInitial = numPixels / 10;
+      // Start from a random set of minority pixels
+      Imath::Rand48 rng(1);
+      size_t numOnes = 0;
+      while (numOnes < numInitial) {
+        const size_t i = static_cast<size_t>(rng.nexti()) % numPixels;
+        if (!m_bits[i]) {
+          set(i, true);
+          numOnes++;
+        }
+      }
+      // Move the tightest cluster into the largest void until that makes
+      // no difference. The cap guards against cycles.
+      for (size_t iter = 0; iter < numPixels; ++iter) {
+        const size_t cluster = tightestCluster();
+        set(cluster, false);
+        const size_t hole = largestVoid();
+        set(hole, true);
+        if (hole == cluster) {
+          break;
+        }
+      }
+      std::vector<size_t>  rank(numPixels, 0);
+      const std::vector<float> energy = m_energy;
+      const std::vector<char>  bits   = m_bits;
+      // Rank the initial pattern by removing its tightest clusters
+      for (size_t r = numOnes; r > 0; --r) {
+        const size_t cluster = tightestCluster();
+        set(cluster, false);
+        rank[cluster] = r - 1;
+      }
+      m_energy = energy;
+      m_bits   = bits;
+      // Rank the rest by filling the largest voids. Past the halfway 
+      // point the roles of the pixels swap, but the tightest cluster of 
+      // the remaining zeros is still the largest void, since the filter 
+      // sums to the same value everywhere.
+      for (size_t r = numOnes; r < numPixels; ++r) {
+        const size_t hole = largestVoid();
+        set(hole, true);
+        rank[hole] = r;
+      }
+      std::vector<float> mask(numPixels);
+      for (size_t i = 0; i < numPixels; ++i) {
+        mask[i] = (rank[i] + 0.5f) / numPixels;
+      }
+      return mask;
+    }
+  private:
+    //! Sets or clears a pixel and updates the energy of all pixels
+    void set(const size_t index, const bool value)
+    {
+      m_bits[index] = value;
+      const float  sign = value ? 1.0f : -1.0f;
+      const size_t x    = index % m_size;
+      const size_t y    = index / m_size;
+      for (size_t j = 0; j < m_size; ++j) {
+        const size_t dy = (j + m_size - y) % m_size;
+        for (size_t i = 0; i < m_size; ++i) {
+          const size_t dx = (i + m_size - x) % m_size;
+          m_energy[i + j * m_size] += sign * m_kernel[dx + dy * m_size];
+        }
+      }
+    }
+    //! Returns the set pixel with the highest energy
+    size_t tightestCluster() const
+    {
+      size_t best      = 0;
+      float  maxEnergy = -1.0f;
+      for (size_t i = 0, size = m_energy.size(); i < size; ++i) {
+        if (m_bits[i] && m_energy[i] > maxEnergy) {
+          maxEnergy = m_energy[i];
+          best      = i;
+        }
+      }
+      return best;
+    }
+    //! Returns the unset pixel with the lowest energy
+    size_t largestVoid() const
+    {
+      size_t best      = 0;
+      float  minEnergy = std::numeric_limits<float>::max();
+      for (size_t i = 0, size = m_energy.size(); i < size; ++i) {
+        if (!m_bits[i] && m_energy[i] < minEnergy) {
+          minEnergy = m_energy[i];
+          best      = i;
+        }
+      }
+      return best;
+    }
+    //! Resolution of the mask
+    size_t             m_size;
+    //! Filter weight by wrapped x/y distance
+    std::vector<float> m_kernel;
+    //! Filtered sum of the set pixels
+    std::vector<float> m_energy;
+    //! Current pattern
+    std::vector<char>  m_bits;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  std::vector<float> g_mask;
+  boost::once_flag   g_maskFlag = BOOST_ONCE_INIT;
+
+  //--------------------------------------------------------------------------//
+
+  void initMask()
+  {
+    g_mask = VoidAndCluster(k_maskSize, k_sigma).generate();
+  }
+
+  //--------------------------------------------------------------------------//
+
+}
+
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using boost::uint32_t;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// BlueNoiseSampler
+//----------------------------------------------------------------------------//
+
+float BlueNoiseSampler::sample(const size_t x, const size_t y, 
+                               const size_t index, 
+                               const size_t /* numSamples */,
+                               const size_t dimension) const
+{
+  // The sequence is the same in every pixel, so it is only scrambled per 
+  // dimension pair
+  const uint32_t pairSeed = hash(static_cast<uint32_t>(dimension / 2));
+  const float    value    = 
+    toUnit(owenScramble(sobol(static_cast<uint32_t>(index), dimension % 2),
+                        hash(pairSeed, dimension % 2 + 1)));
+  // Cranley-Patterson rotation by the mask value
+  const float    shifted  = value + maskValue(x, y, dimension);
+  return clampUnit(shifted < 1.0f ? shifted : shifted - 1.0f);
+}
+
+//----------------------------------------------------------------------------//
+
+float BlueNoiseSampler::maskValue(const size_t x, const size_t y, 
+                                  const size_t dimension)
+{
+  boost::call_once(initMask, g_maskFlag);
+  // Each dimension reads the mask at its own offset, so that dimensions 
+  // aren't correlated with each other
+  const uint32_t offset = hash(static_cast<uint32_t>(dimension) + 1);
+  const size_t   xMask  = (x + (offset % k_maskSize)) % k_maskSize;
+  const size_t   yMask  = (y + (offset / k_maskSize) % k_maskSize) % 
+                          k_maskSize;
+  return g_mask[xMask + yMask * k_maskSize];
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,193 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file PixelSampler.cpp
+  Contains implementations of PixelSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/PixelSamplers/PixelSampler.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using boost::uint32_t;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// PixelSampler
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::hash(uint32_t value)
+{
+  // Integer finalizer with low bias, from Chris Wellons' hash prospector
+  value ^= value >> 16;
+  value *= 0x7feb352du;
+  value ^= value >> 15;
+  value *= 0x846ca68bu;
+  value ^= value >> 16;
+  return value;
+}
+
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::hash(const uint32_t a, const uint32_t b)
+{
+  return hash(a ^ (hash(b) + 0x9e3779b9u + (a << 6) + (a >> 2)));
+}
+
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::seed(const size_t x, const size_t y, 
+                            const size_t dimension)
+{
+  return hash(hash(hash(static_cast<uint32_t>(x)), 
+                   static_cast<uint32_t>(y)), 
+              static_cast<uint32_t>(dimension));
+}
+
+//----------------------------------------------------------------------------//
+
+float PixelSampler::toUnit(const uint32_t value)
+{
+  // 24 bits fit exactly in a float's mantissa, so the result is never 1.0
+  return (value >> 8) * (1.0f / 16777216.0f);
+}
+
+//----------------------------------------------------------------------------//
+
+float PixelSampler::clampUnit(const float value)
+{
+  static const float k_oneMinusEpsilon = 1.0f - 1.0f / 16777216.0f;
+  return std::max(0.0f, std::min(value, k_oneMinusEpsilon));
+}
+
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::permute(uint32_t index, const uint32_t size, 
+                               const uint32_t seed)
+{
+  // From Kensler, "Correlated Multi-Jittered Sampling". The hash is a 
+  // bijection on the next power of two, and cycle walking discards the 
+  // values that fall outside of [0, size).
+  uint32_t mask = size - 1;
+  mask |= mask >> 1;
+  mask |= mask >> 2;
+  mask |= mask >> 4;
+  mask |= mask >> 8;
+  mask |= mask >> 16;
+  do {
+    index ^= seed;
+    index *= 0xe170893du;
+    index ^= seed >> 16;
+    index ^= (index & mask) >> 4;
+    index ^= seed >> 8;
+    index *= 0x0929eb3fu;
+    index ^= seed >> 23;
+    index ^= (index & mask) >> 1;
+    index *= 1 | seed >> 27;
+    index *= 0x6935fa69u;
+    index ^= (index & mask) >> 11;
+    index *= 0x74dcb303u;
+    index ^= (index & mask) >> 2;
+    index *= 0x9e501cc3u;
+    index ^= (index & mask) >> 2;
+    index *= 0xc860a3dfu;
+    index &= mask;
+    index ^= index >> 5;
+  } while (index >= size);
+  return (index + seed) % size;
+}
+
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::reverseBits(uint32_t value)
+{
+  value = (value << 16) | (value >> 16);
+  value = ((value & 0x00ff00ffu) << 8) | ((value & 0xff00ff00u) >> 8);
+  value = ((value & 0x0f0f0f0fu) << 4) | ((value & 0xf0f0f0f0u) >> 4);
+  value = ((value & 0x33333333u) << 2) | ((value & 0xccccccccu) >> 2);
+  value = ((value & 0x55555555u) << 1) | ((value & 0xaaaaaaaau) >> 1);
+  return value;
+}
+
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::owenScramble(const uint32_t value, 
+                                    const uint32_t seed)
+{
+  // From Burley, "Practical Hash-based Owen Scrambling". The hash only 
+  // lets each bit affect the bits above it, so applying it to the reversed
+  // value makes each bit depend only on the bits before it.
+  uint32_t x = reverseBits(value);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+//----------------------------------------------------------------------------//
+
+uint32_t PixelSampler::sobol(uint32_t index, const size_t dimension)
+{
+  // The first dimension is the van der Corput sequence
+  if (dimension == 0) {
+    return reverseBits(index);
+  }
+  // The second dimension's direction numbers come from the polynomial 
+  // x + 1, which gives v[i] = v[i - 1] ^ (v[i - 1] >> 1)
+  uint32_t result = 0;
+  for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+    if (index & 1) {
+      result ^= v;
+    }
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,76 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file SobolSampler.cpp
+  Contains implementations of SobolSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/PixelSamplers/SobolSampler.h"
+
+// System includes
+
+// Library includes
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using boost::uint32_t;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SobolSampler
+//----------------------------------------------------------------------------//
+
+float SobolSampler::sample(const size_t x, const size_t y, 
+                           const size_t index, const size_t /* numSamples */,
+                           const size_t dimension) const
+{
+  // Both dimensions of a pair share the shuffled index, so that they stay
+  // stratified together. Scrambling the index only reorders the points 
+  // within aligned power of two blocks, which keeps each prefix a net.
+  const uint32_t pairSeed = seed(x, y, dimension / 2);
+  const uint32_t shuffled = owenScramble(static_cast<uint32_t>(index), 
+                                         pairSeed);
+  return toUnit(owenScramble(sobol(shuffled, dimension % 2), 
+                             hash(pairSeed, dimension % 2 + 1)));
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,77 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file StratifiedSampler.cpp
+  Contains implementations of StratifiedSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/PixelSamplers/StratifiedSampler.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using boost::uint32_t;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// StratifiedSampler
+//----------------------------------------------------------------------------//
+
+float StratifiedSampler::sample(const size_t x, const size_t y, 
+                                const size_t index, const size_t numSamples,
+                                const size_t dimension) const
+{
+  const uint32_t n       = static_cast<uint32_t>(std::max(numSamples, 
+                                                          size_t(1)));
+  // Each pass of n samples covers the strata in a new order
+  const uint32_t pass    = static_cast<uint32_t>(index / n);
+  const uint32_t s       = hash(seed(x, y, dimension), pass);
+  const uint32_t stratum = permute(static_cast<uint32_t>(index % n), n, s);
+  return clampUnit((stratum + toUnit(hash(s, stratum))) / n);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
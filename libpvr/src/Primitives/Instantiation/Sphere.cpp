@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <OpenEXR/ImathRandom.h>
@@ -48,8 +50,6 @@
 #include "pvr/ModelingUtils.h"
 #include "pvr/RenderGlobals.h"
 
-#include "pvr/Primitives/Rasterization/Point.h"
-
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -74,162 +74,158 @@ namespace Inst {
 // Sphere
 //----------------------------------------------------------------------------//
 
-ModelerInput::Ptr Sphere::execute(const Geo::Geometry::CPtr geo) const
+size_t Sphere::numInputs(const Geo::Geometry::CPtr geo) const
 {
-  assert(geo != NULL);
-  assert(geo->particles() != NULL);
-
   if (!geo->particles()) {
     Log::warning("Instantiation primitive has no particles. "
                  "Skipping execution.");
-    return ModelerInput::Ptr();
+    return 0;
   }
 
-  // Set up output geometry ---
-
-  size_t numPoints                 = numOutputPoints(geo);
-
-  Geometry::Ptr          outGeo    = Geometry::create();
-  Particles::Ptr         particles = Particles::create();
-  ModelerInput::Ptr      result    = ModelerInput::create();
-  Prim::Rast::Point::Ptr pointPrim = Prim::Rast::Point::create();
-  
-  particles->add(numPoints);
-  outGeo->setParticles(particles);
-  result->setGeometry(outGeo);
-  result->setVolumePrimitive(pointPrim);
-
-  AttrTable &points  = particles->pointAttrs();
-  AttrRef    wsV     = points.addVectorAttr("v", Vector(0.0));
-  AttrRef    radius  = points.addFloatAttr("radius", 1, vector<float>(1, 1.0));
-  AttrRef    density = points.addVectorAttr("density", Vector(1.0));
-
-  // Loop over input points ---
-
-  size_t idx = 0;
-  ProgressReporter progress(2.5f, "  ");
-  AttrVisitor visitor(geo->particles()->pointAttrs(), m_params);
-
-  Log::print("Sphere processing " + str(geo->particles()->size()) +
-             " input points");
-  Log::print("  Output: " + str(numPoints) + " points");
-
-  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Update attributes
-    m_attrs.update(i);
-    // Seed random number generator
-    Imath::Rand48 rng(m_attrs.seed);
-    // Noise offset by seed
-    Vector nsOffset;
-    nsOffset.x = rng.nextf(-100, 100);
-    nsOffset.y = rng.nextf(-100, 100);
-    nsOffset.z = rng.nextf(-100, 100);
-    // For each instance
-    for (int i = 0; i < m_attrs.numPoints; ++i, ++idx) {
-      // Check if user terminated
-      Sys::Interrupt::throwOnAbort();
-      // Print progress
-      progress.update(static_cast<float>(idx) / numPoints);
-      // Randomize local space position
-      Vector lsP(0.0);
-      if (m_attrs.doFill) {
-        lsP = solidSphereRand<V3f>(rng);
-      } else {
-        lsP = hollowSphereRand<V3f>(rng);
-      }
-      // Define noise space
-      V3f nsP = lsP;
-      nsP += nsOffset;
-      // Set instance position
-      V3f instanceWsP = m_attrs.wsCenter;
-      instanceWsP += lsP * m_attrs.radius;
-      // Apply displacement noise
-      //! \todo Should this multiply by radius instead?
-      if (m_attrs.doDispNoise) {
-        V3f noise = m_attrs.dispFractal->evalVec(nsP);
-        instanceWsP += noise * (m_attrs.dispAmplitude / m_attrs.radius);
-      }
-      // Set instance density  
-      V3f instanceDensity = m_attrs.density;
-      // Apply density noise
-      if (m_attrs.doDensNoise) {
-        float noise = m_attrs.densFractal->eval(nsP);
-        instanceDensity *= noise;
-      }
-      // Set instance attributes
-      particles->setPosition(idx, instanceWsP);
-      points.setVectorAttr(wsV, idx, m_attrs.wsVelocity.value());
-      points.setVectorAttr(density, idx, instanceDensity);
-      points.setFloatAttr(radius, idx, 0, m_attrs.instanceRadius);
-    }
-  }
+  return geo->particles()->size();
+}
+
+//----------------------------------------------------------------------------//
 
-  return result;
+InstancingContext::Ptr 
+Sphere::createContext(const Geo::Geometry::CPtr geo) const
+{
+  return InstancingContext::Ptr(new Context(geo->particles()->pointAttrs(),
+                                            m_params));
 }
 
 //----------------------------------------------------------------------------//
 
-BBox Sphere::wsBounds(Geo::Geometry::CPtr geometry) const
+size_t Sphere::updateInput(const size_t input, 
+                           InstancingContext &iContext) const
 {
-  assert(geometry != NULL);
-  assert(geometry->particles() != NULL);
+  Context &context = static_cast<Context &>(iContext);
 
-  if (!geometry->particles()) {
-    Log::warning("Instantiation primitive has no particles. "
-                 "Skipping bounds generation.");
-    return BBox();
-  }
+  context.attrs.update(context.visitor.begin(input));
+  return std::max(context.attrs.numPoints.value(), 0);
+}
 
-  BBox wsBBox;
-  AttrVisitor visitor(geometry->particles()->pointAttrs(), m_params);
-
-  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i) {
-    // Update point attrs
-    m_attrs.update(i);
-    // Pad to account for radius, motion and displacement fractal
-    Vector wsStart = m_attrs.wsCenter.value();
-    Vector wsEnd = m_attrs.wsCenter.value() + 
-      m_attrs.wsVelocity.value() * RenderGlobals::dt();
-    Vector pad = m_attrs.radius.as<Vector>();
-    if (m_attrs.doDispNoise) {
-      Noise::Fractal::Range range = m_attrs.dispFractal->range();
-      double maxDispl = m_attrs.dispAmplitude * 
-        std::max(std::abs(range.first), std::abs(range.second));
-      pad += Vector(maxDispl);
+//----------------------------------------------------------------------------//
+
+void Sphere::instanceInput(InstancingContext &iContext, 
+                           InstancePoint *points) const
+{
+  const AttrState &attrs = static_cast<Context &>(iContext).attrs;
+
+  // Seed random number generator
+  Imath::Rand48 rng(attrs.seed);
+  // Noise offset by seed
+  Vector nsOffset;
+  nsOffset.x = rng.nextf(-100, 100);
+  nsOffset.y = rng.nextf(-100, 100);
+  nsOffset.z = rng.nextf(-100, 100);
+  // Randomize the local space position of each instance. The noise is
+  // then evaluated for all instances of the point at once.
+  const size_t numInstances = std::max(attrs.numPoints.value(), 0);
+  vector<Vector> lsPs(numInstances);
+  vector<V3f>    nsPs(numInstances);
+  for (size_t i = 0; i < numInstances; ++i) {
+    // Randomize local space position
+    if (attrs.doFill) {
+      lsPs[i] = solidSphereRand<V3f>(rng);
+    } else {
+      lsPs[i] = hollowSphereRand<V3f>(rng);
     }
-    wsBBox.extendBy(wsStart + pad);
-    wsBBox.extendBy(wsStart - pad);
-    wsBBox.extendBy(wsEnd + pad);
-    wsBBox.extendBy(wsEnd - pad);
+    // Define noise space
+    V3f nsP = lsPs[i];
+    nsP += nsOffset;
+    nsPs[i] = nsP;
+  }
+  vector<V3f>   dispNoise;
+  vector<float> densNoise;
+  if (attrs.doDispNoise && numInstances > 0) {
+    dispNoise.resize(numInstances);
+    attrs.dispFractal->evalVecBatch(&nsPs[0], &dispNoise[0], numInstances);
+  }
+  if (attrs.doDensNoise && numInstances > 0) {
+    densNoise.resize(numInstances);
+    attrs.densFractal->evalBatch(&nsPs[0], &densNoise[0], numInstances);
+  }
+  // For each instance
+  for (size_t i = 0; i < numInstances; ++i) {
+    InstancePoint &point = points[i];
+    // Set instance position
+    point.wsP = attrs.wsCenter;
+    point.wsP += lsPs[i] * attrs.radius;
+    // Apply displacement noise
+    //! \todo Should this multiply by radius instead?
+    if (attrs.doDispNoise) {
+      point.wsP += dispNoise[i] * (attrs.dispAmplitude / attrs.radius);
+    }
+    // Set instance density  
+    point.density = attrs.density;
+    // Apply density noise
+    if (attrs.doDensNoise) {
+      point.density *= densNoise[i];
+    }
+    // Set remaining attributes
+    point.wsV    = attrs.wsVelocity;
+    point.radius = attrs.instanceRadius;
   }
-
-  return wsBBox;
 }
 
 //----------------------------------------------------------------------------//
 
-size_t Sphere::numOutputPoints(const Geo::Geometry::CPtr geo) const
+BBox Sphere::inputWsBounds(const InstancingContext &iContext) const
 {
-  size_t count = 0;
-  AttrVisitor visitor(geo->particles()->pointAttrs(), m_params);
-
-  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i) {
-    m_attrs.update(i);
-    count += m_attrs.numPoints.value();
+  const AttrState &attrs = static_cast<const Context &>(iContext).attrs;
+
+  // Pad to account for radius, motion and displacement fractal
+  Vector wsStart = attrs.wsCenter.value();
+  Vector wsEnd = attrs.wsCenter.value() + 
+    attrs.wsVelocity.value() * RenderGlobals::dt();
+  Vector pad = attrs.radius.as<Vector>();
+  if (attrs.doDispNoise) {
+    Noise::Fractal::Range range = attrs.dispFractal->range();
+    double maxDispl = attrs.dispAmplitude * 
+      std::max(std::abs(range.first), std::abs(range.second));
+    pad += Vector(maxDispl);
   }
-  
-  return count;
+
+  BBox wsBBox;
+  wsBBox.extendBy(wsStart + pad);
+  wsBBox.extendBy(wsStart - pad);
+  wsBBox.extendBy(wsEnd + pad);
+  wsBBox.extendBy(wsEnd - pad);
+  return wsBBox;
 }
 
 //----------------------------------------------------------------------------//
 // Point::AttrState
 //----------------------------------------------------------------------------//
 
+void Sphere::AttrState::bind(const Geo::AttrVisitor &visitor)
+{
+  visitor.bind(wsCenter);
+  visitor.bind(wsVelocity);
+  visitor.bind(instanceRadius);
+  visitor.bind(radius);
+  visitor.bind(density);
+  visitor.bind(numPoints);
+  visitor.bind(doFill);
+  visitor.bind(seed);
+  visitor.bind(densScale);
+  visitor.bind(densOctaves);
+  visitor.bind(densOctaveGain);
+  visitor.bind(densLacunarity);
+  visitor.bind(dispScale);
+  visitor.bind(dispOctaves);
+  visitor.bind(dispOctaveGain);
+  visitor.bind(dispLacunarity);
+  visitor.bind(dispAmplitude);
+  visitor.bind(doDensNoise);
+  visitor.bind(doDispNoise);
+  visitor.bind(tiledNoise);
+  visitor.bind(simplexNoise);
+}
+
+//----------------------------------------------------------------------------//
+
 void Sphere::AttrState::update
 (const Geo::AttrVisitor::const_iterator &i)
 {
@@ -252,13 +248,15 @@ void Sphere::AttrState::update
   i.update(dispAmplitude);
   i.update(doDensNoise);
   i.update(doDispNoise);
+  i.update(tiledNoise);
+  i.update(simplexNoise);
   // Set up fractals
-  NoiseFunction::CPtr densNoise = NoiseFunction::CPtr(new PerlinNoise);
-  densFractal = Fractal::CPtr(new fBm(densNoise, densScale, densOctaves, 
-                                      densOctaveGain, densLacunarity));
-  NoiseFunction::CPtr dispNoise = NoiseFunction::CPtr(new PerlinNoise);
-  dispFractal = Fractal::CPtr(new fBm(dispNoise, dispScale, dispOctaves, 
-                                      dispOctaveGain, dispLacunarity));
+  densFractal = densFractalCache.get(false, tiledNoise, simplexNoise, 
+                                     densScale, densOctaves,
+                                     densOctaveGain, densLacunarity);
+  dispFractal = dispFractalCache.get(false, tiledNoise, simplexNoise, 
+                                     dispScale, dispOctaves,
+                                     dispOctaveGain, dispLacunarity);
 }
 
 //----------------------------------------------------------------------------//
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <OpenEXR/ImathRandom.h>
@@ -47,7 +49,6 @@
 #include "pvr/ModelerInput.h"
 #include "pvr/ModelingUtils.h"
 #include "pvr/RenderGlobals.h"
-#include "pvr/Primitives/Rasterization/Point.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -63,6 +64,68 @@ using namespace pvr::Noise;
 using namespace pvr::Sys;
 using namespace pvr::Util;
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of instances whose attributes are interpolated together
+  const size_t k_batchSize = 64;
+
+  //! Float channels of each patch corner. Vectors take three consecutive 
+  //! channels.
+  enum PatchChannel {
+    DensityChannel    = 0,
+    WsPChannel        = 3,
+    WsVChannel        = 6,
+    WsNormalChannel   = 9,
+    WsDPdsChannel     = 12,
+    WsDPdtChannel     = 15,
+    ThicknessChannel  = 18,
+    k_numPatchChannels
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes a vector to three consecutive channels
+  inline void setChannels(float *channels, const Imath::V3f &v)
+  {
+    channels[0] = v.x;
+    channels[4] = v.y;
+    channels[8] = v.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads a vector from three consecutive channels of a batch
+  inline Imath::V3f batchVector(const float values[][k_batchSize], 
+                                const int channel, const size_t i)
+  {
+    return Imath::V3f(values[channel][i], values[channel + 1][i], 
+                      values[channel + 2][i]);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Attributes of a batch of instances
+  struct Batch
+  {
+    //! Local space position
+    float  lsX[k_batchSize], lsY[k_batchSize], lsZ[k_batchSize];
+    //! Patch of each instance, and its position within the patch
+    size_t patch[k_batchSize];
+    float  u[k_batchSize], v[k_batchSize];
+    //! Interpolated channels
+    float  values[k_numPatchChannels][k_batchSize];
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 
 namespace pvr {
@@ -74,169 +137,197 @@ namespace Inst {
 // Surface
 //----------------------------------------------------------------------------//
 
-ModelerInput::Ptr Surface::execute(const Geo::Geometry::CPtr geo) const
+size_t Surface::numInputs(const Geo::Geometry::CPtr geo) const
 {
-  typedef AttrVisitor::const_iterator AttrIter;
-
-  assert(geo != NULL);
-  assert(geo->meshes() != NULL);
-
   if (!geo->meshes()) {
     Log::warning("Instantiation primitive has no meshes. "
                  "Skipping execution.");
-    return ModelerInput::Ptr();
+    return 0;
   }
 
-  Log::print("Surface processing " + str(geo->meshes()->size()) +
-             " input meshes");
-
-  // Set up output geometry ---
-
-  size_t numInstancePoints = numOutputPoints(geo);
-
-  Log::print("  Output: " + str(numInstancePoints) + " points");
+  return geo->meshes()->size();
+}
 
-  Prim::Rast::Point::Ptr pointPrim = Prim::Rast::Point::create();
-  ModelerInput::Ptr      result    = ModelerInput::create();
-  Geometry::Ptr          outGeo    = Geometry::create();
-  Particles::Ptr         particles = Particles::create();
+//----------------------------------------------------------------------------//
 
-  AttrTable &points = particles->pointAttrs();
-  particles->add(numInstancePoints);
+InstancingContext::Ptr 
+Surface::createContext(const Geo::Geometry::CPtr geo) const
+{
+  return InstancingContext::Ptr(new Context(geo->meshes(), m_params));
+}
 
-  std::vector<float> oneDefault(1, 1.0);
+//----------------------------------------------------------------------------//
 
-  AttrRef vRef       = points.addVectorAttr("v", Vector(0.0));
-  AttrRef radiusRef  = points.addFloatAttr("radius", 1, oneDefault);
-  AttrRef densityRef = points.addVectorAttr("density", Vector(1.0));
+size_t Surface::updateInput(const size_t input, 
+                            InstancingContext &iContext) const
+{
+  typedef AttrVisitor::const_iterator AttrIter;
 
-  outGeo->setParticles(particles);
-  result->setGeometry(outGeo);
-  result->setVolumePrimitive(pointPrim);
+  Context &context = static_cast<Context &>(iContext);
+
+  // Update mesh attributes
+  context.surfAttrs.update(context.meshVisitor.begin(input));
+  // Update point attributes
+  context.numCols = context.meshes->numCols(input);
+  context.numRows = context.meshes->numRows(input);
+  size_t   first     = context.meshes->startPoint(input);
+  size_t   numPoints = context.numCols * context.numRows;
+  AttrIter iPoint    = context.pointVisitor.begin(first);
+  context.pointAttrs.resize(numPoints);
+  for (size_t i = 0; i < numPoints; ++i, ++iPoint) {
+    context.pointAttrs[i].update(iPoint);
+  }
 
-  // Loop over input points ---
+  return std::max(context.surfAttrs.numPoints.value(), 0);
+}
 
-  size_t idx = 0;
-  ProgressReporter progress(2.5f, "  ");
+//----------------------------------------------------------------------------//
 
-  // Iteration variables
-  Meshes::CPtr meshes      (geo->meshes());
-  AttrVisitor  meshVisitor (meshes->meshAttrs(), m_params);
-  AttrVisitor  pointVisitor(meshes->pointAttrs(), m_params);
+void Surface::instanceInput(InstancingContext &iContext, 
+                            InstancePoint *points) const
+{
+  Context             &context   = static_cast<Context &>(iContext);
+  const SurfAttrState &surfAttrs = context.surfAttrs;
+  const size_t         numCols   = context.numCols;
+  const size_t         numRows   = context.numRows;
+  PatchTable          &patches   = context.patches;
+
+  patches.update(context.pointAttrs, numCols, numRows, 
+                 surfAttrs.doAreaUniform);
+  if (patches.corners.empty()) {
+    return;
+  }
 
-  for (AttrIter iMesh = meshVisitor.begin(), endMesh = meshVisitor.end(); 
-       iMesh != endMesh; ++iMesh) {
-    // Update mesh attributes
-    updateSurfAttrs(iMesh);
-    // Update point attribute
-    size_t first     = meshes->startPoint(iMesh.index());
-    size_t numCols   = meshes->numCols(iMesh.index());
-    size_t numRows   = meshes->numRows(iMesh.index());
-    size_t numPoints = numCols * numRows;
-    updatePointAttrs(pointVisitor.begin(first), numPoints);
-    // Seed random number generator
-    Imath::Rand48 rng(m_surfAttrs.seed);
+  const std::vector<float> &cdf       = patches.areaCdf;
+  const int                 numPoints = surfAttrs.numPoints;
+
+  // Seed random number generator
+  Imath::Rand48 rng(surfAttrs.seed);
+  // Instances are interpolated in batches, one channel at a time
+  Batch batch;
+  for (int first = 0; first < numPoints; first += k_batchSize) {
+    const size_t n = std::min(k_batchSize, 
+                              static_cast<size_t>(numPoints - first));
+    // Randomize local space position
+    for (size_t i = 0; i < n; ++i) {
+      batch.lsX[i] = rng.nextf();
+      batch.lsY[i] = rng.nextf();
+      batch.lsZ[i] = rng.nextf();
+    }
+    // Find the patch of each instance
+    for (size_t i = 0; i < n; ++i) {
+      float s = batch.lsX[i] * (numCols - 1);
+      float t = batch.lsY[i] * (numRows - 1);
+      if (!cdf.empty()) {
+        // Pick the patch by area. What's left of lsX within the patch's
+        // part of the CDF is the position across the patch.
+        const size_t p = std::min<size_t>
+          (std::upper_bound(cdf.begin(), cdf.end(), batch.lsX[i]) - 
+           cdf.begin(), cdf.size() - 1);
+        const float  start = p > 0 ? cdf[p - 1] : 0.0f;
+        const float  width = cdf[p] - start;
+        const float  frac  = 
+          width > 0.0f ? std::min((batch.lsX[i] - start) / width, 1.0f) : 
+          0.0f;
+        s = (p % patches.numCols) + frac;
+        t = (p / patches.numCols) + batch.lsY[i];
+        // Noise and edge fades use the resulting parametric position
+        if (numCols > 1) {
+          batch.lsX[i] = s / (numCols - 1);
+        }
+        if (numRows > 1) {
+          batch.lsY[i] = t / (numRows - 1);
+        }
+      }
+      // A position on the far edge of the mesh ends up at the far side of
+      // the last patch
+      const size_t x = std::min(static_cast<size_t>(std::floor(s)), 
+                                patches.numCols - 1);
+      const size_t y = std::min(static_cast<size_t>(std::floor(t)), 
+                                patches.numRows - 1);
+      batch.patch[i] = x + y * patches.numCols;
+      batch.u[i]     = s - x;
+      batch.v[i]     = t - y;
+    }
+    // Interpolate, in the same order of operations as Math::linear2D()
+    for (int c = 0; c < k_numPatchChannels; ++c) {
+      const float *corners = &patches.corners[c * 4];
+      float       *values  = batch.values[c];
+      for (size_t i = 0; i < n; ++i) {
+        const float *k  = corners + batch.patch[i] * k_numPatchChannels * 4;
+        const float  u  = batch.u[i];
+        const float  v  = batch.v[i];
+        const float  y0 = k[0] * (1.0f - u) + k[1] * u;
+        const float  y1 = k[2] * (1.0f - u) + k[3] * u;
+        values[i] = y0 * (1.0f - v) + y1 * v;
+      }
+    }
     // For each instance
-    for (int i = 0; i < m_surfAttrs.numPoints; ++i, ++idx) {
-      // Check if user terminated
-      Sys::Interrupt::throwOnAbort();
-      // Print progress
-      progress.update(static_cast<float>(idx) / numInstancePoints);
-      // Randomize local space position
-      V3f lsP;
-      lsP.x = rng.nextf();
-      lsP.y = rng.nextf();
-      lsP.z = rng.nextf();
-      // Let s,t be floating-point index
-      float s = lsP.x * (numCols - 1);
-      float t = lsP.y * (numRows - 1);
-      // Interpolate instance attributes
-      V3f instanceDensity = SURFACE_INST_INTERP(density, s, t);
-      V3f instanceWsP     = SURFACE_INST_INTERP(wsP, s, t);
-      V3f instanceWsV     = SURFACE_INST_INTERP(wsVelocity, s, t);
-      V3f wsN             = SURFACE_INST_INTERP(wsNormal, s, t).normalized();
-      V3f wsDPds          = SURFACE_INST_INTERP(wsDPds, s, t).normalized();
-      V3f wsDPdt          = SURFACE_INST_INTERP(wsDPdt, s, t).normalized();
-      float thickness     = SURFACE_INST_INTERP(thickness, s, t);
+    for (size_t i = 0; i < n; ++i) {
+      const V3f lsP(batch.lsX[i], batch.lsY[i], batch.lsZ[i]);
+      V3f instanceDensity = batchVector(batch.values, DensityChannel, i);
+      V3f instanceWsP     = batchVector(batch.values, WsPChannel, i);
+      V3f instanceWsV     = batchVector(batch.values, WsVChannel, i);
+      V3f wsN             = 
+        batchVector(batch.values, WsNormalChannel, i).normalized();
+      V3f wsDPds          = 
+        batchVector(batch.values, WsDPdsChannel, i).normalized();
+      V3f wsDPdt          = 
+        batchVector(batch.values, WsDPdtChannel, i).normalized();
+      float thickness     = batch.values[ThicknessChannel][i];
       // Offset along normal
       instanceWsP += Math::fit01(lsP.z, -1.0f, 1.0f) * wsN * thickness;
       // Apply noises
       V3f nsP = lsP;
-      if (m_surfAttrs.doDensNoise) {
-        V3f nsLookupP = nsP / m_surfAttrs.densScale.value();
-        float noise = m_surfAttrs.densFractal->eval(nsLookupP);
-        float fade = edgeFade(lsP.x, lsP.y, lsP.z);
+      if (surfAttrs.doDensNoise) {
+        V3f nsLookupP = nsP / surfAttrs.densScale.value();
+        float noise = surfAttrs.densFractal->eval(nsLookupP);
+        float fade = edgeFade(lsP.x, lsP.y, lsP.z, surfAttrs.densFade);
         instanceDensity *= noise + fade;
       }
-      if (m_surfAttrs.doDispNoise) {
-        V3f nsLookupP = nsP / m_surfAttrs.dispScale.value();
-        V3f disp = m_surfAttrs.dispFractal->evalVec(nsLookupP);
+      if (surfAttrs.doDispNoise) {
+        V3f nsLookupP = nsP / surfAttrs.dispScale.value();
+        V3f disp = surfAttrs.dispFractal->evalVec(nsLookupP);
         instanceWsP += disp.x * wsDPds * thickness * 
-          m_surfAttrs.dispAmplitude.value();
+          surfAttrs.dispAmplitude.value();
         instanceWsP += disp.y * wsDPdt * thickness * 
-          m_surfAttrs.dispAmplitude.value();
+          surfAttrs.dispAmplitude.value();
         instanceWsP += disp.z * wsN * thickness * 
-          m_surfAttrs.dispAmplitude.value();
+          surfAttrs.dispAmplitude.value();
       }
       // Set instance attributes
-      particles->setPosition(idx, instanceWsP);
-      points.setVectorAttr(vRef, idx, instanceWsV);
-      points.setVectorAttr(densityRef, idx, instanceDensity);
-      points.setFloatAttr(radiusRef, idx, 0, m_surfAttrs.instanceRadius);
+      InstancePoint &point = points[first + i];
+      point.wsP     = instanceWsP;
+      point.wsV     = instanceWsV;
+      point.density = instanceDensity;
+      point.radius  = surfAttrs.instanceRadius;
     }
   }
-
-  return result;
 }
 
 //----------------------------------------------------------------------------//
 
-BBox Surface::wsBounds(Geo::Geometry::CPtr geometry) const
+BBox Surface::inputWsBounds(const InstancingContext &iContext) const
 {
-  typedef AttrVisitor::const_iterator AttrIter;
-
-  assert(geometry != NULL);
-
-  if (!geometry->meshes()) {
-    Log::warning("Instantiation primitive has no meshes. "
-                 "Skipping bounds generation.");
-    return BBox();
+  const Context       &context   = static_cast<const Context &>(iContext);
+  const SurfAttrState &surfAttrs = context.surfAttrs;
+
+  // Displacement is the same over the whole surface
+  double displacement = 0.0;
+  if (surfAttrs.doDispNoise) {
+    Noise::Fractal::Range range = surfAttrs.dispFractal->range();
+    displacement = surfAttrs.dispAmplitude * 
+      std::max(std::abs(range.first), std::abs(range.second));
   }
 
-  // Iteration variables
-  BBox           wsBBox;
-  Meshes::CPtr   meshes = geometry->meshes();
-  AttrVisitor    meshVisitor(meshes->meshAttrs(), m_params);
-  AttrVisitor    pointVisitor(meshes->pointAttrs(), m_params);
-
-  for (AttrIter iMesh = meshVisitor.begin(), endMesh = meshVisitor.end(); 
-       iMesh != endMesh; ++iMesh) {
-    // Update mesh attributes
-    updateSurfAttrs(iMesh);
-    // Update point attribute
-    size_t first = meshes->startPoint(iMesh.index());
-    size_t numRows = meshes->numRows(iMesh.index());
-    size_t numCols = meshes->numCols(iMesh.index());
-    size_t numPoints = numRows * numCols;
-    updatePointAttrs(pointVisitor.begin(first), numPoints);
-    // Compute world-space bounds
-    size_t index = 0;
-    for (std::vector<PointAttrState>::const_iterator i = m_pointAttrs.begin(),
-           end = m_pointAttrs.end(); i != end; ++i, ++index) {
-      Vector thickness = Vector(i->thickness.value());
-      float displacement = 0.0f;
-      if (m_surfAttrs.doDispNoise) {
-        Noise::Fractal::Range range = m_surfAttrs.dispFractal->range();
-        double maxDispl = m_surfAttrs.dispAmplitude * 
-          std::max(std::abs(range.first), std::abs(range.second));
-        displacement = Math::max(Vector(maxDispl));
-      }
-      Vector wsV   = i->wsVelocity.value();
-      Vector wsP   = i->wsP.value();
-      Vector wsEnd = wsP + wsV * RenderGlobals::dt();
-      wsBBox = extendBounds(wsBBox, wsP, thickness * (1.0 + displacement));
-      wsBBox = extendBounds(wsBBox, wsEnd, thickness * (1.0 + displacement));
-    }
+  BBox wsBBox;
+  BOOST_FOREACH (const PointAttrState &point, context.pointAttrs) {
+    Vector thickness = Vector(point.thickness.value());
+    Vector wsV       = point.wsVelocity.value();
+    Vector wsP       = point.wsP.value();
+    Vector wsEnd     = wsP + wsV * RenderGlobals::dt();
+    wsBBox = extendBounds(wsBBox, wsP, thickness * (1.0 + displacement));
+    wsBBox = extendBounds(wsBBox, wsEnd, thickness * (1.0 + displacement));
   }
 
   return wsBBox;
@@ -244,29 +335,14 @@ BBox Surface::wsBounds(Geo::Geometry::CPtr geometry) const
 
 //----------------------------------------------------------------------------//
   
-size_t Surface::pointIdx(const float s, const float t, 
-                         const size_t numCols, const size_t numRows, 
-                         const int xOff, const int yOff) const
-{
-  size_t x = static_cast<size_t>(std::floor(s)) + xOff;
-  size_t y = static_cast<size_t>(std::floor(t)) + yOff;
-  x = Imath::clamp(x, static_cast<size_t>(0), numCols - 1);
-  y = Imath::clamp(y, static_cast<size_t>(0), numRows - 1);
-  return x + y * numCols;
-}
-
-//----------------------------------------------------------------------------//
-
-float Surface::edgeFade(float x, float y, float z) const
+float Surface::edgeFade(float x, float y, float z, 
+                        const Imath::V3f &fit) const
 {
   // Mirror at 0.5 for each dimension
   x = std::min(x, 1.0f - x);
   y = std::min(y, 1.0f - y);
   z = std::min(z, 1.0f - z);
   
-  // Get fit param 
-  V3f fit = m_surfAttrs.densFade.value();
-
   // Re-fit according to param
   if (fit.x > 0.0f) {
     x = Math::fit(x, 0.0f, fit.x, -1.0f, 1.0f);
@@ -294,46 +370,6 @@ float Surface::edgeFade(float x, float y, float z) const
 }
 
 
-//----------------------------------------------------------------------------//
-
-size_t Surface::numOutputPoints(const Geo::Geometry::CPtr geo) const
-{
-  size_t count = 0;
-  AttrVisitor visitor(geo->meshes()->meshAttrs(), m_params);
-
-  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i) {
-    m_surfAttrs.update(i);
-    count += m_surfAttrs.numPoints.value();
-  }
-  
-  return count;
-}
-
-//----------------------------------------------------------------------------//
-
-void Surface::updateSurfAttrs(Geo::AttrVisitor::const_iterator i) const
-{
-  // Update base class
-  // SurfaceBase::updateSurfAttrs(i);
-  // Update this class
-  m_surfAttrs.update(i);
-}
-
-//----------------------------------------------------------------------------//
-
-void Surface::updatePointAttrs(Geo::AttrVisitor::const_iterator iPoint, 
-                            const size_t numPoints) const
-{
-  // Update base class
-  // SurfaceBase::updatePointAttrs(iPoint, numPoints);
-  // Update this class
-  m_pointAttrs.resize(numPoints);
-  for (size_t i = 0; i < numPoints; ++i, ++iPoint) {
-    m_pointAttrs[i].update(iPoint);
-  }
-}
-
 //----------------------------------------------------------------------------//
 // Point::SurfAttrState
 //----------------------------------------------------------------------------//
@@ -356,13 +392,73 @@ void Surface::SurfAttrState::update(const Geo::AttrVisitor::const_iterator &i)
   i.update(dispAmplitude);
   i.update(doDensNoise);
   i.update(doDispNoise);
+  i.update(doAreaUniform);
   // Set up fractals
-  NoiseFunction::CPtr densNoise = NoiseFunction::CPtr(new PerlinNoise);
-  densFractal = Fractal::CPtr(new fBm(densNoise, 1.0, densOctaves, 
-                                      densOctaveGain, densLacunarity));
-  NoiseFunction::CPtr dispNoise = NoiseFunction::CPtr(new PerlinNoise);
-  dispFractal = Fractal::CPtr(new fBm(dispNoise, 1.0, dispOctaves, 
-                                      dispOctaveGain, dispLacunarity));
+  densFractal = densFractalCache.get(false, false, false, 1.0, densOctaves,
+                                     densOctaveGain, densLacunarity);
+  dispFractal = dispFractalCache.get(false, false, false, 1.0, dispOctaves,
+                                     dispOctaveGain, dispLacunarity);
+}
+
+//----------------------------------------------------------------------------//
+// Surface::PatchTable
+//----------------------------------------------------------------------------//
+
+void Surface::PatchTable::update(const std::vector<PointAttrState> &pointAttrs,
+                                 const size_t meshCols, const size_t meshRows,
+                                 const bool doAreaCdf)
+{
+  // A mesh with a single row or column still has one patch across it, 
+  // whose corners coincide
+  numCols = std::max(meshCols, static_cast<size_t>(2)) - 1;
+  numRows = std::max(meshRows, static_cast<size_t>(2)) - 1;
+
+  const size_t numPatches = numCols * numRows;
+  corners.resize(numPatches * k_numPatchChannels * 4);
+  areaCdf.clear();
+  if (meshCols == 0 || meshRows == 0) {
+    corners.clear();
+    return;
+  }
+
+  double area = 0.0;
+  for (size_t y = 0; y < numRows; ++y) {
+    for (size_t x = 0; x < numCols; ++x) {
+      const size_t x1 = std::min(x + 1, meshCols - 1);
+      const size_t y1 = std::min(y + 1, meshRows - 1);
+      const PointAttrState *c[4] = {
+        &pointAttrs[x  + y  * meshCols], &pointAttrs[x1 + y  * meshCols], 
+        &pointAttrs[x  + y1 * meshCols], &pointAttrs[x1 + y1 * meshCols]
+      };
+      float *patch = &corners[(x + y * numCols) * k_numPatchChannels * 4];
+      for (int i = 0; i < 4; ++i) {
+        setChannels(patch + DensityChannel * 4 + i, c[i]->density.value());
+        setChannels(patch + WsPChannel * 4 + i, c[i]->wsP.value());
+        setChannels(patch + WsVChannel * 4 + i, c[i]->wsVelocity.value());
+        setChannels(patch + WsNormalChannel * 4 + i, c[i]->wsNormal.value());
+        setChannels(patch + WsDPdsChannel * 4 + i, c[i]->wsDPds.value());
+        setChannels(patch + WsDPdtChannel * 4 + i, c[i]->wsDPdt.value());
+        patch[ThicknessChannel * 4 + i] = c[i]->thickness.value();
+      }
+      if (doAreaCdf) {
+        // Two triangles, split along the p10-p01 diagonal
+        const V3f p00 = c[0]->wsP.value(), p10 = c[1]->wsP.value();
+        const V3f p01 = c[2]->wsP.value(), p11 = c[3]->wsP.value();
+        area += 0.5 * ((p10 - p00).cross(p01 - p00).length() + 
+                       (p01 - p11).cross(p10 - p11).length());
+        areaCdf.push_back(static_cast<float>(area));
+      }
+    }
+  }
+
+  if (area > 0.0) {
+    for (size_t i = 0, size = areaCdf.size(); i < size; ++i) {
+      areaCdf[i] /= static_cast<float>(area);
+    }
+    areaCdf.back() = 1.0f;
+  } else {
+    areaCdf.clear();
+  }
 }
 
 //----------------------------------------------------------------------------//
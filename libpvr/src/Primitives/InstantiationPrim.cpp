@@ -0,0 +1,713 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file InstantiationPrim.cpp
+  Contains implementations of InstantiationPrim and PointInstancer classes.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Primitives/InstantiationPrim.h"
+
+// System includes
+
+#include <algorithm>
+#include <limits>
+
+// Library includes
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+// Project includes
+
+#include "pvr/Geometry.h"
+#include "pvr/Interrupt.h"
+#include "pvr/Log.h"
+#include "pvr/Threading.h"
+#include "pvr/Primitives/Rasterization/Point.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+  using namespace pvr::Model;
+  using namespace pvr::Model::Prim::Inst;
+
+  //--------------------------------------------------------------------------//
+
+  //! Maximum number of points instanced per batch. Larger batches keep more
+  //! threads busy, at the cost of memory for the points in flight.
+  const size_t k_batchSize = 1 << 18;
+  //! Number of points processed between progress updates and interrupt
+  //! checks
+  const size_t k_progressInterval = 4096;
+  //! Number of grids that deterministic aggregation splits the inputs 
+  //! into, whatever the number of threads
+  const size_t k_deterministicGroups = 64;
+
+  //--------------------------------------------------------------------------//
+
+  //! Stores the given input in the pointer. Used as chunk callback when
+  //! all points are gathered in a single ModelerInput.
+  void storeInput(ModelerInput::Ptr input, ModelerInput::Ptr *result)
+  {
+    *result = input;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Creates a ModelerInput holding numPoints points and a Point 
+  //! rasterization primitive. If particles is non-null it is set to point
+  //! at the new particle set.
+  ModelerInput::Ptr createPointInput(const size_t numPoints,
+                                     Geo::Particles::Ptr *particles = NULL)
+  {
+    Geo::Geometry::Ptr     outGeo    = Geo::Geometry::create();
+    Geo::Particles::Ptr    outParts  = Geo::Particles::create();
+    ModelerInput::Ptr      result    = ModelerInput::create();
+    Prim::Rast::Point::Ptr pointPrim = Prim::Rast::Point::create();
+    outParts->add(numPoints);
+    outGeo->setParticles(outParts);
+    result->setGeometry(outGeo);
+    result->setVolumePrimitive(pointPrim);
+    if (particles) {
+      *particles = outParts;
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Accumulates points in fixed-size chunks. Each chunk is handed to the 
+  //! callback as a separate ModelerInput when it is full, after which it
+  //! is released and the next one is allocated.
+  class ChunkSink : public PointSink
+  {
+  public:
+    ChunkSink(const size_t chunkSize, 
+              const InstantiationPrim::ChunkCallback &callback)
+      : m_remaining(0), 
+        m_chunkSize(chunkSize),
+        m_idx(0), 
+        m_points(NULL),
+        m_callback(callback)
+    { }
+    // From PointSink
+    virtual void begin(const size_t numPoints)
+    {
+      m_remaining = numPoints;
+      if (m_chunkSize == 0) {
+        m_chunkSize = numPoints;
+      }
+    }
+    virtual void add(const InstancePoint &point)
+    {
+      if (!m_input) {
+        allocate();
+      }
+      m_particles->setPosition(m_idx, point.wsP);
+      m_points->setVectorAttr(m_wsV, m_idx, point.wsV);
+      m_points->setVectorAttr(m_density, m_idx, point.density);
+      m_points->setFloatAttr(m_radius, m_idx, 0, point.radius);
+      if (++m_idx == m_particles->size()) {
+        flush();
+      }
+    }
+  private:
+    //! Allocates the next chunk
+    void allocate()
+    {
+      assert(m_remaining > 0 && "More points added than announced");
+      const size_t size = std::min(m_chunkSize, m_remaining);
+      m_input     = createPointInput(size, &m_particles);
+      m_points    = &m_particles->pointAttrs();
+      m_wsV       = m_points->addVectorAttr("v", Imath::V3f(0.0));
+      m_radius    = m_points->addFloatAttr("radius", 1, 
+                                           std::vector<float>(1, 1.0));
+      m_density   = m_points->addVectorAttr("density", Imath::V3f(1.0));
+      m_remaining -= size;
+      m_idx        = 0;
+    }
+    //! Hands the current chunk to the callback and releases it
+    void flush()
+    {
+      ModelerInput::Ptr input = m_input;
+      m_input.reset();
+      m_particles.reset();
+      m_points = NULL;
+      m_callback(input);
+    }
+    //! Number of points not yet allocated to a chunk
+    size_t                             m_remaining;
+    //! Maximum number of points per chunk
+    size_t                             m_chunkSize;
+    //! Index of next point in current chunk
+    size_t                             m_idx;
+    //! Current chunk
+    ModelerInput::Ptr                  m_input;
+    Geo::Particles::Ptr                m_particles;
+    Geo::AttrTable                    *m_points;
+    Geo::AttrRef                       m_wsV;
+    Geo::AttrRef                       m_radius;
+    Geo::AttrRef                       m_density;
+    //! Receives each completed chunk
+    InstantiationPrim::ChunkCallback   m_callback;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes each point straight into a voxel buffer using the Rast::Point
+  //! kernel.
+  class RasterSink : public PointSink
+  {
+  public:
+    RasterSink(VoxelBuffer::Ptr buffer)
+      : m_buffer(buffer), 
+        m_prim(Prim::Rast::Point::create()),
+        m_context(m_prim->createContext())
+    { 
+      // The sink is the only writer, so it owns the whole buffer
+      m_context->dvsWindow = buffer->dataWindow();
+    }
+    // From PointSink
+    virtual void begin(const size_t)
+    { }
+    virtual void add(const InstancePoint &point)
+    {
+      m_point.wsCenter   = point.wsP;
+      m_point.wsVelocity = point.wsV;
+      m_point.density    = point.density;
+      m_point.radius     = point.radius;
+      m_prim->rasterizePoint(m_point, m_buffer, *m_context);
+    }
+  private:
+    VoxelBuffer::Ptr                          m_buffer;
+    Prim::Rast::Point::Ptr                    m_prim;
+    Prim::Rast::RasterizationContext::Ptr     m_context;
+    Prim::Rast::Point::Item                   m_point;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Creates an empty accumulation grid covering the buffer. Sparse buffers
+  //! lend their block size, so that each block of the grid maps to one of 
+  //! theirs.
+  SparseBuffer::Ptr createGrid(VoxelBuffer::Ptr buffer)
+  {
+    SparseBuffer::Ptr grid(new SparseBuffer);
+    if (SparseBuffer::Ptr sparse = 
+        Field3D::field_dynamic_cast<SparseBuffer>(buffer)) {
+      grid->setBlockOrder(sparse->blockOrder());
+    }
+    grid->setSize(buffer->extents(), buffer->dataWindow());
+    grid->setMapping(buffer->mapping());
+    return grid;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds rows [begin, end) of blocks of the grids to the buffer. Rows 
+  //! cover disjoint voxels, so they may be merged concurrently.
+  void mergeGrids(const std::vector<SparseBuffer::Ptr> &grids, 
+                  VoxelBuffer &buffer, const size_t begin, const size_t end)
+  {
+    using Imath::V3i;
+
+    const SparseBuffer &layout    = *grids.front();
+    const DiscreteBBox &dw        = layout.dataWindow();
+    const V3i           blockRes  = layout.blockRes();
+    const int           blockSize = layout.blockSize();
+
+    for (int bk = static_cast<int>(begin); bk < static_cast<int>(end); ++bk) {
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi) {
+          const V3i min = dw.min + V3i(bi, bj, bk) * blockSize;
+          const V3i max(std::min(min.x + blockSize - 1, dw.max.x),
+                        std::min(min.y + blockSize - 1, dw.max.y),
+                        std::min(min.z + blockSize - 1, dw.max.z));
+          BOOST_FOREACH (const SparseBuffer::Ptr &grid, grids) {
+            if (!grid->blockIsAllocated(bi, bj, bk)) {
+              continue;
+            }
+            for (int k = min.z; k <= max.z; ++k) {
+              for (int j = min.y; j <= max.y; ++j) {
+                for (int i = min.x; i <= max.x; ++i) {
+                  const Imath::V3f &value = grid->fastValue(i, j, k);
+                  if (value != Imath::V3f(0.0f)) {
+                    buffer.lvalue(i, j, k) += value;
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Sys;
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+namespace Prim {
+namespace Inst {
+
+//----------------------------------------------------------------------------//
+// PointInstancer::InstanceState
+//----------------------------------------------------------------------------//
+
+struct PointInstancer::InstanceState
+{
+  InstanceState()
+    : lastInput(0), firstPoint(0), nextInput(0), job(NULL)
+  { }
+
+  //! Context of each worker thread
+  std::vector<InstancingContext::Ptr> contexts;
+  //! Index of the first output point of each input. Has one extra entry,
+  //! holding the total number of points.
+  std::vector<size_t>                 offsets;
+  //! One past the last input of the current batch
+  size_t                              lastInput;
+  //! Index of the first output point of the current batch
+  size_t                              firstPoint;
+  //! Points of the current batch
+  std::vector<InstancePoint>          points;
+  //! Next input to hand out to a worker
+  boost::atomic<size_t>               nextInput;
+  //! Job that the workers are part of
+  Sys::JobState                      *job;
+};
+
+//----------------------------------------------------------------------------//
+// PointInstancer::ScanState
+//----------------------------------------------------------------------------//
+
+struct PointInstancer::ScanState
+{
+  ScanState(std::vector<InstancingContext::Ptr> &contexts, 
+            std::vector<size_t> &counts, const bool doBounds)
+    : contexts(contexts), counts(counts), doBounds(doBounds), 
+      wsBounds(contexts.size()), job(NULL)
+  { }
+
+  //! Context of each worker thread
+  std::vector<InstancingContext::Ptr> &contexts;
+  //! Number of points of each input
+  std::vector<size_t>                 &counts;
+  //! Whether to bound the inputs
+  bool                                 doBounds;
+  //! Bounds of each thread's inputs
+  std::vector<BBox>                    wsBounds;
+  //! Job that the workers are part of
+  Sys::JobState                       *job;
+};
+
+//----------------------------------------------------------------------------//
+// PointInstancer::AggregateState
+//----------------------------------------------------------------------------//
+
+struct PointInstancer::AggregateState
+{
+  AggregateState()
+    : numInputs(0), numGroups(0), firstGroup(0), job(NULL)
+  { }
+
+  //! Context of each worker thread
+  std::vector<InstancingContext::Ptr>                contexts;
+  //! Rasterization context of each worker thread
+  std::vector<Prim::Rast::RasterizationContext::Ptr> rastContexts;
+  //! Accumulation grid of each worker thread, for its group of the 
+  //! current batch
+  std::vector<SparseBuffer::Ptr>                     grids;
+  //! Number of points instanced by each worker thread
+  std::vector<size_t>                                numPoints;
+  //! Number of inputs in the geometry
+  size_t                                             numInputs;
+  //! Number of contiguous ranges that the inputs are split into
+  size_t                                             numGroups;
+  //! Group of the first worker thread of the current batch
+  size_t                                             firstGroup;
+  //! Rasterizes the points into the grids
+  Prim::Rast::Point::Ptr                             prim;
+  //! Job that the workers are part of
+  Sys::JobState                                     *job;
+};
+
+//----------------------------------------------------------------------------//
+// PointInstancer
+//----------------------------------------------------------------------------//
+
+BBox PointInstancer::wsBounds(Geo::Geometry::CPtr geometry) const
+{
+  assert(geometry != NULL);
+
+  const size_t numInputs = this->numInputs(geometry);
+  if (numInputs == 0) {
+    return BBox();
+  }
+
+  std::vector<InstancingContext::Ptr> contexts(
+    std::min(Sys::numWorkerThreads(0), numInputs));
+  BOOST_FOREACH (InstancingContext::Ptr &context, contexts) {
+    context = createContext(geometry);
+  }
+
+  std::vector<size_t> counts;
+  BBox                wsBBox;
+  scan(geometry, contexts, true, counts, wsBBox);
+  return wsBBox;
+}
+
+//----------------------------------------------------------------------------//
+
+ModelerInput::Ptr PointInstancer::execute(const Geo::Geometry::CPtr geo) const
+{
+  // Gather all points in a single chunk
+  ModelerInput::Ptr result;
+  ChunkSink sink(0, boost::bind(&storeInput, _1, &result));
+  instance(geo, sink, 0);
+
+  // If no points were output, return an empty point set
+  if (!result) {
+    result = createPointInput(0);
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+void PointInstancer::executeChunked(const Geo::Geometry::CPtr geo, 
+                                    const size_t chunkSize,
+                                    const ChunkCallback &callback,
+                                    const size_t numThreads) const
+{
+  ChunkSink sink(chunkSize, callback);
+  instance(geo, sink, numThreads);
+}
+
+//----------------------------------------------------------------------------//
+
+bool PointInstancer::rasterizeDirect(const Geo::Geometry::CPtr geo, 
+                                     VoxelBuffer::Ptr buffer,
+                                     const size_t numThreads) const
+{
+  RasterSink sink(buffer);
+  instance(geo, sink, numThreads);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool PointInstancer::rasterizeAggregated(const Geo::Geometry::CPtr geo, 
+                                         VoxelBuffer::Ptr buffer,
+                                         const size_t numThreads,
+                                         const bool deterministic) const
+{
+  assert(geo != NULL);
+
+  const size_t numInputs = this->numInputs(geo);
+  if (numInputs == 0) {
+    return true;
+  }
+
+  const size_t threads = std::min(Sys::numWorkerThreads(numThreads), 
+                                  numInputs);
+
+  AggregateState state;
+  state.numInputs = numInputs;
+  state.numGroups = 
+    deterministic ? std::min(k_deterministicGroups, numInputs) : threads;
+  state.prim      = Prim::Rast::Point::create();
+  state.contexts.resize(std::min(threads, state.numGroups));
+  state.rastContexts.resize(state.contexts.size());
+  state.numPoints.assign(state.contexts.size(), 0);
+  BOOST_FOREACH (InstancingContext::Ptr &context, state.contexts) {
+    context = createContext(geo);
+  }
+
+  Log::print(typeName() + " aggregating " + str(numInputs) + 
+             " inputs into " + str(state.numGroups) + " grids, using " + 
+             str(state.contexts.size()) + " threads");
+
+  ProgressReporter progress(2.5f, "  ");
+  ProgressReporter mergeProgress(std::numeric_limits<float>::max());
+  Sys::JobState    job(numInputs);
+  state.job = &job;
+
+  // Each batch fills one grid per thread and adds them to the buffer, in
+  // group order. Every voxel thereby sums up the groups in the same order,
+  // however many batches they take.
+  size_t numPoints = 0, gridMemory = 0;
+  for (state.firstGroup = 0; state.firstGroup < state.numGroups; 
+       state.firstGroup += state.contexts.size()) {
+    const size_t batchSize = 
+      std::min(state.contexts.size(), state.numGroups - state.firstGroup);
+    // Fresh rasterization contexts let go of the last batch's grids
+    state.grids.resize(batchSize);
+    for (size_t i = 0; i < batchSize; ++i) {
+      state.grids[i]        = createGrid(buffer);
+      state.rastContexts[i] = state.prim->createContext();
+      // Each thread owns its whole grid
+      state.rastContexts[i]->dvsWindow = buffer->dataWindow();
+    }
+    // Instance and rasterize, each thread into its own grid
+    Sys::runWorkers(batchSize, 
+                    boost::bind(&PointInstancer::aggregateInputs, this,
+                                boost::ref(state), _1), 
+                    job, progress);
+    size_t batchMemory = 0;
+    BOOST_FOREACH (const SparseBuffer::Ptr &grid, state.grids) {
+      batchMemory += grid->memSize();
+    }
+    gridMemory = std::max(gridMemory, batchMemory);
+    Sys::parallelFor(state.grids.front()->blockRes().z, 1,
+                     boost::bind(&mergeGrids, boost::cref(state.grids),
+                                 boost::ref(*buffer), _1, _2),
+                     Sys::numWorkerThreads(numThreads), mergeProgress);
+  }
+
+  BOOST_FOREACH (const size_t count, state.numPoints) {
+    numPoints += count;
+  }
+  Log::print("  Output: " + str(numPoints) + " points, " + 
+             str(gridMemory / (1024 * 1024)) + " MB of grids");
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void PointInstancer::instance(const Geo::Geometry::CPtr geo, PointSink &sink,
+                              const size_t numThreads) const
+{
+  assert(geo != NULL);
+
+  const size_t numInputs = this->numInputs(geo);
+  if (numInputs == 0) {
+    sink.begin(0);
+    return;
+  }
+
+  InstanceState state;
+  state.contexts.resize(Sys::numWorkerThreads(numThreads));
+  BOOST_FOREACH (InstancingContext::Ptr &context, state.contexts) {
+    context = createContext(geo);
+  }
+
+  // Find the output range of each input
+  std::vector<size_t> counts;
+  BBox                wsBBox;
+  scan(geo, state.contexts, false, counts, wsBBox);
+  state.offsets.resize(numInputs + 1);
+  state.offsets[0] = 0;
+  for (size_t i = 0; i < numInputs; ++i) {
+    state.offsets[i + 1] = state.offsets[i] + counts[i];
+  }
+  const size_t numPoints = state.offsets[numInputs];
+
+  Log::print(typeName() + " processing " + str(numInputs) + " inputs, using " +
+             str(state.contexts.size()) + " threads");
+  Log::print("  Output: " + str(numPoints) + " points");
+
+  sink.begin(numPoints);
+
+  ProgressReporter progress(2.5f, "  ");
+  Sys::JobState    job(numPoints);
+  state.job = &job;
+
+  for (size_t first = 0; first < numInputs; ) {
+    // Gather inputs until the batch is full. An input that is larger than
+    // a batch gets a batch of its own.
+    size_t last = first + 1;
+    while (last < numInputs && 
+           state.offsets[last + 1] - state.offsets[first] <= k_batchSize) {
+      ++last;
+    }
+    state.lastInput  = last;
+    state.firstPoint = state.offsets[first];
+    state.nextInput  = first;
+    state.points.resize(state.offsets[last] - state.offsets[first]);
+    first = last;
+    if (state.points.empty()) {
+      continue;
+    }
+    // Instance the batch. Each input writes to its own range of points.
+    Sys::runWorkers(std::min(state.contexts.size(), 
+                             state.lastInput - state.nextInput), 
+                    boost::bind(&PointInstancer::instanceBatch, this,
+                                boost::ref(state), _1), 
+                    job, progress);
+    // Hand the points to the sink in their original order
+    for (size_t i = 0, size = state.points.size(); i < size; ++i) {
+      if (i % k_progressInterval == 0) {
+        Sys::Interrupt::throwOnAbort();
+      }
+      sink.add(state.points[i]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void PointInstancer::scan(const Geo::Geometry::CPtr geo, 
+                          std::vector<InstancingContext::Ptr> &contexts, 
+                          const bool doBounds, std::vector<size_t> &counts, 
+                          BBox &wsBounds) const
+{
+  const size_t numInputs = this->numInputs(geo);
+  counts.assign(numInputs, 0);
+  wsBounds = BBox();
+  if (numInputs == 0) {
+    return;
+  }
+
+  ProgressReporter progress(2.5f, doBounds ? "  Bounds: " : "  Counting: ");
+  Sys::JobState    job(numInputs);
+  ScanState        state(contexts, counts, doBounds);
+  state.job = &job;
+  Sys::runWorkers(std::min(contexts.size(), numInputs), 
+                  boost::bind(&PointInstancer::scanInputs, this,
+                              boost::ref(state), _1), 
+                  job, progress);
+
+  BOOST_FOREACH (const BBox &bounds, state.wsBounds) {
+    wsBounds.extendBy(bounds);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void PointInstancer::scanInputs(ScanState &state, const size_t thread) const
+{
+  const size_t numInputs  = state.counts.size();
+  const size_t numThreads = std::min(state.contexts.size(), numInputs);
+  const size_t first      = numInputs * thread / numThreads;
+  const size_t last       = numInputs * (thread + 1) / numThreads;
+
+  InstancingContext &context = *state.contexts[thread];
+
+  Sys::JobCounter counter(*state.job, k_progressInterval);
+  for (size_t input = first; input < last; ++input) {
+    if (!counter.add()) {
+      return;
+    }
+    state.counts[input] = updateInput(input, context);
+    if (state.doBounds) {
+      state.wsBounds[thread].extendBy(inputWsBounds(context));
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void PointInstancer::instanceBatch(InstanceState &state, 
+                                   const size_t thread) const
+{
+  InstancingContext &context = *state.contexts[thread];
+
+  Sys::JobCounter counter(*state.job, k_progressInterval);
+  while (!state.job->aborted()) {
+    // Claim the next input
+    const size_t input = state.nextInput++;
+    if (input >= state.lastInput) {
+      break;
+    }
+    const size_t numPoints = updateInput(input, context);
+    assert(numPoints == state.offsets[input + 1] - state.offsets[input]);
+    if (numPoints > 0) {
+      instanceInput(context, 
+                    &state.points[state.offsets[input] - state.firstPoint]);
+    }
+    counter.add(numPoints);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void PointInstancer::aggregateInputs(AggregateState &state, 
+                                     const size_t thread) const
+{
+  const size_t group = state.firstGroup + thread;
+  const size_t first = state.numInputs * group / state.numGroups;
+  const size_t last  = state.numInputs * (group + 1) / state.numGroups;
+
+  InstancingContext                  &context  = *state.contexts[thread];
+  Prim::Rast::RasterizationContext   &rContext = *state.rastContexts[thread];
+  const VoxelBuffer::Ptr              grid     = state.grids[thread];
+
+  // Only the points of the current input are held
+  std::vector<InstancePoint> points;
+  Prim::Rast::Point::Item    item;
+
+  Sys::JobCounter counter(*state.job, 1);
+  for (size_t input = first; input < last; ++input) {
+    const size_t numPoints = updateInput(input, context);
+    points.resize(numPoints);
+    if (numPoints > 0) {
+      instanceInput(context, &points[0]);
+    }
+    for (size_t i = 0; i < numPoints; ++i) {
+      const InstancePoint &point = points[i];
+      item.wsCenter   = point.wsP;
+      item.wsVelocity = point.wsV;
+      item.density    = point.density;
+      item.radius     = point.radius;
+      state.prim->queuePoint(item, grid, rContext);
+    }
+    state.numPoints[thread] += numPoints;
+    if (!counter.add()) {
+      break;
+    }
+  }
+  state.prim->flushPoints(rContext);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Inst
+} // namespace Prim
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
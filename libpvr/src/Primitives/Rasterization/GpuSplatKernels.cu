@@ -0,0 +1,591 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuSplatKernels.cu
+  Contains the CUDA kernels that rasterize point primitives, and their host
+  interface.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Primitives/Rasterization/GpuSplatKernels.h"
+
+#ifdef PVR_USE_CUDA
+
+// System includes
+
+#include <vector>
+
+// Library includes
+
+#include <cuda_runtime.h>
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Model::Prim::Rast::Gpu;
+
+  //--------------------------------------------------------------------------//
+  // Constants
+  //--------------------------------------------------------------------------//
+
+  //! Threads per block of the kernels
+  const int k_threadsPerBlock = 128;
+  //! Number of voxels of an item that each block of threads rasterizes.
+  //! Large items are split into many chunks, so that a few big points
+  //! don't keep the rest of the device waiting.
+  const int k_voxelsPerChunk  = 1024;
+
+  //--------------------------------------------------------------------------//
+  // Structs
+  //--------------------------------------------------------------------------//
+
+  //! A run of k_voxelsPerChunk voxels of an item's box
+  struct Chunk
+  {
+    int                item;
+    unsigned long long first;
+  };
+
+  //--------------------------------------------------------------------------//
+  // Vector helpers
+  //--------------------------------------------------------------------------//
+
+  __device__ inline float3 operator + (const float3 &a, const float3 &b)
+  { return make_float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+
+  __device__ inline float3 operator - (const float3 &a, const float3 &b)
+  { return make_float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+
+  __device__ inline float3 operator * (const float3 &a, const float s)
+  { return make_float3(a.x * s, a.y * s, a.z * s); }
+
+  __device__ inline float3 toFloat3(const float v[3])
+  { return make_float3(v[0], v[1], v[2]); }
+
+  __device__ inline float maxComponent(const float3 &v)
+  { return fmaxf(v.x, fmaxf(v.y, v.z)); }
+
+  __device__ inline float length(const float3 &v)
+  { return sqrtf(v.x * v.x + v.y * v.y + v.z * v.z); }
+
+  //--------------------------------------------------------------------------//
+
+  //! Transforms a vector by a 3x3 matrix, for row vectors as in Imath
+  __device__ inline float3 transform(const float m[3][3], const float3 &v)
+  {
+    return make_float3(v.x * m[0][0] + v.y * m[1][0] + v.z * m[2][0],
+                       v.x * m[0][1] + v.y * m[1][1] + v.z * m[2][1],
+                       v.x * m[0][2] + v.y * m[1][2] + v.z * m[2][2]);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! World-space offset from an item's center to the center of voxel
+  //! (x, y, z)
+  __device__ inline float3 wsOffset(const Grid &grid, const float vsCenter[3],
+                                    const int x, const int y, const int z)
+  {
+    const float3 vsOffset = make_float3((x + 0.5f) - vsCenter[0],
+                                        (y + 0.5f) - vsCenter[1],
+                                        (z + 0.5f) - vsCenter[2]);
+    return transform(grid.vsToWs, vsOffset);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds value to voxel (x, y, z). Voxels outside the data window or in
+  //! unallocated blocks are left alone.
+  __device__ void addVoxel(const Grid &grid, float *bricks,
+                           const int x, const int y, const int z,
+                           const float3 &value)
+  {
+    if (x < grid.dataMin[0] || x > grid.dataMax[0] ||
+        y < grid.dataMin[1] || y > grid.dataMax[1] ||
+        z < grid.dataMin[2] || z > grid.dataMax[2]) {
+      return;
+    }
+    const int size = grid.blockSize;
+    const int i    = x - grid.dataMin[0];
+    const int j    = y - grid.dataMin[1];
+    const int k    = z - grid.dataMin[2];
+    const int block =
+      ((k / size) * grid.blockRes[1] + j / size) * grid.blockRes[0] +
+      i / size;
+    const int brick = grid.blockBricks[block];
+    if (brick < 0) {
+      return;
+    }
+    float *voxel = bricks + 3 *
+      (((static_cast<size_t>(brick) * size + k % size) * size + j % size) *
+       size + i % size);
+    atomicAdd(voxel + 0, value.x);
+    atomicAdd(voxel + 1, value.y);
+    atomicAdd(voxel + 2, value.z);
+  }
+
+  //--------------------------------------------------------------------------//
+  // Noise, as in NoiseImpl.h and Noise.cpp
+  //--------------------------------------------------------------------------//
+
+  //! Matches quick_floor(), including its behavior for negative integers
+  __device__ inline int quickFloor(const float x)
+  { return static_cast<int>(x) - (x < 0.0f ? 1 : 0); }
+
+  //--------------------------------------------------------------------------//
+
+  __device__ inline unsigned int rot(const unsigned int x, const int k)
+  { return (x << k) | (x >> (32 - k)); }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches inthash<3>()
+  __device__ inline unsigned int hash(const int x, const int y, const int z)
+  {
+    unsigned int a, b, c;
+    a = b = c = 0xdeadbeef + (3 << 2) + 13;
+    c += static_cast<unsigned int>(z);
+    b += static_cast<unsigned int>(y);
+    a += static_cast<unsigned int>(x);
+    c ^= b; c -= rot(b, 14);
+    a ^= c; a -= rot(c, 11);
+    b ^= a; b -= rot(a, 25);
+    c ^= b; c -= rot(b, 16);
+    a ^= c; a -= rot(c, 4);
+    b ^= a; b -= rot(a, 14);
+    c ^= b; c -= rot(b, 24);
+    return c;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  __device__ inline float grad(const unsigned int hash, const float x,
+                               const float y, const float z)
+  {
+    const int   h = hash & 15;
+    const float u = h < 8 ? x : y;
+    const float v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  __device__ inline float fade(const float t)
+  { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); }
+
+  //--------------------------------------------------------------------------//
+
+  __device__ inline float lerp(const float t, const float a, const float b)
+  { return (1.0f - t) * a + t * b; }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches PerlinNoise::eval()
+  __device__ float perlin(const float3 &p)
+  {
+    const int X = quickFloor(p.x), Y = quickFloor(p.y), Z = quickFloor(p.z);
+    const float fx = p.x - X, fy = p.y - Y, fz = p.z - Z;
+    const float u = fade(fx), v = fade(fy), w = fade(fz);
+    const float result =
+      lerp(w,
+           lerp(v,
+                lerp(u, grad(hash(X,     Y,     Z), fx, fy, fz),
+                     grad(hash(X + 1, Y,     Z), fx - 1.0f, fy, fz)),
+                lerp(u, grad(hash(X,     Y + 1, Z), fx, fy - 1.0f, fz),
+                     grad(hash(X + 1, Y + 1, Z), fx - 1.0f, fy - 1.0f, fz))),
+           lerp(v,
+                lerp(u, grad(hash(X,     Y,     Z + 1), fx, fy, fz - 1.0f),
+                     grad(hash(X + 1, Y,     Z + 1), fx - 1.0f, fy,
+                          fz - 1.0f)),
+                lerp(u, grad(hash(X,     Y + 1, Z + 1), fx, fy - 1.0f,
+                             fz - 1.0f),
+                     grad(hash(X + 1, Y + 1, Z + 1), fx - 1.0f, fy - 1.0f,
+                          fz - 1.0f))));
+    return 0.9820f * result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches filteredOctaves() in Noise.cpp
+  __device__ inline float filteredOctaves(const float octaves,
+                                          const float scale,
+                                          const float lacunarity,
+                                          const float filterWidth)
+  {
+    if (filterWidth <= 0.0f || lacunarity <= 1.0f) {
+      return octaves;
+    }
+    const float nyquist =
+      logf(0.5f * scale / filterWidth) / logf(lacunarity);
+    return fminf(octaves, fmaxf(nyquist, 1.0f));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches fBm::evalBatch() with filter widths, for the point's fBm
+  __device__ float fBm(const PyroPoint &point, const float3 &p,
+                       const float filterWidth)
+  {
+    const float octaves = filteredOctaves(point.octaves, point.scale,
+                                          point.lacunarity, filterWidth);
+    float3 noiseP = p * (1.0f / point.scale);
+    float  result = 0.0f;
+    float  octaveContribution = 1.0f;
+    for (float o = 0.0f; o < octaves; o += 1.0f) {
+      const float noise  = point.absNoise ? fabsf(perlin(noiseP)) :
+        perlin(noiseP);
+      const float weight = fminf(fmaxf(octaves - o, 0.0f), 1.0f);
+      result += noise * octaveContribution * weight;
+      noiseP = noiseP * point.lacunarity;
+      octaveContribution *= point.octaveGain;
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches Math::gamma()
+  __device__ inline float applyGamma(const float x, const float gamma)
+  {
+    if (x > 0.0f) {
+      return powf(x, 1.0f / gamma);
+    } else if (x < 0.0f) {
+      return -powf(-x, 1.0f / gamma);
+    }
+    return 0.0f;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Samples
+  //--------------------------------------------------------------------------//
+
+  //! Matches Point::getSample()
+  __device__ float3 sample(const Grid &grid, const Sphere &sphere,
+                           const int x, const int y, const int z)
+  {
+    const float dist  = length(wsOffset(grid, sphere.vsCenter, x, y, z));
+    const float range = sphere.wsOuterRadius - sphere.wsInnerRadius;
+    const float t     = range != 0.0f ?
+      (dist - sphere.wsInnerRadius) / range : 0.0f;
+    return toFloat3(sphere.density) * (1.0f - t);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches PyroclasticPoint::getSampleBatch()
+  __device__ float3 sample(const Grid &grid, const PyroPoint &point,
+                           const int x, const int y, const int z)
+  {
+    const float3 density = toFloat3(point.density);
+    const float3 lsP     = transform(point.rotation,
+                                     wsOffset(grid, point.vsCenter, x, y, z) *
+                                     (1.0f / point.wsRadius));
+    const float  lsDist  = length(lsP);
+    const float  sphereFunc = lsDist - 1.0f;
+    // Voxels that are fully inside or outside for any noise value
+    if (point.gamma > 0.0f) {
+      if (point.isPyroclastic) {
+        const float width = 0.5f * point.filterWidth;
+        if (sphereFunc >= point.dispMax + width) {
+          return make_float3(0.0f, 0.0f, 0.0f);
+        } else if (sphereFunc <= point.dispMin - width) {
+          return density;
+        }
+      } else if (sphereFunc >= point.dispMax) {
+        return make_float3(0.0f, 0.0f, 0.0f);
+      }
+    }
+    float3 p = lsP;
+    if (point.isPyroclastic && point.isPyro2D && lsDist > 0.0f) {
+      p = p * (1.0f / lsDist);
+    }
+    float fractalVal = fBm(point, p + toFloat3(point.nsOffset),
+                           point.filterWidth);
+    fractalVal = applyGamma(fractalVal, point.gamma) * point.amplitude;
+    if (point.isPyroclastic) {
+      // Matches Noise::pyroclastic()
+      const float width = point.filterWidth * 0.5f;
+      const float pyro  =
+        1.0f - (sphereFunc - fractalVal + width) / (2.0f * width);
+      return density * fminf(fmaxf(pyro, 0.0f), 1.0f);
+    }
+    return density * fmaxf(0.0f, 1.0f - lsDist + fractalVal);
+  }
+
+  //--------------------------------------------------------------------------//
+  // Kernels
+  //--------------------------------------------------------------------------//
+
+  //! Writes one splat per thread, as SplatWriter does
+  __global__ void splatPoints(const Grid grid, float *bricks,
+                              const Splat *splats, const int numSplats)
+  {
+    const int index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index >= numSplats) {
+      return;
+    }
+    const Splat  &splat = splats[index];
+    const float3  value = toFloat3(splat.value);
+    if (!splat.antialiased) {
+      addVoxel(grid, bricks, static_cast<int>(floorf(splat.vsP[0])),
+               static_cast<int>(floorf(splat.vsP[1])),
+               static_cast<int>(floorf(splat.vsP[2])), value);
+      return;
+    }
+    // Offset the position relative to voxel centers
+    const float p[3] = { splat.vsP[0] - 0.5f, splat.vsP[1] - 0.5f,
+                         splat.vsP[2] - 0.5f };
+    int   corner[3];
+    float w[3][2];
+    for (int dim = 0; dim < 3; ++dim) {
+      corner[dim] = static_cast<int>(floorf(p[dim]));
+      // Weight of the lower voxel
+      w[dim][0] = (corner[dim] + 1) - p[dim];
+      w[dim][1] = 1.0f - w[dim][0];
+    }
+    for (int k = 0; k < 2; ++k) {
+      for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+          addVoxel(grid, bricks, corner[0] + i, corner[1] + j, corner[2] + k,
+                   value * (w[0][i] * w[1][j] * w[2][k]));
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Samples one chunk of an item's box per block of threads. Only
+  //! positive samples are written, as in RasterizationPrim::rasterize().
+  template <typename Item_T>
+  __global__ void rasterizeItems(const Grid grid, float *bricks,
+                                 const Item_T *items, const Chunk *chunks)
+  {
+    const Chunk   chunk = chunks[blockIdx.x];
+    const Item_T &item  = items[chunk.item];
+    const unsigned long long sizeX = item.boxMax[0] - item.boxMin[0] + 1;
+    const unsigned long long sizeY = item.boxMax[1] - item.boxMin[1] + 1;
+    const unsigned long long sizeZ = item.boxMax[2] - item.boxMin[2] + 1;
+    const unsigned long long count = sizeX * sizeY * sizeZ;
+    for (int i = threadIdx.x; i < k_voxelsPerChunk; i += blockDim.x) {
+      const unsigned long long index = chunk.first + i;
+      if (index >= count) {
+        return;
+      }
+      const int x = item.boxMin[0] + static_cast<int>(index % sizeX);
+      const int y = item.boxMin[1] + static_cast<int>((index / sizeX) % sizeY);
+      const int z = item.boxMin[2] + static_cast<int>(index / (sizeX * sizeY));
+      const float3 value = sample(grid, item, x, y, z);
+      if (maxComponent(value) > 0.0f) {
+        addVoxel(grid, bricks, x, y, z, value);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+  // Host helpers
+  //--------------------------------------------------------------------------//
+
+  //! \returns False if err is an error, with its description in error
+  bool check(const cudaError_t err, std::string &error)
+  {
+    if (err != cudaSuccess) {
+      error = cudaGetErrorString(err);
+      return false;
+    }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies host data to a new device array
+  template <typename T>
+  bool upload(const T *data, const size_t count, T *&result,
+              std::string &error)
+  {
+    result = NULL;
+    if (count == 0) {
+      return true;
+    }
+    return check(cudaMalloc(&result, count * sizeof(T)), error) &&
+      check(cudaMemcpy(result, data, count * sizeof(T),
+                       cudaMemcpyHostToDevice), error);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Splits the boxes of the items into chunks
+  template <typename Item_T>
+  std::vector<Chunk> chunks(const Item_T *items, const size_t numItems)
+  {
+    std::vector<Chunk> result;
+    for (size_t i = 0; i < numItems; ++i) {
+      const Item_T &item = items[i];
+      unsigned long long count = 1;
+      for (int dim = 0; dim < 3; ++dim) {
+        count *= item.boxMax[dim] - item.boxMin[dim] + 1;
+      }
+      Chunk chunk;
+      chunk.item = static_cast<int>(i);
+      for (chunk.first = 0; chunk.first < count;
+           chunk.first += k_voxelsPerChunk) {
+        result.push_back(chunk);
+      }
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Uploads the items and launches rasterizeItems() for them. The device
+  //! arrays are added to allocs, so that the caller can free them once the
+  //! kernel is done.
+  template <typename Item_T>
+  bool launch(const Grid &grid, float *bricks, const Item_T *items,
+              const size_t numItems, std::vector<void*> &allocs,
+              std::string &error)
+  {
+    if (numItems == 0) {
+      return true;
+    }
+    const std::vector<Chunk> itemChunks = chunks(items, numItems);
+    Item_T *deviceItems  = NULL;
+    Chunk  *deviceChunks = NULL;
+    const bool isUploaded =
+      upload(items, numItems, deviceItems, error) &&
+      upload(&itemChunks[0], itemChunks.size(), deviceChunks, error);
+    allocs.push_back(deviceItems);
+    allocs.push_back(deviceChunks);
+    if (!isUploaded) {
+      return false;
+    }
+    rasterizeItems<Item_T><<<static_cast<unsigned int>(itemChunks.size()),
+                     k_threadsPerBlock>>>
+      (grid, bricks, deviceItems, deviceChunks);
+    return check(cudaGetLastError(), error);
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+namespace Prim {
+namespace Rast {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int numDevices()
+{
+  int count = 0;
+  if (cudaGetDeviceCount(&count) != cudaSuccess) {
+    // Clear the error, so that it isn't reported by later calls
+    cudaGetLastError();
+    return 0;
+  }
+  return count;
+}
+
+//----------------------------------------------------------------------------//
+
+bool rasterize(const Grid &grid,
+               const Splat *splats, const size_t numSplats,
+               const Sphere *spheres, const size_t numSpheres,
+               const PyroPoint *pyroPoints, const size_t numPyroPoints,
+               float *bricks, std::string &error)
+{
+  if (grid.numBricks == 0) {
+    return true;
+  }
+
+  const size_t numBlocks = static_cast<size_t>(grid.blockRes[0]) *
+    grid.blockRes[1] * grid.blockRes[2];
+  const size_t brickBytes = static_cast<size_t>(grid.blockSize) *
+    grid.blockSize * grid.blockSize * 3 * sizeof(float);
+
+  std::vector<void*> allocs;
+  Grid               deviceGrid = grid;
+  int               *blockBricks = NULL;
+  float             *deviceBricks = NULL;
+  Splat             *deviceSplats = NULL;
+
+  bool isDone =
+    upload(grid.blockBricks, numBlocks, blockBricks, error) &&
+    check(cudaMalloc(&deviceBricks, grid.numBricks * brickBytes), error) &&
+    check(cudaMemset(deviceBricks, 0, grid.numBricks * brickBytes), error) &&
+    upload(splats, numSplats, deviceSplats, error);
+  allocs.push_back(blockBricks);
+  allocs.push_back(deviceBricks);
+  allocs.push_back(deviceSplats);
+  deviceGrid.blockBricks = blockBricks;
+
+  if (isDone && numSplats > 0) {
+    const int numThreadBlocks = static_cast<int>
+      ((numSplats + k_threadsPerBlock - 1) / k_threadsPerBlock);
+    splatPoints<<<numThreadBlocks, k_threadsPerBlock>>>
+      (deviceGrid, deviceBricks, deviceSplats, static_cast<int>(numSplats));
+    isDone = check(cudaGetLastError(), error);
+  }
+
+  isDone = isDone &&
+    launch(deviceGrid, deviceBricks, spheres, numSpheres, allocs, error) &&
+    launch(deviceGrid, deviceBricks, pyroPoints, numPyroPoints, allocs,
+           error) &&
+    check(cudaMemcpy(bricks, deviceBricks, grid.numBricks * brickBytes,
+                     cudaMemcpyDeviceToHost), error);
+
+  // cudaFree() waits for the kernels, and ignores null pointers
+  for (size_t i = 0, size = allocs.size(); i < size; ++i) {
+    cudaFree(allocs[i]);
+  }
+  return isDone;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Rast
+} // namespace Prim
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,305 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuSplatting.cpp
+  Contains implementations of the host side of GPU point rasterization.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Primitives/Rasterization/GpuSplatting.h"
+
+#ifdef PVR_USE_CUDA
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+
+#include <Field3D/FieldMapping.h>
+
+// Project includes
+
+#include "pvr/Math.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+  using namespace pvr::Model::Prim::Rast;
+
+  //--------------------------------------------------------------------------//
+
+  //! Block size used on the device for dense buffers
+  const int k_denseBlockSize = 16;
+
+  //--------------------------------------------------------------------------//
+
+  //! Marks the blocks that the voxels from min to max touch
+  void markBlocks(const Gpu::Grid &grid, const Imath::V3i &min,
+                  const Imath::V3i &max, std::vector<int> &blockBricks)
+  {
+    Imath::V3i first, last;
+    for (int dim = 0; dim < 3; ++dim) {
+      const int lo = std::max(min[dim], grid.dataMin[dim]);
+      const int hi = std::min(max[dim], grid.dataMax[dim]);
+      if (lo > hi) {
+        return;
+      }
+      first[dim] = (lo - grid.dataMin[dim]) / grid.blockSize;
+      last[dim]  = (hi - grid.dataMin[dim]) / grid.blockSize;
+    }
+    for (int k = first.z; k <= last.z; ++k) {
+      for (int j = first.y; j <= last.y; ++j) {
+        for (int i = first.x; i <= last.x; ++i) {
+          blockBricks[(k * grid.blockRes[1] + j) * grid.blockRes[0] + i] = 0;
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Voxels that a splat writes to
+  void splatVoxels(const Gpu::Splat &splat, Imath::V3i &min, Imath::V3i &max)
+  {
+    for (int dim = 0; dim < 3; ++dim) {
+      if (splat.antialiased) {
+        min[dim] = static_cast<int>(std::floor(splat.vsP[dim] - 0.5f));
+        max[dim] = min[dim] + 1;
+      } else {
+        min[dim] = max[dim] = static_cast<int>(std::floor(splat.vsP[dim]));
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <typename Item_T>
+  void markItems(const Gpu::Grid &grid, const std::vector<Item_T> &items,
+                 std::vector<int> &blockBricks)
+  {
+    BOOST_FOREACH (const Item_T &item, items) {
+      markBlocks(grid, Imath::V3i(item.boxMin[0], item.boxMin[1],
+                                  item.boxMin[2]),
+                 Imath::V3i(item.boxMax[0], item.boxMax[1], item.boxMax[2]),
+                 blockBricks);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <typename T>
+  const T* data(const std::vector<T> &v)
+  { return v.empty() ? NULL : &v[0]; }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+namespace Prim {
+namespace Rast {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+bool isSupported(VoxelBuffer::Ptr buffer, std::string &reason)
+{
+  MatrixFieldMapping::Ptr mapping =
+    field_dynamic_cast<MatrixFieldMapping>(buffer->mapping());
+  if (!mapping || mapping->localToWorldSamples().size() != 1) {
+    reason = "the buffer doesn't have a static MatrixFieldMapping";
+    return false;
+  }
+  if (numDevices() == 0) {
+    reason = "no CUDA device found";
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool itemBox(VoxelBuffer::Ptr buffer, const BBox &vsBounds,
+             int boxMin[3], int boxMax[3])
+{
+  DiscreteBBox box = Math::discreteBounds(vsBounds);
+  box.min -= Imath::V3i(1);
+  box.max += Imath::V3i(1);
+  box = Math::clipBounds(box, buffer->dataWindow());
+  if (box.isEmpty()) {
+    return false;
+  }
+  for (int dim = 0; dim < 3; ++dim) {
+    boxMin[dim] = box.min[dim];
+    boxMax[dim] = box.max[dim];
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool rasterize(VoxelBuffer::Ptr buffer,
+               const std::vector<Splat> &splats,
+               const std::vector<Sphere> &spheres,
+               const std::vector<PyroPoint> &pyroPoints,
+               std::string &error)
+{
+  FieldMapping::Ptr  mapping    = buffer->mapping();
+  const DiscreteBBox dataWindow = buffer->dataWindow();
+  if (dataWindow.isEmpty()) {
+    return true;
+  }
+
+  Grid grid;
+
+  // Mappings are affine, so the rows are the images of the unit vectors
+  Vector wsOrigin;
+  mapping->voxelToWorld(Vector(0.0), wsOrigin);
+  for (int i = 0; i < 3; ++i) {
+    Vector vsAxis(0.0), wsAxis;
+    vsAxis[i] = 1.0;
+    mapping->voxelToWorld(vsAxis, wsAxis);
+    toDevice(wsAxis - wsOrigin, grid.vsToWs[i]);
+  }
+
+  // Sparse buffers keep their own blocks, so that each device brick maps
+  // to one of them
+  grid.blockSize = k_denseBlockSize;
+  if (SparseBuffer *sparse = dynamic_cast<SparseBuffer *>(buffer.get())) {
+    grid.blockSize = sparse->blockSize();
+  }
+  size_t numBlocks = 1;
+  for (int dim = 0; dim < 3; ++dim) {
+    grid.dataMin[dim]  = dataWindow.min[dim];
+    grid.dataMax[dim]  = dataWindow.max[dim];
+    grid.blockRes[dim] =
+      (dataWindow.max[dim] - dataWindow.min[dim] + grid.blockSize) /
+      grid.blockSize;
+    numBlocks *= grid.blockRes[dim];
+  }
+
+  // Find the blocks that the items touch, and give each a brick
+  std::vector<int> blockBricks(numBlocks, -1);
+  BOOST_FOREACH (const Splat &splat, splats) {
+    Imath::V3i min, max;
+    splatVoxels(splat, min, max);
+    markBlocks(grid, min, max, blockBricks);
+  }
+  markItems(grid, spheres, blockBricks);
+  markItems(grid, pyroPoints, blockBricks);
+  grid.numBricks = 0;
+  BOOST_FOREACH (int &brick, blockBricks) {
+    if (brick == 0) {
+      brick = static_cast<int>(grid.numBricks++);
+    }
+  }
+  grid.blockBricks = &blockBricks[0];
+
+  const size_t brickSize =
+    static_cast<size_t>(grid.blockSize) * grid.blockSize * grid.blockSize;
+  std::vector<float> bricks(grid.numBricks * brickSize * 3);
+  if (!Gpu::rasterize(grid, data(splats), splats.size(),
+                      data(spheres), spheres.size(),
+                      data(pyroPoints), pyroPoints.size(),
+                      bricks.empty() ? NULL : &bricks[0], error)) {
+    return false;
+  }
+
+  // Add the bricks to the buffer. The buffer may hold data already.
+  for (int bk = 0; bk < grid.blockRes[2]; ++bk) {
+    for (int bj = 0; bj < grid.blockRes[1]; ++bj) {
+      for (int bi = 0; bi < grid.blockRes[0]; ++bi) {
+        const int brick =
+          blockBricks[(bk * grid.blockRes[1] + bj) * grid.blockRes[0] + bi];
+        if (brick < 0) {
+          continue;
+        }
+        const Imath::V3i first = dataWindow.min +
+          Imath::V3i(bi, bj, bk) * grid.blockSize;
+        const Imath::V3i last(std::min(first.x + grid.blockSize - 1,
+                                       dataWindow.max.x),
+                              std::min(first.y + grid.blockSize - 1,
+                                       dataWindow.max.y),
+                              std::min(first.z + grid.blockSize - 1,
+                                       dataWindow.max.z));
+        const float *values = &bricks[static_cast<size_t>(brick) * 
+                                      brickSize * 3];
+        for (int k = first.z; k <= last.z; ++k) {
+          for (int j = first.y; j <= last.y; ++j) {
+            for (int i = first.x; i <= last.x; ++i) {
+              const size_t index =
+                ((k - first.z) * grid.blockSize + (j - first.y)) *
+                grid.blockSize + (i - first.x);
+              const Imath::V3f value(values[index * 3 + 0],
+                                     values[index * 3 + 1],
+                                     values[index * 3 + 2]);
+              if (value != Imath::V3f(0.0f)) {
+                buffer->lvalue(i, j, k) += value;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Rast
+} // namespace Prim
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
@@ -33,10 +33,15 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 // Library includes
 
 // Project includes
 
+#include "pvr/AttrChannels.h"
 #include "pvr/RenderGlobals.h"
 #include "pvr/Interrupt.h"
 #include "pvr/Log.h"
@@ -62,20 +67,44 @@ namespace Rast {
 // Line
 //----------------------------------------------------------------------------//
 
-void Line::getSample(const RasterizationState &state,
+float Line::wsFeatureSize(Geo::Geometry::CPtr geometry) const
+{
+  Polygons::CPtr polys = geometry->polygons();
+  if (!polys || polys->pointAttrs().size() == 0) {
+    return 0.0f;
+  }
+
+  const PointAttrState attrs;
+  AttrChannels         channels(polys->pointAttrs(), m_params);
+  channels.add(attrs.radius);
+
+  const AttrChannels::Span radius    = channels.span(attrs.radius.name());
+  float                    minRadius = std::numeric_limits<float>::max();
+  for (size_t i = 0, size = channels.size(); i < size; ++i) {
+    minRadius = std::min(minRadius, std::abs(radius[i]));
+  }
+  return minRadius;
+}
+
+//----------------------------------------------------------------------------//
+
+void Line::getSample(const RasterizationContext &rContext,
+                     const RasterizationState &state,
                      RasterizationSample &sample) const
 {
-  if (m_basePointAttrs.size() < 2) {
+  const Context &context = static_cast<const Context &>(rContext);
+
+  if (context.basePointAttrs.size() < 2) {
     return;
   }
 
   SegmentInfo info;
 
-  if (findClosestSegment(state, info)) {
+  if (findClosestSegment(context, state, info)) {
 
     // Compute falloff depending on whether we want antialiasing
     float falloff;
-    if (m_basePolyAttrs.antialiased.value()) {
+    if (context.basePolyAttrs.antialiased.value()) {
       float halfWidth = state.wsVoxelSize.length() * 0.5;
       falloff = 1.0 - Math::smoothStep(info.distance, 
                                        info.radius - halfWidth, 
@@ -85,8 +114,8 @@ void Line::getSample(const RasterizationState &state,
     }
 
     // Set values in RasterizationSample
-    sample.value      = falloff * LINE_INTERP(density, info);
-    sample.wsVelocity = LINE_INTERP(wsVelocity, info);
+    sample.value      = falloff * LINE_INTERP(context, density, info);
+    sample.wsVelocity = LINE_INTERP(context, wsVelocity, info);
 
   }
 }
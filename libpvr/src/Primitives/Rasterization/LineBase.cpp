@@ -38,7 +38,6 @@
 // Project includes
 
 #include "pvr/RenderGlobals.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/ModelingUtils.h"
 
@@ -50,7 +49,10 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
-
+  //! Largest resolution of the segment grid, which keeps cell indices 
+  //! within 64 bits. The grid only stores occupied cells, so memory doesn't
+  //! depend on the resolution.
+  const size_t k_maxGridRes = 1 << 20;
 
   //--------------------------------------------------------------------------//
 
@@ -78,185 +80,273 @@ namespace Rast {
 // LineBase
 //----------------------------------------------------------------------------//
 
-BBox LineBase::wsBounds(Geo::Geometry::CPtr geometry) const
+void LineBase::itemWsBounds(Geo::Geometry::CPtr geometry, 
+                            const size_t firstPoly, const size_t lastPoly,
+                            RasterizationContext &rContext, 
+                            Imath::Box3f *bounds) const
 {
   typedef AttrVisitor::const_iterator AttrIter;
 
   assert(geometry != NULL);
   assert(geometry->polygons() != NULL);
 
-  if (!geometry->polygons()) {
-    Log::warning("Line primitive(s) have no polygons. "
-                 "Skipping bounds generation.");
-    return BBox();
-  }
-
   // Iteration variables
-  BBox           wsBBox;
   Polygons::CPtr polys = geometry->polygons();
   AttrVisitor    polyVisitor(polys->polyAttrs(), m_params);
   AttrVisitor    pointVisitor(polys->pointAttrs(), m_params);
 
-  for (AttrIter iPoly = polyVisitor.begin(), endPoly = polyVisitor.end(); 
-       iPoly != endPoly; ++iPoly) {
+  Context &context = static_cast<Context &>(rContext);
+
+  AttrIter iPoly = polyVisitor.begin(firstPoly);
+  for (size_t poly = firstPoly; poly < lastPoly; ++poly, ++iPoly) {
     // Update poly attributes
-    updatePolyAttrs(iPoly);
+    updatePolyAttrs(iPoly, context);
     // Update point attribute
     size_t first = polys->pointForVertex(iPoly.index(), 0);
     size_t numPoints = polys->numVertices(iPoly.index());
-    updatePointAttrs(pointVisitor.begin(first), numPoints);
+    updatePointAttrs(pointVisitor.begin(first), numPoints, context);
     // Compute world-space bounds
+    BBox   wsBBox;
     size_t index = 0;
-    for (std::vector<PointAttrState>::const_iterator i = m_basePointAttrs.begin(),
-           end = m_basePointAttrs.end(); i != end; ++i, ++index) {
+    for (std::vector<PointAttrState>::const_iterator 
+           i = context.basePointAttrs.begin(),
+           end = context.basePointAttrs.end(); i != end; ++i, ++index) {
       Vector radius      = Vector(i->radius.value());
-      float displacement = displacementBounds(index);
+      float displacement = displacementBounds(index, context);
       Vector wsV         = i->wsVelocity.value();
       Vector wsP         = i->wsCenter.value();
       Vector wsEnd       = wsP + wsV * RenderGlobals::dt();
       wsBBox = extendBounds(wsBBox, wsP, radius * (1.0 + displacement));
       wsBBox = extendBounds(wsBBox, wsEnd, radius * (1.0 + displacement));
     }
+    bounds[poly - firstPoly] = Imath::Box3f(wsBBox.min, wsBBox.max);
   }
-
-  return wsBBox;
 }
   
 //----------------------------------------------------------------------------//
 
-void LineBase::execute(Geo::Geometry::CPtr geometry, 
-                                         VoxelBuffer::Ptr buffer) const
+RasterizationContext::Ptr LineBase::createContext() const
 {
-  using namespace Field3D;
-  using namespace std;
-  
-  typedef AttrVisitor::const_iterator AttrIter;
+  return RasterizationContext::Ptr(new Context);
+}
+
+//----------------------------------------------------------------------------//
+
+size_t LineBase::numItems(Geo::Geometry::CPtr geometry) const
+{
+  Polygons::CPtr polys = geometry->polygons();
+
+  if (!polys) {
+    Log::warning("Line primitive - no polygons in input");
+    return 0;
+  }
 
-  Polygons::CPtr   polys  = geometry->polygons();
   const AttrTable &points = polys->pointAttrs();
   
   // Check for P attribute - all other attributes can be defaults
   if (!points.vectorAttrRef("P").isValid()) {
     Log::warning("Line primitive - no P attribute in input");
-    return;
+    return 0;
   }
 
-  Log::print("Line primitive processing " + 
-             str(polys->polyAttrs().size()) + " input polys, " + 
-             str(points.size()) + " points");
+  return polys->polyAttrs().size();
+}
 
-  // Iteration variables
-  size_t           count = 0;
-  Timer            timer;
-  ProgressReporter progress(2.5f, "  ");
-  AttrVisitor      polyVisitor(polys->polyAttrs(), m_params);
-  AttrVisitor      pointVisitor(polys->pointAttrs(), m_params);
-  
-  for (AttrIter iPoly = polyVisitor.begin(), endPoly = polyVisitor.end(); 
-       iPoly != endPoly; ++iPoly, ++count) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(static_cast<float>(count) / polys->polyAttrs().size());
-    // Update attributes
-    updatePolyAttrs(iPoly);
-    size_t first = polys->pointForVertex(iPoly.index(), 0);
-    size_t numPoints = polys->numVertices(iPoly.index());
-    updatePointAttrs(pointVisitor.begin(first), numPoints);
-    // Compute voxel-space bounds
-    BBox vsBounds;
-    // Loop over each point
-    size_t ptIndex = 0;
-    for (std::vector<PointAttrState>::const_iterator i = m_basePointAttrs.begin(),
-           end = m_basePointAttrs.end(); i != end; ++i, ++ptIndex) {
-      float displ = displacementBounds(ptIndex);
-      vsBounds.extendBy(vsSphereBounds(buffer->mapping(), i->wsCenter.value(), 
-                                       i->radius.value() * (1.0 + displ)));
+//----------------------------------------------------------------------------//
+
+BBox LineBase::updateItem(Geo::Geometry::CPtr geometry, 
+                          Field3D::FieldMapping::Ptr mapping, 
+                          const size_t item,
+                          RasterizationContext &rContext) const
+{
+  Context &context = static_cast<Context &>(rContext);
+
+  Polygons::CPtr polys = geometry->polygons();
+  AttrVisitor    polyVisitor(polys->polyAttrs(), m_params);
+  AttrVisitor    pointVisitor(polys->pointAttrs(), m_params);
+
+  // Update attributes
+  updatePolyAttrs(polyVisitor.begin(item), context);
+  size_t first = polys->pointForVertex(item, 0);
+  size_t numPoints = polys->numVertices(item);
+  updatePointAttrs(pointVisitor.begin(first), numPoints, context);
+  // Compute voxel-space bounds, with and without motion
+  BBox vsBounds;
+  context.vsBounds = BBox();
+  context.hasMotion = false;
+  // Loop over each point
+  size_t ptIndex = 0;
+  for (std::vector<PointAttrState>::const_iterator 
+         i = context.basePointAttrs.begin(),
+         end = context.basePointAttrs.end(); i != end; ++i, ++ptIndex) {
+    float  displ  = displacementBounds(ptIndex, context);
+    float  radius = i->radius.value() * (1.0 + displ);
+    Vector wsV    = i->wsVelocity.value();
+    Vector wsP    = i->wsCenter.value();
+    context.vsBounds.extendBy(vsSphereBounds(mapping, wsP, radius));
+    if (wsV.length2() > 0.0) {
+      context.hasMotion = true;
+      vsBounds.extendBy(vsSphereBounds(mapping, wsP + wsV * RenderGlobals::dt(),
+                                       radius));
     }
-    // Update acceleration structure
-    updateAccelStruct();
-    // Finally rasterize
-    rasterize(vsBounds, buffer);
   }
+  vsBounds.extendBy(context.vsBounds);
+  return vsBounds;
+}
 
-  Log::print("  Time elapsed: " + str(timer.elapsed()));
+//----------------------------------------------------------------------------//
+
+void LineBase::rasterizeItem(VoxelBuffer::Ptr buffer, 
+                             RasterizationContext &rContext) const
+{
+  Context &context = static_cast<Context &>(rContext);
+  // Update acceleration structure
+  updateAccelStruct(context);
+  // Bound each segment's capsule separately. The bounds of a long curve as
+  // a whole are mostly empty.
+  Field3D::FieldMapping::Ptr mapping = buffer->mapping();
+  context.segmentVsBounds.clear();
+  for (size_t i = 0, size = context.basePointAttrs.size(); i + 1 < size; 
+       ++i) {
+    const PointAttrState &p0 = context.basePointAttrs[i];
+    const PointAttrState &p1 = context.basePointAttrs[i + 1];
+    const float displ = std::max(displacementBounds(i, context), 
+                                 displacementBounds(i + 1, context));
+    BBox vsBounds = vsSphereBounds(mapping, p0.wsCenter.value(), 
+                                   p0.radius.value() * (1.0 + displ));
+    vsBounds.extendBy(vsSphereBounds(mapping, p1.wsCenter.value(), 
+                                     p1.radius.value() * (1.0 + displ)));
+    context.segmentVsBounds.push_back(vsBounds);
+  }
+  // Finally rasterize
+  rasterize(context.segmentVsBounds, buffer, context);
 }
 
 //----------------------------------------------------------------------------//
 
-void LineBase::updateAccelStruct() const
+void LineBase::updateAccelStruct(Context &context) const
 {
-  // Compute bounds and average radius
+  // Build BVH if requested. Capsules reach as far as their displacement.
+  if (context.basePolyAttrs.useBvh.value()) {
+    context.bvhAccel.clear();
+    for (size_t i = 0, size = context.basePointAttrs.size() - 1; i < size; 
+         ++i) {
+      Vector p0(context.basePointAttrs[i].wsCenter.value());
+      Vector p1(context.basePointAttrs[i + 1].wsCenter.value());
+      float  r0 = context.basePointAttrs[i].radius.value();
+      float  r1 = context.basePointAttrs[i + 1].radius.value();
+      float  displ = std::max(displacementBounds(i, context), 
+                              displacementBounds(i + 1, context));
+      context.bvhAccel.addCapsule(p0, p1, r0, r1, 
+                                  std::max(r0, r1) * (1.0 + displ), i);
+    }
+    context.bvhAccel.build();
+    return;
+  }
+  // Compute bounds, average radius and average segment length
   BBox wsBounds;
   double sumRadius = 0.0;
-  for (size_t i = 0, size =  m_basePointAttrs.size() - 1; i < size; ++i) {
-    float radius = m_basePointAttrs[i].radius;
-    wsBounds = extendBounds(wsBounds, m_basePointAttrs[i].wsCenter.value(),
+  double sumLength = 0.0;
+  for (size_t i = 0, size = context.basePointAttrs.size() - 1; i < size; 
+       ++i) {
+    float radius = context.basePointAttrs[i].radius;
+    wsBounds = extendBounds(wsBounds, 
+                            context.basePointAttrs[i].wsCenter.value(),
                             radius);
     sumRadius += radius;
+    sumLength += (context.basePointAttrs[i + 1].wsCenter.value() - 
+                  context.basePointAttrs[i].wsCenter.value()).length();
   }
-  double avgRadius = sumRadius / m_basePointAttrs.size();
-  // Update acceleration structure domain
+  double avgRadius = sumRadius / context.basePointAttrs.size();
+  double avgLength = context.basePointAttrs.size() > 1 ? 
+    sumLength / (context.basePointAttrs.size() - 1) : 0.0;
+  // Update acceleration structure domain. Cells the size of a segment, or
+  // of the radius for thick curves, hold a few segments each, and each
+  // segment only reaches a few cells. The grid only stores those cells, so
+  // memory follows the segment count rather than the curve's extent.
   //! \todo Cellsize should never be < 2 * buffer's voxel size
   Vector origin = wsBounds.min;
-  size_t res = 32;
-  Vector voxelSize = wsBounds.size() / static_cast<double>(res);
-  float cellSize = max(voxelSize);
-  if (cellSize < avgRadius) {
-    res = std::ceil(max(wsBounds.size()) / avgRadius);
-    cellSize = avgRadius;
+  double extent = max(wsBounds.size());
+  double cellSize = std::max(avgLength, avgRadius);
+  size_t res = 1;
+  if (cellSize > 0.0) {
+    res = std::min(static_cast<size_t>(std::ceil(extent / cellSize)), 
+                   k_maxGridRes);
+    res = std::max(res, static_cast<size_t>(1));
+  }
+  cellSize = std::max(cellSize, extent / res);
+  if (cellSize <= 0.0) {
+    cellSize = 1.0;
   }
-  m_gridAccel.clear(cellSize, res, origin);
+  context.gridAccel.clear(cellSize, res, origin);
   // Add line segments to hash
-  for (size_t i = 0, size = m_basePointAttrs.size() - 1; i < size; ++i) {
-    Vector p0(m_basePointAttrs[i].wsCenter.value());
-    Vector p1(m_basePointAttrs[i + 1].wsCenter.value());
-    float displ = std::max(displacementBounds(i), displacementBounds(i + 1));
-    float radius = std::max(m_basePointAttrs[i].radius.value(),
-                            m_basePointAttrs[i + 1].radius.value());
-    m_gridAccel.addLine(p0, p1, radius * (1.0 + displ) + cellSize, i);
+  for (size_t i = 0, size = context.basePointAttrs.size() - 1; i < size; 
+       ++i) {
+    Vector p0(context.basePointAttrs[i].wsCenter.value());
+    Vector p1(context.basePointAttrs[i + 1].wsCenter.value());
+    float displ = std::max(displacementBounds(i, context), 
+                           displacementBounds(i + 1, context));
+    float radius = std::max(context.basePointAttrs[i].radius.value(),
+                            context.basePointAttrs[i + 1].radius.value());
+    context.gridAccel.addLine(p0, p1, radius * (1.0 + displ) + cellSize, i);
   }
+  context.gridAccel.build();
 }
 
 //----------------------------------------------------------------------------//
 
-bool LineBase::findClosestSegment(const RasterizationState &state, 
+bool LineBase::findClosestSegment(const Context &context,
+                                  const RasterizationState &state, 
                                   SegmentInfo &info) const
 {
-  typedef Accel::UniformGrid<size_t>::HashVec HashVec;
+  typedef Accel::UniformGrid<size_t>::Range Range;
 
   double minRelDist   = std::numeric_limits<double>::max();
   double t            = 0.0;
   double tExtend      = 0.0;
   double displacement = 0.0;
-  const HashVec &vec  = m_gridAccel.get(state.wsP);
+  // Find candidate segments. The BVH finds the single closest one directly.
+  Range  range;
+  size_t bvhIndex;
+  if (context.basePolyAttrs.useBvh.value()) {
+    double slack = state.wsVoxelSize.length() * 0.5;
+    if (!context.bvhAccel.closest(state.wsP, slack, bvhIndex, minRelDist)) {
+      return false;
+    }
+    range = Range(&bvhIndex, &bvhIndex + 1);
+    minRelDist = std::numeric_limits<double>::max();
+  } else {
+    range = context.gridAccel.get(state.wsP);
+  }
 
-  if (vec.size() == 0) {
+  if (range.empty()) {
     return false;
   }
 
-  for (HashVec::const_iterator iIdx = vec.begin(), end = vec.end();
+  for (Range::const_iterator iIdx = range.begin(), end = range.end();
        iIdx != end; ++iIdx) {
     // Segment index
     const size_t i = *iIdx;
     // Find closest point on Line
-    Vector p0(m_basePointAttrs[i].wsCenter.value());
-    Vector p1(m_basePointAttrs[i + 1].wsCenter.value());
+    Vector p0(context.basePointAttrs[i].wsCenter.value());
+    Vector p1(context.basePointAttrs[i + 1].wsCenter.value());
     Vector pOnLine = Math::closestPointOnLineSegment(p0, p1, state.wsP, 
                                                      t, tExtend);
     // Compare distance to radius
-    double radius = Math::fit01(t, m_basePointAttrs[i].radius.value(), 
-                                m_basePointAttrs[i + 1].radius.value());
+    double radius = Math::fit01(t, context.basePointAttrs[i].radius.value(), 
+                                context.basePointAttrs[i + 1].radius.value());
     double dist = (state.wsP - pOnLine).length();
     double relDist = dist / radius;
     // If within radius, update info
     if (relDist < minRelDist) {
       minRelDist = relDist;
-      displacement = std::max(displacementBounds(i), displacementBounds(i + 1));
+      displacement = std::max(displacementBounds(i, context), 
+                              displacementBounds(i + 1, context));
       info.radius = radius;
       info.distance = dist;
       info.index = i;
-      if (i == 0 && t == 0.0 || i == (m_basePointAttrs.size() - 2) && t == 1.0) {
+      if (i == 0 && t == 0.0 || 
+          i == (context.basePointAttrs.size() - 2) && t == 1.0) {
         info.t = tExtend;
       } else {
         info.t = t;
@@ -273,19 +363,20 @@ bool LineBase::findClosestSegment(const RasterizationState &state,
 //----------------------------------------------------------------------------//
 
 void LineBase::updatePolyAttrs
-(Geo::AttrVisitor::const_iterator i) const
+(Geo::AttrVisitor::const_iterator i, Context &context) const
 {
-  m_basePolyAttrs.update(i);
+  context.basePolyAttrs.update(i);
 }
 
 //----------------------------------------------------------------------------//
 
 void LineBase::updatePointAttrs
-(Geo::AttrVisitor::const_iterator iPoint, const size_t numPoints) const
+(Geo::AttrVisitor::const_iterator iPoint, const size_t numPoints,
+ Context &context) const
 {
-  m_basePointAttrs.resize(numPoints);
+  context.basePointAttrs.resize(numPoints);
   for (size_t i = 0; i < numPoints; ++i, ++iPoint) {
-    m_basePointAttrs[i].update(iPoint);
+    context.basePointAttrs[i].update(iPoint);
   }
 }
 
@@ -310,6 +401,7 @@ void LineBase::PolyAttrState::update
 (const Geo::AttrVisitor::const_iterator &i)
 {
   i.update(antialiased);
+  i.update(useBvh);
 }
 
 //----------------------------------------------------------------------------//
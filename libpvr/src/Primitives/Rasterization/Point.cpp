@@ -33,16 +33,21 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 // Library includes
 
 // Project includes
 
+#include "pvr/AttrChannels.h"
 #include "pvr/Geometry.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
 #include "pvr/ModelingUtils.h"
 #include "pvr/RenderGlobals.h"
+#include "pvr/Primitives/Rasterization/GpuSplatting.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -97,136 +102,381 @@ Point::Ptr Point::create()
 
 //----------------------------------------------------------------------------//
 
-void Point::execute(Geo::Geometry::CPtr geometry, 
-                    VoxelBuffer::Ptr buffer) const
+RasterizationContext::Ptr Point::createContext() const
 {
-  using namespace Field3D;
-  using namespace std;
-  
+  return RasterizationContext::Ptr(new Context);
+}
+
+//----------------------------------------------------------------------------//
+
+float Point::wsFeatureSize(Geo::Geometry::CPtr geometry) const
+{
+  if (!geometry->particles() || 
+      geometry->particles()->pointAttrs().size() == 0) {
+    return 0.0f;
+  }
+
+  const AttrState attrs;
+  AttrChannels    channels(geometry->particles()->pointAttrs(), m_params);
+  channels.add(attrs.radius);
+
+  const AttrChannels::Span radius    = channels.span(attrs.radius.name());
+  float                    minRadius = std::numeric_limits<float>::max();
+  for (size_t i = 0, size = channels.size(); i < size; ++i) {
+    minRadius = std::min(minRadius, std::abs(radius[i]));
+  }
+  return minRadius;
+}
+
+//----------------------------------------------------------------------------//
+
+void Point::computeItemWsBounds(Geo::Geometry::CPtr geometry,
+                                std::vector<Imath::Box3f> &bounds) const
+{
+  assert(geometry != NULL);
+
+  if (!geometry->particles()) {
+    Log::warning("Rasterization primitive has no particles. "
+                 "Skipping bounds generation.");
+    bounds.clear();
+    return;
+  }
+
+  const AttrTable &points = geometry->particles()->pointAttrs();
+  bounds.assign(points.size(), Imath::Box3f());
+  if (points.size() == 0) {
+    return;
+  }
+
+  // The AttrState supplies attribute names and defaults
+  const AttrState attrs;
+  AttrChannels    channels(points, m_params);
+  channels.add(attrs.wsCenter);
+  channels.add(attrs.wsVelocity);
+  channels.add(attrs.radius);
+
+  const float              dt     = RenderGlobals::dt();
+  const size_t             size   = channels.size();
+  const AttrChannels::Span radius = channels.span(attrs.radius.name());
+
+  // Each axis is independent, so handle one channel at a time
+  for (int dim = 0; dim < 3; ++dim) {
+    const AttrChannels::Span wsP = channels.span(attrs.wsCenter.name(), dim);
+    const AttrChannels::Span wsV = channels.span(attrs.wsVelocity.name(), dim);
+    for (size_t i = 0; i < size; ++i) {
+      const float wsEnd = wsP[i] + wsV[i] * dt;
+      const float r     = std::abs(radius[i]);
+      bounds[i].min[dim] = std::min(wsP[i], wsEnd) - r;
+      bounds[i].max[dim] = std::max(wsP[i], wsEnd) + r;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Point::numItems(Geo::Geometry::CPtr geometry) const
+{
+  if (!geometry->particles()) {
+    Log::warning("Point primitive - no particles in input");
+    return 0;
+  }
+
   const AttrTable &points = geometry->particles()->pointAttrs();
 
   if (!points.vectorAttrRef("P").isValid()) {
     Log::warning("Point primitive - no P attribute in input");
+    return 0;
+  }
+
+  return points.size();
+}
+
+//----------------------------------------------------------------------------//
+
+BBox Point::updateItem(Geo::Geometry::CPtr geometry, 
+                       Field3D::FieldMapping::Ptr mapping, 
+                       const size_t item,
+                       RasterizationContext &rContext) const
+{
+  Context   &context = static_cast<Context &>(rContext);
+  AttrState &attrs   = context.attrs;
+  Item      &point   = context.point;
+
+  // Update attributes
+  AttrVisitor visitor(geometry->particles()->pointAttrs(), m_params);
+  attrs.update(visitor.begin(item));
+  point.wsCenter    = attrs.wsCenter.as<Vector>();
+  point.wsVelocity  = attrs.wsVelocity.as<Vector>();
+  point.radius      = attrs.radius;
+  point.density     = attrs.density;
+  point.antialiased = attrs.antialiased;
+
+  return setupPoint(mapping, context);
+}
+
+//----------------------------------------------------------------------------//
+
+void Point::rasterizePoint(const Item &point, VoxelBuffer::Ptr buffer,
+                           RasterizationContext &rContext) const
+{
+  Context &context = static_cast<Context &>(rContext);
+
+  context.point = point;
+  if (setupPoint(buffer->mapping(), context).isEmpty()) {
     return;
   }
+  rasterizeItem(buffer, context);
+  flushItems(context);
+}
 
-  Timer             timer;
-  size_t            count = 0;
-  ProgressReporter  progress(2.5f, "  ");
-  FieldMapping::Ptr mapping(buffer->mapping());
-  AttrVisitor       visitor(points, m_params);
+//----------------------------------------------------------------------------//
 
-  Log::print("Point primitive processing " + str(points.size()) + 
-             " input points");
+void Point::queuePoint(const Item &point, VoxelBuffer::Ptr buffer,
+                       RasterizationContext &rContext) const
+{
+  Context &context = static_cast<Context &>(rContext);
 
-  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i, ++count) {
-
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(static_cast<float>(count) / points.size());
-    // Update attributes
-    m_attrs.update(i);
-    // Point attributes
-    const V3f    &density     = m_attrs.density;
-    const float   wsRadius    = m_attrs.radius;
-    const Vector  wsCenter    = m_attrs.wsCenter.as<Vector>();
-    const Vector  wsVelocity  = m_attrs.wsVelocity.as<Vector>();
-    const bool    antialiased = m_attrs.antialiased;
-    // Skip if density at or below zero
-    if (Math::max(density) <= 0.0) {
-      continue;
-    }
-    // Transform to voxel space
-    Vector vsP;
-    mapping->worldToVoxel(wsCenter, vsP);
-    // Determine relative size of the point, compared to the shortest
-    // edge of a voxel.
-    Vector wsVoxelSize = pvr::Model::wsVoxelSize(mapping, vsP);
-    double relativeSize = wsRadius / Math::min(wsVoxelSize);
-    
-    // Check relative size of point
-    if (relativeSize > 1.0) {
-
-      // If we're larger than a voxel, rasterize the point as a sphere
-    
-      // Calculate filter width
-      float filterWidth = wsVoxelSize.length();
-      // Calculate rasterization bounds
-      //! \bug Rasterization bounds do not include filter width
-      BBox vsBounds = 
-        vsSphereBounds(mapping, wsCenter, wsRadius + filterWidth * 0.5);
-      // Call rasterize(), which will query getSample() for values
-      rasterize(vsBounds, buffer);
+  context.point = point;
+  if (setupPoint(buffer->mapping(), context).isEmpty()) {
+    return;
+  }
+  rasterizeItem(buffer, context);
+}
 
-    } else {
+//----------------------------------------------------------------------------//
+
+void Point::flushPoints(RasterizationContext &context) const
+{
+  flushItems(context);
+}
+
+//----------------------------------------------------------------------------//
+
+void Point::rasterizeItem(VoxelBuffer::Ptr buffer, 
+                          RasterizationContext &rContext) const
+{
+  using namespace Field3D;
+  using namespace std;
 
-      // If we are smaller than a voxel we splat the point, 
-      // compensating for pscale by varying density.
-
-      // Account for voxel size
-      V3f voxelVolume = V3f(wsVoxelSize.x * wsVoxelSize.y * wsVoxelSize.z);
-      V3f voxelDensity = 
-        density / voxelVolume * sphereVolume(wsRadius);
-      // Write points
-      if (wsVelocity.length() == 0) {
-        if (antialiased) {
-          writeAntialiasedPoint(vsP, voxelDensity, buffer);
-        } else {
-          writePoint(vsP, voxelDensity, buffer);
-        }
+  Context &context = static_cast<Context &>(rContext);
+  const Item    &point   = context.point;
+
+  // Check relative size of point
+  if (context.isSphere) {
+
+    // If we're larger than a voxel, rasterize the point as a sphere
+    // Call rasterize(), which will query getSample() for values
+    rasterize(context.vsBounds, buffer, context);
+
+  } else {
+
+    // If we are smaller than a voxel we splat the point, 
+    // compensating for pscale by varying density.
+
+    const V3f          &density     = point.density;
+    const float         wsRadius    = point.radius;
+    const Vector       &wsCenter    = point.wsCenter;
+    const Vector       &wsVelocity  = point.wsVelocity;
+    const bool          antialiased = point.antialiased;
+    const Vector       &vsP         = context.vsP;
+    const Vector       &wsVoxelSize = context.wsVoxelSize;
+    const DiscreteBBox &window      = context.dvsWindow;
+
+    // Account for voxel size
+    V3f voxelVolume = V3f(wsVoxelSize.x * wsVoxelSize.y * wsVoxelSize.z);
+    V3f voxelDensity = 
+      density / voxelVolume * sphereVolume(wsRadius);
+    // Queue points. They get written by flushItems().
+    SplatWriter &splats = context.splats;
+    splats.setBuffer(buffer);
+    if (wsVelocity.length() == 0) {
+      splats.queuePoint(vsP, voxelDensity, antialiased, window);
+    } else {
+      Vector wsEnd = wsCenter + wsVelocity * RenderGlobals::dt();
+      Vector vsEnd;
+      buffer->mapping()->worldToVoxel(wsEnd, vsEnd);
+      if (antialiased) {
+        writeLine<true>(vsP, vsEnd, voxelDensity, splats, window);
       } else {
-        Vector wsEnd = wsCenter + wsVelocity * RenderGlobals::dt();
-        Vector vsEnd;
-        mapping->worldToVoxel(wsEnd, vsEnd);
-        if (antialiased) {
-          writeLine<true>(vsP, vsEnd, voxelDensity, buffer);
-        } else {
-          writeLine<false>(vsP, vsEnd, voxelDensity, buffer);
-        }
+        writeLine<false>(vsP, vsEnd, voxelDensity, splats, window);
       }
-
     }
 
   }
+}
+
+//----------------------------------------------------------------------------//
+
+void Point::flushItems(RasterizationContext &rContext) const
+{
+  static_cast<Context &>(rContext).splats.flush();
+}
+
+//----------------------------------------------------------------------------//
+
+#ifdef PVR_USE_CUDA
+
+bool Point::executeOnDevice(Geo::Geometry::CPtr geometry, 
+                            VoxelBuffer::Ptr buffer) const
+{
+  std::string reason;
+  if (!Gpu::isSupported(buffer, reason)) {
+    Log::warning("Point primitive can't be rasterized on the GPU: " + 
+                 reason + ". Using the CPU instead.");
+    return false;
+  }
+
+  Field3D::FieldMapping::Ptr mapping = buffer->mapping();
+  const AttrTable           &points  = geometry->particles()->pointAttrs();
+
+  Context     context;
+  AttrState  &attrs = context.attrs;
+  Item       &point = context.point;
+  AttrVisitor visitor(points, m_params);
+
+  // Attributes are resolved here, exactly as updateItem() does, and the 
+  // device only sees the setupPoint() results
+  std::vector<Gpu::Splat>  splats;
+  std::vector<Gpu::Sphere> spheres;
+  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
+       i != end; ++i) {
+    attrs.update(i);
+    point.wsCenter    = attrs.wsCenter.as<Vector>();
+    point.wsVelocity  = attrs.wsVelocity.as<Vector>();
+    point.radius      = attrs.radius;
+    point.density     = attrs.density;
+    point.antialiased = attrs.antialiased;
+    if (point.wsVelocity.length2() > 0.0) {
+      Log::warning("Point primitive can't rasterize moving points on the "
+                   "GPU. Using the CPU instead.");
+      return false;
+    }
+    if (setupPoint(mapping, context).isEmpty()) {
+      continue;
+    }
+    if (context.isSphere) {
+      Gpu::Sphere sphere;
+      if (!Gpu::itemBox(buffer, context.vsBounds, 
+                        sphere.boxMin, sphere.boxMax)) {
+        continue;
+      }
+      // Same filter width compensation as getSample()
+      const float halfWidth = 0.5 * context.wsVoxelSize.length();
+      const float factor = 1.0 / (1.0 + pow(halfWidth / point.radius, 3.0f));
+      sphere.wsOuterRadius = point.radius + halfWidth;
+      sphere.wsInnerRadius = 
+        (point.radius - halfWidth) / point.radius * sphere.wsOuterRadius;
+      Gpu::toDevice(context.vsP, sphere.vsCenter);
+      Gpu::toDevice(point.density * factor, sphere.density);
+      spheres.push_back(sphere);
+    } else {
+      // Same density compensation as rasterizeItem()
+      const Vector &wsVoxelSize = context.wsVoxelSize;
+      const V3f voxelVolume(wsVoxelSize.x * wsVoxelSize.y * wsVoxelSize.z);
+      Gpu::Splat splat;
+      Gpu::toDevice(context.vsP, splat.vsP);
+      Gpu::toDevice(point.density / voxelVolume * sphereVolume(point.radius),
+                    splat.value);
+      splat.antialiased = point.antialiased;
+      splats.push_back(splat);
+    }
+  }
+
+  Log::print(typeName() + " primitive rasterizing " + str(spheres.size()) + 
+             " spheres and " + str(splats.size()) + " splats on the GPU");
 
-  Log::print("  Time elapsed: " + str(timer.elapsed()));
+  if (!Gpu::rasterize(buffer, splats, spheres, 
+                      std::vector<Gpu::PyroPoint>(), reason)) {
+    Log::warning("Point primitive failed to rasterize on the GPU: " + 
+                 reason + ". Using the CPU instead.");
+    return false;
+  }
+  return true;
 }
 
+#endif // PVR_USE_CUDA
+
 //----------------------------------------------------------------------------//
 
-void Point::getSample(const RasterizationState &state,
+void Point::getSample(const RasterizationContext &context,
+                      const RasterizationState &state,
                       RasterizationSample &sample) const
 {
+  const Item &point = static_cast<const Context &>(context).point;
+
   float filterWidth = state.wsVoxelSize.length();
   float halfWidth = 0.5 * filterWidth;
-  float factor = 1.0 / (1.0 + pow(halfWidth / m_attrs.radius, 3.0f));
-  sample.value = evaluateSphere(state.wsP, m_attrs.wsCenter.as<Vector>(), 
-                                m_attrs.radius + halfWidth, 
-                                m_attrs.density.value() * factor, 
-                                (m_attrs.radius - halfWidth) / m_attrs.radius);
-  sample.wsVelocity = m_attrs.wsVelocity.as<Vector>();
+  float factor = 1.0 / (1.0 + pow(halfWidth / point.radius, 3.0f));
+  sample.value = evaluateSphere(state.wsP, point.wsCenter, 
+                                point.radius + halfWidth, 
+                                point.density * factor, 
+                                (point.radius - halfWidth) / point.radius);
+  sample.wsVelocity = point.wsVelocity;
 }
 
 //----------------------------------------------------------------------------//
 
-BBox Point::pointWsBounds(const Geo::AttrVisitor::const_iterator &i) const
+BBox Point::pointWsBounds(const Geo::AttrVisitor::const_iterator &i,
+                          RasterizationContext &context) const
 {
+  AttrState &attrs = static_cast<Context &>(context).attrs;
+
   BBox wsBBox;
   // Update point attrs
-  m_attrs.update(i);
+  attrs.update(i);
   // Pad to account for radius and motion
-  Vector wsStart = m_attrs.wsCenter.value();
-  Vector wsEnd = m_attrs.wsCenter.value() + 
-    m_attrs.wsVelocity.value() * RenderGlobals::dt();
-  wsBBox.extendBy(wsStart + m_attrs.radius.as<Vector>());
-  wsBBox.extendBy(wsStart - m_attrs.radius.as<Vector>());
-  wsBBox.extendBy(wsEnd + m_attrs.radius.as<Vector>());
-  wsBBox.extendBy(wsEnd - m_attrs.radius.as<Vector>());
+  Vector wsStart = attrs.wsCenter.value();
+  Vector wsEnd = attrs.wsCenter.value() + 
+    attrs.wsVelocity.value() * RenderGlobals::dt();
+  wsBBox.extendBy(wsStart + attrs.radius.as<Vector>());
+  wsBBox.extendBy(wsStart - attrs.radius.as<Vector>());
+  wsBBox.extendBy(wsEnd + attrs.radius.as<Vector>());
+  wsBBox.extendBy(wsEnd - attrs.radius.as<Vector>());
   return wsBBox;
 }
   
+//----------------------------------------------------------------------------//
+
+BBox Point::setupPoint(Field3D::FieldMapping::Ptr mapping, 
+                       Context &context) const
+{
+  const Item   &point      = context.point;
+  const float   wsRadius   = point.radius;
+  const Vector &wsCenter   = point.wsCenter;
+  const Vector &wsVelocity = point.wsVelocity;
+  // Skip if density at or below zero
+  if (Math::max(point.density) <= 0.0) {
+    return BBox();
+  }
+  // Transform to voxel space
+  mapping->worldToVoxel(wsCenter, context.vsP);
+  // Determine relative size of the point, compared to the shortest
+  // edge of a voxel.
+  context.wsVoxelSize = pvr::Model::wsVoxelSize(mapping, context.vsP);
+  context.hasMotion = wsVelocity.length2() > 0.0;
+  context.isSphere = wsRadius / Math::min(context.wsVoxelSize) > 1.0;
+  // Bounds at the start and end of the motion
+  Vector wsEnd = wsCenter + wsVelocity * RenderGlobals::dt();
+  Vector vsEnd;
+  mapping->worldToVoxel(wsEnd, vsEnd);
+  BBox vsBounds;
+  if (context.isSphere) {
+    // Calculate filter width
+    float filterWidth = context.wsVoxelSize.length();
+    // Calculate rasterization bounds
+    //! \bug Rasterization bounds do not include filter width
+    context.vsBounds = 
+      vsSphereBounds(mapping, wsCenter, wsRadius + filterWidth * 0.5);
+    vsBounds.extendBy(context.vsBounds);
+    vsBounds.extendBy(vsSphereBounds(mapping, wsEnd, 
+                                     wsRadius + filterWidth * 0.5));
+  } else {
+    vsBounds.extendBy(context.vsP);
+    vsBounds.extendBy(vsEnd);
+  }
+  return vsBounds;
+}
+
 //----------------------------------------------------------------------------//
 // Point::AttrState
 //----------------------------------------------------------------------------//
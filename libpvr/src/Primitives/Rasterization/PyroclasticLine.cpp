@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 // Project includes
@@ -42,6 +44,21 @@
 #include "pvr/Log.h"
 #include "pvr/ModelingUtils.h"
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of voxels whose noise is evaluated in one batch
+  const size_t k_noiseBatchSize = 64;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -52,14 +69,6 @@ using namespace pvr::Geo;
 using namespace pvr::Math;
 using namespace pvr::Noise;
 
-//----------------------------------------------------------------------------//
-// Defines
-//----------------------------------------------------------------------------//
-
-#define PYRO_LINE_INTERP(variable, info)                          \
-  Math::fit01(info.t, m_pointAttrs[info.index].variable.value(),  \
-              m_pointAttrs[info.index + 1].variable.value())      \
-
 //----------------------------------------------------------------------------//
 
 namespace pvr {
@@ -73,12 +82,21 @@ Vector lineWsToLs(const Vector &wsP, const Vector &wsE1, const Vector &wsE2,
                   const Vector &wsE3, const Vector &wsCenter, 
                   const float u, const float radius)
 {
-  // Build transform
-  Matrix lsToWs = Math::coordinateSystem(wsE1, wsE2, wsE3, wsCenter);
-  Matrix wsToLs = lsToWs.inverse();
-  // Compute coordinate
-  Vector lsP = wsP * wsToLs;
-  return Vector(lsP.x / radius, lsP.y / radius, u);
+  // Solve lsP * [e1 e2 e3] = wsP - wsCenter using Cramer's rule, which is 
+  // much cheaper than building and inverting the local-to-world matrix
+  const Vector e2CrossE3 = wsE2.cross(wsE3);
+  const double det       = wsE1.dot(e2CrossE3);
+  if (det == 0.0) {
+    // Degenerate frame. Fall back to the matrix inverse's behavior.
+    Matrix lsToWs = Math::coordinateSystem(wsE1, wsE2, wsE3, wsCenter);
+    Vector lsP    = wsP * lsToWs.inverse();
+    return Vector(lsP.x / radius, lsP.y / radius, u);
+  }
+  const Vector d     = wsP - wsCenter;
+  const double scale = 1.0 / (det * radius);
+  return Vector(d.dot(e2CrossE3) * scale, 
+                d.dot(wsE3.cross(wsE1)) * scale, 
+                u);
 }
 
 //----------------------------------------------------------------------------//
@@ -92,119 +110,198 @@ PyroclasticLine::Ptr PyroclasticLine::create()
 
 //----------------------------------------------------------------------------//
 
-void PyroclasticLine::getSample(const RasterizationState &state,
+RasterizationContext::Ptr PyroclasticLine::createContext() const
+{
+  return RasterizationContext::Ptr(new Context);
+}
+
+//----------------------------------------------------------------------------//
+
+void PyroclasticLine::getSample(const RasterizationContext &rContext,
+                                const RasterizationState &state,
                                 RasterizationSample &sample) const
 {
-  if (m_basePointAttrs.size() < 2) {
+  getSampleBatch(rContext, &state, &sample, 1);
+}
+
+//----------------------------------------------------------------------------//
+
+void PyroclasticLine::getSampleBatch(const RasterizationContext &rContext,
+                                     const RasterizationState *states,
+                                     RasterizationSample *samples,
+                                     const size_t n) const
+{
+  const Context &context = static_cast<const Context &>(rContext);
+
+  if (context.basePointAttrs.size() < 2) {
     return;
   }
 
   // Per-Polygon attribute
-  const bool    isPyroclastic = m_polyAttrs.pyroclastic;
-  const bool    isPyro2D      = m_polyAttrs.pyro2D;
-  const V3f     scale         = m_polyAttrs.scale;
-  Fractal::CPtr fractal       = m_polyAttrs.fractal;
-
-  SegmentInfo info;
-  
-  if (findClosestSegment(state, info)) {
-
-    // Interpolate values along line
-    sample.wsVelocity     = LINE_INTERP(wsVelocity, info);
-    Imath::V3f wsCenter   = LINE_INTERP(wsCenter, info);
-    Imath::V3f density    = LINE_INTERP(density, info);
-    Imath::V3f N          = PYRO_LINE_INTERP(wsNormal, info);
-    Imath::V3f T          = PYRO_LINE_INTERP(wsTangent, info);
-    float      u          = PYRO_LINE_INTERP(u, info);
-    float      gamma      = PYRO_LINE_INTERP(gamma, info);
-    float      amplitude  = PYRO_LINE_INTERP(amplitude, info);
-
-    // Transform to local space
-    Vector lsP = lineWsToLs(state.wsP, N.cross(T), N, T, 
-                            wsCenter, u, info.radius);
-
-    // Normalize the length of the vector in the XY plane
-    // if user wants "2D" style displacement.
-    if (isPyroclastic && isPyro2D) {
-      lsP = Math::normalizeXY(lsP);
+  const bool    isPyroclastic = context.polyAttrs.pyroclastic;
+  const bool    isPyro2D      = context.polyAttrs.pyro2D;
+  const V3f     scale         = context.polyAttrs.scale;
+  Fractal::CPtr fractal       = context.polyAttrs.fractal;
+  const Segments &segments    = context.segments;
+  // The noise space footprint is widest along the axis of smallest scale
+  const float   minScale      = Math::min(scale);
+
+  // Per-voxel state of the voxels that hit a segment
+  size_t      indices[k_noiseBatchSize];
+  SegmentInfo infos[k_noiseBatchSize];
+  V3f         densities[k_noiseBatchSize];
+  float       gammas[k_noiseBatchSize];
+  float       amplitudes[k_noiseBatchSize];
+  V3f         nsP[k_noiseBatchSize];
+  float       filterWidths[k_noiseBatchSize];
+  float       fractalVals[k_noiseBatchSize];
+
+  for (size_t first = 0; first < n; first += k_noiseBatchSize) {
+    const size_t last  = std::min(n, first + k_noiseBatchSize);
+    size_t       count = 0;
+
+    // Find the closest segment of each voxel
+    for (size_t v = first; v < last; ++v) {
+      SegmentInfo &info = infos[count];
+      info = SegmentInfo();
+      if (findClosestSegment(context, states[v], info)) {
+        indices[count] = v;
+        ++count;
+      }
     }
 
-    // Transform to noise space
-    Vector nsP = lsP / scale;
-
-    // Evaluate fractal
-    double fractalVal = fractal->eval(nsP);
-    fractalVal = Math::gamma(fractalVal, gamma);
-    fractalVal *= amplitude;
-
-    // Calculate sample value
-    if (isPyroclastic) {
-      float  filterWidth  = state.wsVoxelSize.length() / info.radius;
-      double distanceFunc = info.distance / info.radius - 1.0;
-      float  pyro         = pyroclastic(distanceFunc, fractalVal, filterWidth);
-      sample.value        = pyro * density;
-    } else {
-      double distanceFunc = 1.0 - info.distance / info.radius;
-      float  noise        = std::max(0.0, distanceFunc + fractalVal);
-      sample.value        = noise * density;
+    // Interpolate the segment attributes and compute noise coordinates
+    for (size_t i = 0; i < count; ++i) {
+      const RasterizationState &state = states[indices[i]];
+      const size_t              seg   = infos[i].index;
+      const float               t     = infos[i].t;
+      samples[indices[i]].wsVelocity  = segments.wsVelocity.eval(seg, t);
+      const V3f   wsCenter = segments.wsCenter.eval(seg, t);
+      const V3f   N        = segments.wsNormal.eval(seg, t);
+      const V3f   T        = segments.wsTangent.eval(seg, t);
+      const float u        = segments.u.eval(seg, t);
+      densities[i]         = segments.density.eval(seg, t);
+      gammas[i]            = segments.gamma.eval(seg, t);
+      amplitudes[i]        = segments.amplitude.eval(seg, t);
+
+      // Transform to local space
+      Vector lsP = lineWsToLs(state.wsP, N.cross(T), N, T, 
+                              wsCenter, u, infos[i].radius);
+
+      // Normalize the length of the vector in the XY plane
+      // if user wants "2D" style displacement.
+      if (isPyroclastic && isPyro2D) {
+        lsP = Math::normalizeXY(lsP);
+      }
+
+      // Transform to noise space
+      nsP[i] = lsP / scale;
+      // Octaves finer than the voxel would only alias
+      filterWidths[i] = state.wsVoxelSize.length() / infos[i].radius / 
+        minScale;
     }
 
+    // Evaluate fractal for all voxels that hit a segment
+    fractal->evalBatch(nsP, filterWidths, fractalVals, count);
+
+    for (size_t i = 0; i < count; ++i) {
+      const RasterizationState &state  = states[indices[i]];
+      const SegmentInfo        &info   = infos[i];
+      RasterizationSample      &sample = samples[indices[i]];
+
+      double fractalVal = fractalVals[i];
+      fractalVal = Math::gamma(fractalVal, gammas[i]);
+      fractalVal *= amplitudes[i];
+
+      // Calculate sample value
+      if (isPyroclastic) {
+        float  filterWidth  = state.wsVoxelSize.length() / info.radius;
+        double distanceFunc = info.distance / info.radius - 1.0;
+        float  pyro         = pyroclastic(distanceFunc, fractalVal, filterWidth);
+        sample.value        = pyro * densities[i];
+      } else {
+        double distanceFunc = 1.0 - info.distance / info.radius;
+        float  noise        = std::max(0.0, distanceFunc + fractalVal);
+        sample.value        = noise * densities[i];
+      }
+    }
   }
 }
 
 //----------------------------------------------------------------------------//
 
-void PyroclasticLine::updatePolyAttrs(Geo::AttrVisitor::const_iterator i) const
+void PyroclasticLine::updatePolyAttrs(Geo::AttrVisitor::const_iterator i,
+                                      LineBase::Context &baseContext) const
 {
+  Context &context = static_cast<Context &>(baseContext);
   // Update base class
-  LineBase::updatePolyAttrs(i);
+  LineBase::updatePolyAttrs(i, context);
   // Update this class
-  m_polyAttrs.update(i);
+  PolyAttrState &polyAttrs = context.polyAttrs;
+  polyAttrs.update(i);
   // Update fractal 
-  NoiseFunction::CPtr noise;
-  if (m_polyAttrs.absNoise) {
-    noise = NoiseFunction::CPtr(new AbsPerlinNoise);
-  } else {
-    noise = NoiseFunction::CPtr(new PerlinNoise);
-  }
-  m_polyAttrs.fractal.reset(new fBm(noise, 1.0, m_polyAttrs.octaves, 
-                                    m_polyAttrs.octaveGain, 
-                                    m_polyAttrs.lacunarity));
+  polyAttrs.fractal = 
+    polyAttrs.fractalCache.get(polyAttrs.absNoise, polyAttrs.tiledNoise, 
+                               polyAttrs.simplexNoise, 1.0,
+                               polyAttrs.octaves, polyAttrs.octaveGain, 
+                               polyAttrs.lacunarity);
 }
 
 //----------------------------------------------------------------------------//
 
 void PyroclasticLine::updatePointAttrs(Geo::AttrVisitor::const_iterator iPoint, 
-                                       const size_t numPoints) const
+                                       const size_t numPoints,
+                                       LineBase::Context &baseContext) const
 {
+  Context &context = static_cast<Context &>(baseContext);
   // Update base class
-  LineBase::updatePointAttrs(iPoint, numPoints);
+  LineBase::updatePointAttrs(iPoint, numPoints, context);
   // Update this class
-  m_pointAttrs.resize(numPoints);
+  context.pointAttrs.resize(numPoints);
   for (size_t i = 0; i < numPoints; ++i, ++iPoint) {
-    m_pointAttrs[i].update(iPoint);
+    context.pointAttrs[i].update(iPoint);
+  }
+  // Interpolation of each segment, so getSampleBatch() needn't look up two 
+  // points per attribute for every voxel
+  const size_t numSegments = numPoints > 0 ? numPoints - 1 : 0;
+  Segments &segments = context.segments;
+  segments.wsCenter.resize(numSegments);
+  segments.wsVelocity.resize(numSegments);
+  segments.density.resize(numSegments);
+  segments.wsNormal.resize(numSegments);
+  segments.wsTangent.resize(numSegments);
+  segments.u.resize(numSegments);
+  segments.amplitude.resize(numSegments);
+  segments.gamma.resize(numSegments);
+  for (size_t i = 0; i < numSegments; ++i) {
+    const LineBase::PointAttrState &b0 = context.basePointAttrs[i];
+    const LineBase::PointAttrState &b1 = context.basePointAttrs[i + 1];
+    const PointAttrState           &p0 = context.pointAttrs[i];
+    const PointAttrState           &p1 = context.pointAttrs[i + 1];
+    segments.wsCenter.set(i, b0.wsCenter.value(), b1.wsCenter.value());
+    segments.wsVelocity.set(i, b0.wsVelocity.value(), b1.wsVelocity.value());
+    segments.density.set(i, b0.density.value(), b1.density.value());
+    segments.wsNormal.set(i, p0.wsNormal.value(), p1.wsNormal.value());
+    segments.wsTangent.set(i, p0.wsTangent.value(), p1.wsTangent.value());
+    segments.u.set(i, p0.u.value(), p1.u.value());
+    segments.amplitude.set(i, p0.amplitude.value(), p1.amplitude.value());
+    segments.gamma.set(i, p0.gamma.value(), p1.gamma.value());
   }
 }
 
 //----------------------------------------------------------------------------//
 
-float PyroclasticLine::displacementBounds(const size_t index) const
+float PyroclasticLine::displacementBounds
+(const size_t index, const LineBase::Context &baseContext) const
 {
-  float amplitude  = m_pointAttrs[index].amplitude;
-  float scale      = Math::max(m_polyAttrs.scale.value());
-  float lacunarity = m_polyAttrs.lacunarity;
-  
-  NoiseFunction::CPtr noise;
-  if (m_polyAttrs.absNoise) {
-    noise = NoiseFunction::CPtr(new AbsPerlinNoise);
-  } else {
-    noise = NoiseFunction::CPtr(new PerlinNoise);
-  }
+  const Context &context = static_cast<const Context &>(baseContext);
+  const PolyAttrState &polyAttrs = context.polyAttrs;
 
-  Fractal::CPtr fractal(new fBm(noise, scale, m_polyAttrs.octaves, 
-                                m_polyAttrs.octaveGain, lacunarity));
+  float amplitude = context.pointAttrs[index].amplitude;
 
-  return fractal->range().second * amplitude;
+  // The fractal's range doesn't depend on its scale, so the one set up in
+  // updatePolyAttrs() can be used directly
+  return polyAttrs.fractal->range().second * amplitude;
 }
 
 //----------------------------------------------------------------------------//
@@ -221,6 +318,8 @@ void PyroclasticLine::PolyAttrState::update
   i.update(pyro2D);
   i.update(absNoise);
   i.update(pyroclastic);
+  i.update(tiledNoise);
+  i.update(simplexNoise);
 }
 
 //----------------------------------------------------------------------------//
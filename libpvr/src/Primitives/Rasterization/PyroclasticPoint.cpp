@@ -33,17 +33,22 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 // Library includes
 
 #include <Field3D/Field.h>
 
 // Project includes
 
+#include "pvr/AttrChannels.h"
 #include "pvr/RenderGlobals.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
 #include "pvr/ModelingUtils.h"
+#include "pvr/Primitives/Rasterization/GpuSplatting.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -57,6 +62,11 @@ namespace {
   
   //--------------------------------------------------------------------------//
 
+  //! Number of voxels whose noise is evaluated in one batch
+  const size_t k_noiseBatchSize = 64;
+
+  //--------------------------------------------------------------------------//
+
   float sphereSDF(const Vector &wsP, const Vector &wsCenter, 
                   const float wsRadius)
   {
@@ -96,124 +106,336 @@ PyroclasticPoint::Ptr PyroclasticPoint::create()
 
 //----------------------------------------------------------------------------//
 
+RasterizationContext::Ptr PyroclasticPoint::createContext() const
+{
+  return RasterizationContext::Ptr(new Context);
+}
+
+//----------------------------------------------------------------------------//
+
+float PyroclasticPoint::wsFeatureSize(Geo::Geometry::CPtr geometry) const
+{
+  if (!geometry->particles() || 
+      geometry->particles()->pointAttrs().size() == 0) {
+    return 0.0f;
+  }
+
+  const AttrState attrs;
+  AttrChannels    channels(geometry->particles()->pointAttrs(), m_params);
+  channels.add(attrs.radius);
+  channels.add(attrs.scale);
+  channels.add(attrs.octaves);
+  channels.add(attrs.lacunarity);
+
+  const AttrChannels::Span radius     = channels.span(attrs.radius.name());
+  const AttrChannels::Span scale      = channels.span(attrs.scale.name());
+  const AttrChannels::Span octaves    = channels.span(attrs.octaves.name());
+  const AttrChannels::Span lacunarity = 
+    channels.span(attrs.lacunarity.name());
+
+  // Noise space is scaled by the radius, and each octave divides the 
+  // wavelength of the first one, scale, by the lacunarity
+  float minSize = std::numeric_limits<float>::max();
+  for (size_t i = 0, size = channels.size(); i < size; ++i) {
+    const float r          = std::abs(radius[i]);
+    const float finest     = std::max(octaves[i] - 1.0f, 0.0f);
+    const float wavelength = r * std::abs(scale[i]) / 
+      std::pow(std::max(lacunarity[i], 1.0f), finest);
+    minSize = std::min(minSize, std::min(r, wavelength));
+  }
+  return minSize;
+}
+
+//----------------------------------------------------------------------------//
+
 //! \todo Create new base class that only leaves getSample virtual
-void PyroclasticPoint::execute(Geo::Geometry::CPtr geometry, 
-                               VoxelBuffer::Ptr buffer) const
+size_t PyroclasticPoint::numItems(Geo::Geometry::CPtr geometry) const
 {
-  using namespace Field3D;
-  using namespace std;
-  
+  if (!geometry->particles()) {
+    Log::warning("PyroclasticPoint - no particles in input");
+    return 0;
+  }
+
   const AttrTable &points = geometry->particles()->pointAttrs();
 
-  Timer             timer;
-  size_t            count = 0;
-  ProgressReporter  progress(2.5f, "  ");
-  AttrVisitor       visitor(points, m_params);
-  FieldMapping::Ptr mapping(buffer->mapping());
- 
-  PVR_PRIM_SANITY_CHECK("PyroclasticPoint");
+  if (!points.vectorAttrRef("P").isValid()) {
+    Log::warning("PyroclasticPoint - no P attribute in input");
+    return 0;
+  }
+
+  return points.size();
+}
+
+//----------------------------------------------------------------------------//
+
+BBox PyroclasticPoint::updateItem(Geo::Geometry::CPtr geometry, 
+                                  Field3D::FieldMapping::Ptr mapping, 
+                                  const size_t item,
+                                  RasterizationContext &rContext) const
+{
+  Context   &context = static_cast<Context &>(rContext);
+  AttrState &attrs   = context.attrs;
+
+  // Update attributes
+  AttrVisitor visitor(geometry->particles()->pointAttrs(), m_params);
+  attrs.update(visitor.begin(item));
+  // Check fractal range
+  Fractal::Range range = attrs.fractal->range();
+  // Calculate rasterization bounds
+  float totalRadius = attrs.radius + 
+    attrs.radius * attrs.amplitude * range.second;
+  context.vsBounds = vsSphereBounds(mapping, attrs.wsCenter.as<Vector>(), 
+                                    totalRadius);
+  // Include the end of the motion
+  Vector wsVelocity = attrs.wsVelocity.as<Vector>();
+  Vector wsEnd = attrs.wsCenter.as<Vector>() + 
+    wsVelocity * RenderGlobals::dt();
+  context.hasMotion = wsVelocity.length2() > 0.0;
+  BBox vsBounds = context.vsBounds;
+  vsBounds.extendBy(vsSphereBounds(mapping, wsEnd, totalRadius));
+  return vsBounds;
+}
+
+//----------------------------------------------------------------------------//
+
+void PyroclasticPoint::rasterizeItem(VoxelBuffer::Ptr buffer, 
+                                     RasterizationContext &rContext) const
+{
+  const Context &context = static_cast<const Context &>(rContext);
+  // Call rasterize(), which will come back and query getSample() for values
+  rasterize(context.vsBounds, buffer, context);
+}
+
+//----------------------------------------------------------------------------//
+
+#ifdef PVR_USE_CUDA
+
+bool PyroclasticPoint::executeOnDevice(Geo::Geometry::CPtr geometry, 
+                                       VoxelBuffer::Ptr buffer) const
+{
+  std::string reason;
+  if (!Gpu::isSupported(buffer, reason)) {
+    Log::warning("PyroclasticPoint primitive can't be rasterized on the "
+                 "GPU: " + reason + ". Using the CPU instead.");
+    return false;
+  }
+
+  Field3D::FieldMapping::Ptr mapping = buffer->mapping();
 
-  Log::print("Pyroclastic point primitive processing " + str(points.size()) + 
-             " input points");
+  Context     context;
+  AttrState  &attrs = context.attrs;
+  AttrVisitor visitor(geometry->particles()->pointAttrs(), m_params);
 
+  // Everything that getSampleBatch() computes once per point is computed 
+  // here, and the device evaluates the per-voxel part
+  std::vector<Gpu::PyroPoint> points;
   for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i, ++count) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(static_cast<float>(count) / points.size());
-    // Update attributes
-    m_attrs.update(i);
-    // Transform to voxel space
-    Vector vsP;
-    mapping->worldToVoxel(m_attrs.wsCenter.as<Vector>(), vsP);
-    // Check fractal range
-    Fractal::Range range = m_attrs.fractal->range();
-    // Calculate rasterization bounds
-    float totalRadius = m_attrs.radius + 
-      m_attrs.radius * m_attrs.amplitude * range.second;
-    BBox vsBounds = vsSphereBounds(mapping, m_attrs.wsCenter.as<Vector>(), 
-                                   totalRadius);
-    // Call rasterize(), which will come back and query getSample() for values
-    rasterize(vsBounds, buffer);
+       i != end; ++i) {
+    attrs.update(i);
+    if (attrs.wsVelocity.value().length2() > 0.0f || attrs.tiledNoise || 
+        attrs.simplexNoise) {
+      Log::warning("PyroclasticPoint primitive can't rasterize moving "
+                   "points or tiled or simplex noise on the GPU. Using the "
+                   "CPU instead.");
+      return false;
+    }
+    // Same bounds as updateItem()
+    const Vector         wsCenter = attrs.wsCenter.as<Vector>();
+    const float          wsRadius = attrs.radius;
+    const Fractal::Range range    = attrs.fractal->range();
+    const float totalRadius = wsRadius + 
+      wsRadius * attrs.amplitude * range.second;
+    Gpu::PyroPoint point;
+    if (!Gpu::itemBox(buffer, vsSphereBounds(mapping, wsCenter, totalRadius),
+                      point.boxMin, point.boxMax)) {
+      continue;
+    }
+    Vector vsCenter;
+    mapping->worldToVoxel(wsCenter, vsCenter);
+    Gpu::toDevice(vsCenter, point.vsCenter);
+    Gpu::toDevice(attrs.density.value(), point.density);
+    point.wsRadius = wsRadius;
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c) {
+        point.rotation[r][c] = static_cast<float>(attrs.rotation[r][c]);
+      }
+    }
+    Gpu::toDevice(Math::offsetVector<double>(attrs.seed), point.nsOffset);
+    point.filterWidth = 
+      pvr::Model::wsVoxelSize(mapping, vsCenter).length() / wsRadius;
+    point.scale         = attrs.scale;
+    point.octaves       = attrs.octaves;
+    point.octaveGain    = attrs.octaveGain;
+    point.lacunarity    = attrs.lacunarity;
+    point.absNoise      = attrs.absNoise;
+    point.amplitude     = attrs.amplitude;
+    point.gamma         = attrs.gamma;
+    point.isPyroclastic = attrs.pyroclastic;
+    point.isPyro2D      = attrs.pyro2D;
+    const double dispA  = point.amplitude * 
+      Math::gamma(range.first, point.gamma);
+    const double dispB  = point.amplitude * 
+      Math::gamma(range.second, point.gamma);
+    point.dispMin = std::min(dispA, dispB);
+    point.dispMax = std::max(dispA, dispB);
+    points.push_back(point);
   }
 
-  Log::print("  Time elapsed: " + str(timer.elapsed()));
+  Log::print(typeName() + " primitive rasterizing " + str(points.size()) + 
+             " points on the GPU");
+
+  if (!Gpu::rasterize(buffer, std::vector<Gpu::Splat>(), 
+                      std::vector<Gpu::Sphere>(), points, reason)) {
+    Log::warning("PyroclasticPoint primitive failed to rasterize on the "
+                 "GPU: " + reason + ". Using the CPU instead.");
+    return false;
+  }
+  return true;
 }
 
+#endif // PVR_USE_CUDA
+
 //----------------------------------------------------------------------------//
 
-void PyroclasticPoint::getSample(const RasterizationState &state,
+void PyroclasticPoint::getSample(const RasterizationContext &context,
+                                 const RasterizationState &state,
                                  RasterizationSample &sample) const
 {
-  // Point attributes
-  const V3f    &density       = m_attrs.density;  
-  const float   wsRadius      = m_attrs.radius;
-  const Vector  wsCenter      = m_attrs.wsCenter.as<Vector>();
-  const Vector  wsVelocity    = m_attrs.wsVelocity.as<Vector>();
-  const Matrix &rotation      = m_attrs.rotation;
-  const bool    isPyroclastic = m_attrs.pyroclastic;
-  const bool    isPyro2D      = m_attrs.pyro2D;
-  const int     seed          = m_attrs.seed;
-  const float   gamma         = m_attrs.gamma;
-  const float   amplitude     = m_attrs.amplitude;
-  Fractal::CPtr fractal       = m_attrs.fractal;
-
-  // Transform to the point's local coordinate system
-  Vector lsP, lsPUnrot = (state.wsP - wsCenter) / wsRadius;
-  rotation.multVecMatrix(lsPUnrot, lsP);
-  Vector nsP = lsP;
-
-  // Normalize noise coordinate if '2D' displacement is desired
-  if (isPyroclastic && isPyro2D) {
-    nsP.normalize();
-  }
+  getSampleBatch(context, &state, &sample, 1);
+}
 
-  // Offset by seed
-  nsP += Math::offsetVector<double>(seed);
-
-  // Compute fractal function
-  double fractalVal = fractal->eval(nsP);
-  fractalVal = Math::gamma(fractalVal, gamma);
-  fractalVal *= amplitude;
-
-  // Calculate sample value
-  if (isPyroclastic) {
-    // Pyroclastic mode
-    double sphereFunc   = lsP.length() - 1.0;
-    float  filterWidth  = state.wsVoxelSize.length() / wsRadius;
-    float  pyro         = pyroclastic(sphereFunc, fractalVal, filterWidth);
-    sample.value        = density * pyro;
-  } else {
-    // Non-pyroclastic mode
-    double distanceFunc = 1.0 - lsP.length();
-    float  noise        = std::max(0.0, distanceFunc + fractalVal);
-    sample.value        = density * noise;
-  }
+//----------------------------------------------------------------------------//
+
+void PyroclasticPoint::getSampleBatch(const RasterizationContext &context,
+                                      const RasterizationState *states,
+                                      RasterizationSample *samples,
+                                      const size_t n) const
+{
+  const AttrState &attrs = static_cast<const Context &>(context).attrs;
 
-  // Update velocity
-  sample.wsVelocity = wsVelocity;
+  // Point attributes
+  const V3f    &density       = attrs.density;  
+  const float   wsRadius      = attrs.radius;
+  const Vector  wsCenter      = attrs.wsCenter.as<Vector>();
+  const Vector  wsVelocity    = attrs.wsVelocity.as<Vector>();
+  const Matrix &rotation      = attrs.rotation;
+  const bool    isPyroclastic = attrs.pyroclastic;
+  const bool    isPyro2D      = attrs.pyro2D;
+  const int     seed          = attrs.seed;
+  const float   gamma         = attrs.gamma;
+  const float   amplitude     = attrs.amplitude;
+  Fractal::CPtr fractal       = attrs.fractal;
+  const Vector  nsOffset      = Math::offsetVector<double>(seed);
+
+  // Bounds of the displacement, used to find voxels whose value doesn't
+  // depend on the noise
+  const Fractal::Range range       = fractal->range();
+  const double         dispA       = amplitude * 
+    Math::gamma(range.first, gamma);
+  const double         dispB       = amplitude * 
+    Math::gamma(range.second, gamma);
+  const double         dispMin     = std::min(dispA, dispB);
+  const double         dispMax     = std::max(dispA, dispB);
+  const bool           canClassify = gamma > 0.0f;
+
+  Vector lsP[k_noiseBatchSize];
+  V3f    nsP[k_noiseBatchSize];
+  float  filterWidths[k_noiseBatchSize];
+  float  fractalVals[k_noiseBatchSize];
+  size_t band[k_noiseBatchSize];
+
+  for (size_t first = 0; first < n; first += k_noiseBatchSize) {
+    const size_t count = std::min(n - first, k_noiseBatchSize);
+    size_t numBand = 0;
+
+    // Transform to the point's local coordinate system. Voxels that are
+    // fully inside or outside for any noise value are filled directly, and
+    // only the narrow band in between needs the fractal function.
+    for (size_t i = 0; i < count; ++i) {
+      const RasterizationState &state  = states[first + i];
+      RasterizationSample      &sample = samples[first + i];
+      Vector lsPUnrot = (state.wsP - wsCenter) / wsRadius;
+      rotation.multVecMatrix(lsPUnrot, lsP[i]);
+      sample.wsVelocity = wsVelocity;
+      if (canClassify) {
+        const double sphereFunc = lsP[i].length() - 1.0;
+        if (isPyroclastic) {
+          const double width = 0.5 * state.wsVoxelSize.length() / wsRadius;
+          if (sphereFunc >= dispMax + width) {
+            sample.value = V3f(0.0f);
+            continue;
+          } else if (sphereFunc <= dispMin - width) {
+            sample.value = density;
+            continue;
+          }
+        } else if (sphereFunc >= dispMax) {
+          sample.value = V3f(0.0f);
+          continue;
+        }
+      }
+      Vector p = lsP[i];
+      // Normalize noise coordinate if '2D' displacement is desired
+      if (isPyroclastic && isPyro2D) {
+        p.normalize();
+      }
+      // Offset by seed
+      nsP[numBand] = p + nsOffset;
+      // Octaves finer than the voxel would only alias
+      filterWidths[numBand] = state.wsVoxelSize.length() / wsRadius;
+      band[numBand++] = i;
+    }
+
+    // Compute fractal function for all band voxels at once
+    fractal->evalBatch(nsP, filterWidths, fractalVals, numBand);
+
+    for (size_t b = 0; b < numBand; ++b) {
+      const size_t              i      = band[b];
+      const RasterizationState &state  = states[first + i];
+      RasterizationSample      &sample = samples[first + i];
+
+      double fractalVal = fractalVals[b];
+      fractalVal = Math::gamma(fractalVal, gamma);
+      fractalVal *= amplitude;
+
+      // Calculate sample value
+      if (isPyroclastic) {
+        // Pyroclastic mode
+        double sphereFunc   = lsP[i].length() - 1.0;
+        float  pyro         = pyroclastic(sphereFunc, fractalVal, 
+                                          filterWidths[b]);
+        sample.value        = density * pyro;
+      } else {
+        // Non-pyroclastic mode
+        double distanceFunc = 1.0 - lsP[i].length();
+        float  noise        = std::max(0.0, distanceFunc + fractalVal);
+        sample.value        = density * noise;
+      }
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
 
 BBox PyroclasticPoint::pointWsBounds
-(const Geo::AttrVisitor::const_iterator &i) const
+(const Geo::AttrVisitor::const_iterator &i, 
+ RasterizationContext &context) const
 {
+  AttrState &attrs = static_cast<Context &>(context).attrs;
+
   BBox wsBBox;
-  m_attrs.update(i);
+  attrs.update(i);
 
   // Check fractal range
-  Fractal::Range range = m_attrs.fractal->range();
+  Fractal::Range range = attrs.fractal->range();
 
   // Compute start and end of motion
-  Vector wsStart = m_attrs.wsCenter.value();
-  Vector wsEnd = m_attrs.wsCenter.value() + 
-    m_attrs.wsVelocity.value() * RenderGlobals::dt();
+  Vector wsStart = attrs.wsCenter.value();
+  Vector wsEnd = attrs.wsCenter.value() + 
+    attrs.wsVelocity.value() * RenderGlobals::dt();
 
   // Pad to account for displacement
-  Vector padding = Vector(m_attrs.radius.value() + 
-                          range.second * m_attrs.amplitude * m_attrs.radius);
+  Vector padding = Vector(attrs.radius.value() + 
+                          range.second * attrs.amplitude * attrs.radius);
   wsBBox.extendBy(wsStart + padding);
   wsBBox.extendBy(wsStart - padding);
   wsBBox.extendBy(wsEnd + padding);
@@ -248,16 +470,12 @@ AttrState::update(const Geo::AttrVisitor::const_iterator &i)
   i.update(absNoise);
   i.update(antialiased);
   i.update(pyroclastic);
+  i.update(tiledNoise);
+  i.update(simplexNoise);
 
   // Set up fractal
-  NoiseFunction::CPtr noise;
-  if (absNoise) {
-    noise = NoiseFunction::CPtr(new AbsPerlinNoise);
-  } else {
-    noise = NoiseFunction::CPtr(new PerlinNoise);
-  }
-  fractal = Fractal::CPtr(new fBm(noise, scale, octaves, 
-                                  octaveGain, lacunarity));
+  fractal = fractalCache.get(absNoise, tiledNoise, simplexNoise, scale, 
+                             octaves, octaveGain, lacunarity);
 
   // Set up rotation matrix
   rotation = Euler(orientation.value()).toMatrix44().transpose();
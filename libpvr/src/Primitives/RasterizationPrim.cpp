@@ -33,18 +33,27 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include <Field3D/Field.h>
+#include <Field3D/FieldMapping.h>
 
 // Project includes
 
 #include "pvr/AttrUtil.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
 #include "pvr/ModelingUtils.h"
 #include "pvr/RenderGlobals.h"
+#include "pvr/StlUtil.h"
+#include "pvr/Threading.h"
+#include "pvr/Trace.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -54,6 +63,447 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  const std::string k_strSpatialSort("spatial_sort");
+  const std::string k_strUseGpu("use_gpu");
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of slabs to create per thread. More slabs balance the load 
+  //! better, at the cost of items being visited by more threads.
+  const size_t k_slabsPerThread = 4;
+  //! Number of voxels rasterized between checks for aborted jobs
+  const size_t k_abortCheckInterval = 4096;
+  //! Number of items processed between progress updates
+  const size_t k_progressInterval = 64;
+  //! Number of key bits handled by each radix sort pass
+  const int    k_radixBits = 8;
+  //! Largest number of halving passes used by the motion filter
+  const int    k_maxMotionPasses = 16;
+  //! Largest variation of an item's voxel-space motion, in voxels, for 
+  //! which it's blurred with the motion filter
+  const double k_maxMotionVariation = 0.5;
+  //! Largest distance, as a fraction of the voxel size, that a frustum 
+  //! scanline may stray from a straight line and still be stepped linearly
+  const double k_maxScanlineError = 1e-6;
+
+  //--------------------------------------------------------------------------//
+
+  //! Splits the buffer's data window into slabs along z. For sparse buffers
+  //! the slab boundaries line up with the block boundaries, so that no 
+  //! block is shared between two slabs.
+  std::vector<DiscreteBBox> partitionSlabs(VoxelBuffer::Ptr buffer, 
+                                           const size_t numThreads)
+  {
+    std::vector<DiscreteBBox> slabs;
+
+    const DiscreteBBox dataWindow = buffer->dataWindow();
+    if (dataWindow.isEmpty()) {
+      return slabs;
+    }
+
+    // Sparse blocks are counted from the data window's min corner
+    int alignment = 1;
+    if (SparseBuffer *sparse = dynamic_cast<SparseBuffer *>(buffer.get())) {
+      alignment = sparse->blockSize();
+    }
+
+    const int depth      = dataWindow.max.z - dataWindow.min.z + 1;
+    const int numAligned = (depth + alignment - 1) / alignment;
+    const int numTarget  = 
+      numThreads > 1 ? static_cast<int>(numThreads * k_slabsPerThread) : 1;
+    const int numSlabs   = std::max(1, std::min(numAligned, numTarget));
+    const int thickness  = 
+      ((numAligned + numSlabs - 1) / numSlabs) * alignment;
+
+    for (int z = dataWindow.min.z; z <= dataWindow.max.z; z += thickness) {
+      DiscreteBBox slab = dataWindow;
+      slab.min.z = z;
+      slab.max.z = std::min(z + thickness - 1, dataWindow.max.z);
+      slabs.push_back(slab);
+    }
+
+    return slabs;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns whether two parameter maps hold the same values
+  bool paramsEqual(const Util::ParamMap &a, const Util::ParamMap &b)
+  {
+    return a.intMap == b.intMap && a.floatMap == b.floatMap && 
+      a.vectorMap == b.vectorMap && a.stringMap == b.stringMap;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Spreads the low 21 bits of x out so that there are two zero bits 
+  //! between each of them.
+  boost::uint64_t spreadBits(boost::uint64_t x)
+  {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x001f00000000ffffULL;
+    x = (x | x << 16) & 0x001f0000ff0000ffULL;
+    x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2)  & 0x1249249249249249ULL;
+    return x;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the Morton code of a non-negative voxel coordinate
+  boost::uint64_t mortonCode(const Imath::V3i &p)
+  {
+    return spreadBits(p.x) | (spreadBits(p.y) << 1) | (spreadBits(p.z) << 2);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sorts items by their keys. The sort is stable, so items with equal 
+  //! keys stay in their original order. Only the passes needed for the 
+  //! largest key are run.
+  void radixSort(std::vector<size_t> &items, 
+                 const std::vector<boost::uint64_t> &keys)
+  {
+    typedef std::pair<boost::uint64_t, size_t> Entry;
+
+    const size_t numBuckets = 1 << k_radixBits;
+    const size_t n = items.size();
+
+    std::vector<Entry> entries(n), scratch(n);
+    boost::uint64_t maxKey = 0;
+    for (size_t i = 0; i < n; ++i) {
+      entries[i] = Entry(keys[items[i]], items[i]);
+      maxKey |= entries[i].first;
+    }
+
+    for (int shift = 0; shift < 64 && (maxKey >> shift) != 0; 
+         shift += k_radixBits) {
+      // Count the entries in each bucket, then turn counts into offsets
+      std::vector<size_t> offsets(numBuckets + 1, 0);
+      for (size_t i = 0; i < n; ++i) {
+        ++offsets[((entries[i].first >> shift) & (numBuckets - 1)) + 1];
+      }
+      for (size_t b = 1; b <= numBuckets; ++b) {
+        offsets[b] += offsets[b - 1];
+      }
+      for (size_t i = 0; i < n; ++i) {
+        scratch[offsets[(entries[i].first >> shift) & (numBuckets - 1)]++] = 
+          entries[i];
+      }
+      entries.swap(scratch);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      items[i] = entries[i].second;
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the voxel-space motion of a point at vsP that moves by 
+  //! wsMotion in world space
+  Vector vsMotionAt(Field3D::FieldMapping::Ptr mapping, const Vector &vsP,
+                    const Vector &wsMotion)
+  {
+    Vector wsP, vsEnd;
+    mapping->voxelToWorld(vsP, wsP);
+    mapping->worldToVoxel(wsP + wsMotion, vsEnd);
+    return vsEnd - vsP;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! A moving voxel sample, which gets blurred along its motion
+  struct MotionSample
+  {
+    MotionSample(const Imath::V3i &dvsP, const Imath::V3f &value, 
+                 const Vector &wsP, const Vector &wsVelocity)
+      : dvsP(dvsP), value(value), wsP(wsP), wsVelocity(wsVelocity)
+    { }
+    Imath::V3i dvsP;
+    Imath::V3f value;
+    Vector     wsP;
+    Vector     wsVelocity;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Dense grid of voxel values, used as scratch space by the motion filter.
+  //! Voxels outside the bounds read as zero.
+  struct MotionGrid
+  {
+    void resize(const DiscreteBBox &newBounds)
+    {
+      bounds = newBounds;
+      res = bounds.size() + Imath::V3i(1);
+      data.assign(static_cast<size_t>(res.x) * res.y * res.z, 
+                  Imath::V3f(0.0f));
+    }
+    Imath::V3f value(const int i, const int j, const int k) const
+    {
+      if (!Model::isInWindow(i, j, k, bounds)) {
+        return Imath::V3f(0.0f);
+      }
+      return data[index(i, j, k)];
+    }
+    Imath::V3f& lvalue(const int i, const int j, const int k)
+    { return data[index(i, j, k)]; }
+    size_t index(const int i, const int j, const int k) const
+    {
+      return (i - bounds.min.x) + 
+        res.x * ((j - bounds.min.y) + 
+                 static_cast<size_t>(res.y) * (k - bounds.min.z));
+    }
+    DiscreteBBox            bounds;
+    Imath::V3i              res;
+    std::vector<Imath::V3f> data;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes dst = selfWeight * src + (1 - selfWeight) * src shifted by 
+  //! vsShift. The shifted grid is reconstructed with the same trilinear 
+  //! weights that an antialiased splat uses. Since the shift is the same 
+  //! for every voxel, so are the weights.
+  void shiftGrid(const MotionGrid &src, const Vector &vsShift, 
+                 const float selfWeight, MotionGrid &dst)
+  {
+    const Imath::V3i offset(static_cast<int>(std::floor(vsShift.x)),
+                            static_cast<int>(std::floor(vsShift.y)),
+                            static_cast<int>(std::floor(vsShift.z)));
+    const Vector     fraction(vsShift - static_cast<Vector>(offset));
+    const float      shiftWeight = 1.0f - selfWeight;
+
+    const double wx[2] = { 1.0 - fraction.x, fraction.x };
+    const double wy[2] = { 1.0 - fraction.y, fraction.y };
+    const double wz[2] = { 1.0 - fraction.z, fraction.z };
+
+    DiscreteBBox bounds(src.bounds.min + offset, 
+                        src.bounds.max + offset + Imath::V3i(1));
+    if (selfWeight > 0.0f) {
+      bounds.extendBy(src.bounds);
+    }
+    dst.resize(bounds);
+
+    for (int k = bounds.min.z; k <= bounds.max.z; ++k) {
+      for (int j = bounds.min.y; j <= bounds.max.y; ++j) {
+        for (int i = bounds.min.x; i <= bounds.max.x; ++i) {
+          Imath::V3f shifted(0.0f);
+          for (int c = 0; c < 2; ++c) {
+            for (int b = 0; b < 2; ++b) {
+              for (int a = 0; a < 2; ++a) {
+                shifted += src.value(i - offset.x - a, j - offset.y - b, 
+                                     k - offset.z - c) * 
+                  (wx[a] * wy[b] * wz[c]);
+              }
+            }
+          }
+          Imath::V3f &value = dst.lvalue(i, j, k);
+          value = shifted * shiftWeight;
+          if (selfWeight > 0.0f) {
+            value += src.value(i, j, k) * selfWeight;
+          }
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Blurs the grid along vsMotion, as if each voxel were splatted along 
+  //! a line from its position to its position plus vsMotion. The line is
+  //! built by repeatedly averaging the grid with a copy of itself, shifted 
+  //! by half of the previous shift, so that n passes place 2^n samples 
+  //! along the motion at no more than one voxel apart.
+  void motionFilter(MotionGrid &grid, const Vector &vsMotion)
+  {
+    const double length = vsMotion.length();
+    int numPasses = 0;
+    while (numPasses < k_maxMotionPasses && 
+           static_cast<double>(1 << numPasses) < length) {
+      ++numPasses;
+    }
+
+    MotionGrid scratch;
+    // Center the samples on their intervals of the motion
+    const Vector vsStep = vsMotion / static_cast<double>(1 << numPasses);
+    shiftGrid(grid, vsStep * 0.5, 0.0f, scratch);
+    grid.data.swap(scratch.data);
+    std::swap(grid.bounds, scratch.bounds);
+    std::swap(grid.res, scratch.res);
+    // Each pass doubles the number of samples
+    for (int pass = 1; pass <= numPasses; ++pass) {
+      shiftGrid(grid, vsMotion / static_cast<double>(1 << pass), 0.5f, 
+                scratch);
+      grid.data.swap(scratch.data);
+      std::swap(grid.bounds, scratch.bounds);
+      std::swap(grid.res, scratch.res);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Blurs moving samples along their motion and writes them to the 
+  //! buffer, touching only voxels inside the window.
+  void rasterizeMotion(const std::vector<MotionSample> &samples, 
+                       VoxelBuffer::Ptr buffer, const DiscreteBBox &window)
+  {
+    Field3D::FieldMapping::Ptr mapping(buffer->mapping());
+
+    // Items usually move as a whole. If each sample moves by about the same 
+    // amount in voxel space, the samples are gathered into a grid that is 
+    // blurred in a few passes, rather than being splatted as one line each.
+    bool         isUniform = true;
+    DiscreteBBox dvsBounds;
+    BOOST_FOREACH (const MotionSample &sample, samples) {
+      isUniform = isUniform && sample.wsVelocity == samples[0].wsVelocity;
+      dvsBounds.extendBy(sample.dvsP);
+    }
+    const double dt = RenderGlobals::dt();
+    const Vector wsMotion = samples[0].wsVelocity * dt;
+    const Vector vsMotion = 
+      vsMotionAt(mapping, Field3D::discToCont(dvsBounds.min), wsMotion);
+    if (isUniform) {
+      const Vector vsMaxMotion = 
+        vsMotionAt(mapping, Field3D::discToCont(dvsBounds.max), wsMotion);
+      isUniform = (vsMaxMotion - vsMotion).length() <= k_maxMotionVariation;
+    }
+
+    if (!isUniform) {
+      Model::SplatWriter writer(buffer);
+      BOOST_FOREACH (const MotionSample &sample, samples) {
+        Vector vsP = Field3D::discToCont(sample.dvsP);
+        Vector vsEnd;
+        mapping->worldToVoxel(sample.wsP + sample.wsVelocity * dt, vsEnd);
+        Model::writeLine<true>(vsP, vsEnd, sample.value, writer, window);
+      }
+      return;
+    }
+
+    MotionGrid grid;
+    grid.resize(dvsBounds);
+    BOOST_FOREACH (const MotionSample &sample, samples) {
+      grid.lvalue(sample.dvsP.x, sample.dvsP.y, sample.dvsP.z) = sample.value;
+    }
+    motionFilter(grid, vsMotion);
+
+    const DiscreteBBox dvsWrite = 
+      Math::clipBounds(Math::clipBounds(grid.bounds, buffer->dataWindow()), 
+                       window);
+    for (int k = dvsWrite.min.z; k <= dvsWrite.max.z; ++k) {
+      for (int j = dvsWrite.min.y; j <= dvsWrite.max.y; ++j) {
+        for (int i = dvsWrite.min.x; i <= dvsWrite.max.x; ++i) {
+          const Imath::V3f &value = grid.lvalue(i, j, k);
+          if (Math::max(value) > 0.0f) {
+            buffer->lvalue(i, j, k) += value;
+          }
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the world space positions and voxel sizes along the scanlines
+  //! of a mapping, without calling the mapping for every voxel. Positions
+  //! in a matrix mapping are affine in the voxel coordinate, so each span 
+  //! is stepped from its first voxel, and the voxel size is constant. In a
+  //! frustum mapping the voxel size only changes between z slices, and a 
+  //! scanline is straight for the usual perspective cameras, which is 
+  //! checked once per span. Other mappings are called for every voxel.
+  class ScanlineMapping
+  {
+  public:
+    typedef Model::Prim::Rast::RasterizationState RasterizationState;
+
+    ScanlineMapping(Field3D::FieldMapping::Ptr mapping)
+      : m_mapping(mapping), m_wsDx(0.0), m_wsVoxelSize(0.0),
+        m_isMatrix(field_dynamic_cast<Field3D::MatrixFieldMapping>(mapping)),
+        m_isFrustum(field_dynamic_cast<Field3D::FrustumFieldMapping>(mapping))
+    { 
+      if (m_isMatrix) {
+        Vector wsOrigin;
+        m_mapping->voxelToWorld(Vector(0.0), wsOrigin);
+        m_mapping->voxelToWorld(Vector(1.0, 0.0, 0.0), m_wsDx);
+        m_wsDx -= wsOrigin;
+        m_wsVoxelSize = m_mapping->wsVoxelSize(0, 0, 0);
+      }
+    }
+    //! Call before the spans of a new z slice
+    void setSlice(const int x, const int y, const int z)
+    {
+      if (m_isFrustum) {
+        m_wsVoxelSize = m_mapping->wsVoxelSize(x, y, z);
+      }
+    }
+    //! Sets up the states of the width voxels starting at (x, y, z)
+    void setupSpan(const int x, const int y, const int z, const size_t width,
+                   RasterizationState *states) const
+    {
+      if (m_isMatrix || m_isFrustum) {
+        Vector wsP, wsDx;
+        m_mapping->voxelToWorld(Field3D::discToCont(Imath::V3i(x, y, z)),
+                                wsP);
+        if (m_isMatrix) {
+          wsDx = m_wsDx;
+        } else if (!frustumStep(x, y, z, width, wsP, wsDx)) {
+          exactSpan(x, y, z, width, states);
+          return;
+        }
+        for (size_t s = 0; s < width; ++s) {
+          states[s].wsP         = wsP + wsDx * static_cast<double>(s);
+          states[s].wsVoxelSize = m_wsVoxelSize;
+        }
+      } else {
+        exactSpan(x, y, z, width, states);
+      }
+    }
+  private:
+    //! Finds the step between the voxels of a frustum span.
+    //! \returns False if the span isn't straight enough to be stepped.
+    bool frustumStep(const int x, const int y, const int z, 
+                     const size_t width, const Vector &wsP, 
+                     Vector &wsDx) const
+    {
+      if (width < 2) {
+        wsDx = Vector(0.0);
+        return true;
+      }
+      const int last = x + static_cast<int>(width) - 1;
+      const int mid  = x + static_cast<int>(width) / 2;
+      Vector wsLast, wsMid;
+      m_mapping->voxelToWorld(Field3D::discToCont(Imath::V3i(last, y, z)),
+                              wsLast);
+      m_mapping->voxelToWorld(Field3D::discToCont(Imath::V3i(mid, y, z)),
+                              wsMid);
+      wsDx = (wsLast - wsP) / static_cast<double>(width - 1);
+      const Vector wsError = wsP + wsDx * static_cast<double>(mid - x) - wsMid;
+      return wsError.length() <= 
+        k_maxScanlineError * Math::min(m_wsVoxelSize);
+    }
+    //! Calls the mapping for every voxel of the span
+    void exactSpan(const int x, const int y, const int z, const size_t width,
+                   RasterizationState *states) const
+    {
+      for (size_t s = 0; s < width; ++s) {
+        const Imath::V3i voxel(x + static_cast<int>(s), y, z);
+        states[s].wsVoxelSize = 
+          m_mapping->wsVoxelSize(voxel.x, voxel.y, voxel.z);
+        m_mapping->voxelToWorld(Field3D::discToCont(voxel), states[s].wsP);
+      }
+    }
+    Field3D::FieldMapping::Ptr m_mapping;
+    Vector                     m_wsDx;
+    Vector                     m_wsVoxelSize;
+    const bool                 m_isMatrix;
+    const bool                 m_isFrustum;
+  };
+
   //--------------------------------------------------------------------------//
 
 } // local namespace
@@ -76,88 +526,573 @@ namespace Model {
 namespace Prim {
 namespace Rast {
 
+//----------------------------------------------------------------------------//
+// RasterizationPrim::ExecuteState
+//----------------------------------------------------------------------------//
+
+struct RasterizationPrim::ExecuteState
+{
+  ExecuteState(Geo::Geometry::CPtr geometry, VoxelBuffer::Ptr buffer,
+               const size_t numItems, const size_t numThreads)
+    : geometry(geometry), buffer(buffer), mapping(buffer->mapping()),
+      numItems(numItems), numThreads(numThreads), itemWsBounds(NULL),
+      nextSlab(0), job(NULL)
+  { }
+
+  //! Geometry being rasterized
+  Geo::Geometry::CPtr              geometry;
+  //! Buffer being written to
+  VoxelBuffer::Ptr                 buffer;
+  //! Mapping of the buffer
+  FieldMapping::Ptr                mapping;
+  //! Number of items in the geometry
+  size_t                           numItems;
+  //! Number of worker threads
+  size_t                           numThreads;
+  //! Regions of the buffer that are owned by one thread at a time
+  std::vector<DiscreteBBox>        slabs;
+  //! Items overlapping each slab, per binning thread. Indexed as
+  //! threadBins[thread][slab].
+  std::vector<std::vector<std::vector<size_t> > > threadBins;
+  //! Items overlapping each slab, in their original order, or in Morton
+  //! order if keys is non-empty
+  std::vector<std::vector<size_t> > bins;
+  //! Morton code of each item's voxel-space center. Only used when the
+  //! items are sorted spatially.
+  std::vector<boost::uint64_t>     keys;
+  //! World-space bounds of each item, from wsBounds(). May be null.
+  const std::vector<Imath::Box3f> *itemWsBounds;
+  //! Next slab to hand out to a worker
+  size_t                           nextSlab;
+  //! Guards nextSlab
+  boost::mutex                     mutex;
+  //! Job of the current pass
+  Sys::JobState                   *job;
+};
+
+//----------------------------------------------------------------------------//
+// RasterizationPrim::BoundsState
+//----------------------------------------------------------------------------//
+
+struct RasterizationPrim::BoundsState
+{
+  BoundsState(Geo::Geometry::CPtr geometry, std::vector<Imath::Box3f> &bounds,
+              const size_t numThreads)
+    : geometry(geometry), bounds(bounds), numThreads(numThreads), job(NULL)
+  { }
+
+  //! Geometry being bounded
+  Geo::Geometry::CPtr        geometry;
+  //! Bounds of each item
+  std::vector<Imath::Box3f> &bounds;
+  //! Number of worker threads
+  size_t                     numThreads;
+  //! Job of the bounds pass
+  Sys::JobState             *job;
+};
+
 //----------------------------------------------------------------------------//
 // RasterizationPrim
 //----------------------------------------------------------------------------//
 
+BBox RasterizationPrim::wsBounds(Geo::Geometry::CPtr geometry) const
+{
+  assert(geometry != NULL);
+
+  m_itemWsBounds.clear();
+  m_boundsGeometry.reset();
+
+  const size_t numItems = this->numItems(geometry);
+  if (numItems == 0) {
+    return BBox();
+  }
+
+  computeItemWsBounds(geometry, m_itemWsBounds);
+  if (m_itemWsBounds.size() != numItems) {
+    m_itemWsBounds.clear();
+    return BBox();
+  }
+
+  m_boundsGeometry = geometry;
+  m_boundsParams   = m_params;
+  m_boundsDt       = RenderGlobals::dt();
+
+  BBox wsBBox;
+  BOOST_FOREACH (const Imath::Box3f &bounds, m_itemWsBounds) {
+    if (!bounds.isEmpty()) {
+      wsBBox.extendBy(BBox(bounds.min, bounds.max));
+    }
+  }
+  return wsBBox;
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+RasterizationPrim::computeItemWsBounds(Geo::Geometry::CPtr geometry,
+                                       std::vector<Imath::Box3f> &bounds) const
+{
+  const size_t numItems = this->numItems(geometry);
+  bounds.assign(numItems, Imath::Box3f());
+  if (numItems == 0) {
+    return;
+  }
+
+  ProgressReporter progress(2.5f, "  Bounds: ");
+  Sys::JobState    job(numItems);
+  BoundsState      state(geometry, bounds, 
+                         std::min(Sys::numWorkerThreads(0), numItems));
+  state.job = &job;
+  Sys::runWorkers(state.numThreads, 
+                  boost::bind(&RasterizationPrim::boundItems, this, 
+                              boost::ref(state), _1), 
+                  job, progress);
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::boundItems(BoundsState &state, 
+                                   const size_t thread) const
+{
+  const size_t numItems = state.bounds.size();
+  const size_t first    = numItems * thread / state.numThreads;
+  const size_t last     = numItems * (thread + 1) / state.numThreads;
+
+  RasterizationContext::Ptr context = createContext();
+
+  // Work in chunks, so that progress and aborts are checked regularly
+  const size_t chunkSize = k_progressInterval * k_progressInterval;
+  for (size_t start = first; start < last; start += chunkSize) {
+    if (state.job->aborted()) {
+      return;
+    }
+    const size_t end = std::min(start + chunkSize, last);
+    itemWsBounds(state.geometry, start, end, *context, 
+                 &state.bounds[start]);
+    state.job->markDone(end - start);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+const std::vector<Imath::Box3f>* 
+RasterizationPrim::cachedItemWsBounds(Geo::Geometry::CPtr geometry) const
+{
+  if (m_boundsGeometry != geometry || m_boundsDt != RenderGlobals::dt() ||
+      !paramsEqual(m_boundsParams, m_params)) {
+    return NULL;
+  }
+  return &m_itemWsBounds;
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::execute(Geo::Geometry::CPtr geometry, 
+                                VoxelBuffer::Ptr buffer,
+                                const size_t numThreads,
+                                const bool deterministic) const
+{
+  const size_t numItems = this->numItems(geometry);
+  if (numItems == 0) {
+    return;
+  }
+
+  Timer        timer;
+
+  // Primitives that rasterize on a device write all items in one go
+  int useGpu = 0;
+  getValue(m_params.intMap, k_strUseGpu, useGpu);
+  if (useGpu && deterministic) {
+    Log::print("  Rasterizing on the CPU, since the result must be "
+               "deterministic");
+  } else if (useGpu && executeOnDevice(geometry, buffer)) {
+    std::vector<Imath::Box3f>().swap(m_itemWsBounds);
+    m_boundsGeometry.reset();
+    Log::print("  Time elapsed: " + str(timer.elapsed()));
+    return;
+  }
+
+  ExecuteState state(geometry, buffer, numItems, 
+                     std::min(Sys::numWorkerThreads(numThreads), numItems));
+
+  state.slabs = partitionSlabs(buffer, state.numThreads);
+  if (state.slabs.empty()) {
+    return;
+  }
+
+  int spatialSort = 0;
+  getValue(m_params.intMap, k_strSpatialSort, spatialSort);
+  if (spatialSort) {
+    state.keys.resize(numItems, 0);
+  }
+
+  Log::print(typeName() + " primitive processing " + str(numItems) + 
+             " items in " + str(state.slabs.size()) + " slabs, using " + 
+             str(state.numThreads) + " threads");
+
+  // Items are binned by the bounds from wsBounds() if they are still valid
+  state.itemWsBounds = cachedItemWsBounds(geometry);
+  if (state.itemWsBounds && state.itemWsBounds->size() != numItems) {
+    state.itemWsBounds = NULL;
+  }
+
+  // Find the items that overlap each slab. Each thread handles a contiguous
+  // range of items, and the ranges are merged in order.
+  if (state.slabs.size() == 1 && !spatialSort) {
+    state.bins.resize(1);
+    state.bins[0].resize(numItems);
+    for (size_t i = 0; i < numItems; ++i) {
+      state.bins[0][i] = i;
+    }
+  } else {
+    ProgressReporter binProgress(2.5f, "  Binning: ");
+    Sys::JobState    binJob(numItems);
+    state.threadBins.resize(state.numThreads);
+    state.job = &binJob;
+    Sys::runWorkers(state.numThreads, 
+                    boost::bind(&RasterizationPrim::binItems, this, 
+                                boost::ref(state), _1), 
+                    binJob, binProgress);
+    state.bins.resize(state.slabs.size());
+    for (size_t slab = 0, numSlabs = state.slabs.size(); slab < numSlabs; 
+         ++slab) {
+      for (size_t t = 0; t < state.numThreads; ++t) {
+        const std::vector<size_t> &items = state.threadBins[t][slab];
+        state.bins[slab].insert(state.bins[slab].end(), 
+                                items.begin(), items.end());
+      }
+    }
+    state.threadBins.clear();
+  }
+
+  // The cached bounds have served their purpose
+  state.itemWsBounds = NULL;
+  std::vector<Imath::Box3f>().swap(m_itemWsBounds);
+  m_boundsGeometry.reset();
+
+  // Sort each slab's items by the Morton code of their center, so that 
+  // consecutive items write to nearby voxels
+  if (spatialSort) {
+    ProgressReporter sortProgress(2.5f, "  Sorting: ");
+    Sys::JobState    sortJob(state.slabs.size());
+    state.job = &sortJob;
+    Sys::runWorkers(std::min(state.numThreads, state.slabs.size()), 
+                    boost::bind(&RasterizationPrim::sortBins, this, 
+                                boost::ref(state), _1), 
+                    sortJob, sortProgress);
+    state.keys.clear();
+    state.nextSlab = 0;
+  }
+
+  // Rasterize the slabs. Each slab is owned by the thread that picks it up.
+  size_t numWrites = 0;
+  BOOST_FOREACH (const std::vector<size_t> &items, state.bins) {
+    numWrites += items.size();
+  }
+  if (numWrites > 0) {
+    ProgressReporter progress(2.5f, "  ");
+    Sys::JobState    job(numWrites);
+    state.job = &job;
+    Sys::runWorkers(std::min(state.numThreads, state.slabs.size()), 
+                    boost::bind(&RasterizationPrim::rasterizeSlabs, this, 
+                                boost::ref(state), _1), 
+                    job, progress);
+  }
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::binItems(ExecuteState &state, 
+                                 const size_t thread) const
+{
+  const size_t first = state.numItems * thread / state.numThreads;
+  const size_t last  = state.numItems * (thread + 1) / state.numThreads;
+  const size_t numSlabs = state.slabs.size();
+  const DiscreteBBox dataWindow = state.buffer->dataWindow();
+  // Slabs share the same thickness, except possibly for the last one
+  const int    zMin      = state.slabs.front().min.z;
+  const int    thickness = state.slabs.front().max.z - zMin + 1;
+
+  std::vector<std::vector<size_t> > &bins = state.threadBins[thread];
+  bins.resize(numSlabs);
+
+  RasterizationContext::Ptr context = createContext();
+
+  Sys::JobCounter counter(*state.job, k_progressInterval);
+  for (size_t item = first; item < last; ++item) {
+    if (!counter.add()) {
+      return;
+    }
+    BBox vsBounds;
+    if (state.itemWsBounds) {
+      const Imath::Box3f &wsItemBounds = (*state.itemWsBounds)[item];
+      if (wsItemBounds.isEmpty()) {
+        continue;
+      }
+      const BBox wsBBox(wsItemBounds.min, wsItemBounds.max);
+      BOOST_FOREACH (const Vector &wsP, Math::cornerPoints(wsBBox)) {
+        Vector vsP;
+        state.mapping->worldToVoxel(wsP, vsP);
+        vsBounds.extendBy(vsP);
+      }
+    } else {
+      vsBounds = updateItem(state.geometry, state.mapping, item, *context);
+      if (vsBounds.isEmpty()) {
+        continue;
+      }
+    }
+    // Pad by one voxel to account for antialiasing
+    DiscreteBBox dvsBounds = Math::discreteBounds(vsBounds);
+    dvsBounds.min -= Imath::V3i(1);
+    dvsBounds.max += Imath::V3i(1);
+    dvsBounds = Math::clipBounds(dvsBounds, dataWindow);
+    if (dvsBounds.isEmpty()) {
+      continue;
+    }
+    if (!state.keys.empty()) {
+      const Imath::V3i center = (dvsBounds.min + dvsBounds.max) / 2;
+      state.keys[item] = mortonCode(center - dataWindow.min);
+    }
+    const size_t firstSlab = (dvsBounds.min.z - zMin) / thickness;
+    const size_t lastSlab  = 
+      std::min((dvsBounds.max.z - zMin) / thickness, 
+               static_cast<int>(numSlabs) - 1);
+    for (size_t slab = firstSlab; slab <= lastSlab; ++slab) {
+      bins[slab].push_back(item);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::sortBins(ExecuteState &state, const size_t) const
+{
+  while (!state.job->aborted()) {
+    size_t slab;
+    {
+      boost::mutex::scoped_lock lock(state.mutex);
+      if (state.nextSlab == state.slabs.size()) {
+        return;
+      }
+      slab = state.nextSlab++;
+    }
+    radixSort(state.bins[slab], state.keys);
+    state.job->markDone(1);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::rasterizeSlabs(ExecuteState &state, 
+                                       const size_t) const
+{
+  RasterizationContext::Ptr context = createContext();
+  context->job = state.job;
+
+  while (!state.job->aborted()) {
+    // Claim the next slab
+    size_t slab;
+    {
+      boost::mutex::scoped_lock lock(state.mutex);
+      if (state.nextSlab == state.slabs.size()) {
+        return;
+      }
+      slab = state.nextSlab++;
+    }
+    Sys::Trace::Scope trace("RasterizationPrim::rasterizeSlab", "modeling");
+    // Nothing outside the slab may be touched by this thread
+    context->dvsWindow = state.slabs[slab];
+    Sys::JobCounter counter(*state.job, k_progressInterval);
+    BOOST_FOREACH (const size_t item, state.bins[slab]) {
+      if (!counter.add()) {
+        return;
+      }
+      if (!updateItem(state.geometry, state.mapping, item, 
+                      *context).isEmpty()) {
+        rasterizeItem(state.buffer, *context);
+      }
+    }
+    flushItems(*context);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::flushItems(RasterizationContext &) const
+{
+  // Nothing is deferred by default
+}
+
+//----------------------------------------------------------------------------//
+
+bool RasterizationPrim::executeOnDevice(Geo::Geometry::CPtr, 
+                                        VoxelBuffer::Ptr) const
+{
+  Log::warning(typeName() + " primitive can't be rasterized on a GPU. "
+               "Using the CPU instead.");
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
 void RasterizationPrim::rasterize(const BBox &vsBounds,
-                                  VoxelBuffer::Ptr buffer) const
+                                  VoxelBuffer::Ptr buffer,
+                                  const RasterizationContext &context) const
 {
-  FieldMapping::Ptr mapping(buffer->mapping());
+  rasterize(std::vector<BBox>(1, vsBounds), buffer, context);
+}
 
-  DiscreteBBox dvsBounds = Math::discreteBounds(vsBounds);
-  dvsBounds.min -= Imath::V3i(1);
-  dvsBounds.max += Imath::V3i(1);
-  DiscreteBBox bufferBounds = buffer->dataWindow();
-  dvsBounds = Math::clipBounds(dvsBounds, bufferBounds);
-  
-  V3i size = dvsBounds.size();
-  size_t numVoxels = size.x * size.y * size.z;
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::rasterize(const std::vector<BBox> &vsBounds,
+                                  VoxelBuffer::Ptr buffer,
+                                  const RasterizationContext &context) const
+{
+  typedef std::pair<int, int> Span;
 
-  Util::Timer interruptTimer;
+  ScanlineMapping mapping(buffer->mapping());
 
-  ProgressReporter progress(2.5f, "  Rasterization: ");
+  // Pad and clip each box, and find the bounds of all of them
+  std::vector<DiscreteBBox> boxes;
+  DiscreteBBox              dvsBounds;
+  BOOST_FOREACH (const BBox &bounds, vsBounds) {
+    DiscreteBBox box = Math::discreteBounds(bounds);
+    box.min -= Imath::V3i(1);
+    box.max += Imath::V3i(1);
+    box = Math::clipBounds(box, buffer->dataWindow());
+    // Unless the item moves, no voxel outside the window can contribute to it
+    if (!context.hasMotion) {
+      box = Math::clipBounds(box, context.dvsWindow);
+    }
+    if (!box.isEmpty()) {
+      boxes.push_back(box);
+      dvsBounds.extendBy(box);
+    }
+  }
+  if (boxes.empty()) {
+    return;
+  }
+
+  // Find the boxes that overlap each z slice
+  std::vector<std::vector<size_t> > 
+    slices(dvsBounds.max.z - dvsBounds.min.z + 1);
+  for (size_t i = 0, size = boxes.size(); i < size; ++i) {
+    for (int z = boxes[i].min.z; z <= boxes[i].max.z; ++z) {
+      slices[z - dvsBounds.min.z].push_back(i);
+    }
+  }
+
+  const DiscreteBBox &window   = context.dvsWindow;
+  const size_t        maxWidth = dvsBounds.max.x - dvsBounds.min.x + 1;
   size_t count = 0;
 
-  // Iterate over voxels
-  for (VoxelBuffer::iterator i = buffer->begin(dvsBounds), 
-         end = buffer->end(dvsBounds); i != end; ++i, ++count) {
-    RasterizationState rState;
-    RasterizationSample rSample;
-    // Check if user terminated
-    if (interruptTimer.elapsed() > 1.0) {
-      Sys::Interrupt::throwOnAbort();
-      interruptTimer.reset();
-    }
-    // Print progress
-    if (count % 100 == 0) {
-      progress.update(static_cast<float>(count) / numVoxels);
-    }
-    // Get sampling derivatives/voxel size
-    rState.wsVoxelSize = mapping->wsVoxelSize(i.x, i.y, i.z);
-    // Transform voxel position to world space
-    Vector vsP = discToCont(V3i(i.x, i.y, i.z));
-    mapping->voxelToWorld(vsP, rState.wsP);
-    // Sample the primitive
-    this->getSample(rState, rSample);
-    if (Math::max(rSample.value) > 0.0f) {
-      if (rSample.wsVelocity.length2() == 0.0) {
-        *i += rSample.value;
-      } else {
-        Vector vsEnd;
-        Vector wsMotion = rSample.wsVelocity * RenderGlobals::dt();
-        mapping->worldToVoxel(rState.wsP + wsMotion, vsEnd);
-        writeLine<true>(vsP, vsEnd, rSample.value, buffer);
+  std::vector<RasterizationState>  rStates(maxWidth);
+  std::vector<RasterizationSample> rSamples(maxWidth);
+  std::vector<MotionSample>        moving;
+  std::vector<Span>                spans;
+
+  // Iterate over scanlines
+  for (int z = dvsBounds.min.z; z <= dvsBounds.max.z; ++z) {
+    const std::vector<size_t> &slice = slices[z - dvsBounds.min.z];
+    mapping.setSlice(dvsBounds.min.x, dvsBounds.min.y, z);
+    for (int y = dvsBounds.min.y; y <= dvsBounds.max.y; ++y) {
+      // Find the parts of the scanline that any box covers. Overlapping 
+      // spans are merged so that no voxel is written twice.
+      spans.clear();
+      BOOST_FOREACH (const size_t i, slice) {
+        if (y >= boxes[i].min.y && y <= boxes[i].max.y) {
+          spans.push_back(Span(boxes[i].min.x, boxes[i].max.x));
+        }
+      }
+      if (spans.empty()) {
+        continue;
+      }
+      std::sort(spans.begin(), spans.end());
+      size_t numSpans = 0;
+      for (size_t i = 1, size = spans.size(); i < size; ++i) {
+        if (spans[i].first <= spans[numSpans].second + 1) {
+          spans[numSpans].second = std::max(spans[numSpans].second, 
+                                            spans[i].second);
+        } else {
+          spans[++numSpans] = spans[i];
+        }
+      }
+      spans.resize(numSpans + 1);
+      BOOST_FOREACH (const Span &span, spans) {
+        const size_t width = span.second - span.first + 1;
+        // Check if the job was aborted
+        count += width;
+        if (count >= k_abortCheckInterval) {
+          if (context.job && context.job->aborted()) {
+            return;
+          }
+          count = 0;
+        }
+        // Get sampling derivatives/voxel size and world space positions
+        mapping.setupSpan(span.first, y, z, width, &rStates[0]);
+        // Sample the primitive for the whole span
+        std::fill(rSamples.begin(), rSamples.begin() + width, 
+                  RasterizationSample());
+        this->getSampleBatch(context, &rStates[0], &rSamples[0], width);
+        // Write the static samples. Moving ones are blurred below.
+        for (size_t s = 0; s < width; ++s) {
+          const RasterizationSample &rSample = rSamples[s];
+          if (Math::max(rSample.value) <= 0.0f) {
+            continue;
+          }
+          const int x = span.first + s;
+          if (rSample.wsVelocity.length2() == 0.0) {
+            if (isInWindow(x, y, z, window)) {
+              buffer->lvalue(x, y, z) += rSample.value;
+            }
+          } else {
+            moving.push_back(MotionSample(V3i(x, y, z), rSample.value, 
+                                          rStates[s].wsP, 
+                                          rSample.wsVelocity));
+          }
+        }
       }
     }
   }
+
+  if (!moving.empty()) {
+    rasterizeMotion(moving, buffer, window);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RasterizationPrim::getSampleBatch(const RasterizationContext &context,
+                                       const RasterizationState *states,
+                                       RasterizationSample *samples,
+                                       const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    getSample(context, states[i], samples[i]);
+  }
 }
 
 //----------------------------------------------------------------------------//
 // PointBase
 //----------------------------------------------------------------------------//
 
-BBox PointBase::wsBounds(Geo::Geometry::CPtr geometry) const
+void PointBase::itemWsBounds(Geo::Geometry::CPtr geometry, 
+                             const size_t first, const size_t last,
+                             RasterizationContext &context, 
+                             Imath::Box3f *bounds) const
 {
   assert(geometry != NULL);
   assert(geometry->particles() != NULL);
 
-  if (!geometry->particles()) {
-    Log::warning("Rasterization primitive has no particles. "
-                 "Skipping bounds generation.");
-    return BBox();
-  }
-
-  BBox wsBBox;
   AttrVisitor visitor(geometry->particles()->pointAttrs(), m_params);
 
-  for (AttrVisitor::const_iterator i = visitor.begin(), end = visitor.end(); 
-       i != end; ++i) {
-    BBox pointBounds = pointWsBounds(i);
-    wsBBox.extendBy(pointBounds);
+  AttrVisitor::const_iterator i = visitor.begin(first);
+  for (size_t item = first; item < last; ++item, ++i) {
+    const BBox pointBounds = pointWsBounds(i, context);
+    bounds[item - first] = Imath::Box3f(pointBounds.min, pointBounds.max);
   }
-
-  return wsBBox;
 }
 
 //----------------------------------------------------------------------------//
@@ -37,7 +37,6 @@
 
 // Project headers
 
-#include "pvr/RenderGlobals.h"
 #include "pvr/Scene.h"
 #include "pvr/Volumes/Volume.h"
 
@@ -64,16 +63,53 @@ DensitySampler::DensitySampler()
 
 //----------------------------------------------------------------------------//
 
+void DensitySampler::bindAttributes(const Volume &volume) const
+{
+  volume.bindAttribute(m_densityAttr);
+}
+
+//----------------------------------------------------------------------------//
+
 RaymarchSample
 DensitySampler::sample(const VolumeSampleState &state) const
 {
   VolumeSample sample = 
-    RenderGlobals::scene()->volume->sample(state, m_densityAttr);
+    state.rayState.context->scene->volume->sample(state, m_densityAttr);
   return RaymarchSample(sample.value, sample.value);
 }
 
 //----------------------------------------------------------------------------//
 
+void DensitySampler::sampleBatch(const VolumeSampleStatePtrVec &states,
+                                 RaymarchSampleVec &samples) const
+{
+  if (states.empty()) {
+    samples.clear();
+    return;
+  }
+
+  VolumeSampleVec     volumeSamples;
+  const Volume::CPtr &volume = states[0]->rayState.context->scene->volume;
+  volume->sampleBatch(states, m_densityAttr, volumeSamples);
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    samples[i] = RaymarchSample(volumeSamples[i].value, 
+                                volumeSamples[i].value);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool DensitySampler::extinctionMajorant(const RayState &state, 
+                                        const double t0, const double t1,
+                                        Color &majorant) const
+{
+  return state.context->scene->volume->majorant(state, m_densityAttr, 
+                                                t0, t1, majorant);
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
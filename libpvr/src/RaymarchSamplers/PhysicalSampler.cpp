@@ -33,9 +33,14 @@
 
 // System includes
 
+#include <algorithm>
+#include <vector>
+
 // Library includes
 
 #include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <OpenEXR/ImathRandom.h>
 
 // Project headers
 
@@ -43,9 +48,10 @@
 #include "pvr/Scene.h"
 #include "pvr/Volumes/Volume.h"
 #include "pvr/Constants.h"
-
+#include "pvr/InScatterCache.h"
 #include "pvr/Lights/Light.h"
-#include "pvr/RenderGlobals.h"
+#include "pvr/Stats.h"
+#include "pvr/StlUtil.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -55,7 +61,265 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
-  
+  using namespace pvr;
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+  // Strings
+  //--------------------------------------------------------------------------//
+
+  const std::string k_strLightSamples("light_samples");
+  const std::string k_strOcclusionCullThreshold("occlusion_cull_threshold");
+  const std::string k_strOcclusionCullRoulette("occlusion_cull_roulette");
+
+  //--------------------------------------------------------------------------//
+  // Structs
+  //--------------------------------------------------------------------------//
+
+  //! Unoccluded contribution of a single light at a sample point
+  struct LightContribution
+  {
+    LightContribution(const size_t idx, const Color &c, const Vector &wsP)
+      : lightIdx(idx), L(c), wsLightP(wsP)
+    { }
+    //! Index of the light in the scene's light list
+    size_t       lightIdx;
+    //! Scattered luminance, before occlusion
+    Color        L;
+    //! Sampled position on the light
+    Vector       wsLightP;
+  };
+
+  typedef std::vector<LightContribution> LightContributionVec;
+
+  //--------------------------------------------------------------------------//
+
+  //! Contribution that waits for its light's occluder to be evaluated
+  struct DeferredContribution
+  {
+    DeferredContribution(const size_t idx, const LightContribution &c)
+      : sampleIdx(idx), L(c.L), wsLightP(c.wsLightP)
+    { }
+    //! Index of the sample point in the batch
+    size_t sampleIdx;
+    //! Scattered luminance, before occlusion
+    Color  L;
+    //! Sampled position on the light
+    Vector wsLightP;
+  };
+
+  typedef std::vector<DeferredContribution> DeferredContributionVec;
+
+  //--------------------------------------------------------------------------//
+  // Helper functions
+  //--------------------------------------------------------------------------//
+
+  //! Records the luminance of a single light in the sample, if the ray 
+  //! asked for it
+  void addLightLuminance(const RayState &rayState, const size_t lightIdx, 
+                         const size_t numLights, const Color &L,
+                         RaymarchSample &sample)
+  {
+    if (!rayState.doOutputLights) {
+      return;
+    }
+    if (sample.lightLuminance.empty()) {
+      sample.lightLuminance.assign(numLights, Colors::zero());
+    }
+    sample.lightLuminance[lightIdx] += L;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Seeds the light selection from the sample point, so that the choice of
+  //! lights is deterministic regardless of which thread renders the sample.
+  //! Each stream gives an independent sequence for the same point.
+  size_t sampleSeed(const VolumeSampleState &state, const size_t stream = 0)
+  {
+    size_t seed = stream;
+    boost::hash_combine(seed, state.wsP.x);
+    boost::hash_combine(seed, state.wsP.y);
+    boost::hash_combine(seed, state.wsP.z);
+    boost::hash_combine(seed, state.rayState.time);
+    return seed;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the light links of a scattering sample. Samples that no
+  //! composite volume linked use the mask of the scene's volume itself.
+  LightLinks sampleLinks(const VolumeSampleState &state,
+                         const VolumeSample &scSample)
+  {
+    if (scSample.lightLinks.isLinked()) {
+      return scSample.lightLinks;
+    }
+    LightLinks links;
+    links.add(state.rayState.context->scene->volume->lightMask(), 1.0f);
+    return links;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the render's in-scatter cache if it may stand in for the
+  //! lights at the sample point, and null otherwise. The cache holds no
+  //! direction or per-light parts, so only isotropic samples on rays that 
+  //! don't output each light's luminance, and that all lights illuminate,
+  //! may use it.
+  const InScatterCache* inScatterCache(const VolumeSampleState &state,
+                                       const VolumeSample &scSample,
+                                       const LightLinks &links)
+  {
+    const InScatterCache *cache = state.rayState.context->inScatterCache;
+    if (!cache || state.rayState.doOutputLights || !scSample.isIsotropic() ||
+        links.isLinked()) {
+      return NULL;
+    }
+    return cache;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Collects the attributes that the scene's volume has, and the position
+  //! of each in attrs. Attributes that it lacks sample to zero, so leaving
+  //! them out of the lookup doesn't change the result.
+  //! \returns The number of attributes collected
+  size_t boundAttrs(const VolumeAttr *const *attrs, const size_t numAttrs,
+                    const VolumeAttr **bound, size_t *slots)
+  {
+    size_t numBound = 0;
+    for (size_t i = 0; i < numAttrs; ++i) {
+      if (attrs[i]->index() != VolumeAttr::IndexInvalid) {
+        bound[numBound] = attrs[i];
+        slots[numBound] = i;
+        ++numBound;
+      }
+    }
+    return numBound;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Scalar importance used when choosing between lights
+  float importance(const Color &L)
+  {
+    return L.x + L.y + L.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the unoccluded contribution of each light at the sample point,
+  //! given the sample of each light at the point. Lights that contribute 
+  //! nothing, or that aren't linked to the sample, are culled before 
+  //! their occluder is queried. Lights linked to part of the sample are 
+  //! scaled by that part. If numSamples is
+  //! non-zero and smaller than the number of remaining lights, numSamples 
+  //! lights are chosen in proportion to their contribution, with the 
+  //! selection probability folded into L.
+  void findContributions(const VolumeSampleState &state,
+                         const VolumeSample &scSample,
+                         const LightLinks &links,
+                         const LightSample *lightSamples,
+                         const size_t numSamples,
+                         LightContributionVec &contribs)
+  {
+    const Scene       *scene   = state.rayState.context->scene;
+    const Color &      sigma_s = scSample.value;
+    const Vector       wo      = -state.rayState.wsRay.dir;
+
+    contribs.clear();
+    contribs.reserve(scene->lights.size());
+
+    for (size_t i = 0, size = scene->lights.size(); i < size; ++i) {
+      const LightSample &lightSample = lightSamples[i];
+      const float        linked      = links.fraction(i);
+      if (linked <= 0.0f || Math::max(lightSample.luminance) <= 0.0f) {
+        continue;
+      }
+      const Vector wi = (state.wsP - lightSample.wsP).normalized();
+      const float  p  = scSample.probability(wi, wo);
+      const Color  L  = sigma_s * (p * linked) * lightSample.luminance;
+      if (Math::max(L) > 0.0f) {
+        contribs.push_back(LightContribution(i, L, lightSample.wsP));
+      }
+    }
+
+    if (numSamples == 0 || contribs.size() <= numSamples) {
+      return;
+    }
+
+    // Choose lights using stratified samples of the cumulative distribution
+    std::vector<float> cdf(contribs.size());
+    float sum = 0.0f;
+    for (size_t i = 0, size = contribs.size(); i < size; ++i) {
+      sum += importance(contribs[i].L);
+      cdf[i] = sum;
+    }
+
+    Imath::Rand48        rng(sampleSeed(state));
+    LightContributionVec chosen;
+    chosen.reserve(numSamples);
+
+    for (size_t i = 0; i < numSamples; ++i) {
+      const float  u   = (i + rng.nextf()) / numSamples * sum;
+      const size_t idx = 
+        std::min(static_cast<size_t>(std::upper_bound(cdf.begin(), 
+                                                      cdf.end(), u) - 
+                                     cdf.begin()),
+                 contribs.size() - 1);
+      const LightContribution &c   = contribs[idx];
+      const float              pdf = importance(c.L) / sum;
+      chosen.push_back(LightContribution(c.lightIdx, 
+                                         c.L / (pdf * numSamples), 
+                                         c.wsLightP));
+    }
+
+    contribs.swap(chosen);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Culls the contributions whose occluder lookup couldn't add threshold 
+  //! times the luminance that the ray has accumulated, even if the light 
+  //! were unoccluded. With roulette, such a contribution survives with a
+  //! probability in proportion to what it could add, and is scaled by the 
+  //! inverse of it, which leaves the expected luminance unchanged.
+  //! \returns The number of contributions culled
+  size_t cullContributions(const VolumeSampleState &state,
+                           const float threshold, const bool doRoulette,
+                           LightContributionVec &contribs)
+  {
+    if (threshold <= 0.0f || state.stepLength <= 0.0 || contribs.empty()) {
+      return 0;
+    }
+    const float minImportance = threshold * importance(state.rayLuminance);
+    if (minImportance <= 0.0f) {
+      return 0;
+    }
+
+    // The step's weight can't exceed the transmittance at its start times 
+    // its length
+    const Color   weight = state.rayTransmittance * state.stepLength;
+    Imath::Rand48 rng(sampleSeed(state, 1));
+    size_t        numKept = 0;
+
+    for (size_t i = 0, size = contribs.size(); i < size; ++i) {
+      LightContribution &c     = contribs[i];
+      const float        bound = importance(c.L * weight);
+      if (bound < minImportance) {
+        const float p = bound / minImportance;
+        if (!doRoulette || rng.nextf() >= p) {
+          continue;
+        }
+        c.L /= p;
+      }
+      contribs[numKept++] = c;
+    }
+
+    const size_t numCulled = contribs.size() - numKept;
+    contribs.erase(contribs.begin() + numKept, contribs.end());
+    return numCulled;
+  }
 
   //--------------------------------------------------------------------------//
 
@@ -72,6 +336,16 @@ using namespace std;
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// PhysicalSampler::Params
+//----------------------------------------------------------------------------//
+
+PhysicalSampler::Params::Params()
+  : lightSamples(0), occlusionCullThreshold(0.0f), occlusionCullRoulette(1)
+{ 
+  // Empty
+}
+
 //----------------------------------------------------------------------------//
 // PhysicalSampler
 //----------------------------------------------------------------------------//
@@ -86,57 +360,316 @@ PhysicalSampler::PhysicalSampler()
 
 //----------------------------------------------------------------------------//
 
+void PhysicalSampler::setParams(const Util::ParamMap &params)
+{
+  getValue(params.intMap, k_strLightSamples, m_params.lightSamples);
+  getValue(params.floatMap, k_strOcclusionCullThreshold, 
+           m_params.occlusionCullThreshold);
+  getValue(params.intMap, k_strOcclusionCullRoulette, 
+           m_params.occlusionCullRoulette);
+}
+
+//----------------------------------------------------------------------------//
+
+void PhysicalSampler::bindAttributes(const Volume &volume) const
+{
+  volume.bindAttribute(m_scatteringAttr);
+  volume.bindAttribute(m_absorptionAttr);
+  volume.bindAttribute(m_emissionAttr);
+}
+
+//----------------------------------------------------------------------------//
+
 RaymarchSample PhysicalSampler::sample(const VolumeSampleState &state) const
 {
-  const Scene::CPtr    scene          = RenderGlobals::scene();
-  const Volume::CPtr   volume         = scene->volume;
+  const Volume::CPtr  &volume         = state.rayState.context->scene->volume;
+
+  // Look up all the attributes that the volume has at once
+  const VolumeAttr    *attrs[3]       = { &m_absorptionAttr, &m_emissionAttr, 
+                                          &m_scatteringAttr };
+  const VolumeAttr    *bound[3];
+  size_t               slots[3];
+  const size_t         numBound       = boundAttrs(attrs, 3, bound, slots);
+  VolumeSample         attrSamples[3];
+  if (numBound == 3) {
+    volume->sampleAttributes(state, attrs, 3, attrSamples);
+  } else if (numBound > 0) {
+    VolumeSample boundSamples[3];
+    volume->sampleAttributes(state, bound, numBound, boundSamples);
+    for (size_t i = 0; i < numBound; ++i) {
+      attrSamples[slots[i]] = boundSamples[i];
+    }
+  }
 
-  LightSampleState     lightState     (state.rayState);
-  OcclusionSampleState occlusionState (state.rayState);
+  return sampleScattering(state, attrSamples[0].value, attrSamples[1].value,
+                          attrSamples[2]);
+}
 
-  const Vector         wo             = -state.rayState.wsRay.dir;
+//----------------------------------------------------------------------------//
 
-  VolumeSample         abSample       = volume->sample(state, m_absorptionAttr);
-  VolumeSample         emSample       = volume->sample(state, m_emissionAttr);
-  VolumeSample         scSample       = volume->sample(state, m_scatteringAttr);
+void PhysicalSampler::sampleBatch(const VolumeSampleStatePtrVec &states,
+                                  RaymarchSampleVec &samples) const
+{
+  if (states.empty()) {
+    samples.clear();
+    return;
+  }
 
-  const Color &        sigma_s        = scSample.value;
-  const Color &        sigma_a        = abSample.value;
-  const Color &        L_em           = emSample.value;
+  const Scene         *scene          = states[0]->rayState.context->scene;
+  const Volume::CPtr  &volume         = scene->volume;
+
+  const VolumeAttr    *attrs[3]       = { &m_absorptionAttr, &m_emissionAttr, 
+                                          &m_scatteringAttr };
+  const VolumeAttr    *bound[3];
+  size_t               slots[3];
+  const size_t         numBound       = boundAttrs(attrs, 3, bound, slots);
+  VolumeSampleVec      attrSamples[3];
+
+  if (numBound == 3) {
+    volume->sampleAttributesBatch(states, attrs, 3, attrSamples);
+  } else {
+    VolumeSampleVec boundSamples[3];
+    if (numBound > 0) {
+      volume->sampleAttributesBatch(states, bound, numBound, boundSamples);
+    }
+    for (size_t i = 0; i < numBound; ++i) {
+      attrSamples[slots[i]].swap(boundSamples[i]);
+    }
+    for (size_t i = 0; i < 3; ++i) {
+      attrSamples[i].resize(states.size());
+    }
+  }
 
-  // Only perform calculation if ray is primary and scattering coefficient is
-  // greater than zero.
+  const VolumeSampleVec &abSamples = attrSamples[0];
+  const VolumeSampleVec &emSamples = attrSamples[1];
+  const VolumeSampleVec &scSamples = attrSamples[2];
+
+  const size_t numLights  = scene->lights.size();
+  const size_t numSamples = 
+    static_cast<size_t>(std::max(m_params.lightSamples, 0));
+
+  // Find the sample points that scatter light
+  std::vector<size_t> scattering;
+  std::vector<LightLinks> links;
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    const Color &sigma_s = scSamples[i].value;
+    samples[i] = RaymarchSample(emSamples[i].value, 
+                                sigma_s + abSamples[i].value);
+    if (Math::max(sigma_s) <= 0.0f ||
+        states[i]->rayState.rayType != RayState::FullRaymarch) {
+      continue;
+    }
+    const LightLinks scLinks = sampleLinks(*states[i], scSamples[i]);
+    if (const InScatterCache *cache = 
+        inScatterCache(*states[i], scSamples[i], scLinks)) {
+      samples[i].luminance += sigma_s * cache->sample(*states[i]);
+    } else {
+      scattering.push_back(i);
+      links.push_back(scLinks);
+    }
+  }
+  if (scattering.empty() || numLights == 0) {
+    return;
+  }
+
+  // Sample each light at all the scattering points at once
+  std::vector<LightSampleState> lightStates;
+  LightSampleStatePtrVec        lightStatePtrs;
+  LightSampleVec                lightBatch;
+  LightSampleVec                lightSamples(scattering.size() * numLights);
+
+  lightStates.reserve(scattering.size());
+  BOOST_FOREACH (const size_t i, scattering) {
+    lightStates.push_back(LightSampleState(states[i]->rayState));
+    lightStates.back().wsP = states[i]->wsP;
+  }
+  BOOST_FOREACH (const LightSampleState &lightState, lightStates) {
+    lightStatePtrs.push_back(&lightState);
+  }
+  for (size_t l = 0; l < numLights; ++l) {
+    // Lights that no sample in the batch is linked to are never sampled
+    bool isLinked = false;
+    for (size_t j = 0, size = links.size(); j < size && !isLinked; ++j) {
+      isLinked = links[j].fraction(l) > 0.0f;
+    }
+    if (!isLinked) {
+      continue;
+    }
+    scene->lights[l]->sampleBatch(lightStatePtrs, lightBatch);
+    for (size_t j = 0, size = scattering.size(); j < size; ++j) {
+      lightSamples[j * numLights + l] = lightBatch[j];
+    }
+  }
+
+  // Find the light contributions of every sample point, grouped by light, 
+  // so that each light's occluder is evaluated once for the whole batch.
+  std::vector<DeferredContributionVec> deferred(numLights);
+  LightContributionVec                 contribs;
+
+  for (size_t j = 0, size = scattering.size(); j < size; ++j) {
+    const size_t i = scattering[j];
+    findContributions(*states[i], scSamples[i], links[j], 
+                      &lightSamples[j * numLights], numSamples, contribs);
+    Sys::Stats::add(Sys::Stats::CulledOccluderLookups,
+                    cullContributions(*states[i], 
+                                      m_params.occlusionCullThreshold,
+                                      m_params.occlusionCullRoulette != 0,
+                                      contribs));
+    BOOST_FOREACH (const LightContribution &c, contribs) {
+      deferred[c.lightIdx].push_back(DeferredContribution(i, c));
+    }
+  }
+
+  // Evaluate each light's occluder and accumulate
+  std::vector<OcclusionSampleState> occlusionStates;
+  OcclusionSampleStatePtrVec        occlusionStatePtrs;
+  ColorVec                          transmittances;
+
+  for (size_t l = 0; l < numLights; ++l) {
+    const DeferredContributionVec &lightContribs = deferred[l];
+    if (lightContribs.empty()) {
+      continue;
+    }
+    occlusionStates.clear();
+    occlusionStates.reserve(lightContribs.size());
+    BOOST_FOREACH (const DeferredContribution &c, lightContribs) {
+      OcclusionSampleState occlusionState(states[c.sampleIdx]->rayState);
+      occlusionState.wsP      = states[c.sampleIdx]->wsP;
+      occlusionState.wsLightP = c.wsLightP;
+      occlusionStates.push_back(occlusionState);
+    }
+    occlusionStatePtrs.clear();
+    BOOST_FOREACH (const OcclusionSampleState &o, occlusionStates) {
+      occlusionStatePtrs.push_back(&o);
+    }
+    Sys::Stats::add(Sys::Stats::OccluderLookups, occlusionStatePtrs.size());
+    scene->lights[l]->occluder()->sampleBatch(occlusionStatePtrs, 
+                                              transmittances);
+    for (size_t i = 0, size = lightContribs.size(); i < size; ++i) {
+      const size_t    sampleIdx = lightContribs[i].sampleIdx;
+      const Color     L         = lightContribs[i].L * transmittances[i];
+      RaymarchSample &sample    = samples[sampleIdx];
+      sample.luminance += L;
+      addLightLuminance(states[sampleIdx]->rayState, l, numLights, L, 
+                        sample);
+    }
+  }
+}
 
-  Color                L_sc           = Colors::zero();
+//----------------------------------------------------------------------------//
 
-  if (Math::max(sigma_s) > 0.0f &&
-      state.rayState.rayType == RayState::FullRaymarch) {
+Color PhysicalSampler::extinction(const VolumeSampleState &state) const
+{
+  return state.rayState.context->scene->volume->sampleSum(state, 
+                                                          m_scatteringAttr,
+                                                          m_absorptionAttr);
+}
 
-    // Update light and occluder sample states
-    lightState.wsP     = state.wsP;
-    occlusionState.wsP = state.wsP;
+//----------------------------------------------------------------------------//
 
-    // For each light source
-    BOOST_FOREACH (Light::CPtr light, scene->lights) {
+void PhysicalSampler::extinctionBatch(const VolumeSampleStatePtrVec &states,
+                                      RaymarchSampleVec &samples) const
+{
+  if (states.empty()) {
+    samples.clear();
+    return;
+  }
 
-      // Sample the light
-      LightSample lightSample = light->sample(lightState);
+  ColorVec            sigma_e;
+  const Volume::CPtr &volume = states[0]->rayState.context->scene->volume;
+  volume->sampleSumBatch(states, m_scatteringAttr, m_absorptionAttr, sigma_e);
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    samples[i] = RaymarchSample(Colors::zero(), sigma_e[i]);
+  }
+}
 
-      // Sample the occluder
-      occlusionState.wsLightP = lightSample.wsP;
-      Color transmittance     = light->occluder()->sample(occlusionState);
+//----------------------------------------------------------------------------//
 
-      // Find the scattering probability
-      const Vector wi = (state.wsP - lightSample.wsP).normalized();
-      const float  p  = scSample.phaseFunction->probability(wi, wo);
+bool PhysicalSampler::extinctionMajorant(const RayState &state, 
+                                         const double t0, const double t1,
+                                         Color &majorant) const
+{
+  const Volume::CPtr &volume = state.context->scene->volume;
+
+  Color sigma_s, sigma_a;
+  if (!volume->majorant(state, m_scatteringAttr, t0, t1, sigma_s) ||
+      !volume->majorant(state, m_absorptionAttr, t0, t1, sigma_a)) {
+    return false;
+  }
+  majorant = sigma_s + sigma_a;
 
-      // Update luminance
-      L_sc += sigma_s * p * lightSample.luminance * transmittance;
+  return true;
+}
 
+//----------------------------------------------------------------------------//
+
+RaymarchSample 
+PhysicalSampler::sampleScattering(const VolumeSampleState &state,
+                                  const Color &sigma_a, 
+                                  const Color &L_em,
+                                  const VolumeSample &scSample) const
+{
+  const Scene         *scene          = state.rayState.context->scene;
+
+  const Color &        sigma_s        = scSample.value;
+
+  // Only perform calculation if ray is primary and scattering coefficient is
+  // greater than zero.
+
+  RaymarchSample       result(L_em, sigma_s + sigma_a);
+
+  if (Math::max(sigma_s) <= 0.0f ||
+      state.rayState.rayType != RayState::FullRaymarch) {
+    return result;
+  }
+
+  // Interpolate the lights' contribution if possible
+  const LightLinks links = sampleLinks(state, scSample);
+  if (const InScatterCache *cache = inScatterCache(state, scSample, links)) {
+    result.luminance += sigma_s * cache->sample(state);
+    return result;
+  }
+
+  if (scene->lights.empty()) {
+    return result;
+  }
+
+  OcclusionSampleState occlusionState(state.rayState);
+  occlusionState.wsP = state.wsP;
+
+  // Sample each linked light and find the contributing ones
+  LightSampleState lightState(state.rayState);
+  lightState.wsP = state.wsP;
+  LightSampleVec lightSamples(scene->lights.size());
+  for (size_t i = 0, size = scene->lights.size(); i < size; ++i) {
+    if (links.fraction(i) > 0.0f) {
+      lightSamples[i] = scene->lights[i]->sample(lightState);
     }
   }
+  LightContributionVec contribs;
+  findContributions(state, scSample, links, 
+                    lightSamples.empty() ? NULL : &lightSamples[0],
+                    static_cast<size_t>(std::max(m_params.lightSamples, 0)),
+                    contribs);
+  Sys::Stats::add(Sys::Stats::CulledOccluderLookups,
+                  cullContributions(state, m_params.occlusionCullThreshold,
+                                    m_params.occlusionCullRoulette != 0,
+                                    contribs));
+
+  // Sample the occluder of each
+  Sys::Stats::add(Sys::Stats::OccluderLookups, contribs.size());
+  BOOST_FOREACH (const LightContribution &c, contribs) {
+    occlusionState.wsLightP = c.wsLightP;
+    const Color L = c.L * scene->lights[c.lightIdx]->occluder()->
+      sample(occlusionState);
+    result.luminance += L;
+    addLightLuminance(state.rayState, c.lightIdx, scene->lights.size(), L, 
+                      result);
+  }
 
-  return RaymarchSample(L_sc + L_em, sigma_s + sigma_a);
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <boost/foreach.hpp>
@@ -46,6 +48,7 @@
 #include "pvr/Math.h"
 #include "pvr/RenderGlobals.h"
 #include "pvr/Scene.h"
+#include "pvr/Stats.h"
 #include "pvr/StlUtil.h"
 #include "pvr/Types.h"
 #include "pvr/Volumes/Volume.h"
@@ -68,6 +71,14 @@ namespace {
   const std::string k_strVolumeStepLengthMult("volume_step_length_multiplier");
   const std::string k_strDoTrapezoidIntegration("do_trapezoid_integration");
   const std::string k_strEarlyTermThresh("early_termination_threshold");
+  const std::string k_strShadowStepLengthMult("shadow_step_length_multiplier");
+  const std::string k_strShadowEarlyTermThresh(
+    "shadow_early_termination_threshold");
+  const std::string k_strJitterSteps("jitter_steps");
+  const std::string k_strHomogeneousStepLengthMult(
+    "homogeneous_step_length_multiplier");
+  const std::string k_strRouletteThresh("roulette_threshold");
+  const std::string k_strShadowRouletteThresh("shadow_roulette_threshold");
 
   //--------------------------------------------------------------------------//
   // Helper functions
@@ -102,7 +113,13 @@ AdaptiveRaymarcher::Params::Params()
   : threshold(0.1), 
     volumeStepLengthMult(4.0),
     doTrapezoidIntegration(1), 
-    earlyTerminationThreshold(0.001)
+    earlyTerminationThreshold(0.001),
+    shadowStepLengthMult(1.0),
+    shadowEarlyTerminationThreshold(0.001),
+    doJitterSteps(0),
+    homogeneousStepLengthMult(4.0),
+    rouletteThreshold(0.0),
+    shadowRouletteThreshold(0.0)
 { 
   // Empty
 }
@@ -121,6 +138,18 @@ void AdaptiveRaymarcher::setParams(const Util::ParamMap &params)
            m_params.doTrapezoidIntegration);
   getValue(params.floatMap, k_strEarlyTermThresh, 
            m_params.earlyTerminationThreshold);
+  getValue(params.floatMap, k_strShadowStepLengthMult, 
+           m_params.shadowStepLengthMult);
+  getValue(params.floatMap, k_strShadowEarlyTermThresh, 
+           m_params.shadowEarlyTerminationThreshold);
+  getValue(params.intMap, k_strJitterSteps, 
+           m_params.doJitterSteps);
+  getValue(params.floatMap, k_strHomogeneousStepLengthMult, 
+           m_params.homogeneousStepLengthMult);
+  getValue(params.floatMap, k_strRouletteThresh, 
+           m_params.rouletteThreshold);
+  getValue(params.floatMap, k_strShadowRouletteThresh, 
+           m_params.shadowRouletteThreshold);
 
   cout << "Threshold: " << m_params.threshold << endl;
 }
@@ -130,10 +159,15 @@ void AdaptiveRaymarcher::setParams(const Util::ParamMap &params)
 IntegrationResult
 AdaptiveRaymarcher::integrate(const RayState &state) const
 {
+  Sys::Stats::add(state.rayType == RayState::FullRaymarch ?
+                  Sys::Stats::FullRaymarchRays : 
+                  Sys::Stats::TransmittanceOnlyRays);
+
   // Integration intervals ---
 
-  IntervalVec rawIntervals = RenderGlobals::scene()->volume->intersect(state);
-  IntervalVec intervals = splitIntervals(rawIntervals);
+  RaymarchScratch::Lease scratch;
+  findIntervals(state, *scratch);
+  const IntervalVec &intervals = scratch->intervals;
 
   if (intervals.size() == 0) {
     return IntegrationResult();
@@ -141,17 +175,42 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
 
   // Output transmittance function ---
 
-  ColorCurve::Ptr lf = setupDeepLCurve(state, intervals[0].t0);
-  ColorCurve::Ptr tf = setupDeepTCurve(state, intervals[0].t0);
+  ColorCurve::Ptr   lf = setupDeepLCurve(state, intervals[0].t0);
+  ColorCurve::Ptr   tf = setupDeepTCurve(state, intervals[0].t0);
+  DeepSimplifyState simplify;
 
   // Ray integration variables ---
 
   VolumeSampleState sampleState(state);
   Color             L = Colors::zero();
   Color             T = Colors::one();
+  Imath::Rand48     rng(raySeed(state));
 
   Color previousL = Colors::zero();
   Color previousT = Colors::one();
+
+  // Luminance of each light, if requested, and its previous trapezoid term
+  ColorVec lightL, previousLightL;
+
+  // Samples that ended a step that turned out to be too long. The shorter
+  // steps that replace it end at the sample instead of discarding it, so
+  // every evaluated sample contributes. They lie ahead of the current 
+  // step, with the nearest one last.
+  RaymarchSampleVec   &rejectedSamples = scratch->rejectedSamples;
+  std::vector<double> &rejectedTimes   = scratch->rejectedTimes;
+
+  // Shadow rays use their own step length and termination settings
+  const bool   isShadowRay   = state.rayType == RayState::TransmittanceOnly;
+  const double stepMult      = 
+    m_params.volumeStepLengthMult * 
+    (isShadowRay ? m_params.shadowStepLengthMult : 1.0) *
+    RenderGlobals::previewStepScale();
+  const double termThreshold = 
+    isShadowRay ? m_params.shadowEarlyTerminationThreshold : 
+    m_params.earlyTerminationThreshold;
+  const double rouletteThreshold = 
+    isShadowRay ? m_params.shadowRouletteThreshold : 
+    m_params.rouletteThreshold;
   
   // Interval loop ---
 
@@ -163,29 +222,118 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
 
     // Base step length, used as upper bound
     const double baseStepLength = 
-      std::min(interval.stepLength * m_params.volumeStepLengthMult,
+      std::min(interval.stepLength * stepMult,
                tEnd - tStart);
 
     // Set up first raymarch step
     double stepT0 = tStart;
-    double stepT1 = tStart + baseStepLength;
+    double stepT1 = tStart + 
+      (m_params.doJitterSteps ? jitteredStepLength(state, baseStepLength) : 
+       baseStepLength);
 
     // Prevent infinite loops.
     if (stepT0 == stepT1) {
       continue;
     }
 
+    Sys::Stats::add(Sys::Stats::RaymarchIntervals);
+
+    rejectedSamples.clear();
+    rejectedTimes.clear();
+
+    // Homogeneous intervals ---
+
+    // Transmittance is integrated in closed form, so shadow rays take the
+    // whole interval in one step, and camera rays take uniform steps that
+    // only need to resolve the lighting.
+    if (interval.isHomogeneous) {
+      const double stepLength = isShadowRay ? tEnd - tStart :
+        baseStepLength * m_params.homogeneousStepLengthMult;
+      bool doTerminate = false;
+      long numSteps    = 0;
+      double t0 = tStart;
+      double t1 = std::min(tStart + 
+                           (m_params.doJitterSteps && !isShadowRay ? 
+                            jitteredStepLength(state, stepLength) : 
+                            stepLength), tEnd);
+      while (t0 < tEnd) {
+        numSteps++;
+        const double length = t1 - t0;
+        sampleState.wsP              = state.wsRay((t0 + t1) * 0.5);
+        sampleState.rayTransmittance = T;
+        sampleState.rayLuminance     = L;
+        sampleState.stepLength       = length;
+        RaymarchSample sample = isShadowRay ?
+          RaymarchSample(Colors::zero(), 
+                         m_raymarchSampler->extinction(sampleState)) :
+          m_raymarchSampler->sample(sampleState);
+        // Weight by the transmittance over the step before updating it
+        const Color weight = T * homogeneousStepWeight(sample.extinction, 
+                                                       length);
+        T *= exp(-sample.extinction * length);
+        L += sample.luminance * weight;
+        if (state.doOutputLights) {
+          accumulateLights(sample, weight, lightL);
+        }
+        // Russian roulette and early termination
+        T *= rouletteWeight(T, rouletteThreshold, rng);
+        if (Math::max(T) <= termThreshold) {
+          T = Colors::zero();
+          doTerminate = true;
+          Sys::Stats::add(Sys::Stats::EarlyTerminations);
+        }
+        // Update transmittance and luminance functions
+        if (tf || lf) {
+          updateDeepFunctions(t1, L, T, lf, tf, simplify);
+        }
+        if (doTerminate) {
+          break;
+        }
+        t0 = t1;
+        t1 = std::min(t1 + stepLength, tEnd);
+      }
+      Sys::Stats::add(Sys::Stats::RaymarchSteps, numSteps);
+      if (doTerminate) {
+        break;
+      }
+      // The trapezoid rule starts over in the next interval
+      previousT = Colors::one();
+      previousL = Colors::zero();
+      previousLightL.assign(lightL.size(), Colors::zero());
+      continue;
+    }
+
     // Raymarch loop ---
  
     bool doTerminate = false;
+    long numSteps    = 0;
 
     while (stepT0 < tEnd) {
 
-      const double stepLength = stepT1 - stepT0;
-      const double t = stepT1;
+      // Steps that end at or just short of a rejected sample are snapped to
+      // it and reuse it. Otherwise a new sample is taken at the step's end.
+      RaymarchSample sample;
+      if (!rejectedTimes.empty() && 
+          stepT1 + 0.1 * (stepT1 - stepT0) >= rejectedTimes.back()) {
+        stepT1 = rejectedTimes.back();
+        std::swap(sample, rejectedSamples.back());
+        rejectedSamples.pop_back();
+        rejectedTimes.pop_back();
+      } else {
+        // Every evaluated sample counts. Steps that end at it later are 
+        // no longer than this one.
+        numSteps++;
+        sampleState.wsP              = state.wsRay(stepT1);
+        sampleState.rayTransmittance = T;
+        sampleState.rayLuminance     = L;
+        sampleState.stepLength       = stepT1 - stepT0;
+        sample = isShadowRay ?
+          RaymarchSample(Colors::zero(), 
+                         m_raymarchSampler->extinction(sampleState)) :
+          m_raymarchSampler->sample(sampleState);
+      }
 
-      sampleState.wsP = state.wsRay(t);
-      RaymarchSample sample = m_raymarchSampler->sample(sampleState);
+      const double stepLength = stepT1 - stepT0;
 
 #if 1
       const double divisor = std::sqrt(Math::max(T) / m_params.threshold);
@@ -202,7 +350,11 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
         const double suggestedStep = meanFreePath / divisor;
         // Check if we need to reduce the step size
         if (stepLength > suggestedStep * 1.1) {
-          // Recompute step with shorter step length
+          // Recompute step with shorter step length, keeping the sample for
+          // when the shorter steps reach it
+          rejectedSamples.push_back(RaymarchSample());
+          std::swap(rejectedSamples.back(), sample);
+          rejectedTimes.push_back(stepT1);
           stepT1 = std::min(stepT0 + std::min(suggestedStep, adaptedStepLength),
                             tEnd);
           continue;
@@ -239,16 +391,45 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
       } else {
         L += sample.luminance * T * stepLength;
       }
+      if (state.doOutputLights) {
+        const ColorVec &sampleL = sample.lightLuminance;
+        if (lightL.size() < sampleL.size()) {
+          lightL.resize(sampleL.size(), Colors::zero());
+          previousLightL.resize(sampleL.size(), Colors::zero());
+        }
+        for (size_t i = 0, size = lightL.size(); i < size; ++i) {
+          const Color term = i < sampleL.size() ? 
+            sampleL[i] * T * stepLength : Colors::zero();
+          if (m_params.doTrapezoidIntegration) {
+            lightL[i] += (term + previousLightL[i]) * 0.5;
+            previousLightL[i] = term;
+          } else {
+            lightL[i] += term;
+          }
+        }
+      }
+
+      // Russian roulette. The trapezoid terms carried to the next step are 
+      // reweighted along with the transmittance.
+      const float survival = rouletteWeight(T, rouletteThreshold, rng);
+      if (survival != 1.0f) {
+        T         *= survival;
+        previousL *= survival;
+        for (size_t i = 0, size = previousLightL.size(); i < size; ++i) {
+          previousLightL[i] *= survival;
+        }
+      }
 
       // Early termination
-      if (Math::max(T) < m_params.earlyTerminationThreshold) {
+      if (Math::max(T) <= termThreshold) {
         T = Colors::zero();
         doTerminate = true;
+        Sys::Stats::add(Sys::Stats::EarlyTerminations);
       }
 
       // Update transmittance and luminance functions
       if (tf || lf) {
-        updateDeepFunctions(stepT1, L, T, lf, tf);
+        updateDeepFunctions(stepT1, L, T, lf, tf, simplify);
       }
 
       // Terminate if requested
@@ -258,6 +439,8 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
 
     }
 
+    Sys::Stats::add(Sys::Stats::RaymarchSteps, numSteps);
+
   } // end for each interval
 
   if (tf) {
@@ -268,7 +451,9 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
     lf->removeDuplicates();
   }
 
-  return IntegrationResult(L, lf, T, tf);
+  IntegrationResult result(L, lf, T, tf);
+  result.lightLuminance.swap(lightL);
+  return result;
 }
 
 //----------------------------------------------------------------------------//
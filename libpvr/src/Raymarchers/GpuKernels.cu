@@ -0,0 +1,760 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuKernels.cu
+  Contains the CUDA kernels of GpuRaymarcher and their host interface.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Raymarchers/GpuKernels.h"
+
+#ifdef PVR_USE_CUDA
+
+// System includes
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Library includes
+
+#include <cuda_runtime.h>
+
+//----------------------------------------------------------------------------//
+// Device resources
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+
+class Scene
+{
+public:
+  Scene()
+    : volumes(NULL), numVolumes(0), occluders(NULL), lights(NULL),
+      numLights(0)
+  { }
+  //! Backing arrays of the textures
+  std::vector<cudaArray_t>         arrays;
+  //! All texture objects
+  std::vector<cudaTextureObject_t> textures;
+  //! Block arrays of the sparse volumes
+  std::vector<int*>                blockBricks;
+  //! Device arrays of the scene description
+  Volume                          *volumes;
+  int                              numVolumes;
+  Occluder                        *occluders;
+  Light                           *lights;
+  int                              numLights;
+};
+
+//----------------------------------------------------------------------------//
+
+class Stream
+{
+public:
+  Stream()
+    : stream(0), rays(NULL), results(NULL), capacity(0)
+  { }
+  cudaStream_t stream;
+  Ray         *rays;
+  Result      *results;
+  //! Number of rays that rays and results have room for
+  size_t       capacity;
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Render::Gpu;
+
+  //--------------------------------------------------------------------------//
+  // Constants
+  //--------------------------------------------------------------------------//
+
+  //! Threads per block of the raymarch kernel
+  const int   k_threadsPerBlock = 128;
+
+  //! Isotropic phase function, as Phase::k_isotropic
+  __constant__ float k_isotropic = 0.07957747154594767f;
+
+  //--------------------------------------------------------------------------//
+  // Vector helpers
+  //--------------------------------------------------------------------------//
+
+  __device__ inline float3 operator + (const float3 &a, const float3 &b)
+  { return make_float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+
+  __device__ inline float3 operator * (const float3 &a, const float3 &b)
+  { return make_float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+
+  __device__ inline float3 operator * (const float3 &a, const float s)
+  { return make_float3(a.x * s, a.y * s, a.z * s); }
+
+  __device__ inline float3 toFloat3(const float v[3])
+  { return make_float3(v[0], v[1], v[2]); }
+
+  __device__ inline float maxComponent(const float3 &v)
+  { return fmaxf(v.x, fmaxf(v.y, v.z)); }
+
+  __device__ inline float dot(const float3 &a, const float3 &b)
+  { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+  //--------------------------------------------------------------------------//
+
+  //! Transforms a point, as Imath's Matrix44::multVecMatrix()
+  __device__ inline float3 transformPoint(const float m[4][4],
+                                          const float3 &p)
+  {
+    const float x = p.x * m[0][0] + p.y * m[1][0] + p.z * m[2][0] + m[3][0];
+    const float y = p.x * m[0][1] + p.y * m[1][1] + p.z * m[2][1] + m[3][1];
+    const float z = p.x * m[0][2] + p.y * m[1][2] + p.z * m[2][2] + m[3][2];
+    const float w = p.x * m[0][3] + p.y * m[1][3] + p.z * m[2][3] + m[3][3];
+    return make_float3(x / w, y / w, z / w);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Transforms a direction, as Imath's Matrix44::multDirMatrix()
+  __device__ inline float3 transformDir(const float m[4][4], const float3 &d)
+  {
+    return make_float3(d.x * m[0][0] + d.y * m[1][0] + d.z * m[2][0],
+                       d.x * m[0][1] + d.y * m[1][1] + d.z * m[2][1],
+                       d.x * m[0][2] + d.y * m[1][2] + d.z * m[2][2]);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether vsP is inside the data window, as Math::isInBounds()
+  __device__ inline bool isInBounds(const float3 &vsP, const int min[3],
+                                    const int max[3])
+  {
+    return vsP.x >= min[0] && vsP.x <= max[0] &&
+           vsP.y >= min[1] && vsP.y <= max[1] &&
+           vsP.z >= min[2] && vsP.z <= max[2];
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Intersects a ray with a box, as Math::intersect()
+  __device__ bool intersect(const float3 &pos, const float3 &dir,
+                            const float min[3], const float max[3],
+                            float &outT0, float &outT1)
+  {
+    const float p[3] = { pos.x, pos.y, pos.z };
+    const float d[3] = { dir.x, dir.y, dir.z };
+    float tNear = -3.402823466e+38f;
+    float tFar  = 3.402823466e+38f;
+    for (int dim = 0; dim < 3; ++dim) {
+      // Rays parallel to the slab either miss it or are inside throughout
+      if (fabsf(d[dim]) < 1.0e-6f) {
+        if (p[dim] < min[dim] || p[dim] > max[dim]) {
+          return false;
+        }
+        continue;
+      }
+      float t0 = (min[dim] - p[dim]) / d[dim];
+      float t1 = (max[dim] - p[dim]) / d[dim];
+      if (t0 > t1) {
+        const float t = t0; t0 = t1; t1 = t;
+      }
+      tNear = fmaxf(tNear, t0);
+      tFar  = fminf(tFar, t1);
+      if (tNear > tFar || tFar < 0.0f) {
+        return false;
+      }
+    }
+    outT0 = tNear;
+    outT1 = tFar;
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Lookups
+  //--------------------------------------------------------------------------//
+
+  //! Reads a texture at the given texel space position. Texel centers are
+  //! at +0.5, like voxel centers in Field3D's voxel space.
+  __device__ inline float3 fetch(const unsigned long long texture,
+                                 const float3 &p)
+  {
+    const float4 t =
+      tex3D<float4>(static_cast<cudaTextureObject_t>(texture), p.x, p.y, p.z);
+    return make_float3(t.x, t.y, t.z);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the voxel value of a volume at a world space position, as
+  //! VoxelVolume::sample() does before scaling by the attribute.
+  __device__ float3 voxelValue(const Volume &v, const float3 &wsP)
+  {
+    const float3 vsP = transformPoint(v.wsToVs, wsP);
+    if (!isInBounds(vsP, v.dataMin, v.dataMax)) {
+      return make_float3(0.0f, 0.0f, 0.0f);
+    }
+    float3 p = make_float3(vsP.x - v.dataMin[0], vsP.y - v.dataMin[1],
+                           vsP.z - v.dataMin[2]);
+    if (v.blockSize == 0) {
+      return fetch(v.texture, p);
+    }
+    // Find the block, then the same position in its brick
+    const int bs = v.blockSize;
+    const int bi = min(static_cast<int>(p.x) / bs, v.blockRes[0] - 1);
+    const int bj = min(static_cast<int>(p.y) / bs, v.blockRes[1] - 1);
+    const int bk = min(static_cast<int>(p.z) / bs, v.blockRes[2] - 1);
+    const int brick =
+      v.blockBricks[(bk * v.blockRes[1] + bj) * v.blockRes[0] + bi];
+    if (brick < 0) {
+      return make_float3(0.0f, 0.0f, 0.0f);
+    }
+    const int padded = bs + 2;
+    const int ai     = brick % v.atlasBricks[0];
+    const int aj     = (brick / v.atlasBricks[0]) % v.atlasBricks[1];
+    const int ak     = brick / (v.atlasBricks[0] * v.atlasBricks[1]);
+    p.x += ai * padded - bi * bs + 1;
+    p.y += aj * padded - bj * bs + 1;
+    p.z += ak * padded - bk * bs + 1;
+    return fetch(v.texture, p);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the transmittance of an occluder, as VoxelOccluder::sample()
+  __device__ float3 occlusion(const Occluder &o, const float3 &wsP)
+  {
+    const float3 vsP = transformPoint(o.wsToVs, wsP);
+    if (!isInBounds(vsP, o.dataMin, o.dataMax)) {
+      return make_float3(1.0f, 1.0f, 1.0f);
+    }
+    return fetch(o.texture,
+                 make_float3(vsP.x - o.dataMin[0], vsP.y - o.dataMin[1],
+                             vsP.z - o.dataMin[2]));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the unoccluded luminance of a light at wsP, as PointLight and
+  //! SpotLight's sample()
+  __device__ float3 lightLuminance(const Light &light, const float3 &wsP)
+  {
+    const float3 wsD = make_float3(wsP.x - light.position[0],
+                                   wsP.y - light.position[1],
+                                   wsP.z - light.position[2]);
+    const float  distanceSq = dot(wsD, wsD);
+    float        falloff    = 1.0f;
+    if (light.isSpot) {
+      const float length   = sqrtf(distanceSq);
+      const float cosTheta =
+        length > 0.0f ? dot(wsD, toFloat3(light.axis)) / length : 0.0f;
+      if (cosTheta < light.cosWidth) {
+        return make_float3(0.0f, 0.0f, 0.0f);
+      } else if (cosTheta <= light.cosStart) {
+        const float delta =
+          (cosTheta - light.cosWidth) / (light.cosStart - light.cosWidth);
+        falloff = delta * delta * delta * delta;
+      }
+    }
+    if (light.falloffEnabled) {
+      falloff *= light.softRolloff && distanceSq < 1.0f ?
+        powf(1.0f / distanceSq, 0.25f) : 1.0f / distanceSq;
+    }
+    return toFloat3(light.intensity) * falloff;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Kernels
+  //--------------------------------------------------------------------------//
+
+  //! Integrates one ray per thread, as UniformRaymarcher::integrateRay()
+  //! does with PhysicalSampler, for scenes without holdouts
+  __global__ void integrateRays(const Volume *volumes, const int numVolumes,
+                                const Occluder *occluders,
+                                const Light *lights, const int numLights,
+                                const Params params, const Ray *rays,
+                                Result *results, const int numRays)
+  {
+    const int idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (idx >= numRays) {
+      return;
+    }
+
+    const Ray    &ray = rays[idx];
+    const float3  pos = toFloat3(ray.pos);
+    const float3  dir = toFloat3(ray.dir);
+
+    // Intersect each volume. Steps are one voxel long along the ray, as
+    // makeInterval() computes them.
+    float t0s[MaxVolumes], t1s[MaxVolumes], stepLengths[MaxVolumes];
+    float events[2 * MaxVolumes];
+    int   numEvents = 0;
+    for (int v = 0; v < numVolumes; ++v) {
+      const float3 vsPos = transformPoint(volumes[v].wsToVs, pos);
+      const float3 vsDir = transformDir(volumes[v].wsToVs, dir);
+      t0s[v] = 1.0f;
+      t1s[v] = 0.0f;
+      if (intersect(vsPos, vsDir, volumes[v].vsBoundsMin,
+                    volumes[v].vsBoundsMax, t0s[v], t1s[v]) &&
+          t0s[v] < t1s[v]) {
+        stepLengths[v]      = rsqrtf(dot(vsDir, vsDir));
+        events[numEvents++] = t0s[v];
+        events[numEvents++] = t1s[v];
+      }
+    }
+
+    // Sort the interval end points, as splitIntervals() does
+    for (int i = 1; i < numEvents; ++i) {
+      const float t = events[i];
+      int j = i - 1;
+      for (; j >= 0 && events[j] > t; --j) {
+        events[j + 1] = events[j];
+      }
+      events[j + 1] = t;
+    }
+
+    const float stepMult  = ray.isShadow ? params.shadowStepLengthMult : 1.0f;
+    const float threshold =
+      ray.isShadow ? params.shadowEarlyTerminationThreshold :
+      params.earlyTerminationThreshold;
+
+    float3 L            = make_float3(0.0f, 0.0f, 0.0f);
+    float3 T            = make_float3(1.0f, 1.0f, 1.0f);
+    int    numSteps     = 0;
+    int    numIntervals = 0;
+    bool   isTerminated = false;
+
+    // Each span between two end points uses the shortest step length of
+    // the volumes that overlap it
+    for (int e = 0; e + 1 < numEvents && !isTerminated; ++e) {
+
+      const float a = events[e], b = events[e + 1];
+      if (!(a < b)) {
+        continue;
+      }
+      float volumeStep = 3.402823466e+38f;
+      for (int v = 0; v < numVolumes; ++v) {
+        if (t0s[v] < t1s[v] && t0s[v] <= a && t1s[v] >= b) {
+          volumeStep = fminf(volumeStep, stepLengths[v]);
+        }
+      }
+      if (volumeStep == 3.402823466e+38f) {
+        continue;
+      }
+
+      const float tStart = fmaxf(a, ray.tMin);
+      const float tEnd   = fminf(b, ray.tMax);
+      const float baseStepLength =
+        fminf((params.useVolumeStepLength ?
+               volumeStep * params.volumeStepLengthMult :
+               params.stepLength) * stepMult, tEnd - tStart);
+
+      float stepT0 = tStart;
+      float stepT1 = tStart + (params.doJitterSteps ?
+                               baseStepLength * (1.0f - ray.stepOffset) :
+                               baseStepLength);
+      if (stepT0 == stepT1 || !(stepT0 < tEnd)) {
+        continue;
+      }
+      numIntervals++;
+
+      while (stepT0 < tEnd) {
+
+        const float3 wsP = pos + dir * ((stepT0 + stepT1) * 0.5f);
+
+        // Sum the attributes of all volumes the ray passes through
+        float3 sigma_s = make_float3(0.0f, 0.0f, 0.0f);
+        float3 sigma_a = make_float3(0.0f, 0.0f, 0.0f);
+        float3 L_em    = make_float3(0.0f, 0.0f, 0.0f);
+        for (int v = 0; v < numVolumes; ++v) {
+          if (!(t0s[v] < t1s[v])) {
+            continue;
+          }
+          const Volume &volume = volumes[v];
+          const float3  value  = voxelValue(volume, wsP);
+          sigma_s = sigma_s + value * toFloat3(volume.scattering);
+          sigma_a = sigma_a + value * toFloat3(volume.absorption);
+          L_em    = L_em + value * toFloat3(volume.emission);
+        }
+
+        // Transmittance-only rays don't need luminance
+        float3 Ls = make_float3(0.0f, 0.0f, 0.0f);
+        if (!ray.isShadow) {
+          Ls = L_em;
+          if (maxComponent(sigma_s) > 0.0f) {
+            float3 Li = make_float3(0.0f, 0.0f, 0.0f);
+            for (int l = 0; l < numLights; ++l) {
+              const Light &light = lights[l];
+              float3 lightL = lightLuminance(light, wsP);
+              if (maxComponent(lightL) <= 0.0f) {
+                continue;
+              }
+              if (light.occluder >= 0) {
+                lightL = lightL * occlusion(occluders[light.occluder], wsP);
+              }
+              Li = Li + lightL;
+            }
+            Ls = Ls + sigma_s * Li * k_isotropic;
+          }
+        }
+
+        // Update transmittance, then luminance
+        const float  stepLength = stepT1 - stepT0;
+        const float3 sigma_e    = sigma_s + sigma_a;
+        if (maxComponent(sigma_e) > 0.0f) {
+          T = T * make_float3(__expf(-sigma_e.x * stepLength),
+                              __expf(-sigma_e.y * stepLength),
+                              __expf(-sigma_e.z * stepLength));
+        }
+        L = L + Ls * T * stepLength;
+        numSteps++;
+
+        if (params.doEarlyTermination && maxComponent(T) < threshold) {
+          T            = make_float3(0.0f, 0.0f, 0.0f);
+          isTerminated = true;
+          break;
+        }
+
+        stepT0 = stepT1;
+        stepT1 = fminf(tEnd, stepT1 + baseStepLength);
+      }
+
+    }
+
+    Result &result          = results[idx];
+    result.luminance[0]     = L.x;
+    result.luminance[1]     = L.y;
+    result.luminance[2]     = L.z;
+    result.transmittance[0] = T.x;
+    result.transmittance[1] = T.y;
+    result.transmittance[2] = T.z;
+    result.numSteps         = numSteps;
+    result.numIntervals     = numIntervals;
+    result.isTerminated     = isTerminated;
+  }
+
+  //--------------------------------------------------------------------------//
+  // Host helpers
+  //--------------------------------------------------------------------------//
+
+  //! \returns False if err is an error, with its description in error
+  bool check(const cudaError_t err, std::string &error)
+  {
+    if (err != cudaSuccess) {
+      error = cudaGetErrorString(err);
+      return false;
+    }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies host data to a new device array
+  template <typename T>
+  bool upload(const T *data, const size_t count, T *&result,
+              std::string &error)
+  {
+    result = NULL;
+    if (count == 0) {
+      return true;
+    }
+    return check(cudaMalloc(&result, count * sizeof(T)), error) &&
+      check(cudaMemcpy(result, data, count * sizeof(T),
+                       cudaMemcpyHostToDevice), error);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Uploads a 3D texture of float4 texels. The array and texture are
+  //! added to the scene as soon as they exist, so that destroyScene()
+  //! frees them if a later step fails.
+  bool createTexture(const TextureDesc &desc, Scene &scene,
+                     unsigned long long &result, std::string &error)
+  {
+    const cudaChannelFormatDesc channels = cudaCreateChannelDesc<float4>();
+    const cudaExtent            extent   =
+      make_cudaExtent(desc.size[0], desc.size[1], desc.size[2]);
+
+    cudaArray_t array;
+    if (!check(cudaMalloc3DArray(&array, &channels, extent), error)) {
+      return false;
+    }
+    scene.arrays.push_back(array);
+
+    cudaMemcpy3DParms copy;
+    std::memset(&copy, 0, sizeof(copy));
+    copy.srcPtr   = make_cudaPitchedPtr(const_cast<float*>(desc.texels),
+                                        desc.size[0] * sizeof(float4),
+                                        desc.size[0], desc.size[1]);
+    copy.dstArray = array;
+    copy.extent   = extent;
+    copy.kind     = cudaMemcpyHostToDevice;
+    if (!check(cudaMemcpy3D(&copy), error)) {
+      return false;
+    }
+
+    cudaResourceDesc resource;
+    std::memset(&resource, 0, sizeof(resource));
+    resource.resType         = cudaResourceTypeArray;
+    resource.res.array.array = array;
+
+    // Lookups clamp to the data window, as the CPU interpolators do
+    cudaTextureDesc texture;
+    std::memset(&texture, 0, sizeof(texture));
+    texture.addressMode[0]   = cudaAddressModeClamp;
+    texture.addressMode[1]   = cudaAddressModeClamp;
+    texture.addressMode[2]   = cudaAddressModeClamp;
+    texture.filterMode       =
+      desc.isLinear ? cudaFilterModeLinear : cudaFilterModePoint;
+    texture.readMode         = cudaReadModeElementType;
+    texture.normalizedCoords = 0;
+
+    cudaTextureObject_t object;
+    if (!check(cudaCreateTextureObject(&object, &resource, &texture, NULL),
+               error)) {
+      return false;
+    }
+    scene.textures.push_back(object);
+    result = object;
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+namespace Gpu {
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int numDevices()
+{
+  int count = 0;
+  if (cudaGetDeviceCount(&count) != cudaSuccess) {
+    // Clear the error, so that it isn't reported by later calls
+    cudaGetLastError();
+    return 0;
+  }
+  return count;
+}
+
+//----------------------------------------------------------------------------//
+
+int maxTextureSize()
+{
+  int device = 0;
+  cudaDeviceProp props;
+  if (cudaGetDevice(&device) != cudaSuccess ||
+      cudaGetDeviceProperties(&props, device) != cudaSuccess) {
+    cudaGetLastError();
+    return 0;
+  }
+  return std::min(props.maxTexture3D[0],
+                  std::min(props.maxTexture3D[1], props.maxTexture3D[2]));
+}
+
+//----------------------------------------------------------------------------//
+
+Scene* createScene(const VolumeDesc *volumes, const size_t numVolumes,
+                   const OccluderDesc *occluders, const size_t numOccluders,
+                   const Light *lights, const size_t numLights,
+                   std::string &error)
+{
+  if (numVolumes > MaxVolumes) {
+    error = "Too many volumes";
+    return NULL;
+  }
+
+  Scene *scene = new Scene;
+
+  // Volumes
+  std::vector<Volume> deviceVolumes;
+  for (size_t i = 0; i < numVolumes; ++i) {
+    Volume volume = volumes[i].volume;
+    int   *blockBricks;
+    if (!createTexture(volumes[i].texture, *scene, volume.texture, error) ||
+        !upload(volumes[i].blockBricks, volumes[i].numBlocks, blockBricks,
+                error)) {
+      destroyScene(scene);
+      return NULL;
+    }
+    if (blockBricks) {
+      scene->blockBricks.push_back(blockBricks);
+    }
+    volume.blockBricks = blockBricks;
+    deviceVolumes.push_back(volume);
+  }
+
+  // Occluders
+  std::vector<Occluder> deviceOccluders;
+  for (size_t i = 0; i < numOccluders; ++i) {
+    Occluder occluder = occluders[i].occluder;
+    if (!createTexture(occluders[i].texture, *scene, occluder.texture,
+                       error)) {
+      destroyScene(scene);
+      return NULL;
+    }
+    deviceOccluders.push_back(occluder);
+  }
+
+  // Scene description
+  if (!upload(deviceVolumes.empty() ? NULL : &deviceVolumes[0],
+              deviceVolumes.size(), scene->volumes, error) ||
+      !upload(deviceOccluders.empty() ? NULL : &deviceOccluders[0],
+              deviceOccluders.size(), scene->occluders, error) ||
+      !upload(lights, numLights, scene->lights, error)) {
+    destroyScene(scene);
+    return NULL;
+  }
+  scene->numVolumes = static_cast<int>(numVolumes);
+  scene->numLights  = static_cast<int>(numLights);
+
+  return scene;
+}
+
+//----------------------------------------------------------------------------//
+
+void destroyScene(Scene *scene)
+{
+  if (!scene) {
+    return;
+  }
+  for (size_t i = 0, size = scene->textures.size(); i < size; ++i) {
+    cudaDestroyTextureObject(scene->textures[i]);
+  }
+  for (size_t i = 0, size = scene->arrays.size(); i < size; ++i) {
+    cudaFreeArray(scene->arrays[i]);
+  }
+  for (size_t i = 0, size = scene->blockBricks.size(); i < size; ++i) {
+    cudaFree(scene->blockBricks[i]);
+  }
+  cudaFree(scene->volumes);
+  cudaFree(scene->occluders);
+  cudaFree(scene->lights);
+  delete scene;
+}
+
+//----------------------------------------------------------------------------//
+
+Stream* createStream(std::string &error)
+{
+  Stream *stream = new Stream;
+  if (!check(cudaStreamCreateWithFlags(&stream->stream,
+                                       cudaStreamNonBlocking), error)) {
+    delete stream;
+    return NULL;
+  }
+  return stream;
+}
+
+//----------------------------------------------------------------------------//
+
+void destroyStream(Stream *stream)
+{
+  if (!stream) {
+    return;
+  }
+  cudaFree(stream->rays);
+  cudaFree(stream->results);
+  cudaStreamDestroy(stream->stream);
+  delete stream;
+}
+
+//----------------------------------------------------------------------------//
+
+bool integrate(const Scene &scene, const Params &params,
+               const Ray *rays, const size_t numRays, Result *results,
+               Stream &stream, std::string &error)
+{
+  if (numRays == 0) {
+    return true;
+  }
+
+  // Grow the ray buffers. They are kept from call to call, so that a
+  // render only allocates while its packets get larger.
+  if (numRays > stream.capacity) {
+    cudaFree(stream.rays);
+    cudaFree(stream.results);
+    stream.rays     = NULL;
+    stream.results  = NULL;
+    stream.capacity = 0;
+    if (!check(cudaMalloc(&stream.rays, numRays * sizeof(Ray)), error) ||
+        !check(cudaMalloc(&stream.results, numRays * sizeof(Result)),
+               error)) {
+      return false;
+    }
+    stream.capacity = numRays;
+  }
+
+  const int numBlocks =
+    static_cast<int>((numRays + k_threadsPerBlock - 1) / k_threadsPerBlock);
+
+  if (!check(cudaMemcpyAsync(stream.rays, rays, numRays * sizeof(Ray),
+                             cudaMemcpyHostToDevice, stream.stream), error)) {
+    return false;
+  }
+  integrateRays<<<numBlocks, k_threadsPerBlock, 0, stream.stream>>>
+    (scene.volumes, scene.numVolumes, scene.occluders, scene.lights,
+     scene.numLights, params, stream.rays, stream.results,
+     static_cast<int>(numRays));
+  return check(cudaGetLastError(), error) &&
+    check(cudaMemcpyAsync(results, stream.results, numRays * sizeof(Result),
+                          cudaMemcpyDeviceToHost, stream.stream), error) &&
+    check(cudaStreamSynchronize(stream.stream), error);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Gpu
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
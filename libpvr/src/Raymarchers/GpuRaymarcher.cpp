@@ -0,0 +1,887 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file GpuRaymarcher.cpp
+  Contains implementations of GpuRaymarcher class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Raymarchers/GpuRaymarcher.h"
+
+#ifdef PVR_USE_CUDA
+
+// System includes
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <Field3D/DenseField.h>
+#include <Field3D/SparseField.h>
+
+// Project headers
+
+#include "pvr/Camera.h"
+#include "pvr/Log.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/Scene.h"
+#include "pvr/Stats.h"
+#include "pvr/StlUtil.h"
+#include "pvr/Lights/PointLight.h"
+#include "pvr/Lights/SpotLight.h"
+#include "pvr/Occluders/VoxelOccluder.h"
+#include "pvr/Raymarchers/GpuKernels.h"
+#include "pvr/RaymarchSamplers/PhysicalSampler.h"
+#include "pvr/Volumes/CompositeVolume.h"
+#include "pvr/Volumes/VoxelVolume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+  using namespace pvr::Render;
+  using namespace Field3D;
+
+  //--------------------------------------------------------------------------//
+
+  typedef Imath::V3f V3f;
+  typedef Imath::Vec3<half> V3h;
+
+  //--------------------------------------------------------------------------//
+  // Strings
+  //--------------------------------------------------------------------------//
+
+  const std::string k_strPacketSize("packet_size");
+
+  //! Default number of rays in a packet. Large enough to fill a device,
+  //! small enough that a 64x64 tile is a single packet.
+  const size_t k_packetSize = 4096;
+
+  //--------------------------------------------------------------------------//
+  // Data
+  //--------------------------------------------------------------------------//
+
+  //! Each render thread launches its packets on its own stream, so that
+  //! the copies and kernels of different threads overlap.
+  boost::thread_specific_ptr<Gpu::Stream> g_stream(&Gpu::destroyStream);
+
+  //! Packets fall back to the CPU one at a time, so the warning would 
+  //! otherwise repeat for every packet of a render
+  pvr::Util::Log::RateLimiter g_cpuFallbackWarnings("GpuRaymarcher "
+                                                    "integrating on the CPU");
+
+  //--------------------------------------------------------------------------//
+  // Structs
+  //--------------------------------------------------------------------------//
+
+  //! A Gpu::VolumeDesc along with the host data it points to
+  struct HostVolume
+  {
+    Gpu::VolumeDesc    desc;
+    std::vector<float> texels;
+    std::vector<int>   blockBricks;
+  };
+
+  //! A Gpu::OccluderDesc along with the host data it points to
+  struct HostOccluder
+  {
+    Gpu::OccluderDesc  desc;
+    std::vector<float> texels;
+  };
+
+  //--------------------------------------------------------------------------//
+  // Helper functions
+  //--------------------------------------------------------------------------//
+
+  void toDevice(const Matrix &m, float result[4][4])
+  {
+    for (int i = 0; i < 4; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        result[i][j] = static_cast<float>(m[i][j]);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <typename T>
+  void toDevice(const Imath::Vec3<T> &v, float result[3])
+  {
+    for (int i = 0; i < 3; ++i) {
+      result[i] = static_cast<float>(v[i]);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  void toDevice(const Imath::Box3i &dataWindow, int min[3], int max[3])
+  {
+    for (int i = 0; i < 3; ++i) {
+      min[i] = dataWindow.min[i];
+      max[i] = dataWindow.max[i];
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Voxel values as texels. Scalar buffers fill all three channels, as
+  //! they do when VoxelVolume interpolates them.
+  V3f texel(const float value)
+  { return V3f(value); }
+  V3f texel(const half value)
+  { return V3f(static_cast<float>(value)); }
+  V3f texel(const V3f &value)
+  { return value; }
+  V3f texel(const V3h &value)
+  { return V3f(value.x, value.y, value.z); }
+
+  //--------------------------------------------------------------------------//
+
+  void setTexel(const V3f &value, const size_t index,
+                std::vector<float> &texels)
+  {
+    texels[index * 4 + 0] = value.x;
+    texels[index * 4 + 1] = value.y;
+    texels[index * 4 + 2] = value.z;
+    texels[index * 4 + 3] = 0.0f;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the world-to-voxel matrix of a mapping, as
+  //! VoxelVolume::updateWorldToVoxel() does.
+  //! \returns False unless the mapping is a MatrixFieldMapping without
+  //! motion.
+  bool worldToVoxelMatrix(FieldMapping::Ptr mapping, Matrix &wsToVs)
+  {
+    MatrixFieldMapping::Ptr matrixMapping =
+      field_dynamic_cast<MatrixFieldMapping>(mapping);
+    if (!matrixMapping || matrixMapping->localToWorldSamples().size() != 1) {
+      return false;
+    }
+    Vector origin, lsX, lsY, lsZ;
+    mapping->voxelToLocal(Vector(0.0), origin);
+    mapping->voxelToLocal(Vector(1.0, 0.0, 0.0), lsX);
+    mapping->voxelToLocal(Vector(0.0, 1.0, 0.0), lsY);
+    mapping->voxelToLocal(Vector(0.0, 0.0, 1.0), lsZ);
+    Matrix vsToLs;
+    vsToLs.setScale(Vector(lsX.x - origin.x, lsY.y - origin.y,
+                           lsZ.z - origin.z));
+    vsToLs[3][0] = origin.x;
+    vsToLs[3][1] = origin.y;
+    vsToLs[3][2] = origin.z;
+    const Matrix vsToWs =
+      vsToLs * matrixMapping->localToWorldSamples()[0].second;
+    wsToVs = vsToWs.inverse();
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies a dense field into a single texture
+  template <typename Field_T>
+  bool packDense(const Field_T &field, const int maxSize, HostVolume &result)
+  {
+    const Imath::Box3i dw   = field.dataWindow();
+    const Imath::V3i   size = dw.size() + Imath::V3i(1);
+    if (std::max(size.x, std::max(size.y, size.z)) > maxSize) {
+      return false;
+    }
+    result.texels.resize(static_cast<size_t>(size.x) * size.y * size.z * 4);
+    size_t index = 0;
+    for (int k = dw.min.z; k <= dw.max.z; ++k) {
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        for (int i = dw.min.x; i <= dw.max.x; ++i, ++index) {
+          setTexel(texel(field.fastValue(i, j, k)), index, result.texels);
+        }
+      }
+    }
+    Gpu::TextureDesc &texture = result.desc.texture;
+    texture.size[0] = size.x;
+    texture.size[1] = size.y;
+    texture.size[2] = size.z;
+    result.desc.volume.blockSize = 0;
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Packs the blocks of a sparse field that aren't zero throughout into an
+  //! atlas of bricks. Each brick has a one voxel apron, so that linear
+  //! lookups near a block's edge match lookups in the full buffer. Blocks
+  //! next to a non-zero block get a brick too, since lookups near their
+  //! edges reach into it.
+  template <typename Field_T>
+  bool packSparse(const Field_T &field, const int maxSize, HostVolume &result)
+  {
+    const Imath::Box3i dw        = field.dataWindow();
+    const int          blockSize = field.blockSize();
+    const Imath::V3i   blockRes  = field.blockRes();
+    const int          padded    = blockSize + 2;
+
+    // Find the blocks that need a brick
+    const size_t      numBlocks =
+      static_cast<size_t>(blockRes.x) * blockRes.y * blockRes.z;
+    std::vector<char> isNonZero(numBlocks, 0);
+    for (int bk = 0, b = 0; bk < blockRes.z; ++bk) {
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi, ++b) {
+          isNonZero[b] = field.blockIsAllocated(bi, bj, bk) ||
+            texel(field.getBlockEmptyValue(bi, bj, bk)) != V3f(0.0f);
+        }
+      }
+    }
+    std::vector<int> &blockBricks = result.blockBricks;
+    blockBricks.assign(numBlocks, -1);
+    int numBricks = 0;
+    for (int bk = 0, b = 0; bk < blockRes.z; ++bk) {
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi, ++b) {
+          bool needsBrick = false;
+          for (int k = std::max(bk - 1, 0);
+               k <= std::min(bk + 1, blockRes.z - 1) && !needsBrick; ++k) {
+            for (int j = std::max(bj - 1, 0);
+                 j <= std::min(bj + 1, blockRes.y - 1) && !needsBrick; ++j) {
+              for (int i = std::max(bi - 1, 0);
+                   i <= std::min(bi + 1, blockRes.x - 1); ++i) {
+                if (isNonZero[(k * blockRes.y + j) * blockRes.x + i]) {
+                  needsBrick = true;
+                  break;
+                }
+              }
+            }
+          }
+          if (needsBrick) {
+            blockBricks[b] = numBricks++;
+          }
+        }
+      }
+    }
+
+    // Lay out the atlas
+    const int maxBricks = maxSize / padded;
+    const int atlasX    = std::max(std::min(numBricks, maxBricks), 1);
+    const int atlasY    =
+      std::max(std::min((numBricks + atlasX - 1) / atlasX, maxBricks), 1);
+    const int atlasZ    =
+      std::max((numBricks + atlasX * atlasY - 1) / (atlasX * atlasY), 1);
+    if (maxBricks == 0 || atlasZ > maxBricks) {
+      return false;
+    }
+    const Imath::V3i size(atlasX * padded, atlasY * padded, atlasZ * padded);
+    result.texels.assign(static_cast<size_t>(size.x) * size.y * size.z * 4,
+                         0.0f);
+
+    // Copy each brick, clamping the apron to the data window
+    for (int bk = 0, b = 0; bk < blockRes.z; ++bk) {
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi, ++b) {
+          const int brick = blockBricks[b];
+          if (brick < 0) {
+            continue;
+          }
+          const Imath::V3i atlas(brick % atlasX, (brick / atlasX) % atlasY,
+                                 brick / (atlasX * atlasY));
+          const Imath::V3i origin = dw.min +
+            Imath::V3i(bi, bj, bk) * blockSize - Imath::V3i(1);
+          for (int k = 0; k < padded; ++k) {
+            const int z = Imath::clamp(origin.z + k, dw.min.z, dw.max.z);
+            for (int j = 0; j < padded; ++j) {
+              const int y = Imath::clamp(origin.y + j, dw.min.y, dw.max.y);
+              const size_t row =
+                ((static_cast<size_t>(atlas.z * padded + k) * size.y) +
+                 atlas.y * padded + j) * size.x + atlas.x * padded;
+              for (int i = 0; i < padded; ++i) {
+                const int x = Imath::clamp(origin.x + i, dw.min.x, dw.max.x);
+                setTexel(texel(field.fastValue(x, y, z)), row + i,
+                         result.texels);
+              }
+            }
+          }
+        }
+      }
+    }
+
+    Gpu::TextureDesc &texture = result.desc.texture;
+    Gpu::Volume      &volume  = result.desc.volume;
+    texture.size[0]       = size.x;
+    texture.size[1]       = size.y;
+    texture.size[2]       = size.z;
+    volume.blockSize      = blockSize;
+    volume.blockRes[0]    = blockRes.x;
+    volume.blockRes[1]    = blockRes.y;
+    volume.blockRes[2]    = blockRes.z;
+    volume.atlasBricks[0] = atlasX;
+    volume.atlasBricks[1] = atlasY;
+    volume.atlasBricks[2] = atlasZ;
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Packs the field if it's a DenseField or SparseField of Data_T.
+  //! \returns False if it's neither, or too large for the device.
+  template <typename Data_T>
+  bool packField(FieldRes::Ptr field, const int maxSize, HostVolume &result)
+  {
+    if (typename DenseField<Data_T>::Ptr dense =
+        field_dynamic_cast<DenseField<Data_T> >(field)) {
+      return packDense(*dense, maxSize, result);
+    }
+    if (typename SparseField<Data_T>::Ptr sparse =
+        field_dynamic_cast<SparseField<Data_T> >(field)) {
+      return packSparse(*sparse, maxSize, result);
+    }
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the VoxelVolumes of the scene.
+  //! \returns False if the scene has other kinds of volumes.
+  bool findVoxelVolumes(const Volume::CPtr &volume,
+                        std::vector<const VoxelVolume *> &result)
+  {
+    if (const VoxelVolume *voxel =
+        dynamic_cast<const VoxelVolume *>(volume.get())) {
+      result.push_back(voxel);
+      return true;
+    }
+    if (dynamic_cast<const CompositeVolume *>(volume.get())) {
+      BOOST_FOREACH (const Volume::CPtr &input, volume->inputs()) {
+        if (!findVoxelVolumes(input, result)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets up the device version of a volume.
+  //! \returns False if the device can't render it.
+  bool setupVolume(const VoxelVolume &volume, const int maxSize,
+                   HostVolume &result, std::string &reason)
+  {
+    const VoxelVolume::InterpType interp = volume.interpolation();
+    FieldRes::Ptr                 field  = volume.field();
+    if (!field) {
+      reason = "a VoxelVolume has no buffer, or one stored in a format "
+        "that isn't a Field3D field";
+      return false;
+    }
+    if ((interp != VoxelVolume::NoInterp &&
+         interp != VoxelVolume::LinearInterp) ||
+        volume.hasVelocity() || volume.useMipmaps() ||
+        !volume.phaseFunction()->isIsotropic()) {
+      reason = "unsupported VoxelVolume settings";
+      return false;
+    }
+
+    Matrix wsToVs;
+    if (!worldToVoxelMatrix(field->mapping(), wsToVs)) {
+      reason = "unsupported VoxelVolume mapping";
+      return false;
+    }
+
+    // Voxel space bounds of the mapping, which is where rays enter and
+    // leave the volume
+    Vector vsMin, vsMax;
+    field->mapping()->localToVoxel(Vector(0.0), vsMin);
+    field->mapping()->localToVoxel(Vector(1.0), vsMax);
+
+    Gpu::Volume &v = result.desc.volume;
+    toDevice(wsToVs, v.wsToVs);
+    toDevice(vsMin, v.vsBoundsMin);
+    toDevice(vsMax, v.vsBoundsMax);
+    toDevice(field->dataWindow(), v.dataMin, v.dataMax);
+    toDevice(volume.attributeValue("scattering"), v.scattering);
+    toDevice(volume.attributeValue("absorption"), v.absorption);
+    toDevice(volume.attributeValue("emission"), v.emission);
+    v.blockBricks = NULL;
+    v.texture     = 0;
+
+    result.desc.texture.isLinear = interp == VoxelVolume::LinearInterp;
+
+    if (!packField<float>(field, maxSize, result) &&
+        !packField<half>(field, maxSize, result) &&
+        !packField<V3f>(field, maxSize, result) &&
+        !packField<V3h>(field, maxSize, result)) {
+      reason = "unsupported or too large voxel buffer " + field->name;
+      return false;
+    }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets up the device version of a VoxelOccluder. The multiple
+  //! scattering buffer is added in once, up front.
+  //! \returns False if the device can't render it.
+  bool setupOccluder(const VoxelOccluder &occluder, const int maxSize,
+                     HostOccluder &result)
+  {
+    const DenseBuffer &buffer = occluder.buffer();
+    const DenseBuffer &msBuffer = occluder.multipleScatteringBuffer();
+    const float        msStrength = occluder.multipleScatteringStrength();
+
+    Matrix wsToVs;
+    if (!worldToVoxelMatrix(buffer.mapping(), wsToVs)) {
+      return false;
+    }
+
+    const Imath::Box3i dw   = buffer.dataWindow();
+    const Imath::V3i   size = dw.size() + Imath::V3i(1);
+    if (std::max(size.x, std::max(size.y, size.z)) > maxSize) {
+      return false;
+    }
+    result.texels.resize(static_cast<size_t>(size.x) * size.y * size.z * 4);
+    size_t index = 0;
+    for (int k = dw.min.z; k <= dw.max.z; ++k) {
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        for (int i = dw.min.x; i <= dw.max.x; ++i, ++index) {
+          V3f value = buffer.fastValue(i, j, k);
+          if (msStrength > 0.0f) {
+            value += msBuffer.fastValue(i, j, k) * msStrength;
+          }
+          setTexel(value, index, result.texels);
+        }
+      }
+    }
+
+    Gpu::Occluder &o = result.desc.occluder;
+    toDevice(wsToVs, o.wsToVs);
+    toDevice(dw, o.dataMin, o.dataMax);
+    o.texture = 0;
+
+    Gpu::TextureDesc &texture = result.desc.texture;
+    texture.size[0]  = size.x;
+    texture.size[1]  = size.y;
+    texture.size[2]  = size.z;
+    texture.isLinear = true;
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets up the device version of a point or spot light, except for its
+  //! occluder.
+  //! \returns False if the device can't render it.
+  bool setupLight(const Light &light, Gpu::Light &result)
+  {
+    toDevice(light.intensity(), result.intensity);
+    result.falloffEnabled = light.falloffEnabled();
+    result.softRolloff    = light.softRolloff();
+    result.isSpot         = false;
+    result.cosWidth       = -1.0f;
+    result.cosStart       = -1.0f;
+    result.occluder       = -1;
+    for (int i = 0; i < 3; ++i) {
+      result.axis[i] = 0.0f;
+    }
+
+    if (const PointLight *point = dynamic_cast<const PointLight *>(&light)) {
+      toDevice(point->position(), result.position);
+      return true;
+    }
+
+    if (const SpotLight *spot = dynamic_cast<const SpotLight *>(&light)) {
+      if (!spot->camera()) {
+        return false;
+      }
+      // Only lights without motion
+      const Camera::MatrixVec &matrices =
+        spot->camera()->cameraToWorldMatrices();
+      for (size_t i = 1, size = matrices.size(); i < size; ++i) {
+        if (matrices[i] != matrices[0]) {
+          return false;
+        }
+      }
+      if (matrices.empty()) {
+        return false;
+      }
+      Vector wsAxis;
+      matrices[0].multDirMatrix(Vector(0.0, 0.0, 1.0), wsAxis);
+      wsAxis.normalize();
+      toDevice(spot->camera()->position(PTime(0.0)), result.position);
+      toDevice(wsAxis, result.axis);
+      result.isSpot   = true;
+      result.cosWidth = spot->cosConeWidth();
+      result.cosStart = spot->cosConeStart();
+      return true;
+    }
+
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Uploads the scene to the current device.
+  //! \returns Null if the device can't render it, with the reason in
+  //! reason.
+  Gpu::Scene* uploadScene(const Scene &scene, std::string &reason)
+  {
+    const int maxSize = Gpu::maxTextureSize();
+
+    // Volumes
+    std::vector<const VoxelVolume *> voxelVolumes;
+    if (!scene.volume || !findVoxelVolumes(scene.volume, voxelVolumes)) {
+      reason = "the scene has volumes other than VoxelVolume";
+      return NULL;
+    }
+    if (voxelVolumes.size() > Gpu::MaxVolumes) {
+      reason = "the scene has too many volumes";
+      return NULL;
+    }
+    std::vector<HostVolume> volumes(voxelVolumes.size());
+    for (size_t i = 0, size = voxelVolumes.size(); i < size; ++i) {
+      if (!setupVolume(*voxelVolumes[i], maxSize, volumes[i], reason)) {
+        return NULL;
+      }
+    }
+
+    // Lights and their occluders
+    if (scene.lights.size() > Gpu::MaxLights) {
+      reason = "the scene has too many lights";
+      return NULL;
+    }
+    std::vector<Gpu::Light>   lights(scene.lights.size());
+    std::vector<HostOccluder> occluders;
+    for (size_t i = 0, size = scene.lights.size(); i < size; ++i) {
+      const Light &light = *scene.lights[i];
+      if (!setupLight(light, lights[i])) {
+        reason = "unsupported light " + light.typeName();
+        return NULL;
+      }
+      const Occluder *occluder = light.occluder().get();
+      if (!occluder || dynamic_cast<const NullOccluder *>(occluder)) {
+        continue;
+      }
+      const VoxelOccluder *voxelOccluder =
+        dynamic_cast<const VoxelOccluder *>(occluder);
+      occluders.push_back(HostOccluder());
+      if (!voxelOccluder ||
+          !setupOccluder(*voxelOccluder, maxSize, occluders.back())) {
+        reason = "unsupported occluder " + occluder->typeName();
+        return NULL;
+      }
+      lights[i].occluder = static_cast<int>(occluders.size() - 1);
+    }
+
+    // The descriptions point into the host data, which is in place now
+    std::vector<Gpu::VolumeDesc>   volumeDescs;
+    std::vector<Gpu::OccluderDesc> occluderDescs;
+    BOOST_FOREACH (HostVolume &v, volumes) {
+      v.desc.texture.texels = &v.texels[0];
+      v.desc.blockBricks    = v.blockBricks.empty() ? NULL : &v.blockBricks[0];
+      v.desc.numBlocks      = v.blockBricks.size();
+      volumeDescs.push_back(v.desc);
+    }
+    BOOST_FOREACH (HostOccluder &o, occluders) {
+      o.desc.texture.texels = &o.texels[0];
+      occluderDescs.push_back(o.desc);
+    }
+
+    Gpu::Scene *result =
+      Gpu::createScene(volumeDescs.empty() ? NULL : &volumeDescs[0],
+                       volumeDescs.size(),
+                       occluderDescs.empty() ? NULL : &occluderDescs[0],
+                       occluderDescs.size(),
+                       lights.empty() ? NULL : &lights[0], lights.size(),
+                       reason);
+    if (!result) {
+      reason = "the upload failed: " + reason;
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the calling thread's stream, creating it if needed. Returns
+  //! null if it can't be created.
+  Gpu::Stream* threadStream(std::string &error)
+  {
+    Gpu::Stream *stream = g_stream.get();
+    if (!stream) {
+      stream = Gpu::createStream(error);
+      g_stream.reset(stream);
+    }
+    return stream;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// GpuRaymarcher
+//----------------------------------------------------------------------------//
+
+GpuRaymarcher::GpuRaymarcher()
+  : m_packetSize(k_packetSize), m_scene(NULL), m_isUploaded(false)
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+void GpuRaymarcher::setParams(const Util::ParamMap &params)
+{
+  UniformRaymarcher::setParams(params);
+
+  int packetSize = static_cast<int>(m_packetSize);
+  getValue(params.intMap, k_strPacketSize, packetSize);
+  m_packetSize = static_cast<size_t>(std::max(packetSize, 1));
+}
+
+//----------------------------------------------------------------------------//
+
+void GpuRaymarcher::bindAttributes(const Volume &volume) const
+{
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_isUploaded = false;
+  }
+  UniformRaymarcher::bindAttributes(volume);
+}
+
+//----------------------------------------------------------------------------//
+
+size_t GpuRaymarcher::packetSize() const
+{
+  return m_packetSize;
+}
+
+//----------------------------------------------------------------------------//
+
+void GpuRaymarcher::integratePacket(const RayStateVec &states,
+                                    IntegrationResultVec &results) const
+{
+  const RenderContext *context = states.empty() ? NULL : states[0].context;
+
+  boost::shared_ptr<Gpu::Scene> scene;
+  if (context && context->scene && !context->inScatterCache) {
+    scene = deviceScene(*context->scene);
+  }
+  if (!scene) {
+    UniformRaymarcher::integratePacket(states, results);
+    return;
+  }
+
+  results.resize(states.size());
+
+  // Split the packet. Deep and per-light output stays on the CPU. ---
+
+  std::vector<Gpu::Ray> rays;
+  std::vector<size_t>   deviceIndices;
+  RayStateVec           cpuStates;
+  std::vector<size_t>   cpuIndices;
+
+  const float tMax = std::numeric_limits<float>::max();
+
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    const RayState &state = states[i];
+    if (state.doOutputDeepT || state.doOutputDeepL || state.doOutputLights) {
+      cpuStates.push_back(state);
+      cpuIndices.push_back(i);
+      continue;
+    }
+    Gpu::Ray ray;
+    toDevice(state.wsRay.pos, ray.pos);
+    toDevice(state.wsRay.dir, ray.dir);
+    ray.tMin       = static_cast<float>(std::min<double>(state.tMin, tMax));
+    ray.tMax       = static_cast<float>(std::min<double>(state.tMax, tMax));
+    ray.stepOffset = static_cast<float>(state.stepOffset);
+    ray.isShadow   = state.rayType == RayState::TransmittanceOnly;
+    rays.push_back(ray);
+    deviceIndices.push_back(i);
+  }
+
+  // Integrate on the device ---
+
+  if (!rays.empty()) {
+
+    Gpu::Params params;
+    // Preview renders take longer steps
+    const double previewScale        = RenderGlobals::previewStepScale();
+    params.stepLength                = m_params.stepLength * previewScale;
+    params.useVolumeStepLength       = m_params.useVolumeStepLength;
+    params.volumeStepLengthMult      = 
+      m_params.volumeStepLengthMult * previewScale;
+    params.doEarlyTermination        = m_params.doEarlyTermination;
+    params.earlyTerminationThreshold = m_params.earlyTerminationThreshold;
+    params.shadowStepLengthMult      = m_params.shadowStepLengthMult;
+    params.shadowEarlyTerminationThreshold =
+      m_params.shadowEarlyTerminationThreshold;
+    params.doJitterSteps             = m_params.doJitterSteps;
+
+    std::vector<Gpu::Result> deviceResults(rays.size());
+    std::string              error;
+    Gpu::Stream             *stream = threadStream(error);
+
+    if (stream && Gpu::integrate(*scene, params, &rays[0], rays.size(),
+                                 &deviceResults[0], *stream, error)) {
+      for (size_t i = 0, size = rays.size(); i < size; ++i) {
+        const Gpu::Result &r = deviceResults[i];
+        Sys::Stats::add(rays[i].isShadow ?
+                        Sys::Stats::TransmittanceOnlyRays :
+                        Sys::Stats::FullRaymarchRays);
+        Sys::Stats::add(Sys::Stats::RaymarchSteps, r.numSteps);
+        Sys::Stats::add(Sys::Stats::RaymarchIntervals, r.numIntervals);
+        if (r.isTerminated) {
+          Sys::Stats::add(Sys::Stats::EarlyTerminations);
+        }
+        results[deviceIndices[i]] =
+          IntegrationResult(Color(r.luminance[0], r.luminance[1],
+                                  r.luminance[2]),
+                            Color(r.transmittance[0], r.transmittance[1],
+                                  r.transmittance[2]));
+      }
+    } else {
+      PVR_LOG_WARNING_LIMITED(g_cpuFallbackWarnings, 
+                              "GpuRaymarcher integrating on the CPU: " + 
+                              error);
+      for (size_t i = 0, size = deviceIndices.size(); i < size; ++i) {
+        cpuStates.push_back(states[deviceIndices[i]]);
+        cpuIndices.push_back(deviceIndices[i]);
+      }
+    }
+
+  }
+
+  // Integrate the rest on the CPU ---
+
+  if (!cpuStates.empty()) {
+    IntegrationResultVec cpuResults;
+    UniformRaymarcher::integratePacket(cpuStates, cpuResults);
+    for (size_t i = 0, size = cpuIndices.size(); i < size; ++i) {
+      results[cpuIndices[i]] = cpuResults[i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool GpuRaymarcher::isAvailable()
+{
+  return Gpu::numDevices() > 0;
+}
+
+//----------------------------------------------------------------------------//
+
+bool GpuRaymarcher::isSupported(std::string &reason) const
+{
+  if (!dynamic_cast<const PhysicalSampler *>(m_raymarchSampler.get())) {
+    reason = "the raymarch sampler isn't PhysicalSampler";
+    return false;
+  }
+  const PhysicalSampler &sampler =
+    static_cast<const PhysicalSampler &>(*m_raymarchSampler);
+  if (sampler.lightSamples() != 0) {
+    reason = "light_samples is set";
+    return false;
+  }
+  if (sampler.occlusionCullThreshold() > 0.0f) {
+    reason = "occlusion_cull_threshold is set";
+    return false;
+  }
+  if (m_holdoutAttr.index() != VolumeAttr::IndexInvalid) {
+    reason = "the scene has holdouts";
+    return false;
+  }
+  if (m_params.doLinearSteps || m_params.maxStepOpticalDepth > 0.0 ||
+      m_params.rouletteThreshold > 0.0 ||
+      m_params.shadowRouletteThreshold > 0.0) {
+    reason = "linear steps, max_step_optical_depth or roulette is enabled";
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+boost::shared_ptr<Gpu::Scene>
+GpuRaymarcher::deviceScene(const Scene &scene) const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  if (m_isUploaded && m_scene == &scene) {
+    return m_deviceScene;
+  }
+
+  m_scene      = &scene;
+  m_isUploaded = true;
+  m_deviceScene.reset();
+
+  std::string reason;
+  if (!isAvailable()) {
+    reason = "no CUDA device was found";
+  } else if (isSupported(reason)) {
+    if (Gpu::Scene *deviceScene = uploadScene(scene, reason)) {
+      m_deviceScene.reset(deviceScene, &Gpu::destroyScene);
+    }
+  }
+  if (!m_deviceScene) {
+    Log::print("GpuRaymarcher integrating on the CPU, since " + reason);
+  }
+
+  return m_deviceScene;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_CUDA
+
+//----------------------------------------------------------------------------//
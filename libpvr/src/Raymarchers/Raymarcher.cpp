@@ -33,16 +33,125 @@
 
 // System includes
 
-#include <list>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 // Library includes
 
 #include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/tss.hpp>
 
 // Project headers
 
 #include "pvr/Camera.h"
-#include "pvr/RenderGlobals.h"
+#include "pvr/Math.h"
+#include "pvr/Scene.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! A thread's scratch buffers, one per level of nested integration. 
+  //! They're held by pointer so that leased ones stay put when the pool
+  //! grows.
+  struct ScratchPool
+  {
+    ScratchPool()
+      : depth(0)
+    { }
+    ~ScratchPool()
+    {
+      BOOST_FOREACH (pvr::Render::RaymarchScratch *s, scratch) {
+        delete s;
+      }
+    }
+    std::vector<pvr::Render::RaymarchScratch *> scratch;
+    size_t                                      depth;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  boost::thread_specific_ptr<ScratchPool> g_scratchPool;
+
+  //--------------------------------------------------------------------------//
+
+  //! Largest error allowed when dropping knots of the deep functions. A
+  //! quarter of DeepImage's default maxError, which simplifies them again.
+  //! Absolute for transmittance, and relative to values above one for 
+  //! luminance.
+  const float k_deepTolerance = 0.0005f;
+
+  //--------------------------------------------------------------------------//
+
+  //! Narrows the slope bounds so that segments from anchor stay within 
+  //! tolerance of value at depth t
+  void narrowBounds(const pvr::Util::ColorCurve::Sample &anchor, 
+                    const float t, const pvr::Color &value, 
+                    const float tolerance, 
+                    pvr::Render::DeepSimplifyState::Bounds &bounds)
+  {
+    const float dt = t - anchor.first;
+    for (int c = 0; c < 3; ++c) {
+      const float low  = (value[c] - tolerance - anchor.second[c]) / dt;
+      const float high = (value[c] + tolerance - anchor.second[c]) / dt;
+      bounds.low[c]  = bounds.isValid ? std::max(bounds.low[c], low) : low;
+      bounds.high[c] = bounds.isValid ? std::min(bounds.high[c], high) : high;
+    }
+    bounds.isValid = true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds a knot to a deep function, replacing the provisional last knot 
+  //! if the segment to the new one stays within the slope bounds
+  void addDeepKnot(pvr::Util::ColorCurve &curve, const float t, 
+                   const pvr::Color &value, const float tolerance,
+                   pvr::Render::DeepSimplifyState::Bounds &bounds)
+  {
+    typedef pvr::Util::ColorCurve::Sample    Sample;
+    typedef pvr::Util::ColorCurve::SampleVec SampleVec;
+
+    const SampleVec &samples = curve.samples();
+    const size_t     size    = samples.size();
+
+    // Out of order knots are inserted as is, and end the current segment
+    if (size == 0 || t <= samples.back().first) {
+      curve.addSample(t, value);
+      bounds.isValid = false;
+      return;
+    }
+
+    if (size > 1 && bounds.isValid) {
+      const Sample &anchor = samples[size - 2];
+      const float   dt     = t - anchor.first;
+      bool          isInside = true;
+      for (int c = 0; c < 3 && isInside; ++c) {
+        const float slope = (value[c] - anchor.second[c]) / dt;
+        isInside = slope >= bounds.low[c] && slope <= bounds.high[c];
+      }
+      if (isInside) {
+        narrowBounds(anchor, t, value, tolerance, bounds);
+        curve.setLastSample(t, value);
+        return;
+      }
+    }
+
+    // Keep the last knot, and start a new segment from it
+    const Sample anchor = samples.back();
+    bounds.isValid = false;
+    narrowBounds(anchor, t, value, tolerance, bounds);
+    curve.addSample(t, value);
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -56,49 +165,128 @@ using namespace boost;
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// RaymarchScratch::Lease
+//----------------------------------------------------------------------------//
+
+RaymarchScratch::Lease::Lease()
+{
+  ScratchPool *pool = g_scratchPool.get();
+  if (!pool) {
+    pool = new ScratchPool;
+    g_scratchPool.reset(pool);
+  }
+  if (pool->depth == pool->scratch.size()) {
+    pool->scratch.push_back(new RaymarchScratch);
+  }
+  m_scratch = pool->scratch[pool->depth++];
+}
+
+//----------------------------------------------------------------------------//
+
+RaymarchScratch::Lease::~Lease()
+{
+  g_scratchPool->depth--;
+}
+
+//----------------------------------------------------------------------------//
+// Raymarcher
+//----------------------------------------------------------------------------//
+
+void Raymarcher::bindAttributes(const Volume &volume) const
+{
+  if (m_raymarchSampler) {
+    m_raymarchSampler->bindAttributes(volume);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Raymarcher::integratePacket(const RayStateVec &states, 
+                                 IntegrationResultVec &results) const
+{
+  results.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    results[i] = integrate(states[i]);
+  }
+}
+
 //----------------------------------------------------------------------------//
 // Utility function implementations
 //----------------------------------------------------------------------------//
 
 IntervalVec splitIntervals(const IntervalVec &intervals)
 {
+  RaymarchScratch scratch;
+  scratch.rawIntervals = intervals;
+  splitIntervals(scratch);
+  return scratch.intervals;
+}
+
+//----------------------------------------------------------------------------//
+
+void splitIntervals(RaymarchScratch &scratch)
+{
+  const IntervalVec &intervals    = scratch.rawIntervals;
+  IntervalVec       &outIntervals = scratch.intervals;
+
+  outIntervals.clear();
+
   // If we have zero or one intervals we do nothing
   if (intervals.size() < 2) {
-    return intervals;
+    outIntervals.assign(intervals.begin(), intervals.end());
+    return;
   }
 
-  // Gather all interval start/end points
-  vector<double> points;
-  points.reserve(intervals.size() * 2);
+  // Gather all interval start/end points. Every point splits the output, 
+  // but only non-empty intervals contribute a step length.
+  IntervalEventVec &events = scratch.events;
+  events.clear();
   BOOST_FOREACH (const Interval &i, intervals) {
-    points.push_back(i.t0);
-    points.push_back(i.t1);
-  }
-
-  // Sort and unique start/end points 
-  sort(points.begin(), points.end());
-  vector<double>::iterator newEnd = unique(points.begin(), points.end());
-  points.resize(newEnd - points.begin());
-
-  // For each endpoint pair, find the incoming interval(s) that overlap it
-  IntervalVec outIntervals;
-  for (size_t i = 0, size = points.size() - 1; i < size; ++i) {
-    Interval newInterval(points[i], points[i + 1], 
-                         std::numeric_limits<float>::max());
-    bool foundInterval = false;
-    BOOST_FOREACH (const Interval &interval, intervals) {
-      if (interval.t0 < newInterval.t1 && interval.t1 > newInterval.t0) {
-        newInterval.stepLength = std::min(interval.stepLength, 
-                                          newInterval.stepLength);
-        foundInterval = true;
+    const bool valid = i.t0 < i.t1;
+    events.push_back(IntervalEvent(i.t0, i.stepLength, 
+                                   valid ? IntervalEvent::Start : 
+                                   IntervalEvent::Point, i.isHomogeneous));
+    events.push_back(IntervalEvent(i.t1, i.stepLength, 
+                                   valid ? IntervalEvent::End : 
+                                   IntervalEvent::Point, i.isHomogeneous));
+  }
+  sort(events.begin(), events.end());
+
+  // Sweep over the sorted points, tracking the step lengths of all 
+  // intervals that overlap the current span, in sorted order. The smallest
+  // one is used. A span is homogeneous only if all its intervals are, since
+  // a sum of constants is constant.
+  vector<double> &active = scratch.activeStepLengths;
+  active.clear();
+  size_t numHeterogeneous = 0;
+  for (size_t i = 0, size = events.size(); i < size; ) {
+    const double t = events[i].t;
+    for (; i < size && events[i].t == t; ++i) {
+      const double step = events[i].stepLength;
+      if (events[i].type == IntervalEvent::Start) {
+        active.insert(lower_bound(active.begin(), active.end(), step), step);
+        numHeterogeneous += events[i].isHomogeneous ? 0 : 1;
+      } else if (events[i].type == IntervalEvent::End) {
+        active.erase(lower_bound(active.begin(), active.end(), step));
+        numHeterogeneous -= events[i].isHomogeneous ? 0 : 1;
       }
     }
-    if (foundInterval) {
-      outIntervals.push_back(newInterval);
+    if (i < size && !active.empty()) {
+      outIntervals.push_back(Interval(t, events[i].t, active.front(),
+                                      numHeterogeneous == 0));
     }
   }
-  
-  return outIntervals;
+}
+
+//----------------------------------------------------------------------------//
+
+void findIntervals(const RayState &state, RaymarchScratch &scratch)
+{
+  scratch.rawIntervals.clear();
+  state.context->scene->volume->appendIntersections(state, 
+                                                    scratch.rawIntervals);
+  splitIntervals(scratch);
 }
 
 //----------------------------------------------------------------------------//
@@ -132,14 +320,87 @@ Util::ColorCurve::Ptr setupDeepTCurve(const RayState &state, const float first)
 //----------------------------------------------------------------------------//
 
 void updateDeepFunctions(const float t, const Color &L, const Color &T, 
-                         Util::ColorCurve::Ptr lf, Util::ColorCurve::Ptr tf)
+                         const Util::ColorCurve::Ptr &lf, 
+                         const Util::ColorCurve::Ptr &tf,
+                         DeepSimplifyState &simplify)
 {
   if (tf) {
-    tf->addSample(t, T);
+    addDeepKnot(*tf, t, T, k_deepTolerance, simplify.tf);
   }
   if (lf) {
-    lf->addSample(t, L);
+    const float scale = std::max(1.0f, Math::max(L));
+    addDeepKnot(*lf, t, L, k_deepTolerance * scale, simplify.lf);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+double jitteredStepLength(const RayState &state, const double stepLength)
+{
+  // The offset is in [0,1), so the step never collapses to zero length
+  return stepLength * (1.0 - state.stepOffset);
+}
+
+//----------------------------------------------------------------------------//
+
+size_t raySeed(const RayState &state)
+{
+  size_t seed = 0;
+  boost::hash_combine(seed, state.wsRay.pos.x);
+  boost::hash_combine(seed, state.wsRay.pos.y);
+  boost::hash_combine(seed, state.wsRay.pos.z);
+  boost::hash_combine(seed, state.wsRay.dir.x);
+  boost::hash_combine(seed, state.wsRay.dir.y);
+  boost::hash_combine(seed, state.wsRay.dir.z);
+  boost::hash_combine(seed, state.time);
+  return seed;
+}
+
+//----------------------------------------------------------------------------//
+
+float rouletteWeight(const Color &T, const double threshold, 
+                     Imath::Rand48 &rng)
+{
+  const float maxT = Math::max(T);
+  if (threshold <= 0.0 || maxT >= threshold) {
+    return 1.0f;
+  }
+  const float pSurvive = maxT / threshold;
+  if (rng.nextf() >= pSurvive) {
+    return 0.0f;
+  }
+  return 1.0f / pSurvive;
+}
+
+//----------------------------------------------------------------------------//
+
+void accumulateLights(const RaymarchSample &sample, const Color &weight, 
+                      ColorVec &lightL)
+{
+  const ColorVec &sampleL = sample.lightLuminance;
+  if (lightL.size() < sampleL.size()) {
+    lightL.resize(sampleL.size(), Colors::zero());
+  }
+  for (size_t i = 0, size = sampleL.size(); i < size; ++i) {
+    lightL[i] += sampleL[i] * weight;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color homogeneousStepWeight(const Color &extinction, const double stepLength)
+{
+  Color weight;
+  for (int c = 0; c < 3; ++c) {
+    const double opticalDepth = extinction[c] * stepLength;
+    // Below this, the series expansion is more accurate than the division
+    if (opticalDepth < 1e-4) {
+      weight[c] = stepLength * (1.0 - 0.5 * opticalDepth);
+    } else {
+      weight[c] = (1.0 - std::exp(-opticalDepth)) / extinction[c];
+    }
   }
+  return weight;
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,358 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file TrackingRaymarcher.cpp
+  Contains implementations of TrackingRaymarcher class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Raymarchers/TrackingRaymarcher.h"
+
+// System includes
+
+#include <cmath>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Curve.h"
+#include "pvr/Math.h"
+#include "pvr/Scene.h"
+#include "pvr/Stats.h"
+#include "pvr/StlUtil.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+  // Strings
+  //--------------------------------------------------------------------------//
+
+  const std::string k_strSegmentSteps("segment_steps");
+
+  //--------------------------------------------------------------------------//
+  // Helper functions
+  //--------------------------------------------------------------------------//
+
+  Color exp(const Color &val)
+  {
+    return Color(std::exp(val.x), std::exp(val.y), std::exp(val.z));
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// TrackingRaymarcher::TrackingParams
+//----------------------------------------------------------------------------//
+
+TrackingRaymarcher::TrackingParams::TrackingParams()
+  : segmentSteps(16.0)
+{ 
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+// TrackingRaymarcher
+//----------------------------------------------------------------------------//
+
+void TrackingRaymarcher::setParams(const Util::ParamMap &params)
+{
+  UniformRaymarcher::setParams(params);
+  getValue(params.floatMap, k_strSegmentSteps, 
+           m_trackingParams.segmentSteps);
+}
+
+//----------------------------------------------------------------------------//
+
+IntegrationResult
+TrackingRaymarcher::integrate(const RayState &state) const
+{
+  if (!isTracked(state)) {
+    return UniformRaymarcher::integrate(state);
+  }
+
+  Sys::Stats::add(Sys::Stats::TransmittanceOnlyRays);
+
+  // Integration intervals ---
+
+  RaymarchScratch::Lease scratch;
+  findIntervals(state, *scratch);
+  const IntervalVec &intervals = scratch->intervals;
+
+  if (intervals.size() == 0) {
+    return IntegrationResult();
+  }
+
+  // Set up transmittance function and luminance function ---
+
+  ColorCurve::Ptr   lf = setupDeepLCurve(state, intervals[0].t0);
+  ColorCurve::Ptr   tf = setupDeepTCurve(state, intervals[0].t0);
+  DeepSimplifyState simplify;
+
+  // Ray integration variables ---
+
+  VolumeSampleState sampleState(state);
+  Imath::Rand48     rng(raySeed(state));
+  Color             T     = Colors::one();
+  bool              alive = true;
+
+  // Interval loop ---
+
+  BOOST_FOREACH (const Interval &interval, intervals) {
+
+    // Interval integration variables
+    const double tStart = std::max(interval.t0, state.tMin);
+    const double tEnd   = std::min(interval.t1, state.tMax);
+
+    // Pick step and segment length
+    const double stepLength =
+      m_params.useVolumeStepLength ? 
+      interval.stepLength * m_params.volumeStepLengthMult : 
+      m_params.stepLength;
+    const double segmentLength = 
+      stepLength * std::max(m_trackingParams.segmentSteps, 1.0);
+
+    // Prevent infinite loops
+    if (tStart >= tEnd || stepLength <= 0.0) {
+      continue;
+    }
+
+    Sys::Stats::add(Sys::Stats::RaymarchIntervals);
+
+    // Homogeneous intervals are integrated exactly with a single step, 
+    // which is both cheaper and noise free compared to tracking
+    if (interval.isHomogeneous) {
+      alive = marchSegment(sampleState, tStart, tEnd, tEnd - tStart, T, tf,
+                           simplify);
+      if (!alive) {
+        break;
+      }
+      continue;
+    }
+
+    // Segment loop ---
+
+    for (double t0 = tStart; alive && t0 < tEnd; ) {
+      const double t1 = std::min(tEnd, t0 + segmentLength);
+      Color sigmaMajorant, holdoutMajorant;
+      if (m_raymarchSampler->extinctionMajorant(state, t0, t1, 
+                                                sigmaMajorant) &&
+          boundHoldouts(state, t0, t1, holdoutMajorant)) {
+        // Segments with no extinction are skipped entirely
+        const float majorant = Math::max(sigmaMajorant + holdoutMajorant);
+        if (majorant > 0.0f) {
+          alive = trackSegment(state, sampleState, t0, t1, majorant, rng, 
+                               T, tf, simplify);
+        }
+      } else {
+        alive = marchSegment(sampleState, t0, t1, 
+                             std::min(stepLength, t1 - t0), T, tf, simplify);
+      }
+      t0 = t1;
+    }
+
+    updateDeepFunctions(tEnd, Colors::zero(), T, lf, tf, simplify);
+
+    if (!alive) {
+      break;
+    }
+
+  } // end for each interval
+
+  if (tf) {
+    tf->removeDuplicates();
+  }
+
+  if (lf) {
+    lf->removeDuplicates();
+  }
+
+  return IntegrationResult(Colors::zero(), lf, T, tf);
+}
+
+//----------------------------------------------------------------------------//
+
+void TrackingRaymarcher::integratePacket(const RayStateVec &states,
+                                         IntegrationResultVec &results) const
+{
+  BOOST_FOREACH (const RayState &state, states) {
+    if (isTracked(state)) {
+      Raymarcher::integratePacket(states, results);
+      return;
+    }
+  }
+  UniformRaymarcher::integratePacket(states, results);
+}
+
+//----------------------------------------------------------------------------//
+
+bool TrackingRaymarcher::isTracked(const RayState &state)
+{
+  // Primary rays need the holdout and alpha handling of the uniform 
+  // raymarcher.
+  return state.rayType == RayState::TransmittanceOnly && state.rayDepth > 0;
+}
+
+//----------------------------------------------------------------------------//
+
+bool TrackingRaymarcher::trackSegment(const RayState &state, 
+                                      VolumeSampleState &sampleState,
+                                      const double t0, const double t1,
+                                      const float majorant, 
+                                      Imath::Rand48 &rng, 
+                                      Color &T, ColorCurve::Ptr tf,
+                                      DeepSimplifyState &simplify) const
+{
+  double t = t0;
+
+  while (true) {
+
+    // Sample free-flight distance to next tentative collision
+    t -= std::log(1.0 - rng.nextf()) / majorant;
+    if (t >= t1) {
+      return true;
+    }
+
+    // Weight by the probability of the collision being a null collision.
+    // The majorant is a true bound for all interpolators that don't 
+    // overshoot, and otherwise the weight is clamped.
+    Sys::Stats::add(Sys::Stats::RaymarchSteps);
+    sampleState.wsP   = state.wsRay(t);
+    const Color sigma = extinction(sampleState);
+    T.x *= std::max(1.0f - sigma.x / majorant, 0.0f);
+    T.y *= std::max(1.0f - sigma.y / majorant, 0.0f);
+    T.z *= std::max(1.0f - sigma.z / majorant, 0.0f);
+
+    // Russian roulette instead of early termination, to stay unbiased
+    if (m_params.doEarlyTermination) {
+      const float threshold = earlyTerminationThreshold(state);
+      const float maxT      = Math::max(T);
+      if (maxT < threshold) {
+        const float pSurvive = maxT / threshold;
+        if (rng.nextf() >= pSurvive) {
+          Sys::Stats::add(Sys::Stats::EarlyTerminations);
+          T = Colors::zero();
+          updateDeepFunctions(t, Colors::zero(), T, ColorCurve::Ptr(), tf, 
+                              simplify);
+          return false;
+        }
+        T /= pSurvive;
+      }
+    }
+
+    updateDeepFunctions(t, Colors::zero(), T, ColorCurve::Ptr(), tf, 
+                        simplify);
+
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool TrackingRaymarcher::marchSegment(VolumeSampleState &sampleState,
+                                      const double t0, const double t1,
+                                      const double stepLength, 
+                                      Color &T, ColorCurve::Ptr tf,
+                                      DeepSimplifyState &simplify) const
+{
+  const Ray &wsRay = sampleState.rayState.wsRay;
+
+  for (double stepT0 = t0; stepT0 < t1; ) {
+
+    const double stepT1 = std::min(t1, stepT0 + stepLength);
+    sampleState.wsP     = wsRay((stepT0 + stepT1) * 0.5);
+    Sys::Stats::add(Sys::Stats::RaymarchSteps);
+
+    const Color sigma = extinction(sampleState);
+    if (Math::max(sigma) > 0.0f) {
+      T *= exp(-sigma * (stepT1 - stepT0));
+    }
+
+    if (m_params.doEarlyTermination &&
+        Math::max(T) < earlyTerminationThreshold(sampleState.rayState)) {
+      Sys::Stats::add(Sys::Stats::EarlyTerminations);
+      T = Colors::zero();
+      updateDeepFunctions(stepT1, Colors::zero(), T, ColorCurve::Ptr(), tf,
+                          simplify);
+      return false;
+    }
+
+    updateDeepFunctions(stepT1, Colors::zero(), T, ColorCurve::Ptr(), tf,
+                        simplify);
+
+    stepT0 = stepT1;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+Color TrackingRaymarcher::extinction(const VolumeSampleState &sampleState) const
+{
+  // Secondary rays treat holdouts as regular extinction, the same way
+  // the uniform raymarcher does.
+  const Color sigma = m_raymarchSampler->extinction(sampleState);
+  if (m_holdoutAttr.index() == VolumeAttr::IndexInvalid) {
+    return sigma;
+  }
+  const Volume::CPtr &volume = sampleState.rayState.context->scene->volume;
+  return sigma + volume->sample(sampleState, m_holdoutAttr).value;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -33,6 +33,9 @@
 
 // System includes
 
+#include <algorithm>
+#include <vector>
+
 // Library includes
 
 #include <boost/foreach.hpp>
@@ -46,6 +49,7 @@
 #include "pvr/Math.h"
 #include "pvr/RenderGlobals.h"
 #include "pvr/Scene.h"
+#include "pvr/Stats.h"
 #include "pvr/StlUtil.h"
 #include "pvr/Types.h"
 #include "pvr/Volumes/Volume.h"
@@ -69,6 +73,23 @@ namespace {
   const std::string k_strVolumeStepLengthMult("volume_step_length_multiplier");
   const std::string k_strDoEarlyTerm("do_early_termination");
   const std::string k_strEarlyTermThresh("early_termination_threshold");
+  const std::string k_strShadowStepLengthMult("shadow_step_length_multiplier");
+  const std::string k_strShadowEarlyTermThresh(
+    "shadow_early_termination_threshold");
+  const std::string k_strMaxStepOpticalDepth("max_step_optical_depth");
+  const std::string k_strDeferredLighting("deferred_lighting");
+  const std::string k_strJitterSteps("jitter_steps");
+  const std::string k_strHomogeneousStepLengthMult(
+    "homogeneous_step_length_multiplier");
+  const std::string k_strLinearSteps("linear_steps");
+  const std::string k_strRouletteThresh("roulette_threshold");
+  const std::string k_strShadowRouletteThresh("shadow_roulette_threshold");
+
+  //! Number of rays in a packet
+  const size_t k_packetSize = 8;
+  //! Number of steps whose lighting is evaluated together when lighting is
+  //! deferred
+  const size_t k_deferredBatchSize = 32;
 
   //--------------------------------------------------------------------------//
   // Helper functions
@@ -81,8 +102,30 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
-  void updateTransmittance(const Render::RayState &state, 
-                           const double stepLength, 
+  //! Plays Russian roulette with the extinction transmittance of a ray, 
+  //! reweighting the output transmittances of surviving rays.
+  //! \returns False if the ray should terminate.
+  bool playRoulette(const double threshold, Imath::Rand48 &rng,
+                    Color &T_e, Color &T_alpha, Color &T_m)
+  {
+    const float weight = Render::rouletteWeight(T_e, threshold, rng);
+    if (weight == 0.0f) {
+      return false;
+    }
+    if (weight != 1.0f) {
+      T_e     *= weight;
+      T_alpha *= weight;
+      T_m     *= weight;
+    }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Updates the transmittance of a primary (ray depth zero) or secondary
+  //! ray. Without holdouts, sigma_h is ignored.
+  template <bool IsPrimary, bool HasHoldouts>
+  void updateTransmittance(const double stepLength, 
                            Color &sigma_e, const Color &sigma_h, 
                            Color &T_e, Color &T_h, Color &T_alpha, Color &T_m)
   {
@@ -90,13 +133,15 @@ namespace {
     Color expSigmaH = Colors::one();
 
     // Update holdout transmittance 
-    if (state.rayDepth > 0) {
-      sigma_e += sigma_h;
-    } else {
-      // Update accumulated holdout
-      if (Math::max(sigma_h) > 0.0f) {
-        expSigmaH = exp(-sigma_h * stepLength);
-        T_h *= expSigmaH;
+    if (HasHoldouts) {
+      if (!IsPrimary) {
+        sigma_e += sigma_h;
+      } else {
+        // Update accumulated holdout
+        if (Math::max(sigma_h) > 0.0f) {
+          expSigmaH = exp(-sigma_h * stepLength);
+          T_h *= expSigmaH;
+        }
       }
     }
 
@@ -107,7 +152,7 @@ namespace {
     }
 
     // Update output transmittance
-    if (state.rayDepth == 0) {
+    if (IsPrimary) {
       T_m     = Math::lerp(T_alpha, T_m, expSigmaH);
       T_alpha = Math::lerp(T_m, T_alpha, expSigmaE);
     }
@@ -115,6 +160,84 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  void updateTransmittance(const Render::RayState &state, 
+                           const bool hasHoldouts, const double stepLength, 
+                           Color &sigma_e, const Color &sigma_h, 
+                           Color &T_e, Color &T_h, Color &T_alpha, Color &T_m)
+  {
+    if (state.rayDepth == 0) {
+      if (hasHoldouts) {
+        updateTransmittance<true, true>(stepLength, sigma_e, sigma_h, 
+                                        T_e, T_h, T_alpha, T_m);
+      } else {
+        updateTransmittance<true, false>(stepLength, sigma_e, sigma_h, 
+                                         T_e, T_h, T_alpha, T_m);
+      }
+    } else {
+      if (hasHoldouts) {
+        updateTransmittance<false, true>(stepLength, sigma_e, sigma_h, 
+                                         T_e, T_h, T_alpha, T_m);
+      } else {
+        updateTransmittance<false, false>(stepLength, sigma_e, sigma_h, 
+                                          T_e, T_h, T_alpha, T_m);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the weight of a step's luminance. Steps through homogeneous
+  //! intervals use the exact integral of transmittance over the step, so
+  //! their accuracy doesn't depend on their optical depth.
+  //! \note Must be called after updateTransmittance(), which has already 
+  //! added the holdouts of secondary rays to their extinction.
+  Color stepWeight(const Render::RayState &state, const bool isHomogeneous,
+                   const double stepLength, 
+                   const Color &sigma_e, const Color &sigma_h,
+                   const Color &T_start, const Color &T_end)
+  {
+    if (!isHomogeneous) {
+      return T_end * stepLength;
+    }
+    const Color sigma = state.rayDepth > 0 ? sigma_e : sigma_e + sigma_h;
+    return T_start * Render::homogeneousStepWeight(sigma, stepLength);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes the weights of the luminance at the start and at the end of a
+  //! step, relative to the transmittance at the start of the step, when the
+  //! luminance varies linearly across the step and the extinction is 
+  //! constant.
+  void linearStepWeights(const Color &sigma, const double stepLength,
+                         Color &w0, Color &w1)
+  {
+    for (int c = 0; c < 3; ++c) {
+      const double a = sigma[c] * stepLength;
+      // Below this, the series expansion is more accurate than the division
+      if (a < 1e-3) {
+        w0[c] = stepLength * (0.5 - a / 6.0);
+        w1[c] = stepLength * (0.5 - a / 3.0);
+      } else {
+        const double e = std::exp(-a);
+        w1[c] = stepLength * ((1.0 - e) / (a * a) - e / a);
+        w0[c] = stepLength * (1.0 - e) / a - w1[c];
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Counts a ray passed to the raymarcher
+  void countRay(const Render::RayState &state)
+  {
+    Sys::Stats::add(state.rayType == Render::RayState::FullRaymarch ?
+                    Sys::Stats::FullRaymarchRays : 
+                    Sys::Stats::TransmittanceOnlyRays);
+  }
+
+  //--------------------------------------------------------------------------//
+
 } // local namespace
 
 //----------------------------------------------------------------------------//
@@ -129,13 +252,77 @@ using namespace pvr::Util;
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// UniformRaymarcher::PacketRay
+//----------------------------------------------------------------------------//
+
+struct UniformRaymarcher::PacketRay
+{
+  // Constructors ---
+
+  PacketRay(const RayState &state)
+    : state(state), sampleState(state), 
+      intervals(NULL), numIntervals(0), interval(0), 
+      L(Colors::zero()), T_e(Colors::one()), T_h(Colors::one()), 
+      T_alpha(Colors::one()), T_m(Colors::zero()),
+      rng(raySeed(state)), isDone(false)
+  { }
+
+  // Data members ---
+
+  //! Ray being integrated
+  const RayState     &state;
+  //! Sample state passed to the volume
+  VolumeSampleState   sampleState;
+  //! Non-overlapping integration intervals, stored in the packet's scratch
+  const Interval     *intervals;
+  //! Number of integration intervals
+  size_t              numIntervals;
+  //! Index of current interval
+  size_t              interval;
+  //! End of current interval
+  double              tEnd;
+  //! Step length of current interval
+  double              baseStepLength;
+  //! Start of current step
+  double              stepT0;
+  //! End of current step
+  double              stepT1;
+  //! Accumulated luminance
+  Color               L;
+  //! Accumulated luminance of each light, if requested
+  ColorVec            lightL;
+  //! Transmittance due to extinction
+  Color               T_e;
+  //! Transmittance due to holdouts
+  Color               T_h;
+  //! Output transmittance
+  Color               T_alpha;
+  //! Holdout matte
+  Color               T_m;
+  //! Deep luminance function. May be null.
+  ColorCurve::Ptr     lf;
+  //! Deep transmittance function. May be null.
+  ColorCurve::Ptr     tf;
+  //! Drops knots of lf and tf as they are added
+  DeepSimplifyState   simplify;
+  //! Random sequence for Russian roulette
+  Imath::Rand48       rng;
+  //! Whether the ray is finished
+  bool                isDone;
+};
+
 //----------------------------------------------------------------------------//
 // UniformRaymarcher::Params
 //----------------------------------------------------------------------------//
 
 UniformRaymarcher::Params::Params()
   : stepLength(1.0), useVolumeStepLength(true), volumeStepLengthMult(1.0),
-    doEarlyTermination(true), earlyTerminationThreshold(0.001)
+    doEarlyTermination(true), earlyTerminationThreshold(0.001),
+    shadowStepLengthMult(1.0), shadowEarlyTerminationThreshold(0.001),
+    maxStepOpticalDepth(0.0), deferredLighting(false), doJitterSteps(false),
+    homogeneousStepLengthMult(4.0), doLinearSteps(false),
+    rouletteThreshold(0.0), shadowRouletteThreshold(0.0)
 { 
   // Empty
 }
@@ -164,6 +351,32 @@ void UniformRaymarcher::setParams(const Util::ParamMap &params)
            m_params.doEarlyTermination);
   getValue(params.floatMap, k_strEarlyTermThresh, 
            m_params.earlyTerminationThreshold);
+  getValue(params.floatMap, k_strShadowStepLengthMult, 
+           m_params.shadowStepLengthMult);
+  getValue(params.floatMap, k_strShadowEarlyTermThresh, 
+           m_params.shadowEarlyTerminationThreshold);
+  getValue(params.floatMap, k_strMaxStepOpticalDepth, 
+           m_params.maxStepOpticalDepth);
+  getValue(params.intMap, k_strDeferredLighting, 
+           m_params.deferredLighting);
+  getValue(params.intMap, k_strJitterSteps, 
+           m_params.doJitterSteps);
+  getValue(params.floatMap, k_strHomogeneousStepLengthMult, 
+           m_params.homogeneousStepLengthMult);
+  getValue(params.floatMap, k_strRouletteThresh, 
+           m_params.rouletteThreshold);
+  getValue(params.floatMap, k_strShadowRouletteThresh, 
+           m_params.shadowRouletteThreshold);
+  getValue(params.intMap, k_strLinearSteps, 
+           m_params.doLinearSteps);
+}
+
+//----------------------------------------------------------------------------//
+
+void UniformRaymarcher::bindAttributes(const Volume &volume) const
+{
+  volume.bindAttribute(m_holdoutAttr);
+  Raymarcher::bindAttributes(volume);
 }
 
 //----------------------------------------------------------------------------//
@@ -171,10 +384,42 @@ void UniformRaymarcher::setParams(const Util::ParamMap &params)
 IntegrationResult
 UniformRaymarcher::integrate(const RayState &state) const
 {
+  typedef IntegrationResult 
+    (UniformRaymarcher::*IntegrateFunc)(const RayState &) const;
+
+  // Indexed by primary ray, deep output and holdouts, in that bit order
+  static const IntegrateFunc funcs[8] = {
+    &UniformRaymarcher::integrateRay<false, false, false>,
+    &UniformRaymarcher::integrateRay<false, false, true>,
+    &UniformRaymarcher::integrateRay<false, true,  false>,
+    &UniformRaymarcher::integrateRay<false, true,  true>,
+    &UniformRaymarcher::integrateRay<true,  false, false>,
+    &UniformRaymarcher::integrateRay<true,  false, true>,
+    &UniformRaymarcher::integrateRay<true,  true,  false>,
+    &UniformRaymarcher::integrateRay<true,  true,  true>
+  };
+
+  // Holdout lookups are skipped once the volume has reported not having one
+  const bool isPrimary   = state.rayDepth == 0;
+  const bool hasDeep     = state.doOutputDeepL || state.doOutputDeepT;
+  const bool hasHoldouts = m_holdoutAttr.index() != VolumeAttr::IndexInvalid;
+
+  return (this->*funcs[isPrimary * 4 + hasDeep * 2 + hasHoldouts])(state);
+}
+
+//----------------------------------------------------------------------------//
+
+template <bool IsPrimary, bool HasDeepOutput, bool HasHoldouts>
+IntegrationResult
+UniformRaymarcher::integrateRay(const RayState &state) const
+{
+  countRay(state);
+
   // Integration intervals ---
 
-  IntervalVec rawIntervals = RenderGlobals::scene()->volume->intersect(state);
-  IntervalVec intervals = splitIntervals(rawIntervals);
+  RaymarchScratch::Lease scratch;
+  findIntervals(state, *scratch);
+  const IntervalVec &intervals = scratch->intervals;
 
   if (intervals.size() == 0) {
     return IntegrationResult();
@@ -182,17 +427,40 @@ UniformRaymarcher::integrate(const RayState &state) const
 
   // Set up transmittance function and luminance function ---
 
-  ColorCurve::Ptr lf = setupDeepLCurve(state, intervals[0].t0);
-  ColorCurve::Ptr tf = setupDeepTCurve(state, intervals[0].t0);
+  ColorCurve::Ptr   lf = setupDeepLCurve(state, intervals[0].t0);
+  ColorCurve::Ptr   tf = setupDeepTCurve(state, intervals[0].t0);
+  DeepSimplifyState simplify;
 
   // Ray integration variables ---
 
-  VolumeSampleState sampleState(state);
   Color             L       = Colors::zero();
+  ColorVec          lightL;
   Color             T_e     = Colors::one();
   Color             T_h     = Colors::one();
   Color             T_alpha = Colors::one();
   Color             T_m     = Colors::zero();
+  Imath::Rand48     rng(raySeed(state));
+
+  // Sample points of a batch of steps. Unless lighting is deferred, each 
+  // batch holds a single step, which uses sampleState. Sample states refer
+  // to the ray, so deferred batches can't reuse them from ray to ray.
+
+  const size_t      batchSize = 
+    m_params.deferredLighting ? k_deferredBatchSize : 1;
+
+  VolumeSampleState              sampleState(state);
+  std::vector<VolumeSampleState> batchStates(batchSize > 1 ? batchSize : 0,
+                                             sampleState);
+  VolumeSampleState             *sampleStates = 
+    batchSize > 1 ? &batchStates[0] : &sampleState;
+  VolumeSampleStatePtrVec       &sampleStatePtrs = scratch->sampleStatePtrs;
+  VolumeSampleVec               &hoSamples       = scratch->hoSamples;
+  RaymarchSampleVec             &samples         = scratch->samples;
+
+  // With linear steps, the sample at the end of each step is kept as the
+  // start of the next one
+  RaymarchSample startSample;
+  Color          startHoldout;
 
   // Interval loop ---
 
@@ -203,66 +471,159 @@ UniformRaymarcher::integrate(const RayState &state) const
     const double tEnd   = std::min(interval.t1, state.tMax);
 
     // Pick step length
-    const double stepLengthToUse =
-      m_params.useVolumeStepLength ? 
-      interval.stepLength * m_params.volumeStepLengthMult : 
-      m_params.stepLength;
-    const double baseStepLength = std::min(stepLengthToUse, tEnd - tStart);
+    const double baseStepLength = 
+      std::min(intervalStepLength(state, interval, tStart, tEnd), 
+               tEnd - tStart);
 
     // Set up first raymarch step
     double stepT0 = tStart;
-    double stepT1 = tStart + baseStepLength;
+    double stepT1 = tStart + 
+      (m_params.doJitterSteps ? jitteredStepLength(state, baseStepLength) : 
+       baseStepLength);
 
     // Prevent infinite loops
     if (stepT0 == stepT1) {
       continue;
     }
 
+    Sys::Stats::add(Sys::Stats::RaymarchIntervals);
+
+    // Linear steps need a sample at the start of the interval
+    if (m_params.doLinearSteps) {
+      sampleStates[0].wsP              = state.wsRay(tStart);
+      sampleStates[0].rayTransmittance = T_e * T_h;
+      sampleStates[0].rayLuminance     = L;
+      sampleStates[0].stepLength       = baseStepLength;
+      sampleStatePtrs.assign(1, &sampleStates[0]);
+      sampleSteps(sampleStatePtrs, *scratch);
+      std::swap(startSample, samples[0]);
+      startHoldout = hoSamples[0].value;
+    }
+
     // Raymarch loop ---
  
     bool doTerminate = false;
+    long numSteps    = 0;
 
     while (stepT0 < tEnd) {
 
-      // Information about current step
-      const double stepLength = stepT1 - stepT0;
-      const double t          = (stepT0 + stepT1) * 0.5;
-      sampleState.wsP         = state.wsRay(t);
+      // Record the sample points of the next batch of steps. Linear steps 
+      // are sampled at their end, others at their midpoint. The ray's 
+      // transmittance and luminance at the start of the batch bound those 
+      // of each step, and a linear step's end sample also starts the next.
+      const double sampleOffset = m_params.doLinearSteps ? 1.0 : 0.5;
+      size_t numBatchSteps = 0;
+      for (double t0 = stepT0, t1 = stepT1; 
+           numBatchSteps < batchSize && t0 < tEnd; ++numBatchSteps) {
+        VolumeSampleState &step = sampleStates[numBatchSteps];
+        step.wsP              = state.wsRay(t0 + (t1 - t0) * sampleOffset);
+        step.rayTransmittance = T_e * T_h;
+        step.rayLuminance     = L;
+        step.stepLength       = 
+          t1 - t0 + (m_params.doLinearSteps ? baseStepLength : 0.0);
+        t0 = t1;
+        t1 = min(tEnd, t1 + baseStepLength);
+      }
 
       // Get holdout, luminance and extinction from the scene
-      VolumeSample hoSample = 
-        RenderGlobals::scene()->volume->sample(sampleState, m_holdoutAttr);
-      RaymarchSample sample = m_raymarchSampler->sample(sampleState);
-
-      // Update transmittance
-      updateTransmittance(state, stepLength, sample.extinction, hoSample.value,
-                          T_e, T_h, T_alpha, T_m);
-
-      // Update luminance
-      L += sample.luminance * T_e * T_h * stepLength;
-
-      // Early termination
-      if (m_params.doEarlyTermination &&
-          Math::max(T_e) < m_params.earlyTerminationThreshold) {
-        T_e         = Colors::zero();
-        T_alpha     = Colors::zero();
-        doTerminate = true;
+      sampleStatePtrs.clear();
+      for (size_t i = 0; i < numBatchSteps; ++i) {
+        sampleStatePtrs.push_back(&sampleStates[i]);
       }
+      sampleSteps(sampleStatePtrs, *scratch);
+
+      // Accumulate the batch
+      for (size_t i = 0; i < numBatchSteps; ++i) {
+
+        // Information about current step
+        const double stepLength = stepT1 - stepT0;
+        const Color  T_start    = T_e * T_h;
+
+        if (m_params.doLinearSteps) {
+
+          // Linear extinction integrates to that of its mean
+          Color sigma_e = (startSample.extinction + samples[i].extinction) * 
+            0.5;
+          Color sigma_h = (startHoldout + hoSamples[i].value) * 0.5;
+
+          // Update transmittance
+          updateTransmittance<IsPrimary, HasHoldouts>(stepLength, 
+                                                      sigma_e, sigma_h, 
+                                                      T_e, T_h, T_alpha, T_m);
+
+          // Update luminance, integrating the linear luminance against the
+          // exponential transmittance. Luminance is also attenuated by 
+          // holdouts, which updateTransmittance() has already added to the
+          // extinction of secondary rays.
+          Color w0, w1;
+          linearStepWeights(IsPrimary ? sigma_e + sigma_h : sigma_e,
+                            stepLength, w0, w1);
+          L += (startSample.luminance * w0 + samples[i].luminance * w1) * 
+            T_start;
+          if (state.doOutputLights) {
+            accumulateLights(startSample, w0 * T_start, lightL);
+            accumulateLights(samples[i], w1 * T_start, lightL);
+          }
+
+          // The end of this step starts the next one
+          std::swap(startSample, samples[i]);
+          startHoldout = hoSamples[i].value;
+
+        } else {
+
+          // Update transmittance
+          updateTransmittance<IsPrimary, HasHoldouts>(stepLength, 
+                                                      samples[i].extinction, 
+                                                      hoSamples[i].value, 
+                                                      T_e, T_h, T_alpha, T_m);
+
+          // Update luminance
+          const Color weight = 
+            stepWeight(state, interval.isHomogeneous, stepLength, 
+                       samples[i].extinction, hoSamples[i].value, 
+                       T_start, T_e * T_h);
+          L += samples[i].luminance * weight;
+          if (state.doOutputLights) {
+            accumulateLights(samples[i], weight, lightL);
+          }
+
+        }
+
+        // Russian roulette and early termination
+        if (!playRoulette(rouletteThreshold(state), rng, T_e, T_alpha, T_m) ||
+            (m_params.doEarlyTermination &&
+             Math::max(T_e) < earlyTerminationThreshold(state))) {
+          T_e         = Colors::zero();
+          T_alpha     = Colors::zero();
+          doTerminate = true;
+          Sys::Stats::add(Sys::Stats::EarlyTerminations);
+        }
+
+        // Update transmittance and luminance functions
+        if (HasDeepOutput) {
+          updateDeepFunctions(stepT1, L, T_e, lf, tf, simplify);
+        }
+
+        // Set up next raymarch step
+        stepT0 = stepT1;
+        stepT1 = min(tEnd, stepT1 + baseStepLength);
+        numSteps++;
+
+        // Terminate if requested
+        if (doTerminate) {
+          break;
+        }
+
+      } // end accumulation of single batch
 
-      // Update transmittance and luminance functions
-      updateDeepFunctions(stepT1, L, T_e, lf, tf);
-
-      // Set up next raymarch step
-      stepT0 = stepT1;
-      stepT1 = min(tEnd, stepT1 + baseStepLength);
-
-      // Terminate if requested
       if (doTerminate) {
         break;
       }
 
     } // end raymarch of single interval
 
+    Sys::Stats::add(Sys::Stats::RaymarchSteps, numSteps);
+
     if (doTerminate) {
       break;
     }
@@ -277,15 +638,335 @@ UniformRaymarcher::integrate(const RayState &state) const
     lf->removeDuplicates();
   }
 
-  if (state.rayDepth == 0) {
-    return IntegrationResult(L, lf, T_alpha, tf);
+  IntegrationResult result = IsPrimary ? 
+    IntegrationResult(L, lf, T_alpha, tf) : IntegrationResult(L, lf, T_e, tf);
+  result.lightLuminance.swap(lightL);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t UniformRaymarcher::packetSize() const
+{
+  return k_packetSize;
+}
+
+//----------------------------------------------------------------------------//
+
+void UniformRaymarcher::integratePacket(const RayStateVec &states,
+                                        IntegrationResultVec &results) const
+{
+  // Deferred lighting batches the steps along each ray instead, and linear
+  // steps are only implemented there
+  if (m_params.deferredLighting || m_params.doLinearSteps) {
+    Raymarcher::integratePacket(states, results);
+    return;
+  }
+
+  results.assign(states.size(), IntegrationResult());
+
+  // Set up each ray ---
+
+  // The rays are constructed in place from the states, and the intervals 
+  // of all the rays share one buffer, so a packet allocates only once.
+  std::vector<PacketRay> rays(states.begin(), states.end());
+
+  RaymarchScratch::Lease scratch;
+  IntervalVec           &packetIntervals = scratch->packetIntervals;
+
+  packetIntervals.clear();
+  BOOST_FOREACH (PacketRay &ray, rays) {
+    countRay(ray.state);
+    findIntervals(ray.state, *scratch);
+    ray.numIntervals = scratch->intervals.size();
+    packetIntervals.insert(packetIntervals.end(), scratch->intervals.begin(),
+                           scratch->intervals.end());
+  }
+
+  for (size_t i = 0, offset = 0, size = rays.size(); i < size; ++i) {
+    PacketRay &ray = rays[i];
+    if (ray.numIntervals == 0) {
+      ray.isDone = true;
+      continue;
+    }
+    ray.intervals = &packetIntervals[offset];
+    offset += ray.numIntervals;
+    ray.lf = setupDeepLCurve(ray.state, ray.intervals[0].t0);
+    ray.tf = setupDeepTCurve(ray.state, ray.intervals[0].t0);
+    ray.simplify = DeepSimplifyState();
+    ray.isDone = !beginInterval(ray);
+  }
+
+  // Raymarch loop ---
+
+  std::vector<size_t>     &activeRays   = scratch->rayIndices;
+  VolumeSampleStatePtrVec &sampleStates = scratch->sampleStatePtrs;
+  VolumeSampleVec         &hoSamples    = scratch->hoSamples;
+  RaymarchSampleVec       &samples      = scratch->samples;
+
+  const bool hasHoldouts = m_holdoutAttr.index() != VolumeAttr::IndexInvalid;
+
+  while (true) {
+
+    // Gather the sample points of the rays that are still marching
+    activeRays.clear();
+    sampleStates.clear();
+    for (size_t i = 0, size = rays.size(); i < size; ++i) {
+      PacketRay &ray = rays[i];
+      if (!ray.isDone) {
+        const double t = (ray.stepT0 + ray.stepT1) * 0.5;
+        ray.sampleState.wsP              = ray.state.wsRay(t);
+        ray.sampleState.rayTransmittance = ray.T_e * ray.T_h;
+        ray.sampleState.rayLuminance     = ray.L;
+        ray.sampleState.stepLength       = ray.stepT1 - ray.stepT0;
+        activeRays.push_back(i);
+        sampleStates.push_back(&ray.sampleState);
+      }
+    }
+
+    if (activeRays.empty()) {
+      break;
+    }
+
+    Sys::Stats::add(Sys::Stats::RaymarchSteps, activeRays.size());
+
+    // Get holdout, luminance and extinction for all the sample points
+    sampleSteps(sampleStates, *scratch);
+
+    // Update each ray
+    for (size_t i = 0, size = activeRays.size(); i < size; ++i) {
+
+      PacketRay &ray = rays[activeRays[i]];
+
+      const double stepLength = ray.stepT1 - ray.stepT0;
+      const Color  T_start    = ray.T_e * ray.T_h;
+
+      // Update transmittance
+      updateTransmittance(ray.state, hasHoldouts, stepLength, 
+                          samples[i].extinction, hoSamples[i].value, 
+                          ray.T_e, ray.T_h, ray.T_alpha, ray.T_m);
+
+      // Update luminance
+      const Color weight = 
+        stepWeight(ray.state, ray.intervals[ray.interval].isHomogeneous, 
+                   stepLength, samples[i].extinction, hoSamples[i].value, 
+                   T_start, ray.T_e * ray.T_h);
+      ray.L += samples[i].luminance * weight;
+      if (ray.state.doOutputLights) {
+        accumulateLights(samples[i], weight, ray.lightL);
+      }
+
+      // Russian roulette and early termination
+      bool doTerminate = false;
+      if (!playRoulette(rouletteThreshold(ray.state), ray.rng, 
+                        ray.T_e, ray.T_alpha, ray.T_m) ||
+          (m_params.doEarlyTermination &&
+           Math::max(ray.T_e) < earlyTerminationThreshold(ray.state))) {
+        ray.T_e     = Colors::zero();
+        ray.T_alpha = Colors::zero();
+        doTerminate = true;
+        Sys::Stats::add(Sys::Stats::EarlyTerminations);
+      }
+
+      // Update transmittance and luminance functions
+      updateDeepFunctions(ray.stepT1, ray.L, ray.T_e, ray.lf, ray.tf, 
+                          ray.simplify);
+
+      // Set up next raymarch step, moving on to the next interval if needed
+      ray.stepT0 = ray.stepT1;
+      ray.stepT1 = min(ray.tEnd, ray.stepT1 + ray.baseStepLength);
+
+      if (doTerminate) {
+        ray.isDone = true;
+      } else if (ray.stepT0 >= ray.tEnd) {
+        ray.interval++;
+        ray.isDone = !beginInterval(ray);
+      }
+
+    }
+
+  } // end raymarch loop
+
+  // Collect results ---
+
+  for (size_t i = 0, size = rays.size(); i < size; ++i) {
+    const PacketRay &ray = rays[i];
+    if (ray.numIntervals == 0) {
+      continue;
+    }
+    if (ray.tf) {
+      ray.tf->removeDuplicates();
+    }
+    if (ray.lf) {
+      ray.lf->removeDuplicates();
+    }
+    if (ray.state.rayDepth == 0) {
+      results[i] = IntegrationResult(ray.L, ray.lf, ray.T_alpha, ray.tf);
+    } else {
+      results[i] = IntegrationResult(ray.L, ray.lf, ray.T_e, ray.tf);
+    }
+    results[i].lightLuminance = ray.lightL;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool UniformRaymarcher::beginInterval(PacketRay &ray) const
+{
+  for (; ray.interval < ray.numIntervals; ++ray.interval) {
+
+    const Interval &interval = ray.intervals[ray.interval];
+
+    // Interval integration variables
+    const double tStart = std::max(interval.t0, ray.state.tMin);
+    ray.tEnd            = std::min(interval.t1, ray.state.tMax);
+
+    // Pick step length
+    ray.baseStepLength = 
+      std::min(intervalStepLength(ray.state, interval, tStart, ray.tEnd), 
+               ray.tEnd - tStart);
+
+    // Set up first raymarch step
+    ray.stepT0 = tStart;
+    ray.stepT1 = tStart + 
+      (m_params.doJitterSteps ? 
+       jitteredStepLength(ray.state, ray.baseStepLength) : 
+       ray.baseStepLength);
+
+    // Skip empty intervals, which would otherwise loop forever
+    if (ray.stepT0 != ray.stepT1 && ray.stepT0 < ray.tEnd) {
+      Sys::Stats::add(Sys::Stats::RaymarchIntervals);
+      return true;
+    }
+
+  }
+
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+double UniformRaymarcher::intervalStepLength(const RayState &state, 
+                                             const Interval &interval,
+                                             const double tStart, 
+                                             const double tEnd) const
+{
+  // Transmittance is exact across homogeneous intervals however long the 
+  // step, so only luminance, which varies with the lighting, needs steps
+  if (interval.isHomogeneous && 
+      state.rayType == RayState::TransmittanceOnly) {
+    return tEnd - tStart;
+  }
+
+  const double stepLength =
+    (m_params.useVolumeStepLength ? 
+     interval.stepLength * m_params.volumeStepLengthMult : 
+     m_params.stepLength) *
+    (state.rayType == RayState::TransmittanceOnly ? 
+     m_params.shadowStepLengthMult : 1.0) *
+    (interval.isHomogeneous ? m_params.homogeneousStepLengthMult : 1.0) *
+    RenderGlobals::previewStepScale();
+
+  if (m_params.maxStepOpticalDepth <= 0.0 || tStart >= tEnd) {
+    return stepLength;
+  }
+
+  // Thin intervals don't need to be sampled at voxel resolution, since 
+  // their contribution is bounded by their majorant
+  Color sigmaMajorant, holdoutMajorant;
+  if (!m_raymarchSampler->extinctionMajorant(state, tStart, tEnd, 
+                                             sigmaMajorant) ||
+      !boundHoldouts(state, tStart, tEnd, holdoutMajorant)) {
+    return stepLength;
+  }
+  const double maxExtinction = Math::max(sigmaMajorant + holdoutMajorant);
+  if (maxExtinction <= 0.0) {
+    return tEnd - tStart;
+  }
+  return std::max(stepLength, m_params.maxStepOpticalDepth / maxExtinction);
+}
+
+//----------------------------------------------------------------------------//
+
+bool UniformRaymarcher::boundHoldouts(const RayState &state, 
+                                      const double t0, const double t1,
+                                      Color &result) const
+{
+  if (m_holdoutAttr.index() == VolumeAttr::IndexInvalid) {
+    result = Colors::zero();
+    return true;
+  }
+  return state.context->scene->volume->majorant(state, m_holdoutAttr, 
+                                                t0, t1, result);
+}
+
+//----------------------------------------------------------------------------//
+
+void UniformRaymarcher::sampleSteps(const VolumeSampleStatePtrVec &states,
+                                    RaymarchScratch &scratch) const
+{
+  if (states.empty()) {
+    return;
+  }
+
+  const Volume::CPtr &volume = states[0]->rayState.context->scene->volume;
+
+  // Single points avoid the batch overhead
+  const bool isSingle = states.size() == 1;
+
+  // Holdouts are rare, so skip their lookups entirely once the volume has 
+  // reported not having one
+  if (m_holdoutAttr.index() == VolumeAttr::IndexInvalid) {
+    scratch.hoSamples.assign(states.size(), VolumeSample());
+  } else if (isSingle) {
+    scratch.hoSamples.resize(1);
+    scratch.hoSamples[0] = volume->sample(*states[0], m_holdoutAttr);
+  } else {
+    volume->sampleBatch(states, m_holdoutAttr, scratch.hoSamples);
+  }
+
+  // Transmittance-only rays need no luminance
+  bool isShadowBatch = true;
+  BOOST_FOREACH (const VolumeSampleState *state, states) {
+    if (state->rayState.rayType != RayState::TransmittanceOnly) {
+      isShadowBatch = false;
+      break;
+    }
+  }
+
+  if (isSingle) {
+    scratch.samples.resize(1);
+    scratch.samples[0] = isShadowBatch ?
+      RaymarchSample(Colors::zero(), 
+                     m_raymarchSampler->extinction(*states[0])) :
+      m_raymarchSampler->sample(*states[0]);
+  } else if (isShadowBatch) {
+    m_raymarchSampler->extinctionBatch(states, scratch.samples);
   } else {
-    return IntegrationResult(L, lf, T_e, tf);
+    m_raymarchSampler->sampleBatch(states, scratch.samples);
   }
 }
 
 //----------------------------------------------------------------------------//
 
+double 
+UniformRaymarcher::earlyTerminationThreshold(const RayState &state) const
+{
+  return state.rayType == RayState::TransmittanceOnly ? 
+    m_params.shadowEarlyTerminationThreshold : 
+    m_params.earlyTerminationThreshold;
+}
+
+//----------------------------------------------------------------------------//
+
+double UniformRaymarcher::rouletteThreshold(const RayState &state) const
+{
+  return state.rayType == RayState::TransmittanceOnly ? 
+    m_params.shadowRouletteThreshold : m_params.rouletteThreshold;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
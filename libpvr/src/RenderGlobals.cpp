@@ -33,11 +33,15 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
 #include <stdlib.h>
 
 // Project includes
 
+#include "pvr/Camera.h"
 #include "pvr/Log.h"
+#include "pvr/Threading.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -59,6 +63,7 @@ float RenderGlobals::ms_shutter = 0.0f;
 
 RenderGlobals::SceneCPtr RenderGlobals::ms_scene;
 RenderGlobals::CameraCPtr RenderGlobals::ms_camera;
+size_t RenderGlobals::ms_previewLevel = 0;
 
 //----------------------------------------------------------------------------//
 // RenderGlobals implementations
@@ -98,6 +103,24 @@ void RenderGlobals::setCamera(CameraCPtr camera)
 
 //----------------------------------------------------------------------------//
 
+void RenderGlobals::setNumThreads(const size_t numThreads)
+{
+  Sys::setNumThreads(numThreads);
+}
+
+//----------------------------------------------------------------------------//
+
+void RenderGlobals::setPreviewLevel(const size_t level)
+{
+  ms_previewLevel = level;
+  if (level > 0) {
+    Log::print("Preview level " + str(level) + ": resolutions scaled by 1/" +
+               str(1 << level));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 float RenderGlobals::fps()
 { 
   return ms_fps; 
@@ -133,6 +156,52 @@ RenderGlobals::CameraCPtr RenderGlobals::camera()
 
 //----------------------------------------------------------------------------//
 
+size_t RenderGlobals::numThreads()
+{ 
+  return Sys::numThreads(); 
+}
+
+//----------------------------------------------------------------------------//
+
+size_t RenderGlobals::previewLevel()
+{
+  return ms_previewLevel;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t RenderGlobals::previewResolution(const size_t res)
+{
+  if (ms_previewLevel == 0) {
+    return res;
+  }
+  return std::max(res >> ms_previewLevel, static_cast<size_t>(1));
+}
+
+//----------------------------------------------------------------------------//
+
+double RenderGlobals::previewStepScale()
+{
+  return std::ldexp(1.0, static_cast<int>(ms_previewLevel));
+}
+
+//----------------------------------------------------------------------------//
+
+RenderGlobals::CameraCPtr RenderGlobals::previewCamera(CameraCPtr camera)
+{
+  if (ms_previewLevel == 0 || !camera) {
+    return camera;
+  }
+  const Imath::V2i res = camera->resolution();
+  Render::Camera::Ptr preview = camera->clone();
+  preview->setResolution
+    (Imath::V2i(static_cast<int>(previewResolution(res.x)),
+                static_cast<int>(previewResolution(res.y))));
+  return preview;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace pvr
 
 //----------------------------------------------------------------------------//
@@ -33,17 +33,37 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <vector>
+
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <Field3D/Field.h>
+
+#include <OpenEXR/ImathFun.h>
+
 // Project headers
 
 #include "pvr/Constants.h"
 #include "pvr/RenderGlobals.h"
 #include "pvr/Interrupt.h"
 #include "pvr/Log.h"
+#include "pvr/Math.h"
 #include "pvr/PhaseFunction.h"
+#include "pvr/PixelSamplers/StratifiedSampler.h"
 #include "pvr/Scene.h"
 #include "pvr/Strings.h"
+#include "pvr/Trace.h"
+#include "pvr/Volumes/CompositeVolume.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -113,6 +133,233 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Stride of the coarsest preview pass of a progressive render
+  const size_t k_previewStride = 8;
+
+  //! Pixels added around the projected volume bounds. Covers the jitter of 
+  //! the pixel samples, which reach half a pixel outside the pixel.
+  const int k_cullPadding = 2;
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the bounds of the volumes that are sampled directly. Composite 
+  //! volumes are replaced by their inputs, which bound tighter.
+  void findLeafBounds(const pvr::Render::Volume::CPtr &volume, 
+                      std::vector<pvr::BBox> &bounds)
+  {
+    using namespace pvr::Render;
+
+    if (dynamic_cast<const CompositeVolume*>(volume.get())) {
+      BOOST_FOREACH (Volume::CPtr input, volume->inputs()) {
+        findLeafBounds(input, bounds);
+      }
+      return;
+    }
+    const pvr::BBox wsBounds = volume->wsBounds();
+    if (!wsBounds.isEmpty()) {
+      bounds.push_back(wsBounds);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Projects world-space bounds to raster space, over the camera's 
+  //! shutter interval.
+  //! \returns False if the bounds can't be projected, because they reach 
+  //! behind the camera, or because the camera sees all around.
+  bool projectBounds(const pvr::Render::Camera &camera, 
+                     const pvr::BBox &wsBounds, Imath::Box2d &rsBounds)
+  {
+    using namespace pvr;
+
+    if (camera.canTransformNegativeCamZ()) {
+      return false;
+    }
+
+    // Each time sample of the camera, and halfway between them
+    const size_t              numTimes = 
+      2 * std::max(camera.numTimeSamples(), 2u) - 1;
+    const std::vector<Vector> corners  = Math::cornerPoints(wsBounds);
+
+    rsBounds.makeEmpty();
+    for (size_t i = 0; i < numTimes; ++i) {
+      const PTime time(Math::parametric(i, numTimes));
+      BOOST_FOREACH (const Vector &wsP, corners) {
+        if (camera.worldToCamera(wsP, time).z <= 0.0) {
+          return false;
+        }
+        const Vector rsP = camera.worldToRaster(wsP, time);
+        rsBounds.extendBy(Imath::V2d(rsP.x, rsP.y));
+      }
+    }
+
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Divides a light's luminance by its intensity. Channels without 
+  //! intensity have no luminance to divide.
+  pvr::Color perUnitIntensity(const pvr::Color &L, 
+                              const pvr::Color &intensity)
+  {
+    return pvr::Color(intensity.x != 0.0f ? L.x / intensity.x : 0.0f,
+                      intensity.y != 0.0f ? L.y / intensity.y : 0.0f,
+                      intensity.z != 0.0f ? L.z / intensity.z : 0.0f);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Transmittance below which a ray counts as having hit the volume, for
+  //! the first-hit depth that guides the denoiser
+  const float k_firstHitTransmittance = 0.99f;
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets the pixels of the rows [begin, end) of the depth image's data 
+  //! window to the depth at which the transmittance map first drops below
+  //! k_firstHitTransmittance. Pixels that never do are left at zero. The 
+  //! transmittance map starts at the corner of the data window.
+  void firstHitRows(const pvr::Render::DeepImage &transmittance,
+                    pvr::Render::Image &depth, const size_t begin, 
+                    const size_t end)
+  {
+    using namespace pvr::Render;
+
+    const Imath::Box2i window = depth.dataWindow();
+    for (size_t j = begin; j < end; ++j) {
+      for (int i = 0; i <= window.max.x - window.min.x; ++i) {
+        const DeepImage::Curve::Ptr func = transmittance.pixelFunction(i, j);
+        BOOST_FOREACH (const DeepImage::Curve::Sample &sample, 
+                       func->samples()) {
+          if (pvr::Math::max(sample.second) < k_firstHitTransmittance) {
+            depth.setPixel(window.min.x + i, window.min.y + j, 
+                           pvr::Color(sample.first));
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Suffixes of the checkpoint files. See Renderer::setCheckpoint().
+  const char *k_checkpointImageSuffix         = ".exr";
+  const char *k_checkpointTransmittanceSuffix = ".transmittance.pvrdeep";
+  const char *k_checkpointLuminanceSuffix     = ".luminance.pvrdeep";
+  const char *k_checkpointTilesSuffix         = ".tiles";
+
+  //--------------------------------------------------------------------------//
+
+  //! Identifies the render a checkpoint belongs to. Tile indices only mean
+  //! the same thing for the same window, tile size and split.
+  std::string checkpointKey(const Imath::V2i &res, 
+                            const Imath::Box2i &window,
+                            const size_t tileSize, const size_t splitPart,
+                            const size_t numSplitParts)
+  {
+    using namespace pvr::Util;
+    return "pvr checkpoint 1 res " + str(res.x) + " " + str(res.y) + 
+      " window " + str(window.min.x) + " " + str(window.min.y) + " " + 
+      str(window.max.x) + " " + str(window.max.y) + " tile " + 
+      str(tileSize) + " split " + str(splitPart) + " " + str(numSplitParts);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Checkpoint files are written under a partial name, then renamed, so
+  //! that a render killed while saving keeps its previous checkpoint
+  std::string partialFilename(const std::string &prefix, const char *suffix)
+  {
+    return prefix + ".partial" + suffix;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Renames a partial checkpoint file to its final name, replacing the 
+  //! previous one.
+  //! \returns False if the partial file couldn't be renamed
+  bool replaceFile(const std::string &prefix, const char *suffix)
+  {
+    const std::string from = partialFilename(prefix, suffix);
+    const std::string to   = prefix + suffix;
+    if (std::rename(from.c_str(), to.c_str()) == 0) {
+      return true;
+    }
+    // Windows doesn't rename onto an existing file
+    std::remove(to.c_str());
+    return std::rename(from.c_str(), to.c_str()) == 0;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Names of the cost AOV's channels, in RGBA order
+  const char *k_costChannelNames[4] = { 
+    "steps", "volume_samples", "occluder_lookups", "ns" 
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Records the calling thread's statistics counters and the clock, so
+  //! that the work done until add() can be charged to a pixel of the cost 
+  //! AOV. Does nothing if there is no cost AOV.
+  class PixelCost
+  {
+  public:
+    PixelCost(const pvr::Image::Ptr &image)
+      : m_image(image.get()), m_steps(0), m_samples(0), m_lookups(0)
+    { 
+      if (m_image) {
+        m_steps   = steps();
+        m_samples = volumeSamples();
+        m_lookups = occluderLookups();
+        m_start   = boost::posix_time::microsec_clock::universal_time();
+      }
+    }
+    //! Adds the work since construction to the given pixel
+    void add(const size_t x, const size_t y) const
+    {
+      using namespace boost::posix_time;
+      if (!m_image) {
+        return;
+      }
+      const time_duration elapsed = microsec_clock::universal_time() - m_start;
+      const pvr::Color    cost(steps() - m_steps, 
+                               volumeSamples() - m_samples, 
+                               occluderLookups() - m_lookups);
+      m_image->setPixel(x, y, m_image->pixel(x, y) + cost);
+      m_image->setPixelAlpha(x, y, m_image->pixelAlpha(x, y) + 
+                             static_cast<float>(elapsed.total_nanoseconds()));
+    }
+  private:
+    static long steps()
+    { 
+      return pvr::Sys::Stats::threadValue(pvr::Sys::Stats::RaymarchSteps); 
+    }
+    //! Composite volumes count their children's lookups, so only leaf 
+    //! volumes are counted here
+    static long volumeSamples()
+    {
+      using pvr::Sys::Stats;
+      return Stats::threadValue(Stats::VoxelVolumeSamples) + 
+        Stats::threadValue(Stats::ConstantVolumeSamples) + 
+        Stats::threadValue(Stats::FractalCloudSamples) + 
+        Stats::threadValue(Stats::OpenVDBVolumeSamples);
+    }
+    static long occluderLookups()
+    { 
+      return pvr::Sys::Stats::threadValue(pvr::Sys::Stats::OccluderLookups); 
+    }
+    pvr::Image              *m_image;
+    long                     m_steps;
+    long                     m_samples;
+    long                     m_lookups;
+    boost::posix_time::ptime m_start;
+  };
+
+  //--------------------------------------------------------------------------//
+
 } // local namespace
 
 //----------------------------------------------------------------------------//
@@ -130,13 +377,138 @@ using namespace pvr::Util;
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// Renderer::PixelSamples
+//----------------------------------------------------------------------------//
+
+//! Accumulated samples of a single pixel. Keeps the running sums needed 
+//! to estimate how far the pixel's mean is from converged.
+struct Renderer::PixelSamples
+{
+  typedef std::vector<ColorCurve::CPtr> CurveVec;
+
+  PixelSamples()
+  { clear(); }
+
+  void clear()
+  {
+    luminance = Colors::zero();
+    alpha     = Colors::zero();
+    count     = 0;
+    lSum      = lSqSum = aSum = aSqSum = 0.0;
+    isDone    = false;
+    tf.clear();
+    lf.clear();
+    std::fill(lightLuminance.begin(), lightLuminance.end(), Colors::zero());
+  }
+
+  void add(const IntegrationResult &result)
+  {
+    const Color  a = Colors::one() - result.transmittance;
+    const double l = (result.luminance.x + result.luminance.y + 
+                      result.luminance.z) / 3.0;
+    const double v = (a.x + a.y + a.z) / 3.0;
+    luminance += result.luminance;
+    alpha     += a;
+    count++;
+    lSum      += l;
+    lSqSum    += l * l;
+    aSum      += v;
+    aSqSum    += v * v;
+    if (result.transmittanceFunction) {
+      tf.push_back(result.transmittanceFunction);
+    }
+    if (result.luminanceFunction) {
+      lf.push_back(result.luminanceFunction);
+    }
+    if (lightLuminance.size() < result.lightLuminance.size()) {
+      lightLuminance.resize(result.lightLuminance.size(), Colors::zero());
+    }
+    for (size_t i = 0, size = result.lightLuminance.size(); i < size; ++i) {
+      lightLuminance[i] += result.lightLuminance[i];
+    }
+  }
+
+  //! Standard error of the mean alpha and luminance, whichever is larger.
+  //! Luminance error is relative above one, so that bright pixels don't
+  //! sample forever. Infinite until there are two samples.
+  double error() const
+  {
+    if (count < 2) {
+      return std::numeric_limits<double>::max();
+    }
+    const double n     = static_cast<double>(count);
+    const double lMean = lSum / n;
+    const double lVar  = std::max(0.0, (lSqSum - lSum * lMean) / (n - 1.0));
+    const double aVar  = std::max(0.0, (aSqSum - aSum * aSum / n) / 
+                                  (n - 1.0));
+    const double lErr  = std::sqrt(lVar / n) / std::max(1.0, lMean);
+    const double aErr  = std::sqrt(aVar / n);
+    return std::max(lErr, aErr);
+  }
+  
+  Color    luminance;
+  Color    alpha;
+  size_t   count;
+  double   lSum;
+  double   lSqSum;
+  double   aSum;
+  double   aSqSum;
+  bool     isDone;
+  CurveVec tf;
+  CurveVec lf;
+  ColorVec lightLuminance;
+};
+
+//----------------------------------------------------------------------------//
+// Renderer::PixelBlock
+//----------------------------------------------------------------------------//
+
+//! Pixels x0 up to but not including x1 of row y, traced as one with 
+//! numSamples samples per round. See Camera::pixelStride().
+struct Renderer::PixelBlock
+{
+  size_t x0;
+  size_t x1;
+  size_t y;
+  size_t numSamples;
+};
+
+//----------------------------------------------------------------------------//
+// Renderer::Checkpoint
+//----------------------------------------------------------------------------//
+
+struct Renderer::Checkpoint
+{
+  //! Identifies the render, see checkpointKey()
+  std::string         key;
+  //! Whether each tile, by index, was read back from the checkpoint being
+  //! resumed. Not modified while rendering.
+  std::vector<char>   isResumed;
+  //! Indices of the finished tiles, including the resumed ones
+  std::vector<size_t> tiles;
+  //! Pixels of the finished tiles
+  Image::Ptr          image;
+  DeepImage::Ptr      transmittance;
+  DeepImage::Ptr      luminance;
+  //! Time since the last save
+  Timer               timer;
+  //! Guards all of the above but isResumed during rendering
+  boost::mutex        mutex;
+};
+
 //----------------------------------------------------------------------------//
 // Renderer::Params
 //----------------------------------------------------------------------------//
 
 Renderer::Params::Params()
   : doPrimary(true), doLuminanceMap(false), doTransmittanceMap(false), 
-    doRandomizePixelSamples(false), numPixelSamples(1)
+    doRandomizePixelSamples(false), doAdaptiveSampling(false),
+    doProgressive(false), doCrop(false), doLightAovs(false), 
+    doEmissionAov(false), doCostAov(false), splitPart(0), numSplitParts(1),
+    numPixelSamples(1), maxPixelSamples(4), adaptiveThreshold(0.01f), 
+    numThreads(0), tileSize(32), inScatterCacheRes(0), 
+    checkpointInterval(300.0f), doResume(false)
 { 
   
 }
@@ -146,11 +518,16 @@ Renderer::Params::Params()
 //----------------------------------------------------------------------------//
 
 Renderer::Renderer()
-  : m_primary(Image::create()),
+  : m_sharesScene(false),
+    m_pixelSampler(StratifiedSampler::create()),
+    m_primary(Image::create()),
     m_deepTransmittance(DeepImage::create()),
-    m_deepLuminance(DeepImage::create())
+    m_deepLuminance(DeepImage::create()),
+    m_holdoutDepthType(RayDistanceDepth),
+    m_statistics(Sys::Stats::NumCounters, 0),
+    m_renderTime(0.0f)
 {
-  
+  updateContext();
 }
 
 //----------------------------------------------------------------------------//
@@ -172,11 +549,37 @@ Renderer::Ptr Renderer::clone() const
   if (m_scene) {
     renderer->m_scene = m_scene->clone();
   }
+  renderer->m_sharesScene = false;
+  renderer->m_noisyPrimary.reset();
+  renderer->m_lightAovs.clear();
+  renderer->m_aovIntensities.clear();
+  renderer->m_views.clear();
+  renderer->disableMainRenderParams();
+  renderer->updateContext();
   return renderer;
 }
 
 //----------------------------------------------------------------------------//
 
+Renderer::Ptr Renderer::createView(Camera::CPtr camera) const
+{
+  Ptr view(new Renderer);
+  // Share the const data, but none of the outputs
+  view->m_params           = m_params;
+  view->m_scene            = m_scene;
+  view->m_sharesScene      = true;
+  view->m_raymarcher       = m_raymarcher;
+  view->m_shadowRaymarcher = m_shadowRaymarcher;
+  view->m_pixelSampler     = m_pixelSampler;
+  view->m_denoiser         = m_denoiser;
+  view->disableMainRenderParams();
+  // Allocates the outputs and updates the context
+  view->setCamera(camera);
+  return view;
+}
+
+//----------------------------------------------------------------------------//
+
 Renderer::Ptr Renderer::create()
 { 
   return Ptr(new Renderer); 
@@ -189,13 +592,14 @@ void Renderer::setCamera(Camera::CPtr camera)
   assert(camera != NULL && "Got null pointer in Renderer::setCamera");
 
   m_camera = camera;
+  updateContext();
   V2i res = m_camera->resolution();
   m_primary = Image::create();
   m_primary->setSize(res.x, res.y);
+  m_noisyPrimary.reset();
+  // The deep images are sized by execute(), and only if they're enabled
   m_deepTransmittance = DeepImage::create();
-  m_deepTransmittance->setSize(res.x, res.y);
   m_deepLuminance = DeepImage::create();
-  m_deepLuminance->setSize(res.x, res.y);
 }
 
 //----------------------------------------------------------------------------//
@@ -207,13 +611,32 @@ void Renderer::setRaymarcher(Raymarcher::CPtr raymarcher)
 
 //----------------------------------------------------------------------------//
 
+void Renderer::setShadowRaymarcher(Raymarcher::CPtr raymarcher)
+{
+  m_shadowRaymarcher = raymarcher;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setPixelSampler(PixelSampler::CPtr sampler)
+{
+  assert(sampler != NULL && "Got null pointer in Renderer::setPixelSampler");
+
+  m_pixelSampler = sampler;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setDenoiser(Denoiser::CPtr denoiser)
+{
+  m_denoiser = denoiser;
+}
+
+//----------------------------------------------------------------------------//
+
 void Renderer::addVolume(Volume::CPtr volume)
 {
-  if (!m_scene) {
-    m_scene = Scene::Ptr(new Scene);
-    RenderGlobals::setScene(m_scene);
-  }
-  m_scene->volume = volume;
+  mutableScene().volume = volume;
 }
 
 //----------------------------------------------------------------------------//
@@ -224,11 +647,7 @@ void Renderer::addLight(Light::CPtr light)
     Log::warning("Tried to add null pointer with Renderer::addLight()");
     return;
   }
-  if (!m_scene) {
-    m_scene = Scene::Ptr(new Scene);
-    RenderGlobals::setScene(m_scene);
-  }
-  m_scene->lights.push_back(light);
+  mutableScene().lights.push_back(light);
 }
 
 //----------------------------------------------------------------------------//
@@ -250,6 +669,18 @@ void Renderer::printSceneInfo() const
 
 //----------------------------------------------------------------------------//
 
+void Renderer::bindAttributes() const
+{
+  if (m_raymarcher && m_scene && m_scene->volume) {
+    m_raymarcher->bindAttributes(*m_scene->volume);
+  }
+  if (m_shadowRaymarcher && m_scene && m_scene->volume) {
+    m_shadowRaymarcher->bindAttributes(*m_scene->volume);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 Scene::Ptr Renderer::scene() const
 {
   return m_scene;
@@ -278,216 +709,1655 @@ void Renderer::setLuminanceMapEnabled(const bool enabled)
 
 //----------------------------------------------------------------------------//
 
-void Renderer::setDoRandomizePixelSamples(const bool enabled)
+void Renderer::setLightAovsEnabled(const bool enabled)
 {
-  m_params.doRandomizePixelSamples = enabled;
+  m_params.doLightAovs = enabled;
 }
 
 //----------------------------------------------------------------------------//
 
-void Renderer::setNumPixelSamples(const size_t numSamples)
+void Renderer::setEmissionAovEnabled(const bool enabled)
 {
-  m_params.numPixelSamples = numSamples;
+  m_params.doEmissionAov = enabled;
 }
 
 //----------------------------------------------------------------------------//
 
-size_t Renderer::numPixelSamples() const
+void Renderer::setCostAovEnabled(const bool enabled)
 {
-  return m_params.numPixelSamples;
+  m_params.doCostAov = enabled;
 }
-  
+
 //----------------------------------------------------------------------------//
 
-void Renderer::setNumDeepSamples(const size_t numSamples)
+void Renderer::setDoRandomizePixelSamples(const bool enabled)
 {
-  if (m_deepTransmittance) {
-    m_deepTransmittance->setNumSamples(numSamples);
-  }
-  if (m_deepLuminance) {
-    m_deepLuminance->setNumSamples(numSamples);
-  }
+  m_params.doRandomizePixelSamples = enabled;
 }
 
 //----------------------------------------------------------------------------//
 
-void Renderer::execute()
+void Renderer::setNumPixelSamples(const size_t numSamples)
 {
-  if (!m_camera) {
-    throw MissingCameraException();
-  }
+  m_params.numPixelSamples = numSamples;
+}
 
-  if (!m_scene) {
-    throw MissingSceneException();
-  }
+//----------------------------------------------------------------------------//
 
-  if (!m_scene->volume) {
-    throw MissingVolumeException();
-  }
+size_t Renderer::numPixelSamples() const
+{
+  return RenderGlobals::previewResolution(m_params.numPixelSamples);
+}
 
-  if (!m_raymarcher) {
-    throw MissingRaymarcherException();
-  }
+//----------------------------------------------------------------------------//
 
-  // Log reporting ---
+size_t Renderer::maxPixelSamples() const
+{
+  return RenderGlobals::previewResolution(m_params.maxPixelSamples);
+}
 
-  const size_t numSamples = m_params.numPixelSamples;
+//----------------------------------------------------------------------------//
 
-  if (m_params.doPrimary) {
-    Log::print("Rendering image " + str(m_primary->size()) + 
-               " (" + str(numSamples) + " x " + str(numSamples) + ")");
-  } else {
-    Log::print("Rendering transmittance map " + str(m_primary->size()) + 
-               " (" + str(numSamples) + " x " + str(numSamples) + ")");
-  }
+void Renderer::setCropWindow(const size_t xMin, const size_t yMin, 
+                             const size_t xMax, const size_t yMax)
+{
+  m_params.doCrop     = true;
+  m_params.cropWindow = Box2i(V2i(xMin, yMin), V2i(xMax, yMax));
+}
 
-  // Initialization ---
+//----------------------------------------------------------------------------//
 
-  RenderGlobals::setCamera(m_camera);
+void Renderer::clearCropWindow()
+{
+  m_params.doCrop = false;
+}
 
-  m_rng.init(0);
-  Timer timer;
-  ProgressReporter progress(2.5f, "  ");
+//----------------------------------------------------------------------------//
 
-  // For each pixel ---
-
-  for (Image::pixel_iterator i = m_primary->begin(), end = m_primary->end();
-       i != end; ++i) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(i.progress());
-    // Pixel result
-    Color luminance = Colors::zero();
-    Color alpha = Colors::zero();
-    // Transmittance functions to be averaged
-    std::vector<ColorCurve::CPtr> tf, lf;
-    // For each pixel sample (in x/y)
-    for (size_t iX = 0; iX < numSamples; iX++) {
-      for (size_t iY = 0; iY < numSamples; iY++) {
-        // Set up the next sample
-        float xSample, ySample;
-        PTime pTime(0.0);
-        setupSample(i.rsX(), i.rsY(), iX, iY, xSample, ySample, pTime);
-        // Render pixel
-        IntegrationResult result = integrateRay(xSample, ySample, pTime);
-        // Update accumulated result
-        luminance += result.luminance;
-        alpha     += Colors::one() - result.transmittance;
-        if (result.transmittanceFunction) {
-          tf.push_back(result.transmittanceFunction);
-        }
-        if (result.luminanceFunction) {
-          lf.push_back(result.luminanceFunction);
-        }
-      }
-    }
-    // Normalize luminance and transmittance
-    luminance *= 1.0 / std::pow(m_params.numPixelSamples, 2.0);
-    alpha     *= 1.0 / std::pow(m_params.numPixelSamples, 2.0);
-    // Update resulting image and transmittance/luminance maps
-    i.setPixel(luminance);
-    i.setPixelAlpha((alpha.x + alpha.y + alpha.z) / 3.0f);
-    if (tf.size() > 0) {
-      m_deepTransmittance->setPixel(i.x, i.y, ColorCurve::average(tf));
-    }
-    if (lf.size() > 0) {
-      m_deepLuminance->setPixel(i.x, i.y, ColorCurve::average(lf));
-    }
+void Renderer::setSplit(const size_t part, const size_t numParts)
+{
+  if (numParts == 0 || part >= numParts) {
+    throw InvalidSplitException(str(part) + " of " + str(numParts));
   }
-
-  Log::print("  Time elapsed: " + str(timer.elapsed()));
+  m_params.splitPart     = part;
+  m_params.numSplitParts = numParts;
 }
-  
+
 //----------------------------------------------------------------------------//
 
-IntegrationResult Renderer::trace(const RayState &state) const
+void Renderer::setProgressiveEnabled(const bool enabled)
 {
-  return m_raymarcher->integrate(state);
+  m_params.doProgressive = enabled;
 }
 
 //----------------------------------------------------------------------------//
 
-Raymarcher::CPtr Renderer::raymarcher() const
+void Renderer::setProgressCallback(const ProgressCallback &callback)
 {
-  return m_raymarcher;
+  m_progressCallback = callback;
 }
 
 //----------------------------------------------------------------------------//
 
-DeepImage::Ptr Renderer::transmittanceMap() const
+void Renderer::setAdaptiveSamplingEnabled(const bool enabled)
 {
-  return m_deepTransmittance;
+  m_params.doAdaptiveSampling = enabled;
 }
 
 //----------------------------------------------------------------------------//
 
-DeepImage::Ptr Renderer::luminanceMap() const
+void Renderer::setMaxPixelSamples(const size_t numSamples)
 {
-  return m_deepLuminance;
+  m_params.maxPixelSamples = numSamples;
 }
 
 //----------------------------------------------------------------------------//
 
-void Renderer::saveImage(const std::string &filename) const
+void Renderer::setAdaptiveThreshold(const float threshold)
 {
-  m_primary->write(filename, Image::RGBA);
+  m_params.adaptiveThreshold = threshold;
 }
+  
+//----------------------------------------------------------------------------//
 
+size_t Renderer::numThreads() const
+{
+  return m_params.numThreads;
+}
+  
 //----------------------------------------------------------------------------//
 
-IntegrationResult Renderer::integrateRay(const float x, const float y,
-                                         const PTime time) const
+void Renderer::setNumDeepSamples(const size_t numSamples)
 {
-  // Create default RayState. Rely on its constructor to set reasonable
-  // defaults
-  RayState state;
-  // Update the values that are non-default
-  state.wsRay = setupRay(m_camera, x, y, time);
-  state.time = time;
-  if (!m_params.doPrimary) {
-    state.rayType = RayState::TransmittanceOnly;
-    state.rayDepth = 1;
+  if (m_deepTransmittance) {
+    m_deepTransmittance->setNumSamples(numSamples);
+  }
+  if (m_deepLuminance) {
+    m_deepLuminance->setNumSamples(numSamples);
   }
-  state.doOutputDeepT = m_params.doTransmittanceMap;
-  state.doOutputDeepL = m_params.doLuminanceMap;
-  // Let the Raymarcher do the integration work
-  return m_raymarcher->integrate(state);
 }
 
 //----------------------------------------------------------------------------//
 
-void Renderer::setupSample(const float xCenter, const float yCenter,
-                           const size_t xSubpixel, const size_t ySubpixel, 
-                           float &xSample, float &ySample, PTime &pTime) const
+void Renderer::setNumThreads(const size_t numThreads)
 {
-  const size_t numSamples = m_params.numPixelSamples;
-
-  xSample = xCenter;
-  ySample = yCenter;
-  if (m_params.doRandomizePixelSamples) {
-    xSample += m_rng.nextf() - 0.5f;
-    ySample += m_rng.nextf() - 0.5f;
-  }
-  pTime = PTime((xSubpixel + ySubpixel * numSamples + m_rng.nextf()) / 
-                (numSamples * numSamples));
+  m_params.numThreads = numThreads;
 }
 
 //----------------------------------------------------------------------------//
-// Utility functions
+
+void Renderer::setTileSize(const size_t tileSize)
+{
+  m_params.tileSize = std::max(tileSize, static_cast<size_t>(1));
+}
+
 //----------------------------------------------------------------------------//
 
-Ray setupRay(Camera::CPtr camera, const float x, const float y, 
-             const PTime time) 
+void Renderer::setInScatterCacheResolution(const size_t res)
 {
-  // Find camera position at current time. This will serve as the Ray's origin
-  const Vector wsEye = camera->position(time);
-  // Compute direction by transforming pixel position in raster space to
-  // world space
-  const Vector rsP(x, y, 1.0);
-  Vector wsP = camera->rasterToWorld(rsP, time);
+  m_params.inScatterCacheRes = res;
+}
 
-  return Ray(wsEye, wsP);  
+//----------------------------------------------------------------------------//
+
+void Renderer::setCheckpoint(const std::string &prefix, const float interval)
+{
+  m_params.checkpointPrefix   = prefix;
+  m_params.checkpointInterval = std::max(interval, 0.0f);
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setResumeEnabled(const bool enabled)
+{
+  m_params.doResume = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setHoldoutDepth(Image::CPtr depth, 
+                               const HoldoutDepthType type)
+{
+  m_holdoutDepth     = depth;
+  m_holdoutDepthType = type;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::execute()
+{
+  Sys::Trace::Scope trace("Renderer::execute", "render");
+
+  setupRender();
+
+  // The cache starts out empty, since the lights may have changed
+  if (m_params.inScatterCacheRes > 0) {
+    m_inScatterCache = 
+      InScatterCache::create(m_scene, m_params.inScatterCacheRes);
+    Log::print("  In-scatter cache resolution " + 
+               str(m_params.inScatterCacheRes));
+  }
+  updateContext();
+
+  // Views share everything but their camera and outputs
+  BOOST_FOREACH (const Ptr &view, m_views) {
+    view->m_params           = m_params;
+    view->m_scene            = m_scene;
+    view->m_raymarcher       = m_raymarcher;
+    view->m_shadowRaymarcher = m_shadowRaymarcher;
+    view->m_pixelSampler     = m_pixelSampler;
+    view->m_denoiser         = m_denoiser;
+    view->m_inScatterCache   = m_inScatterCache;
+    view->updateContext();
+    view->setupRender();
+  }
+
+  setupCheckpoint();
+
+  Timer timer;
+
+  // The cost AOV is measured with the statistics counters
+  const bool wasCounting = Sys::Stats::isEnabled();
+  if (m_params.doCostAov) {
+    Sys::Stats::setEnabled(true);
+  }
+  Sys::Stats::reset();
+
+  // Render tiles on worker threads ---
+
+  if (m_params.doProgressive) {
+    // Each view refines on its own, so that the progress callback sees
+    // one view at a time
+    renderProgressive();
+    BOOST_FOREACH (const Ptr &view, m_views) {
+      view->renderProgressive();
+    }
+  } else if (m_checkpoint) {
+    runPass(boost::bind(&Renderer::renderCheckpointTile, this, _1, _2));
+  } else if (m_views.empty()) {
+    runPass(boost::bind(&Renderer::renderTile, this, _1, _2));
+  } else {
+    runViewsPass();
+  }
+
+  // An interrupted render saves what it has, too
+  if (m_checkpoint) {
+    boost::mutex::scoped_lock lock(m_checkpoint->mutex);
+    saveCheckpoint();
+    m_checkpoint.reset();
+  }
+
+  m_renderTime = timer.elapsed();
+  Log::print("  Time elapsed: " + str(m_renderTime));
+
+  finishRender();
+  denoise();
+  BOOST_FOREACH (const Ptr &view, m_views) {
+    view->finishRender();
+    view->denoise();
+  }
+
+  // Free the cache once no rays refer to it
+  m_inScatterCache.reset();
+  updateContext();
+  BOOST_FOREACH (const Ptr &view, m_views) {
+    view->m_inScatterCache.reset();
+    view->updateContext();
+  }
+
+  // Statistics ---
+
+  m_statistics = Sys::Stats::aggregate();
+  if (wasCounting) {
+    Log::print("  Statistics:");
+    BOOST_FOREACH (const std::string &line, Sys::Stats::info(m_statistics)) {
+      Log::print("    " + line);
+    }
+  }
+  Sys::Stats::setEnabled(wasCounting);
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::addView(Camera::CPtr camera)
+{
+  Ptr view(new Renderer);
+  view->setCamera(camera);
+  m_views.push_back(view);
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::clearViews()
+{
+  m_views.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Renderer::numViews() const
+{
+  return m_views.size();
+}
+
+//----------------------------------------------------------------------------//
+
+Renderer::Ptr Renderer::view(const size_t index) const
+{
+  if (index >= m_views.size()) {
+    throw InvalidViewException(str(index));
+  }
+  return m_views[index];
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setupRender()
+{
+  if (!m_camera) {
+    throw MissingCameraException();
+  }
+
+  if (!m_scene) {
+    throw MissingSceneException();
+  }
+
+  if (!m_scene->volume) {
+    throw MissingVolumeException();
+  }
+
+  if (!m_raymarcher) {
+    throw MissingRaymarcherException();
+  }
+
+  // Only the crop window gets pixel storage
+  const V2i   res    = m_primary->size();
+  const Box2i window = renderWindow();
+  const V2i   size   = window.size() + V2i(1);
+
+  if (window.isEmpty()) {
+    throw EmptyCropWindowException();
+  }
+
+  m_primary->setDataWindow(window);
+
+  // Log reporting ---
+
+  const size_t numSamples = numPixelSamples();
+  const size_t maxSamples = maxPixelSamples();
+
+  string samplesStr = str(numSamples) + " x " + str(numSamples);
+  if (m_params.doProgressive) {
+    samplesStr += ", progressive";
+  } else if (m_params.doAdaptiveSampling) {
+    samplesStr += ", adaptive up to " + str(maxSamples) + " x " + 
+      str(maxSamples);
+  }
+
+  if (m_params.doPrimary) {
+    Log::print("Rendering image " + str(res) + " (" + samplesStr + ")");
+  } else {
+    Log::print("Rendering transmittance map " + str(res) + 
+               " (" + samplesStr + ")");
+  }
+
+  if (m_params.doCrop) {
+    Log::print("  Crop window " + str(window.min) + " - " + str(window.max));
+  }
+
+  if (m_params.numSplitParts > 1) {
+    Log::print("  Split part " + str(m_params.splitPart) + " of " + 
+               str(m_params.numSplitParts));
+  }
+
+  // Initialization ---
+
+  RenderGlobals::setCamera(m_camera);
+
+  // Resolve all attributes before any render thread samples them
+  bindAttributes();
+  if (!m_scene->lights.empty()) {
+    m_scene->volume->bindLights(m_scene->lights);
+  }
+  BOOST_FOREACH (Light::CPtr light, m_scene->lights) {
+    if (light->occluder()) {
+      light->occluder()->bindAttributes();
+    }
+  }
+
+  // Tiles set deep pixels concurrently, which needs uncompacted images. 
+  // The deep images only cover the crop window. Every pixel costs memory
+  // even if it's never set, so disabled outputs are left empty.
+  if (m_params.doTransmittanceMap) {
+    m_deepTransmittance->setSize(size.x, size.y);
+  } else {
+    m_deepTransmittance->setSize(0, 0);
+  }
+  if (m_params.doLuminanceMap) {
+    m_deepLuminance->setSize(size.x, size.y);
+  } else {
+    m_deepLuminance->setSize(0, 0);
+  }
+
+  setupLightAovs(window);
+
+  if (m_params.doCostAov) {
+    m_costAov = Image::create();
+    m_costAov->setSize(res.x, res.y);
+    m_costAov->setDataWindow(window);
+  } else {
+    m_costAov.reset();
+  }
+
+  findVisibleRects();
+
+  const size_t numWorkers = Sys::numWorkerThreads(m_params.numThreads);
+  const size_t numTiles   = 
+    TileScheduler(size.x, size.y, m_params.tileSize, numWorkers).numTiles();
+
+  Log::print("  Using " + str(std::min(numWorkers, numTiles)) + " threads, " +
+             str(numTiles) + " tiles");
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::finishRender()
+{
+  // Pack the deep images now that all their pixels are set
+  if (m_params.doTransmittanceMap) {
+    m_deepTransmittance->compact();
+  }
+  if (m_params.doLuminanceMap) {
+    m_deepLuminance->compact();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::updateContext()
+{
+  m_context.scene          = m_scene.get();
+  m_context.camera         = m_camera.get();
+  m_context.inScatterCache = m_inScatterCache.get();
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::disableMainRenderParams()
+{
+  // Secondary passes such as transmittance maps should cover their whole 
+  // image in a single pass
+  m_params.doProgressive     = false;
+  m_params.doCrop            = false;
+  m_params.splitPart         = 0;
+  m_params.numSplitParts     = 1;
+  m_params.doLightAovs       = false;
+  m_params.doEmissionAov     = false;
+  m_params.doCostAov         = false;
+  m_params.inScatterCacheRes = 0;
+  m_params.checkpointPrefix.clear();
+  m_params.doResume          = false;
+  m_progressCallback         = ProgressCallback();
+}
+
+//----------------------------------------------------------------------------//
+
+Scene& Renderer::mutableScene()
+{
+  if (!m_scene) {
+    m_scene = Scene::Ptr(new Scene);
+    RenderGlobals::setScene(m_scene);
+    updateContext();
+  } else if (m_sharesScene) {
+    m_scene = m_scene->clone();
+    updateContext();
+  }
+  m_sharesScene = false;
+  return *m_scene;
+}
+  
+//----------------------------------------------------------------------------//
+
+bool Renderer::relight()
+{
+  if (!m_scene || m_lightAovs.empty() || 
+      m_lightAovs.size() != m_scene->lights.size()) {
+    Log::warning("Renderer::relight() needs light AOVs of the current "
+                 "lights. Call setLightAovsEnabled() and execute() first.");
+    return false;
+  }
+
+  Timer timer;
+
+  // A denoised image is relit before denoising, then denoised again
+  Image::Ptr   image     = m_noisyPrimary ? m_noisyPrimary : m_primary;
+  float       *pixels    = image->pixels();
+  const V2i    size      = image->dataWindow().size() + V2i(1);
+  const size_t numPixels = size.x * size.y;
+  
+  // The image is linear in each light's intensity, so adding the change in
+  // intensity times the light's AOV gives the image at the new intensity
+  for (size_t l = 0, numLights = m_lightAovs.size(); l < numLights; ++l) {
+    const Color intensity = m_scene->lights[l]->intensity();
+    const Color delta     = intensity - m_aovIntensities[l];
+    if (delta == Colors::zero()) {
+      continue;
+    }
+    const float *aov = m_lightAovs[l]->pixels();
+    for (size_t i = 0; i < numPixels * 4; i += 4) {
+      pixels[i]     += delta.x * aov[i];
+      pixels[i + 1] += delta.y * aov[i + 1];
+      pixels[i + 2] += delta.z * aov[i + 2];
+    }
+    m_aovIntensities[l] = intensity;
+  }
+
+  if (m_noisyPrimary) {
+    std::copy(pixels, pixels + numPixels * 4, m_primary->pixels());
+    if (m_denoiser) {
+      m_denoiser->apply(*m_primary, denoiseGuides(), m_params.numThreads);
+    }
+  }
+
+  Log::print("Relit image in " + str(timer.elapsed()) + " seconds");
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+IntegrationResult Renderer::trace(const RayState &state) const
+{
+  // Rays set up outside the renderer, e.g. by occluders, belong to this
+  // renderer's scene
+  if (!state.context) {
+    RayState contextState(state);
+    contextState.context = &m_context;
+    return trace(contextState);
+  }
+  if (m_shadowRaymarcher && state.rayType == RayState::TransmittanceOnly) {
+    return m_shadowRaymarcher->integrate(state);
+  }
+  return m_raymarcher->integrate(state);
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::tracePacket(const RayStateVec &states, 
+                           IntegrationResultVec &results) const
+{
+  if (states.empty()) {
+    results.clear();
+    return;
+  }
+  if (!states[0].context) {
+    RayStateVec contextStates(states);
+    BOOST_FOREACH (RayState &state, contextStates) {
+      state.context = &m_context;
+    }
+    tracePacket(contextStates, results);
+    return;
+  }
+  if (m_shadowRaymarcher && 
+      states[0].rayType == RayState::TransmittanceOnly) {
+    m_shadowRaymarcher->integratePacket(states, results);
+    return;
+  }
+  m_raymarcher->integratePacket(states, results);
+}
+
+//----------------------------------------------------------------------------//
+
+Camera::CPtr Renderer::camera() const
+{
+  return m_camera;
+}
+
+//----------------------------------------------------------------------------//
+
+Raymarcher::CPtr Renderer::raymarcher() const
+{
+  return m_raymarcher;
+}
+
+//----------------------------------------------------------------------------//
+
+Raymarcher::CPtr Renderer::shadowRaymarcher() const
+{
+  return m_shadowRaymarcher;
+}
+
+//----------------------------------------------------------------------------//
+
+PixelSampler::CPtr Renderer::pixelSampler() const
+{
+  return m_pixelSampler;
+}
+
+//----------------------------------------------------------------------------//
+
+Denoiser::CPtr Renderer::denoiser() const
+{
+  return m_denoiser;
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Renderer::lightAov(const size_t light) const
+{
+  if (light >= m_lightAovs.size()) {
+    return Image::Ptr();
+  }
+  return m_lightAovs[light];
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Renderer::emissionAov() const
+{
+  if (!m_params.doEmissionAov || m_lightAovs.empty()) {
+    return Image::Ptr();
+  }
+
+  Image::Ptr   emission  = 
+    m_noisyPrimary ? m_noisyPrimary->clone() : m_primary->clone();
+  float       *pixels    = emission->pixels();
+  const V2i    size      = emission->dataWindow().size() + V2i(1);
+  const size_t numPixels = size.x * size.y;
+
+  // Whatever luminance the lights didn't scatter
+  for (size_t l = 0, numLights = m_lightAovs.size(); l < numLights; ++l) {
+    const Color &intensity = m_aovIntensities[l];
+    const float *aov       = m_lightAovs[l]->pixels();
+    for (size_t i = 0; i < numPixels * 4; i += 4) {
+      pixels[i]     -= intensity.x * aov[i];
+      pixels[i + 1] -= intensity.y * aov[i + 1];
+      pixels[i + 2] -= intensity.z * aov[i + 2];
+    }
+  }
+
+  return emission;
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Renderer::costAov() const
+{
+  return m_costAov;
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Renderer::imageSnapshot() const
+{
+  return m_primary->clone();
+}
+
+//----------------------------------------------------------------------------//
+
+DeepImage::Ptr Renderer::transmittanceMap() const
+{
+  return m_deepTransmittance;
+}
+
+//----------------------------------------------------------------------------//
+
+DeepImage::Ptr Renderer::luminanceMap() const
+{
+  return m_deepLuminance;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::saveImage(const std::string &filename) const
+{
+  m_primary->write(filename, Image::RGBA);
+}
+
+//----------------------------------------------------------------------------//
+
+Sys::BackgroundTask::Ptr 
+Renderer::saveImageAsync(const std::string &filename) const
+{
+  return m_primary->writeAsync(filename, Image::RGBA);
+}
+
+//----------------------------------------------------------------------------//
+
+bool Renderer::saveAovs(const std::string &filename) const
+{
+  Image::LayerVec layers;
+  layers.push_back(Image::Layer("", m_primary, Image::RGBA));
+  if (m_params.doEmissionAov && !m_lightAovs.empty()) {
+    layers.push_back(Image::Layer("emission", emissionAov(), Image::RGB));
+  }
+  if (m_params.doLightAovs) {
+    for (size_t l = 0, numLights = m_lightAovs.size(); l < numLights; ++l) {
+      layers.push_back(Image::Layer("light" + str(l), lightImage(l), 
+                                    Image::RGB));
+    }
+  }
+  if (m_costAov) {
+    Image::Layer cost("cost", m_costAov, Image::RGBA);
+    cost.channelNames.assign(k_costChannelNames, k_costChannelNames + 4);
+    layers.push_back(cost);
+  }
+  return Image::writeLayers(filename, layers);
+}
+
+//----------------------------------------------------------------------------//
+
+bool Renderer::saveTransmittanceMap(const std::string &filename) const
+{
+  if (!m_params.doTransmittanceMap || !m_deepTransmittance) {
+    Log::warning("No transmittance map to save: " + filename);
+    return false;
+  }
+  return m_deepTransmittance->write(filename, DeepImage::Transmittance);
+}
+
+//----------------------------------------------------------------------------//
+
+bool Renderer::saveLuminanceMap(const std::string &filename) const
+{
+  if (!m_params.doLuminanceMap || !m_deepLuminance) {
+    Log::warning("No luminance map to save: " + filename);
+    return false;
+  }
+  return m_deepLuminance->write(filename, DeepImage::Luminance);
+}
+
+//----------------------------------------------------------------------------//
+
+const Sys::Stats::Counts& Renderer::statistics() const
+{
+  return m_statistics;
+}
+
+//----------------------------------------------------------------------------//
+
+float Renderer::renderTime() const
+{
+  return m_renderTime;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::runPass(const TileFunc &renderFunc) const
+{
+  const Box2i  window     = m_primary->dataWindow();
+  const V2i    size       = window.size() + V2i(1);
+  const size_t numWorkers = Sys::numWorkerThreads(m_params.numThreads);
+
+  TileScheduler scheduler(window.min.x, window.min.y, size.x, size.y, 
+                          m_params.tileSize, numWorkers);
+  const size_t numThreads = std::min(numWorkers, scheduler.numTiles());
+
+  ProgressReporter progress(2.5f, "  ");
+  Sys::JobState job(size.x * size.y);
+  Sys::runWorkers(numThreads, 
+                  boost::bind(&Renderer::renderTiles, this, 
+                              boost::ref(scheduler), boost::ref(job), _1,
+                              boost::cref(renderFunc)),
+                  job, progress);
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::runViewsPass() const
+{
+  const size_t numWorkers = Sys::numWorkerThreads(m_params.numThreads);
+
+  // This renderer is the first view
+  std::vector<const Renderer*> renderers(1, this);
+  BOOST_FOREACH (const Ptr &view, m_views) {
+    renderers.push_back(view.get());
+  }
+
+  TileSchedulerVec schedulers;
+  size_t           numPixels = 0;
+  size_t           numTiles  = 0;
+  BOOST_FOREACH (const Renderer *renderer, renderers) {
+    const Box2i window = renderer->m_primary->dataWindow();
+    const V2i   size   = window.size() + V2i(1);
+    schedulers.push_back(TileSchedulerPtr(
+      new TileScheduler(window.min.x, window.min.y, size.x, size.y, 
+                        m_params.tileSize, numWorkers)));
+    numPixels += size.x * size.y;
+    numTiles  += schedulers.back()->numTiles();
+  }
+  const size_t numThreads = std::min(numWorkers, numTiles);
+
+  ProgressReporter progress(2.5f, "  ");
+  Sys::JobState job(numPixels);
+  Sys::runWorkers(numThreads, 
+                  boost::bind(&Renderer::renderViewTiles, this, 
+                              boost::cref(renderers), boost::ref(schedulers), 
+                              boost::ref(job), _1),
+                  job, progress);
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderViewTiles(const std::vector<const Renderer*> &renderers,
+                               TileSchedulerVec &schedulers,
+                               Sys::JobState &job, const size_t queue) const
+{
+  // Workers start on different views, then help with the others once 
+  // their own view runs dry
+  const size_t numViews = renderers.size();
+  for (size_t i = 0; i < numViews && !job.aborted(); ++i) {
+    const size_t    v        = (queue + i) % numViews;
+    const Renderer &renderer = *renderers[v];
+    renderer.renderTiles(*schedulers[v], job, queue, 
+                         boost::bind(&Renderer::renderTile, &renderer, 
+                                     _1, _2));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderTiles(TileScheduler &scheduler, Sys::JobState &job,
+                           const size_t queue, 
+                           const TileFunc &renderFunc) const
+{
+  Tile tile;
+  while (!job.aborted() && scheduler.next(queue, tile)) {
+    // The other parts of a split render own the remaining tiles
+    if (tile.index % m_params.numSplitParts == m_params.splitPart) {
+      Sys::Trace::Scope trace("Renderer::renderTile", "render");
+      renderFunc(tile, job);
+    }
+    job.markDone(tile.numPixels());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderProgressive()
+{
+  const V2i    size       = m_primary->dataWindow().size() + V2i(1);
+  const size_t numSamples = std::max(numPixelSamples(), 
+                                     static_cast<size_t>(1));
+  const size_t numRefines = numSamples * numSamples;
+
+  // Preview passes go from coarse to fine, then each refinement pass adds
+  // one more sample to every pixel
+  std::vector<size_t> strides;
+  for (size_t stride = k_previewStride; stride > 1; stride /= 2) {
+    strides.push_back(stride);
+  }
+
+  const size_t    numPasses = strides.size() + numRefines;
+  size_t          pass      = 0;
+  PixelSamplesVec pixels(size.x * size.y);
+
+  BOOST_FOREACH (const size_t stride, strides) {
+    runPass(boost::bind(&Renderer::renderPreviewTile, this, _1, _2, stride));
+    finishPass(++pass, numPasses);
+  }
+
+  for (size_t sample = 0; sample < numRefines; ++sample) {
+    runPass(boost::bind(&Renderer::renderRefineTile, this, _1, _2, sample,
+                        boost::ref(pixels)));
+    finishPass(++pass, numPasses);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::finishPass(const size_t pass, const size_t numPasses) const
+{
+  Log::print("  Finished pass " + str(pass) + " of " + str(numPasses));
+  if (m_progressCallback) {
+    m_progressCallback(pass, numPasses);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderTile(const Tile &tile, const Sys::JobState &job) const
+{
+  const size_t numSamples      = numPixelSamples();
+  const size_t samplesPerPixel = numSamples * numSamples;
+  // Neighboring pixels are integrated together, since their rays are 
+  // coherent enough to benefit from the raymarcher's packet integration.
+  // Packets run along the rows of the tile and may span several rows, so
+  // raymarchers with large packets get the whole tile at once. The cost 
+  // AOV needs each pixel's work on its own.
+  const size_t pixelsPerPacket = m_costAov ? 1 :
+    std::max(static_cast<size_t>(1), 
+             cameraRaymarcher().packetSize() / std::max(samplesPerPixel, 
+                                                   static_cast<size_t>(1)));
+  // Each round takes a full set of pixel samples. Adaptive sampling keeps 
+  // adding rounds to the pixels that haven't converged.
+  const size_t maxRounds       = 
+    m_params.doAdaptiveSampling ?
+    std::max(static_cast<size_t>(1), 
+             maxPixelSamples() * maxPixelSamples() / 
+             std::max(samplesPerPixel, static_cast<size_t>(1))) : 1;
+  const size_t numPixels       = tile.numPixels();
+
+  RayStateVec          states;
+  IntegrationResultVec results;
+  PixelSamplesVec      pixels(std::min(pixelsPerPacket, numPixels));
+
+  // Tiles that can't see the volume are left empty
+  if (isCulled(tile.x0, tile.y0, tile.x1, tile.y1)) {
+    Sys::Stats::add(Sys::Stats::CulledPixels, numPixels);
+    pixels[0].clear();
+    for (size_t y = tile.y0; y < tile.y1; ++y) {
+      for (size_t x = tile.x0; x < tile.x1; ++x) {
+        writePixel(x, y, pixels[0], true);
+      }
+    }
+    return;
+  }
+
+  // Pixels that the camera traces as one are handled as a single block.
+  // Blocks start at multiples of the stride, so they line up across tiles.
+  std::vector<PixelBlock> blocks;
+  blocks.reserve(numPixels);
+  for (size_t y = tile.y0; y < tile.y1; ++y) {
+    const size_t stride  = std::max(m_camera->pixelStride(y), 
+                                    static_cast<size_t>(1));
+    const float  density = m_camera->pixelSampleDensity(y);
+    PixelBlock block;
+    block.y          = y;
+    block.numSamples = 
+      std::max(static_cast<size_t>(1), 
+               static_cast<size_t>(samplesPerPixel * density + 0.5f));
+    for (block.x0 = tile.x0; block.x0 < tile.x1; block.x0 = block.x1) {
+      block.x1 = std::min((block.x0 / stride + 1) * stride, tile.x1);
+      blocks.push_back(block);
+    }
+  }
+  const size_t numBlocks = blocks.size();
+
+  // For each packet of blocks, numbered along the rows of the tile ---
+
+  for (size_t p0 = 0; p0 < numBlocks; p0 += pixelsPerPacket) {
+    // Stop early if another thread failed or the user terminated
+    if (job.aborted()) {
+      return;
+    }
+    const size_t p1 = std::min(p0 + pixelsPerPacket, numBlocks);
+    for (size_t p = p0; p < p1; ++p) {
+      const PixelBlock &b = blocks[p];
+      pixels[p - p0].clear();
+      if (isCulled(b.x0, b.y, b.x1, b.y + 1)) {
+        pixels[p - p0].isDone = true;
+        Sys::Stats::add(Sys::Stats::CulledPixels, b.x1 - b.x0);
+      }
+    }
+    const PixelCost cost(m_costAov);
+    for (size_t round = 0; round < maxRounds; ++round) {
+      // Set up the rays for each pixel sample (in x/y)
+      states.clear();
+      for (size_t p = p0; p < p1; ++p) {
+        if (pixels[p - p0].isDone) {
+          continue;
+        }
+        const PixelBlock &b = blocks[p];
+        // Each round continues the pixel's sample sequence
+        for (size_t i = 0; i < b.numSamples; ++i) {
+          states.push_back(setupSample(b.x0, b.y, round * b.numSamples + i,
+                                       b.numSamples, b.x1 - b.x0));
+        }
+      }
+      if (states.empty()) {
+        break;
+      }
+      Sys::Stats::add(Sys::Stats::PixelSamples, states.size());
+      // Render the pixels
+      cameraRaymarcher().integratePacket(states, results);
+      // Update accumulated results, then check which pixels are done
+      IntegrationResultVec::const_iterator result = results.begin();
+      for (size_t p = p0; p < p1; ++p) {
+        PixelSamples &pixel = pixels[p - p0];
+        if (pixel.isDone) {
+          continue;
+        }
+        for (size_t i = 0; i < blocks[p].numSamples; ++i, ++result) {
+          pixel.add(*result);
+        }
+        pixel.isDone = pixel.error() <= m_params.adaptiveThreshold;
+      }
+    }
+    cost.add(blocks[p0].x0, blocks[p0].y);
+    // Update resulting image and transmittance/luminance maps. Every 
+    // pixel of a block gets its result.
+    for (size_t p = p0; p < p1; ++p) {
+      const PixelBlock &b = blocks[p];
+      for (size_t x = b.x0; x < b.x1; ++x) {
+        writePixel(x, b.y, pixels[p - p0], true);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderCheckpointTile(const Tile &tile, 
+                                    const Sys::JobState &job) const
+{
+  Checkpoint &checkpoint = *m_checkpoint;
+  if (checkpoint.isResumed[tile.index]) {
+    return;
+  }
+
+  renderTile(tile, job);
+
+  // An aborted tile may be missing pixels
+  if (job.aborted()) {
+    return;
+  }
+
+  // The tile's pixels are done, so they can be read without locking
+  boost::mutex::scoped_lock lock(checkpoint.mutex);
+  for (size_t y = tile.y0; y < tile.y1; ++y) {
+    for (size_t x = tile.x0; x < tile.x1; ++x) {
+      checkpoint.image->setPixel(x, y, m_primary->pixel(x, y));
+      checkpoint.image->setPixelAlpha(x, y, m_primary->pixelAlpha(x, y));
+    }
+  }
+  const V2i origin = m_primary->dataWindow().min;
+  if (checkpoint.transmittance) {
+    checkpoint.transmittance->copyPixels(*m_deepTransmittance, 
+                                         tile.x0 - origin.x, 
+                                         tile.y0 - origin.y,
+                                         tile.x1 - origin.x, 
+                                         tile.y1 - origin.y);
+  }
+  if (checkpoint.luminance) {
+    checkpoint.luminance->copyPixels(*m_deepLuminance, 
+                                     tile.x0 - origin.x, tile.y0 - origin.y,
+                                     tile.x1 - origin.x, tile.y1 - origin.y);
+  }
+  checkpoint.tiles.push_back(tile.index);
+
+  if (checkpoint.timer.elapsed() >= m_params.checkpointInterval) {
+    saveCheckpoint();
+    checkpoint.timer.reset();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setupCheckpoint()
+{
+  m_checkpoint.reset();
+
+  const std::string &prefix = m_params.checkpointPrefix;
+  if (prefix.empty()) {
+    return;
+  }
+  if (m_params.doProgressive || !m_views.empty()) {
+    Log::warning("Checkpointing only applies to renders that aren't "
+                 "progressive and have no views");
+    return;
+  }
+
+  const V2i    res      = m_primary->size();
+  const Box2i  window   = m_primary->dataWindow();
+  const V2i    size     = window.size() + V2i(1);
+  const size_t numTiles = 
+    TileScheduler(size.x, size.y, m_params.tileSize, 1).numTiles();
+
+  m_checkpoint.reset(new Checkpoint);
+  Checkpoint &checkpoint = *m_checkpoint;
+  checkpoint.key = checkpointKey(res, window, m_params.tileSize, 
+                                 m_params.splitPart, m_params.numSplitParts);
+  checkpoint.isResumed.assign(numTiles, 0);
+  // The image is saved at full precision, so that resuming is lossless
+  checkpoint.image = Image::create();
+  checkpoint.image->setSize(res.x, res.y);
+  checkpoint.image->setDataWindow(window);
+  checkpoint.image->setPixelType(Image::FloatPixels);
+  if (m_params.doTransmittanceMap) {
+    checkpoint.transmittance = DeepImage::create();
+    checkpoint.transmittance->setSize(size.x, size.y);
+  }
+  if (m_params.doLuminanceMap) {
+    checkpoint.luminance = DeepImage::create();
+    checkpoint.luminance->setSize(size.x, size.y);
+  }
+
+  Log::print("  Checkpointing to " + prefix + " every " + 
+             str(m_params.checkpointInterval) + " s");
+
+  if (!m_params.doResume) {
+    return;
+  }
+
+  // Read back the checkpoint. Nothing is used unless all of it matches.
+
+  std::ifstream in((prefix + k_checkpointTilesSuffix).c_str());
+  std::string   key;
+  if (!in || !std::getline(in, key)) {
+    Log::warning("No checkpoint to resume, starting over: " + prefix);
+    return;
+  }
+  if (key != checkpoint.key) {
+    Log::warning("Checkpoint is of a different render, starting over: " + 
+                 prefix);
+    return;
+  }
+  std::vector<size_t> tiles;
+  size_t              index;
+  while (in >> index) {
+    if (index < numTiles) {
+      tiles.push_back(index);
+    }
+  }
+
+  Image::Ptr image = Image::read(prefix + k_checkpointImageSuffix);
+  if (!image || image->size() != res || image->dataWindow() != window) {
+    Log::warning("Checkpoint image is missing or doesn't match, starting "
+                 "over: " + prefix);
+    return;
+  }
+  DeepImage::Ptr transmittance, luminance;
+  if (checkpoint.transmittance) {
+    transmittance = 
+      DeepImage::read(prefix + k_checkpointTransmittanceSuffix);
+    if (!transmittance || transmittance->size() != size) {
+      Log::warning("Checkpoint transmittance map is missing or doesn't "
+                   "match, starting over: " + prefix);
+      return;
+    }
+  }
+  if (checkpoint.luminance) {
+    luminance = DeepImage::read(prefix + k_checkpointLuminanceSuffix);
+    if (!luminance || luminance->size() != size) {
+      Log::warning("Checkpoint luminance map is missing or doesn't match, "
+                   "starting over: " + prefix);
+      return;
+    }
+  }
+
+  // The outputs are empty, so merging copies the checkpointed pixels
+  m_primary->merge(*image);
+  checkpoint.image->merge(*image);
+  if (transmittance) {
+    m_deepTransmittance->merge(*transmittance);
+    checkpoint.transmittance->merge(*transmittance);
+  }
+  if (luminance) {
+    m_deepLuminance->merge(*luminance);
+    checkpoint.luminance->merge(*luminance);
+  }
+  BOOST_FOREACH (const size_t tile, tiles) {
+    if (!checkpoint.isResumed[tile]) {
+      checkpoint.isResumed[tile] = 1;
+      checkpoint.tiles.push_back(tile);
+    }
+  }
+
+  Log::print("  Resuming " + str(checkpoint.tiles.size()) + " of " + 
+             str(numTiles) + " tiles");
+  if (m_params.doLightAovs || m_params.doEmissionAov || m_params.doCostAov) {
+    Log::warning("AOVs aren't checkpointed, and are left empty in resumed "
+                 "tiles");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::saveCheckpoint() const
+{
+  const Checkpoint  &checkpoint = *m_checkpoint;
+  const std::string &prefix     = m_params.checkpointPrefix;
+
+  Timer timer;
+
+  // Every file is written before any is replaced, and the tile list is 
+  // replaced last. A render killed in between may leave images with more
+  // tiles than the list, and those tiles are simply rendered again.
+  checkpoint.image->write(partialFilename(prefix, k_checkpointImageSuffix),
+                          Image::RGBA);
+  bool isWritten = true;
+  if (checkpoint.transmittance) {
+    isWritten = isWritten && checkpoint.transmittance->write
+      (partialFilename(prefix, k_checkpointTransmittanceSuffix));
+  }
+  if (checkpoint.luminance) {
+    isWritten = isWritten && checkpoint.luminance->write
+      (partialFilename(prefix, k_checkpointLuminanceSuffix));
+  }
+  {
+    std::ofstream out(partialFilename(prefix, 
+                                      k_checkpointTilesSuffix).c_str());
+    out << checkpoint.key << "\n";
+    BOOST_FOREACH (const size_t tile, checkpoint.tiles) {
+      out << tile << "\n";
+    }
+    isWritten = isWritten && out.good();
+  }
+
+  isWritten = isWritten && replaceFile(prefix, k_checkpointImageSuffix);
+  if (isWritten && checkpoint.transmittance) {
+    isWritten = replaceFile(prefix, k_checkpointTransmittanceSuffix);
+  }
+  if (isWritten && checkpoint.luminance) {
+    isWritten = replaceFile(prefix, k_checkpointLuminanceSuffix);
+  }
+  isWritten = isWritten && replaceFile(prefix, k_checkpointTilesSuffix);
+
+  if (!isWritten) {
+    Log::warning("Couldn't write checkpoint: " + prefix);
+    return;
+  }
+  Log::print("  Checkpointed " + str(checkpoint.tiles.size()) + " of " + 
+             str(checkpoint.isResumed.size()) + " tiles in " + 
+             str(timer.elapsed()) + " s");
+}
+
+//----------------------------------------------------------------------------//
+
+const Raymarcher& Renderer::cameraRaymarcher() const
+{
+  if (m_shadowRaymarcher && !m_params.doPrimary) {
+    return *m_shadowRaymarcher;
+  }
+  return *m_raymarcher;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderPreviewTile(const Tile &tile, const Sys::JobState &job,
+                                 const size_t stride) const
+{
+  RayStateVec          states;
+  IntegrationResultVec results;
+
+  // Each ray covers a block of stride x stride pixels, clipped to the tile
+  for (size_t y0 = tile.y0; y0 < tile.y1; y0 += stride) {
+    // Stop early if another thread failed or the user terminated
+    if (job.aborted()) {
+      return;
+    }
+    const size_t y1 = std::min(y0 + stride, tile.y1);
+    // Set up one ray through the center of each block, at mid-shutter. 
+    // Previews don't contribute to the deep images.
+    states.clear();
+    std::vector<bool> culled;
+    for (size_t x0 = tile.x0; x0 < tile.x1; x0 += stride) {
+      const size_t x1 = std::min(x0 + stride, tile.x1);
+      // Blocks that can't see the volume aren't traced at all
+      culled.push_back(isCulled(x0, y0, x1, y1));
+      if (culled.back()) {
+        continue;
+      }
+      RayState state = setupRayState((x0 + x1) * 0.5f, (y0 + y1) * 0.5f, 
+                                     PTime(0.5));
+      state.doOutputDeepT  = false;
+      state.doOutputDeepL  = false;
+      state.doOutputLights = false;
+      states.push_back(state);
+    }
+    // Render the blocks
+    cameraRaymarcher().integratePacket(states, results);
+    for (size_t x0 = tile.x0, i = 0, j = 0; x0 < tile.x1; x0 += stride, ++i) {
+      const IntegrationResult result = 
+        culled[i] ? IntegrationResult() : results[j++];
+      const size_t x1        = std::min(x0 + stride, tile.x1);
+      const Color  alpha     = Colors::one() - result.transmittance;
+      const float  alphaMean = (alpha.x + alpha.y + alpha.z) / 3.0f;
+      for (size_t y = y0; y < y1; ++y) {
+        for (size_t x = x0; x < x1; ++x) {
+          m_primary->setPixel(x, y, result.luminance);
+          m_primary->setPixelAlpha(x, y, alphaMean);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderRefineTile(const Tile &tile, const Sys::JobState &job,
+                                const size_t sample, 
+                                PixelSamplesVec &pixels) const
+{
+  const size_t numSamples = std::max(numPixelSamples(), 
+                                     static_cast<size_t>(1));
+  const size_t numRefines = numSamples * numSamples;
+  const Box2i  window     = m_primary->dataWindow();
+  const size_t width      = window.size().x + 1;
+  // The cost AOV needs each pixel's work on its own
+  const size_t packetSize = m_costAov ? 1 :
+    std::max(cameraRaymarcher().packetSize(), static_cast<size_t>(1));
+  // The deep images are only complete once the last sample is in
+  const bool   doDeep     = sample + 1 == numRefines;
+
+  RayStateVec          states;
+  IntegrationResultVec results;
+
+  for (size_t y = tile.y0; y < tile.y1; ++y) {
+    // Stop early if another thread failed or the user terminated
+    if (job.aborted()) {
+      return;
+    }
+    for (size_t x0 = tile.x0; x0 < tile.x1; x0 += packetSize) {
+      const size_t x1 = std::min(x0 + packetSize, tile.x1);
+      // Set up the ray for this pass' sample of each visible pixel
+      states.clear();
+      for (size_t x = x0; x < x1; ++x) {
+        if (!isCulled(x, y, x + 1, y + 1)) {
+          states.push_back(setupSample(x, y, sample, numRefines, 1));
+        }
+      }
+      // Render the pixels and add the new samples to them. Culled pixels
+      // get an empty sample so they are still written.
+      const PixelCost cost(m_costAov);
+      cameraRaymarcher().integratePacket(states, results);
+      cost.add(x0, y);
+      for (size_t x = x0, i = 0; x < x1; ++x) {
+        PixelSamples &pixel = 
+          pixels[(y - window.min.y) * width + x - window.min.x];
+        if (isCulled(x, y, x + 1, y + 1)) {
+          pixel.add(IntegrationResult());
+          if (sample == 0) {
+            Sys::Stats::add(Sys::Stats::CulledPixels);
+          }
+        } else {
+          pixel.add(results[i++]);
+        }
+        writePixel(x, y, pixel, doDeep);
+        // The deep functions are no longer needed once they're written
+        if (doDeep) {
+          pixel.tf.clear();
+          pixel.lf.clear();
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::writePixel(const size_t x, const size_t y, 
+                          const PixelSamples &pixel, const bool doDeep) const
+{
+  // Each pixel is owned by exactly one tile, so no locking is needed.
+
+  // Normalize luminance and transmittance
+  const float scale     = 1.0f / std::max(pixel.count, static_cast<size_t>(1));
+  const Color luminance = pixel.luminance * scale;
+  const Color alpha     = pixel.alpha * scale;
+  m_primary->setPixel(x, y, luminance);
+  m_primary->setPixelAlpha(x, y, (alpha.x + alpha.y + alpha.z) / 3.0f);
+
+  // Light AOVs are stored per unit of intensity
+  for (size_t l = 0, size = m_lightAovs.size(); l < size; ++l) {
+    const Color L = l < pixel.lightLuminance.size() ? 
+      pixel.lightLuminance[l] * scale : Colors::zero();
+    m_lightAovs[l]->setPixel(x, y, perUnitIntensity(L, m_aovIntensities[l]));
+  }
+
+  if (!doDeep) {
+    return;
+  }
+
+  // The deep images start at the corner of the data window
+  const V2i    origin = m_primary->dataWindow().min;
+  const size_t xDeep  = x - origin.x;
+  const size_t yDeep  = y - origin.y;
+  if (pixel.tf.size() > 0) {
+    m_deepTransmittance->setPixel(xDeep, yDeep, pixel.tf);
+  }
+  if (pixel.lf.size() > 0) {
+    m_deepLuminance->setPixel(xDeep, yDeep, pixel.lf);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setupLightAovs(const Box2i &window)
+{
+  m_lightAovs.clear();
+  m_aovIntensities.clear();
+  if (!(m_params.doLightAovs || m_params.doEmissionAov) || 
+      !m_params.doPrimary) {
+    return;
+  }
+  const V2i res = m_primary->size();
+  BOOST_FOREACH (Light::CPtr light, m_scene->lights) {
+    Image::Ptr aov = Image::create();
+    aov->setSize(res.x, res.y);
+    aov->setDataWindow(window);
+    m_lightAovs.push_back(aov);
+    m_aovIntensities.push_back(light->intensity());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Image::Ptr Renderer::lightImage(const size_t light) const
+{
+  Image::Ptr   image     = m_lightAovs[light]->clone();
+  float       *pixels    = image->pixels();
+  const V2i    size      = image->dataWindow().size() + V2i(1);
+  const size_t numPixels = size.x * size.y;
+  const Color &intensity = m_aovIntensities[light];
+
+  for (size_t i = 0; i < numPixels * 4; i += 4) {
+    pixels[i]     *= intensity.x;
+    pixels[i + 1] *= intensity.y;
+    pixels[i + 2] *= intensity.z;
+  }
+
+  return image;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::findVisibleRects()
+{
+  const Box2i window = m_primary->dataWindow();
+
+  m_visibleRects.clear();
+
+  std::vector<BBox> bounds;
+  findLeafBounds(m_scene->volume, bounds);
+
+  BOOST_FOREACH (const BBox &wsBounds, bounds) {
+    Imath::Box2d rsBounds;
+    if (!projectBounds(*m_camera, wsBounds, rsBounds)) {
+      m_visibleRects.assign(1, window);
+      return;
+    }
+    // Clip in floating point, since the projection may be huge
+    const Box2i rect(V2i(static_cast<int>(std::max(std::floor(rsBounds.min.x),
+                                                   window.min.x - 1.0)),
+                         static_cast<int>(std::max(std::floor(rsBounds.min.y),
+                                                   window.min.y - 1.0))) - 
+                     V2i(k_cullPadding),
+                     V2i(static_cast<int>(std::min(std::ceil(rsBounds.max.x),
+                                                   window.max.x + 1.0)),
+                         static_cast<int>(std::min(std::ceil(rsBounds.max.y),
+                                                   window.max.y + 1.0))) + 
+                     V2i(k_cullPadding));
+    if (rect.intersects(window)) {
+      m_visibleRects.push_back(rect);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool Renderer::isCulled(const size_t x0, const size_t y0, 
+                        const size_t x1, const size_t y1) const
+{
+  const Box2i pixels(V2i(x0, y0), V2i(x1 - 1, y1 - 1));
+  BOOST_FOREACH (const Box2i &rect, m_visibleRects) {
+    if (rect.intersects(pixels)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+RayState Renderer::setupRayState(const float x, const float y,
+                                const PTime time) const
+{
+  // Create default RayState. Rely on its constructor to set reasonable
+  // defaults
+  RayState state;
+  // Update the values that are non-default
+  state.context = &m_context;
+  state.wsRay = setupRay(m_camera, x, y, time);
+  state.time = time;
+  state.wsFootprint = 
+    pixelFootprintWidth(m_camera, state.wsRay, x, y, time);
+  state.footprintSpread = 
+    pixelFootprintSpread(m_camera, state.wsRay, x, y, time);
+  if (!m_params.doPrimary) {
+    state.rayType = RayState::TransmittanceOnly;
+    state.rayDepth = 1;
+  }
+  state.doOutputDeepT  = m_params.doTransmittanceMap;
+  state.doOutputDeepL  = m_params.doLuminanceMap;
+  state.doOutputLights = !m_lightAovs.empty();
+  if (m_holdoutDepth) {
+    state.tMax = holdoutDistance(x, y, state.wsRay, time);
+  }
+  return state;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::denoise()
+{
+  m_noisyPrimary.reset();
+  if (!m_denoiser || !m_params.doPrimary) {
+    return;
+  }
+  if (!m_lightAovs.empty()) {
+    m_noisyPrimary = m_primary->clone();
+  }
+  m_denoiser->apply(*m_primary, denoiseGuides(), m_params.numThreads);
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<Image::CPtr> Renderer::denoiseGuides() const
+{
+  std::vector<Image::CPtr> guides;
+
+  const V2i   res    = m_primary->size();
+  const Box2i window = m_primary->dataWindow();
+
+  if (m_params.doTransmittanceMap) {
+    Image::Ptr depth = Image::create();
+    depth->setSize(res.x, res.y);
+    depth->setDataWindow(window);
+    Util::ProgressReporter progress(std::numeric_limits<float>::max());
+    Sys::parallelFor(window.max.y - window.min.y + 1, 1, 
+                     boost::bind(&firstHitRows, 
+                                 boost::cref(*m_deepTransmittance),
+                                 boost::ref(*depth), _1, _2),
+                     Sys::numWorkerThreads(m_params.numThreads), progress);
+    guides.push_back(depth);
+  }
+
+  if (m_holdoutDepth) {
+    // Looked up the way holdoutDistance() is for the pixel centers at mid
+    // shutter. Pixels that don't hold out are left at zero.
+    const PTime time(0.5);
+    Image::Ptr  depth = Image::create();
+    depth->setSize(res.x, res.y);
+    depth->setDataWindow(window);
+    for (int y = window.min.y; y <= window.max.y; ++y) {
+      for (int x = window.min.x; x <= window.max.x; ++x) {
+        const float  rsX      = x + 0.5f;
+        const float  rsY      = y + 0.5f;
+        const double distance = 
+          holdoutDistance(rsX, rsY, setupRay(m_camera, rsX, rsY, time), time);
+        if (distance < std::numeric_limits<double>::max()) {
+          depth->setPixel(x, y, Color(distance));
+        }
+      }
+    }
+    guides.push_back(depth);
+  }
+
+  return guides;
+}
+
+//----------------------------------------------------------------------------//
+
+double Renderer::holdoutDistance(const float x, const float y, 
+                                 const Ray &wsRay, const PTime time) const
+{
+  const double noHoldout = std::numeric_limits<double>::max();
+  // Find the nearest pixel of the depth map
+  const V2i res      = m_camera->resolution();
+  const V2i depthRes = m_holdoutDepth->size();
+  const int i = Imath::clamp(static_cast<int>(std::floor(x * depthRes.x / 
+                                                         res.x)), 
+                             0, depthRes.x - 1);
+  const int j = Imath::clamp(static_cast<int>(std::floor(y * depthRes.y / 
+                                                         res.y)), 
+                             0, depthRes.y - 1);
+  const double depth = m_holdoutDepth->pixel(i, j).x;
+  // Rejects NaN as well as empty pixels
+  if (!(depth > 0.0 && depth < noHoldout)) {
+    return noHoldout;
+  }
+  if (m_holdoutDepthType == RayDistanceDepth) {
+    return depth;
+  }
+  // Camera-space z is linear in the ray parameter
+  const Vector csStart = m_camera->worldToCamera(wsRay.pos, time);
+  const Vector csEnd   = m_camera->worldToCamera(wsRay(1.0), time);
+  const double dz      = csEnd.z - csStart.z;
+  if (dz == 0.0) {
+    return noHoldout;
+  }
+  // The depth is a distance, whichever way the camera looks down its z axis
+  const double csZ = dz < 0.0 ? -depth : depth;
+  return std::max((csZ - csStart.z) / dz, 0.0);
+}
+
+//----------------------------------------------------------------------------//
+
+Box2i Renderer::renderWindow() const
+{
+  const V2i   res = m_primary->size();
+  const Box2i full(V2i(0), res - V2i(1));
+  if (!m_params.doCrop) {
+    return full;
+  }
+  // Clip the crop window to the image. This is empty if they don't overlap.
+  const Box2i &crop = m_params.cropWindow;
+  return Box2i(V2i(std::max(crop.min.x, full.min.x), 
+                   std::max(crop.min.y, full.min.y)),
+               V2i(std::min(crop.max.x, full.max.x), 
+                   std::min(crop.max.y, full.max.y)));
+}
+
+//----------------------------------------------------------------------------//
+
+RayState Renderer::setupSample(const size_t x, const size_t y, 
+                               const size_t index, 
+                               const size_t numSamples,
+                               const size_t width) const
+{
+  // Sample values only depend on the pixel and the index, so results don't
+  // depend on the number of threads or the order of the tiles
+  const PixelSampler &sampler = *m_pixelSampler;
+
+  float xSample = x + 0.5f * width;
+  float ySample = Field3D::discToCont(static_cast<int>(y));
+  if (m_params.doRandomizePixelSamples) {
+    xSample += (sampler.sample(x, y, index, numSamples, 
+                               PixelSampler::PixelX) - 0.5f) * width;
+    ySample += sampler.sample(x, y, index, numSamples, 
+                              PixelSampler::PixelY) - 0.5f;
+  }
+  const PTime pTime(sampler.sample(x, y, index, numSamples, 
+                                   PixelSampler::Time));
+
+  RayState state   = setupRayState(xSample, ySample, pTime);
+  state.stepOffset = sampler.sample(x, y, index, numSamples, 
+                                    PixelSampler::StepOffset);
+  return state;
+}
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+Ray setupRay(const Camera::CPtr &camera, const float x, const float y, 
+             const PTime time) 
+{
+  // The ray starts at the camera position at the current time, and passes 
+  // through the pixel position transformed from raster space to world space
+  return camera->rasterRay(x, y, time);
+}
+
+//----------------------------------------------------------------------------//
+
+double pixelFootprintSpread(const Camera::CPtr &camera, const Ray &wsRay,
+                            const float x, const float y, const PTime time)
+{
+  const Vector dirX = setupRay(camera, x + 1.0f, y, time).dir;
+  const Vector dirY = setupRay(camera, x, y + 1.0f, time).dir;
+  return std::max((dirX - wsRay.dir).length(), (dirY - wsRay.dir).length());
+}
+
+//----------------------------------------------------------------------------//
+
+double pixelFootprintWidth(const Camera::CPtr &camera, const Ray &wsRay,
+                           const float x, const float y, const PTime time)
+{
+  const Vector posX = setupRay(camera, x + 1.0f, y, time).pos;
+  const Vector posY = setupRay(camera, x, y + 1.0f, time).pos;
+  return std::max((posX - wsRay.pos).length(), (posY - wsRay.pos).length());
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,163 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseCache.cpp
+  Contains implementations of SparseCache class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/SparseCache.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+#include <Field3D/SparseFile.h>
+
+// Project includes
+
+#include "pvr/Log.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// SparseCache static member instantiation
+//----------------------------------------------------------------------------//
+
+float SparseCache::ms_memoryLimit = 0.0f;
+
+//----------------------------------------------------------------------------//
+// SparseCache implementations
+//----------------------------------------------------------------------------//
+
+void SparseCache::setMemoryLimit(const float megabytes)
+{
+  Field3D::SparseFileManager &mgr = Field3D::SparseFileManager::singleton();
+  ms_memoryLimit = std::max(megabytes, 0.0f);
+  if (ms_memoryLimit > 0.0f) {
+    mgr.setMaxMemUse(ms_memoryLimit);
+    mgr.setLimitMemUse(true);
+    Log::print("Sparse block cache enabled. Limit: " + 
+               str(ms_memoryLimit) + " MB");
+  } else {
+    mgr.setLimitMemUse(false);
+    Log::print("Sparse block cache disabled");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+float SparseCache::memoryLimit()
+{
+  return ms_memoryLimit;
+}
+
+//----------------------------------------------------------------------------//
+
+bool SparseCache::isEnabled()
+{
+  return Field3D::SparseFileManager::singleton().doLimitMemUse();
+}
+
+//----------------------------------------------------------------------------//
+
+long SparseCache::numMisses()
+{
+  return Field3D::SparseFileManager::singleton().totalLoads();
+}
+
+//----------------------------------------------------------------------------//
+
+long SparseCache::numResidentBlocks()
+{
+  return Field3D::SparseFileManager::singleton().numLoadedBlocks();
+}
+
+//----------------------------------------------------------------------------//
+
+long SparseCache::numDistinctBlocks()
+{
+  return Field3D::SparseFileManager::singleton().totalLoadedBlocks();
+}
+
+//----------------------------------------------------------------------------//
+
+float SparseCache::fractionResident()
+{
+  return Field3D::SparseFileManager::singleton().cacheFractionLoaded();
+}
+
+//----------------------------------------------------------------------------//
+
+float SparseCache::loadsPerBlock()
+{
+  return Field3D::SparseFileManager::singleton().cacheLoadsPerBlock();
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseCache::resetStatistics()
+{
+  Field3D::SparseFileManager::singleton().resetCacheStatistics();
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<std::string> SparseCache::info()
+{
+  std::vector<std::string> info;
+  if (!isEnabled()) {
+    info.push_back("Sparse block cache disabled");
+    return info;
+  }
+  info.push_back("Memory limit: " + str(ms_memoryLimit) + " MB");
+  info.push_back("Misses (block loads): " + str(numMisses()));
+  info.push_back("Resident blocks: " + str(numResidentBlocks()));
+  info.push_back("Distinct blocks loaded: " + str(numDistinctBlocks()));
+  info.push_back("Fraction resident: " + str(fractionResident()));
+  info.push_back("Loads per block: " + str(loadsPerBlock()));
+  return info;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,311 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file SplatWriter.cpp
+  Contains implementations of SplatWriter class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/SplatWriter.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+
+#include <OpenEXR/ImathBoxAlgo.h>
+
+// Project includes
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of queued splats that triggers a flush
+  const size_t k_maxQueueSize = 65536;
+  //! Log2 of the block size used to sort splats into dense buffers
+  const int    k_denseBlockOrder = 3;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns whether the voxels [min, max] are all inside window
+  bool isInside(const Imath::V3i &min, const Imath::V3i &max, 
+                const DiscreteBBox &window)
+  {
+    return min.x >= window.min.x && max.x <= window.max.x && 
+           min.y >= window.min.y && max.y <= window.max.y && 
+           min.z >= window.min.z && max.z <= window.max.z;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the voxel containing vsP
+  Imath::V3i containingVoxel(const Vector &vsP)
+  {
+    return Imath::V3i(Field3D::contToDisc(vsP.x), 
+                      Field3D::contToDisc(vsP.y),
+                      Field3D::contToDisc(vsP.z));
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace Imath;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+
+//----------------------------------------------------------------------------//
+// SplatWriter
+//----------------------------------------------------------------------------//
+
+SplatWriter::SplatWriter()
+  : m_dense(NULL), m_sparse(NULL), m_blockOrder(k_denseBlockOrder), 
+    m_blockRes(0)
+{ 
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+SplatWriter::SplatWriter(VoxelBuffer::Ptr buffer)
+  : m_dense(NULL), m_sparse(NULL), m_blockOrder(k_denseBlockOrder), 
+    m_blockRes(0)
+{ 
+  setBuffer(buffer);
+}
+
+//----------------------------------------------------------------------------//
+
+SplatWriter::~SplatWriter()
+{ 
+  flush();
+}
+
+//----------------------------------------------------------------------------//
+
+void SplatWriter::setBuffer(VoxelBuffer::Ptr buffer)
+{
+  if (buffer == m_buffer) {
+    return;
+  }
+
+  flush();
+
+  m_buffer     = buffer;
+  m_dense      = dynamic_cast<DenseBuffer *>(buffer.get());
+  m_sparse     = dynamic_cast<SparseBuffer *>(buffer.get());
+  m_dataWindow = buffer ? buffer->dataWindow() : DiscreteBBox();
+  m_blockOrder = m_sparse ? m_sparse->blockOrder() : k_denseBlockOrder;
+
+  const int blockSize = 1 << m_blockOrder;
+  m_blockRes = m_dataWindow.isEmpty() ? V3i(0) : 
+    (m_dataWindow.size() + V3i(blockSize)) / blockSize;
+}
+
+//----------------------------------------------------------------------------//
+
+void SplatWriter::writePoint(const Vector &vsP, const V3f &value, 
+                             const DiscreteBBox &dvsWindow)
+{
+  const V3i v = containingVoxel(vsP);
+
+  if (!isInside(v, v, dvsWindow)) {
+    return;
+  }
+
+  if (isInside(v, v, m_dataWindow)) {
+    if (m_dense) {
+      m_dense->fastLValue(v.x, v.y, v.z) += value;
+      return;
+    } 
+    if (m_sparse) {
+      m_sparse->fastLValue(v.x, v.y, v.z) += value;
+      return;
+    }
+  }
+
+  m_buffer->lvalue(v.x, v.y, v.z) += value;
+}
+
+//----------------------------------------------------------------------------//
+
+void SplatWriter::writeAntialiasedPoint(const Vector &vsP, const V3f &value, 
+                                        const DiscreteBBox &dvsWindow)
+{
+  // Offset the voxel-space position relative to voxel centers
+  const Vector p(vsP.x - 0.5, vsP.y - 0.5, vsP.z - 0.5);
+  // Lower-left corner of the cube of 8 voxels that we need to access
+  const V3i corner(static_cast<int>(std::floor(p.x)), 
+                   static_cast<int>(std::floor(p.y)), 
+                   static_cast<int>(std::floor(p.z)));
+  const V3i last = corner + V3i(1);
+  // Weight of the lower voxel along each axis
+  const Vector fraction(static_cast<Vector>(last) - p);
+
+  if (!(m_dense || m_sparse) || !isInside(corner, last, dvsWindow) || 
+      !isInside(corner, last, m_dataWindow)) {
+    writeAntialiasedSlow(corner, fraction, value, dvsWindow);
+    return;
+  }
+
+  const double wx[2] = { fraction.x, 1.0 - fraction.x };
+  const double wy[2] = { fraction.y, 1.0 - fraction.y };
+  const double wz[2] = { fraction.z, 1.0 - fraction.z };
+
+  if (m_dense) {
+    // DenseBuffer stores x fastest, then y, then z
+    const V3i    res     = m_dataWindow.size() + V3i(1);
+    const size_t yStride = res.x;
+    const size_t zStride = yStride * res.y;
+    V3f         *origin  = &m_dense->fastLValue(corner.x, corner.y, corner.z);
+    for (int k = 0; k < 2; ++k) {
+      for (int j = 0; j < 2; ++j) {
+        V3f *row = origin + k * zStride + j * yStride;
+        row[0] += value * (wx[0] * wy[j] * wz[k]);
+        row[1] += value * (wx[1] * wy[j] * wz[k]);
+      }
+    }
+  } else {
+    for (int k = 0; k < 2; ++k) {
+      for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+          m_sparse->fastLValue(corner.x + i, corner.y + j, corner.z + k) += 
+            value * (wx[i] * wy[j] * wz[k]);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SplatWriter::queuePoint(const Vector &vsP, const V3f &value,
+                             const bool antialiased, 
+                             const DiscreteBBox &dvsWindow)
+{
+  if (!m_queue.empty() && 
+      (dvsWindow.min != m_queueWindow.min || 
+       dvsWindow.max != m_queueWindow.max)) {
+    flush();
+  }
+
+  Splat splat;
+  splat.block       = blockIndex(vsP);
+  splat.vsP         = vsP;
+  splat.value       = value;
+  splat.antialiased = antialiased;
+
+  m_queueWindow = dvsWindow;
+  m_queue.push_back(splat);
+
+  if (m_queue.size() >= k_maxQueueSize) {
+    flush();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SplatWriter::flush()
+{
+  if (m_queue.empty()) {
+    return;
+  }
+  std::stable_sort(m_queue.begin(), m_queue.end());
+  BOOST_FOREACH (const Splat &splat, m_queue) {
+    if (splat.antialiased) {
+      writeAntialiasedPoint(splat.vsP, splat.value, m_queueWindow);
+    } else {
+      writePoint(splat.vsP, splat.value, m_queueWindow);
+    }
+  }
+  m_queue.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+void SplatWriter::writeAntialiasedSlow(const V3i &corner, 
+                                       const Vector &fraction,
+                                       const V3f &value,
+                                       const DiscreteBBox &dvsWindow)
+{
+  const double wx[2] = { fraction.x, 1.0 - fraction.x };
+  const double wy[2] = { fraction.y, 1.0 - fraction.y };
+  const double wz[2] = { fraction.z, 1.0 - fraction.z };
+
+  for (int k = 0; k < 2; ++k) {
+    for (int j = 0; j < 2; ++j) {
+      for (int i = 0; i < 2; ++i) {
+        const V3i v = corner + V3i(i, j, k);
+        if (isInside(v, v, dvsWindow)) {
+          m_buffer->lvalue(v.x, v.y, v.z) += value * (wx[i] * wy[j] * wz[k]);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t SplatWriter::blockIndex(const Vector &vsP) const
+{
+  if (m_dataWindow.isEmpty()) {
+    return 0;
+  }
+  const V3i v = clip(containingVoxel(vsP), m_dataWindow) - m_dataWindow.min;
+  const V3i block(v.x >> m_blockOrder, v.y >> m_blockOrder, 
+                  v.z >> m_blockOrder);
+  return block.x + static_cast<size_t>(m_blockRes.x) * 
+    (block.y + static_cast<size_t>(m_blockRes.y) * block.z);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
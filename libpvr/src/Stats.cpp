@@ -0,0 +1,205 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Stats.cpp
+  Contains implementations of Stats class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Stats.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+// Project includes
+
+#include "pvr/Log.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Sys;
+
+  //--------------------------------------------------------------------------//
+
+  typedef boost::shared_array<long> CountBlock;
+
+  //--------------------------------------------------------------------------//
+
+  //! Thread-specific pointers don't own their blocks, the registry does. 
+  //! That way the counts of finished worker threads can still be aggregated.
+  void noCleanup(long *)
+  { }
+
+  //--------------------------------------------------------------------------//
+
+  //! All blocks that have been handed out, and the mutex protecting them
+  std::vector<CountBlock> g_blocks;
+  boost::mutex            g_blocksMutex;
+
+  //--------------------------------------------------------------------------//
+
+  boost::thread_specific_ptr<long> g_threadBlock(&noCleanup);
+
+  //--------------------------------------------------------------------------//
+
+  const char *k_names[Stats::NumCounters] = {
+    "full_raymarch_rays",
+    "transmittance_only_rays",
+    "raymarch_intervals",
+    "raymarch_steps",
+    "early_terminations",
+    "voxel_volume_samples",
+    "constant_volume_samples",
+    "composite_volume_samples",
+    "fractal_cloud_samples",
+    "openvdb_volume_samples",
+    "occluder_lookups",
+    "culled_occluder_lookups",
+    "occluder_cache_hits",
+    "occluder_cache_misses",
+    "in_scatter_cache_hits",
+    "in_scatter_cache_misses",
+    "eso_blocks_skipped",
+    "pixel_samples",
+    "culled_pixels"
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Stats static member instantiation
+//----------------------------------------------------------------------------//
+
+bool Stats::ms_enabled = false;
+
+//----------------------------------------------------------------------------//
+// Stats implementations
+//----------------------------------------------------------------------------//
+
+void Stats::setEnabled(const bool enabled)
+{
+  ms_enabled = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Stats::reset()
+{
+  boost::mutex::scoped_lock lock(g_blocksMutex);
+  BOOST_FOREACH (const CountBlock &block, g_blocks) {
+    std::fill(block.get(), block.get() + NumCounters, 0);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Stats::Counts Stats::aggregate()
+{
+  Counts counts(NumCounters, 0);
+  boost::mutex::scoped_lock lock(g_blocksMutex);
+  BOOST_FOREACH (const CountBlock &block, g_blocks) {
+    for (int i = 0; i < NumCounters; ++i) {
+      counts[i] += block[i];
+    }
+  }
+  return counts;
+}
+
+//----------------------------------------------------------------------------//
+
+std::string Stats::name(const Counter counter)
+{
+  if (counter < 0 || counter >= NumCounters) {
+    return std::string();
+  }
+  return k_names[counter];
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<std::string> Stats::info(const Counts &counts)
+{
+  std::vector<std::string> info;
+  for (size_t i = 0, size = std::min(counts.size(), size_t(NumCounters)); 
+       i < size; ++i) {
+    info.push_back(name(static_cast<Counter>(i)) + " : " + str(counts[i]));
+  }
+  return info;
+}
+
+//----------------------------------------------------------------------------//
+
+long* Stats::threadCounts()
+{
+  long *counts = g_threadBlock.get();
+  if (!counts) {
+    CountBlock block(new long[NumCounters]);
+    std::fill(block.get(), block.get() + NumCounters, 0);
+    {
+      boost::mutex::scoped_lock lock(g_blocksMutex);
+      g_blocks.push_back(block);
+    }
+    counts = block.get();
+    g_threadBlock.reset(counts);
+  }
+  return counts;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,590 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Threading.cpp
+  Contains implementations of threading utilities.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Threading.h"
+
+// System includes
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+// Project headers
+
+#include "pvr/Interrupt.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Sys;
+
+  //--------------------------------------------------------------------------//
+
+  //! How often the calling thread polls for interrupts, in milliseconds
+  const size_t k_pollInterval = 50;
+
+  //! Environment variable that sets the default thread count
+  const char *k_numThreadsEnvVar = "PVR_NUM_THREADS";
+
+  //--------------------------------------------------------------------------//
+
+  //! Thread count set by setNumThreads(). Zero means the default.
+  boost::atomic<size_t> g_numThreads(0);
+
+  //! The global thread pool. Never destroyed, since its threads may still
+  //! be waiting for work when the process exits.
+  ThreadPool           *g_threadPool = NULL;
+  boost::once_flag      g_threadPoolOnce = BOOST_ONCE_INIT;
+
+  //! Set on pool threads only
+  boost::thread_specific_ptr<bool> g_isPoolThread;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the thread count from the environment, or one per core.
+  size_t defaultNumThreads()
+  {
+    if (const char *value = std::getenv(k_numThreadsEnvVar)) {
+      const int numThreads = std::atoi(value);
+      if (numThreads > 0) {
+        return static_cast<size_t>(numThreads);
+      }
+    }
+    return std::max(boost::thread::hardware_concurrency(), 1u);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs a single worker and routes any exception to the job state
+  void runWorker(const boost::function<void (size_t)> &worker, 
+                 const size_t index, JobState &job)
+  {
+    try {
+      // Workers that haven't started when the job is aborted are skipped
+      if (!job.aborted()) {
+        worker(index);
+      }
+    }
+    catch (const std::exception &e) {
+      job.abort(e.what());
+    }
+    catch (...) {
+      job.abort("Unknown exception");
+    }
+    job.workerFinished();
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Worker used by parallelFor(). Claims chunks until none are left.
+  void runChunks(const size_t numItems, const size_t chunkSize,
+                 const boost::function<void (size_t, size_t)> &func,
+                 boost::atomic<size_t> &nextChunk, JobState &job,
+                 const size_t /* thread */)
+  {
+    while (!job.aborted()) {
+      const size_t chunk = nextChunk.fetch_add(1, boost::memory_order_relaxed);
+      const size_t begin = chunk * chunkSize;
+      if (begin >= numItems) {
+        return;
+      }
+      const size_t end = std::min(begin + chunkSize, numItems);
+      func(begin, end);
+      job.markDone(end - begin);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// JobState
+//----------------------------------------------------------------------------//
+
+JobState::JobState(const size_t numUnits)
+  : m_numUnits(numUnits), m_numDone(0), m_numWorkers(0), m_numFinished(0),
+    m_aborted(false)
+{ 
+  
+}
+
+//----------------------------------------------------------------------------//
+
+void JobState::markDone(const size_t numUnits)
+{
+  const size_t numDone = 
+    m_numDone.fetch_add(numUnits, boost::memory_order_relaxed) + numUnits;
+  // Only the update that completes the job needs the lock. Holding it while
+  // signaling means a waiter either sees the new count or gets the signal.
+  if (numDone >= m_numUnits && numDone - numUnits < m_numUnits) {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_completed.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void JobState::abort(const std::string &error)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (!error.empty() && m_error.empty()) {
+    m_error = error;
+  }
+  m_aborted.store(true, boost::memory_order_relaxed);
+  m_completed.notify_all();
+}
+
+//----------------------------------------------------------------------------//
+
+void JobState::setNumWorkers(const size_t numWorkers)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_numWorkers = numWorkers;
+  m_numFinished = 0;
+}
+
+//----------------------------------------------------------------------------//
+
+void JobState::workerFinished()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_numFinished++;
+  if (isComplete()) {
+    m_completed.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool JobState::wait(const size_t milliseconds)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (!isComplete()) {
+    m_completed.timed_wait(lock, 
+                           boost::posix_time::milliseconds(milliseconds));
+  }
+  return isComplete();
+}
+
+//----------------------------------------------------------------------------//
+
+bool JobState::waitForWorkers(const size_t milliseconds)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (m_numFinished < m_numWorkers) {
+    m_completed.timed_wait(lock, 
+                           boost::posix_time::milliseconds(milliseconds));
+  }
+  return m_numFinished >= m_numWorkers;
+}
+
+//----------------------------------------------------------------------------//
+
+float JobState::progress() const
+{
+  if (m_numUnits == 0) {
+    return 1.0f;
+  }
+  const size_t numDone = m_numDone.load(boost::memory_order_relaxed);
+  return static_cast<float>(numDone) / static_cast<float>(m_numUnits);
+}
+
+//----------------------------------------------------------------------------//
+
+bool JobState::aborted() const
+{
+  // Workers poll this often. The error message and any results are read
+  // after the workers are joined, so no ordering is needed here.
+  return m_aborted.load(boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
+bool JobState::hasError() const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return !m_error.empty();
+}
+
+//----------------------------------------------------------------------------//
+
+std::string JobState::error() const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return m_error;
+}
+
+//----------------------------------------------------------------------------//
+
+bool JobState::isComplete() const
+{
+  return m_aborted.load(boost::memory_order_relaxed) || 
+    m_numDone.load(boost::memory_order_relaxed) >= m_numUnits || 
+    (m_numWorkers > 0 && m_numFinished >= m_numWorkers);
+}
+
+//----------------------------------------------------------------------------//
+// LazyFillState
+//----------------------------------------------------------------------------//
+
+LazyFillState::LazyFillState(const size_t size)
+  : m_size(size), m_states(new boost::atomic<int>[size])
+{ 
+  for (size_t i = 0; i < m_size; ++i) {
+    m_states[i].store(Empty, boost::memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void LazyFillState::fill(const size_t i, 
+                         const boost::function<void ()> &compute) const
+{
+  assert(i < m_size && "LazyFillState::fill(): index out of range");
+
+  while (true) {
+    int state = Empty;
+    // Try to claim the element
+    if (m_states[i].compare_exchange_strong(state, Computing, 
+                                            boost::memory_order_acquire)) {
+      try {
+        compute();
+      } 
+      catch (...) {
+        m_states[i].store(Empty, boost::memory_order_release);
+        throw;
+      }
+      m_states[i].store(Ready, boost::memory_order_release);
+      return;
+    }
+    // Another thread got there first. The failed exchange is an acquire 
+    // load, so its writes are visible if it's done.
+    if (state == Ready) {
+      return;
+    }
+    boost::this_thread::yield();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool LazyFillState::claim(const size_t i) const
+{
+  assert(i < m_size && "LazyFillState::claim(): index out of range");
+  int state = Empty;
+  return m_states[i].compare_exchange_strong(state, Computing, 
+                                             boost::memory_order_acquire);
+}
+
+//----------------------------------------------------------------------------//
+
+void LazyFillState::finish(const size_t i) const
+{
+  assert(i < m_size && "LazyFillState::finish(): index out of range");
+  m_states[i].store(Ready, boost::memory_order_release);
+}
+
+//----------------------------------------------------------------------------//
+
+void LazyFillState::release(const size_t i) const
+{
+  assert(i < m_size && "LazyFillState::release(): index out of range");
+  m_states[i].store(Empty, boost::memory_order_release);
+}
+
+//----------------------------------------------------------------------------//
+// ThreadPool
+//----------------------------------------------------------------------------//
+
+ThreadPool::ThreadPool()
+  : m_size(0)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+ThreadPool& ThreadPool::global()
+{
+  boost::call_once(&ThreadPool::createGlobal, g_threadPoolOnce);
+  return *g_threadPool;
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::createGlobal()
+{
+  g_threadPool = new ThreadPool;
+}
+
+//----------------------------------------------------------------------------//
+
+bool ThreadPool::isPoolThread()
+{
+  return g_isPoolThread.get() != NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::submit(const JobState *job, const Task &task)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_tasks.push_back(QueuedTask(job, task));
+  // Grow the pool if setNumThreads() has been raised since the last job
+  for (const size_t size = numThreads(); m_size < size; ++m_size) {
+    m_threads.create_thread(boost::bind(&ThreadPool::workerLoop, this));
+  }
+  m_taskQueued.notify_one();
+}
+
+//----------------------------------------------------------------------------//
+
+bool ThreadPool::runPending(const JobState *job)
+{
+  Task task;
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::deque<QueuedTask>::iterator i = m_tasks.begin();
+    for (; i != m_tasks.end() && i->job != job; ++i) { }
+    if (i == m_tasks.end()) {
+      return false;
+    }
+    task = i->task;
+    m_tasks.erase(i);
+  }
+  task();
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t ThreadPool::size() const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return m_size;
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::workerLoop()
+{
+  g_isPoolThread.reset(new bool(true));
+  while (true) {
+    Task task;
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (m_tasks.empty()) {
+        m_taskQueued.wait(lock);
+      }
+      task = m_tasks.front().task;
+      m_tasks.pop_front();
+    }
+    // Tasks come from runWorker(), which doesn't throw
+    task();
+  }
+}
+
+//----------------------------------------------------------------------------//
+// BackgroundTask
+//----------------------------------------------------------------------------//
+
+BackgroundTask::BackgroundTask(const boost::function<void ()> &task)
+  : m_task(boost::bind(task)), m_job(1)
+{
+  m_job.setNumWorkers(1);
+  m_thread = boost::thread(boost::bind(&runWorker, boost::cref(m_task), 0,
+                                       boost::ref(m_job)));
+}
+
+//----------------------------------------------------------------------------//
+
+BackgroundTask::Ptr BackgroundTask::run(const boost::function<void ()> &task)
+{
+  return Ptr(new BackgroundTask(task));
+}
+
+//----------------------------------------------------------------------------//
+
+BackgroundTask::~BackgroundTask()
+{
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void BackgroundTask::wait()
+{
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  if (m_job.hasError()) {
+    throw WorkerThreadException(m_job.error());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool BackgroundTask::isDone()
+{
+  return m_job.wait(0);
+}
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+void setNumThreads(const size_t numThreads)
+{
+  g_numThreads.store(numThreads, boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
+size_t numThreads()
+{
+  const size_t numThreads = g_numThreads.load(boost::memory_order_relaxed);
+  if (numThreads > 0) {
+    return numThreads;
+  }
+  return defaultNumThreads();
+}
+
+//----------------------------------------------------------------------------//
+
+size_t numWorkerThreads(const size_t requested)
+{
+  if (requested > 0) {
+    return requested;
+  }
+  return numThreads();
+}
+
+//----------------------------------------------------------------------------//
+
+void runWorkers(const size_t numThreads,
+                const boost::function<void (size_t)> &worker,
+                JobState &job, Util::ProgressReporter &progress)
+{
+  // Queue workers on the thread pool ---
+
+  const size_t numWorkers = std::max(numThreads, static_cast<size_t>(1));
+  job.setNumWorkers(numWorkers);
+
+  ThreadPool &pool = ThreadPool::global();
+  for (size_t i = 0; i < numWorkers; ++i) {
+    pool.submit(&job, boost::bind(&runWorker, boost::cref(worker), i,
+                                  boost::ref(job)));
+  }
+
+  if (ThreadPool::isPoolThread()) {
+    // A job nested inside another one. The enclosing job may be using all
+    // of the pool's threads, so this thread runs its own workers while it 
+    // waits. Interrupts are handled by the outermost job.
+    while (!job.waitForWorkers(0)) {
+      if (!pool.runPending(&job)) {
+        job.waitForWorkers(k_pollInterval);
+      }
+    }
+  } else {
+    // Interrupts and progress are handled by the calling thread only, 
+    // since the global interrupt handler may not be callable from worker
+    // threads.
+    while (!job.wait(k_pollInterval)) {
+      if (Interrupt::checkAbort()) {
+        job.abort();
+      }
+      progress.update(job.progress());
+    }
+    // The workers reference the job, so it can't go out of scope until
+    // they have all exited.
+    while (!job.waitForWorkers(k_pollInterval)) { }
+  }
+
+  if (job.hasError()) {
+    throw WorkerThreadException(job.error());
+  }
+  if (job.aborted()) {
+    throw UserInterruptException();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void parallelFor(const size_t numItems, const size_t chunkSize,
+                 const boost::function<void (size_t, size_t)> &func,
+                 const size_t numThreads, Util::ProgressReporter &progress)
+{
+  if (numItems == 0) {
+    return;
+  }
+
+  const size_t size = std::max(chunkSize, static_cast<size_t>(1));
+  const size_t numChunks = (numItems + size - 1) / size;
+  // No point in running more workers than there are chunks
+  const size_t numWorkers = std::min(numWorkerThreads(numThreads), numChunks);
+
+  JobState              job(numItems);
+  boost::atomic<size_t> nextChunk(0);
+  runWorkers(numWorkers, 
+             boost::bind(&runChunks, numItems, size, boost::cref(func),
+                         boost::ref(nextChunk), boost::ref(job), _1),
+             job, progress);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,187 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file TileScheduler.cpp
+  Contains implementations of TileScheduler class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/TileScheduler.h"
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //! Converts a distance along a Hilbert curve covering an n x n grid to 
+  //! grid coordinates. n must be a power of two.
+  void hilbertToGrid(const size_t n, const size_t d, size_t &x, size_t &y)
+  {
+    size_t t = d;
+    x = y = 0;
+    for (size_t s = 1; s < n; s *= 2) {
+      const size_t rx = 1 & (t / 2);
+      const size_t ry = 1 & (t ^ rx);
+      // Rotate the quadrant
+      if (ry == 0) {
+        if (rx == 1) {
+          x = s - 1 - x;
+          y = s - 1 - y;
+        }
+        std::swap(x, y);
+      }
+      x += s * rx;
+      y += s * ry;
+      t /= 4;
+    }
+  }
+
+}
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// TileScheduler
+//----------------------------------------------------------------------------//
+
+TileScheduler::TileScheduler(const size_t width, const size_t height, 
+                             const size_t tileSize, const size_t numQueues)
+  : m_numTiles(0), m_queues(std::max(numQueues, static_cast<size_t>(1)))
+{
+  init(0, 0, width, height, tileSize);
+}
+
+//----------------------------------------------------------------------------//
+
+TileScheduler::TileScheduler(const size_t xMin, const size_t yMin, 
+                             const size_t width, const size_t height, 
+                             const size_t tileSize, const size_t numQueues)
+  : m_numTiles(0), m_queues(std::max(numQueues, static_cast<size_t>(1)))
+{
+  init(xMin, yMin, width, height, tileSize);
+}
+
+//----------------------------------------------------------------------------//
+
+void TileScheduler::init(const size_t xMin, const size_t yMin, 
+                         const size_t width, const size_t height, 
+                         const size_t tileSize)
+{
+  const size_t size = std::max(tileSize, static_cast<size_t>(1));
+  const size_t numX = (width + size - 1) / size;
+  const size_t numY = (height + size - 1) / size;
+  m_numTiles = numX * numY;
+  // Order the tiles along a Hilbert curve and give each queue a contiguous
+  // run of it, so that each worker stays in a compact region of the image
+  // and concurrent tiles touch nearby voxels. The curve covers the smallest
+  // power-of-two grid holding all tiles, and points outside are skipped.
+  const size_t tilesPerQueue = 
+    std::max((m_numTiles + m_queues.size() - 1) / m_queues.size(), 
+             static_cast<size_t>(1));
+  size_t gridSize = 1;
+  while (gridSize < numX || gridSize < numY) {
+    gridSize *= 2;
+  }
+  for (size_t d = 0, count = 0; count < m_numTiles; ++d) {
+    size_t i, j;
+    hilbertToGrid(gridSize, d, i, j);
+    if (i >= numX || j >= numY) {
+      continue;
+    }
+    Tile tile;
+    tile.index = i + j * numX;
+    tile.x0    = xMin + i * size;
+    tile.y0    = yMin + j * size;
+    tile.x1    = std::min(tile.x0 + size, xMin + width);
+    tile.y1    = std::min(tile.y0 + size, yMin + height);
+    m_queues[count / tilesPerQueue].push_back(tile);
+    ++count;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool TileScheduler::next(const size_t queue, Tile &tile)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  // Take from the front of our own queue first
+  TileQueue &own = m_queues[queue % m_queues.size()];
+  if (!own.empty()) {
+    tile = own.front();
+    own.pop_front();
+    return true;
+  }
+
+  // Steal from the back of the fullest queue
+  TileQueue *victim = NULL;
+  for (size_t i = 0, size = m_queues.size(); i < size; ++i) {
+    if (!victim || m_queues[i].size() > victim->size()) {
+      victim = &m_queues[i];
+    }
+  }
+  if (victim && !victim->empty()) {
+    tile = victim->back();
+    victim->pop_back();
+    return true;
+  }
+
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t TileScheduler::numTiles() const
+{
+  return m_numTiles;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,289 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+
+/*! \file Trace.cpp
+  Contains implementations of Trace class.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Trace.h"
+
+// System includes
+
+#include <fstream>
+#include <vector>
+
+// Library includes
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+// Project includes
+
+#include "pvr/Log.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Sys;
+
+  //--------------------------------------------------------------------------//
+
+  //! A complete event, in Chrome trace terms
+  struct Event
+  {
+    std::string    name;
+    const char    *category;
+    boost::int64_t start;
+    boost::int64_t duration;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! The events recorded by one thread
+  struct EventBlock
+  {
+    size_t             threadIndex;
+    std::vector<Event> events;
+  };
+
+  typedef boost::shared_ptr<EventBlock> EventBlockPtr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Thread-specific pointers don't own their blocks, the registry does. 
+  //! That way the events of finished worker threads can still be written.
+  void noCleanup(EventBlock *)
+  { }
+
+  //--------------------------------------------------------------------------//
+
+  //! All blocks that have been handed out, and the mutex protecting them
+  std::vector<EventBlockPtr> g_blocks;
+  boost::mutex               g_blocksMutex;
+
+  //--------------------------------------------------------------------------//
+
+  boost::thread_specific_ptr<EventBlock> g_threadBlock(&noCleanup);
+
+  //--------------------------------------------------------------------------//
+
+  //! Output filename and the time that tracing started
+  std::string              g_filename;
+  boost::posix_time::ptime g_startTime;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the calling thread's event block, creating it if needed
+  EventBlock* threadBlock()
+  {
+    EventBlock *block = g_threadBlock.get();
+    if (!block) {
+      EventBlockPtr newBlock(new EventBlock);
+      {
+        boost::mutex::scoped_lock lock(g_blocksMutex);
+        newBlock->threadIndex = g_blocks.size();
+        g_blocks.push_back(newBlock);
+      }
+      block = newBlock.get();
+      g_threadBlock.reset(block);
+    }
+    return block;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Escapes a string for use in JSON
+  std::string escape(const std::string &s)
+  {
+    std::string result;
+    BOOST_FOREACH (const char c, s) {
+      if (c == '"' || c == '\\') {
+        result += '\\';
+        result += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        result += ' ';
+      } else {
+        result += c;
+      }
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes any trace that is still running when the process exits
+  struct ExitFlush
+  {
+    ~ExitFlush()
+    { Trace::stop(); }
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Trace static member instantiation
+//----------------------------------------------------------------------------//
+
+bool Trace::ms_enabled = false;
+
+//----------------------------------------------------------------------------//
+
+namespace {
+  //! Must be constructed after the registry, so that it is destroyed first
+  ExitFlush g_exitFlush;
+}
+
+//----------------------------------------------------------------------------//
+// Trace::Scope implementations
+//----------------------------------------------------------------------------//
+
+Trace::Scope::Scope(const std::string &name, const char *category)
+  : m_category(category), m_start(0)
+{
+  if (ms_enabled) {
+    m_name  = name;
+    m_start = now();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Trace::Scope::~Scope()
+{
+  if (ms_enabled && !m_name.empty()) {
+    record(m_name, m_category, m_start, now() - m_start);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Trace implementations
+//----------------------------------------------------------------------------//
+
+void Trace::start(const std::string &filename)
+{
+  boost::mutex::scoped_lock lock(g_blocksMutex);
+  BOOST_FOREACH (const EventBlockPtr &block, g_blocks) {
+    block->events.clear();
+  }
+  g_filename  = filename;
+  g_startTime = boost::posix_time::microsec_clock::universal_time();
+  ms_enabled  = true;
+}
+
+//----------------------------------------------------------------------------//
+
+void Trace::stop()
+{
+  if (!ms_enabled) {
+    return;
+  }
+  ms_enabled = false;
+
+  boost::mutex::scoped_lock lock(g_blocksMutex);
+
+  std::ofstream out(g_filename.c_str());
+  if (!out) {
+    Log::warning("Couldn't write trace file: " + g_filename);
+    return;
+  }
+
+  out << "{\"traceEvents\":[\n";
+  bool first = true;
+  BOOST_FOREACH (const EventBlockPtr &block, g_blocks) {
+    // Name the thread, so the viewer doesn't just show its index
+    out << (first ? "" : ",\n")
+        << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" 
+        << block->threadIndex << ",\"args\":{\"name\":\"pvr thread " 
+        << block->threadIndex << "\"}}";
+    first = false;
+    BOOST_FOREACH (const Event &event, block->events) {
+      out << ",\n{\"name\":\"" << escape(event.name) 
+          << "\",\"cat\":\"" << escape(event.category)
+          << "\",\"ph\":\"X\",\"ts\":" << event.start 
+          << ",\"dur\":" << event.duration 
+          << ",\"pid\":0,\"tid\":" << block->threadIndex << "}";
+    }
+    block->events.clear();
+  }
+  out << "\n]}\n";
+
+  Log::print("Wrote trace file: " + g_filename);
+}
+
+//----------------------------------------------------------------------------//
+
+void Trace::record(const std::string &name, const char *category,
+                   const boost::int64_t start, const boost::int64_t duration)
+{
+  if (!ms_enabled) {
+    return;
+  }
+  Event event;
+  event.name     = name;
+  event.category = category;
+  event.start    = start;
+  event.duration = duration;
+  threadBlock()->events.push_back(event);
+}
+
+//----------------------------------------------------------------------------//
+
+boost::int64_t Trace::now()
+{
+  using namespace boost::posix_time;
+  return (microsec_clock::universal_time() - g_startTime).total_microseconds();
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -33,9 +33,13 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <Field3D/Field3DFile.h>
 #include <Field3D/DenseField.h>
@@ -46,6 +50,7 @@
 #include "pvr/Constants.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/Stats.h"
 #include "pvr/VoxelBuffer.h"
 
 //----------------------------------------------------------------------------//
@@ -61,6 +66,56 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Largest number of attributes that sampleAttributes() forwards to the
+  //! children in one call. Longer lists are sampled one at a time.
+  const size_t k_maxAttrs = 8;
+
+  //--------------------------------------------------------------------------//
+
+  //! Per-thread buffer for the children hit by a ray
+  boost::thread_specific_ptr<std::vector<size_t> > g_threadHits;
+
+  //--------------------------------------------------------------------------//
+
+  std::vector<size_t>& threadHits()
+  {
+    if (!g_threadHits.get()) {
+      g_threadHits.reset(new std::vector<size_t>);
+    }
+    return *g_threadHits;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds a child sample's phase function and light mask to the lobes and
+  //! light links of the composite sample, weighted by the child's value. 
+  //! Children with their own lobes or links contribute those. Children 
+  //! without a light mask use the composite's.
+  void addLobe(const VolumeSample &childSample, const Volume &child,
+               const LightMask *defaultMask, VolumeSample &result)
+  {
+    const float weight = Math::max(childSample.value);
+    if (weight <= 0.0f) {
+      return;
+    }
+    if (childSample.lobes.empty()) {
+      result.lobes.add(childSample.phaseFunction, weight);
+    } else {
+      result.lobes.add(childSample.lobes, weight);
+    }
+    const LightMask *mask = child.lightMask();
+    if (!mask) {
+      mask = defaultMask;
+    }
+    if (childSample.lightLinks.isLinked()) {
+      result.lightLinks.add(childSample.lightLinks, weight, mask);
+    } else {
+      result.lightLinks.add(mask, weight);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
   struct MatchName : 
     public std::unary_function<CompositeVolume::ChildAttrs, bool>
   {
@@ -118,6 +173,8 @@ Volume::AttrNameVec CompositeVolume::attributeNames() const
 VolumeSample CompositeVolume::sample(const VolumeSampleState &state,
                                      const VolumeAttr &attribute) const
 {
+  Sys::Stats::add(Sys::Stats::CompositeVolumeSamples);
+
   if (attribute.index() == VolumeAttr::IndexNotSet) {
     setupAttribute(attribute);
   }
@@ -125,19 +182,289 @@ VolumeSample CompositeVolume::sample(const VolumeSampleState &state,
     return VolumeSample(Colors::zero(), m_phaseFunction);
   }
 
-  Color value = Colors::zero();
+  VolumeSample result(Colors::zero(), m_phaseFunction);
+  int attrIndex = attribute.index();
+  // Phase functions are only evaluated for primary rays
+  const bool doLobes = state.rayState.rayType == RayState::FullRaymarch;
+
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    const VolumeAttr &childAttr = m_childAttrs[attrIndex].attrs[i];
+    const VolumeSample childSample = m_volumes[i]->sample(state, childAttr);
+    result.value += childSample.value;
+    if (doLobes) {
+      addLobe(childSample, *m_volumes[i], lightMask(), result);
+    }
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::sampleBatch(const VolumeSampleStatePtrVec &states,
+                                  const VolumeAttr &attribute,
+                                  VolumeSampleVec &samples) const
+{
+  Sys::Stats::add(Sys::Stats::CompositeVolumeSamples, states.size());
+
+  samples.assign(states.size(), VolumeSample(Colors::zero(), m_phaseFunction));
+
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(attribute);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid || states.empty()) {
+    return;
+  }
+
+  int             attrIndex = attribute.index();
+  VolumeSampleVec childSamples;
+
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    const VolumeAttr &childAttr = m_childAttrs[attrIndex].attrs[i];
+    m_volumes[i]->sampleBatch(states, childAttr, childSamples);
+    for (size_t s = 0, numStates = states.size(); s < numStates; ++s) {
+      samples[s].value += childSamples[s].value;
+      if (states[s]->rayState.rayType == RayState::FullRaymarch) {
+        addLobe(childSamples[s], *m_volumes[i], lightMask(), samples[s]);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::sampleAttributes(const VolumeSampleState &state,
+                                       const VolumeAttr *const *attributes,
+                                       const size_t numAttrs,
+                                       VolumeSample *samples) const
+{
+  if (numAttrs > k_maxAttrs) {
+    Volume::sampleAttributes(state, attributes, numAttrs, samples);
+    return;
+  }
+
+  // Only the attributes that some child has are forwarded
+  size_t valid[k_maxAttrs];
+  size_t numValid = 0;
+  for (size_t a = 0; a < numAttrs; ++a) {
+    if (attributes[a]->index() == VolumeAttr::IndexNotSet) {
+      setupAttribute(*attributes[a]);
+    }
+    samples[a] = VolumeSample(Colors::zero(), m_phaseFunction);
+    if (attributes[a]->index() != VolumeAttr::IndexInvalid) {
+      valid[numValid++] = a;
+    }
+  }
+  if (numValid == 0) {
+    return;
+  }
+
+  Sys::Stats::add(Sys::Stats::CompositeVolumeSamples);
+
+  // Phase functions are only evaluated for primary rays
+  const bool         doLobes = 
+    state.rayState.rayType == RayState::FullRaymarch;
+  const VolumeAttr  *childAttrs[k_maxAttrs];
+  VolumeSample       childSamples[k_maxAttrs];
+
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    for (size_t v = 0; v < numValid; ++v) {
+      childAttrs[v] = 
+        &m_childAttrs[attributes[valid[v]]->index()].attrs[i];
+    }
+    m_volumes[i]->sampleAttributes(state, childAttrs, numValid, 
+                                   childSamples);
+    for (size_t v = 0; v < numValid; ++v) {
+      VolumeSample &result = samples[valid[v]];
+      result.value += childSamples[v].value;
+      if (doLobes) {
+        addLobe(childSamples[v], *m_volumes[i], lightMask(), result);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+CompositeVolume::sampleAttributesBatch(const VolumeSampleStatePtrVec &states,
+                                       const VolumeAttr *const *attributes,
+                                       const size_t numAttrs,
+                                       VolumeSampleVec *samples) const
+{
+  if (numAttrs > k_maxAttrs) {
+    Volume::sampleAttributesBatch(states, attributes, numAttrs, samples);
+    return;
+  }
+
+  size_t valid[k_maxAttrs];
+  size_t numValid = 0;
+  for (size_t a = 0; a < numAttrs; ++a) {
+    if (attributes[a]->index() == VolumeAttr::IndexNotSet) {
+      setupAttribute(*attributes[a]);
+    }
+    samples[a].assign(states.size(), 
+                      VolumeSample(Colors::zero(), m_phaseFunction));
+    if (attributes[a]->index() != VolumeAttr::IndexInvalid) {
+      valid[numValid++] = a;
+    }
+  }
+  if (numValid == 0 || states.empty()) {
+    return;
+  }
+
+  Sys::Stats::add(Sys::Stats::CompositeVolumeSamples, states.size());
+
+  const VolumeAttr *childAttrs[k_maxAttrs];
+  VolumeSampleVec   childSamples[k_maxAttrs];
+
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    for (size_t v = 0; v < numValid; ++v) {
+      childAttrs[v] = 
+        &m_childAttrs[attributes[valid[v]]->index()].attrs[i];
+    }
+    m_volumes[i]->sampleAttributesBatch(states, childAttrs, numValid, 
+                                        childSamples);
+    for (size_t v = 0; v < numValid; ++v) {
+      VolumeSampleVec &result = samples[valid[v]];
+      for (size_t s = 0, numStates = states.size(); s < numStates; ++s) {
+        result[s].value += childSamples[v][s].value;
+        if (states[s]->rayState.rayType == RayState::FullRaymarch) {
+          addLobe(childSamples[v][s], *m_volumes[i], lightMask(), 
+                  result[s]);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color CompositeVolume::sampleSum(const VolumeSampleState &state,
+                                 const VolumeAttr &first, 
+                                 const VolumeAttr &second) const
+{
+  if (first.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(first);
+  }
+  if (second.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(second);
+  }
+  // Without child attributes for both, there's nothing to combine
+  if (first.index() == VolumeAttr::IndexInvalid || 
+      second.index() == VolumeAttr::IndexInvalid) {
+    return Volume::sampleSum(state, first, second);
+  }
+
+  Sys::Stats::add(Sys::Stats::CompositeVolumeSamples);
+
+  const ChildAttrs &firstAttrs  = m_childAttrs[first.index()];
+  const ChildAttrs &secondAttrs = m_childAttrs[second.index()];
+
+  Color result = Colors::zero();
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    result += m_volumes[i]->sampleSum(state, firstAttrs.attrs[i], 
+                                      secondAttrs.attrs[i]);
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::sampleSumBatch(const VolumeSampleStatePtrVec &states,
+                                     const VolumeAttr &first, 
+                                     const VolumeAttr &second,
+                                     ColorVec &result) const
+{
+  if (first.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(first);
+  }
+  if (second.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(second);
+  }
+  if (first.index() == VolumeAttr::IndexInvalid || 
+      second.index() == VolumeAttr::IndexInvalid) {
+    Volume::sampleSumBatch(states, first, second, result);
+    return;
+  }
+
+  Sys::Stats::add(Sys::Stats::CompositeVolumeSamples, states.size());
+
+  result.assign(states.size(), Colors::zero());
+
+  const ChildAttrs &firstAttrs  = m_childAttrs[first.index()];
+  const ChildAttrs &secondAttrs = m_childAttrs[second.index()];
+  ColorVec          childResult;
+
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    m_volumes[i]->sampleSumBatch(states, firstAttrs.attrs[i], 
+                                 secondAttrs.attrs[i], childResult);
+    for (size_t s = 0, numStates = states.size(); s < numStates; ++s) {
+      result[s] += childResult[s];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool CompositeVolume::majorant(const RayState &state, 
+                               const VolumeAttr &attribute,
+                               const double t0, const double t1,
+                               Color &result) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(attribute);
+  }
+
+  result = Colors::zero();
+
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return true;
+  }
+
+  int attrIndex = attribute.index();
+
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    const VolumeAttr &childAttr = m_childAttrs[attrIndex].attrs[i];
+    Color childMajorant;
+    if (!m_volumes[i]->majorant(state, childAttr, t0, t1, childMajorant)) {
+      return false;
+    }
+    result += childMajorant;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool CompositeVolume::boundsMajorant(const BBox &wsBounds, 
+                                     const VolumeAttr &attribute,
+                                     Color &result) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(attribute);
+  }
+
+  result = Colors::zero();
+
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return true;
+  }
+
   int attrIndex = attribute.index();
 
   for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
     const VolumeAttr &childAttr = m_childAttrs[attrIndex].attrs[i];
-    const Color sampleValue = m_volumes[i]->sample(state, childAttr).value;
-    value += sampleValue;
-    if (state.rayState.rayType == RayState::FullRaymarch) {
-      m_compositePhaseFunction->setWeight(i, Math::max(sampleValue));
+    Color childMajorant;
+    if (!m_volumes[i]->boundsMajorant(wsBounds, childAttr, childMajorant)) {
+      return false;
     }
+    result += childMajorant;
   }
 
-  return VolumeSample(value, m_phaseFunction);
+  return true;
 }
 
 //----------------------------------------------------------------------------//
@@ -156,16 +483,64 @@ BBox CompositeVolume::wsBounds() const
 IntervalVec CompositeVolume::intersect(const RayState &state) const
 {
   IntervalVec intervals;
-  BOOST_FOREACH (Volume::CPtr child, m_volumes) {
-    IntervalVec childIntervals = child->intersect(state);
-    intervals.insert(intervals.begin(),
-                     childIntervals.begin(), childIntervals.end());
-  }
+  appendIntersections(state, intervals);
   return intervals;
 }
 
 //----------------------------------------------------------------------------//
 
+void CompositeVolume::appendIntersections(const RayState &state,
+                                          IntervalVec &intervals) const
+{
+  if (!m_childBvhState.isReady(0)) {
+    m_childBvhState.fill(0, boost::bind(&CompositeVolume::buildChildBvh, 
+                                        this));
+  }
+
+  // Only intersect the children whose bounds the ray hits. Indices are
+  // sorted so that intervals come out in child order. Nested composites
+  // share the thread's hit buffer, each using the part past its parent's.
+  std::vector<size_t> &hits  = threadHits();
+  const size_t         first = hits.size();
+  hits.insert(hits.end(), m_unboundedChildren.begin(), 
+              m_unboundedChildren.end());
+  m_childBvh.intersect(state.wsRay, hits);
+  std::sort(hits.begin() + first, hits.end());
+
+  for (size_t i = first; i < hits.size(); ++i) {
+    m_volumes[hits[i]]->appendIntersections(state, intervals);
+  }
+  hits.resize(first);
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::bindAttribute(const VolumeAttr &attribute) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setupAttribute(attribute);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return;
+  }
+  const ChildAttrs &childAttrs = m_childAttrs[attribute.index()];
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    m_volumes[i]->bindAttribute(childAttrs.attrs[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::bindLights(const LightVec &sceneLights) const
+{
+  Volume::bindLights(sceneLights);
+  BOOST_FOREACH (const Volume::CPtr &child, m_volumes) {
+    child->bindLights(sceneLights);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 Volume::CVec CompositeVolume::inputs() const
 {
   return m_volumes;
@@ -177,6 +552,7 @@ void CompositeVolume::add(Volume::CPtr child)
 {
   m_volumes.push_back(child);
   m_compositePhaseFunction->add(child->phaseFunction());
+  m_childBvhState = Sys::LazyFillState(1);
 }
 
 //----------------------------------------------------------------------------//
@@ -209,6 +585,25 @@ void CompositeVolume::setupAttribute(const VolumeAttr &attribute) const
 
 //----------------------------------------------------------------------------//
 
+void CompositeVolume::buildChildBvh() const
+{
+  m_childBvh.clear();
+  m_unboundedChildren.clear();
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    const BBox bounds = m_volumes[i]->wsBounds();
+    if (bounds.isEmpty() || bounds.isInfinite()) {
+      m_unboundedChildren.push_back(i);
+    } else {
+      // Pad slightly so that grazing rays are never culled
+      const Vector pad = bounds.size() * 1.0e-4;
+      m_childBvh.add(BBox(bounds.min - pad, bounds.max + pad), i);
+    }
+  }
+  m_childBvh.build();
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
@@ -42,6 +42,7 @@
 #include "pvr/Constants.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/Stats.h"
 #include "pvr/Strings.h"
 
 //----------------------------------------------------------------------------//
@@ -76,6 +77,8 @@ Volume::AttrNameVec ConstantVolume::attributeNames() const
 VolumeSample ConstantVolume::sample(const VolumeSampleState &state,
                                     const VolumeAttr &attribute) const
 {
+  Sys::Stats::add(Sys::Stats::ConstantVolumeSamples);
+
   if (attribute.index() == VolumeAttr::IndexNotSet) {
     setIndexForName(attribute, m_attrNames);
   }
@@ -109,6 +112,16 @@ BBox ConstantVolume::wsBounds() const
 //----------------------------------------------------------------------------//
 
 IntervalVec ConstantVolume::intersect(const RayState &state) const
+{
+  IntervalVec intervals;
+  appendIntersections(state, intervals);
+  return intervals;
+}
+
+//----------------------------------------------------------------------------//
+
+void ConstantVolume::appendIntersections(const RayState &state,
+                                         IntervalVec &intervals) const
 {
   // Transform ray to local space
   Ray lsRay;
@@ -118,11 +131,46 @@ IntervalVec ConstantVolume::intersect(const RayState &state) const
   // Intersect against unity bounds
   double t0, t1;
   if (Math::intersect(lsRay, Bounds::zeroOne(), t0, t1)) {
-    return IntervalVec(1, Interval(t0, t1, (t1 - t0) / 
-                                   (std::sqrt(m_maxAttrValue) * 20.0)));
+    // Every attribute is constant inside the bounds
+    intervals.push_back(Interval(t0, t1, (t1 - t0) / 
+                                 (std::sqrt(m_maxAttrValue) * 20.0), true));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool ConstantVolume::majorant(const RayState &/* state */, 
+                              const VolumeAttr &attribute,
+                              const double /* t0 */, const double /* t1 */,
+                              Color &result) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    result = Colors::zero();
+  } else {
+    result = m_attrValues[attribute.index()];
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool ConstantVolume::boundsMajorant(const BBox &wsBounds,
+                                    const VolumeAttr &attribute,
+                                    Color &result) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid ||
+      !wsBounds.intersects(this->wsBounds())) {
+    result = Colors::zero();
   } else {
-    return IntervalVec();
+    result = m_attrValues[attribute.index()];
   }
+  return true;
 }
 
 //----------------------------------------------------------------------------//
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <vector>
+
 // Library includes
 
 // Project headers
@@ -40,6 +42,7 @@
 #include "pvr/Constants.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/Stats.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -72,6 +75,8 @@ Volume::AttrNameVec FractalCloud::attributeNames() const
 VolumeSample FractalCloud::sample(const VolumeSampleState &state,
                                   const VolumeAttr &attribute) const
 {
+  Sys::Stats::add(Sys::Stats::FractalCloudSamples);
+
   if (attribute.index() == VolumeAttr::IndexNotSet) {
     if (attribute.name() == "scattering") {
       attribute.setIndex(0);
@@ -85,13 +90,63 @@ VolumeSample FractalCloud::sample(const VolumeSampleState &state,
   
   double distFunc = 1.0 - state.wsP.length();
 
-  return VolumeSample(Color(distFunc + m_fractal->eval(state.wsP)) * m_density,
+  // Leave out the octaves finer than the ray's footprint
+  const float fractalVal = m_fractal->eval(state.wsP, state.footprint());
+
+  return VolumeSample(Color(distFunc + fractalVal) * m_density, 
                       m_phaseFunction);
 }
 
 //----------------------------------------------------------------------------//
 
+void FractalCloud::sampleBatch(const VolumeSampleStatePtrVec &states,
+                               const VolumeAttr &attribute,
+                               VolumeSampleVec &samples) const
+{
+  Sys::Stats::add(Sys::Stats::FractalCloudSamples, states.size());
+
+  samples.assign(states.size(), VolumeSample(Colors::zero(), m_phaseFunction));
+
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    if (attribute.name() == "scattering") {
+      attribute.setIndex(0);
+    } else {
+      attribute.setIndexInvalid();
+    }
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid || states.empty()) {
+    return;
+  }
+
+  std::vector<Imath::V3f> nsP(states.size());
+  std::vector<float>      filterWidths(states.size());
+  std::vector<float>      fractalVals(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    nsP[i] = states[i]->wsP;
+    filterWidths[i] = states[i]->footprint();
+  }
+  m_fractal->evalBatch(&nsP[0], &filterWidths[0], &fractalVals[0], 
+                       states.size());
+
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    double distFunc = 1.0 - states[i]->wsP.length();
+    samples[i].value = Color(distFunc + fractalVals[i]) * m_density;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 IntervalVec FractalCloud::intersect(const RayState &state) const
+{
+  IntervalVec intervals;
+  appendIntersections(state, intervals);
+  return intervals;
+}
+
+//----------------------------------------------------------------------------//
+
+void FractalCloud::appendIntersections(const RayState &state,
+                                       IntervalVec &intervals) const
 {
   Fractal::Range range = m_fractal->range();
   double maxDisplacement = (1.0 + range.second) * Vector(1.0).length();
@@ -100,9 +155,7 @@ IntervalVec FractalCloud::intersect(const RayState &state) const
   double t0, t1;
   if (Math::intersect(state.wsRay, wsBounds, t0, t1)) {
     double stepLength = 0.1 / std::log(1.0 + m_density);
-    return IntervalVec(1, Interval(t0, t1, stepLength));
-  } else {
-    return IntervalVec();
+    intervals.push_back(Interval(t0, t1, stepLength));
   }
 }
 
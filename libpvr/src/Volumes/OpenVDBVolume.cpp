@@ -0,0 +1,527 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file OpenVDBVolume.cpp
+  Contains implementations of OpenVDBVolume class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Volumes/OpenVDBVolume.h"
+
+#ifdef PVR_USE_OPENVDB
+
+// System includes
+
+#include <algorithm>
+
+// Library includes
+
+#include <boost/scoped_ptr.hpp>
+
+#include <openvdb/openvdb.h>
+#include <openvdb/math/Ray.h>
+#include <openvdb/tools/Interpolation.h>
+#include <openvdb/tools/RayIntersector.h>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/Stats.h"
+#include "pvr/Strings.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  // Typedefs ---
+
+  typedef openvdb::math::Ray<double> VdbRay;
+
+  // Constants ---
+
+  //! Intervals closer than this, in voxels, are merged
+  const double k_mergeTolerance = 1e-3;
+
+  // Utility functions ---
+
+  Imath::V3f toV3f(const float value)
+  {
+    return Imath::V3f(value);
+  }
+
+  Imath::V3f toV3f(const openvdb::Vec3s &value)
+  {
+    return Imath::V3f(value.x(), value.y(), value.z());
+  }
+
+  openvdb::Vec3d toVdb(const pvr::Vector &v)
+  {
+    return openvdb::Vec3d(v.x, v.y, v.z);
+  }
+
+  pvr::Vector fromVdb(const openvdb::Vec3d &v)
+  {
+    return pvr::Vector(v.x(), v.y(), v.z());
+  }
+
+}
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// OpenVDBVolume::GridData
+//----------------------------------------------------------------------------//
+
+struct OpenVDBVolume::GridData
+{
+  virtual ~GridData()
+  { }
+  //! Interpolates the grid at a world space position
+  virtual Imath::V3f sample(const Vector &wsP) const = 0;
+  //! Interpolates the grid at each sample position using a single
+  //! accessor, and stores the value times scale.
+  virtual void       sampleBatch(const VolumeSampleStatePtrVec &states,
+                                 const Imath::V3f &scale,
+                                 VolumeSampleVec &samples) const = 0;
+  //! Appends intervals for the active parts of the tree along the ray
+  virtual void       appendIntersections(const Ray &wsRay,
+                                         IntervalVec &intervals) const = 0;
+  //! Transforms a world space position to index space
+  virtual Vector     worldToIndex(const Vector &wsP) const = 0;
+
+  //! Name of the grid
+  std::string gridName;
+  //! Value type of the grid
+  std::string valueType;
+  //! Largest value of each component in the grid, including tiles and
+  //! the background value
+  Imath::V3f  maxValue;
+  //! World space bounds of the active voxels, padded by the support of
+  //! the interpolation
+  BBox        wsBounds;
+  //! Memory used by the grid
+  size_t      memSize;
+  //! Number of leaf nodes in the tree
+  size_t      numLeafNodes;
+};
+
+//----------------------------------------------------------------------------//
+// OpenVDBVolume::TypedGridData
+//----------------------------------------------------------------------------//
+
+template <typename GridT>
+struct OpenVDBVolume::TypedGridData : public OpenVDBVolume::GridData
+{
+  // Typedefs ---
+
+  typedef typename GridT::TreeType  TreeT;
+  typedef typename GridT::ValueType ValueT;
+  //! Unsafe accessors don't register with the tree, which makes them cheap
+  //! to construct. The tree is never modified after loading.
+  typedef openvdb::tree::ValueAccessor<const TreeT, false> AccessorT;
+  //! The hierarchical DDA descends all the way to the leaf nodes
+  typedef openvdb::tools::VolumeRayIntersector<
+    GridT, TreeT::LeafNodeType::LEVEL, VdbRay>             IntersectorT;
+
+  // Ctor ---
+
+  TypedGridData(typename GridT::ConstPtr g)
+    : grid(g)
+  {
+    gridName = grid->getName();
+    valueType = grid->valueType();
+    memSize = grid->memUsage();
+    numLeafNodes = grid->tree().leafCount();
+
+    // Find the largest value of each component
+    maxValue = toV3f(grid->background());
+    for (typename GridT::ValueOnCIter i = grid->cbeginValueOn(); i; ++i) {
+      const Imath::V3f value = toV3f(*i);
+      maxValue.x = std::max(maxValue.x, value.x);
+      maxValue.y = std::max(maxValue.y, value.y);
+      maxValue.z = std::max(maxValue.z, value.z);
+    }
+
+    if (grid->empty()) {
+      return;
+    }
+
+    // Trilinear lookups are non-zero up to one voxel outside the active
+    // voxels, so the bounds and the DDA's mask are both padded by one
+    const openvdb::CoordBBox isBounds = grid->evalActiveVoxelBoundingBox();
+    const openvdb::Vec3d pad(1.0);
+    const openvdb::Vec3d isMin = isBounds.min().asVec3d() - pad;
+    const openvdb::Vec3d isMax = isBounds.max().asVec3d() + pad;
+    for (int i = 0; i < 8; ++i) {
+      const openvdb::Vec3d isCorner(i & 1 ? isMax.x() : isMin.x(),
+                                    i & 2 ? isMax.y() : isMin.y(),
+                                    i & 4 ? isMax.z() : isMin.z());
+      wsBounds.extendBy(fromVdb(grid->indexToWorld(isCorner)));
+    }
+    intersector.reset(new IntersectorT(*grid, 1));
+  }
+
+  // From GridData ---
+
+  virtual Imath::V3f sample(const Vector &wsP) const
+  {
+    AccessorT accessor(grid->tree());
+    return interpolate(accessor, wsP);
+  }
+
+  virtual void sampleBatch(const VolumeSampleStatePtrVec &states,
+                           const Imath::V3f &scale,
+                           VolumeSampleVec &samples) const
+  {
+    // Consecutive points along a ray mostly fall in the same leaf node,
+    // which the accessor caches between lookups
+    AccessorT accessor(grid->tree());
+    for (size_t i = 0, size = states.size(); i < size; ++i) {
+      samples[i].value = scale * interpolate(accessor, states[i]->wsP);
+    }
+  }
+
+  virtual void appendIntersections(const Ray &wsRay,
+                                   IntervalVec &intervals) const
+  {
+    if (!intersector) {
+      return;
+    }
+    // The transform is linear, so the index space ray has the same
+    // parametrization as the world space one, and the DDA's times can be
+    // used directly
+    const openvdb::Vec3d isPos = grid->worldToIndex(toVdb(wsRay.pos));
+    const openvdb::Vec3d isDir =
+      grid->worldToIndex(toVdb(wsRay.pos + wsRay.dir)) - isPos;
+    const double isLength = isDir.length();
+    if (isLength == 0.0) {
+      return;
+    }
+    // The copy shares the mask tree of the original, and only holds the
+    // per-ray state
+    IntersectorT rayIntersector(*intersector);
+    if (!rayIntersector.setIndexRay(VdbRay(isPos, isDir))) {
+      return;
+    }
+    // March from one run of active nodes to the next, merging runs that
+    // touch
+    const double stepLength = 1.0 / isLength;
+    const double tolerance = k_mergeTolerance * stepLength;
+    const size_t first = intervals.size();
+    double t0, t1;
+    while (rayIntersector.march(t0, t1)) {
+      if (intervals.size() > first && t0 <= intervals.back().t1 + tolerance) {
+        intervals.back().t1 = t1;
+      } else {
+        intervals.push_back(Interval(t0, t1, stepLength));
+      }
+    }
+  }
+
+  virtual Vector worldToIndex(const Vector &wsP) const
+  {
+    return fromVdb(grid->worldToIndex(toVdb(wsP)));
+  }
+
+  // Utility methods ---
+
+  Imath::V3f interpolate(const AccessorT &accessor, const Vector &wsP) const
+  {
+    const openvdb::Vec3d isP = grid->worldToIndex(toVdb(wsP));
+    return toV3f(openvdb::tools::BoxSampler::sample(accessor, isP));
+  }
+
+  // Data members ---
+
+  //! The grid
+  typename GridT::ConstPtr       grid;
+  //! Holds the mask tree that the DDA traverses. Null for empty grids.
+  boost::scoped_ptr<IntersectorT> intersector;
+};
+
+//----------------------------------------------------------------------------//
+// OpenVDBVolume
+//----------------------------------------------------------------------------//
+
+OpenVDBVolume::OpenVDBVolume()
+  : m_gridMemory(Sys::Memory::VoxelBuffers),
+    m_useEmptySpaceOptimization(true)
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+OpenVDBVolume::~OpenVDBVolume()
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+Volume::AttrNameVec OpenVDBVolume::attributeNames() const
+{
+  return m_attrNames;
+}
+
+//----------------------------------------------------------------------------//
+
+VolumeSample OpenVDBVolume::sample(const VolumeSampleState &state,
+                                   const VolumeAttr &attribute) const
+{
+  Sys::Stats::add(Sys::Stats::OpenVDBVolumeSamples);
+
+  const Imath::V3f scale = attributeScale(attribute);
+  if (!m_grid || Math::max(scale) == 0.0f) {
+    return VolumeSample(Colors::zero(), m_phaseFunction);
+  }
+
+  return VolumeSample(scale * m_grid->sample(state.wsP), m_phaseFunction);
+}
+
+//----------------------------------------------------------------------------//
+
+void OpenVDBVolume::sampleBatch(const VolumeSampleStatePtrVec &states,
+                                const VolumeAttr &attribute,
+                                VolumeSampleVec &samples) const
+{
+  Sys::Stats::add(Sys::Stats::OpenVDBVolumeSamples, states.size());
+
+  samples.assign(states.size(), VolumeSample(Colors::zero(), m_phaseFunction));
+
+  const Imath::V3f scale = attributeScale(attribute);
+  if (!m_grid || Math::max(scale) == 0.0f) {
+    return;
+  }
+
+  m_grid->sampleBatch(states, scale, samples);
+}
+
+//----------------------------------------------------------------------------//
+
+BBox OpenVDBVolume::wsBounds() const
+{
+  return m_wsBounds;
+}
+
+//----------------------------------------------------------------------------//
+
+IntervalVec OpenVDBVolume::intersect(const RayState &state) const
+{
+  IntervalVec intervals;
+  appendIntersections(state, intervals);
+  return intervals;
+}
+
+//----------------------------------------------------------------------------//
+
+void OpenVDBVolume::appendIntersections(const RayState &state,
+                                        IntervalVec &intervals) const
+{
+  if (!m_grid) {
+    return;
+  }
+
+  if (m_useEmptySpaceOptimization) {
+    m_grid->appendIntersections(state.wsRay, intervals);
+    return;
+  }
+
+  double t0, t1;
+  if (Math::intersect(state.wsRay, m_wsBounds, t0, t1)) {
+    const Vector isNear = m_grid->worldToIndex(state.wsRay(t0));
+    const Vector isFar = m_grid->worldToIndex(state.wsRay(t1));
+    const double numSamples = (isFar - isNear).length();
+    intervals.push_back(Interval(t0, t1, (t1 - t0) / numSamples));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool OpenVDBVolume::majorant(const RayState &/* state */,
+                             const VolumeAttr &attribute,
+                             const double /* t0 */, const double /* t1 */,
+                             Color &result) const
+{
+  if (!m_grid) {
+    result = Colors::zero();
+  } else {
+    result = attributeScale(attribute) * m_grid->maxValue;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool OpenVDBVolume::boundsMajorant(const BBox &wsBounds,
+                                   const VolumeAttr &attribute,
+                                   Color &result) const
+{
+  if (!m_grid || !wsBounds.intersects(m_wsBounds)) {
+    result = Colors::zero();
+  } else {
+    result = attributeScale(attribute) * m_grid->maxValue;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+Volume::StringVec OpenVDBVolume::info() const
+{
+  StringVec info;
+  for (size_t i = 0, size = m_attrNames.size(); i < size; ++i) {
+    info.push_back(m_attrNames[i] + " : " + Util::str(m_attrValues[i]));
+  }
+  if (m_grid) {
+    info.push_back("Grid: " + m_grid->gridName + " <" + m_grid->valueType +
+                   ">, " + Util::str(m_grid->numLeafNodes) + " leaf nodes, " +
+                   Util::str(m_grid->memSize / (1024.0 * 1024.0)) + " MB");
+  }
+  if (m_useEmptySpaceOptimization) {
+    info.push_back("Empty space optimization: hierarchical DDA");
+  } else {
+    info.push_back("Empty space optimization disabled");
+  }
+  return info;
+}
+
+//----------------------------------------------------------------------------//
+
+void OpenVDBVolume::load(const std::string &filename,
+                         const std::string &gridName)
+{
+  Log::print("Loading OpenVDB grid: " + filename);
+
+  // Safe to call more than once
+  openvdb::initialize();
+
+  openvdb::GridBase::Ptr grid;
+  try {
+    openvdb::io::File file(filename);
+    file.open();
+    if (gridName.empty()) {
+      // Only read the metadata until a supported grid is found
+      for (openvdb::io::File::NameIterator i = file.beginName(),
+             end = file.endName(); i != end; ++i) {
+        openvdb::GridBase::ConstPtr meta = file.readGridMetadata(i.gridName());
+        if (meta->isType<openvdb::FloatGrid>() ||
+            meta->isType<openvdb::Vec3SGrid>()) {
+          grid = file.readGrid(i.gridName());
+          break;
+        }
+      }
+    } else if (file.hasGrid(gridName)) {
+      grid = file.readGrid(gridName);
+    }
+    file.close();
+  }
+  catch (const openvdb::Exception &e) {
+    Log::warning("Couldn't load " + filename + ": " + e.what());
+    return;
+  }
+
+  if (!grid) {
+    if (gridName.empty()) {
+      Log::warning("No float or vec3s grid could be loaded from " + filename);
+    } else {
+      Log::warning("No grid named " + gridName + " in " + filename);
+    }
+    return;
+  }
+
+  if (!grid->transform().isLinear()) {
+    throw UnsupportedGridException("Non-linear transform on " +
+                                   grid->getName() + " in " + filename);
+  }
+
+  if (openvdb::FloatGrid::Ptr g =
+      openvdb::gridPtrCast<openvdb::FloatGrid>(grid)) {
+    m_grid.reset(new TypedGridData<openvdb::FloatGrid>(g));
+  } else if (openvdb::Vec3SGrid::Ptr g =
+             openvdb::gridPtrCast<openvdb::Vec3SGrid>(grid)) {
+    m_grid.reset(new TypedGridData<openvdb::Vec3SGrid>(g));
+  } else {
+    throw UnsupportedGridException(grid->getName() + " <" +
+                                   grid->valueType() + "> in " + filename);
+  }
+
+  m_wsBounds = m_grid->wsBounds;
+  m_gridMemory.track(m_grid->memSize);
+
+  if (m_grid->numLeafNodes == 0) {
+    Log::warning("OpenVDB grid has no active voxels: " + m_grid->gridName);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void OpenVDBVolume::addAttribute(const std::string &attrName,
+                                 const Imath::V3f &value)
+{
+  m_attrNames.push_back(attrName);
+  m_attrValues.push_back(value);
+}
+
+//----------------------------------------------------------------------------//
+
+void OpenVDBVolume::setUseEmptySpaceOptimization(const bool enabled)
+{
+  m_useEmptySpaceOptimization = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+Imath::V3f OpenVDBVolume::attributeScale(const VolumeAttr &attribute) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return Imath::V3f(0.0f);
+  }
+  return m_attrValues[attribute.index()];
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // PVR_USE_OPENVDB
+
+//----------------------------------------------------------------------------//
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 // Project headers
@@ -46,6 +48,80 @@
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// LightLinks
+//----------------------------------------------------------------------------//
+
+void LightLinks::add(const LightMask *mask, const float weight)
+{
+  if (weight <= 0.0f) {
+    return;
+  }
+  // Children mostly share masks, so merge with an existing link first
+  for (size_t i = 0; i < m_size; i++) {
+    if (m_masks[i] == mask) {
+      m_weights[i] += weight;
+      return;
+    }
+  }
+  if (m_size < MaxLinks) {
+    m_masks[m_size] = mask;
+    m_weights[m_size] = weight;
+    m_size++;
+  } else {
+    // Replace the lightest link
+    size_t lightest = 0;
+    for (size_t i = 1; i < m_size; i++) {
+      if (m_weights[i] < m_weights[lightest]) {
+        lightest = i;
+      }
+    }
+    if (weight <= m_weights[lightest]) {
+      return;
+    }
+    m_masks[lightest] = mask;
+    m_weights[lightest] = weight;
+  }
+  m_isLinked = m_isLinked || mask != NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+void LightLinks::add(const LightLinks &links, const float weight,
+                     const LightMask *defaultMask)
+{
+  float sum = 0.0f;
+  for (size_t i = 0; i < links.m_size; i++) {
+    sum += links.m_weights[i];
+  }
+  if (sum <= 0.0f) {
+    return;
+  }
+  for (size_t i = 0; i < links.m_size; i++) {
+    add(links.m_masks[i] ? links.m_masks[i] : defaultMask, 
+        links.m_weights[i] * weight / sum);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+float LightLinks::fraction(const size_t lightIdx) const
+{
+  if (!m_isLinked) {
+    return 1.0f;
+  }
+  float lit = 0.0f;
+  float sum = 0.0f;
+  for (size_t i = 0; i < m_size; i++) {
+    const LightMask *mask = m_masks[i];
+    if (!mask || (lightIdx < mask->size() && (*mask)[lightIdx])) {
+      lit += m_weights[i];
+    }
+    sum += m_weights[i];
+  }
+  return sum > 0.0f ? lit / sum : 0.0f;
+}
+
 //----------------------------------------------------------------------------//
 // Volume
 //----------------------------------------------------------------------------//
@@ -83,6 +159,147 @@ Phase::PhaseFunction::CPtr Volume::phaseFunction() const
 
 //----------------------------------------------------------------------------//
 
+void Volume::linkLight(LightPtr light)
+{
+  assert(light != NULL && "Got null pointer for light");
+  if (light) {
+    m_linkedLights.push_back(light);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::clearLightLinks()
+{
+  m_linkedLights.clear();
+  m_lightMask.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+const Volume::LightVec& Volume::linkedLights() const
+{
+  return m_linkedLights;
+}
+
+//----------------------------------------------------------------------------//
+
+const LightMask* Volume::lightMask() const
+{
+  return m_linkedLights.empty() ? NULL : &m_lightMask;
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::bindLights(const LightVec &sceneLights) const
+{
+  m_lightMask.assign(sceneLights.size(), 0);
+  for (size_t i = 0, size = sceneLights.size(); i < size; ++i) {
+    m_lightMask[i] = std::find(m_linkedLights.begin(), m_linkedLights.end(),
+                               sceneLights[i]) != m_linkedLights.end();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::appendIntersections(const RayState &state, 
+                                 IntervalVec &intervals) const
+{
+  const IntervalVec own = intersect(state);
+  intervals.insert(intervals.end(), own.begin(), own.end());
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::sampleBatch(const VolumeSampleStatePtrVec &states,
+                         const VolumeAttr &attribute,
+                         VolumeSampleVec &samples) const
+{
+  samples.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    samples[i] = sample(*states[i], attribute);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::sampleAttributes(const VolumeSampleState &state,
+                              const VolumeAttr *const *attributes,
+                              const size_t numAttrs,
+                              VolumeSample *samples) const
+{
+  for (size_t i = 0; i < numAttrs; ++i) {
+    samples[i] = sample(state, *attributes[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::sampleAttributesBatch(const VolumeSampleStatePtrVec &states,
+                                   const VolumeAttr *const *attributes,
+                                   const size_t numAttrs,
+                                   VolumeSampleVec *samples) const
+{
+  for (size_t i = 0; i < numAttrs; ++i) {
+    sampleBatch(states, *attributes[i], samples[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color Volume::sampleSum(const VolumeSampleState &state, 
+                        const VolumeAttr &first, 
+                        const VolumeAttr &second) const
+{
+  return sample(state, first).value + sample(state, second).value;
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::sampleSumBatch(const VolumeSampleStatePtrVec &states,
+                            const VolumeAttr &first, 
+                            const VolumeAttr &second,
+                            ColorVec &result) const
+{
+  VolumeSampleVec firstSamples, secondSamples;
+  sampleBatch(states, first, firstSamples);
+  sampleBatch(states, second, secondSamples);
+  result.resize(states.size());
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    result[i] = firstSamples[i].value + secondSamples[i].value;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool Volume::majorant(const RayState &/* state */, 
+                      const VolumeAttr &/* attribute */,
+                      const double /* t0 */, const double /* t1 */,
+                      Color &/* result */) const
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+bool Volume::boundsMajorant(const BBox &/* wsBounds */, 
+                            const VolumeAttr &/* attribute */,
+                            Color &/* result */) const
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::bindAttribute(const VolumeAttr &attribute) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, attributeNames());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 Volume::StringVec Volume::info() const
 {
   return StringVec();
@@ -104,7 +321,7 @@ void setIndexForName(const VolumeAttr &attr, const Volume::StringVec &v)
   Volume::AttrNameVec::const_iterator i = 
     std::find(v.begin(), v.end(), attr.name());
   if (i != v.end()) {
-    attr.setIndex(std::distance(i, v.begin()));
+    attr.setIndex(std::distance(v.begin(), i));
   } else {
     attr.setIndexInvalid();
   }
@@ -0,0 +1,462 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file VolumeBaker.cpp
+  Contains implementations of VolumeBaker class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Volumes/VolumeBaker.h"
+
+// System includes
+
+#include <algorithm>
+#include <limits>
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+#include <Field3D/Field3DFile.h>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/Memory.h"
+#include "pvr/Strings.h"
+#include "pvr/Trace.h"
+#include "pvr/Volumes/CompositeVolume.h"
+#include "pvr/Volumes/VoxelVolume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Default resolution of the longest edge
+  const size_t k_defaultRes = 128;
+  //! Size of the tiles that dense buffers are baked and culled by
+  const int    k_denseTileSize = 8;
+  //! Block order of sparse buffers, i.e. 8^3 voxel blocks
+  const int    k_sparseBlockOrder = 3;
+  //! Layer name used by write() and read()
+  const char   k_layerName[] = "volume_baker";
+  //! Near plane of frustum mappings, as a fraction of the far plane
+  const double k_minNearFraction = 1.0e-3;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// VolumeBaker
+//----------------------------------------------------------------------------//
+
+VolumeBaker::VolumeBaker(Volume::CPtr volume)
+  : m_volume(volume),
+    m_res(k_defaultRes),
+    m_mapping(UniformMapping),
+    m_useSparseBuffers(true),
+    m_numThreads(0)
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+void VolumeBaker::setResolution(const size_t res)
+{
+  m_res = std::max(res, static_cast<size_t>(1));
+}
+
+//----------------------------------------------------------------------------//
+
+void VolumeBaker::setMapping(const MappingType mapping)
+{
+  m_mapping = mapping;
+}
+
+//----------------------------------------------------------------------------//
+
+void VolumeBaker::setCamera(PerspectiveCamera::CPtr camera)
+{
+  m_camera = camera;
+}
+
+//----------------------------------------------------------------------------//
+
+void VolumeBaker::setUseSparseBuffers(const bool enabled)
+{
+  m_useSparseBuffers = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void VolumeBaker::setNumThreads(const size_t numThreads)
+{
+  m_numThreads = numThreads;
+}
+
+//----------------------------------------------------------------------------//
+
+void VolumeBaker::execute()
+{
+  Sys::Trace::Scope trace("VolumeBaker::execute", "volume");
+
+  Log::print("Baking " + m_volume->typeName());
+
+  if (m_mapping == FrustumMapping && !m_camera) {
+    throw MissingCameraException();
+  }
+
+  m_buffers.clear();
+
+  const BBox wsBounds = m_volume->wsBounds();
+  if (wsBounds.isEmpty()) {
+    Log::warning("VolumeBaker: The volume has empty bounds");
+    return;
+  }
+
+  Timer timer;
+
+  const Volume::AttrNameVec attrNames = m_volume->attributeNames();
+  BOOST_FOREACH (const std::string &attrName, attrNames) {
+    VoxelBuffer::Ptr buffer = createBuffer(wsBounds);
+    if (!buffer) {
+      return;
+    }
+    buffer->name      = k_layerName;
+    buffer->attribute = attrName;
+
+    // Resolve the attribute before the threads start sampling with it
+    const VolumeAttr attribute(attrName);
+    m_volume->bindAttribute(attribute);
+
+    SparseBuffer::Ptr sparse   = field_dynamic_cast<SparseBuffer>(buffer);
+    const int         tileSize =
+      sparse ? sparse->blockSize() : k_denseTileSize;
+    const Box3i       dataWindow = buffer->dataWindow();
+    const V3i         tileRes    =
+      (dataWindow.size() + V3i(tileSize)) / tileSize;
+
+    // Find the tiles where the attribute may be non-zero. Tiles that can't
+    // be bounded are baked.
+    std::vector<V3i> tiles;
+    for (int tk = 0; tk < tileRes.z; ++tk) {
+      for (int tj = 0; tj < tileRes.y; ++tj) {
+        for (int ti = 0; ti < tileRes.x; ++ti) {
+          const V3i          min = dataWindow.min + V3i(ti, tj, tk) * tileSize;
+          const Imath::Box3d vsTile(Vector(min),
+                                    Vector(min + V3i(tileSize)));
+          BBox               wsTile;
+          BOOST_FOREACH (const Vector &vsP, Math::cornerPoints(vsTile)) {
+            Vector wsP;
+            buffer->mapping()->voxelToWorld(vsP, wsP);
+            wsTile.extendBy(wsP);
+          }
+          if (!wsTile.intersects(wsBounds)) {
+            continue;
+          }
+          Color majorant;
+          if (!m_volume->boundsMajorant(wsTile, attribute, majorant) ||
+              Math::max(majorant) > 0.0f) {
+            tiles.push_back(V3i(ti, tj, tk));
+          }
+        }
+      }
+    }
+
+    const size_t tileVoxels =
+      static_cast<size_t>(tileSize) * tileSize * tileSize;
+    if (sparse) {
+      Sys::Memory::checkBudget(tiles.size() * tileVoxels * sizeof(V3f),
+                               "VolumeBaker");
+    }
+
+    Log::print("  " + attrName + ": " + str(tiles.size()) + " of " +
+               str(tileRes.x * tileRes.y * tileRes.z) + " tiles baked");
+
+    if (tiles.empty()) {
+      m_buffers.push_back(buffer);
+      continue;
+    }
+
+    // Each tile is baked by a single thread
+    const size_t numThreads =
+      std::min(Sys::numWorkerThreads(m_numThreads), tiles.size());
+
+    ProgressReporter progress(2.5f, "  ");
+    Sys::JobState    job(tiles.size());
+    if (sparse) {
+      Sys::runWorkers(numThreads,
+                      boost::bind(&VolumeBaker::bakeTiles<SparseBuffer>, this,
+                                  boost::ref(*sparse), boost::cref(attribute),
+                                  boost::cref(tiles), tileSize, numThreads,
+                                  boost::ref(job), _1),
+                      job, progress);
+    } else {
+      DenseBuffer::Ptr dense = field_dynamic_cast<DenseBuffer>(buffer);
+      Sys::runWorkers(numThreads,
+                      boost::bind(&VolumeBaker::bakeTiles<DenseBuffer>, this,
+                                  boost::ref(*dense), boost::cref(attribute),
+                                  boost::cref(tiles), tileSize, numThreads,
+                                  boost::ref(job), _1),
+                      job, progress);
+    }
+
+    m_buffers.push_back(buffer);
+  }
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+Volume::Ptr VolumeBaker::volume() const
+{
+  if (m_buffers.empty()) {
+    return Volume::Ptr();
+  }
+
+  std::vector<VoxelVolume::Ptr> volumes;
+  BOOST_FOREACH (const VoxelBuffer::Ptr &buffer, m_buffers) {
+    VoxelVolume::Ptr volume = VoxelVolume::create();
+    volume->setBuffer(buffer);
+    volume->addAttribute(buffer->attribute, V3f(1.0f));
+    volume->setPhaseFunction(m_volume->phaseFunction());
+    BOOST_FOREACH (const Volume::LightPtr &light, m_volume->linkedLights()) {
+      volume->linkLight(light);
+    }
+    volumes.push_back(volume);
+  }
+
+  if (volumes.size() == 1) {
+    return volumes.front();
+  }
+
+  CompositeVolume::Ptr composite = CompositeVolume::create();
+  BOOST_FOREACH (const VoxelVolume::Ptr &volume, volumes) {
+    composite->add(volume);
+  }
+  return composite;
+}
+
+//----------------------------------------------------------------------------//
+
+bool VolumeBaker::write(const std::string &filename) const
+{
+  Log::print("Writing baked volume: " + filename);
+
+  Field3DOutputFile out;
+  if (!out.create(filename)) {
+    Log::warning("Couldn't write baked volume: " + filename);
+    return false;
+  }
+  BOOST_FOREACH (const VoxelBuffer::Ptr &buffer, m_buffers) {
+    if (!out.writeVectorLayer<float>(buffer)) {
+      Log::warning("Couldn't write baked volume: " + filename);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool VolumeBaker::read(const std::string &filename)
+{
+  Log::print("Loading baked volume: " + filename);
+
+  Field3DInputFile in;
+  if (!in.open(filename)) {
+    Log::warning("Couldn't load " + filename);
+    return false;
+  }
+
+  std::vector<VoxelBuffer::Ptr> buffers;
+  Field<V3f>::Vec fields = in.readVectorLayers<float>(k_layerName);
+  BOOST_FOREACH (const Field<V3f>::Ptr &field, fields) {
+    if (SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(field)) {
+      buffers.push_back(sparse);
+    } else if (DenseBuffer::Ptr dense =
+               field_dynamic_cast<DenseBuffer>(field)) {
+      buffers.push_back(dense);
+    }
+  }
+  if (buffers.empty()) {
+    Log::warning("No baked volume could be loaded from " + filename);
+    return false;
+  }
+
+  m_buffers = buffers;
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+VoxelBuffer::Ptr VolumeBaker::createBuffer(const BBox &wsBounds) const
+{
+  VoxelBuffer::Ptr buffer;
+  if (m_useSparseBuffers) {
+    SparseBuffer::Ptr sparse(new SparseBuffer);
+    sparse->setBlockOrder(k_sparseBlockOrder);
+    buffer = sparse;
+  } else {
+    buffer = DenseBuffer::Ptr(new DenseBuffer);
+  }
+
+  V3i bufferRes;
+  if (m_mapping == FrustumMapping) {
+    // Fit the clip planes to the depth range of the volume's bounds
+    const PTime time(0.0);
+    double      near = std::numeric_limits<double>::max(), far = 0.0;
+    BOOST_FOREACH (const Vector &wsP, Math::cornerPoints(wsBounds)) {
+      const Vector csP = m_camera->worldToCamera(wsP, time);
+      near = std::min(near, csP.z);
+      far  = std::max(far, csP.z);
+    }
+    if (far <= 0.0) {
+      Log::warning("VolumeBaker: The volume is behind the camera");
+      return VoxelBuffer::Ptr();
+    }
+    near = std::max(near, far * k_minNearFraction);
+    PerspectiveCamera::Ptr cam = m_camera->clone();
+    cam->setClipPlanes(near, far);
+    // The volume is baked at the start of the shutter, so a single set of
+    // transforms is enough
+    FrustumFieldMapping::Ptr mapping(new FrustumFieldMapping);
+    mapping->setTransforms(cam->screenToWorldMatrices()[0],
+                           cam->cameraToWorldMatrices()[0]);
+    buffer->setMapping(mapping);
+    // Voxels follow the camera's aspect ratio on screen
+    const Imath::V2i rasterRes = m_camera->resolution();
+    const double     aspect    = 
+      static_cast<double>(rasterRes.x) / rasterRes.y;
+    bufferRes = V3i(m_res);
+    if (aspect >= 1.0) {
+      bufferRes.y = std::max(static_cast<int>(m_res / aspect), 1);
+    } else {
+      bufferRes.x = std::max(static_cast<int>(m_res * aspect), 1);
+    }
+  } else {
+    MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping);
+    mapping->setLocalToWorld(Math::coordinateSystem(wsBounds));
+    buffer->setMapping(mapping);
+    bufferRes = wsBounds.size() / Math::max(wsBounds.size()) * m_res;
+    bufferRes = Imath::V3i(std::max(bufferRes.x, 1), std::max(bufferRes.y, 1),
+                           std::max(bufferRes.z, 1));
+  }
+
+  // Dense buffers allocate all their voxels up front
+  if (!m_useSparseBuffers) {
+    Sys::Memory::checkBudget(static_cast<size_t>(bufferRes.x) * bufferRes.y *
+                             bufferRes.z * sizeof(V3f), "VolumeBaker");
+  }
+
+  buffer->setSize(bufferRes);
+  buffer->clear(Colors::zero());
+
+  Log::print("  Resolution: " + str(bufferRes));
+
+  return buffer;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Buffer_T>
+void VolumeBaker::bakeTiles(Buffer_T &buffer, const VolumeAttr &attribute,
+                            const std::vector<V3i> &tiles,
+                            const int tileSize, const size_t numThreads,
+                            Sys::JobState &job, const size_t thread) const
+{
+  const Box3i dataWindow = buffer.dataWindow();
+
+  // Each row of a tile is sampled as one batch, which lets procedural
+  // volumes like FractalCloud evaluate their noise in bulk
+  RayState                        state;
+  std::vector<VolumeSampleState>  sampleStates(tileSize,
+                                               VolumeSampleState(state));
+  VolumeSampleStatePtrVec         statePtrs;
+  VolumeSampleVec                 samples;
+
+  for (size_t t = thread, size = tiles.size(); t < size; t += numThreads) {
+    const V3i min = dataWindow.min + tiles[t] * tileSize;
+    const V3i max(std::min(min.x + tileSize - 1, dataWindow.max.x),
+                  std::min(min.y + tileSize - 1, dataWindow.max.y),
+                  std::min(min.z + tileSize - 1, dataWindow.max.z));
+    // Tiles at the edge of the data window have shorter rows
+    statePtrs.clear();
+    for (int i = min.x; i <= max.x; ++i) {
+      statePtrs.push_back(&sampleStates[i - min.x]);
+    }
+    for (int k = min.z; k <= max.z; ++k) {
+      for (int j = min.y; j <= max.y; ++j) {
+        for (int i = min.x; i <= max.x; ++i) {
+          buffer.mapping()->voxelToWorld(discToCont(V3i(i, j, k)),
+                                         sampleStates[i - min.x].wsP);
+        }
+        m_volume->sampleBatch(statePtrs, attribute, samples);
+        for (int i = min.x; i <= max.x; ++i) {
+          buffer.fastLValue(i, j, k) = samples[i - min.x].value;
+        }
+      }
+    }
+    // Report progress, and stop if the user terminated or another thread
+    // failed
+    job.markDone(1);
+    if (job.aborted()) {
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
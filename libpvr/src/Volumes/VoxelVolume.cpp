@@ -33,17 +33,40 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PVR_VOXEL_SIMD
+#endif
+
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
 #include <Field3D/Field3DFile.h>
 #include <Field3D/DenseField.h>
 #include <Field3D/SparseField.h>
 
 // Project headers
 
+#include "pvr/BrickedBuffer.h"
+#include "pvr/CompressedBuffer.h"
 #include "pvr/Constants.h"
+#include "pvr/CubicInterp.h"
+#include "pvr/Filter.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/QuantizedBuffer.h"
+#include "pvr/RenderGlobals.h"
+#include "pvr/SparseCache.h"
+#include "pvr/Stats.h"
+#include "pvr/Trace.h"
 #include "pvr/VoxelBuffer.h"
 
 //----------------------------------------------------------------------------//
@@ -120,524 +143,3117 @@ void stepToNextBlock(const pvr::Vector &tDelta, const Imath::V3i &sgn,
 
 //----------------------------------------------------------------------------//
 
-} // local namespace
+//! Finds the ray parameter at which the block space ray leaves the given
+//! block along each axis. Used to start a voxel traversal, and to restart
+//! it after skipping ahead.
+void setupTraversal(const pvr::Ray &bsRay, const Imath::V3i &sgn, 
+                    const int x, const int y, const int z, pvr::Vector &tMax)
+{
+  // Whether to look at positive or negative side of block
+  const pvr::Vector cell(x + (sgn.x > 0 ? 1 : 0), 
+                         y + (sgn.y > 0 ? 1 : 0), 
+                         z + (sgn.z > 0 ? 1 : 0));
+  tMax = (cell - bsRay.pos) / bsRay.dir;
+  handleNaN(tMax);
+}
 
 //----------------------------------------------------------------------------//
-// Namespaces
+
+//! Fits z(s) = (c[0] * s + c[1]) / (c[2] * s + 1) through three points. 
+//! Along a line through a camera's eye, the z coordinate of a frustum 
+//! mapping has this form for both depth distributions, as long as s is 
+//! measured from a point in front of the eye.
+//! \returns False if the points are too close to determine the curve.
+bool fitColumnDepth(const double s[3], const double z[3], double c[3])
+{
+  // Rows of c[0] * s + c[1] - c[2] * s * z = z, solved by Cramer's rule
+  double m[3][3];
+  for (int i = 0; i < 3; ++i) {
+    m[i][0] = s[i];
+    m[i][1] = 1.0;
+    m[i][2] = -s[i] * z[i];
+  }
+  const double det = 
+    m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+    m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+    m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  if (std::abs(det) < 1e-12) {
+    return false;
+  }
+  for (int col = 0; col < 3; ++col) {
+    double a[3][3];
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        a[i][j] = j == col ? z[i] : m[i][j];
+      }
+    }
+    c[col] = (a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+              a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+              a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0])) / det;
+  }
+  return true;
+}
+
 //----------------------------------------------------------------------------//
 
-using namespace boost;
-using namespace std;
+//! Majorant grid cell size used for dense buffers. Sparse buffers use their
+//! block size.
+const int k_majorantCellSize = 8;
 
-using namespace Field3D;
+//----------------------------------------------------------------------------//
 
-using namespace pvr::Util; 
+//! Maximum number of mip levels built above the full resolution buffer.
+const size_t k_maxMipLevels = 8;
 
 //----------------------------------------------------------------------------//
 
-namespace pvr {
-namespace Render {
+//! Log2 of the macrocell size used for empty space optimization of dense
+//! buffers.
+const int k_macrocellOrder = 3;
+
+//! Approximate number of voxels along each interval of a frustum mapped 
+//! buffer. Voxel size varies along rays through frustum mappings, so each
+//! interval only averages it over this many voxels.
+const double k_voxelsPerFrustumInterval = 64.0;
+
+//! Smallest batch of samples along one ray that is checked for lying in a
+//! single voxel column of a frustum mapped buffer.
+const size_t k_minColumnSamples = 4;
+
+//! Largest difference, in voxels, between the x and y coordinates of the
+//! sample points of a batch that lies in a single voxel column.
+const double k_columnTolerance = 1e-4;
+
+//! Largest number of buffers in a VoxelVolume, counting the main buffer. 
+//! Lookups keep the value of each buffer on the stack.
+const size_t k_maxBuffers = 8;
 
 //----------------------------------------------------------------------------//
-// UniformMappingIntersection
+// Voxel type conversion
 //----------------------------------------------------------------------------//
 
-UniformMappingIntersection::UniformMappingIntersection
-(Field3D::MatrixFieldMapping::Ptr mapping)
-  : m_mapping(mapping)
-{
-  
-}
-  
+//! Type used when summing voxels of the given type
+template <typename Data_T>
+struct Accum 
+{ typedef Data_T type; };
+
+template <>
+struct Accum<half> 
+{ typedef float type; };
+
+template <>
+struct Accum<Imath::Vec3<half> > 
+{ typedef Imath::V3f type; };
+
 //----------------------------------------------------------------------------//
 
-//! \note worldToLocalDir does not yet take a time argument.
-IntervalVec UniformMappingIntersection::intersect(const Ray &wsRay, 
-                                                  const PTime time) const
-{
-  // Transform ray to local space for intersection test
-  Ray lsRay;
-  m_mapping->worldToLocal(wsRay.pos, lsRay.pos, time);
-  m_mapping->worldToLocalDir(wsRay.dir, lsRay.dir);
-  // Use unit bounding box to intersect against
-  BBox lsBBox = Bounds::zeroOne();
-  // Calculate intersection points
-  double t0, t1;
-  if (Math::intersect(lsRay, lsBBox, t0, t1)) {
-    return IntervalVec(1, makeInterval(wsRay, t0, t1, m_mapping));
-  } else {
-    return IntervalVec();
-  }
-}
-  
+//! Converts a voxel value to its Accum type.
+inline float      accum(const float value)             { return value; }
+inline float      accum(const half value)              { return value; }
+inline Imath::V3f accum(const Imath::V3f &value)       { return value; }
+inline Imath::V3f accum(const Imath::Vec3<half> &value) 
+{ return Imath::V3f(value.x, value.y, value.z); }
+
 //----------------------------------------------------------------------------//
-// FrustumMappingIntersection
+
+//! Returns a voxel value as a V3f. Scalars are replicated into all three
+//! channels.
+template <typename Data_T>
+Imath::V3f toV3f(const Data_T &value)
+{ return Imath::V3f(accum(value)); }
+
 //----------------------------------------------------------------------------//
 
-FrustumMappingIntersection::FrustumMappingIntersection
-(Field3D::FrustumFieldMapping::Ptr mapping)
-  : m_mapping(mapping)
-{
-  
-}
+//! Returns the scalar value of a V3f. This is the average of the channels,
+//! except for replicated scalars, which are returned as-is.
+inline float toScalar(const Imath::V3f &v)
+{ return v.x == v.y && v.y == v.z ? v.x : (v.x + v.y + v.z) / 3.0f; }
 
 //----------------------------------------------------------------------------//
 
-IntervalVec FrustumMappingIntersection::intersect(const Ray &wsRay, 
-                                                  const PTime time) const
-{
-  typedef std::vector<Vector> PointVec;
+//! Converts a V3f to the given voxel type.
+inline void fromV3f(const Imath::V3f &v, float &value) 
+{ value = toScalar(v); }
+inline void fromV3f(const Imath::V3f &v, half &value) 
+{ value = toScalar(v); }
+inline void fromV3f(const Imath::V3f &v, Imath::V3f &value) 
+{ value = v; }
+inline void fromV3f(const Imath::V3f &v, Imath::Vec3<half> &value) 
+{ value = Imath::Vec3<half>(v.x, v.y, v.z); }
 
-  // Get the eight corners of the local space bounding box
-  BBox lsBounds = Bounds::zeroOne();
-  PointVec lsCorners = Math::cornerPoints(lsBounds);
-  // Get the world space positions of the eight corners of the frustum
-  PointVec wsCorners(lsCorners.size());
-  for (PointVec::iterator lsP = lsCorners.begin(), wsP = wsCorners.begin(),
-         end = lsCorners.end(); lsP != end; ++lsP, ++wsP) {
-    m_mapping->localToWorld(*lsP, *wsP, time);
-  }
+//----------------------------------------------------------------------------//
 
-  // Construct plane for each face of frustum
-  Plane planes[6];
-  planes[0] = Plane(wsCorners[4], wsCorners[0], wsCorners[6]);
-  planes[1] = Plane(wsCorners[1], wsCorners[5], wsCorners[3]);
-  planes[2] = Plane(wsCorners[4], wsCorners[5], wsCorners[0]);
-  planes[3] = Plane(wsCorners[2], wsCorners[3], wsCorners[6]);
-  planes[4] = Plane(wsCorners[0], wsCorners[1], wsCorners[2]);
-  planes[5] = Plane(wsCorners[5], wsCorners[4], wsCorners[7]);
+//! Names of the supported voxel types, as used by Field3D.
+inline std::string voxelTypeName(const float)             { return "float"; }
+inline std::string voxelTypeName(const half)              { return "half"; }
+inline std::string voxelTypeName(const Imath::V3f &)       { return "V3f"; }
+inline std::string voxelTypeName(const Imath::Vec3<half> &) { return "V3h"; }
 
-  // Intersect ray against planes
-  double t0 = -std::numeric_limits<double>::max();
-  double t1 = std::numeric_limits<double>::max();
-  for (int i = 0; i < 6; ++i) {
-    double t;
-    const Plane &p = planes[i];
-    if (p.intersectT(wsRay, t)) {
-      if (wsRay.dir.dot(p.normal) > 0.0) {
-        // Non-opposing plane
-        t1 = std::min(t1, t);
-      } else {
-        // Opposing plane
-        t0 = std::max(t0, t);
+//----------------------------------------------------------------------------//
+
+//! Converts a DenseField to another voxel type.
+template <typename Out_T, typename In_T>
+typename Field3D::DenseField<Out_T>::Ptr 
+convert(const Field3D::DenseField<In_T> &field)
+{
+  typename Field3D::DenseField<Out_T>::Ptr 
+    buffer(new Field3D::DenseField<Out_T>);
+  buffer->setSize(field.extents(), field.dataWindow());
+  buffer->setMapping(field.mapping());
+
+  const Field3D::Box3i &dw = field.dataWindow();
+  for (int k = dw.min.z; k <= dw.max.z; ++k) {
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        fromV3f(toV3f(field.fastValue(i, j, k)), buffer->fastLValue(i, j, k));
       }
     }
   }
-  if (t0 < t1) {
-    t0 = std::max(t0, 0.0);
-    return IntervalVec(1, makeInterval(wsRay, t0, t1, m_mapping));
-  } else {
-    return IntervalVec();
-  }
+
+  return buffer;
 }
 
-//----------------------------------------------------------------------------//
-// SparseUniformOptimizer
 //----------------------------------------------------------------------------//
 
-SparseUniformOptimizer::SparseUniformOptimizer
-(SparseBuffer::Ptr sparse, 
- Field3D::MatrixFieldMapping::Ptr mapping)
-  : m_sparse(sparse), m_mapping(mapping)
-{ 
+//! Converts a SparseField to another voxel type, keeping its block layout.
+//! Only allocated blocks are allocated in the result, unallocated blocks 
+//! keep their (converted) empty value.
+template <typename Out_T, typename In_T>
+typename Field3D::SparseField<Out_T>::Ptr 
+convert(const Field3D::SparseField<In_T> &field)
+{
+  typename Field3D::SparseField<Out_T>::Ptr 
+    buffer(new Field3D::SparseField<Out_T>);
+  buffer->setBlockOrder(field.blockOrder());
+  buffer->setSize(field.extents(), field.dataWindow());
+  buffer->setMapping(field.mapping());
+
+  const Field3D::Box3i &dw = field.dataWindow();
+  const Imath::V3i blockRes = field.blockRes();
+  const int blockSize = field.blockSize();
+
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        if (!field.blockIsAllocated(bi, bj, bk)) {
+          Out_T empty;
+          fromV3f(toV3f(field.getBlockEmptyValue(bi, bj, bk)), empty);
+          buffer->setBlockEmptyValue(bi, bj, bk, empty);
+          continue;
+        }
+        const Imath::V3i min = dw.min + Imath::V3i(bi, bj, bk) * blockSize;
+        const Imath::V3i max = 
+          Imath::V3i(std::min(min.x + blockSize - 1, dw.max.x), 
+                     std::min(min.y + blockSize - 1, dw.max.y), 
+                     std::min(min.z + blockSize - 1, dw.max.z));
+        for (int k = min.z; k <= max.z; ++k) {
+          for (int j = min.y; j <= max.y; ++j) {
+            for (int i = min.x; i <= max.x; ++i) {
+              fromV3f(toV3f(field.fastValue(i, j, k)), 
+                      buffer->fastLValue(i, j, k));
+            }
+          }
+        }
+      }
+    }
+  }
 
+  return buffer;
 }
 
 //----------------------------------------------------------------------------//
 
-IntervalVec
-SparseUniformOptimizer::optimize(const RayState &state, 
-                                 const IntervalVec &intervals) const
+//! Converts a DenseField to a scalar SparseField. Zero voxels aren't 
+//! written, so blocks that only hold zeros stay unallocated.
+template <typename In_T>
+Field3D::SparseField<float>::Ptr 
+toSparseScalar(const Field3D::DenseField<In_T> &field)
 {
-  if (intervals.size() != 1) {
-    return intervals;
+  Field3D::SparseField<float>::Ptr buffer(new Field3D::SparseField<float>);
+  buffer->setSize(field.extents(), field.dataWindow());
+  buffer->setMapping(field.mapping());
+
+  const Field3D::Box3i &dw = field.dataWindow();
+  for (int k = dw.min.z; k <= dw.max.z; ++k) {
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        const float value = toScalar(toV3f(field.fastValue(i, j, k)));
+        if (value != 0.0f) {
+          buffer->fastLValue(i, j, k) = value;
+        }
+      }
+    }
   }
 
-  IntervalVec result;
-
-  const Ray &wsRay = state.wsRay;
-  const PTime &time = state.time;
-
-  // Find start voxel
-  Vector wsStart = wsRay(intervals[0].t0), vsStart;
-  m_sparse->mapping()->worldToVoxel(wsStart, vsStart, time);
-  V3i in = Imath::clip(V3i(vsStart), m_sparse->extents());
-
-  // Find start block
-  V3i bStart;
-  m_sparse->getBlockCoord(in.x, in.y, in.z, bStart.x, bStart.y, bStart.z);
+  return buffer;
+}
 
-  // Transform ray to block space
-  Ray bsRay;
-  worldToBlock(m_mapping, m_sparse->blockSize(), wsRay, bsRay);
-  
-  // Find runs along ray ---
+//----------------------------------------------------------------------------//
 
-  // Implementation is based on:
-  // "A Fast Voxel Traversal Algorithm for Ray Tracing"
-  // John Amanatides, Andrew Woo
-  // http://www.cse.yorku.ca/~amana/research/grid.pdf
+//! Converts a SparseField to a scalar SparseField.
+template <typename In_T>
+Field3D::SparseField<float>::Ptr 
+toSparseScalar(const Field3D::SparseField<In_T> &field)
+{
+  return convert<float>(field);
+}
 
-  // Current block
-  int x = bStart.x, y = bStart.y, z = bStart.z;
-  // Direction to step
-  V3i sgn(sign(bsRay.dir.x), sign(bsRay.dir.y), sign(bsRay.dir.z));
-  // Whether to look at positive or negative side of block
-  Vector cell(x + (sgn.x > 0 ? 1 : 0), 
-              y + (sgn.y > 0 ? 1 : 0), 
-              z + (sgn.z > 0 ? 1 : 0));
-  // Distance we could step in each direction, at most
-  Vector tMax((cell - bsRay.pos) / bsRay.dir);
-  // Size of one step in each dimension
-  Vector tDelta(sgn.x / bsRay.dir.x, sgn.y / bsRay.dir.y, sgn.z / bsRay.dir.z);
-  // Ensure there are no inf's or nan's
-  handleNaN(tMax);
-  handleNaN(tDelta);
-  // Check if first block starts a run
-  bool run = m_sparse->blockIsAllocated(x, y, z);
-  // Keep track of start-of-run and last visited block
-  V3i last(bStart), startRun(bStart);
+//----------------------------------------------------------------------------//
+// Majorant grid
+//----------------------------------------------------------------------------//
 
-  // Traverse blocks
-  while (m_sparse->blockIndexIsValid(x, y, z)) {
-    if (m_sparse->blockIsAllocated(x, y, z)) {
-      if (!run) {
-        startRun = V3i(x, y, z);
-        run = true;
-      }
-    } else {
-      if (run) {
-        result.push_back(intervalForRun(wsRay, time, startRun, last));
-        run = false;
+//! Returns the component-wise maximum of the voxels in [min, max].
+template <typename Field_T>
+Imath::V3f cellMax(const Field_T &field, const Imath::V3i &min, 
+                   const Imath::V3i &max)
+{
+  Imath::V3f result(0.0f);
+  for (int k = min.z; k <= max.z; ++k) {
+    for (int j = min.y; j <= max.y; ++j) {
+      for (int i = min.x; i <= max.x; ++i) {
+        const Imath::V3f value = toV3f(field.fastValue(i, j, k));
+        result.x = std::max(result.x, value.x);
+        result.y = std::max(result.y, value.y);
+        result.z = std::max(result.z, value.z);
       }
     }
-    last = V3i(x, y, z);    
-    stepToNextBlock(tDelta, sgn, tMax, x, y, z);
-  }
-
-  if (run) {
-    result.push_back(intervalForRun(wsRay, time, startRun, last));
   }
-
   return result;
 }
 
 //----------------------------------------------------------------------------//
 
-Interval
-SparseUniformOptimizer::intervalForRun(const Ray &wsRay, const PTime time,
-                                       const Imath::V3i &start, 
-                                       const Imath::V3i &end) const
+//! Returns the voxel bounds of the given majorant grid cell.
+inline void cellBounds(const Field3D::Box3i &dw, const Imath::V3i &cell, 
+                       const int cellSize, Imath::V3i &min, Imath::V3i &max)
 {
-  double t0, t1, intT0, intT1;
-  intersect(wsRay, time, start, t0, t1);
-  intT0 = std::min(t0, t1);
-  intersect(wsRay, time, end, t0, t1);
-  intT1 = std::max(t0, t1);
-  return makeInterval(wsRay, intT0, intT1, m_sparse->mapping());
+  min = dw.min + cell * cellSize;
+  max = Imath::V3i(std::min(min.x + cellSize - 1, dw.max.x), 
+                   std::min(min.y + cellSize - 1, dw.max.y), 
+                   std::min(min.z + cellSize - 1, dw.max.z));
 }
 
 //----------------------------------------------------------------------------//
 
-//! \note worldToLocalDir does not yet take a time argument.
-void
-SparseUniformOptimizer::intersect(const Ray &wsRay, const PTime time, 
-                                  const Imath::V3i block,
-                                  double &t0, double &t1) const
+//! Majorant grid cell size for sparse buffers, which is their block size.
+template <typename Sparse_T>
+int majorantCellSize(const Sparse_T &sparse)
 {
-  // Transform to local space
-  Ray lsRay;
-  m_mapping->worldToLocal(wsRay.pos, lsRay.pos, time);
-  m_mapping->worldToLocalDir(wsRay.dir, lsRay.dir);
-  // Intersect in local space
-  Imath::Box3i box;
-  int blockSz = m_sparse->blockSize();
-  box.min = V3i(block.x * blockSz, block.y * blockSz, block.z * blockSz);
-  box.max = box.min + V3i(blockSz - 1, blockSz - 1, blockSz - 1);
-  BBox vsBox(box.min, box.max + V3i(1)), lsBox;
-  m_mapping->voxelToLocal(vsBox.min, lsBox.min);
-  m_mapping->voxelToLocal(vsBox.max, lsBox.max);
-  Math::intersect(lsRay, lsBox, t0, t1);
+  return sparse.blockSize();
 }
 
 //----------------------------------------------------------------------------//
-// SparseFrustumOptimizer
-//----------------------------------------------------------------------------//
-
-SparseFrustumOptimizer::SparseFrustumOptimizer
-(SparseBuffer::Ptr sparse, 
- Field3D::FrustumFieldMapping::Ptr mapping)
-  : m_sparse(sparse), m_mapping(mapping)
-{ 
 
+//! Majorant grid cell size for dense buffers.
+template <typename Data_T>
+int majorantCellSize(const Field3D::DenseField<Data_T> &)
+{
+  return k_majorantCellSize;
 }
 
 //----------------------------------------------------------------------------//
 
-IntervalVec
-SparseFrustumOptimizer::optimize(const RayState &state, 
-                                 const IntervalVec &intervals) const
+//! Returns the maximum of the given majorant grid cell of a sparse buffer,
+//! whose cells are its blocks. Unallocated blocks are never touched, so 
+//! they don't get paged in.
+template <typename Sparse_T>
+Imath::V3f majorantCellMax(const Sparse_T &sparse, const Imath::V3i &cell,
+                           const int cellSize)
 {
-  if (intervals.size() != 1) {
-    return intervals;
-  }
-
-  if (state.rayType != RayState::FullRaymarch ||
-      state.rayDepth != 0) {
-    return intervals;
-  }
-
-  IntervalVec result;
-  const Ray &wsRay = state.wsRay;
-  const PTime &time = state.time;
-
-  // Find start and end voxel
-  Vector vsStart, vsEnd;
-  m_sparse->mapping()->worldToVoxel(wsRay(intervals[0].t0), vsStart);
-  m_sparse->mapping()->worldToVoxel(wsRay(intervals[0].t1), vsEnd);
-  V3i in = Imath::clip(V3i(vsStart), m_sparse->extents());
-  V3i out = Imath::clip(V3i(vsEnd), m_sparse->extents());
-
-  // Find start and end block
-  V3i bStart, bEnd;
-  m_sparse->getBlockCoord(in.x, in.y, in.z, bStart.x, bStart.y, bStart.z);
-  m_sparse->getBlockCoord(out.x, out.y, out.z, bEnd.x, bEnd.y, bEnd.z);
-
-  // Ensure ray travels down z axis
-  if (bStart.x != bEnd.x || bStart.y != bEnd.y) {
-    return intervals;
-  }
-
-  // Current block
-  int x = bStart.x, y = bStart.y, z = bStart.z;
-  // Check if first block starts a run
-  bool run = m_sparse->blockIsAllocated(x, y, z);
-  // Keep track of start-of-run and last visited block
-  int startRun = z, last = z;
-
-  // Traverse row of blocks
-  for (; z <= bEnd.z; z++) {
-    if (m_sparse->blockIsAllocated(x, y, z)) {
-      if (!run) {
-        startRun = z;
-        run = true;
-      }
-    } else {
-      if (run) {
-        result.push_back(intervalForRun(wsRay, time, vsStart, startRun, last));
-        run = false;
-      }
-    }
-    last = z;
-  }
-
-  if (run) {
-    result.push_back(intervalForRun(wsRay, time, vsStart, startRun, last));
+  if (!sparse.blockIsAllocated(cell.x, cell.y, cell.z)) {
+    const Imath::V3f empty = 
+      toV3f(sparse.getBlockEmptyValue(cell.x, cell.y, cell.z));
+    return Imath::V3f(std::max(empty.x, 0.0f), std::max(empty.y, 0.0f), 
+                      std::max(empty.z, 0.0f));
   }
-
-  return result;
+  Imath::V3i min, max;
+  cellBounds(sparse.dataWindow(), cell, cellSize, min, max);
+  return cellMax(sparse, min, max);
 }
 
 //----------------------------------------------------------------------------//
 
-Interval 
-SparseFrustumOptimizer::intervalForRun(const Ray &wsRay, const PTime time,
-                                       const Vector &vsFirst, 
-                                       const int start, const int end) const
+//! Returns the maximum of the given majorant grid cell of a dense buffer.
+template <typename Data_T>
+Imath::V3f majorantCellMax(const Field3D::DenseField<Data_T> &dense, 
+                           const Imath::V3i &cell, const int cellSize)
 {
-  double vsStartZ = start * m_sparse->blockSize();
-  double vsEndZ = (end + 1) * m_sparse->blockSize();
-  Vector vsStart(vsFirst.x, vsFirst.y, vsStartZ);
-  Vector vsEnd(vsFirst.x, vsFirst.y, vsEndZ);
-  Vector wsStart, wsEnd;
-  m_mapping->voxelToWorld(vsStart, wsStart);
-  m_mapping->voxelToWorld(vsEnd, wsEnd);
-  double t0 = (wsStart - wsRay.pos).length();
-  double t1 = (wsEnd - wsRay.pos).length();
-  return makeInterval(wsRay, t0, t1, m_mapping);
+  Imath::V3i min, max;
+  cellBounds(dense.dataWindow(), cell, cellSize, min, max);
+  return cellMax(dense, min, max);
 }
 
 //----------------------------------------------------------------------------//
-// VoxelVolume
+// Block statistics
 //----------------------------------------------------------------------------//
 
-VoxelVolume::VoxelVolume()
-  : m_interpType(LinearInterp), m_useEmptySpaceOptimization(true)
+//! Returns the largest channel of the voxels in [min, max], after clipping
+//! to the data window. Negative values count as zero.
+template <typename Field_T>
+float clippedMax(const Field_T &field, const Imath::V3i &min, 
+                 const Imath::V3i &max)
 {
-  // Empty
+  const Field3D::Box3i &dw = field.dataWindow();
+  const Imath::V3f value = cellMax(field, Imath::clip(min, dw), 
+                                   Imath::clip(max, dw));
+  return std::max(value.x, std::max(value.y, value.z));
 }
 
 //----------------------------------------------------------------------------//
 
-Volume::AttrNameVec VoxelVolume::attributeNames() const
+//! Returns the maximum of the voxels in the given block, and those within 
+//! one voxel of it.
+template <typename Field_T>
+float dilatedBlockMax(const Field_T &field, const Imath::V3i &block, 
+                      const int blockSize)
 {
-  return m_attrNames;
+  Imath::V3i min, max;
+  cellBounds(field.dataWindow(), block, blockSize, min, max);
+  return clippedMax(field, min - Imath::V3i(1), max + Imath::V3i(1));
 }
 
 //----------------------------------------------------------------------------//
 
-VolumeSample VoxelVolume::sample(const VolumeSampleState &state,
-                                 const VolumeAttr &attribute) const
+//! Returns the maximum of an unallocated block of a sparse buffer. The 
+//! block itself holds only its empty value, so just the one voxel thick 
+//! shell around it is read.
+template <typename Sparse_T>
+float unallocatedBlockMax(const Sparse_T &sparse, const Imath::V3i &block, 
+                          const int blockSize)
 {
-  // Check (and set up) attribute index ---
-
-  if (attribute.index() == VolumeAttr::IndexNotSet) {
-    setIndexForName(attribute, m_attrNames);
-  }
-  if (attribute.index() == VolumeAttr::IndexInvalid) {
-    return VolumeSample(Colors::zero(), m_phaseFunction);
+  const Imath::V3f empty = 
+    toV3f(sparse.getBlockEmptyValue(block.x, block.y, block.z));
+  float result = std::max(0.0f, std::max(empty.x, std::max(empty.y, empty.z)));
+
+  Imath::V3i min, max;
+  cellBounds(sparse.dataWindow(), block, blockSize, min, max);
+  const Imath::V3i lo = min - Imath::V3i(1), hi = max + Imath::V3i(1);
+  for (int axis = 0; axis < 3; ++axis) {
+    Imath::V3i faceMin = lo, faceMax = hi;
+    faceMax[axis] = lo[axis];
+    result = std::max(result, clippedMax(sparse, faceMin, faceMax));
+    faceMin[axis] = hi[axis];
+    faceMax[axis] = hi[axis];
+    result = std::max(result, clippedMax(sparse, faceMin, faceMax));
   }
+  return result;
+}
 
-  // Transform to voxel space for sampling ---
-  
-  Vector vsP;
-  m_buffer->mapping()->worldToVoxel(state.wsP, vsP, state.rayState.time);
+//----------------------------------------------------------------------------//
 
-  if (!Math::isInBounds(vsP, m_buffer->dataWindow())) {
-    return VolumeSample(Colors::zero(), m_phaseFunction);
+//! Builds the block map of a sparse buffer, using its own blocks. 
+template <typename Sparse_T>
+pvr::Render::SparseBlockMap blockMap(const Sparse_T &sparse)
+{
+  const Imath::V3i res = sparse.blockRes();
+  const int blockSize = sparse.blockSize();
+  std::vector<float> blockMax(res.x * res.y * res.z, 0.0f);
+  for (int k = 0; k < res.z; ++k) {
+    for (int j = 0; j < res.y; ++j) {
+      for (int i = 0; i < res.x; ++i) {
+        const Imath::V3i block(i, j, k);
+        blockMax[i + res.x * (j + res.y * k)] = 
+          sparse.blockIsAllocated(i, j, k) ? 
+          dilatedBlockMax(sparse, block, blockSize) :
+          unallocatedBlockMax(sparse, block, blockSize);
+      }
+    }
   }
+  return pvr::Render::SparseBlockMap(sparse.mapping(), sparse.extents(), 
+                                     sparse.blockOrder(), res, blockMax);
+}
 
-  // Interpolate voxel value ---
-
-  V3f value(0.0);
+//----------------------------------------------------------------------------//
 
-  switch (m_interpType) {
-  case NoInterp:
-    {
-      V3i dvsP = contToDisc(vsP);
-      value = m_buffer->value(dvsP.x, dvsP.y, dvsP.z);
-      break;
+//! Builds the block map of a dense buffer, dividing it into macrocells.
+template <typename Data_T>
+pvr::Render::SparseBlockMap blockMap(const Field3D::DenseField<Data_T> &dense)
+{
+  const Field3D::Box3i &dw = dense.dataWindow();
+  const int blockSize = 1 << k_macrocellOrder;
+  const Imath::V3i res = (dw.size() + Imath::V3i(blockSize)) / blockSize;
+  std::vector<float> blockMax(res.x * res.y * res.z, 0.0f);
+  for (int k = 0; k < res.z; ++k) {
+    for (int j = 0; j < res.y; ++j) {
+      for (int i = 0; i < res.x; ++i) {
+        blockMax[i + res.x * (j + res.y * k)] = 
+          dilatedBlockMax(dense, Imath::V3i(i, j, k), blockSize);
+      }
     }
-  case CubicInterp:
-    value = m_cubicInterp.sample(*m_buffer, vsP);
-    break;
-  case MonotonicCubicInterp:
-    value = m_monotonicCubicInterp.sample(*m_buffer, vsP);
-    break;
-  case GaussianInterp:
-    value = m_gaussInterp.sample(*m_buffer, vsP);
-    break;
-  case MitchellInterp:
-    value = m_mitchellInterp.sample(*m_buffer, vsP);
-    break;
-  case LinearInterp:
-  default:
-    value = m_linearInterp.sample(*m_buffer, vsP);
-    break;
   }
-
-  return VolumeSample(m_attrValues[attribute.index()] * value, 
-                      m_phaseFunction);
+  return pvr::Render::SparseBlockMap(dense.mapping(), dense.extents(), 
+                                     k_macrocellOrder, res, blockMax);
 }
 
+//----------------------------------------------------------------------------//
+// Mip levels
 //----------------------------------------------------------------------------//
 
-BBox VoxelVolume::wsBounds() const
+//! Divides by two, rounding towards negative infinity.
+int halve(const int x)
 {
-  return m_wsBounds;
+  return x < 0 ? (x - 1) / 2 : x / 2;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the voxel window of the next coarser mip level.
+Field3D::Box3i halve(const Field3D::Box3i &box)
+{
+  return Field3D::Box3i(Imath::V3i(halve(box.min.x), halve(box.min.y), 
+                                   halve(box.min.z)),
+                        Imath::V3i(halve(box.max.x), halve(box.max.y), 
+                                   halve(box.max.z)));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the average of the (up to eight) voxels in the given field that
+//! are covered by voxel (i, j, k) of the next coarser mip level.
+template <typename Field_T>
+typename Field_T::value_type 
+average(const Field_T &field, const int i, const int j, const int k)
+{
+  typedef typename Field_T::value_type Data_T;
+
+  const Field3D::Box3i &dw = field.dataWindow();
+  typename Accum<Data_T>::type sum(0.0f);
+  int count = 0;
+  for (int kk = std::max(2 * k, dw.min.z); 
+       kk <= std::min(2 * k + 1, dw.max.z); ++kk) {
+    for (int jj = std::max(2 * j, dw.min.y); 
+         jj <= std::min(2 * j + 1, dw.max.y); ++jj) {
+      for (int ii = std::max(2 * i, dw.min.x); 
+           ii <= std::min(2 * i + 1, dw.max.x); ++ii) {
+        sum += accum(field.fastValue(ii, jj, kk));
+        count++;
+      }
+    }
+  }
+  return count > 0 ? Data_T(sum / static_cast<float>(count)) : Data_T(sum);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Box filters a DenseField down to half resolution. The mapping is kept
+//! for completeness, but mip levels are always looked up in voxel space.
+template <typename Data_T>
+typename Field3D::DenseField<Data_T>::Ptr 
+downsample(const Field3D::DenseField<Data_T> &field)
+{
+  typename Field3D::DenseField<Data_T>::Ptr 
+    buffer(new Field3D::DenseField<Data_T>);
+  buffer->setSize(halve(field.extents()), halve(field.dataWindow()));
+  buffer->setMapping(field.mapping());
+
+  const Field3D::Box3i &dw = buffer->dataWindow();
+  for (int k = dw.min.z; k <= dw.max.z; ++k) {
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        buffer->fastLValue(i, j, k) = average(field, i, j, k);
+      }
+    }
+  }
+
+  return buffer;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Box filters a sparse buffer (SparseField or QuantizedBuffer) down to a 
+//! SparseField of half resolution. Blocks that only cover unallocated 
+//! blocks of the input stay unallocated, with the average of their empty 
+//! values.
+template <typename Sparse_T>
+typename Field3D::SparseField<typename Sparse_T::value_type>::Ptr 
+downsampleSparse(const Sparse_T &field)
+{
+  typedef typename Sparse_T::value_type Data_T;
+
+  typename Field3D::SparseField<Data_T>::Ptr 
+    buffer(new Field3D::SparseField<Data_T>);
+  buffer->setBlockOrder(field.blockOrder());
+  buffer->setSize(halve(field.extents()), halve(field.dataWindow()));
+  buffer->setMapping(field.mapping());
+
+  const Field3D::Box3i &fieldDw = field.dataWindow();
+  const Field3D::Box3i &dw = buffer->dataWindow();
+  const Imath::V3i blockRes = buffer->blockRes();
+  const int blockSize = buffer->blockSize();
+
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        Imath::V3i min, max;
+        cellBounds(dw, Imath::V3i(bi, bj, bk), blockSize, min, max);
+        // Find the input blocks covered by this block. Block coordinates
+        // are relative to the data window.
+        const Imath::V3i fieldMin = 
+          Imath::clip(min * 2, fieldDw) - fieldDw.min;
+        const Imath::V3i fieldMax = 
+          Imath::clip(max * 2 + Imath::V3i(1), fieldDw) - fieldDw.min;
+        Imath::V3i bMin, bMax;
+        field.getBlockCoord(fieldMin.x, fieldMin.y, fieldMin.z, 
+                            bMin.x, bMin.y, bMin.z);
+        field.getBlockCoord(fieldMax.x, fieldMax.y, fieldMax.z, 
+                            bMax.x, bMax.y, bMax.z);
+        bool isAllocated = false;
+        typename Accum<Data_T>::type emptySum(0.0f);
+        int numEmpty = 0;
+        for (int k = bMin.z; k <= bMax.z; ++k) {
+          for (int j = bMin.y; j <= bMax.y; ++j) {
+            for (int i = bMin.x; i <= bMax.x; ++i) {
+              if (field.blockIsAllocated(i, j, k)) {
+                isAllocated = true;
+              } else {
+                emptySum += accum(field.getBlockEmptyValue(i, j, k));
+                numEmpty++;
+              }
+            }
+          }
+        }
+        if (!isAllocated) {
+          buffer->setBlockEmptyValue(bi, bj, bk, 
+            Data_T(emptySum / static_cast<float>(numEmpty)));
+          continue;
+        }
+        for (int k = min.z; k <= max.z; ++k) {
+          for (int j = min.y; j <= max.y; ++j) {
+            for (int i = min.x; i <= max.x; ++i) {
+              buffer->fastLValue(i, j, k) = average(field, i, j, k);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return buffer;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename Field3D::SparseField<Data_T>::Ptr 
+downsample(const Field3D::SparseField<Data_T> &field)
+{
+  return downsampleSparse(field);
+}
+
+//----------------------------------------------------------------------------//
+
+//! QuantizedBuffer levels are filtered at full precision, then quantized.
+template <typename Code_T>
+typename pvr::QuantizedBuffer<Code_T>::Ptr 
+downsample(const pvr::QuantizedBuffer<Code_T> &field)
+{
+  return typename pvr::QuantizedBuffer<Code_T>::Ptr
+    (new pvr::QuantizedBuffer<Code_T>(*downsampleSparse(field)));
+}
+
+//----------------------------------------------------------------------------//
+
+//! CompressedBuffer levels are filtered into a SparseField, then 
+//! compressed.
+template <typename Data_T>
+typename pvr::CompressedBuffer<Data_T>::Ptr 
+downsample(const pvr::CompressedBuffer<Data_T> &field)
+{
+  return typename pvr::CompressedBuffer<Data_T>::Ptr
+    (new pvr::CompressedBuffer<Data_T>(*downsampleSparse(field)));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Box filters a BrickedBuffer down to half resolution, keeping the brick 
+//! size.
+template <typename Data_T>
+typename pvr::BrickedBuffer<Data_T>::Ptr 
+downsample(const pvr::BrickedBuffer<Data_T> &field)
+{
+  typename pvr::BrickedBuffer<Data_T>::Ptr 
+    buffer(new pvr::BrickedBuffer<Data_T>(halve(field.extents()), 
+                                          halve(field.dataWindow()), 
+                                          field.blockOrder()));
+  buffer->setMapping(field.mapping());
+
+  const Field3D::Box3i &dw = buffer->dataWindow();
+  for (int k = dw.min.z; k <= dw.max.z; ++k) {
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        buffer->fastLValue(i, j, k) = average(field, i, j, k);
+      }
+    }
+  }
+
+  return buffer;
+}
+
+//----------------------------------------------------------------------------//
+// Loading
+//----------------------------------------------------------------------------//
+
+//! Returns the first DenseField or SparseField in a list of Field3D layers.
+template <typename Vec_T>
+Field3D::FieldRes::Ptr firstField(const Vec_T &fields)
+{
+  typedef typename Vec_T::value_type::element_type::value_type Data_T;
+  for (size_t i = 0, size = fields.size(); i < size; ++i) {
+    if (Field3D::field_dynamic_cast<Field3D::SparseField<Data_T> >(fields[i]) ||
+        Field3D::field_dynamic_cast<Field3D::DenseField<Data_T> >(fields[i])) {
+      return fields[i];
+    }
+  }
+  return Field3D::FieldRes::Ptr();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether the field is a SparseField of one of the supported types.
+bool isSparse(Field3D::FieldRes::Ptr field)
+{
+  return 
+    Field3D::field_dynamic_cast<pvr::SparseBuffer>(field) ||
+    Field3D::field_dynamic_cast<pvr::SparseScalarBuffer>(field) ||
+    Field3D::field_dynamic_cast<pvr::SparseHalfBuffer>(field) ||
+    Field3D::field_dynamic_cast<pvr::SparseHalfVectorBuffer>(field);
+}
+
+//----------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace boost;
+using namespace std;
+
+using namespace Field3D;
+
+using namespace pvr::Util; 
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// SparseBlockMap
+//----------------------------------------------------------------------------//
+
+SparseBlockMap::SparseBlockMap(Field3D::FieldMapping::Ptr mapping, 
+                               const Field3D::Box3i &extents, 
+                               const int blockOrder,
+                               const Imath::V3i &blockRes, 
+                               const std::vector<float> &blockMax)
+  : m_mapping(mapping), 
+    m_extents(extents),
+    m_blockOrder(blockOrder), 
+    m_blockRes(blockRes),
+    m_blockMax(blockMax),
+    m_threshold(0.0f)
+{ 
+  assert(m_blockMax.size() == 
+         static_cast<size_t>(m_blockRes.x * m_blockRes.y * m_blockRes.z));
+
+  updateSuperBlocks();
+}
+
+//----------------------------------------------------------------------------//
+
+bool SparseBlockMap::merge(const SparseBlockMap &other)
+{
+  if (other.m_extents != m_extents || other.m_blockOrder != m_blockOrder ||
+      other.m_blockRes != m_blockRes) {
+    return false;
+  }
+  for (size_t i = 0, size = m_blockMax.size(); i < size; ++i) {
+    m_blockMax[i] = std::max(m_blockMax[i], other.m_blockMax[i]);
+  }
+  updateSuperBlocks();
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseBlockMap::updateSuperBlocks()
+{
+  // Gather the maximum of each super block
+  const int superSize = superBlockSize();
+  m_superRes = (m_blockRes + V3i(superSize - 1)) / superSize;
+  m_superMax.assign(m_superRes.x * m_superRes.y * m_superRes.z, 0.0f);
+  for (int bk = 0; bk < m_blockRes.z; ++bk) {
+    for (int bj = 0; bj < m_blockRes.y; ++bj) {
+      for (int bi = 0; bi < m_blockRes.x; ++bi) {
+        float &superMax = 
+          m_superMax[(bi >> k_superBlockOrder) + m_superRes.x * 
+                     ((bj >> k_superBlockOrder) + m_superRes.y * 
+                      (bk >> k_superBlockOrder))];
+        superMax = std::max(superMax, blockMax(bi, bj, bk));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+// UniformMappingIntersection
+//----------------------------------------------------------------------------//
+
+UniformMappingIntersection::UniformMappingIntersection
+(Field3D::MatrixFieldMapping::Ptr mapping)
+  : m_mapping(mapping)
+{
+  
+}
+  
+//----------------------------------------------------------------------------//
+
+IntervalVec UniformMappingIntersection::intersect(const Ray &wsRay, 
+                                                  const PTime time) const
+{
+  IntervalVec intervals;
+  appendIntersections(wsRay, time, intervals);
+  return intervals;
+}
+  
+//----------------------------------------------------------------------------//
+
+//! \note worldToLocalDir does not yet take a time argument.
+void 
+UniformMappingIntersection::appendIntersections(const Ray &wsRay, 
+                                                const PTime time,
+                                                IntervalVec &intervals) const
+{
+  // Transform ray to local space for intersection test
+  Ray lsRay;
+  m_mapping->worldToLocal(wsRay.pos, lsRay.pos, time);
+  m_mapping->worldToLocalDir(wsRay.dir, lsRay.dir);
+  // Use unit bounding box to intersect against
+  BBox lsBBox = Bounds::zeroOne();
+  // Calculate intersection points
+  double t0, t1;
+  if (Math::intersect(lsRay, lsBBox, t0, t1)) {
+    intervals.push_back(makeInterval(wsRay, t0, t1, m_mapping));
+  }
+}
+  
+//----------------------------------------------------------------------------//
+// FrustumMappingIntersection
+//----------------------------------------------------------------------------//
+
+FrustumMappingIntersection::FrustumMappingIntersection
+(Field3D::FrustumFieldMapping::Ptr mapping)
+  : m_mapping(mapping)
+{
+  // Most frusta don't move, so their planes can be computed once
+  Plane closePlanes[6];
+  computePlanes(PTime(0.0f), m_planes);
+  computePlanes(PTime(1.0f), closePlanes);
+  m_isStatic = true;
+  for (int i = 0; i < 6; ++i) {
+    m_isStatic = m_isStatic && 
+      m_planes[i].normal == closePlanes[i].normal &&
+      m_planes[i].distance == closePlanes[i].distance;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+IntervalVec FrustumMappingIntersection::intersect(const Ray &wsRay, 
+                                                  const PTime time) const
+{
+  Plane        movingPlanes[6];
+  const Plane *planes = m_planes;
+  if (!m_isStatic) {
+    computePlanes(time, movingPlanes);
+    planes = movingPlanes;
+  }
+
+  // Intersect ray against planes. The planes face outwards, so the ray 
+  // enters through the ones it's heading against, and leaves through the
+  // others.
+  double t0 = -std::numeric_limits<double>::max();
+  double t1 = std::numeric_limits<double>::max();
+  for (int i = 0; i < 6; ++i) {
+    const Plane  &p        = planes[i];
+    const double  dirDotN  = wsRay.dir.dot(p.normal);
+    if (dirDotN == 0.0) {
+      continue;
+    }
+    const double  t        = (p.distance - wsRay.pos.dot(p.normal)) / dirDotN;
+    if (dirDotN > 0.0) {
+      // Non-opposing plane
+      t1 = std::min(t1, t);
+    } else {
+      // Opposing plane
+      t0 = std::max(t0, t);
+    }
+  }
+  IntervalVec intervals;
+  if (t0 < t1) {
+    t0 = std::max(t0, 0.0);
+    appendFrustumIntervals(wsRay, t0, t1, m_mapping, intervals);
+  }
+  return intervals;
+}
+
+//----------------------------------------------------------------------------//
+
+void FrustumMappingIntersection::computePlanes(const PTime time, 
+                                               Plane planes[6]) const
+{
+  typedef std::vector<Vector> PointVec;
+
+  // Get the eight corners of the local space bounding box
+  BBox lsBounds = Bounds::zeroOne();
+  PointVec lsCorners = Math::cornerPoints(lsBounds);
+  // Get the world space positions of the eight corners of the frustum
+  PointVec wsCorners(lsCorners.size());
+  for (PointVec::iterator lsP = lsCorners.begin(), wsP = wsCorners.begin(),
+         end = lsCorners.end(); lsP != end; ++lsP, ++wsP) {
+    m_mapping->localToWorld(*lsP, *wsP, time);
+  }
+
+  // Construct plane for each face of frustum
+  planes[0] = Plane(wsCorners[4], wsCorners[0], wsCorners[6]);
+  planes[1] = Plane(wsCorners[1], wsCorners[5], wsCorners[3]);
+  planes[2] = Plane(wsCorners[4], wsCorners[5], wsCorners[0]);
+  planes[3] = Plane(wsCorners[2], wsCorners[3], wsCorners[6]);
+  planes[4] = Plane(wsCorners[0], wsCorners[1], wsCorners[2]);
+  planes[5] = Plane(wsCorners[5], wsCorners[4], wsCorners[7]);
+}
+
+//----------------------------------------------------------------------------//
+// SparseUniformOptimizer
+//----------------------------------------------------------------------------//
+
+SparseUniformOptimizer::SparseUniformOptimizer
+(const SparseBlockMap &blocks, 
+ Field3D::MatrixFieldMapping::Ptr mapping)
+  : m_blocks(blocks), m_mapping(mapping)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+IntervalVec
+SparseUniformOptimizer::optimize(const RayState &state, 
+                                 const IntervalVec &intervals) const
+{
+  if (intervals.size() != 1) {
+    return intervals;
+  }
+
+  IntervalVec result;
+
+  const Ray &wsRay = state.wsRay;
+  const PTime &time = state.time;
+
+  // Find start voxel
+  Vector wsStart = wsRay(intervals[0].t0), vsStart;
+  m_blocks.mapping()->worldToVoxel(wsStart, vsStart, time);
+  V3i in = Imath::clip(V3i(vsStart), m_blocks.extents());
+
+  // Find start block
+  V3i bStart;
+  m_blocks.getBlockCoord(in.x, in.y, in.z, bStart.x, bStart.y, bStart.z);
+
+  // Transform ray to block space. Block space rays are parameterized just
+  // like the world space ray, so the traversal's t values can be used
+  // directly.
+  Ray bsRay;
+  worldToBlock(m_mapping, m_blocks.blockSize(), wsRay, bsRay);
+  
+  // Find runs along ray ---
+
+  // Implementation is based on:
+  // "A Fast Voxel Traversal Algorithm for Ray Tracing"
+  // John Amanatides, Andrew Woo
+  // http://www.cse.yorku.ca/~amana/research/grid.pdf
+
+  // Current block
+  int x = bStart.x, y = bStart.y, z = bStart.z;
+  // Direction to step
+  V3i sgn(sign(bsRay.dir.x), sign(bsRay.dir.y), sign(bsRay.dir.z));
+  // Distance we could step in each direction, at most
+  Vector tMax;
+  setupTraversal(bsRay, sgn, x, y, z, tMax);
+  // Size of one step in each dimension
+  Vector tDelta(sgn.x / bsRay.dir.x, sgn.y / bsRay.dir.y, sgn.z / bsRay.dir.z);
+  // Ensure there are no inf's or nan's
+  handleNaN(tDelta);
+  // Whether a run of occupied blocks is in progress
+  bool run = false;
+  // Where the current block was entered, and where the current run started
+  double tEnter = intervals[0].t0, tRun = tEnter;
+  // Where the buffer's interval ends
+  const double tEnd = intervals[0].t1;
+  // Super block size, in blocks
+  const int superSize = m_blocks.superBlockSize();
+  // Number of empty blocks and super blocks passed
+  long numSkipped = 0;
+
+  // Traverse blocks
+  while (tEnter < tEnd && m_blocks.blockIndexIsValid(x, y, z)) {
+    if (!m_blocks.superBlockIsOccupied(x, y, z)) {
+      numSkipped++;
+      if (run) {
+        result.push_back(makeInterval(wsRay, tRun, tEnter, 
+                                      m_blocks.mapping()));
+        run = false;
+      }
+      // Skip ahead to the first block past the super block
+      const V3i    super(x & ~(superSize - 1), y & ~(superSize - 1),
+                         z & ~(superSize - 1));
+      const Vector side(super.x + (sgn.x > 0 ? superSize : 0), 
+                        super.y + (sgn.y > 0 ? superSize : 0), 
+                        super.z + (sgn.z > 0 ? superSize : 0));
+      Vector       tSide((side - bsRay.pos) / bsRay.dir);
+      handleNaN(tSide);
+      const double tExit = std::min(tSide.x, std::min(tSide.y, tSide.z));
+      const Vector bsP   = bsRay(tExit);
+      x = static_cast<int>(std::floor(bsP.x));
+      y = static_cast<int>(std::floor(bsP.y));
+      z = static_cast<int>(std::floor(bsP.z));
+      // The exit point lies on the side of the super block, which floor()
+      // may not place on the far side of
+      if (tSide.x == tExit) {
+        x = sgn.x > 0 ? super.x + superSize : super.x - 1;
+      } else if (tSide.y == tExit) {
+        y = sgn.y > 0 ? super.y + superSize : super.y - 1;
+      } else {
+        z = sgn.z > 0 ? super.z + superSize : super.z - 1;
+      }
+      tEnter = std::max(tEnter, tExit);
+      setupTraversal(bsRay, sgn, x, y, z, tMax);
+      continue;
+    }
+    if (m_blocks.blockIsOccupied(x, y, z)) {
+      if (!run) {
+        tRun = tEnter;
+        run = true;
+      }
+    } else {
+      numSkipped++;
+      if (run) {
+        result.push_back(makeInterval(wsRay, tRun, tEnter, 
+                                      m_blocks.mapping()));
+        run = false;
+      }
+    }
+    // The block is left where the ray crosses its nearest side
+    tEnter = std::max(tEnter, std::min(tMax.x, std::min(tMax.y, tMax.z)));
+    stepToNextBlock(tDelta, sgn, tMax, x, y, z);
+  }
+
+  if (run) {
+    result.push_back(makeInterval(wsRay, tRun, std::min(tEnter, tEnd), 
+                                  m_blocks.mapping()));
+  }
+
+  Sys::Stats::add(Sys::Stats::EsoBlocksSkipped, numSkipped);
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+//----------------------------------------------------------------------------//
+// SparseFrustumOptimizer
+//----------------------------------------------------------------------------//
+
+SparseFrustumOptimizer::SparseFrustumOptimizer
+(const SparseBlockMap &blocks, 
+ Field3D::FrustumFieldMapping::Ptr mapping)
+  : m_blocks(blocks), m_mapping(mapping)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+IntervalVec
+SparseFrustumOptimizer::optimize(const RayState &state, 
+                                 const IntervalVec &intervals) const
+{
+  if (intervals.size() != 1) {
+    return intervals;
+  }
+
+  IntervalVec result;
+  const Ray &wsRay = state.wsRay;
+  const PTime &time = state.time;
+  const double tStart = intervals[0].t0, tEnd = intervals[0].t1;
+
+  // Find start and end voxel
+  Vector vsStart, vsEnd;
+  m_blocks.mapping()->worldToVoxel(wsRay(tStart), vsStart, time);
+  m_blocks.mapping()->worldToVoxel(wsRay(tEnd), vsEnd, time);
+  V3i in = Imath::clip(V3i(vsStart), m_blocks.extents());
+  V3i out = Imath::clip(V3i(vsEnd), m_blocks.extents());
+
+  // Find start and end block
+  V3i bStart, bEnd;
+  m_blocks.getBlockCoord(in.x, in.y, in.z, bStart.x, bStart.y, bStart.z);
+  m_blocks.getBlockCoord(out.x, out.y, out.z, bEnd.x, bEnd.y, bEnd.z);
+
+  // Find runs along ray ---
+
+  // Block boundaries are planes in world space, and each voxel space 
+  // coordinate changes monotonically along a straight ray. The ray 
+  // therefore visits exactly the blocks of a 3D DDA from bStart to bEnd, 
+  // with each step taken across the nearest of the next boundary planes.
+
+  // Current block
+  V3i b(bStart);
+  // Direction to step
+  const V3i sgn(sign(bEnd.x - bStart.x), sign(bEnd.y - bStart.y), 
+                sign(bEnd.z - bStart.z));
+  // Ray parameter of the next boundary crossing in each dimension
+  Vector tNext;
+  for (int axis = 0; axis < 3; ++axis) {
+    tNext[axis] = sgn[axis] == 0 ? tEnd :
+      boundaryT(wsRay, time, axis, b[axis] + (sgn[axis] > 0 ? 1 : 0));
+  }
+  // Start of the current block and of the current run
+  double t0 = tStart, runStart = tStart;
+  bool run = false;
+  // Number of empty blocks passed
+  long numSkipped = 0;
+
+  // Traverse blocks. Each step moves one block closer to bEnd, so this 
+  // terminates after visiting at most |bEnd - bStart|_1 + 1 blocks.
+  while (true) {
+    // Find the dimension whose boundary is crossed first
+    int axis = -1;
+    for (int a = 0; a < 3; ++a) {
+      if (b[a] != bEnd[a] && (axis < 0 || tNext[a] < tNext[axis])) {
+        axis = a;
+      }
+    }
+    const double t1 = 
+      axis < 0 ? tEnd : std::min(std::max(tNext[axis], t0), tEnd);
+    if (m_blocks.blockIsOccupied(b.x, b.y, b.z)) {
+      if (!run) {
+        runStart = t0;
+        run = true;
+      }
+    } else {
+      numSkipped++;
+      if (run) {
+        appendFrustumIntervals(wsRay, runStart, t0, m_mapping, result);
+        run = false;
+      }
+    }
+    if (axis < 0) {
+      break;
+    }
+    // Step to next block
+    t0 = t1;
+    b[axis] += sgn[axis];
+    tNext[axis] = 
+      boundaryT(wsRay, time, axis, b[axis] + (sgn[axis] > 0 ? 1 : 0));
+  }
+
+  if (run) {
+    appendFrustumIntervals(wsRay, runStart, tEnd, m_mapping, result);
+  }
+
+  Sys::Stats::add(Sys::Stats::EsoBlocksSkipped, numSkipped);
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+double 
+SparseFrustumOptimizer::boundaryT(const Ray &wsRay, const PTime time,
+                                  const int axis, const int block) const
+{
+  // Three voxel space points on the boundary, transformed to world space
+  const Field3D::Box3i &extents = m_blocks.extents();
+  Vector vsP[3];
+  vsP[0] = Vector(extents.min);
+  vsP[1] = Vector(extents.min);
+  vsP[2] = Vector(extents.min);
+  vsP[1][(axis + 1) % 3] = extents.max[(axis + 1) % 3] + 1;
+  vsP[2][(axis + 2) % 3] = extents.max[(axis + 2) % 3] + 1;
+  Vector wsP[3];
+  for (int i = 0; i < 3; ++i) {
+    vsP[i][axis] = block * m_blocks.blockSize();
+    Vector lsP;
+    m_mapping->voxelToLocal(vsP[i], lsP);
+    m_mapping->localToWorld(lsP, wsP[i], time);
+  }
+  // Intersect ray with the boundary plane
+  double t;
+  if (Plane(wsP[0], wsP[1], wsP[2]).intersectT(wsRay, t)) {
+    return t;
+  }
+  return std::numeric_limits<double>::max();
+}
+
+//----------------------------------------------------------------------------//
+// VoxelStorage
+//----------------------------------------------------------------------------//
+
+class VoxelStorage
+{
+public:
+
+  // Ctor, dtor ----------------------------------------------------------------
+
+  virtual ~VoxelStorage()
+  { }
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Returns the mapping of the full resolution buffer
+  virtual FieldMapping::Ptr mapping() const = 0;
+  //! Returns the data window of the full resolution buffer
+  virtual Box3i             dataWindow() const = 0;
+  //! Returns the number of mip levels, including the full resolution one
+  virtual size_t            numLevels() const = 0;
+  //! Interpolates the given mip level. vsP is in that level's voxel space.
+  virtual V3f               interpolate(const size_t level, 
+                                        const VoxelVolume::InterpType type,
+                                        const Vector &vsP) const = 0;
+  //! Returns the size of majorant grid cells, in voxels
+  virtual int               majorantCellSize() const = 0;
+  //! Returns the maximum voxel value in the given majorant grid cell
+  virtual V3f               majorantCellMax(const V3i &cell, 
+                                            const int cellSize) const = 0;
+  //! Returns the per-block maxima of the full resolution buffer, which 
+  //! empty space optimizers are built from, or null if the buffer is empty.
+  //! Built by the first call.
+  virtual const SparseBlockMap* blocks() const = 0;
+  //! Builds the coarser mip levels, or clears them if enabled is false
+  virtual void              buildMipLevels(const bool enabled) = 0;
+  //! Builds the prefiltered copy of the full resolution buffer that the
+  //! given interpolation type is looked up in, or clears it if the type
+  //! doesn't use one.
+  virtual void              prefilter(const VoxelVolume::InterpType type) = 0;
+  //! Returns whether a prefiltered copy of the full resolution buffer 
+  //! exists
+  virtual bool              isPrefiltered() const = 0;
+  //! Returns the buffer type, e.g. "SparseField<half>"
+  virtual std::string       typeName() const = 0;
+  //! Returns the memory used by all mip levels, in bytes
+  virtual size_t            memSize() const = 0;
+  //! Returns the full resolution buffer, or null if it isn't a Field3D 
+  //! field
+  virtual FieldRes::Ptr     field() const = 0;
+};
+
+//----------------------------------------------------------------------------//
+// VoxelStorage helpers
+//----------------------------------------------------------------------------//
+
+//! The Field3D interpolators for one voxel type. The other interpolation
+//! types use the kernels below, which know the concrete buffer type.
+template <typename Data_T>
+struct Interpolators
+{
+  CubicFieldInterp<Data_T> monotonicCubic;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether the Width^3 taps starting at c are all inside dw.
+template <int Width>
+bool tapsInside(const Box3i &dw, const V3i &c)
+{
+  return c.x >= dw.min.x && c.x + Width - 1 <= dw.max.x && 
+         c.y >= dw.min.y && c.y + Width - 1 <= dw.max.y && 
+         c.z >= dw.min.z && c.z + Width - 1 <= dw.max.z;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the Width^3 taps starting at c, clamped to the data window. The 
+//! values are indexed [x][y][z], as the Field3D interpolators expect.
+template <int Width, typename Field_T, typename Accum_T>
+void gatherClamped(const Field_T &field, const V3i &c, 
+                   Accum_T values[Width][Width][Width])
+{
+  const Box3i &dw = field.dataWindow();
+  for (int k = 0; k < Width; ++k) {
+    const int kIdx = Imath::clamp(c.z + k, dw.min.z, dw.max.z);
+    for (int j = 0; j < Width; ++j) {
+      const int jIdx = Imath::clamp(c.y + j, dw.min.y, dw.max.y);
+      for (int i = 0; i < Width; ++i) {
+        const int iIdx = Imath::clamp(c.x + i, dw.min.x, dw.max.x);
+        values[i][j][k] = accum(field.fastValue(iIdx, jIdx, kIdx));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the taps of a dense buffer. Taps inside the data window are read
+//! straight from the voxel array, without clamping.
+template <int Width, typename Data_T, typename Accum_T>
+void gatherTaps(const DenseField<Data_T> &field, const V3i &c, 
+                Accum_T values[Width][Width][Width])
+{
+  const Box3i &dw = field.dataWindow();
+  if (!tapsInside<Width>(dw, c)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  // DenseField stores x fastest, then y, then z
+  const V3i     res     = dw.size() + V3i(1);
+  const size_t  yStride = res.x;
+  const size_t  zStride = yStride * res.y;
+  const Data_T *origin  = &field.fastValue(c.x, c.y, c.z);
+  for (int k = 0; k < Width; ++k) {
+    for (int j = 0; j < Width; ++j) {
+      const Data_T *row = origin + k * zStride + j * yStride;
+      for (int i = 0; i < Width; ++i) {
+        values[i][j][k] = accum(row[i]);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the taps of a sparse buffer. When all taps fall inside one 
+//! block, the block is resolved once: an unallocated block fills all taps
+//! with its empty value, and an allocated one is read without clamping.
+template <int Width, typename Data_T, typename Accum_T>
+void gatherTaps(const SparseField<Data_T> &field, const V3i &c, 
+                Accum_T values[Width][Width][Width])
+{
+  const Box3i &dw = field.dataWindow();
+  if (!tapsInside<Width>(dw, c)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  // Block coordinates are relative to the data window's minimum
+  const int order = field.blockOrder();
+  const V3i min   = c - dw.min;
+  const V3i max   = min + V3i(Width - 1);
+  const V3i block(min.x >> order, min.y >> order, min.z >> order);
+  if (block != V3i(max.x >> order, max.y >> order, max.z >> order)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  if (!field.blockIsAllocated(block.x, block.y, block.z)) {
+    const Accum_T empty = 
+      accum(field.getBlockEmptyValue(block.x, block.y, block.z));
+    std::fill(&values[0][0][0], &values[0][0][0] + Width * Width * Width, 
+              empty);
+    return;
+  }
+  for (int k = 0; k < Width; ++k) {
+    for (int j = 0; j < Width; ++j) {
+      for (int i = 0; i < Width; ++i) {
+        values[i][j][k] = accum(field.fastValue(c.x + i, c.y + j, c.z + k));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the taps of a bricked buffer. When all taps fall inside one 
+//! brick, the brick is resolved once and the taps are read from it 
+//! directly.
+template <int Width, typename Data_T, typename Accum_T>
+void gatherTaps(const BrickedBuffer<Data_T> &field, const V3i &c, 
+                Accum_T values[Width][Width][Width])
+{
+  const Box3i &dw = field.dataWindow();
+  if (!tapsInside<Width>(dw, c)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  // Brick coordinates are relative to the data window's minimum
+  const int order = field.blockOrder();
+  const V3i min   = c - dw.min;
+  const V3i max   = min + V3i(Width - 1);
+  const V3i brick(min.x >> order, min.y >> order, min.z >> order);
+  if (brick != V3i(max.x >> order, max.y >> order, max.z >> order)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  const Data_T *data  = field.brickData(brick.x, brick.y, brick.z);
+  const V3i     local = min - brick * (1 << order);
+  for (int k = 0; k < Width; ++k) {
+    for (int j = 0; j < Width; ++j) {
+      for (int i = 0; i < Width; ++i) {
+        values[i][j][k] = 
+          accum(data[field.brickOffset(local.x + i, local.y + j, 
+                                       local.z + k)]);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the taps of a compressed buffer. When all taps fall inside one 
+//! block, the block is decompressed or found in the block cache once, 
+//! rather than once per tap.
+template <int Width, typename Data_T, typename Accum_T>
+void gatherTaps(const CompressedBuffer<Data_T> &field, const V3i &c, 
+                Accum_T values[Width][Width][Width])
+{
+  const Box3i &dw = field.dataWindow();
+  if (!tapsInside<Width>(dw, c)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  // Block coordinates are relative to the data window's minimum
+  const int order = field.blockOrder();
+  const V3i min   = c - dw.min;
+  const V3i max   = min + V3i(Width - 1);
+  const V3i block(min.x >> order, min.y >> order, min.z >> order);
+  if (block != V3i(max.x >> order, max.y >> order, max.z >> order)) {
+    gatherClamped<Width>(field, c, values);
+    return;
+  }
+  if (!field.blockIsAllocated(block.x, block.y, block.z)) {
+    const Accum_T empty = 
+      accum(field.getBlockEmptyValue(block.x, block.y, block.z));
+    std::fill(&values[0][0][0], &values[0][0][0] + Width * Width * Width, 
+              empty);
+    return;
+  }
+  const Data_T *data  = field.blockData(block.x, block.y, block.z);
+  const V3i     local = min - block * (1 << order);
+  for (int k = 0; k < Width; ++k) {
+    for (int j = 0; j < Width; ++j) {
+      for (int i = 0; i < Width; ++i) {
+        values[i][j][k] = 
+          accum(data[field.blockOffset(local.x + i, local.y + j, 
+                                       local.z + k)]);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+#if defined(PVR_VOXEL_SIMD)
+
+//! Loads a V3f into the first three lanes. The last lane is zero.
+inline __m128 load3(const V3f &v)
+{ return _mm_set_ps(0.0f, v.z, v.y, v.x); }
+
+//----------------------------------------------------------------------------//
+
+//! Returns the first three lanes as a V3f
+inline V3f store3(const __m128 v)
+{
+  float lanes[4];
+  _mm_storeu_ps(lanes, v);
+  return V3f(lanes[0], lanes[1], lanes[2]);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the sum of the four lanes
+inline float sum4(const __m128 v)
+{
+  const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns w0 * a + w1 * b
+inline __m128 blend(const __m128 a, const __m128 b, const float w0, 
+                    const float w1)
+{
+  return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w0), a), 
+                    _mm_mul_ps(_mm_set1_ps(w1), b));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the weighted sum of four lanes or voxels
+inline __m128 blend(const __m128 v[4], const float w[4])
+{
+  return _mm_add_ps(blend(v[0], v[1], w[0], w[1]), 
+                    blend(v[2], v[3], w[2], w[3]));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Catmull-Rom weights of the four taps around fractional position x. 
+//! These are the coefficients of cubicInterp().
+inline void cubicWeights(const float x, float w[4])
+{
+  const float x2 = x * x;
+  const float x3 = x2 * x;
+  w[0] = 0.5f * (2.0f * x2 - x - x3);
+  w[1] = 0.5f * (2.0f - 5.0f * x2 + 3.0f * x3);
+  w[2] = 0.5f * (x + 4.0f * x2 - 3.0f * x3);
+  w[3] = 0.5f * (x3 - x2);
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+//! Trilinear kernel, matching Field3D::LinearFieldInterp. The compiler 
+//! does better with eight taps than an explicit SSE2 version does.
+struct LinearKernel
+{
+  static const int width = 2;
+  template <typename Accum_T>
+  Accum_T operator () (const V3f &f1, Accum_T values[2][2][2]) const
+  { 
+    const V3f f0 = V3f(1.0f) - f1;
+    return 
+      f0.z * (f0.y * (f0.x * values[0][0][0] + f1.x * values[1][0][0]) +
+              f1.y * (f0.x * values[0][1][0] + f1.x * values[1][1][0])) +
+      f1.z * (f0.y * (f0.x * values[0][0][1] + f1.x * values[1][0][1]) +
+              f1.y * (f0.x * values[0][1][1] + f1.x * values[1][1][1]));
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Catmull-Rom kernel, matching TriCubicFieldInterp. With SSE2, scalar 
+//! and V3f taps are blended four lanes at a time.
+struct CubicKernel
+{
+  static const int width = 4;
+  template <typename Accum_T>
+  Accum_T operator () (const V3f &x, Accum_T values[4][4][4]) const
+  { return tricubicInterp(x.x, x.y, x.z, values); }
+#if defined(PVR_VOXEL_SIMD)
+  float operator () (const V3f &x, float values[4][4][4]) const
+  {
+    float wx[4], wy[4], wz[4];
+    cubicWeights(x.x, wx);
+    cubicWeights(x.y, wy);
+    cubicWeights(x.z, wz);
+    // Rows along z are four contiguous taps. Blend the rows in y and x, 
+    // then blend the remaining z row as a dot product.
+    __m128 yBlends[4];
+    for (int i = 0; i < 4; ++i) {
+      __m128 rows[4];
+      for (int j = 0; j < 4; ++j) {
+        rows[j] = _mm_loadu_ps(values[i][j]);
+      }
+      yBlends[i] = blend(rows, wy);
+    }
+    return sum4(_mm_mul_ps(blend(yBlends, wx), _mm_loadu_ps(wz)));
+  }
+  V3f operator () (const V3f &x, V3f values[4][4][4]) const
+  {
+    float wx[4], wy[4], wz[4];
+    cubicWeights(x.x, wx);
+    cubicWeights(x.y, wy);
+    cubicWeights(x.z, wz);
+    __m128 yBlends[4];
+    for (int i = 0; i < 4; ++i) {
+      __m128 zBlends[4];
+      for (int j = 0; j < 4; ++j) {
+        __m128 taps[4];
+        for (int k = 0; k < 4; ++k) {
+          taps[k] = load3(values[i][j][k]);
+        }
+        zBlends[j] = blend(taps, wz);
+      }
+      yBlends[i] = blend(zBlends, wy);
+    }
+    return store3(blend(yBlends, wx));
+  }
+#endif
+};
+
+//----------------------------------------------------------------------------//
+
+//! Separable filter kernel, matching GaussianFieldInterp and 
+//! MitchellFieldInterp
+template <typename Filt_T>
+struct FilterKernel
+{
+  static const int width = Filt_T::width;
+  template <typename Accum_T>
+  Accum_T operator () (const V3f &x, 
+                       Accum_T values[width][width][width]) const
+  { return Filter::filter3D<Accum_T, Filt_T>(x.x, x.y, x.z, values, 
+                                             m_filter); }
+  Filt_T m_filter;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Interpolates a DenseField or SparseField using the given kernel. The 
+//! taps are gathered without virtual calls and filtered in the voxel 
+//! type's Accum type.
+template <typename Kernel_T, typename Field_T>
+V3f sampleKernel(const Field_T &field, const Vector &vsP, 
+                 const Kernel_T &kernel)
+{
+  typedef typename Accum<typename Field_T::value_type>::type Accum_T;
+
+  const int width = Kernel_T::width;
+
+  // Voxel centers are at .5 coordinates
+  const Vector p = vsP - Vector(0.5);
+  const V3i    base(static_cast<int>(std::floor(p.x)), 
+                    static_cast<int>(std::floor(p.y)), 
+                    static_cast<int>(std::floor(p.z)));
+  const V3f    x(p - Vector(base));
+
+  Accum_T values[width][width][width];
+  gatherTaps<width>(field, base - V3i(width / 2 - 1), values);
+
+  return toV3f(kernel(x, values));
+}
+
+//----------------------------------------------------------------------------//
+
+//! The monotonic cubic interpolator is Field3D's own, and still reads 
+//! through Field::value().
+template <typename Data_T>
+V3f sampleMonotonicCubic(const Interpolators<Data_T> &interp, 
+                         const Field<Data_T> &field, const Vector &vsP)
+{
+  return toV3f(interp.monotonicCubic.sample(field, vsP));
+}
+
+//----------------------------------------------------------------------------//
+
+//! BrickedBuffer isn't a Field3D::Field, so monotonic cubic interpolation
+//! falls back to plain cubic interpolation.
+template <typename Data_T>
+V3f sampleMonotonicCubic(const Interpolators<Data_T> &, 
+                         const BrickedBuffer<Data_T> &field, 
+                         const Vector &vsP)
+{
+  return sampleKernel(field, vsP, CubicKernel());
+}
+
+//----------------------------------------------------------------------------//
+
+//! CompressedBuffer isn't a Field3D::Field either.
+template <typename Data_T>
+V3f sampleMonotonicCubic(const Interpolators<Data_T> &, 
+                         const CompressedBuffer<Data_T> &field, 
+                         const Vector &vsP)
+{
+  return sampleKernel(field, vsP, CubicKernel());
+}
+
+//----------------------------------------------------------------------------//
+
+//! Interpolates a DenseField, SparseField, BrickedBuffer or 
+//! CompressedBuffer.
+template <typename Field_T>
+V3f interpolateFieldKernel(const Interpolators<typename Field_T::value_type> 
+                           &interp, const Field_T &field, 
+                           const VoxelVolume::InterpType type, 
+                           const Vector &vsP)
+{
+  switch (type) {
+  case VoxelVolume::NoInterp:
+    {
+      const V3i dvsP = Imath::clip(contToDisc(vsP), field.dataWindow());
+      return toV3f(field.fastValue(dvsP.x, dvsP.y, dvsP.z));
+    }
+  case VoxelVolume::CubicInterp:
+    return sampleKernel(field, vsP, CubicKernel());
+  case VoxelVolume::MonotonicCubicInterp:
+    return sampleMonotonicCubic(interp, field, vsP);
+  case VoxelVolume::GaussianInterp:
+    return sampleKernel(field, vsP, FilterKernel<Filter::Gaussian>());
+  case VoxelVolume::MitchellInterp:
+    return sampleKernel(field, vsP, 
+                        FilterKernel<Filter::MitchellNetravali>());
+  case VoxelVolume::LinearInterp:
+  default:
+    return sampleKernel(field, vsP, LinearKernel());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3f interpolateField(const Interpolators<Data_T> &interp, 
+                     const DenseField<Data_T> &field, 
+                     const VoxelVolume::InterpType type, const Vector &vsP)
+{
+  return interpolateFieldKernel(interp, field, type, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3f interpolateField(const Interpolators<Data_T> &interp, 
+                     const SparseField<Data_T> &field, 
+                     const VoxelVolume::InterpType type, const Vector &vsP)
+{
+  return interpolateFieldKernel(interp, field, type, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3f interpolateField(const Interpolators<Data_T> &interp, 
+                     const BrickedBuffer<Data_T> &field, 
+                     const VoxelVolume::InterpType type, const Vector &vsP)
+{
+  return interpolateFieldKernel(interp, field, type, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3f interpolateField(const Interpolators<Data_T> &interp, 
+                     const CompressedBuffer<Data_T> &field, 
+                     const VoxelVolume::InterpType type, const Vector &vsP)
+{
+  return interpolateFieldKernel(interp, field, type, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+//! QuantizedBuffer isn't a Field3D::Field, so it can't use the Field3D 
+//! interpolators. All interpolation types except NoInterp use trilinear
+//! interpolation, which matches Field3D::LinearFieldInterp.
+template <typename Code_T>
+V3f interpolateField(const Interpolators<float> &, 
+                     const QuantizedBuffer<Code_T> &field, 
+                     const VoxelVolume::InterpType type, const Vector &vsP)
+{
+  const Box3i &dw = field.dataWindow();
+
+  if (type == VoxelVolume::NoInterp) {
+    const V3i dvsP = Imath::clip(contToDisc(vsP), dw);
+    return V3f(field.fastValue(dvsP.x, dvsP.y, dvsP.z));
+  }
+
+  // Voxel centers are at .5 coordinates
+  const Vector p  = vsP - Vector(0.5);
+  const V3i    c  = V3i(static_cast<int>(std::floor(p.x)), 
+                        static_cast<int>(std::floor(p.y)), 
+                        static_cast<int>(std::floor(p.z)));
+  const V3f    f1 = V3f(p - Vector(c));
+  const V3f    f0 = V3f(1.0f) - f1;
+  const V3i    c0 = Imath::clip(c, dw);
+  const V3i    c1 = Imath::clip(c + V3i(1), dw);
+
+  const float value = 
+    f0.z * (f0.y * (f0.x * field.fastValue(c0.x, c0.y, c0.z) + 
+                    f1.x * field.fastValue(c1.x, c0.y, c0.z)) +
+            f1.y * (f0.x * field.fastValue(c0.x, c1.y, c0.z) + 
+                    f1.x * field.fastValue(c1.x, c1.y, c0.z))) +
+    f1.z * (f0.y * (f0.x * field.fastValue(c0.x, c0.y, c1.z) + 
+                    f1.x * field.fastValue(c1.x, c0.y, c1.z)) +
+            f1.y * (f0.x * field.fastValue(c0.x, c1.y, c1.z) + 
+                    f1.x * field.fastValue(c1.x, c1.y, c1.z)));
+
+  return V3f(value);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Creates the empty space optimizer for the given block map
+EmptySpaceOptimizer::CPtr createOptimizer(const SparseBlockMap &blocks)
+{
+  MatrixFieldMapping::Ptr mMapping = 
+    field_dynamic_cast<MatrixFieldMapping>(blocks.mapping());
+  FrustumFieldMapping::Ptr fMapping = 
+    field_dynamic_cast<FrustumFieldMapping>(blocks.mapping());
+  if (mMapping) {
+    return SparseUniformOptimizer::create(blocks, mMapping);
+  } else if (fMapping) {
+    return SparseFrustumOptimizer::create(blocks, fMapping);
+  } 
+  Log::warning("VoxelVolume::setBuffer(): Unrecognized mapping type.");
+  return EmptySpaceOptimizer::CPtr();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+std::string storageTypeName(const DenseField<Data_T> &)
+{
+  return "DenseField<" + voxelTypeName(Data_T()) + ">";
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+std::string storageTypeName(const SparseField<Data_T> &)
+{
+  return "SparseField<" + voxelTypeName(Data_T()) + ">";
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+std::string storageTypeName(const BrickedBuffer<Data_T> &field)
+{
+  return "BrickedBuffer<" + voxelTypeName(Data_T()) + ", " + 
+    str(field.blockSize()) + "^3>";
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Code_T>
+std::string storageTypeName(const QuantizedBuffer<Code_T> &)
+{
+  return "QuantizedBuffer<" + str(sizeof(Code_T) * 8) + " bit>";
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+std::string storageTypeName(const CompressedBuffer<Data_T> &)
+{
+  return "CompressedBuffer<" + voxelTypeName(Data_T()) + ", " + 
+    Sys::BlockCache::codecName() + ">";
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns a Field3D field as a FieldRes
+template <typename Field_T>
+FieldRes::Ptr fieldRes(const boost::intrusive_ptr<Field_T> &field)
+{
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Buffers that aren't Field3D fields have no FieldRes
+template <typename Field_T>
+FieldRes::Ptr fieldRes(const boost::shared_ptr<Field_T> &)
+{
+  return FieldRes::Ptr();
+}
+
+//----------------------------------------------------------------------------//
+// Prefiltering
+//----------------------------------------------------------------------------//
+
+//! Returns the weights that the filter gives the taps at offsets -1, 0 and
+//! 1 from a voxel center. Both filters are zero at offset 2, so these are
+//! all the taps that Filter::filter1D() uses at voxel centers.
+template <typename Filt_T>
+void centerWeights(const Filt_T &filter, float weights[3])
+{
+  const float sum = filter(0.0f) + 2.0f * filter(1.0f);
+  weights[0] = weights[2] = filter(1.0f) / sum;
+  weights[1] = filter(0.0f) / sum;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Filters voxel c along the given axis, clamping the taps to the data 
+//! window.
+template <typename Field_T>
+typename Field_T::value_type 
+filterVoxel(const Field_T &field, const int axis, const float *weights, 
+            const V3i &c)
+{
+  typedef typename Field_T::value_type Data_T;
+
+  const Box3i &dw = field.dataWindow();
+  V3i lo(c), hi(c);
+  lo[axis] = std::max(c[axis] - 1, dw.min[axis]);
+  hi[axis] = std::min(c[axis] + 1, dw.max[axis]);
+  return Data_T(weights[0] * accum(field.fastValue(lo.x, lo.y, lo.z)) + 
+                weights[1] * accum(field.fastValue(c.x, c.y, c.z)) + 
+                weights[2] * accum(field.fastValue(hi.x, hi.y, hi.z)));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Filters z slices [begin, end) of a DenseField or BrickedBuffer along the
+//! given axis.
+template <typename Field_T>
+void filterSlices(const Field_T &in, Field_T &out, const int axis, 
+                  const float *weights, const size_t begin, const size_t end)
+{
+  const Box3i &dw = in.dataWindow();
+  for (int k = dw.min.z + static_cast<int>(begin), 
+         kEnd = dw.min.z + static_cast<int>(end); k < kEnd; ++k) {
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        out.fastLValue(i, j, k) = filterVoxel(in, axis, weights, V3i(i, j, k));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Filters rows [begin, end) of blocks of a SparseField along the given 
+//! axis. A block stays unallocated if it and its neighbors along the axis
+//! are unallocated and share its empty value.
+template <typename Data_T>
+void filterBlocks(const SparseField<Data_T> &in, SparseField<Data_T> &out, 
+                  const int axis, const float *weights, const size_t begin, 
+                  const size_t end)
+{
+  const Box3i &dw = in.dataWindow();
+  const V3i    blockRes = in.blockRes();
+  const int    blockSize = in.blockSize();
+
+  for (int bk = static_cast<int>(begin); bk < static_cast<int>(end); ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        const V3i block(bi, bj, bk);
+        const Data_T empty = in.getBlockEmptyValue(bi, bj, bk);
+        bool isConstant = true;
+        for (int offset = -1; offset <= 1 && isConstant; ++offset) {
+          V3i b(block);
+          b[axis] = Imath::clamp(b[axis] + offset, 0, blockRes[axis] - 1);
+          isConstant = !in.blockIsAllocated(b.x, b.y, b.z) && 
+            in.getBlockEmptyValue(b.x, b.y, b.z) == empty;
+        }
+        if (isConstant) {
+          out.setBlockEmptyValue(bi, bj, bk, empty);
+          continue;
+        }
+        V3i min, max;
+        cellBounds(dw, block, blockSize, min, max);
+        for (int k = min.z; k <= max.z; ++k) {
+          for (int j = min.y; j <= max.y; ++j) {
+            for (int i = min.x; i <= max.x; ++i) {
+              out.fastLValue(i, j, k) = 
+                filterVoxel(in, axis, weights, V3i(i, j, k));
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Runs func over numItems slices or block rows on all threads
+void runPrefilterPass(const size_t numItems, 
+                      const boost::function<void (size_t, size_t)> &func)
+{
+  Util::ProgressReporter progress(std::numeric_limits<float>::max());
+  Sys::parallelFor(numItems, 1, func, Sys::numThreads(), progress);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename DenseField<Data_T>::Ptr
+prefilterPass(const DenseField<Data_T> &field, const int axis, 
+              const float *weights)
+{
+  typename DenseField<Data_T>::Ptr out(new DenseField<Data_T>);
+  out->setSize(field.extents(), field.dataWindow());
+  out->setMapping(field.mapping());
+  runPrefilterPass(field.dataResolution().z, 
+                   boost::bind(&filterSlices<DenseField<Data_T> >, 
+                               boost::cref(field), boost::ref(*out), axis, 
+                               weights, _1, _2));
+  return out;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SparseField<Data_T>::Ptr
+prefilterPass(const SparseField<Data_T> &field, const int axis, 
+              const float *weights)
+{
+  typename SparseField<Data_T>::Ptr out(new SparseField<Data_T>);
+  out->setBlockOrder(field.blockOrder());
+  out->setSize(field.extents(), field.dataWindow());
+  out->setMapping(field.mapping());
+  runPrefilterPass(field.blockRes().z, 
+                   boost::bind(&filterBlocks<Data_T>, boost::cref(field), 
+                               boost::ref(*out), axis, weights, _1, _2));
+  return out;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename BrickedBuffer<Data_T>::Ptr
+prefilterPass(const BrickedBuffer<Data_T> &field, const int axis, 
+              const float *weights)
+{
+  typename BrickedBuffer<Data_T>::Ptr 
+    out(new BrickedBuffer<Data_T>(field.extents(), field.dataWindow(), 
+                                  field.blockOrder()));
+  out->setMapping(field.mapping());
+  const Box3i &dw = field.dataWindow();
+  runPrefilterPass(dw.isEmpty() ? 0 : dw.max.z - dw.min.z + 1, 
+                   boost::bind(&filterSlices<BrickedBuffer<Data_T> >, 
+                               boost::cref(field), boost::ref(*out), axis, 
+                               weights, _1, _2));
+  return out;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Convolves a buffer with the discrete kernel of the given interpolation
+//! type, one axis at a time. Trilinear interpolation of the result matches
+//! the filter exactly at voxel centers, and closely in between. 
+//! \returns Null if the interpolation type doesn't need a prefiltered 
+//! buffer.
+template <typename Field_T>
+typename Field_T::Ptr prefilterField(const Field_T &field, 
+                                     const VoxelVolume::InterpType type)
+{
+  float weights[3];
+  switch (type) {
+  case VoxelVolume::GaussianInterp:
+    centerWeights(Filter::Gaussian(), weights);
+    break;
+  case VoxelVolume::MitchellInterp:
+    centerWeights(Filter::MitchellNetravali(), weights);
+    break;
+  default:
+    return typename Field_T::Ptr();
+  }
+  typename Field_T::Ptr result = prefilterPass(field, 0, weights);
+  result = prefilterPass(*result, 1, weights);
+  return prefilterPass(*result, 2, weights);
+}
+
+//----------------------------------------------------------------------------//
+
+//! QuantizedBuffer only supports trilinear interpolation, so there is 
+//! nothing to prefilter.
+template <typename Code_T>
+typename QuantizedBuffer<Code_T>::Ptr 
+prefilterField(const QuantizedBuffer<Code_T> &, 
+               const VoxelVolume::InterpType)
+{
+  return typename QuantizedBuffer<Code_T>::Ptr();
+}
+
+//----------------------------------------------------------------------------//
+
+//! A prefiltered copy would have to be compressed as well, and the filter
+//! kernels read the compressed buffer just as well, so CompressedBuffer 
+//! isn't prefiltered.
+template <typename Data_T>
+typename CompressedBuffer<Data_T>::Ptr 
+prefilterField(const CompressedBuffer<Data_T> &, 
+               const VoxelVolume::InterpType)
+{
+  return typename CompressedBuffer<Data_T>::Ptr();
+}
+
+//----------------------------------------------------------------------------//
+// FieldStorage
+//----------------------------------------------------------------------------//
+
+//! VoxelStorage for a DenseField, SparseField, BrickedBuffer, 
+//! QuantizedBuffer or CompressedBuffer. Mip levels are stored using the 
+//! same type as the full resolution buffer.
+template <typename Field_T>
+class FieldStorage : public VoxelStorage
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename Field_T::value_type Data_T;
+  typedef typename Field_T::Ptr        FieldPtr;
+
+  // Ctor ----------------------------------------------------------------------
+
+  FieldStorage(FieldPtr field)
+    : m_levels(1, field), m_prefilterType(VoxelVolume::LinearInterp)
+  { }
+
+  // From VoxelStorage ---------------------------------------------------------
+
+  virtual FieldMapping::Ptr mapping() const
+  { return m_levels[0]->mapping(); }
+  virtual Box3i dataWindow() const
+  { return m_levels[0]->dataWindow(); }
+  virtual size_t numLevels() const
+  { return m_levels.size(); }
+  virtual V3f interpolate(const size_t level, 
+                          const VoxelVolume::InterpType type,
+                          const Vector &vsP) const
+  { 
+    if (level == 0 && m_prefiltered && type == m_prefilterType) {
+      return interpolateField(m_interp, *m_prefiltered, 
+                              VoxelVolume::LinearInterp, vsP);
+    }
+    return interpolateField(m_interp, *m_levels[level], type, vsP); 
+  }
+  virtual int majorantCellSize() const
+  { return ::majorantCellSize(*m_levels[0]); }
+  virtual V3f majorantCellMax(const V3i &cell, const int cellSize) const
+  { return ::majorantCellMax(*m_levels[0], cell, cellSize); }
+  virtual const SparseBlockMap* blocks() const;
+  virtual void buildMipLevels(const bool enabled);
+  virtual void prefilter(const VoxelVolume::InterpType type);
+  virtual bool isPrefiltered() const
+  { return m_prefiltered.get() != NULL; }
+  virtual std::string typeName() const
+  { return storageTypeName(*m_levels[0]); }
+  virtual size_t memSize() const;
+  virtual FieldRes::Ptr field() const
+  { return fieldRes(m_levels[0]); }
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! Mip levels, the full resolution buffer being the first. Voxel (i, j, k)
+  //! of a level is the average of voxels (2i..2i+1, 2j..2j+1, 2k..2k+1) of
+  //! the level before it.
+  std::vector<FieldPtr> m_levels;
+  //! The full resolution buffer convolved with the discrete kernel of 
+  //! m_prefilterType. Lookups of that type into the full resolution 
+  //! buffer interpolate it trilinearly instead. Coarser mip levels are 
+  //! still looked up with the full kernel.
+  FieldPtr              m_prefiltered;
+  //! Interpolation type that m_prefiltered was built for
+  VoxelVolume::InterpType m_prefilterType;
+  //! Interpolators for the voxel type
+  Interpolators<Data_T> m_interp;
+  //! Per-block maxima of the full resolution buffer. Built by the first 
+  //! call to blocks().
+  mutable boost::shared_ptr<SparseBlockMap> m_blocks;
+};
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T>
+const SparseBlockMap* FieldStorage<Field_T>::blocks() const
+{
+  if (m_levels[0]->dataWindow().isEmpty()) {
+    return NULL;
+  }
+  if (!m_blocks) {
+    m_blocks.reset(new SparseBlockMap(blockMap(*m_levels[0])));
+  }
+  return m_blocks.get();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T>
+void FieldStorage<Field_T>::buildMipLevels(const bool enabled)
+{
+  m_levels.resize(1);
+  if (!enabled) {
+    return;
+  }
+  // Halve the resolution until a single voxel remains
+  while (m_levels.size() <= k_maxMipLevels) {
+    const V3i res = m_levels.back()->dataWindow().size() + V3i(1);
+    if (std::max(res.x, std::max(res.y, res.z)) <= 1) {
+      break;
+    }
+    m_levels.push_back(downsample(*m_levels.back()));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T>
+void FieldStorage<Field_T>::prefilter(const VoxelVolume::InterpType type)
+{
+  if (m_prefiltered && type == m_prefilterType) {
+    return;
+  }
+  m_prefiltered = prefilterField(*m_levels[0], type);
+  m_prefilterType = type;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T>
+size_t FieldStorage<Field_T>::memSize() const
+{
+  size_t size = 0;
+  for (size_t i = 0, end = m_levels.size(); i < end; ++i) {
+    size += static_cast<size_t>(m_levels[i]->memSize());
+  }
+  if (m_prefiltered) {
+    size += static_cast<size_t>(m_prefiltered->memSize());
+  }
+  return size;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Ptr_T>
+boost::shared_ptr<VoxelStorage> makeStorage(const Ptr_T &field)
+{
+  typedef typename Ptr_T::element_type Field_T;
+  return boost::shared_ptr<VoxelStorage>(new FieldStorage<Field_T>(field));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Creates the storage for a field, converting it to the given format.
+template <typename Field_T>
+boost::shared_ptr<VoxelStorage> 
+makeStorage(const boost::intrusive_ptr<Field_T> &field, 
+            const VoxelVolume::StorageFormat format)
+{
+  typedef typename Field_T::value_type Data_T;
+
+  switch (format) {
+  case VoxelVolume::FloatStorage:
+    return makeStorage(convert<float>(*field));
+  case VoxelVolume::HalfStorage:
+    return makeStorage(convert<half>(*field));
+  case VoxelVolume::HalfVectorStorage:
+    return makeStorage(convert<Imath::Vec3<half> >(*field));
+  case VoxelVolume::Quantized8Storage:
+    return makeStorage(QuantizedBuffer8::Ptr
+                       (new QuantizedBuffer8(*toSparseScalar(*field))));
+  case VoxelVolume::Quantized16Storage:
+    return makeStorage(QuantizedBuffer16::Ptr
+                       (new QuantizedBuffer16(*toSparseScalar(*field))));
+  case VoxelVolume::BrickedStorage:
+    return makeStorage(typename BrickedBuffer<Data_T>::Ptr
+                       (new BrickedBuffer<Data_T>(*field)));
+  case VoxelVolume::CompressedStorage:
+    return makeStorage(typename CompressedBuffer<Data_T>::Ptr
+                       (new CompressedBuffer<Data_T>(*field)));
+  case VoxelVolume::NativeStorage:
+  default:
+    return makeStorage(field);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Creates the storage for any supported field type. Returns null if the
+//! field type isn't supported.
+boost::shared_ptr<VoxelStorage> 
+createStorage(FieldRes::Ptr field, const VoxelVolume::StorageFormat format)
+{
+  if (SparseBuffer::Ptr f = field_dynamic_cast<SparseBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (DenseBuffer::Ptr f = field_dynamic_cast<DenseBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (SparseScalarBuffer::Ptr f = 
+      field_dynamic_cast<SparseScalarBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (DenseScalarBuffer::Ptr f = field_dynamic_cast<DenseScalarBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (SparseHalfBuffer::Ptr f = field_dynamic_cast<SparseHalfBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (DenseHalfBuffer::Ptr f = field_dynamic_cast<DenseHalfBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (SparseHalfVectorBuffer::Ptr f = 
+      field_dynamic_cast<SparseHalfVectorBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  if (DenseHalfVectorBuffer::Ptr f = 
+      field_dynamic_cast<DenseHalfVectorBuffer>(field)) {
+    return makeStorage(f, format);
+  }
+  return boost::shared_ptr<VoxelStorage>();
+}
+
+//----------------------------------------------------------------------------//
+// VoxelVolume
+//----------------------------------------------------------------------------//
+
+VoxelVolume::VoxelVolume()
+  : m_storageMemory(Sys::Memory::VoxelBuffers), 
+    m_storageFormat(NativeStorage), m_interpType(LinearInterp), 
+    m_useEmptySpaceOptimization(true), m_emptySpaceThreshold(0.0f), 
+    m_useMipmaps(false), m_maxSpeed(0.0),
+    m_majorantCellSize(0), m_majorantState(1)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+Volume::AttrNameVec VoxelVolume::attributeNames() const
+{
+  return m_attrNames;
+}
+
+//----------------------------------------------------------------------------//
+
+VolumeSample VoxelVolume::sample(const VolumeSampleState &state,
+                                 const VolumeAttr &attribute) const
+{
+  Sys::Stats::add(Sys::Stats::VoxelVolumeSamples);
+
+  // Check (and set up) attribute index ---
+
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return VolumeSample(Colors::zero(), m_phaseFunction);
+  }
+
+  // Transform to voxel space for sampling ---
+  
+  Vector vsP;
+  worldToVoxel(advect(state.wsP, state.rayState.time), state.rayState.time, 
+               vsP);
+
+  if (!Math::isInBounds(vsP, m_dataWindow)) {
+    return VolumeSample(Colors::zero(), m_phaseFunction);
+  }
+
+  // Interpolate voxel value ---
+
+  const V3f value = 
+    bufferValue(m_attrBuffers[attribute.index()], state, vsP);
+
+  return VolumeSample(m_attrValues[attribute.index()] * value, 
+                      m_phaseFunction);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleBatch(const VolumeSampleStatePtrVec &states,
+                              const VolumeAttr &attribute,
+                              VolumeSampleVec &samples) const
+{
+  Sys::Stats::add(Sys::Stats::VoxelVolumeSamples, states.size());
+
+  samples.assign(states.size(), VolumeSample(Colors::zero(), m_phaseFunction));
+
+  // Check (and set up) attribute index once for the whole batch ---
+
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return;
+  }
+
+  const V3f    attrValue = m_attrValues[attribute.index()];
+  const size_t buffer    = m_attrBuffers[attribute.index()];
+
+  // Sample each point ---
+
+  std::vector<Vector> vsPs;
+  worldToVoxelBatch(states, vsPs);
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    if (Math::isInBounds(vsPs[i], m_dataWindow)) {
+      samples[i].value = attrValue * bufferValue(buffer, *states[i], vsPs[i]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleAttributes(const VolumeSampleState &state,
+                                   const VolumeAttr *const *attributes,
+                                   const size_t numAttrs,
+                                   VolumeSample *samples) const
+{
+  Sys::Stats::add(Sys::Stats::VoxelVolumeSamples);
+
+  // Skip the lookup if none of the attributes are present
+  bool isPresent = false;
+  for (size_t a = 0; a < numAttrs; ++a) {
+    samples[a] = VolumeSample(Colors::zero(), m_phaseFunction);
+    isPresent = isPresent || attributeScale(*attributes[a]) != V3f(0.0f);
+  }
+  if (!isPresent) {
+    return;
+  }
+
+  Vector vsP;
+  worldToVoxel(advect(state.wsP, state.rayState.time), state.rayState.time, 
+               vsP);
+
+  if (!Math::isInBounds(vsP, m_dataWindow)) {
+    return;
+  }
+
+  // Each buffer is interpolated the first time an attribute reads it
+  V3f  values[k_maxBuffers];
+  bool isSampled[k_maxBuffers] = { false };
+  for (size_t a = 0; a < numAttrs; ++a) {
+    const V3f scale = attributeScale(*attributes[a]);
+    if (scale == V3f(0.0f)) {
+      continue;
+    }
+    const size_t buffer = attributeBuffer(*attributes[a]);
+    if (!isSampled[buffer]) {
+      values[buffer]    = bufferValue(buffer, state, vsP);
+      isSampled[buffer] = true;
+    }
+    samples[a].value = scale * values[buffer];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleAttributesBatch(const VolumeSampleStatePtrVec &states,
+                                        const VolumeAttr *const *attributes,
+                                        const size_t numAttrs,
+                                        VolumeSampleVec *samples) const
+{
+  Sys::Stats::add(Sys::Stats::VoxelVolumeSamples, states.size());
+
+  std::vector<V3f>    scales(numAttrs);
+  std::vector<size_t> buffers(numAttrs);
+  bool                isPresent = false;
+  bool                isRead[k_maxBuffers] = { false };
+  for (size_t a = 0; a < numAttrs; ++a) {
+    samples[a].assign(states.size(), 
+                      VolumeSample(Colors::zero(), m_phaseFunction));
+    scales[a]  = attributeScale(*attributes[a]);
+    buffers[a] = attributeBuffer(*attributes[a]);
+    if (scales[a] != V3f(0.0f)) {
+      isPresent          = true;
+      isRead[buffers[a]] = true;
+    }
+  }
+  if (!isPresent) {
+    return;
+  }
+
+  std::vector<Vector> vsPs;
+  worldToVoxelBatch(states, vsPs);
+  V3f values[k_maxBuffers];
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    if (Math::isInBounds(vsPs[i], m_dataWindow)) {
+      for (size_t b = 0, numBuffers = m_attrStorage.size() + 1; 
+           b < numBuffers; ++b) {
+        if (isRead[b]) {
+          values[b] = bufferValue(b, *states[i], vsPs[i]);
+        }
+      }
+      for (size_t a = 0; a < numAttrs; ++a) {
+        if (isRead[buffers[a]]) {
+          samples[a][i].value = scales[a] * values[buffers[a]];
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color VoxelVolume::sampleSum(const VolumeSampleState &state,
+                             const VolumeAttr &first, 
+                             const VolumeAttr &second) const
+{
+  Sys::Stats::add(Sys::Stats::VoxelVolumeSamples);
+
+  const V3f firstScale  = attributeScale(first);
+  const V3f secondScale = attributeScale(second);
+  if (firstScale == V3f(0.0f) && secondScale == V3f(0.0f)) {
+    return Colors::zero();
+  }
+
+  Vector vsP;
+  worldToVoxel(advect(state.wsP, state.rayState.time), state.rayState.time, 
+               vsP);
+
+  if (!Math::isInBounds(vsP, m_dataWindow)) {
+    return Colors::zero();
+  }
+
+  const size_t firstBuffer  = attributeBuffer(first);
+  const size_t secondBuffer = attributeBuffer(second);
+  if (firstBuffer == secondBuffer) {
+    return (firstScale + secondScale) * bufferValue(firstBuffer, state, vsP);
+  }
+  return firstScale * bufferValue(firstBuffer, state, vsP) + 
+    secondScale * bufferValue(secondBuffer, state, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleSumBatch(const VolumeSampleStatePtrVec &states,
+                                 const VolumeAttr &first, 
+                                 const VolumeAttr &second,
+                                 ColorVec &result) const
+{
+  Sys::Stats::add(Sys::Stats::VoxelVolumeSamples, states.size());
+
+  result.assign(states.size(), Colors::zero());
+
+  const V3f firstScale  = attributeScale(first);
+  const V3f secondScale = attributeScale(second);
+  if (firstScale == V3f(0.0f) && secondScale == V3f(0.0f)) {
+    return;
+  }
+  const size_t firstBuffer  = attributeBuffer(first);
+  const size_t secondBuffer = attributeBuffer(second);
+
+  std::vector<Vector> vsPs;
+  worldToVoxelBatch(states, vsPs);
+  for (size_t i = 0, size = states.size(); i < size; ++i) {
+    if (!Math::isInBounds(vsPs[i], m_dataWindow)) {
+      continue;
+    }
+    if (firstBuffer == secondBuffer) {
+      result[i] = (firstScale + secondScale) * 
+        bufferValue(firstBuffer, *states[i], vsPs[i]);
+    } else {
+      result[i] = firstScale * bufferValue(firstBuffer, *states[i], vsPs[i]) +
+        secondScale * bufferValue(secondBuffer, *states[i], vsPs[i]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelVolume::majorant(const RayState &state, 
+                           const VolumeAttr &attribute,
+                           const double t0, const double t1,
+                           Color &result) const
+{
+  result = Colors::zero();
+
+  // Check (and set up) attribute index ---
+
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return true;
+  }
+
+  // The coarse level's majorant is added to the main buffer's
+  const size_t buffer = m_attrBuffers[attribute.index()];
+  if (buffer == 0 && m_coarse && 
+      !m_coarse->majorant(state, attribute, t0, t1, result)) {
+    return false;
+  }
+
+  // Build the majorant grid on first use ---
+
+  if (!m_majorantState.isReady(0)) {
+    m_majorantState.fill(0, boost::bind(&VoxelVolume::buildMajorantGrid, 
+                                        this));
+  }
+  if (m_majorants.empty()) {
+    return true;
+  }
+
+  // Find the voxel space bounds of the segment ---
+
+  Vector vsStart, vsEnd;
+  worldToVoxel(state.wsRay(t0), state.time, vsStart);
+  worldToVoxel(state.wsRay(t1), state.time, vsEnd);
+  Imath::Box3d vsBounds;
+  vsBounds.extendBy(vsStart);
+  vsBounds.extendBy(vsEnd);
+
+  const V3f maxValue = majorantInside(buffer, vsBounds);
+
+  result += m_attrValues[attribute.index()] * maxValue;
+  
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelVolume::boundsMajorant(const BBox &wsBounds, 
+                                 const VolumeAttr &attribute,
+                                 Color &result) const
+{
+  result = Colors::zero();
+
+  // Check (and set up) attribute index ---
+
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return true;
+  }
+
+  // The coarse level's majorant is added to the main buffer's
+  const size_t buffer = m_attrBuffers[attribute.index()];
+  if (buffer == 0 && m_coarse && 
+      !m_coarse->boundsMajorant(wsBounds, attribute, result)) {
+    return false;
+  }
+  if (!wsBounds.intersects(m_wsBounds)) {
+    return true;
+  }
+
+  // Build the majorant grid on first use ---
+
+  if (!m_majorantState.isReady(0)) {
+    m_majorantState.fill(0, boost::bind(&VoxelVolume::buildMajorantGrid, 
+                                        this));
+  }
+  if (m_majorants.empty()) {
+    return true;
+  }
+
+  // Find the voxel space bounds of the corners at each motion sample ---
+
+  const std::vector<Vector> wsCorners = Math::cornerPoints(wsBounds);
+  Imath::Box3d vsBounds;
+  for (size_t c = 0, numCorners = wsCorners.size(); c < numCorners; ++c) {
+    const Vector &wsP = wsCorners[c];
+    Vector        vsP;
+    if (m_worldToVoxel.numSamples() > 0) {
+      for (size_t i = 0, size = m_worldToVoxel.numSamples(); i < size; ++i) {
+        m_worldToVoxel.samples()[i].second.multVecMatrix(wsP, vsP);
+        vsBounds.extendBy(vsP);
+      }
+    } else {
+      m_mapping->worldToVoxel(wsP, vsP, 0.0f);
+      vsBounds.extendBy(vsP);
+      m_mapping->worldToVoxel(wsP, vsP, 1.0f);
+      vsBounds.extendBy(vsP);
+    }
+  }
+
+  result += m_attrValues[attribute.index()] * 
+    majorantInside(buffer, vsBounds);
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::majorantInside(const size_t buffer, 
+                                Imath::Box3d vsBounds) const
+{
+  // Lines are only straight in voxel space for uniform mappings
+  if (!field_dynamic_cast<MatrixFieldMapping>(m_mapping)) {
+    vsBounds.min -= Vector(m_majorantCellSize);
+    vsBounds.max += Vector(m_majorantCellSize);
+  }
+  // With render-time motion blur, lookups may read voxels up to the
+  // largest displacement away
+  const double wsDisplacement = wsMaxDisplacement();
+  if (wsDisplacement > 0.0) {
+    const V3i    dvsP        = contToDisc(vsBounds.center());
+    const Vector wsVoxelSize = 
+      m_mapping->wsVoxelSize(dvsP.x, dvsP.y, dvsP.z);
+    const Vector vsPadding(wsDisplacement / Math::min(wsVoxelSize) + 1.0);
+    vsBounds.min -= vsPadding;
+    vsBounds.max += vsPadding;
+  }
+
+  // Find the max of all majorant cells overlapping the bounds ---
+
+  const V3i dwMin = m_dataWindow.min;
+  const V3i cMin = Imath::clip(
+    (contToDisc(vsBounds.min) - dwMin) / m_majorantCellSize, 
+    Box3i(V3i(0), m_majorantRes - V3i(1)));
+  const V3i cMax = Imath::clip(
+    (contToDisc(vsBounds.max) - dwMin) / m_majorantCellSize, 
+    Box3i(V3i(0), m_majorantRes - V3i(1)));
+
+  const std::vector<V3f> &majorants = m_majorants[buffer];
+
+  V3f maxValue(0.0f);
+  for (int k = cMin.z; k <= cMax.z; ++k) {
+    for (int j = cMin.y; j <= cMax.y; ++j) {
+      for (int i = cMin.x; i <= cMax.x; ++i) {
+        const V3f &value = majorants[i + m_majorantRes.x * 
+                                     (j + m_majorantRes.y * k)];
+        maxValue.x = std::max(maxValue.x, value.x);
+        maxValue.y = std::max(maxValue.y, value.y);
+        maxValue.z = std::max(maxValue.z, value.z);
+      }
+    }
+  }
+
+  return maxValue;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::interpolate(const VoxelStorage &storage, 
+                             const Vector &vsP) const
+{
+  return storage.interpolate(0, m_interpType, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::interpolate(const VoxelStorage &storage,
+                             const VolumeSampleState &state,
+                             const Vector &vsP) const
+{
+  // Number of levels above the full resolution one
+  const size_t numLevels = storage.numLevels() - 1;
+  if (numLevels == 0) {
+    return interpolate(storage, vsP);
+  }
+
+  // The level of detail is the footprint's width in voxels, on a log2 
+  // scale. Preview renders look up coarser levels, reusing the full 
+  // resolution buffer's mip levels.
+  double       lod         = static_cast<double>(RenderGlobals::previewLevel());
+  const double wsFootprint = state.footprint();
+  if (wsFootprint > 0.0) {
+    const V3i    dvsP        = contToDisc(vsP);
+    const Vector wsVoxelSize = m_mapping->wsVoxelSize(dvsP.x, dvsP.y, dvsP.z);
+    lod += std::max(std::log(wsFootprint / Math::min(wsVoxelSize)) / 
+                    std::log(2.0), 0.0);
+  }
+  if (lod <= 0.0) {
+    return interpolate(storage, vsP);
+  }
+  
+  // Blend between the two nearest levels, so that level changes don't show
+  const size_t level   = std::min(static_cast<size_t>(lod), numLevels);
+  const double scale   = std::ldexp(1.0, -static_cast<int>(level));
+  const V3f    value   = storage.interpolate(level, m_interpType, 
+                                             vsP * scale);
+  const float  t       = static_cast<float>(lod - level);
+  if (level == numLevels || t <= 0.0f) {
+    return value;
+  }
+  const V3f    coarser = storage.interpolate(level + 1, m_interpType, 
+                                             vsP * (scale * 0.5));
+
+  return value * (1.0f - t) + coarser * t;
+}
+
+//----------------------------------------------------------------------------//
+
+BBox VoxelVolume::wsBounds() const
+{
+  const double wsDisplacement = wsMaxDisplacement();
+  if (wsDisplacement > 0.0 && !m_wsBounds.isEmpty()) {
+    return BBox(m_wsBounds.min - Vector(wsDisplacement), 
+                m_wsBounds.max + Vector(wsDisplacement));
+  }
+  return m_wsBounds;
 }
 
 //----------------------------------------------------------------------------//
 
 IntervalVec VoxelVolume::intersect(const RayState &state) const
 {
-  assert (m_intersectionHandler && "Missing intersection handler");
-  if (m_eso && m_useEmptySpaceOptimization) {
-    IntervalVec i = m_intersectionHandler->intersect(state.wsRay, state.time);
-    return m_eso->optimize(state, i);                   
-  } else {
-    return m_intersectionHandler->intersect(state.wsRay, state.time);
+  assert (m_intersectionHandler && "Missing intersection handler");
+  if (wsMaxDisplacement() > 0.0) {
+    // The buffer's blocks and mapping bounds are only valid at the start 
+    // of the shutter, so the padded bounds are used instead
+    IntervalVec result;
+    double t0, t1;
+    if (Math::intersect(state.wsRay, wsBounds(), t0, t1)) {
+      result.push_back(makeInterval(state.wsRay, t0, t1, m_mapping));
+    }
+    return result;
+  }
+  if (m_eso && m_useEmptySpaceOptimization) {
+    IntervalVec i = m_intersectionHandler->intersect(state.wsRay, state.time);
+    IntervalVec result = m_eso->optimize(state, i);
+    // The coarse level may be occupied where the buffer is empty
+    if (m_coarse) {
+      m_coarse->appendIntersections(state, result);
+    }
+    return result;
+  } else {
+    return m_intersectionHandler->intersect(state.wsRay, state.time);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::appendIntersections(const RayState &state,
+                                      IntervalVec &intervals) const
+{
+  assert (m_intersectionHandler && "Missing intersection handler");
+  if ((m_eso && m_useEmptySpaceOptimization) || wsMaxDisplacement() > 0.0) {
+    Volume::appendIntersections(state, intervals);
+  } else {
+    m_intersectionHandler->appendIntersections(state.wsRay, state.time, 
+                                               intervals);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Volume::StringVec VoxelVolume::info() const
+{
+  StringVec info;
+  for (size_t i = 0, size = m_attrNames.size(); i < size; ++i) {
+    info.push_back(m_attrNames[i] + " : " + str(m_attrValues[i]));
+  }
+  if (m_storage) {
+    info.push_back("Storage: " + m_storage->typeName() + ", " + 
+                   str(m_storage->memSize() / (1024.0 * 1024.0)) + " MB");
+  }
+  for (size_t b = 1, numBuffers = m_attrStorage.size() + 1; b < numBuffers; 
+       ++b) {
+    std::string names;
+    for (size_t i = 0, size = m_attrNames.size(); i < size; ++i) {
+      if (m_attrBuffers[i] == b) {
+        names += (names.empty() ? "" : ", ") + m_attrNames[i];
+      }
+    }
+    const VoxelStorage &storage = bufferStorage(b);
+    info.push_back("Attribute buffer (" + names + "): " + 
+                   storage.typeName() + ", " + 
+                   str(storage.memSize() / (1024.0 * 1024.0)) + " MB");
+  }
+  if (m_eso && m_useEmptySpaceOptimization) {
+    info.push_back("Empty space optimization: " + m_eso->typeName());
+  } else {
+    info.push_back("Empty space optimization disabled");
+  }
+  if (m_useMipmaps && m_storage) {
+    info.push_back("Mip levels: " + str(m_storage->numLevels() - 1));
+  }
+  if (m_velocity) {
+    info.push_back("Velocity: " + m_velocity->typeName() + 
+                   ", max speed " + str(m_maxSpeed));
+  }
+  if (m_coarse && m_coarse->m_storage) {
+    const V3i res = m_coarse->m_dataWindow.size() + V3i(1);
+    info.push_back("Coarse level: " + str(res) + ", " + 
+                   m_coarse->m_storage->typeName() + ", " +
+                   str(m_coarse->m_storage->memSize() / (1024.0 * 1024.0)) + 
+                   " MB");
+  }
+  return info;
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::load(const std::string &filename) 
+{
+  Log::print("Loading voxel buffer: " + filename);
+
+  Field3DInputFile in;
+  if (!in.open(filename)) {
+    Log::warning("Couldn't load " + filename);
+    return;
+  }
+
+  // Vector layers are preferred over scalar ones
+  FieldRes::Ptr field = firstField(in.readVectorLayers<float>());
+  if (!field) {
+    field = firstField(in.readVectorLayers<half>());
+  }
+  if (!field) {
+    field = firstField(in.readScalarLayers<float>());
+  }
+  if (!field) {
+    field = firstField(in.readScalarLayers<half>());
+  }
+  if (!field) {
+    Log::warning("No DenseField or SparseField of <float>, <half>, <V3f> or "
+                 "<V3h> could be loaded from " + filename);
+    return;
+  }
+
+  if (isSparse(field) && Sys::SparseCache::isEnabled()) {
+    if (m_storageFormat == NativeStorage) {
+      Log::print("  Paging SparseField blocks on demand");
+    } else {
+      Log::warning("Converting a paged SparseField loads all of its "
+                   "allocated blocks into memory: " + filename);
+    }
+  }
+
+  setField(field);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setBuffer(VoxelBuffer::Ptr buffer)
+{
+  setField(buffer);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setField(Field3D::FieldRes::Ptr field)
+{
+  Sys::Trace::Scope trace("VoxelVolume::setField", "volume");
+
+  if (!field) {
+    throw MissingBufferException();
+  }
+  boost::shared_ptr<VoxelStorage> storage = 
+    createStorage(field, m_storageFormat);
+  if (!storage) {
+    throw UnsupportedBufferException();
+  }
+  setStorage(storage);
+  // Native storage shares its full resolution buffer with whoever created 
+  // it, which may already be accounting for it
+  if (m_storageFormat == NativeStorage) {
+    m_storageMemory.track(field.get(), m_storage->memSize());
+  } else {
+    m_storageMemory.track(m_storage->memSize());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setCoarseBuffer(VoxelBuffer::Ptr buffer)
+{
+  if (!buffer) {
+    m_coarse.reset();
+    return;
+  }
+  // The coarse volume takes the current settings. The setters below keep
+  // it in sync with later changes.
+  VoxelVolume::Ptr coarse = create();
+  coarse->m_storageFormat             = m_storageFormat;
+  coarse->m_attrNames                 = m_attrNames;
+  coarse->m_attrValues                = m_attrValues;
+  coarse->m_attrBuffers.assign(m_attrNames.size(), 0);
+  coarse->m_interpType                = m_interpType;
+  coarse->m_useEmptySpaceOptimization = m_useEmptySpaceOptimization;
+  coarse->m_emptySpaceThreshold       = m_emptySpaceThreshold;
+  coarse->m_useMipmaps                = m_useMipmaps;
+  coarse->m_velocity                  = m_velocity;
+  coarse->m_velocityMapping           = m_velocityMapping;
+  coarse->m_maxSpeed                  = m_maxSpeed;
+  coarse->setBuffer(buffer);
+  m_coarse = coarse;
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setVelocityBuffer(VoxelBuffer::Ptr velocity)
+{
+  if (m_coarse) {
+    m_coarse->setVelocityBuffer(velocity);
+  }
+  m_velocity.reset();
+  m_velocityMapping.reset();
+  m_maxSpeed = 0.0;
+  if (!velocity) {
+    return;
+  }
+  m_velocity = createStorage(velocity, NativeStorage);
+  if (!m_velocity) {
+    throw UnsupportedBufferException();
+  }
+  m_velocityMapping = m_velocity->mapping();
+  for (VoxelBuffer::const_iterator i = velocity->cbegin(), 
+         end = velocity->cend(); i != end; ++i) {
+    m_maxSpeed = std::max(m_maxSpeed, static_cast<double>((*i).length()));
+  }
+  Log::print("VoxelVolume velocity buffer max speed: " + str(m_maxSpeed));
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::addAttribute(const std::string &attrName, 
+                               const Imath::V3f &value)
+{
+  m_attrNames.push_back(attrName);
+  m_attrValues.push_back(value);
+  m_attrBuffers.push_back(0);
+  if (m_coarse) {
+    m_coarse->addAttribute(attrName, value);
   }
 }
 
 //----------------------------------------------------------------------------//
 
-Volume::StringVec VoxelVolume::info() const
+void VoxelVolume::setInterpolation(const InterpType interpType)
 {
-  StringVec info;
-  for (size_t i = 0, size = m_attrNames.size(); i < size; ++i) {
-    info.push_back(m_attrNames[i] + " : " + str(m_attrValues[i]));
+  m_interpType = interpType;
+  if (m_storage) {
+    prefilter();
   }
-  if (m_eso && m_useEmptySpaceOptimization) {
-    info.push_back("Empty space optimization: " + m_eso->typeName());
-  } else {
-    info.push_back("Empty space optimization disabled");
+  if (m_coarse) {
+    m_coarse->setInterpolation(interpType);
   }
-  return info;
 }
 
 //----------------------------------------------------------------------------//
 
-void VoxelVolume::load(const std::string &filename) 
+void VoxelVolume::setUseEmptySpaceOptimization(const bool enabled)
 {
-  Log::print("Loading voxel buffer: " + filename);
+  m_useEmptySpaceOptimization = enabled;
+  if (m_coarse) {
+    m_coarse->setUseEmptySpaceOptimization(enabled);
+  }
+}
 
-  Field<Imath::V3f>::Vec buffers;
-  Field3DInputFile in;
-  if (!in.open(filename)) {
-    Log::warning("Couldn't load " + filename);
-    return;
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setEmptySpaceThreshold(const float threshold)
+{
+  m_emptySpaceThreshold = threshold;
+  if (m_storage) {
+    updateOptimizer();
   }
+  if (m_coarse) {
+    m_coarse->setEmptySpaceThreshold(threshold);
+  }
+}
 
-  buffers = in.readVectorLayers<float>();
-  if (buffers.size() == 0) {
-    Log::warning("No <float> fields could be loaded from " + filename);
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setUseMipmaps(const bool enabled)
+{
+  if (m_coarse) {
+    m_coarse->setUseMipmaps(enabled);
+  }
+  if (enabled == m_useMipmaps) {
     return;
   }
+  m_useMipmaps = enabled;
+  if (m_storage) {
+    buildMipLevels();
+  }
+}
 
-  DenseBuffer::Ptr denseBuffer = field_dynamic_cast<DenseBuffer>(buffers[0]);
-  if (denseBuffer) {
-    m_buffer = denseBuffer;
-  } else {
-    Log::warning("No DenseField in: " + filename);
+//----------------------------------------------------------------------------//
+
+Field3D::FieldRes::Ptr VoxelVolume::field() const
+{
+  return m_storage ? m_storage->field() : FieldRes::Ptr();
+}
+
+//----------------------------------------------------------------------------//
+
+Vector VoxelVolume::wsVoxelSize() const
+{
+  if (!m_mapping || m_dataWindow.isEmpty()) {
+    return Vector(0.0);
   }
-  
-  updateIntersectionHandler();
+  const V3i dvsP = (m_dataWindow.min + m_dataWindow.max) / 2;
+  return m_mapping->wsVoxelSize(dvsP.x, dvsP.y, dvsP.z);
 }
 
 //----------------------------------------------------------------------------//
 
-void VoxelVolume::setBuffer(VoxelBuffer::Ptr buffer)
+VoxelVolume::InterpType VoxelVolume::interpolation() const
 {
-  m_buffer = buffer;
-  updateIntersectionHandler();
-  SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer);
-  if (sparse) {
-    MatrixFieldMapping::Ptr mMapping = 
-      field_dynamic_cast<MatrixFieldMapping>(sparse->mapping());
-    FrustumFieldMapping::Ptr fMapping = 
-      field_dynamic_cast<FrustumFieldMapping>(sparse->mapping());
-    if (mMapping) {
-      m_eso = SparseUniformOptimizer::create(sparse, mMapping);
-    } else if (fMapping) {
-      m_eso = SparseFrustumOptimizer::create(sparse, fMapping);
-    } else {
-      Log::warning("VoxelVolume::setBuffer(): Unrecognized mapping type.");
+  return m_interpType;
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelVolume::hasVelocity() const
+{
+  return m_velocity.get() != NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelVolume::useMipmaps() const
+{
+  return m_useMipmaps;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::attributeValue(const std::string &attrName) const
+{
+  for (size_t i = 0, size = m_attrNames.size(); i < size; ++i) {
+    if (m_attrNames[i] == attrName) {
+      return m_attrValues[i];
     }
   }
+  return V3f(0.0f);
 }
 
 //----------------------------------------------------------------------------//
 
-void VoxelVolume::addAttribute(const std::string &attrName, 
-                               const Imath::V3f &value)
+size_t VoxelVolume::numBuffers() const
 {
-  m_attrNames.push_back(attrName);
-  m_attrValues.push_back(value);
+  return m_storage ? m_attrStorage.size() + 1 : 0;
 }
 
 //----------------------------------------------------------------------------//
 
-void VoxelVolume::setInterpolation(const InterpType interpType)
+void VoxelVolume::setStorageFormat(const StorageFormat format)
 {
-  m_interpType = interpType;
+  m_storageFormat = format;
 }
 
 //----------------------------------------------------------------------------//
 
-void VoxelVolume::setUseEmptySpaceOptimization(const bool enabled)
+void VoxelVolume::setStorage(boost::shared_ptr<VoxelStorage> storage)
 {
-  m_useEmptySpaceOptimization = enabled;
+  m_storage = storage;
+  m_mapping = storage->mapping();
+  m_dataWindow = storage->dataWindow();
+  clearAttrBuffers();
+  updateWorldToVoxel();
+  resetMajorants();
+  updateIntersectionHandler();
+  updateOptimizer();
+  buildMipLevels();
+  prefilter();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setAttributeBuffer(const std::string &attrName,
+                                     VoxelBuffer::Ptr buffer)
+{
+  const AttrNameVec::const_iterator name = 
+    std::find(m_attrNames.begin(), m_attrNames.end(), attrName);
+  if (name == m_attrNames.end()) {
+    throw MissingAttributeException(attrName);
+  }
+  const size_t attr = name - m_attrNames.begin();
+
+  if (!buffer) {
+    m_attrBuffers[attr] = 0;
+  } else {
+    if (!m_storage) {
+      throw MissingBufferException();
+    }
+    // Attributes given the same buffer share its storage
+    const std::vector<FieldRes::Ptr>::const_iterator field = 
+      std::find(m_attrFields.begin(), m_attrFields.end(), buffer);
+    if (field != m_attrFields.end()) {
+      m_attrBuffers[attr] = field - m_attrFields.begin() + 1;
+    } else {
+      if (m_attrStorage.size() + 1 >= k_maxBuffers) {
+        throw TooManyBuffersException();
+      }
+      boost::shared_ptr<VoxelStorage> storage = 
+        createStorage(buffer, m_storageFormat);
+      if (!storage) {
+        throw UnsupportedBufferException();
+      }
+      if (storage->dataWindow() != m_dataWindow || !storage->mapping() ||
+          !storage->mapping()->isIdentical(m_mapping)) {
+        throw MismatchedBufferException(attrName);
+      }
+      storage->buildMipLevels(m_useMipmaps);
+      storage->prefilter(m_interpType);
+      m_attrStorage.push_back(storage);
+      m_attrFields.push_back(buffer);
+      m_attrStorageMemory.push_back
+        (Sys::Memory::Tracker(Sys::Memory::VoxelBuffers));
+      // As in setField(), native storage may already be accounted for
+      if (m_storageFormat == NativeStorage) {
+        m_attrStorageMemory.back().track(buffer.get(), storage->memSize());
+      } else {
+        m_attrStorageMemory.back().track(storage->memSize());
+      }
+      m_attrBuffers[attr] = m_attrStorage.size();
+    }
+  }
+
+  pruneAttrBuffers();
+  resetMajorants();
+  updateOptimizer();
 }
 
 //----------------------------------------------------------------------------//
@@ -645,17 +3261,17 @@ void VoxelVolume::setUseEmptySpaceOptimization(const bool enabled)
 void VoxelVolume::updateIntersectionHandler()
 {
   // Error checks
-  if (!m_buffer) {
+  if (!m_storage) {
     throw MissingBufferException();
   }
-  if (!m_buffer->mapping()) {
+  if (!m_mapping) {
     throw MissingMappingException();
   }
   // Update intersection handler
   MatrixFieldMapping::Ptr matrixMapping = 
-    field_dynamic_cast<MatrixFieldMapping>(m_buffer->mapping());
+    field_dynamic_cast<MatrixFieldMapping>(m_mapping);
   FrustumFieldMapping::Ptr frustumMapping = 
-    field_dynamic_cast<FrustumFieldMapping>(m_buffer->mapping());
+    field_dynamic_cast<FrustumFieldMapping>(m_mapping);
   if (matrixMapping) {
     m_intersectionHandler.reset(new UniformMappingIntersection(matrixMapping));
   } else if (frustumMapping) {
@@ -670,11 +3286,371 @@ void VoxelVolume::updateIntersectionHandler()
   Vector wsP;
   for (std::vector<Vector>::iterator lsP = lsCorners.begin(), end = lsCorners.end(); 
        lsP != end; ++lsP) {
-    m_buffer->mapping()->localToWorld(*lsP, wsP);
+    m_mapping->localToWorld(*lsP, wsP);
     m_wsBounds.extendBy(wsP);
   }
 }
 
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateWorldToVoxel()
+{
+  m_worldToVoxel = Util::MatrixCurve();
+
+  MatrixFieldMapping::Ptr matrixMapping = 
+    field_dynamic_cast<MatrixFieldMapping>(m_mapping);
+  if (!matrixMapping) {
+    return;
+  }
+
+  // Voxel to local space is a scale and offset, shared by all motion samples
+  Vector origin, lsX, lsY, lsZ;
+  m_mapping->voxelToLocal(Vector(0.0), origin);
+  m_mapping->voxelToLocal(Vector(1.0, 0.0, 0.0), lsX);
+  m_mapping->voxelToLocal(Vector(0.0, 1.0, 0.0), lsY);
+  m_mapping->voxelToLocal(Vector(0.0, 0.0, 1.0), lsZ);
+  Matrix vsToLs;
+  vsToLs.setScale(Vector(lsX.x - origin.x, lsY.y - origin.y, 
+                         lsZ.z - origin.z));
+  vsToLs[3][0] = origin.x;
+  vsToLs[3][1] = origin.y;
+  vsToLs[3][2] = origin.z;
+
+  const MatrixFieldMapping::MatrixCurve::SampleVec &samples = 
+    matrixMapping->localToWorldSamples();
+  for (size_t i = 0, size = samples.size(); i < size; ++i) {
+    const Matrix vsToWs = vsToLs * samples[i].second;
+    m_worldToVoxel.addSample(samples[i].first, vsToWs.inverse());
+  }
+
+  // Single precision transform of non-moving mappings
+  if (samples.size() == 1) {
+    const Matrix &wsToVs = m_worldToVoxel.samples().front().second;
+    m_vsOrigin = (Vector(m_dataWindow.min) + Vector(m_dataWindow.max) + 
+                  Vector(1.0)) * 0.5;
+    wsToVs.inverse().multVecMatrix(m_vsOrigin, m_wsOrigin);
+    m_originToVoxel = Imath::M44f(wsToVs);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Vector VoxelVolume::advect(const Vector &wsP, const PTime time) const
+{
+  if (!m_velocity || time == 0.0f) {
+    return wsP;
+  }
+  Vector vsP;
+  m_velocityMapping->worldToVoxel(wsP, vsP);
+  if (!Math::isInBounds(vsP, m_velocity->dataWindow())) {
+    return wsP;
+  }
+  const V3f velocity = m_velocity->interpolate(0, LinearInterp, vsP);
+  return wsP - Vector(velocity) * (RenderGlobals::dt() * time);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::worldToVoxelBatch(const VolumeSampleStatePtrVec &states,
+                                    std::vector<Vector> &vsPs) const
+{
+  const size_t size = states.size();
+  vsPs.resize(size);
+
+  // Only frustum mappings without motion are worth fitting to, since 
+  // matrix mappings are already a single transform per point
+  bool isColumn = m_worldToVoxel.numSamples() == 0 && !m_velocity &&
+    size >= k_minColumnSamples;
+  for (size_t i = 1; isColumn && i < size; ++i) {
+    isColumn = &states[i]->rayState == &states[0]->rayState;
+  }
+
+  if (isColumn) {
+    // Transform the first, middle and last points
+    const RayState &rayState = states[0]->rayState;
+    const Ray      &wsRay    = rayState.wsRay;
+    const size_t    ends[3]  = { 0, size / 2, size - 1 };
+    const double    s0       = (states[0]->wsP - wsRay.pos).dot(wsRay.dir);
+    double          s[3], z[3], c[3];
+    Vector          vsEnds[3];
+    for (int e = 0; e < 3; ++e) {
+      const Vector &wsP = states[ends[e]]->wsP;
+      worldToVoxel(wsP, rayState.time, vsEnds[e]);
+      s[e] = (wsP - wsRay.pos).dot(wsRay.dir) - s0;
+      z[e] = vsEnds[e].z;
+    }
+    // A line whose points share x and y passes through the camera's eye, 
+    // so all of its points do
+    for (int e = 1; isColumn && e < 3; ++e) {
+      isColumn = 
+        std::abs(vsEnds[e].x - vsEnds[0].x) < k_columnTolerance &&
+        std::abs(vsEnds[e].y - vsEnds[0].y) < k_columnTolerance;
+    }
+    if (isColumn && fitColumnDepth(s, z, c)) {
+      for (size_t i = 0; i < size; ++i) {
+        const double si = (states[i]->wsP - wsRay.pos).dot(wsRay.dir) - s0;
+        vsPs[i] = Vector(vsEnds[0].x, vsEnds[0].y, 
+                         (c[0] * si + c[1]) / (c[2] * si + 1.0));
+      }
+      return;
+    }
+  }
+
+  for (size_t i = 0; i < size; ++i) {
+    const VolumeSampleState &state = *states[i];
+    worldToVoxel(advect(state.wsP, state.rayState.time), 
+                 state.rayState.time, vsPs[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+double VoxelVolume::wsMaxDisplacement() const
+{
+  return m_maxSpeed * RenderGlobals::dt();
+}
+
+//----------------------------------------------------------------------------//
+
+size_t VoxelVolume::attributeBuffer(const VolumeAttr &attribute) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return 0;
+  }
+  return m_attrBuffers[attribute.index()];
+}
+
+//----------------------------------------------------------------------------//
+
+const VoxelStorage& VoxelVolume::bufferStorage(const size_t buffer) const
+{
+  return buffer == 0 ? *m_storage : *m_attrStorage[buffer - 1];
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::bufferValue(const size_t buffer, 
+                             const VolumeSampleState &state,
+                             const Vector &vsP) const
+{
+  if (buffer > 0) {
+    return interpolate(*m_attrStorage[buffer - 1], state, vsP);
+  }
+  V3f value = interpolate(*m_storage, state, vsP);
+  if (m_coarse) {
+    value += m_coarse->voxelValue(state);
+  }
+  return value;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::attributeScale(const VolumeAttr &attribute) const
+{
+  if (attribute.index() == VolumeAttr::IndexNotSet) {
+    setIndexForName(attribute, m_attrNames);
+  }
+  if (attribute.index() == VolumeAttr::IndexInvalid) {
+    return V3f(0.0f);
+  }
+  return m_attrValues[attribute.index()];
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::voxelValue(const VolumeSampleState &state) const
+{
+  Vector vsP;
+  worldToVoxel(advect(state.wsP, state.rayState.time), state.rayState.time, 
+               vsP);
+  if (!Math::isInBounds(vsP, m_dataWindow)) {
+    return V3f(0.0f);
+  }
+  return interpolate(*m_storage, state, vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::clearAttrBuffers()
+{
+  m_attrBuffers.assign(m_attrNames.size(), 0);
+  m_attrStorage.clear();
+  m_attrFields.clear();
+  m_attrStorageMemory.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::pruneAttrBuffers()
+{
+  // Buffer b of the old list becomes remap[b] in the new one
+  const size_t        numBuffers = m_attrStorage.size() + 1;
+  std::vector<bool>   isRead(numBuffers, false);
+  std::vector<size_t> remap(numBuffers, 0);
+  BOOST_FOREACH (const size_t buffer, m_attrBuffers) {
+    isRead[buffer] = true;
+  }
+
+  std::vector<boost::shared_ptr<VoxelStorage> > storage;
+  std::vector<FieldRes::Ptr>                    fields;
+  std::vector<Sys::Memory::Tracker>             memory;
+  for (size_t b = 1; b < numBuffers; ++b) {
+    if (isRead[b]) {
+      storage.push_back(m_attrStorage[b - 1]);
+      fields.push_back(m_attrFields[b - 1]);
+      memory.push_back(m_attrStorageMemory[b - 1]);
+      remap[b] = storage.size();
+    }
+  }
+  if (storage.size() == m_attrStorage.size()) {
+    return;
+  }
+
+  BOOST_FOREACH (size_t &buffer, m_attrBuffers) {
+    buffer = remap[buffer];
+  }
+  m_attrStorage.swap(storage);
+  m_attrFields.swap(fields);
+  m_attrStorageMemory.swap(memory);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateOptimizer()
+{
+  m_eso.reset();
+  const SparseBlockMap *mainBlocks = m_storage->blocks();
+  if (!mainBlocks) {
+    return;
+  }
+  // A block is skipped only if it is empty in every buffer
+  SparseBlockMap blocks(*mainBlocks);
+  BOOST_FOREACH (const boost::shared_ptr<VoxelStorage> &storage, 
+                 m_attrStorage) {
+    const SparseBlockMap *attrBlocks = storage->blocks();
+    if (attrBlocks && !blocks.merge(*attrBlocks)) {
+      Log::warning("VoxelVolume attribute buffer doesn't share the block "
+                   "layout of the buffer. Empty space optimization is "
+                   "disabled.");
+      return;
+    }
+  }
+  blocks.setThreshold(m_emptySpaceThreshold);
+  m_eso = createOptimizer(blocks);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::resetMajorants()
+{
+  m_majorants.clear();
+  m_majorantState = Sys::LazyFillState(1);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::buildMipLevels()
+{
+  m_storage->buildMipLevels(m_useMipmaps);
+  m_storageMemory.update(m_storage->memSize());
+  for (size_t i = 0, size = m_attrStorage.size(); i < size; ++i) {
+    m_attrStorage[i]->buildMipLevels(m_useMipmaps);
+    m_attrStorageMemory[i].update(m_attrStorage[i]->memSize());
+  }
+  if (m_useMipmaps) {
+    Log::print("VoxelVolume built " + str(m_storage->numLevels() - 1) + 
+               " mip levels");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::prefilter()
+{
+  Sys::Trace::Scope trace("VoxelVolume::prefilter", "volume");
+  Timer timer;
+  m_storage->prefilter(m_interpType);
+  m_storageMemory.update(m_storage->memSize());
+  for (size_t i = 0, size = m_attrStorage.size(); i < size; ++i) {
+    m_attrStorage[i]->prefilter(m_interpType);
+    m_attrStorageMemory[i].update(m_attrStorage[i]->memSize());
+  }
+  if (m_storage->isPrefiltered()) {
+    Log::print("VoxelVolume prefiltered the buffer in " + 
+               str(timer.elapsed()) + " seconds");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::buildMajorantGrid() const
+{
+  m_majorants.clear();
+
+  if (!m_storage || m_dataWindow.isEmpty()) {
+    return;
+  }
+
+  // All buffers use the cell size of the main buffer, since they share 
+  // the data window
+  const Box3i &dw = m_dataWindow;
+  const int cellSize = m_storage->majorantCellSize();
+  const V3i res = (dw.size() + V3i(cellSize)) / cellSize;
+
+  Log::print("VoxelVolume building majorant grid: " + str(res));
+
+  std::vector<std::vector<V3f> > majorants(m_attrStorage.size() + 1);
+  std::vector<V3f>               cellMaxima(res.x * res.y * res.z);
+  for (size_t b = 0, numBuffers = majorants.size(); b < numBuffers; ++b) {
+    const VoxelStorage &storage = bufferStorage(b);
+
+    // Find the maximum of each cell
+
+    for (int k = 0; k < res.z; ++k) {
+      for (int j = 0; j < res.y; ++j) {
+        for (int i = 0; i < res.x; ++i) {
+          cellMaxima[i + res.x * (j + res.y * k)] = 
+            storage.majorantCellMax(V3i(i, j, k), cellSize);
+        }
+      }
+    }
+
+    // Dilate by one cell, since interpolation near a cell's edge reads 
+    // voxels in the neighboring cells.
+
+    std::vector<V3f> &grid = majorants[b];
+    grid.resize(cellMaxima.size());
+    for (int k = 0; k < res.z; ++k) {
+      for (int j = 0; j < res.y; ++j) {
+        for (int i = 0; i < res.x; ++i) {
+          V3f value(0.0f);
+          for (int kk = std::max(k - 1, 0); kk <= std::min(k + 1, res.z - 1);
+               ++kk) {
+            for (int jj = std::max(j - 1, 0); 
+                 jj <= std::min(j + 1, res.y - 1); ++jj) {
+              for (int ii = std::max(i - 1, 0); 
+                   ii <= std::min(i + 1, res.x - 1); ++ii) {
+                const V3f &cell = cellMaxima[ii + res.x * (jj + res.y * kk)];
+                value.x = std::max(value.x, cell.x);
+                value.y = std::max(value.y, cell.y);
+                value.z = std::max(value.z, cell.z);
+              }
+            }
+          }
+          grid[i + res.x * (j + res.y * k)] = value;
+        }
+      }
+    }
+  }
+
+  m_majorants.swap(majorants);
+  m_majorantRes = res;
+  m_majorantCellSize = cellSize;
+}
+
 //----------------------------------------------------------------------------//
 // Utility functions
 //----------------------------------------------------------------------------//
@@ -694,6 +3670,33 @@ Interval makeInterval(const Ray &wsRay, const double t0, const double t1,
 
 //----------------------------------------------------------------------------//
 
+void appendFrustumIntervals(const Ray &wsRay, const double t0, const double t1,
+                            Field3D::FieldMapping::Ptr mapping,
+                            IntervalVec &intervals)
+{
+  // The average step length is short enough to measure the local voxel 
+  // size by
+  const Interval whole = makeInterval(wsRay, t0, t1, mapping);
+  const double   dt    = whole.stepLength;
+  if (!(dt > 0.0 && dt < t1 - t0)) {
+    intervals.push_back(whole);
+    return;
+  }
+  for (double start = t0; start < t1; ) {
+    Vector vsA, vsB;
+    mapping->worldToVoxel(wsRay(start), vsA);
+    mapping->worldToVoxel(wsRay(start + dt), vsB);
+    const double localStep = dt / std::max((vsB - vsA).length(), 1e-6);
+    const double length = localStep * k_voxelsPerFrustumInterval;
+    // Don't leave a short remainder
+    const double end = t1 - start < length * 1.5 ? t1 : start + length;
+    intervals.push_back(makeInterval(wsRay, start, end, mapping));
+    start = end;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
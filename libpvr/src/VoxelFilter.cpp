@@ -0,0 +1,475 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file VoxelFilter.cpp
+  Contains implementations of the voxel buffer filters.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/VoxelFilter.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Library includes
+
+#include <boost/bind.hpp>
+
+#include <OpenEXR/ImathFun.h>
+
+// Project includes
+
+#include "pvr/Filter.h"
+#include "pvr/Log.h"
+#include "pvr/Threading.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  using Field3D::Box3i;
+  using Imath::V3f;
+  using Imath::V3i;
+
+  //--------------------------------------------------------------------------//
+
+  //! How a pass combines the taps of an output voxel
+  enum Reduction {
+    WeightedSum,
+    Maximum
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! An input voxel that contributes to an output voxel
+  struct Tap
+  {
+    Tap(const int i, const float w)
+      : index(i), weight(w)
+    { }
+    int   index;
+    float weight;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Filters a buffer along one axis. Every other axis keeps its extents
+  //! and data window.
+  struct AxisPass
+  {
+    AxisPass(const int a, const Reduction r)
+      : axis(a), reduction(r)
+    { }
+    int       axis;
+    Reduction reduction;
+    //! Extents and data window of the output, along the axis
+    int       extMin, extMax;
+    int       dwMin, dwMax;
+    //! Taps of each output voxel in the data window, starting at dwMin.
+    //! Tap indices are inside the input's data window.
+    std::vector<std::vector<Tap> > taps;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Normalizes the weights of the taps, dropping the ones that are zero
+  void normalize(std::vector<Tap> &taps)
+  {
+    std::vector<Tap> result;
+    float sum = 0.0f;
+    for (size_t i = 0, size = taps.size(); i < size; ++i) {
+      if (taps[i].weight != 0.0f) {
+        result.push_back(taps[i]);
+        sum += taps[i].weight;
+      }
+    }
+    for (size_t i = 0, size = result.size(); i < size; ++i) {
+      result[i].weight /= sum;
+    }
+    taps.swap(result);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Keeps the resolution, with each output voxel a blend of its
+  //! neighbors within radius voxels
+  AxisPass blurPass(const VoxelBuffer &buffer, const int axis,
+                    const float radius)
+  {
+    const Box3i &ext = buffer.extents();
+    const Box3i &dw  = buffer.dataWindow();
+    const int    reach = static_cast<int>(std::ceil(radius));
+    // Filter::Gaussian reaches zero at a distance of two
+    const float  scale = 2.0f / radius;
+    const Filter::Gaussian filter;
+
+    AxisPass pass(axis, WeightedSum);
+    pass.extMin = ext.min[axis];
+    pass.extMax = ext.max[axis];
+    pass.dwMin  = dw.min[axis];
+    pass.dwMax  = dw.max[axis];
+    for (int i = pass.dwMin; i <= pass.dwMax; ++i) {
+      std::vector<Tap> taps;
+      for (int offset = -reach; offset <= reach; ++offset) {
+        const int index = Imath::clamp(i + offset, pass.dwMin, pass.dwMax);
+        taps.push_back(Tap(index, filter(offset * scale)));
+      }
+      normalize(taps);
+      pass.taps.push_back(taps);
+    }
+    return pass;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Changes the resolution to res, keeping the buffer's local space
+  AxisPass resamplePass(const VoxelBuffer &buffer, const int axis,
+                        const int res)
+  {
+    const Box3i &ext    = buffer.extents();
+    const Box3i &dw     = buffer.dataWindow();
+    const int    inRes  = ext.max[axis] - ext.min[axis] + 1;
+    const double ratio  = static_cast<double>(inRes) / res;
+    // Widen the filter when the output voxels are larger, so that each of
+    // them covers at least the input voxels it overlaps
+    const double width  = std::max(ratio, 1.0);
+    const Filter::MitchellNetravali filter;
+
+    AxisPass pass(axis, WeightedSum);
+    pass.extMin = 0;
+    pass.extMax = res - 1;
+    // Output voxels whose centers are inside the input's data window
+    pass.dwMin = std::max(static_cast<int>
+                          (std::ceil((dw.min[axis] - ext.min[axis]) / ratio -
+                                     0.5)), 0);
+    pass.dwMax = std::min(static_cast<int>
+                          (std::floor((dw.max[axis] + 1 - ext.min[axis]) /
+                                      ratio - 0.5)), res - 1);
+    pass.dwMax = std::max(pass.dwMax, pass.dwMin);
+    for (int i = pass.dwMin; i <= pass.dwMax; ++i) {
+      // Position of the output voxel center in input discrete space
+      const double p     = ext.min[axis] + (i + 0.5) * ratio - 0.5;
+      const int    first = static_cast<int>(std::ceil(p - 2.0 * width));
+      const int    last  = static_cast<int>(std::floor(p + 2.0 * width));
+      std::vector<Tap> taps;
+      for (int j = first; j <= last; ++j) {
+        const int index = Imath::clamp(j, dw.min[axis], dw.max[axis]);
+        taps.push_back(Tap(index, filter(static_cast<float>((j - p) /
+                                                            width))));
+      }
+      normalize(taps);
+      pass.taps.push_back(taps);
+    }
+    return pass;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Divides the resolution by factor, rounding up, and keeps the maximum
+  //! of the input voxels that each output voxel overlaps in local space
+  AxisPass maxDownsamplePass(const VoxelBuffer &buffer, const int axis,
+                             const int factor)
+  {
+    const Box3i &ext   = buffer.extents();
+    const Box3i &dw    = buffer.dataWindow();
+    const int    inRes = ext.max[axis] - ext.min[axis] + 1;
+    const int    res   = (inRes + factor - 1) / factor;
+
+    AxisPass pass(axis, Maximum);
+    pass.extMin = 0;
+    pass.extMax = res - 1;
+    // Input voxel i overlaps output voxels floor(i * res / inRes) through
+    // floor(((i + 1) * res - 1) / inRes)
+    const long lRes = res, lInRes = inRes;
+    pass.dwMin = static_cast<int>((dw.min[axis] - ext.min[axis]) * lRes /
+                                  lInRes);
+    pass.dwMax = static_cast<int>(((dw.max[axis] - ext.min[axis] + 1) *
+                                   lRes - 1) / lInRes);
+    for (int i = pass.dwMin; i <= pass.dwMax; ++i) {
+      const int first = ext.min[axis] + static_cast<int>(i * lInRes / lRes);
+      const int last  = ext.min[axis] +
+        static_cast<int>(((i + 1) * lInRes - 1) / lRes);
+      std::vector<Tap> taps;
+      for (int j = std::max(first, dw.min[axis]);
+           j <= std::min(last, dw.max[axis]); ++j) {
+        taps.push_back(Tap(j, 1.0f));
+      }
+      pass.taps.push_back(taps);
+    }
+    return pass;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes output voxel c
+  template <typename Field_T>
+  V3f filterVoxel(const Field_T &in, const AxisPass &pass, const V3i &c)
+  {
+    const std::vector<Tap> &taps = pass.taps[c[pass.axis] - pass.dwMin];
+    V3i p(c);
+    if (pass.reduction == Maximum) {
+      V3f result(-std::numeric_limits<float>::max());
+      for (size_t i = 0, size = taps.size(); i < size; ++i) {
+        p[pass.axis] = taps[i].index;
+        const V3f &value = in.fastValue(p.x, p.y, p.z);
+        result.x = std::max(result.x, value.x);
+        result.y = std::max(result.y, value.y);
+        result.z = std::max(result.z, value.z);
+      }
+      return result;
+    }
+    V3f result(0.0f);
+    for (size_t i = 0, size = taps.size(); i < size; ++i) {
+      p[pass.axis] = taps[i].index;
+      result += taps[i].weight * in.fastValue(p.x, p.y, p.z);
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes z slices [begin, end) of the output's data window
+  void filterSlices(const DenseBuffer &in, DenseBuffer &out,
+                    const AxisPass &pass, const size_t begin,
+                    const size_t end)
+  {
+    const Box3i &dw = out.dataWindow();
+    for (int k = dw.min.z + static_cast<int>(begin),
+           kEnd = dw.min.z + static_cast<int>(end); k < kEnd; ++k) {
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        for (int i = dw.min.x; i <= dw.max.x; ++i) {
+          out.fastLValue(i, j, k) = filterVoxel(in, pass, V3i(i, j, k));
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes rows [begin, end) of blocks of the output. Blocks whose taps
+  //! only read unallocated input blocks of one empty value are left
+  //! unallocated, with that empty value.
+  void filterBlocks(const SparseBuffer &in, SparseBuffer &out,
+                    const AxisPass &pass, const size_t begin,
+                    const size_t end)
+  {
+    const int    axis      = pass.axis;
+    const Box3i &inDw      = in.dataWindow();
+    const Box3i &dw        = out.dataWindow();
+    const V3i    blockRes  = out.blockRes();
+    const int    blockSize = out.blockSize();
+
+    for (int bk = static_cast<int>(begin); bk < static_cast<int>(end); ++bk) {
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi) {
+          const V3i block(bi, bj, bk);
+          const V3i min = dw.min + block * blockSize;
+          const V3i max(std::min(min.x + blockSize - 1, dw.max.x),
+                    std::min(min.y + blockSize - 1, dw.max.y),
+                    std::min(min.z + blockSize - 1, dw.max.z));
+          // Input voxels that the block's taps read, along the axis
+          int first = std::numeric_limits<int>::max();
+          int last  = std::numeric_limits<int>::min();
+          for (int i = min[axis]; i <= max[axis]; ++i) {
+            const std::vector<Tap> &taps = pass.taps[i - pass.dwMin];
+            for (size_t t = 0, size = taps.size(); t < size; ++t) {
+              first = std::min(first, taps[t].index);
+              last  = std::max(last, taps[t].index);
+            }
+          }
+          // The other axes share the input's block grid
+          const int bFirst = (first - inDw.min[axis]) / blockSize;
+          const int bLast  = (last - inDw.min[axis]) / blockSize;
+          bool isConstant = true;
+          V3f  value(0.0f);
+          for (int b = bFirst; isConstant && b <= bLast; ++b) {
+            V3i inBlock(block);
+            inBlock[axis] = b;
+            const V3f empty =
+              in.getBlockEmptyValue(inBlock.x, inBlock.y, inBlock.z);
+            isConstant =
+              !in.blockIsAllocated(inBlock.x, inBlock.y, inBlock.z) &&
+              (b == bFirst || empty == value);
+            value = empty;
+          }
+          if (isConstant) {
+            out.setBlockEmptyValue(bi, bj, bk, value);
+            continue;
+          }
+          for (int k = min.z; k <= max.z; ++k) {
+            for (int j = min.y; j <= max.y; ++j) {
+              for (int i = min.x; i <= max.x; ++i) {
+                out.fastLValue(i, j, k) = filterVoxel(in, pass, V3i(i, j, k));
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs a pass on the buffer's data structure
+  VoxelBuffer::Ptr runPass(VoxelBuffer::Ptr buffer, const AxisPass &pass,
+                           const size_t numThreads)
+  {
+    using namespace Field3D;
+
+    Box3i ext = buffer->extents();
+    Box3i dw  = buffer->dataWindow();
+    ext.min[pass.axis] = pass.extMin;
+    ext.max[pass.axis] = pass.extMax;
+    dw.min[pass.axis]  = pass.dwMin;
+    dw.max[pass.axis]  = pass.dwMax;
+
+    Util::ProgressReporter progress(std::numeric_limits<float>::max());
+    const size_t threads = Sys::numWorkerThreads(numThreads);
+
+    VoxelBuffer::Ptr result;
+    if (SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer)) {
+      SparseBuffer::Ptr out(new SparseBuffer);
+      out->setBlockOrder(sparse->blockOrder());
+      out->setSize(ext, dw);
+      Sys::parallelFor(out->blockRes().z, 1,
+                       boost::bind(&filterBlocks, boost::cref(*sparse),
+                                   boost::ref(*out), boost::cref(pass),
+                                   _1, _2),
+                       threads, progress);
+      result = out;
+    } else if (DenseBuffer::Ptr dense =
+               field_dynamic_cast<DenseBuffer>(buffer)) {
+      DenseBuffer::Ptr out(new DenseBuffer);
+      out->setSize(ext, dw);
+      Sys::parallelFor(dw.max.z - dw.min.z + 1, 1,
+                       boost::bind(&filterSlices, boost::cref(*dense),
+                                   boost::ref(*out), boost::cref(pass),
+                                   _1, _2),
+                       threads, progress);
+      result = out;
+    } else {
+      throw UnsupportedFilterBufferException("");
+    }
+
+    result->setMapping(buffer->mapping());
+    result->name      = buffer->name;
+    result->attribute = buffer->attribute;
+    result->copyMetadata(*buffer);
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Model {
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+VoxelBuffer::Ptr gaussianBlur(VoxelBuffer::Ptr buffer, const float radius,
+                              const size_t numThreads)
+{
+  if (radius < 1.0f || buffer->dataWindow().isEmpty()) {
+    return buffer;
+  }
+  Timer timer;
+  VoxelBuffer::Ptr result = buffer;
+  for (int axis = 0; axis < 3; ++axis) {
+    result = runPass(result, blurPass(*result, axis, radius), numThreads);
+  }
+  Log::print("Blurred buffer by " + str(radius) + " voxels in " +
+             str(timer.elapsed()) + " seconds");
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+VoxelBuffer::Ptr resample(VoxelBuffer::Ptr buffer, const Imath::V3i &res,
+                          const size_t numThreads)
+{
+  if (res.x < 1 || res.y < 1 || res.z < 1) {
+    throw InvalidFilterArgumentException("resolution " + str(res));
+  }
+  if (buffer->dataWindow().isEmpty()) {
+    return buffer;
+  }
+  Timer timer;
+  VoxelBuffer::Ptr result = buffer;
+  for (int axis = 0; axis < 3; ++axis) {
+    result = runPass(result, resamplePass(*result, axis, res[axis]),
+                     numThreads);
+  }
+  Log::print("Resampled buffer to " + str(res) + " in " +
+             str(timer.elapsed()) + " seconds");
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+VoxelBuffer::Ptr maxDownsample(VoxelBuffer::Ptr buffer, const int factor,
+                               const size_t numThreads)
+{
+  if (factor < 1) {
+    throw InvalidFilterArgumentException("factor " + str(factor));
+  }
+  if (factor == 1 || buffer->dataWindow().isEmpty()) {
+    return buffer;
+  }
+  VoxelBuffer::Ptr result = buffer;
+  for (int axis = 0; axis < 3; ++axis) {
+    result = runPass(result, maxDownsamplePass(*result, axis, factor),
+                     numThreads);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Model
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
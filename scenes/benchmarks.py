@@ -0,0 +1,183 @@
+#! /usr/bin/env python
+
+import json, os, platform, subprocess, sys, time
+from optparse import OptionParser
+
+# Settings ------------
+
+# Scenes that exercise the modeling, rendering and occlusion hot paths
+scenes = [
+    "rasterization/pyroclastic_point",
+    "rendering/sparse_eso",
+    "precomp_occl/otf_tmap",
+    "precomp_occl/otf_voxel",
+    "precomp_occl/tmap",
+    "precomp_occl/voxel",
+    ]
+
+# Scenes that time themselves at increasing thread counts
+scalingScenes = [
+    "rendering/dense_scaling",
+    ]
+
+defaultBaseline = "benchmark_baseline.json"
+defaultBinary = os.path.join("..", "libpvr", "examples", "benchmarks", 
+                             "pvr_bench")
+
+# Functions ------------
+
+def getBinary():
+    if options.binary:
+        return options.binary
+    if os.environ.has_key("PVR_BENCH"):
+        return os.environ["PVR_BENCH"]
+    return defaultBinary
+
+def runMicro():
+    binary = getBinary()
+    if not os.path.exists(binary):
+        print "[ benchmarks ] WARNING: No micro-benchmark binary at", binary
+        return {}
+    print ""
+    print "[ benchmarks ] Running micro-benchmarks:", binary
+    print ""
+    output = subprocess.Popen([binary], stdout=subprocess.PIPE).communicate()[0]
+    return json.loads(output)
+
+def runScene(dir):
+    print ""
+    print "[ benchmarks ] Rendering", dir
+    print ""
+    if platform.system() == 'Windows':
+        cmd = "cd " + dir + " && render.py"
+    else:
+        cmd = "cd " + dir + "; ./render.py"
+    start = time.time()
+    result = os.system(cmd)
+    seconds = time.time() - start
+    if result != 0:
+        print "[ benchmarks ] ERROR: Failed to run", dir
+        return None
+    return { "seconds" : seconds }
+
+def runScaling(dir):
+    print ""
+    print "[ benchmarks ] Timing thread scaling of", dir
+    print ""
+    if platform.system() == 'Windows':
+        cmd = "cd " + dir + " && scaling.py"
+    else:
+        cmd = "cd " + dir + "; ./scaling.py"
+    if os.system(cmd) != 0:
+        print "[ benchmarks ] ERROR: Failed to run", dir
+        return None
+    return json.load(open(os.path.join(dir, "out", "scaling.json")))
+
+def compare(results, baseline, tolerance):
+    """Returns a list of (name, metric, baseline, current) for each value
+    that got slower than the tolerance allows."""
+    regressions = []
+    for group in ["micro", "scenes"]:
+        for name, current in results.get(group, {}).items():
+            reference = baseline.get(group, {}).get(name)
+            if not reference:
+                continue
+            # Lower is better for both of these
+            for metric in ["ns_per_op", "seconds"]:
+                if metric in current and metric in reference:
+                    if current[metric] > reference[metric] * (1.0 + tolerance):
+                        regressions.append((name, metric, reference[metric], 
+                                            current[metric]))
+    return regressions
+
+# Script ------------
+
+parser = OptionParser()
+parser.add_option("-b", "--binary", dest="binary", default=None,
+                  help="Path to the pvr_bench micro-benchmark binary")
+parser.add_option("-o", "--output", dest="output", default=None,
+                  help="File to write the JSON results to")
+parser.add_option("--baseline", dest="baseline", default=defaultBaseline,
+                  help="Baseline JSON file to compare against")
+parser.add_option("-u", "--update-baseline", dest="update", default=False,
+                  action="store_true", help="Store the results as baseline")
+parser.add_option("-t", "--tolerance", dest="tolerance", default=0.15,
+                  type="float", help="Allowed slowdown, as a fraction")
+parser.add_option("-m", "--micro-only", dest="microOnly", default=False,
+                  action="store_true", help="Skip the scene renders")
+parser.add_option("-s", "--scaling", dest="scaling", default=False,
+                  action="store_true", 
+                  help="Also time the scaling scenes at each thread count")
+parser.add_option("-p", "--pythonpath", dest="pythonpath", default=None,
+                  help="Directory to prepend to PYTHONPATH for the scenes")
+
+(options, args) = parser.parse_args()
+
+if options.pythonpath:
+    paths = [os.path.abspath(options.pythonpath)]
+    if os.environ.has_key("PYTHONPATH"):
+        paths.append(os.environ["PYTHONPATH"])
+    os.environ["PYTHONPATH"] = os.pathsep.join(paths)
+
+results = { "micro" : runMicro(), "scenes" : {} }
+failedScenes = []
+
+if not options.microOnly:
+    for dir in (args or scenes):
+        result = runScene(dir)
+        if result is None:
+            failedScenes.append(dir)
+        else:
+            results["scenes"][dir] = result
+
+if options.scaling:
+    results["scaling"] = {}
+    for dir in scalingScenes:
+        result = runScaling(dir)
+        if result is None:
+            failedScenes.append(dir)
+        else:
+            results["scaling"][dir] = result
+
+resultsJson = json.dumps(results, indent=2, sort_keys=True)
+
+if options.output:
+    open(options.output, "w").write(resultsJson + "\n")
+
+print ""
+print "########################"
+print " PVR BENCHMARK RESULTS "
+print "########################"
+print ""
+print resultsJson
+print ""
+
+if options.update:
+    open(options.baseline, "w").write(resultsJson + "\n")
+    print "Stored baseline in", options.baseline
+    sys.exit(0)
+
+status = 0
+
+for dir in failedScenes:
+    print "ERROR: Failed to run: " + dir
+    status = 1
+
+if os.path.exists(options.baseline):
+    baseline = json.load(open(options.baseline))
+    regressions = compare(results, baseline, options.tolerance)
+    for name, metric, reference, current in regressions:
+        print "REGRESSION: %s %s: %g -> %g (%+.1f%%)" % \
+            (name, metric, reference, current, 
+             (current / reference - 1.0) * 100.0)
+    if regressions:
+        status = 1
+    else:
+        print "No regressions against", options.baseline
+else:
+    print "No baseline found at", options.baseline, \
+        "- run with --update-baseline to store one"
+
+print ""
+
+sys.exit(status)
@@ -1,10 +1,16 @@
 #! /usr/bin/env python
 
-import os, platform, sys
+import json, os, platform, subprocess, sys, time
 from optparse import OptionParser
 
 # Settings ------------
 
+# Per-scene file holding the performance baseline
+perfBaselineName = "perf_baseline.json"
+# Per-scene file the render's statistics counters are appended to
+statsFileName = os.path.join("out", "stats.jsonl")
+defaultPerfOutput = "perf_results.json"
+
 # Exceptions ------------
 
 class TestFail(Exception):
@@ -54,10 +60,69 @@ def runTest(dir):
         if result != 0:
             raise TestFail(dir, "Bad return code")
 
+def runPerfTest(dir):
+    """Runs the test and returns its wall time, peak RSS in MB and the summed
+    statistics counters of its renders."""
+    print ""
+    print "[ regression_tests ] Running performance test in", dir
+    print ""
+    statsPath = os.path.join(dir, statsFileName)
+    if os.path.exists(statsPath):
+        os.remove(statsPath)
+    elif not os.path.isdir(os.path.dirname(statsPath)):
+        os.makedirs(os.path.dirname(statsPath))
+    env = dict(os.environ)
+    env["PVR_STATS_FILE"] = os.path.abspath(statsPath)
+    start = time.time()
+    if platform.system() == 'Windows':
+        process = subprocess.Popen("render.py", cwd = dir, env = env, 
+                                   shell = True)
+        result, peakRss = process.wait(), None
+    else:
+        process = subprocess.Popen("./render.py", cwd = dir, env = env)
+        pid, result, usage = os.wait4(process.pid, 0)
+        # ru_maxrss is in bytes on OSX and in kilobytes elsewhere
+        if platform.system() == 'Darwin':
+            peakRss = usage.ru_maxrss / (1024.0 * 1024.0)
+        else:
+            peakRss = usage.ru_maxrss / 1024.0
+    seconds = time.time() - start
+    if result != 0:
+        raise TestFail(dir, "Bad return code")
+    stats = {}
+    if os.path.exists(statsPath):
+        for line in open(statsPath):
+            for name, count in json.loads(line).items():
+                stats[name] = stats.get(name, 0) + count
+    return { "seconds" : seconds, "peak_rss_mb" : peakRss, "stats" : stats }
+
+def comparePerf(dir, current):
+    """Returns a list of (metric, baseline, current) for each value that is
+    outside its tolerance. Time and memory only count when they grow, while
+    a counter that changes either way means the scene does different work."""
+    path = os.path.join(dir, perfBaselineName)
+    if not os.path.exists(path):
+        return None
+    baseline = json.load(open(path))
+    regressions = []
+    for metric, tolerance in [("seconds", options.timeTolerance), 
+                              ("peak_rss_mb", options.rssTolerance)]:
+        reference = baseline.get(metric)
+        value = current.get(metric)
+        if reference and value and value > reference * (1.0 + tolerance):
+            regressions.append((metric, reference, value))
+    for name, reference in sorted(baseline.get("stats", {}).items()):
+        value = current["stats"].get(name, 0)
+        if abs(value - reference) > abs(reference) * options.statsTolerance:
+            regressions.append((name, reference, value))
+    return regressions
+
 def handleDir(arg, dir, files):
     if "render.py" in files:
         try:
-            if not options.compare:
+            if options.perf and not options.compare:
+                perfResults[dir] = runPerfTest(dir)
+            elif not options.compare:
                 runTest(dir)
             compareResults(dir)
         except TestFail as e:
@@ -70,10 +135,28 @@ def handleDir(arg, dir, files):
 
 failureDirs = []
 failedResults = []
+perfResults = {}
 
 parser = OptionParser()
 parser.add_option("-c", "--compare", dest="compare", default = False,
                   action = "store_true", help="Only compare files")
+parser.add_option("-p", "--perf", dest="perf", default = False,
+                  action = "store_true", 
+                  help="Record wall time, peak RSS and statistics counters, "
+                  "and compare them against each scene's " + perfBaselineName)
+parser.add_option("-o", "--perf-output", dest="perfOutput", 
+                  default = defaultPerfOutput,
+                  help="File to write the performance results to")
+parser.add_option("-u", "--update-perf-baseline", dest="updatePerf", 
+                  default = False, action = "store_true",
+                  help="Store the performance results as the new baselines")
+parser.add_option("--time-tolerance", dest="timeTolerance", default = 0.15,
+                  type = "float", help="Allowed slowdown, as a fraction")
+parser.add_option("--rss-tolerance", dest="rssTolerance", default = 0.10,
+                  type = "float", help="Allowed memory growth, as a fraction")
+parser.add_option("--stats-tolerance", dest="statsTolerance", 
+                  default = 0.02, type = "float", 
+                  help="Allowed change in statistics counters, as a fraction")
 
 (options, args) = parser.parse_args()
 
@@ -98,3 +181,38 @@ else:
         print "ERROR: Image difference: " + dir
 
 print ""
+
+if perfResults:
+    open(options.perfOutput, "w").write(
+        json.dumps(perfResults, indent = 2, sort_keys = True) + "\n")
+    print "Wrote performance results to", options.perfOutput
+    print ""
+    print "%-40s %10s %10s %12s  %s" % ("Scene", "Seconds", "RSS (MB)", 
+                                        "Steps", "Status")
+    perfFailures = 0
+    for dir in sorted(perfResults.keys()):
+        current = perfResults[dir]
+        if options.updatePerf:
+            open(os.path.join(dir, perfBaselineName), "w").write(
+                json.dumps(current, indent = 2, sort_keys = True) + "\n")
+            status = "baseline stored"
+        else:
+            regressions = comparePerf(dir, current)
+            if regressions is None:
+                status = "no baseline"
+            elif regressions:
+                perfFailures += 1
+                status = "REGRESSION: " + ", ".join(
+                    "%s %g -> %g" % r for r in regressions)
+            else:
+                status = "ok"
+        print "%-40s %10.2f %10s %12d  %s" % \
+            (dir, current["seconds"], 
+             "%.1f" % current["peak_rss_mb"] if current["peak_rss_mb"] 
+             else "-",
+             current["stats"].get("raymarch_steps", 0), status)
+    print ""
+    if perfFailures:
+        print "ERROR: Performance regressions in %d scene(s)" % perfFailures
+        print ""
+        sys.exit(1)
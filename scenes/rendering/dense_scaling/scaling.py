@@ -0,0 +1,127 @@
+#! /usr/bin/env python
+
+# ------------------------------------------------------------------------------
+# Times modeling and rendering of a large dense buffer at increasing thread 
+# counts. Writes the timings to out/scaling.json, for benchmarks.py --scaling.
+# ------------------------------------------------------------------------------
+
+# ------------------------------------------------------------------------------
+# Imports
+# ------------------------------------------------------------------------------
+
+import json
+import multiprocessing
+import os
+import time
+
+from pvr import *
+
+import pvr.cameras
+import pvr.lights
+import pvr.renderers
+
+# ------------------------------------------------------------------------------
+# Settings
+# ------------------------------------------------------------------------------
+
+reduceRes  =    2
+instanceMult =  0.1
+bufferRes =     V3i(1024 / reduceRes, 1024 / reduceRes, 1024 / reduceRes)
+
+primType = Prim.Inst.Surface
+
+primParams = {
+    # Base per-point
+    "N"                              : V3f(0.0, 1.0, 0.0),
+    "T"                              : V3f(1.0, 0.0, 0.0), 
+    "v"                              : V3f(0.0),
+    "density"                        : V3f(200.0) * (1.0 / instanceMult),
+    "thickness"                      : 0.1,
+    # Base per-prim
+    "instance_radius"                : 0.002, 
+    "num_points"                     : int(800000 * instanceMult), 
+    "fill"                           : 1, 
+    # Noise per-prim
+    "density_noise_scale"            : V3f(0.2, 0.2, 0.4),
+    "density_noise_fade"             : V3f(0.5, 0.5, 0.5),
+    "density_noise_octaves"          : 8.0,
+    "density_noise_octave_gain"      : 0.75, 
+    "density_noise_lacunarity"       : 1.92,
+    "density_noise"                  : 1,    # Turns on density noise
+    "displacement_noise"             : 0     # Turns on displacement noise
+}
+
+raymarcherParams = {
+    "use_volume_step_length" : 1,
+    "volume_step_length_multiplier" : 1.0, 
+    "do_early_termination" : 1,
+    "early_termination_threshold" : 0.01
+}
+
+# Thread counts to time, doubling up to the number of cores
+threadCounts = [1]
+while threadCounts[-1] * 2 <= multiprocessing.cpu_count():
+    threadCounts.append(threadCounts[-1] * 2)
+if threadCounts[-1] != multiprocessing.cpu_count():
+    threadCounts.append(multiprocessing.cpu_count())
+
+# ------------------------------------------------------------------------------
+# Functions
+# ------------------------------------------------------------------------------
+
+def model(camera, numThreads):
+    modeler = Modeler()
+    modeler.setMapping(Mapping.UniformMappingType)
+    modeler.setDataStructure(DataStructure.DenseBufferType)
+    modeler.setCamera(camera)
+    modeler.setNumThreads(numThreads)
+    input = ModelerInput()
+    prim  = primType()
+    prim.setParams(primParams)
+    input.setGeometry(Geometry.read("../../volumes/uniform_buffer/surface.bgeo"))
+    input.setVolumePrimitive(prim)
+    modeler.addInput(input)
+    modeler.updateBounds()
+    # Allocates and clears the buffer, on all threads
+    modeler.setResolution(bufferRes.x, bufferRes.y, bufferRes.z)
+    modeler.execute()
+    return modeler
+
+def render(camera, buffer, numThreads):
+    renderer = pvr.renderers.standard(raymarcherParams)
+    renderer.setNumThreads(numThreads)
+    renderer.setCamera(camera)
+    volume = VoxelVolume()
+    volume.setBuffer(buffer)
+    volume.addAttribute("scattering", V3f(1.0))
+    renderer.addVolume(volume)
+    for light in pvr.lights.standardThreePoint(renderer, 1.0 / reduceRes):
+        renderer.addLight(light)
+    renderer.execute()
+
+# ------------------------------------------------------------------------------
+# Script
+# ------------------------------------------------------------------------------
+
+camera = pvr.cameras.standard(1.0 / reduceRes)
+
+results = {}
+
+for numThreads in threadCounts:
+    start = time.time()
+    modeler = model(camera, numThreads)
+    modelSeconds = time.time() - start
+    start = time.time()
+    render(camera, modeler.buffer(), numThreads)
+    renderSeconds = time.time() - start
+    results[str(numThreads)] = { "model_seconds"  : modelSeconds, 
+                                 "render_seconds" : renderSeconds }
+    # Free the buffer before the next allocation
+    del modeler
+
+if not os.path.exists("out"):
+    os.mkdir("out")
+open(os.path.join("out", "scaling.json"), "w").write(
+    json.dumps(results, indent=2, sort_keys=True) + "\n")
+
+# ------------------------------------------------------------------------------
@@ -0,0 +1,288 @@
+#! /usr/bin/env python
+
+# ------------------------------------------------------------------------------
+# Builds synthetic scenes from parameters and times modeling and rendering of
+# them over a grid of thread counts and problem sizes. Reports voxels/s,
+# rays/s and peak memory for each combination, as a table and as JSON, so
+# that scaling curves can be compared between machines and builds.
+#
+# Example:
+#
+#   ./scaling_bench.py --points 1000000 --clustered --lines 1000 --lights 3 \
+#       --occluder OtfTransmittanceMapOccluder --res 256 --sparse \
+#       --sizes 0.25,0.5,1 --output scaling.json
+# ------------------------------------------------------------------------------
+
+# ------------------------------------------------------------------------------
+# Imports
+# ------------------------------------------------------------------------------
+
+import json
+import math
+import multiprocessing
+import random
+import resource
+import time
+from optparse import OptionParser
+
+from pvr import *
+
+import pvr.cameras
+import pvr.lights
+import pvr.renderers
+
+# ------------------------------------------------------------------------------
+# Settings
+# ------------------------------------------------------------------------------
+
+raymarcherParams = {
+    "use_volume_step_length" : 1,
+    "volume_step_length_multiplier" : 1.0,
+    "do_early_termination" : 1,
+    "early_termination_threshold" : 0.01
+}
+
+# Particles and lines fill a sphere of this radius around the origin, which
+# is what pvr.cameras.standard() looks at
+sceneRadius = 1.5
+
+# Number and size of the clusters that particles go into in clustered mode
+numClusters = 16
+clusterRadius = 0.15
+
+# ------------------------------------------------------------------------------
+# Functions
+# ------------------------------------------------------------------------------
+
+def defaultThreadCounts():
+    counts = [1]
+    while counts[-1] * 2 <= multiprocessing.cpu_count():
+        counts.append(counts[-1] * 2)
+    if counts[-1] != multiprocessing.cpu_count():
+        counts.append(multiprocessing.cpu_count())
+    return counts
+
+def parseList(s, type):
+    return [type(v) for v in s.split(",") if v]
+
+def randomInSphere(rng, radius):
+    while True:
+        p = V3f(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1))
+        if p.length() <= 1.0:
+            return p * radius
+
+def makeParticles(numPoints, clustered, seed):
+    rng = random.Random(seed)
+    centers = [randomInSphere(rng, sceneRadius - clusterRadius)
+               for i in range(numClusters)]
+    parts = Particles()
+    parts.resize(numPoints)
+    for i in range(numPoints):
+        if clustered:
+            p = centers[i % numClusters] + randomInSphere(rng, clusterRadius)
+        else:
+            p = randomInSphere(rng, sceneRadius)
+        parts.setPosition(i, p)
+    return parts
+
+def makeLines(numLines, seed, numVertices = 8):
+    rng = random.Random(seed)
+    lines = Polygons()
+    pointAttrs = lines.pointAttrs()
+    pRef = pointAttrs.vectorAttrRef("P")
+    for i in range(numLines):
+        lineIdx = lines.addPolygon(numVertices)
+        lines.setIsClosed(lineIdx, False)
+        start = randomInSphere(rng, sceneRadius * 0.8)
+        step = randomInSphere(rng, sceneRadius * 0.05)
+        for j in range(numVertices):
+            pIdx = lines.addPoint()
+            lines.setVertex(lineIdx, j, pIdx)
+            pointAttrs.setVectorAttr(pRef, pIdx, start + step * j)
+    return lines
+
+def makeLights(renderer, numLights, occluder, resMult):
+    """Spot lights on a ring above the scene, all aimed at the origin."""
+    lights = []
+    for i in range(numLights):
+        angle = 360.0 * i / max(numLights, 1)
+        dir = math.radians(angle)
+        parms = {
+            "position"  : V3f(10.0 * math.sin(dir), 7.0, 10.0 * math.cos(dir)),
+            "rotation"  : V3f(-35.0, angle, 0.0),
+            "fov"       : 30.0,
+            "intensity" : Color(1.0 / max(numLights, 1))
+            }
+        lights.append(pvr.lights.makeSpotLight(renderer, parms, resMult,
+                                               occluder))
+    return lights
+
+def model(camera, geo, numThreads):
+    modeler = Modeler()
+    modeler.setMapping(Mapping.UniformMappingType)
+    if options.sparse:
+        modeler.setDataStructure(DataStructure.SparseBufferType)
+        modeler.setSparseBlockSize(SparseBlockSize.Size16)
+    else:
+        modeler.setDataStructure(DataStructure.DenseBufferType)
+    modeler.setCamera(camera)
+    modeler.setNumThreads(numThreads)
+    if geo.particles():
+        prim = Prim.Rast.Point()
+        prim.setParams({ "density" : V3f(options.density),
+                         "radius" : options.radius, "antialiased" : 1 })
+        input = ModelerInput()
+        input.setGeometry(geo)
+        input.setVolumePrimitive(prim)
+        modeler.addInput(input)
+    if geo.polygons() and geo.polygons().size() > 0:
+        prim = Prim.Rast.Line()
+        prim.setParams({ "density" : V3f(options.density),
+                         "radius" : options.radius, "antialiased" : 1 })
+        input = ModelerInput()
+        input.setGeometry(geo)
+        input.setVolumePrimitive(prim)
+        modeler.addInput(input)
+    modeler.updateBounds()
+    modeler.setResolution(options.res)
+    modeler.execute()
+    return modeler
+
+def render(camera, buffer, numThreads):
+    renderer = pvr.renderers.standard(raymarcherParams)
+    renderer.setNumThreads(numThreads)
+    renderer.setCamera(camera)
+    volume = VoxelVolume()
+    volume.setBuffer(buffer)
+    volume.addAttribute("scattering", V3f(1.0))
+    renderer.addVolume(volume)
+    occluder = getattr(pvr, options.occluder)
+    for light in makeLights(renderer, options.lights, occluder,
+                            options.imageRes):
+        renderer.addLight(light)
+    renderer.execute()
+    return renderer
+
+def runCase(camera, size, numThreads):
+    numPoints = int(options.points * size)
+    numLines = int(options.lines * size)
+    geo = Geometry()
+    if numPoints > 0:
+        geo.setParticles(makeParticles(numPoints, options.clustered,
+                                       options.seed))
+    geo.setPolygons(makeLines(numLines, options.seed))
+    Memory.resetPeaks()
+    start = time.time()
+    modeler = model(camera, geo, numThreads)
+    modelSeconds = time.time() - start
+    buffer = modeler.buffer()
+    res = buffer.dataResolution()
+    numVoxels = float(res.x) * res.y * res.z
+    start = time.time()
+    renderer = render(camera, buffer, numThreads)
+    renderSeconds = time.time() - start
+    stats = renderer.statistics()
+    numRays = stats.get("full_raymarch_rays", 0) + \
+        stats.get("transmittance_only_rays", 0)
+    return {
+        "threads"         : numThreads,
+        "size"            : size,
+        "points"          : numPoints,
+        "lines"           : numLines,
+        "model_seconds"   : modelSeconds,
+        "render_seconds"  : renderSeconds,
+        "voxels_per_sec"  : numVoxels / max(modelSeconds, 1e-6),
+        "rays_per_sec"    : numRays / max(renderSeconds, 1e-6),
+        "peak_tracked_mb" : Memory.statistics()["total"][1] / 1048576.0,
+        # Process high-water mark, in KB on Linux. Only grows across cases.
+        "peak_rss_mb"     :
+            resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024.0,
+        }
+
+# ------------------------------------------------------------------------------
+# Script
+# ------------------------------------------------------------------------------
+
+parser = OptionParser()
+parser.add_option("--points", dest="points", default=100000, type="int",
+                  help="Number of particles at size 1")
+parser.add_option("--clustered", dest="clustered", default=False,
+                  action="store_true",
+                  help="Put the particles in clusters instead of uniformly")
+parser.add_option("--lines", dest="lines", default=0, type="int",
+                  help="Number of line polygons at size 1")
+parser.add_option("--lights", dest="lights", default=3, type="int",
+                  help="Number of spot lights")
+parser.add_option("--occluder", dest="occluder",
+                  default="OtfTransmittanceMapOccluder",
+                  help="Occluder class of the lights, e.g. RaymarchOccluder, "
+                  "VoxelOccluder, OtfVoxelOccluder, TransmittanceMapOccluder")
+parser.add_option("--res", dest="res", default=256, type="int",
+                  help="Buffer resolution along the longest edge")
+parser.add_option("--sparse", dest="sparse", default=False,
+                  action="store_true", help="Model into a sparse buffer")
+parser.add_option("--density", dest="density", default=10.0, type="float",
+                  help="Density of each particle and line")
+parser.add_option("--radius", dest="radius", default=0.02, type="float",
+                  help="Radius of each particle and line")
+parser.add_option("--image-res", dest="imageRes", default=0.25,
+                  type="float", help="Camera and light resolution multiplier")
+parser.add_option("--threads", dest="threads", default=None,
+                  help="Comma separated thread counts. Defaults to powers "
+                  "of two up to the number of cores")
+parser.add_option("--sizes", dest="sizes", default="1",
+                  help="Comma separated problem size multipliers, applied "
+                  "to --points and --lines")
+parser.add_option("--seed", dest="seed", default=1, type="int",
+                  help="Random seed of the generated geometry")
+parser.add_option("-o", "--output", dest="output", default=None,
+                  help="File to write the JSON results to")
+
+(options, args) = parser.parse_args()
+
+threadCounts = parseList(options.threads, int) if options.threads else \
+    defaultThreadCounts()
+sizes = parseList(options.sizes, float)
+
+camera = pvr.cameras.standard(options.imageRes)
+
+# Rays are counted by the statistics counters
+Stats.setEnabled(True)
+
+results = []
+for size in sizes:
+    for numThreads in threadCounts:
+        print ""
+        print "[ scaling_bench ] Size %g, %d thread(s)" % (size, numThreads)
+        print ""
+        results.append(runCase(camera, size, numThreads))
+
+settings = dict(vars(options))
+settings["threads"] = threadCounts
+settings["sizes"] = sizes
+
+if options.output:
+    open(options.output, "w").write(
+        json.dumps({ "settings" : settings, "results" : results },
+                   indent=2, sort_keys=True) + "\n")
+
+print ""
+print "########################"
+print " PVR SCALING RESULTS "
+print "########################"
+print ""
+print "%6s %8s %12s %12s %10s %10s %10s" % \
+    ("Size", "Threads", "Voxels/s", "Rays/s", "Speedup", "Mem (MB)",
+     "RSS (MB)")
+for r in results:
+    # Speedup against the lowest thread count of the same size
+    base = [b for b in results if b["size"] == r["size"]][0]
+    total = r["model_seconds"] + r["render_seconds"]
+    baseTotal = base["model_seconds"] + base["render_seconds"]
+    print "%6g %8d %12.4g %12.4g %9.2fx %10.1f %10.1f" % \
+        (r["size"], r["threads"], r["voxels_per_sec"], r["rays_per_sec"],
+         baseTotal / max(total, 1e-6), r["peak_tracked_mb"],
+         r["peak_rss_mb"])
+print ""
+
+# ------------------------------------------------------------------------------